@@ -56,6 +56,8 @@ class CircularQueue {
     using reference = T&;
     using iterator_category = std::random_access_iterator_tag;
 
+    // Required by some algorithms (e.g. std::inplace_merge()).
+    Iterator() = default;
     Iterator(CircularQueue* queue, uint64_t pos, uint32_t generation)
         : queue_(queue),
           pos_(pos)
@@ -162,11 +164,11 @@ class CircularQueue {
       PERFETTO_DCHECK(pos_ <= queue_->end_);
     }
 
-    CircularQueue* queue_;
-    uint64_t pos_;
+    CircularQueue* queue_ = nullptr;
+    uint64_t pos_ = 0;
 
 #if PERFETTO_DCHECK_IS_ON()
-    uint32_t generation_;
+    uint32_t generation_ = 0;
 #endif
   };
 
@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_EXT_BASE_FLAT_HASH_MAP_H_
+#define INCLUDE_PERFETTO_EXT_BASE_FLAT_HASH_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace perfetto {
+namespace base {
+
+// A hash map with open addressing and linear probing, storing its entries in
+// flat arrays. Compared to std::unordered_map there is no allocation per
+// entry and a lookup touches (usually) one cache line of tags plus the
+// matching key, which makes it much faster for the small keys used in the hot
+// paths of the trace importers.
+//
+// Differences with std::unordered_map:
+// - Pointers to the values (and iterators) are invalidated by Insert(),
+//   operator[] and Erase(): the arrays can be reallocated, and Erase() moves
+//   back the entries that follow the erased one in its probe sequence
+//   (backward shift deletion), so that erased slots are free right away and
+//   lookups never have to skip tombstones.
+// - Iteration order is unspecified and changes on rehash and erase.
+//
+// |Hasher| doesn't need to mix the bits of its result: identity hashes, like
+// the std::hash of integers, are fine as the hash is scrambled again here.
+//
+// On x86, lookups compare the tags of 16 consecutive slots at once with SSE2.
+// To make this possible without wrapping around, the tags of the first slots
+// are cloned after the last one.
+template <typename Key, typename Value, typename Hasher = std::hash<Key>>
+class FlatHashMap {
+ public:
+  class Iterator {
+   public:
+    explicit Iterator(FlatHashMap* map) : map_(map) { FindNextLiveSlot(); }
+
+    const Key& key() const { return *map_->key_at(idx_); }
+    Value& value() const { return *map_->value_at(idx_); }
+
+    explicit operator bool() const { return idx_ < map_->capacity_; }
+    Iterator& operator++() {
+      PERFETTO_DCHECK(idx_ < map_->capacity_);
+      idx_++;
+      FindNextLiveSlot();
+      return *this;
+    }
+
+   private:
+    void FindNextLiveSlot() {
+      while (idx_ < map_->capacity_ && map_->tags_[idx_] < kMinLiveTag)
+        idx_++;
+    }
+
+    FlatHashMap* map_ = nullptr;
+    size_t idx_ = 0;
+  };
+
+  FlatHashMap() = default;
+  ~FlatHashMap() { Clear(); }
+
+  FlatHashMap(FlatHashMap&& other) noexcept { *this = std::move(other); }
+  FlatHashMap& operator=(FlatHashMap&& other) noexcept {
+    if (this == &other)
+      return *this;
+    Clear();
+    tags_ = std::move(other.tags_);
+    keys_ = std::move(other.keys_);
+    values_ = std::move(other.values_);
+    capacity_ = other.capacity_;
+    size_ = other.size_;
+    other.capacity_ = other.size_ = 0;
+    return *this;
+  }
+
+  FlatHashMap(const FlatHashMap&) = delete;
+  FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+  // Inserts |key| with |value| if |key| is not in the map yet. Returns the
+  // value of |key| and whether it was inserted.
+  std::pair<Value*, bool> Insert(Key key, Value value) {
+    Value* existing = Find(key);
+    if (existing)
+      return std::make_pair(existing, false);
+
+    if ((size_ + 1) * kMaxLoadDen > capacity_ * kMaxLoadNum)
+      Rehash();
+
+    uint64_t hash = Hash(key);
+    size_t idx = static_cast<size_t>(hash) & (capacity_ - 1);
+    while (tags_[idx] != kFreeTag)
+      idx = (idx + 1) & (capacity_ - 1);
+    SetTag(idx, TagFor(hash));
+    new (key_at(idx)) Key(std::move(key));
+    new (value_at(idx)) Value(std::move(value));
+    size_++;
+    return std::make_pair(value_at(idx), true);
+  }
+
+  // Returns the value of |key|, or nullptr if |key| is not in the map.
+  Value* Find(const Key& key) const {
+    size_t idx = FindSlot(key);
+    return idx == kNotFound ? nullptr : value_at(idx);
+  }
+
+  // Removes |key| from the map. Returns false if it was not in the map.
+  bool Erase(const Key& key) {
+    size_t idx = FindSlot(key);
+    if (idx == kNotFound)
+      return false;
+    FreeSlot(idx);
+    size_--;
+
+    // Fill the hole with the next entry of the probe sequence that can be
+    // moved there, i.e. whose home slot isn't between the hole and itself,
+    // and repeat with the hole it leaves until a free slot is reached.
+    const size_t mask = capacity_ - 1;
+    size_t hole = idx;
+    for (size_t cur = (hole + 1) & mask; tags_[cur] != kFreeTag;
+         cur = (cur + 1) & mask) {
+      size_t home = static_cast<size_t>(Hash(*key_at(cur))) & mask;
+      if (((cur - home) & mask) < ((cur - hole) & mask))
+        continue;
+      new (key_at(hole)) Key(std::move(*key_at(cur)));
+      new (value_at(hole)) Value(std::move(*value_at(cur)));
+      SetTag(hole, tags_[cur]);
+      FreeSlot(cur);
+      hole = cur;
+    }
+    return true;
+  }
+
+  // Returns the value of |key|, inserting a default constructed one first if
+  // |key| is not in the map.
+  Value& operator[](Key key) {
+    Value* value = Find(key);
+    if (value)
+      return *value;
+    return *Insert(std::move(key), Value()).first;
+  }
+
+  void Clear() {
+    for (size_t i = 0; i < capacity_; ++i) {
+      if (tags_[i] < kMinLiveTag)
+        continue;
+      key_at(i)->~Key();
+      value_at(i)->~Value();
+    }
+    tags_.reset();
+    keys_.reset();
+    values_.reset();
+    capacity_ = size_ = 0;
+  }
+
+  Iterator GetIterator() { return Iterator(this); }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+
+ private:
+  using KeyStorage =
+      typename std::aligned_storage<sizeof(Key), alignof(Key)>::type;
+  using ValueStorage =
+      typename std::aligned_storage<sizeof(Value), alignof(Value)>::type;
+
+  // The |tags_| of free slots. Live slots have a tag >= kMinLiveTag derived
+  // from the hash of their key, so that most mismatching slots are skipped
+  // without comparing keys.
+  static constexpr uint8_t kFreeTag = 0;
+  static constexpr uint8_t kMinLiveTag = 1;
+
+  // The number of tags compared at once by FindSlot(), which is also the
+  // number of tags cloned at the end of |tags_|.
+  static constexpr size_t kGroupSize = 16;
+
+  static constexpr size_t kMinCapacity = kGroupSize;
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+  // The map is rehashed when more than 3/4 of the slots are live.
+  static constexpr size_t kMaxLoadNum = 3;
+  static constexpr size_t kMaxLoadDen = 4;
+
+  static uint64_t Hash(const Key& key) {
+    // Fibonacci hashing: spreads the bits of identity hashes (e.g. small
+    // integers) over the whole word.
+    uint64_t hash =
+        static_cast<uint64_t>(Hasher()(key)) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 32);
+  }
+
+  static uint8_t TagFor(uint64_t hash) {
+    auto tag = static_cast<uint8_t>(hash >> 56);
+    return tag < kMinLiveTag ? static_cast<uint8_t>(tag + kMinLiveTag) : tag;
+  }
+
+  size_t FindSlot(const Key& key) const {
+    if (size_ == 0)
+      return kNotFound;
+    uint64_t hash = Hash(key);
+    uint8_t tag = TagFor(hash);
+    const size_t mask = capacity_ - 1;
+#if defined(__SSE2__)
+    const __m128i tag_group = _mm_set1_epi8(static_cast<char>(tag));
+    const __m128i free_group = _mm_setzero_si128();
+    // Terminates as the load factor guarantees that there are free slots.
+    for (size_t idx = static_cast<size_t>(hash) & mask;;
+         idx = (idx + kGroupSize) & mask) {
+      __m128i group =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&tags_[idx]));
+      auto matches = static_cast<uint32_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(group, tag_group)));
+      auto frees = static_cast<uint32_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(group, free_group)));
+      // The probe sequence of |key| ends at the first free slot.
+      if (frees)
+        matches &= (frees & (~frees + 1)) - 1;
+      for (; matches; matches &= matches - 1) {
+        size_t offset = static_cast<size_t>(__builtin_ctz(matches));
+        size_t slot = (idx + offset) & mask;
+        if (*key_at(slot) == key)
+          return slot;
+      }
+      if (frees)
+        return kNotFound;
+    }
+#else
+    // Terminates as the load factor guarantees that there are free slots.
+    for (size_t idx = static_cast<size_t>(hash) & mask;;
+         idx = (idx + 1) & mask) {
+      if (tags_[idx] == kFreeTag)
+        return kNotFound;
+      if (tags_[idx] == tag && *key_at(idx) == key)
+        return idx;
+    }
+#endif
+  }
+
+  // Sets the tag of the slot |idx|, and its clone if it has one.
+  void SetTag(size_t idx, uint8_t tag) {
+    tags_[idx] = tag;
+    if (idx < kGroupSize)
+      tags_[capacity_ + idx] = tag;
+  }
+
+  void FreeSlot(size_t idx) {
+    key_at(idx)->~Key();
+    value_at(idx)->~Value();
+    SetTag(idx, kFreeTag);
+  }
+
+  // Moves the entries to new arrays, with at least twice the capacity needed
+  // for them.
+  void Rehash() {
+    size_t new_capacity = capacity_ ? capacity_ : kMinCapacity;
+    while ((size_ + 1) * 2 > new_capacity)
+      new_capacity *= 2;
+
+    FlatHashMap old = std::move(*this);
+    tags_.reset(new uint8_t[new_capacity + kGroupSize]());
+    keys_.reset(new KeyStorage[new_capacity]);
+    values_.reset(new ValueStorage[new_capacity]);
+    capacity_ = new_capacity;
+    for (size_t i = 0; i < old.capacity_; ++i) {
+      if (old.tags_[i] < kMinLiveTag)
+        continue;
+      uint64_t hash = Hash(*old.key_at(i));
+      size_t idx = static_cast<size_t>(hash) & (capacity_ - 1);
+      while (tags_[idx] != kFreeTag)
+        idx = (idx + 1) & (capacity_ - 1);
+      SetTag(idx, old.tags_[i]);
+      new (key_at(idx)) Key(std::move(*old.key_at(i)));
+      new (value_at(idx)) Value(std::move(*old.value_at(i)));
+      size_++;
+    }
+    // |old| destroys the moved-from entries.
+  }
+
+  Key* key_at(size_t idx) const {
+    return reinterpret_cast<Key*>(&keys_[idx]);
+  }
+  Value* value_at(size_t idx) const {
+    return reinterpret_cast<Value*>(&values_[idx]);
+  }
+
+  std::unique_ptr<uint8_t[]> tags_;  // |capacity_| + |kGroupSize| tags.
+  std::unique_ptr<KeyStorage[]> keys_;
+  std::unique_ptr<ValueStorage[]> values_;
+  size_t capacity_ = 0;  // Always a power of two (or 0).
+  size_t size_ = 0;
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_EXT_BASE_FLAT_HASH_MAP_H_
@@ -17,7 +17,6 @@
 #ifndef INCLUDE_PERFETTO_EXT_BASE_METATRACE_H_
 #define INCLUDE_PERFETTO_EXT_BASE_METATRACE_H_
 
-#include <array>
 #include <atomic>
 #include <functional>
 #include <string>
@@ -35,7 +34,8 @@
 //    and a single reader.
 //    The responsibility of this layer is to store events and counters as
 //    efficiently as possible without re-entering any tracing code.
-//    This is really a static-storage-based ring-buffer based on a POD array.
+//    This is really a ring-buffer based on a POD array, allocated when
+//    meta-tracing is enabled and never freed afterwards.
 //    This layer does NOT deal with serializing the meta-trace buffer.
 //    It posts a task when it's half full and expects something outside of
 //    base/ to drain the ring-buffer and serialize it, eventually writing it
@@ -66,15 +66,25 @@ extern std::atomic<uint32_t> g_enabled_tags;
 // in Record.
 extern std::atomic<uint64_t> g_enabled_timestamp;
 
+// Number of records of the ring buffer, unless otherwise specified in
+// Enable(). 64K * 16 bytes = 1MB.
+constexpr size_t kDefaultRingBufferCapacity = 64 * 1024;
+
 // Enables meta-tracing for one or more tags. Once enabled it will discard any
 // further Enable() calls and return false until disabled,
 // |read_task| is a closure that will be called enqueued |task_runner| when the
 // meta-tracing ring buffer is half full. The task is expected to read the ring
 // buffer using RingBuffer::GetReadIterator() and serialize the contents onto a
 // file or into the trace itself.
+// |capacity| is the number of records of the ring buffer and must be a power
+// of two. A larger ring buffer gives more time to |read_task| to drain it
+// before losing events when the |task_runner| is busy.
 // Must be called on the |task_runner| passed.
 // |task_runner| must have static lifetime.
-bool Enable(std::function<void()> read_task, base::TaskRunner*, uint32_t tags);
+bool Enable(std::function<void()> read_task,
+            base::TaskRunner*,
+            uint32_t tags,
+            size_t capacity = kDefaultRingBufferCapacity);
 
 // Disables meta-tracing.
 // Must be called on the same |task_runner| as Enable().
@@ -143,14 +153,15 @@ struct Record {
   };
 };
 
-// Hold the meta-tracing data into a statically allocated array.
+// Hold the meta-tracing data into an array allocated by Enable().
 // This class uses static storage (as opposite to being a singleton) to:
 // - Have the guarantee of always valid storage, so that meta-tracing can be
-//   safely used in any part of the codebase, including base/ itself.
+//   safely used in any part of the codebase, including base/ itself. The
+//   array is never freed: a writer that raced with Disable() might still be
+//   writing into it. A later Enable() reuses it if it's large enough.
 // - Avoid barriers that thread-safe static locals would require.
 class RingBuffer {
  public:
-  static constexpr size_t kCapacity = 4096;  // 4096 * 16 bytes = 64K.
 
   // This iterator is not idempotent and will bump the read index in the buffer
   // at the end of the reads. There can be only one reader at any time.
@@ -189,7 +200,7 @@ class RingBuffer {
       //   |rd_index_|.
       // - After terminating a read batch, the ~ReadIterator dtor updates the
       //   |rd_index_| with a release-store.
-      // - Reader and writer are typically kCapacity/2 apart. So unless an
+      // - Reader and writer are typically capacity()/2 apart. So unless an
       //   overrun happens a writer won't reuse a newly released record any time
       //   soon. If an overrun happens, everything is busted regardless.
       At(cur_)->type_and_id.store(0, std::memory_order_relaxed);
@@ -210,12 +221,14 @@ class RingBuffer {
   };
 
   static Record* At(uint64_t index) {
-    // Doesn't really have to be pow2, but if not the compiler will emit
-    // arithmetic operations to compute the modulo instead of a bitwise AND.
-    static_assert(!(kCapacity & (kCapacity - 1)), "kCapacity must be pow2");
     PERFETTO_DCHECK(index >= rd_index_);
     PERFETTO_DCHECK(index <= wr_index_);
-    return &records_[index % kCapacity];
+    // The acquire-load pairs with the release-store in Reset(), so that a
+    // larger capacity is never used with the smaller array it replaced.
+    size_t capacity = capacity_.load(std::memory_order_acquire);
+    Record* records = records_.load(std::memory_order_relaxed);
+    // The capacity is a power of two, see Reset().
+    return &records[index & (capacity - 1)];
   }
 
   // Must be called on the same task runner passed to Enable()
@@ -226,13 +239,15 @@ class RingBuffer {
   }
 
   static Record* AppendNewRecord();
-  static void Reset();
+  static void Reset(size_t capacity);
+
+  static size_t capacity() { return capacity_.load(std::memory_order_relaxed); }
 
   static bool has_overruns() {
     return has_overruns_.load(std::memory_order_acquire);
   }
 
-  // Can temporarily return a value >= kCapacity but is eventually consistent.
+  // Can temporarily return a value >= capacity() but is eventually consistent.
   // This would happen in case of overruns until threads hit the --wr_index_
   // in AppendNewRecord().
   static uint64_t GetSizeForTesting() {
@@ -249,7 +264,9 @@ class RingBuffer {
   // Used only for DCHECKs.
   static bool IsOnValidTaskRunner();
 
-  static std::array<Record, kCapacity> records_;
+  static std::atomic<Record*> records_;
+  static std::atomic<size_t> capacity_;
+  static size_t allocated_capacity_;  // Size of the |records_| array.
   static std::atomic<bool> read_task_queued_;
   static std::atomic<uint64_t> wr_index_;
   static std::atomic<uint64_t> rd_index_;
@@ -53,6 +53,12 @@ class PagedMemory {
     // reserved and the user should call EnsureCommitted() before writing to
     // memory addresses.
     kDontCommit = 1 << 1,
+
+    // Advises the kernel to back the memory with transparent huge pages, which
+    // reduces the TLB misses when copying or scanning large buffers. Only the
+    // 2MB-aligned parts of the region can be backed by huge pages. It is a
+    // hint: it is ignored if THP is disabled or not supported by the platform.
+    kHugePages = 1 << 2,
   };
 
   // Allocates |size| bytes using mmap(MAP_ANONYMOUS). The returned memory is
@@ -66,6 +72,13 @@ class PagedMemory {
   // if implemented.
   bool AdviseDontNeed(void* p, size_t size);
 
+  // Sets the NUMA memory policy of the whole region to prefer |node|: pages
+  // are allocated on that node when they are first touched, falling back on
+  // other nodes if it runs out of memory. It has no effect on the pages which
+  // were already touched, so it should be called straight after Allocate().
+  // Returns true if implemented and successful.
+  bool AdvisePreferredNumaNode(uint32_t node);
+
   // Ensures that at least the first |committed_size| bytes of the allocated
   // memory region are committed. The implementation may commit memory in larger
   // chunks above |committed_size|. Crashes if the memory couldn't be committed.
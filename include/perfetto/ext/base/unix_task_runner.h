@@ -25,13 +25,16 @@
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/thread_checker.h"
 
+#include <atomic>
 #include <chrono>
-#include <deque>
 #include <map>
 #include <mutex>
 #include <vector>
 
-#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <sys/epoll.h>
+#elif !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #include <poll.h>
 #endif
 
@@ -66,7 +69,8 @@ class UnixTaskRunner : public TaskRunner {
   void Quit();
 
   // Checks whether there are any pending immediate tasks to run. Note that
-  // delayed tasks don't count even if they are due to run.
+  // delayed tasks don't count even if they are due to run. Must be called on
+  // the task runner thread.
   bool IsIdleForTesting();
 
   // TaskRunner implementation:
@@ -82,11 +86,18 @@ class UnixTaskRunner : public TaskRunner {
   bool QuitCalled();
 
  private:
+  struct ImmediateTask {
+    std::atomic<ImmediateTask*> next{nullptr};
+    std::function<void()> callback;
+  };
+
   void WakeUp();
+  bool HasImmediateTasks() const;
+  std::function<void()> PopImmediateTask();
   void UpdateWatchTasksLocked();
   int GetDelayMsToNextTaskLocked() const;
   void RunImmediateAndDelayedTask();
-  void PostFileDescriptorWatches(uint64_t windows_wait_result);
+  void PostFileDescriptorWatches(uint64_t wait_result);
   void RunFileDescriptorWatch(PlatformHandle);
 
   ThreadChecker thread_checker_;
@@ -94,35 +105,62 @@ class UnixTaskRunner : public TaskRunner {
 
   EventFd event_;
 
-// The array of fds/handles passed to poll(2) / WaitForMultipleObjects().
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  // On Linux the watched fds are kept in an epoll(7) instance rather than
+  // passed to poll(2) on each iteration, so that the cost of a wake-up doesn't
+  // grow with the number of (mostly idle) watched fds. The fds are registered
+  // with EPOLLONESHOT, which disables them once reported until their task
+  // runs and re-arms them.
+  ScopedFile epoll_fd_;
+  std::vector<struct epoll_event> epoll_events_;
+#elif PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  // The array of handles passed to WaitForMultipleObjects().
   std::vector<PlatformHandle> poll_fds_;
 #else
+  // The array of fds passed to poll(2).
   std::vector<struct pollfd> poll_fds_;
 #endif
 
+  // Immediate tasks are posted without taking |lock_|, into a lock-free
+  // multi-producer single-consumer queue: a linked list whose nodes are
+  // appended by atomically swapping |immediate_tasks_head_|, and popped on the
+  // task runner thread from |immediate_tasks_tail_|. The tail is a stub node,
+  // whose task has already been popped (or which never had one).
+  std::atomic<ImmediateTask*> immediate_tasks_head_;
+  ImmediateTask* immediate_tasks_tail_;
+
+  // Set by the task runner thread before sleeping. PostTask() notifies
+  // |event_| only if it is set (and clears it), so that the threads posting
+  // tasks to a busy task runner don't write into the eventfd.
+  std::atomic<bool> sleeping_{false};
+
   // --- Begin lock-protected members ---
 
   std::mutex lock_;
 
-  std::deque<std::function<void()>> immediate_tasks_;
   std::multimap<TimeMillis, std::function<void()>> delayed_tasks_;
   bool quit_ = false;
 
   struct WatchTask {
     std::function<void()> callback;
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-    // On UNIX systems we make the FD number negative in |poll_fds_| to avoid
-    // polling it again until the queued task runs. On Windows we can't do that.
-    // Instead we keep track of its state here.
+    // On UNIX systems we make the FD number negative in |poll_fds_| (or disable
+    // it in the epoll set) to avoid polling it again until the queued task
+    // runs. On Windows we can't do that. Instead we keep track of its state
+    // here.
     bool pending = false;
-#else
+#elif !PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
     size_t poll_fd_index;  // Index into |poll_fds_|.
 #endif
   };
 
   std::map<PlatformHandle, WatchTask> watch_tasks_;
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
   bool watch_tasks_changed_ = false;
+#endif
 
   // --- End lock-protected members ---
 };
@@ -75,6 +75,10 @@ constexpr size_t kPageSize = 4096;
 // similar mm-related syscalls.
 uint32_t GetSysPageSize();
 
+// Returns the resident set size of the current process in bytes, or 0 if it
+// cannot be measured on this platform (only Linux and Android are supported).
+uint64_t GetCurrentProcessRssBytes();
+
 template <typename T>
 constexpr size_t ArraySize(const T& array) {
   return sizeof(array) / sizeof(array[0]);
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_EXT_TRACE_PROCESSOR_EXPORT_SYSTRACE_H_
+#define INCLUDE_PERFETTO_EXT_TRACE_PROCESSOR_EXPORT_SYSTRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/base/export.h"
+#include "perfetto/trace_processor/status.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class SystraceSerializer;
+class TraceProcessor;
+
+namespace systrace {
+
+struct ExportOptions {
+  // Whether the lines are escaped to be embedded in a JSON string (i.e. the
+  // "systemTraceEvents" of a JSON trace), each of them ending with an escaped
+  // "\n" rather than a newline.
+  bool escape_for_json = false;
+
+  // The maximum number of events to export. 0 means that all the events are
+  // exported.
+  uint32_t max_events = 0;
+
+  // Whether the last |max_events| events are exported rather than the first
+  // ones.
+  bool keep_end = false;
+
+  // The maximum number of threads which can be used to serialize the events.
+  // 0 or 1 means that the events are serialized on the calling thread. Ignored
+  // on builds without thread support (e.g. WASM).
+  uint32_t worker_threads = 0;
+};
+
+// Called with consecutive pieces of the exported text.
+using WriteCallback = std::function<util::Status(const char* data, size_t)>;
+
+// Exports the ftrace events in the raw table of the trace loaded in
+// TraceProcessor as systrace text lines (i.e. the same lines as returned by
+// to_ftrace(id) for each row, in the order of the table), skipping the
+// chrome_event.* and track_event.* rows. Must not be called concurrently with
+// Parse() or queries. Stops at the first error returned by |write|.
+util::Status PERFETTO_EXPORT ExportRawEvents(TraceProcessor*,
+                                             const ExportOptions&,
+                                             const WriteCallback& write);
+
+// Exports the same lines as ExportRawEvents(), but incrementally while the
+// trace is parsed: each call to ExportNewEvents() exports the rows inserted
+// in the raw table since the previous call. The events are inserted in
+// timestamp order once they leave the sorting window, so the text is the same
+// as when exporting after the end of the trace, except that the thread names
+// are the ones known when each event is exported. This avoids waiting for the
+// whole trace to be loaded before writing anything.
+// |max_events| and |keep_end| are not supported, as they need the number of
+// events of the whole trace.
+class PERFETTO_EXPORT RawEventsStreamer {
+ public:
+  RawEventsStreamer(TraceProcessor*, const ExportOptions&);
+  ~RawEventsStreamer();
+
+  // Must not be called concurrently with Parse() or queries. Stops at the
+  // first error returned by |write|.
+  util::Status ExportNewEvents(const WriteCallback& write);
+
+  uint64_t exported_events() const { return exported_events_; }
+
+ private:
+  RawEventsStreamer(const RawEventsStreamer&) = delete;
+  RawEventsStreamer& operator=(const RawEventsStreamer&) = delete;
+
+  TraceProcessor* const tp_;
+  const ExportOptions options_;
+  uint32_t next_row_ = 0;
+  uint64_t exported_events_ = 0;
+  // Whether the events of each name (by string id) are exported.
+  std::unordered_map<uint32_t, bool> exported_by_name_;
+  // Kept across calls, as they cache the layout of the args of each event.
+  std::vector<std::unique_ptr<SystraceSerializer>> serializers_;
+};
+
+}  // namespace systrace
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_EXT_TRACE_PROCESSOR_EXPORT_SYSTRACE_H_
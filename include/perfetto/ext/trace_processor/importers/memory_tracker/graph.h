@@ -19,10 +19,9 @@
 
 #include <sys/types.h>
 
-#include <forward_list>
+#include <deque>
 #include <map>
 #include <memory>
-#include <set>
 #include <string>
 #include <vector>
 
@@ -173,6 +172,10 @@ class PERFETTO_EXPORT GlobalNodeGraph {
     }
     MemoryAllocatorNodeId id() const { return id_; }
     void set_id(MemoryAllocatorNodeId id) { id_ = id; }
+    // The index of the node in the arena of its GlobalNodeGraph: nodes are
+    // numbered densely in creation order so per-node state of traversals can
+    // be kept in flat arrays.
+    uint32_t index() const { return index_; }
     GlobalNodeGraph::Edge* owns_edge() const { return owns_edge_; }
     std::map<std::string, Node*>* children() { return &children_; }
     const std::map<std::string, Node*>& const_children() const {
@@ -189,9 +192,12 @@ class PERFETTO_EXPORT GlobalNodeGraph {
     }
 
    private:
+    friend class GlobalNodeGraph;
+
     GlobalNodeGraph::Process* node_graph_;
     Node* const parent_;
     MemoryAllocatorNodeId id_;
+    uint32_t index_ = 0;
     std::map<std::string, Entry> entries_;
     std::map<std::string, Node*> children_;
     bool explicit_ = false;
@@ -228,6 +234,22 @@ class PERFETTO_EXPORT GlobalNodeGraph {
     const int priority_;
   };
 
+  // A set of nodes of a graph, stored as a bitmap indexed by Node::index().
+  class PERFETTO_EXPORT VisitedSet {
+   public:
+    bool Contains(const Node* node) const {
+      return node->index() < visited_.size() && visited_[node->index()];
+    }
+    void Insert(const Node* node) {
+      if (node->index() >= visited_.size())
+        visited_.resize(node->index() + 1);
+      visited_[node->index()] = true;
+    }
+
+   private:
+    std::vector<bool> visited_;
+  };
+
   // An iterator-esque class which yields nodes in a depth-first pre order.
   class PERFETTO_EXPORT PreOrderIterator {
    public:
@@ -240,7 +262,7 @@ class PERFETTO_EXPORT GlobalNodeGraph {
 
    private:
     std::vector<Node*> to_visit_;
-    std::set<const Node*> visited_;
+    VisitedSet visited_;
   };
 
   // An iterator-esque class which yields nodes in a depth-first post order.
@@ -255,7 +277,7 @@ class PERFETTO_EXPORT GlobalNodeGraph {
 
    private:
     std::vector<Node*> to_visit_;
-    std::set<Node*> visited_;
+    VisitedSet visited_;
     std::vector<Node*> path_;
   };
 
@@ -293,7 +315,7 @@ class PERFETTO_EXPORT GlobalNodeGraph {
   const ProcessNodeGraphMap& process_node_graphs() const {
     return process_node_graphs_;
   }
-  const std::forward_list<Edge>& edges() const { return all_edges_; }
+  const std::deque<Edge>& edges() const { return all_edges_; }
 
  private:
   // Creates a node in the arena which is associated with the given
@@ -301,8 +323,10 @@ class PERFETTO_EXPORT GlobalNodeGraph {
   Node* CreateNode(GlobalNodeGraph::Process* process_graph,
                    GlobalNodeGraph::Node* parent);
 
-  std::forward_list<Node> all_nodes_;
-  std::forward_list<Edge> all_edges_;
+  // Deques keep the nodes and edges in contiguous chunks without ever moving
+  // them, as they are referenced by pointer.
+  std::deque<Node> all_nodes_;
+  std::deque<Edge> all_edges_;
   IdNodeMap nodes_by_id_;
   std::unique_ptr<GlobalNodeGraph::Process> shared_memory_graph_;
   ProcessNodeGraphMap process_node_graphs_;
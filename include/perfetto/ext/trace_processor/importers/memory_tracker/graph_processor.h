@@ -63,7 +63,7 @@ class PERFETTO_EXPORT GraphProcessor {
 
   static void MarkWeakOwnersAndChildrenRecursively(
       GlobalNodeGraph::Node* node,
-      std::set<const GlobalNodeGraph::Node*>* nodes);
+      GlobalNodeGraph::VisitedSet* visited);
 
   static void RemoveWeakNodesRecursively(GlobalNodeGraph::Node* parent);
 
@@ -18,6 +18,7 @@
 #define INCLUDE_PERFETTO_EXT_TRACING_CORE_SHARED_MEMORY_ARBITER_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <functional>
 #include <memory>
@@ -41,6 +42,37 @@ class TraceWriter;
 // from the SharedMemory it receives from the Service-side.
 class PERFETTO_EXPORT SharedMemoryArbiter {
  public:
+  // Counters about the usage of the shared memory buffer (SMB) by the
+  // TraceWriters of this arbiter, useful to size the SMB. Many stalls or
+  // dropped chunks mean that the SMB is too small. A low ratio of written vs
+  // acquired bytes means that the writers return their chunks mostly empty.
+  struct Stats {
+    // Chunks handed out to the TraceWriters and their total size in bytes.
+    uint64_t chunks_acquired = 0;
+    uint64_t chunk_bytes_acquired = 0;
+
+    // Payload bytes written into the chunks before returning them.
+    uint64_t chunk_bytes_written = 0;
+
+    // Number of times a TraceWriter didn't find any free chunk and had to
+    // wait for the service to free one (BufferExhaustedPolicy::kStall) or
+    // started dropping data (BufferExhaustedPolicy::kDrop).
+    uint64_t stalls = 0;
+    uint64_t chunks_dropped = 0;
+
+    // CommitData() requests sent to the service and chunks committed with
+    // them. The difference between two samples of these over time gives the
+    // achieved commit IPC rate and batching efficiency.
+    uint64_t commit_requests = 0;
+    uint64_t chunks_committed = 0;
+
+    // Only with adaptive batching (see EnableAdaptiveBatchCommits()): the
+    // batching period picked for the last batch and the average latency of the
+    // service in acknowledging commits.
+    uint32_t last_batch_commits_duration_ms = 0;
+    uint64_t commit_latency_us = 0;
+  };
+
   virtual ~SharedMemoryArbiter();
 
   // Creates a new TraceWriter and assigns it a new WriterID. The WriterID is
@@ -138,6 +170,29 @@ class PERFETTO_EXPORT SharedMemoryArbiter {
   // DataSourceDescriptor.will_notify_on_stop=true).
   virtual void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) = 0;
 
+  // Enables adaptive batching of commits, which overrides
+  // SetBatchCommitsDuration() while enabled (0 disables it). The batching
+  // period is picked at the beginning of each batch, up to
+  // |max_batch_commits_duration_ms|: it shrinks as the SMB fills up and as the
+  // latency of the service in acknowledging commits grows, so that chunks are
+  // not held for longer than |max_batch_commits_duration_ms| overall. The
+  // batch is also committed early when the SMB is close to full.
+  //
+  // Adaptive batching takes effect only once the service advertised its own
+  // max batching period (see SetMaxBatchCommitsDurationByService()), which
+  // further caps |max_batch_commits_duration_ms|. As for
+  // SetBatchCommitsDuration(), producers should call
+  // FlushPendingCommitDataRequests() before stopping their data sources.
+  virtual void EnableAdaptiveBatchCommits(
+      uint32_t max_batch_commits_duration_ms) = 0;
+
+  // When the producer and service live in separate processes, this method
+  // should be called with InitializeConnectionResponse.
+  // max_batch_commits_duration_ms if set by the service (see
+  // producer_port.proto).
+  virtual void SetMaxBatchCommitsDurationByService(
+      uint32_t max_batch_commits_duration_ms) = 0;
+
   // Called to enable direct producer-side patching of chunks that have not yet
   // been committed to the service. The return value indicates whether direct
   // patching was successfully enabled. It will be true if
@@ -168,6 +223,10 @@ class PERFETTO_EXPORT SharedMemoryArbiter {
   // true.
   virtual bool TryShutdown() = 0;
 
+  // Returns the usage counters of the shared memory buffer. Can be called on
+  // any thread.
+  virtual Stats GetStats() = 0;
+
   // Create a bound arbiter instance. Args:
   // |SharedMemory|: the shared memory buffer to use.
   // |page_size|: a multiple of 4KB that defines the granularity of tracing
@@ -39,6 +39,7 @@ class TaskRunner;
 class Consumer;
 class Producer;
 class SharedMemoryArbiter;
+class TracePacket;
 class TraceWriter;
 
 // Exposed for testing.
@@ -195,6 +196,17 @@ class PERFETTO_EXPORT ConsumerEndpoint {
   // Tracing data will be delivered invoking Consumer::OnTraceData().
   virtual void ReadBuffers() = 0;
 
+  // Like ReadBuffers() but the service writes the packets directly into |fd|
+  // (e.g. the output file or a memfd), each prefixed by its proto preamble as
+  // with TraceConfig.write_into_file, rather than passing them to the
+  // consumer. This saves copying the trace through the IPC channel. All the
+  // buffers are read in one go, followed by a single Consumer::OnTraceData()
+  // call with no packets and |has_more| == false. |fd| should not be a pipe:
+  // the service blocks while writing into it.
+  // Services (or transports) that don't support it fall back on ReadBuffers(),
+  // so the consumer must still handle the packets passed to OnTraceData().
+  virtual void ReadBuffersIntoFile(base::ScopedFile fd) = 0;
+
   virtual void FreeBuffers() = 0;
 
   // Will call OnDetach().
@@ -239,6 +251,20 @@ class PERFETTO_EXPORT ConsumerEndpoint {
   using SaveTraceForBugreportCallback =
       std::function<void(bool /*success*/, const std::string& /*msg*/)>;
   virtual void SaveTraceForBugreport(SaveTraceForBugreportCallback) = 0;
+
+  // Takes a snapshot of the buffers of the running tracing session with the
+  // given TraceConfig.unique_session_name, without stopping it. The source
+  // session is flushed first. The snapshot becomes the (already stopped)
+  // tracing session of this consumer, which can read it with ReadBuffers()
+  // and release it with FreeBuffers(), while the source session keeps
+  // recording. This consumer must not have a tracing session already, and must
+  // have the same uid as the consumer of the source session (or be root).
+  // The callback is invoked once the snapshot is ready, or on failure, with
+  // |msg| describing the error.
+  using CloneSessionCallback =
+      std::function<void(bool /*success*/, const std::string& /*msg*/)>;
+  virtual void CloneSession(const std::string& unique_session_name,
+                            CloneSessionCallback) = 0;
 };  // class ConsumerEndpoint.
 
 // The public API of the tracing Service business logic.
@@ -256,6 +282,11 @@ class PERFETTO_EXPORT TracingService {
   using ProducerEndpoint = perfetto::ProducerEndpoint;
   using ConsumerEndpoint = perfetto::ConsumerEndpoint;
 
+  // The max period over which producers can batch their commits with adaptive
+  // batching (see SharedMemoryArbiter::EnableAdaptiveBatchCommits()). Batched
+  // chunks can't be read by the service, keep them from lagging much behind.
+  static constexpr uint32_t kMaxBatchCommitsDurationMs = 100;
+
   enum class ProducerSMBScrapingMode {
     // Use service's default setting for SMB scraping. Currently, the default
     // mode is to disable SMB scraping, but this may change in the future.
@@ -270,6 +301,10 @@ class PERFETTO_EXPORT TracingService {
     kDisabled
   };
 
+  // Replaces the packets in the passed vector with an equivalent (but
+  // smaller) sequence of packets containing the compressed original packets.
+  using CompressorFn = void (*)(std::vector<TracePacket>*);
+
   // Implemented in src/core/tracing_service_impl.cc .
   static std::unique_ptr<TracingService> CreateInstance(
       std::unique_ptr<SharedMemory::Factory>,
@@ -347,6 +382,28 @@ class PERFETTO_EXPORT TracingService {
   //
   // This feature is currently used by Chrome.
   virtual void SetSMBScrapingEnabled(bool enabled) = 0;
+
+  // Enables direct commits for the producers connected from now on with
+  // |in_process| = true, which share the address space of the service: their
+  // SharedMemoryArbiter marks the completed chunks as such in the SMB, without
+  // listing them in CommitData() requests, and the service moves all the
+  // completed chunks of their SMB into the log buffers on each CommitData().
+  // This saves the bookkeeping of each chunk commit on the producer side.
+  virtual void SetInProcessDirectCommitsEnabled(bool enabled) = 0;
+
+  // Sets the function used to compress the trace data of the tracing sessions
+  // which ask for it through TraceConfig.compression_type, both when returned
+  // by ReadBuffers() and when written into a file. If this is not set (e.g.
+  // because zlib is not available), the data is not compressed.
+  virtual void SetCompressorFn(CompressorFn) = 0;
+
+  // Sets the number of threads used to read the trace buffers. When a tracing
+  // session with more than one buffer is drained into a file
+  // (TraceConfig.write_into_file), its buffers are read and validated in
+  // parallel on these threads, while the service thread waits for them. The
+  // state of the tracing sessions and the IPC handling stay on the service
+  // thread. 0 (the default) reads all the buffers on the service thread.
+  virtual void SetBufferReadWorkers(size_t num_workers) = 0;
 };
 
 }  // namespace perfetto
@@ -23,11 +23,13 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <cinttypes>
 #include <string>
+#include <vector>
 
 namespace perfetto {
 namespace profiling {
@@ -44,33 +46,10 @@ struct SmapsParserState {
   SmapsEntry current_entry{};
 };
 
-template <typename T>
-static bool ParseSmaps(FILE* f, T callback) {
-  SmapsParserState state;
-
-  size_t line_size = 1024;
-  char* line = static_cast<char*>(malloc(line_size));
-
-  for (;;) {
-    errno = 0;
-    ssize_t rd = getline(&line, &line_size, f);
-    if (rd == -1) {
-      free(line);
-      if (state.parsed_header)
-        callback(state.current_entry);
-      return errno == 0;
-    } else {
-      if (line[rd - 1] == '\n') {
-        line[rd - 1] = '\0';
-        rd--;
-      }
-      if (!ParseSmapsLine(line, static_cast<size_t>(rd), &state, callback)) {
-        free(line);
-        return false;
-      }
-    }
-  }
-}
+// Size of the buffer ParseSmaps(int fd, ...) allocates if it is passed an
+// empty one. Most smaps files of large processes are read in a few hundred
+// reads with it.
+constexpr size_t kSmapsReadBufferSize = 64 * 1024;
 
 static inline const char* FindNthToken(const char* line,
                                        size_t n,
@@ -89,12 +68,31 @@ static inline const char* FindNthToken(const char* line,
   return nullptr;
 }
 
+// Parses the "<number> kB" value of the field line [begin, end) into |value|.
+// Leaves |value| unchanged if there is no number.
+static inline void ParseSmapsKbValue(const char* begin,
+                                     const char* end,
+                                     int64_t* value) {
+  while (begin != end && *begin == ' ')
+    begin++;
+  if (begin == end || *begin < '0' || *begin > '9')
+    return;
+  int64_t res = 0;
+  for (; begin != end && *begin >= '0' && *begin <= '9'; begin++)
+    res = res * 10 + (*begin - '0');
+  *value = res;
+}
+
+// |line| doesn't need to be null-terminated, nor to contain the trailing
+// newline.
 template <typename T>
-static bool ParseSmapsLine(char* line,
+static bool ParseSmapsLine(const char* line,
                            size_t size,
                            SmapsParserState* state,
                            T callback) {
-  char* first_token_end = static_cast<char*>(memchr(line, ' ', size));
+  const char* line_end = line + size;
+  const char* first_token_end =
+      static_cast<const char*>(memchr(line, ' ', size));
   if (first_token_end == nullptr || first_token_end == line)
     return false;  // Malformed.
   bool is_header = *(first_token_end - 1) != ':';
@@ -103,23 +101,130 @@ static bool ParseSmapsLine(char* line,
     if (state->parsed_header)
       callback(state->current_entry);
 
-    state->current_entry = {};
+    // Reset the fields one by one rather than assigning a new entry, so that
+    // the pathname keeps its capacity and parsing doesn't allocate once it is
+    // large enough.
+    SmapsEntry& entry = state->current_entry;
+    entry.size_kb = -1;
+    entry.private_dirty_kb = -1;
+    entry.swap_kb = -1;
     const char* last_token_begin = FindNthToken(line, 5u, size);
     if (last_token_begin)
-      state->current_entry.pathname.assign(last_token_begin);
+      entry.pathname.assign(last_token_begin, line_end);
+    else
+      entry.pathname.clear();
     state->parsed_header = true;
     return true;
   }
   if (!state->parsed_header)
     return false;
 
-  sscanf(line, "Size: %" PRId64 " kB", &state->current_entry.size_kb);
-  sscanf(line, "Swap: %" PRId64 " kB", &state->current_entry.swap_kb);
-  sscanf(line, "Private_Dirty: %" PRId64 " kB",
-         &state->current_entry.private_dirty_kb);
+  // Most of the fields are not needed: only compare the keys with the same
+  // length as the ones which are, and skip the rest without parsing them.
+  const size_t key_size = static_cast<size_t>(first_token_end - line);
+  int64_t* value = nullptr;
+  if (key_size == sizeof("Size:") - 1 && memcmp(line, "Size:", key_size) == 0)
+    value = &state->current_entry.size_kb;
+  else if (key_size == sizeof("Swap:") - 1 &&
+           memcmp(line, "Swap:", key_size) == 0)
+    value = &state->current_entry.swap_kb;
+  else if (key_size == sizeof("Private_Dirty:") - 1 &&
+           memcmp(line, "Private_Dirty:", key_size) == 0)
+    value = &state->current_entry.private_dirty_kb;
+  if (value)
+    ParseSmapsKbValue(first_token_end, line_end, value);
   return true;
 }
 
+template <typename T>
+static bool ParseSmaps(FILE* f, T callback) {
+  SmapsParserState state;
+
+  size_t line_size = 1024;
+  char* line = static_cast<char*>(malloc(line_size));
+
+  for (;;) {
+    errno = 0;
+    ssize_t rd = getline(&line, &line_size, f);
+    if (rd == -1) {
+      free(line);
+      if (state.parsed_header)
+        callback(state.current_entry);
+      return errno == 0;
+    } else {
+      if (line[rd - 1] == '\n') {
+        line[rd - 1] = '\0';
+        rd--;
+      }
+      if (!ParseSmapsLine(line, static_cast<size_t>(rd), &state, callback)) {
+        free(line);
+        return false;
+      }
+    }
+  }
+}
+
+// Same as above, but reads |fd| from its start with pread() through |buf|,
+// without going through stdio. |buf| can be reused across calls, e.g. when
+// reading the smaps of many processes or the same fd repeatedly, so that
+// parsing doesn't allocate. If it is empty, it is resized to
+// kSmapsReadBufferSize. It grows if a line doesn't fit into it.
+//
+// This also parses /proc/pid/smaps_rollup, as a single entry with the
+// "[rollup]" pathname, when only the totals of a process are needed.
+template <typename T>
+static bool ParseSmaps(int fd, std::vector<char>* buf, T callback) {
+  if (buf->empty())
+    buf->resize(kSmapsReadBufferSize);
+
+  SmapsParserState state;
+  // The data of buf in [begin, end) is read but not parsed yet.
+  size_t begin = 0;
+  size_t end = 0;
+  off_t offset = 0;
+  for (;;) {
+    if (end == buf->size()) {
+      if (begin == 0) {
+        buf->resize(buf->size() * 2);
+      } else {
+        memmove(buf->data(), buf->data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+      }
+    }
+    ssize_t rd = pread(fd, buf->data() + end, buf->size() - end, offset);
+    if (rd == -1 && errno == EINTR)
+      continue;
+    if (rd == -1)
+      return false;
+    if (rd == 0) {
+      if (begin != end &&
+          !ParseSmapsLine(buf->data() + begin, end - begin, &state, callback)) {
+        return false;
+      }
+      if (state.parsed_header)
+        callback(state.current_entry);
+      return true;
+    }
+    offset += rd;
+    end += static_cast<size_t>(rd);
+
+    const char* data = buf->data();
+    for (;;) {
+      const char* line = data + begin;
+      const char* newline =
+          static_cast<const char*>(memchr(line, '\n', end - begin));
+      if (!newline)
+        break;
+      if (!ParseSmapsLine(line, static_cast<size_t>(newline - line), &state,
+                          callback)) {
+        return false;
+      }
+      begin = static_cast<size_t>(newline + 1 - data);
+    }
+  }
+}
+
 }  // namespace profiling
 }  // namespace perfetto
 
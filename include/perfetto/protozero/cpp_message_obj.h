@@ -26,6 +26,8 @@
 
 namespace protozero {
 
+class Message;
+
 // Base class for generated .gen.h classes, which are full C++ objects that
 // support both ser and deserialization (but are not zero-copy).
 // This is only used by the "cpp" targets not the "pbzero" ones.
@@ -36,6 +38,10 @@ class PERFETTO_EXPORT CppMessageObj {
   virtual std::vector<uint8_t> SerializeAsArray() const = 0;
   virtual bool ParseFromArray(const void*, size_t) = 0;
 
+  // Serializes into |msg|, e.g. a nested message of a protozero message being
+  // written, without going through an intermediate buffer.
+  virtual void Serialize(Message* msg) const = 0;
+
   bool ParseFromString(const std::string& str) {
     return ParseFromArray(str.data(), str.size());
   }
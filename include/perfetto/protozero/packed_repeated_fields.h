@@ -44,6 +44,9 @@ namespace protozero {
 //   buf.Append(-1);
 //   msg->set_fieldname(buf);
 //   msg.SerializeAsString();
+//
+// When the values are already in an array, prefer appending them all at once
+// with PackedVarInt::Append(values, count).
 
 class PackedBufferBase {
  public:
@@ -64,17 +67,18 @@ class PackedBufferBase {
   }
 
  protected:
-  void GrowIfNeeded() {
+  // max(uint64_t varint encoding, biggest fixed type (uint64)).
+  static constexpr size_t kMaxElementSize = 10;
+
+  // Makes room for at least |size| more bytes.
+  void GrowIfNeeded(size_t size = kMaxElementSize) {
     PERFETTO_DCHECK(write_ptr_ >= storage_begin_ && write_ptr_ <= storage_end_);
-    if (PERFETTO_UNLIKELY(write_ptr_ + kMaxElementSize > storage_end_)) {
-      GrowSlowpath();
+    if (PERFETTO_UNLIKELY(write_ptr_ + size > storage_end_)) {
+      GrowSlowpath(size);
     }
   }
 
-  void GrowSlowpath();
-
-  // max(uint64_t varint encoding, biggest fixed type (uint64)).
-  static constexpr size_t kMaxElementSize = 10;
+  void GrowSlowpath(size_t size);
 
   // So sizeof(this) == 8k.
   static constexpr size_t kOnStackStorageSize = 8192 - 32;
@@ -93,6 +97,38 @@ class PackedVarInt : public PackedBufferBase {
     GrowIfNeeded();
     write_ptr_ = proto_utils::WriteVarInt(value, write_ptr_);
   }
+
+  // Appends |count| values. Faster than appending them one by one: the bounds
+  // are checked once per block of values, and the blocks of values < 0x80,
+  // the most common ones in e.g. enum, index or delta-encoded fields, are
+  // written with a loop the compiler can vectorize.
+  template <typename T>
+  void Append(const T* values, size_t count) {
+    static_assert(std::is_integral<T>::value && !std::is_same<T, bool>::value,
+                  "PackedVarInt::Append(values, count) needs an int type");
+    using UnsignedType = typename std::make_unsigned<T>::type;
+    constexpr size_t kBlockSize = 8;
+    size_t i = 0;
+    for (; i + kBlockSize <= count; i += kBlockSize) {
+      GrowIfNeeded(kBlockSize * kMaxElementSize);
+      const T* block = values + i;
+      // Negative values are sign extended: they are also >= 0x80 here.
+      UnsignedType bits = 0;
+      for (size_t j = 0; j < kBlockSize; j++)
+        bits = static_cast<UnsignedType>(bits |
+                                         static_cast<UnsignedType>(block[j]));
+      if (PERFETTO_LIKELY(bits < 0x80)) {
+        for (size_t j = 0; j < kBlockSize; j++)
+          write_ptr_[j] = static_cast<uint8_t>(block[j]);
+        write_ptr_ += kBlockSize;
+      } else {
+        for (size_t j = 0; j < kBlockSize; j++)
+          write_ptr_ = proto_utils::WriteVarInt(block[j], write_ptr_);
+      }
+    }
+    for (; i < count; i++)
+      Append(values[i]);
+  }
 };
 
 template <typename T /* e.g. uint32_t for Fixed32 */>
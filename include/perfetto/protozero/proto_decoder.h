@@ -18,6 +18,8 @@
 #define INCLUDE_PERFETTO_PROTOZERO_PROTO_DECODER_H_
 
 #include <stdint.h>
+#include <string.h>
+
 #include <array>
 #include <memory>
 #include <vector>
@@ -267,6 +269,50 @@ class PackedRepeatedFieldIterator {
   bool* const parse_error_;
 };
 
+// Decodes all the elements of a packed repeated varint field, e.g. the
+// |data| and |size| of the Field of GetPackedRepeated(), and appends them to
+// |out|. Faster than PackedRepeatedFieldIterator when all the elements are
+// needed: the runs of one-byte varints, the most common ones in e.g. enum,
+// index or delta-encoded fields, are decoded eight at a time.
+// Returns false if the buffer ends with a truncated varint. The elements
+// before it are appended anyways.
+template <typename T>
+bool DecodePackedVarInts(const uint8_t* data,
+                         size_t size,
+                         std::vector<T>* out) {
+  const size_t old_size = out->size();
+  // Each element takes at least one byte.
+  out->resize(old_size + size);
+  T* out_ptr = out->data() + old_size;
+  const uint8_t* pos = data;
+  const uint8_t* const end = data + size;
+  bool success = true;
+  while (pos != end) {
+    if (static_cast<size_t>(end - pos) >= sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, pos, sizeof(word));
+      // None of the next eight bytes has the continuation bit set.
+      if ((word & 0x8080808080808080ull) == 0) {
+        for (size_t i = 0; i < sizeof(uint64_t); i++)
+          out_ptr[i] = static_cast<T>(pos[i]);
+        out_ptr += sizeof(uint64_t);
+        pos += sizeof(uint64_t);
+        continue;
+      }
+    }
+    uint64_t value = 0;
+    const uint8_t* next = proto_utils::ParseVarInt(pos, end, &value);
+    if (PERFETTO_UNLIKELY(next == pos)) {
+      success = false;
+      break;
+    }
+    *out_ptr++ = static_cast<T>(value);
+    pos = next;
+  }
+  out->resize(static_cast<size_t>(out_ptr - out->data()));
+  return success;
+}
+
 // This decoder loads all fields upfront, without recursing in nested messages.
 // It is used as a base class for typed decoders generated by the pbzero plugin.
 // The split between TypedProtoDecoderBase and TypedProtoDecoder<> is to have
@@ -277,12 +323,17 @@ class PackedRepeatedFieldIterator {
 // [ field 0 (invalid) ] [ fields 1 .. N ] [ repeated fields ]
 //                                        ^                  ^
 //                                        num_fields_        size_
+// Only the entries of the fields 1 .. N that are set in |presence_| are
+// initialized, so that the cost of decoding a message doesn't depend on its
+// highest field id (e.g. FtraceEvent, with ids in the hundreds, of which only
+// a few are set at a time).
 class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
  public:
   // If the field |id| is known at compile time, prefer the templated
   // specialization at<kFieldNumber>().
   const Field& Get(uint32_t id) const {
-    return PERFETTO_LIKELY(id < num_fields_) ? fields_[id] : fields_[0];
+    return PERFETTO_LIKELY(id < num_fields_ && IsSet(id)) ? fields_[id]
+                                                           : fields_[0];
   }
 
   // Returns an object that allows to iterate over all instances of a repeated
@@ -291,7 +342,7 @@ class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
   template <typename T>
   RepeatedFieldIterator<T> GetRepeated(uint32_t field_id) const {
     return RepeatedFieldIterator<T>(field_id, &fields_[num_fields_],
-                                    &fields_[size_], &fields_[field_id]);
+                                    &fields_[size_], &Get(field_id));
   }
 
   // Returns an objects that allows to iterate over all entries of a packed
@@ -323,24 +374,34 @@ class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
 
  protected:
   TypedProtoDecoderBase(Field* storage,
+                        uint64_t* presence,
                         uint32_t num_fields,
                         uint32_t capacity,
                         const uint8_t* buffer,
                         size_t length)
       : ProtoDecoder(buffer, length),
         fields_(storage),
+        presence_(presence),
         num_fields_(num_fields),
         size_(num_fields),
         capacity_(capacity) {
     // The reason why Field needs to be trivially de/constructible is to avoid
-    // implicit initializers on all the ~1000 entries. We need it to initialize
-    // only on the first |max_field_id| fields, the remaining capacity doesn't
-    // require initialization.
+    // implicit initializers on all the ~1000 entries. Only the invalid 0th
+    // field is initialized, the others are when first seen in ParseAllFields().
     static_assert(std::is_trivially_constructible<Field>::value &&
                       std::is_trivially_destructible<Field>::value &&
                       std::is_trivial<Field>::value,
                   "Field must be a trivial aggregate type");
-    memset(fields_, 0, sizeof(Field) * num_fields_);
+    memset(fields_, 0, sizeof(Field));
+    memset(presence_, 0, sizeof(uint64_t) * PresenceWords(num_fields_));
+  }
+
+  static constexpr size_t PresenceWords(size_t num_fields) {
+    return (num_fields + 63) / 64;
+  }
+
+  bool IsSet(uint32_t id) const {
+    return (presence_[id / 64] >> (id % 64)) & 1;
   }
 
   void ParseAllFields();
@@ -358,6 +419,11 @@ class PERFETTO_EXPORT TypedProtoDecoderBase : public ProtoDecoder {
   // case of a large number of repeated fields.
   Field* fields_;
 
+  // Bitmap of the fields 1 .. N that have been seen, i.e. whose entries in
+  // |fields_| are initialized. Points to the on-stack storage provided by the
+  // TypedProtoDecoder specialization.
+  uint64_t* presence_;
+
   // Number of fields without accounting repeated storage. This is equal to
   // MAX_FIELD_ID + 1 (to account for the invalid 0th field).
   // This value is always <= size_ (and hence <= capacity);
@@ -382,6 +448,7 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
  public:
   TypedProtoDecoder(const uint8_t* buffer, size_t length)
       : TypedProtoDecoderBase(on_stack_storage_,
+                              on_stack_presence_,
                               /*num_fields=*/MAX_FIELD_ID + 1,
                               kCapacity,
                               buffer,
@@ -393,7 +460,7 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
   template <uint32_t FIELD_ID>
   const Field& at() const {
     static_assert(FIELD_ID <= MAX_FIELD_ID, "FIELD_ID > MAX_FIELD_ID");
-    return fields_[FIELD_ID];
+    return IsSet(FIELD_ID) ? fields_[FIELD_ID] : fields_[0];
   }
 
   TypedProtoDecoder(TypedProtoDecoder&& other) noexcept
@@ -405,6 +472,9 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
       memcpy(on_stack_storage_, other.on_stack_storage_,
              sizeof(on_stack_storage_));
     }
+    presence_ = on_stack_presence_;
+    memcpy(on_stack_presence_, other.on_stack_presence_,
+           sizeof(on_stack_presence_));
   }
 
  private:
@@ -422,6 +492,7 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
       1 + (HAS_NONPACKED_REPEATED_FIELDS ? kMaxDecoderFieldId : MAX_FIELD_ID);
 
   Field on_stack_storage_[kCapacity];
+  uint64_t on_stack_presence_[PresenceWords(MAX_FIELD_ID + 1)];
 };
 
 }  // namespace protozero
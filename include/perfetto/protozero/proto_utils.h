@@ -115,7 +115,9 @@ constexpr size_t kMaxMessageLength = (1u << (kMessageLengthFieldSize * 7)) - 1;
 // Largest value of simple (not length-delimited) field is 64-bit varint
 // (10 bytes at most). 15 bytes buffer is enough to store a simple field.
 constexpr size_t kMaxTagEncodedSize = 5;
-constexpr size_t kMaxSimpleFieldEncodedSize = kMaxTagEncodedSize + 10;
+constexpr size_t kMaxVarIntEncodedSize = 10;
+constexpr size_t kMaxSimpleFieldEncodedSize =
+    kMaxTagEncodedSize + kMaxVarIntEncodedSize;
 
 // Proto types: (int|uint|sint)(32|64), bool, enum.
 constexpr uint32_t MakeTagVarInt(uint32_t field_id) {
@@ -237,6 +239,24 @@ inline const uint8_t* ParseVarInt(const uint8_t* start,
                                   uint64_t* out_value) {
   const uint8_t* pos = start;
   uint64_t value = 0;
+
+  // Fastpath for the buffers that can hold the longest VarInt, which is most
+  // of them: no bound checks are needed in the loop, which the compiler can
+  // then unroll.
+  if (PERFETTO_LIKELY(static_cast<size_t>(end - start) >=
+                      kMaxVarIntEncodedSize)) {
+    for (uint32_t shift = 0; shift < 64u; shift += 7) {
+      uint8_t cur_byte = *pos++;
+      value |= static_cast<uint64_t>(cur_byte & 0x7f) << shift;
+      if ((cur_byte & 0x80) == 0) {
+        *out_value = value;
+        return pos;
+      }
+    }
+    *out_value = 0;
+    return start;
+  }
+
   for (uint32_t shift = 0; pos < end && shift < 64u; shift += 7) {
     // Cache *pos into |cur_byte| to prevent that the compiler dereferences the
     // pointer twice (here and in the if() below) due to char* aliasing rules.
@@ -79,6 +79,16 @@ class PERFETTO_EXPORT ScatteredHeapBuffer
   // Stitch all the slices into a single contiguous buffer.
   std::vector<uint8_t> StitchSlices();
 
+  // Like StitchSlices(), for the callers that need a string, to save a copy.
+  std::string StitchSlicesAsString();
+
+  // Returns the number of bytes written, i.e. the size of StitchSlices().
+  size_t GetWrittenSize();
+
+  // Copies the written bytes into |dst|, which must have room for
+  // GetWrittenSize() bytes.
+  void CopyWrittenBytesTo(uint8_t* dst);
+
   // Note that the returned ranges point back to this buffer and thus cannot
   // outlive it.
   std::vector<protozero::ContiguousMemoryRange> GetRanges();
@@ -153,8 +163,22 @@ class HeapBuffered {
   }
 
   std::string SerializeAsString() {
-    auto vec = SerializeAsArray();
-    return std::string(reinterpret_cast<const char*>(vec.data()), vec.size());
+    msg_.Finalize();
+    return shb_.StitchSlicesAsString();
+  }
+
+  // Returns the size of the serialized message. It can be copied with
+  // SerializeTo(), e.g. after a header, without the intermediate copy of
+  // SerializeAsArray().
+  size_t SerializedSize() {
+    msg_.Finalize();
+    return shb_.GetWrittenSize();
+  }
+
+  // |dst| must have room for SerializedSize() bytes.
+  void SerializeTo(uint8_t* dst) {
+    msg_.Finalize();
+    shb_.CopyWrittenBytesTo(dst);
   }
 
   std::vector<protozero::ContiguousMemoryRange> GetRanges() {
@@ -72,7 +72,19 @@ enum class SortingMode {
   // will act very similarly to the pre-v20 behaviour of this option.
   //
   // This option is scheduled to be removed in v21.
-  kForceFlushPeriodWindowedSort = 2
+  kForceFlushPeriodWindowedSort = 2,
+
+  // This option makes trace processor only sort events within a sliding
+  // window of |Config::sorting_window_ns|: as soon as events older than the
+  // window are seen, they are extracted and parsed. This bounds the memory
+  // used by sorting regardless of the length of the trace, which is useful
+  // for long-running traces (e.g. ring-buffer traces which are continuously
+  // appended to).
+  //
+  // Events arriving more than one window later than events the trace
+  // processor has already seen are dropped; the number of such events is
+  // reported by the |sorter_window_late_events| stat.
+  kForceWindowedSort = 3,
 };
 
 // Enum which encodes which event (if any) should be used to drop ftrace data
@@ -103,6 +115,10 @@ struct PERFETTO_EXPORT Config {
   // trace packets. See the enum documentation for more details.
   SortingMode sorting_mode = SortingMode::kDefaultHeuristics;
 
+  // The size of the sorting window, in nanoseconds, when |sorting_mode| is
+  // |SortingMode::kForceWindowedSort|. Ignored otherwise.
+  int64_t sorting_window_ns = 5ll * 1000 * 1000 * 1000;
+
   // When set to false, this option makes the trace processor not include ftrace
   // events in the raw table; this makes converting events back to the systrace
   // text format impossible. On the other hand, it also saves ~50% of memory
@@ -113,6 +129,39 @@ struct PERFETTO_EXPORT Config {
   // unaffected by this flag.
   bool ingest_ftrace_in_raw_table = true;
 
+  // When set to false, the syscalls (i.e. the sys_enter and sys_exit ftrace
+  // events) are only stored in the compact syscall table, instead of also
+  // being turned into slices on the tracks of the threads. This significantly
+  // speeds up the import of traces with syscall tracing enabled. The
+  // syscall_slice view exposes the syscalls with the columns of the slice
+  // table.
+  bool ingest_syscalls_as_slices = true;
+
+  // When set to true, the samples of the rss_stat ftrace events which have
+  // the same value as the previous sample of their process counter track are
+  // dropped instead of being inserted into the counter table. As the kernel
+  // emits these events for every small change of the memory counters, this
+  // significantly reduces the size of the counter table of memory-heavy
+  // traces without changing the values of the counters over time: only the
+  // timestamp of the last sample of each run of equal values is lost.
+  bool coalesce_rss_stat_counters = false;
+
+  // When non-zero, the samples of the rss_stat ftrace events of each process
+  // counter track are downsampled to buckets of this many nanoseconds: each
+  // bucket is represented by at most two rows, at the timestamps of its
+  // first two distinct samples, holding the exact minimum and maximum of the
+  // samples of the bucket in the order in which they were reached.
+  int64_t rss_stat_resolution_ns = 0;
+
+  // When set to true, the fields of the ftrace events ingested in the raw
+  // table are kept as the (compact) encoded events rather than inserted into
+  // the args table while parsing. They are only decoded into the args table
+  // the first time the raw or the args table is read (or when a query session
+  // is created). This significantly reduces the memory usage of ftrace heavy
+  // traces as long as these tables are not queried. Note that the arg_set_ids
+  // of the raw table rows are then only set once the args are decoded.
+  bool lazy_ftrace_raw_args = false;
+
   // Indicates the event which should be used as a marker to drop ftrace data in
   // the trace before that event. See the ennu documenetation for more details.
   DropFtraceDataBefore drop_ftrace_data_before =
@@ -121,6 +170,106 @@ struct PERFETTO_EXPORT Config {
   // Any built-in metric proto or sql files matching these paths are skipped
   // during trace processor metric initialization.
   std::vector<std::string> skip_builtin_metric_paths;
+
+  // The maximum number of threads which can be used to sort the per-CPU
+  // queues of the trace sorter before they are merged and passed to the
+  // parsing stage. 0 or 1 means that all sorting happens on the thread calling
+  // Parse()/NotifyEndOfFile(). Ignored on builds without thread support (e.g.
+  // WASM).
+  uint32_t sorting_worker_threads = 0;
+
+  // When set to true, the events extracted from the trace sorter are parsed
+  // (and inserted into the tables) on a dedicated thread while the calling
+  // thread keeps merging the sorted queues. Tokenization of the following
+  // chunks of the trace only starts once all the extracted events have been
+  // parsed. Ignored on builds without thread support (e.g. WASM).
+  bool pipelined_parsing = false;
+
+  // The maximum number of threads which can be used to decompress the
+  // |compressed_packets| of proto traces (i.e. traces written with
+  // |TraceConfig::compression_type| set). 0 or 1 means that all packets are
+  // decompressed on the thread calling Parse(). This does not affect traces
+  // where the whole file is gzipped, as they can only be inflated serially.
+  // Ignored on builds without thread support (e.g. WASM).
+  uint32_t decompression_worker_threads = 0;
+
+  // When set to true, the integer columns of the tables which scale with the
+  // size of the trace (e.g. slices, sched, counters, args) are stored in a
+  // compressed form once the trace has been fully loaded. This significantly
+  // reduces memory usage of large traces at the cost of making queries on
+  // these tables slightly slower.
+  bool compress_integer_columns = false;
+
+  // When non-zero, the resident memory of the process is compared to this
+  // budget once the trace has been fully loaded. If it is over the budget,
+  // the compressed integer columns of the tables which scale with the size of
+  // the trace are moved to a temporary file which is memory mapped back
+  // (largest columns first) until the excess memory has been freed: queries
+  // keep working as before, with the kernel paging the data in and out as
+  // needed. Implies |compress_integer_columns|. If the resident memory cannot
+  // be measured, all the compressed columns are spilled. Ignored on
+  // platforms without memory mapped files (e.g. Windows and WASM).
+  uint64_t spill_memory_budget_bytes = 0;
+
+  // The maximum number of processes which can be used by ComputeMetric() to
+  // compute the requested metrics concurrently. When > 1, the metrics are
+  // split between worker processes forked from the calling one, each of which
+  // computes its metrics sequentially on a copy-on-write snapshot of the
+  // trace and of the SQL state. As a consequence, the tables and views
+  // created by the metrics are not available after ComputeMetric() returns,
+  // except for those created by the RUN_METRIC files shared by several
+  // metrics, which are run once before forking.
+  // 0 or 1 means that all metrics are computed in the calling process. As
+  // forking is not safe in a process running other threads, the metrics are
+  // also computed in the calling process whenever it runs other threads.
+  // Only used on Linux and Android.
+  uint32_t metric_worker_processes = 0;
+
+  // The maximum number of threads which can be used by the SPAN_JOIN
+  // operator tables to join ranges of partitions of the child tables
+  // concurrently, once the rows of both child tables have been fetched.
+  // Only used for partitioned joins returning enough rows. 0 or 1 means that
+  // the rows are streamed from SQLite and joined lazily on the thread running
+  // the query, without fetching all the rows first. Ignored on
+  // builds without thread support (e.g. WASM).
+  uint32_t span_join_worker_threads = 0;
+
+  // The maximum number of threads which can be used to sum the samples of the
+  // native heap and perf profiles per callsite when building the
+  // experimental_flamegraph table. Only used for profiles with enough
+  // samples. 0 or 1 means that the samples are summed on the thread running
+  // the query. Ignored on builds without thread support (e.g. WASM).
+  uint32_t flamegraph_worker_threads = 0;
+
+  // The maximum number of threads which can be used to prepare the
+  // TrackEvents extracted by the trace sorter before they are parsed: the
+  // events are decoded and their names and categories are interned
+  // concurrently for different packet sequences. 0 or 1 means that this is
+  // done while parsing each event. Ignored on builds without thread support
+  // (e.g. WASM).
+  uint32_t track_event_worker_threads = 0;
+
+  // The maximum number of threads which can be used to decode the big
+  // packets of the profilers (heap graphs and heapprofd profiles) extracted
+  // by the trace sorter before they are parsed, concurrently for different
+  // packet sequences. 0 or 1 means that the packets are decoded while parsing
+  // them. Ignored on builds without thread support (e.g. WASM).
+  uint32_t packet_preparation_worker_threads = 0;
+};
+
+// Limits on the resources used by a query, see
+// TraceProcessor::ExecuteQueryWithBudget(). 0 means no limit.
+struct PERFETTO_EXPORT QueryBudget {
+  // The wall time the query can run for, from the ExecuteQueryWithBudget()
+  // call.
+  uint64_t max_duration_ms = 0;
+
+  // The number of rows the query can return.
+  uint64_t max_rows = 0;
+
+  // How much the resident memory of the process can grow while the query
+  // runs. Only supported on Linux and Android, ignored elsewhere.
+  uint64_t max_memory_bytes = 0;
 };
 
 // Represents a dynamically typed value returned by SQL.
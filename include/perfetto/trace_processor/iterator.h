@@ -64,6 +64,11 @@ class PERFETTO_EXPORT Iterator {
   // Returns the status of the iterator.
   util::Status Status();
 
+  // Returns true if the query does not write to the database, i.e. it does
+  // not create, modify or drop tables, views or rows (see
+  // sqlite3_stmt_readonly()). Returns false if the query failed to compile.
+  bool IsReadOnly();
+
  private:
   friend class QueryResultSerializer;
 
@@ -18,6 +18,8 @@
 #define INCLUDE_PERFETTO_TRACE_PROCESSOR_READ_TRACE_H_
 
 #include <functional>
+#include <limits>
+#include <string>
 #include <vector>
 
 #include "perfetto/base/export.h"
@@ -33,6 +35,38 @@ util::Status PERFETTO_EXPORT ReadTrace(
     const char* filename,
     const std::function<void(uint64_t parsed_size)>& progress_callback = {});
 
+// Loads the traces in |filenames|, e.g. recorded on different devices, into
+// the same instance (see TraceProcessorStorage::ParseTrace()). The files are
+// read in parallel, each on a thread of its own, while the ones already read
+// are parsed.
+util::Status PERFETTO_EXPORT ReadTraces(
+    TraceProcessor* tp,
+    const std::vector<std::string>& filenames,
+    const std::function<void(uint64_t parsed_size)>& progress_callback = {});
+
+// Selects the parts of an indexed trace to load with ReadTraceSections().
+struct TraceSectionFilter {
+  // Time window, in the default trace clock (BUILTIN_CLOCK_BOOTTIME).
+  int64_t start_ts = 0;
+  int64_t end_ts = std::numeric_limits<int64_t>::max();
+
+  // If not empty, only the sections containing one of these TracePacket
+  // field ids (e.g. 1 for ftrace_events) are loaded.
+  std::vector<uint32_t> packet_types;
+};
+
+// Like ReadTrace(), but if the trace ends with a TraceIndex (see
+// TraceConfig.write_trace_index) only reads and parses the sections of the
+// file needed for |filter|, which is much faster than loading the whole file
+// for a short window of a long trace. The sections are selected
+// conservatively: some data outside of |filter| might be loaded too. Loads
+// the whole trace if it has no index.
+util::Status PERFETTO_EXPORT ReadTraceSections(
+    TraceProcessor* tp,
+    const char* filename,
+    const TraceSectionFilter& filter,
+    const std::function<void(uint64_t parsed_size)>& progress_callback = {});
+
 util::Status PERFETTO_EXPORT DecompressTrace(const uint8_t* data,
                                              size_t size,
                                              std::vector<uint8_t>* output);
@@ -48,6 +48,24 @@ class PERFETTO_EXPORT TraceProcessor : public TraceProcessorStorage {
   virtual Iterator ExecuteQuery(const std::string& sql,
                                 int64_t time_queued = 0) = 0;
 
+  // Like ExecuteQuery(), but the query is interrupted as soon as it exceeds
+  // |budget| or when InterruptQuery() is called: Next() then returns false
+  // and Status() returns an error saying why. The rows returned before are
+  // still valid. The budget applies until the returned iterator is destroyed.
+  virtual Iterator ExecuteQueryWithBudget(const std::string& sql,
+                                          const QueryBudget& budget,
+                                          int64_t time_queued = 0) = 0;
+
+  // Like ExecuteQueryWithBudget(), but binds |args| to the parameters (?,
+  // ?NNN, :name, ...) of |sql| in order. The parameters without args are NULL.
+  // The statement prepared for |sql| is cached once the returned iterator is
+  // destroyed and reused by the following calls with the same |sql|, which
+  // only differ by their args. The strings and bytes of |args| are copied.
+  virtual Iterator ExecuteQueryWithArgs(const std::string& sql,
+                                        const std::vector<SqlValue>& args,
+                                        const QueryBudget& budget = {},
+                                        int64_t time_queued = 0) = 0;
+
   // Registers a metric at the given path which will run the specified SQL.
   virtual util::Status RegisterMetric(const std::string& path,
                                       const std::string& sql) = 0;
@@ -86,6 +104,7 @@ class PERFETTO_EXPORT TraceProcessor : public TraceProcessorStorage {
       std::string* metrics_string) = 0;
 
   // Interrupts the current query. Typically used by Ctrl-C handler.
+  // Can be called from any thread.
   virtual void InterruptQuery() = 0;
 
   // Deletes all tables and views that have been created (by the UI or user)
@@ -113,11 +132,33 @@ class PERFETTO_EXPORT TraceProcessor : public TraceProcessorStorage {
   virtual util::Status DisableAndReadMetatrace(
       std::vector<uint8_t>* trace_proto) = 0;
 
+  // Enables or disables the profiling of the queries started afterwards. The
+  // profile of a query (the time spent in each table and in the filtering of
+  // each column, the rows scanned and returned, ...) replaces the previous
+  // one in the query_profile table once all its rows have been read or its
+  // iterator is destroyed.
+  virtual void EnableQueryProfiling(bool enabled) = 0;
+
   // Gets all the currently loaded proto descriptors used in metric computation.
   // This includes all compiled-in binary descriptors, and all proto descriptors
   // loaded by trace processor shell at runtime. The message is encoded as
   // DescriptorSet, defined in perfetto/trace_processor/trace_processor.proto.
   virtual std::vector<uint8_t> GetMetricDescriptors() = 0;
+
+  // Creates a query session on the data loaded so far: a TraceProcessor with
+  // its own SQLite connection, and so its own tables, views and functions
+  // created by queries, which shares the parsed trace with this instance
+  // instead of copying it. Queries can run concurrently on different threads
+  // on different sessions (and on this instance), but each session must only
+  // be used by one thread at a time.
+  //
+  // Sessions should only be created once the trace is fully loaded (i.e. after
+  // NotifyEndOfFile()). They cannot parse data, this instance must not parse
+  // more data while they exist and they must be destroyed before it. A session
+  // has the metrics registered on this instance when it is created.
+  // Metatracing is process-wide and not thread-safe: it must not be enabled
+  // while queries run concurrently.
+  virtual std::unique_ptr<TraceProcessor> CreateQuerySession() = 0;
 };
 
 // When set, logs SQLite actions on the console.
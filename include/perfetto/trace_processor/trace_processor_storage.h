@@ -45,6 +45,37 @@ class PERFETTO_EXPORT TraceProcessorStorage {
   // floor and return errors forever.
   virtual util::Status Parse(std::unique_ptr<uint8_t[]>, size_t) = 0;
 
+  // Variant of Parse() for data which is not owned through a heap buffer,
+  // e.g. a read-only mapping of the trace file. Instead of copying the data,
+  // the trace processor retains |data| (and so the memory it points to) for
+  // as long as any of the packets it contains is alive. Use the aliasing
+  // constructor of std::shared_ptr to pass chunks of a larger allocation.
+  // |size| must be < 4GB.
+  virtual util::Status ParseShared(std::shared_ptr<const uint8_t> data,
+                                   size_t size);
+
+  // Variant of Parse() for loading several traces in the same storage, e.g.
+  // the traces recorded on different devices or a system trace and a Chrome
+  // JSON trace. |trace_idx| identifies the trace |data| belongs to. Each trace
+  // gets its own format detection, tokenizer and clock domains (clocks with
+  // the same id in different traces are not assumed to be the same clock, and
+  // each trace is converted to its own trace time clock) and the events of
+  // all the traces are merged in timestamp order. The chunks of different
+  // traces can be interleaved in any order. Must be called before any call to
+  // Parse(), which then appends to the trace 0. |trace_idx| must be < 256.
+  virtual util::Status ParseTrace(uint32_t trace_idx,
+                                  std::unique_ptr<uint8_t[]> data,
+                                  size_t size);
+
+  // Makes all the data passed into Parse() so far available for querying
+  // without ending the trace: the events queued in the ordering stage are
+  // parsed and the tables derived from them are refreshed. More data can be
+  // appended with Parse() afterwards, e.g. when following a trace which is
+  // still being written. Events older than the ones already flushed are
+  // parsed out of order (see the sorter_push_event_out_of_order stat) and
+  // may be dropped: flushing too often makes the trace less accurate.
+  virtual void Flush() = 0;
+
   // When parsing a bounded file (as opposite to streaming from a device) this
   // function should be called when the last chunk of the file has been passed
   // into Parse(). This allows to flush the events queued in the ordering stage,
@@ -26,6 +26,7 @@
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <vector>
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -56,10 +57,13 @@ class TrackEvent_Decoder;
 }  // namespace protos
 
 struct ConsoleColor;
+class ConsoleAsyncOutput;
+class ConsoleOutputRing;
 
 class PERFETTO_EXPORT ConsoleInterceptor
     : public Interceptor<ConsoleInterceptor> {
  public:
+  ConsoleInterceptor();
   ~ConsoleInterceptor() override;
 
   static void Register();
@@ -81,9 +85,15 @@ class PERFETTO_EXPORT ConsoleInterceptor
     bool use_colors{};
 
     // Messages up to this length are buffered and written atomically. If a
-    // message is longer, it will be printed with multiple writes.
+    // message is longer, it will be printed with multiple writes (or truncated
+    // with async output).
     std::array<char, 1024> message_buffer{};
     size_t buffer_pos{};
+    bool message_truncated{};
+
+    // Set with async output: the messages are queued here instead of being
+    // written to |fd|.
+    std::shared_ptr<ConsoleOutputRing> async_ring;
 
     // We only support a single trace writer sequence per thread, so the
     // sequence state is stored in TLS.
@@ -116,6 +126,12 @@ class PERFETTO_EXPORT ConsoleInterceptor
 
   int fd_ = STDOUT_FILENO;
   bool use_colors_ = true;
+  bool async_output_enabled_ = false;
+  size_t async_buffer_size_ = 0;
+
+  // Drains the |async_ring| of all threads. Only set while the session is
+  // started.
+  std::unique_ptr<ConsoleAsyncOutput> async_output_;
 
   TrackEventStateTracker::SessionState session_state_;
   uint64_t start_time_ns_{};
@@ -130,6 +130,16 @@ struct DefaultDataSourceTraits {
   // TraceContext::GetIncrementalState().
   using IncrementalStateType = void;
 
+  // |CustomTlsStateType| can optionally be used to cache, for each thread and
+  // data source instance, the state that the trace points need from the data
+  // source instance (e.g., options parsed from the config in OnSetup()).
+  // It's created on the first trace point of each thread, which isn't
+  // otherwise slowed down by the lookup of the data source instance and by
+  // its lock. It must have a constructor taking the TraceContext, which can be
+  // used to access the data source with GetDataSourceLocked(). See
+  // TraceContext::GetCustomTlsState().
+  using CustomTlsStateType = void;
+
   // Allows overriding what type of thread-local state configuration the data
   // source uses. By default every data source gets independent thread-local
   // state, which means every instance uses separate trace writers and
@@ -235,6 +245,14 @@ class DataSource : public DataSourceBase {
           tls_inst_->incremental_state.get());
     }
 
+    // Returns the state created for this thread and data source instance, see
+    // DefaultDataSourceTraits::CustomTlsStateType. Unlike
+    // GetDataSourceLocked(), this doesn't take any lock.
+    typename DataSourceTraits::CustomTlsStateType* GetCustomTlsState() {
+      return reinterpret_cast<typename DataSourceTraits::CustomTlsStateType*>(
+          tls_inst_->custom_tls_state.get());
+    }
+
    private:
     friend class DataSource;
     template <typename, const internal::TrackEventCategoryRegistry*>
@@ -312,7 +330,6 @@ class DataSource : public DataSourceBase {
       Lambda tracing_fn,
       typename Traits::TracePointData trace_point_data = {}) {
     PERFETTO_DCHECK(instances);
-    constexpr auto kMaxDataSourceInstances = internal::kMaxDataSourceInstances;
 
     // See tracing_muxer.h for the structure of the TLS.
     auto* tracing_impl = internal::TracingMuxer::Get();
@@ -347,10 +364,12 @@ class DataSource : public DataSourceBase {
       tracing_impl->DestroyStoppedTraceWritersForCurrentThread();
     }
 
-    for (uint32_t i = 0; i < kMaxDataSourceInstances; i++) {
-      internal::DataSourceState* instance_state =
-          static_state_.TryGetCached(instances, i);
-      if (!instance_state)
+    // Only the set bits of |instances| are visited. The instances which
+    // already have a trace writer on this thread are tracked in the
+    // |initialized_instances| bitmap of the TLS, and go straight to the
+    // tracing lambda.
+    for (uint32_t i = 0, bits = instances; bits; i++, bits >>= 1) {
+      if (!(bits & 1))
         continue;
 
       // Even if we passed the check above, the DataSourceInstance might be
@@ -377,33 +396,12 @@ class DataSource : public DataSourceBase {
       // point. But stopping and starting tracing (even once) takes so much
       // handshaking to make this extremely unrealistic.
 
-      auto& tls_inst = tls_state_->per_instance[i];
-      if (PERFETTO_UNLIKELY(!tls_inst.trace_writer)) {
-        // Here we need an acquire barrier, which matches the release-store made
-        // by TracingMuxerImpl::SetupDataSource(), to ensure that the backend_id
-        // and buffer_id are consistent.
-        instances = Traits::GetActiveInstances(trace_point_data)
-                        ->load(std::memory_order_acquire);
-        instance_state = static_state_.TryGetCached(instances, i);
-        if (!instance_state || !instance_state->trace_lambda_enabled)
-          continue;
-        tls_inst.backend_id = instance_state->backend_id;
-        tls_inst.backend_connection_id = instance_state->backend_connection_id;
-        tls_inst.buffer_id = instance_state->buffer_id;
-        tls_inst.data_source_instance_id =
-            instance_state->data_source_instance_id;
-        tls_inst.is_intercepted = instance_state->interceptor_id != 0;
-        tls_inst.trace_writer = tracing_impl->CreateTraceWriter(
-            &static_state_, i, instance_state,
-            DataSourceType::kBufferExhaustedPolicy);
-        CreateIncrementalState(&tls_inst);
-
-        // Even in the case of out-of-IDs, SharedMemoryArbiterImpl returns a
-        // NullTraceWriter. The returned pointer should never be null.
-        assert(tls_inst.trace_writer);
+      if (PERFETTO_UNLIKELY(!(tls_state_->initialized_instances & (1u << i))) &&
+          !InitializeInstanceTls<Traits>(i, trace_point_data)) {
+        continue;
       }
 
-      tracing_fn(TraceContext(&tls_inst, i));
+      tracing_fn(TraceContext(&tls_state_->per_instance[i], i));
     }
   }
 
@@ -455,6 +453,75 @@ class DataSource : public DataSourceBase {
     }
   };
 
+  // The slow path of TraceWithInstances(), for the first trace point of the
+  // current thread into the |i|-th instance. Creates the trace writer and the
+  // other thread-local state of the instance. Returns false if the instance
+  // can't be traced into.
+  template <typename Traits>
+  PERFETTO_NO_INLINE static bool InitializeInstanceTls(
+      uint32_t i,
+      typename Traits::TracePointData trace_point_data) {
+    // Here we need an acquire barrier, which matches the release-store made
+    // by TracingMuxerImpl::SetupDataSource(), to ensure that the backend_id
+    // and buffer_id are consistent.
+    uint32_t instances = Traits::GetActiveInstances(trace_point_data)
+                             ->load(std::memory_order_acquire);
+    internal::DataSourceState* instance_state =
+        static_state_.TryGetCached(instances, i);
+    if (!instance_state || !instance_state->trace_lambda_enabled)
+      return false;
+
+    auto& tls_inst = tls_state_->per_instance[i];
+    tls_inst.backend_id = instance_state->backend_id;
+    tls_inst.backend_connection_id = instance_state->backend_connection_id;
+    tls_inst.buffer_id = instance_state->buffer_id;
+    tls_inst.data_source_instance_id = instance_state->data_source_instance_id;
+    tls_inst.is_intercepted = instance_state->interceptor_id != 0;
+    tls_inst.trace_writer = internal::TracingMuxer::Get()->CreateTraceWriter(
+        &static_state_, i, instance_state,
+        DataSourceType::kBufferExhaustedPolicy);
+    CreateIncrementalState(&tls_inst);
+
+    // Even in the case of out-of-IDs, SharedMemoryArbiterImpl returns a
+    // NullTraceWriter. The returned pointer should never be null.
+    assert(tls_inst.trace_writer);
+
+    // Cleared by TracingMuxerImpl::DestroyStoppedTraceWritersForCurrentThread()
+    // together with the state above.
+    tls_state_->initialized_instances |= 1u << i;
+    CreateCustomTlsState(&tls_inst, i);
+    return true;
+  }
+
+  // Create the user provided custom thread-local state in the given
+  // thread-local storage. As for CreateIncrementalStateImpl(), the last
+  // parameter is used to specialize the case where there is no such type.
+  template <typename T>
+  static void CreateCustomTlsStateImpl(
+      internal::DataSourceInstanceThreadLocalState* tls_inst,
+      uint32_t instance_index,
+      const T*) {
+    PERFETTO_DCHECK(!tls_inst->custom_tls_state);
+    TraceContext trace_context(tls_inst, instance_index);
+    tls_inst->custom_tls_state =
+        internal::DataSourceInstanceThreadLocalState::ObjectWithDeleter(
+            reinterpret_cast<void*>(new T(trace_context)),
+            [](void* p) { delete reinterpret_cast<T*>(p); });
+  }
+
+  static void CreateCustomTlsStateImpl(
+      internal::DataSourceInstanceThreadLocalState*,
+      uint32_t,
+      const void*) {}
+
+  static void CreateCustomTlsState(
+      internal::DataSourceInstanceThreadLocalState* tls_inst,
+      uint32_t instance_index) {
+    CreateCustomTlsStateImpl(
+        tls_inst, instance_index,
+        static_cast<typename DataSourceTraits::CustomTlsStateType*>(nullptr));
+  }
+
   // Create the user provided incremental state in the given thread-local
   // storage. Note: The second parameter here is used to specialize the case
   // where there is no incremental state type.
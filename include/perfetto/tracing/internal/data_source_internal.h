@@ -93,6 +93,13 @@ struct DataSourceState {
   // the following slots.
   uint32_t interceptor_id = 0;
 
+  // Non-zero if this instance was started by startup tracing (see
+  // Tracing::SetupStartupTracingBlocking()). Its trace writers commit to the
+  // target buffer reservation with this id, which gets bound to the actual
+  // buffer once the service adopts the instance. Until then,
+  // |data_source_instance_id| is 0.
+  uint16_t startup_target_buffer_reservation = 0;
+
   // This lock is not held to implement Trace() and it's used only if the trace
   // code wants to access its own data source state.
   // This is to prevent that accessing the data source on an arbitrary embedder
@@ -145,11 +152,13 @@ struct DataSourceStaticState {
 
 // Per-DataSource-instance thread-local state.
 struct DataSourceInstanceThreadLocalState {
-  using IncrementalStatePointer = std::unique_ptr<void, void (*)(void*)>;
+  using ObjectWithDeleter = std::unique_ptr<void, void (*)(void*)>;
+  using IncrementalStatePointer = ObjectWithDeleter;
 
   void Reset() {
     trace_writer.reset();
     incremental_state.reset();
+    custom_tls_state.reset();
     backend_id = 0;
     backend_connection_id = 0;
     buffer_id = 0;
@@ -160,6 +169,7 @@ struct DataSourceInstanceThreadLocalState {
 
   std::unique_ptr<TraceWriterBase> trace_writer;
   IncrementalStatePointer incremental_state = {nullptr, [](void*) {}};
+  ObjectWithDeleter custom_tls_state = {nullptr, [](void*) {}};
   uint32_t incremental_state_generation;
   TracingBackendId backend_id;
   uint32_t backend_connection_id;
@@ -176,6 +186,11 @@ struct DataSourceThreadLocalState {
   // generation, which is per-global-TLS and not per data-source.
   TracingTLS* root_tls = nullptr;
 
+  // A bitmap of the entries of |per_instance| which have been initialized
+  // (i.e. have a trace writer) on this thread. Allows the trace points to skip
+  // the initialization checks of the instances.
+  uint32_t initialized_instances = 0;
+
   // One entry per each data source instance.
   std::array<DataSourceInstanceThreadLocalState, kMaxDataSourceInstances>
       per_instance{};
@@ -159,6 +159,13 @@ class PERFETTO_EXPORT TrackEventInternal {
                          std::forward<T>(value));
   }
 
+  // Writes the interning ids of the debug annotation names |names| into
+  // |iids|, both of which have |count| elements.
+  static void InternDebugAnnotationNames(perfetto::EventContext*,
+                                         const char* const* names,
+                                         size_t count,
+                                         uint64_t* iids);
+
   // If the given track hasn't been seen by the trace writer yet, write a
   // descriptor for it into the trace. Doesn't take a lock unless the track
   // descriptor is new.
@@ -17,9 +17,15 @@
 #ifndef INCLUDE_PERFETTO_TRACING_INTERNAL_WRITE_TRACK_EVENT_ARGS_H_
 #define INCLUDE_PERFETTO_TRACING_INTERNAL_WRITE_TRACK_EVENT_ARGS_H_
 
+#include <string.h>
+
+#include <type_traits>
+
 #include "perfetto/base/compiler.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/tracing/event_context.h"
 #include "perfetto/tracing/traced_proto.h"
+#include "protos/perfetto/trace/track_event/debug_annotation.pbzero.h"
 
 namespace perfetto {
 namespace internal {
@@ -99,15 +105,216 @@ PERFETTO_ALWAYS_INLINE void WriteTrackEventArgs(
   WriteTrackEventArgs(std::move(event_ctx), std::forward<Args>(args)...);
 }
 
+// Debug annotations with a bool, integer or floating point value are written
+// following a plan computed at compile time: the proto preambles of the
+// annotation and of its fields are constants, and each run of consecutive
+// planned annotations of a TRACE_EVENT is encoded into a stack buffer and
+// appended to the event at once, with a single call to intern all the names.
+// Other values go through AddDebugAnnotation() and their TracedValue.
+template <typename T, typename Enable = void>
+struct PlannedDebugAnnotationValue {
+  static constexpr bool kPlanned = false;
+};
+
+template <>
+struct PlannedDebugAnnotationValue<bool> {
+  static constexpr bool kPlanned = true;
+  static constexpr uint8_t kTag =
+      protozero::proto_utils::MakeTagVarInt(
+          protos::pbzero::DebugAnnotation::kBoolValueFieldNumber);
+
+  static uint8_t* Write(bool value, uint8_t* ptr) {
+    *ptr++ = kTag;
+    *ptr++ = value ? 1 : 0;
+    return ptr;
+  }
+};
+
+template <typename T>
+struct PlannedDebugAnnotationValue<
+    T,
+    typename std::enable_if<std::is_integral<T>::value &&
+                            !std::is_same<T, bool>::value &&
+                            std::is_signed<T>::value>::type> {
+  static constexpr bool kPlanned = true;
+  static constexpr uint8_t kTag =
+      protozero::proto_utils::MakeTagVarInt(
+          protos::pbzero::DebugAnnotation::kIntValueFieldNumber);
+
+  static uint8_t* Write(T value, uint8_t* ptr) {
+    *ptr++ = kTag;
+    return protozero::proto_utils::WriteVarInt(static_cast<int64_t>(value),
+                                               ptr);
+  }
+};
+
+template <typename T>
+struct PlannedDebugAnnotationValue<
+    T,
+    typename std::enable_if<std::is_integral<T>::value &&
+                            !std::is_same<T, bool>::value &&
+                            std::is_unsigned<T>::value>::type> {
+  static constexpr bool kPlanned = true;
+  static constexpr uint8_t kTag =
+      protozero::proto_utils::MakeTagVarInt(
+          protos::pbzero::DebugAnnotation::kUintValueFieldNumber);
+
+  static uint8_t* Write(T value, uint8_t* ptr) {
+    *ptr++ = kTag;
+    return protozero::proto_utils::WriteVarInt(static_cast<uint64_t>(value),
+                                               ptr);
+  }
+};
+
+template <typename T>
+struct PlannedDebugAnnotationValue<
+    T,
+    typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static constexpr bool kPlanned = true;
+  static constexpr uint8_t kTag =
+      protozero::proto_utils::MakeTagFixed<double>(
+          protos::pbzero::DebugAnnotation::kDoubleValueFieldNumber);
+
+  static uint8_t* Write(T value, uint8_t* ptr) {
+    // Same (little endian) layout as Message::AppendFixed().
+    double double_value = static_cast<double>(value);
+    *ptr++ = kTag;
+    memcpy(ptr, &double_value, sizeof(double_value));
+    return ptr + sizeof(double_value);
+  }
+};
+
+template <typename Name, typename Value>
+struct IsPlannedDebugAnnotation
+    : std::integral_constant<
+          bool,
+          std::is_convertible<Name, const char*>::value &&
+              PlannedDebugAnnotationValue<
+                  typename std::decay<Value>::type>::kPlanned> {};
+
+// The number of planned debug annotations at the start of |Args|.
+template <typename... Args>
+struct PlannedDebugAnnotationCount : std::integral_constant<size_t, 0> {};
+
+template <typename Name, typename Value, typename... Args>
+struct PlannedDebugAnnotationCount<Name, Value, Args...>
+    : std::integral_constant<
+          size_t,
+          IsPlannedDebugAnnotation<Name, Value>::value
+              ? 1 + PlannedDebugAnnotationCount<Args...>::value
+              : 0> {};
+
+// The encoded name_iid and value fields always fit in a one byte length, which
+// makes the annotation smaller than the nested messages written by protozero,
+// which have a redundant four bytes length.
+constexpr size_t kMaxPlannedDebugAnnotationSize =
+    2 + 2 * protozero::proto_utils::kMaxSimpleFieldEncodedSize;
+static_assert(kMaxPlannedDebugAnnotationSize - 2 < 0x80,
+              "The annotation length must fit in one byte");
+
+template <size_t N>
+struct DebugAnnotationPlan {
+  template <typename Name, typename Value, typename... Args>
+  PERFETTO_ALWAYS_INLINE static void CollectNames(const char** names,
+                                                  const Name& name,
+                                                  const Value&,
+                                                  const Args&... args) {
+    *names = name;
+    DebugAnnotationPlan<N - 1>::CollectNames(names + 1, args...);
+  }
+
+  // Encodes the first |N| debug annotations into |ptr|, then appends |buf| to
+  // the event and writes the remaining arguments.
+  template <typename Name, typename Value, typename... Args>
+  PERFETTO_ALWAYS_INLINE static void Write(EventContext event_ctx,
+                                           const uint64_t* iids,
+                                           uint8_t* buf,
+                                           uint8_t* ptr,
+                                           Name&&,
+                                           Value&& value,
+                                           Args&&... args) {
+    constexpr uint8_t kAnnotationTag =
+        protozero::proto_utils::MakeTagLengthDelimited(
+            protos::pbzero::TrackEvent::kDebugAnnotationsFieldNumber);
+    constexpr uint8_t kNameIidTag =
+        protozero::proto_utils::MakeTagVarInt(
+            protos::pbzero::DebugAnnotation::kNameIidFieldNumber);
+    *ptr++ = kAnnotationTag;
+    uint8_t* size_field = ptr++;
+    uint8_t* annotation_start = ptr;
+    *ptr++ = kNameIidTag;
+    ptr = protozero::proto_utils::WriteVarInt(*iids, ptr);
+    ptr = PlannedDebugAnnotationValue<typename std::decay<Value>::type>::Write(
+        value, ptr);
+    *size_field = static_cast<uint8_t>(ptr - annotation_start);
+    DebugAnnotationPlan<N - 1>::Write(std::move(event_ctx), iids + 1, buf, ptr,
+                                      std::forward<Args>(args)...);
+  }
+};
+
+template <>
+struct DebugAnnotationPlan<0> {
+  template <typename... Args>
+  PERFETTO_ALWAYS_INLINE static void CollectNames(const char**,
+                                                  const Args&...) {}
+
+  template <typename... Args>
+  PERFETTO_ALWAYS_INLINE static void Write(EventContext event_ctx,
+                                           const uint64_t*,
+                                           uint8_t* buf,
+                                           uint8_t* ptr,
+                                           Args&&... args) {
+    event_ctx.event()->AppendRawProtoBytes(buf,
+                                           static_cast<size_t>(ptr - buf));
+    WriteTrackEventArgs(std::move(event_ctx), std::forward<Args>(args)...);
+  }
+};
+
+// Write a run of planned debug annotations and recursively write the rest of
+// the arguments.
+template <typename ArgValue, typename... Args>
+PERFETTO_ALWAYS_INLINE void WriteDebugAnnotationArgs(std::true_type,
+                                                     EventContext event_ctx,
+                                                     const char* arg_name,
+                                                     ArgValue&& arg_value,
+                                                     Args&&... args) {
+  constexpr size_t kCount =
+      PlannedDebugAnnotationCount<const char*, ArgValue, Args...>::value;
+  const char* names[kCount];
+  uint64_t iids[kCount];
+  uint8_t buf[kCount * kMaxPlannedDebugAnnotationSize];
+  DebugAnnotationPlan<kCount>::CollectNames(names, arg_name, arg_value,
+                                            args...);
+  TrackEventInternal::InternDebugAnnotationNames(&event_ctx, names, kCount,
+                                                 iids);
+  DebugAnnotationPlan<kCount>::Write(std::move(event_ctx), iids, buf, buf,
+                                     arg_name,
+                                     std::forward<ArgValue>(arg_value),
+                                     std::forward<Args>(args)...);
+}
+
 // Write one debug annotation and recursively write the rest of the arguments.
+template <typename ArgValue, typename... Args>
+PERFETTO_ALWAYS_INLINE void WriteDebugAnnotationArgs(std::false_type,
+                                                     EventContext event_ctx,
+                                                     const char* arg_name,
+                                                     ArgValue&& arg_value,
+                                                     Args&&... args) {
+  TrackEventInternal::AddDebugAnnotation(&event_ctx, arg_name,
+                                         std::forward<ArgValue>(arg_value));
+  WriteTrackEventArgs(std::move(event_ctx), std::forward<Args>(args)...);
+}
+
 template <typename ArgValue, typename... Args>
 PERFETTO_ALWAYS_INLINE void WriteTrackEventArgs(EventContext event_ctx,
                                                 const char* arg_name,
                                                 ArgValue&& arg_value,
                                                 Args&&... args) {
-  TrackEventInternal::AddDebugAnnotation(&event_ctx, arg_name,
-                                         std::forward<ArgValue>(arg_value));
-  WriteTrackEventArgs(std::move(event_ctx), std::forward<Args>(args)...);
+  WriteDebugAnnotationArgs(
+      std::integral_constant<
+          bool, IsPlannedDebugAnnotation<const char*, ArgValue>::value>(),
+      std::move(event_ctx), arg_name, std::forward<ArgValue>(arg_value),
+      std::forward<Args>(args)...);
 }
 
 }  // namespace internal
@@ -115,6 +115,14 @@ struct TracingInitArgs {
   // callback instead of being logged directly.
   LogMessageCallback log_message_callback = nullptr;
 
+  // [Optional] If set, the shared memory buffer for the system backend is
+  // allocated by the current process rather than by the service. This allows
+  // Tracing::SetupStartupTracingBlocking() to record trace data before the
+  // connection to the service is established. The data is handed over to the
+  // service in place once it connects, without copies. Requires a version of
+  // the service which supports producer-provided buffers.
+  bool enable_startup_tracing = false;
+
  protected:
   friend class Tracing;
   friend class internal::TracingMuxerImpl;
@@ -137,6 +145,19 @@ struct TracingInitArgs {
   bool dcheck_is_on_ = PERFETTO_DCHECK_IS_ON();
 };
 
+// Options for Tracing::SetupStartupTracingBlocking().
+struct SetupStartupTracingOpts {
+  // The backend whose service is expected to adopt the startup session. Only
+  // the system backend supports startup tracing. kUnspecifiedBackend picks it
+  // if available.
+  BackendType backend = kUnspecifiedBackend;
+
+  // If the service hasn't started a tracing session which adopts the startup
+  // data sources within this time, they are stopped and the data recorded so
+  // far is discarded.
+  uint32_t timeout_ms = 10000;
+};
+
 // The entry-point for using perfetto.
 class PERFETTO_EXPORT Tracing {
  public:
@@ -177,6 +198,22 @@ class PERFETTO_EXPORT Tracing {
   static std::unique_ptr<TracingSession> NewTrace(
       BackendType = kUnspecifiedBackend);
 
+  // Starts the data sources of |config| locally, before (or while) the
+  // connection to the service is established, so that trace points hit early
+  // during the startup of the process are recorded. Requires
+  // TracingInitArgs::enable_startup_tracing. The data sources must have been
+  // registered beforehand. Returns once the data sources have started.
+  //
+  // The data is written into the shared memory buffer and kept there until the
+  // service sets up a tracing session containing data sources with the same
+  // name and config. These adopt the startup data sources, and the chunks
+  // written so far are committed to the session's buffer without copying
+  // them. All the data sources of |config| must target the same buffer. The
+  // buffer should be large enough to hold the data recorded until the service
+  // connects, as any chunk that doesn't fit is dropped.
+  static void SetupStartupTracingBlocking(const TraceConfig&,
+                                          SetupStartupTracingOpts = {});
+
  private:
   static void InitializeInternal(const TracingInitArgs&);
 
@@ -68,6 +68,14 @@ class PERFETTO_EXPORT TracingBackend {
     // the client when calling Tracing::Initialize().
     uint32_t shmem_size_hint_bytes = 0;
     uint32_t shmem_page_size_hint_bytes = 0;
+
+    // If true, the backend allocates the shared memory buffer on the producer
+    // side and hands it over to the service when connecting, rather than
+    // waiting for the service to provide one. The buffer is then usable
+    // (through ProducerEndpoint::MaybeSharedMemoryArbiter()) before the
+    // connection is established, which is what startup tracing relies on.
+    // Backends which don't support this ignore the flag.
+    bool use_producer_provided_smb = false;
   };
 
   virtual std::unique_ptr<ProducerEndpoint> ConnectProducer(
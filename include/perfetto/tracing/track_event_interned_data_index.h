@@ -22,6 +22,8 @@
 #include "perfetto/base/compiler.h"
 #include "perfetto/tracing/event_context.h"
 
+#include <stdint.h>
+
 #include <map>
 #include <type_traits>
 #include <unordered_map>
@@ -93,6 +95,72 @@ struct BigInternedDataTraits {
   };
 };
 
+namespace internal {
+
+// A direct-mapped cache of interning ids in front of the std::map of
+// SmallInternedDataTraits, so that the values used by the hottest trace points
+// (e.g. event names and categories, which are interned by pointer) are found
+// with a multiplicative hash and a single comparison. Like the index, it is
+// part of the incremental state of the sequence, hence it is per thread and
+// starts empty whenever the incremental state is cleared.
+// Only enabled for pointers and integers, the other types have no cache.
+template <typename ValueType, typename Enable = void>
+class InternedDataCache {
+ public:
+  bool Find(const ValueType&, size_t*) const { return false; }
+  void Insert(const ValueType&, size_t) {}
+};
+
+template <typename ValueType>
+class InternedDataCache<
+    ValueType,
+    typename std::enable_if<std::is_pointer<ValueType>::value ||
+                            std::is_integral<ValueType>::value>::type> {
+ public:
+  bool Find(const ValueType& value, size_t* iid) const {
+    const Entry& entry = entries_[GetSlot(value)];
+    if (entry.iid && entry.value == value) {
+      *iid = entry.iid;
+      return true;
+    }
+    return false;
+  }
+
+  void Insert(const ValueType& value, size_t iid) {
+    Entry& entry = entries_[GetSlot(value)];
+    entry.value = value;
+    entry.iid = iid;
+  }
+
+ private:
+  static constexpr size_t kSizeLog2 = 4;
+
+  struct Entry {
+    ValueType value;
+    size_t iid;  // 0 for empty entries, interning ids start from 1.
+  };
+
+  template <typename T>
+  static uint64_t ToKey(T* value) {
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value));
+  }
+  template <typename T>
+  static uint64_t ToKey(T value) {
+    return static_cast<uint64_t>(value);
+  }
+
+  static size_t GetSlot(const ValueType& value) {
+    // Fibonacci hashing, which uses the high bits of the product and hence
+    // spreads pointers with the same alignment.
+    return static_cast<size_t>((ToKey(value) * 0x9E3779B97F4A7C15ull) >>
+                               (64 - kSizeLog2));
+  }
+
+  Entry entries_[1 << kSizeLog2]{};
+};
+
+}  // namespace internal
+
 // This type of interning index keeps full copies of interned data without
 // hashing the values. This is a good fit for small types that can be directly
 // used as index keys.
@@ -101,18 +169,19 @@ struct SmallInternedDataTraits {
   class Index {
    public:
     bool LookUpOrInsert(size_t* iid, const ValueType& value) {
+      if (PERFETTO_LIKELY(cache_.Find(value, iid)))
+        return true;
       size_t next_id = data_.size() + 1;
       auto it_and_inserted = data_.insert(std::make_pair(value, next_id));
-      if (!it_and_inserted.second) {
-        *iid = it_and_inserted.first->second;
-        return true;
-      }
-      *iid = next_id;
-      return false;
+      bool found = !it_and_inserted.second;
+      *iid = found ? it_and_inserted.first->second : next_id;
+      cache_.Insert(value, *iid);
+      return found;
     }
 
    private:
     std::map<ValueType, size_t> data_;
+    internal::InternedDataCache<ValueType> cache_;
   };
 };
 
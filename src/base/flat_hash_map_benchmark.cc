@@ -0,0 +1,156 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+
+namespace {
+
+// Keys of the shapes found in the trace importers and in heapprofd, with a
+// given number of distinct values, looked up in random order.
+template <typename Key>
+struct KeyTraits;
+
+// Tids as seen in a sched-heavy trace: small values in the 32-bit range.
+template <>
+struct KeyTraits<uint32_t> {
+  static uint32_t Make(uint32_t rand) { return rand % 100000; }
+};
+
+// Allocation addresses and PCs: 64-bit, aligned, with the same top bits.
+template <>
+struct KeyTraits<uint64_t> {
+  static uint64_t Make(uint32_t rand) {
+    return 0x7f0000000000ull + (static_cast<uint64_t>(rand) << 4);
+  }
+};
+
+// Event names and other strings not interned in a StringPool.
+template <>
+struct KeyTraits<std::string> {
+  static std::string Make(uint32_t rand) {
+    return "android.event." + std::to_string(rand);
+  }
+};
+
+template <typename Key>
+std::vector<Key> GetRandKeys(size_t num_keys, uint32_t num_distinct) {
+  std::minstd_rand0 rng(0);
+  std::vector<Key> distinct;
+  for (uint32_t i = 0; i < num_distinct; i++)
+    distinct.push_back(KeyTraits<Key>::Make(static_cast<uint32_t>(rng())));
+  std::vector<Key> keys;
+  for (size_t i = 0; i < num_keys; i++)
+    keys.push_back(distinct[rng() % num_distinct]);
+  return keys;
+}
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(64);
+  } else {
+    b->RangeMultiplier(4)->Range(64, 16384);
+  }
+}
+
+// Adapts the std containers and FlatHashMap to the same interface.
+template <typename Map>
+struct MapOps {
+  template <typename Key>
+  static uint32_t* Find(Map& map, const Key& key) {
+    auto it = map.find(key);
+    return it == map.end() ? nullptr : &it->second;
+  }
+  template <typename Key>
+  static void Insert(Map& map, const Key& key, uint32_t value) {
+    map.emplace(key, value);
+  }
+  template <typename Key>
+  static void Erase(Map& map, const Key& key) {
+    map.erase(key);
+  }
+};
+
+template <typename Key>
+struct MapOps<perfetto::base::FlatHashMap<Key, uint32_t>> {
+  using Map = perfetto::base::FlatHashMap<Key, uint32_t>;
+  static uint32_t* Find(Map& map, const Key& key) { return map.Find(key); }
+  static void Insert(Map& map, const Key& key, uint32_t value) {
+    map.Insert(key, value);
+  }
+  static void Erase(Map& map, const Key& key) { map.Erase(key); }
+};
+
+}  // namespace
+
+// Models the get-or-insert pattern of the trace importers (e.g. tid -> utid).
+template <typename MapType, typename Key>
+static void BM_MapFindOrInsert(benchmark::State& state) {
+  std::vector<Key> keys =
+      GetRandKeys<Key>(1 << 16, static_cast<uint32_t>(state.range(0)));
+  MapType map;
+  size_t i = 0;
+  for (auto _ : state) {
+    const Key& key = keys[i++ & (keys.size() - 1)];
+    uint32_t* value = MapOps<MapType>::Find(map, key);
+    if (!value)
+      MapOps<MapType>::Insert(map, key, static_cast<uint32_t>(i));
+    benchmark::DoNotOptimize(value);
+  }
+}
+
+// Models short-lived entries (e.g. live allocations in heapprofd, pending
+// binder transactions): half of the operations insert, the others erase.
+template <typename MapType, typename Key>
+static void BM_MapInsertErase(benchmark::State& state) {
+  std::vector<Key> keys =
+      GetRandKeys<Key>(1 << 16, static_cast<uint32_t>(state.range(0)));
+  MapType map;
+  size_t i = 0;
+  for (auto _ : state) {
+    const Key& key = keys[i++ & (keys.size() - 1)];
+    if (i & 1)
+      MapOps<MapType>::Insert(map, key, static_cast<uint32_t>(i));
+    else
+      MapOps<MapType>::Erase(map, key);
+  }
+  benchmark::DoNotOptimize(map);
+}
+
+using perfetto::base::FlatHashMap;
+
+#define PERFETTO_MAP_BENCHMARKS(BM, KEY)                                 \
+  BENCHMARK_TEMPLATE(BM, FlatHashMap<KEY, uint32_t>, KEY)                \
+      ->Apply(BenchmarkArgs);                                            \
+  BENCHMARK_TEMPLATE(BM, std::map<KEY, uint32_t>, KEY)                   \
+      ->Apply(BenchmarkArgs);                                            \
+  BENCHMARK_TEMPLATE(BM, std::unordered_map<KEY, uint32_t>, KEY)         \
+      ->Apply(BenchmarkArgs)
+
+PERFETTO_MAP_BENCHMARKS(BM_MapFindOrInsert, uint32_t);
+PERFETTO_MAP_BENCHMARKS(BM_MapFindOrInsert, uint64_t);
+PERFETTO_MAP_BENCHMARKS(BM_MapFindOrInsert, std::string);
+PERFETTO_MAP_BENCHMARKS(BM_MapInsertErase, uint32_t);
+PERFETTO_MAP_BENCHMARKS(BM_MapInsertErase, uint64_t);
+PERFETTO_MAP_BENCHMARKS(BM_MapInsertErase, std::string);
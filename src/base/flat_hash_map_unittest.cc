@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/flat_hash_map.h"
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+TEST(FlatHashMapTest, InsertAndLookup) {
+  FlatHashMap<int, std::string> map;
+  EXPECT_EQ(map.size(), 0u);
+  EXPECT_EQ(map.Find(1), nullptr);
+
+  auto res = map.Insert(1, "a");
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(*res.first, "a");
+  EXPECT_EQ(map.size(), 1u);
+
+  // Inserting an existing key doesn't replace its value.
+  res = map.Insert(1, "b");
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(*res.first, "a");
+  EXPECT_EQ(map.size(), 1u);
+
+  map[2] = "c";
+  EXPECT_EQ(*map.Find(2), "c");
+  EXPECT_EQ(map[3], "");
+  EXPECT_EQ(map.size(), 3u);
+}
+
+TEST(FlatHashMapTest, Erase) {
+  FlatHashMap<int, int> map;
+  for (int i = 0; i < 100; i++)
+    map.Insert(i, i * 10);
+  for (int i = 0; i < 100; i += 2)
+    EXPECT_TRUE(map.Erase(i));
+  EXPECT_FALSE(map.Erase(0));
+  EXPECT_EQ(map.size(), 50u);
+  for (int i = 0; i < 100; i++) {
+    if (i % 2)
+      EXPECT_EQ(*map.Find(i), i * 10);
+    else
+      EXPECT_EQ(map.Find(i), nullptr);
+  }
+
+  // The erased keys can be inserted again.
+  EXPECT_TRUE(map.Insert(0, 42).second);
+  EXPECT_EQ(*map.Find(0), 42);
+}
+
+TEST(FlatHashMapTest, Iterate) {
+  FlatHashMap<uint32_t, uint32_t> map;
+  for (uint32_t i = 0; i < 1000; i++)
+    map.Insert(i * 64, i);
+  map.Erase(0);
+
+  std::map<uint32_t, uint32_t> seen;
+  for (auto it = map.GetIterator(); it; ++it)
+    seen[it.key()] = it.value();
+  EXPECT_EQ(seen.size(), 999u);
+  for (const auto& kv : seen)
+    EXPECT_EQ(kv.first, kv.second * 64);
+}
+
+TEST(FlatHashMapTest, NonTrivialTypes) {
+  FlatHashMap<std::string, std::unique_ptr<int>> map;
+  for (int i = 0; i < 100; i++)
+    map.Insert(std::to_string(i), std::unique_ptr<int>(new int(i)));
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(**map.Find(std::to_string(i)), i);
+
+  FlatHashMap<std::string, std::unique_ptr<int>> moved = std::move(map);
+  EXPECT_EQ(moved.size(), 100u);
+  EXPECT_EQ(**moved.Find("42"), 42);
+  moved.Clear();
+  EXPECT_EQ(moved.size(), 0u);
+  EXPECT_EQ(moved.Find("42"), nullptr);
+}
+
+// Erasing an entry moves back the colliding entries that follow it.
+TEST(FlatHashMapTest, EraseWithCollisions) {
+  // All the keys have the same home slot.
+  struct CollidingHash {
+    size_t operator()(uint32_t) const { return 15; }
+  };
+  FlatHashMap<uint32_t, uint32_t, CollidingHash> map;
+  for (uint32_t i = 0; i < 10; i++)
+    map.Insert(i, i);
+  for (uint32_t i = 0; i < 10; i += 3) {
+    EXPECT_TRUE(map.Erase(i));
+    for (uint32_t j = 0; j < 10; j++) {
+      if (j <= i && j % 3 == 0)
+        EXPECT_EQ(map.Find(j), nullptr);
+      else
+        EXPECT_EQ(*map.Find(j), j);
+    }
+  }
+  EXPECT_EQ(map.size(), 6u);
+}
+
+// Probe sequences longer than a group of tags, which wrap around the end of
+// the slots, and the cloned tags of the first slots being kept up to date.
+TEST(FlatHashMapTest, LongProbeSequences) {
+  struct CollidingHash {
+    size_t operator()(uint32_t key) const { return key % 2; }
+  };
+  FlatHashMap<uint32_t, uint32_t, CollidingHash> map;
+  for (uint32_t i = 0; i < 100; i++)
+    map.Insert(i, i);
+  for (uint32_t i = 0; i < 100; i += 7)
+    EXPECT_TRUE(map.Erase(i));
+  for (uint32_t i = 0; i < 100; i++) {
+    if (i % 7 == 0)
+      EXPECT_EQ(map.Find(i), nullptr);
+    else
+      EXPECT_EQ(*map.Find(i), i);
+  }
+  EXPECT_EQ(map.Find(100), nullptr);
+  EXPECT_EQ(map.Find(101), nullptr);
+}
+
+// Checks random inserts and erases against std::map, including the backward
+// shifts of erases and the rehashes.
+TEST(FlatHashMapTest, RandomOperations) {
+  std::minstd_rand0 rng(0);
+  FlatHashMap<uint32_t, uint32_t> map;
+  std::map<uint32_t, uint32_t> ref;
+  for (uint32_t i = 0; i < 100000; i++) {
+    uint32_t key = static_cast<uint32_t>(rng()) % 2048;
+    if (rng() % 3 == 0) {
+      EXPECT_EQ(map.Erase(key), ref.erase(key) == 1);
+    } else {
+      EXPECT_EQ(map.Insert(key, i).second, ref.emplace(key, i).second);
+    }
+    ASSERT_EQ(map.size(), ref.size());
+  }
+  for (uint32_t key = 0; key < 2048; key++) {
+    auto it = ref.find(key);
+    uint32_t* value = map.Find(key);
+    if (it == ref.end()) {
+      EXPECT_EQ(value, nullptr);
+    } else {
+      ASSERT_NE(value, nullptr);
+      EXPECT_EQ(*value, it->second);
+    }
+  }
+  // The erases must not make the map grow forever.
+  EXPECT_LE(map.capacity(), 8192u);
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -29,8 +29,9 @@ std::atomic<uint32_t> g_enabled_tags{0};
 std::atomic<uint64_t> g_enabled_timestamp{0};
 
 // static members
-constexpr size_t RingBuffer::kCapacity;
-std::array<Record, RingBuffer::kCapacity> RingBuffer::records_;
+std::atomic<Record*> RingBuffer::records_;
+std::atomic<size_t> RingBuffer::capacity_;
+size_t RingBuffer::allocated_capacity_;
 std::atomic<bool> RingBuffer::read_task_queued_;
 std::atomic<uint64_t> RingBuffer::wr_index_;
 std::atomic<uint64_t> RingBuffer::rd_index_;
@@ -59,7 +60,8 @@ struct Delegate {
 
 bool Enable(std::function<void()> read_task,
             base::TaskRunner* task_runner,
-            uint32_t tags) {
+            uint32_t tags,
+            size_t capacity) {
   PERFETTO_DCHECK(read_task);
   PERFETTO_DCHECK(task_runner->RunsTasksOnCurrentThread());
   if (g_enabled_tags.load(std::memory_order_acquire))
@@ -68,7 +70,7 @@ bool Enable(std::function<void()> read_task,
   Delegate* dg = Delegate::GetInstance();
   dg->task_runner = task_runner;
   dg->read_task = std::move(read_task);
-  RingBuffer::Reset();
+  RingBuffer::Reset(capacity);
   g_enabled_timestamp.store(TraceTimeNowNs(), std::memory_order_relaxed);
   g_enabled_tags.store(tags, std::memory_order_release);
   return true;
@@ -84,10 +86,20 @@ void Disable() {
 }
 
 // static
-void RingBuffer::Reset() {
+void RingBuffer::Reset(size_t capacity) {
+  // Doesn't really have to be pow2, but if not the writers would have to
+  // compute a modulo instead of a bitwise AND.
+  PERFETTO_CHECK(capacity >= 2 && !(capacity & (capacity - 1)));
   bankruptcy_record_.clear();
-  for (Record& record : records_)
-    record.clear();
+  if (capacity > allocated_capacity_) {
+    // The previous array, if any, is leaked. See the comment on RingBuffer.
+    records_.store(new Record[capacity], std::memory_order_relaxed);
+    allocated_capacity_ = capacity;
+  }
+  Record* records = records_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < capacity; i++)
+    records[i].clear();
+  capacity_.store(capacity, std::memory_order_release);
   wr_index_ = 0;
   rd_index_ = 0;
   has_overruns_ = false;
@@ -104,7 +116,8 @@ Record* RingBuffer::AppendNewRecord() {
 
   PERFETTO_DCHECK(wr_index >= rd_index);
   auto size = wr_index - rd_index;
-  if (PERFETTO_LIKELY(size < kCapacity / 2))
+  auto capacity = capacity_.load(std::memory_order_relaxed);
+  if (PERFETTO_LIKELY(size < capacity / 2))
     return At(wr_index);
 
   // Slow-path: Enqueue the read task and handle overruns.
@@ -122,7 +135,7 @@ Record* RingBuffer::AppendNewRecord() {
     }
   }
 
-  if (PERFETTO_LIKELY(size < kCapacity))
+  if (PERFETTO_LIKELY(size < capacity))
     return At(wr_index);
 
   has_overruns_.store(true, std::memory_order_release);
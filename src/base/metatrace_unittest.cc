@@ -40,8 +40,9 @@ class MetatraceTest : public ::testing::Test {
     m::Disable();
   }
 
-  void Enable(uint32_t tags) {
-    m::Enable([this] { ReadCallback(); }, &task_runner_, tags);
+  void Enable(uint32_t tags,
+              size_t capacity = m::kDefaultRingBufferCapacity) {
+    m::Enable([this] { ReadCallback(); }, &task_runner_, tags, capacity);
   }
 
   MOCK_METHOD0(ReadCallback, void());
@@ -140,16 +141,16 @@ TEST_F(MetatraceTest, HandleOverruns) {
     auto checkpoint = task_runner_.CreateCheckpoint(checkpoint_name);
     EXPECT_CALL(*this, ReadCallback()).WillOnce(Invoke(checkpoint));
 
-    for (size_t i = 0; i < m::RingBuffer::kCapacity; i++)
+    for (size_t i = 0; i < m::RingBuffer::capacity(); i++)
       m::TraceCounter(/*tag=*/1, /*id=*/42, /*value=*/cnt++);
-    ASSERT_EQ(m::RingBuffer::GetSizeForTesting(), m::RingBuffer::kCapacity);
+    ASSERT_EQ(m::RingBuffer::GetSizeForTesting(), m::RingBuffer::capacity());
     ASSERT_FALSE(m::RingBuffer::has_overruns());
 
     for (int n = 0; n < 3; n++)
       m::TraceCounter(/*tag=*/1, /*id=*/42, /*value=*/-1);  // Will overrun.
 
     ASSERT_TRUE(m::RingBuffer::has_overruns());
-    ASSERT_EQ(m::RingBuffer::GetSizeForTesting(), m::RingBuffer::kCapacity);
+    ASSERT_EQ(m::RingBuffer::GetSizeForTesting(), m::RingBuffer::capacity());
 
     for (auto it = m::RingBuffer::GetReadIterator(); it; ++it)
       ASSERT_EQ(it->counter_value, exp_cnt++);
@@ -161,12 +162,35 @@ TEST_F(MetatraceTest, HandleOverruns) {
   }
 }
 
+// Test that the capacity passed to Enable() is honored, also when growing or
+// shrinking the ring buffer across sessions.
+TEST_F(MetatraceTest, Capacity) {
+  EXPECT_CALL(*this, ReadCallback()).Times(testing::AnyNumber());
+  for (size_t capacity : {1024u, 4 * 1024u, 1024u}) {
+    Enable(m::TAG_ANY, capacity);
+    ASSERT_EQ(m::RingBuffer::capacity(), capacity);
+    for (size_t i = 0; i < capacity; i++)
+      m::TraceCounter(/*tag=*/1, /*id=*/1, static_cast<int>(i));
+    ASSERT_FALSE(m::RingBuffer::has_overruns());
+    m::TraceCounter(/*tag=*/1, /*id=*/1, -1);  // Will overrun.
+    ASSERT_TRUE(m::RingBuffer::has_overruns());
+
+    int expected = 0;
+    for (auto it = m::RingBuffer::GetReadIterator(); it; ++it)
+      ASSERT_EQ(it->counter_value, expected++);
+    ASSERT_EQ(static_cast<size_t>(expected), capacity);
+
+    task_runner_.RunUntilIdle();
+    m::Disable();
+  }
+}
+
 // Sets up a scenario where the writer writes constantly (however, guaranteeing
 // to not overrun) and the reader catches up. Tests that all events are seen
 // consistently without gaps.
 TEST_F(MetatraceTest, InterleavedReadWrites) {
   Enable(m::TAG_ANY);
-  constexpr int kMaxValue = m::RingBuffer::kCapacity * 3;
+  const int kMaxValue = static_cast<int>(m::RingBuffer::capacity()) * 3;
 
   std::atomic<int> last_value_read{-1};
   auto read_task = [&last_value_read] {
@@ -192,10 +216,10 @@ TEST_F(MetatraceTest, InterleavedReadWrites) {
 
   // The writer will write continuously counters from 0 to kMaxValue.
   auto writer_done = task_runner_.CreateCheckpoint("writer_done");
-  std::thread writer_thread([this, &writer_done, &last_value_read] {
+  std::thread writer_thread([this, &writer_done, &last_value_read, kMaxValue] {
     for (int i = 0; i < kMaxValue; i++) {
       m::TraceCounter(/*tag=*/1, /*id=*/1, i);
-      const int kCapacity = static_cast<int>(m::RingBuffer::kCapacity);
+      const int kCapacity = static_cast<int>(m::RingBuffer::capacity());
 
       // Wait for the reader to avoid overruns.
       // Using memory_order_relaxed because the QEMU arm emulator seems to incur
@@ -230,7 +254,7 @@ TEST_F(MetatraceTest, ThreadRaces) {
     EXPECT_CALL(*this, ReadCallback()).WillOnce(Invoke(checkpoint));
 
     auto thread_main = [](uint16_t thd_idx) {
-      for (size_t i = 0; i < m::RingBuffer::kCapacity + 500; i++)
+      for (size_t i = 0; i < m::RingBuffer::capacity() + 500; i++)
         m::TraceCounter(/*tag=*/1, thd_idx, static_cast<int>(i));
     };
 
@@ -243,7 +267,7 @@ TEST_F(MetatraceTest, ThreadRaces) {
       t.join();
 
     task_runner_.RunUntilCheckpoint(checkpoint_name);
-    ASSERT_EQ(m::RingBuffer::GetSizeForTesting(), m::RingBuffer::kCapacity);
+    ASSERT_EQ(m::RingBuffer::GetSizeForTesting(), m::RingBuffer::capacity());
 
     std::array<int, kNumThreads> last_val{};  // Last value for each thread.
     for (auto it = m::RingBuffer::GetReadIterator(); it; ++it) {
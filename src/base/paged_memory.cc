@@ -25,6 +25,12 @@
 #include <sys/mman.h>
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/container_annotations.h"
 #include "perfetto/ext/base/utils.h"
@@ -70,6 +76,13 @@ PagedMemory PagedMemory::Allocate(size_t req_size, int flags) {
   int res = mprotect(ptr, GuardSize(), PROT_NONE);
   res |= mprotect(usable_region + rounded_up_size, GuardSize(), PROT_NONE);
   PERFETTO_CHECK(res == 0);
+#if defined(MADV_HUGEPAGE)
+  if (flags & kHugePages) {
+    // Can fail with EINVAL if the kernel is built without THP. This is fine,
+    // the memory is just backed by normal pages.
+    madvise(usable_region, rounded_up_size, MADV_HUGEPAGE);
+  }
+#endif
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
   auto memory = PagedMemory(usable_region, req_size);
@@ -135,6 +148,27 @@ bool PagedMemory::AdviseDontNeed(void* p, size_t size) {
         // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
 }
 
+bool PagedMemory::AdvisePreferredNumaNode(uint32_t node) {
+  PERFETTO_DCHECK(p_);
+#if (PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
+     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)) && \
+    defined(__NR_mbind)
+  // There is no libc wrapper for mbind(), see
+  // http://man7.org/linux/man-pages/man2/mbind.2.html
+  constexpr int kMpolPreferred = 1;  // MPOL_PREFERRED from <linux/mempolicy.h>
+  constexpr uint32_t kBitsPerWord = sizeof(unsigned long) * 8;
+  if (node >= kBitsPerWord)
+    return false;
+  unsigned long node_mask = 1ul << node;
+  long res = syscall(__NR_mbind, p_, RoundUpToSysPageSize(size_),
+                     kMpolPreferred, &node_mask, kBitsPerWord + 1, 0);
+  return res == 0;
+#else
+  base::ignore_result(node);
+  return false;
+#endif
+}
+
 #if TRACK_COMMITTED_SIZE()
 void PagedMemory::EnsureCommitted(size_t committed_size) {
   PERFETTO_DCHECK(committed_size > 0u);
@@ -17,6 +17,7 @@
 #include "perfetto/ext/base/paged_memory.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/utils.h"
@@ -180,6 +181,22 @@ TEST(PagedMemoryTest, GuardRegions) {
   EXPECT_DEATH_IF_SUPPORTED({ raw[kSize] = 'x'; }, ".*");
 }
 
+// The huge page and NUMA hints may be ignored by the kernel but must not
+// change the behavior of the memory.
+TEST(PagedMemoryTest, HugePagesAndNumaHints) {
+  const size_t kSize = 4 * 1024 * 1024;
+  PagedMemory mem = PagedMemory::Allocate(
+      kSize, PagedMemory::kHugePages | PagedMemory::kDontCommit);
+  ASSERT_TRUE(mem.IsValid());
+  mem.AdvisePreferredNumaNode(0);
+  mem.EnsureCommitted(kSize);
+  char* ptr = reinterpret_cast<char*>(mem.Get());
+  for (size_t i = 0; i < kSize; i++)
+    ASSERT_EQ(0, ptr[i]);
+  memset(ptr, 'x', kSize);
+  ASSERT_EQ('x', ptr[kSize - 1]);
+}
+
 // Disable this on:
 // MacOS: because it doesn't seem to have an equivalent rlimit to bound mmap().
 // Fuchsia: doesn't support rlimit.
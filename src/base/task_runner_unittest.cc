@@ -19,6 +19,7 @@
 #include "perfetto/ext/base/unix_task_runner.h"
 
 #include <thread>
+#include <vector>
 
 #include "perfetto/ext/base/event_fd.h"
 #include "perfetto/ext/base/file_utils.h"
@@ -96,6 +97,33 @@ TEST_F(TaskRunnerTest, PostImmediateTaskFromOtherThread) {
   EXPECT_EQ(0x1234, counter);
 }
 
+TEST_F(TaskRunnerTest, PostImmediateTaskFromManyThreads) {
+  auto& task_runner = this->task_runner;
+  static constexpr int kNumThreads = 8;
+  static constexpr int kNumTasksPerThread = 1000;
+  int last_task[kNumThreads]{};
+  int num_tasks = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&task_runner, &last_task, &num_tasks, i] {
+      for (int j = 1; j <= kNumTasksPerThread; j++) {
+        task_runner.PostTask([&task_runner, &last_task, &num_tasks, i, j] {
+          // The tasks posted by a thread run in order.
+          EXPECT_EQ(last_task[i] + 1, j);
+          last_task[i] = j;
+          if (++num_tasks == kNumThreads * kNumTasksPerThread)
+            task_runner.Quit();
+        });
+      }
+    });
+  }
+  task_runner.Run();
+  for (auto& thread : threads)
+    thread.join();
+  for (int i = 0; i < kNumThreads; i++)
+    EXPECT_EQ(last_task[i], kNumTasksPerThread);
+}
+
 TEST_F(TaskRunnerTest, PostDelayedTaskFromOtherThread) {
   auto& task_runner = this->task_runner;
   std::thread thread([&task_runner] {
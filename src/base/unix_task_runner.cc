@@ -36,14 +36,48 @@
 namespace perfetto {
 namespace base {
 
-UnixTaskRunner::UnixTaskRunner() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+namespace {
+
+// Max number of fds reported by a single epoll_wait(). Any other ready fd is
+// reported by the next one.
+constexpr size_t kMaxEpollEvents = 64;
+
+void EpollCtl(int epoll_fd, int op, int fd, uint32_t events) {
+  struct epoll_event event {};
+  event.events = events;
+  event.data.fd = fd;
+  // This fails only if |fd| has been closed before removing its watch.
+  if (epoll_ctl(epoll_fd, op, fd, &event) != 0)
+    PERFETTO_DPLOG("epoll_ctl(%d) failed for fd %d", op, fd);
+}
+
+}  // namespace
+#endif
+
+UnixTaskRunner::UnixTaskRunner()
+    : immediate_tasks_head_(new ImmediateTask()),
+      immediate_tasks_tail_(immediate_tasks_head_.load()) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  epoll_fd_.reset(epoll_create1(EPOLL_CLOEXEC));
+  PERFETTO_CHECK(epoll_fd_);
+  epoll_events_.resize(kMaxEpollEvents);
+#endif
   AddFileDescriptorWatch(event_.fd(), [] {
     // Not reached -- see PostFileDescriptorWatches().
     PERFETTO_DFATAL("Should be unreachable.");
   });
 }
 
-UnixTaskRunner::~UnixTaskRunner() = default;
+UnixTaskRunner::~UnixTaskRunner() {
+  while (immediate_tasks_tail_) {
+    ImmediateTask* next = immediate_tasks_tail_->next.load();
+    delete immediate_tasks_tail_;
+    immediate_tasks_tail_ = next;
+  }
+}
 
 void UnixTaskRunner::WakeUp() {
   event_.Notify();
@@ -60,7 +94,18 @@ void UnixTaskRunner::Run() {
       if (quit_)
         return;
       poll_timeout_ms = GetDelayMsToNextTaskLocked();
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
       UpdateWatchTasksLocked();
+#endif
+    }
+
+    // From now on PostTask() wakes us up. Check again for the tasks which
+    // were posted before it could see that.
+    if (poll_timeout_ms != 0) {
+      sleeping_.store(true);
+      if (HasImmediateTasks())
+        poll_timeout_ms = 0;
     }
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -76,12 +121,20 @@ void UnixTaskRunner::Run() {
     // WaitForSingleObject() for the one handle that WaitForMultipleObject()
     // returned.
     PostFileDescriptorWatches(ret);
+#elif PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+    int ret = PERFETTO_EINTR(epoll_wait(*epoll_fd_, epoll_events_.data(),
+                                        static_cast<int>(epoll_events_.size()),
+                                        poll_timeout_ms));
+    PERFETTO_CHECK(ret >= 0);
+    PostFileDescriptorWatches(static_cast<uint64_t>(ret));
 #else
     int ret = PERFETTO_EINTR(poll(
         &poll_fds_[0], static_cast<nfds_t>(poll_fds_.size()), poll_timeout_ms));
     PERFETTO_CHECK(ret >= 0);
     PostFileDescriptorWatches(0 /*ignored*/);
 #endif
+    sleeping_.store(false, std::memory_order_relaxed);
 
     // To avoid starvation we always interleave all types of tasks -- immediate,
     // delayed and file descriptor watches.
@@ -101,10 +154,28 @@ bool UnixTaskRunner::QuitCalled() {
 }
 
 bool UnixTaskRunner::IsIdleForTesting() {
-  std::lock_guard<std::mutex> lock(lock_);
-  return immediate_tasks_.empty();
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  return !HasImmediateTasks();
+}
+
+bool UnixTaskRunner::HasImmediateTasks() const {
+  return immediate_tasks_tail_->next.load() != nullptr;
 }
 
+std::function<void()> UnixTaskRunner::PopImmediateTask() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  ImmediateTask* tail = immediate_tasks_tail_;
+  ImmediateTask* next = tail->next.load(std::memory_order_acquire);
+  if (!next)
+    return nullptr;
+  // |next| becomes the new stub node.
+  immediate_tasks_tail_ = next;
+  delete tail;
+  return std::move(next->callback);
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
 void UnixTaskRunner::UpdateWatchTasksLocked() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -125,18 +196,14 @@ void UnixTaskRunner::UpdateWatchTasksLocked() {
 #endif
   }
 }
+#endif
 
 void UnixTaskRunner::RunImmediateAndDelayedTask() {
-  // If locking overhead becomes an issue, add a separate work queue.
-  std::function<void()> immediate_task;
+  std::function<void()> immediate_task = PopImmediateTask();
   std::function<void()> delayed_task;
   TimeMillis now = GetWallTimeMs();
   {
     std::lock_guard<std::mutex> lock(lock_);
-    if (!immediate_tasks_.empty()) {
-      immediate_task = std::move(immediate_tasks_.front());
-      immediate_tasks_.pop_front();
-    }
     if (!delayed_tasks_.empty()) {
       auto it = delayed_tasks_.begin();
       if (now >= it->first) {
@@ -154,6 +221,28 @@ void UnixTaskRunner::RunImmediateAndDelayedTask() {
     RunTaskWithWatchdogGuard(delayed_task);
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+void UnixTaskRunner::PostFileDescriptorWatches(uint64_t wait_result) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // |wait_result| is the number of events returned by epoll_wait().
+  for (size_t i = 0; i < wait_result; i++) {
+    const PlatformHandle handle = epoll_events_[i].data.fd;
+
+    // The wake-up event is handled inline to avoid an infinite recursion of
+    // posted tasks.
+    if (handle == event_.fd()) {
+      event_.Clear();
+      continue;
+    }
+
+    // Binding to |this| is safe since we are the only object executing the
+    // task. There is no need to flag the task as pending: EPOLLONESHOT has
+    // disabled the fd until RunFileDescriptorWatch() re-arms it.
+    PostTask(std::bind(&UnixTaskRunner::RunFileDescriptorWatch, this, handle));
+  }
+}
+#else
 void UnixTaskRunner::PostFileDescriptorWatches(uint64_t windows_wait_result) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   for (size_t i = 0; i < poll_fds_.size(); i++) {
@@ -202,6 +291,7 @@ void UnixTaskRunner::PostFileDescriptorWatches(uint64_t windows_wait_result) {
 #endif
   }
 }
+#endif
 
 void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
   std::function<void()> task;
@@ -212,6 +302,13 @@ void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
       return;
     WatchTask& watch_task = it->second;
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+    // Make epoll pay attention to the fd again. If the watch has been replaced
+    // in the meantime, this is a no-op as the new one is already armed.
+    EpollCtl(*epoll_fd_, EPOLL_CTL_MOD, fd,
+             EPOLLIN | EPOLLHUP | EPOLLONESHOT);
+#else
     // Make poll(2) pay attention to the fd again. Since another thread may have
     // updated this watch we need to refresh the set first.
     UpdateWatchTasksLocked();
@@ -228,6 +325,7 @@ void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
     PERFETTO_DCHECK(::abs(poll_fds_[fd_index].fd) == fd);
     poll_fds_[fd_index].fd = fd;
 #endif
+#endif  // !PERFETTO_OS_LINUX && !PERFETTO_OS_ANDROID
     task = watch_task.callback;
   }
   errno = 0;
@@ -236,7 +334,7 @@ void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
 
 int UnixTaskRunner::GetDelayMsToNextTaskLocked() const {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  if (!immediate_tasks_.empty())
+  if (HasImmediateTasks())
     return 0;
   if (!delayed_tasks_.empty()) {
     TimeMillis diff = delayed_tasks_.begin()->first - GetWallTimeMs();
@@ -246,13 +344,13 @@ int UnixTaskRunner::GetDelayMsToNextTaskLocked() const {
 }
 
 void UnixTaskRunner::PostTask(std::function<void()> task) {
-  bool was_empty;
-  {
-    std::lock_guard<std::mutex> lock(lock_);
-    was_empty = immediate_tasks_.empty();
-    immediate_tasks_.push_back(std::move(task));
-  }
-  if (was_empty)
+  ImmediateTask* node = new ImmediateTask();
+  node->callback = std::move(task);
+  ImmediateTask* prev = immediate_tasks_head_.exchange(node);
+  // Until this store the task runner can't see |node|, nor the tasks posted
+  // after it by other threads. Their wake-ups are taken care of by this one.
+  prev->next.store(node);
+  if (sleeping_.exchange(false))
     WakeUp();
 }
 
@@ -274,6 +372,17 @@ void UnixTaskRunner::AddFileDescriptorWatch(PlatformHandle fd,
     PERFETTO_DCHECK(!watch_tasks_.count(fd));
     WatchTask& watch_task = watch_tasks_[fd];
     watch_task.callback = std::move(task);
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+    // The wake-up event is drained inline rather than by a task, hence it
+    // doesn't need to be disabled once reported.
+    uint32_t events = EPOLLIN | EPOLLHUP;
+    if (fd != event_.fd())
+      events |= EPOLLONESHOT;
+    EpollCtl(*epoll_fd_, EPOLL_CTL_ADD, fd, events);
+  }
+  // No need to schedule a wake-up, epoll_wait() picks up the new fd.
+#else
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     watch_task.pending = false;
 #else
@@ -282,6 +391,7 @@ void UnixTaskRunner::AddFileDescriptorWatch(PlatformHandle fd,
     watch_tasks_changed_ = true;
   }
   WakeUp();
+#endif
 }
 
 void UnixTaskRunner::RemoveFileDescriptorWatch(PlatformHandle fd) {
@@ -290,7 +400,12 @@ void UnixTaskRunner::RemoveFileDescriptorWatch(PlatformHandle fd) {
     std::lock_guard<std::mutex> lock(lock_);
     PERFETTO_DCHECK(watch_tasks_.count(fd));
     watch_tasks_.erase(fd);
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+    EpollCtl(*epoll_fd_, EPOLL_CTL_DEL, fd, 0);
+#else
     watch_tasks_changed_ = true;
+#endif
   }
   // No need to schedule a wake-up for this.
 }
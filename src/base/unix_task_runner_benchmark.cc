@@ -0,0 +1,90 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/event_fd.h"
+#include "perfetto/ext/base/pipe.h"
+#include "perfetto/ext/base/unix_task_runner.h"
+
+namespace {
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1);
+  } else {
+    b->RangeMultiplier(4)->Range(1, 1024);
+  }
+}
+
+}  // namespace
+
+// Measures the time to dispatch a file descriptor watch when the task runner
+// is also watching |state.range(0)| idle fds, e.g. the sockets of the producers
+// that are not committing data.
+static void BM_UnixTaskRunner_WatchDispatch(benchmark::State& state) {
+  perfetto::base::UnixTaskRunner task_runner;
+  std::vector<perfetto::base::Pipe> idle_pipes;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    idle_pipes.emplace_back(perfetto::base::Pipe::Create());
+    task_runner.AddFileDescriptorWatch(*idle_pipes.back().rd, [] {});
+  }
+
+  perfetto::base::EventFd evt;
+  task_runner.AddFileDescriptorWatch(evt.fd(), [&task_runner, &evt] {
+    evt.Clear();
+    task_runner.Quit();
+  });
+
+  for (auto _ : state) {
+    evt.Notify();
+    task_runner.Run();
+  }
+
+  task_runner.RemoveFileDescriptorWatch(evt.fd());
+  for (const auto& pipe : idle_pipes)
+    task_runner.RemoveFileDescriptorWatch(*pipe.rd);
+}
+
+BENCHMARK(BM_UnixTaskRunner_WatchDispatch)->Apply(BenchmarkArgs);
+
+// Measures the throughput of the tasks posted by another thread, e.g. the
+// commits of the SharedMemoryArbiter posted to the IPC thread.
+static void BM_UnixTaskRunner_PostTaskFromOtherThread(benchmark::State& state) {
+  perfetto::base::UnixTaskRunner task_runner;
+  static constexpr int kNumTasks = 1000;
+  for (auto _ : state) {
+    int num_tasks = 0;
+    std::thread thread([&task_runner, &num_tasks] {
+      for (int i = 0; i < kNumTasks; i++) {
+        task_runner.PostTask([&task_runner, &num_tasks] {
+          if (++num_tasks == kNumTasks)
+            task_runner.Quit();
+        });
+      }
+    });
+    task_runner.Run();
+    thread.join();
+  }
+  state.SetItemsProcessed(state.iterations() * kNumTasks);
+}
+
+BENCHMARK(BM_UnixTaskRunner_PostTaskFromOtherThread);
@@ -97,6 +97,22 @@ uint32_t GetSysPageSize() {
 #endif
 }
 
+uint64_t GetCurrentProcessRssBytes() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  std::string statm;
+  if (!ReadFile("/proc/self/statm", &statm))
+    return 0;
+  // The first two fields are the total and resident number of pages.
+  char* end = nullptr;
+  strtoull(statm.c_str(), &end, 10);
+  uint64_t rss_pages = strtoull(end, nullptr, 10);
+  return rss_pages * GetSysPageSize();
+#else
+  return 0;
+#endif
+}
+
 uid_t GetCurrentUserId() {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
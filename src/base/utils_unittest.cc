@@ -202,6 +202,15 @@ TEST(UtilsTest, Align) {
   EXPECT_EQ(0xffffff00u, AlignUp<16>(0xffffff00 - 1));
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+TEST(UtilsTest, GetCurrentProcessRssBytes) {
+  uint64_t rss = GetCurrentProcessRssBytes();
+  EXPECT_GT(rss, 0u);
+  EXPECT_EQ(rss % GetSysPageSize(), 0u);
+}
+#endif
+
 }  // namespace
 }  // namespace base
 }  // namespace perfetto
@@ -59,16 +59,19 @@ BufferedFrameDeserializer::BeginReceive() {
     buf_.AdviseDontNeed(buf() + page_size, capacity_ - page_size);
   }
 
+  if (consumed_size_ > 0)
+    CompactBuffer();
+
   PERFETTO_CHECK(capacity_ > size_);
   return ReceiveBuffer{buf() + size_, capacity_ - size_};
 }
 
 bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
-  const auto page_size = base::GetSysPageSize();
   PERFETTO_CHECK(recv_size + size_ <= capacity_);
   size_ += recv_size;
 
-  // At this point the contents buf_ can contain:
+  // At this point the contents buf_ (past the frames received before, if they
+  // haven't been shifted out yet) can contain:
   // A) Only a fragment of the header (the size of the frame). E.g.,
   //    03 00 00 (the header is 4 bytes, one is missing).
   //
@@ -84,18 +87,16 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
   //
   // C Is the more likely case and the one we are optimizing for. A, B, D can
   // happen because of the streaming nature of the socket.
-  // The invariant of this function is that, when it returns, buf_ is either
-  // empty (we drained all the complete frames) or starts with the header of the
-  // next, still incomplete, frame.
-
-  size_t consumed_size = 0;
+  // The invariant of this function is that, when it returns, the bytes of buf_
+  // past |consumed_size_| are either empty (we tokenized all the complete
+  // frames) or start with the header of the next, still incomplete, frame.
   for (;;) {
-    if (size_ < consumed_size + kHeaderSize)
+    if (size_ < consumed_size_ + kHeaderSize)
       break;  // Case A, not enough data to read even the header.
 
     // Read the header into |payload_size|.
     uint32_t payload_size = 0;
-    const char* rd_ptr = buf() + consumed_size;
+    const char* rd_ptr = buf() + consumed_size_;
     memcpy(base::AssumeLittleEndian(&payload_size), rd_ptr, kHeaderSize);
 
     // Saturate the |payload_size| to prevent overflows. The > capacity_ check
@@ -105,7 +106,7 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
     next_frame_size += kHeaderSize;
     rd_ptr += kHeaderSize;
 
-    if (size_ < consumed_size + next_frame_size) {
+    if (size_ < consumed_size_ + next_frame_size) {
       // Case B. We got the header but not the whole frame.
       if (next_frame_size > capacity_) {
         // The caller is expected to shut down the socket and give up at this
@@ -117,68 +118,107 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
       break;
     }
 
-    // Case C. We got at least one header and whole frame.
-    DecodeFrame(rd_ptr, payload_size);
-    consumed_size += next_frame_size;
+    // Case C. We got at least one header and whole frame. Empty frames are
+    // skipped.
+    if (payload_size > 0) {
+      encoded_frames_.push_back(protozero::ConstBytes{
+          reinterpret_cast<const uint8_t*>(rd_ptr), payload_size});
+    }
+    consumed_size_ += next_frame_size;
   }
 
-  PERFETTO_DCHECK(consumed_size <= size_);
-  if (consumed_size > 0) {
-    // Shift out the consumed data from the buffer. In the typical case (C)
-    // there is nothing to shift really, just setting size_ = 0 is enough.
-    // Shifting is only for the (unlikely) case D.
-    size_ -= consumed_size;
-    if (size_ > 0) {
-      // Case D. We consumed some frames but there is a leftover at the end of
-      // the buffer. Shift out the consumed bytes, so that on the next round
-      // |buf_| starts with the header of the next unconsumed frame.
-      const char* move_begin = buf() + consumed_size;
-      PERFETTO_CHECK(move_begin > buf());
-      PERFETTO_CHECK(move_begin + size_ <= buf() + capacity_);
-      memmove(buf(), move_begin, size_);
-    }
-    // If we just finished decoding a large frame that used more than one page,
-    // release the extra memory in the buffer. Large frames should be quite
-    // rare.
-    if (consumed_size > page_size) {
-      size_t size_rounded_up = (size_ / page_size + 1) * page_size;
-      if (size_rounded_up < capacity_) {
-        char* madvise_begin = buf() + size_rounded_up;
-        const size_t madvise_size = capacity_ - size_rounded_up;
-        PERFETTO_CHECK(madvise_begin > buf() + size_);
-        PERFETTO_CHECK(madvise_begin + madvise_size <= buf() + capacity_);
-        buf_.AdviseDontNeed(madvise_begin, madvise_size);
-      }
+  PERFETTO_DCHECK(consumed_size_ <= size_);
+  // At this point size() == 0 for case C, > 0 for cases A, B, D.
+  return true;
+}
+
+void BufferedFrameDeserializer::CompactBuffer() {
+  const auto page_size = base::GetSysPageSize();
+  PERFETTO_DCHECK(consumed_size_ > 0 && consumed_size_ <= size_);
+
+  // The frames that haven't been popped yet are about to be overwritten.
+  for (const protozero::ConstBytes& frame : encoded_frames_) {
+    copied_frames_.emplace_back(reinterpret_cast<const char*>(frame.data),
+                                frame.size);
+  }
+  encoded_frames_.clear();
+
+  // Shift out the consumed data from the buffer. In the typical case (C)
+  // there is nothing to shift really, just setting size_ = 0 is enough.
+  // Shifting is only for the (unlikely) case D.
+  const size_t consumed_size = consumed_size_;
+  size_ -= consumed_size;
+  consumed_size_ = 0;
+  if (size_ > 0) {
+    // Case D. We consumed some frames but there is a leftover at the end of
+    // the buffer. Shift out the consumed bytes, so that |buf_| starts with the
+    // header of the next unconsumed frame.
+    const char* move_begin = buf() + consumed_size;
+    PERFETTO_CHECK(move_begin > buf());
+    PERFETTO_CHECK(move_begin + size_ <= buf() + capacity_);
+    memmove(buf(), move_begin, size_);
+  }
+  // If we just finished decoding a large frame that used more than one page,
+  // release the extra memory in the buffer. Large frames should be quite
+  // rare.
+  if (consumed_size > page_size) {
+    size_t size_rounded_up = (size_ / page_size + 1) * page_size;
+    if (size_rounded_up < capacity_) {
+      char* madvise_begin = buf() + size_rounded_up;
+      const size_t madvise_size = capacity_ - size_rounded_up;
+      PERFETTO_CHECK(madvise_begin > buf() + size_);
+      PERFETTO_CHECK(madvise_begin + madvise_size <= buf() + capacity_);
+      buf_.AdviseDontNeed(madvise_begin, madvise_size);
     }
   }
-  // At this point |size_| == 0 for case C, > 0 for cases A, B, D.
-  return true;
 }
 
 std::unique_ptr<Frame> BufferedFrameDeserializer::PopNextFrame() {
-  if (decoded_frames_.empty())
-    return nullptr;
-  std::unique_ptr<Frame> frame = std::move(decoded_frames_.front());
-  decoded_frames_.pop_front();
-  return frame;
+  // Frames that can't be parsed are skipped.
+  for (;;) {
+    protozero::ConstBytes encoded_frame = PopNextEncodedFrame();
+    if (!encoded_frame.data)
+      return nullptr;
+    std::unique_ptr<Frame> frame(new Frame);
+    if (frame->ParseFromArray(encoded_frame.data, encoded_frame.size))
+      return frame;
+  }
 }
 
-void BufferedFrameDeserializer::DecodeFrame(const char* data, size_t size) {
-  if (size == 0)
-    return;
-  std::unique_ptr<Frame> frame(new Frame);
-  if (frame->ParseFromArray(data, size))
-    decoded_frames_.push_back(std::move(frame));
+protozero::ConstBytes BufferedFrameDeserializer::PopNextEncodedFrame() {
+  if (!copied_frames_.empty()) {
+    popped_frame_ = std::move(copied_frames_.front());
+    copied_frames_.pop_front();
+    return protozero::ConstBytes{
+        reinterpret_cast<const uint8_t*>(popped_frame_.data()),
+        popped_frame_.size()};
+  }
+  if (encoded_frames_.empty())
+    return protozero::ConstBytes{nullptr, 0};
+  protozero::ConstBytes frame = encoded_frames_.front();
+  encoded_frames_.pop_front();
+  return frame;
 }
 
 // static
 std::string BufferedFrameDeserializer::Serialize(const Frame& frame) {
-  std::vector<uint8_t> payload = frame.SerializeAsArray();
-  const uint32_t payload_size = static_cast<uint32_t>(payload.size());
+  protozero::HeapBuffered<protozero::Message> payload;
+  frame.Serialize(payload.get());
+  return Serialize(&payload);
+}
+
+// static
+std::string BufferedFrameDeserializer::Serialize(
+    protozero::HeapBuffered<protozero::Message>* payload) {
+  // Serialize the frame straight after the header, rather than going through
+  // SerializeAsArray(), which would copy the payload once more.
+  const uint32_t payload_size =
+      static_cast<uint32_t>(payload->SerializedSize());
   std::string buf;
   buf.resize(kHeaderSize + payload_size);
   memcpy(&buf[0], base::AssumeLittleEndian(&payload_size), kHeaderSize);
-  memcpy(&buf[kHeaderSize], payload.data(), payload.size());
+  if (payload_size)
+    payload->SerializeTo(reinterpret_cast<uint8_t*>(&buf[kHeaderSize]));
   return buf;
 }
 
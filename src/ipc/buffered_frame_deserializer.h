@@ -19,12 +19,16 @@
 
 #include <stddef.h>
 
+#include <deque>
 #include <list>
 #include <memory>
+#include <string>
 
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/ipc/basic_types.h"
+#include "perfetto/protozero/field.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 
 namespace perfetto {
 
@@ -80,6 +84,9 @@ using Frame = ::perfetto::protos::gen::IPCFrame;
 //   that a malicious sends an abnormally large frame and OOMs us.
 // - Simplicity: just use a linear mmap region. No reallocations or scattering.
 //   Takes care of madvise()-ing unused memory.
+// - Allow decoding the frames straight from the receive buffer: the frames
+//   are only tokenized by EndReceive() and stay in the buffer until the next
+//   BeginReceive(), which copies out the ones that haven't been popped yet.
 
 class BufferedFrameDeserializer {
  public:
@@ -97,6 +104,11 @@ class BufferedFrameDeserializer {
   // in common that doesn't justify having its own class.
   static std::string Serialize(const Frame&);
 
+  // Like the above, for a frame written with protozero, e.g. to write the
+  // method arguments of an InvokeMethod request straight into the frame,
+  // without serializing them into a string first.
+  static std::string Serialize(protozero::HeapBuffered<protozero::Message>*);
+
   // Returns a buffer that can be passed to recv(). The buffer is deliberately
   // not initialized.
   ReceiveBuffer BeginReceive();
@@ -112,16 +124,25 @@ class BufferedFrameDeserializer {
   // if no further frames have been decoded.
   std::unique_ptr<Frame> PopNextFrame();
 
+  // Like PopNextFrame(), but returns the proto-encoded frame without decoding
+  // it, or {nullptr, 0} if there are no further frames. The returned bytes
+  // usually point into the receive buffer and are valid only until the next
+  // call to BeginReceive() or to one of the PopNext*() methods.
+  protozero::ConstBytes PopNextEncodedFrame();
+
   size_t capacity() const { return capacity_; }
-  size_t size() const { return size_; }
+
+  // The number of bytes received that are not part of a complete frame yet.
+  size_t size() const { return size_ - consumed_size_; }
 
  private:
   BufferedFrameDeserializer(const BufferedFrameDeserializer&) = delete;
   BufferedFrameDeserializer& operator=(const BufferedFrameDeserializer&) =
       delete;
 
-  // If a valid frame is decoded it is added to |decoded_frames_|.
-  void DecodeFrame(const char*, size_t);
+  // Copies the frames that haven't been popped yet out of |buf_| and shifts
+  // out their bytes, ahead of receiving more data.
+  void CompactBuffer();
 
   char* buf() { return reinterpret_cast<char*>(buf_.Get()); }
 
@@ -132,7 +153,22 @@ class BufferedFrameDeserializer {
   // EndReceive()). This is always <= |capacity_|.
   size_t size_ = 0;
 
-  std::list<std::unique_ptr<Frame>> decoded_frames_;
+  // The number of bytes at the beginning of |buf_| that contain complete
+  // frames (and their headers), kept in |buf_| until the next BeginReceive().
+  // This is always <= |size_|.
+  size_t consumed_size_ = 0;
+
+  // The frames that have been copied out of |buf_| by CompactBuffer(). They
+  // always precede the ones in |encoded_frames_|.
+  std::list<std::string> copied_frames_;
+
+  // Holds the last frame popped from |copied_frames_|, for the caller of
+  // PopNextEncodedFrame().
+  std::string popped_frame_;
+
+  // The complete frames received since the last BeginReceive(), pointing into
+  // |buf_|.
+  std::deque<protozero::ConstBytes> encoded_frames_;
 };
 
 }  // namespace ipc
@@ -306,6 +306,40 @@ TEST(BufferedFrameDeserializerTest, CanRecoverAfterUnparsableFrames) {
   }
 }
 
+// The encoded frames point into the receive buffer until the next
+// BeginReceive(), which must copy out the ones that haven't been popped yet.
+TEST(BufferedFrameDeserializerTest, EncodedFramesOutliveReceiveBuffer) {
+  BufferedFrameDeserializer bfd;
+  std::vector<char> frame1 = GetSimpleFrame(32);
+  std::vector<char> frame2 = GetSimpleFrame(64);
+  std::vector<char> frame3 = GetSimpleFrame(128);
+
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd.BeginReceive();
+  CheckedMemcpy(rbuf, frame1);
+  CheckedMemcpy(rbuf, frame2, frame1.size());
+  ASSERT_TRUE(bfd.EndReceive(frame1.size() + frame2.size()));
+
+  protozero::ConstBytes encoded_frame = bfd.PopNextEncodedFrame();
+  ASSERT_TRUE(encoded_frame.data);
+  EXPECT_EQ(encoded_frame.ToStdString(),
+            std::string(frame1.begin() + kHeaderSize, frame1.end()));
+
+  // |frame2| hasn't been popped, it's copied before being overwritten.
+  rbuf = bfd.BeginReceive();
+  CheckedMemcpy(rbuf, frame3);
+  ASSERT_TRUE(bfd.EndReceive(frame3.size()));
+
+  encoded_frame = bfd.PopNextEncodedFrame();
+  ASSERT_TRUE(encoded_frame.data);
+  EXPECT_EQ(encoded_frame.ToStdString(),
+            std::string(frame2.begin() + kHeaderSize, frame2.end()));
+  std::unique_ptr<Frame> decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  ASSERT_TRUE(FrameEq(frame3, *decoded_frame));
+  EXPECT_FALSE(bfd.PopNextEncodedFrame().data);
+  EXPECT_EQ(0u, bfd.size());
+}
+
 // Test that we can sustain recvs() which constantly max out the capacity.
 // It sets up four frames:
 // |frame1|: small, 1024 + 4 bytes.
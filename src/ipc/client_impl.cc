@@ -116,14 +116,21 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
                                   base::WeakPtr<ServiceProxy> service_proxy,
                                   int fd) {
   RequestID request_id = ++last_request_id_;
-  Frame frame;
-  frame.set_request_id(request_id);
-  Frame::InvokeMethod* req = frame.mutable_msg_invoke_method();
-  req->set_service_id(service_id);
-  req->set_method_id(remote_method_id);
-  req->set_drop_reply(drop_reply);
-  req->set_args_proto(method_args.SerializeAsString());
-  if (!SendFrame(frame, fd)) {
+  // Written with protozero rather than as a Frame, so that the arguments are
+  // serialized straight into the frame, instead of into an intermediate
+  // string which is then copied into the Frame and serialized again. This is
+  // the same encoding, see Frame::InvokeMethod.
+  using InvokeMethod = Frame::InvokeMethod;
+  protozero::HeapBuffered<protozero::Message> frame;
+  frame->AppendVarInt(Frame::kRequestIdFieldNumber, request_id);
+  protozero::Message* req = frame->BeginNestedMessage<protozero::Message>(
+      Frame::kMsgInvokeMethodFieldNumber);
+  req->AppendVarInt(InvokeMethod::kServiceIdFieldNumber, service_id);
+  req->AppendVarInt(InvokeMethod::kMethodIdFieldNumber, remote_method_id);
+  method_args.Serialize(req->BeginNestedMessage<protozero::Message>(
+      InvokeMethod::kArgsProtoFieldNumber));
+  req->AppendTinyVarInt(InvokeMethod::kDropReplyFieldNumber, drop_reply);
+  if (!SendFrame(&frame, fd)) {
     PERFETTO_DLOG("BeginInvoke() failed while sending the frame");
     return 0;
   }
@@ -140,8 +147,15 @@ RequestID ClientImpl::BeginInvoke(ServiceID service_id,
 
 bool ClientImpl::SendFrame(const Frame& frame, int fd) {
   // Serialize the frame into protobuf, add the size header, and send it.
-  std::string buf = BufferedFrameDeserializer::Serialize(frame);
+  return SendSerializedFrame(BufferedFrameDeserializer::Serialize(frame), fd);
+}
+
+bool ClientImpl::SendFrame(protozero::HeapBuffered<protozero::Message>* frame,
+                           int fd) {
+  return SendSerializedFrame(BufferedFrameDeserializer::Serialize(frame), fd);
+}
 
+bool ClientImpl::SendSerializedFrame(const std::string& buf, int fd) {
   // TODO(primiano): this should do non-blocking I/O. But then what if the
   // socket buffer is full? We might want to either drop the request or throttle
   // the send and PostTask the reply later? Right now we are making Send()
@@ -196,11 +210,16 @@ void ClientImpl::OnDisconnect(base::UnixSocket*) {
 }
 
 void ClientImpl::OnDataAvailable(base::UnixSocket*) {
-  size_t rsize;
+  // The socket watch is level-triggered: stop reading as soon as a recv()
+  // doesn't fill the buffer, rather than making one more recv() just to get
+  // EAGAIN. If more data has arrived in the meantime, this will be called
+  // again.
+  bool may_have_more_data;
   do {
     auto buf = frame_deserializer_.BeginReceive();
     base::ScopedFile fd;
-    rsize = sock_->Receive(buf.data, buf.size, &fd);
+    size_t rsize = sock_->Receive(buf.data, buf.size, &fd);
+    may_have_more_data = rsize == buf.size;
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     PERFETTO_DCHECK(!fd);
 #else
@@ -216,10 +235,12 @@ void ClientImpl::OnDataAvailable(base::UnixSocket*) {
       return sock_->Shutdown(true);  // In turn will trigger an OnDisconnect().
       // TODO(fmayer): check this.
     }
-  } while (rsize > 0);
 
-  while (std::unique_ptr<Frame> frame = frame_deserializer_.PopNextFrame())
-    OnFrameReceived(*frame);
+    // Decode the frames before the next BeginReceive(), while they are still
+    // in the receive buffer and don't need to be copied out of it.
+    while (std::unique_ptr<Frame> frame = frame_deserializer_.PopNextFrame())
+      OnFrameReceived(*frame);
+  } while (may_have_more_data);
 }
 
 void ClientImpl::OnFrameReceived(const Frame& frame) {
@@ -297,7 +318,10 @@ void ClientImpl::OnInvokeMethodReply(QueuedRequest req,
     // If this becomes a hotspot, optimize by maintaining a dedicated hashtable.
     for (const auto& method : service_proxy->GetDescriptor().methods) {
       if (req.method_name == method.name) {
-        decoded_reply = method.reply_proto_decoder(reply.reply_proto());
+        const std::string& reply_proto = reply.reply_proto();
+        decoded_reply = method.reply_proto_decoder(
+            reinterpret_cast<const uint8_t*>(reply_proto.data()),
+            reply_proto.size());
         break;
       }
     }
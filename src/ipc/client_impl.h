@@ -85,6 +85,8 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
 
   void TryConnect();
   bool SendFrame(const Frame&, int fd = -1);
+  bool SendFrame(protozero::HeapBuffered<protozero::Message>*, int fd = -1);
+  bool SendSerializedFrame(const std::string&, int fd);
   void OnFrameReceived(const Frame&);
   void OnBindServiceReply(QueuedRequest,
                           const protos::gen::IPCFrame_BindServiceReply&);
@@ -24,6 +24,7 @@
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/ipc/service.h"
 #include "perfetto/ext/ipc/service_descriptor.h"
+#include "perfetto/protozero/proto_decoder.h"
 
 #include "protos/perfetto/ipc/wire_protocol.gen.h"
 
@@ -123,33 +124,55 @@ void HostImpl::OnDataAvailable(base::UnixSocket* sock) {
   ClientConnection* client = it->second;
   BufferedFrameDeserializer& frame_deserializer = client->frame_deserializer;
 
-  size_t rsize;
+  // The socket watch is level-triggered: stop reading as soon as a recv()
+  // doesn't fill the buffer, rather than making one more recv() just to get
+  // EAGAIN. If more data has arrived in the meantime, this will be called
+  // again.
+  bool may_have_more_data;
   do {
     auto buf = frame_deserializer.BeginReceive();
     base::ScopedFile fd;
-    rsize = client->sock->Receive(buf.data, buf.size, &fd);
+    size_t rsize = client->sock->Receive(buf.data, buf.size, &fd);
+    may_have_more_data = rsize == buf.size;
     if (fd) {
       PERFETTO_DCHECK(!client->received_fd);
       client->received_fd = std::move(fd);
     }
     if (!frame_deserializer.EndReceive(rsize))
       return OnDisconnect(client->sock.get());
-  } while (rsize > 0);
 
-  for (;;) {
-    std::unique_ptr<Frame> frame = frame_deserializer.PopNextFrame();
-    if (!frame)
-      break;
-    OnReceivedFrame(client, *frame);
-  }
+    // Handle the frames before the next BeginReceive(), straight from the
+    // receive buffer.
+    for (;;) {
+      protozero::ConstBytes frame = frame_deserializer.PopNextEncodedFrame();
+      if (!frame.data)
+        break;
+      OnReceivedFrame(client, frame);
+    }
+  } while (may_have_more_data);
 }
 
 void HostImpl::OnReceivedFrame(ClientConnection* client,
-                               const Frame& req_frame) {
+                               protozero::ConstBytes encoded_frame) {
+  // The method invocations, by far the most frequent requests, are decoded
+  // lazily, without copying their arguments out of the receive buffer.
+  protozero::TypedProtoDecoder<Frame::kMsgRequestErrorFieldNumber, true>
+      frame_decoder(encoded_frame.data, encoded_frame.size);
+  if (frame_decoder.bytes_left())
+    return;  // Unparsable frames are dropped, like PopNextFrame() does.
+  const protozero::Field& invoke_method =
+      frame_decoder.at<Frame::kMsgInvokeMethodFieldNumber>();
+  if (invoke_method.valid()) {
+    return OnInvokeMethod(
+        client, frame_decoder.at<Frame::kRequestIdFieldNumber>().as_uint64(),
+        invoke_method.as_bytes());
+  }
+
+  Frame req_frame;
+  if (!req_frame.ParseFromArray(encoded_frame.data, encoded_frame.size))
+    return;
   if (req_frame.has_msg_bind_service())
     return OnBindService(client, req_frame);
-  if (req_frame.has_msg_invoke_method())
-    return OnInvokeMethod(client, req_frame);
 
   PERFETTO_DLOG("Received invalid RPC frame from client %" PRIu64, client->id);
   Frame reply_frame;
@@ -180,26 +203,32 @@ void HostImpl::OnBindService(ClientConnection* client, const Frame& req_frame) {
 }
 
 void HostImpl::OnInvokeMethod(ClientConnection* client,
-                              const Frame& req_frame) {
-  const Frame::InvokeMethod& req = req_frame.msg_invoke_method();
+                              RequestID request_id,
+                              protozero::ConstBytes encoded_invoke_method) {
+  using InvokeMethod = Frame::InvokeMethod;
+  protozero::TypedProtoDecoder<InvokeMethod::kDropReplyFieldNumber, false> req(
+      encoded_invoke_method.data, encoded_invoke_method.size);
   Frame reply_frame;
-  RequestID request_id = req_frame.request_id();
   reply_frame.set_request_id(request_id);
   reply_frame.mutable_msg_invoke_method_reply()->set_success(false);
-  auto svc_it = services_.find(req.service_id());
+  auto svc_it = services_.find(
+      req.at<InvokeMethod::kServiceIdFieldNumber>().as_uint32());
   if (svc_it == services_.end())
     return SendFrame(client, reply_frame);  // |success| == false by default.
 
   Service* service = svc_it->second.instance.get();
   const ServiceDescriptor& svc = service->GetDescriptor();
   const auto& methods = svc.methods;
-  const uint32_t method_id = req.method_id();
+  const uint32_t method_id =
+      req.at<InvokeMethod::kMethodIdFieldNumber>().as_uint32();
   if (method_id == 0 || method_id > methods.size())
     return SendFrame(client, reply_frame);
 
   const ServiceDescriptor::Method& method = methods[method_id - 1];
+  protozero::ConstBytes args =
+      req.at<InvokeMethod::kArgsProtoFieldNumber>().as_bytes();
   std::unique_ptr<ProtoMessage> decoded_req_args(
-      method.request_proto_decoder(req.args_proto()));
+      method.request_proto_decoder(args.data, args.size));
   if (!decoded_req_args)
     return SendFrame(client, reply_frame);
 
@@ -207,7 +236,7 @@ void HostImpl::OnInvokeMethod(ClientConnection* client,
   base::WeakPtr<HostImpl> host_weak_ptr = weak_ptr_factory_.GetWeakPtr();
   ClientID client_id = client->id;
 
-  if (!req.drop_reply()) {
+  if (!req.at<InvokeMethod::kDropReplyFieldNumber>().as_bool()) {
     deferred_reply.Bind([host_weak_ptr, client_id,
                          request_id](AsyncResult<ProtoMessage> reply) {
       if (!host_weak_ptr)
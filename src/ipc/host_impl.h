@@ -73,9 +73,11 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
   HostImpl& operator=(const HostImpl&) = delete;
 
   bool Initialize(const char* socket_name);
-  void OnReceivedFrame(ClientConnection*, const Frame&);
+  void OnReceivedFrame(ClientConnection*, protozero::ConstBytes encoded_frame);
   void OnBindService(ClientConnection*, const Frame&);
-  void OnInvokeMethod(ClientConnection*, const Frame&);
+  void OnInvokeMethod(ClientConnection*,
+                      RequestID,
+                      protozero::ConstBytes encoded_invoke_method);
   void ReplyToMethodInvocation(ClientID, RequestID, AsyncResult<ProtoMessage>);
   const ExposedService* GetServiceByName(const std::string&);
 
@@ -27,10 +27,12 @@
 #include "perfetto/protozero/proto_utils.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
 #include <cinttypes>
 #include <functional>
+#include <limits>
 #include <map>
 #include <utility>
 
@@ -47,6 +49,107 @@ using TokenId = KernelSymbolMap::TokenTable::TokenId;
 constexpr size_t kSymNameMaxLen = 128;
 constexpr size_t kSymMaxSizeBytes = 1024 * 1024;
 
+// Walks the entries of the symbol buffer in address order, starting from an
+// entry of the sparse index.
+class SymbolCursor {
+ public:
+  explicit SymbolCursor(const uint8_t* buf_end) : buf_end_(buf_end) {}
+
+  // Moves to the entry at |entry|, whose address is |rel_addr|. The address
+  // delta of the entry is ignored, as the index tells its address.
+  void Reset(const uint8_t* entry, uint32_t rel_addr) {
+    uint64_t unused_delta = 0;
+    tokens_ = protozero::proto_utils::ParseVarInt(entry, buf_end_,
+                                                  &unused_delta);
+    valid_ = tokens_ != entry;
+    addr_ = rel_addr;
+    if (valid_)
+      FindNext();
+  }
+
+  // Moves to the next entry. Requires has_next().
+  void Next() {
+    PERFETTO_DCHECK(has_next_);
+    addr_ = next_addr_;
+    tokens_ = next_tokens_;
+    FindNext();
+  }
+
+  bool valid() const { return valid_; }
+  uint32_t addr() const { return addr_; }
+  const uint8_t* tokens() const { return tokens_; }
+  bool has_next() const { return has_next_; }
+  uint32_t next_addr() const { return next_addr_; }
+
+ private:
+  // Skips the token indexes of the current entry, until the one with the EOF
+  // marker, and reads the address delta of the next entry.
+  void FindNext() {
+    has_next_ = false;
+    const uint8_t* rdptr = tokens_;
+    for (bool eof = false; !eof;) {
+      uint64_t v = 0;
+      const auto* old = rdptr;
+      rdptr = protozero::proto_utils::ParseVarInt(rdptr, buf_end_, &v);
+      if (rdptr == old)
+        return;
+      eof = v & 1;
+    }
+    uint64_t delta = 0;
+    const auto* old = rdptr;
+    rdptr = protozero::proto_utils::ParseVarInt(rdptr, buf_end_, &delta);
+    if (rdptr == old)
+      return;
+    has_next_ = true;
+    next_addr_ = addr_ + static_cast<uint32_t>(delta);
+    next_tokens_ = rdptr;
+  }
+
+  const uint8_t* const buf_end_;
+  bool valid_ = false;
+  uint32_t addr_ = 0;
+  const uint8_t* tokens_ = nullptr;
+  bool has_next_ = false;
+  uint32_t next_addr_ = 0;
+  const uint8_t* next_tokens_ = nullptr;
+};
+
+// Bump when changing the layout of the serialized image.
+constexpr char kImageMagic[8] = {'K', 'S', 'Y', 'M', 'I', 'M', 'G', '1'};
+
+// The fixed size header of the serialized image, followed by the token buffer,
+// the token index, the symbol buffer and the symbol index, in this order.
+struct ImageHeader {
+  char magic[8];
+  uint32_t sym_index_sampling;
+  uint32_t token_index_sampling;
+  uint64_t base_addr;
+  uint64_t num_syms;
+  uint32_t num_tokens;
+  uint32_t token_buf_size;
+  uint32_t token_index_size;
+  uint32_t sym_buf_size;
+  uint32_t sym_index_size;
+  uint32_t padding;
+};
+
+template <typename T>
+void AppendArray(std::string* out, const T* data, size_t count) {
+  out->append(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+// Copies |count| elements of type T from |*data| into |out|, advancing |*data|
+// and decreasing |*size|. Returns false if there isn't enough data.
+template <typename T>
+bool ReadArray(const char** data, size_t* size, size_t count, T* out) {
+  if (*size / sizeof(T) < count)
+    return false;
+  memcpy(out, *data, count * sizeof(T));
+  *data += count * sizeof(T);
+  *size -= count * sizeof(T);
+  return true;
+}
+
 // Reads a kallsyms file in blocks of 4 pages each and decode its lines using
 // a simple FSM. Calls the passed lambda for each valid symbol.
 // It skips undefined symbols and other useless stuff.
@@ -377,6 +480,86 @@ size_t KernelSymbolMap::Parse(const std::string& kallsyms_path) {
   return num_syms_;
 }
 
+std::string KernelSymbolMap::Serialize() const {
+  ImageHeader hdr{};
+  memcpy(hdr.magic, kImageMagic, sizeof(hdr.magic));
+  hdr.sym_index_sampling = static_cast<uint32_t>(kSymIndexSampling);
+  hdr.token_index_sampling = static_cast<uint32_t>(kTokenIndexSampling);
+  hdr.base_addr = base_addr_;
+  hdr.num_syms = num_syms_;
+  hdr.num_tokens = tokens_.num_tokens_;
+  hdr.token_buf_size = static_cast<uint32_t>(tokens_.buf_.size());
+  hdr.token_index_size = static_cast<uint32_t>(tokens_.index_.size());
+  hdr.sym_buf_size = static_cast<uint32_t>(buf_.size());
+  hdr.sym_index_size = static_cast<uint32_t>(index_.size());
+
+  std::string image;
+  image.reserve(sizeof(hdr) + tokens_.size_bytes() + addr_bytes());
+  AppendArray(&image, &hdr, 1);
+  AppendArray(&image, tokens_.buf_.data(), tokens_.buf_.size());
+  AppendArray(&image, tokens_.index_.data(), tokens_.index_.size());
+  AppendArray(&image, buf_.data(), buf_.size());
+  for (const auto& rel_addr_and_offset : index_) {
+    AppendArray(&image, &rel_addr_and_offset.first, 1);
+    AppendArray(&image, &rel_addr_and_offset.second, 1);
+  }
+  return image;
+}
+
+size_t KernelSymbolMap::ParseSerialized(const char* data, size_t size) {
+  PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, KALLSYMS_PARSE);
+  ImageHeader hdr;
+  if (!ReadArray(&data, &size, 1, &hdr) ||
+      memcmp(hdr.magic, kImageMagic, sizeof(hdr.magic)) != 0 ||
+      hdr.sym_index_sampling != kSymIndexSampling ||
+      hdr.token_index_sampling != kTokenIndexSampling) {
+    return 0;
+  }
+
+  // Images with sizes that don't add up are rejected before allocating.
+  const uint64_t expected_size =
+      uint64_t{hdr.token_buf_size} + hdr.token_index_size * uint64_t{4} +
+      hdr.sym_buf_size + hdr.sym_index_size * uint64_t{8};
+  if (expected_size != size)
+    return 0;
+  std::vector<char> token_buf(hdr.token_buf_size);
+  std::vector<uint32_t> token_index(hdr.token_index_size);
+  std::vector<uint8_t> buf(hdr.sym_buf_size);
+  std::vector<std::pair<uint32_t, uint32_t>> index(hdr.sym_index_size);
+  bool ok = ReadArray(&data, &size, token_buf.size(), token_buf.data()) &&
+            ReadArray(&data, &size, token_index.size(), token_index.data()) &&
+            ReadArray(&data, &size, buf.size(), buf.data());
+  for (auto& rel_addr_and_offset : index) {
+    ok = ok && ReadArray(&data, &size, 1, &rel_addr_and_offset.first) &&
+         ReadArray(&data, &size, 1, &rel_addr_and_offset.second);
+  }
+  if (!ok)
+    return 0;
+
+  // Check the invariants that Lookup() relies on.
+  if (token_index.size() !=
+      (hdr.num_tokens + kTokenIndexSampling - 1) / kTokenIndexSampling) {
+    return 0;
+  }
+  for (uint32_t offset : token_index) {
+    if (offset > token_buf.size())
+      return 0;
+  }
+  for (const auto& rel_addr_and_offset : index) {
+    if (rel_addr_and_offset.second >= buf.size())
+      return 0;
+  }
+
+  tokens_.num_tokens_ = hdr.num_tokens;
+  tokens_.buf_ = std::move(token_buf);
+  tokens_.index_ = std::move(token_index);
+  base_addr_ = hdr.base_addr;
+  num_syms_ = static_cast<size_t>(hdr.num_syms);
+  buf_ = std::move(buf);
+  index_ = std::move(index);
+  return num_syms_;
+}
+
 std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
   if (index_.empty() || sym_addr < base_addr_)
     return "";
@@ -429,10 +612,81 @@ std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
     return "";
 
   // The address has been found. Now rejoin the tokens to form the symbol name.
-
-  rdptr = next_rdptr;
   std::string sym_name;
   sym_name.reserve(kSymNameMaxLen);
+  AppendSymbolName(next_rdptr, &sym_name);
+  return sym_name;
+}
+
+void KernelSymbolMap::LookupSorted(const uint64_t* addrs,
+                                   size_t count,
+                                   SymbolNames* out) {
+  out->buf_.clear();
+  out->ranges_.clear();
+  out->ranges_.reserve(count);
+  const uint8_t* const buf_end = buf_.data() + buf_.size();
+  SymbolCursor cursor(buf_end);
+
+  // The last index entry at or before the cursor, and the symbol of the last
+  // name appended to |out|.
+  size_t index_pos = 0;
+  const uint8_t* last_tokens = nullptr;
+  std::pair<uint32_t, uint32_t> last_range{0, 0};
+
+  for (size_t i = 0; i < count; i++) {
+    const uint64_t sym_addr = addrs[i];
+    PERFETTO_DCHECK(i == 0 || addrs[i - 1] <= sym_addr);
+    if (index_.empty() || sym_addr < base_addr_ ||
+        sym_addr - base_addr_ > std::numeric_limits<uint32_t>::max()) {
+      out->ranges_.emplace_back(0, 0);
+      continue;
+    }
+    const uint32_t sym_rel_addr = static_cast<uint32_t>(sym_addr - base_addr_);
+
+    // Jump with the index only if the address is past the next index entry,
+    // searching only the entries after the current one.
+    if (!cursor.valid() || (index_pos + 1 < index_.size() &&
+                            index_[index_pos + 1].first < sym_rel_addr)) {
+      auto begin = index_.cbegin();
+      if (cursor.valid())
+        begin += static_cast<ptrdiff_t>(index_pos);
+      auto it = std::upper_bound(begin, index_.cend(),
+                                 std::make_pair(sym_rel_addr, 0u));
+      if (it != index_.cbegin())
+        --it;
+      index_pos = static_cast<size_t>(it - index_.cbegin());
+      cursor.Reset(&buf_[it->second], it->first);
+    }
+
+    // Then continue with a linear scan, like Lookup().
+    while (cursor.valid() && cursor.has_next() &&
+           cursor.next_addr() <= sym_rel_addr) {
+      cursor.Next();
+      while (index_pos + 1 < index_.size() &&
+             index_[index_pos + 1].first <= cursor.addr()) {
+        index_pos++;
+      }
+    }
+
+    if (!cursor.valid() || cursor.addr() > sym_rel_addr ||
+        sym_rel_addr - cursor.addr() > kSymMaxSizeBytes) {
+      out->ranges_.emplace_back(0, 0);
+      continue;
+    }
+    if (cursor.tokens() != last_tokens) {
+      last_tokens = cursor.tokens();
+      last_range.first = static_cast<uint32_t>(out->buf_.size());
+      AppendSymbolName(last_tokens, &out->buf_);
+      last_range.second = static_cast<uint32_t>(out->buf_.size());
+    }
+    out->ranges_.emplace_back(last_range);
+  }
+}
+
+void KernelSymbolMap::AppendSymbolName(const uint8_t* tokens,
+                                       std::string* out) {
+  const uint8_t* rdptr = tokens;
+  const uint8_t* const buf_end = buf_.data() + buf_.size();
   for (bool eof = false, is_first_token = true; !eof; is_first_token = false) {
     uint64_t v = 0;
     const auto* old = rdptr;
@@ -442,11 +696,20 @@ std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
     eof = v & 1;
     base::StringView token = tokens_.Lookup(static_cast<TokenId>(v >> 1));
     if (!is_first_token)
-      sym_name.push_back('_');
+      out->push_back('_');
     for (size_t i = 0; i < token.size(); i++)
-      sym_name.push_back(token.at(i) & 0x7f);
+      out->push_back(token.at(i) & 0x7f);
   }
-  return sym_name;
+}
+
+KernelSymbolMap::SymbolNames::SymbolNames() = default;
+KernelSymbolMap::SymbolNames::~SymbolNames() = default;
+
+base::StringView KernelSymbolMap::SymbolNames::at(size_t i) const {
+  PERFETTO_DCHECK(i < ranges_.size());
+  const auto& range = ranges_[i];
+  return base::StringView(buf_.data() + range.first,
+                          range.second - range.first);
 }
 
 }  // namespace perfetto
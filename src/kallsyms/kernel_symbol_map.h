@@ -111,6 +111,10 @@ class StringView;
 // 2. Skip over at most kSymIndexSamplinig until the symbol is found.
 // 3. For each token index, lookup the corresponding token string and
 //    concatenate them to build the symbol name.
+// LookupSorted() resolves many addresses, sorted in ascending order, in a
+// single merge pass over the symbol table: the scan continues from the symbol
+// found for the previous address, and the index is searched only when the
+// next address is past the next index entry.
 
 class KernelSymbolMap {
  public:
@@ -125,12 +129,49 @@ class KernelSymbolMap {
   // Parses a kallsyms file. Returns the number of valid symbols decoded.
   size_t Parse(const std::string& kallsyms_path);
 
+  // Returns a binary image of the parsed tables, which ParseSerialized() can
+  // load back in a fraction of the time it takes to parse kallsyms, as it
+  // doesn't need to tokenize or sort anything.
+  std::string Serialize() const;
+
+  // Loads an image returned by Serialize(), with the same index samplings.
+  // Returns the number of symbols loaded, 0 if the image is not valid (in
+  // which case the map is left unchanged).
+  size_t ParseSerialized(const char* data, size_t size);
+
   // Looks up the closest symbol (i.e. the one with the highest address <=
   // |addr|) from its absolute 64-bit address.
   // Returns an empty string if the symbol is not found (which can happen only
   // if the passed |addr| is < min(addr)).
   std::string Lookup(uint64_t addr);
 
+  // The output of LookupSorted(). Reusing it across lookups avoids allocating
+  // a string per symbol: all the names are concatenated in one buffer.
+  class SymbolNames {
+   public:
+    SymbolNames();
+    ~SymbolNames();
+
+    // Number of addresses looked up.
+    size_t size() const { return ranges_.size(); }
+
+    // Returns the name of the symbol of the |i|-th address, empty if it
+    // wasn't found. Valid until the next LookupSorted() call.
+    base::StringView at(size_t i) const;
+
+   private:
+    friend class KernelSymbolMap;
+
+    std::string buf_;
+    // The [begin, end) offsets in |buf_| of the name of each address.
+    std::vector<std::pair<uint32_t, uint32_t>> ranges_;
+  };
+
+  // Looks up |count| addresses, which must be sorted in ascending order, as
+  // Lookup() would. The name of |addrs[i]| is returned in |out->at(i)|.
+  // Consecutive addresses within the same symbol share its name.
+  void LookupSorted(const uint64_t* addrs, size_t count, SymbolNames* out);
+
   // Returns the numberr of valid symbols decoded.
   size_t num_syms() const { return num_syms_; }
 
@@ -157,6 +198,8 @@ class KernelSymbolMap {
     }
 
    private:
+    friend class KernelSymbolMap;  // For (de)serialization.
+
     TokenId num_tokens_ = 0;
 
     std::vector<char> buf_;  // Token buffer.
@@ -167,6 +210,10 @@ class KernelSymbolMap {
   };
 
  private:
+  // Appends to |out| the name of the symbol whose token indexes start at
+  // |tokens|.
+  void AppendSymbolName(const uint8_t* tokens, std::string* out);
+
   TokenTable tokens_;  // Token table.
 
   uint64_t base_addr_ = 0;    // Address of the first symbol (after sorting).
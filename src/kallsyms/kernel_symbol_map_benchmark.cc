@@ -14,11 +14,15 @@
 
 #include <random>
 #include <set>
+#include <algorithm>
+#include <iterator>
 #include <unordered_set>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/base/test/utils.h"
 #include "src/kallsyms/kernel_symbol_map.h"
@@ -114,3 +118,72 @@ static void BM_KallSyms(benchmark::State& state) {
 }
 
 BENCHMARK(BM_KallSyms)->Apply(BenchmarkArgs);
+
+// Looks up the same symbols as BM_KallSyms, sorted, in a single batch.
+static void BM_KallSymsLookupSorted(benchmark::State& state) {
+  perfetto::KernelSymbolMap::kTokenIndexSampling =
+      static_cast<size_t>(state.range(0));
+  perfetto::KernelSymbolMap::kSymIndexSampling =
+      static_cast<size_t>(state.range(1));
+  perfetto::KernelSymbolMap kallsyms;
+
+  const bool skip = IsBenchmarkFunctionalOnly();
+  if (!skip) {
+    kallsyms.Parse(perfetto::base::GetTestDataPath("test/data/kallsyms.txt"));
+  }
+
+  std::vector<ExpectedSym> syms(std::begin(kExpectedSyms),
+                                std::end(kExpectedSyms));
+  std::sort(syms.begin(), syms.end(),
+            [](const ExpectedSym& a, const ExpectedSym& b) {
+              return a.addr < b.addr;
+            });
+  std::vector<uint64_t> addrs;
+  for (const ExpectedSym& sym : syms)
+    addrs.push_back(sym.addr);
+
+  perfetto::KernelSymbolMap::SymbolNames names;
+  for (auto _ : state) {
+    kallsyms.LookupSorted(addrs.data(), addrs.size(), &names);
+    for (size_t i = 0; i < syms.size(); i++)
+      PERFETTO_CHECK(skip || names.at(i) == perfetto::base::StringView(
+                                                 syms[i].name));
+  }
+
+  state.counters["mem"] = static_cast<double>(kallsyms.size_bytes());
+}
+
+BENCHMARK(BM_KallSymsLookupSorted)->Apply(BenchmarkArgs);
+
+// Cold start: parses the whole kallsyms file on each iteration.
+static void BM_KallSymsParse(benchmark::State& state) {
+  const bool skip = IsBenchmarkFunctionalOnly();
+  const std::string path =
+      perfetto::base::GetTestDataPath("test/data/kallsyms.txt");
+  for (auto _ : state) {
+    perfetto::KernelSymbolMap kallsyms;
+    if (!skip)
+      PERFETTO_CHECK(kallsyms.Parse(path) > 0);
+  }
+}
+
+BENCHMARK(BM_KallSymsParse);
+
+// Cold start from the image cached by a previous session.
+static void BM_KallSymsParseSerialized(benchmark::State& state) {
+  const bool skip = IsBenchmarkFunctionalOnly();
+  std::string image;
+  if (!skip) {
+    perfetto::KernelSymbolMap kallsyms;
+    kallsyms.Parse(perfetto::base::GetTestDataPath("test/data/kallsyms.txt"));
+    image = kallsyms.Serialize();
+  }
+  for (auto _ : state) {
+    perfetto::KernelSymbolMap kallsyms;
+    if (!skip)
+      PERFETTO_CHECK(kallsyms.ParseSerialized(image.data(), image.size()) > 0);
+  }
+  state.counters["image_size"] = static_cast<double>(image.size());
+}
+
+BENCHMARK(BM_KallSymsParseSerialized);
@@ -160,5 +160,89 @@ TEST(KernelSymbolMapTest, GoldenTest) {
   }
 }
 
+TEST(KernelSymbolMapTest, LookupSorted) {
+  std::string fake_kallsyms;
+  std::minstd_rand rng(0);
+  uint64_t addr = 0xffffff8f70000000ULL;
+  for (int i = 0; i < 1000; i++) {
+    char line[64];
+    sprintf(line, "%" PRIx64 " t sym_%d\n", addr, i);
+    fake_kallsyms += line;
+    // Some symbols share their address with the previous one.
+    addr += rng() % 4 == 0 ? 0 : 1 + rng() % 512;
+  }
+  base::TempFile tmp = base::TempFile::Create();
+  base::WriteAll(tmp.fd(), fake_kallsyms.data(), fake_kallsyms.size());
+  base::FlushFile(tmp.fd());
+
+  KernelSymbolMap kallsyms;
+  kallsyms.Parse(tmp.path().c_str());
+  ASSERT_GT(kallsyms.num_syms(), 0u);
+
+  // Sorted addresses, with repetitions, sparse runs which need the index and
+  // dense ones which are found with linear scans.
+  std::vector<uint64_t> addrs;
+  addrs.push_back(0x42);
+  addrs.push_back(0xffffff8f6fffffffULL);
+  for (uint64_t a = 0xffffff8f70000000ULL; a < addr + 4096;) {
+    addrs.push_back(a);
+    if (rng() % 8 == 0)
+      addrs.push_back(a);
+    a += rng() % 16 == 0 ? 1 + rng() % 8192 : 1 + rng() % 256;
+  }
+  addrs.push_back(0xffffff8fffffffffULL);
+
+  KernelSymbolMap::SymbolNames names;
+  kallsyms.LookupSorted(addrs.data(), addrs.size(), &names);
+  ASSERT_EQ(names.size(), addrs.size());
+  for (size_t i = 0; i < addrs.size(); i++)
+    ASSERT_EQ(names.at(i).ToStdString(), kallsyms.Lookup(addrs[i])) << i;
+  EXPECT_EQ(names.at(0).ToStdString(), "");
+  EXPECT_EQ(names.at(2).ToStdString(), "sym_0");
+
+  // The output is reused by the next lookups.
+  kallsyms.LookupSorted(addrs.data(), 1, &names);
+  EXPECT_EQ(names.size(), 1u);
+  KernelSymbolMap empty;
+  empty.LookupSorted(addrs.data(), addrs.size(), &names);
+  ASSERT_EQ(names.size(), addrs.size());
+  EXPECT_TRUE(names.at(2).empty());
+}
+
+TEST(KernelSymbolMapTest, Serialize) {
+  base::TempFile tmp = base::TempFile::Create();
+  static const char kContents[] = R"(ffffff8f73e2fa10 t one
+ffffff8f73e2fa20 t two_
+ffffff8f73e2fa30 t _three  [module_name_ignored]
+ffffff8f73e2fa40 t _fo_ur_
+ffffff8f73e2fa90 t NiNe
+)";
+  base::WriteAll(tmp.fd(), kContents, sizeof(kContents));
+  base::FlushFile(tmp.fd());
+
+  KernelSymbolMap kallsyms;
+  kallsyms.Parse(tmp.path().c_str());
+  std::string image = kallsyms.Serialize();
+
+  KernelSymbolMap loaded;
+  EXPECT_EQ(loaded.ParseSerialized(image.data(), image.size()), 5u);
+  EXPECT_EQ(loaded.size_bytes(), kallsyms.size_bytes());
+  EXPECT_EQ(loaded.Lookup(0xffffff8f73e2fa10ULL), "one");
+  EXPECT_EQ(loaded.Lookup(0xffffff8f73e2fa21ULL), "two_");
+  EXPECT_EQ(loaded.Lookup(0xffffff8f73e2fa30ULL), "_three");
+  EXPECT_EQ(loaded.Lookup(0xffffff8f73e2fa40ULL), "_fo_ur_");
+  EXPECT_EQ(loaded.Lookup(0xffffff8f73e2fa99ULL), "NiNe");
+  EXPECT_EQ(loaded.Lookup(0xffffff8f73e2fa00ULL), "");
+
+  // Truncated or corrupted images are rejected.
+  KernelSymbolMap invalid;
+  EXPECT_EQ(invalid.ParseSerialized(image.data(), image.size() - 1), 0u);
+  std::string corrupted = image;
+  corrupted[0] = 'X';
+  EXPECT_EQ(invalid.ParseSerialized(corrupted.data(), corrupted.size()), 0u);
+  EXPECT_EQ(invalid.num_syms(), 0u);
+  EXPECT_EQ(invalid.Lookup(0xffffff8f73e2fa10ULL), "");
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -18,12 +18,15 @@
 
 #include <string>
 
+#include <fcntl.h>
+#include <stdio.h>
 #include <unistd.h>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/kallsyms/kernel_symbol_map.h"
 
@@ -38,6 +41,8 @@ namespace {
 const char kKallsymsPath[] = "/proc/kallsyms";
 const char kPtrRestrictPath[] = "/proc/sys/kernel/kptr_restrict";
 const char kLowerPtrRestrictAndroidProp[] = "security.lower_kptr_restrict";
+const char kBootIdPath[] = "/proc/sys/kernel/random/boot_id";
+const char kModulesPath[] = "/proc/modules";
 
 // This class takes care of temporarily lowering kptr_restrict and putting it
 // back to the original value if necessary. It solves the following problem:
@@ -146,23 +151,93 @@ void ScopedKptrUnrestrict::WriteKptrRestrict(const std::string& value) {
 
 }  // namespace
 
+std::string GetKernelCacheKey() {
+  std::string boot_id;
+  if (!base::ReadFile(kBootIdPath, &boot_id))
+    return "";
+  std::string key = "boot_id: " + boot_id;
+  // Only the module names are kept, the other columns (e.g. the reference
+  // counts) change all the time.
+  std::string modules;
+  base::ReadFile(kModulesPath, &modules);
+  for (base::StringSplitter lines(std::move(modules), '\n'); lines.Next();) {
+    base::StringSplitter words(&lines, ' ');
+    if (words.Next())
+      key += std::string(words.cur_token()) + "\n";
+  }
+  return key;
+}
+
 LazyKernelSymbolizer::LazyKernelSymbolizer() = default;
 LazyKernelSymbolizer::~LazyKernelSymbolizer() = default;
 
 KernelSymbolMap* LazyKernelSymbolizer::GetOrCreateKernelSymbolMap() {
-  PERFETTO_DCHECK_THREAD(thread_checker_);
   if (symbol_map_)
     return symbol_map_.get();
+  PERFETTO_DCHECK_THREAD(thread_checker_);
 
   symbol_map_.reset(new KernelSymbolMap());
 
-  // If kptr_restrict is set, try temporarily lifting it (it works only if
-  // traced_probes is run as a privileged user).
-  ScopedKptrUnrestrict kptr_unrestrict;
-  symbol_map_->Parse(kKallsymsPath);
+  std::string cache_key = cache_file_.empty() ? "" : GetKernelCacheKey();
+  if (!cache_key.empty() && LoadCacheFile(cache_key))
+    return symbol_map_.get();
+
+  {
+    // If kptr_restrict is set, try temporarily lifting it (it works only if
+    // traced_probes is run as a privileged user).
+    ScopedKptrUnrestrict kptr_unrestrict;
+    symbol_map_->Parse(kKallsymsPath);
+  }
+  if (!cache_key.empty() && symbol_map_->num_syms() > 0)
+    WriteCacheFile(cache_key);
   return symbol_map_.get();
 }
 
+// The cache file contains the cache key, NUL terminated, followed by the
+// image of the symbol map.
+bool LazyKernelSymbolizer::LoadCacheFile(const std::string& cache_key) {
+  std::string contents;
+  if (!base::ReadFile(cache_file_, &contents))
+    return false;
+  if (contents.size() <= cache_key.size() ||
+      contents.compare(0, cache_key.size(), cache_key) != 0 ||
+      contents[cache_key.size()] != '\0') {
+    PERFETTO_DLOG("Ignoring the stale kallsyms cache %s", cache_file_.c_str());
+    return false;
+  }
+  const size_t image_offset = cache_key.size() + 1;
+  if (!symbol_map_->ParseSerialized(contents.data() + image_offset,
+                                    contents.size() - image_offset)) {
+    PERFETTO_ELOG("Ignoring the invalid kallsyms cache %s",
+                  cache_file_.c_str());
+    return false;
+  }
+  return true;
+}
+
+void LazyKernelSymbolizer::WriteCacheFile(const std::string& cache_key) {
+  std::string contents = cache_key;
+  contents.push_back('\0');
+  contents += symbol_map_->Serialize();
+  // Written to a temporary file first and then renamed, so that a crash
+  // doesn't leave a truncated cache behind.
+  std::string tmp_path = cache_file_ + ".tmp";
+  unlink(tmp_path.c_str());
+  base::ScopedFile fd =
+      base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (!fd || base::WriteAll(*fd, contents.data(), contents.size()) !=
+                 static_cast<ssize_t>(contents.size())) {
+    PERFETTO_PLOG("Failed to write the kallsyms cache %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+    return;
+  }
+  fd.reset();
+  if (rename(tmp_path.c_str(), cache_file_.c_str()) != 0) {
+    PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+  }
+}
+
 void LazyKernelSymbolizer::Destroy() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   symbol_map_.reset();
@@ -18,6 +18,7 @@
 #define SRC_KALLSYMS_LAZY_KERNEL_SYMBOLIZER_H_
 
 #include <memory>
+#include <string>
 
 #include "perfetto/ext/base/thread_checker.h"
 
@@ -25,6 +26,12 @@ namespace perfetto {
 
 class KernelSymbolMap;
 
+// Returns a key that changes across reboots and when kernel modules are loaded
+// or unloaded, which is when the kernel symbols (because of KASLR) and the
+// tracefs event formats can change. Empty if the boot id can't be read, in
+// which case nothing should be cached.
+std::string GetKernelCacheKey();
+
 // This class is a wrapper around KernelSymbolMap. It serves two purposes:
 // 1. Deals with /proc/kallsyms reads and temporary lowering of kptr_restrict.
 //    KernelSymbolMap is just a parser and doesn't do I/O.
@@ -44,10 +51,20 @@ class LazyKernelSymbolizer {
   ~LazyKernelSymbolizer();
 
   // Returns |instance_|, creating it if doesn't exist or was destroyed.
+  // Creation must happen on the thread that owns this object. Once created, the
+  // map can be obtained and looked up from other threads too (the ftrace reader
+  // threads), as long as they are joined before Destroy().
   KernelSymbolMap* GetOrCreateKernelSymbolMap();
 
   bool is_valid() const { return !!symbol_map_; }
 
+  // Keeps a binary image of the symbol map in |path|, so that the following
+  // sessions (also after a restart of traced_probes) load it instead of
+  // parsing /proc/kallsyms again. The image is only reused within the same
+  // boot and with the same kernel modules loaded. As it contains the kernel
+  // addresses, the file is only readable by its owner.
+  void set_cache_file(std::string path) { cache_file_ = std::move(path); }
+
   // Destroys the |symbol_map_| freeing up memory. A further call to
   // GetOrCreateKernelSymbolMap() will create it again.
   void Destroy();
@@ -57,7 +74,11 @@ class LazyKernelSymbolizer {
       const char* ksyms_path_for_testing = nullptr);
 
  private:
+  bool LoadCacheFile(const std::string& cache_key);
+  void WriteCacheFile(const std::string& cache_key);
+
   std::unique_ptr<KernelSymbolMap> symbol_map_;
+  std::string cache_file_;
   PERFETTO_THREAD_CHECKER(thread_checker_)
 };
 
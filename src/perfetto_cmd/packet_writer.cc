@@ -16,7 +16,14 @@
 
 #include "src/perfetto_cmd/packet_writer.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #include <fcntl.h>
 #include <signal.h>
@@ -26,7 +33,9 @@
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/getopt.h"
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/protozero/proto_utils.h"
 
@@ -62,6 +71,13 @@ const size_t kPendingBytesLimit = 32 * 1024;
 
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
+// AsyncPacketWriter hands the packets over to its threads once it has
+// accumulated this many bytes of them.
+constexpr size_t kAsyncBlockSize = 2 * 1024 * 1024;
+
+// Upper bound for the number of threads compressing the blocks in parallel.
+constexpr unsigned kMaxCompressThreads = 4;
+
 template <uint32_t id>
 size_t GetPreamble(size_t sz, Preamble* preamble) {
   uint8_t* ptr = reinterpret_cast<uint8_t*>(preamble->data());
@@ -250,6 +266,159 @@ void ZipPacketWriter::Deflate(const uint8_t* ptr, size_t size) {
 
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
+// A copy of some consecutive packets, laid out back to back.
+struct PacketBlock {
+  PacketBlock() { data.reserve(kAsyncBlockSize); }
+
+  void Append(const TracePacket& packet) {
+    for (const Slice& slice : packet.slices())
+      data.append(reinterpret_cast<const char*>(slice.start), slice.size);
+    packet_sizes.push_back(packet.size());
+  }
+
+  // The returned packets point into |data|.
+  std::vector<TracePacket> GetPackets() const {
+    std::vector<TracePacket> packets(packet_sizes.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < packet_sizes.size(); i++) {
+      packets[i].AddSlice(&data[offset], packet_sizes[i]);
+      offset += packet_sizes[i];
+    }
+    return packets;
+  }
+
+  std::string data;
+  std::vector<size_t> packet_sizes;
+
+  // Notified once the block has been compressed, when compressing.
+  base::WaitableEvent compressed;
+};
+
+// Copies the packets it is passed into a PacketBlock.
+class BlockPacketWriter : public PacketWriter {
+ public:
+  explicit BlockPacketWriter(PacketBlock* block) : block_(block) {}
+  bool WritePacket(const TracePacket& packet) override {
+    block_->Append(packet);
+    return true;
+  }
+
+ private:
+  PacketBlock* const block_;
+};
+
+class AsyncPacketWriter : public PacketWriter {
+ public:
+  AsyncPacketWriter(std::unique_ptr<PacketWriter>, size_t num_compress_threads);
+  ~AsyncPacketWriter() override;
+  bool WritePacket(const TracePacket& packet) override;
+
+ private:
+  void SubmitBlock();
+  static void CompressBlock(PacketBlock*);
+  void WriteBlock(PacketBlock*);
+
+  std::unique_ptr<PacketWriter> writer_;  // Only used on |write_thread_|.
+  std::unique_ptr<PacketBlock> block_;    // Being filled by WritePacket().
+  size_t max_blocks_in_flight_;
+  std::atomic<bool> write_failed_{false};
+
+  std::mutex mutex_;
+  std::condition_variable block_written_;
+  size_t blocks_in_flight_ = 0;  // Guarded by |mutex_|.
+
+  std::vector<std::unique_ptr<base::ThreadTaskRunner>> compress_threads_;
+  size_t next_compress_thread_ = 0;
+  std::unique_ptr<base::ThreadTaskRunner> write_thread_;
+};
+
+AsyncPacketWriter::AsyncPacketWriter(std::unique_ptr<PacketWriter> writer,
+                                     size_t num_compress_threads)
+    : writer_(std::move(writer)),
+      block_(new PacketBlock()),
+      max_blocks_in_flight_(num_compress_threads + 2),
+      write_thread_(new base::ThreadTaskRunner(
+          base::ThreadTaskRunner::CreateAndStart("PacketWriter"))) {
+  for (size_t i = 0; i < num_compress_threads; i++) {
+    compress_threads_.emplace_back(new base::ThreadTaskRunner(
+        base::ThreadTaskRunner::CreateAndStart("PacketZipper")));
+  }
+}
+
+AsyncPacketWriter::~AsyncPacketWriter() {
+  if (!block_->packet_sizes.empty())
+    SubmitBlock();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    block_written_.wait(lock, [this] { return blocks_in_flight_ == 0; });
+  }
+  // Join the threads before destroying |writer_|.
+  compress_threads_.clear();
+  write_thread_.reset();
+}
+
+bool AsyncPacketWriter::WritePacket(const TracePacket& packet) {
+  if (write_failed_)
+    return false;
+  block_->Append(packet);
+  if (block_->data.size() >= kAsyncBlockSize)
+    SubmitBlock();
+  return !write_failed_;
+}
+
+void AsyncPacketWriter::SubmitBlock() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    block_written_.wait(
+        lock, [this] { return blocks_in_flight_ < max_blocks_in_flight_; });
+    blocks_in_flight_++;
+  }
+  std::shared_ptr<PacketBlock> block(std::move(block_));
+  block_.reset(new PacketBlock());
+
+  const bool compress = !compress_threads_.empty();
+  if (compress) {
+    base::ThreadTaskRunner* compress_thread =
+        compress_threads_[next_compress_thread_++ % compress_threads_.size()]
+            .get();
+    compress_thread->PostTask([block] { CompressBlock(block.get()); });
+  }
+
+  // The blocks are written in the order they are posted, waiting for each one
+  // to be compressed if needed while the following ones are compressed on the
+  // other threads.
+  write_thread_->PostTask([this, block, compress] {
+    if (compress)
+      block->compressed.Wait();
+    WriteBlock(block.get());
+  });
+}
+
+// static
+void AsyncPacketWriter::CompressBlock(PacketBlock* block) {
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  std::unique_ptr<PacketBlock> compressed_block(new PacketBlock());
+  {
+    ZipPacketWriter zip_writer(std::unique_ptr<PacketWriter>(
+        new BlockPacketWriter(compressed_block.get())));
+    zip_writer.WritePackets(block->GetPackets());
+  }  // Finalizes the last compressed packet.
+  block->data.swap(compressed_block->data);
+  block->packet_sizes.swap(compressed_block->packet_sizes);
+#else
+  PERFETTO_FATAL("Zlib not enabled in the build config");
+#endif
+  block->compressed.Notify();
+}
+
+void AsyncPacketWriter::WriteBlock(PacketBlock* block) {
+  if (!write_failed_ && !writer_->WritePackets(block->GetPackets()))
+    write_failed_ = true;
+  std::lock_guard<std::mutex> lock(mutex_);
+  blocks_in_flight_--;
+  block_written_.notify_all();
+}
+
 }  // namespace
 
 PacketWriter::PacketWriter() {}
@@ -267,4 +436,21 @@ std::unique_ptr<PacketWriter> CreateZipPacketWriter(
 }
 #endif
 
+std::unique_ptr<PacketWriter> CreateAsyncPacketWriter(
+    std::unique_ptr<PacketWriter> writer,
+    bool compress) {
+  size_t num_compress_threads = 0;
+  if (compress) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+    PERFETTO_FATAL("Zlib not enabled in the build config");
+#endif
+    // Leave one core to the main thread, which receives the trace data.
+    unsigned num_cpus = std::thread::hardware_concurrency();
+    num_compress_threads = std::max(
+        1u, std::min(kMaxCompressThreads, num_cpus > 1 ? num_cpus - 1 : 1u));
+  }
+  return std::unique_ptr<PacketWriter>(
+      new AsyncPacketWriter(std::move(writer), num_compress_threads));
+}
+
 }  // namespace perfetto
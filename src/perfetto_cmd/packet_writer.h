@@ -45,6 +45,18 @@ std::unique_ptr<PacketWriter> CreateFilePacketWriter(FILE*);
 std::unique_ptr<PacketWriter> CreateZipPacketWriter(
     std::unique_ptr<PacketWriter>);
 
+// Returns a PacketWriter which copies the packets into blocks of a few MB and
+// writes them into |writer| on a background thread, so that the caller (i.e.
+// the IPC reception) doesn't wait for the disk. If |compress| is true, the
+// blocks are first compressed as by CreateZipPacketWriter(), in parallel on a
+// pool of threads, and then written in order. The blocks in flight are
+// bounded, WritePacket() blocks when the writer falls behind. Once a write
+// fails, WritePacket() returns false. The destructor drains the pending
+// blocks into |writer|.
+std::unique_ptr<PacketWriter> CreateAsyncPacketWriter(
+    std::unique_ptr<PacketWriter> writer,
+    bool compress);
+
 }  // namespace perfetto
 
 #endif  // SRC_PERFETTO_CMD_PACKET_WRITER_H_
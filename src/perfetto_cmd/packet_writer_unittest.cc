@@ -117,6 +117,53 @@ TEST(PacketWriterTest, FilePacketWriter) {
   EXPECT_EQ(trace.packet()[0].for_testing().str(), "abc");
 }
 
+TEST(PacketWriterTest, AsyncPacketWriter) {
+  base::TempFile tmp = base::TempFile::CreateUnlinked();
+  base::ScopedResource<FILE*, fclose, nullptr> f(
+      fdopen(tmp.ReleaseFD().release(), "wb"));
+
+  // Enough packets to fill several blocks.
+  std::unique_ptr<PacketWriter> writer =
+      CreateAsyncPacketWriter(CreateFilePacketWriter(*f), /*compress=*/false);
+  for (uint32_t i = 0; i < 1000; i++) {
+    std::vector<perfetto::TracePacket> packets;
+    for (uint32_t j = 0; j < 10; j++) {
+      packets.push_back(CreateTracePacket([i, j](TracePacketProto* msg) {
+        auto* for_testing = msg->mutable_for_testing();
+        for_testing->set_seq_value(i * 10 + j);
+        for_testing->set_str(std::string(1024, 'x'));
+      }));
+    }
+    EXPECT_TRUE(writer->WritePackets(std::move(packets)));
+  }
+  writer.reset();
+
+  std::string s;
+  fseek(*f, 0, SEEK_SET);
+  EXPECT_TRUE(base::ReadFileStream(*f, &s));
+
+  protos::gen::Trace trace;
+  EXPECT_TRUE(trace.ParseFromString(s));
+  uint32_t packet_count = 0;
+  for (const auto& packet : trace.packet())
+    EXPECT_EQ(packet.for_testing().seq_value(), packet_count++);
+  EXPECT_EQ(packet_count, 10000u);
+}
+
+TEST(PacketWriterTest, AsyncPacketWriter_Empty) {
+  base::TempFile tmp = base::TempFile::CreateUnlinked();
+  base::ScopedResource<FILE*, fclose, nullptr> f(
+      fdopen(tmp.ReleaseFD().release(), "wb"));
+
+  {
+    std::unique_ptr<PacketWriter> writer =
+        CreateAsyncPacketWriter(CreateFilePacketWriter(*f), /*compress=*/false);
+    writer->WritePackets(std::vector<TracePacket>());
+  }
+
+  EXPECT_EQ(fseek(*f, 0, SEEK_END), 0);
+}
+
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
 TEST(PacketWriterTest, ZipPacketWriter) {
@@ -315,6 +362,51 @@ TEST(PacketWriterTest, ZipPacketWriter_ShouldSplitPackets) {
   EXPECT_EQ(packet_count, 1000u);
 }
 
+TEST(PacketWriterTest, AsyncPacketWriter_Compressed) {
+  base::TempFile tmp = base::TempFile::CreateUnlinked();
+  base::ScopedResource<FILE*, fclose, nullptr> f(
+      fdopen(tmp.ReleaseFD().release(), "wb"));
+
+  // Enough packets to fill several blocks, which are compressed in parallel,
+  // and a packet too large to be compressed.
+  {
+    std::unique_ptr<PacketWriter> writer =
+        CreateAsyncPacketWriter(CreateFilePacketWriter(*f), /*compress=*/true);
+    for (uint32_t i = 0; i < 5000; i++) {
+      std::vector<perfetto::TracePacket> packets;
+      packets.push_back(CreateTracePacket([i](TracePacketProto* msg) {
+        auto* for_testing = msg->mutable_for_testing();
+        for_testing->set_seq_value(i);
+        for_testing->set_str(RandomString(i == 2500 ? 1024 * 1024 : 1024));
+      }));
+      EXPECT_TRUE(writer->WritePackets(std::move(packets)));
+    }
+  }
+
+  std::string s;
+  fseek(*f, 0, SEEK_SET);
+  EXPECT_TRUE(base::ReadFileStream(*f, &s));
+
+  protos::gen::Trace trace;
+  EXPECT_TRUE(trace.ParseFromString(s));
+
+  uint32_t packet_count = 0;
+  for (const auto& packet : trace.packet()) {
+    if (!packet.has_compressed_packets()) {
+      EXPECT_EQ(packet.for_testing().seq_value(), packet_count++);
+      continue;
+    }
+    const std::string& data = packet.compressed_packets();
+    EXPECT_LT(data.size(), 500 * 1024u);
+    protos::gen::Trace subtrace;
+    EXPECT_TRUE(subtrace.ParseFromString(Decompress(data)));
+    for (const auto& subpacket : subtrace.packet())
+      EXPECT_EQ(subpacket.for_testing().seq_value(), packet_count++);
+  }
+
+  EXPECT_EQ(packet_count, 5000u);
+}
+
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
 }  // namespace
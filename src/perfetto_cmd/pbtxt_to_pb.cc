@@ -16,10 +16,13 @@
 
 #include <ctype.h>
 
+#include <algorithm>
+#include <initializer_list>
 #include <map>
 #include <set>
 #include <stack>
 #include <string>
+#include <unordered_map>
 
 #include "src/perfetto_cmd/pbtxt_to_pb.h"
 
@@ -140,7 +143,7 @@ struct Token {
 struct ParserDelegateContext {
   const DescriptorProto* descriptor;
   protozero::Message* message;
-  std::set<std::string> seen_fields;
+  std::set<const FieldDescriptorProto*> seen_fields;  // Non-repeated only.
 };
 
 class ParserDelegate {
@@ -355,7 +358,7 @@ class ParserDelegate {
       int32_t enum_value_number = 0;
       for (const EnumValueDescriptorProto& enum_value :
            enum_descriptor->value()) {
-        if (value.ToStdString() != enum_value.name())
+        if (value.txt != base::StringView(enum_value.name()))
           continue;
         found_value = true;
         enum_value_number = enum_value.number();
@@ -442,10 +445,21 @@ class ParserDelegate {
     msg()->AppendFixed<T>(field_id, static_cast<T>(opt_n.value_or(0l)));
   }
 
+  // Parses the numbers as sscanf("%" PRIu64) would, without copying them: an
+  // optional '-' (the number is then negated modulo 2^64) followed by digits,
+  // ignoring what follows them (e.g. a fractional part).
   template <typename T>
   bool ParseInteger(base::StringView s, T* number_ptr) {
+    size_t i = 0;
+    const bool negative = !s.empty() && s.at(0) == '-';
+    if (negative)
+      i++;
+    PERFETTO_CHECK(i < s.size() && IsDigit(s.at(i)));
     uint64_t n = 0;
-    PERFETTO_CHECK(sscanf(s.ToStdString().c_str(), "%" PRIu64, &n) == 1);
+    for (; i < s.size() && IsDigit(s.at(i)); i++)
+      n = n * 10 + static_cast<uint64_t>(s.at(i) - '0');
+    if (negative)
+      n = 0 - n;
     PERFETTO_CHECK(n <= std::numeric_limits<T>::max());
     *number_ptr = static_cast<T>(n);
     return true;
@@ -454,42 +468,37 @@ class ParserDelegate {
   const FieldDescriptorProto* FindFieldByName(
       Token key,
       Token value,
-      std::set<FieldDescriptorProto::Type> valid_field_types) {
-    const std::string field_name = key.ToStdString();
-    const FieldDescriptorProto* field_descriptor = nullptr;
-    for (const auto& f : descriptor()->field()) {
-      if (f.name() == field_name) {
-        field_descriptor = &f;
-        break;
-      }
-    }
-
-    if (!field_descriptor) {
+      std::initializer_list<FieldDescriptorProto::Type> valid_field_types) {
+    const FieldIndex& field_index = GetFieldIndex(descriptor());
+    auto field_it = field_index.find(key.txt);
+    if (field_it == field_index.end()) {
       AddError(key, "No field named \"$n\" in proto $p",
                {
-                   {"$n", field_name},
+                   {"$n", key.ToStdString()},
                    {"$p", descriptor_name()},
                });
       return nullptr;
     }
+    const FieldDescriptorProto* field_descriptor = field_it->second;
 
     bool is_repeated =
         field_descriptor->label() == FieldDescriptorProto::LABEL_REPEATED;
-    auto it_and_inserted = ctx_.top().seen_fields.emplace(field_name);
-    if (!it_and_inserted.second && !is_repeated) {
+    if (!is_repeated &&
+        !ctx_.top().seen_fields.insert(field_descriptor).second) {
       AddError(key, "Saw non-repeating field '$f' more than once",
                {
-                   {"$f", field_name},
+                   {"$f", key.ToStdString()},
                });
     }
 
-    if (!valid_field_types.count(field_descriptor->type())) {
+    if (std::find(valid_field_types.begin(), valid_field_types.end(),
+                  field_descriptor->type()) == valid_field_types.end()) {
       AddError(value,
                "Expected value of type $t for field $k in proto $n "
                "instead saw '$v'",
                {
                    {"$t", FieldToTypeName(field_descriptor)},
-                   {"$k", field_name},
+                   {"$k", key.ToStdString()},
                    {"$n", descriptor_name()},
                    {"$v", value.ToStdString()},
                });
@@ -499,6 +508,20 @@ class ParserDelegate {
     return field_descriptor;
   }
 
+  // The fields of a message, by name. Built the first time a field of the
+  // message is parsed, as a config uses only a few of the messages of the
+  // TraceConfig descriptor.
+  using FieldIndex =
+      std::unordered_map<base::StringView, const FieldDescriptorProto*>;
+  const FieldIndex& GetFieldIndex(const DescriptorProto* descriptor) {
+    FieldIndex& field_index = field_indexes_[descriptor];
+    if (field_index.empty()) {
+      for (const auto& field : descriptor->field())
+        field_index.emplace(base::StringView(field.name()), &field);
+    }
+    return field_index;
+  }
+
   const DescriptorProto* descriptor() {
     PERFETTO_CHECK(!ctx_.empty());
     return ctx_.top().descriptor;
@@ -515,6 +538,7 @@ class ParserDelegate {
   ErrorReporter* reporter_;
   std::map<std::string, const DescriptorProto*> name_to_descriptor_;
   std::map<std::string, const EnumDescriptorProto*> name_to_enum_;
+  std::map<const DescriptorProto*, FieldIndex> field_indexes_;
 };
 
 void Parse(const std::string& input, ParserDelegate* delegate) {
@@ -530,7 +554,7 @@ void Parse(const std::string& input, ParserDelegate* delegate) {
 
   for (size_t i = 0; i < input.size(); i++, column++) {
     bool last_character = i + 1 == input.size();
-    char c = input.at(i);
+    char c = input[i];
     if (c == '\n') {
       column = 0;
       row++;
@@ -20,6 +20,7 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -35,6 +36,7 @@
 #include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <iterator>
@@ -46,6 +48,8 @@
 #include "perfetto/ext/base/ctrl_c_handler.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/getopt.h"
+#include "perfetto/ext/base/hash.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/thread_utils.h"
 #include "perfetto/ext/base/utils.h"
@@ -132,6 +136,50 @@ bool ParseTraceConfigPbtxt(const std::string& file_name,
   return true;
 }
 
+// Like ParseTraceConfigPbtxt(), but keeps the proto-encoded config in
+// |cache_dir|, keyed by the hash of the pbtxt and of the perfetto version (the
+// descriptor used to encode it), so that the same config isn't parsed again by
+// the next invocations. Failures to read or write the cache are ignored.
+bool ParseTraceConfigPbtxtCached(const std::string& cache_dir,
+                                 const std::string& file_name,
+                                 const std::string& pbtxt,
+                                 TraceConfig* config) {
+  base::Hash hash;
+  const char* version = base::GetVersionString();
+  hash.Update(version, strlen(version) + 1);
+  hash.Update(pbtxt.size());
+  hash.Update(pbtxt.data(), pbtxt.size());
+  const std::string cache_path =
+      cache_dir + "/" + base::Uint64ToHexStringNoPrefix(hash.digest()) + ".pb";
+
+  std::string cached;
+  if (base::ReadFile(cache_path, &cached) && config->ParseFromString(cached)) {
+    PERFETTO_DLOG("Using the cached TraceConfig %s", cache_path.c_str());
+    return true;
+  }
+
+  if (!ParseTraceConfigPbtxt(file_name, pbtxt, config))
+    return false;
+
+  // Write the entry under a temporary name and rename it, so that concurrent
+  // invocations never read a partially written entry.
+  const std::string tmp_path =
+      cache_path + "." + base::Uuidv4().ToPrettyString();
+  const std::string encoded = config->SerializeAsString();
+  base::ScopedFile fd =
+      base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (!fd) {
+    PERFETTO_DPLOG("Could not create %s", tmp_path.c_str());
+    return true;
+  }
+  bool written = base::WriteAll(*fd, encoded.data(), encoded.size()) ==
+                 static_cast<ssize_t>(encoded.size());
+  fd.reset();
+  if (!written || rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+    remove(tmp_path.c_str());
+  return true;
+}
+
 bool IsUserBuild() {
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   char value[PROP_VALUE_MAX];
@@ -162,6 +210,35 @@ base::Optional<PerfettoStatsdAtom> ConvertRateLimiterResponseToAtom(
   PERFETTO_FATAL("For GCC");
 }
 
+// Returns the upper bound of the bucket which contains the |percentile|-th
+// duration of |histogram|, capped to its max.
+uint64_t GetLatencyPercentile(const protos::gen::LatencyHistogram& histogram,
+                              uint64_t percentile) {
+  const uint64_t rank = (histogram.count() * percentile + 99) / 100;
+  uint64_t count = 0;
+  for (const auto& bucket : histogram.buckets()) {
+    count += bucket.count();
+    if (count >= rank)
+      return std::min(bucket.upper_bound_ns(), histogram.max_ns());
+  }
+  return histogram.max_ns();
+}
+
+void PrintLatencyHistogram(const char* indent,
+                           const char* name,
+                           const protos::gen::LatencyHistogram& histogram) {
+  if (!histogram.count())
+    return;
+  printf("%s%s: { count: %" PRIu64 " avg_us: %" PRIu64 " p50_us: %" PRIu64
+         " p90_us: %" PRIu64 " p99_us: %" PRIu64 " max_us: %" PRIu64 " }\n",
+         indent, name, histogram.count(),
+         histogram.sum_ns() / histogram.count() / 1000,
+         GetLatencyPercentile(histogram, 50) / 1000,
+         GetLatencyPercentile(histogram, 90) / 1000,
+         GetLatencyPercentile(histogram, 99) / 1000,
+         histogram.max_ns() / 1000);
+}
+
 }  // namespace
 
 const char* kStateDir = "/data/misc/perfetto-traces";
@@ -187,6 +264,8 @@ Usage: %s
   --out            -o      : /path/to/out/trace/file or - for stdout
   --txt                    : Parse config as pbtxt. Not for production use.
                              Not a stable API.
+  --config-cache DIR       : With --txt, keep the parsed config in DIR and
+                             reuse it when the same config is passed again.
   --query                  : Queries the service state and prints it as
                              human-readable text.
   --query-raw              : Like --query, but prints raw proto-encoded bytes
@@ -240,6 +319,7 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
     OPT_SUBSCRIPTION_ID,
     OPT_RESET_GUARDRAILS,
     OPT_PBTXT_CONFIG,
+    OPT_CONFIG_CACHE,
     OPT_DROPBOX,
     OPT_UPLOAD,
     OPT_IGNORE_GUARDRAILS,
@@ -262,6 +342,7 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       {"app", required_argument, nullptr, 'a'},
       {"no-guardrails", no_argument, nullptr, OPT_IGNORE_GUARDRAILS},
       {"txt", no_argument, nullptr, OPT_PBTXT_CONFIG},
+      {"config-cache", required_argument, nullptr, OPT_CONFIG_CACHE},
       {"upload", no_argument, nullptr, OPT_UPLOAD},
       {"dropbox", required_argument, nullptr, OPT_DROPBOX},
       {"alert-id", required_argument, nullptr, OPT_ALERT_ID},
@@ -282,6 +363,7 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
   std::string config_file_name;
   std::string trace_config_raw;
   bool parse_as_pbtxt = false;
+  std::string config_cache_dir;
   TraceConfig::StatsdMetadata statsd_metadata;
   limiter_.reset(new RateLimiter());
 
@@ -383,6 +465,11 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       continue;
     }
 
+    if (option == OPT_CONFIG_CACHE) {
+      config_cache_dir = optarg;
+      continue;
+    }
+
     if (option == OPT_IGNORE_GUARDRAILS) {
       ignore_guardrails_ = true;
       continue;
@@ -523,7 +610,11 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       return 1;
     }
     PERFETTO_DLOG("Parsing TraceConfig, %zu bytes", trace_config_raw.size());
-    if (parse_as_pbtxt) {
+    if (parse_as_pbtxt && !config_cache_dir.empty()) {
+      parsed = ParseTraceConfigPbtxtCached(config_cache_dir, config_file_name,
+                                           trace_config_raw,
+                                           trace_config_.get());
+    } else if (parse_as_pbtxt) {
       parsed = ParseTraceConfigPbtxt(config_file_name, trace_config_raw,
                                      trace_config_.get());
     } else {
@@ -670,11 +761,13 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       packet_writer_ = CreateFilePacketWriter(trace_out_stream_.get());
   }
 
+  // Unless asked otherwise, the compression is performed by the service.
   if (trace_config_->compression_type() ==
-      TraceConfig::COMPRESSION_TYPE_DEFLATE) {
+          TraceConfig::COMPRESSION_TYPE_DEFLATE &&
+      trace_config_->compress_from_cli()) {
     if (packet_writer_) {
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
-      packet_writer_ = CreateZipPacketWriter(std::move(packet_writer_));
+      compress_from_cli_ = true;
 #else
       PERFETTO_ELOG("Cannot compress. Zlib not enabled in the build config");
 #endif
@@ -683,6 +776,18 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
     }
   }
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  // Unless the trace is compressed here, let the service write it directly
+  // into the output file, saving the copies through the IPC channel. Only for
+  // regular files: the service would block on a pipe until it's drained.
+  if (packet_writer_ && !compress_from_cli_) {
+    struct stat out_stat;
+    read_buffers_into_file_ =
+        fstat(fileno(*trace_out_stream_), &out_stat) == 0 &&
+        S_ISREG(out_stat.st_mode);
+  }
+#endif
+
   if (save_to_incidentd_ && !ignore_guardrails_ &&
       (trace_config_->duration_ms() == 0 &&
        trace_config_->trigger_config().trigger_timeout_ms() == 0)) {
@@ -690,6 +795,8 @@ base::Optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
     return 1;
   }
 
+  // No thread must have been started yet: only the calling thread survives the
+  // fork() of Daemonize().
   if (background_) {
     base::Daemonize();
   }
@@ -725,8 +832,7 @@ int PerfettoCmd::ConnectToServiceAndRun() {
   }  // if (triggers_to_activate_)
 
   if (query_service_ || bugreport_) {
-    consumer_endpoint_ =
-        ConsumerIPCClient::Connect(GetConsumerSocket(), this, &task_runner_);
+    consumer_endpoint_ = ConnectConsumer();
     task_runner_.Run();
     return 1;  // We can legitimately get here if the service disconnects.
   }            // if (query_service || bugreport_)
@@ -780,16 +886,37 @@ int PerfettoCmd::ConnectToServiceAndRun() {
   }
 #endif
 
-  consumer_endpoint_ =
-      ConsumerIPCClient::Connect(GetConsumerSocket(), this, &task_runner_);
+  // Compress and write the trace data on other threads, so that OnTraceData()
+  // returns, and the next ReadBuffers() response is received, meanwhile.
+  // This must happen after Daemonize(): the writer threads started here would
+  // not survive the fork() of --background.
+  if (packet_writer_) {
+    packet_writer_ =
+        CreateAsyncPacketWriter(std::move(packet_writer_), compress_from_cli_);
+  }
+
+  consumer_endpoint_ = ConnectConsumer();
   SetupCtrlCSignalHandler();
   task_runner_.Run();
 
+  // Disconnect while an in-process service is still alive.
+  if (in_process_service_)
+    consumer_endpoint_.reset();
+
   return limiter_->OnTraceDone(args, update_guardrail_state_, bytes_written_)
              ? 0
              : 1;
 }
 
+std::unique_ptr<TracingService::ConsumerEndpoint>
+PerfettoCmd::ConnectConsumer() {
+  if (in_process_service_) {
+    return in_process_service_->ConnectConsumer(this,
+                                                base::GetCurrentUserId());
+  }
+  return ConsumerIPCClient::Connect(GetConsumerSocket(), this, &task_runner_);
+}
+
 void PerfettoCmd::OnConnect() {
   LogUploadEvent(PerfettoStatsdAtom::kOnConnect);
   if (query_service_) {
@@ -916,6 +1043,15 @@ void PerfettoCmd::OnTracingDisabled(const std::string& error) {
     return FinalizeTraceAndExit();
   }
 
+  if (read_buffers_into_file_) {
+    // The service reads all the buffers in one go and then invokes
+    // OnTraceData() once, so the timeout between OnTraceData() calls doesn't
+    // apply (the overall trace timeout still does).
+    consumer_endpoint_->ReadBuffersIntoFile(
+        base::ScopedFile(dup(fileno(*trace_out_stream_))));
+    return;
+  }
+
   trace_data_timeout_armed_ = false;
   CheckTraceDataTimeout();
 
@@ -1055,6 +1191,10 @@ void PerfettoCmd::PrintServiceState(bool success,
     printf("  name: \"%s\" \n", producer.name().c_str());
     printf("  uid: %d \n", producer.uid());
     printf("  sdk_version: \"%s\" \n", producer.sdk_version().c_str());
+    PrintLatencyHistogram("  ", "commit_data_latency",
+                          producer.commit_data_latency());
+    PrintLatencyHistogram("  ", "smb_scrape_latency",
+                          producer.smb_scrape_latency());
     printf("}\n");
   }
 
@@ -1070,6 +1210,15 @@ void PerfettoCmd::PrintServiceState(bool success,
          svc_state.tracing_service_version().c_str());
   printf("num_sessions: %d\n", svc_state.num_sessions());
   printf("num_sessions_started: %d\n", svc_state.num_sessions_started());
+  PrintLatencyHistogram("", "commit_data_latency",
+                        svc_state.commit_data_latency());
+  PrintLatencyHistogram("", "chunk_copy_latency",
+                        svc_state.chunk_copy_latency());
+  PrintLatencyHistogram("", "smb_scrape_latency",
+                        svc_state.smb_scrape_latency());
+  PrintLatencyHistogram("", "flush_latency", svc_state.flush_latency());
+  PrintLatencyHistogram("", "read_buffers_latency",
+                        svc_state.read_buffers_latency());
 }
 
 void PerfettoCmd::OnObservableEvents(
@@ -56,6 +56,14 @@ class PerfettoCmd : public Consumer {
   base::Optional<int> ParseCmdlineAndMaybeDaemonize(int argc, char** argv);
   int ConnectToServiceAndRun();
 
+  // If set, ConnectToServiceAndRun() connects to |service| rather than to
+  // traced over IPC. |service| must run on task_runner() and must outlive the
+  // ConnectToServiceAndRun() call. Used by tracebox --all-in-one.
+  void set_in_process_service(TracingService* service) {
+    in_process_service_ = service;
+  }
+  base::TaskRunner* task_runner() { return &task_runner_; }
+
   // perfetto::Consumer implementation.
   void OnConnect() override;
   void OnDisconnect() override;
@@ -75,6 +83,7 @@ class PerfettoCmd : public Consumer {
   void PrintUsage(const char* argv0);
   void PrintServiceState(bool success, const TracingServiceState&);
   void OnTimeout();
+  std::unique_ptr<TracingService::ConsumerEndpoint> ConnectConsumer();
   bool is_detach() const { return !detach_key_.empty(); }
   bool is_attach() const { return !attach_key_.empty(); }
 
@@ -97,12 +106,18 @@ class PerfettoCmd : public Consumer {
 
   base::UnixTaskRunner task_runner_;
 
+  TracingService* in_process_service_ = nullptr;
   std::unique_ptr<RateLimiter> limiter_;
   std::unique_ptr<perfetto::TracingService::ConsumerEndpoint>
       consumer_endpoint_;
   std::unique_ptr<TraceConfig> trace_config_;
   std::unique_ptr<PacketWriter> packet_writer_;
   base::ScopedFstream trace_out_stream_;
+  // Whether the service is asked to write the trace directly into
+  // |trace_out_stream_| rather than sending it over IPC.
+  bool read_buffers_into_file_ = false;
+  // Whether the trace is compressed here rather than by the service.
+  bool compress_from_cli_ = false;
   std::vector<std::string> triggers_to_activate_;
   std::string trace_out_path_;
   base::EventFd ctrl_c_evt_;
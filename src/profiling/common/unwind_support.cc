@@ -16,13 +16,25 @@
 
 #include "src/profiling/common/unwind_support.h"
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <cinttypes>
+#include <tuple>
 
 #include <procinfo/process_map.h>
+#include <unwindstack/MachineArm.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineMips.h>
+#include <unwindstack/MachineMips64.h>
+#include <unwindstack/MachineX86.h>
+#include <unwindstack/MachineX86_64.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 
-#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/hash.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 
 namespace perfetto {
 namespace profiling {
@@ -37,12 +49,146 @@ size_t StackOverlayMemory::Read(uint64_t addr, void* dst, size_t size) {
   if (addr >= sp_ && addr + size <= stack_end_ && addr + size > sp_) {
     size_t offset = static_cast<size_t>(addr - sp_);
     memcpy(dst, stack_ + offset, size);
+    if (reads_)
+      reads_->push_back({static_cast<uint32_t>(offset),
+                         static_cast<uint32_t>(size)});
     return size;
   }
 
+  if (read_past_stack_ && addr >= sp_)
+    *read_past_stack_ = true;
   return mem_->Read(addr, dst, size);
 }
 
+namespace {
+
+uint64_t GetRawReg(unwindstack::Regs* regs, uint16_t reg) {
+  if (reg >= regs->total_regs())
+    return 0;
+  const char* raw = static_cast<const char*>(regs->RawData());
+  if (regs->Is32Bit()) {
+    uint32_t value;
+    memcpy(&value, raw + reg * sizeof(uint32_t), sizeof(value));
+    return value;
+  }
+  uint64_t value;
+  memcpy(&value, raw + reg * sizeof(uint64_t), sizeof(value));
+  return value;
+}
+
+bool IsAnonymousOrMemfd(const std::string& map_name) {
+  return map_name.empty() || base::StartsWith(map_name, "[anon:") ||
+         base::StartsWith(map_name, "/memfd:");
+}
+
+}  // namespace
+
+constexpr size_t UnwindCache::kMaxEntries;
+constexpr size_t UnwindCache::kMaxStackBytes;
+
+// static
+UnwindCache::Key UnwindCache::MakeKey(unwindstack::Regs* regs,
+                                      uint64_t stack_start) {
+  Key key{};
+  key.regs[0] = regs->pc();
+  key.regs[1] = regs->sp();
+  // The frame pointers and link registers, which the unwinding of the first
+  // frames can start from.
+  switch (regs->Arch()) {
+    case unwindstack::ARCH_ARM:
+      key.regs[2] = GetRawReg(regs, unwindstack::ARM_REG_R7);
+      key.regs[3] = GetRawReg(regs, unwindstack::ARM_REG_R11);
+      key.regs[4] = GetRawReg(regs, unwindstack::ARM_REG_LR);
+      break;
+    case unwindstack::ARCH_ARM64:
+      key.regs[2] = GetRawReg(regs, unwindstack::ARM64_REG_R29);
+      key.regs[3] = GetRawReg(regs, unwindstack::ARM64_REG_LR);
+      break;
+    case unwindstack::ARCH_X86:
+      key.regs[2] = GetRawReg(regs, unwindstack::X86_REG_EBP);
+      break;
+    case unwindstack::ARCH_X86_64:
+      key.regs[2] = GetRawReg(regs, unwindstack::X86_64_REG_RBP);
+      break;
+    case unwindstack::ARCH_MIPS:
+      key.regs[2] = GetRawReg(regs, unwindstack::MIPS_REG_R30);
+      key.regs[3] = GetRawReg(regs, unwindstack::MIPS_REG_RA);
+      break;
+    case unwindstack::ARCH_MIPS64:
+      key.regs[2] = GetRawReg(regs, unwindstack::MIPS64_REG_R30);
+      key.regs[3] = GetRawReg(regs, unwindstack::MIPS64_REG_RA);
+      break;
+    case unwindstack::ARCH_UNKNOWN:
+      break;
+  }
+  key.stack_start = stack_start;
+  return key;
+}
+
+size_t UnwindCache::KeyHasher::operator()(const Key& key) const {
+  base::Hash hasher;
+  for (uint64_t reg : key.regs)
+    hasher.Update(reg);
+  hasher.Update(key.stack_start);
+  return static_cast<size_t>(hasher.digest());
+}
+
+const std::vector<unwindstack::FrameData>* UnwindCache::Find(
+    const Key& key,
+    const uint8_t* stack,
+    size_t stack_size) {
+  Entry* entry = entries_.Find(key);
+  if (!entry)
+    return nullptr;
+  const char* cached_bytes = entry->stack_bytes.data();
+  for (const StackRead& read : entry->reads) {
+    if (read.offset + read.size > stack_size ||
+        memcmp(stack + read.offset, cached_bytes, read.size) != 0) {
+      return nullptr;
+    }
+    cached_bytes += read.size;
+  }
+  return &entry->frames;
+}
+
+void UnwindCache::Insert(const Key& key,
+                         const uint8_t* stack,
+                         size_t stack_size,
+                         const std::vector<StackRead>& reads,
+                         const std::vector<unwindstack::FrameData>& frames) {
+  Entry entry;
+  // The unwinder reads some of the words more than once.
+  entry.reads = reads;
+  std::sort(entry.reads.begin(), entry.reads.end(),
+            [](const StackRead& a, const StackRead& b) {
+              return std::tie(a.offset, a.size) < std::tie(b.offset, b.size);
+            });
+  entry.reads.erase(std::unique(entry.reads.begin(), entry.reads.end(),
+                                [](const StackRead& a, const StackRead& b) {
+                                  return a.offset == b.offset &&
+                                         a.size == b.size;
+                                }),
+                    entry.reads.end());
+  for (const StackRead& read : entry.reads) {
+    if (read.offset + read.size > stack_size)
+      return;
+    entry.stack_bytes.append(reinterpret_cast<const char*>(stack) + read.offset,
+                             read.size);
+    if (entry.stack_bytes.size() > kMaxStackBytes)
+      return;
+  }
+  for (const unwindstack::FrameData& frame : frames) {
+    if (IsAnonymousOrMemfd(frame.map_name))
+      return;
+  }
+  // Bounds the memory rather than keeping the most used entries: the
+  // samples of a steady workload fill the cache again quickly.
+  if (entries_.size() >= kMaxEntries)
+    entries_.Clear();
+  entry.frames = frames;
+  entries_[key] = std::move(entry);
+}
+
 FDMemory::FDMemory(base::ScopedFile mem_fd) : mem_fd_(std::move(mem_fd)) {}
 
 size_t FDMemory::Read(uint64_t addr, void* dst, size_t size) {
@@ -58,14 +204,22 @@ size_t FDMemory::Read(uint64_t addr, void* dst, size_t size) {
 FDMaps::FDMaps(base::ScopedFile fd) : fd_(std::move(fd)) {}
 
 bool FDMaps::Parse() {
-  // If the process has already exited, lseek or ReadFileDescriptor will
-  // return false.
-  if (lseek(*fd_, 0, SEEK_SET) == -1)
-    return false;
-
+  // Read with pread rather than seeking to the start, as duplicates of the fd
+  // share the file offset and are parsed concurrently by heapprofd's
+  // unwinding workers. If the process has already exited, pread will fail.
   std::string content;
-  if (!base::ReadFileDescriptor(*fd_, &content))
-    return false;
+  for (;;) {
+    constexpr size_t kChunkSize = 4096;
+    size_t offset = content.size();
+    content.resize(offset + kChunkSize);
+    ssize_t rd = PERFETTO_EINTR(pread64(*fd_, &content[offset], kChunkSize,
+                                        static_cast<off64_t>(offset)));
+    if (rd == -1)
+      return false;
+    content.resize(offset + static_cast<size_t>(rd));
+    if (rd == 0)
+      break;
+  }
 
   unwindstack::SharedString name("");
   unwindstack::MapInfo* prev_map = nullptr;
@@ -98,14 +252,19 @@ void FDMaps::Reset() {
 
 UnwindingMetadata::UnwindingMetadata(base::ScopedFile maps_fd,
                                      base::ScopedFile mem_fd)
-    : fd_maps(std::move(maps_fd)),
-      fd_mem(std::make_shared<FDMemory>(std::move(mem_fd))) {
+    : UnwindingMetadata(std::move(maps_fd),
+                        std::make_shared<FDMemory>(std::move(mem_fd))) {}
+
+UnwindingMetadata::UnwindingMetadata(base::ScopedFile maps_fd,
+                                     std::shared_ptr<unwindstack::Memory> mem)
+    : fd_maps(std::move(maps_fd)), fd_mem(std::move(mem)) {
   if (!fd_maps.Parse())
     PERFETTO_DLOG("Failed initial maps parse");
 }
 
 void UnwindingMetadata::ReparseMaps() {
   reparses++;
+  unwind_cache.Clear();
   fd_maps.Reset();
   fd_maps.Parse();
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
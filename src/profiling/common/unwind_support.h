@@ -20,10 +20,16 @@
 // defines PERFETTO_BUILDFLAG
 #include "perfetto/base/build_config.h"
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <unwindstack/Maps.h>
+#include <unwindstack/Regs.h>
 #include <unwindstack/Unwinder.h>
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
 #include <unwindstack/DexFiles.h>
@@ -32,6 +38,7 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/scoped_file.h"
 
 namespace perfetto {
@@ -60,6 +67,8 @@ class FDMaps : public unwindstack::Maps {
   bool Parse() override;
   void Reset();
 
+  int fd() const { return *fd_; }
+
  private:
   base::ScopedFile fd_;
 };
@@ -73,6 +82,12 @@ class FDMemory : public unwindstack::Memory {
   base::ScopedFile mem_fd_;
 };
 
+// A read of [sp + offset, sp + offset + size) from a StackOverlayMemory.
+struct StackRead {
+  uint32_t offset;
+  uint32_t size;
+};
+
 // Overlays size bytes pointed to by stack for addresses in [sp, sp + size).
 // Addresses outside of that range are read from mem_fd, which should be an fd
 // that opened /proc/[pid]/mem.
@@ -84,15 +99,85 @@ class StackOverlayMemory : public unwindstack::Memory {
                      size_t size);
   size_t Read(uint64_t addr, void* dst, size_t size) override;
 
+  // Appends the reads served from the overlaid stack to |reads|, for the
+  // UnwindCache. Reads of addresses above sp that miss the overlay, which
+  // might be a truncated part of the stack, set |read_past_stack|.
+  void RecordReads(std::vector<StackRead>* reads, bool* read_past_stack) {
+    reads_ = reads;
+    read_past_stack_ = read_past_stack;
+  }
+
  private:
   std::shared_ptr<unwindstack::Memory> mem_;
   const uint64_t sp_;
   const uint64_t stack_end_;
   const uint8_t* const stack_;
+  std::vector<StackRead>* reads_ = nullptr;
+  bool* read_past_stack_ = nullptr;
+};
+
+// Caches the frames unwound from the samples of a process, as the same
+// stacks are sampled over and over.
+// Unwinding depends on the registers, on the stack and on the mappings and
+// code of the process. Entries are keyed on the registers that the unwinding
+// of compiled code starts from (pc, sp and the frame pointer and link
+// registers) and only match a sample whose stack has the same bytes where
+// the unwinding of the entry read it. The cache has to be cleared when the
+// mappings change. Unwinds through anonymous or memfd mappings, such as JIT
+// code, are not cached as their code can change in place.
+class UnwindCache {
+ public:
+  static constexpr size_t kMaxEntries = 128;
+  static constexpr size_t kMaxStackBytes = 4096;
+
+  struct Key {
+    uint64_t regs[5];
+    // Start of the sampled stack, which the StackReads are relative to.
+    uint64_t stack_start;
+
+    bool operator==(const Key& other) const {
+      return memcmp(this, &other, sizeof(*this)) == 0;
+    }
+  };
+
+  static Key MakeKey(unwindstack::Regs* regs, uint64_t stack_start);
+
+  // Returns the frames of a previous unwind of the sample with |key| and
+  // |stack|, or nullptr.
+  const std::vector<unwindstack::FrameData>* Find(const Key& key,
+                                                  const uint8_t* stack,
+                                                  size_t stack_size);
+
+  // Caches |frames|, the result of a successful unwind of the sample with
+  // |key| and |stack| during which |reads| of the stack were made.
+  void Insert(const Key& key,
+              const uint8_t* stack,
+              size_t stack_size,
+              const std::vector<StackRead>& reads,
+              const std::vector<unwindstack::FrameData>& frames);
+
+  void Clear() { entries_.Clear(); }
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct KeyHasher {
+    size_t operator()(const Key& key) const;
+  };
+  struct Entry {
+    std::vector<StackRead> reads;
+    std::string stack_bytes;
+    std::vector<unwindstack::FrameData> frames;
+  };
+
+  base::FlatHashMap<Key, Entry, KeyHasher> entries_;
 };
 
 struct UnwindingMetadata {
   UnwindingMetadata(base::ScopedFile maps_fd, base::ScopedFile mem_fd);
+  // |mem| can be shared with other UnwindingMetadata of the same process, as
+  // the reads through it are stateless.
+  UnwindingMetadata(base::ScopedFile maps_fd,
+                    std::shared_ptr<unwindstack::Memory> mem);
 
   // move-only
   UnwindingMetadata(const UnwindingMetadata&) = delete;
@@ -112,6 +197,8 @@ struct UnwindingMetadata {
 
   std::string empty_string_;
   FDMaps fd_maps;
+  // Cleared by ReparseMaps.
+  UnwindCache unwind_cache;
   // The API of libunwindstack expects shared_ptr for Memory.
   std::shared_ptr<unwindstack::Memory> fd_mem;
   uint64_t reparses = 0;
@@ -17,12 +17,13 @@
 #ifndef SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 #define SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 
-#include <map>
 #include <vector>
 
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "src/profiling/common/callstack_trie.h"
 #include "src/profiling/common/interner.h"
+#include "src/profiling/memory/object_pool.h"
 #include "src/profiling/memory/unwound_messages.h"
 
 // Below is an illustration of the bookkeeping system state where
@@ -111,6 +112,9 @@ class HeapTracker {
     explicit CallstackAllocations(GlobalCallstackTrie::Node* n) : node(n) {}
 
     uint64_t allocs = 0;
+    // Whether |value| changed since the last GetCallstackAllocations. Not
+    // maintained in dump_at_max mode.
+    bool changed_since_dump = true;
 
     union {
       CallstackMaxAllocations retain_max;
@@ -129,6 +133,7 @@ class HeapTracker {
   // Caller needs to ensure that callsites outlives the HeapTracker.
   explicit HeapTracker(GlobalCallstackTrie* callsites, bool dump_at_max_mode)
       : callsites_(callsites), dump_at_max_mode_(dump_at_max_mode) {}
+  ~HeapTracker();
 
   void RecordMalloc(const std::vector<unwindstack::FrameData>& callstack,
                     const std::vector<std::string>& build_ids,
@@ -145,42 +150,46 @@ class HeapTracker {
     // * We need to remove them after the callstacks were dumped, which
     //   currently happens after the allocations are dumped.
     // * This way, we do not destroy and recreate callstacks as frequently.
-    for (auto it_and_alloc : dead_callstack_allocations_) {
-      auto& it = it_and_alloc.first;
-      uint64_t allocated = it_and_alloc.second;
-      const CallstackAllocations& alloc = it->second;
+    for (const auto& node_and_allocated : dead_callstack_allocations_) {
+      GlobalCallstackTrie::Node* node = node_and_allocated.first;
+      uint64_t allocated = node_and_allocated.second;
+      CallstackAllocations** alloc_ptr = callstack_allocations_.Find(node);
+      PERFETTO_DCHECK(alloc_ptr);
+      CallstackAllocations* alloc = *alloc_ptr;
       // For non-dump-at-max, we need to check, even if there are still no
       // allocations referencing this callstack, whether there were any
       // allocations that happened but were freed again. If that was the case,
       // we need to keep the callsite, because the next dump will indicate a
       // different self_alloc and self_freed.
-      if (alloc.allocs == 0 &&
+      if (alloc->allocs == 0 &&
           (dump_at_max_mode_ ||
-           alloc.value.totals.allocation_count == allocated)) {
+           alloc->value.totals.allocation_count == allocated)) {
         // TODO(fmayer): We could probably be smarter than throw away
         // our whole frames cache.
         ClearFrameCache();
-        callstack_allocations_.erase(it);
+        callstack_allocations_.Erase(node);
+        callstack_allocations_pool_.Delete(alloc);
       }
     }
     dead_callstack_allocations_.clear();
 
-    for (auto it = callstack_allocations_.begin();
-         it != callstack_allocations_.end(); ++it) {
-      const CallstackAllocations& alloc = it->second;
+    for (auto it = callstack_allocations_.GetIterator(); it; ++it) {
+      const CallstackAllocations& alloc = *it.value();
       fn(alloc);
+      it.value()->changed_since_dump = false;
 
       if (alloc.allocs == 0)
         dead_callstack_allocations_.emplace_back(
-            it, !dump_at_max_mode_ ? alloc.value.totals.allocation_count : 0);
+            it.key(),
+            !dump_at_max_mode_ ? alloc.value.totals.allocation_count : 0);
     }
   }
 
   template <typename F>
   void GetAllocations(F fn) {
-    for (const auto& addr_and_allocation : allocations_) {
-      const Allocation& alloc = addr_and_allocation.second;
-      fn(addr_and_allocation.first, alloc.sample_size, alloc.alloc_size,
+    for (auto it = allocations_.GetIterator(); it; ++it) {
+      const Allocation& alloc = it.value();
+      fn(it.key(), alloc.sample_size, alloc.alloc_size,
          alloc.callstack_allocations()->node->id());
     }
   }
@@ -191,7 +200,7 @@ class HeapTracker {
     RecordOperation(sequence_number, {address, timestamp});
   }
 
-  void ClearFrameCache() { frame_cache_.clear(); }
+  void ClearFrameCache() { frame_cache_.Clear(); }
 
   uint64_t dump_timestamp() {
     return dump_at_max_mode_ ? max_timestamp_ : committed_timestamp_;
@@ -256,15 +265,13 @@ class HeapTracker {
 
   CallstackAllocations* MaybeCreateCallstackAllocations(
       GlobalCallstackTrie::Node* node) {
-    auto callstack_allocations_it = callstack_allocations_.find(node);
-    if (callstack_allocations_it == callstack_allocations_.end()) {
+    CallstackAllocations*& callstack_allocations =
+        callstack_allocations_[node];
+    if (!callstack_allocations) {
       GlobalCallstackTrie::IncrementNode(node);
-      bool inserted;
-      std::tie(callstack_allocations_it, inserted) =
-          callstack_allocations_.emplace(node, node);
-      PERFETTO_DCHECK(inserted);
+      callstack_allocations = callstack_allocations_pool_.New(node);
     }
-    return &callstack_allocations_it->second;
+    return callstack_allocations;
   }
 
   void RecordOperation(uint64_t sequence_number,
@@ -298,11 +305,11 @@ class HeapTracker {
         alloc.callstack_allocations()->value.retain_max.max_count =
             alloc.callstack_allocations()->value.retain_max.cur_count;
       } else {
-        for (auto& p : callstack_allocations_) {
+        for (auto it = callstack_allocations_.GetIterator(); it; ++it) {
           // We need to reset max = cur for every CallstackAllocation, as we
           // do not know which ones have changed since the last max.
           // TODO(fmayer): Add an index to speed this up
-          CallstackAllocations& csa = p.second;
+          CallstackAllocations& csa = *it.value();
           csa.value.retain_max.max = csa.value.retain_max.cur;
           csa.value.retain_max.max_count = csa.value.retain_max.cur_count;
         }
@@ -314,6 +321,7 @@ class HeapTracker {
       alloc.callstack_allocations()->value.totals.allocated +=
           alloc.sample_size;
       alloc.callstack_allocations()->value.totals.allocation_count++;
+      alloc.callstack_allocations()->changed_since_dump = true;
     }
   }
 
@@ -325,19 +333,24 @@ class HeapTracker {
     } else {
       alloc.callstack_allocations()->value.totals.freed += alloc.sample_size;
       alloc.callstack_allocations()->value.totals.free_count++;
+      alloc.callstack_allocations()->changed_since_dump = true;
     }
   }
 
   // We cannot use an interner here, because after the last allocation goes
   // away, we still need to keep the CallstackAllocations around until the next
   // dump.
-  std::map<GlobalCallstackTrie::Node*, CallstackAllocations>
+  // The CallstackAllocations are pointed to by the Allocations, so they live
+  // in a pool rather than in the map, whose entries move.
+  ObjectPool<CallstackAllocations> callstack_allocations_pool_;
+  base::FlatHashMap<GlobalCallstackTrie::Node*, CallstackAllocations*>
       callstack_allocations_;
 
-  std::vector<std::pair<decltype(callstack_allocations_)::iterator, uint64_t>>
+  std::vector<std::pair<GlobalCallstackTrie::Node*, uint64_t>>
       dead_callstack_allocations_;
 
-  std::map<uint64_t /* allocation address */, Allocation> allocations_;
+  base::FlatHashMap<uint64_t /* allocation address */, Allocation>
+      allocations_;
 
   // An operation is either a commit of an allocation or freeing of an
   // allocation. An operation is a free if its seq_id is larger than
@@ -346,7 +359,8 @@ class HeapTracker {
   //
   // If its seq_id is less than the sequence_number of the corresponding
   // allocation it could be either, but is ignored either way.
-  std::map<uint64_t /* seq_id */, PendingOperation /* allocation address */>
+  base::FlatHashMap<uint64_t /* seq_id */,
+                    PendingOperation /* allocation address */>
       pending_operations_;
 
   uint64_t committed_timestamp_ = 0;
@@ -363,7 +377,7 @@ class HeapTracker {
 
   // We index by abspc, which is unique as long as the maps do not change.
   // This is why we ClearFrameCache after we reparsed maps.
-  std::unordered_map<uint64_t /* abs pc */, Interned<Frame>> frame_cache_;
+  base::FlatHashMap<uint64_t /* abs pc */, Interned<Frame>> frame_cache_;
 };
 
 }  // namespace profiling
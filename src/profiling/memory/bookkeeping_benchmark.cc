@@ -0,0 +1,89 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "src/profiling/memory/bookkeeping.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr uint64_t kNumAddresses = 1 << 16;
+constexpr uint64_t kNumCallstacks = 64;
+
+std::vector<std::vector<unwindstack::FrameData>> MakeCallstacks() {
+  std::vector<std::vector<unwindstack::FrameData>> callstacks;
+  for (uint64_t i = 0; i < kNumCallstacks; i++) {
+    std::vector<unwindstack::FrameData> callstack;
+    for (uint64_t depth = 0; depth < 8; depth++) {
+      unwindstack::FrameData data{};
+      data.function_name = "fun" + std::to_string(depth);
+      data.map_name = "map";
+      data.pc = depth == 7 ? i : depth;
+      callstack.emplace_back(std::move(data));
+    }
+    callstacks.emplace_back(std::move(callstack));
+  }
+  return callstacks;
+}
+
+}  // namespace
+
+// Mallocs and frees of many live addresses, in order.
+static void BM_HeapTrackerMallocFree(benchmark::State& state) {
+  GlobalCallstackTrie callsites;
+  HeapTracker hd(&callsites, false);
+  auto callstacks = MakeCallstacks();
+  std::vector<std::string> build_ids(8);
+  uint64_t sequence_number = 0;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    uint64_t address = 0x1000 + (i % kNumAddresses) * 16;
+    if (i >= kNumAddresses)
+      hd.RecordFree(address, ++sequence_number, sequence_number);
+    hd.RecordMalloc(callstacks[i % kNumCallstacks], build_ids, address, 16, 16,
+                    ++sequence_number, sequence_number);
+    i++;
+  }
+}
+
+BENCHMARK(BM_HeapTrackerMallocFree);
+
+// Like above, but the frees arrive before the preceding malloc, so that they
+// go through the pending operations.
+static void BM_HeapTrackerMallocFreeOutOfOrder(benchmark::State& state) {
+  GlobalCallstackTrie callsites;
+  HeapTracker hd(&callsites, false);
+  auto callstacks = MakeCallstacks();
+  std::vector<std::string> build_ids(8);
+  uint64_t sequence_number = 0;
+  uint64_t i = 0;
+  for (auto _ : state) {
+    uint64_t address = 0x1000 + (i % kNumAddresses) * 16;
+    hd.RecordFree(address, sequence_number + 2, sequence_number + 2);
+    hd.RecordMalloc(callstacks[i % kNumCallstacks], build_ids, address, 16, 16,
+                    sequence_number + 1, sequence_number + 1);
+    sequence_number += 2;
+    i++;
+  }
+}
+
+BENCHMARK(BM_HeapTrackerMallocFreeOutOfOrder);
+
+}  // namespace profiling
+}  // namespace perfetto
@@ -102,6 +102,38 @@ TEST(BookkeepingTest, Replace) {
   hd.GetCallstackAllocations([](const HeapTracker::CallstackAllocations&) {});
 }
 
+TEST(BookkeepingTest, ChangedSinceDump) {
+  uint64_t sequence_number = 1;
+  GlobalCallstackTrie c;
+  HeapTracker hd(&c, false);
+
+  hd.RecordMalloc(stack(), DummyBuildIds(stack().size()), 0x1, 5, 5,
+                  sequence_number, 100 * sequence_number);
+  sequence_number++;
+  hd.RecordMalloc(stack2(), DummyBuildIds(stack2().size()), 0x2, 2, 2,
+                  sequence_number, 100 * sequence_number);
+  sequence_number++;
+
+  size_t changed = 0;
+  auto count_changed =
+      [&changed](const HeapTracker::CallstackAllocations& alloc) {
+        if (alloc.changed_since_dump)
+          changed++;
+      };
+  hd.GetCallstackAllocations(count_changed);
+  EXPECT_EQ(changed, 2u);
+
+  changed = 0;
+  hd.GetCallstackAllocations(count_changed);
+  EXPECT_EQ(changed, 0u);
+
+  hd.RecordFree(0x2, sequence_number, 100 * sequence_number);
+  sequence_number++;
+  changed = 0;
+  hd.GetCallstackAllocations(count_changed);
+  EXPECT_EQ(changed, 1u);
+}
+
 TEST(BookkeepingTest, Basic) {
   uint64_t sequence_number = 1;
   GlobalCallstackTrie c;
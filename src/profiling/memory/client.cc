@@ -16,6 +16,7 @@
 
 #include "src/profiling/memory/client.h"
 
+#include <pthread.h>
 #include <signal.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
@@ -56,6 +57,21 @@ namespace {
 const char kSingleByte[1] = {'x'};
 constexpr auto kResendBackoffUs = 100;
 
+inline size_t GetFreeBatchIndex(size_t num_batches) {
+  // pthread_t is the address of the thread's control block on Linux and
+  // Android. Mix it, as its low bits are mostly the same across threads.
+  uint64_t hash = static_cast<uint64_t>(pthread_self()) * 0x9E3779B97F4A7C15ull;
+  return static_cast<size_t>(hash >> 32) % num_batches;
+}
+
+inline uint64_t GetCoarseTimeMs() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) != 0)
+    return 0;
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 +
+         static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
 inline bool IsMainThread() {
   return getpid() == base::GetThreadId();
 }
@@ -365,6 +381,11 @@ bool Client::RecordMalloc(uint32_t heap_id,
     return postfork_return_value_;
   }
 
+  // Sampled mallocs are rare compared to frees, and already expensive. Use
+  // them to make sure that the frees of idle threads don't stay buffered.
+  if (!FlushFreeBatches())
+    return false;
+
   AllocMetadata metadata;
   const char* stackptr = reinterpret_cast<char*>(__builtin_frame_address(0));
   unwindstack::AsmGetRegs(metadata.register_data);
@@ -437,6 +458,30 @@ bool Client::RecordFree(uint32_t heap_id, const uint64_t alloc_address) {
       1 + sequence_number_[heap_id].fetch_add(1, std::memory_order_acq_rel);
   current_entry.addr = alloc_address;
   current_entry.heap_id = heap_id;
+
+  // The sequence number is assigned above, so the daemon still applies the
+  // free in the right order relative to the other threads' operations, even
+  // though it is sent later.
+  //
+  // If the batch is in use by another thread mapped to it, send the free on
+  // its own rather than waiting. The lock is only held for short appends and
+  // flushes, so the Try below hardly ever spins.
+  FreeBatch* batch = &free_batches_[GetFreeBatchIndex(kNumFreeBatches)];
+  if (PERFETTO_LIKELY(!batch->lock.locked.load(std::memory_order_relaxed))) {
+    ScopedSpinlock lock(&batch->lock, ScopedSpinlock::Mode::Try);
+    if (PERFETTO_LIKELY(lock.locked())) {
+      uint64_t now_ms = GetCoarseTimeMs();
+      if (batch->num_entries == 0)
+        batch->first_entry_timestamp_ms = now_ms;
+      batch->entries[batch->num_entries++] = current_entry;
+      if (batch->num_entries < kMaxFreeBatchEntries &&
+          now_ms - batch->first_entry_timestamp_ms < kFreeBatchMaxAgeMs) {
+        return true;
+      }
+      return FlushFreeBatchLocked(batch);
+    }
+  }
+
   WireMessage msg = {};
   msg.record_type = RecordType::Free;
   msg.free_header = &current_entry;
@@ -454,6 +499,47 @@ bool Client::RecordFree(uint32_t heap_id, const uint64_t alloc_address) {
   return true;
 }
 
+bool Client::FlushFreeBatches() {
+  if (PERFETTO_UNLIKELY(IsPostFork())) {
+    return postfork_return_value_;
+  }
+  for (FreeBatch& batch : free_batches_) {
+    // Skip the batches that are being appended to or flushed by their thread.
+    if (batch.lock.locked.load(std::memory_order_relaxed))
+      continue;
+    ScopedSpinlock lock(&batch.lock, ScopedSpinlock::Mode::Try);
+    if (!lock.locked())
+      continue;
+    if (!FlushFreeBatchLocked(&batch))
+      return false;
+  }
+  return true;
+}
+
+bool Client::FlushFreeBatchLocked(FreeBatch* batch) {
+  if (batch->num_entries == 0)
+    return true;
+  FreeBatchHeader header;
+  header.num_entries = batch->num_entries;
+  WireMessage msg = {};
+  msg.record_type = RecordType::FreeBatch;
+  msg.free_batch_header = &header;
+  msg.payload = reinterpret_cast<char*>(&batch->entries[0]);
+  msg.payload_size = static_cast<size_t>(batch->num_entries) * sizeof(FreeEntry);
+  batch->num_entries = 0;
+  // Do not send control socket byte, as frees are very cheap to handle, so we
+  // just delay to the next alloc.
+  int64_t bytes_free = SendWireMessageWithRetriesIfBlocking(msg);
+  if (bytes_free == -1)
+    return false;
+  // Seems like we are filling up the shmem with frees. Flush.
+  if (static_cast<uint64_t>(bytes_free) < shmem_.size() / 2 &&
+      shmem_.GetAndResetReaderPaused()) {
+    return SendControlSocketByte();
+  }
+  return true;
+}
+
 bool Client::RecordHeapInfo(uint32_t heap_id,
                             const char* heap_name,
                             uint64_t interval) {
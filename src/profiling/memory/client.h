@@ -23,11 +23,13 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <type_traits>
 #include <vector>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "src/profiling/memory/sampler.h"
+#include "src/profiling/memory/scoped_spinlock.h"
 #include "src/profiling/memory/shared_ring_buffer.h"
 #include "src/profiling/memory/unhooked_allocator.h"
 #include "src/profiling/memory/wire_protocol.h"
@@ -110,11 +112,38 @@ class Client {
   uint64_t adaptive_sampling_max_sampling_interval_bytes() {
     return client_config_.adaptive_sampling_max_sampling_interval_bytes;
   }
+  uint64_t adaptive_sampling_spinlock_blocked_us() {
+    return client_config_.adaptive_sampling_spinlock_blocked_us;
+  }
+  bool adaptive_sampling_restore_interval() {
+    return client_config_.adaptive_sampling_restore_interval;
+  }
   uint64_t write_avail() { return shmem_.write_avail(); }
 
   bool IsConnected();
 
  private:
+  // Threads are mapped to batches by a hash of their pthread_t, rather than
+  // using thread-local storage, which might allocate.
+  static constexpr size_t kNumFreeBatches = 16;
+  // A batch is flushed by the next free of a thread mapped to it, once its
+  // first entry is this old, or by the next sampled malloc of any thread.
+  static constexpr uint64_t kFreeBatchMaxAgeMs = 100;
+
+  struct FreeBatch {
+    Spinlock lock;
+    uint64_t num_entries;
+    uint64_t first_entry_timestamp_ms;
+    FreeEntry entries[kMaxFreeBatchEntries];
+  };
+
+  static_assert(std::is_trivially_constructible<FreeBatch>::value,
+                "FreeBatch needs to be trivially constructible.");
+
+  // Sends the buffered deallocations of all threads. The daemon cannot apply
+  // the operations that follow a buffered one until it receives it.
+  bool FlushFreeBatches() PERFETTO_WARN_UNUSED_RESULT;
+  bool FlushFreeBatchLocked(FreeBatch* batch) PERFETTO_WARN_UNUSED_RESULT;
   const char* GetStackEnd(const char* stacktop);
   bool SendControlSocketByte() PERFETTO_WARN_UNUSED_RESULT;
   int64_t SendWireMessageWithRetriesIfBlocking(const WireMessage&)
@@ -131,6 +160,7 @@ class Client {
   std::atomic<uint64_t>
       sequence_number_[base::ArraySize(ClientConfiguration{}.heaps)] = {};
   SharedRingBuffer shmem_;
+  FreeBatch free_batches_[kNumFreeBatches] = {};
 
   // Used to detect (during the slow path) the situation where the process has
   // forked during profiling, and is performing malloc operations in the child.
@@ -25,6 +25,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cinttypes>
 #include <memory>
@@ -32,6 +33,7 @@
 #include <type_traits>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/no_destructor.h"
 #include "perfetto/ext/base/unix_socket.h"
@@ -40,6 +42,7 @@
 #include "src/profiling/common/proc_utils.h"
 #include "src/profiling/memory/client.h"
 #include "src/profiling/memory/client_api_factory.h"
+#include "src/profiling/memory/sampler.h"
 #include "src/profiling/memory/scoped_spinlock.h"
 #include "src/profiling/memory/unhooked_allocator.h"
 #include "src/profiling/memory/wire_protocol.h"
@@ -53,11 +56,20 @@ struct AHeapInfo {
   void* disabled_callback_data;
 
   // Internal fields.
-  perfetto::profiling::Sampler sampler;
+  // Each thread samples with its own Sampler (see GetThreadSampler), which
+  // picks up changes of the interval on its next allocation.
+  std::atomic<uint64_t> sampling_interval;
   std::atomic<bool> ready;
   std::atomic<bool> enabled;
   std::atomic<uint64_t> adaptive_sampling_shmem_threshold;
   std::atomic<uint64_t> adaptive_sampling_max_sampling_interval_bytes;
+  // The interval of the session, which adaptive sampling can restore
+  // |sampling_interval| to.
+  std::atomic<uint64_t> configured_sampling_interval;
+  // The number of sampled allocations since the buffer was last under
+  // pressure. Only updated by the sampled allocations while holding
+  // g_client_lock.
+  std::atomic<uint64_t> samples_without_pressure;
 };
 
 struct AHeapProfileEnableCallbackInfo {
@@ -71,6 +83,13 @@ namespace {
 using perfetto::profiling::ScopedSpinlock;
 using perfetto::profiling::UnhookedAllocator;
 
+// With adaptive_sampling_restore_interval, the sampling interval is halved
+// once this many allocations were sampled without any pressure, with at
+// least this times adaptive_sampling_shmem_threshold bytes free in the
+// buffer. Both prevent the interval from flapping.
+constexpr uint64_t kAdaptiveSamplingRestoreSamples = 1024;
+constexpr uint64_t kAdaptiveSamplingRestoreShmemFactor = 4;
+
 #if defined(__GLIBC__)
 const char* getprogname() {
   return program_invocation_short_name;
@@ -121,8 +140,35 @@ AHeapInfo& GetHeap(uint32_t id) {
   return g_heaps[id];
 }
 
-// Protects g_client, and serves as an external lock for sampling decisions (see
-// perfetto::profiling::Sampler).
+// The samplers of each thread, so that the allocations that are not sampled
+// don't need to take any lock. A thread only keeps the samplers of a few
+// heaps, selected by heap id: when two heaps share a slot, switching between
+// them resets the sampler, which doesn't bias the samples (see Sampler).
+//
+// Zero-initialized and trivially destructible, so that it doesn't need any
+// TLS initialization or destruction code, which could allocate.
+struct ThreadSampler {
+  uint32_t heap_id;
+  perfetto::profiling::Sampler sampler;
+};
+
+constexpr uint32_t kThreadSamplers = 8;
+
+PERFETTO_THREAD_LOCAL ThreadSampler g_thread_samplers[kThreadSamplers];
+
+perfetto::profiling::Sampler& GetThreadSampler(uint32_t heap_id,
+                                               uint64_t sampling_interval) {
+  ThreadSampler& thread_sampler = g_thread_samplers[heap_id % kThreadSamplers];
+  if (PERFETTO_UNLIKELY(thread_sampler.heap_id != heap_id ||
+                        thread_sampler.sampler.sampling_interval() !=
+                            sampling_interval)) {
+    thread_sampler.heap_id = heap_id;
+    thread_sampler.sampler.SetSamplingInterval(sampling_interval);
+  }
+  return thread_sampler.sampler;
+}
+
+// Protects g_client, and the updates of the heaps' sampling intervals.
 //
 // We rely on this atomic's destuction being a nop, as it is possible for the
 // hooks to attempt to acquire the spinlock after its destructor should have run
@@ -217,6 +263,9 @@ uint64_t MaybeToggleHeap(uint32_t heap_id,
     heap.adaptive_sampling_max_sampling_interval_bytes.store(
         client->client_config().adaptive_sampling_max_sampling_interval_bytes,
         std::memory_order_relaxed);
+    heap.configured_sampling_interval.store(interval,
+                                            std::memory_order_relaxed);
+    heap.samples_without_pressure.store(0, std::memory_order_relaxed);
     heap.enabled.store(true, std::memory_order_release);
     client->RecordHeapInfo(heap_id, &heap.heap_name[0], interval);
   } else if (heap.enabled.load(std::memory_order_acquire)) {
@@ -370,7 +419,7 @@ __attribute__((visibility("default"))) uint32_t AHeapProfile_registerHeap(
         OnSpinlockTimeout();
         return 0;
       }
-      info->sampler.SetSamplingInterval(interval);
+      info->sampling_interval.store(interval, std::memory_order_relaxed);
     }
   }
   return heap_id;
@@ -382,7 +431,16 @@ AHeapProfile_reportAllocation(uint32_t heap_id, uint64_t id, uint64_t size) {
   if (!heap.enabled.load(std::memory_order_acquire)) {
     return false;
   }
-  size_t sampled_alloc_sz = 0;
+  uint64_t sampling_interval =
+      heap.sampling_interval.load(std::memory_order_relaxed);
+  if (PERFETTO_UNLIKELY(sampling_interval == 0))
+    return false;
+  // Decided without any lock, most allocations stop here.
+  size_t sampled_alloc_sz = GetThreadSampler(heap_id, sampling_interval)
+                                .SampleSize(static_cast<size_t>(size));
+  if (sampled_alloc_sz == 0)  // not sampling
+    return false;
+
   std::shared_ptr<perfetto::profiling::Client> client;
   {
     ScopedSpinlock s(&g_client_lock, ScopedSpinlock::Mode::Try);
@@ -400,22 +458,44 @@ AHeapProfile_reportAllocation(uint32_t heap_id, uint64_t id, uint64_t size) {
       client_ptr->AddClientSpinlockBlockedUs(s.blocked_us());
     }
 
-    sampled_alloc_sz = heap.sampler.SampleSize(static_cast<size_t>(size));
-    if (sampled_alloc_sz == 0)  // not sampling
-      return false;
-    if (client_ptr->write_avail() <
-        client_ptr->adaptive_sampling_shmem_threshold()) {
+    uint64_t write_avail = client_ptr->write_avail();
+    uint64_t shmem_threshold = client_ptr->adaptive_sampling_shmem_threshold();
+    uint64_t blocked_us_threshold =
+        client_ptr->adaptive_sampling_spinlock_blocked_us();
+    if (write_avail < shmem_threshold ||
+        (blocked_us_threshold != 0 && s.blocked_us() >= blocked_us_threshold)) {
+      heap.samples_without_pressure.store(0, std::memory_order_relaxed);
+      // Reloaded, as another thread might have already increased it.
+      uint64_t interval =
+          heap.sampling_interval.load(std::memory_order_relaxed);
       bool should_increment = true;
       if (client_ptr->adaptive_sampling_max_sampling_interval_bytes() != 0) {
         should_increment =
-            heap.sampler.sampling_interval() <
+            interval <
             client_ptr->adaptive_sampling_max_sampling_interval_bytes();
       }
       if (should_increment) {
-        uint64_t new_interval = 2 * heap.sampler.sampling_interval();
-        heap.sampler.SetSamplingInterval(2 * heap.sampler.sampling_interval());
+        uint64_t new_interval = 2 * interval;
+        heap.sampling_interval.store(new_interval, std::memory_order_relaxed);
+        client_ptr->RecordHeapInfo(heap_id, "", new_interval);
+      }
+    } else if (client_ptr->adaptive_sampling_restore_interval()) {
+      uint64_t samples =
+          heap.samples_without_pressure.load(std::memory_order_relaxed) + 1;
+      uint64_t interval =
+          heap.sampling_interval.load(std::memory_order_relaxed);
+      uint64_t configured_interval =
+          heap.configured_sampling_interval.load(std::memory_order_relaxed);
+      if (samples >= kAdaptiveSamplingRestoreSamples &&
+          interval > configured_interval &&
+          write_avail >=
+              kAdaptiveSamplingRestoreShmemFactor * shmem_threshold) {
+        samples = 0;
+        uint64_t new_interval = std::max(interval / 2, configured_interval);
+        heap.sampling_interval.store(new_interval, std::memory_order_relaxed);
         client_ptr->RecordHeapInfo(heap_id, "", new_interval);
       }
+      heap.samples_without_pressure.store(samples, std::memory_order_relaxed);
     }
 
     client = client_ptr;  // owning copy
@@ -551,8 +631,8 @@ __attribute__((visibility("default"))) bool AHeapProfile_initSession(
       return false;
     }
 
-    // This needs to happen under the lock for mutual exclusion regarding the
-    // random engine.
+    // This needs to happen under the lock for mutual exclusion with the
+    // adaptive sampling.
     for (uint32_t i = kMinHeapId; i < max_heap; ++i) {
       AHeapInfo& heap = GetHeap(i);
       if (!heap.ready.load(std::memory_order_acquire)) {
@@ -562,7 +642,7 @@ __attribute__((visibility("default"))) bool AHeapProfile_initSession(
           GetHeapSamplingInterval(client->client_config(), heap.heap_name);
       if (interval) {
         heaps_enabled[i] = true;
-        heap.sampler.SetSamplingInterval(interval);
+        heap.sampling_interval.store(interval, std::memory_order_relaxed);
       }
     }
 
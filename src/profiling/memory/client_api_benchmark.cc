@@ -14,6 +14,8 @@
 
 #include <benchmark/benchmark.h>
 
+#include <atomic>
+
 #include "perfetto/heap_profile.h"
 #include "src/profiling/memory/heap_profile_internal.h"
 
@@ -215,6 +217,67 @@ static void BM_ClientApiEnabledHeapFree(benchmark::State& state) {
 
 BENCHMARK(BM_ClientApiEnabledHeapFree);
 
+// Like above, but from many threads at once, to measure the contention on the
+// shared ring buffer.
+static void BM_ClientApiEnabledHeapFreeMultiThreaded(benchmark::State& state) {
+  static std::atomic<uint32_t> threads_running{0};
+  const uint32_t heap_id = GetHeapId();
+
+  // The first thread sets up the session, the others wait for it at the start
+  // of the benchmark loop.
+  if (threads_running.fetch_add(1) == 0) {
+    ClientConfiguration client_config{};
+    client_config.default_interval = 32000;
+    client_config.all_heaps = true;
+    g_client_config = client_config;
+    PERFETTO_CHECK(AHeapProfile_initSession(malloc, free));
+    PERFETTO_CHECK(g_shmem_fd);
+  }
+
+  for (auto _ : state) {
+    AHeapProfile_reportFree(heap_id, 0x123);
+  }
+
+  // All the threads are done with the loop, the last one tears down the
+  // session.
+  if (threads_running.fetch_sub(1) == 1) {
+    DisconnectGlobalServerSocket();
+    SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)))
+        ->SetShuttingDown();
+  }
+}
+
+BENCHMARK(BM_ClientApiEnabledHeapFreeMultiThreaded)->ThreadRange(1, 32);
+
+// Allocations from many threads at once, most of which are not sampled, to
+// measure the contention on the sampling decision.
+static void BM_ClientApiOneHundrethAllocationMultiThreaded(
+    benchmark::State& state) {
+  static std::atomic<uint32_t> threads_running{0};
+  const uint32_t heap_id = GetHeapId();
+
+  if (threads_running.fetch_add(1) == 0) {
+    ClientConfiguration client_config{};
+    client_config.default_interval = 32000;
+    client_config.all_heaps = true;
+    g_client_config = client_config;
+    PERFETTO_CHECK(AHeapProfile_initSession(malloc, free));
+    PERFETTO_CHECK(g_shmem_fd);
+  }
+
+  for (auto _ : state) {
+    AHeapProfile_reportAllocation(heap_id, 0x123, 320);
+  }
+
+  if (threads_running.fetch_sub(1) == 1) {
+    DisconnectGlobalServerSocket();
+    SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)))
+        ->SetShuttingDown();
+  }
+}
+
+BENCHMARK(BM_ClientApiOneHundrethAllocationMultiThreaded)->ThreadRange(1, 32);
+
 static void BM_ClientApiMallocFree(benchmark::State& state) {
   for (auto _ : state) {
     volatile char* x = static_cast<char*>(malloc(100));
@@ -145,6 +145,10 @@ bool HeapprofdConfigToClientConfiguration(
       heapprofd_config.adaptive_sampling_shmem_threshold();
   cli_config->adaptive_sampling_max_sampling_interval_bytes =
       heapprofd_config.adaptive_sampling_max_sampling_interval_bytes();
+  cli_config->adaptive_sampling_spinlock_blocked_us =
+      heapprofd_config.adaptive_sampling_spinlock_blocked_us();
+  cli_config->adaptive_sampling_restore_interval =
+      heapprofd_config.adaptive_sampling_restore_interval();
   size_t n = 0;
   const std::vector<std::string>& exclude_heaps =
       heapprofd_config.exclude_heaps();
@@ -203,7 +207,8 @@ bool HeapprofdConfigToClientConfiguration(
 }
 
 // We create kUnwinderThreads unwinding threads. Bookkeeping is done on the main
-// thread.
+// thread. Each process is sharded to one of the unwinding threads, which hands
+// its samples to the others when it falls behind.
 HeapprofdProducer::HeapprofdProducer(HeapprofdMode mode,
                                      base::TaskRunner* task_runner,
                                      bool exit_when_done)
@@ -213,11 +218,24 @@ HeapprofdProducer::HeapprofdProducer(HeapprofdMode mode,
       unwinding_workers_(MakeUnwindingWorkers(this, kUnwinderThreads)),
       socket_delegate_(this),
       weak_factory_(this) {
+  for (UnwindingWorker& worker : unwinding_workers_) {
+    std::vector<UnwindingWorker*> peers;
+    for (UnwindingWorker& peer : unwinding_workers_) {
+      if (&peer != &worker)
+        peers.push_back(&peer);
+    }
+    worker.SetPeers(std::move(peers));
+  }
   CheckDataSourceCpuTask();
   CheckDataSourceMemoryTask();
 }
 
-HeapprofdProducer::~HeapprofdProducer() = default;
+HeapprofdProducer::~HeapprofdProducer() {
+  // The workers post samples to each other: stop that before the first of
+  // them is destroyed.
+  for (UnwindingWorker& worker : unwinding_workers_)
+    worker.SetPeers({});
+}
 
 void HeapprofdProducer::SetTargetProcess(pid_t target_pid,
                                          std::string target_cmdline) {
@@ -674,9 +692,12 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
 
     bool from_startup = data_source->signaled_pids.find(pid) ==
                         data_source->signaled_pids.cend();
+    bool incremental =
+        !data_source->config.dump_at_max() &&
+        data_source->config.continuous_dump_config().incremental();
 
-    auto new_heapsamples = [pid, from_startup, process_state, data_source,
-                            &heap_info](
+    auto new_heapsamples = [pid, from_startup, incremental, process_state,
+                            data_source, &heap_info](
                                ProfilePacket::ProcessHeapSamples* proto) {
       proto->set_pid(static_cast<uint64_t>(pid));
       proto->set_timestamp(heap_info.heap_tracker.dump_timestamp());
@@ -691,8 +712,11 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
         proto->set_heap_name(heap_info.heap_name.c_str());
       proto->set_sampling_interval_bytes(heap_info.sampling_interval);
       proto->set_orig_sampling_interval_bytes(heap_info.orig_sampling_interval);
+      proto->set_max_sampling_interval_bytes(heap_info.max_sampling_interval);
       auto* stats = proto->set_stats();
       SetStats(stats, *process_state);
+      if (incremental)
+        proto->set_incremental(true);
     };
 
     DumpState dump_state(data_source->trace_writer.get(),
@@ -700,8 +724,10 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
                          &data_source->intern_state);
 
     heap_info.heap_tracker.GetCallstackAllocations(
-        [&dump_state,
-         &data_source](const HeapTracker::CallstackAllocations& alloc) {
+        [&dump_state, &data_source,
+         incremental](const HeapTracker::CallstackAllocations& alloc) {
+          if (incremental && !alloc.changed_since_dump)
+            return;
           dump_state.WriteAllocation(alloc, data_source->config.dump_at_max());
         });
     dump_state.DumpCallstacks(&callsites_);
@@ -1126,6 +1152,8 @@ void HeapprofdProducer::HandleHeapNameRecord(HeapNameRecord rec) {
     if (!hi.sampling_interval)
       hi.orig_sampling_interval = entry.sample_interval;
     hi.sampling_interval = entry.sample_interval;
+    hi.max_sampling_interval =
+        std::max(hi.max_sampling_interval, entry.sample_interval);
   }
 }
 
@@ -202,6 +202,20 @@ TEST(HeapprofdConfigToClientConfigurationTest, AdaptiveSamplingWithMax) {
             4 * 4096u);
 }
 
+TEST(HeapprofdConfigToClientConfigurationTest, AdaptiveSamplingRestore) {
+  HeapprofdConfig cfg;
+  cfg.add_heaps("foo");
+  cfg.set_sampling_interval_bytes(4096);
+  cfg.set_adaptive_sampling_shmem_threshold(1024u);
+  cfg.set_adaptive_sampling_spinlock_blocked_us(100u);
+  cfg.set_adaptive_sampling_restore_interval(true);
+  ClientConfiguration cli_config;
+  ASSERT_TRUE(HeapprofdConfigToClientConfiguration(cfg, &cli_config));
+  EXPECT_EQ(cli_config.adaptive_sampling_shmem_threshold, 1024u);
+  EXPECT_EQ(cli_config.adaptive_sampling_spinlock_blocked_us, 100u);
+  EXPECT_TRUE(cli_config.adaptive_sampling_restore_interval);
+}
+
 TEST(HeapprofdConfigToClientConfigurationTest, AllHeaps) {
   HeapprofdConfig cfg;
   cfg.set_all_heaps(true);
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_MEMORY_OBJECT_POOL_H_
+#define SRC_PROFILING_MEMORY_OBJECT_POOL_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Allocates objects of type T in slabs of kSlabSize objects, reusing the
+// slots of the deleted ones. The objects never move, so that they can be
+// pointed to from flat hash maps, and creating or deleting one doesn't go
+// through malloc in the steady state.
+// The objects must all be deleted before the pool.
+template <typename T, size_t kSlabSize = 256>
+class ObjectPool {
+ public:
+  ObjectPool() = default;
+  ~ObjectPool() { PERFETTO_DCHECK(size_ == 0); }
+
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  template <typename... Args>
+  T* New(Args&&... args) {
+    void* slot;
+    if (!free_slots_.empty()) {
+      slot = free_slots_.back();
+      free_slots_.pop_back();
+    } else {
+      if (next_slot_in_slab_ == kSlabSize) {
+        slabs_.emplace_back(new Slot[kSlabSize]);
+        next_slot_in_slab_ = 0;
+      }
+      slot = &slabs_.back()[next_slot_in_slab_++];
+    }
+    size_++;
+    return new (slot) T(std::forward<Args>(args)...);
+  }
+
+  void Delete(T* obj) {
+    PERFETTO_DCHECK(size_ > 0);
+    obj->~T();
+    free_slots_.push_back(obj);
+    size_--;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+  std::vector<std::unique_ptr<Slot[]>> slabs_;
+  std::vector<void*> free_slots_;
+  size_t next_slot_in_slab_ = kSlabSize;
+  size_t size_ = 0;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_MEMORY_OBJECT_POOL_H_
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/memory/object_pool.h"
+
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+TEST(ObjectPoolTest, NewAndDelete) {
+  ObjectPool<std::string, 4> pool;
+  std::vector<std::string*> objs;
+  for (int i = 0; i < 10; i++)
+    objs.push_back(pool.New(std::to_string(i)));
+  EXPECT_EQ(pool.size(), 10u);
+  for (int i = 0; i < 10; i++)
+    EXPECT_EQ(*objs[static_cast<size_t>(i)], std::to_string(i));
+  for (std::string* obj : objs)
+    pool.Delete(obj);
+  EXPECT_EQ(pool.size(), 0u);
+}
+
+TEST(ObjectPoolTest, ReusesDeletedSlots) {
+  ObjectPool<std::string, 4> pool;
+  std::string* a = pool.New("a");
+  std::string* b = pool.New("b");
+  pool.Delete(a);
+  std::string* c = pool.New("c");
+  EXPECT_EQ(c, a);
+  EXPECT_EQ(*b, "b");
+  EXPECT_EQ(*c, "c");
+  pool.Delete(b);
+  pool.Delete(c);
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -16,9 +16,13 @@
 
 #include "perfetto/profiling/parse_smaps.h"
 
+#include <fcntl.h>
+
 #include <cinttypes>
 
+#include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "src/base/test/utils.h"
 #include "test/gtest_and_gmock.h"
 
@@ -88,6 +92,61 @@ TEST(ParseSmapsTest, SmokeNoEol) {
   EXPECT_THAT(entries, ElementsAre(cat1, cat2, heap));
 }
 
+TEST(ParseSmapsTest, Fd) {
+  base::ScopedFile fd(base::OpenFile(
+      base::GetTestDataPath("src/profiling/memory/test/data/cat_smaps"),
+      O_RDONLY));
+  ASSERT_TRUE(fd);
+  // Smaller than a line, so that the lines span several reads and the buffer
+  // grows.
+  std::vector<char> buf(16);
+  std::vector<SmapsEntry> entries;
+  EXPECT_TRUE(ParseSmaps(*fd, &buf, [&entries](const SmapsEntry& e) {
+    entries.emplace_back(e);
+  }));
+
+  SmapsEntry cat;
+  cat.pathname = "/bin/cat";
+  cat.size_kb = 8;
+  cat.private_dirty_kb = 0;
+  cat.swap_kb = 0;
+  SmapsEntry heap;
+  heap.pathname = "[heap stuff]";
+  heap.size_kb = 132;
+  heap.private_dirty_kb = 8;
+  heap.swap_kb = 4;
+  EXPECT_THAT(entries, ElementsAre(cat, cat, heap));
+
+  // The buffer is reused to parse the same fd again.
+  entries.clear();
+  EXPECT_TRUE(ParseSmaps(*fd, &buf, [&entries](const SmapsEntry& e) {
+    entries.emplace_back(e);
+  }));
+  EXPECT_THAT(entries, ElementsAre(cat, cat, heap));
+}
+
+TEST(ParseSmapsTest, FdRollupNoEol) {
+  base::TempFile tmp = base::TempFile::Create();
+  const char kRollup[] =
+      "5614e178c000-7ffd4d9fe000 ---p 00000000 00:00 0      [rollup]\n"
+      "Rss:                1024 kB\n"
+      "Private_Dirty:       512 kB\n"
+      "Swap:                 16 kB";
+  ASSERT_EQ(base::WriteAll(tmp.fd(), kRollup, sizeof(kRollup) - 1),
+            static_cast<ssize_t>(sizeof(kRollup) - 1));
+  std::vector<char> buf;
+  std::vector<SmapsEntry> entries;
+  EXPECT_TRUE(ParseSmaps(tmp.fd(), &buf, [&entries](const SmapsEntry& e) {
+    entries.emplace_back(e);
+  }));
+
+  SmapsEntry rollup;
+  rollup.pathname = "[rollup]";
+  rollup.private_dirty_kb = 512;
+  rollup.swap_kb = 16;
+  EXPECT_THAT(entries, ElementsAre(rollup));
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
@@ -16,12 +16,24 @@
 
 #include "src/profiling/memory/sampler.h"
 
+#include <atomic>
+
 namespace perfetto {
 namespace profiling {
 
-std::default_random_engine& GetGlobalRandomEngineLocked() {
-  static std::default_random_engine engine;
-  return engine;
+uint64_t NextSamplerSeed() {
+  static std::atomic<uint64_t> next_seed{kSamplerSeed};
+  return next_seed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Sampler::Seed(uint64_t seed) {
+  // splitmix64, so that consecutive seeds give unrelated sequences.
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  // The state of xorshift must not be zero.
+  random_state_ = z ? z : 1;
 }
 
 }  // namespace profiling
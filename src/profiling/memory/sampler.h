@@ -17,11 +17,9 @@
 #ifndef SRC_PROFILING_MEMORY_SAMPLER_H_
 #define SRC_PROFILING_MEMORY_SAMPLER_H_
 
+#include <math.h>
 #include <stdint.h>
 
-#include <atomic>
-#include <random>
-
 #include "perfetto/ext/base/utils.h"
 
 namespace perfetto {
@@ -29,7 +27,8 @@ namespace profiling {
 
 constexpr uint64_t kSamplerSeed = 1;
 
-std::default_random_engine& GetGlobalRandomEngineLocked();
+// Returns a different seed for each call, for the samplers of each thread.
+uint64_t NextSamplerSeed();
 
 // Poisson sampler for memory allocations. We apply sampling individually to
 // each byte. The whole allocation gets accounted as often as the number of
@@ -39,15 +38,28 @@ std::default_random_engine& GetGlobalRandomEngineLocked();
 // https://cs.chromium.org/search/?q=f:cc+symbol:AllocatorShimLogAlloc+package:%5Echromium$&type=cs
 // Googlers: see go/chrome-shp for more details.
 //
+// Each sampler has its own random number generator, so that each thread can
+// have its own samplers and sample without any lock. As the intervals between
+// samples are memoryless, a sampler can be reset at any point without biasing
+// the samples.
+//
+// Trivially constructible and destructible, so that it can be kept in
+// thread-local storage without any initialization or destruction code. It
+// must be zero-initialized before the first SetSamplingInterval call.
+//
 // NB: not thread-safe, requires external synchronization.
 class Sampler {
  public:
   void SetSamplingInterval(uint64_t sampling_interval) {
+    if (PERFETTO_UNLIKELY(random_state_ == 0))
+      Seed(NextSamplerSeed());
     sampling_interval_ = sampling_interval;
     sampling_rate_ = 1.0 / static_cast<double>(sampling_interval_);
     interval_to_next_sample_ = NextSampleInterval();
   }
 
+  void Seed(uint64_t seed);
+
   // Returns number of bytes that should be be attributed to the sample.
   // If returned size is 0, the allocation should not be sampled.
   //
@@ -62,9 +74,20 @@ class Sampler {
   uint64_t sampling_interval() const { return sampling_interval_; }
 
  private:
+  // xorshift64*, which is plenty for picking the samples and much cheaper than
+  // the standard engines.
+  uint64_t NextRandom() {
+    random_state_ ^= random_state_ >> 12;
+    random_state_ ^= random_state_ << 25;
+    random_state_ ^= random_state_ >> 27;
+    return random_state_ * 0x2545F4914F6CDD1DULL;
+  }
+
   int64_t NextSampleInterval() {
-    std::exponential_distribution<double> dist(sampling_rate_);
-    int64_t next = static_cast<int64_t>(dist(GetGlobalRandomEngineLocked()));
+    // Uniform in (0, 1].
+    double uniform = static_cast<double>((NextRandom() >> 11) + 1) /
+                     static_cast<double>(1ULL << 53);
+    int64_t next = static_cast<int64_t>(-log(uniform) / sampling_rate_);
     // We approximate the geometric distribution using an exponential
     // distribution.
     // We need to add 1 because that gives us the number of failures before
@@ -87,6 +110,7 @@ class Sampler {
   uint64_t sampling_interval_;
   double sampling_rate_;
   int64_t interval_to_next_sample_;
+  uint64_t random_state_;
 };
 
 }  // namespace profiling
@@ -25,28 +25,50 @@ namespace profiling {
 namespace {
 
 TEST(SamplerTest, TestLarge) {
-  GetGlobalRandomEngineLocked().seed(1);
-  Sampler sampler;
+  Sampler sampler{};
+  sampler.Seed(kSamplerSeed);
   sampler.SetSamplingInterval(512);
   EXPECT_EQ(sampler.SampleSize(1024), 1024u);
 }
 
 TEST(SamplerTest, TestSmall) {
-  GetGlobalRandomEngineLocked().seed(1);
-  Sampler sampler;
+  Sampler sampler{};
+  // A seed for which the first sample falls within the first 511 bytes.
+  sampler.Seed(2);
   sampler.SetSamplingInterval(512);
   EXPECT_EQ(sampler.SampleSize(511), 512u);
 }
 
 TEST(SamplerTest, TestSequence) {
-  GetGlobalRandomEngineLocked().seed(1);
-  Sampler sampler;
+  Sampler sampler{};
+  sampler.Seed(kSamplerSeed);
   sampler.SetSamplingInterval(1);
   EXPECT_EQ(sampler.SampleSize(3), 3u);
   EXPECT_EQ(sampler.SampleSize(7), 7u);
   EXPECT_EQ(sampler.SampleSize(5), 5u);
 }
 
+TEST(SamplerTest, TestSeeds) {
+  Sampler sampler{};
+  sampler.SetSamplingInterval(512);
+  Sampler other_sampler{};
+  other_sampler.SetSamplingInterval(512);
+  size_t sampled = 0;
+  size_t other_sampled = 0;
+  bool same = true;
+  for (int i = 0; i < 1000; i++) {
+    size_t size = sampler.SampleSize(64);
+    size_t other_size = other_sampler.SampleSize(64);
+    same = same && size == other_size;
+    sampled += size;
+    other_sampled += other_size;
+  }
+  // The two samplers pick different allocations, at a similar rate.
+  EXPECT_FALSE(same);
+  EXPECT_GT(sampled, 0u);
+  EXPECT_GT(other_sampled, 0u);
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -49,6 +50,13 @@ constexpr auto kGuardSize = base::kPageSize * 1024 * 16;  // 64 MB.
 constexpr auto kFDSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
 #endif
 
+// The write stats are updated by concurrent writers without holding the
+// spinlock.
+void IncrementStat(uint64_t* stat, uint64_t n) {
+  reinterpret_cast<std::atomic<uint64_t>*>(stat)->fetch_add(
+      n, std::memory_order_relaxed);
+}
+
 }  // namespace
 
 
@@ -93,6 +101,12 @@ SharedRingBuffer::SharedRingBuffer(CreateFlag, size_t size) {
     return;
 
   new (meta_) MetadataPage();
+  // This reader zeroes the space it consumes, so the writers can reserve
+  // space without the spinlock. This is set before the fd is handed to the
+  // client, which reads it once in Attach().
+  meta_->reader_features.store(kReaderZeroesFreedSpace,
+                               std::memory_order_relaxed);
+  lock_free_writes_ = true;
 }
 
 SharedRingBuffer::~SharedRingBuffer() {
@@ -189,7 +203,7 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
 
   base::Optional<PointerPositions> opt_pos = GetPointerPositions();
   if (!opt_pos) {
-    meta_->stats.num_writes_corrupt++;
+    IncrementStat(&meta_->stats.num_writes_corrupt, 1);
     errno = EBADF;
     return result;
   }
@@ -205,7 +219,7 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
   }
 
   if (size_with_header > write_avail(pos)) {
-    meta_->stats.num_writes_overflow++;
+    IncrementStat(&meta_->stats.num_writes_overflow, 1);
     errno = EAGAIN;
     return result;
   }
@@ -215,8 +229,8 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
   result.size = size;
   result.data = wr_ptr + kHeaderSize;
   result.bytes_free = write_avail(pos);
-  meta_->stats.bytes_written += size;
-  meta_->stats.num_writes_succeeded++;
+  IncrementStat(&meta_->stats.bytes_written, size);
+  IncrementStat(&meta_->stats.num_writes_succeeded, 1);
 
   // We can make this a relaxed store, as this gets picked up by the acquire
   // load in GetPointerPositions (and the release store below).
@@ -230,6 +244,57 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
   return result;
 }
 
+SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(size_t size) {
+  PERFETTO_DCHECK(lock_free_writes_);
+  Buffer result;
+
+  const uint64_t size_with_header =
+      base::AlignUp<kAlignment>(size + kHeaderSize);
+
+  // size_with_header < size is for catching overflow of size_with_header.
+  if (PERFETTO_UNLIKELY(size_with_header < size)) {
+    errno = EINVAL;
+    return result;
+  }
+
+  // Writers reserve their record by advancing write_pos with a CAS, rather
+  // than under the spinlock, so that concurrent writers never block each
+  // other. The reserved header is already zero (see EndRead), so the reader
+  // waits for EndWrite before consuming the record, and the records that
+  // follow it.
+  base::Optional<PointerPositions> opt_pos;
+  for (;;) {
+    opt_pos = GetPointerPositions();
+    if (!opt_pos) {
+      IncrementStat(&meta_->stats.num_writes_corrupt, 1);
+      errno = EBADF;
+      return result;
+    }
+    if (size_with_header > write_avail(*opt_pos)) {
+      IncrementStat(&meta_->stats.num_writes_overflow, 1);
+      errno = EAGAIN;
+      return result;
+    }
+    // This is matched by the acquire load in GetPointerPositions. The
+    // acquire on success makes sure the reader's zeroing of the reserved
+    // space (released by EndRead) is visible before we write to it.
+    uint64_t expected = opt_pos->write_pos;
+    if (meta_->write_pos.compare_exchange_weak(
+            expected, opt_pos->write_pos + size_with_header,
+            std::memory_order_acq_rel, std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  const PointerPositions& pos = *opt_pos;
+
+  result.size = size;
+  result.data = at(pos.write_pos) + kHeaderSize;
+  result.bytes_free = write_avail(pos) - size_with_header;
+  IncrementStat(&meta_->stats.bytes_written, size);
+  IncrementStat(&meta_->stats.num_writes_succeeded, 1);
+  return result;
+}
+
 void SharedRingBuffer::EndWrite(Buffer buf) {
   if (!buf)
     return;
@@ -292,7 +357,15 @@ void SharedRingBuffer::EndRead(Buffer buf) {
   if (!buf)
     return;
   size_t size_with_header = base::AlignUp<kAlignment>(buf.size + kHeaderSize);
-  meta_->read_pos.fetch_add(size_with_header, std::memory_order_relaxed);
+  // The writers which don't hold the spinlock while reserving space cannot
+  // clear the header of their record before it becomes visible to the
+  // reader. Instead, the reader hands back the space zeroed: any 8-byte
+  // aligned word of the free space can become a header. This is advertised
+  // to the writers by kReaderZeroesFreedSpace.
+  memset(buf.data - kHeaderSize, 0, size_with_header);
+  // This needs to release to make sure the writers see the zeroed space
+  // before they reserve it. This is matched by the acquire in BeginWrite.
+  meta_->read_pos.fetch_add(size_with_header, std::memory_order_release);
   meta_->stats.num_reads_succeeded++;
 }
 
@@ -314,10 +387,12 @@ SharedRingBuffer::SharedRingBuffer(SharedRingBuffer&& other) noexcept {
 SharedRingBuffer& SharedRingBuffer::operator=(
     SharedRingBuffer&& other) noexcept {
   mem_fd_ = std::move(other.mem_fd_);
-  std::tie(meta_, mem_, size_, size_mask_) =
-      std::tie(other.meta_, other.mem_, other.size_, other.size_mask_);
-  std::tie(other.meta_, other.mem_, other.size_, other.size_mask_) =
-      std::make_tuple(nullptr, nullptr, 0, 0);
+  std::tie(meta_, mem_, size_, size_mask_, lock_free_writes_) =
+      std::tie(other.meta_, other.mem_, other.size_, other.size_mask_,
+               other.lock_free_writes_);
+  std::tie(other.meta_, other.mem_, other.size_, other.size_mask_,
+           other.lock_free_writes_) =
+      std::make_tuple(nullptr, nullptr, 0, 0, false);
   return *this;
 }
 
@@ -335,6 +410,12 @@ base::Optional<SharedRingBuffer> SharedRingBuffer::Attach(
   auto buf = SharedRingBuffer(AttachFlag(), std::move(mem_fd));
   if (!buf.is_valid())
     return base::nullopt;
+  // Older readers don't set this, and don't zero the space they consume: the
+  // writers then need to take the spinlock and clear the record headers
+  // themselves.
+  buf.lock_free_writes_ =
+      buf.meta_->reader_features.load(std::memory_order_relaxed) &
+      kReaderZeroesFreedSpace;
   return base::make_optional(std::move(buf));
 }
 
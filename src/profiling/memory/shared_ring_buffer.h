@@ -43,6 +43,10 @@ namespace profiling {
 // - If a write succeeds, the reader is guaranteed to see the whole buffer.
 // - Reads are atomic, no fragmentation.
 // - The reader sees writes in write order (% discarding).
+// - Writers don't block each other if the reader supports it (see
+//   lock_free_writes()): space is reserved by advancing the write position
+//   with a CAS, and the record is committed by EndWrite. A reserved but not
+//   yet committed record holds back the reader, not the writers.
 //
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 // *IMPORTANT*: The ring buffer must be written under the assumption that the
@@ -51,9 +55,6 @@ namespace profiling {
 // bounds checks followed by reads / writes, as they might change in the
 // meantime.
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-//
-// TODO:
-// - Write a benchmark.
 class SharedRingBuffer {
  public:
   class Buffer {
@@ -75,6 +76,13 @@ class SharedRingBuffer {
     uint64_t bytes_free = 0;
   };
 
+  // Bits of MetadataPage::reader_features, set by the reader in Create().
+  enum ReaderFeatures : uint64_t {
+    // EndRead() zeroes the space it consumes, so that the writers can reserve
+    // space without the spinlock.
+    kReaderZeroesFreedSpace = 1 << 0,
+  };
+
   enum ErrorState : uint64_t {
     kNoError = 0,
     kHitTimeout = 1,
@@ -116,7 +124,14 @@ class SharedRingBuffer {
     return write_avail(*pos);
   }
 
+  // Whether the reader advertised kReaderZeroesFreedSpace. If so, the writers
+  // must use BeginWrite(size_t), otherwise BeginWrite(spinlock, size_t).
+  bool lock_free_writes() const { return lock_free_writes_; }
+
   Buffer BeginWrite(const ScopedSpinlock& spinlock, size_t size);
+  // Safe to call concurrently from multiple threads, without holding the
+  // spinlock. Only if lock_free_writes().
+  Buffer BeginWrite(size_t size);
   void EndWrite(Buffer buf);
 
   Buffer BeginRead();
@@ -124,7 +139,15 @@ class SharedRingBuffer {
 
   Stats GetStats(ScopedSpinlock& spinlock) {
     PERFETTO_DCHECK(spinlock.locked());
-    Stats stats = meta_->stats;
+    Stats stats = {};
+    // The write stats are updated by the writers without the spinlock.
+    stats.bytes_written = LoadStat(&meta_->stats.bytes_written);
+    stats.num_writes_succeeded = LoadStat(&meta_->stats.num_writes_succeeded);
+    stats.num_writes_corrupt = LoadStat(&meta_->stats.num_writes_corrupt);
+    stats.num_writes_overflow = LoadStat(&meta_->stats.num_writes_overflow);
+    stats.num_reads_succeeded = meta_->stats.num_reads_succeeded;
+    stats.num_reads_corrupt = meta_->stats.num_reads_corrupt;
+    stats.num_reads_nodata = meta_->stats.num_reads_nodata;
     stats.failed_spinlocks =
         meta_->failed_spinlocks.load(std::memory_order_relaxed);
     stats.error_state = meta_->error_state.load(std::memory_order_relaxed);
@@ -135,9 +158,7 @@ class SharedRingBuffer {
 
   void SetErrorState(ErrorState error) { meta_->error_state.store(error); }
 
-  // This is used by the caller to be able to hold the SpinLock after
-  // BeginWrite has returned. This is so that additional bookkeeping can be
-  // done under the lock. This will be used to increment the sequence_number.
+  // Used for GetStats, and by the writers unless lock_free_writes().
   ScopedSpinlock AcquireLock(ScopedSpinlock::Mode mode) {
     auto lock = ScopedSpinlock(&meta_->spinlock, mode);
     if (PERFETTO_UNLIKELY(!lock.locked()))
@@ -189,16 +210,20 @@ class SharedRingBuffer {
     PERFETTO_CROSS_ABI_ALIGNED(std::atomic<ErrorState>) error_state;
     alignas(sizeof(uint64_t)) std::atomic<bool> shutting_down;
     alignas(sizeof(uint64_t)) std::atomic<bool> reader_paused;
-    // For stats that are only accessed by a single thread or under the
-    // spinlock, members of this struct are directly modified. Other stats use
-    // the atomics above this struct.
+    // For stats that are only accessed by a single thread, members of this
+    // struct are directly modified. The write stats are modified through
+    // atomic operations, as the writers might not hold the spinlock. Other
+    // stats use the atomics above this struct.
     //
     // When the user requests stats, the atomics above get copied into this
     // struct, which is then returned.
     alignas(sizeof(uint64_t)) Stats stats;
+    // Bitmask of ReaderFeatures. Added at the end so that it reads as zero
+    // with readers which predate it.
+    PERFETTO_CROSS_ABI_ALIGNED(std::atomic<uint64_t>) reader_features;
   };
 
-  static_assert(sizeof(MetadataPage) == 144,
+  static_assert(sizeof(MetadataPage) == 152,
                 "metadata page size needs to be ABI independent");
 
  private:
@@ -226,9 +251,11 @@ class SharedRingBuffer {
     // observe the write_pos increment, but not the size field write of the
     // payload.
     //
-    // This is matched by a release at the end of BeginWrite.
+    // This is matched by the CAS in BeginWrite.
     pos.write_pos = meta_->write_pos.load(std::memory_order_acquire);
-    pos.read_pos = meta_->read_pos.load(std::memory_order_relaxed);
+    // Writers need to acquire load the read_pos to make sure they observe
+    // the zeroing of the space freed by EndRead.
+    pos.read_pos = meta_->read_pos.load(std::memory_order_acquire);
 
     base::Optional<PointerPositions> result;
     if (IsCorrupt(pos))
@@ -255,6 +282,11 @@ class SharedRingBuffer {
 
   inline uint8_t* at(uint64_t pos) { return mem_ + (pos & size_mask_); }
 
+  static uint64_t LoadStat(uint64_t* stat) {
+    return reinterpret_cast<std::atomic<uint64_t>*>(stat)->load(
+        std::memory_order_relaxed);
+  }
+
   base::ScopedFile mem_fd_;
   MetadataPage* meta_ = nullptr;  // Start of the mmaped region.
   uint8_t* mem_ = nullptr;  // Start of the contents (i.e. meta_ + kPageSize).
@@ -263,6 +295,7 @@ class SharedRingBuffer {
   // mmap.
   size_t size_ = 0;
   size_t size_mask_ = 0;
+  bool lock_free_writes_ = false;
 
   // Remember to update the move ctor when adding new fields.
 };
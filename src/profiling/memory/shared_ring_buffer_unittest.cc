@@ -16,6 +16,8 @@
 
 #include "src/profiling/memory/shared_ring_buffer.h"
 
+#include <sys/mman.h>
+
 #include <array>
 #include <mutex>
 #include <random>
@@ -36,10 +38,10 @@ std::string ToString(const SharedRingBuffer::Buffer& buf_and_size) {
 
 bool TryWrite(SharedRingBuffer* wr, const char* src, size_t size) {
   SharedRingBuffer::Buffer buf;
-  {
-    auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Try);
-    if (!lock.locked())
-      return false;
+  if (wr->lock_free_writes()) {
+    buf = wr->BeginWrite(size);
+  } else {
+    auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Blocking);
     buf = wr->BeginWrite(lock, size);
   }
   if (!buf)
@@ -162,11 +164,7 @@ TEST(SharedRingBufferTest, WriteShutdown) {
   ASSERT_TRUE(rd);
   SharedRingBuffer wr =
       *SharedRingBuffer::Attach(base::ScopedFile(dup(rd->fd())));
-  SharedRingBuffer::Buffer buf;
-  {
-    auto lock = wr.AcquireLock(ScopedSpinlock::Mode::Blocking);
-    buf = wr.BeginWrite(lock, 10);
-  }
+  SharedRingBuffer::Buffer buf = wr.BeginWrite(10);
   rd = base::nullopt;
   memset(buf.data, 0, buf.size);
   wr.EndWrite(std::move(buf));
@@ -254,6 +252,144 @@ TEST(SharedRingBufferTest, MultiThreadingTest) {
   reader_thread.join();
 }
 
+// Many writers on a small buffer, so that the reserved records frequently wrap
+// around and reuse the space just freed by the reader. The reader and the
+// writers share the same mapping, so that TSan can follow the
+// synchronization on the record headers.
+TEST(SharedRingBufferTest, ConcurrentWritersSmallBuffer) {
+  constexpr auto kBufSize = base::kPageSize;
+  SharedRingBuffer rd = *SharedRingBuffer::Create(kBufSize);
+  SharedRingBuffer& wr = rd;
+
+  std::mutex mutex;
+  std::unordered_map<std::string, int64_t> expected_contents;
+  std::atomic<size_t> writers_running{0};
+
+  constexpr size_t kNumWriterThreads = 8;
+  auto writer_thread_fn = [&wr, &expected_contents, &mutex,
+                           &writers_running](size_t thread_id) {
+    std::minstd_rand0 rnd_engine(static_cast<uint32_t>(thread_id));
+    std::uniform_int_distribution<size_t> dist(1, 256);
+    for (int i = 0; i < 2000; i++) {
+      std::string data;
+      data.resize(dist(rnd_engine));
+      std::generate(data.begin(), data.end(), rnd_engine);
+      // Record the contents before committing them, as the reader might
+      // consume them as soon as EndWrite returns.
+      SharedRingBuffer::Buffer buf = wr.BeginWrite(data.size());
+      if (!buf) {
+        std::this_thread::yield();
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        expected_contents[data]++;
+      }
+      memcpy(buf.data, data.data(), data.size());
+      wr.EndWrite(std::move(buf));
+    }
+    writers_running--;
+  };
+
+  auto reader_thread_fn = [&rd, &expected_contents, &mutex, &writers_running] {
+    for (;;) {
+      // Loaded before reading, so that a failed read after the writers are
+      // done means that the buffer is empty.
+      bool done = writers_running.load() == 0;
+      auto buf = rd.BeginRead();
+      if (!buf) {
+        if (done)
+          return;
+        std::this_thread::yield();
+        continue;
+      }
+      std::string data = ToString(buf);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        expected_contents[std::move(data)]--;
+      }
+      rd.EndRead(std::move(buf));
+    }
+  };
+
+  writers_running = kNumWriterThreads;
+  std::array<std::thread, kNumWriterThreads> writer_threads;
+  for (size_t i = 0; i < kNumWriterThreads; i++)
+    writer_threads[i] = std::thread(writer_thread_fn, i);
+  std::thread reader_thread(reader_thread_fn);
+
+  for (size_t i = 0; i < kNumWriterThreads; i++)
+    writer_threads[i].join();
+  reader_thread.join();
+
+  for (const auto& contents_and_count : expected_contents)
+    EXPECT_EQ(contents_and_count.second, 0);
+
+  auto lock = rd.AcquireLock(ScopedSpinlock::Mode::Blocking);
+  SharedRingBuffer::Stats stats = rd.GetStats(lock);
+  EXPECT_GT(stats.num_writes_succeeded, 0u);
+  EXPECT_EQ(stats.num_writes_succeeded, stats.num_reads_succeeded);
+  EXPECT_EQ(stats.num_reads_corrupt, 0u);
+}
+
+// A reader which predates kReaderZeroesFreedSpace leaves the consumed records
+// in the buffer. The writers must then take the spinlock and clear the record
+// headers themselves, as a stale header would otherwise be read as committed.
+TEST(SharedRingBufferTest, OlderReader) {
+  constexpr auto kBufSize = base::kPageSize * 4;
+  base::Optional<SharedRingBuffer> rd = SharedRingBuffer::Create(kBufSize);
+  ASSERT_TRUE(rd);
+  EXPECT_TRUE(rd->lock_free_writes());
+
+  constexpr auto kMapSize = base::kPageSize + kBufSize;
+  void* mem = mmap(nullptr, kMapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   rd->fd(), 0);
+  ASSERT_NE(mem, MAP_FAILED);
+  auto* meta = static_cast<SharedRingBuffer::MetadataPage*>(mem);
+  meta->reader_features.store(0);
+  // Fills the (empty) buffer with stale records of 4 bytes.
+  auto fill_stale = [mem] {
+    uint64_t* words = reinterpret_cast<uint64_t*>(static_cast<uint8_t*>(mem) +
+                                                  base::kPageSize);
+    for (size_t i = 0; i < kBufSize / sizeof(uint64_t); i++)
+      words[i] = 4;
+  };
+
+  base::Optional<SharedRingBuffer> wr =
+      SharedRingBuffer::Attach(base::ScopedFile(dup(rd->fd())));
+  ASSERT_TRUE(wr);
+  EXPECT_FALSE(wr->lock_free_writes());
+
+  for (size_t i = 0; i < 50; i++) {
+    fill_stale();
+    std::string data(base::kPageSize + i * 100, static_cast<char>('a' + i));
+    ASSERT_TRUE(TryWrite(&*wr, data.data(), data.size()));
+    {
+      auto buf = rd->BeginRead();
+      ASSERT_EQ(ToString(buf), data);
+      rd->EndRead(std::move(buf));
+    }
+
+    // A record which is reserved but not committed holds back the reader.
+    fill_stale();
+    SharedRingBuffer::Buffer reserved;
+    {
+      auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Blocking);
+      reserved = wr->BeginWrite(lock, 8);
+    }
+    ASSERT_TRUE(reserved);
+    EXPECT_FALSE(rd->BeginRead());
+    memcpy(reserved.data, "1234567", 8);
+    wr->EndWrite(std::move(reserved));
+    {
+      auto buf = rd->BeginRead();
+      ASSERT_EQ(ToString(buf), std::string("1234567", 8));
+      rd->EndRead(std::move(buf));
+    }
+  }
+  munmap(mem, kMapSize);
+}
+
 TEST(SharedRingBufferTest, InvalidSize) {
   constexpr auto kBufSize = base::kPageSize * 4 + 1;
   base::Optional<SharedRingBuffer> wr = SharedRingBuffer::Create(kBufSize);
@@ -264,12 +400,7 @@ TEST(SharedRingBufferTest, EmptyWrite) {
   constexpr auto kBufSize = base::kPageSize * 4;
   base::Optional<SharedRingBuffer> wr = SharedRingBuffer::Create(kBufSize);
   ASSERT_TRUE(wr);
-  SharedRingBuffer::Buffer buf;
-  {
-    auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Try);
-    ASSERT_TRUE(lock.locked());
-    buf = wr->BeginWrite(lock, 0);
-  }
+  SharedRingBuffer::Buffer buf = wr->BeginWrite(0);
   EXPECT_TRUE(buf);
   wr->EndWrite(std::move(buf));
 }
@@ -83,7 +83,9 @@ int FuzzRingBufferWrite(const uint8_t* data, size_t size) {
   PERFETTO_CHECK(!!buf);
 
   SharedRingBuffer::Buffer write_buf;
-  {
+  if (buf->lock_free_writes()) {
+    write_buf = buf->BeginWrite(header.write_size);
+  } else {
     auto lock = buf->AcquireLock(ScopedSpinlock::Mode::Try);
     PERFETTO_CHECK(lock.locked());
     write_buf = buf->BeginWrite(lock, header.write_size);
@@ -19,6 +19,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <unwindstack/MachineArm.h>
 #include <unwindstack/MachineArm64.h>
 #include <unwindstack/MachineMips.h>
@@ -70,6 +72,11 @@ constexpr size_t kUnwindBatchSize = 1000;
 constexpr size_t kRecordBatchSize = 1024;
 constexpr size_t kMaxAllocRecordArenaSize = 2 * kRecordBatchSize;
 
+// Samples queued on a peer beyond this are unwound by the owning worker
+// instead, so that a busy peer doesn't buffer a backlog outside of the shmem,
+// where the client can't see it.
+constexpr size_t kMaxPendingOffloadedSamples = 64;
+
 #pragma GCC diagnostic push
 // We do not care about deterministic destructor order.
 #pragma GCC diagnostic ignored "-Wglobal-constructors"
@@ -121,6 +128,23 @@ std::unique_ptr<unwindstack::Regs> CreateRegsFromRawData(
   return ret;
 }
 
+struct UnwindingWorker::SharedClientState {
+  pid_t pid;
+  DataSourceInstanceID data_source_instance_id;
+  // Duplicate of the client's /proc/[pid]/maps fd, duplicated again by each
+  // peer, as FDMaps owns its fd.
+  base::ScopedFile maps_fd;
+  std::shared_ptr<unwindstack::Memory> fd_mem;
+  // Set by the owning worker before it posts the drains.
+  SharedRingBuffer::Stats stats = {};
+  std::atomic<size_t> pending_drains{0};
+};
+
+struct UnwindingWorker::OffloadedSample {
+  AllocMetadata alloc_metadata;
+  std::vector<char> stack;
+};
+
 bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
   AllocMetadata* alloc_metadata = msg->alloc_header;
   std::unique_ptr<unwindstack::Regs> regs(CreateRegsFromRawData(
@@ -139,10 +163,24 @@ bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
     return false;
   }
   uint8_t* stack = reinterpret_cast<uint8_t*>(msg->payload);
-  std::shared_ptr<unwindstack::Memory> mems =
+  UnwindCache::Key cache_key =
+      UnwindCache::MakeKey(regs.get(), alloc_metadata->stack_pointer);
+  if (const std::vector<unwindstack::FrameData>* cached_frames =
+          metadata->unwind_cache.Find(cache_key, stack, msg->payload_size)) {
+    out->frames = *cached_frames;
+    out->build_ids.resize(out->frames.size());
+    for (size_t i = 0; i < out->frames.size(); ++i)
+      out->build_ids[i] = metadata->GetBuildId(out->frames[i]);
+    return true;
+  }
+
+  std::shared_ptr<StackOverlayMemory> mems =
       std::make_shared<StackOverlayMemory>(metadata->fd_mem,
                                            alloc_metadata->stack_pointer, stack,
                                            msg->payload_size);
+  std::vector<StackRead> stack_reads;
+  bool read_past_stack = false;
+  mems->RecordReads(&stack_reads, &read_past_stack);
 
   unwindstack::Unwinder unwinder(kMaxFrames, &metadata->fd_maps, regs.get(),
                                  mems);
@@ -186,6 +224,11 @@ bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
     out->build_ids[i] = metadata->GetBuildId(out->frames[i]);
   }
 
+  if (error_code == unwindstack::ERROR_NONE && !read_past_stack) {
+    metadata->unwind_cache.Insert(cache_key, stack, msg->payload_size,
+                                  stack_reads, out->frames);
+  }
+
   if (error_code != unwindstack::ERROR_NONE) {
     PERFETTO_DLOG("Unwinding error %" PRIu8, error_code);
     unwindstack::FrameData frame_data{};
@@ -227,6 +270,26 @@ void UnwindingWorker::OnDisconnect(base::UnixSocket* self) {
   }
   DataSourceInstanceID ds_id = client_data.data_source_instance_id;
 
+  // The peers report the disconnection once they are done with the samples
+  // they were handed, so that it is seen after all the client's records.
+  bool drain_peers = false;
+  if (!client_data.offload_peers.empty()) {
+    std::shared_ptr<SharedClientState> shared_state = client_data.shared_state;
+    shared_state->stats = stats;
+    shared_state->pending_drains.store(client_data.offload_peers.size(),
+                                       std::memory_order_relaxed);
+    std::lock_guard<std::mutex> l(*peers_mutex_);
+    // The peers are only cleared on shutdown, when the peers might be gone.
+    drain_peers = !peers_.empty();
+    if (drain_peers) {
+      for (UnwindingWorker* peer : client_data.offload_peers) {
+        peer->thread_task_runner_.get()->PostTask([peer, shared_state] {
+          peer->HandleDrainPeerClient(shared_state);
+        });
+      }
+    }
+  }
+
   client_data_.erase(it);
   // The erase invalidates the self pointer.
   self = nullptr;
@@ -236,7 +299,8 @@ void UnwindingWorker::OnDisconnect(base::UnixSocket* self) {
     // in case there are pending AllocRecords on the main thread.
     alloc_record_arena_.Disable();
   }
-  delegate_->PostSocketDisconnected(this, ds_id, peer_pid, stats);
+  if (!drain_peers)
+    delegate_->PostSocketDisconnected(this, ds_id, peer_pid, stats);
 }
 
 void UnwindingWorker::OnDataAvailable(base::UnixSocket* self) {
@@ -257,8 +321,10 @@ UnwindingWorker::ReadAndUnwindBatchResult UnwindingWorker::ReadAndUnwindBatch(
     buf = shmem.BeginRead();
     if (!buf)
       break;
-    HandleBuffer(this, &alloc_record_arena_, buf, client_data,
-                 client_data->sock->peer_pid_linux(), delegate_);
+    if (!MaybeOffloadBuffer(buf, client_data)) {
+      HandleBuffer(this, &alloc_record_arena_, buf, client_data,
+                   client_data->sock->peer_pid_linux(), delegate_);
+    }
     shmem.EndRead(std::move(buf));
     // Reparsing takes time, so process the rest in a new batch to avoid timing
     // out.
@@ -313,6 +379,150 @@ void UnwindingWorker::BatchUnwindJob(pid_t peer_pid) {
   PERFETTO_CHECK(job_reposted || reader_paused);
 }
 
+void UnwindingWorker::SetPeers(std::vector<UnwindingWorker*> peers) {
+  std::lock_guard<std::mutex> l(*peers_mutex_);
+  peers_ = std::move(peers);
+}
+
+bool UnwindingWorker::MaybeOffloadBuffer(const SharedRingBuffer::Buffer& buf,
+                                         ClientData* client_data) {
+  // Only offload once the client writes faster than this worker unwinds.
+  SharedRingBuffer& shmem = client_data->shmem;
+  if (client_data->stream_allocations ||
+      shmem.write_avail() >= shmem.size() / 2) {
+    return false;
+  }
+  WireMessage msg;
+  if (!ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
+                          &msg) ||
+      msg.record_type != RecordType::Malloc) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> l(*peers_mutex_);
+  if (peers_.empty())
+    return false;
+  // Round-robin over the peers and this worker itself. The samples of a peer
+  // that is busy already are unwound here.
+  uint64_t slot = client_data->offload_round++ % (peers_.size() + 1);
+  if (slot == peers_.size())
+    return false;
+  UnwindingWorker* peer = peers_[slot];
+  if (peer->pending_offloaded_samples_->load(std::memory_order_relaxed) >=
+      kMaxPendingOffloadedSamples) {
+    return false;
+  }
+
+  if (!client_data->shared_state) {
+    std::shared_ptr<SharedClientState> shared_state(new SharedClientState());
+    shared_state->pid = client_data->sock->peer_pid_linux();
+    shared_state->data_source_instance_id =
+        client_data->data_source_instance_id;
+    shared_state->maps_fd.reset(dup(client_data->metadata.fd_maps.fd()));
+    if (!shared_state->maps_fd) {
+      PERFETTO_PLOG("dup maps fd");
+      return false;
+    }
+    shared_state->fd_mem = client_data->metadata.fd_mem;
+    client_data->shared_state = std::move(shared_state);
+  }
+  if (std::find(client_data->offload_peers.begin(),
+                client_data->offload_peers.end(),
+                peer) == client_data->offload_peers.end()) {
+    client_data->offload_peers.push_back(peer);
+  }
+
+  // Copy the sample out, so that its shmem can be returned to the client.
+  std::shared_ptr<OffloadedSample> sample(new OffloadedSample());
+  sample->alloc_metadata = *msg.alloc_header;
+  sample->stack.assign(msg.payload, msg.payload + msg.payload_size);
+  std::shared_ptr<SharedClientState> shared_state = client_data->shared_state;
+  peer->pending_offloaded_samples_->fetch_add(1, std::memory_order_relaxed);
+  peer->thread_task_runner_.get()->PostTask([peer, shared_state, sample] {
+    peer->HandleOffloadedSample(shared_state, sample);
+  });
+  return true;
+}
+
+void UnwindingWorker::HandleOffloadedSample(
+    std::shared_ptr<SharedClientState> shared_state,
+    std::shared_ptr<OffloadedSample> sample) {
+  pending_offloaded_samples_->fetch_sub(1, std::memory_order_relaxed);
+  PeerClient& peer_client = peer_clients_[shared_state.get()];
+  if (!peer_client.metadata) {
+    base::ScopedFile maps_fd(dup(*shared_state->maps_fd));
+    if (!maps_fd)
+      PERFETTO_PLOG("dup maps fd");
+    peer_client.metadata.reset(
+        new UnwindingMetadata(std::move(maps_fd), shared_state->fd_mem));
+    peer_client.shared_state = shared_state;
+  }
+
+  WireMessage msg = {};
+  msg.record_type = RecordType::Malloc;
+  msg.alloc_header = &sample->alloc_metadata;
+  msg.payload = sample->stack.data();
+  msg.payload_size = sample->stack.size();
+  UnwindAndPostAllocRecord(this, &alloc_record_arena_, &msg,
+                           peer_client.metadata.get(), shared_state->pid,
+                           shared_state->data_source_instance_id,
+                           /*stream_allocations=*/false, delegate_);
+}
+
+void UnwindingWorker::HandleDrainPeerClient(
+    std::shared_ptr<SharedClientState> shared_state) {
+  // All the samples of the client that were posted to this worker ran before
+  // this task.
+  peer_clients_.erase(shared_state.get());
+  if (shared_state->pending_drains.fetch_sub(1, std::memory_order_acq_rel) ==
+      1) {
+    delegate_->PostSocketDisconnected(
+        this, shared_state->data_source_instance_id, shared_state->pid,
+        shared_state->stats);
+  }
+}
+
+// static
+void UnwindingWorker::UnwindAndPostAllocRecord(
+    UnwindingWorker* self,
+    AllocRecordArena* alloc_record_arena,
+    WireMessage* msg,
+    UnwindingMetadata* metadata,
+    pid_t peer_pid,
+    DataSourceInstanceID ds_id,
+    bool stream_allocations,
+    Delegate* delegate) {
+  std::unique_ptr<AllocRecord> rec = alloc_record_arena->BorrowAllocRecord();
+  rec->alloc_metadata = *msg->alloc_header;
+  rec->pid = peer_pid;
+  rec->data_source_instance_id = ds_id;
+  auto start_time_us = base::GetWallTimeNs() / 1000;
+  if (!stream_allocations)
+    DoUnwind(msg, metadata, rec.get());
+  rec->unwinding_time_us = static_cast<uint64_t>(
+      ((base::GetWallTimeNs() / 1000) - start_time_us).count());
+  delegate->PostAllocRecord(self, std::move(rec));
+}
+
+// static
+void UnwindingWorker::AddFreeRecord(UnwindingWorker* self,
+                                    const FreeEntry* entry,
+                                    ClientData* client_data,
+                                    pid_t peer_pid,
+                                    Delegate* delegate) {
+  FreeRecord rec;
+  rec.pid = peer_pid;
+  rec.data_source_instance_id = client_data->data_source_instance_id;
+  // We need to copy this, so we can return the memory to the shmem buffer.
+  memcpy(&rec.entry, entry, sizeof(*entry));
+  client_data->free_records.emplace_back(std::move(rec));
+  if (client_data->free_records.size() == kRecordBatchSize) {
+    delegate->PostFreeRecord(self, std::move(client_data->free_records));
+    client_data->free_records.clear();
+    client_data->free_records.reserve(kRecordBatchSize);
+  }
+}
+
 // static
 void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
                                    AllocRecordArena* alloc_record_arena,
@@ -333,27 +543,20 @@ void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
   }
 
   if (msg.record_type == RecordType::Malloc) {
-    std::unique_ptr<AllocRecord> rec = alloc_record_arena->BorrowAllocRecord();
-    rec->alloc_metadata = *msg.alloc_header;
-    rec->pid = peer_pid;
-    rec->data_source_instance_id = data_source_instance_id;
-    auto start_time_us = base::GetWallTimeNs() / 1000;
-    if (!client_data->stream_allocations)
-      DoUnwind(&msg, unwinding_metadata, rec.get());
-    rec->unwinding_time_us = static_cast<uint64_t>(
-        ((base::GetWallTimeNs() / 1000) - start_time_us).count());
-    delegate->PostAllocRecord(self, std::move(rec));
+    UnwindAndPostAllocRecord(self, alloc_record_arena, &msg, unwinding_metadata,
+                             peer_pid, data_source_instance_id,
+                             client_data->stream_allocations, delegate);
   } else if (msg.record_type == RecordType::Free) {
-    FreeRecord rec;
-    rec.pid = peer_pid;
-    rec.data_source_instance_id = data_source_instance_id;
-    // We need to copy this, so we can return the memory to the shmem buffer.
-    memcpy(&rec.entry, msg.free_header, sizeof(*msg.free_header));
-    client_data->free_records.emplace_back(std::move(rec));
-    if (client_data->free_records.size() == kRecordBatchSize) {
-      delegate->PostFreeRecord(self, std::move(client_data->free_records));
-      client_data->free_records.clear();
-      client_data->free_records.reserve(kRecordBatchSize);
+    AddFreeRecord(self, msg.free_header, client_data, peer_pid, delegate);
+  } else if (msg.record_type == RecordType::FreeBatch) {
+    // ReceiveWireMessage checked that the payload holds exactly
+    // |num_entries| entries.
+    size_t num_entries = msg.payload_size / sizeof(FreeEntry);
+    for (size_t i = 0; i < num_entries; ++i) {
+      FreeEntry entry;
+      // The payload is not necessarily aligned for FreeEntry.
+      memcpy(&entry, msg.payload + i * sizeof(FreeEntry), sizeof(entry));
+      AddFreeRecord(self, &entry, client_data, peer_pid, delegate);
     }
   } else if (msg.record_type == RecordType::HeapName) {
     HeapNameRecord rec;
@@ -396,6 +599,9 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
       std::move(handoff_data.client_config),
       handoff_data.stream_allocations,
       {},
+      {},
+      {},
+      0,
   };
   client_data.free_records.reserve(kRecordBatchSize);
   client_data.shmem.SetReaderPaused();
@@ -19,6 +19,12 @@
 
 #include <unwindstack/Regs.h>
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/thread_task_runner.h"
@@ -92,6 +98,12 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     alloc_record_arena_.ReturnAllocRecord(std::move(record));
   }
 
+  // Lets this worker hand samples of its backlogged clients to |peers| to be
+  // unwound there, rather than unwinding everything of a process on the
+  // worker it was sharded to. SetPeers({}) stops the offloading: it has to be
+  // called on every worker before any of them is destroyed.
+  void SetPeers(std::vector<UnwindingWorker*> peers);
+
   // Implementation of UnixSocket::EventListener.
   // Do not call explicitly.
   void OnDisconnect(base::UnixSocket* self) override;
@@ -102,6 +114,9 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   void OnDataAvailable(base::UnixSocket* self) override;
 
  public:
+  // The part of a client needed by the peers that unwind its samples.
+  struct SharedClientState;
+
   // public for testing/fuzzer
   struct ClientData {
     DataSourceInstanceID data_source_instance_id;
@@ -111,6 +126,12 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     ClientConfiguration client_config;
     bool stream_allocations;
     std::vector<FreeRecord> free_records;
+    // Set once the first sample is offloaded to a peer.
+    std::shared_ptr<SharedClientState> shared_state;
+    // The peers that were handed samples, which need to be drained before
+    // reporting the disconnection.
+    std::vector<UnwindingWorker*> offload_peers;
+    uint64_t offload_round;
   };
 
   // public for testing/fuzzing
@@ -122,10 +143,36 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
                            Delegate* delegate);
 
  private:
+  struct OffloadedSample;
+  // Unwinding state of a client of another worker, see SetPeers.
+  struct PeerClient {
+    std::shared_ptr<SharedClientState> shared_state;
+    std::unique_ptr<UnwindingMetadata> metadata;
+  };
+
+  static void UnwindAndPostAllocRecord(UnwindingWorker* self,
+                                       AllocRecordArena* alloc_record_arena,
+                                       WireMessage* msg,
+                                       UnwindingMetadata* metadata,
+                                       pid_t peer_pid,
+                                       DataSourceInstanceID ds_id,
+                                       bool stream_allocations,
+                                       Delegate* delegate);
+  static void AddFreeRecord(UnwindingWorker* self,
+                            const FreeEntry* entry,
+                            ClientData* client_data,
+                            pid_t peer_pid,
+                            Delegate* delegate);
   void HandleHandoffSocket(HandoffData data);
   void HandleDisconnectSocket(pid_t pid);
   std::unique_ptr<AllocRecord> BorrowAllocRecord();
 
+  bool MaybeOffloadBuffer(const SharedRingBuffer::Buffer& buf,
+                          ClientData* client_data);
+  void HandleOffloadedSample(std::shared_ptr<SharedClientState> shared_state,
+                             std::shared_ptr<OffloadedSample> sample);
+  void HandleDrainPeerClient(std::shared_ptr<SharedClientState> shared_state);
+
   enum class ReadAndUnwindBatchResult {
     kHasMore,
     kReadSome,
@@ -138,6 +185,15 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   std::map<pid_t, ClientData> client_data_;
   Delegate* delegate_;
 
+  // Guards |peers_|, which are posted to from this worker's thread.
+  std::unique_ptr<std::mutex> peers_mutex_{new std::mutex()};
+  std::vector<UnwindingWorker*> peers_;
+  // Samples posted to this worker by its peers, not yet unwound.
+  std::unique_ptr<std::atomic<size_t>> pending_offloaded_samples_{
+      new std::atomic<size_t>(0)};
+  // Keyed by the SharedClientState, only accessed on this worker's thread.
+  std::map<const SharedClientState*, PeerClient> peer_clients_;
+
   // Task runner with a dedicated thread. Keep last as instances this class are
   // currently (incorrectly) being destroyed on the main thread, instead of the
   // task thread. By destroying this task runner first, we ensure that the
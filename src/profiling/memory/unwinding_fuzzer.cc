@@ -50,7 +50,7 @@ int FuzzUnwinding(const uint8_t* data, size_t size) {
 
   NopDelegate nop_delegate;
   UnwindingWorker::ClientData client_data{
-      id, {}, std::move(metadata), {}, {}, {}, {},
+      id, {}, std::move(metadata), {}, {}, {}, {}, {}, {}, 0,
   };
 
   AllocRecordArena arena;
@@ -20,6 +20,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <unwindstack/RegsGetLocal.h>
 
 #include "perfetto/ext/base/file_utils.h"
@@ -70,6 +71,22 @@ TEST(UnwindingTest, FDMapsParse) {
   ASSERT_EQ(map_info->name(), "[stack]");
 }
 
+TEST(UnwindingTest, FDMapsParseSharedOffset) {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  ASSERT_TRUE(proc_maps);
+  base::ScopedFile other_maps(dup(*proc_maps));
+  ASSERT_TRUE(other_maps);
+  FDMaps maps(std::move(proc_maps));
+  // Moves the file offset shared with |maps|.
+  char buf[64];
+  ASSERT_GT(read(*other_maps, buf, sizeof(buf)), 0);
+  ASSERT_TRUE(maps.Parse());
+  unwindstack::MapInfo* map_info =
+      maps.Find(reinterpret_cast<uint64_t>(&proc_maps));
+  ASSERT_NE(map_info, nullptr);
+  ASSERT_EQ(map_info->name(), "[stack]");
+}
+
 void __attribute__((noinline)) AssertFunctionOffset() {
   constexpr auto kMaxFunctionSize = 1000u;
   // Need to zero-initialize to make MSAN happy. MSAN does not see the writes
@@ -177,6 +194,69 @@ TEST(UnwindingTest, DoUnwindReparse) {
                "namespace)::GetRecord(perfetto::profiling::WireMessage*)");
 }
 
+TEST(UnwindingTest, DoUnwindCached) {
+  base::ScopedFile proc_maps(base::OpenFile("/proc/self/maps", O_RDONLY));
+  base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
+  UnwindingMetadata metadata(std::move(proc_maps), std::move(proc_mem));
+  WireMessage msg;
+  auto record = GetRecord(&msg);
+  AllocRecord out;
+  ASSERT_TRUE(DoUnwind(&msg, &metadata, &out));
+  ASSERT_EQ(metadata.unwind_cache.size(), 1u);
+  AllocRecord cached_out;
+  ASSERT_TRUE(DoUnwind(&msg, &metadata, &cached_out));
+  ASSERT_EQ(cached_out.frames.size(), out.frames.size());
+  for (size_t i = 0; i < out.frames.size(); ++i) {
+    EXPECT_EQ(cached_out.frames[i].function_name, out.frames[i].function_name);
+    EXPECT_EQ(cached_out.frames[i].pc, out.frames[i].pc);
+  }
+  EXPECT_EQ(cached_out.build_ids, out.build_ids);
+  metadata.ReparseMaps();
+  EXPECT_EQ(metadata.unwind_cache.size(), 0u);
+}
+
+TEST(UnwindCacheTest, MatchesReadStackBytes) {
+  UnwindCache cache;
+  UnwindCache::Key key{};
+  key.regs[0] = 0x1000;
+  key.stack_start = 0x7f00;
+  uint8_t stack[32] = {};
+  stack[8] = 1;
+  unwindstack::FrameData frame{};
+  frame.function_name = "fun";
+  frame.map_name = "/system/lib64/libc.so";
+  cache.Insert(key, stack, sizeof(stack), {{8, 8}, {8, 8}}, {frame});
+
+  auto* frames = cache.Find(key, stack, sizeof(stack));
+  ASSERT_NE(frames, nullptr);
+  EXPECT_EQ((*frames)[0].function_name, "fun");
+
+  // Bytes that were not read by the unwinding don't matter.
+  stack[0] = 2;
+  EXPECT_NE(cache.Find(key, stack, sizeof(stack)), nullptr);
+  // Nor does a longer stack.
+  uint8_t longer_stack[64] = {};
+  memcpy(longer_stack, stack, sizeof(stack));
+  EXPECT_NE(cache.Find(key, longer_stack, sizeof(longer_stack)), nullptr);
+
+  stack[12] = 3;
+  EXPECT_EQ(cache.Find(key, stack, sizeof(stack)), nullptr);
+  stack[12] = 0;
+  EXPECT_EQ(cache.Find(key, stack, 12), nullptr);
+  key.regs[0] = 0x1004;
+  EXPECT_EQ(cache.Find(key, stack, sizeof(stack)), nullptr);
+}
+
+TEST(UnwindCacheTest, SkipsJitFrames) {
+  UnwindCache cache;
+  UnwindCache::Key key{};
+  uint8_t stack[8] = {};
+  unwindstack::FrameData frame{};
+  frame.map_name = "/memfd:jit-cache (deleted)";
+  cache.Insert(key, stack, sizeof(stack), {{0, 8}}, {frame});
+  EXPECT_EQ(cache.size(), 0u);
+}
+
 TEST(AllocRecordArenaTest, Smoke) {
   AllocRecordArena a;
   auto borrowed = a.BorrowAllocRecord();
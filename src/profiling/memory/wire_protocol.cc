@@ -63,7 +63,9 @@ int64_t WithBuffer(SharedRingBuffer* shmem, size_t total_size, F fn) {
     return -1;
   }
   SharedRingBuffer::Buffer buf;
-  {
+  if (shmem->lock_free_writes()) {
+    buf = shmem->BeginWrite(total_size);
+  } else {
     ScopedSpinlock lock = shmem->AcquireLock(ScopedSpinlock::Mode::Try);
     if (!lock.locked()) {
       PERFETTO_DLOG("Failed to acquire spinlock.");
@@ -114,6 +116,19 @@ int64_t SendWireMessage(SharedRingBuffer* shmem, const WireMessage& msg) {
                    sizeof(*msg.free_header));
           });
     }
+    case RecordType::FreeBatch: {
+      size_t total_size = sizeof(msg.record_type) +
+                          sizeof(*msg.free_batch_header) + msg.payload_size;
+      return WithBuffer(
+          shmem, total_size, [msg](SharedRingBuffer::Buffer* buf) {
+            memcpy(buf->data, &msg.record_type, sizeof(msg.record_type));
+            memcpy(buf->data + sizeof(msg.record_type), msg.free_batch_header,
+                   sizeof(*msg.free_batch_header));
+            memcpy(buf->data + sizeof(msg.record_type) +
+                       sizeof(*msg.free_batch_header),
+                   msg.payload, msg.payload_size);
+          });
+    }
     case RecordType::HeapName: {
       constexpr size_t total_size =
           sizeof(msg.record_type) + sizeof(*msg.heap_name_header);
@@ -155,6 +170,20 @@ bool ReceiveWireMessage(char* buf, size_t size, WireMessage* out) {
       PERFETTO_DFATAL_OR_ELOG("Cannot read free header.");
       return false;
     }
+  } else if (*record_type == RecordType::FreeBatch) {
+    if (!ViewAndAdvance<FreeBatchHeader>(&buf, &out->free_batch_header,
+                                         end)) {
+      PERFETTO_DFATAL_OR_ELOG("Cannot read free batch header.");
+      return false;
+    }
+    uint64_t num_entries = out->free_batch_header->num_entries;
+    if (num_entries > kMaxFreeBatchEntries ||
+        static_cast<size_t>(end - buf) != num_entries * sizeof(FreeEntry)) {
+      PERFETTO_DFATAL_OR_ELOG("Invalid free batch size.");
+      return false;
+    }
+    out->payload = buf;
+    out->payload_size = static_cast<size_t>(end - buf);
   } else if (*record_type == RecordType::HeapName) {
     if (!ViewAndAdvance<HeapName>(&buf, &out->heap_name_header, end)) {
       PERFETTO_DFATAL_OR_ELOG("Cannot read free header.");
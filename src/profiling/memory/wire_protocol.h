@@ -91,11 +91,13 @@ struct ClientConfiguration {
   PERFETTO_CROSS_ABI_ALIGNED(uint64_t) adaptive_sampling_shmem_threshold;
   PERFETTO_CROSS_ABI_ALIGNED(uint64_t)
   adaptive_sampling_max_sampling_interval_bytes;
+  PERFETTO_CROSS_ABI_ALIGNED(uint64_t) adaptive_sampling_spinlock_blocked_us;
   alignas(8) ClientConfigurationHeap heaps[64];
   PERFETTO_CROSS_ABI_ALIGNED(bool) block_client;
   PERFETTO_CROSS_ABI_ALIGNED(bool) disable_fork_teardown;
   PERFETTO_CROSS_ABI_ALIGNED(bool) disable_vfork_detection;
   PERFETTO_CROSS_ABI_ALIGNED(bool) all_heaps;
+  PERFETTO_CROSS_ABI_ALIGNED(bool) adaptive_sampling_restore_interval;
   // Just double check that the array sizes are in correct order.
 };
 
@@ -103,6 +105,7 @@ enum class RecordType : uint64_t {
   Free = 0,
   Malloc = 1,
   HeapName = 2,
+  FreeBatch = 3,
 };
 
 // Make the whole struct 8-aligned. This is to make sizeof(AllocMetdata)
@@ -131,6 +134,15 @@ struct FreeEntry {
   PERFETTO_CROSS_ABI_ALIGNED(uint32_t) heap_id;
 };
 
+// Followed by |num_entries| FreeEntry. Used by the client to send the frees
+// of a thread together, rather than one record each.
+struct FreeBatchHeader {
+  PERFETTO_CROSS_ABI_ALIGNED(uint64_t) num_entries;
+};
+
+// Maximum number of entries of a FreeBatch.
+constexpr size_t kMaxFreeBatchEntries = 64;
+
 struct HeapName {
   PERFETTO_CROSS_ABI_ALIGNED(uint64_t) sample_interval;
   PERFETTO_CROSS_ABI_ALIGNED(uint32_t) heap_id;
@@ -142,9 +154,11 @@ static_assert(sizeof(AllocMetadata) == 328,
               "AllocMetadata needs to be the same size across ABIs.");
 static_assert(sizeof(FreeEntry) == 24,
               "FreeEntry needs to be the same size across ABIs.");
+static_assert(sizeof(FreeBatchHeader) == 8,
+              "FreeBatchHeader needs to be the same size across ABIs.");
 static_assert(sizeof(HeapName) == 80,
               "HeapName needs to be the same size across ABIs.");
-static_assert(sizeof(ClientConfiguration) == 4656,
+static_assert(sizeof(ClientConfiguration) == 4664,
               "ClientConfiguration needs to be the same size across ABIs.");
 
 enum HandshakeFDs : size_t {
@@ -159,6 +173,8 @@ struct WireMessage {
   AllocMetadata* alloc_header;
   FreeEntry* free_header;
   HeapName* heap_name_header;
+  // For FreeBatch, the entries are in the payload.
+  FreeBatchHeader* free_batch_header;
 
   char* payload;
   size_t payload_size;
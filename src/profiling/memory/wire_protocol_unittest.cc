@@ -132,6 +132,46 @@ TEST(WireProtocolTest, FreeMessage) {
   shmem_server->EndRead(std::move(buf));
 }
 
+TEST(WireProtocolTest, FreeBatchMessage) {
+  FreeEntry entries[3] = {};
+  for (uint64_t i = 0; i < 3; ++i) {
+    entries[i].sequence_number = 0x111111111111111 + i;
+    entries[i].addr = 0x222222222222222 + i;
+    entries[i].heap_id = static_cast<uint32_t>(i);
+  }
+  FreeBatchHeader header = {};
+  header.num_entries = 3;
+  WireMessage msg = {};
+  msg.record_type = RecordType::FreeBatch;
+  msg.free_batch_header = &header;
+  msg.payload = reinterpret_cast<char*>(&entries[0]);
+  msg.payload_size = sizeof(entries);
+
+  auto shmem_client = SharedRingBuffer::Create(kShmemSize);
+  ASSERT_TRUE(shmem_client);
+  ASSERT_TRUE(shmem_client->is_valid());
+  auto shmem_server = SharedRingBuffer::Attach(CopyFD(shmem_client->fd()));
+
+  ASSERT_GE(SendWireMessage(&shmem_client.value(), msg), 0);
+
+  auto buf = shmem_server->BeginRead();
+  ASSERT_TRUE(buf);
+  WireMessage recv_msg;
+  ASSERT_TRUE(ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
+                                 &recv_msg));
+
+  ASSERT_EQ(recv_msg.record_type, msg.record_type);
+  ASSERT_EQ(recv_msg.free_batch_header->num_entries, 3u);
+  ASSERT_EQ(recv_msg.payload_size, sizeof(entries));
+  for (size_t i = 0; i < 3; ++i) {
+    FreeEntry entry;
+    memcpy(&entry, recv_msg.payload + i * sizeof(FreeEntry), sizeof(entry));
+    EXPECT_EQ(entry, entries[i]);
+  }
+
+  shmem_server->EndRead(std::move(buf));
+}
+
 TEST(GetHeapSamplingInterval, Default) {
   ClientConfiguration cli_config{};
   cli_config.all_heaps = true;
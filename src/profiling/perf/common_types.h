@@ -55,7 +55,12 @@ struct ParsedSample {
   std::unique_ptr<unwindstack::Regs> regs;
   std::vector<char> stack;
   bool stack_maxed = false;
+  // Kernel-unwound callchain, split at the userspace context marker: the
+  // kernel part (starting with the PERF_CONTEXT_KERNEL marker), and the
+  // userspace frames, which are present only if the frame pointers were
+  // walked by the kernel (in which case |regs| and |stack| are empty).
   std::vector<uint64_t> kernel_ips;
+  std::vector<uint64_t> user_ips;
 };
 
 // Entry in an unwinding queue. Either a sample that requires unwinding, or a
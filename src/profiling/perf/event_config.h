@@ -134,6 +134,7 @@ class EventConfig {
   bool sample_callstacks() const { return sample_callstacks_; }
   const TargetFilter& filter() const { return target_filter_; }
   bool kernel_frames() const { return kernel_frames_; }
+  bool frame_pointer_unwinding() const { return frame_pointer_unwinding_; }
   perf_event_attr* perf_attr() const {
     return const_cast<perf_event_attr*>(&perf_event_attr_);
   }
@@ -150,6 +151,7 @@ class EventConfig {
               bool sample_callstacks,
               TargetFilter target_filter,
               bool kernel_frames,
+              bool frame_pointer_unwinding,
               uint32_t ring_buffer_pages,
               uint32_t read_tick_period_ms,
               uint64_t samples_per_tick_limit,
@@ -177,6 +179,10 @@ class EventConfig {
   // If true, include kernel frames in the callstacks.
   const bool kernel_frames_;
 
+  // If true, the userspace frames are walked by the kernel using the frame
+  // pointers, instead of sampling the stacks for DWARF unwinding.
+  const bool frame_pointer_unwinding_;
+
   // Size (in 4k pages) of each per-cpu ring buffer shared with the kernel.
   // Must be a power of two.
   const uint32_t ring_buffer_pages_;
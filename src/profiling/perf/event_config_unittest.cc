@@ -328,6 +328,50 @@ TEST(EventConfigTest, CallstackSamplingModeDetection) {
   }
 }
 
+TEST(EventConfigTest, FramePointerUnwinding) {
+  {  // userspace callchains instead of the stack and registers
+    protos::gen::PerfEventConfig cfg;
+    cfg.mutable_callstack_sampling()->set_user_frames(
+        protos::gen::PerfEventConfig::CallstackSampling::UNWIND_FRAME_POINTER);
+
+    base::Optional<EventConfig> event_config =
+        EventConfig::Create(AsDataSourceConfig(cfg));
+
+    ASSERT_TRUE(event_config.has_value());
+    EXPECT_TRUE(event_config->frame_pointer_unwinding());
+    const perf_event_attr* attr = event_config->perf_attr();
+    uint64_t callstack_sample_types =
+        PERF_SAMPLE_STACK_USER | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_CALLCHAIN;
+    EXPECT_EQ(attr->sample_type & callstack_sample_types,
+              static_cast<uint64_t>(PERF_SAMPLE_CALLCHAIN));
+    EXPECT_FALSE(attr->exclude_callchain_user);
+    EXPECT_TRUE(attr->exclude_callchain_kernel);
+  }
+  {  // with kernel frames
+    protos::gen::PerfEventConfig cfg;
+    cfg.mutable_callstack_sampling()->set_kernel_frames(true);
+    cfg.mutable_callstack_sampling()->set_user_frames(
+        protos::gen::PerfEventConfig::CallstackSampling::UNWIND_FRAME_POINTER);
+
+    base::Optional<EventConfig> event_config =
+        EventConfig::Create(AsDataSourceConfig(cfg));
+
+    ASSERT_TRUE(event_config.has_value());
+    EXPECT_FALSE(event_config->perf_attr()->exclude_callchain_user);
+    EXPECT_FALSE(event_config->perf_attr()->exclude_callchain_kernel);
+  }
+  {  // DWARF unwinding by default
+    protos::gen::PerfEventConfig cfg;
+    cfg.mutable_callstack_sampling();
+
+    base::Optional<EventConfig> event_config =
+        EventConfig::Create(AsDataSourceConfig(cfg));
+
+    ASSERT_TRUE(event_config.has_value());
+    EXPECT_FALSE(event_config->frame_pointer_unwinding());
+  }
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
@@ -23,6 +23,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "perfetto/ext/base/utils.h"
 #include "src/profiling/perf/regs_parsing.h"
 
@@ -87,7 +89,10 @@ PerfRingBuffer::PerfRingBuffer(PerfRingBuffer&& other) noexcept
     : metadata_page_(other.metadata_page_),
       mmap_sz_(other.mmap_sz_),
       data_buf_(other.data_buf_),
-      data_buf_sz_(other.data_buf_sz_) {
+      data_buf_sz_(other.data_buf_sz_),
+      read_offset_(other.read_offset_),
+      published_read_offset_(other.published_read_offset_),
+      write_offset_(other.write_offset_) {
   other.metadata_page_ = nullptr;
   other.mmap_sz_ = 0;
   other.data_buf_ = nullptr;
@@ -137,35 +142,41 @@ base::Optional<PerfRingBuffer> PerfRingBuffer::Allocate(
   PERFETTO_CHECK(ret.metadata_page_->data_offset == base::kPageSize);
   PERFETTO_CHECK(ret.metadata_page_->data_size = ret.data_buf_sz_);
 
+  ret.read_offset_ = ret.metadata_page_->data_tail;
+  ret.published_read_offset_ = ret.read_offset_;
+  ret.write_offset_ = ret.read_offset_;
+
   return base::make_optional(std::move(ret));
 }
 
 // See |perf_output_put_handle| for the necessary synchronization between the
 // kernel and this userspace thread (which are using the same shared memory, but
 // might be on different cores).
-// TODO(rsavitski): is there false sharing between |data_tail| and |data_head|?
-// Is there an argument for maintaining our own copy of |data_tail| instead of
-// reloading it?
+// Both |data_tail| and |data_head| are shared with the kernel, which might be
+// writing to the buffer from other cores, so we keep local copies of them and
+// only synchronize once per batch of records.
 char* PerfRingBuffer::ReadRecordNonconsuming() {
   static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "");
 
   PERFETTO_DCHECK(valid());
 
-  // |data_tail| is written only by this userspace thread, so we can safely read
-  // it without any synchronization.
-  uint64_t read_offset = metadata_page_->data_tail;
+  if (read_offset_ == write_offset_) {
+    // Caught up with the last known write position: hand the consumed space
+    // back to the kernel before looking for new data.
+    PublishReadOffset();
 
-  // |data_head| is written by the kernel, perform an acquiring load such that
-  // the payload reads below are ordered after this load.
-  uint64_t write_offset =
-      reinterpret_cast<std::atomic<uint64_t>*>(&metadata_page_->data_head)
-          ->load(std::memory_order_acquire);
+    // |data_head| is written by the kernel, perform an acquiring load such
+    // that the payload reads below are ordered after this load.
+    write_offset_ =
+        reinterpret_cast<std::atomic<uint64_t>*>(&metadata_page_->data_head)
+            ->load(std::memory_order_acquire);
 
-  PERFETTO_DCHECK(read_offset <= write_offset);
-  if (write_offset == read_offset)
-    return nullptr;  // no new data
+    PERFETTO_DCHECK(read_offset_ <= write_offset_);
+    if (write_offset_ == read_offset_)
+      return nullptr;  // no new data
+  }
 
-  size_t read_pos = static_cast<size_t>(read_offset & (data_buf_sz_ - 1));
+  size_t read_pos = static_cast<size_t>(read_offset_ & (data_buf_sz_ - 1));
 
   // event header (64 bits) guaranteed to be contiguous
   PERFETTO_DCHECK(read_pos <= data_buf_sz_ - sizeof(perf_event_header));
@@ -199,14 +210,24 @@ char* PerfRingBuffer::ReadRecordNonconsuming() {
 void PerfRingBuffer::Consume(size_t bytes) {
   PERFETTO_DCHECK(valid());
 
+  read_offset_ += bytes;
+  PERFETTO_DCHECK(read_offset_ <= write_offset_);
+  if (read_offset_ - published_read_offset_ >= data_buf_sz_ / 4)
+    PublishReadOffset();
+}
+
+void PerfRingBuffer::PublishReadOffset() {
+  if (read_offset_ == published_read_offset_)
+    return;
+
   // Advance |data_tail|, which is written only by this thread. The store of the
   // updated value needs to have release semantics such that the preceding
   // payload reads are ordered before it. The reader in this case is the kernel,
   // which reads |data_tail| to calculate the available ring buffer capacity
   // before trying to store a new record.
-  uint64_t updated_tail = metadata_page_->data_tail + bytes;
   reinterpret_cast<std::atomic<uint64_t>*>(&metadata_page_->data_tail)
-      ->store(updated_tail, std::memory_order_release);
+      ->store(read_offset_, std::memory_order_release);
+  published_read_offset_ = read_offset_;
 }
 
 EventReader::EventReader(uint32_t cpu,
@@ -250,7 +271,7 @@ base::Optional<EventReader> EventReader::ConfigureEvents(
 }
 
 base::Optional<ParsedSample> EventReader::ReadUntilSample(
-    std::function<void(uint64_t)> records_lost_callback) {
+    const std::function<void(uint64_t)>& records_lost_callback) {
   for (;;) {
     char* event = ring_buffer_.ReadRecordNonconsuming();
     if (!event)
@@ -340,6 +361,19 @@ ParsedSample EventReader::ParseSampleRecord(uint32_t cpu,
     sample.kernel_ips.resize(static_cast<size_t>(chain_len));
     parse_pos = ReadValues<uint64_t>(sample.kernel_ips.data(), parse_pos,
                                      static_cast<size_t>(chain_len));
+
+    // Move the userspace part of the callchain (if any) out of the kernel
+    // part, without its context marker.
+    auto user_it = std::find(sample.kernel_ips.begin(), sample.kernel_ips.end(),
+                             static_cast<uint64_t>(PERF_CONTEXT_USER));
+    if (user_it != sample.kernel_ips.end()) {
+      auto user_end =
+          std::find_if(user_it + 1, sample.kernel_ips.end(), [](uint64_t ip) {
+            return ip >= static_cast<uint64_t>(PERF_CONTEXT_MAX);
+          });
+      sample.user_ips.assign(user_it + 1, user_end);
+      sample.kernel_ips.erase(user_it, sample.kernel_ips.end());
+    }
   }
 
   if (event_attr_.sample_type & PERF_SAMPLE_REGS_USER) {
@@ -365,10 +399,9 @@ ParsedSample EventReader::ParseSampleRecord(uint32_t cpu,
       PERFETTO_DLOG("sampled stack size: %" PRIu64 " / %" PRIu64 "",
                     filled_stack_size, max_stack_size);
 
-      // copy stack bytes into a vector
+      // copy stack bytes into a vector (without zero-filling it first)
       size_t payload_sz = static_cast<size_t>(filled_stack_size);
-      sample.stack.resize(payload_sz);
-      memcpy(sample.stack.data(), stack_start, payload_sz);
+      sample.stack.assign(stack_start, stack_start + payload_sz);
 
       // remember whether the stack sample is (most likely) truncated
       sample.stack_maxed = (filled_stack_size == max_stack_size);
@@ -44,7 +44,13 @@ class PerfRingBuffer {
   PerfRingBuffer(PerfRingBuffer&& other) noexcept;
   PerfRingBuffer& operator=(PerfRingBuffer&& other) noexcept;
 
+  // Returns the oldest unconsumed record, or nullptr if caught up with the
+  // writer. The kernel's write position is only reloaded once the records
+  // before the previously loaded one have all been consumed.
   char* ReadRecordNonconsuming();
+  // Consumes the record returned by |ReadRecordNonconsuming|. The consumed
+  // space is handed back to the kernel in batches: once a quarter of the
+  // buffer has been consumed, or when catching up with the writer.
   void Consume(size_t bytes);
 
  private:
@@ -52,6 +58,9 @@ class PerfRingBuffer {
 
   bool valid() const { return metadata_page_ != nullptr; }
 
+  // Publishes |read_offset_| as the |data_tail| read by the kernel.
+  void PublishReadOffset();
+
   // Points at the start of the mmap'd region.
   perf_event_mmap_page* metadata_page_ = nullptr;
 
@@ -62,6 +71,12 @@ class PerfRingBuffer {
   char* data_buf_ = nullptr;
   size_t data_buf_sz_ = 0;
 
+  // Local copies of the read and write positions, to avoid touching the
+  // metadata page shared with the kernel for every record.
+  uint64_t read_offset_ = 0;
+  uint64_t published_read_offset_ = 0;
+  uint64_t write_offset_ = 0;
+
   // When a record wraps around the ring buffer boundary, it is reconstructed in
   // a contiguous form in this buffer. This allows us to always return a pointer
   // to a contiguous record.
@@ -83,7 +98,7 @@ class EventReader {
   // or catching up to the writer. The other record of interest
   // (PERF_RECORD_LOST) is handled via the given callback.
   base::Optional<ParsedSample> ReadUntilSample(
-      std::function<void(uint64_t)> lost_events_callback);
+      const std::function<void(uint64_t)>& lost_events_callback);
 
   void EnableEvents();
   // Pauses the event counting, without invalidating existing samples.
@@ -16,6 +16,7 @@
 
 #include "src/profiling/perf/perf_producer.h"
 
+#include <algorithm>
 #include <random>
 #include <utility>
 
@@ -80,6 +81,16 @@ size_t NumberOfCpus() {
   return static_cast<size_t>(sysconf(_SC_NPROCESSORS_CONF));
 }
 
+// One unwinder per |kCpusPerUnwinder| cpus, as every unwinder keeps its own
+// copy of the kernel symbols, and of the parsed maps of its processes.
+constexpr size_t kCpusPerUnwinder = 8;
+constexpr size_t kMaxUnwinders = 4;
+
+size_t NumberOfUnwinders() {
+  return std::min(std::max(NumberOfCpus() / kCpusPerUnwinder, size_t{1}),
+                  kMaxUnwinders);
+}
+
 TraceWriter::TracePacketHandle StartTracePacket(TraceWriter* trace_writer) {
   auto packet = trace_writer->NewTracePacket();
   packet->set_sequence_flags(
@@ -260,9 +271,15 @@ PerfProducer::PerfProducer(ProcDescriptorGetter* proc_fd_getter,
                            base::TaskRunner* task_runner)
     : task_runner_(task_runner),
       proc_fd_getter_(proc_fd_getter),
-      unwinding_worker_(this),
       weak_factory_(this) {
   proc_fd_getter->SetDelegate(this);
+
+  size_t num_unwinders = NumberOfUnwinders();
+  unwinder_pool_locks_ = std::make_shared<UnwinderPoolLocks>(num_unwinders);
+  for (size_t i = 0; i < num_unwinders; i++) {
+    unwinding_workers_.emplace_back(
+        new UnwinderHandle(this, unwinder_pool_locks_, i));
+  }
 }
 
 void PerfProducer::SetupDataSource(DataSourceInstanceID,
@@ -342,13 +359,14 @@ void PerfProducer::StartDataSource(DataSourceInstanceID ds_id,
       ds_it->second.trace_writer.get(),
       protos::pbzero::TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
 
-  // Inform unwinder of the new data source instance, and optionally start a
-  // periodic task to clear its cached state.
-  unwinding_worker_->PostStartDataSource(ds_id,
-                                         ds.event_config.kernel_frames());
-  if (ds.event_config.unwind_state_clear_period_ms()) {
-    unwinding_worker_->PostClearCachedStatePeriodic(
-        ds_id, ds.event_config.unwind_state_clear_period_ms());
+  // Inform the unwinders of the new data source instance, and optionally start
+  // a periodic task to clear their cached state.
+  for (auto& worker : unwinding_workers_) {
+    (*worker)->PostStartDataSource(ds_id, ds.event_config.kernel_frames());
+    if (ds.event_config.unwind_state_clear_period_ms()) {
+      (*worker)->PostClearCachedStatePeriodic(
+          ds_id, ds.event_config.unwind_state_clear_period_ms());
+    }
   }
 
   // Kick off periodic read task.
@@ -506,12 +524,15 @@ void PerfProducer::TickDataSourceRead(DataSourceInstanceID ds_id) {
     }
   }
 
-  // Wake up the unwinder as we've (likely) pushed samples into its queue.
-  unwinding_worker_->PostProcessQueue();
+  // Wake up the unwinders as we've (likely) pushed samples into their queues.
+  for (auto& worker : unwinding_workers_)
+    (*worker)->PostProcessQueue();
 
   if (PERFETTO_UNLIKELY(ds.status == DataSourceState::Status::kShuttingDown) &&
       !more_records_available) {
-    unwinding_worker_->PostInitiateDataSourceStop(ds_id);
+    ds.pending_unwinder_stops = unwinding_workers_.size();
+    for (auto& worker : unwinding_workers_)
+      (*worker)->PostInitiateDataSourceStop(ds_id);
   } else {
     // otherwise, keep reading
     auto tick_period_ms = it->second.event_config.read_tick_period_ms();
@@ -533,13 +554,15 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
 
   // If the kernel ring buffer dropped data, record it in the trace.
   size_t cpu = reader->cpu();
-  auto records_lost_callback = [this, ds_id, cpu](uint64_t records_lost) {
-    auto weak_this = weak_factory_.GetWeakPtr();
-    task_runner_->PostTask([weak_this, ds_id, cpu, records_lost] {
-      if (weak_this)
-        weak_this->EmitRingBufferLoss(ds_id, cpu, records_lost);
-    });
-  };
+  // Converted to a std::function once, rather than on every read.
+  std::function<void(uint64_t)> records_lost_callback =
+      [this, ds_id, cpu](uint64_t records_lost) {
+        auto weak_this = weak_factory_.GetWeakPtr();
+        task_runner_->PostTask([weak_this, ds_id, cpu, records_lost] {
+          if (weak_this)
+            weak_this->EmitRingBufferLoss(ds_id, cpu, records_lost);
+        });
+      };
 
   for (uint64_t i = 0; i < max_samples; i++) {
     base::Optional<ParsedSample> sample =
@@ -557,8 +580,9 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
       continue;
     }
 
-    // If sampling callstacks, we're not interested in kernel threads/workers.
-    if (!sample->regs) {
+    // If sampling callstacks, we're not interested in kernel threads/workers,
+    // which have neither the userspace registers nor a userspace callchain.
+    if (!sample->regs && sample->user_ips.empty()) {
       continue;
     }
 
@@ -609,7 +633,7 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
         ds->event_config.max_enqueued_footprint_bytes();
     uint64_t sample_stack_size = sample->stack.size();
     if (max_footprint_bytes) {
-      uint64_t footprint_bytes = unwinding_worker_->GetEnqueuedFootprint();
+      uint64_t footprint_bytes = GetEnqueuedFootprint();
       if (footprint_bytes + sample_stack_size >= max_footprint_bytes) {
         PERFETTO_DLOG("Skipping sample enqueueing due to footprint limit.");
         EmitSkippedSample(ds_id, std::move(sample.value()),
@@ -618,14 +642,15 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
       }
     }
 
-    // Push the sample into the unwinding queue if there is room.
-    auto& queue = unwinding_worker_->unwind_queue();
+    // Push the sample into its unwinder's queue if there is room.
+    Unwinder* unwinder = UnwinderForPid(pid);
+    auto& queue = unwinder->unwind_queue();
     WriteView write_view = queue.BeginWrite();
     if (write_view.valid) {
       queue.at(write_view.write_pos) =
           UnwindEntry{ds_id, std::move(sample.value())};
       queue.CommitWrite();
-      unwinding_worker_->IncrementEnqueuedFootprint(sample_stack_size);
+      unwinder->IncrementEnqueuedFootprint(sample_stack_size);
     } else {
       PERFETTO_DLOG("Unwinder queue full, skipping sample");
       EmitSkippedSample(ds_id, std::move(sample.value()),
@@ -669,7 +694,7 @@ void PerfProducer::OnProcDescriptors(pid_t pid,
                     static_cast<int>(pid), static_cast<size_t>(it.first));
 
       proc_status_it->second = ProcessTrackingStatus::kResolved;
-      unwinding_worker_->PostAdoptProcDescriptors(
+      UnwinderForPid(pid)->PostAdoptProcDescriptors(
           it.first, pid, std::move(maps_fd), std::move(mem_fd));
       return;  // done
     }
@@ -732,7 +757,7 @@ void PerfProducer::EvaluateDescriptorLookupTimeout(DataSourceInstanceID ds_id,
     proc_status_it->second = ProcessTrackingStatus::kExpired;
     // Also inform the unwinder of the state change (so that it can discard any
     // of the already-enqueued samples).
-    unwinding_worker_->PostRecordTimedOutProcDescriptors(ds_id, pid);
+    UnwinderForPid(pid)->PostRecordTimedOutProcDescriptors(ds_id, pid);
   }
 }
 
@@ -894,6 +919,11 @@ void PerfProducer::FinishDataSourceStop(DataSourceInstanceID ds_id) {
   DataSourceState& ds = ds_it->second;
   PERFETTO_CHECK(ds.status == DataSourceState::Status::kShuttingDown);
 
+  // Wait for all the unwinders to be done with the source's samples.
+  PERFETTO_DCHECK(ds.pending_unwinder_stops > 0);
+  if (--ds.pending_unwinder_stops > 0)
+    return;
+
   ds.trace_writer->Flush();
   data_sources_.erase(ds_it);
 
@@ -924,7 +954,8 @@ void PerfProducer::PurgeDataSource(DataSourceInstanceID ds_id) {
   PERFETTO_LOG("Stopping DataSource(%zu) prematurely",
                static_cast<size_t>(ds_id));
 
-  unwinding_worker_->PostPurgeDataSource(ds_id);
+  for (auto& worker : unwinding_workers_)
+    (*worker)->PostPurgeDataSource(ds_id);
 
   // Write a packet indicating the abrupt stop.
   {
@@ -948,6 +979,18 @@ void PerfProducer::PurgeDataSource(DataSourceInstanceID ds_id) {
   }
 }
 
+Unwinder* PerfProducer::UnwinderForPid(pid_t pid) {
+  size_t index = static_cast<size_t>(pid) % unwinding_workers_.size();
+  return unwinding_workers_[index]->get();
+}
+
+uint64_t PerfProducer::GetEnqueuedFootprint() {
+  uint64_t footprint_bytes = 0;
+  for (auto& worker : unwinding_workers_)
+    footprint_bytes += (*worker)->GetEnqueuedFootprint();
+  return footprint_bytes;
+}
+
 void PerfProducer::StartMetatraceSource(DataSourceInstanceID ds_id,
                                         BufferID target_buffer) {
   auto writer = endpoint_->CreateTraceWriter(target_buffer);
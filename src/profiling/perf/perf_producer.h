@@ -54,7 +54,8 @@ namespace profiling {
 // summary in the mean time: three stages: (1) kernel buffer reader that parses
 // the samples -> (2) callstack unwinder -> (3) interning and serialization of
 // samples. This class handles stages (1) and (3) on the main thread. Unwinding
-// is done by |Unwinder| on a dedicated thread.
+// is done by a pool of |Unwinder|s, each on a dedicated thread, with the
+// samples sharded across them by pid.
 class PerfProducer : public Producer,
                      public ProcDescriptorDelegate,
                      public Unwinder::Delegate {
@@ -145,6 +146,9 @@ class PerfProducer : public Producer,
     // Command lines we have decided to unwind, up to a total of
     // additional_cmdline_count values.
     base::FlatSet<std::string> additional_cmdlines;
+
+    // Number of unwinders that have yet to finish their part of the stop.
+    size_t pending_unwinder_stops = 0;
   };
 
   // For |EmitSkippedSample|.
@@ -217,6 +221,11 @@ class PerfProducer : public Producer,
 
   void StartMetatraceSource(DataSourceInstanceID ds_id, BufferID target_buffer);
 
+  // Returns the unwinder that all the samples of |pid| are handed to.
+  Unwinder* UnwinderForPid(pid_t pid);
+  // Heap memory held by the samples enqueued across all unwinders.
+  uint64_t GetEnqueuedFootprint();
+
   // Task runner owned by the main thread.
   base::TaskRunner* const task_runner_;
   State state_ = kNotStarted;
@@ -246,8 +255,9 @@ class PerfProducer : public Producer,
   // State associated with perf-sampling data sources.
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
 
-  // Unwinding stage, running on a dedicated thread.
-  UnwinderHandle unwinding_worker_;
+  // Unwinding stage, running on a pool of dedicated threads. Never resized.
+  std::shared_ptr<UnwinderPoolLocks> unwinder_pool_locks_;
+  std::vector<std::unique_ptr<UnwinderHandle>> unwinding_workers_;
 
   // Used for tracepoint name -> id lookups. Initialized lazily, and in general
   // best effort - can be null if tracefs isn't accessible.
@@ -16,12 +16,14 @@
 
 #include "src/profiling/perf/unwinding.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <mutex>
 
 #include <unwindstack/Unwinder.h>
 
 #include "perfetto/ext/base/metatrace.h"
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/thread_utils.h"
 #include "perfetto/ext/base/utils.h"
 
@@ -35,8 +37,14 @@ namespace profiling {
 
 Unwinder::Delegate::~Delegate() = default;
 
-Unwinder::Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner)
-    : task_runner_(task_runner), delegate_(delegate) {
+Unwinder::Unwinder(Delegate* delegate,
+                   base::UnixTaskRunner* task_runner,
+                   std::shared_ptr<UnwinderPoolLocks> pool_locks,
+                   size_t pool_index)
+    : task_runner_(task_runner),
+      delegate_(delegate),
+      pool_locks_(std::move(pool_locks)),
+      pool_index_(pool_index) {
   ResetAndEnableUnwindstackCache();
   base::MaybeSetThreadName("stack-unwinding");
 }
@@ -259,9 +267,13 @@ base::FlatSet<DataSourceInstanceID> Unwinder::ConsumeAndUnwindReadySamples() {
                                  static_cast<int32_t>(pid));
 
       PERFETTO_CHECK(proc_state.unwind_state.has_value());
-      CompletedSample unwound_sample =
-          UnwindSample(entry.sample, &proc_state.unwind_state.value(),
-                       proc_state.attempted_unwinding);
+      CompletedSample unwound_sample;
+      {
+        std::lock_guard<std::mutex> lock(pool_locks_->unwind_lock(pool_index_));
+        unwound_sample =
+            UnwindSample(entry.sample, &proc_state.unwind_state.value(),
+                         proc_state.attempted_unwinding);
+      }
       proc_state.attempted_unwinding = true;
 
       PERFETTO_METATRACE_COUNTER(TAG_PRODUCER, PROFILER_UNWIND_CURRENT_PID, 0);
@@ -301,15 +313,23 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DCHECK(unwind_state);
 
+  if (!sample.regs)
+    return SymbolizeCallchainSample(sample, unwind_state);
+
   CompletedSample ret;
   ret.common = sample.common;
 
   // Overlay the stack bytes over /proc/<pid>/mem.
-  std::shared_ptr<unwindstack::Memory> overlay_memory =
-      std::make_shared<StackOverlayMemory>(
-          unwind_state->fd_mem, sample.regs->sp(),
-          reinterpret_cast<const uint8_t*>(sample.stack.data()),
-          sample.stack.size());
+  const uint8_t* stack = reinterpret_cast<const uint8_t*>(sample.stack.data());
+  std::shared_ptr<StackOverlayMemory> overlay_memory =
+      std::make_shared<StackOverlayMemory>(unwind_state->fd_mem,
+                                           sample.regs->sp(), stack,
+                                           sample.stack.size());
+  std::vector<StackRead> stack_reads;
+  bool read_past_stack = false;
+  overlay_memory->RecordReads(&stack_reads, &read_past_stack);
+  UnwindCache::Key cache_key =
+      UnwindCache::MakeKey(sample.regs.get(), sample.regs->sp());
 
   struct UnwindResult {
     unwindstack::ErrorCode error_code;
@@ -347,8 +367,17 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
             unwinder.ConsumeFrames()};
   };
 
+  // Repeated stacks are unwound from the cache, unless the stack sample was
+  // truncated, in which case what follows the sampled part is unknown.
+  const std::vector<unwindstack::FrameData>* cached_frames =
+      sample.stack_maxed ? nullptr
+                         : unwind_state->unwind_cache.Find(
+                               cache_key, stack, sample.stack.size());
+
   // first unwind attempt
-  UnwindResult unwind = attempt_unwind();
+  UnwindResult unwind =
+      cached_frames ? UnwindResult(unwindstack::ERROR_NONE, 0, *cached_frames)
+                    : attempt_unwind();
 
   bool should_retry = unwind.error_code == unwindstack::ERROR_INVALID_MAP ||
                       unwind.warnings & unwindstack::WARNING_DEX_PC_NOT_IN_MAP;
@@ -376,6 +405,12 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
     unwind = attempt_unwind();
   }
 
+  if (!cached_frames && !sample.stack_maxed && !read_past_stack &&
+      unwind.error_code == unwindstack::ERROR_NONE) {
+    unwind_state->unwind_cache.Insert(cache_key, stack, sample.stack.size(),
+                                      stack_reads, unwind.frames);
+  }
+
   // Symbolize kernel-unwound kernel frames (if any).
   std::vector<unwindstack::FrameData> kernel_frames =
       SymbolizeKernelCallchain(sample);
@@ -414,6 +449,62 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
   return ret;
 }
 
+CompletedSample Unwinder::SymbolizeCallchainSample(
+    const ParsedSample& sample,
+    UnwindingMetadata* unwind_state) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+
+  auto build_user_frames = [&sample, unwind_state] {
+    PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_UNWIND_ATTEMPT);
+    unwindstack::Unwinder unwinder(kUnwindingMaxFrames, &unwind_state->fd_maps,
+                                   unwind_state->fd_mem);
+    unwinder.SetArch(unwindstack::Regs::CurrentArch());
+#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
+    unwinder.SetJitDebug(
+        unwind_state->GetJitDebug(unwindstack::Regs::CurrentArch()));
+    unwinder.SetDexFiles(
+        unwind_state->GetDexFiles(unwindstack::Regs::CurrentArch()));
+#endif
+    std::vector<unwindstack::FrameData> frames;
+    frames.reserve(std::min(sample.user_ips.size(), kUnwindingMaxFrames));
+    for (uint64_t pc : sample.user_ips) {
+      if (frames.size() == kUnwindingMaxFrames)
+        break;
+      frames.emplace_back(unwinder.BuildFrameFromPcOnly(pc));
+    }
+    return frames;
+  };
+  std::vector<unwindstack::FrameData> user_frames = build_user_frames();
+
+  // As with ERROR_INVALID_MAP for the DWARF unwinding, a pc outside of all the
+  // parsed mappings most likely means that the maps are outdated.
+  if (std::any_of(user_frames.begin(), user_frames.end(),
+                  [](const unwindstack::FrameData& frame) {
+                    return frame.map_name.empty();
+                  })) {
+    {
+      PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_MAPS_REPARSE);
+      PERFETTO_DLOG("Reparsing maps for pid [%d]",
+                    static_cast<int>(sample.common.pid));
+      unwind_state->ReparseMaps();
+    }
+    user_frames = build_user_frames();
+  }
+
+  CompletedSample ret;
+  ret.common = sample.common;
+  ret.frames = SymbolizeKernelCallchain(sample);
+  size_t kernel_frames_size = ret.frames.size();
+  ret.frames.reserve(kernel_frames_size + user_frames.size());
+  ret.build_ids.reserve(kernel_frames_size + user_frames.size());
+  ret.build_ids.resize(kernel_frames_size, "");
+  for (unwindstack::FrameData& frame : user_frames) {
+    ret.build_ids.emplace_back(unwind_state->GetBuildId(frame));
+    ret.frames.emplace_back(std::move(frame));
+  }
+  return ret;
+}
+
 std::vector<unwindstack::FrameData> Unwinder::SymbolizeKernelCallchain(
     const ParsedSample& sample) {
   std::vector<unwindstack::FrameData> ret;
@@ -432,17 +523,27 @@ std::vector<unwindstack::FrameData> Unwinder::SymbolizeKernelCallchain(
 
   auto* kernel_map = kernel_symbolizer_.GetOrCreateKernelSymbolMap();
   PERFETTO_DCHECK(kernel_map);
-  ret.reserve(sample.kernel_ips.size());
-  for (size_t i = 1; i < sample.kernel_ips.size(); i++) {
-    std::string function_name = kernel_map->Lookup(sample.kernel_ips[i]);
-
-    // Synthesise a partially-valid libunwindstack frame struct for the kernel
-    // frame. We reuse the type for convenience. The kernel frames are marked by
-    // a magical "kernel" string as their containing mapping.
-    unwindstack::FrameData frame{};
-    frame.function_name = std::move(function_name);
+
+  // Look up the frames in address order, which takes a single pass over the
+  // symbol table and shares the names of the frames within the same function.
+  kernel_ips_by_addr_.clear();
+  for (size_t i = 1; i < sample.kernel_ips.size(); i++)
+    kernel_ips_by_addr_.emplace_back(sample.kernel_ips[i], i - 1);
+  std::sort(kernel_ips_by_addr_.begin(), kernel_ips_by_addr_.end());
+  sorted_kernel_ips_.clear();
+  for (const auto& ip_and_pos : kernel_ips_by_addr_)
+    sorted_kernel_ips_.push_back(ip_and_pos.first);
+  kernel_map->LookupSorted(sorted_kernel_ips_.data(), sorted_kernel_ips_.size(),
+                           &kernel_sym_names_);
+
+  // Synthesise partially-valid libunwindstack frame structs for the kernel
+  // frames. We reuse the type for convenience. The kernel frames are marked by
+  // a magical "kernel" string as their containing mapping.
+  ret.resize(kernel_ips_by_addr_.size());
+  for (size_t i = 0; i < kernel_ips_by_addr_.size(); i++) {
+    unwindstack::FrameData& frame = ret[kernel_ips_by_addr_[i].second];
+    frame.function_name = kernel_sym_names_.at(i).ToStdString();
     frame.map_name = "kernel";
-    ret.emplace_back(std::move(frame));
   }
   return ret;
 }
@@ -549,12 +650,22 @@ void Unwinder::ClearCachedStatePeriodic(DataSourceInstanceID ds_id,
 }
 
 void Unwinder::ResetAndEnableUnwindstackCache() {
+  pool_locks_->ResetAndEnableUnwindstackCache();
+}
+
+void UnwinderPoolLocks::ResetAndEnableUnwindstackCache() {
   PERFETTO_DLOG("Resetting unwindstack cache");
+  // Wait for the in-flight unwinds of the whole pool. The locks are always
+  // taken in the same order, so concurrent resets can't deadlock.
+  std::vector<std::unique_lock<std::mutex>> unwind_guards;
+  for (std::mutex& unwind_lock : unwind_locks_)
+    unwind_guards.emplace_back(unwind_lock);
+
   // Libunwindstack uses an unsynchronized variable for setting/checking whether
-  // the cache is enabled. Therefore unwinding and cache toggling should stay on
-  // the same thread, but we might be moving unwinding across threads if we're
-  // recreating |Unwinder| instances (during a reconnect to traced). Therefore,
-  // use our own static lock to synchronize the cache toggling.
+  // the cache is enabled. Besides the pool's unwinders, we might be moving
+  // unwinding across threads if we're recreating |Unwinder| instances (during a
+  // reconnect to traced). Therefore, also use our own static lock to
+  // synchronize the cache toggling across pools.
   // TODO(rsavitski): consider fixing this in libunwindstack itself.
   static std::mutex* lock = new std::mutex{};
   std::lock_guard<std::mutex> guard{*lock};
@@ -19,7 +19,11 @@
 
 #include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <linux/perf_event.h>
 #include <stdint.h>
@@ -43,9 +47,31 @@ namespace profiling {
 
 constexpr static uint32_t kUnwindQueueCapacity = 1024;
 
+// Libunwindstack's global Elf cache cannot be reset while another thread is
+// unwinding through it. Each |Unwinder| of a pool holds its own lock while
+// unwinding a sample, so that the unwinders don't contend with each other,
+// while resetting the cache takes the locks of all of them.
+class UnwinderPoolLocks {
+ public:
+  explicit UnwinderPoolLocks(size_t num_unwinders)
+      : unwind_locks_(num_unwinders) {}
+
+  std::mutex& unwind_lock(size_t unwinder_index) {
+    return unwind_locks_[unwinder_index];
+  }
+
+  // Frees the cached Elf objects, and reallocates a fresh cache.
+  void ResetAndEnableUnwindstackCache();
+
+ private:
+  std::vector<std::mutex> unwind_locks_;
+};
+
 // Unwinds callstacks based on the sampled stack and register state (see
 // |ParsedSample|). Has a single unwinding ring queue, shared across
-// all data sources.
+// all data sources. The producer can run a pool of unwinders, sharding the
+// samples across them by pid, in which case each process is only ever
+// unwound by the same |Unwinder|.
 //
 // Samples cannot be unwound without having /proc/<pid>/{maps,mem} file
 // descriptors for that process. This lookup can be asynchronous (e.g. on
@@ -154,7 +180,10 @@ class Unwinder {
   };
 
   // Must be instantiated via the |UnwinderHandle|.
-  Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner);
+  Unwinder(Delegate* delegate,
+           base::UnixTaskRunner* task_runner,
+           std::shared_ptr<UnwinderPoolLocks> pool_locks,
+           size_t pool_index);
 
   // Marks the data source as valid and active at the unwinding stage.
   // Initializes kernel address symbolization if needed.
@@ -179,6 +208,11 @@ class Unwinder {
                                UnwindingMetadata* unwind_state,
                                bool pid_unwound_before);
 
+  // Frame pointer unwinding mode: the userspace frames were already walked by
+  // the kernel, so they only need to be symbolized.
+  CompletedSample SymbolizeCallchainSample(const ParsedSample& sample,
+                                           UnwindingMetadata* unwind_state);
+
   // Returns a list of symbolized kernel frames in the sample (if any).
   std::vector<unwindstack::FrameData> SymbolizeKernelCallchain(
       const ParsedSample& sample);
@@ -236,11 +270,19 @@ class Unwinder {
 
   base::UnixTaskRunner* const task_runner_;
   Delegate* const delegate_;
+  const std::shared_ptr<UnwinderPoolLocks> pool_locks_;
+  const size_t pool_index_;
   UnwindQueue<UnwindEntry, kUnwindQueueCapacity> unwind_queue_;
   QueueFootprintTracker footprint_tracker_;
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
   LazyKernelSymbolizer kernel_symbolizer_;
 
+  // Scratch buffers of SymbolizeKernelCallchain(), reused across samples: the
+  // kernel frames as (address, position in the callchain), sorted by address.
+  std::vector<std::pair<uint64_t, size_t>> kernel_ips_by_addr_;
+  std::vector<uint64_t> sorted_kernel_ips_;
+  KernelSymbolMap::SymbolNames kernel_sym_names_;
+
   PERFETTO_THREAD_CHECKER(thread_checker_)
 };
 
@@ -250,7 +292,9 @@ class Unwinder {
 // owned state, and consolidate.
 class UnwinderHandle {
  public:
-  explicit UnwinderHandle(Unwinder::Delegate* delegate) {
+  UnwinderHandle(Unwinder::Delegate* delegate,
+                 std::shared_ptr<UnwinderPoolLocks> pool_locks,
+                 size_t pool_index) {
     std::mutex init_lock;
     std::condition_variable init_cv;
 
@@ -268,7 +312,8 @@ class UnwinderHandle {
         };
 
     thread_ = std::thread(&UnwinderHandle::RunTaskThread, this,
-                          std::move(initializer), delegate);
+                          std::move(initializer), delegate,
+                          std::move(pool_locks), pool_index);
 
     std::unique_lock<std::mutex> lock(init_lock);
     init_cv.wait(lock, [this] { return !!task_runner_ && !!unwinder_; });
@@ -286,13 +331,17 @@ class UnwinderHandle {
   }
 
   Unwinder* operator->() { return unwinder_; }
+  Unwinder* get() { return unwinder_; }
 
  private:
   void RunTaskThread(
       std::function<void(base::UnixTaskRunner*, Unwinder*)> initializer,
-      Unwinder::Delegate* delegate) {
+      Unwinder::Delegate* delegate,
+      std::shared_ptr<UnwinderPoolLocks> pool_locks,
+      size_t pool_index) {
     base::UnixTaskRunner task_runner;
-    Unwinder unwinder(delegate, &task_runner);
+    Unwinder unwinder(delegate, &task_runner, std::move(pool_locks),
+                      pool_index);
     task_runner.PostTask(
         std::bind(std::move(initializer), &task_runner, &unwinder));
     task_runner.Run();
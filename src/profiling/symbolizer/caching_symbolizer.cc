@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/caching_symbolizer.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
+
+namespace perfetto {
+namespace profiling {
+
+namespace {
+
+// Bump the version when changing the layout of the records.
+constexpr char kMagic[8] = {'P', 'F', 'S', 'Y', 'M', 'C', 'H', '1'};
+
+// A cache file is a sequence of chunks, one per write:
+// [magic][u32 chunk_size][records], each record being
+// [u64 load_bias][u64 address][u32 num_frames], followed for each frame by
+// [u32 line][u32 size][function_name][u32 size][file_name].
+// The values are in the host byte order, the cache is never moved across
+// machines.
+
+template <typename T>
+void AppendValue(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendString(std::string* out, const std::string& str) {
+  AppendValue(out, static_cast<uint32_t>(str.size()));
+  out->append(str);
+}
+
+class ChunkReader {
+ public:
+  ChunkReader(const std::string& data, size_t offset, size_t end)
+      : data_(data), offset_(offset), end_(end) {}
+
+  bool done() const { return offset_ == end_; }
+
+  template <typename T>
+  bool ReadValue(T* value) {
+    if (end_ - offset_ < sizeof(T))
+      return false;
+    memcpy(value, data_.data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+
+  bool ReadString(std::string* str) {
+    uint32_t size;
+    if (!ReadValue(&size) || end_ - offset_ < size)
+      return false;
+    str->assign(data_, offset_, size);
+    offset_ += size;
+    return true;
+  }
+
+ private:
+  const std::string& data_;
+  size_t offset_;
+  const size_t end_;
+};
+
+}  // namespace
+
+CachingSymbolizer::CachingSymbolizer(std::string cache_dir,
+                                     std::unique_ptr<Symbolizer> symbolizer)
+    : cache_dir_(std::move(cache_dir)), symbolizer_(std::move(symbolizer)) {
+  // Fails if the directory already exists, which is fine.
+  base::Mkdir(cache_dir_);
+}
+
+CachingSymbolizer::~CachingSymbolizer() = default;
+
+std::string CachingSymbolizer::CacheFilePath(
+    const std::string& build_id) const {
+  return cache_dir_ + "/" + base::ToHex(build_id);
+}
+
+CachingSymbolizer::BuildIdCache* CachingSymbolizer::GetOrLoad(
+    const std::string& build_id) {
+  auto it_and_inserted = build_ids_.emplace(build_id, BuildIdCache());
+  BuildIdCache* cache = &it_and_inserted.first->second;
+  if (!it_and_inserted.second)
+    return cache;
+
+  std::string data;
+  if (!base::ReadFile(CacheFilePath(build_id), &data))
+    return cache;
+
+  // Stop at the first malformed chunk, which is most likely the one being
+  // written by another process.
+  size_t offset = 0;
+  while (data.size() - offset >= sizeof(kMagic) + sizeof(uint32_t) &&
+         memcmp(data.data() + offset, kMagic, sizeof(kMagic)) == 0) {
+    uint32_t chunk_size;
+    memcpy(&chunk_size, data.data() + offset + sizeof(kMagic),
+           sizeof(chunk_size));
+    offset += sizeof(kMagic) + sizeof(chunk_size);
+    if (data.size() - offset < chunk_size)
+      break;
+
+    BuildIdCache chunk_records;
+    ChunkReader reader(data, offset, offset + chunk_size);
+    bool valid = true;
+    while (valid && !reader.done()) {
+      uint64_t load_bias;
+      uint64_t address;
+      uint32_t num_frames;
+      valid = reader.ReadValue(&load_bias) && reader.ReadValue(&address) &&
+              reader.ReadValue(&num_frames);
+      std::vector<SymbolizedFrame> frames;
+      for (uint32_t i = 0; valid && i < num_frames; i++) {
+        SymbolizedFrame frame;
+        valid = reader.ReadValue(&frame.line) &&
+                reader.ReadString(&frame.function_name) &&
+                reader.ReadString(&frame.file_name);
+        frames.emplace_back(std::move(frame));
+      }
+      if (valid)
+        chunk_records[Key(load_bias, address)] = std::move(frames);
+    }
+    if (!valid) {
+      PERFETTO_ELOG("Ignoring malformed symbolizer cache chunk for %s",
+                    base::ToHex(build_id).c_str());
+      break;
+    }
+    for (auto& record : chunk_records)
+      (*cache)[record.first] = std::move(record.second);
+    offset += chunk_size;
+  }
+  return cache;
+}
+
+std::vector<std::vector<SymbolizedFrame>> CachingSymbolizer::Symbolize(
+    const std::string& mapping_name,
+    const std::string& build_id,
+    uint64_t load_bias,
+    const std::vector<uint64_t>& addresses) {
+  if (build_id.empty())
+    return symbolizer_->Symbolize(mapping_name, build_id, load_bias, addresses);
+
+  BuildIdCache* cache = GetOrLoad(build_id);
+  std::vector<std::vector<SymbolizedFrame>> result(addresses.size());
+  std::vector<uint64_t> missing;
+  std::vector<size_t> missing_indices;
+  for (size_t i = 0; i < addresses.size(); i++) {
+    auto it = cache->find(Key(load_bias, addresses[i]));
+    if (it != cache->end()) {
+      result[i] = it->second;
+    } else {
+      missing.push_back(addresses[i]);
+      missing_indices.push_back(i);
+    }
+  }
+  if (missing.empty())
+    return result;
+
+  // Symbolize all the missing addresses of the mapping in one go.
+  std::vector<std::vector<SymbolizedFrame>> symbolized =
+      symbolizer_->Symbolize(mapping_name, build_id, load_bias, missing);
+  if (symbolized.empty()) {
+    if (missing.size() == addresses.size())
+      return {};
+    return result;
+  }
+  PERFETTO_DCHECK(symbolized.size() == missing.size());
+
+  std::string records;
+  for (size_t i = 0; i < missing.size() && i < symbolized.size(); i++) {
+    const std::vector<SymbolizedFrame>& frames = symbolized[i];
+    AppendValue(&records, load_bias);
+    AppendValue(&records, missing[i]);
+    AppendValue(&records, static_cast<uint32_t>(frames.size()));
+    for (const SymbolizedFrame& frame : frames) {
+      AppendValue(&records, frame.line);
+      AppendString(&records, frame.function_name);
+      AppendString(&records, frame.file_name);
+    }
+    (*cache)[Key(load_bias, missing[i])] = frames;
+    result[missing_indices[i]] = std::move(symbolized[i]);
+  }
+
+  std::string chunk(kMagic, sizeof(kMagic));
+  AppendValue(&chunk, static_cast<uint32_t>(records.size()));
+  chunk.append(records);
+  std::string path = CacheFilePath(build_id);
+  base::ScopedFile fd =
+      base::OpenFile(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (!fd || base::WriteAll(*fd, chunk.data(), chunk.size()) !=
+                 static_cast<ssize_t>(chunk.size())) {
+    PERFETTO_PLOG("Failed to write symbolizer cache %s", path.c_str());
+  }
+  return result;
+}
+
+std::unique_ptr<Symbolizer> MaybeCachingSymbolizer(
+    std::unique_ptr<Symbolizer> symbolizer) {
+  const char* cache_dir = getenv("PERFETTO_SYMBOLIZER_CACHE");
+  if (!symbolizer || cache_dir == nullptr || *cache_dir == '\0')
+    return symbolizer;
+  return std::unique_ptr<Symbolizer>(
+      new CachingSymbolizer(cache_dir, std::move(symbolizer)));
+}
+
+}  // namespace profiling
+}  // namespace perfetto
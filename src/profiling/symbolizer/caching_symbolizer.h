@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_CACHING_SYMBOLIZER_H_
+#define SRC_PROFILING_SYMBOLIZER_CACHING_SYMBOLIZER_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// Wraps another Symbolizer, keeping its results in a cache directory, with one
+// file per build id, so that the same addresses are not symbolized again by
+// later runs, or by other tools sharing the directory.
+// Only the addresses that were symbolized are cached: if the binary of a
+// mapping can't be found, it will be looked for again the next time.
+// The cache files are only ever appended to, each batch of new results with a
+// single write, so that concurrent processes can share a directory.
+class CachingSymbolizer : public Symbolizer {
+ public:
+  CachingSymbolizer(std::string cache_dir,
+                    std::unique_ptr<Symbolizer> symbolizer);
+  ~CachingSymbolizer() override;
+
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::string& mapping_name,
+      const std::string& build_id,
+      uint64_t load_bias,
+      const std::vector<uint64_t>& addresses) override;
+
+  bool BuildIdNeedsHexConversion() override {
+    return symbolizer_->BuildIdNeedsHexConversion();
+  }
+
+ private:
+  using Key = std::pair<uint64_t /* load_bias */, uint64_t /* address */>;
+  using BuildIdCache = std::map<Key, std::vector<SymbolizedFrame>>;
+
+  std::string CacheFilePath(const std::string& build_id) const;
+  // Returns the cached results for |build_id|, loading its cache file the
+  // first time.
+  BuildIdCache* GetOrLoad(const std::string& build_id);
+
+  const std::string cache_dir_;
+  std::unique_ptr<Symbolizer> symbolizer_;
+  std::map<std::string, BuildIdCache> build_ids_;
+};
+
+// Wraps |symbolizer| in a CachingSymbolizer if the PERFETTO_SYMBOLIZER_CACHE
+// environment variable is set to a cache directory, returns it as is
+// otherwise.
+std::unique_ptr<Symbolizer> MaybeCachingSymbolizer(
+    std::unique_ptr<Symbolizer> symbolizer);
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_CACHING_SYMBOLIZER_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/caching_symbolizer.h"
+
+#include <unistd.h>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr char kBuildId[] = "\x01\x02\x03\x04";
+
+// Symbolizes each address to a single frame named after it, recording the
+// addresses it was asked for.
+class FakeSymbolizer : public Symbolizer {
+ public:
+  explicit FakeSymbolizer(std::vector<std::vector<uint64_t>>* requests)
+      : requests_(requests) {}
+
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::string&,
+      const std::string&,
+      uint64_t,
+      const std::vector<uint64_t>& addresses) override {
+    requests_->push_back(addresses);
+    std::vector<std::vector<SymbolizedFrame>> result;
+    for (uint64_t address : addresses) {
+      SymbolizedFrame frame;
+      frame.function_name = "fn" + std::to_string(address);
+      frame.file_name = "file.cc";
+      frame.line = static_cast<uint32_t>(address);
+      result.push_back({frame});
+    }
+    return result;
+  }
+
+  bool BuildIdNeedsHexConversion() override { return true; }
+
+ private:
+  std::vector<std::vector<uint64_t>>* requests_;
+};
+
+std::unique_ptr<Symbolizer> MakeSymbolizer(
+    const std::string& cache_dir,
+    std::vector<std::vector<uint64_t>>* requests) {
+  return std::unique_ptr<Symbolizer>(new CachingSymbolizer(
+      cache_dir, std::unique_ptr<Symbolizer>(new FakeSymbolizer(requests))));
+}
+
+TEST(CachingSymbolizerTest, OnlySymbolizesMisses) {
+  base::TmpDirTree tree;
+  tree.AddFile(base::ToHex(kBuildId), "");
+  std::vector<std::vector<uint64_t>> requests;
+  auto symbolizer = MakeSymbolizer(tree.path(), &requests);
+
+  auto frames = symbolizer->Symbolize("libfoo.so", kBuildId, 0, {1, 2});
+  ASSERT_EQ(frames.size(), 2u);
+  frames = symbolizer->Symbolize("libfoo.so", kBuildId, 0, {2, 3, 1});
+  ASSERT_EQ(frames.size(), 3u);
+  EXPECT_EQ(frames[0][0].function_name, "fn2");
+  EXPECT_EQ(frames[1][0].function_name, "fn3");
+  EXPECT_EQ(frames[2][0].function_name, "fn1");
+  EXPECT_EQ(frames[2][0].line, 1u);
+
+  ASSERT_EQ(requests.size(), 2u);
+  EXPECT_EQ(requests[1], std::vector<uint64_t>({3}));
+}
+
+TEST(CachingSymbolizerTest, ReusesCacheDirectory) {
+  base::TmpDirTree tree;
+  tree.AddFile(base::ToHex(kBuildId), "");
+  std::vector<std::vector<uint64_t>> requests;
+  MakeSymbolizer(tree.path(), &requests)
+      ->Symbolize("libfoo.so", kBuildId, 0x1000, {1, 2});
+  ASSERT_EQ(requests.size(), 1u);
+
+  auto symbolizer = MakeSymbolizer(tree.path(), &requests);
+  auto frames = symbolizer->Symbolize("libfoo.so", kBuildId, 0x1000, {1, 2});
+  ASSERT_EQ(frames.size(), 2u);
+  EXPECT_EQ(frames[1][0].function_name, "fn2");
+  EXPECT_EQ(frames[1][0].file_name, "file.cc");
+  EXPECT_EQ(requests.size(), 1u);
+
+  // A different load bias is a different key.
+  symbolizer->Symbolize("libfoo.so", kBuildId, 0, {1});
+  EXPECT_EQ(requests.size(), 2u);
+}
+
+TEST(CachingSymbolizerTest, IgnoresTruncatedChunk) {
+  base::TmpDirTree tree;
+  tree.AddFile(base::ToHex(kBuildId), "");
+  std::vector<std::vector<uint64_t>> requests;
+  MakeSymbolizer(tree.path(), &requests)
+      ->Symbolize("libfoo.so", kBuildId, 0, {1});
+  MakeSymbolizer(tree.path(), &requests)
+      ->Symbolize("libfoo.so", kBuildId, 0, {1, 2});
+  ASSERT_EQ(requests.size(), 2u);
+
+  // Drop the end of the second chunk, as if its write was interrupted.
+  std::string path = tree.AbsolutePath(base::ToHex(kBuildId));
+  std::string contents;
+  ASSERT_TRUE(base::ReadFile(path, &contents));
+  contents.resize(contents.size() - 1);
+  ASSERT_EQ(truncate(path.c_str(), static_cast<off_t>(contents.size())), 0);
+
+  auto symbolizer = MakeSymbolizer(tree.path(), &requests);
+  auto frames = symbolizer->Symbolize("libfoo.so", kBuildId, 0, {1, 2});
+  ASSERT_EQ(frames.size(), 2u);
+  ASSERT_EQ(requests.size(), 3u);
+  EXPECT_EQ(requests[2], std::vector<uint64_t>({2}));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -325,11 +325,15 @@ bool ParseLlvmSymbolizerLine(const std::string& line,
 BinaryFinder::~BinaryFinder() = default;
 
 LocalBinaryIndexer::LocalBinaryIndexer(std::vector<std::string> roots)
-    : buildid_to_file_(BuildIdIndex(std::move(roots))) {}
+    : roots_(std::move(roots)) {}
 
 base::Optional<FoundBinary> LocalBinaryIndexer::FindBinary(
     const std::string& abspath,
     const std::string& build_id) {
+  if (!indexed_) {
+    buildid_to_file_ = BuildIdIndex(std::move(roots_));
+    indexed_ = true;
+  }
   auto it = buildid_to_file_.find(build_id);
   if (it != buildid_to_file_.end())
     return it->second;
@@ -58,6 +58,10 @@ class LocalBinaryIndexer : public BinaryFinder {
   ~LocalBinaryIndexer() override;
 
  private:
+  // The roots are only indexed on the first lookup, so that runs whose
+  // addresses are all cached don't walk them.
+  std::vector<std::string> roots_;
+  bool indexed_ = false;
   std::map<std::string, FoundBinary> buildid_to_file_;
 };
 
@@ -16,6 +16,10 @@
 
 #include "src/protozero/filtering/message_filter.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/proto_utils.h"
 
@@ -123,8 +127,26 @@ MessageFilter::FilteredMessage MessageFilter::FilterMessageFragments(
   for (size_t slice_idx = 0; slice_idx < num_slices; ++slice_idx) {
     const InputSlice& slice = slices[slice_idx];
     const uint8_t* data = static_cast<const uint8_t*>(slice.data);
-    for (size_t i = 0; i < slice.len; ++i)
-      FilterOneByte(data[i]);
+    for (size_t i = 0; i < slice.len;) {
+      // Fastpath for the payload of string / bytes fields (and of submessages
+      // that are not allowed): rather than going through FilterOneByte(), copy
+      // (or skip) it in bulk. The last byte is left to FilterOneByte(), which
+      // takes care of popping the state if it is also the end of the message.
+      StackState* state = &stack_.back();
+      if (state->eat_next_bytes > 1) {
+        const uint32_t n = static_cast<uint32_t>(std::min(
+            static_cast<size_t>(state->eat_next_bytes - 1), slice.len - i));
+        if (state->passthrough_eaten_bytes) {
+          memcpy(out_, &data[i], n);
+          out_ += n;
+        }
+        state->eat_next_bytes -= n;
+        state->in_bytes += n;
+        i += n;
+        continue;
+      }
+      FilterOneByte(data[i++]);
+    }
   }
 
   // Construct the output object.
@@ -16,22 +16,36 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/protozero/proto_decoder.h"
 #include "src/base/test/utils.h"
 #include "src/protozero/filtering/message_filter.h"
 
-static void BM_ProtozeroMessageFilter(benchmark::State& state) {
+namespace {
+
+std::string LoadTrace(const char* path) {
   std::string trace_data;
-  static const char kTestTrace[] = "test/data/example_android_trace_30s.pb";
-  perfetto::base::ReadFile(perfetto::base::GetTestDataPath(kTestTrace),
-                           &trace_data);
+  perfetto::base::ReadFile(perfetto::base::GetTestDataPath(path), &trace_data);
   PERFETTO_CHECK(!trace_data.empty());
+  return trace_data;
+}
 
+std::string LoadFullTraceFilter() {
   std::string filter;
   static const char kFullTraceFilter[] = "test/data/full_trace_filter.bytecode";
   perfetto::base::ReadFile(kFullTraceFilter, &filter);
   PERFETTO_CHECK(!filter.empty());
+  return filter;
+}
+
+}  // namespace
+
+static void BM_ProtozeroMessageFilter(benchmark::State& state) {
+  static const char kTestTrace[] = "test/data/example_android_trace_30s.pb";
+  std::string trace_data = LoadTrace(kTestTrace);
+  std::string filter = LoadFullTraceFilter();
 
   protozero::MessageFilter filt;
   filt.LoadFilterBytecode(filter.data(), filter.size());
@@ -45,4 +59,53 @@ static void BM_ProtozeroMessageFilter(benchmark::State& state) {
       static_cast<int64_t>(state.iterations() * trace_data.size()));
 }
 
+// Filters the trace one packet at a time, as the tracing service does in
+// ReadBuffers(): the filter root is moved to Trace.packet and each packet is
+// passed as the fragments it would have in the TraceBuffer chunks.
+static void BM_ProtozeroMessageFilterPackets(benchmark::State& state,
+                                             const char* trace_path) {
+  std::string trace_data = LoadTrace(trace_path);
+  std::string filter = LoadFullTraceFilter();
+
+  protozero::MessageFilter filt;
+  filt.LoadFilterBytecode(filter.data(), filter.size());
+  const uint32_t packet_field_id = 1;  // Trace.packet.
+  PERFETTO_CHECK(filt.SetFilterRoot(&packet_field_id, 1));
+
+  // Roughly the size of a chunk of the shared memory buffer.
+  constexpr size_t kMaxFragmentSize = 4096;
+  std::vector<std::vector<protozero::MessageFilter::InputSlice>> packets;
+  protozero::ProtoDecoder trace(trace_data.data(), trace_data.size());
+  for (auto field = trace.ReadField(); field.valid();
+       field = trace.ReadField()) {
+    if (field.id() != packet_field_id)
+      continue;
+    packets.emplace_back();
+    for (size_t off = 0; off < field.size(); off += kMaxFragmentSize) {
+      packets.back().push_back({field.data() + off,
+                                std::min(kMaxFragmentSize, field.size() - off)});
+    }
+  }
+  PERFETTO_CHECK(!packets.empty());
+
+  for (auto _ : state) {
+    for (const auto& fragments : packets) {
+      auto res = filt.FilterMessageFragments(fragments.data(), fragments.size());
+      benchmark::DoNotOptimize(res);
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * trace_data.size()));
+  state.counters["packets/s"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * packets.size()),
+      benchmark::Counter::kIsRate);
+}
+
 BENCHMARK(BM_ProtozeroMessageFilter);
+BENCHMARK_CAPTURE(BM_ProtozeroMessageFilterPackets,
+                  example_android_trace_30s,
+                  "test/data/example_android_trace_30s.pb");
+BENCHMARK_CAPTURE(BM_ProtozeroMessageFilterPackets,
+                  android_sched_and_ps,
+                  "test/data/android_sched_and_ps.pb");
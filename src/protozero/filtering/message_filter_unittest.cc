@@ -273,6 +273,68 @@ TEST(MessageFilterTest, MalformedInput) {
   }
 }
 
+// Long string / bytes fields are copied (or skipped) in bulk. Check that this
+// gives the same result regardless of how the input is fragmented, also when
+// a field ends together with its submessage.
+TEST(MessageFilterTest, LongFieldsAcrossFragments) {
+  auto schema = perfetto::base::TempFile::Create();
+  static const char kSchema[] = R"(
+  syntax = "proto2";
+  message FilterSchema {
+    message Nested {
+      optional string str = 1;
+    }
+    optional string str = 1;
+    repeated Nested nest = 2;
+    optional int32 i32 = 3;
+  };
+  )";
+  perfetto::base::WriteAll(*schema, kSchema, strlen(kSchema));
+  perfetto::base::FlushFile(*schema);
+  FilterUtil filter;
+  ASSERT_TRUE(filter.LoadMessageDefinition(schema.path(), "", ""));
+  std::string bytecode = filter.GenerateFilterBytecode();
+  ASSERT_GT(bytecode.size(), 0u);
+  MessageFilter flt;
+  ASSERT_TRUE(flt.LoadFilterBytecode(bytecode.data(), bytecode.size()));
+
+  const std::string allowed(1000, 'a');
+  const std::string stripped(3000, 's');
+  HeapBuffered<Message> msg;
+  msg->AppendString(/*field_id=*/1, allowed);
+  msg->AppendString(/*field_id=*/4, stripped);
+  auto* nest = msg->BeginNestedMessage<Message>(/*field_id=*/2);
+  nest->AppendString(/*field_id=*/2, stripped);
+  nest->AppendString(/*field_id=*/1, allowed);
+  nest->Finalize();
+  msg->AppendVarInt(/*field_id=*/3, 42);
+  std::vector<uint8_t> encoded = msg.SerializeAsArray();
+
+  auto expected = flt.FilterMessage(encoded.data(), encoded.size());
+  ASSERT_FALSE(expected.error);
+  ProtoDecoder dec(expected.data.get(), expected.size);
+  EXPECT_EQ(dec.FindField(1).as_std_string(), allowed);
+  EXPECT_FALSE(dec.FindField(4).valid());
+  EXPECT_EQ(dec.FindField(3).as_int32(), 42);
+  ProtoDecoder nest_dec(dec.FindField(2).as_bytes());
+  EXPECT_EQ(nest_dec.FindField(1).as_std_string(), allowed);
+  EXPECT_FALSE(nest_dec.FindField(2).valid());
+
+  std::minstd_rand0 rnd(0);
+  for (int repetitions = 0; repetitions < 100; ++repetitions) {
+    std::vector<MessageFilter::InputSlice> fragments;
+    for (size_t off = 0; off < encoded.size();) {
+      size_t len = std::min(1 + rnd() % 1500, encoded.size() - off);
+      fragments.push_back({&encoded[off], len});
+      off += len;
+    }
+    auto res = flt.FilterMessageFragments(&fragments[0], fragments.size());
+    ASSERT_FALSE(res.error);
+    ASSERT_EQ(res.size, expected.size);
+    EXPECT_EQ(memcmp(res.data.get(), expected.data.get(), res.size), 0);
+  }
+}
+
 // It processes a real test trace with a real filter. The filter has been
 // obtained from the full upstream perfetto proto (+ re-adding the for_testing
 // field which got removed after adding most test traces). This covers the most
@@ -24,6 +24,7 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/message_handle.h"
 #include "perfetto/protozero/root_message.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/base/test/utils.h"
 #include "src/protozero/test/fake_scattered_buffer.h"
 #include "test/gtest_and_gmock.h"
@@ -422,5 +423,23 @@ TEST_F(MessageTest, MoveMessageHandle) {
   ASSERT_EQ(0x83u, msg_size[0]);
 }
 
+TEST(HeapBufferedTest, SerializeAcrossSlices) {
+  // Small slices, so that the message spans several of them.
+  HeapBuffered<Message> msg(16, 16);
+  for (uint32_t i = 1; i <= 32; i++)
+    msg->AppendVarInt(i, i * 1000);
+  Message* nested = msg->BeginNestedMessage<Message>(33);
+  nested->AppendString(1, "a string longer than one slice");
+
+  std::vector<uint8_t> array = msg.SerializeAsArray();
+  EXPECT_GT(msg.GetSlices().size(), 1u);
+  EXPECT_EQ(msg.SerializeAsString(),
+            std::string(array.begin(), array.end()));
+  ASSERT_EQ(msg.SerializedSize(), array.size());
+  std::vector<uint8_t> copy(array.size());
+  msg.SerializeTo(copy.data());
+  EXPECT_EQ(copy, array);
+}
+
 }  // namespace
 }  // namespace protozero
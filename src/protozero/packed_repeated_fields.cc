@@ -16,17 +16,21 @@
 
 #include "perfetto/protozero/packed_repeated_fields.h"
 
+#include <algorithm>
+
 #include "perfetto/ext/base/utils.h"
 
 namespace protozero {
 
 // static
+constexpr size_t PackedBufferBase::kMaxElementSize;
 constexpr size_t PackedBufferBase::kOnStackStorageSize;
 
-void PackedBufferBase::GrowSlowpath() {
+void PackedBufferBase::GrowSlowpath(size_t size) {
   size_t write_off = static_cast<size_t>(write_ptr_ - storage_begin_);
   size_t old_size = static_cast<size_t>(storage_end_ - storage_begin_);
   size_t new_size = old_size < 65536 ? (old_size * 2) : (old_size * 3 / 2);
+  new_size = std::max(new_size, write_off + size);
   new_size = perfetto::base::AlignUp<4096>(new_size);
   std::unique_ptr<uint8_t[]> new_buf(new uint8_t[new_size]);
   memcpy(new_buf.get(), storage_begin_, old_size);
@@ -83,6 +83,12 @@ ParseOneField(const uint8_t* const buffer, const uint8_t* const end) {
 
   switch (field_type) {
     case static_cast<uint8_t>(ProtoWireType::kVarInt): {
+      // Fastpath for the values < 128, e.g. enums and bools.
+      if (PERFETTO_LIKELY(*pos < 0x80)) {
+        int_value = *pos;
+        new_pos = pos + 1;
+        break;
+      }
       new_pos = ParseVarInt(pos, end, &int_value);
 
       // new_pos not being greater than pos means ParseVarInt could not fully
@@ -97,9 +103,14 @@ ParseOneField(const uint8_t* const buffer, const uint8_t* const end) {
 
     case static_cast<uint8_t>(ProtoWireType::kLengthDelimited): {
       uint64_t payload_length;
-      new_pos = ParseVarInt(pos, end, &payload_length);
-      if (PERFETTO_UNLIKELY(new_pos == pos))
-        return res;
+      if (PERFETTO_LIKELY(*pos < 0x80)) {  // Fastpath for payloads < 128 bytes.
+        payload_length = *pos;
+        new_pos = pos + 1;
+      } else {
+        new_pos = ParseVarInt(pos, end, &payload_length);
+        if (PERFETTO_UNLIKELY(new_pos == pos))
+          return res;
+      }
 
       // ParseVarInt guarantees that |new_pos| <= |end| when it succeeds;
       if (payload_length > static_cast<uint64_t>(end - new_pos))
@@ -201,8 +212,11 @@ void TypedProtoDecoderBase::ParseAllFields() {
       continue;
 
     Field* fld = &fields_[field_id];
-    if (PERFETTO_LIKELY(!fld->valid())) {
+    uint64_t* presence_word = &presence_[field_id / 64];
+    const uint64_t presence_bit = 1ull << (field_id % 64);
+    if (PERFETTO_LIKELY(!(*presence_word & presence_bit))) {
       // This is the first time we see this field.
+      *presence_word |= presence_bit;
       *fld = std::move(res.field);
     } else {
       // Repeated field case.
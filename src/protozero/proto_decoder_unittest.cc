@@ -532,6 +532,52 @@ TEST(ProtoDecoderTest, MalformedPackedVarIntBuffer) {
   ASSERT_TRUE(parse_error);
 }
 
+TEST(ProtoDecoderTest, PackedVarIntAppendArray) {
+  // Mixes blocks of small values, which take the single byte fast path, with
+  // blocks of multi-byte and negative values.
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < 35; i++)
+    values.push_back(i % 3 == 0 && i > 16 ? -i * 100000 : i);
+
+  PackedVarInt scalar;
+  for (int64_t value : values)
+    scalar.Append(value);
+  PackedVarInt bulk;
+  bulk.Append(values.data(), values.size());
+  ASSERT_EQ(std::string(reinterpret_cast<const char*>(bulk.data()),
+                        bulk.size()),
+            std::string(reinterpret_cast<const char*>(scalar.data()),
+                        scalar.size()));
+
+  std::vector<int64_t> decoded;
+  ASSERT_TRUE(DecodePackedVarInts(bulk.data(), bulk.size(), &decoded));
+  EXPECT_EQ(decoded, values);
+}
+
+TEST(ProtoDecoderTest, DecodePackedVarInts) {
+  std::vector<uint32_t> values;
+  for (uint32_t i = 0; i < 21; i++)
+    values.push_back(i < 9 ? i : i << 10);
+  PackedVarInt buf;
+  buf.Append(values.data(), values.size());
+
+  std::vector<uint32_t> decoded;
+  ASSERT_TRUE(DecodePackedVarInts(buf.data(), buf.size(), &decoded));
+  EXPECT_EQ(decoded, values);
+
+  // The values are appended to the existing ones.
+  ASSERT_TRUE(DecodePackedVarInts(buf.data(), buf.size(), &decoded));
+  EXPECT_EQ(decoded.size(), 2 * values.size());
+
+  // A truncated last varint is a parse error.
+  decoded.clear();
+  EXPECT_FALSE(DecodePackedVarInts(buf.data(), buf.size() - 1, &decoded));
+
+  decoded.clear();
+  ASSERT_TRUE(DecodePackedVarInts(buf.data(), 0, &decoded));
+  EXPECT_TRUE(decoded.empty());
+}
+
 // Tests that big field ids (> 0xffff) are just skipped but don't fail parsing.
 // This is a regression test for b/145339282 (DataSourceConfig.for_testing
 // having a very large ID == 268435455 until Android R).
@@ -591,5 +637,30 @@ TEST(ProtoDecoderTest, OneBigFieldIdOnly) {
   ASSERT_FALSE(field.valid());
 }
 
+// The entries of the fields that are not set are not initialized, check that
+// they are still reported as not set, after a move too.
+TEST(ProtoDecoderTest, SparseFieldIds) {
+  HeapBuffered<Message> message;
+  message->AppendVarInt(/*field_id=*/3, 42);
+  message->AppendVarInt(/*field_id=*/700, 1);
+  message->AppendVarInt(/*field_id=*/700, 2);
+  auto data = message.SerializeAsArray();
+
+  using Decoder = TypedProtoDecoder<999, true>;
+  Decoder tmp(data.data(), data.size());
+  Decoder decoder(std::move(tmp));
+  EXPECT_EQ(decoder.at<3>().as_int32(), 42);
+  EXPECT_FALSE(decoder.at<4>().valid());
+  EXPECT_FALSE(decoder.Get(699).valid());
+  EXPECT_FALSE(decoder.GetRepeated<int32_t>(699));
+  EXPECT_EQ(decoder.Get(700).as_int32(), 2);
+  auto it = decoder.GetRepeated<int32_t>(700);
+  ASSERT_TRUE(it);
+  EXPECT_EQ(*it, 1);
+  ASSERT_TRUE(++it);
+  EXPECT_EQ(*it, 2);
+  EXPECT_FALSE(++it);
+}
+
 }  // namespace
 }  // namespace protozero
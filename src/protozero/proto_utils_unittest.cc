@@ -194,6 +194,21 @@ TEST(ProtoUtilsTest, VarIntDecoding) {
   }
 }
 
+// Same as above, but with enough room past the VarInt to take the fastpath
+// that doesn't check the bounds of the buffer.
+TEST(ProtoUtilsTest, VarIntDecodingWithTrailingBytes) {
+  for (size_t i = 0; i < ArraySize(kVarIntExpectations); ++i) {
+    const VarIntExpectation& exp = kVarIntExpectations[i];
+    uint8_t buf[kMaxVarIntEncodedSize * 2];
+    memset(buf, 0xff, sizeof(buf));
+    memcpy(buf, exp.encoded, exp.encoded_size);
+    uint64_t value = std::numeric_limits<uint64_t>::max();
+    const uint8_t* res = ParseVarInt(buf, buf + sizeof(buf), &value);
+    ASSERT_EQ(&buf[exp.encoded_size], res);
+    ASSERT_EQ(exp.int_value, value);
+  }
+}
+
 // ParseVarInt() must fail gracefully if we hit the |end| without seeing the
 // MSB == 0 (i.e. end-of-sequence).
 TEST(ProtoUtilsTest, VarIntDecodingOutOfBounds) {
@@ -46,6 +46,7 @@ using perfetto::base::StripChars;
 using perfetto::base::StripSuffix;
 using perfetto::base::ToUpper;
 
+static constexpr auto TYPE_BOOL = FieldDescriptor::TYPE_BOOL;
 static constexpr auto TYPE_MESSAGE = FieldDescriptor::TYPE_MESSAGE;
 static constexpr auto TYPE_SINT32 = FieldDescriptor::TYPE_SINT32;
 static constexpr auto TYPE_SINT64 = FieldDescriptor::TYPE_SINT64;
@@ -578,7 +579,7 @@ void CppObjGenerator::GenClassDecl(const Descriptor* msg, Printer* p) const {
   p->Print("bool ParseFromArray(const void*, size_t) override;\n");
   p->Print("std::string SerializeAsString() const override;\n");
   p->Print("std::vector<uint8_t> SerializeAsArray() const override;\n");
-  p->Print("void Serialize(::protozero::Message*) const;\n");
+  p->Print("void Serialize(::protozero::Message*) const override;\n");
 
   // Generate accessors.
   for (int i = 0; i < msg->field_count(); i++) {
@@ -772,12 +773,23 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
         if (field->type() == TYPE_SINT32 || field->type() == TYPE_SINT64) {
           PERFETTO_FATAL("packed signed (zigzag) fields are not supported");
         }
-        p->Print(
-            "for (::protozero::PackedRepeatedFieldIterator<$w$, $c$> "
-            "rep(field.data(), field.size(), &packed_error); rep; ++rep) {\n",
-            "w", GetPackedWireType(field), "c", GetCppType(field, false));
-        p->Print("  $n$_.emplace_back(*rep);\n", "n", field->lowercase_name());
-        p->Print("}\n");
+        if (GetPackedBuffer(field) == "::protozero::PackedVarInt" &&
+            field->type() != TYPE_BOOL) {
+          p->Print(
+              "if (!::protozero::DecodePackedVarInts(field.data(), "
+              "field.size(), &$n$_))\n",
+              "n", field->lowercase_name());
+          p->Print("  packed_error = true;\n");
+        } else {
+          p->Print(
+              "for (::protozero::PackedRepeatedFieldIterator<$w$, $c$> "
+              "rep(field.data(), field.size(), &packed_error); rep; ++rep) "
+              "{\n",
+              "w", GetPackedWireType(field), "c", GetCppType(field, false));
+          p->Print("  $n$_.emplace_back(*rep);\n", "n",
+                   field->lowercase_name());
+          p->Print("}\n");
+        }
       } else if (field->is_repeated()) {
         p->Print("$n$_.emplace_back();\n", "n", field->lowercase_name());
         p->Print(statement.c_str(), "rval",
@@ -838,8 +850,13 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
       p->Print("{\n");
       p->Indent();
       p->Print("$p$ pack;\n", "p", GetPackedBuffer(field));
-      p->Print(args, "for (auto& it : $n$_)\n");
-      p->Print(args, "  pack.Append(it);\n");
+      if (GetPackedBuffer(field) == "::protozero::PackedVarInt" &&
+          field->type() != TYPE_BOOL) {
+        p->Print(args, "pack.Append($n$_.data(), $n$_.size());\n");
+      } else {
+        p->Print(args, "for (auto& it : $n$_)\n");
+        p->Print(args, "  pack.Append(it);\n");
+      }
       p->Print(args, "msg->AppendBytes($id$, pack.data(), pack.size());\n");
       p->Outdent();
       p->Print("}\n");
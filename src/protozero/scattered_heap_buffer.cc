@@ -16,6 +16,8 @@
 
 #include "perfetto/protozero/scattered_heap_buffer.h"
 
+#include <string.h>
+
 #include <algorithm>
 
 namespace protozero {
@@ -76,18 +78,32 @@ ScatteredHeapBuffer::GetSlices() {
 }
 
 std::vector<uint8_t> ScatteredHeapBuffer::StitchSlices() {
-  size_t stitched_size = 0u;
-  const auto& slices = GetSlices();
-  for (const auto& slice : slices)
-    stitched_size += slice.size() - slice.unused_bytes();
-
-  std::vector<uint8_t> buffer;
-  buffer.reserve(stitched_size);
-  for (const auto& slice : slices) {
+  std::vector<uint8_t> buffer(GetWrittenSize());
+  if (!buffer.empty())
+    CopyWrittenBytesTo(buffer.data());
+  return buffer;
+}
+
+std::string ScatteredHeapBuffer::StitchSlicesAsString() {
+  std::string buffer(GetWrittenSize(), '\0');
+  if (!buffer.empty())
+    CopyWrittenBytesTo(reinterpret_cast<uint8_t*>(&buffer[0]));
+  return buffer;
+}
+
+size_t ScatteredHeapBuffer::GetWrittenSize() {
+  size_t written_size = 0u;
+  for (const auto& slice : GetSlices())
+    written_size += slice.size() - slice.unused_bytes();
+  return written_size;
+}
+
+void ScatteredHeapBuffer::CopyWrittenBytesTo(uint8_t* dst) {
+  for (const auto& slice : GetSlices()) {
     auto used_range = slice.GetUsedRange();
-    buffer.insert(buffer.end(), used_range.begin, used_range.end);
+    memcpy(dst, used_range.begin, used_range.size());
+    dst += used_range.size();
   }
-  return buffer;
 }
 
 std::vector<protozero::ContiguousMemoryRange> ScatteredHeapBuffer::GetRanges() {
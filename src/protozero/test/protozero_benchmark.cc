@@ -17,6 +17,7 @@
 // See /docs/design-docs/protozero.md for rationale and results.
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <unistd.h>
@@ -24,6 +25,8 @@
 #include <benchmark/benchmark.h>
 
 #include "perfetto/base/compiler.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/static_buffer.h"
 
 // Autogenerated headers in out/*/gen/
@@ -128,6 +131,38 @@ PERFETTO_ALWAYS_INLINE void Clobber(benchmark::State& state) {
   benchmark::ClobberMemory();
 }
 
+std::string EncodeNestedMessage() {
+  pblite::EveryField msg;
+  FillMessage_Nested(&msg);
+  return msg.SerializeAsString();
+}
+
+// Reads all the fields of the message and of its nested messages, to compare
+// the decoding cost.
+uint64_t DecodeNested_Protozero(const void* data, size_t size) {
+  pbzero::EveryField::Decoder msg(static_cast<const uint8_t*>(data), size);
+  uint64_t res = static_cast<uint64_t>(msg.field_int32()) +
+                 msg.field_uint32() +
+                 static_cast<uint64_t>(msg.field_int64()) +
+                 msg.field_uint64() + msg.field_string().size;
+  for (auto it = msg.field_nested(); it; ++it)
+    res += DecodeNested_Protozero(it->data, it->size);
+  return res;
+}
+
+// Values of packed varint fields, below |max_value|. With a max_value of 128,
+// they are all encoded in one byte, like the prio, prev_state or comm index
+// fields of the compact sched events.
+std::vector<uint32_t> PackedValues(uint32_t max_value) {
+  std::vector<uint32_t> values(4096);
+  uint32_t seed = 1;
+  for (uint32_t& value : values) {
+    seed = seed * 1103515245 + 12345;
+    value = (seed >> 8) % max_value;
+  }
+  return values;
+}
+
 }  // namespace
 
 static void BM_Protozero_Simple_Libprotobuf(benchmark::State& state) {
@@ -191,6 +226,85 @@ static void BM_Protozero_Nested_SpeedOfLight(benchmark::State& state) {
   }
 }
 
+static void BM_Protozero_Decode_Nested_Libprotobuf(benchmark::State& state) {
+  const std::string encoded = EncodeNestedMessage();
+  for (auto _ : state) {
+    pblite::EveryField msg;
+    PERFETTO_CHECK(msg.ParseFromString(encoded));
+    benchmark::DoNotOptimize(msg);
+  }
+}
+
+static void BM_Protozero_Decode_Nested_Protozero(benchmark::State& state) {
+  const std::string encoded = EncodeNestedMessage();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        DecodeNested_Protozero(encoded.data(), encoded.size()));
+  }
+}
+
+static void BM_Protozero_PackedVarInt_Append(benchmark::State& state) {
+  const std::vector<uint32_t> values =
+      PackedValues(static_cast<uint32_t>(state.range(0)));
+  for (auto _ : state) {
+    protozero::PackedVarInt packed;
+    for (uint32_t value : values)
+      packed.Append(value);
+    benchmark::DoNotOptimize(packed.data());
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(values.size()));
+}
+
+static void BM_Protozero_PackedVarInt_AppendArray(benchmark::State& state) {
+  const std::vector<uint32_t> values =
+      PackedValues(static_cast<uint32_t>(state.range(0)));
+  for (auto _ : state) {
+    protozero::PackedVarInt packed;
+    packed.Append(values.data(), values.size());
+    benchmark::DoNotOptimize(packed.data());
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(values.size()));
+}
+
+static void BM_Protozero_PackedVarInt_Iterator(benchmark::State& state) {
+  const std::vector<uint32_t> values =
+      PackedValues(static_cast<uint32_t>(state.range(0)));
+  protozero::PackedVarInt packed;
+  packed.Append(values.data(), values.size());
+  std::vector<uint32_t> decoded;
+  for (auto _ : state) {
+    decoded.clear();
+    bool parse_error = false;
+    using protozero::proto_utils::ProtoWireType;
+    for (protozero::PackedRepeatedFieldIterator<ProtoWireType::kVarInt,
+                                                uint32_t>
+             it(packed.data(), packed.size(), &parse_error);
+         it; ++it) {
+      decoded.push_back(*it);
+    }
+    benchmark::DoNotOptimize(decoded.data());
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(values.size()));
+}
+
+static void BM_Protozero_PackedVarInt_DecodeAll(benchmark::State& state) {
+  const std::vector<uint32_t> values =
+      PackedValues(static_cast<uint32_t>(state.range(0)));
+  protozero::PackedVarInt packed;
+  packed.Append(values.data(), values.size());
+  std::vector<uint32_t> decoded;
+  for (auto _ : state) {
+    decoded.clear();
+    protozero::DecodePackedVarInts(packed.data(), packed.size(), &decoded);
+    benchmark::DoNotOptimize(decoded.data());
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(values.size()));
+}
+
 BENCHMARK(BM_Protozero_Simple_Libprotobuf);
 BENCHMARK(BM_Protozero_Simple_Protozero);
 BENCHMARK(BM_Protozero_Simple_SpeedOfLight);
@@ -198,3 +312,11 @@ BENCHMARK(BM_Protozero_Simple_SpeedOfLight);
 BENCHMARK(BM_Protozero_Nested_Libprotobuf);
 BENCHMARK(BM_Protozero_Nested_Protozero);
 BENCHMARK(BM_Protozero_Nested_SpeedOfLight);
+
+BENCHMARK(BM_Protozero_Decode_Nested_Libprotobuf);
+BENCHMARK(BM_Protozero_Decode_Nested_Protozero);
+
+BENCHMARK(BM_Protozero_PackedVarInt_Append)->Arg(128)->Arg(1 << 20);
+BENCHMARK(BM_Protozero_PackedVarInt_AppendArray)->Arg(128)->Arg(1 << 20);
+BENCHMARK(BM_Protozero_PackedVarInt_Iterator)->Arg(128)->Arg(1 << 20);
+BENCHMARK(BM_Protozero_PackedVarInt_DecodeAll)->Arg(128)->Arg(1 << 20);
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+std::atomic<size_t> g_live_chunks{0};
+
+constexpr size_t AlignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+}  // namespace
+
+// Each object is preceded by a pointer to the chunk it belongs to, which is
+// how Free() finds the chunk whose count should be decremented.
+struct Arena::Chunk {
+  // The number of objects alive in the chunk, +1 while the arena is still
+  // allocating from it.
+  std::atomic<uint32_t> refcount{1};
+  size_t capacity = 0;
+  size_t used = 0;
+
+  uint8_t* data() { return reinterpret_cast<uint8_t*>(this) + kHeaderSize; }
+
+  static constexpr size_t kHeaderSize = 64;
+};
+
+constexpr size_t Arena::kChunkSize;
+constexpr size_t Arena::Chunk::kHeaderSize;
+
+Arena::Arena() = default;
+
+Arena::~Arena() {
+  ReleaseCurrentChunk();
+}
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+  constexpr size_t kBackPtrSize = sizeof(Chunk*);
+  static_assert(sizeof(Chunk) <= Chunk::kHeaderSize, "Chunk header too big");
+
+  size_t offset = 0;
+  if (current_) {
+    offset = AlignUp(current_->used + kBackPtrSize, alignment);
+  }
+  if (!current_ || offset + size > current_->capacity) {
+    ReleaseCurrentChunk();
+    size_t capacity = std::max(kChunkSize, size + kBackPtrSize + alignment);
+    void* mem = malloc(Chunk::kHeaderSize + capacity);
+    PERFETTO_CHECK(mem);
+    current_ = new (mem) Chunk();
+    current_->capacity = capacity;
+    g_live_chunks.fetch_add(1, std::memory_order_relaxed);
+    offset = AlignUp(kBackPtrSize, alignment);
+  }
+
+  uint8_t* ptr = current_->data() + offset;
+  memcpy(ptr - kBackPtrSize, &current_, kBackPtrSize);
+  current_->used = offset + size;
+  current_->refcount.fetch_add(1, std::memory_order_relaxed);
+  return ptr;
+}
+
+// static
+void Arena::Free(void* ptr) {
+  Chunk* chunk;
+  memcpy(&chunk, static_cast<uint8_t*>(ptr) - sizeof(Chunk*), sizeof(Chunk*));
+  Unref(chunk);
+}
+
+// static
+void Arena::Unref(Chunk* chunk) {
+  if (chunk->refcount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+  chunk->~Chunk();
+  free(chunk);
+  g_live_chunks.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Arena::ReleaseCurrentChunk() {
+  if (!current_)
+    return;
+  Unref(current_);
+  current_ = nullptr;
+}
+
+// static
+size_t Arena::live_chunks_for_testing() {
+  return g_live_chunks.load(std::memory_order_relaxed);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
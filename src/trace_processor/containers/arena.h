@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_ARENA_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace perfetto {
+namespace trace_processor {
+
+// Bump allocator for objects which are allocated and freed in (roughly) the
+// same order, e.g. the payloads of the events buffered by TraceSorter.
+//
+// Objects are bump-allocated from large chunks, each of which keeps track of
+// the number of objects still alive in it. A chunk is freed as a whole once
+// all its objects have been destroyed and the arena has moved on to the next
+// chunk; memory of individual objects is never reused.
+//
+// Objects are owned by ArenaPtrs which can outlive the arena itself and can be
+// destroyed on any thread. Allocation, however, is not thread-safe.
+class Arena {
+ public:
+  template <typename T>
+  struct Deleter {
+    void operator()(T* ptr) const {
+      ptr->~T();
+      Arena::Free(ptr);
+    }
+  };
+
+  template <typename T>
+  using Ptr = std::unique_ptr<T, Deleter<T>>;
+
+  // The size of the chunks objects are allocated from. Larger objects get a
+  // chunk of their own.
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  Arena();
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Constructs a T in the arena.
+  template <typename T, typename... Args>
+  Ptr<T> Make(Args&&... args) {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "Over-aligned types are not supported");
+    void* mem = Allocate(sizeof(T), alignof(T));
+    return Ptr<T>(new (mem) T(std::forward<Args>(args)...));
+  }
+
+  // Returns the number of chunks, across all the arenas, which have been
+  // allocated and not freed yet.
+  static size_t live_chunks_for_testing();
+
+ private:
+  struct Chunk;
+
+  void* Allocate(size_t size, size_t alignment);
+  static void Free(void* ptr);
+
+  // Drops a reference to |chunk|, freeing it if it was the last one.
+  static void Unref(Chunk* chunk);
+
+  // Drops the reference the arena holds on |current_|.
+  void ReleaseCurrentChunk();
+
+  Chunk* current_ = nullptr;
+};
+
+template <typename T>
+using ArenaPtr = Arena::Ptr<T>;
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_ARENA_H_
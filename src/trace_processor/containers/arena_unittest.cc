@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/arena.h"
+
+#include <stdint.h>
+
+#include <array>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+struct Counted {
+  explicit Counted(int* alive_count) : alive(alive_count) { (*alive)++; }
+  ~Counted() { (*alive)--; }
+
+  int* alive;
+  std::string payload = std::string(100, 'x');
+};
+
+struct alignas(16) Aligned {
+  double values[2];
+};
+
+TEST(ArenaUnittest, MakeAndDestroy) {
+  size_t base_chunks = Arena::live_chunks_for_testing();
+  int alive = 0;
+  {
+    Arena arena;
+    ArenaPtr<Counted> a = arena.Make<Counted>(&alive);
+    ArenaPtr<Counted> b = arena.Make<Counted>(&alive);
+    ASSERT_EQ(alive, 2);
+    ASSERT_NE(a.get(), b.get());
+    ASSERT_EQ(a->payload, std::string(100, 'x'));
+
+    a.reset();
+    ASSERT_EQ(alive, 1);
+    ASSERT_EQ(Arena::live_chunks_for_testing(), base_chunks + 1);
+  }
+  ASSERT_EQ(alive, 0);
+  ASSERT_EQ(Arena::live_chunks_for_testing(), base_chunks);
+}
+
+TEST(ArenaUnittest, ChunksFreedWhenEmpty) {
+  size_t base_chunks = Arena::live_chunks_for_testing();
+  int alive = 0;
+  Arena arena;
+
+  std::vector<ArenaPtr<Counted>> objects;
+  for (uint32_t i = 0; i < 10000; ++i)
+    objects.emplace_back(arena.Make<Counted>(&alive));
+  size_t chunks = Arena::live_chunks_for_testing() - base_chunks;
+  ASSERT_GT(chunks, 1u);
+
+  // Freeing the first half of the objects should free about half of the
+  // chunks.
+  for (uint32_t i = 0; i < 5000; ++i)
+    objects[i].reset();
+  size_t remaining = Arena::live_chunks_for_testing() - base_chunks;
+  ASSERT_LT(remaining, chunks);
+  ASSERT_GE(remaining, chunks / 2);
+
+  // The chunk currently used by the arena is kept alive.
+  objects.clear();
+  ASSERT_EQ(alive, 0);
+  ASSERT_EQ(Arena::live_chunks_for_testing(), base_chunks + 1);
+}
+
+TEST(ArenaUnittest, ObjectsOutliveArena) {
+  size_t base_chunks = Arena::live_chunks_for_testing();
+  int alive = 0;
+  std::vector<ArenaPtr<Counted>> objects;
+  {
+    Arena arena;
+    for (uint32_t i = 0; i < 1000; ++i)
+      objects.emplace_back(arena.Make<Counted>(&alive));
+  }
+  ASSERT_EQ(alive, 1000);
+  objects.clear();
+  ASSERT_EQ(alive, 0);
+  ASSERT_EQ(Arena::live_chunks_for_testing(), base_chunks);
+}
+
+TEST(ArenaUnittest, LargeObjects) {
+  Arena arena;
+  ArenaPtr<std::array<uint8_t, Arena::kChunkSize * 2>> large =
+      arena.Make<std::array<uint8_t, Arena::kChunkSize * 2>>();
+  large->fill(1);
+  int alive = 0;
+  ArenaPtr<Counted> small = arena.Make<Counted>(&alive);
+  ASSERT_EQ((*large)[Arena::kChunkSize * 2 - 1], 1);
+  ASSERT_EQ(alive, 1);
+}
+
+TEST(ArenaUnittest, Alignment) {
+  Arena arena;
+  std::vector<ArenaPtr<uint8_t>> bytes;
+  std::vector<ArenaPtr<Aligned>> aligned;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    bytes.emplace_back(arena.Make<uint8_t>(static_cast<uint8_t>(i)));
+    aligned.emplace_back(arena.Make<Aligned>());
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(aligned.back().get()) % 16, 0u);
+  }
+  for (uint32_t i = 0; i < 1000; ++i)
+    ASSERT_EQ(*bytes[i], static_cast<uint8_t>(i));
+}
+
+TEST(ArenaUnittest, FreeOnOtherThread) {
+  size_t base_chunks = Arena::live_chunks_for_testing();
+  int alive = 0;
+  Arena arena;
+  std::vector<ArenaPtr<Counted>> objects;
+  for (uint32_t i = 0; i < 10000; ++i)
+    objects.emplace_back(arena.Make<Counted>(&alive));
+
+  std::thread thread([&objects] { objects.clear(); });
+  thread.join();
+  ASSERT_EQ(alive, 0);
+  ASSERT_EQ(Arena::live_chunks_for_testing(), base_chunks + 1);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
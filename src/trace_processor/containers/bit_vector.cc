@@ -56,18 +56,108 @@ BitVector::SetBitsIterator BitVector::IterateSetBits() const {
 
 void BitVector::UpdateSetBits(const BitVector& o) {
   PERFETTO_DCHECK(o.size() <= GetNumBitsSet());
+  InvalidateIndex();
 
-  // For each set bit in this bitvector, we lookup whether the bit in |other|
-  // at that index (if in bounds) is set. If not, we clear the bit.
-  for (auto it = IterateSetBits(); it; it.Next()) {
-    if (it.ordinal() >= o.size() || !o.IsSet(it.ordinal()))
-      it.Clear();
+  // For each word in this bitvector, we lookup the bits in |other| at the
+  // ordinals of the set bits of the word (which are contiguous in |other|) and
+  // put them in place of these bits: this clears the bits which are not set
+  // in |other| (or are out of its bounds) without looking at each set bit.
+  uint32_t ordinal = 0;
+  for (Block& block : blocks_) {
+    for (uint32_t i = 0; i < Block::kWords; ++i) {
+      BitWord& word = block.word(i);
+      uint32_t count = word.GetNumBitsSet();
+      if (count == 0)
+        continue;
+      word.UpdateSetBits(o.GetBitsStartingAt(ordinal));
+      ordinal += count;
+    }
   }
+  UpdateCounts();
 
   // After the loop, we should have precisely the same number of bits
   // set as |other|.
   PERFETTO_DCHECK(o.GetNumBitsSet() == GetNumBitsSet());
 }
 
+void BitVector::And(const BitVector& other) {
+  InvalidateIndex();
+
+  size_t common_blocks = std::min(blocks_.size(), other.blocks_.size());
+  for (size_t i = 0; i < common_blocks; ++i) {
+    for (uint32_t j = 0; j < Block::kWords; ++j)
+      blocks_[i].word(j).And(other.blocks_[i].word(j).word());
+  }
+  // As bits beyond the size of |other| are never set, all the blocks after
+  // the last one of |other| are cleared.
+  for (size_t i = common_blocks; i < blocks_.size(); ++i)
+    blocks_[i] = Block();
+  UpdateCounts();
+}
+
+size_t BitVector::SizeBytes() const {
+  size_t size = blocks_.capacity() * sizeof(Block) +
+                counts_.capacity() * sizeof(uint32_t);
+  if (index_) {
+    size += index_->word_counts.capacity() * sizeof(uint64_t) +
+            index_->select_samples.capacity() * sizeof(uint32_t);
+  }
+  return size;
+}
+
+void BitVector::BuildRankSelectIndex() {
+  InvalidateIndex();
+
+  std::unique_ptr<Index> index(new Index());
+  index->word_counts.resize(blocks_.size());
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    uint64_t packed = 0;
+    uint32_t count = 0;
+    for (uint32_t j = 1; j < Block::kWords; ++j) {
+      count += blocks_[i].word(j - 1).GetNumBitsSet();
+      packed |= static_cast<uint64_t>(count)
+                << (Index::kWordCountBits * (j - 1));
+    }
+    index->word_counts[i] = packed;
+  }
+
+  uint32_t next_sample = 0;
+  uint32_t set_bits = GetNumBitsSet();
+  for (uint32_t i = 0; i < counts_.size(); ++i) {
+    uint32_t end_count = i + 1 < counts_.size() ? counts_[i + 1] : set_bits;
+    for (; next_sample < end_count; next_sample += kSelectSampleRate)
+      index->select_samples.push_back(i);
+  }
+  index_ = std::move(index);
+}
+
+uint64_t BitVector::GetBitsStartingAt(uint32_t idx) const {
+  if (idx >= size_)
+    return 0;
+
+  // Bits beyond |size_| are always cleared so we can just read the words
+  // containing the 64 bits starting at |idx|.
+  Address addr = IndexToAddress(idx);
+  uint32_t shift = addr.block_offset.bit_idx;
+  uint64_t bits =
+      blocks_[addr.block_idx].word(addr.block_offset.word_idx).word() >> shift;
+  uint32_t next_idx = idx - shift + BitWord::kBits;
+  if (shift == 0 || next_idx >= size_)
+    return bits;
+
+  Address next = IndexToAddress(next_idx);
+  uint64_t next_bits =
+      blocks_[next.block_idx].word(next.block_offset.word_idx).word();
+  return bits | (next_bits << (BitWord::kBits - shift));
+}
+
+void BitVector::UpdateCounts() {
+  uint32_t count = 0;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    counts_[i] = count;
+    count += blocks_[i].GetNumBitsSet();
+  }
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
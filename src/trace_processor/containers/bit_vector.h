@@ -23,10 +23,15 @@
 
 #include <algorithm>
 #include <array>
+#include <memory>
 #include <vector>
 
 #include "perfetto/base/logging.h"
 
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -63,6 +68,10 @@ class BitVector {
   // Returns the size of the bitvector.
   uint32_t size() const { return static_cast<uint32_t>(size_); }
 
+  // Returns the number of bytes of memory used by the bits, counts and
+  // rank/select index of this BitVector.
+  size_t SizeBytes() const;
+
   // Returns whether the bit at |idx| is set.
   bool IsSet(uint32_t idx) const {
     PERFETTO_DCHECK(idx < size());
@@ -87,6 +96,14 @@ class BitVector {
     Address addr = IndexToAddress(end - 1);
     uint32_t idx = addr.block_idx;
 
+    // If we have an index, the number of set bits until the start of the word
+    // is known so we only need to count the bits inside the word.
+    if (index_) {
+      const BlockOffset& offset = addr.block_offset;
+      return counts_[idx] + IndexedCountBeforeWord(idx, offset.word_idx) +
+             blocks_[idx].word(offset.word_idx).GetNumBitsSet(offset.bit_idx);
+    }
+
     // Add the number of set bits until the start of the block to the number
     // of set bits until the end address inside the block.
     return counts_[idx] + blocks_[idx].GetNumBitsSet(addr.block_offset);
@@ -97,6 +114,9 @@ class BitVector {
   uint32_t IndexOfNthSet(uint32_t n) const {
     PERFETTO_DCHECK(n < GetNumBitsSet());
 
+    if (index_)
+      return IndexOfNthSetIndexed(n);
+
     // First search for the block which, up until the start of it, has more than
     // n bits set. Note that this should never return |counts.begin()| as
     // that should always be 0.
@@ -122,6 +142,8 @@ class BitVector {
 
   // Sets the bit at index |idx| to true.
   void Set(uint32_t idx) {
+    InvalidateIndex();
+
     // Set the bit to the correct value inside the block but store the old
     // bit to help fix the counts.
     auto addr = IndexToAddress(idx);
@@ -140,6 +162,8 @@ class BitVector {
 
   // Sets the bit at index |idx| to false.
   void Clear(uint32_t idx) {
+    InvalidateIndex();
+
     // Set the bit to the correct value inside the block but store the old
     // bit to help fix the counts.
     auto addr = IndexToAddress(idx);
@@ -159,6 +183,8 @@ class BitVector {
 
   // Appends true to the bitvector.
   void AppendTrue() {
+    InvalidateIndex();
+
     Address addr = IndexToAddress(size_);
     uint32_t old_blocks_size = static_cast<uint32_t>(blocks_.size());
     uint32_t new_blocks_size = addr.block_idx + 1;
@@ -175,6 +201,8 @@ class BitVector {
 
   // Appends false to the bitvector.
   void AppendFalse() {
+    InvalidateIndex();
+
     Address addr = IndexToAddress(size_);
     uint32_t old_blocks_size = static_cast<uint32_t>(blocks_.size());
     uint32_t new_blocks_size = addr.block_idx + 1;
@@ -199,6 +227,8 @@ class BitVector {
     if (size == old_size)
       return;
 
+    InvalidateIndex();
+
     // Empty bitvectors should be memory efficient so we don't keep any data
     // around in the bitvector.
     if (size == 0) {
@@ -301,6 +331,49 @@ class BitVector {
     return bv;
   }
 
+  // Creates a BitVector of size |end| with the bits between |start| and |end|
+  // filled 64 bits at a time by calling |f(index of first bit, count)|.
+  //
+  // |f| should return a word where bit i is set iff the bit at
+  // |index of first bit + i| should be set; |count| (at most 64) is the number
+  // of bits which will be used from the word and bits past |count| should be
+  // zero. This allows callers to compute many bits at once (e.g. comparing a
+  // batch of values in a loop which the compiler can vectorize) instead of
+  // paying for a call per bit as with Range.
+  template <typename WordFiller = uint64_t(uint32_t, uint32_t)>
+  static BitVector RangeWords(uint32_t start, uint32_t end, WordFiller f) {
+    PERFETTO_DCHECK(start <= end);
+
+    // Wraps |f| so that it can be called for every word of the BitVector:
+    // words outside [start, end) are zero and the words at the edges are
+    // shifted into place.
+    auto word_filler = [start, end, &f](uint32_t word_start) -> uint64_t {
+      uint32_t lo = std::max(start, word_start);
+      uint32_t hi = std::min(end, word_start + BitWord::kBits);
+      if (lo >= hi)
+        return 0;
+      return f(lo, hi - lo) << (lo - word_start);
+    };
+
+    uint32_t block_count = BlockCeil(end);
+    std::vector<Block> blocks;
+    std::vector<uint32_t> counts;
+    blocks.reserve(block_count);
+    counts.reserve(block_count);
+
+    uint32_t set_bits = 0;
+    for (uint32_t i = 0; i < block_count; ++i) {
+      counts.emplace_back(set_bits);
+      if (BlockToIndex(i + 1) <= start) {
+        blocks.emplace_back();
+        continue;
+      }
+      blocks.emplace_back(Block::FromWordFiller(BlockToIndex(i), word_filler));
+      set_bits += blocks.back().GetNumBitsSet();
+    }
+    return BitVector(std::move(blocks), std::move(counts), end);
+  }
+
   // Updates the ith set bit of this bitvector with the value of
   // |other.IsSet(i)|.
   //
@@ -313,9 +386,36 @@ class BitVector {
   // other: 0 1 1 0
   // This will change this to the following:
   // this:  0 1 0 0 1 0 0
-  // TODO(lalitm): investigate whether we should just change this to And.
+  //
+  // This works one word at a time: the bits of |other| corresponding to the
+  // set bits of each word are deposited in the positions of those bits.
   void UpdateSetBits(const BitVector& other);
 
+  // Clears all the bits which are not also set in |other| (i.e. bits beyond
+  // |other.size()| are also cleared). The size of this bitvector is unchanged.
+  //
+  // For example suppose the following:
+  // this:  1 1 0 0 1 0 1
+  // other: 0 1 1 0 1
+  // This will change this to the following:
+  // this:  0 1 0 0 1 0 0
+  void And(const BitVector& other);
+
+  // Builds a rank/select index which makes GetNumBitsSet(end) and
+  // IndexOfNthSet constant time (instead of counting the set bits of the
+  // words of a block and binary searching the blocks respectively).
+  //
+  // The index stores, for each block, the number of set bits before each of
+  // its words and, for every |kSelectSampleRate|th set bit, the block which
+  // contains it; this uses about 2% of the memory used by the bits. It is
+  // dropped when the bitvector is modified so this should only be called on
+  // bitvectors which are not expected to change (e.g. once the trace is fully
+  // loaded).
+  void BuildRankSelectIndex();
+
+  // Returns whether the bitvector currently has a rank/select index.
+  bool HasRankSelectIndex() const { return !!index_; }
+
   // Iterate all the bits in the BitVector.
   //
   // Usage:
@@ -411,12 +511,18 @@ class BitVector {
       // allow branchless algorithms when considering bits of a uint64.
       //
       // In benchmarks, this algorithm has found to be the fastest, portable
-      // way of computing the nth set bit (if we were only targetting new
-      // versions of x64, we could also use pdep + ctz but unfortunately
-      // this would fail on WASM - this about 2.5-3x faster on x64).
+      // way of computing the nth set bit. When targetting versions of x64
+      // with BMI2 (e.g. with -mbmi2 or -march=haswell), we use pdep + ctz
+      // instead as this is about 2.5-3x faster; this is not available on
+      // other architectures (e.g. WASM and ARM).
       //
       // The code below was taken from the paper
       // http://vigna.di.unimi.it/ftp/papers/Broadword.pdf
+#if defined(__BMI2__)
+      // pdep moves the bit |1 << n| to the position of the nth set bit.
+      return static_cast<uint16_t>(__builtin_ctzll(
+          _pdep_u64(1ull << n, word_)));
+#else
       uint64_t s = word_ - ((word_ & 0xAAAAAAAAAAAAAAAA) >> 1);
       s = (s & 0x3333333333333333) + ((s >> 2) & 0x3333333333333333);
       s = ((s + (s >> 4)) & 0x0F0F0F0F0F0F0F0F) * L8;
@@ -428,8 +534,33 @@ class BitVector {
       uint64_t ret = b + ((BwLessThan(s, l * L8) >> 7) * L8 >> 56);
 
       return static_cast<uint16_t>(ret);
+#endif
     }
 
+    // Replaces the ith set bit of the word with the ith bit of |bits|; bits
+    // of |bits| after the |GetNumBitsSet()|th one are ignored.
+    //
+    // For example, if the word is 0b10110 and |bits| is 0b101, the word is
+    // changed to 0b10010.
+    void UpdateSetBits(uint64_t bits) {
+#if defined(__BMI2__)
+      word_ = _pdep_u64(bits, word_);
+#else
+      uint64_t ret = 0;
+      for (uint64_t w = word_; w != 0; w &= w - 1, bits >>= 1) {
+        // |w & -w| isolates the lowest set bit of |w|.
+        ret |= (w & (~w + 1)) & (0ull - (bits & 1ull));
+      }
+      word_ = ret;
+#endif
+    }
+
+    // Bitwise ands the given |mask| with the current value.
+    void And(uint64_t mask) { word_ &= mask; }
+
+    // Returns the raw value of the word.
+    uint64_t word() const { return word_; }
+
     // Returns the number of set bits.
     uint32_t GetNumBitsSet() const {
       return static_cast<uint32_t>(PERFETTO_POPCOUNT(word_));
@@ -652,6 +783,36 @@ class BitVector {
       return b;
     }
 
+    // Creates a block by filling each word with |f(index of first bit in the
+    // word)|.
+    template <typename WordFiller>
+    static Block FromWordFiller(uint32_t offset, WordFiller f) {
+      Block b;
+      for (uint32_t i = 0; i < kWords; ++i) {
+        b.words_[i].Or(f(offset + i * BitWord::kBits));
+      }
+      return b;
+    }
+
+    // Returns the number of set bits in the whole block.
+    uint32_t GetNumBitsSet() const {
+      uint32_t count = 0;
+      for (const BitWord& word : words_) {
+        count += word.GetNumBitsSet();
+      }
+      return count;
+    }
+
+    // Returns the word at index |idx| in the block.
+    const BitWord& word(uint32_t idx) const {
+      PERFETTO_DCHECK(idx < kWords);
+      return words_[idx];
+    }
+    BitWord& word(uint32_t idx) {
+      PERFETTO_DCHECK(idx < kWords);
+      return words_[idx];
+    }
+
    private:
     std::array<BitWord, kWords> words_{};
   };
@@ -705,6 +866,77 @@ class BitVector {
     }
   }
 
+  // Returns the (up to) 64 bits starting at the bit at |idx| as a word:
+  // the bit at |idx| is the lowest bit of the word and bits beyond |size()|
+  // are zero.
+  uint64_t GetBitsStartingAt(uint32_t idx) const;
+
+  // Recomputes the counts vector from the contents of the blocks.
+  void UpdateCounts();
+
+  // See BuildRankSelectIndex().
+  struct Index {
+    // The number of set bits in a block before each of its words is at most
+    // |Block::kBits - BitWord::kBits| = 448 so it fits in 9 bits: the counts
+    // for all the words but the first one (for which it is always zero) are
+    // packed in a single 64 bit integer.
+    static constexpr uint32_t kWordCountBits = 9;
+    static constexpr uint64_t kWordCountMask = (1ull << kWordCountBits) - 1;
+
+    // For each block, the packed number of set bits before each word.
+    std::vector<uint64_t> word_counts;
+
+    // The index of the block containing every |kSelectSampleRate|th set bit.
+    std::vector<uint32_t> select_samples;
+  };
+
+  static constexpr uint32_t kSelectSampleRate = 1024;
+
+  // Returns the number of set bits in the block |block_idx| before the word
+  // |word_idx|. Should only be called if there is an index.
+  uint32_t IndexedCountBeforeWord(uint32_t block_idx, uint32_t word_idx) const {
+    PERFETTO_DCHECK(index_);
+    if (word_idx == 0)
+      return 0;
+    uint64_t counts = index_->word_counts[block_idx];
+    return static_cast<uint32_t>(
+        (counts >> (Index::kWordCountBits * (word_idx - 1))) &
+        Index::kWordCountMask);
+  }
+
+  // Same as IndexOfNthSet but using the index.
+  uint32_t IndexOfNthSetIndexed(uint32_t n) const {
+    // The |n|th set bit is in a block between the blocks containing the
+    // sampled set bits before and after it so we only need to search those.
+    const std::vector<uint32_t>& samples = index_->select_samples;
+    uint32_t sample = n / kSelectSampleRate;
+    auto begin = counts_.begin() + samples[sample];
+    auto end = sample + 1 < samples.size()
+                   ? counts_.begin() + samples[sample + 1] + 1
+                   : counts_.end();
+    auto it = std::upper_bound(begin, end, n);
+    PERFETTO_DCHECK(it != begin);
+    uint32_t block_idx =
+        static_cast<uint32_t>(std::distance(counts_.begin(), it) - 1);
+
+    // The word containing the bit is the last one which has at most
+    // |set_in_block| set bits before it.
+    uint32_t set_in_block = n - counts_[block_idx];
+    uint32_t word_idx = 0;
+    for (uint32_t i = 1; i < Block::kWords; ++i)
+      word_idx += IndexedCountBeforeWord(block_idx, i) <= set_in_block;
+
+    uint32_t set_in_word =
+        set_in_block - IndexedCountBeforeWord(block_idx, word_idx);
+    uint16_t bit_idx =
+        blocks_[block_idx].word(word_idx).IndexOfNthSet(set_in_word);
+    BlockOffset offset{static_cast<uint16_t>(word_idx), bit_idx};
+    return AddressToIndex(Address{block_idx, offset});
+  }
+
+  // Drops the index (if any) as it no longer matches the bits.
+  void InvalidateIndex() { index_.reset(); }
+
   static Address IndexToAddress(uint32_t idx) {
     Address a;
     a.block_idx = idx / Block::kBits;
@@ -747,6 +979,7 @@ class BitVector {
   uint32_t size_ = 0;
   std::vector<uint32_t> counts_;
   std::vector<Block> blocks_;
+  std::unique_ptr<Index> index_;
 };
 
 }  // namespace trace_processor
@@ -62,6 +62,58 @@ BitVector BvWithSizeAndSetPercentage(uint32_t size, uint32_t set_percentage) {
   return bv;
 }
 
+void BenchBitVectorIndexOfNthSet(benchmark::State& state, bool indexed) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+  if (indexed)
+    bv.BuildRankSelectIndex();
+
+  static constexpr uint32_t kPoolSize = 1024 * 1024;
+  std::vector<uint32_t> row_pool(kPoolSize);
+  uint32_t set_bit_count = bv.GetNumBitsSet();
+  if (set_bit_count == 0)
+    return;
+
+  for (uint32_t i = 0; i < kPoolSize; ++i) {
+    row_pool[i] = rnd_engine() % set_bit_count;
+  }
+
+  uint32_t pool_idx = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bv.IndexOfNthSet(row_pool[pool_idx]));
+    pool_idx = (pool_idx + 1) % kPoolSize;
+  }
+}
+
+void BenchBitVectorGetNumBitsSetUntil(benchmark::State& state, bool indexed) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+  if (indexed)
+    bv.BuildRankSelectIndex();
+
+  static constexpr uint32_t kPoolSize = 1024 * 1024;
+  std::vector<uint32_t> end_pool(kPoolSize);
+  for (uint32_t i = 0; i < kPoolSize; ++i) {
+    end_pool[i] = rnd_engine() % (size + 1);
+  }
+
+  uint32_t pool_idx = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bv.GetNumBitsSet(end_pool[pool_idx]));
+    pool_idx = (pool_idx + 1) % kPoolSize;
+  }
+}
+
 }  // namespace
 
 static void BM_BitVectorAppendTrue(benchmark::State& state) {
@@ -133,30 +185,24 @@ static void BM_BitVectorClear(benchmark::State& state) {
 BENCHMARK(BM_BitVectorClear)->Apply(BitVectorArgs);
 
 static void BM_BitVectorIndexOfNthSet(benchmark::State& state) {
-  static constexpr uint32_t kRandomSeed = 42;
-  std::minstd_rand0 rnd_engine(kRandomSeed);
-
-  uint32_t size = static_cast<uint32_t>(state.range(0));
-  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+  BenchBitVectorIndexOfNthSet(state, false);
+}
+BENCHMARK(BM_BitVectorIndexOfNthSet)->Apply(BitVectorArgs);
 
-  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
-  static constexpr uint32_t kPoolSize = 1024 * 1024;
-  std::vector<uint32_t> row_pool(kPoolSize);
-  uint32_t set_bit_count = bv.GetNumBitsSet();
-  if (set_bit_count == 0)
-    return;
+static void BM_BitVectorIndexOfNthSetIndexed(benchmark::State& state) {
+  BenchBitVectorIndexOfNthSet(state, true);
+}
+BENCHMARK(BM_BitVectorIndexOfNthSetIndexed)->Apply(BitVectorArgs);
 
-  for (uint32_t i = 0; i < kPoolSize; ++i) {
-    row_pool[i] = rnd_engine() % set_bit_count;
-  }
+static void BM_BitVectorGetNumBitsSetUntil(benchmark::State& state) {
+  BenchBitVectorGetNumBitsSetUntil(state, false);
+}
+BENCHMARK(BM_BitVectorGetNumBitsSetUntil)->Apply(BitVectorArgs);
 
-  uint32_t pool_idx = 0;
-  for (auto _ : state) {
-    benchmark::DoNotOptimize(bv.IndexOfNthSet(row_pool[pool_idx]));
-    pool_idx = (pool_idx + 1) % kPoolSize;
-  }
+static void BM_BitVectorGetNumBitsSetUntilIndexed(benchmark::State& state) {
+  BenchBitVectorGetNumBitsSetUntil(state, true);
 }
-BENCHMARK(BM_BitVectorIndexOfNthSet)->Apply(BitVectorArgs);
+BENCHMARK(BM_BitVectorGetNumBitsSetUntilIndexed)->Apply(BitVectorArgs);
 
 static void BM_BitVectorGetNumBitsSet(benchmark::State& state) {
   static constexpr uint32_t kRandomSeed = 42;
@@ -269,6 +315,23 @@ static void BM_BitVectorUpdateSetBits(benchmark::State& state) {
 }
 BENCHMARK(BM_BitVectorUpdateSetBits)->Apply(BitVectorArgs);
 
+static void BM_BitVectorAnd(benchmark::State& state) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+  BitVector other = BvWithSizeAndSetPercentage(size, 50);
+  for (auto _ : state) {
+    state.PauseTiming();
+    BitVector copy = bv.Copy();
+    state.ResumeTiming();
+
+    copy.And(other);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_BitVectorAnd)->Apply(BitVectorArgs);
+
 static void BM_BitVectorSetBitsIterator(benchmark::State& state) {
   uint32_t size = static_cast<uint32_t>(state.range(0));
   uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
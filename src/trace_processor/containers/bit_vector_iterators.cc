@@ -44,6 +44,7 @@ void BaseIterator::OnBlockChange(uint32_t old_block, uint32_t new_block) {
   // If we touched the current block, flush the block to the bitvector.
   if (is_block_changed_) {
     bv_->blocks_[old_block] = block_;
+    bv_->InvalidateIndex();
   }
 
   if (set_bit_count_diff_ != 0) {
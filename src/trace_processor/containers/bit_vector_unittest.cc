@@ -253,6 +253,136 @@ TEST(BitVectorUnittest, UpdateSetBitsSmallerPicker) {
   ASSERT_FALSE(bv.IsSet(4));
 }
 
+TEST(BitVectorUnittest, UpdateSetBitsRandom) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  // Covers words which are sparse, dense, full and empty and pickers which
+  // are shorter than the number of set bits.
+  for (uint32_t set_percentage : {1u, 30u, 90u, 100u}) {
+    BitVector bv;
+    for (uint32_t i = 0; i < 12345; ++i) {
+      if (rnd_engine() % 100 < set_percentage) {
+        bv.AppendTrue();
+      } else {
+        bv.AppendFalse();
+      }
+    }
+
+    BitVector picker;
+    for (uint32_t i = 0; i < bv.GetNumBitsSet() - 17; ++i) {
+      if (rnd_engine() % 3 != 0) {
+        picker.AppendTrue();
+      } else {
+        picker.AppendFalse();
+      }
+    }
+
+    std::vector<uint32_t> expected;
+    for (auto it = bv.IterateSetBits(); it; it.Next()) {
+      if (it.ordinal() < picker.size() && picker.IsSet(it.ordinal()))
+        expected.push_back(it.index());
+    }
+
+    bv.UpdateSetBits(picker);
+
+    ASSERT_EQ(bv.size(), 12345u);
+    ASSERT_EQ(bv.GetNumBitsSet(), expected.size());
+    for (uint32_t i = 0; i < expected.size(); ++i)
+      ASSERT_EQ(bv.IndexOfNthSet(i), expected[i]);
+  }
+}
+
+TEST(BitVectorUnittest, And) {
+  BitVector bv;
+  BitVector other;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    if (i % 3 == 0) {
+      bv.AppendTrue();
+    } else {
+      bv.AppendFalse();
+    }
+  }
+  for (uint32_t i = 0; i < 1500; ++i) {
+    if (i % 2 == 0) {
+      other.AppendTrue();
+    } else {
+      other.AppendFalse();
+    }
+  }
+
+  bv.And(other);
+
+  ASSERT_EQ(bv.size(), 2000u);
+  ASSERT_EQ(bv.GetNumBitsSet(), 250u);
+  for (uint32_t i = 0; i < 2000; ++i)
+    ASSERT_EQ(bv.IsSet(i), i < 1500 && i % 6 == 0);
+  for (uint32_t i = 0; i < 250; ++i)
+    ASSERT_EQ(bv.IndexOfNthSet(i), i * 6);
+}
+
+TEST(BitVectorUnittest, RankSelectIndex) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  // Sparse bitvectors have many blocks between the sampled set bits while
+  // dense ones have many samples in each block.
+  for (uint32_t set_percentage : {0u, 1u, 50u, 100u}) {
+    BitVector bv;
+    for (uint32_t i = 0; i < 54321; ++i) {
+      if (rnd_engine() % 100 < set_percentage) {
+        bv.AppendTrue();
+      } else {
+        bv.AppendFalse();
+      }
+    }
+
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> indices;
+    for (uint32_t i = 0; i <= bv.size(); ++i)
+      counts.push_back(bv.GetNumBitsSet(i));
+    for (uint32_t i = 0; i < bv.GetNumBitsSet(); ++i)
+      indices.push_back(bv.IndexOfNthSet(i));
+
+    bv.BuildRankSelectIndex();
+    ASSERT_TRUE(bv.HasRankSelectIndex());
+    for (uint32_t i = 0; i <= bv.size(); ++i)
+      ASSERT_EQ(bv.GetNumBitsSet(i), counts[i]);
+    for (uint32_t i = 0; i < indices.size(); ++i)
+      ASSERT_EQ(bv.IndexOfNthSet(i), indices[i]);
+  }
+}
+
+TEST(BitVectorUnittest, RankSelectIndexDroppedOnModification) {
+  BitVector bv(1000, true);
+  bv.BuildRankSelectIndex();
+  bv.Clear(10);
+  ASSERT_FALSE(bv.HasRankSelectIndex());
+  ASSERT_EQ(bv.IndexOfNthSet(10), 11u);
+
+  bv.BuildRankSelectIndex();
+  for (auto it = bv.IterateSetBits(); it; it.Next()) {
+    if (it.index() < 500)
+      it.Clear();
+  }
+  ASSERT_FALSE(bv.HasRankSelectIndex());
+  ASSERT_EQ(bv.IndexOfNthSet(0), 500u);
+
+  bv.BuildRankSelectIndex();
+  bv.AppendTrue();
+  ASSERT_FALSE(bv.HasRankSelectIndex());
+  ASSERT_EQ(bv.GetNumBitsSet(), 501u);
+
+  // Iterating without modifying the bitvector keeps the index.
+  bv.BuildRankSelectIndex();
+  for (auto it = bv.IterateSetBits(); it; it.Next()) {
+  }
+  ASSERT_TRUE(bv.HasRankSelectIndex());
+
+  BitVector copy = bv.Copy();
+  ASSERT_FALSE(copy.HasRankSelectIndex());
+}
+
 TEST(BitVectorUnittest, IterateAllBitsConst) {
   BitVector bv;
   for (uint32_t i = 0; i < 12345; ++i) {
@@ -411,6 +541,32 @@ TEST(BitVectorUnittest, Range) {
   ASSERT_EQ(bv.GetNumBitsSet(), 341u);
 }
 
+TEST(BitVectorUnittest, RangeWords) {
+  auto filler = [](uint32_t idx, uint32_t count) {
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < count; ++i)
+      word |= static_cast<uint64_t>((idx + i) % 3 == 0) << i;
+    return word;
+  };
+  BitVector bv = BitVector::RangeWords(1, 1025, filler);
+
+  ASSERT_FALSE(bv.IsSet(0));
+  for (uint32_t i = 1; i < 1025; ++i) {
+    ASSERT_EQ(i % 3 == 0, bv.IsSet(i));
+  }
+  ASSERT_EQ(bv.size(), 1025u);
+  ASSERT_EQ(bv.GetNumBitsSet(), 341u);
+  ASSERT_EQ(bv.GetNumBitsSet(700), 233u);
+
+  // Starting after the first block should leave the leading blocks empty.
+  bv = BitVector::RangeWords(600, 700, filler);
+  ASSERT_EQ(bv.size(), 700u);
+  ASSERT_EQ(bv.GetNumBitsSet(), 34u);
+  ASSERT_FALSE(bv.IsSet(597));
+  ASSERT_TRUE(bv.IsSet(600));
+  ASSERT_TRUE(bv.IsSet(699));
+}
+
 TEST(BitVectorUnittest, QueryStressTest) {
   BitVector bv;
   std::vector<bool> bool_vec;
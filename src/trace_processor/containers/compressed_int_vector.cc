@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/compressed_int_vector.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Returns the number of bits needed to represent |value|.
+uint8_t BitWidth(uint64_t value) {
+  uint8_t width = 0;
+  for (; value != 0; value >>= 1)
+    width++;
+  return width;
+}
+
+// Returns the number of bits needed to represent every value in the range
+// [min, max].
+uint8_t RangeBitWidth(int64_t min, int64_t max) {
+  return BitWidth(static_cast<uint64_t>(max) - static_cast<uint64_t>(min));
+}
+
+}  // namespace
+
+constexpr uint32_t CompressedIntVector::kBlockSize;
+
+CompressedIntVector::CompressedIntVector() = default;
+CompressedIntVector::~CompressedIntVector() = default;
+
+CompressedIntVector::CompressedIntVector(CompressedIntVector&&) noexcept =
+    default;
+CompressedIntVector& CompressedIntVector::operator=(
+    CompressedIntVector&&) noexcept = default;
+
+void CompressedIntVector::AppendBlock(const int64_t* values, uint32_t count) {
+  PERFETTO_DCHECK(count > 0 && count <= kBlockSize);
+  PERFETTO_DCHECK(size_ % kBlockSize == 0);
+  PERFETTO_DCHECK(!spilled_words_);
+
+  int64_t min = values[0];
+  int64_t max = values[0];
+  for (uint32_t i = 1; i < count; ++i) {
+    min = values[i] < min ? values[i] : min;
+    max = values[i] > max ? values[i] : max;
+  }
+
+  // Deltas are computed using unsigned arithmetic but compared as signed
+  // values so that decreasing sequences work as well.
+  int64_t min_delta = 0;
+  int64_t max_delta = 0;
+  for (uint32_t i = 1; i < count; ++i) {
+    int64_t delta = static_cast<int64_t>(static_cast<uint64_t>(values[i]) -
+                                         static_cast<uint64_t>(values[i - 1]));
+    min_delta = i == 1 || delta < min_delta ? delta : min_delta;
+    max_delta = i == 1 || delta > max_delta ? delta : max_delta;
+  }
+
+  uint8_t for_width = RangeBitWidth(min, max);
+  uint8_t delta_width = RangeBitWidth(min_delta, max_delta);
+
+  // Only use delta encoding if it saves at least 25% of the memory as random
+  // access into delta encoded blocks is significantly slower.
+  Block block{};
+  block.bit_offset = bit_size_;
+  if (count > 1 && delta_width < for_width &&
+      delta_width * 4 <= for_width * 3) {
+    block.encoding = Encoding::kDelta;
+    block.base = values[0];
+    block.min_delta = min_delta;
+    block.bit_width = delta_width;
+  } else {
+    block.encoding = Encoding::kFrameOfReference;
+    block.base = min;
+    block.bit_width = for_width;
+  }
+
+  uint32_t packed_count =
+      block.encoding == Encoding::kDelta ? count - 1 : count;
+  uint64_t new_bit_size =
+      bit_size_ + static_cast<uint64_t>(packed_count) * block.bit_width;
+  words_.resize(static_cast<size_t>((new_bit_size + 63) / 64));
+
+  uint64_t bit = bit_size_;
+  for (uint32_t i = 0; i < packed_count && block.bit_width > 0; ++i) {
+    uint64_t packed;
+    if (block.encoding == Encoding::kDelta) {
+      packed = static_cast<uint64_t>(values[i + 1]) -
+               static_cast<uint64_t>(values[i]) -
+               static_cast<uint64_t>(min_delta);
+    } else {
+      packed = static_cast<uint64_t>(values[i]) - static_cast<uint64_t>(min);
+    }
+
+    size_t word_idx = static_cast<size_t>(bit / 64);
+    uint32_t shift = static_cast<uint32_t>(bit % 64);
+    words_[word_idx] |= packed << shift;
+    if (shift + block.bit_width > 64)
+      words_[word_idx + 1] |= packed >> (64 - shift);
+    bit += block.bit_width;
+  }
+
+  bit_size_ = new_bit_size;
+  size_ += count;
+  blocks_.emplace_back(block);
+  words_data_ = words_.data();
+}
+
+size_t CompressedIntVector::Spill(SpillFile* file) {
+  if (spilled_words_ || words_.empty())
+    return 0;
+
+  size_t size = words_.size() * sizeof(uint64_t);
+  std::unique_ptr<SpilledRegion> region = file->Spill(words_.data(), size);
+  if (!region)
+    return 0;
+
+  spilled_words_ = std::move(region);
+  words_data_ = static_cast<const uint64_t*>(spilled_words_->data());
+  std::vector<uint64_t>().swap(words_);
+  return size;
+}
+
+void CompressedIntVector::Decode(uint32_t idx,
+                                 uint32_t count,
+                                 int64_t* out) const {
+  PERFETTO_DCHECK(idx + count <= size_);
+  uint32_t end = idx + count;
+  while (idx < end) {
+    uint32_t block_idx = idx / kBlockSize;
+    uint32_t block_start = block_idx * kBlockSize;
+    uint32_t block_end = block_start + kBlockSize;
+    uint32_t decode_end = block_end < end ? block_end : end;
+    DecodeBlock(blocks_[block_idx], idx - block_start, decode_end - block_start,
+                out);
+    out += decode_end - idx;
+    idx = decode_end;
+  }
+}
+
+int64_t CompressedIntVector::GetDelta(const Block& block,
+                                      uint32_t offset) const {
+  uint64_t value = static_cast<uint64_t>(block.base) +
+                   static_cast<uint64_t>(block.min_delta) * offset;
+  for (uint32_t i = 0; i < offset; ++i)
+    value += ReadPacked(block, i);
+  return static_cast<int64_t>(value);
+}
+
+void CompressedIntVector::DecodeBlock(const Block& block,
+                                      uint32_t start,
+                                      uint32_t end,
+                                      int64_t* out) const {
+  if (block.encoding == Encoding::kFrameOfReference) {
+    for (uint32_t i = start; i < end; ++i)
+      *out++ = Add(block.base, ReadPacked(block, i));
+    return;
+  }
+
+  // For delta blocks, we need to go through all the values before |start| to
+  // reconstruct the value at |start| but, after that, each value only needs
+  // a single addition.
+  int64_t value = GetDelta(block, start);
+  *out++ = value;
+  for (uint32_t i = start + 1; i < end; ++i) {
+    value = Add(value, ReadPacked(block, i - 1) +
+                           static_cast<uint64_t>(block.min_delta));
+    *out++ = value;
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_COMPRESSED_INT_VECTOR_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_COMPRESSED_INT_VECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/containers/spill_file.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// An immutable list of 64-bit integers stored in a compressed form which
+// still allows random access.
+//
+// Values are split into blocks of kBlockSize values. Each block is encoded
+// using one of two encodings (whichever is smaller):
+//  * frame-of-reference: each value is stored as its offset from the minimum
+//    value in the block. This works well for columns with a small range of
+//    values (e.g. utid, cpu or arg_set_id).
+//  * delta: each value is stored as its difference to the previous value
+//    (minus the minimum difference in the block). This works well for sorted
+//    columns (e.g. ts).
+// In both cases, the offsets are bitpacked using the smallest number of bits
+// which can represent every offset in the block.
+//
+// Random access is O(1) for frame-of-reference blocks and O(kBlockSize) for
+// delta blocks: because of this, delta encoding is only used when it saves a
+// significant amount of memory. Decode() should be preferred when reading
+// ranges of values as it decodes each block only once.
+//
+// The packed offsets, which make up almost all of the memory used by the
+// vector, can also be moved to a SpillFile (see Spill()).
+class CompressedIntVector {
+ public:
+  // The number of values in each block; all blocks except for the last one
+  // are always full.
+  static constexpr uint32_t kBlockSize = 128;
+
+  CompressedIntVector();
+  ~CompressedIntVector();
+
+  CompressedIntVector(CompressedIntVector&&) noexcept;
+  CompressedIntVector& operator=(CompressedIntVector&&) noexcept;
+
+  // Encodes |count| values starting at |values| as a new block. |count| must
+  // be at most kBlockSize and can only be less than that for the last block.
+  void AppendBlock(const int64_t* values, uint32_t count);
+
+  // Returns the value at |idx|.
+  int64_t Get(uint32_t idx) const {
+    PERFETTO_DCHECK(idx < size_);
+    const Block& block = blocks_[idx / kBlockSize];
+    uint32_t offset = idx % kBlockSize;
+    if (block.encoding == Encoding::kFrameOfReference)
+      return Add(block.base, ReadPacked(block, offset));
+    return GetDelta(block, offset);
+  }
+
+  // Decodes the |count| values starting at |idx| into |out|.
+  void Decode(uint32_t idx, uint32_t count, int64_t* out) const;
+
+  // Returns the number of values in this vector.
+  uint32_t size() const { return size_; }
+
+  // Returns the approximate number of bytes of memory used by this vector.
+  // This does not include the data moved to a SpillFile.
+  size_t SizeBytes() const {
+    return sizeof(*this) + blocks_.capacity() * sizeof(Block) +
+           words_.capacity() * sizeof(uint64_t);
+  }
+
+  // Moves the packed offsets to |file| and reads them from a read-only
+  // mapping of the file from then on. Returns the number of bytes of memory
+  // freed; this is zero if the vector was already spilled or if writing to
+  // |file| failed, in which case the vector is unchanged.
+  size_t Spill(SpillFile* file);
+
+  // Returns the number of bytes of memory which would be freed by Spill().
+  size_t SpillableSizeBytes() const { return words_.size() * sizeof(uint64_t); }
+
+  // Returns whether the packed offsets of this vector were moved to a
+  // SpillFile.
+  bool IsSpilled() const { return !!spilled_words_; }
+
+ private:
+  enum class Encoding : uint8_t {
+    kFrameOfReference,
+    kDelta,
+  };
+
+  struct Block {
+    // The minimum value in the block for frame-of-reference blocks or the
+    // first value in the block for delta blocks.
+    int64_t base;
+
+    // The minimum difference between consecutive values; only used by delta
+    // blocks.
+    int64_t min_delta;
+
+    // The index of the bit in |words_| where the packed offsets start.
+    uint64_t bit_offset;
+
+    uint8_t bit_width;
+    Encoding encoding;
+  };
+
+  // All arithmetic is done on unsigned integers so that overflows wrap
+  // around instead of being undefined behaviour; as we only ever undo the
+  // operations we did while encoding, this always gives back the original
+  // value.
+  static int64_t Add(int64_t a, uint64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) + b);
+  }
+
+  // Returns the offset at position |i| of |block|.
+  uint64_t ReadPacked(const Block& block, uint32_t i) const {
+    uint32_t width = block.bit_width;
+    if (width == 0)
+      return 0;
+
+    uint64_t bit = block.bit_offset + static_cast<uint64_t>(i) * width;
+    uint64_t word_idx = bit / 64;
+    uint32_t shift = static_cast<uint32_t>(bit % 64);
+    uint64_t value = words_data_[word_idx] >> shift;
+    if (shift + width > 64)
+      value |= words_data_[word_idx + 1] << (64 - shift);
+    return width == 64 ? value : value & ((1ull << width) - 1);
+  }
+
+  int64_t GetDelta(const Block& block, uint32_t offset) const;
+
+  void DecodeBlock(const Block& block,
+                   uint32_t start,
+                   uint32_t end,
+                   int64_t* out) const;
+
+  std::vector<Block> blocks_;
+  std::vector<uint64_t> words_;
+
+  // Points to either the data of |words_| or to |spilled_words_| once the
+  // vector is spilled (at which point |words_| is empty).
+  const uint64_t* words_data_ = nullptr;
+  std::unique_ptr<SpilledRegion> spilled_words_;
+
+  uint64_t bit_size_ = 0;
+  uint32_t size_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_COMPRESSED_INT_VECTOR_H_
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/compressed_int_vector.h"
+
+#include <limits>
+#include <memory>
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+CompressedIntVector Encode(const std::vector<int64_t>& values) {
+  const uint32_t kBlockSize = CompressedIntVector::kBlockSize;
+  CompressedIntVector cv;
+  for (uint32_t i = 0; i < values.size(); i += kBlockSize) {
+    uint32_t count = static_cast<uint32_t>(values.size()) - i;
+    cv.AppendBlock(values.data() + i, count < kBlockSize ? count : kBlockSize);
+  }
+  return cv;
+}
+
+void CheckRoundTrip(const std::vector<int64_t>& values) {
+  CompressedIntVector cv = Encode(values);
+  ASSERT_EQ(cv.size(), values.size());
+  for (uint32_t i = 0; i < values.size(); ++i)
+    ASSERT_EQ(cv.Get(i), values[i]) << "Index " << i;
+
+  std::vector<int64_t> decoded(values.size());
+  cv.Decode(0, cv.size(), decoded.data());
+  ASSERT_EQ(decoded, values);
+
+  // Decode a range which starts and ends in the middle of blocks.
+  if (values.size() > 200) {
+    std::vector<int64_t> partial(150);
+    cv.Decode(50, 150, partial.data());
+    for (uint32_t i = 0; i < 150; ++i)
+      ASSERT_EQ(partial[i], values[50 + i]);
+  }
+}
+
+TEST(CompressedIntVectorUnittest, SortedValues) {
+  std::vector<int64_t> values;
+  int64_t ts = 1000000000000;
+  std::minstd_rand0 rnd(42);
+  for (uint32_t i = 0; i < 1000; ++i) {
+    ts += rnd() % 10000;
+    values.push_back(ts);
+  }
+  CheckRoundTrip(values);
+
+  // Sorted values should be delta encoded and take much less space than the
+  // raw values.
+  CompressedIntVector cv = Encode(values);
+  ASSERT_LT(cv.SizeBytes(), values.size() * sizeof(int64_t) / 3);
+}
+
+TEST(CompressedIntVectorUnittest, SmallRange) {
+  std::vector<int64_t> values;
+  std::minstd_rand0 rnd(42);
+  for (uint32_t i = 0; i < 1000; ++i)
+    values.push_back(static_cast<int64_t>(rnd() % 16));
+  CheckRoundTrip(values);
+
+  CompressedIntVector cv = Encode(values);
+  ASSERT_LT(cv.SizeBytes(), values.size() * sizeof(int64_t) / 8);
+}
+
+TEST(CompressedIntVectorUnittest, ConstantValues) {
+  CheckRoundTrip(std::vector<int64_t>(300, -5));
+}
+
+TEST(CompressedIntVectorUnittest, ExtremeValues) {
+  std::vector<int64_t> values;
+  std::minstd_rand0 rnd(42);
+  for (uint32_t i = 0; i < 500; ++i) {
+    switch (rnd() % 4) {
+      case 0:
+        values.push_back(std::numeric_limits<int64_t>::max());
+        break;
+      case 1:
+        values.push_back(std::numeric_limits<int64_t>::min());
+        break;
+      case 2:
+        values.push_back(0);
+        break;
+      case 3:
+        values.push_back(static_cast<int64_t>(rnd()) - (1ll << 30));
+        break;
+    }
+  }
+  CheckRoundTrip(values);
+}
+
+TEST(CompressedIntVectorUnittest, DecreasingValues) {
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < 400; ++i)
+    values.push_back(100000 - i * 3);
+  CheckRoundTrip(values);
+}
+
+TEST(CompressedIntVectorUnittest, PartialLastBlock) {
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < 131; ++i)
+    values.push_back(i * i);
+  CheckRoundTrip(values);
+  CheckRoundTrip({42});
+}
+
+TEST(CompressedIntVectorUnittest, Spill) {
+  std::unique_ptr<SpillFile> file = SpillFile::Create();
+  if (!file)
+    GTEST_SKIP() << "Spill files are not supported on this platform";
+
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < 1000; ++i)
+    values.push_back(i * 37 % 1001);
+  CompressedIntVector cv = Encode(values);
+  CompressedIntVector other = Encode({1, 1000, 3});
+
+  size_t spillable = cv.SpillableSizeBytes();
+  ASSERT_GT(spillable, 0u);
+  ASSERT_EQ(cv.Spill(file.get()), spillable);
+  ASSERT_TRUE(cv.IsSpilled());
+  ASSERT_EQ(cv.SpillableSizeBytes(), 0u);
+  ASSERT_EQ(cv.Spill(file.get()), 0u);
+
+  // Regions after the first one should also be readable.
+  ASSERT_GT(other.Spill(file.get()), 0u);
+  file.reset();
+
+  for (uint32_t i = 0; i < values.size(); ++i)
+    ASSERT_EQ(cv.Get(i), values[i]) << "Index " << i;
+  std::vector<int64_t> decoded(values.size());
+  cv.Decode(0, cv.size(), decoded.data());
+  ASSERT_EQ(decoded, values);
+
+  CompressedIntVector moved = std::move(other);
+  ASSERT_EQ(moved.Get(0), 1);
+  ASSERT_EQ(moved.Get(1), 1000);
+  ASSERT_EQ(moved.Get(2), 3);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
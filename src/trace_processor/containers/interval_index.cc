@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/interval_index.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+IntervalIndex::IntervalIndex() = default;
+
+IntervalIndex::IntervalIndex(const std::vector<Interval>& intervals) {
+  PERFETTO_CHECK(intervals.size() <= std::numeric_limits<uint32_t>::max());
+  uint32_t size = static_cast<uint32_t>(intervals.size());
+
+  indices_.resize(size);
+  for (uint32_t i = 0; i < size; ++i)
+    indices_[i] = i;
+
+  // Tables are usually (close to) sorted by start already; the stable sort
+  // keeps intervals with the same start in index order.
+  auto by_start = [&intervals](uint32_t a, uint32_t b) {
+    return intervals[a].start < intervals[b].start;
+  };
+  if (!std::is_sorted(indices_.begin(), indices_.end(), by_start))
+    std::stable_sort(indices_.begin(), indices_.end(), by_start);
+
+  starts_.resize(size);
+  for (uint32_t i = 0; i < size; ++i)
+    starts_[i] = intervals[indices_[i]].start;
+
+  leaf_count_ = 1;
+  while (leaf_count_ < size)
+    leaf_count_ *= 2;
+
+  max_ends_.assign(2 * leaf_count_, std::numeric_limits<int64_t>::min());
+  for (uint32_t i = 0; i < size; ++i)
+    max_ends_[leaf_count_ + i] = intervals[indices_[i]].end;
+  for (uint32_t node = leaf_count_ - 1; node > 0; --node)
+    max_ends_[node] = std::max(max_ends_[2 * node], max_ends_[2 * node + 1]);
+}
+
+IntervalIndex::~IntervalIndex() = default;
+
+IntervalIndex::IntervalIndex(IntervalIndex&&) noexcept = default;
+IntervalIndex& IntervalIndex::operator=(IntervalIndex&&) = default;
+
+void IntervalIndex::FindOverlapping(int64_t start,
+                                    int64_t end,
+                                    std::vector<uint32_t>* indices) const {
+  if (starts_.empty())
+    return;
+
+  // Only the intervals starting before |end| can overlap the range.
+  uint32_t limit = static_cast<uint32_t>(
+      std::lower_bound(starts_.begin(), starts_.end(), end) - starts_.begin());
+
+  size_t first = indices->size();
+  Collect(1, 0, leaf_count_, limit, start, indices);
+  std::sort(indices->begin() + static_cast<std::ptrdiff_t>(first),
+            indices->end());
+}
+
+void IntervalIndex::Collect(uint32_t node,
+                            uint32_t begin,
+                            uint32_t width,
+                            uint32_t limit,
+                            int64_t start,
+                            std::vector<uint32_t>* indices) const {
+  if (begin >= limit || max_ends_[node] <= start)
+    return;
+
+  if (width == 1) {
+    indices->push_back(indices_[begin]);
+    return;
+  }
+  uint32_t half = width / 2;
+  Collect(2 * node, begin, half, limit, start, indices);
+  Collect(2 * node + 1, begin + half, half, limit, start, indices);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
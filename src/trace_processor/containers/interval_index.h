@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_INTERVAL_INDEX_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_INTERVAL_INDEX_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+
+// Static index over a set of half-open intervals [start, end) which finds the
+// intervals overlapping a given range in O((k + 1) * log(n)), where k is the
+// number of results.
+//
+// Intervals are sorted by start and a binary tree over the sorted intervals
+// keeps the maximum end of each subtree. A query only looks at the intervals
+// starting before the end of the range and skips the subtrees which all end
+// before its start.
+class IntervalIndex {
+ public:
+  struct Interval {
+    int64_t start;
+    int64_t end;
+  };
+
+  IntervalIndex();
+
+  // Indexes |intervals|; the index of an interval in the vector is the value
+  // returned by FindOverlapping.
+  explicit IntervalIndex(const std::vector<Interval>& intervals);
+
+  ~IntervalIndex();
+
+  IntervalIndex(IntervalIndex&&) noexcept;
+  IntervalIndex& operator=(IntervalIndex&&);
+
+  // Appends to |indices|, in increasing order, the index of every interval
+  // such that |interval.start| < |end| and |interval.end| > |start|. For an
+  // empty range [x, x), these are the intervals strictly containing x.
+  void FindOverlapping(int64_t start,
+                       int64_t end,
+                       std::vector<uint32_t>* indices) const;
+
+  // Returns the number of indexed intervals.
+  uint32_t size() const { return static_cast<uint32_t>(starts_.size()); }
+
+ private:
+  IntervalIndex(const IntervalIndex&) = delete;
+  IntervalIndex& operator=(const IntervalIndex&) = delete;
+
+  // Appends the intervals in the subtree rooted at |node|, which spans the
+  // sorted positions [|begin|, |begin| + |width|), which are before |limit|
+  // and end after |start|.
+  void Collect(uint32_t node,
+               uint32_t begin,
+               uint32_t width,
+               uint32_t limit,
+               int64_t start,
+               std::vector<uint32_t>* indices) const;
+
+  // Start and original index of the intervals, sorted by start.
+  std::vector<int64_t> starts_;
+  std::vector<uint32_t> indices_;
+
+  // Implicit binary tree with |leaf_count_| leaves (a power of two): node 1
+  // is the root and the children of node i are 2 * i and 2 * i + 1. Each node
+  // stores the maximum end of the intervals below it.
+  std::vector<int64_t> max_ends_;
+  uint32_t leaf_count_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_INTERVAL_INDEX_H_
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/interval_index.h"
+
+#include <stdint.h>
+
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+using Interval = IntervalIndex::Interval;
+
+std::vector<uint32_t> Find(const IntervalIndex& index,
+                           int64_t start,
+                           int64_t end) {
+  std::vector<uint32_t> indices;
+  index.FindOverlapping(start, end, &indices);
+  return indices;
+}
+
+TEST(IntervalIndexUnittest, Empty) {
+  IntervalIndex index;
+  ASSERT_EQ(index.size(), 0u);
+  ASSERT_THAT(Find(index, 0, 100), IsEmpty());
+
+  IntervalIndex empty_vector(std::vector<Interval>{});
+  ASSERT_THAT(Find(empty_vector, 0, 100), IsEmpty());
+}
+
+TEST(IntervalIndexUnittest, HalfOpenIntervals) {
+  IntervalIndex index({{10, 20}, {20, 30}, {0, 100}, {25, 25}});
+  ASSERT_EQ(index.size(), 4u);
+
+  ASSERT_THAT(Find(index, 0, 10), ElementsAre(2u));
+  ASSERT_THAT(Find(index, 19, 20), ElementsAre(0u, 2u));
+  ASSERT_THAT(Find(index, 20, 21), ElementsAre(1u, 2u));
+  ASSERT_THAT(Find(index, 15, 26), ElementsAre(0u, 1u, 2u, 3u));
+  ASSERT_THAT(Find(index, 100, 200), IsEmpty());
+
+  // An empty range finds the intervals strictly containing its position.
+  ASSERT_THAT(Find(index, 15, 15), ElementsAre(0u, 2u));
+  ASSERT_THAT(Find(index, 20, 20), ElementsAre(2u));
+}
+
+TEST(IntervalIndexUnittest, UnsortedAndUnbounded) {
+  const int64_t kMax = std::numeric_limits<int64_t>::max();
+  IntervalIndex index({{50, kMax}, {10, 20}, {-5, 0}, {10, 15}});
+
+  ASSERT_THAT(Find(index, 12, 13), ElementsAre(1u, 3u));
+  ASSERT_THAT(Find(index, 1000, kMax), ElementsAre(0u));
+  ASSERT_THAT(Find(index, std::numeric_limits<int64_t>::min(), 0),
+              ElementsAre(2u));
+}
+
+TEST(IntervalIndexUnittest, AppendsInIncreasingOrder) {
+  IntervalIndex index({{30, 40}, {0, 10}, {5, 35}});
+  std::vector<uint32_t> indices = {100};
+  index.FindOverlapping(0, 50, &indices);
+  ASSERT_THAT(indices, ElementsAre(100u, 0u, 1u, 2u));
+}
+
+TEST(IntervalIndexUnittest, MatchesBruteForce) {
+  std::minstd_rand0 rnd(0);
+  for (uint32_t size : {1u, 2u, 7u, 64u, 1000u, 4097u}) {
+    std::vector<Interval> intervals;
+    for (uint32_t i = 0; i < size; ++i) {
+      int64_t start = static_cast<int64_t>(rnd() % 10000);
+      // Mostly short intervals with a few long ones, like slices.
+      int64_t dur = static_cast<int64_t>(i % 16 == 0 ? rnd() % 5000
+                                                      : rnd() % 50);
+      intervals.push_back(Interval{start, start + dur});
+    }
+    IntervalIndex index(intervals);
+
+    for (uint32_t q = 0; q < 200; ++q) {
+      int64_t start = static_cast<int64_t>(rnd() % 11000) - 500;
+      int64_t end = start + static_cast<int64_t>(rnd() % 300);
+
+      std::vector<uint32_t> expected;
+      for (uint32_t i = 0; i < size; ++i) {
+        if (intervals[i].start < end && intervals[i].end > start)
+          expected.push_back(i);
+      }
+      ASSERT_EQ(Find(index, start, end), expected)
+          << "size " << size << " range [" << start << ", " << end << ")";
+    }
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "src/trace_processor/containers/nested_set_index.h"
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// static
+constexpr uint32_t NestedSetIndex::kNoParent;
+
+NestedSetIndex::NestedSetIndex() = default;
+
+NestedSetIndex::NestedSetIndex(const std::vector<uint32_t>& parents) {
+  PERFETTO_CHECK(parents.size() < std::numeric_limits<uint32_t>::max());
+  const auto size = static_cast<uint32_t>(parents.size());
+
+  // The children of each node, in increasing order, in compressed sparse row
+  // form.
+  std::vector<uint32_t> child_offsets(size + 1, 0);
+  for (uint32_t parent : parents) {
+    if (parent != kNoParent) {
+      PERFETTO_CHECK(parent < size);
+      child_offsets[parent + 1]++;
+    }
+  }
+  for (uint32_t i = 0; i < size; ++i)
+    child_offsets[i + 1] += child_offsets[i];
+  std::vector<uint32_t> children(child_offsets[size]);
+  {
+    std::vector<uint32_t> next(child_offsets.begin(), child_offsets.end() - 1);
+    for (uint32_t node = 0; node < size; ++node) {
+      if (parents[node] != kNoParent)
+        children[next[parents[node]]++] = node;
+    }
+  }
+
+  // Slice stacks can be very deep so the traversal uses an explicit stack.
+  preorder_.reserve(size);
+  positions_.resize(size);
+  ends_.resize(size);
+  struct StackElem {
+    uint32_t node;
+    uint32_t next_child;
+  };
+  std::vector<StackElem> stack;
+  for (uint32_t root = 0; root < size; ++root) {
+    if (parents[root] != kNoParent)
+      continue;
+    positions_[root] = static_cast<uint32_t>(preorder_.size());
+    preorder_.push_back(root);
+    stack.push_back({root, child_offsets[root]});
+    while (!stack.empty()) {
+      StackElem& top = stack.back();
+      if (top.next_child == child_offsets[top.node + 1]) {
+        ends_[top.node] = static_cast<uint32_t>(preorder_.size());
+        stack.pop_back();
+        continue;
+      }
+      uint32_t child = children[top.next_child++];
+      positions_[child] = static_cast<uint32_t>(preorder_.size());
+      preorder_.push_back(child);
+      stack.push_back({child, child_offsets[child]});
+    }
+  }
+  // Nodes on a cycle are never reached from a root.
+  PERFETTO_CHECK(preorder_.size() == size);
+}
+
+NestedSetIndex::~NestedSetIndex() = default;
+
+NestedSetIndex::NestedSetIndex(NestedSetIndex&&) noexcept = default;
+NestedSetIndex& NestedSetIndex::operator=(NestedSetIndex&&) = default;
+
+void NestedSetIndex::GetDescendants(uint32_t node,
+                                    std::vector<uint32_t>* descendants) const {
+  auto first = static_cast<std::ptrdiff_t>(descendants->size());
+  descendants->insert(descendants->end(),
+                      preorder_.begin() + positions_[node] + 1,
+                      preorder_.begin() + ends_[node]);
+  // When children have higher indices than their parents (as is the case for
+  // slices), a subtree is usually in increasing order already.
+  auto begin = descendants->begin() + first;
+  if (!std::is_sorted(begin, descendants->end()))
+    std::sort(begin, descendants->end());
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_NESTED_SET_INDEX_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_NESTED_SET_INDEX_H_
+
+#include <stdint.h>
+
+#include <limits>
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+
+// Static index over a forest, given as the parent of each node, which lays
+// the nodes out in depth-first preorder so that the descendants of every node
+// are the contiguous range of nodes following it (the "nested set" model).
+//
+// This makes finding the k descendants of a node O(k log k) (O(k) if they are
+// already in increasing order) and checking whether a node is an ancestor of
+// another O(1), whatever the size and shape of the forest.
+class NestedSetIndex {
+ public:
+  static constexpr uint32_t kNoParent = std::numeric_limits<uint32_t>::max();
+
+  NestedSetIndex();
+
+  // Indexes the forest where the parent of node i is |parents[i]|, or
+  // kNoParent for the roots. The parents must not form cycles.
+  explicit NestedSetIndex(const std::vector<uint32_t>& parents);
+
+  ~NestedSetIndex();
+
+  NestedSetIndex(NestedSetIndex&&) noexcept;
+  NestedSetIndex& operator=(NestedSetIndex&&);
+
+  // Appends to |descendants|, in increasing order, all the descendants of
+  // |node| (excluding |node| itself).
+  void GetDescendants(uint32_t node, std::vector<uint32_t>* descendants) const;
+
+  // Returns the number of descendants of |node|.
+  uint32_t GetDescendantCount(uint32_t node) const {
+    return ends_[node] - positions_[node] - 1;
+  }
+
+  // Returns whether |ancestor| is a strict ancestor of |node|.
+  bool IsAncestor(uint32_t ancestor, uint32_t node) const {
+    return positions_[ancestor] < positions_[node] &&
+           positions_[node] < ends_[ancestor];
+  }
+
+  // Returns the number of indexed nodes.
+  uint32_t size() const { return static_cast<uint32_t>(preorder_.size()); }
+
+ private:
+  NestedSetIndex(const NestedSetIndex&) = delete;
+  NestedSetIndex& operator=(const NestedSetIndex&) = delete;
+
+  // The nodes in depth-first preorder, with the roots and the children of
+  // each node visited in increasing order.
+  std::vector<uint32_t> preorder_;
+
+  // For each node, its position in |preorder_| and the position following
+  // its last descendant.
+  std::vector<uint32_t> positions_;
+  std::vector<uint32_t> ends_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_NESTED_SET_INDEX_H_
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "src/trace_processor/containers/nested_set_index.h"
+
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+constexpr uint32_t kNoParent = NestedSetIndex::kNoParent;
+
+std::vector<uint32_t> Descendants(const NestedSetIndex& index, uint32_t node) {
+  std::vector<uint32_t> descendants;
+  index.GetDescendants(node, &descendants);
+  return descendants;
+}
+
+TEST(NestedSetIndexUnittest, Empty) {
+  NestedSetIndex index;
+  ASSERT_EQ(index.size(), 0u);
+
+  NestedSetIndex empty_vector(std::vector<uint32_t>{});
+  ASSERT_EQ(empty_vector.size(), 0u);
+}
+
+TEST(NestedSetIndexUnittest, Forest) {
+  // 0 -> 1 -> 2    4 -> 6    5
+  //  \-> 3          \-> 7 -> 8
+  NestedSetIndex index(
+      {kNoParent, 0, 1, 0, kNoParent, kNoParent, 4, 4, 7});
+  ASSERT_EQ(index.size(), 9u);
+
+  ASSERT_THAT(Descendants(index, 0), ElementsAre(1u, 2u, 3u));
+  ASSERT_THAT(Descendants(index, 1), ElementsAre(2u));
+  ASSERT_THAT(Descendants(index, 2), IsEmpty());
+  ASSERT_THAT(Descendants(index, 4), ElementsAre(6u, 7u, 8u));
+  ASSERT_THAT(Descendants(index, 5), IsEmpty());
+  ASSERT_EQ(index.GetDescendantCount(0), 3u);
+  ASSERT_EQ(index.GetDescendantCount(8), 0u);
+
+  ASSERT_TRUE(index.IsAncestor(0, 2));
+  ASSERT_TRUE(index.IsAncestor(7, 8));
+  ASSERT_FALSE(index.IsAncestor(0, 0));
+  ASSERT_FALSE(index.IsAncestor(2, 0));
+  ASSERT_FALSE(index.IsAncestor(1, 3));
+  ASSERT_FALSE(index.IsAncestor(0, 4));
+}
+
+TEST(NestedSetIndexUnittest, ParentsAfterChildren) {
+  // 3 -> 1 -> 0
+  //  \-> 2
+  NestedSetIndex index({1, 3, 3, kNoParent});
+  ASSERT_THAT(Descendants(index, 3), ElementsAre(0u, 1u, 2u));
+  ASSERT_THAT(Descendants(index, 1), ElementsAre(0u));
+
+  std::vector<uint32_t> descendants{42};
+  index.GetDescendants(1, &descendants);
+  ASSERT_THAT(descendants, ElementsAre(42u, 0u));
+}
+
+TEST(NestedSetIndexUnittest, DeepChain) {
+  const uint32_t kSize = 1000000;
+  std::vector<uint32_t> parents(kSize);
+  parents[0] = kNoParent;
+  for (uint32_t i = 1; i < kSize; ++i)
+    parents[i] = i - 1;
+  NestedSetIndex index(parents);
+  ASSERT_EQ(index.GetDescendantCount(0), kSize - 1);
+  ASSERT_TRUE(index.IsAncestor(0, kSize - 1));
+  ASSERT_THAT(Descendants(index, kSize - 2), ElementsAre(kSize - 1));
+}
+
+TEST(NestedSetIndexUnittest, MatchesParentWalk) {
+  std::minstd_rand rnd(42);
+  const uint32_t kSize = 500;
+  std::vector<uint32_t> parents(kSize);
+  for (uint32_t i = 0; i < kSize; ++i)
+    parents[i] = i == 0 || rnd() % 8 == 0 ? kNoParent : rnd() % i;
+  NestedSetIndex index(parents);
+
+  for (uint32_t node = 0; node < kSize; ++node) {
+    std::vector<uint32_t> expected;
+    for (uint32_t other = 0; other < kSize; ++other) {
+      bool is_descendant = false;
+      for (uint32_t p = parents[other]; p != kNoParent; p = parents[p])
+        is_descendant |= p == node;
+      if (is_descendant)
+        expected.push_back(other);
+      ASSERT_EQ(index.IsAncestor(node, other), is_descendant);
+    }
+    ASSERT_EQ(Descendants(index, node), expected);
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -19,11 +19,17 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <deque>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/containers/compressed_int_vector.h"
 #include "src/trace_processor/containers/row_map.h"
+#include "src/trace_processor/containers/spill_file.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -40,8 +46,34 @@ class NullableVectorBase {
 
   NullableVectorBase(NullableVectorBase&&) = default;
   NullableVectorBase& operator=(NullableVectorBase&&) noexcept = default;
+
+  // Incremented whenever a value is appended or set.
+  uint64_t mutation_count() const { return mutation_count_; }
+
+ protected:
+  uint64_t mutation_count_ = 0;
+};
+
+namespace internal {
+
+// Converts values of type T to and from the int64_t values stored in a
+// CompressedIntVector. Only integral types can be compressed.
+template <typename T, bool = std::is_integral<T>::value>
+struct IntCompressionTraits {
+  static constexpr bool kSupported = true;
+  static int64_t ToInt64(T value) { return static_cast<int64_t>(value); }
+  static T FromInt64(int64_t value) { return static_cast<T>(value); }
+};
+
+template <typename T>
+struct IntCompressionTraits<T, false> {
+  static constexpr bool kSupported = false;
+  static int64_t ToInt64(T) { PERFETTO_FATAL("Type cannot be compressed"); }
+  static T FromInt64(int64_t) { PERFETTO_FATAL("Type cannot be compressed"); }
 };
 
+}  // namespace internal
+
 // A data structure which compactly stores a list of possibly nullable data.
 //
 // Internally, this class is implemented using a combination of a std::deque
@@ -49,9 +81,15 @@ class NullableVectorBase {
 // By default, for each null value, it only uses a single bit inside the
 // BitVector at a slight cost (searching the BitVector to find the index into
 // the std::deque) when looking up the data.
+//
+// For integral types, the std::deque can also be replaced by a
+// CompressedIntVector by calling Compress(); this is transparent to callers
+// apart from the vector being decompressed if it is modified.
 template <typename T>
 class NullableVector : public NullableVectorBase {
  private:
+  using CompressionTraits = internal::IntCompressionTraits<T>;
+
   enum class Mode {
     // Sparse mode is the default mode and ensures that nulls are stored using
     // only
@@ -86,10 +124,10 @@ class NullableVector : public NullableVectorBase {
   base::Optional<T> Get(uint32_t idx) const {
     if (mode_ == Mode::kDense) {
       bool contains = valid_.Contains(idx);
-      return contains ? base::Optional<T>(data_[idx]) : base::nullopt;
+      return contains ? base::Optional<T>(DataAt(idx)) : base::nullopt;
     } else {
       auto opt_idx = valid_.IndexOf(idx);
-      return opt_idx ? base::Optional<T>(data_[*opt_idx]) : base::nullopt;
+      return opt_idx ? base::Optional<T>(DataAt(*opt_idx)) : base::nullopt;
     }
   }
 
@@ -105,21 +143,34 @@ class NullableVector : public NullableVectorBase {
   // ...
   T GetNonNull(uint32_t ordinal) const {
     if (mode_ == Mode::kDense) {
-      return data_[valid_.Get(ordinal)];
+      return DataAt(valid_.Get(ordinal));
     } else {
-      PERFETTO_DCHECK(ordinal < data_.size());
-      return data_[ordinal];
+      PERFETTO_DCHECK(ordinal < DataSize());
+      return DataAt(ordinal);
     }
   }
 
   // Adds the given value to the NullableVector.
   void Append(T val) {
+    MaybeDecompress();
+    mutation_count_++;
     data_.emplace_back(val);
     valid_.Insert(size_++);
   }
 
+  // Adds the |count| values starting at |vals| to the NullableVector.
+  void AppendRange(const T* vals, uint32_t count) {
+    MaybeDecompress();
+    mutation_count_++;
+    data_.insert(data_.end(), vals, vals + count);
+    valid_.InsertRange(size_, size_ + count);
+    size_ += count;
+  }
+
   // Adds a null value to the NullableVector.
   void AppendNull() {
+    MaybeDecompress();
+    mutation_count_++;
     if (mode_ == Mode::kDense) {
       data_.emplace_back();
     }
@@ -137,6 +188,8 @@ class NullableVector : public NullableVectorBase {
 
   // Sets the value at |idx| to the given |val|.
   void Set(uint32_t idx, T val) {
+    MaybeDecompress();
+    mutation_count_++;
     if (mode_ == Mode::kDense) {
       if (!valid_.Contains(idx)) {
         valid_.Insert(idx);
@@ -159,6 +212,92 @@ class NullableVector : public NullableVectorBase {
     }
   }
 
+  // Copies the values at indices [idx, idx + count) into |out|.
+  //
+  // Should only be called if this vector is dense or contains no nulls as only
+  // then is the value at index i stored at position i. Null entries of dense
+  // vectors are copied as default initialized values; callers should mask
+  // these out using |GetNonNullWord|.
+  void CopyRange(uint32_t idx, uint32_t count, T* out) const {
+    PERFETTO_DCHECK(mode_ == Mode::kDense || valid_.size() == size_);
+    PERFETTO_DCHECK(idx + count <= size_);
+    if (PERFETTO_UNLIKELY(compressed_)) {
+      CopyRangeCompressed(idx, count, out);
+      return;
+    }
+    auto it = data_.begin() + static_cast<ptrdiff_t>(idx);
+    std::copy(it, it + static_cast<ptrdiff_t>(count), out);
+  }
+
+  // Replaces the storage of the non-null values with a CompressedIntVector.
+  // This reduces memory usage significantly for sorted values (e.g.
+  // timestamps) or values with a small range (e.g. ids) at the cost of
+  // slower lookups. No-op for types which cannot be compressed or if the
+  // vector is already compressed.
+  void Compress() {
+    if (!CompressionTraits::kSupported || compressed_)
+      return;
+
+    std::unique_ptr<CompressedIntVector> compressed(new CompressedIntVector());
+    int64_t block[CompressedIntVector::kBlockSize];
+    uint32_t block_size = 0;
+    for (T value : data_) {
+      block[block_size++] = CompressionTraits::ToInt64(value);
+      if (block_size == CompressedIntVector::kBlockSize) {
+        compressed->AppendBlock(block, block_size);
+        block_size = 0;
+      }
+    }
+    if (block_size > 0)
+      compressed->AppendBlock(block, block_size);
+
+    compressed_ = std::move(compressed);
+    std::deque<T>().swap(data_);
+  }
+
+  // Returns whether the values of this vector are currently compressed.
+  bool IsCompressed() const { return !!compressed_; }
+
+  // Moves the compressed values of this vector to |file| so that they are
+  // read from a memory mapping of the file (see CompressedIntVector::Spill).
+  // Returns the number of bytes of memory freed. Only compressed vectors can
+  // be spilled; modifying the vector brings the values back in memory.
+  size_t Spill(SpillFile* file) {
+    return compressed_ ? compressed_->Spill(file) : 0;
+  }
+
+  // Returns the number of bytes of memory which would be freed by Spill().
+  size_t SpillableSizeBytes() const {
+    return compressed_ ? compressed_->SpillableSizeBytes() : 0;
+  }
+
+  // Returns the number of bytes of memory used by the values and the validity
+  // of this vector. This does not include the values moved to a SpillFile.
+  size_t SizeBytes() const {
+    size_t values =
+        compressed_ ? compressed_->SizeBytes() : data_.size() * sizeof(T);
+    return values + valid_.SizeBytes();
+  }
+
+  // Builds a rank/select index for the non-null entries of sparse vectors so
+  // that looking up a value takes constant time (see
+  // BitVector::BuildRankSelectIndex). The index is dropped if the vector is
+  // modified.
+  void BuildRankSelectIndex() {
+    if (mode_ == Mode::kSparse)
+      valid_.BuildRankSelectIndex();
+  }
+
+  // Returns a word where bit i is set iff the value at |idx + i| is non-null
+  // for i < |count| (which should be at most 64).
+  uint64_t GetNonNullWord(uint32_t idx, uint32_t count) const {
+    PERFETTO_DCHECK(count <= 64);
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < count; ++i)
+      word |= static_cast<uint64_t>(valid_.Contains(idx + i)) << i;
+    return word;
+  }
+
   // Returns the size of the NullableVector; this includes any null values.
   uint32_t size() const { return size_; }
 
@@ -168,9 +307,49 @@ class NullableVector : public NullableVectorBase {
  private:
   NullableVector(Mode mode) : mode_(mode) {}
 
+  T DataAt(uint32_t idx) const {
+    return PERFETTO_UNLIKELY(compressed_)
+               ? CompressionTraits::FromInt64(compressed_->Get(idx))
+               : data_[idx];
+  }
+
+  uint32_t DataSize() const {
+    return compressed_ ? compressed_->size()
+                       : static_cast<uint32_t>(data_.size());
+  }
+
+  void CopyRangeCompressed(uint32_t idx, uint32_t count, T* out) const {
+    int64_t buffer[64];
+    for (uint32_t i = 0; i < count; i += 64) {
+      uint32_t chunk = count - i < 64 ? count - i : 64;
+      compressed_->Decode(idx + i, chunk, buffer);
+      for (uint32_t j = 0; j < chunk; ++j)
+        out[i + j] = CompressionTraits::FromInt64(buffer[j]);
+    }
+  }
+
+  // Moves the values back into |data_| so that they can be modified.
+  void MaybeDecompress() {
+    if (PERFETTO_LIKELY(!compressed_))
+      return;
+
+    uint32_t size = compressed_->size();
+    int64_t buffer[64];
+    for (uint32_t i = 0; i < size; i += 64) {
+      uint32_t chunk = size - i < 64 ? size - i : 64;
+      compressed_->Decode(i, chunk, buffer);
+      for (uint32_t j = 0; j < chunk; ++j)
+        data_.emplace_back(CompressionTraits::FromInt64(buffer[j]));
+    }
+    compressed_.reset();
+  }
+
   Mode mode_ = Mode::kSparse;
 
+  // Only one of |data_| and |compressed_| is used at any time: |data_| is
+  // always empty while |compressed_| is non-null.
   std::deque<T> data_;
+  std::unique_ptr<CompressedIntVector> compressed_;
   RowMap valid_;
   uint32_t size_ = 0;
 };
@@ -37,6 +37,29 @@ TEST(NullableVector, Append) {
   ASSERT_EQ(sv.Get(3), base::Optional<int64_t>(40));
 }
 
+TEST(NullableVector, AppendRange) {
+  int64_t values[] = {20, 30, 40};
+  NullableVector<int64_t> sv;
+  sv.AppendNull();
+  sv.AppendRange(values, 3);
+  sv.AppendNull();
+  sv.AppendRange(values, 1);
+
+  ASSERT_EQ(sv.size(), 6u);
+  ASSERT_EQ(sv.Get(0), base::nullopt);
+  ASSERT_EQ(sv.Get(1), base::Optional<int64_t>(20));
+  ASSERT_EQ(sv.Get(3), base::Optional<int64_t>(40));
+  ASSERT_EQ(sv.Get(4), base::nullopt);
+  ASSERT_EQ(sv.Get(5), base::Optional<int64_t>(20));
+
+  NullableVector<int64_t> dense = NullableVector<int64_t>::Dense();
+  dense.AppendNull();
+  dense.AppendRange(values, 3);
+  ASSERT_EQ(dense.size(), 4u);
+  ASSERT_EQ(dense.Get(0), base::nullopt);
+  ASSERT_EQ(dense.Get(2), base::Optional<int64_t>(30));
+}
+
 TEST(NullableVector, Set) {
   NullableVector<int64_t> sv;
   sv.Append(10);
@@ -98,6 +121,162 @@ TEST(NullableVector, Dense) {
   ASSERT_EQ(sv.GetNonNull(2), 2);
 }
 
+TEST(NullableVector, CopyRange) {
+  auto sv = NullableVector<int64_t>::Dense();
+  for (int64_t i = 0; i < 100; ++i) {
+    if (i % 4 == 0) {
+      sv.AppendNull();
+    } else {
+      sv.Append(i);
+    }
+  }
+
+  int64_t values[64];
+  sv.CopyRange(10, 5, values);
+  ASSERT_EQ(values[0], 10);
+  ASSERT_EQ(values[1], 11);
+  ASSERT_EQ(values[4], 14);
+
+  ASSERT_EQ(sv.GetNonNullWord(10, 5), 0b11011u);
+  ASSERT_EQ(sv.GetNonNullWord(64, 36), 0xEEEEEEEEEull);
+}
+
+TEST(NullableVector, Compress) {
+  NullableVector<int64_t> sv;
+  for (int64_t i = 0; i < 1000; ++i) {
+    if (i % 3 == 0) {
+      sv.AppendNull();
+    } else {
+      sv.Append(i * 1000);
+    }
+  }
+  sv.Compress();
+  ASSERT_TRUE(sv.IsCompressed());
+
+  ASSERT_EQ(sv.size(), 1000u);
+  ASSERT_EQ(sv.Get(0), base::nullopt);
+  ASSERT_EQ(sv.Get(1), base::Optional<int64_t>(1000));
+  ASSERT_EQ(sv.Get(998), base::Optional<int64_t>(998000));
+  ASSERT_EQ(sv.GetNonNull(0), 1000);
+
+  // Modifying the vector should transparently decompress it.
+  sv.Set(0, 5);
+  ASSERT_FALSE(sv.IsCompressed());
+  ASSERT_EQ(sv.Get(0), base::Optional<int64_t>(5));
+  ASSERT_EQ(sv.Get(1), base::Optional<int64_t>(1000));
+  ASSERT_EQ(sv.Get(999), base::nullopt);
+}
+
+TEST(NullableVector, RankSelectIndex) {
+  NullableVector<int64_t> sv;
+  for (int64_t i = 0; i < 5000; ++i) {
+    if (i % 7 == 0) {
+      sv.Append(i);
+    } else {
+      sv.AppendNull();
+    }
+  }
+  sv.BuildRankSelectIndex();
+
+  for (uint32_t i = 0; i < 5000; ++i) {
+    base::Optional<int64_t> expected =
+        i % 7 == 0 ? base::Optional<int64_t>(i) : base::nullopt;
+    ASSERT_EQ(sv.Get(i), expected);
+  }
+
+  // Modifying the vector should drop the index without affecting lookups.
+  sv.Set(1, 10);
+  ASSERT_EQ(sv.Get(1), base::Optional<int64_t>(10));
+  ASSERT_EQ(sv.Get(7), base::Optional<int64_t>(7));
+  ASSERT_EQ(sv.Get(4999), base::nullopt);
+}
+
+TEST(NullableVector, CompressDense) {
+  auto sv = NullableVector<uint32_t>::Dense();
+  for (uint32_t i = 0; i < 300; ++i) {
+    if (i % 4 == 0) {
+      sv.AppendNull();
+    } else {
+      sv.Append(i % 7);
+    }
+  }
+  sv.Compress();
+  ASSERT_TRUE(sv.IsCompressed());
+
+  for (uint32_t i = 0; i < 300; ++i) {
+    auto expected = i % 4 == 0 ? base::nullopt : base::make_optional(i % 7);
+    ASSERT_EQ(sv.Get(i), expected);
+  }
+
+  uint32_t values[200];
+  sv.CopyRange(90, 200, values);
+  for (uint32_t i = 0; i < 200; ++i) {
+    if ((90 + i) % 4 != 0) {
+      ASSERT_EQ(values[i], (90 + i) % 7);
+    }
+  }
+
+  sv.Append(10);
+  ASSERT_FALSE(sv.IsCompressed());
+  ASSERT_EQ(sv.Get(300), base::Optional<uint32_t>(10));
+  ASSERT_EQ(sv.Get(299), base::Optional<uint32_t>(299 % 7));
+}
+
+TEST(NullableVector, Spill) {
+  std::unique_ptr<SpillFile> file = SpillFile::Create();
+  if (!file)
+    GTEST_SKIP() << "Spill files are not supported on this platform";
+
+  NullableVector<int64_t> sv;
+  for (int64_t i = 0; i < 1000; ++i) {
+    if (i % 3 == 0) {
+      sv.AppendNull();
+    } else {
+      sv.Append(i * 1000);
+    }
+  }
+
+  // Only compressed vectors can be spilled.
+  ASSERT_EQ(sv.SpillableSizeBytes(), 0u);
+  ASSERT_EQ(sv.Spill(file.get()), 0u);
+
+  sv.Compress();
+  ASSERT_GT(sv.SpillableSizeBytes(), 0u);
+  ASSERT_GT(sv.Spill(file.get()), 0u);
+  ASSERT_EQ(sv.SpillableSizeBytes(), 0u);
+  ASSERT_EQ(sv.Get(0), base::nullopt);
+  ASSERT_EQ(sv.Get(1), base::Optional<int64_t>(1000));
+  ASSERT_EQ(sv.Get(998), base::Optional<int64_t>(998000));
+
+  // Modifying the vector should bring the values back in memory.
+  sv.Set(0, 5);
+  ASSERT_FALSE(sv.IsCompressed());
+  ASSERT_EQ(sv.Get(0), base::Optional<int64_t>(5));
+  ASSERT_EQ(sv.Get(998), base::Optional<int64_t>(998000));
+}
+
+TEST(NullableVector, CompressUnsupportedType) {
+  NullableVector<double> sv;
+  sv.Append(1.5);
+  sv.Compress();
+  ASSERT_FALSE(sv.IsCompressed());
+  ASSERT_EQ(sv.Get(0), base::Optional<double>(1.5));
+}
+
+TEST(NullableVector, SizeBytes) {
+  NullableVector<int64_t> sv = NullableVector<int64_t>::Dense();
+  ASSERT_EQ(sv.SizeBytes(), 0u);
+  for (int64_t i = 0; i < 1024; ++i)
+    sv.Append(i);
+  size_t uncompressed = sv.SizeBytes();
+  ASSERT_GE(uncompressed, 1024 * sizeof(int64_t));
+
+  // The values are small so they should take less space once compressed.
+  sv.Compress();
+  ASSERT_TRUE(sv.IsCompressed());
+  ASSERT_LT(sv.SizeBytes(), uncompressed);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
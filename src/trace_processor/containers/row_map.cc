@@ -77,12 +77,14 @@ RowMap SelectBvWithRange(const BitVector& bv,
   PERFETTO_DCHECK(selector_start <= selector_end);
   PERFETTO_DCHECK(selector_end <= bv.GetNumBitsSet());
 
+  // Instead of clearing the set bits outside the selected range one by one,
+  // turn the range into a BitVector so that they are cleared one word at a
+  // time.
+  BitVector selector(selector_start, false);
+  selector.Resize(selector_end, true);
+
   BitVector ret = bv.Copy();
-  for (auto it = ret.IterateSetBits(); it; it.Next()) {
-    auto set_idx = it.ordinal();
-    if (set_idx < selector_start || set_idx >= selector_end)
-      it.Clear();
-  }
+  ret.UpdateSetBits(selector);
   return RowMap(std::move(ret));
 }
 
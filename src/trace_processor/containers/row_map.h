@@ -254,6 +254,13 @@ class RowMap {
   // Returns whether this rowmap is empty.
   bool empty() const { return size() == 0; }
 
+  // Returns the number of bytes of memory used by the BitVector or index
+  // vector backing this RowMap (i.e. zero for ranges).
+  size_t SizeBytes() const {
+    return bit_vector_.SizeBytes() +
+           index_vector_.capacity() * sizeof(uint32_t);
+  }
+
   // Returns the row at index |row|.
   uint32_t Get(uint32_t idx) const {
     PERFETTO_DCHECK(idx < size());
@@ -354,6 +361,36 @@ class RowMap {
     }
   }
 
+  // Inserts the rows [start, end) into the current RowMap. All the rows must
+  // be greater than the rows already in the RowMap, i.e. this is a bulk
+  // version of calling Insert() at the end of the RowMap.
+  //
+  // Example:
+  // this = [1, 5, 10]
+  // InsertRange(12, 15)  // this = [1, 5, 10, 12, 13, 14]
+  void InsertRange(uint32_t start, uint32_t end) {
+    PERFETTO_DCHECK(start <= end);
+    PERFETTO_DCHECK(empty() || Get(size() - 1) < start);
+    switch (mode_) {
+      case Mode::kRange:
+        if (start == end_idx_) {
+          end_idx_ = end;
+          break;
+        }
+        for (uint32_t row = start; row < end; ++row)
+          Insert(row);
+        break;
+      case Mode::kBitVector:
+        bit_vector_.Resize(start, false);
+        bit_vector_.Resize(end, true);
+        break;
+      case Mode::kIndexVector:
+        for (uint32_t row = start; row < end; ++row)
+          index_vector_.push_back(row);
+        break;
+    }
+  }
+
   // Updates this RowMap by 'picking' the rows at indicies given by |picker|.
   // This is easiest to explain with an example; suppose we have the following
   // RowMaps:
@@ -384,6 +421,15 @@ class RowMap {
     return SelectRowsSlow(selector);
   }
 
+  // If this RowMap is a BitVector, builds a rank/select index for it which
+  // makes Get() and IndexOf() constant time (see
+  // BitVector::BuildRankSelectIndex). No-op for other modes as they are
+  // already constant time.
+  void BuildRankSelectIndex() {
+    if (mode_ == Mode::kBitVector)
+      bit_vector_.BuildRankSelectIndex();
+  }
+
   // Intersects |other| with |this| writing the result into |this|.
   // By "intersect", we mean to keep only the rows present in both RowMaps. The
   // order of the preserved rows will be the same as |this|.
@@ -403,6 +449,13 @@ class RowMap {
       return;
     }
 
+    if (mode_ == Mode::kBitVector && other.mode_ == Mode::kBitVector) {
+      // If both RowMaps are BitVectors, the intersection is just the bitwise
+      // and of them which we can compute one word at a time.
+      bit_vector_.And(other.bit_vector_);
+      return;
+    }
+
     // TODO(lalitm): improve efficiency of this if we end up needing it.
     Filter([&other](uint32_t row) { return other.Contains(row); });
   }
@@ -472,6 +525,25 @@ class RowMap {
     }
   }
 
+  // Same as |FilterInto| but |p(idx, count)| is called for up to 64
+  // consecutive indices at once and returns a word where bit i indicates
+  // whether |idx + i| should be retained in |out| (bits past |count| should be
+  // zero).
+  //
+  // Precondition: both |this| and |out| should be ranges. This is the common
+  // case of filtering a column of a root table on the first constraint and
+  // allows |p| to work on contiguous batches of indices.
+  template <typename WordPredicate = uint64_t(uint32_t, uint32_t)>
+  void FilterIntoWords(RowMap* out, WordPredicate p) const {
+    PERFETTO_DCHECK(IsRange() && out->IsRange());
+    PERFETTO_DCHECK(size() >= out->size());
+
+    uint32_t start = start_idx_;
+    out->FilterRangeWords([start, &p](uint32_t idx, uint32_t count) {
+      return p(start + idx, count);
+    });
+  }
+
   template <typename Comparator = bool(uint32_t, uint32_t)>
   void StableSort(std::vector<uint32_t>* out, Comparator c) const {
     switch (mode_) {
@@ -502,6 +574,9 @@ class RowMap {
   // Returns if the RowMap is internally represented using a range.
   bool IsRange() const { return mode_ == Mode::kRange; }
 
+  // Returns if the RowMap is internally represented using a BitVector.
+  bool IsBitVector() const { return mode_ == Mode::kBitVector; }
+
  private:
   enum class Mode {
     kRange,
@@ -585,13 +660,17 @@ class RowMap {
     }
   }
 
-  template <typename Predicate>
-  void FilterRange(Predicate p) {
+  // If we are only going to scan fewer rows than this, it's not worth the
+  // hassle of working with a BitVector when filtering a range.
+  static constexpr uint32_t kSmallRangeLimit = 2048;
+
+  // Returns whether filtering this range should produce an index vector
+  // instead of a BitVector.
+  bool ShouldFilterRangeToIndexVector() const {
     uint32_t count = end_idx_ - start_idx_;
 
     // Optimization: if we are only going to scan a few rows, it's not
     // worth the haslle of working with a BitVector.
-    constexpr uint32_t kSmallRangeLimit = 2048;
     bool is_small_range = count < kSmallRangeLimit;
 
     // Optimization: weif the cost of a BitVector is more than the highest
@@ -602,11 +681,18 @@ class RowMap {
     // If either of the conditions hold which make it better to use an
     // index vector, use it instead. Alternatively, if we are optimizing for
     // lookup speed, we also want to use an index vector.
-    if (is_small_range || index_vector_cost_ub <= bit_vector_cost ||
-        optimize_for_ == OptimizeFor::kLookupSpeed) {
+    return is_small_range || index_vector_cost_ub <= bit_vector_cost ||
+           optimize_for_ == OptimizeFor::kLookupSpeed;
+  }
+
+  template <typename Predicate>
+  void FilterRange(Predicate p) {
+    uint32_t count = end_idx_ - start_idx_;
+    if (ShouldFilterRangeToIndexVector()) {
       // Try and strike a good balance between not making the vector too
       // big and good performance.
-      std::vector<uint32_t> iv(std::min(kSmallRangeLimit, count));
+      std::vector<uint32_t> iv(count < kSmallRangeLimit ? count
+                                                        : kSmallRangeLimit);
 
       uint32_t out_idx = 0;
       for (uint32_t i = 0; i < count; ++i) {
@@ -634,6 +720,36 @@ class RowMap {
     *this = RowMap(BitVector::Range(start_idx_, end_idx_, p));
   }
 
+  // Same as |FilterRange| but with |p| computing up to 64 bits at a time (see
+  // |FilterIntoWords|).
+  template <typename WordPredicate>
+  void FilterRangeWords(WordPredicate p) {
+    if (ShouldFilterRangeToIndexVector()) {
+      std::vector<uint32_t> iv(end_idx_ - start_idx_);
+
+      uint32_t out_idx = 0;
+      for (uint32_t i = start_idx_; i < end_idx_; i += 64) {
+        uint32_t count = std::min(64u, end_idx_ - i);
+        uint64_t word = p(i, count);
+
+        // We keep this branch free in the same way as |FilterRange|.
+        for (uint32_t j = 0; j < count; ++j) {
+          iv[out_idx] = i + j;
+          out_idx += (word >> j) & 1u;
+        }
+      }
+
+      // Make the vector the correct size and as small as possible.
+      iv.resize(out_idx);
+      iv.shrink_to_fit();
+
+      *this = RowMap(std::move(iv));
+      return;
+    }
+
+    *this = RowMap(BitVector::RangeWords(start_idx_, end_idx_, p));
+  }
+
   void InsertIntoBitVector(uint32_t row) {
     PERFETTO_DCHECK(mode_ == Mode::kBitVector);
 
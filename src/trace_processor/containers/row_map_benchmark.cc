@@ -213,6 +213,20 @@ static void BM_RowMapSelectIvWithIv(benchmark::State& state) {
 }
 BENCHMARK(BM_RowMapSelectIvWithIv);
 
+static void BM_RowMapIntersectBvWithBv(benchmark::State& state) {
+  RowMap rm(CreateBitVector(kSize));
+  RowMap other(CreateBitVector(kSize));
+  for (auto _ : state) {
+    state.PauseTiming();
+    RowMap copy = rm.Copy();
+    state.ResumeTiming();
+
+    copy.Intersect(other);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_RowMapIntersectBvWithBv);
+
 static void BM_RowMapFilterIntoRangeWithRange(benchmark::State& state) {
   RowMap rm(CreateRange(kSize));
   uint32_t rm_size = rm.size();
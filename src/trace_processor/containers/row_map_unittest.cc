@@ -337,6 +337,16 @@ TEST(RowMapUnittest, IntersectMany) {
   ASSERT_EQ(rm.Get(2u), 3u);
 }
 
+TEST(RowMapUnittest, IntersectBitVectors) {
+  RowMap rm(BitVector{true, false, true, true, false, true, true});
+  rm.Intersect(RowMap(BitVector{true, true, false, true, true, true}));
+
+  ASSERT_EQ(rm.size(), 3u);
+  ASSERT_EQ(rm.Get(0u), 0u);
+  ASSERT_EQ(rm.Get(1u), 3u);
+  ASSERT_EQ(rm.Get(2u), 5u);
+}
+
 TEST(RowMapUnittest, FilterIntoEmptyOutput) {
   RowMap rm(0, 10000);
   RowMap filter(4, 4);
@@ -449,6 +459,34 @@ TEST(RowMapUnittest, FilterIntoIndexVectorWithBitVector) {
   ASSERT_EQ(filter.Get(1u), 3u);
 }
 
+TEST(RowMapUnittest, InsertRange) {
+  RowMap range(1, 5);
+  range.InsertRange(5, 8);
+  ASSERT_EQ(range.size(), 7u);
+  ASSERT_TRUE(range.IsRange());
+  ASSERT_EQ(range.Get(6), 7u);
+
+  // A gap in the range needs a BitVector.
+  range.InsertRange(10, 12);
+  ASSERT_EQ(range.size(), 9u);
+  ASSERT_FALSE(range.Contains(8));
+  ASSERT_EQ(range.Get(7), 10u);
+  ASSERT_EQ(range.Get(8), 11u);
+
+  RowMap bv(BitVector{true, false, true});
+  bv.InsertRange(5, 7);
+  ASSERT_EQ(bv.size(), 4u);
+  ASSERT_FALSE(bv.Contains(4));
+  ASSERT_EQ(bv.Get(2), 5u);
+  ASSERT_EQ(bv.Get(3), 6u);
+
+  RowMap iv(std::vector<uint32_t>{1, 3});
+  iv.InsertRange(4, 6);
+  ASSERT_EQ(iv.size(), 4u);
+  ASSERT_EQ(iv.Get(2), 4u);
+  ASSERT_EQ(iv.Get(3), 5u);
+}
+
 TEST(RowMapUnittest, FilterIntoRangeWithIndexVector) {
   RowMap rm(27, 41);
   RowMap filter(std::vector<uint32_t>{3u, 5u, 9u, 10u, 12u});
@@ -479,6 +517,38 @@ TEST(RowMapUnittest, FilterIntoIndexVectorWithIndexVector) {
   ASSERT_EQ(filter.Get(1u), 3u);
 }
 
+TEST(RowMapUnittest, FilterIntoWordsSmallRange) {
+  RowMap rm(27, 131);
+  RowMap filter(3, 100);
+  rm.FilterIntoWords(&filter, [](uint32_t idx, uint32_t count) {
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < count; ++i)
+      word |= static_cast<uint64_t>((idx + i) % 10 == 0) << i;
+    return word;
+  });
+
+  // Rows 3 to 99 map to indices 30 to 126.
+  ASSERT_EQ(filter.size(), 10u);
+  for (uint32_t i = 0; i < filter.size(); ++i)
+    ASSERT_EQ(filter.Get(i), 3u + i * 10);
+}
+
+TEST(RowMapUnittest, FilterIntoWordsLargeRange) {
+  RowMap rm(5, 100005);
+  RowMap filter(1, 100000);
+  rm.FilterIntoWords(&filter, [](uint32_t idx, uint32_t count) {
+    uint64_t word = 0;
+    for (uint32_t i = 0; i < count; ++i)
+      word |= static_cast<uint64_t>((idx + i) % 2 == 0) << i;
+    return word;
+  });
+
+  // Even indices are odd rows (as the RowMap starts at 5), excluding row 0.
+  ASSERT_EQ(filter.size(), 50000u);
+  ASSERT_EQ(filter.Get(0), 1u);
+  ASSERT_EQ(filter.Get(49999), 99999u);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_SMALL_VECTOR_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_SMALL_VECTOR_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// A vector which stores up to |kInlineCapacity| elements inside the object
+// itself and only allocates memory on the heap when it grows past that.
+//
+// This is useful for vectors which are usually small but are created or
+// pushed to very often (e.g. the per-track stacks of open slices) as it
+// avoids the heap allocations (and the pointer chasing) which std::vector
+// would need.
+//
+// Elements need to be move constructible; unlike std::vector, the elements
+// are always moved (even if their move constructor can throw) when the
+// vector grows.
+template <typename T, size_t kInlineCapacity>
+class SmallVector {
+ public:
+  static_assert(kInlineCapacity > 0, "Inline capacity must be > 0");
+
+  SmallVector() = default;
+
+  ~SmallVector() {
+    clear();
+    FreeHeapStorage();
+  }
+
+  SmallVector(SmallVector&& other) noexcept(
+      std::is_nothrow_move_constructible<T>::value) {
+    MoveFrom(std::move(other));
+  }
+
+  SmallVector& operator=(SmallVector&& other) noexcept(
+      std::is_nothrow_move_constructible<T>::value) {
+    if (this != &other) {
+      clear();
+      FreeHeapStorage();
+      MoveFrom(std::move(other));
+    }
+    return *this;
+  }
+
+  SmallVector(const SmallVector&) = delete;
+  SmallVector& operator=(const SmallVector&) = delete;
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (PERFETTO_UNLIKELY(size_ == capacity_))
+      Grow();
+    T* elem = new (&data()[size_]) T(std::forward<Args>(args)...);
+    size_++;
+    return *elem;
+  }
+
+  void push_back(T value) { emplace_back(std::move(value)); }
+
+  void pop_back() {
+    PERFETTO_DCHECK(size_ > 0);
+    data()[--size_].~T();
+  }
+
+  // Destroys the elements in order, like std::vector.
+  void clear() {
+    T* elems = data();
+    for (size_t i = 0; i < size_; ++i)
+      elems[i].~T();
+    size_ = 0;
+  }
+
+  T& operator[](size_t i) {
+    PERFETTO_DCHECK(i < size_);
+    return data()[i];
+  }
+  const T& operator[](size_t i) const {
+    PERFETTO_DCHECK(i < size_);
+    return data()[i];
+  }
+
+  T& back() { return (*this)[size_ - 1]; }
+  const T& back() const { return (*this)[size_ - 1]; }
+
+  T* begin() { return data(); }
+  T* end() { return data() + size_; }
+  const T* begin() const { return data(); }
+  const T* end() const { return data() + size_; }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  size_t capacity() const { return capacity_; }
+
+  // Returns whether the elements are stored inline (i.e. not on the heap).
+  bool is_inline() const { return !heap_storage_; }
+
+ private:
+  using Storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+  T* data() {
+    return reinterpret_cast<T*>(heap_storage_ ? heap_storage_.get()
+                                              : inline_storage_);
+  }
+  const T* data() const {
+    return reinterpret_cast<const T*>(heap_storage_ ? heap_storage_.get()
+                                                    : inline_storage_);
+  }
+
+  void Grow() {
+    size_t new_capacity = capacity_ * 2;
+    std::unique_ptr<Storage[]> new_storage(new Storage[new_capacity]);
+    T* new_data = reinterpret_cast<T*>(new_storage.get());
+    T* old_data = data();
+    for (size_t i = 0; i < size_; ++i) {
+      new (&new_data[i]) T(std::move(old_data[i]));
+      old_data[i].~T();
+    }
+    heap_storage_ = std::move(new_storage);
+    capacity_ = new_capacity;
+  }
+
+  void FreeHeapStorage() {
+    heap_storage_.reset();
+    capacity_ = kInlineCapacity;
+  }
+
+  // Requires |this| to be empty and to use the inline storage.
+  void MoveFrom(SmallVector&& other) {
+    if (other.heap_storage_) {
+      heap_storage_ = std::move(other.heap_storage_);
+      capacity_ = other.capacity_;
+      size_ = other.size_;
+    } else {
+      for (size_t i = 0; i < other.size_; ++i)
+        new (&data()[i]) T(std::move(other.data()[i]));
+      size_ = other.size_;
+      other.clear();
+    }
+    other.size_ = 0;
+    other.capacity_ = kInlineCapacity;
+  }
+
+  Storage inline_storage_[kInlineCapacity];
+  std::unique_ptr<Storage[]> heap_storage_;
+  size_t size_ = 0;
+  size_t capacity_ = kInlineCapacity;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_SMALL_VECTOR_H_
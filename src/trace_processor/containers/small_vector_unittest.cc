@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/small_vector.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(SmallVectorUnittest, InlineAndHeap) {
+  SmallVector<int, 4> vec;
+  ASSERT_TRUE(vec.empty());
+
+  for (int i = 0; i < 4; ++i)
+    vec.push_back(i);
+  ASSERT_TRUE(vec.is_inline());
+  ASSERT_EQ(vec.size(), 4u);
+
+  vec.emplace_back(4);
+  ASSERT_FALSE(vec.is_inline());
+  ASSERT_EQ(vec.size(), 5u);
+  for (int i = 0; i < 5; ++i)
+    ASSERT_EQ(vec[static_cast<size_t>(i)], i);
+  ASSERT_EQ(vec.back(), 4);
+
+  vec.pop_back();
+  ASSERT_EQ(vec.back(), 3);
+  ASSERT_EQ(std::vector<int>(vec.begin(), vec.end()),
+            std::vector<int>({0, 1, 2, 3}));
+
+  vec.clear();
+  ASSERT_TRUE(vec.empty());
+}
+
+TEST(SmallVectorUnittest, NonTrivialElements) {
+  auto counter = std::make_shared<int>(0);
+  {
+    SmallVector<std::shared_ptr<int>, 2> vec;
+    for (int i = 0; i < 10; ++i)
+      vec.push_back(counter);
+    ASSERT_EQ(counter.use_count(), 11);
+
+    vec.pop_back();
+    ASSERT_EQ(counter.use_count(), 10);
+  }
+  ASSERT_EQ(counter.use_count(), 1);
+}
+
+TEST(SmallVectorUnittest, Move) {
+  SmallVector<std::string, 2> inline_vec;
+  inline_vec.emplace_back("a");
+  SmallVector<std::string, 2> moved_inline(std::move(inline_vec));
+  ASSERT_TRUE(inline_vec.empty());
+  ASSERT_EQ(moved_inline.size(), 1u);
+  ASSERT_EQ(moved_inline[0], "a");
+
+  SmallVector<std::string, 2> heap_vec;
+  for (int i = 0; i < 5; ++i)
+    heap_vec.emplace_back(std::to_string(i));
+  SmallVector<std::string, 2> moved_heap;
+  moved_heap = std::move(heap_vec);
+  ASSERT_TRUE(heap_vec.empty());
+  ASSERT_TRUE(heap_vec.is_inline());
+  ASSERT_EQ(moved_heap.size(), 5u);
+  ASSERT_EQ(moved_heap[4], "4");
+
+  // The moved from vectors can be reused.
+  heap_vec.emplace_back("b");
+  ASSERT_EQ(heap_vec[0], "b");
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/containers/spill_file.h"
+
+#include <string>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/utils.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
+#define PERFETTO_HAS_MMAP() 1
+#else
+#define PERFETTO_HAS_MMAP() 0
+#endif
+
+#if PERFETTO_HAS_MMAP()
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+
+SpilledRegion::SpilledRegion(void* addr, size_t size)
+    : addr_(addr), size_(size) {}
+
+SpilledRegion::~SpilledRegion() {
+#if PERFETTO_HAS_MMAP()
+  munmap(addr_, size_);
+#endif
+}
+
+SpillFile::SpillFile(base::ScopedFile fd) : fd_(std::move(fd)) {}
+SpillFile::~SpillFile() = default;
+
+// static
+std::unique_ptr<SpillFile> SpillFile::Create() {
+#if PERFETTO_HAS_MMAP()
+  std::string path = base::GetSysTempDir() + "/perfetto-spill-XXXXXXXX";
+  base::ScopedFile fd(mkstemp(&path[0]));
+  if (!fd) {
+    PERFETTO_PLOG("Failed to create spill file %s", path.c_str());
+    return nullptr;
+  }
+  // Unlink the file straight away so it's removed even if we crash; the
+  // mappings keep the data alive until they are destroyed.
+  unlink(path.c_str());
+  return std::unique_ptr<SpillFile>(new SpillFile(std::move(fd)));
+#else
+  return nullptr;
+#endif
+}
+
+std::unique_ptr<SpilledRegion> SpillFile::Spill(const void* data,
+                                                size_t size) {
+#if PERFETTO_HAS_MMAP()
+  if (size == 0)
+    return nullptr;
+
+  const char* ptr = static_cast<const char*>(data);
+  uint64_t offset = size_;
+  for (size_t written = 0; written < size;) {
+    ssize_t res =
+        PERFETTO_EINTR(pwrite(*fd_, ptr + written, size - written,
+                              static_cast<off_t>(offset + written)));
+    if (res <= 0) {
+      PERFETTO_PLOG("Failed to write to spill file");
+      return nullptr;
+    }
+    written += static_cast<size_t>(res);
+  }
+
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, *fd_,
+                    static_cast<off_t>(offset));
+  if (addr == MAP_FAILED) {
+    PERFETTO_PLOG("Failed to map spill file");
+    return nullptr;
+  }
+
+  uint64_t page_size = base::GetSysPageSize();
+  size_ = offset + (size + page_size - 1) / page_size * page_size;
+  return std::unique_ptr<SpilledRegion>(new SpilledRegion(addr, size));
+#else
+  base::ignore_result(data, size);
+  return nullptr;
+#endif
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CONTAINERS_SPILL_FILE_H_
+#define SRC_TRACE_PROCESSOR_CONTAINERS_SPILL_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "perfetto/ext/base/scoped_file.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// A read-only mapping of a region of a SpillFile. The mapping stays valid
+// after the SpillFile it was created from is destroyed.
+class SpilledRegion {
+ public:
+  SpilledRegion(void* addr, size_t size);
+  ~SpilledRegion();
+
+  SpilledRegion(const SpilledRegion&) = delete;
+  SpilledRegion& operator=(const SpilledRegion&) = delete;
+
+  const void* data() const { return addr_; }
+  size_t size() const { return size_; }
+
+ private:
+  void* const addr_;
+  const size_t size_;
+};
+
+// An unlinked temporary file to which immutable data can be moved once a
+// trace is loaded to reduce the memory usage of trace processor.
+//
+// The data written to the file is mapped back in memory read-only: as these
+// pages are backed by the file, the kernel can drop them when under memory
+// pressure (and read them back from disk on the next access) instead of
+// keeping them resident as it has to do for heap memory.
+class SpillFile {
+ public:
+  // Creates a new spill file in the system temporary directory (see
+  // base::GetSysTempDir). Returns nullptr if the file cannot be created or if
+  // memory mapped files are not supported on this platform (e.g. Windows and
+  // WASM).
+  static std::unique_ptr<SpillFile> Create();
+
+  ~SpillFile();
+
+  // Appends the |size| bytes starting at |data| to the file and returns a
+  // read-only mapping of them. Returns nullptr if writing or mapping the data
+  // failed (e.g. because the disk is full).
+  std::unique_ptr<SpilledRegion> Spill(const void* data, size_t size);
+
+  // Returns the number of bytes written to the file so far.
+  uint64_t size() const { return size_; }
+
+ private:
+  explicit SpillFile(base::ScopedFile fd);
+
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+
+  base::ScopedFile fd_;
+
+  // Always a multiple of the page size as mappings have to start on a page
+  // boundary.
+  uint64_t size_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CONTAINERS_SPILL_FILE_H_
@@ -38,61 +38,187 @@ constexpr size_t StringPool::kBlockIndexBitMask;
 constexpr size_t StringPool::kBlockSizeBytes;
 // static
 constexpr size_t StringPool::kMinLargeStringSizeBytes;
+// static
+constexpr uint32_t StringPool::kMaxBlocks;
+// static
+constexpr uint32_t StringPool::kNoBlock;
+// static
+constexpr uint32_t StringPool::kInitialIndexCapacity;
+
+StringPool::StringPool() : StringPool(1) {}
 
-StringPool::StringPool() {
+StringPool::StringPool(uint32_t num_shards)
+    : num_shards_(num_shards), shards_(new Shard[num_shards]) {
   static_assert(
       StringPool::kMinLargeStringSizeBytes <= StringPool::kBlockSizeBytes + 1,
       "minimum size of large strings must be small enough to support any "
       "string that doesn't fit in a Block.");
+  PERFETTO_CHECK(num_shards > 0 && (num_shards & (num_shards - 1)) == 0);
 
-  blocks_.emplace_back(kBlockSizeBytes);
+  for (uint32_t i = 0; i < num_shards_; ++i) {
+    Shard& shard = shards_[i];
+    shard.tables.emplace_back(new IndexTable(kInitialIndexCapacity));
+    shard.index.store(shard.tables.back().get(), std::memory_order_release);
+  }
 
-  // Reserve a slot for the null string.
-  PERFETTO_CHECK(blocks_.back().TryInsert(NullTermStringView()).first);
+  // Reserve a slot for the null string in the first block; the first shard
+  // will keep inserting into this block.
+  uint32_t block_index = AllocateBlock();
+  PERFETTO_CHECK(blocks_[block_index]->TryInsert(NullTermStringView()).first);
+  shards_[0].block_index = block_index;
 }
 
 StringPool::~StringPool() = default;
 
-StringPool::StringPool(StringPool&&) = default;
-StringPool& StringPool::operator=(StringPool&&) = default;
+StringPool::StringPool(StringPool&& other) noexcept {
+  *this = std::move(other);
+}
+
+StringPool& StringPool::operator=(StringPool&& other) noexcept {
+  num_shards_ = other.num_shards_;
+  shards_ = std::move(other.shards_);
+  blocks_ = std::move(other.blocks_);
+  for (uint32_t i = 0; i < kMaxBlocks; ++i) {
+    block_data_[i].store(other.block_data_[i].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+    other.block_data_[i].store(nullptr, std::memory_order_relaxed);
+  }
+  num_blocks_.store(other.num_blocks_.load(std::memory_order_relaxed),
+                    std::memory_order_release);
+  other.num_blocks_.store(0, std::memory_order_relaxed);
+  large_strings_ = std::move(other.large_strings_);
+  return *this;
+}
+
+size_t StringPool::size() const {
+  size_t size = 0;
+  for (uint32_t i = 0; i < num_shards_; ++i)
+    size += shards_[i].size.load(std::memory_order_relaxed);
+  return size;
+}
+
+StringPool::MemoryUsage StringPool::GetMemoryUsage() const {
+  MemoryUsage usage;
+  for (uint32_t i = 0; i < num_shards_; ++i) {
+    Shard& shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto& table : shard.tables)
+      usage.index_bytes += table->capacity() * sizeof(IndexTable::Slot);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (uint32_t i = 0; i < num_blocks(); ++i)
+    usage.blocks_bytes += blocks_[i]->pos();
+  for (const auto& str : large_strings_)
+    usage.large_strings_bytes += str->capacity();
+  return usage;
+}
+
+StringPool::Id StringPool::InsertString(Shard* shard,
+                                        base::StringView str,
+                                        uint64_t hash) {
+  std::lock_guard<std::mutex> lock(shard->mutex);
+
+  // Another thread could have inserted the string between our lookup and us
+  // taking the lock.
+  Id existing_id = Find(*shard, hash);
+  if (!existing_id.is_null())
+    return existing_id;
+
+  if (PERFETTO_UNLIKELY(shard->block_index == kNoBlock))
+    shard->block_index = AllocateBlock();
 
-StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
   // Try and find enough space in the current block for the string and the
   // metadata (varint-encoded size + the string data + the null terminator).
-  bool success;
-  uint32_t offset;
-  std::tie(success, offset) = blocks_.back().TryInsert(str);
+  bool success = false;
+  uint32_t offset = 0;
+  if (PERFETTO_LIKELY(shard->block_index != kNoBlock))
+    std::tie(success, offset) = blocks_[shard->block_index]->TryInsert(str);
   if (PERFETTO_UNLIKELY(!success)) {
     // The block did not have enough space for the string. If the string is
     // large, add it into the |large_strings_| vector, to avoid discarding a
     // large portion of the current block's memory. This also enables us to
     // support strings that wouldn't fit into a single block. Otherwise, add a
-    // new block to store the string.
-    if (str.size() + kMaxMetadataSize >= kMinLargeStringSizeBytes) {
-      return InsertLargeString(str, hash);
+    // new block to store the string (or fall back to |large_strings_| if
+    // we ran out of blocks).
+    uint32_t block_index = kNoBlock;
+    if (str.size() + kMaxMetadataSize < kMinLargeStringSizeBytes)
+      block_index = AllocateBlock();
+
+    Id string_id;
+    if (block_index == kNoBlock) {
+      string_id = InsertLargeString(str);
     } else {
-      blocks_.emplace_back(kBlockSizeBytes);
-    }
+      shard->block_index = block_index;
 
-    // Try and reserve space again - this time we should definitely succeed.
-    std::tie(success, offset) = blocks_.back().TryInsert(str);
-    PERFETTO_CHECK(success);
+      // Try and reserve space again - this time we should definitely succeed.
+      std::tie(success, offset) = blocks_[block_index]->TryInsert(str);
+      PERFETTO_CHECK(success);
+      string_id = Id::BlockString(block_index, offset);
+    }
+    AddToIndex(shard, hash, string_id);
+    return string_id;
   }
 
   // Compute the id from the block index and offset and add a mapping from the
   // hash to the id.
-  Id string_id = Id::BlockString(blocks_.size() - 1, offset);
-  string_index_.emplace(hash, string_id);
+  Id string_id = Id::BlockString(shard->block_index, offset);
+  AddToIndex(shard, hash, string_id);
   return string_id;
 }
 
-StringPool::Id StringPool::InsertLargeString(base::StringView str,
-                                             uint64_t hash) {
+StringPool::Id StringPool::InsertLargeString(base::StringView str) {
+  std::lock_guard<std::mutex> lock(mutex_);
   large_strings_.emplace_back(new std::string(str.begin(), str.size()));
-  // Compute id from the index and add a mapping from the hash to the id.
-  Id string_id = Id::LargeString(large_strings_.size() - 1);
-  string_index_.emplace(hash, string_id);
-  return string_id;
+  return Id::LargeString(large_strings_.size() - 1);
+}
+
+uint32_t StringPool::AllocateBlock() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint32_t block_index = num_blocks_.load(std::memory_order_relaxed);
+  if (block_index == kMaxBlocks)
+    return kNoBlock;
+
+  blocks_[block_index].reset(new Block(kBlockSizeBytes));
+  block_data_[block_index].store(blocks_[block_index]->Get(0),
+                                 std::memory_order_release);
+  num_blocks_.store(block_index + 1, std::memory_order_release);
+  return block_index;
+}
+
+// static
+void StringPool::AddToIndex(Shard* shard, StringHash hash, Id id) {
+  PERFETTO_DCHECK(!id.is_null());
+
+  const IndexTable* table = shard->tables.back().get();
+  uint32_t size = shard->size.load(std::memory_order_relaxed);
+  if ((size + 1) * 2 > table->capacity()) {
+    // Build the new table fully before publishing it so readers always see a
+    // complete index.
+    std::unique_ptr<IndexTable> grown(new IndexTable(table->capacity() * 2));
+    for (uint32_t i = 0; i < table->capacity(); ++i) {
+      const IndexTable::Slot& slot = table->slots[i];
+      uint32_t raw_id = slot.raw_id.load(std::memory_order_relaxed);
+      if (raw_id == 0)
+        continue;
+      StringHash slot_hash = slot.hash.load(std::memory_order_relaxed);
+      uint32_t j = SlotForHash(*grown, slot_hash);
+      while (grown->slots[j].raw_id.load(std::memory_order_relaxed) != 0)
+        j = (j + 1) & grown->mask;
+      grown->slots[j].hash.store(slot_hash, std::memory_order_relaxed);
+      grown->slots[j].raw_id.store(raw_id, std::memory_order_relaxed);
+    }
+    table = grown.get();
+    shard->tables.emplace_back(std::move(grown));
+    shard->index.store(table, std::memory_order_release);
+  }
+
+  uint32_t i = SlotForHash(*table, hash);
+  while (table->slots[i].raw_id.load(std::memory_order_relaxed) != 0)
+    i = (i + 1) & table->mask;
+  table->slots[i].hash.store(hash, std::memory_order_relaxed);
+  table->slots[i].raw_id.store(id.raw_id(), std::memory_order_release);
+  shard->size.store(size + 1, std::memory_order_relaxed);
 }
 
 std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
@@ -122,7 +248,7 @@ std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
   *(end++) = '\0';
 
   // Update the end of the block and return the pointer to the string.
-  pos_ = OffsetOf(end);
+  pos_.store(OffsetOf(end), std::memory_order_relaxed);
 
   return std::make_pair(true, offset);
 }
@@ -130,9 +256,9 @@ std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
 StringPool::Iterator::Iterator(const StringPool* pool) : pool_(pool) {}
 
 StringPool::Iterator& StringPool::Iterator::operator++() {
-  if (block_index_ < pool_->blocks_.size()) {
+  if (block_index_ < pool_->num_blocks()) {
     // Try and go to the next string in the current block.
-    const auto& block = pool_->blocks_[block_index_];
+    const Block& block = *pool_->blocks_[block_index_];
 
     // Find the size of the string at the current offset in the block
     // and increment the offset by that size.
@@ -158,7 +284,7 @@ StringPool::Iterator& StringPool::Iterator::operator++() {
 }
 
 StringPool::Iterator::operator bool() const {
-  return block_index_ < pool_->blocks_.size() ||
+  return block_index_ < pool_->num_blocks() ||
          large_strings_index_ < pool_->large_strings_.size();
 }
 
@@ -167,8 +293,8 @@ NullTermStringView StringPool::Iterator::StringView() {
 }
 
 StringPool::Id StringPool::Iterator::StringId() {
-  if (block_index_ < pool_->blocks_.size()) {
-    PERFETTO_DCHECK(block_offset_ < pool_->blocks_[block_index_].pos());
+  if (block_index_ < pool_->num_blocks()) {
+    PERFETTO_DCHECK(block_offset_ < pool_->blocks_[block_index_]->pos());
 
     // If we're at (0, 0), we have the null string which has id 0.
     if (block_index_ == 0 && block_offset_ == 0)
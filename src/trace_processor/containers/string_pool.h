@@ -20,8 +20,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <array>
+#include <atomic>
 #include <limits>
-#include <unordered_map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "perfetto/ext/base/optional.h"
@@ -34,6 +37,14 @@ namespace trace_processor {
 
 // Interns strings in a string pool and hands out compact StringIds which can
 // be used to retrieve the string in O(1).
+//
+// InternString(), GetId() and Get() are thread-safe. Looking up a string
+// which is already interned never takes a lock: only inserting a new string
+// does. To reduce contention when many threads insert at the same time, the
+// pool can be split into shards (see StringPool(uint32_t)): each shard has its
+// own index, lock and blocks of string memory. Ids are stable and valid across
+// all shards. Iterating, serializing and moving the pool are *not*
+// thread-safe and must not happen concurrently with interning.
 class StringPool {
  public:
   struct Id {
@@ -102,12 +113,20 @@ class StringPool {
     uint32_t large_strings_index_ = 0;
   };
 
+  // Creates a pool with a single shard.
   StringPool();
+
+  // Creates a pool with |num_shards| shards; |num_shards| must be a power of
+  // two. Strings are assigned to shards by hash so, while every shard needs
+  // its own block, concurrent inserts only contend if they land in the same
+  // shard.
+  explicit StringPool(uint32_t num_shards);
+
   ~StringPool();
 
   // Allow std::move().
-  StringPool(StringPool&&);
-  StringPool& operator=(StringPool&&);
+  StringPool(StringPool&&) noexcept;
+  StringPool& operator=(StringPool&&) noexcept;
 
   // Disable implicit copy.
   StringPool(const StringPool&) = delete;
@@ -118,12 +137,13 @@ class StringPool {
       return Id::Null();
 
     auto hash = str.Hash();
-    auto id_it = string_index_.find(hash);
-    if (id_it != string_index_.end()) {
-      PERFETTO_DCHECK(Get(id_it->second) == str);
-      return id_it->second;
+    Shard& shard = ShardForHash(hash);
+    Id id = Find(shard, hash);
+    if (!id.is_null()) {
+      PERFETTO_DCHECK(Get(id) == str);
+      return id;
     }
-    return InsertString(str, hash);
+    return InsertString(&shard, str, hash);
   }
 
   base::Optional<Id> GetId(base::StringView str) const {
@@ -131,10 +151,10 @@ class StringPool {
       return Id::Null();
 
     auto hash = str.Hash();
-    auto id_it = string_index_.find(hash);
-    if (id_it != string_index_.end()) {
-      PERFETTO_DCHECK(Get(id_it->second) == str);
-      return id_it->second;
+    Id id = Find(ShardForHash(hash), hash);
+    if (!id.is_null()) {
+      PERFETTO_DCHECK(Get(id) == str);
+      return id;
     }
     return base::nullopt;
   }
@@ -149,7 +169,17 @@ class StringPool {
 
   Iterator CreateIterator() const { return Iterator(this); }
 
-  size_t size() const { return string_index_.size(); }
+  size_t size() const;
+
+  // The number of bytes of memory used by the different parts of the pool.
+  struct MemoryUsage {
+    // The strings stored in blocks (i.e. not large strings).
+    size_t blocks_bytes = 0;
+    size_t large_strings_bytes = 0;
+    // The hash tables mapping strings to Ids, including the retired ones.
+    size_t index_bytes = 0;
+  };
+  MemoryUsage GetMemoryUsage() const;
 
  private:
   using StringHash = uint64_t;
@@ -161,11 +191,7 @@ class StringPool {
           size_(size) {}
     ~Block() = default;
 
-    // Allow std::move().
-    Block(Block&&) noexcept = default;
-    Block& operator=(Block&&) = default;
-
-    // Disable implicit copy.
+    // Blocks are never moved as other threads can be reading from them.
     Block(const Block&) = delete;
     Block& operator=(const Block&) = delete;
 
@@ -182,14 +208,56 @@ class StringPool {
       return static_cast<uint32_t>(ptr - Get(0));
     }
 
-    uint32_t pos() const { return pos_; }
+    // Only written by the thread holding the lock of the shard owning the
+    // block but read without it by DCHECKs on other threads.
+    uint32_t pos() const { return pos_.load(std::memory_order_relaxed); }
 
    private:
     base::PagedMemory mem_;
-    uint32_t pos_ = 0;
+    std::atomic<uint32_t> pos_{0};
     size_t size_ = 0;
   };
 
+  // An open addressing (linear probing) hash table mapping string hashes to
+  // Ids which can be read without any locking. Slots are written at most once
+  // (under the lock of the owning shard): the hash is written first and the
+  // Id is then published with release semantics so readers which see a
+  // non-null Id also see its hash.
+  struct IndexTable {
+    struct Slot {
+      std::atomic<StringHash> hash;
+      std::atomic<uint32_t> raw_id;
+    };
+
+    explicit IndexTable(uint32_t capacity)
+        : mask(capacity - 1), slots(new Slot[capacity]()) {}
+
+    uint32_t capacity() const { return mask + 1; }
+
+    const uint32_t mask;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  struct Shard {
+    // Guards all inserts into the shard.
+    std::mutex mutex;
+
+    // The current index of the shard.
+    std::atomic<const IndexTable*> index{nullptr};
+
+    // All the index tables ever created for this shard: the last one is the
+    // current one. Old tables are retired when the index grows but are kept
+    // alive as concurrent readers may still be probing them.
+    std::vector<std::unique_ptr<IndexTable>> tables;
+
+    // Number of strings in the shard.
+    std::atomic<uint32_t> size{0};
+
+    // The index of the block new strings in this shard are inserted into or
+    // kNoBlock if this shard doesn't have a block yet.
+    uint32_t block_index = kNoBlock;
+  };
+
   friend class Iterator;
   friend class StringPoolTest;
 
@@ -213,6 +281,15 @@ class StringPool {
 
   static constexpr size_t kBlockSizeBytes = kBlockOffsetBitMask + 1;  // 32 MB
 
+  // Maximum number of blocks which can be addressed by an Id. Once all of
+  // them are in use, every new string is stored as a large string.
+  static constexpr uint32_t kMaxBlocks = 1u << kNumBlockIndexBits;
+  static constexpr uint32_t kNoBlock = std::numeric_limits<uint32_t>::max();
+
+  // Initial number of slots in the index of each shard. The index is doubled
+  // whenever it becomes half full.
+  static constexpr uint32_t kInitialIndexCapacity = 1024;
+
   // If a string doesn't fit into the current block, we can either start a new
   // block or insert the string into the |large_strings_| vector. To maximize
   // the used proportion of each block's memory, we only start a new block if
@@ -224,11 +301,49 @@ class StringPool {
   // plus 1 byte for null terminator. The actual size may be lower.
   static constexpr uint8_t kMaxMetadataSize = 6;
 
-  // Inserts the string with the given hash into the pool and return its Id.
-  Id InsertString(base::StringView, uint64_t hash);
+  Shard& ShardForHash(StringHash hash) const {
+    // The top bits are used to pick the shard and the bottom bits to pick
+    // the slot in the index so the two are independent.
+    return shards_[static_cast<uint32_t>(hash >> 32) & (num_shards_ - 1)];
+  }
+
+  static uint32_t SlotForHash(const IndexTable& table, StringHash hash) {
+    return static_cast<uint32_t>(hash ^ (hash >> 32)) & table.mask;
+  }
+
+  // Returns the Id of the string with the given hash or the null Id if there
+  // is no such string in |shard|. Does not take any lock.
+  static Id Find(const Shard& shard, StringHash hash) {
+    const IndexTable* table = shard.index.load(std::memory_order_acquire);
+    for (uint32_t i = SlotForHash(*table, hash);; i = (i + 1) & table->mask) {
+      const IndexTable::Slot& slot = table->slots[i];
+      uint32_t raw_id = slot.raw_id.load(std::memory_order_acquire);
+      if (raw_id == 0)
+        return Id::Null();
+      if (slot.hash.load(std::memory_order_relaxed) == hash)
+        return Id::Raw(raw_id);
+    }
+  }
+
+  // Inserts the string with the given hash into |shard| (unless another
+  // thread beat us to it) and returns its Id.
+  Id InsertString(Shard* shard, base::StringView, uint64_t hash);
+
+  // Insert a large string into the pool and return its Id. Does not update
+  // the index.
+  Id InsertLargeString(base::StringView);
+
+  // Allocates a new block and returns its index or kNoBlock if all the blocks
+  // are in use.
+  uint32_t AllocateBlock();
 
-  // Insert a large string into the pool and return its Id.
-  Id InsertLargeString(base::StringView, uint64_t hash);
+  // Adds a mapping from |hash| to |id| in the index of |shard|, growing the
+  // index if necessary. Must be called with the lock of |shard| held.
+  static void AddToIndex(Shard* shard, StringHash hash, Id id);
+
+  uint32_t num_blocks() const {
+    return num_blocks_.load(std::memory_order_acquire);
+  }
 
   // The returned pointer points to the start of the string metadata (i.e. the
   // first byte of the size).
@@ -240,10 +355,11 @@ class StringPool {
     size_t block_index = id.block_index();
     uint32_t block_offset = id.block_offset();
 
-    PERFETTO_DCHECK(block_index < blocks_.size());
-    PERFETTO_DCHECK(block_offset < blocks_[block_index].pos());
+    PERFETTO_DCHECK(block_index < num_blocks());
+    PERFETTO_DCHECK(block_offset < blocks_[block_index]->pos());
 
-    return blocks_[block_index].Get(block_offset);
+    return block_data_[block_index].load(std::memory_order_acquire) +
+           block_offset;
   }
 
   // |ptr| should point to the start of the string metadata (i.e. the first byte
@@ -272,23 +388,36 @@ class StringPool {
   NullTermStringView GetLargeString(Id id) const {
     PERFETTO_DCHECK(id.is_large_string());
     size_t index = id.large_string_index();
-    PERFETTO_DCHECK(index < large_strings_.size());
-    const std::string* str = large_strings_[index].get();
+    const std::string* str;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      PERFETTO_DCHECK(index < large_strings_.size());
+      str = large_strings_[index].get();
+    }
     return NullTermStringView(str->c_str(), str->size());
   }
 
-  // The actual memory storing the strings.
-  std::vector<Block> blocks_;
+  uint32_t num_shards_ = 0;
+  std::unique_ptr<Shard[]> shards_;
+
+  // The actual memory storing the strings. Each slot is only written once,
+  // when the block is allocated.
+  std::array<std::unique_ptr<Block>, kMaxBlocks> blocks_;
+
+  // The start of the memory of each Block in |blocks_|: this allows Get() to
+  // find a string without having to go through the Block.
+  std::array<std::atomic<uint8_t*>, kMaxBlocks> block_data_{};
+
+  // Number of blocks in |blocks_|.
+  std::atomic<uint32_t> num_blocks_{0};
+
+  // Guards |large_strings_| and the allocation of new blocks.
+  mutable std::mutex mutex_;
 
   // Any string that is too large to fit into a Block is stored separately
   // (inside a unique_ptr to ensure any references to it remain valid even if
   // |large_strings_| is resized).
   std::vector<std::unique_ptr<std::string>> large_strings_;
-
-  // Maps hashes of strings to the Id in the string pool.
-  // TODO(lalitm): At some point we should benchmark just using a static
-  // hashtable of 1M elements, we can afford paying a fixed 8MB here
-  std::unordered_map<StringHash, Id> string_index_;
 };
 
 }  // namespace trace_processor
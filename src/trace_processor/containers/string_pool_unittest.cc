@@ -18,6 +18,7 @@
 
 #include <array>
 #include <random>
+#include <thread>
 
 #include "test/gtest_and_gmock.h"
 
@@ -197,6 +198,73 @@ TEST_F(StringPoolTest, BigString) {
   }
 }
 
+TEST_F(StringPoolTest, ShardedPool) {
+  StringPool pool(8);
+  std::vector<StringPool::Id> ids;
+  for (int i = 0; i < 10000; ++i)
+    ids.push_back(pool.InternString(base::StringView(std::to_string(i))));
+  ASSERT_EQ(pool.size(), 10000u);
+
+  for (int i = 0; i < 10000; ++i) {
+    std::string str = std::to_string(i);
+    ASSERT_EQ(pool.Get(ids[static_cast<size_t>(i)]), base::StringView(str));
+    ASSERT_EQ(pool.InternString(base::StringView(str)),
+              ids[static_cast<size_t>(i)]);
+  }
+
+  // Iterating should go through the blocks of every shard.
+  size_t count = 0;
+  for (auto it = pool.CreateIterator(); it; ++it) {
+    if (!it.StringId().is_null())
+      count++;
+  }
+  ASSERT_EQ(count, 10000u);
+}
+
+TEST_F(StringPoolTest, ConcurrentIntern) {
+  constexpr uint32_t kThreads = 4;
+  constexpr uint32_t kStrings = 20000;
+  StringPool pool(4);
+
+  // Every thread interns the same strings (starting at a different point) so
+  // that both lookups and inserts race with each other.
+  std::array<std::vector<StringPool::Id>, kThreads> ids;
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&pool, &ids, t] {
+      ids[t].resize(kStrings);
+      for (uint32_t i = 0; i < kStrings; ++i) {
+        uint32_t idx = (i + t * kStrings / kThreads) % kStrings;
+        std::string str = "str" + std::to_string(idx);
+        StringPool::Id id = pool.InternString(base::StringView(str));
+        ids[t][idx] = id;
+        ASSERT_EQ(pool.Get(id), base::StringView(str));
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  ASSERT_EQ(pool.size(), kStrings);
+  for (uint32_t t = 1; t < kThreads; ++t)
+    ASSERT_EQ(ids[t], ids[0]);
+}
+
+TEST_F(StringPoolTest, MemoryUsage) {
+  StringPool::MemoryUsage empty = pool_.GetMemoryUsage();
+  ASSERT_EQ(empty.large_strings_bytes, 0u);
+  ASSERT_GT(empty.index_bytes, 0u);
+
+  pool_.InternString("small string");
+  // Strings which don't fit in a block are stored separately.
+  std::string big_string(kBlockSizeBytes, 'a');
+  pool_.InternString(base::StringView(big_string));
+
+  StringPool::MemoryUsage usage = pool_.GetMemoryUsage();
+  ASSERT_GE(usage.blocks_bytes, empty.blocks_bytes + strlen("small string"));
+  ASSERT_GE(usage.large_strings_bytes, big_string.size());
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -16,11 +16,46 @@
 
 #include "src/trace_processor/db/column.h"
 
+#include <algorithm>
+
 #include "src/trace_processor/db/compare.h"
+#include "src/trace_processor/db/glob_matcher.h"
 #include "src/trace_processor/db/table.h"
 
 namespace perfetto {
 namespace trace_processor {
+namespace {
+
+// Creates a BitVector with |size| bits where the bits set are the ones set in
+// |words| (64 bits per word). This is much faster than calling
+// BitVector::Set for each bit as that has to update the count of set bits of
+// all the following blocks.
+BitVector BitVectorFromWords(uint32_t size,
+                             const std::vector<uint64_t>& words) {
+  return BitVector::RangeWords(0, size, [&words](uint32_t idx, uint32_t) {
+    return words[idx / 64];
+  });
+}
+
+// The number of rows compared as a single batch by the batch filter methods.
+// This matches the number of bits in a BitVector word.
+constexpr uint32_t kFilterBatchSize = 64;
+
+// Returns a word with bit i set iff |cmp(values[i], value)| is true.
+//
+// This is deliberately written as a fixed size loop without any branches so
+// the compiler is able to vectorize it (e.g. using AVX2 or NEON if they are
+// enabled for the target).
+template <typename T, typename V, typename Comparator>
+uint64_t CompareBatch(const T* values, V value, Comparator cmp) {
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < kFilterBatchSize; ++i) {
+    word |= static_cast<uint64_t>(cmp(static_cast<V>(values[i]), value)) << i;
+  }
+  return word;
+}
+
+}  // namespace
 
 Column::Column(const Column& column,
                Table* table,
@@ -33,7 +68,8 @@ Column::Column(const Column& column,
              col_idx,
              row_map_idx,
              column.nullable_vector_,
-             column.owned_nullable_vector_) {}
+             column.owned_nullable_vector_,
+             column.eq_index_) {}
 
 Column::Column(const char* name,
                ColumnType type,
@@ -42,7 +78,8 @@ Column::Column(const char* name,
                uint32_t col_idx_in_table,
                uint32_t row_map_idx,
                NullableVectorBase* nv,
-               std::shared_ptr<NullableVectorBase> owned_nullable_vector)
+               std::shared_ptr<NullableVectorBase> owned_nullable_vector,
+               std::shared_ptr<EqIndex> eq_index)
     : owned_nullable_vector_(owned_nullable_vector),
       type_(type),
       nullable_vector_(nv),
@@ -51,7 +88,8 @@ Column::Column(const char* name,
       table_(table),
       col_idx_in_table_(col_idx_in_table),
       row_map_idx_(row_map_idx),
-      string_pool_(table->string_pool_) {
+      string_pool_(table->string_pool_),
+      eq_index_(std::move(eq_index)) {
   switch (type_) {
     case ColumnType::kInt32:
       PERFETTO_CHECK(nullable_vector<int32_t>().IsDense() == IsDense());
@@ -75,7 +113,7 @@ Column::Column(const char* name,
 
 Column Column::IdColumn(Table* table, uint32_t col_idx, uint32_t row_map_idx) {
   return Column("id", ColumnType::kId, kIdFlags, table, col_idx, row_map_idx,
-                nullptr, nullptr);
+                nullptr, nullptr, nullptr);
 }
 
 void Column::StableSort(bool desc, std::vector<uint32_t>* idx) const {
@@ -86,6 +124,372 @@ void Column::StableSort(bool desc, std::vector<uint32_t>* idx) const {
   }
 }
 
+bool Column::CanUseEqIndex() const {
+  if (!eq_index_)
+    return false;
+
+  // Going from an index in the storage back to the row in this column is only
+  // cheap if the RowMap is a range or a BitVector.
+  const RowMap& rows = row_map();
+  if (!rows.IsRange() && !rows.IsBitVector())
+    return false;
+
+  return StorageSize() >= kMinRowsForEqIndex;
+}
+
+bool Column::FilterIntoEqIndex(SqlValue value, RowMap* rm) const {
+  PERFETTO_DCHECK(eq_index_);
+
+  if (!CanUseEqIndex())
+    return false;
+
+  const RowMap& rows = row_map();
+  int64_t key;
+  if (type_ == ColumnType::kString) {
+    if (value.type != SqlValue::Type::kString)
+      return false;
+
+    // All the strings in the column are interned in the pool so if the string
+    // is not in the pool, it cannot be in the column.
+    auto opt_id = string_pool_->GetId(value.string_value);
+    if (!opt_id) {
+      rm->Intersect(RowMap());
+      return true;
+    }
+    key = opt_id->raw_id();
+  } else {
+    if (value.type != SqlValue::Type::kLong)
+      return false;
+    key = value.long_value;
+  }
+
+  CatchUpEqIndex();
+
+  auto it = eq_index_->buckets.find(key);
+  if (it == eq_index_->buckets.end()) {
+    rm->Intersect(RowMap());
+    return true;
+  }
+
+  // If previous constraints already reduced the number of rows below the
+  // number of entries with this value, checking each row is cheaper.
+  const std::vector<uint32_t>& idxs = it->second;
+  if (rm->size() <= idxs.size())
+    return false;
+
+  // As |idxs| is sorted and both range and BitVector RowMaps preserve the
+  // order of the storage, |matching| will also be sorted.
+  std::vector<uint32_t> matching;
+  for (uint32_t idx : idxs) {
+    auto opt_row = rows.IndexOf(idx);
+    if (opt_row)
+      matching.push_back(*opt_row);
+  }
+
+  if (rm->IsRange()) {
+    // Fast path: |rm| is a contiguous set of rows so we can just pick out the
+    // matching rows which lie inside it.
+    uint32_t start = rm->empty() ? 0 : rm->Get(0);
+    uint32_t end = start + rm->size();
+    auto b = std::lower_bound(matching.begin(), matching.end(), start);
+    auto e = std::lower_bound(b, matching.end(), end);
+    *rm = RowMap(std::vector<uint32_t>(b, e));
+    return true;
+  }
+
+  std::vector<uint64_t> words((rows.size() + 63) / 64);
+  for (uint32_t row : matching)
+    words[row / 64] |= 1ull << (row % 64);
+  rm->Intersect(RowMap(BitVectorFromWords(rows.size(), words)));
+  return true;
+}
+
+bool Column::FilterIntoStringDictionary(FilterOp op,
+                                        SqlValue value,
+                                        RowMap* rm) const {
+  PERFETTO_DCHECK(eq_index_ && type_ == ColumnType::kString);
+
+  // See FilterIntoEqIndex for why we only support these RowMaps.
+  const RowMap& rows = row_map();
+  if (!rows.IsRange() && !rows.IsBitVector())
+    return false;
+
+  if (value.type != SqlValue::Type::kString)
+    return false;
+
+  if (StorageSize() < kMinRowsForEqIndex)
+    return false;
+
+  CatchUpEqIndex();
+
+  // Picking out the rows for each matching string is only a win over the
+  // table scan if each string is shared by many rows.
+  uint64_t distinct = eq_index_->buckets.size();
+  if (distinct * kMinRowsPerDictionaryEntry > rm->size())
+    return false;
+
+  NullTermStringView str_value = value.string_value;
+  PERFETTO_DCHECK(str_value.data() != nullptr);
+
+  // Parsing the pattern once up front means each string only pays for the
+  // match itself.
+  base::Optional<GlobMatcher> glob;
+  if (op == FilterOp::kGlob)
+    glob.emplace(str_value);
+
+  std::vector<uint64_t> matching((rows.size() + 63) / 64);
+  for (const auto& bucket : eq_index_->buckets) {
+    auto id = StringPool::Id::Raw(static_cast<uint32_t>(bucket.first));
+    NullTermStringView str = string_pool_->Get(id);
+    int cmp = glob ? 0 : compare::String(str, str_value);
+    bool match = false;
+    switch (op) {
+      case FilterOp::kLt:
+        match = cmp < 0;
+        break;
+      case FilterOp::kEq:
+        match = cmp == 0;
+        break;
+      case FilterOp::kGt:
+        match = cmp > 0;
+        break;
+      case FilterOp::kNe:
+        match = cmp != 0;
+        break;
+      case FilterOp::kLe:
+        match = cmp <= 0;
+        break;
+      case FilterOp::kGe:
+        match = cmp >= 0;
+        break;
+      case FilterOp::kGlob:
+        match = glob->Matches(str);
+        break;
+      case FilterOp::kIsNull:
+      case FilterOp::kIsNotNull:
+        PERFETTO_FATAL("Null constraints are not supported");
+    }
+    if (!match)
+      continue;
+
+    for (uint32_t idx : bucket.second) {
+      auto opt_row = rows.IndexOf(idx);
+      if (opt_row)
+        matching[*opt_row / 64] |= 1ull << (*opt_row % 64);
+    }
+  }
+  rm->Intersect(RowMap(BitVectorFromWords(rows.size(), matching)));
+  return true;
+}
+
+void Column::CatchUpEqIndex() const {
+  uint32_t size = StorageSize();
+  if (eq_index_->indexed_size.load(std::memory_order_acquire) == size)
+    return;
+
+  std::lock_guard<std::mutex> lock(eq_index_->mutex);
+  uint32_t indexed_size =
+      eq_index_->indexed_size.load(std::memory_order_relaxed);
+  for (uint32_t i = indexed_size; i < size; ++i) {
+    auto opt_key = GetEqIndexKeyAtIdx(i);
+    if (opt_key)
+      eq_index_->buckets[*opt_key].push_back(i);
+  }
+  eq_index_->indexed_size.store(size, std::memory_order_release);
+}
+
+void Column::UpdateEqIndexEntry(uint32_t idx, bool insert) {
+  PERFETTO_DCHECK(eq_index_ && idx < eq_index_->indexed_size);
+
+  auto opt_key = GetEqIndexKeyAtIdx(idx);
+  if (!opt_key)
+    return;
+
+  std::vector<uint32_t>& bucket = eq_index_->buckets[*opt_key];
+  auto it = std::lower_bound(bucket.begin(), bucket.end(), idx);
+  if (insert) {
+    PERFETTO_DCHECK(it == bucket.end() || *it != idx);
+    bucket.insert(it, idx);
+  } else {
+    PERFETTO_DCHECK(it != bucket.end() && *it == idx);
+    bucket.erase(it);
+    if (bucket.empty())
+      eq_index_->buckets.erase(*opt_key);
+  }
+}
+
+base::Optional<int64_t> Column::GetEqIndexKeyAtIdx(uint32_t idx) const {
+  switch (type_) {
+    case ColumnType::kInt32: {
+      auto opt_value = nullable_vector<int32_t>().Get(idx);
+      return opt_value ? base::make_optional<int64_t>(*opt_value)
+                       : base::nullopt;
+    }
+    case ColumnType::kUint32: {
+      auto opt_value = nullable_vector<uint32_t>().Get(idx);
+      return opt_value ? base::make_optional<int64_t>(*opt_value)
+                       : base::nullopt;
+    }
+    case ColumnType::kInt64: {
+      return nullable_vector<int64_t>().Get(idx);
+    }
+    case ColumnType::kString: {
+      StringPool::Id id = nullable_vector<StringPool::Id>().GetNonNull(idx);
+      return id.is_null() ? base::nullopt
+                          : base::make_optional<int64_t>(id.raw_id());
+    }
+    case ColumnType::kDouble:
+    case ColumnType::kId:
+      PERFETTO_FATAL("Equality index is not supported for this column type");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+uint32_t Column::StorageSize() const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      return nullable_vector<int32_t>().size();
+    case ColumnType::kUint32:
+      return nullable_vector<uint32_t>().size();
+    case ColumnType::kInt64:
+      return nullable_vector<int64_t>().size();
+    case ColumnType::kDouble:
+      return nullable_vector<double>().size();
+    case ColumnType::kString:
+      return nullable_vector<StringPool::Id>().size();
+    case ColumnType::kId:
+      PERFETTO_FATAL("Id columns do not have any storage");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+void Column::CompressStorage() {
+  switch (type_) {
+    case ColumnType::kInt32:
+      mutable_nullable_vector<int32_t>()->Compress();
+      break;
+    case ColumnType::kUint32:
+      mutable_nullable_vector<uint32_t>()->Compress();
+      break;
+    case ColumnType::kInt64:
+      mutable_nullable_vector<int64_t>()->Compress();
+      break;
+    case ColumnType::kDouble:
+    case ColumnType::kString:
+    case ColumnType::kId:
+      break;
+  }
+}
+
+size_t Column::SpillStorage(SpillFile* file) {
+  switch (type_) {
+    case ColumnType::kInt32:
+      return mutable_nullable_vector<int32_t>()->Spill(file);
+    case ColumnType::kUint32:
+      return mutable_nullable_vector<uint32_t>()->Spill(file);
+    case ColumnType::kInt64:
+      return mutable_nullable_vector<int64_t>()->Spill(file);
+    case ColumnType::kDouble:
+    case ColumnType::kString:
+    case ColumnType::kId:
+      return 0;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+size_t Column::SpillableStorageSizeBytes() const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      return nullable_vector<int32_t>().SpillableSizeBytes();
+    case ColumnType::kUint32:
+      return nullable_vector<uint32_t>().SpillableSizeBytes();
+    case ColumnType::kInt64:
+      return nullable_vector<int64_t>().SpillableSizeBytes();
+    case ColumnType::kDouble:
+    case ColumnType::kString:
+    case ColumnType::kId:
+      return 0;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+size_t Column::StorageSizeBytes() const {
+  switch (type_) {
+    case ColumnType::kInt32:
+      return nullable_vector<int32_t>().SizeBytes();
+    case ColumnType::kUint32:
+      return nullable_vector<uint32_t>().SizeBytes();
+    case ColumnType::kInt64:
+      return nullable_vector<int64_t>().SizeBytes();
+    case ColumnType::kDouble:
+      return nullable_vector<double>().SizeBytes();
+    case ColumnType::kString:
+      return nullable_vector<StringPool::Id>().SizeBytes();
+    case ColumnType::kId:
+      return 0;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+size_t Column::IndexSizeBytes() const {
+  if (!eq_index_)
+    return 0;
+  std::lock_guard<std::mutex> lock(eq_index_->mutex);
+  // This ignores the overhead of the nodes of the map: each bucket is counted
+  // as its key and vector.
+  const auto& buckets = eq_index_->buckets;
+  size_t size =
+      buckets.bucket_count() * sizeof(void*) +
+      buckets.size() * (sizeof(int64_t) + sizeof(std::vector<uint32_t>));
+  for (const auto& bucket : buckets)
+    size += bucket.second.capacity() * sizeof(uint32_t);
+  return size;
+}
+
+void Column::BuildRankSelectIndex() {
+  switch (type_) {
+    case ColumnType::kInt32:
+      mutable_nullable_vector<int32_t>()->BuildRankSelectIndex();
+      break;
+    case ColumnType::kUint32:
+      mutable_nullable_vector<uint32_t>()->BuildRankSelectIndex();
+      break;
+    case ColumnType::kInt64:
+      mutable_nullable_vector<int64_t>()->BuildRankSelectIndex();
+      break;
+    case ColumnType::kDouble:
+      mutable_nullable_vector<double>()->BuildRankSelectIndex();
+      break;
+    case ColumnType::kString:
+      mutable_nullable_vector<StringPool::Id>()->BuildRankSelectIndex();
+      break;
+    case ColumnType::kId:
+      break;
+  }
+}
+
+std::shared_ptr<Column::EqIndex> Column::NewEqIndexIfSupported(
+    ColumnType type,
+    uint32_t flags) {
+  // Sorted columns can already be efficiently filtered using binary search.
+  if (flags & Flag::kSorted)
+    return nullptr;
+
+  switch (type) {
+    case ColumnType::kInt32:
+    case ColumnType::kUint32:
+    case ColumnType::kInt64:
+    case ColumnType::kString:
+      return std::make_shared<EqIndex>();
+    case ColumnType::kDouble:
+      // Doubles are not supported because equality on doubles (e.g. for NaN or
+      // -0.0) does not map cleanly onto a hash key.
+    case ColumnType::kId:
+      return nullptr;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
 void Column::FilterIntoSlow(FilterOp op, SqlValue value, RowMap* rm) const {
   switch (type_) {
     case ColumnType::kInt32: {
@@ -159,6 +563,9 @@ void Column::FilterIntoNumericSlow(FilterOp op,
     return;
   }
 
+  if (FilterIntoNumericBatch<T, is_nullable>(op, value, rm))
+    return;
+
   if (value.type == SqlValue::Type::kDouble) {
     double double_value = value.double_value;
     if (std::is_same<T, double>::value) {
@@ -203,6 +610,94 @@ void Column::FilterIntoNumericSlow(FilterOp op,
   }
 }
 
+template <typename T, bool is_nullable>
+bool Column::FilterIntoNumericBatch(FilterOp op,
+                                    SqlValue value,
+                                    RowMap* rm) const {
+  // Batching relies on the rows of this column being stored contiguously and
+  // on the rows to filter being contiguous: this is the case for the first
+  // constraint on a column of a root table.
+  if (!row_map().IsRange() || !rm->IsRange() || rm->empty())
+    return false;
+
+  // Values are only stored at their index if there are no nulls or if the
+  // storage is dense.
+  if (is_nullable && !nullable_vector<T>().IsDense())
+    return false;
+
+  // Comparisons between longs and doubles need special handling (see
+  // compare::LongToDouble) so leave them to the slow path.
+  if (value.type != ToSqlValueType<T>())
+    return false;
+
+  using V = typename std::conditional<std::is_same<T, double>::value, double,
+                                      int64_t>::type;
+  V v = value.type == SqlValue::Type::kDouble
+            ? static_cast<V>(value.double_value)
+            : static_cast<V>(value.long_value);
+
+  // The comparisons below are written in terms of < and > only to match the
+  // behaviour of compare::Numeric (which is used on the slow path) for NaN.
+  switch (op) {
+    case FilterOp::kLt:
+      FilterIntoNumericBatchWithComparator<T, is_nullable>(
+          v, rm, [](V a, V b) { return a < b; });
+      return true;
+    case FilterOp::kGt:
+      FilterIntoNumericBatchWithComparator<T, is_nullable>(
+          v, rm, [](V a, V b) { return a > b; });
+      return true;
+    case FilterOp::kLe:
+      FilterIntoNumericBatchWithComparator<T, is_nullable>(
+          v, rm, [](V a, V b) { return !(a > b); });
+      return true;
+    case FilterOp::kGe:
+      FilterIntoNumericBatchWithComparator<T, is_nullable>(
+          v, rm, [](V a, V b) { return !(a < b); });
+      return true;
+    case FilterOp::kEq:
+      FilterIntoNumericBatchWithComparator<T, is_nullable>(
+          v, rm, [](V a, V b) { return !(a < b) && !(a > b); });
+      return true;
+    case FilterOp::kNe:
+      FilterIntoNumericBatchWithComparator<T, is_nullable>(
+          v, rm, [](V a, V b) { return a < b || a > b; });
+      return true;
+    case FilterOp::kGlob:
+      PERFETTO_FATAL("Glob is only supported on string columns");
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+      PERFETTO_FATAL("Should be handled above");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+template <typename T, bool is_nullable, typename V, typename Comparator>
+void Column::FilterIntoNumericBatchWithComparator(V value,
+                                                  RowMap* rm,
+                                                  Comparator cmp) const {
+  const NullableVector<T>& nv = nullable_vector<T>();
+  row_map().FilterIntoWords(rm, [&nv, value, cmp](uint32_t idx,
+                                                  uint32_t count) {
+    T values[kFilterBatchSize];
+    nv.CopyRange(idx, count, values);
+
+    // Always compare a full batch to keep the loop in |CompareBatch| fixed
+    // size; the values past |count| are zeroed and masked out below.
+    if (PERFETTO_UNLIKELY(count < kFilterBatchSize))
+      std::fill(values + count, values + kFilterBatchSize, T());
+
+    uint64_t word = CompareBatch(values, value, cmp);
+    if (PERFETTO_UNLIKELY(count < kFilterBatchSize))
+      word &= (1ull << count) - 1;
+
+    // Nulls never match any comparison.
+    if (is_nullable)
+      word &= nv.GetNonNullWord(idx, count);
+    return word;
+  });
+}
+
 template <typename T, bool is_nullable, typename Comparator>
 void Column::FilterIntoNumericWithComparatorSlow(FilterOp op,
                                                  RowMap* rm,
@@ -262,6 +757,8 @@ void Column::FilterIntoNumericWithComparatorSlow(FilterOp op,
         return cmp(nullable_vector<T>().GetNonNull(idx)) >= 0;
       });
       break;
+    case FilterOp::kGlob:
+      PERFETTO_FATAL("Glob is only supported on string columns");
     case FilterOp::kIsNull:
     case FilterOp::kIsNotNull:
       PERFETTO_FATAL("Should be handled above");
@@ -332,6 +829,14 @@ void Column::FilterIntoStringSlow(FilterOp op,
         return v.data() != nullptr && compare::String(v, str_value) >= 0;
       });
       break;
+    case FilterOp::kGlob: {
+      GlobMatcher glob(str_value);
+      row_map().FilterInto(rm, [this, &glob](uint32_t idx) {
+        auto v = GetStringPoolStringAtIdx(idx);
+        return v.data() != nullptr && glob.Matches(v);
+      });
+      break;
+    }
     case FilterOp::kIsNull:
     case FilterOp::kIsNotNull:
       PERFETTO_FATAL("Should be handled above");
@@ -387,12 +892,43 @@ void Column::FilterIntoIdSlow(FilterOp op, SqlValue value, RowMap* rm) const {
         return compare::Numeric(idx, id_value) >= 0;
       });
       break;
+    case FilterOp::kGlob:
+      PERFETTO_FATAL("Glob is only supported on string columns");
     case FilterOp::kIsNull:
     case FilterOp::kIsNotNull:
       PERFETTO_FATAL("Should be handled above");
   }
 }
 
+int Column::CompareRows(uint32_t a, uint32_t b) const {
+  uint32_t a_idx = row_map().Get(a);
+  uint32_t b_idx = row_map().Get(b);
+  switch (type_) {
+    case ColumnType::kInt32:
+      return CompareRowsNumeric<int32_t>(a_idx, b_idx);
+    case ColumnType::kUint32:
+      return CompareRowsNumeric<uint32_t>(a_idx, b_idx);
+    case ColumnType::kInt64:
+      return CompareRowsNumeric<int64_t>(a_idx, b_idx);
+    case ColumnType::kDouble:
+      return CompareRowsNumeric<double>(a_idx, b_idx);
+    case ColumnType::kString:
+      return compare::NullableString(GetStringPoolStringAtIdx(a_idx),
+                                     GetStringPoolStringAtIdx(b_idx));
+    case ColumnType::kId:
+      return compare::Numeric(a_idx, b_idx);
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+template <typename T>
+int Column::CompareRowsNumeric(uint32_t a_idx, uint32_t b_idx) const {
+  const auto& nv = nullable_vector<T>();
+  if (IsNullable())
+    return compare::NullableNumeric(nv.Get(a_idx), nv.Get(b_idx));
+  return compare::Numeric(nv.GetNonNull(a_idx), nv.GetNonNull(b_idx));
+}
+
 template <bool desc>
 void Column::StableSort(std::vector<uint32_t>* out) const {
   switch (type_) {
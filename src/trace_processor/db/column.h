@@ -19,11 +19,18 @@
 
 #include <stdint.h>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/nullable_vector.h"
 #include "src/trace_processor/containers/row_map.h"
+#include "src/trace_processor/containers/spill_file.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/compare.h"
 
@@ -54,6 +61,10 @@ enum class FilterOp {
   kLe,
   kIsNull,
   kIsNotNull,
+
+  // Matches strings against a pattern with the semantics of SQLite's GLOB
+  // operator (see GlobMatcher). Only supported on string columns.
+  kGlob,
 };
 
 // Represents a constraint on a column.
@@ -176,7 +187,8 @@ class Column {
                col_idx_in_table,
                row_map_idx,
                storage,
-               nullptr) {}
+               nullptr,
+               NewEqIndexIfSupported(ToColumnType<T>(), flags)) {}
 
   // Create a Column has the same name and is backed by the same data as
   // |column| but is associated to a different table.
@@ -198,7 +210,8 @@ class Column {
                                  uint32_t row_map_idx) {
     NullableVector<T>* ptr = storage.get();
     return Column(name, ToColumnType<T>(), flags, table, col_idx_in_table,
-                  row_map_idx, ptr, std::move(storage));
+                  row_map_idx, ptr, std::move(storage),
+                  NewEqIndexIfSupported(ToColumnType<T>(), flags));
   }
 
   // Creates a Column which returns the index as the value of the row.
@@ -238,6 +251,7 @@ class Column {
   // Sets the value of the column at the given |row|.
   void Set(uint32_t row, SqlValue value) {
     PERFETTO_CHECK(value.type == type());
+    RemoveFromEqIndex(row);
     switch (type_) {
       case ColumnType::kInt32: {
         mutable_nullable_vector<int32_t>()->Set(
@@ -266,12 +280,56 @@ class Column {
         PERFETTO_FATAL("Cannot set value on a id column");
       }
     }
+    AddToEqIndex(row);
   }
 
+  // Compresses the storage backing this column to reduce its memory usage
+  // (see NullableVector::Compress). Only integer columns are compressed;
+  // this is a no-op for all other columns.
+  //
+  // Note: as the storage may be shared with other tables (e.g. child
+  // tables), this affects all the columns backed by the same storage.
+  void CompressStorage();
+
+  // Moves the compressed storage backing this column to |file| (see
+  // NullableVector::Spill) and returns the number of bytes of memory freed.
+  // Only compressed columns can be spilled; this is a no-op for all other
+  // columns. As with CompressStorage, this affects all the columns backed by
+  // the same storage.
+  size_t SpillStorage(SpillFile* file);
+
+  // Returns the number of bytes of memory which would be freed by
+  // SpillStorage().
+  size_t SpillableStorageSizeBytes() const;
+
+  // Returns the number of bytes of memory used by the storage backing this
+  // column (zero for id columns) and by its equality index. As with
+  // CompressStorage, the storage can be shared with the columns of other
+  // tables: storage() allows to only account for it once.
+  size_t StorageSizeBytes() const;
+  size_t IndexSizeBytes() const;
+
+  // Returns true if equality constraints on this column are answered using its
+  // equality index (see |EqIndex|) instead of a full table scan.
+  bool CanUseEqIndex() const;
+
+  // Returns the storage backing this column, or null for id columns.
+  const NullableVectorBase* storage() const { return nullable_vector_; }
+
+  // Builds a rank/select index for the null entries of the storage backing
+  // this column to make looking up its values constant time (see
+  // NullableVector::BuildRankSelectIndex). As with CompressStorage, this
+  // affects all the columns backed by the same storage.
+  void BuildRankSelectIndex();
+
   // Sorts |idx| in ascending or descending order (determined by |desc|) based
   // on the contents of this column.
   void StableSort(bool desc, std::vector<uint32_t>* idx) const;
 
+  // Compares the values of this column at the rows |a| and |b|; returns <0,
+  // 0 or >0 in the same ascending order (with nulls first) as |StableSort|.
+  int CompareRows(uint32_t a, uint32_t b) const;
+
   // Updates the given RowMap by only keeping rows where this column meets the
   // given filter constraint.
   void FilterInto(FilterOp op, SqlValue value, RowMap* rm) const {
@@ -296,6 +354,24 @@ class Column {
         return;
     }
 
+    if (op == FilterOp::kEq && eq_index_) {
+      // If the column has an equality index, try and use it to lookup the rows
+      // with the value instead of a full table scan.
+      bool handled = FilterIntoEqIndex(value, rm);
+      if (handled)
+        return;
+    }
+
+    if (type_ == ColumnType::kString && eq_index_ &&
+        op != FilterOp::kIsNull && op != FilterOp::kIsNotNull) {
+      // String comparisons are expensive so, if the column only has a few
+      // distinct strings, try and evaluate the constraint once per string
+      // instead of once per row.
+      bool handled = FilterIntoStringDictionary(op, value, rm);
+      if (handled)
+        return;
+    }
+
     FilterIntoSlow(op, value, rm);
   }
 
@@ -339,6 +415,9 @@ class Column {
   // Returns true if this column is a dense column.
   bool IsDense() const { return (flags_ & Flag::kDense) != 0; }
 
+  // Returns true if this column is a hidden column.
+  bool IsHidden() const { return (flags_ & Flag::kHidden) != 0; }
+
   // Returns the backing RowMap for this Column.
   // This function is defined out of line because of a circular dependency
   // between |Table| and |Column|.
@@ -378,6 +457,9 @@ class Column {
   Constraint le_value(SqlValue value) const {
     return Constraint{col_idx_in_table_, FilterOp::kLe, value};
   }
+  Constraint glob_value(SqlValue value) const {
+    return Constraint{col_idx_in_table_, FilterOp::kGlob, value};
+  }
   Constraint is_not_null() const {
     return Constraint{col_idx_in_table_, FilterOp::kIsNotNull, SqlValue()};
   }
@@ -423,6 +505,18 @@ class Column {
 
   const StringPool& string_pool() const { return *string_pool_; }
 
+  // Keeps the equality index (if any) in sync with the storage. Should be
+  // called with the storage index of the entry just before (for Remove) and
+  // just after (for Add) the entry is overwritten.
+  void RemoveFromEqIndex(uint32_t idx) {
+    if (eq_index_ && idx < eq_index_->indexed_size)
+      UpdateEqIndexEntry(idx, false /* insert */);
+  }
+  void AddToEqIndex(uint32_t idx) {
+    if (eq_index_ && idx < eq_index_->indexed_size)
+      UpdateEqIndexEntry(idx, true /* insert */);
+  }
+
  private:
   enum class ColumnType {
     // Standard primitive types.
@@ -436,6 +530,43 @@ class Column {
     kId,
   };
 
+  // Index from the value of an entry in the storage to the (sorted) list of
+  // storage indices containing that value.
+  //
+  // This index is used to speed up equality constraints on integer and string
+  // columns which are not sorted: instead of a full table scan, we only need to
+  // look at the rows which are known to contain the value. It is built lazily
+  // on the first equality constraint and is shared between all the columns
+  // backed by the same storage (i.e. copies of the column in other tables).
+  //
+  // For string columns, the keys of |buckets| also act as a dictionary of the
+  // distinct strings in the column: this allows other constraints to be
+  // evaluated once per distinct string instead of once per row.
+  //
+  // We only support Append (by lazily indexing entries past |indexed_size|)
+  // and Set (by updating the affected entry) as these are the only ways the
+  // storage of a column can be changed.
+  //
+  // As the same table can be filtered concurrently by several query sessions
+  // once the trace is loaded, catching up with the storage is done under
+  // |mutex|, and |buckets| is only read once |indexed_size| covers the whole
+  // storage.
+  struct EqIndex {
+    // The number of entries in the storage which are present in |buckets|.
+    std::atomic<uint32_t> indexed_size{0};
+    std::unordered_map<int64_t, std::vector<uint32_t>> buckets;
+    std::mutex mutex;
+  };
+
+  // The minimum number of rows a column needs to have for the equality index
+  // to be built: for smaller columns, the table scan is cheap enough that it's
+  // not worth the memory.
+  static constexpr uint32_t kMinRowsForEqIndex = 1024;
+
+  // The minimum average number of rows per distinct string for a string
+  // column to be filtered using the dictionary of |eq_index_|.
+  static constexpr uint32_t kMinRowsPerDictionaryEntry = 16;
+
   friend class Table;
 
   // Base constructor for this class which all other constructors call into.
@@ -446,7 +577,8 @@ class Column {
          uint32_t col_idx_in_table,
          uint32_t row_map_idx,
          NullableVectorBase* nullable_vector,
-         std::shared_ptr<NullableVectorBase> owned_nullable_vector);
+         std::shared_ptr<NullableVectorBase> owned_nullable_vector,
+         std::shared_ptr<EqIndex> eq_index);
 
   Column(const Column&) = delete;
   Column& operator=(const Column&) = delete;
@@ -524,11 +656,43 @@ class Column {
       case FilterOp::kNe:
       case FilterOp::kIsNull:
       case FilterOp::kIsNotNull:
+      case FilterOp::kGlob:
         break;
     }
     return false;
   }
 
+  // Filter method for equality constraints which uses |eq_index_| to find the
+  // matching rows. Returns whether the constraint was handled by the method.
+  bool FilterIntoEqIndex(SqlValue value, RowMap* rm) const;
+
+  // Filter method for string columns which evaluates the constraint once for
+  // each distinct string in |eq_index_| and then picks out the rows with the
+  // matching strings. Returns whether the constraint was handled by the
+  // method.
+  bool FilterIntoStringDictionary(FilterOp op,
+                                  SqlValue value,
+                                  RowMap* rm) const;
+
+  // Indexes all the entries in the storage which are not yet in |eq_index_|.
+  void CatchUpEqIndex() const;
+
+  // Inserts or removes the storage index |idx| from the bucket of the value
+  // currently at |idx| in |eq_index_|.
+  void UpdateEqIndexEntry(uint32_t idx, bool insert);
+
+  // Returns the key of the storage entry at |idx| in |eq_index_| or nullopt if
+  // the entry is null.
+  base::Optional<int64_t> GetEqIndexKeyAtIdx(uint32_t idx) const;
+
+  // Returns the number of entries in the storage of this column.
+  uint32_t StorageSize() const;
+
+  // Creates an EqIndex if a column with the given |type| and |flags| can make
+  // use of it or nullptr otherwise.
+  static std::shared_ptr<EqIndex> NewEqIndexIfSupported(ColumnType type,
+                                                         uint32_t flags);
+
   // Slow path filter method which will perform a full table scan.
   void FilterIntoSlow(FilterOp op, SqlValue value, RowMap* rm) const;
 
@@ -536,6 +700,20 @@ class Column {
   template <typename T, bool is_nullable>
   void FilterIntoNumericSlow(FilterOp op, SqlValue value, RowMap* rm) const;
 
+  // Filter method for numerics which compares values in batches of 64 rows at a
+  // time. Returns whether the constraint was handled by the method: this is
+  // only possible for comparisons where the storage of the rows of the column
+  // is contiguous (see the implementation for the exact conditions).
+  template <typename T, bool is_nullable>
+  bool FilterIntoNumericBatch(FilterOp op, SqlValue value, RowMap* rm) const;
+
+  // Batch filter method for numerics with a comparator |cmp(row value,
+  // value)|.
+  template <typename T, bool is_nullable, typename V, typename Comparator>
+  void FilterIntoNumericBatchWithComparator(V value,
+                                            RowMap* rm,
+                                            Comparator cmp) const;
+
   // Slow path filter method for numerics with a comparator which will perform a
   // full table scan.
   template <typename T, bool is_nullable, typename Comparator = int(T)>
@@ -558,6 +736,11 @@ class Column {
   template <bool desc, typename T, bool is_nullable>
   void StableSortNumeric(std::vector<uint32_t>* out) const;
 
+  // Compares the values at the indices |a_idx| and |b_idx| of the storage of
+  // this column. |T| should match the type of this column.
+  template <typename T>
+  int CompareRowsNumeric(uint32_t a_idx, uint32_t b_idx) const;
+
   template <typename T>
   static ColumnType ToColumnType() {
     if (std::is_same<T, uint32_t>::value) {
@@ -612,6 +795,11 @@ class Column {
   uint32_t col_idx_in_table_ = 0;
   uint32_t row_map_idx_ = 0;
   const StringPool* string_pool_ = nullptr;
+
+  // Lazily populated index used to speed up equality constraints; nullptr if
+  // this column does not support such an index. See |EqIndex| for details.
+  // Mutable as the index is populated as part of the (const) filter methods.
+  mutable std::shared_ptr<EqIndex> eq_index_;
 };
 
 }  // namespace trace_processor
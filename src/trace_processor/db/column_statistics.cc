@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column_statistics.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// The fraction of rows assumed to be kept by constraints we know nothing
+// about (e.g. range constraints when SQLite is planning the query or GLOB
+// patterns with wildcards).
+constexpr double kRangeSelectivity = 1.0 / 3;
+constexpr double kGlobSelectivity = 0.1;
+
+// Returns a key which is equal for two non-null values of the same column if
+// and only if the values are equal.
+int64_t ValueKey(const SqlValue& value) {
+  switch (value.type) {
+    case SqlValue::kLong:
+      return value.long_value;
+    case SqlValue::kDouble: {
+      int64_t key;
+      memcpy(&key, &value.double_value, sizeof(key));
+      return key;
+    }
+    case SqlValue::kString:
+      // All the strings of a column are interned in the string pool so equal
+      // strings have the same pointer.
+      return static_cast<int64_t>(
+          reinterpret_cast<uintptr_t>(value.string_value));
+    case SqlValue::kNull:
+    case SqlValue::kBytes:
+      break;
+  }
+  return 0;
+}
+
+base::Optional<double> NumericValue(const SqlValue& value) {
+  if (value.type == SqlValue::kLong)
+    return static_cast<double>(value.long_value);
+  if (value.type == SqlValue::kDouble)
+    return value.double_value;
+  return base::nullopt;
+}
+
+}  // namespace
+
+constexpr uint32_t ColumnStatistics::kMaxSampleRows;
+
+// static
+ColumnStatistics ColumnStatistics::Compute(const Column& column) {
+  ColumnStatistics stats;
+  uint32_t row_count = column.row_map().size();
+  stats.row_count = row_count;
+  stats.has_eq_index = column.CanUseEqIndex();
+  if (row_count == 0)
+    return stats;
+
+  // Id columns have one distinct non-null value per row.
+  if (column.IsId()) {
+    stats.distinct_count = row_count;
+    stats.min = NumericValue(column.Get(0));
+    stats.max = NumericValue(column.Get(row_count - 1));
+    return stats;
+  }
+
+  uint32_t sample_count = std::min(row_count, kMaxSampleRows);
+  double step = static_cast<double>(row_count) / sample_count;
+
+  uint32_t null_count = 0;
+  std::unordered_map<int64_t, uint32_t> counts;
+  for (uint32_t i = 0; i < sample_count; ++i) {
+    uint32_t row = static_cast<uint32_t>(i * step);
+    SqlValue value = column.Get(row);
+    if (value.is_null()) {
+      null_count++;
+      continue;
+    }
+    counts[ValueKey(value)]++;
+
+    base::Optional<double> numeric = NumericValue(value);
+    if (!numeric)
+      continue;
+    stats.min = stats.min ? std::min(*stats.min, *numeric) : *numeric;
+    stats.max = stats.max ? std::max(*stats.max, *numeric) : *numeric;
+  }
+  stats.null_fraction = static_cast<double>(null_count) / sample_count;
+
+  // The last row of sorted columns holds their exact maximum (unlike the first
+  // row which may be null as nulls are sorted first).
+  if (column.IsSorted() && column.type() != SqlValue::kString) {
+    base::Optional<double> last = NumericValue(column.Get(row_count - 1));
+    if (last)
+      stats.max = last;
+  }
+
+  // If the sample was the whole column, the count is exact. Otherwise, use the
+  // Guaranteed-Error Estimator (Charikar et al.): values seen only once in the
+  // sample are scaled up as they are likely to be part of many more values
+  // not sampled while values seen several times are likely to be common.
+  double distinct = static_cast<double>(counts.size());
+  if (sample_count < row_count) {
+    uint32_t singletons = 0;
+    for (const auto& it : counts)
+      singletons += it.second == 1;
+    double scale = std::sqrt(static_cast<double>(row_count) / sample_count);
+    distinct = scale * singletons + (distinct - singletons);
+  }
+  double non_null_rows = row_count * (1 - stats.null_fraction);
+  stats.distinct_count = std::min(distinct, std::max(non_null_rows, 1.0));
+  return stats;
+}
+
+// static
+std::vector<ColumnStatistics> ColumnStatistics::ComputeForTable(
+    const Table& table) {
+  std::vector<ColumnStatistics> stats;
+  stats.reserve(table.GetColumnCount());
+  for (uint32_t i = 0; i < table.GetColumnCount(); ++i)
+    stats.emplace_back(Compute(table.GetColumn(i)));
+  return stats;
+}
+
+double ColumnStatistics::EstimateSelectivity(FilterOp op,
+                                             const SqlValue* value) const {
+  if (row_count == 0)
+    return 0;
+
+  double non_null = 1 - null_fraction;
+  double eq = distinct_count > 0 ? non_null / distinct_count : 0;
+  base::Optional<double> numeric =
+      value ? NumericValue(*value) : base::nullopt;
+  switch (op) {
+    case FilterOp::kIsNull:
+      return null_fraction;
+    case FilterOp::kIsNotNull:
+      return non_null;
+    case FilterOp::kEq:
+      if (value && value->is_null())
+        return 0;
+      if (numeric && min && max && (*numeric < *min || *numeric > *max))
+        return 0;
+      return eq;
+    case FilterOp::kNe:
+      if (value && value->is_null())
+        return 0;
+      return std::max(non_null - eq, 0.0);
+    case FilterOp::kLt:
+    case FilterOp::kLe:
+    case FilterOp::kGt:
+    case FilterOp::kGe: {
+      if (value && value->is_null())
+        return 0;
+      if (!numeric || !min || !max)
+        return non_null * kRangeSelectivity;
+
+      // Assume the values are uniformly distributed between min and max.
+      double below = *max > *min ? (*numeric - *min) / (*max - *min)
+                                 : (*numeric < *min ? 0.0 : 1.0);
+      below = std::min(std::max(below, 0.0), 1.0);
+      bool is_below = op == FilterOp::kLt || op == FilterOp::kLe;
+      return non_null * (is_below ? below : 1 - below);
+    }
+    case FilterOp::kGlob:
+      // A pattern without any wildcard is an equality constraint.
+      if (value && value->type == SqlValue::kString &&
+          !strpbrk(value->string_value, "*?[")) {
+        return eq;
+      }
+      return non_null * kGlobSelectivity;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_STATISTICS_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_STATISTICS_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/db/column.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class Table;
+
+// Statistics about the values of a column, used to estimate how many rows
+// a constraint on the column keeps (see DbSqliteTable::EstimateCost).
+//
+// To keep computing them cheap on big tables, the statistics are estimated
+// from an evenly spaced sample of at most |kMaxSampleRows| rows.
+struct ColumnStatistics {
+  static constexpr uint32_t kMaxSampleRows = 4096;
+
+  // Computes the statistics of |column| or of all the columns of |table|.
+  static ColumnStatistics Compute(const Column& column);
+  static std::vector<ColumnStatistics> ComputeForTable(const Table& table);
+
+  // Returns the estimated fraction (between 0 and 1) of the rows of the
+  // column which satisfy the constraint |op| with |value| or, if |value| is
+  // null, with an unknown value (e.g. when SQLite is planning the query).
+  double EstimateSelectivity(FilterOp op, const SqlValue* value) const;
+
+  // The number of rows of the column when the statistics were computed.
+  uint32_t row_count = 0;
+
+  // The estimated number of distinct non-null values.
+  double distinct_count = 0;
+
+  // The estimated fraction of the rows which are null.
+  double null_fraction = 0;
+
+  // The estimated minimum and maximum values; only set for non-empty
+  // numeric columns.
+  base::Optional<double> min;
+  base::Optional<double> max;
+
+  // Whether equality constraints on the column can be answered using an
+  // index (see Column::CanUseEqIndex) instead of a full table scan.
+  bool has_eq_index = false;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_STATISTICS_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column_statistics.h"
+
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/tables/macros.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_TEST_STATS_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestStatsTable, "stats")                           \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)            \
+  C(int64_t, ts, Column::Flag::kSorted)                   \
+  C(uint32_t, utid)                                       \
+  C(base::Optional<int64_t>, arg)                         \
+  C(StringPool::Id, name)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_STATS_TABLE_DEF);
+
+TestStatsTable::~TestStatsTable() = default;
+
+class ColumnStatisticsTest : public ::testing::Test {
+ protected:
+  void Insert(uint32_t count) {
+    StringPool::Id names[] = {pool_.InternString("foo"),
+                              pool_.InternString("bar")};
+    for (uint32_t i = 0; i < count; ++i) {
+      TestStatsTable::Row row;
+      row.ts = 1000 + i;
+      row.utid = i % 100;
+      if (i % 4 == 0)
+        row.arg = i;
+      row.name = names[i % 2];
+      table_.Insert(row);
+    }
+  }
+
+  StringPool pool_;
+  TestStatsTable table_{&pool_, nullptr};
+};
+
+TEST_F(ColumnStatisticsTest, Empty) {
+  auto stats = ColumnStatistics::Compute(table_.utid());
+  ASSERT_EQ(stats.row_count, 0u);
+  ASSERT_EQ(stats.EstimateSelectivity(FilterOp::kEq, nullptr), 0.0);
+}
+
+TEST_F(ColumnStatisticsTest, ExactOnSmallTables) {
+  Insert(1000);
+  auto stats = ColumnStatistics::ComputeForTable(table_);
+  ASSERT_EQ(stats.size(), table_.GetColumnCount());
+
+  const auto& id = stats[table_.id().index_in_table()];
+  ASSERT_DOUBLE_EQ(id.distinct_count, 1000);
+  ASSERT_DOUBLE_EQ(*id.min, 0);
+  ASSERT_DOUBLE_EQ(*id.max, 999);
+
+  const auto& ts = stats[table_.ts().index_in_table()];
+  ASSERT_DOUBLE_EQ(*ts.min, 1000);
+  ASSERT_DOUBLE_EQ(*ts.max, 1999);
+
+  const auto& utid = stats[table_.utid().index_in_table()];
+  ASSERT_DOUBLE_EQ(utid.distinct_count, 100);
+  ASSERT_DOUBLE_EQ(utid.null_fraction, 0);
+  ASSERT_FALSE(utid.has_eq_index);
+
+  const auto& arg = stats[table_.arg().index_in_table()];
+  ASSERT_DOUBLE_EQ(arg.distinct_count, 250);
+  ASSERT_DOUBLE_EQ(arg.null_fraction, 0.75);
+
+  const auto& name = stats[table_.name().index_in_table()];
+  ASSERT_DOUBLE_EQ(name.distinct_count, 2);
+  ASSERT_FALSE(name.min.has_value());
+}
+
+TEST_F(ColumnStatisticsTest, EstimatedOnBigTables) {
+  Insert(100000);
+  auto utid = ColumnStatistics::Compute(table_.utid());
+  ASSERT_EQ(utid.row_count, 100000u);
+  ASSERT_TRUE(utid.has_eq_index);
+
+  // Every value appears many times in the sample so the count is not scaled.
+  ASSERT_DOUBLE_EQ(utid.distinct_count, 100);
+
+  // Most values only appear once in the sample so the count is scaled up.
+  auto ts = ColumnStatistics::Compute(table_.ts());
+  ASSERT_GT(ts.distinct_count, ColumnStatistics::kMaxSampleRows * 4.0);
+  ASSERT_LE(ts.distinct_count, 100000);
+  ASSERT_DOUBLE_EQ(*ts.max, 100999);
+}
+
+TEST_F(ColumnStatisticsTest, Selectivity) {
+  Insert(1000);
+  auto ts = ColumnStatistics::Compute(table_.ts());
+  auto arg = ColumnStatistics::Compute(table_.arg());
+  auto name = ColumnStatistics::Compute(table_.name());
+
+  SqlValue quarter = SqlValue::Long(1250);
+  ASSERT_NEAR(ts.EstimateSelectivity(FilterOp::kLt, &quarter), 0.25, 0.01);
+  ASSERT_NEAR(ts.EstimateSelectivity(FilterOp::kGe, &quarter), 0.75, 0.01);
+
+  SqlValue outside = SqlValue::Long(5000);
+  ASSERT_EQ(ts.EstimateSelectivity(FilterOp::kEq, &outside), 0.0);
+  ASSERT_NEAR(ts.EstimateSelectivity(FilterOp::kEq, nullptr), 0.001, 1e-9);
+
+  ASSERT_DOUBLE_EQ(arg.EstimateSelectivity(FilterOp::kIsNull, nullptr), 0.75);
+  ASSERT_DOUBLE_EQ(arg.EstimateSelectivity(FilterOp::kEq, nullptr), 0.001);
+
+  SqlValue exact = SqlValue::String("foo");
+  SqlValue pattern = SqlValue::String("f*");
+  ASSERT_DOUBLE_EQ(name.EstimateSelectivity(FilterOp::kGlob, &exact), 0.5);
+  ASSERT_LT(name.EstimateSelectivity(FilterOp::kGlob, &pattern), 0.5);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/glob_matcher.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+constexpr char kMatchAll = '*';
+constexpr char kMatchOne = '?';
+constexpr char kMatchSet = '[';
+
+enum class Result {
+  kMatch,
+  kNoMatch,
+
+  // The string does not match and neither would any suffix of it: this
+  // allows the callers handling a '*' to stop trying later positions.
+  kNoWildcardMatch,
+};
+
+bool IsSpecial(char c) {
+  return c == kMatchAll || c == kMatchOne || c == kMatchSet;
+}
+
+// Reads the UTF-8 character at |*p| and advances |*p| past it. Returns 0 (and
+// does not advance) at the end of the string. Invalid sequences are decoded
+// the same way SQLite does.
+uint32_t ReadUtf8(const char** p) {
+  const uint8_t* s = reinterpret_cast<const uint8_t*>(*p);
+  uint32_t c = *s;
+  if (c == 0)
+    return 0;
+  s++;
+  if (c >= 0xc0) {
+    if (c < 0xe0) {
+      c &= 0x1f;
+    } else if (c < 0xf0) {
+      c &= 0x0f;
+    } else if (c < 0xf8) {
+      c &= 0x07;
+    } else if (c < 0xfc) {
+      c &= 0x03;
+    } else {
+      c &= 0x01;
+    }
+    while ((*s & 0xc0) == 0x80)
+      c = (c << 6) + (0x3f & *s++);
+    if (c < 0x80 || (c & 0xFFFFF800) == 0xD800 || (c & 0xFFFFFFFE) == 0xFFFE)
+      c = 0xFFFD;
+  }
+  *p = reinterpret_cast<const char*>(s);
+  return c;
+}
+
+// Skips over the UTF-8 character at |*p|.
+void SkipUtf8(const char** p) {
+  ReadUtf8(p);
+}
+
+// Port of SQLite's patternCompare() specialised for GLOB.
+Result PatternCompare(const char* pattern, const char* str) {
+  uint32_t c;
+  while ((c = ReadUtf8(&pattern)) != 0) {
+    if (c == kMatchAll) {
+      // Skip over any '*' and '?' directly after the '*'; each '?' still
+      // needs a character in the string.
+      while ((c = ReadUtf8(&pattern)) == kMatchAll || c == kMatchOne) {
+        if (c == kMatchOne && ReadUtf8(&str) == 0)
+          return Result::kNoWildcardMatch;
+      }
+
+      // A trailing '*' matches everything.
+      if (c == 0)
+        return Result::kMatch;
+
+      if (c == kMatchSet) {
+        // A set directly after the '*': we have no choice but to try every
+        // position in the string.
+        const char* set_pattern = pattern - 1;
+        while (*str) {
+          Result r = PatternCompare(set_pattern, str);
+          if (r != Result::kNoMatch)
+            return r;
+          SkipUtf8(&str);
+        }
+        return Result::kNoWildcardMatch;
+      }
+
+      // Find every occurrence of the character following the '*' in the
+      // string and try to match the rest of the pattern from there.
+      if (c < 0x80) {
+        char ch = static_cast<char>(c);
+        for (;;) {
+          str = strchr(str, ch);
+          if (!str)
+            return Result::kNoWildcardMatch;
+          str++;
+          Result r = PatternCompare(pattern, str);
+          if (r != Result::kNoMatch)
+            return r;
+        }
+      }
+      uint32_t c2;
+      while ((c2 = ReadUtf8(&str)) != 0) {
+        if (c2 != c)
+          continue;
+        Result r = PatternCompare(pattern, str);
+        if (r != Result::kNoMatch)
+          return r;
+      }
+      return Result::kNoWildcardMatch;
+    }
+
+    if (c == kMatchSet) {
+      uint32_t ch = ReadUtf8(&str);
+      if (ch == 0)
+        return Result::kNoMatch;
+
+      bool seen = false;
+      bool invert = false;
+      uint32_t prior = 0;
+      uint32_t c2 = ReadUtf8(&pattern);
+      if (c2 == '^') {
+        invert = true;
+        c2 = ReadUtf8(&pattern);
+      }
+      if (c2 == ']') {
+        seen = ch == ']';
+        c2 = ReadUtf8(&pattern);
+      }
+      while (c2 != 0 && c2 != ']') {
+        if (c2 == '-' && pattern[0] != ']' && pattern[0] != 0 && prior > 0) {
+          c2 = ReadUtf8(&pattern);
+          if (ch >= prior && ch <= c2)
+            seen = true;
+          prior = 0;
+        } else {
+          if (ch == c2)
+            seen = true;
+          prior = c2;
+        }
+        c2 = ReadUtf8(&pattern);
+      }
+      // An unterminated set never matches.
+      if (c2 == 0 || seen == invert)
+        return Result::kNoMatch;
+      continue;
+    }
+
+    uint32_t c2 = ReadUtf8(&str);
+    if (c == c2)
+      continue;
+    if (c == kMatchOne && c2 != 0)
+      continue;
+    return Result::kNoMatch;
+  }
+  return *str == 0 ? Result::kMatch : Result::kNoMatch;
+}
+
+}  // namespace
+
+GlobMatcher::GlobMatcher(NullTermStringView pattern)
+    : pattern_(pattern.data(), pattern.size()) {
+  size_t first_special = pattern_.size();
+  for (size_t i = 0; i < pattern_.size(); ++i) {
+    if (IsSpecial(pattern_[i])) {
+      first_special = i;
+      break;
+    }
+  }
+  literal_ = pattern_.substr(0, first_special);
+
+  if (first_special == pattern_.size()) {
+    kind_ = Kind::kEquals;
+  } else if (first_special == pattern_.size() - 1 &&
+             pattern_[first_special] == kMatchAll) {
+    kind_ = Kind::kPrefix;
+  } else {
+    kind_ = Kind::kGeneral;
+  }
+}
+
+bool GlobMatcher::Matches(NullTermStringView str) const {
+  switch (kind_) {
+    case Kind::kEquals:
+      return str.size() == literal_.size() &&
+             memcmp(str.data(), literal_.data(), literal_.size()) == 0;
+    case Kind::kPrefix:
+      return str.size() >= literal_.size() &&
+             memcmp(str.data(), literal_.data(), literal_.size()) == 0;
+    case Kind::kGeneral:
+      // The literal prefix is a cheap way to rule out most strings.
+      if (str.size() < literal_.size() ||
+          memcmp(str.data(), literal_.data(), literal_.size()) != 0) {
+        return false;
+      }
+      return PatternCompare(pattern_.c_str() + literal_.size(),
+                            str.c_str() + literal_.size()) == Result::kMatch;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
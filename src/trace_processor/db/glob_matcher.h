@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_GLOB_MATCHER_H_
+#define SRC_TRACE_PROCESSOR_DB_GLOB_MATCHER_H_
+
+#include <string>
+
+#include "src/trace_processor/containers/null_term_string_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Matches strings against a glob pattern with the same semantics as SQLite's
+// GLOB operator:
+//  * '*' matches any sequence of zero or more characters.
+//  * '?' matches exactly one (UTF-8) character.
+//  * '[...]' matches one character in the set; sets can contain ranges
+//    (e.g. '[a-z]') and are negated if they start with '^'. A ']' directly
+//    after the '[' (or '[^') is part of the set.
+// Matching is case sensitive and there is no escape character. Both the
+// pattern and the strings are expected to be valid UTF-8.
+//
+// The pattern is analysed once on construction so that common patterns
+// (e.g. ones without any special characters or with only a trailing '*')
+// can be matched with a simple comparison instead of the general algorithm.
+class GlobMatcher {
+ public:
+  explicit GlobMatcher(NullTermStringView pattern);
+
+  // Returns whether |str| matches the pattern.
+  bool Matches(NullTermStringView str) const;
+
+ private:
+  enum class Kind {
+    // The pattern has no special characters: only the pattern itself matches.
+    kEquals,
+
+    // The pattern is a string without special characters followed by a
+    // single '*': strings starting with |literal_| match.
+    kPrefix,
+
+    // Any other pattern.
+    kGeneral,
+  };
+
+  Kind kind_;
+  std::string pattern_;
+
+  // The part of |pattern_| before the first special character.
+  std::string literal_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_GLOB_MATCHER_H_
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/glob_matcher.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+bool Glob(const char* pattern, const char* str) {
+  return GlobMatcher(NullTermStringView(pattern))
+      .Matches(NullTermStringView(str));
+}
+
+TEST(GlobMatcherTest, Equals) {
+  ASSERT_TRUE(Glob("abc", "abc"));
+  ASSERT_FALSE(Glob("abc", "abd"));
+  ASSERT_FALSE(Glob("abc", "ab"));
+  ASSERT_FALSE(Glob("Foo", "foo"));
+
+  ASSERT_TRUE(Glob("", ""));
+  ASSERT_FALSE(Glob("", "a"));
+}
+
+TEST(GlobMatcherTest, Prefix) {
+  ASSERT_TRUE(Glob("ab*", "abc"));
+  ASSERT_TRUE(Glob("ab*", "ab"));
+  ASSERT_FALSE(Glob("ab*", "a"));
+  ASSERT_FALSE(Glob("Foo*", "foo"));
+
+  ASSERT_TRUE(Glob("*", ""));
+  ASSERT_TRUE(Glob("*", "abc"));
+}
+
+TEST(GlobMatcherTest, MatchAll) {
+  ASSERT_TRUE(Glob("*c", "abc"));
+  ASSERT_FALSE(Glob("*c", "abd"));
+  ASSERT_TRUE(Glob("a*c", "ac"));
+  ASSERT_TRUE(Glob("a*c", "abbbc"));
+  ASSERT_FALSE(Glob("a*c", "abcd"));
+  ASSERT_TRUE(Glob("a*b*c", "aXbYc"));
+  ASSERT_FALSE(Glob("a*b*c", "aXcYb"));
+  ASSERT_TRUE(Glob("binder*reply", "binder transaction reply"));
+  ASSERT_TRUE(Glob("* foo *", "a foo b"));
+  ASSERT_FALSE(Glob("*.so", "libc.so.6"));
+}
+
+TEST(GlobMatcherTest, MatchOne) {
+  ASSERT_TRUE(Glob("a?c", "abc"));
+  ASSERT_FALSE(Glob("a?c", "ac"));
+  ASSERT_TRUE(Glob("a??", "abc"));
+  ASSERT_FALSE(Glob("*?", ""));
+  ASSERT_TRUE(Glob("*?", "a"));
+}
+
+TEST(GlobMatcherTest, Set) {
+  ASSERT_TRUE(Glob("[abc]", "b"));
+  ASSERT_FALSE(Glob("[abc]", "d"));
+  ASSERT_TRUE(Glob("[^abc]", "d"));
+  ASSERT_FALSE(Glob("[^abc]", "a"));
+
+  ASSERT_TRUE(Glob("[a-c]x", "bx"));
+  ASSERT_FALSE(Glob("[a-c]x", "dx"));
+  ASSERT_TRUE(Glob("[a-]", "-"));
+
+  // A ']' directly after the '[' is part of the set.
+  ASSERT_TRUE(Glob("[]]", "]"));
+  ASSERT_FALSE(Glob("[^]]", "]"));
+
+  // Unterminated sets never match.
+  ASSERT_FALSE(Glob("[abc", "a"));
+
+  ASSERT_TRUE(Glob("*[0-9]", "foo7"));
+  ASSERT_FALSE(Glob("*[0-9]", "foo"));
+  ASSERT_TRUE(Glob("*[0-9]x", "f1x2x"));
+}
+
+TEST(GlobMatcherTest, Utf8) {
+  ASSERT_TRUE(Glob("?", "\xc3\xa9"));
+  ASSERT_TRUE(Glob("\xc3\xa9*", "\xc3\xa9" "a"));
+  ASSERT_TRUE(Glob("*\xc3\xa9", "a\xc3\xa9"));
+  ASSERT_TRUE(Glob("[\xc3\xa9-\xc3\xaa]", "\xc3\xaa"));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/group_by.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+const char* AggregateName(Aggregate::Type type) {
+  switch (type) {
+    case Aggregate::Type::kCount:
+      return "count";
+    case Aggregate::Type::kSum:
+      return "sum";
+    case Aggregate::Type::kMin:
+      return "min";
+    case Aggregate::Type::kMax:
+      return "max";
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Returns the value of |column| at |row| for the purpose of aggregating it;
+// SQLite stores NaN doubles as null so they are ignored in the same way.
+SqlValue AggregatedValue(const Column& column, uint32_t row) {
+  SqlValue value = column.Get(row);
+  if (value.type == SqlValue::kDouble && isnan(value.double_value))
+    return SqlValue();
+  return value;
+}
+
+bool AddOverflows(int64_t a, int64_t b) {
+  return b > 0 ? a > std::numeric_limits<int64_t>::max() - b
+               : a < std::numeric_limits<int64_t>::min() - b;
+}
+
+// Computes |aggregate| on each group of |sorted|, where |starts| contains the
+// first row of each group, and appends the result as a new column of
+// |groups|. Returns false if a SUM overflows.
+bool ExtendWithAggregate(const Table& sorted,
+                         const std::vector<uint32_t>& starts,
+                         const Aggregate& aggregate,
+                         Table* groups) {
+  const Column* column =
+      aggregate.col_idx ? &sorted.GetColumn(*aggregate.col_idx) : nullptr;
+  auto group_end = [&sorted, &starts](size_t group) {
+    return group + 1 < starts.size() ? starts[group + 1] : sorted.row_count();
+  };
+
+  if (aggregate.type == Aggregate::Type::kCount) {
+    std::unique_ptr<NullableVector<int64_t>> counts(
+        new NullableVector<int64_t>());
+    for (size_t group = 0; group < starts.size(); ++group) {
+      uint32_t end = group_end(group);
+      int64_t count = 0;
+      for (uint32_t row = starts[group]; row < end; ++row)
+        count += !column || !AggregatedValue(*column, row).is_null();
+      counts->Append(count);
+    }
+    *groups = groups->ExtendWithColumn(AggregateName(aggregate.type),
+                                       std::move(counts),
+                                       Column::Flag::kNonNull);
+    return true;
+  }
+
+  PERFETTO_CHECK(column);
+  if (column->type() == SqlValue::kDouble) {
+    PERFETTO_CHECK(aggregate.type != Aggregate::Type::kSum);
+    std::unique_ptr<NullableVector<double>> values(
+        new NullableVector<double>());
+    for (size_t group = 0; group < starts.size(); ++group) {
+      uint32_t end = group_end(group);
+      base::Optional<double> result;
+      for (uint32_t row = starts[group]; row < end; ++row) {
+        SqlValue value = AggregatedValue(*column, row);
+        if (value.is_null())
+          continue;
+        double v = value.double_value;
+        if (!result) {
+          result = v;
+        } else if (aggregate.type == Aggregate::Type::kMin) {
+          result = std::min(*result, v);
+        } else {
+          result = std::max(*result, v);
+        }
+      }
+      values->Append(result);
+    }
+    *groups = groups->ExtendWithColumn(AggregateName(aggregate.type),
+                                       std::move(values),
+                                       Column::Flag::kNoFlag);
+    return true;
+  }
+
+  PERFETTO_CHECK(column->type() == SqlValue::kLong);
+  std::unique_ptr<NullableVector<int64_t>> values(
+      new NullableVector<int64_t>());
+  for (size_t group = 0; group < starts.size(); ++group) {
+    uint32_t end = group_end(group);
+    base::Optional<int64_t> result;
+    for (uint32_t row = starts[group]; row < end; ++row) {
+      SqlValue value = column->Get(row);
+      if (value.is_null())
+        continue;
+      int64_t v = value.long_value;
+      if (!result) {
+        result = v;
+        continue;
+      }
+      switch (aggregate.type) {
+        case Aggregate::Type::kSum:
+          if (AddOverflows(*result, v))
+            return false;
+          *result += v;
+          break;
+        case Aggregate::Type::kMin:
+          result = std::min(*result, v);
+          break;
+        case Aggregate::Type::kMax:
+          result = std::max(*result, v);
+          break;
+        case Aggregate::Type::kCount:
+          PERFETTO_FATAL("Handled above");
+      }
+    }
+    values->Append(result);
+  }
+  *groups = groups->ExtendWithColumn(AggregateName(aggregate.type),
+                                     std::move(values), Column::Flag::kNoFlag);
+  return true;
+}
+
+}  // namespace
+
+base::Optional<Table> GroupBy(const Table& table,
+                              const std::vector<uint32_t>& group_by,
+                              const std::vector<Aggregate>& aggregates) {
+  std::vector<Order> od;
+  for (uint32_t col : group_by)
+    od.push_back(Order{col, false});
+  Table sorted = table.Sort(od);
+
+  // Adjacent rows are in the same group if they have the same value in all the
+  // |group_by| columns.
+  std::vector<uint32_t> starts;
+  for (uint32_t row = 0; row < sorted.row_count(); ++row) {
+    auto differs = [&sorted, row](uint32_t col) {
+      return sorted.GetColumn(col).CompareRows(row - 1, row) != 0;
+    };
+    if (row == 0 || std::any_of(group_by.begin(), group_by.end(), differs))
+      starts.push_back(row);
+  }
+
+  Table groups = sorted.Apply(RowMap(starts));
+  for (const Aggregate& aggregate : aggregates) {
+    if (!ExtendWithAggregate(sorted, starts, aggregate, &groups))
+      return base::nullopt;
+  }
+  return groups;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
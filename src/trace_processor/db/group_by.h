@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_GROUP_BY_H_
+#define SRC_TRACE_PROCESSOR_DB_GROUP_BY_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// An aggregate function computed by GroupBy over the rows of each group.
+struct Aggregate {
+  enum class Type {
+    kCount,
+    kSum,
+    kMin,
+    kMax,
+  };
+  Type type;
+
+  // The aggregated column; unset for COUNT(*), which counts all the rows.
+  base::Optional<uint32_t> col_idx;
+};
+
+// Groups the rows of |table| which have the same values in the columns
+// |group_by| and computes |aggregates| over the rows of each group. Groups are
+// found by sorting |table| on |group_by| and scanning it once.
+//
+// The returned table has one row for each group, in increasing order of the
+// values of |group_by|. It has the columns of |table| (with their values in
+// the first row of the group) followed by one column for each aggregate. If
+// |group_by| is empty, all the rows are in a single group (and there are no
+// groups if |table| is empty).
+//
+// Aggregates have the semantics of the SQLite functions with the same name:
+// nulls are ignored and the SUM, MIN and MAX of a group without any non-null
+// value is null. SUM is only supported on integer columns and MIN and MAX on
+// integer and double columns. Returns nullopt if a SUM overflows (SQLite
+// fails the query in that case).
+base::Optional<Table> GroupBy(const Table& table,
+                              const std::vector<uint32_t>& group_by,
+                              const std::vector<Aggregate>& aggregates);
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_GROUP_BY_H_
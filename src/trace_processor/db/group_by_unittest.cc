@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/group_by.h"
+
+#include <limits>
+
+#include "src/trace_processor/tables/macros.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_TEST_GROUP_BY_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestGroupByTable, "group_by")                          \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)                \
+  C(base::Optional<int64_t>, key)                             \
+  C(StringPool::Id, name)                                     \
+  C(base::Optional<int64_t>, dur)                             \
+  C(double, value)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_GROUP_BY_TABLE_DEF);
+
+TestGroupByTable::~TestGroupByTable() = default;
+
+using Type = Aggregate::Type;
+
+class GroupByTest : public ::testing::Test {
+ protected:
+  void Insert(base::Optional<int64_t> key,
+              const char* name,
+              base::Optional<int64_t> dur,
+              double value) {
+    table_.Insert(TestGroupByTable::Row(key, pool_.InternString(name), dur,
+                                        value));
+  }
+
+  // Returns the values in the column |col| of |table| as strings.
+  static std::vector<std::string> Values(const Table& table, uint32_t col) {
+    std::vector<std::string> values;
+    for (auto it = table.IterateRows(); it; it.Next()) {
+      SqlValue value = it.Get(col);
+      switch (value.type) {
+        case SqlValue::kNull:
+          values.push_back("NULL");
+          break;
+        case SqlValue::kLong:
+          values.push_back(std::to_string(value.long_value));
+          break;
+        case SqlValue::kDouble:
+          values.push_back(std::to_string(value.double_value));
+          break;
+        case SqlValue::kString:
+          values.push_back(value.string_value);
+          break;
+        case SqlValue::kBytes:
+          values.push_back("BYTES");
+          break;
+      }
+    }
+    return values;
+  }
+
+  StringPool pool_;
+  TestGroupByTable table_{&pool_, nullptr};
+};
+
+TEST_F(GroupByTest, GroupsAreSortedAndNullsGrouped) {
+  Insert(2, "a", 10, 1.5);
+  Insert(base::nullopt, "b", 5, 0.5);
+  Insert(1, "a", base::nullopt, 2.5);
+  Insert(2, "b", 20, -1.0);
+  Insert(base::nullopt, "a", 1, 4.0);
+  Insert(1, "c", base::nullopt, 3.0);
+
+  uint32_t key = table_.key().index_in_table();
+  uint32_t dur = table_.dur().index_in_table();
+  uint32_t value = table_.value().index_in_table();
+  base::Optional<Table> groups =
+      GroupBy(table_, {key},
+              {Aggregate{Type::kCount, base::nullopt},
+               Aggregate{Type::kCount, dur}, Aggregate{Type::kSum, dur},
+               Aggregate{Type::kMin, value}, Aggregate{Type::kMax, dur}});
+  ASSERT_TRUE(groups);
+
+  uint32_t first = table_.GetColumnCount();
+  using S = std::vector<std::string>;
+  ASSERT_EQ(Values(*groups, key), (S{"NULL", "1", "2"}));
+  ASSERT_EQ(Values(*groups, first), (S{"2", "2", "2"}));
+  ASSERT_EQ(Values(*groups, first + 1), (S{"2", "0", "2"}));
+  ASSERT_EQ(Values(*groups, first + 2), (S{"6", "NULL", "30"}));
+  ASSERT_EQ(Values(*groups, first + 3),
+            (S{"0.500000", "2.500000", "-1.000000"}));
+  ASSERT_EQ(Values(*groups, first + 4), (S{"5", "NULL", "20"}));
+}
+
+TEST_F(GroupByTest, MultipleColumnsAndNoGroupBy) {
+  Insert(1, "b", 1, 0);
+  Insert(1, "a", 2, 0);
+  Insert(2, "a", 3, 0);
+  Insert(1, "b", 4, 0);
+
+  uint32_t key = table_.key().index_in_table();
+  uint32_t name = table_.name().index_in_table();
+  uint32_t dur = table_.dur().index_in_table();
+  base::Optional<Table> groups =
+      GroupBy(table_, {name, key}, {Aggregate{Type::kSum, dur}});
+  ASSERT_TRUE(groups);
+
+  uint32_t sum = table_.GetColumnCount();
+  using S = std::vector<std::string>;
+  ASSERT_EQ(Values(*groups, name), (S{"a", "a", "b"}));
+  ASSERT_EQ(Values(*groups, key), (S{"1", "2", "1"}));
+  ASSERT_EQ(Values(*groups, sum), (S{"2", "3", "5"}));
+
+  groups = GroupBy(table_, {}, {Aggregate{Type::kCount, base::nullopt}});
+  ASSERT_TRUE(groups);
+  ASSERT_EQ(Values(*groups, sum), (S{"4"}));
+
+  groups = GroupBy(table_.Filter({table_.key().eq(3)}), {},
+                   {Aggregate{Type::kCount, base::nullopt}});
+  ASSERT_TRUE(groups);
+  ASSERT_EQ(groups->row_count(), 0u);
+}
+
+TEST_F(GroupByTest, SumOverflow) {
+  Insert(1, "a", std::numeric_limits<int64_t>::max(), 0);
+  Insert(1, "a", 1, 0);
+  uint32_t dur = table_.dur().index_in_table();
+  ASSERT_FALSE(GroupBy(table_, {}, {Aggregate{Type::kSum, dur}}));
+  ASSERT_TRUE(GroupBy(table_, {}, {Aggregate{Type::kMax, dur}}));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/query_profiler.h"
+
+#include <atomic>
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+uint64_t NextProfilerId() {
+  static std::atomic<uint64_t> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+PERFETTO_THREAD_LOCAL QueryProfiler* QueryProfiler::current_ = nullptr;
+
+QueryProfiler::QueryProfiler() : id_(NextProfilerId()) {}
+
+QueryProfiler::~QueryProfiler() = default;
+
+void QueryProfiler::RecordColumnFilter(const char* column,
+                                       uint32_t rows_scanned,
+                                       uint32_t rows_returned,
+                                       int64_t filter_ns) {
+  // Filters done outside of any operator are attributed to an unnamed
+  // operator.
+  std::string op = current_operator_ ? *current_operator_ : std::string();
+  ColumnStats& stats = columns_[std::make_pair(std::move(op), column)];
+  stats.filters++;
+  stats.rows_scanned += rows_scanned;
+  stats.rows_returned += rows_returned;
+  stats.filter_ns += filter_ns;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
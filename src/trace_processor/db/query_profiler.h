@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_QUERY_PROFILER_H_
+#define SRC_TRACE_PROCESSOR_DB_QUERY_PROFILER_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include "perfetto/base/compiler.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Records where the time of a query goes, in the spirit of EXPLAIN ANALYZE:
+// for each operator (a virtual table, or a db table queried directly, see
+// DirectTableQuery) the number of cursors, filters, rows scanned and
+// returned and the time spent in them, and for each column the time spent
+// filtering it.
+//
+// A profiler only records the work done on the thread it is activated on
+// (see ScopedActivation) so queries running concurrently on other threads
+// (e.g. in other query sessions) are not attributed to it.
+class QueryProfiler {
+ public:
+  struct OperatorStats {
+    // The number of cursors opened and of calls to xFilter.
+    uint64_t cursors = 0;
+    uint64_t filters = 0;
+
+    // The number of rows the filters started from (only known for the tables
+    // backed by a db table) and the number of rows returned.
+    uint64_t rows_scanned = 0;
+    uint64_t rows_returned = 0;
+
+    // The number of filters answered from the query cache.
+    uint64_t cache_hits = 0;
+
+    // The time spent in xFilter and xNext, including the time spent in the
+    // operators they query (e.g. the children of a span join). |compute_ns|
+    // is the part of |filter_ns| spent computing the table of a table
+    // function.
+    int64_t filter_ns = 0;
+    int64_t next_ns = 0;
+    int64_t compute_ns = 0;
+  };
+
+  struct ColumnStats {
+    // The number of calls to Column::FilterInto, the number of rows they
+    // started from and kept and the time spent in them.
+    uint64_t filters = 0;
+    uint64_t rows_scanned = 0;
+    uint64_t rows_returned = 0;
+    int64_t filter_ns = 0;
+  };
+
+  // Makes |profiler| (if not null) the profiler of the current thread until
+  // destroyed.
+  class ScopedActivation {
+   public:
+    explicit ScopedActivation(QueryProfiler* profiler) {
+      if (PERFETTO_LIKELY(!profiler))
+        return;
+      active_ = true;
+      prev_ = current_;
+      current_ = profiler;
+    }
+    ~ScopedActivation() {
+      if (PERFETTO_UNLIKELY(active_))
+        current_ = prev_;
+    }
+
+    ScopedActivation(const ScopedActivation&) = delete;
+    ScopedActivation& operator=(const ScopedActivation&) = delete;
+
+   private:
+    bool active_ = false;
+    QueryProfiler* prev_ = nullptr;
+  };
+
+  // Attributes the columns filtered while alive to the operator |name|, which
+  // must outlive it.
+  class ScopedOperator {
+   public:
+    ScopedOperator(QueryProfiler* profiler, const std::string* name)
+        : profiler_(profiler) {
+      if (!profiler_)
+        return;
+      prev_ = profiler_->current_operator_;
+      profiler_->current_operator_ = name;
+    }
+    ~ScopedOperator() {
+      if (profiler_)
+        profiler_->current_operator_ = prev_;
+    }
+
+    ScopedOperator(const ScopedOperator&) = delete;
+    ScopedOperator& operator=(const ScopedOperator&) = delete;
+
+   private:
+    QueryProfiler* profiler_ = nullptr;
+    const std::string* prev_ = nullptr;
+  };
+
+  QueryProfiler();
+  ~QueryProfiler();
+
+  QueryProfiler(const QueryProfiler&) = delete;
+  QueryProfiler& operator=(const QueryProfiler&) = delete;
+
+  // Returns the profiler of the current thread, null if the query running on
+  // it is not profiled.
+  static QueryProfiler* current() { return current_; }
+
+  // Returns the stats of the operator |name|. The pointer is valid for the
+  // lifetime of the profiler.
+  OperatorStats* GetOperatorStats(const std::string& name) {
+    return &operators_[name];
+  }
+
+  // Records a call to Column::FilterInto on the column |column| of the current
+  // operator.
+  void RecordColumnFilter(const char* column,
+                          uint32_t rows_scanned,
+                          uint32_t rows_returned,
+                          int64_t filter_ns);
+
+  // Uniquely identifies this profiler among the profilers of the process, so
+  // that the stats of an operator can be cached across calls (see
+  // SqliteTable).
+  uint64_t id() const { return id_; }
+
+  const std::map<std::string, OperatorStats>& operators() const {
+    return operators_;
+  }
+
+  // Keyed by operator and column name.
+  const std::map<std::pair<std::string, std::string>, ColumnStats>& columns()
+      const {
+    return columns_;
+  }
+
+ private:
+  static PERFETTO_THREAD_LOCAL QueryProfiler* current_;
+
+  const uint64_t id_;
+  const std::string* current_operator_ = nullptr;
+
+  std::map<std::string, OperatorStats> operators_;
+  std::map<std::pair<std::string, std::string>, ColumnStats> columns_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DB_QUERY_PROFILER_H_
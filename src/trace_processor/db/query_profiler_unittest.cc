@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/query_profiler.h"
+
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/tables/macros.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_TEST_PROFILE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestProfileTable, "profile")                         \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)              \
+  C(int64_t, ts, Column::Flag::kSorted)                     \
+  C(int64_t, value)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_PROFILE_TABLE_DEF);
+
+TestProfileTable::~TestProfileTable() = default;
+
+class QueryProfilerTest : public ::testing::Test {
+ protected:
+  QueryProfilerTest() {
+    for (int64_t i = 0; i < 100; ++i) {
+      TestProfileTable::Row row;
+      row.ts = i;
+      row.value = i % 10;
+      table_.Insert(row);
+    }
+  }
+
+  std::vector<Constraint> Constraints() {
+    return {table_.ts().ge(50), table_.value().eq(3)};
+  }
+
+  StringPool pool_;
+  TestProfileTable table_{&pool_, nullptr};
+};
+
+TEST_F(QueryProfilerTest, NotActive) {
+  QueryProfiler profiler;
+  ASSERT_EQ(QueryProfiler::current(), nullptr);
+  ASSERT_EQ(table_.Filter(Constraints()).row_count(), 5u);
+  ASSERT_TRUE(profiler.columns().empty());
+}
+
+TEST_F(QueryProfilerTest, ColumnFilters) {
+  QueryProfiler profiler;
+  std::string op = "profile";
+  {
+    QueryProfiler::ScopedActivation activation(&profiler);
+    ASSERT_EQ(QueryProfiler::current(), &profiler);
+    QueryProfiler::ScopedOperator scoped_op(&profiler, &op);
+    ASSERT_EQ(table_.Filter(Constraints()).row_count(), 5u);
+  }
+  ASSERT_EQ(QueryProfiler::current(), nullptr);
+
+  const auto& columns = profiler.columns();
+  ASSERT_EQ(columns.size(), 2u);
+
+  const auto& ts = columns.at(std::make_pair(op, std::string("ts")));
+  ASSERT_EQ(ts.filters, 1u);
+  ASSERT_EQ(ts.rows_scanned, 100u);
+  ASSERT_EQ(ts.rows_returned, 50u);
+
+  const auto& value = columns.at(std::make_pair(op, std::string("value")));
+  ASSERT_EQ(value.filters, 1u);
+  ASSERT_EQ(value.rows_scanned, 50u);
+  ASSERT_EQ(value.rows_returned, 5u);
+}
+
+TEST_F(QueryProfilerTest, NestedActivation) {
+  QueryProfiler outer;
+  QueryProfiler inner;
+  ASSERT_NE(outer.id(), inner.id());
+
+  QueryProfiler::ScopedActivation outer_activation(&outer);
+  {
+    QueryProfiler::ScopedActivation inner_activation(&inner);
+    table_.Filter(Constraints());
+
+    // Activating no profiler keeps the current one.
+    QueryProfiler::ScopedActivation null_activation(nullptr);
+    ASSERT_EQ(QueryProfiler::current(), &inner);
+  }
+  ASSERT_EQ(QueryProfiler::current(), &outer);
+  ASSERT_TRUE(outer.columns().empty());
+
+  // Without an operator, the columns are attributed to an unnamed one.
+  ASSERT_EQ(inner.columns().size(), 2u);
+  ASSERT_EQ(inner.columns().begin()->first.first, "");
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
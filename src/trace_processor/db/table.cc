@@ -16,6 +16,10 @@
 
 #include "src/trace_processor/db/table.h"
 
+#include <algorithm>
+
+#include "perfetto/base/time.h"
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -54,6 +58,40 @@ Table Table::Copy() const {
   return table;
 }
 
+void Table::CompressStorage() {
+  for (Column& col : columns_) {
+    col.CompressStorage();
+  }
+}
+
+void Table::GetSpillableColumns(std::vector<Column*>* columns) {
+  for (Column& col : columns_) {
+    if (col.SpillableStorageSizeBytes() > 0)
+      columns->push_back(&col);
+  }
+}
+
+void Table::BuildRankSelectIndexes() {
+  for (RowMap& rm : row_maps_) {
+    rm.BuildRankSelectIndex();
+  }
+  for (Column& col : columns_) {
+    col.BuildRankSelectIndex();
+  }
+}
+
+uint64_t Table::mutation_count() const {
+  // The counters of the storage only ever increase: their sum changes when
+  // any of them does. Id columns have no storage but the row count covers
+  // them.
+  uint64_t count = row_count_;
+  for (const Column& col : columns_) {
+    if (col.storage())
+      count += col.storage()->mutation_count();
+  }
+  return count;
+}
+
 Table Table::CopyExceptRowMaps() const {
   Table table(string_pool_, nullptr);
   table.row_count_ = row_count_;
@@ -64,6 +102,20 @@ Table Table::CopyExceptRowMaps() const {
   return table;
 }
 
+void Table::FilterIntoProfiled(const std::vector<Constraint>& cs,
+                               QueryProfiler* profiler,
+                               RowMap* rm) const {
+  for (const Constraint& c : cs) {
+    const Column& col = columns_[c.col_idx];
+    uint32_t rows_scanned = rm->size();
+    base::TimeNanos start = base::GetWallTimeNs();
+    col.FilterInto(c.op, c.value, rm);
+    int64_t filter_ns = (base::GetWallTimeNs() - start).count();
+    profiler->RecordColumnFilter(col.name(), rows_scanned, rm->size(),
+                                 filter_ns);
+  }
+}
+
 Table Table::Sort(const std::vector<Order>& od) const {
   if (od.empty())
     return Copy();
@@ -120,10 +172,54 @@ Table Table::Sort(const std::vector<Order>& od) const {
       columns_[it->col_idx].StableSort(it->desc, &idx);
     }
   }
+  return SelectSortedRows(std::move(idx), od);
+}
+
+Table Table::SortAndLimit(const std::vector<Order>& od, uint32_t limit) const {
+  if (limit >= row_count_)
+    return Sort(od);
+
+  // If the table is already in the right order, just keep its first rows.
+  bool sorted_by_first_col =
+      !od.empty() && GetColumn(od.front().col_idx).IsSorted();
+  if (od.empty() || (od.size() == 1 && sorted_by_first_col &&
+                     !od.front().desc)) {
+    return Apply(RowMap(0, limit));
+  }
+
+  std::vector<uint32_t> idx(row_count_);
+  if (od.size() == 1 && sorted_by_first_col) {
+    // As in Sort, the order is the reverse of the one of the table.
+    std::iota(idx.rbegin(), idx.rend(), 0);
+    idx.resize(limit);
+    return SelectSortedRows(std::move(idx), od);
+  }
+
+  // Unlike Sort, we cannot sort one column at a time as only the first |limit|
+  // rows for the last column are kept. Instead, compare the rows on all the
+  // columns at once, breaking ties by the row index to give the same order as
+  // the stable sort. std::partial_sort keeps the best |limit| rows in a heap
+  // while scanning the table, which only needs O(n * log(limit)) comparisons.
+  std::iota(idx.begin(), idx.end(), 0);
+  auto less = [this, &od](uint32_t a, uint32_t b) {
+    for (const Order& o : od) {
+      int res = columns_[o.col_idx].CompareRows(a, b);
+      if (res != 0)
+        return o.desc ? res > 0 : res < 0;
+    }
+    return a < b;
+  };
+  std::partial_sort(idx.begin(), idx.begin() + limit, idx.end(), less);
+  idx.resize(limit);
+  return SelectSortedRows(std::move(idx), od);
+}
 
+Table Table::SelectSortedRows(std::vector<uint32_t> idx,
+                              const std::vector<Order>& od) const {
   // Return a copy of this table with the RowMaps using the computed ordered
   // RowMap.
   Table table = CopyExceptRowMaps();
+  table.row_count_ = static_cast<uint32_t>(idx.size());
   RowMap rm(std::move(idx));
   for (const RowMap& map : row_maps_) {
     table.row_maps_.emplace_back(map.SelectRows(rm));
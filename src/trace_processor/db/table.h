@@ -27,6 +27,7 @@
 #include "perfetto/ext/base/optional.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/query_profiler.h"
 #include "src/trace_processor/db/typed_column.h"
 
 namespace perfetto {
@@ -111,6 +112,11 @@ class Table {
       const std::vector<Constraint>& cs,
       RowMap::OptimizeFor optimize_for = RowMap::OptimizeFor::kMemory) const {
     RowMap rm(0, row_count_, optimize_for);
+    QueryProfiler* profiler = QueryProfiler::current();
+    if (PERFETTO_UNLIKELY(profiler)) {
+      FilterIntoProfiled(cs, profiler, &rm);
+      return rm;
+    }
     for (const Constraint& c : cs) {
       columns_[c.col_idx].FilterInto(c.op, c.value, &rm);
     }
@@ -134,6 +140,12 @@ class Table {
   // Sorts the Table using the specified order by constraints.
   Table Sort(const std::vector<Order>& od) const;
 
+  // Returns the first |limit| rows of the table sorted using the specified
+  // order by constraints. This is equivalent to sorting the whole table and
+  // dropping all but its first |limit| rows but only takes
+  // O(n * log(limit)) time.
+  Table SortAndLimit(const std::vector<Order>& od, uint32_t limit) const;
+
   // Joins |this| table with the |other| table using the values of column |left|
   // of |this| table to lookup the row in |right| column of the |other| table.
   //
@@ -214,7 +226,27 @@ class Table {
   // Creates a copy of this table.
   Table Copy() const;
 
+  // Compresses the storage of all the integer columns in this table. Should
+  // only be called once the table is fully built as modifying a column
+  // decompresses it again.
+  void CompressStorage();
+
+  // Appends the columns of this table whose storage can be moved to a
+  // SpillFile (see Column::SpillStorage) to |columns|.
+  void GetSpillableColumns(std::vector<Column*>* columns);
+
+  // Builds rank/select indexes for the RowMaps and the sparse columns of this
+  // table so that looking up the value of a row takes constant time. Should
+  // only be called once the table is fully built as the indexes are dropped
+  // when the table is modified.
+  void BuildRankSelectIndexes();
+
   uint32_t row_count() const { return row_count_; }
+
+  // Returns a number which changes whenever rows are inserted into this table
+  // or values of its columns are set, including through another table
+  // sharing the columns (e.g. a parent or child table).
+  uint64_t mutation_count() const;
   const std::vector<RowMap>& row_maps() const { return row_maps_; }
 
  protected:
@@ -230,6 +262,17 @@ class Table {
   friend class Column;
 
   Table CopyExceptRowMaps() const;
+
+  // Same as the loop in FilterToRowMap but records the time spent filtering
+  // each column in |profiler|.
+  void FilterIntoProfiled(const std::vector<Constraint>& cs,
+                          QueryProfiler* profiler,
+                          RowMap* rm) const;
+
+  // Returns a copy of this table with the rows at the indices |idx|, in
+  // that order, where |idx| is the result of sorting the table using |od|.
+  Table SelectSortedRows(std::vector<uint32_t> idx,
+                         const std::vector<Order>& od) const;
 };
 
 }  // namespace trace_processor
@@ -15,6 +15,9 @@
  */
 
 #include "src/trace_processor/db/table.h"
+
+#include <random>
+
 #include "perfetto/ext/base/optional.h"
 #include "src/trace_processor/db/typed_column.h"
 #include "src/trace_processor/tables/macros.h"
@@ -48,6 +51,25 @@ PERFETTO_TP_TABLE(PERFETTO_TP_TEST_EVENT_TABLE_DEF);
 
 TestEventTable::~TestEventTable() = default;
 
+#define PERFETTO_TP_TEST_SORT_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestSortTable, "sort")                             \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)            \
+  C(int64_t, ts, Column::Flag::kSorted)                   \
+  C(base::Optional<int64_t>, dur)                         \
+  C(StringPool::Id, name)                                 \
+  C(double, value)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_SORT_TABLE_DEF);
+
+TestSortTable::~TestSortTable() = default;
+
+std::vector<int64_t> Ids(const Table& table) {
+  std::vector<int64_t> ids;
+  uint32_t id_col = table.GetColumnByName("id")->index_in_table();
+  for (auto it = table.IterateRows(); it; it.Next())
+    ids.push_back(it.Get(id_col).long_value);
+  return ids;
+}
+
 TEST(TableTest, ExtendingTableTwice) {
   StringPool pool;
   TestEventTable table{&pool, nullptr};
@@ -65,6 +87,53 @@ TEST(TableTest, ExtendingTableTwice) {
   ASSERT_TRUE(filtered_table.GetColumnByName("b")->Max().has_value());
 }
 
+TEST(TableTest, SortAndLimitMatchesSort) {
+  StringPool pool;
+  TestSortTable table{&pool, nullptr};
+
+  std::minstd_rand0 rnd(0);
+  StringPool::Id names[] = {pool.InternString("a"), pool.InternString("b"),
+                            StringPool::Id::Null()};
+  for (int64_t ts = 0; ts < 500; ++ts) {
+    TestSortTable::Row row;
+    row.ts = ts;
+    if (rnd() % 5 != 0)
+      row.dur = static_cast<int64_t>(rnd() % 20);
+    row.name = names[rnd() % 3];
+    row.value = static_cast<double>(rnd() % 7) / 2;
+    table.Insert(row);
+  }
+
+  uint32_t ts = table.ts().index_in_table();
+  uint32_t dur = table.dur().index_in_table();
+  uint32_t name = table.name().index_in_table();
+  uint32_t value = table.value().index_in_table();
+  std::vector<std::vector<Order>> orders = {
+      {},
+      {Order{ts, false}},
+      {Order{ts, true}},
+      {Order{dur, true}},
+      {Order{name, false}, Order{dur, true}},
+      {Order{value, false}, Order{name, true}, Order{ts, true}},
+  };
+
+  // Also check the result on a filtered table, with a non-range RowMap.
+  Table filtered = table.Filter({table.dur().ne(3)});
+  const Table* tables[] = {&table, &filtered};
+  for (const Table* t : tables) {
+    for (const auto& od : orders) {
+      std::vector<int64_t> sorted = Ids(t->Sort(od));
+      for (uint32_t limit : {0u, 1u, 10u, 100u, t->row_count(), 1000u}) {
+        std::vector<int64_t> expected(
+            sorted.begin(),
+            sorted.begin() + std::min<ptrdiff_t>(limit, t->row_count()));
+        ASSERT_EQ(Ids(t->SortAndLimit(od, limit)), expected)
+            << "limit " << limit << ", " << od.size() << " orders";
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
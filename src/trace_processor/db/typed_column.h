@@ -86,7 +86,10 @@ struct TypedColumn : public Column {
   // Sets the data in the column at index |row|.
   void Set(uint32_t row, non_optional_type v) {
     auto serialized = Serializer::Serialize(v);
-    mutable_nullable_vector()->Set(row_map().Get(row), serialized);
+    uint32_t idx = row_map().Get(row);
+    RemoveFromEqIndex(idx);
+    mutable_nullable_vector()->Set(idx, serialized);
+    AddToEqIndex(idx);
   }
 
   // Inserts the value at the end of the column.
@@ -94,6 +97,11 @@ struct TypedColumn : public Column {
     mutable_nullable_vector()->Append(Serializer::Serialize(v));
   }
 
+  // Inserts the |count| values starting at |vs| at the end of the column.
+  void AppendRange(const T* vs, uint32_t count) {
+    AppendRange(vs, count, std::is_same<T, serialized_type>());
+  }
+
   // Returns the row containing the given value in the Column.
   base::Optional<uint32_t> IndexOf(sql_value_type v) const {
     return Column::IndexOf(ToValue(v));
@@ -153,6 +161,15 @@ struct TypedColumn : public Column {
   NullableVector<serialized_type>* mutable_nullable_vector() {
     return Column::mutable_nullable_vector<serialized_type>();
   }
+
+  // The values can be copied as is when they don't need to be serialized.
+  void AppendRange(const T* vs, uint32_t count, std::true_type) {
+    mutable_nullable_vector()->AppendRange(vs, count);
+  }
+  void AppendRange(const T* vs, uint32_t count, std::false_type) {
+    for (uint32_t i = 0; i < count; ++i)
+      Append(vs[i]);
+  }
 };
 
 // Represents a column containing ids.
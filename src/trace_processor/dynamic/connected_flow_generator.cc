@@ -16,15 +16,20 @@
 
 #include "src/trace_processor/dynamic/connected_flow_generator.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
-#include <queue>
-#include <set>
+#include <utility>
 
-#include "src/trace_processor/dynamic/ancestor_generator.h"
-#include "src/trace_processor/dynamic/descendant_generator.h"
-#include "src/trace_processor/importers/common/flow_tracker.h"
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
+#include "src/trace_processor/containers/nested_set_index.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -67,69 +72,92 @@ enum RelativesVisitMode : uint8_t {
 };
 
 // Searches through the slice table recursively to find connected flows.
+// Slices are identified by their row in the slice table.
 // Usage:
-//  BFS bfs = BFS(context);
+//  BFS bfs = BFS(slices, flow_index, nesting_index);
 //  bfs
 //    // Add list of slices to start with.
-//    .Start(start_id).Start(start_id2)
-//    // Additionally include relatives of |another_id| in search space.
-//    .GoToRelatives(another_id, VISIT_ANCESTORS)
+//    .Start(start_row).Start(start_row2)
+//    // Additionally include relatives of |another_row| in search space.
+//    .GoToRelatives(another_row, VISIT_ANCESTORS)
 //    // Visit all connected slices to the above slices.
 //    .VisitAll(VISIT_INCOMING, VISIT_NO_RELATIVES);
 //
 //  bfs.TakeResultingFlows();
+//
+// The indexes are only read, so that searches can run concurrently. A BFS
+// can be reused for another search after TakeResultingFlows(), which avoids
+// allocating the set of known slices again.
 class BFS {
  public:
-  BFS(TraceProcessorContext* context) : context_(context) {}
-
-  RowMap TakeResultingFlows() && { return RowMap(std::move(flow_rows_)); }
+  BFS(const tables::SliceTable& slices,
+      const TraceStorage::FlowIndex& flow_index,
+      const NestedSetIndex& nesting_index)
+      : slices_(slices),
+        flow_index_(flow_index),
+        nesting_index_(nesting_index),
+        known_slices_(slices.row_count()) {}
+
+  // Returns the flows found by the search and resets the search.
+  std::vector<uint32_t> TakeResultingFlows() {
+    for (const auto& slice : slices_to_visit_)
+      known_slices_[slice.first] = false;
+    slices_to_visit_.clear();
+    next_slice_to_visit_ = 0;
+
+    std::vector<uint32_t> flow_rows;
+    std::swap(flow_rows, flow_rows_);
+    return flow_rows;
+  }
 
-  // Includes a starting slice ID to search.
-  BFS& Start(SliceId start_id) {
-    slices_to_visit_.push({start_id, VisitType::START});
-    known_slices_.insert(start_id);
+  // Includes a starting slice to search.
+  BFS& Start(uint32_t start_row) {
+    Push(start_row, VisitType::START);
     return *this;
   }
 
   // Visits all slices that can be reached from the given starting slices.
   void VisitAll(FlowVisitMode visit_flow, RelativesVisitMode visit_relatives) {
-    while (!slices_to_visit_.empty()) {
-      SliceId slice_id = slices_to_visit_.front().first;
-      VisitType visit_type = slices_to_visit_.front().second;
-      slices_to_visit_.pop();
+    while (next_slice_to_visit_ < slices_to_visit_.size()) {
+      uint32_t slice_row = slices_to_visit_[next_slice_to_visit_].first;
+      VisitType visit_type = slices_to_visit_[next_slice_to_visit_].second;
+      ++next_slice_to_visit_;
 
       // If the given slice is being visited due to being ancestor or descendant
       // of a previous one, do not compute ancestors or descendants again as the
       // result is going to be the same.
       if (visit_type != VisitType::VIA_RELATIVE) {
-        GoToRelatives(slice_id, visit_relatives);
+        GoToRelatives(slice_row, visit_relatives);
       }
 
       // If the slice was visited by a flow, do not try to go back.
       if ((visit_flow & VISIT_INCOMING) &&
           visit_type != VisitType::VIA_OUTGOING_FLOW) {
-        GoByFlow(slice_id, FlowDirection::INCOMING);
+        GoByFlow(slice_row, FlowDirection::INCOMING);
       }
       if ((visit_flow & VISIT_OUTGOING) &&
           visit_type != VisitType::VIA_INCOMING_FLOW) {
-        GoByFlow(slice_id, FlowDirection::OUTGOING);
+        GoByFlow(slice_row, FlowDirection::OUTGOING);
       }
     }
   }
 
-  // Includes the relatives of |slice_id| to the list of slices to visit.
-  BFS& GoToRelatives(SliceId slice_id, RelativesVisitMode visit_relatives) {
+  // Includes the relatives of |slice_row| to the list of slices to visit.
+  BFS& GoToRelatives(uint32_t slice_row, RelativesVisitMode visit_relatives) {
     if (visit_relatives & VISIT_ANCESTORS) {
-      base::Optional<RowMap> ancestors = AncestorGenerator::GetAncestorSlices(
-          context_->storage->slice_table(), slice_id);
-      if (ancestors)
-        GoToRelativesImpl(ancestors->IterateRows());
+      // Closest ancestor first.
+      base::Optional<SliceId> parent_id = slices_.parent_id()[slice_row];
+      while (parent_id) {
+        uint32_t parent_row = *slices_.id().IndexOf(*parent_id);
+        MaybePush(parent_row, VisitType::VIA_RELATIVE);
+        parent_id = slices_.parent_id()[parent_row];
+      }
     }
     if (visit_relatives & VISIT_DESCENDANTS) {
-      base::Optional<RowMap> descendants =
-          DescendantGenerator::GetDescendantSlices(
-              context_->storage->slice_table(), slice_id);
-      GoToRelativesImpl(descendants->IterateRows());
+      descendants_.clear();
+      nesting_index_.GetDescendants(slice_row, &descendants_);
+      for (uint32_t descendant_row : descendants_)
+        MaybePush(descendant_row, VisitType::VIA_RELATIVE);
     }
     return *this;
   }
@@ -147,55 +175,120 @@ class BFS {
     VIA_RELATIVE,
   };
 
-  void GoByFlow(SliceId slice_id, FlowDirection flow_direction) {
-    PERFETTO_DCHECK(known_slices_.count(slice_id) != 0);
+  void GoByFlow(uint32_t slice_row, FlowDirection flow_direction) {
+    PERFETTO_DCHECK(known_slices_[slice_row]);
 
-    const auto& flow = context_->storage->flow_table();
-
-    const TypedColumn<SliceId>& start_col =
-        (flow_direction == FlowDirection::OUTGOING ? flow.slice_out()
-                                                   : flow.slice_in());
-    const TypedColumn<SliceId>& end_col =
-        (flow_direction == FlowDirection::OUTGOING ? flow.slice_in()
-                                                   : flow.slice_out());
-
-    auto rows = flow.FilterToRowMap({start_col.eq(slice_id.value)});
-
-    for (auto row_it = rows.IterateRows(); row_it; row_it.Next()) {
-      flow_rows_.push_back(row_it.row());
-      SliceId next_slice_id = end_col[row_it.row()];
-      if (known_slices_.count(next_slice_id) != 0) {
-        continue;
-      }
+    bool outgoing = flow_direction == FlowDirection::OUTGOING;
+    const std::vector<uint32_t>& offsets =
+        outgoing ? flow_index_.out_offsets : flow_index_.in_offsets;
+    const std::vector<TraceStorage::FlowIndex::Flow>& flows =
+        outgoing ? flow_index_.out_flows : flow_index_.in_flows;
 
-      known_slices_.insert(next_slice_id);
-      slices_to_visit_.push(
-          {next_slice_id, flow_direction == FlowDirection::INCOMING
-                              ? VisitType::VIA_INCOMING_FLOW
-                              : VisitType::VIA_OUTGOING_FLOW});
+    for (uint32_t i = offsets[slice_row]; i < offsets[slice_row + 1]; ++i) {
+      flow_rows_.push_back(flows[i].flow_row);
+      MaybePush(flows[i].slice_row, outgoing ? VisitType::VIA_OUTGOING_FLOW
+                                             : VisitType::VIA_INCOMING_FLOW);
     }
   }
 
-  void GoToRelativesImpl(RowMap::Iterator it) {
-    const auto& slice = context_->storage->slice_table();
-    for (; it; it.Next()) {
-      auto relative_slice_id = slice.id()[it.row()];
-      if (known_slices_.count(relative_slice_id))
-        continue;
-      known_slices_.insert(relative_slice_id);
-      slices_to_visit_.push({relative_slice_id, VisitType::VIA_RELATIVE});
-    }
+  void MaybePush(uint32_t slice_row, VisitType visit_type) {
+    if (!known_slices_[slice_row])
+      Push(slice_row, visit_type);
+  }
+
+  void Push(uint32_t slice_row, VisitType visit_type) {
+    known_slices_[slice_row] = true;
+    slices_to_visit_.emplace_back(slice_row, visit_type);
   }
 
-  std::queue<std::pair<SliceId, VisitType>> slices_to_visit_;
-  std::set<SliceId> known_slices_;
+  const tables::SliceTable& slices_;
+  const TraceStorage::FlowIndex& flow_index_;
+  const NestedSetIndex& nesting_index_;
+
+  // All the slices found so far, in the order they are visited: the ones
+  // before |next_slice_to_visit_| have already been visited. As a slice is
+  // only pushed once, this also lists the slices set in |known_slices_|.
+  std::vector<std::pair<uint32_t, VisitType>> slices_to_visit_;
+  size_t next_slice_to_visit_ = 0;
+
+  // Indexed by slice row.
+  std::vector<bool> known_slices_;
+
   std::vector<uint32_t> flow_rows_;
 
-  TraceProcessorContext* context_;
+  // Scratch space for the descendants of a slice.
+  std::vector<uint32_t> descendants_;
 };
 
+std::vector<uint32_t> FindConnectedFlows(BFS* bfs,
+                                         ConnectedFlowGenerator::Mode mode,
+                                         uint32_t start_row) {
+  switch (mode) {
+    case ConnectedFlowGenerator::Mode::kDirectlyConnectedFlow:
+      bfs->Start(start_row).VisitAll(VISIT_INCOMING_AND_OUTGOING,
+                                     VISIT_NO_RELATIVES);
+      break;
+    case ConnectedFlowGenerator::Mode::kFollowingFlow:
+      bfs->Start(start_row).VisitAll(VISIT_OUTGOING, VISIT_DESCENDANTS);
+      break;
+    case ConnectedFlowGenerator::Mode::kPrecedingFlow:
+      bfs->Start(start_row).VisitAll(VISIT_INCOMING, VISIT_ANCESTORS);
+      break;
+  }
+  return bfs->TakeResultingFlows();
+}
+
 }  // namespace
 
+// static
+std::vector<std::vector<uint32_t>> ConnectedFlowGenerator::GetConnectedFlows(
+    TraceStorage* storage,
+    Mode mode,
+    const std::vector<SliceId>& start_ids,
+    uint32_t worker_threads) {
+  const auto& slice = storage->slice_table();
+
+  // The indexes are (re)built here, on the calling thread: the searches then
+  // only read them.
+  const TraceStorage::FlowIndex& flow_index = storage->GetFlowIndex();
+  const NestedSetIndex& nesting_index = storage->GetSliceNestingIndex();
+
+  std::vector<uint32_t> start_rows;
+  start_rows.reserve(start_ids.size());
+  for (SliceId start_id : start_ids)
+    start_rows.push_back(*slice.id().IndexOf(start_id));
+
+  std::vector<std::vector<uint32_t>> result(start_rows.size());
+  std::atomic<size_t> next_start{0};
+  auto search = [&] {
+    BFS bfs(slice, flow_index, nesting_index);
+    for (;;) {
+      size_t idx = next_start.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= start_rows.size())
+        return;
+      result[idx] = FindConnectedFlows(&bfs, mode, start_rows[idx]);
+    }
+  };
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // Threads are not available (e.g. in WASM builds without pthreads).
+  base::ignore_result(worker_threads);
+  search();
+#else
+  // The calling thread also takes part in the search, so spawn one thread
+  // less.
+  size_t num_threads = std::min(static_cast<size_t>(worker_threads),
+                                start_rows.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(search);
+  search();
+  for (auto& thread : threads)
+    thread.join();
+#endif
+  return result;
+}
+
 std::unique_ptr<Table> ConnectedFlowGenerator::ComputeTable(
     const std::vector<Constraint>& cs,
     const std::vector<Order>&) {
@@ -215,22 +308,10 @@ std::unique_ptr<Table> ConnectedFlowGenerator::ComputeTable(
     return nullptr;
   }
 
-  BFS bfs(context_);
-
-  switch (mode_) {
-    case Mode::kDirectlyConnectedFlow:
-      bfs.Start(start_id).VisitAll(VISIT_INCOMING_AND_OUTGOING,
-                                   VISIT_NO_RELATIVES);
-      break;
-    case Mode::kFollowingFlow:
-      bfs.Start(start_id).VisitAll(VISIT_OUTGOING, VISIT_DESCENDANTS);
-      break;
-    case Mode::kPrecedingFlow:
-      bfs.Start(start_id).VisitAll(VISIT_INCOMING, VISIT_ANCESTORS);
-      break;
-  }
-
-  RowMap result_rows = std::move(bfs).TakeResultingFlows();
+  std::vector<std::vector<uint32_t>> flows =
+      GetConnectedFlows(context_->storage.get(), mode_, {start_id},
+                        /* worker_threads = */ 1);
+  RowMap result_rows(std::move(flows[0]));
 
   // Aditional column for start_id
   std::unique_ptr<NullableVector<uint32_t>> start_ids(
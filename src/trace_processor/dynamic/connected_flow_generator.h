@@ -17,13 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_CONNECTED_FLOW_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_CONNECTED_FLOW_GENERATOR_H_
 
-#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include <vector>
 
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
 #include "src/trace_processor/storage/trace_storage.h"
 
-#include <queue>
-#include <set>
-
 namespace perfetto {
 namespace trace_processor {
 
@@ -57,6 +55,17 @@ class ConnectedFlowGenerator : public DbSqliteTable::DynamicTableGenerator {
   std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>& cs,
                                       const std::vector<Order>& ob) override;
 
+  // Returns, for each of |start_ids|, the rows of the flow table which are
+  // connected to it in |mode|, i.e. the rows of the table computed for this
+  // start id. The start ids must be in the slice table.
+  // The start slices are searched independently, on up to |worker_threads|
+  // threads (including the calling one) if the build supports threads.
+  static std::vector<std::vector<uint32_t>> GetConnectedFlows(
+      TraceStorage* storage,
+      Mode mode,
+      const std::vector<SliceId>& start_ids,
+      uint32_t worker_threads);
+
  private:
   Mode mode_;
   TraceProcessorContext* context_ = nullptr;
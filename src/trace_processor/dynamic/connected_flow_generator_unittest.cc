@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/connected_flow_generator.h"
+
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Mode = ConnectedFlowGenerator::Mode;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+SliceId InsertSlice(TraceStorage* storage, base::Optional<SliceId> parent_id) {
+  tables::SliceTable::Row row;
+  row.track_id = TrackId{0};
+  row.parent_id = parent_id;
+  return storage->mutable_slice_table()->Insert(row).id;
+}
+
+uint32_t InsertFlow(TraceStorage* storage, SliceId out, SliceId in) {
+  tables::FlowTable::Row row;
+  row.slice_out = out;
+  row.slice_in = in;
+  return storage->mutable_flow_table()->Insert(row).row;
+}
+
+std::vector<uint32_t> ConnectedFlows(TraceStorage* storage,
+                                     Mode mode,
+                                     SliceId start_id) {
+  return ConnectedFlowGenerator::GetConnectedFlows(storage, mode, {start_id},
+                                                   1)[0];
+}
+
+TEST(ConnectedFlowGeneratorTest, Simple) {
+  // a is the parent of b, and the flows are b -> c -> d.
+  TraceStorage storage;
+  SliceId a = InsertSlice(&storage, base::nullopt);
+  SliceId b = InsertSlice(&storage, a);
+  SliceId c = InsertSlice(&storage, base::nullopt);
+  SliceId d = InsertSlice(&storage, base::nullopt);
+  uint32_t b_c = InsertFlow(&storage, b, c);
+  uint32_t c_d = InsertFlow(&storage, c, d);
+
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kFollowingFlow, a),
+              ElementsAre(b_c, c_d));
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kFollowingFlow, c),
+              ElementsAre(c_d));
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kPrecedingFlow, d),
+              ElementsAre(c_d, b_c));
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kPrecedingFlow, a), IsEmpty());
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kDirectlyConnectedFlow, c),
+              ElementsAre(b_c, c_d));
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kDirectlyConnectedFlow, a),
+              IsEmpty());
+
+  // The index is rebuilt when slices and flows are added.
+  SliceId e = InsertSlice(&storage, d);
+  uint32_t a_e = InsertFlow(&storage, a, e);
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kFollowingFlow, c),
+              ElementsAre(c_d));
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kFollowingFlow, a),
+              ElementsAre(a_e, b_c, c_d));
+  ASSERT_THAT(ConnectedFlows(&storage, Mode::kPrecedingFlow, e),
+              ElementsAre(a_e, c_d, b_c));
+}
+
+TEST(ConnectedFlowGeneratorTest, ParallelMatchesSerial) {
+  std::minstd_rand rnd(42);
+  TraceStorage storage;
+  std::vector<SliceId> slices;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    base::Optional<SliceId> parent;
+    if (!slices.empty() && rnd() % 4 != 0)
+      parent = slices[rnd() % slices.size()];
+    slices.push_back(InsertSlice(&storage, parent));
+  }
+  for (uint32_t i = 0; i < 3000; ++i) {
+    InsertFlow(&storage, slices[rnd() % slices.size()],
+               slices[rnd() % slices.size()]);
+  }
+
+  for (Mode mode : {Mode::kDirectlyConnectedFlow, Mode::kFollowingFlow,
+                    Mode::kPrecedingFlow}) {
+    std::vector<std::vector<uint32_t>> parallel =
+        ConnectedFlowGenerator::GetConnectedFlows(&storage, mode, slices, 4);
+    ASSERT_EQ(parallel.size(), slices.size());
+    for (uint32_t i = 0; i < slices.size(); ++i)
+      ASSERT_EQ(parallel[i], ConnectedFlows(&storage, mode, slices[i]));
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -40,9 +40,9 @@ Table ExtendTableWithStartId(const T& table, int64_t constraint_value) {
       TypedColumn<uint32_t>::default_flags() | TypedColumn<uint32_t>::kHidden);
 }
 
-base::Optional<RowMap> BuildDescendantsRowMap(const tables::SliceTable& slices,
+base::Optional<RowMap> BuildDescendantsRowMap(TraceStorage* storage,
                                               SliceId starting_id) {
-  auto start_row = slices.id().IndexOf(starting_id);
+  auto start_row = storage->slice_table().id().IndexOf(starting_id);
   // The query gave an invalid ID that doesn't exist in the slice table.
   if (!start_row) {
     // TODO(lalitm): Ideally this should result in an error, or be filtered out
@@ -54,26 +54,24 @@ base::Optional<RowMap> BuildDescendantsRowMap(const tables::SliceTable& slices,
     return base::nullopt;
   }
 
-  // All nested descendents must be on the same track, with a ts between
-  // |start_id.ts| and |start_id.ts| + |start_id.dur|, and who's depth is larger
-  // then |start_row|'s. So we just use Filter to select all relevant slices.
-  return slices.FilterToRowMap(
-      {slices.ts().ge(slices.ts()[*start_row]),
-       slices.ts().le(slices.ts()[*start_row] + slices.dur()[*start_row]),
-       slices.track_id().eq(slices.track_id()[*start_row].value),
-       slices.depth().gt(slices.depth()[*start_row])});
+  // The descendants of a slice directly follow it in the nesting index, so
+  // this does not depend on the number of slices in the trace.
+  std::vector<uint32_t> descendant_rows;
+  storage->GetSliceNestingIndex().GetDescendants(*start_row, &descendant_rows);
+  return RowMap(std::move(descendant_rows));
 }
 
 std::unique_ptr<Table> BuildDescendantsTable(int64_t constraint_value,
-                                             const tables::SliceTable& slices,
+                                             TraceStorage* storage,
                                              SliceId starting_id) {
   // Build up all the children row ids.
-  auto descendants = BuildDescendantsRowMap(slices, starting_id);
+  auto descendants = BuildDescendantsRowMap(storage, starting_id);
   if (!descendants) {
     return nullptr;
   }
   return std::unique_ptr<Table>(new Table(ExtendTableWithStartId(
-      slices.Apply(std::move(*descendants)), constraint_value)));
+      storage->slice_table().Apply(std::move(*descendants)),
+      constraint_value)));
 }
 }  // namespace
 
@@ -97,7 +95,8 @@ util::Status DescendantGenerator::ValidateConstraints(
 std::unique_ptr<Table> DescendantGenerator::ComputeTable(
     const std::vector<Constraint>& cs,
     const std::vector<Order>&) {
-  const auto& slices = context_->storage->slice_table();
+  TraceStorage* storage = context_->storage.get();
+  const auto& slices = storage->slice_table();
 
   uint32_t column = GetConstraintColumnIndex(context_);
   auto it = std::find_if(cs.begin(), cs.end(), [column](const Constraint& c) {
@@ -108,7 +107,7 @@ std::unique_ptr<Table> DescendantGenerator::ComputeTable(
 
   switch (type_) {
     case Descendant::kSlice:
-      return BuildDescendantsTable(start_id, slices,
+      return BuildDescendantsTable(start_id, storage,
                                    SliceId(static_cast<uint32_t>(start_id)));
     case Descendant::kSliceByStack:
       auto result = RowMap();
@@ -117,7 +116,7 @@ std::unique_ptr<Table> DescendantGenerator::ComputeTable(
       for (auto id_it = slice_ids.IterateRows(); id_it; id_it.Next()) {
         auto slice_id = slices.id()[id_it.row()];
 
-        auto descendants = GetDescendantSlices(slices, slice_id);
+        auto descendants = GetDescendantSlices(storage, slice_id);
         for (auto row_it = descendants->IterateRows(); row_it; row_it.Next()) {
           result.Insert(row_it.row());
         }
@@ -153,9 +152,9 @@ uint32_t DescendantGenerator::EstimateRowCount() {
 
 // static
 base::Optional<RowMap> DescendantGenerator::GetDescendantSlices(
-    const tables::SliceTable& slices,
+    TraceStorage* storage,
     SliceId slice_id) {
-  return BuildDescendantsRowMap(slices, slice_id);
+  return BuildDescendantsRowMap(storage, slice_id);
 }
 
 }  // namespace trace_processor
@@ -48,9 +48,11 @@ class DescendantGenerator : public DbSqliteTable::DynamicTableGenerator {
   // Returns a RowMap of slice IDs which are descendants of |slice_id|. Returns
   // NULL if an invalid |slice_id| is given. This is used by
   // ConnectedFlowGenerator to traverse flow indirectly connected flow events.
-  static base::Optional<RowMap> GetDescendantSlices(
-      const tables::SliceTable& slices,
-      SliceId slice_id);
+  //
+  // The descendants of a slice are the slices nested in it through parent_id;
+  // see TraceStorage::GetSliceNestingIndex.
+  static base::Optional<RowMap> GetDescendantSlices(TraceStorage* storage,
+                                                    SliceId slice_id);
 
  private:
   Descendant type_;
@@ -52,10 +52,13 @@ std::unique_ptr<Table> ExperimentalCounterDurGenerator::ComputeTable(
     const std::vector<Constraint>&,
     const std::vector<Order>&) {
   if (!dur_column_) {
-    dur_column_.reset(
-        new NullableVector<int64_t>(ComputeDurColumn(*counter_table_)));
-    delta_column_.reset(
-        new NullableVector<double>(ComputeDeltaColumn(*counter_table_)));
+    dur_column_.reset(new NullableVector<int64_t>());
+    delta_column_.reset(new NullableVector<double>());
+  }
+  uint32_t computed_rows = dur_column_->size();
+  if (computed_rows < counter_table_->row_count()) {
+    AppendRows(*counter_table_, computed_rows, &last_row_for_track_,
+               dur_column_.get(), delta_column_.get());
   }
 
   Table t = counter_table_
@@ -70,69 +73,61 @@ std::unique_ptr<Table> ExperimentalCounterDurGenerator::ComputeTable(
 // static
 NullableVector<int64_t> ExperimentalCounterDurGenerator::ComputeDurColumn(
     const Table& table) {
-  // Keep track of the last seen row for each track id.
-  std::unordered_map<TrackId, uint32_t> last_row_for_track_id;
+  LastRowForTrack last_row_for_track;
   NullableVector<int64_t> dur;
-
-  const auto* ts_col =
-      TypedColumn<int64_t>::FromColumn(table.GetColumnByName("ts"));
-  const auto* track_id_col =
-      TypedColumn<tables::CounterTrackTable::Id>::FromColumn(
-          table.GetColumnByName("track_id"));
-
-  for (uint32_t i = 0; i < table.row_count(); ++i) {
-    // Check if we already have a previous row for the current track id.
-    TrackId track_id = (*track_id_col)[i];
-    auto it = last_row_for_track_id.find(track_id);
-    if (it == last_row_for_track_id.end()) {
-      // This means we don't have any row - start tracking this row for the
-      // future.
-      last_row_for_track_id.emplace(track_id, i);
-    } else {
-      // This means we have an previous row for the current track id. Update
-      // the duration of the previous row to be up to the current ts.
-      uint32_t old_row = it->second;
-      it->second = i;
-      dur.Set(old_row, (*ts_col)[i] - (*ts_col)[old_row]);
-    }
-    // Append -1 to mark this event as not having been finished. On a later
-    // row, we may set this to have the correct value.
-    dur.Append(-1);
-  }
+  NullableVector<double> delta;
+  AppendRows(table, 0, &last_row_for_track, &dur, &delta);
   return dur;
 }
 
 // static
 NullableVector<double> ExperimentalCounterDurGenerator::ComputeDeltaColumn(
     const Table& table) {
-  // Keep track of the last seen row for each track id.
-  std::unordered_map<TrackId, uint32_t> last_row_for_track_id;
+  LastRowForTrack last_row_for_track;
+  NullableVector<int64_t> dur;
   NullableVector<double> delta;
+  AppendRows(table, 0, &last_row_for_track, &dur, &delta);
+  return delta;
+}
 
+// static
+void ExperimentalCounterDurGenerator::AppendRows(
+    const Table& table,
+    uint32_t start_row,
+    LastRowForTrack* last_row_for_track,
+    NullableVector<int64_t>* dur,
+    NullableVector<double>* delta) {
+  const auto* ts_col =
+      TypedColumn<int64_t>::FromColumn(table.GetColumnByName("ts"));
   const auto* value_col =
       TypedColumn<double>::FromColumn(table.GetColumnByName("value"));
   const auto* track_id_col =
       TypedColumn<tables::CounterTrackTable::Id>::FromColumn(
           table.GetColumnByName("track_id"));
 
-  for (uint32_t i = 0; i < table.row_count(); ++i) {
+  for (uint32_t i = start_row; i < table.row_count(); ++i) {
     // Check if we already have a previous row for the current track id.
-    TrackId track_id = (*track_id_col)[i];
-    auto it = last_row_for_track_id.find(track_id);
-    if (it == last_row_for_track_id.end()) {
-      // This means we don't have any row - start tracking this row for the
-      // future.
-      last_row_for_track_id.emplace(track_id, i);
-    } else {
+    uint32_t track_id = (*track_id_col)[i].value;
+    if (track_id >= last_row_for_track->size())
+      last_row_for_track->resize(track_id + 1);
+    base::Optional<uint32_t>& last_row = (*last_row_for_track)[track_id];
+    if (last_row) {
       // This means we have an previous row for the current track id. Update
-      // the duration of the previous row to be up to the current ts.
-      uint32_t old_row = it->second;
-      it->second = i;
-      delta.Set(old_row, (*value_col)[i] - (*value_col)[old_row]);
+      // the duration and delta of the previous row to be up to the current
+      // row.
+      uint32_t old_row = *last_row;
+      dur->Set(old_row, (*ts_col)[i] - (*ts_col)[old_row]);
+      delta->Set(old_row, (*value_col)[i] - (*value_col)[old_row]);
     }
-    delta.Append(0);
+    // Otherwise, this means we don't have any row - start tracking this row
+    // for the future.
+    last_row = i;
+
+    // Append -1 to mark this event as not having been finished. On a later
+    // row, we may set this to have the correct value.
+    dur->Append(-1);
+    delta->Append(0);
   }
-  return delta;
 }
 
 }  // namespace trace_processor
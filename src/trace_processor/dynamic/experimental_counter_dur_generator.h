@@ -17,6 +17,9 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_COUNTER_DUR_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_COUNTER_DUR_GENERATOR_H_
 
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 
 #include "src/trace_processor/storage/trace_storage.h"
@@ -42,9 +45,28 @@ class ExperimentalCounterDurGenerator
   static NullableVector<double> ComputeDeltaColumn(const Table& table);
 
  private:
+  // The last row seen of each counter track, indexed by track id.
+  using LastRowForTrack = std::vector<base::Optional<uint32_t>>;
+
+  // Appends the dur and delta of the rows of |table| starting at |start_row|
+  // to |dur| and |delta|, which contain the dur and delta of the rows before
+  // it. The dur and delta of the previous row of each track are updated, using
+  // |last_row_for_track| which is updated too.
+  static void AppendRows(const Table& table,
+                         uint32_t start_row,
+                         LastRowForTrack* last_row_for_track,
+                         NullableVector<int64_t>* dur,
+                         NullableVector<double>* delta);
+
   const tables::CounterTable* counter_table_ = nullptr;
+
+  // The dur and delta of the rows of the counter table, computed once for the
+  // whole table and then only extended with the rows added to it since the
+  // last query (e.g. when more of the trace is parsed), as the existing rows
+  // of the counter table are never modified.
   std::unique_ptr<NullableVector<int64_t>> dur_column_;
   std::unique_ptr<NullableVector<double>> delta_column_;
+  LastRowForTrack last_row_for_track_;
 };
 
 }  // namespace trace_processor
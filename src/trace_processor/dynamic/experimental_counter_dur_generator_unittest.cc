@@ -51,6 +51,36 @@ TEST(ExperimentalCounterDurGenerator, SmokeDur) {
   ASSERT_EQ(dur.GetNonNull(5), -1);
 }
 
+TEST(ExperimentalCounterDurGenerator, AppendedRows) {
+  StringPool pool;
+  tables::CounterTable table(&pool, nullptr);
+  ExperimentalCounterDurGenerator generator(table);
+
+  auto row = CounterRow(100 /* ts */, 1 /* track_id */);
+  row.value = 10;
+  table.Insert(row);
+  row = CounterRow(102 /* ts */, 2 /* track_id */);
+  table.Insert(row);
+
+  std::unique_ptr<Table> res = generator.ComputeTable({}, {});
+  ASSERT_EQ(res->row_count(), 2u);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(0).long_value, -1);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(1).long_value, -1);
+
+  // The rows added after the first query should update the dur and delta of
+  // the previous rows of their track.
+  row = CounterRow(105 /* ts */, 1 /* track_id */);
+  row.value = 15;
+  table.Insert(row);
+
+  res = generator.ComputeTable({}, {});
+  ASSERT_EQ(res->row_count(), 3u);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(0).long_value, 5);
+  ASSERT_EQ(res->GetColumnByName("delta")->Get(0).double_value, 5);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(1).long_value, -1);
+  ASSERT_EQ(res->GetColumnByName("dur")->Get(2).long_value, -1);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
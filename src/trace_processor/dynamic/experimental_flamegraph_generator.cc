@@ -20,6 +20,7 @@
 
 #include "src/trace_processor/importers/proto/heap_graph_tracker.h"
 #include "src/trace_processor/importers/proto/heap_profile_tracker.h"
+#include "src/trace_processor/sqlite/query_interrupter.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
 namespace perfetto {
@@ -32,6 +33,9 @@ ExperimentalFlamegraphGenerator::ProfileType extractProfileType(
   if (profile_name == "graph") {
     return ExperimentalFlamegraphGenerator::ProfileType::kGraph;
   }
+  if (profile_name == "graph_dominator") {
+    return ExperimentalFlamegraphGenerator::ProfileType::kGraphDominator;
+  }
   if (profile_name == "native") {
     return ExperimentalFlamegraphGenerator::ProfileType::kNative;
   }
@@ -187,34 +191,34 @@ struct CumulativeCounts {
 };
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
     TraceStorage* storage,
-    std::unique_ptr<ExperimentalFlamegraphNodesTable> in,
+    const ExperimentalFlamegraphNodesTable& in,
     const std::string& focus_str) {
-  if (in->row_count() == 0 || focus_str.empty()) {
-    return in;
-  }
-  std::vector<FocusedState> focused_state =
-      ComputeFocusedState(*in, Matcher(focus_str));
   std::unique_ptr<ExperimentalFlamegraphNodesTable> tbl(
       new tables::ExperimentalFlamegraphNodesTable(
           storage->mutable_string_pool(), nullptr));
+  if (in.row_count() == 0) {
+    return tbl;
+  }
+  std::vector<FocusedState> focused_state =
+      ComputeFocusedState(in, Matcher(focus_str));
 
   // Recompute cumulative counts
-  std::vector<CumulativeCounts> node_to_cumulatives(in->row_count());
-  for (int64_t idx = in->row_count() - 1; idx >= 0; --idx) {
+  std::vector<CumulativeCounts> node_to_cumulatives(in.row_count());
+  for (int64_t idx = in.row_count() - 1; idx >= 0; --idx) {
     auto i = static_cast<uint32_t>(idx);
     if (focused_state[i] == FocusedState::kNotFocused) {
       continue;
     }
     auto& cumulatives = node_to_cumulatives[i];
-    cumulatives.size += in->size()[i];
-    cumulatives.count += in->count()[i];
-    cumulatives.alloc_size += in->alloc_size()[i];
-    cumulatives.alloc_count += in->alloc_count()[i];
+    cumulatives.size += in.size()[i];
+    cumulatives.count += in.count()[i];
+    cumulatives.alloc_size += in.alloc_size()[i];
+    cumulatives.alloc_count += in.alloc_count()[i];
 
-    auto parent_id = in->parent_id()[i];
+    auto parent_id = in.parent_id()[i];
     if (parent_id.has_value()) {
       auto& parent_cumulatives =
-          node_to_cumulatives[*in->id().IndexOf(*parent_id)];
+          node_to_cumulatives[*in.id().IndexOf(*parent_id)];
       parent_cumulatives.size += cumulatives.size;
       parent_cumulatives.count += cumulatives.count;
       parent_cumulatives.alloc_size += cumulatives.alloc_size;
@@ -223,8 +227,8 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
   }
 
   // Mapping between the old rows ('node') to the new identifiers.
-  std::vector<ExperimentalFlamegraphNodesTable::Id> node_to_id(in->row_count());
-  for (uint32_t i = 0; i < in->row_count(); ++i) {
+  std::vector<ExperimentalFlamegraphNodesTable::Id> node_to_id(in.row_count());
+  for (uint32_t i = 0; i < in.row_count(); ++i) {
     if (focused_state[i] == FocusedState::kNotFocused) {
       continue;
     }
@@ -232,22 +236,22 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
     tables::ExperimentalFlamegraphNodesTable::Row alloc_row{};
     // We must reparent the rows as every insertion will get its own
     // identifier.
-    auto original_parent_id = in->parent_id()[i];
+    auto original_parent_id = in.parent_id()[i];
     if (original_parent_id.has_value()) {
-      auto original_idx = *in->id().IndexOf(*original_parent_id);
+      auto original_idx = *in.id().IndexOf(*original_parent_id);
       alloc_row.parent_id = node_to_id[original_idx];
     }
 
-    alloc_row.ts = in->ts()[i];
-    alloc_row.upid = in->upid()[i];
-    alloc_row.profile_type = in->profile_type()[i];
-    alloc_row.depth = in->depth()[i];
-    alloc_row.name = in->name()[i];
-    alloc_row.map_name = in->map_name()[i];
-    alloc_row.count = in->count()[i];
-    alloc_row.size = in->size()[i];
-    alloc_row.alloc_count = in->alloc_count()[i];
-    alloc_row.alloc_size = in->alloc_size()[i];
+    alloc_row.ts = in.ts()[i];
+    alloc_row.upid = in.upid()[i];
+    alloc_row.profile_type = in.profile_type()[i];
+    alloc_row.depth = in.depth()[i];
+    alloc_row.name = in.name()[i];
+    alloc_row.map_name = in.map_name()[i];
+    alloc_row.count = in.count()[i];
+    alloc_row.size = in.size()[i];
+    alloc_row.alloc_count = in.alloc_count()[i];
+    alloc_row.alloc_size = in.alloc_size()[i];
 
     const auto& cumulative = node_to_cumulatives[i];
     alloc_row.cumulative_count = cumulative.count;
@@ -258,14 +262,33 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> FocusTable(
   }
   return tbl;
 }
+// A copy of a memoized flamegraph. As the columns of the copy use the storage
+// of the memoized table, this keeps it alive until the copy is destroyed
+// (even if the memoized table is evicted in the meantime).
+class FlamegraphCopy : public Table {
+ public:
+  explicit FlamegraphCopy(
+      std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable> source)
+      : Table(source->Copy()), source_(std::move(source)) {}
+  ~FlamegraphCopy() override;
+
+ private:
+  std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable> source_;
+};
+
+FlamegraphCopy::~FlamegraphCopy() = default;
+
 }  // namespace
 
 ExperimentalFlamegraphGenerator::ExperimentalFlamegraphGenerator(
-    TraceProcessorContext* context)
-    : context_(context) {}
+    TraceProcessorContext* context,
+    QueryInterrupter* interrupter)
+    : context_(context), interrupter_(interrupter) {}
 
 ExperimentalFlamegraphGenerator::~ExperimentalFlamegraphGenerator() = default;
 
+constexpr size_t ExperimentalFlamegraphGenerator::kMaxCachedFlamegraphs;
+
 // For filtering, this method uses the same constraints as
 // ExperimentalFlamegraphGenerator::GetFlamegraphInputValues and should
 // therefore be kept in sync.
@@ -305,31 +328,75 @@ std::unique_ptr<Table> ExperimentalFlamegraphGenerator::ComputeTable(
   // Get the input column values and compute the flamegraph using them.
   auto values = GetFlamegraphInputValues(cs);
 
-  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> table;
+  std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable> flamegraph =
+      GetOrBuildFlamegraph(values);
+  if (!flamegraph) {
+    return nullptr;
+  }
+  if (values.focus_str.empty()) {
+    return std::unique_ptr<Table>(new FlamegraphCopy(std::move(flamegraph)));
+  }
+
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> table =
+      FocusTable(context_->storage.get(), *flamegraph, values.focus_str);
+  // The pseudocolumns must be populated because as far as SQLite is
+  // concerned these are equality constraints.
+  auto focus_id =
+      context_->storage->InternString(base::StringView(values.focus_str));
+  for (uint32_t i = 0; i < table->row_count(); ++i) {
+    table->mutable_focus_str()->Set(i, focus_id);
+  }
+  // We need to explicitly std::move as clang complains about a bug in old
+  // compilers otherwise (-Wreturn-std-move-in-c++11).
+  return std::move(table);
+}
+
+std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable>
+ExperimentalFlamegraphGenerator::GetOrBuildFlamegraph(
+    const InputValues& values) {
+  std::vector<std::pair<FilterOp, int64_t>> time_constraints;
+  for (const TimeConstraints& tc : values.time_constraints)
+    time_constraints.emplace_back(tc.op, tc.value);
+  CacheKey key(values.profile_type, values.upid, values.ts,
+               std::move(time_constraints));
+  auto it = cache_.find(key);
+  if (it != cache_.end())
+    return it->second;
+
+  const uint32_t worker_threads = context_->config.flamegraph_worker_threads;
+  std::function<bool()> should_interrupt;
+  if (interrupter_) {
+    QueryInterrupter* interrupter = interrupter_;
+    should_interrupt = [interrupter] { return interrupter->ShouldInterrupt(); };
+  }
+  std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable> table;
   if (values.profile_type == ProfileType::kGraph) {
     auto* tracker = HeapGraphTracker::GetOrCreate(context_);
     table = tracker->BuildFlamegraph(values.ts, values.upid);
+  } else if (values.profile_type == ProfileType::kGraphDominator) {
+    auto* tracker = HeapGraphTracker::GetOrCreate(context_);
+    table = tracker->BuildDominatorFlamegraph(values.ts, values.upid);
   } else if (values.profile_type == ProfileType::kNative) {
     table = BuildNativeHeapProfileFlamegraph(context_->storage.get(),
-                                             values.upid, values.ts);
+                                             values.upid, values.ts,
+                                             worker_threads, should_interrupt);
   } else if (values.profile_type == ProfileType::kPerf) {
     table = BuildNativeCallStackSamplingFlamegraph(
-        context_->storage.get(), values.upid, values.time_constraints);
+        context_->storage.get(), values.upid, values.time_constraints,
+        worker_threads, should_interrupt);
   }
-  if (!values.focus_str.empty()) {
-    table =
-        FocusTable(context_->storage.get(), std::move(table), values.focus_str);
-    // The pseudocolumns must be populated because as far as SQLite is
-    // concerned these are equality constraints.
-    auto focus_id =
-        context_->storage->InternString(base::StringView(values.focus_str));
-    for (uint32_t i = 0; i < table->row_count(); ++i) {
-      table->mutable_focus_str()->Set(i, focus_id);
-    }
+
+  // The flamegraph of an interrupted query is incomplete: don't cache it.
+  if (interrupter_ && interrupter_->ShouldInterrupt())
+    return nullptr;
+
+  if (cache_order_.size() >= kMaxCachedFlamegraphs) {
+    cache_.erase(cache_order_.front());
+    cache_order_.pop_front();
   }
-  // We need to explicitly std::move as clang complains about a bug in old
-  // compilers otherwise (-Wreturn-std-move-in-c++11).
-  return std::move(table);
+  cache_order_.push_back(key);
+  cache_.emplace(std::move(key), table);
+  return table;
 }
 
 Table::Schema ExperimentalFlamegraphGenerator::CreateSchema() {
@@ -17,6 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_FLAMEGRAPH_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_FLAMEGRAPH_GENERATOR_H_
 
+#include <deque>
+#include <map>
+#include <memory>
+#include <tuple>
+
 #include "src/trace_processor/importers/proto/flamegraph_construction_algorithms.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 
@@ -25,12 +30,13 @@
 namespace perfetto {
 namespace trace_processor {
 
+class QueryInterrupter;
 class TraceProcessorContext;
 
 class ExperimentalFlamegraphGenerator
     : public DbSqliteTable::DynamicTableGenerator {
  public:
-  enum class ProfileType { kGraph, kNative, kPerf };
+  enum class ProfileType { kGraph, kGraphDominator, kNative, kPerf };
 
   struct InputValues {
     ProfileType profile_type;
@@ -40,7 +46,11 @@ class ExperimentalFlamegraphGenerator
     std::string focus_str;
   };
 
-  explicit ExperimentalFlamegraphGenerator(TraceProcessorContext* context);
+  // If |interrupter| is not null, building the flamegraph of native heap
+  // profiles and perf samples stops as soon as it interrupts the query.
+  explicit ExperimentalFlamegraphGenerator(
+      TraceProcessorContext* context,
+      QueryInterrupter* interrupter = nullptr);
   virtual ~ExperimentalFlamegraphGenerator() override;
 
   Table::Schema CreateSchema() override;
@@ -50,8 +60,36 @@ class ExperimentalFlamegraphGenerator
   std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>& cs,
                                       const std::vector<Order>& ob) override;
 
+  // Drops the memoized flamegraphs, e.g. because more of the trace has been
+  // parsed.
+  void ClearCache() {
+    cache_.clear();
+    cache_order_.clear();
+  }
+
  private:
+  // The flamegraphs (before focusing) of the last few (profile type, upid,
+  // timestamp, time constraints) which were queried: the UI queries the same
+  // flamegraph repeatedly (e.g. for each focus string or when expanding
+  // nodes), and building it requires going through all the samples.
+  using CacheKey = std::tuple<ProfileType,
+                              UniquePid,
+                              int64_t,
+                              std::vector<std::pair<FilterOp, int64_t>>>;
+  static constexpr size_t kMaxCachedFlamegraphs = 16;
+
+  // Returns the flamegraph for |values|, building it if it is not cached.
+  // May return nullptr if there is no matching sample.
+  std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable>
+  GetOrBuildFlamegraph(const InputValues& values);
+
   TraceProcessorContext* context_ = nullptr;
+  QueryInterrupter* const interrupter_;
+  std::map<CacheKey,
+           std::shared_ptr<const tables::ExperimentalFlamegraphNodesTable>>
+      cache_;
+  // The keys of |cache_| in insertion order, to evict the oldest entries.
+  std::deque<CacheKey> cache_order_;
 };
 
 }  // namespace trace_processor
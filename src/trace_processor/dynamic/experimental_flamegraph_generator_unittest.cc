@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_flamegraph_generator.h"
+
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using T = tables::ExperimentalFlamegraphNodesTable;
+
+class ExperimentalFlamegraphGeneratorTest : public ::testing::Test {
+ public:
+  ExperimentalFlamegraphGeneratorTest() {
+    context_.storage.reset(new TraceStorage());
+    TraceStorage* storage = context_.storage.get();
+
+    tables::StackProfileMappingTable::Row mapping;
+    mapping.name = storage->InternString("libfoo.so");
+    tables::StackProfileFrameTable::Row frame;
+    frame.name = storage->InternString("main");
+    frame.mapping =
+        storage->mutable_stack_profile_mapping_table()->Insert(mapping).id;
+    auto frame_id =
+        storage->mutable_stack_profile_frame_table()->Insert(frame).id;
+    callsite_id_ = storage->mutable_stack_profile_callsite_table()
+                       ->Insert({0, base::nullopt, frame_id})
+                       .id;
+
+    tables::ProcessTable::Row process;
+    process.pid = 10;
+    upid_ = storage->mutable_process_table()->Insert(process).id.value;
+  }
+
+ protected:
+  // Adds a native allocation of |size| bytes at |ts|.
+  void AddAllocation(int64_t ts, int64_t size) {
+    tables::HeapProfileAllocationTable::Row row;
+    row.ts = ts;
+    row.upid = upid_;
+    row.callsite_id = callsite_id_;
+    row.count = 1;
+    row.size = size;
+    context_.storage->mutable_heap_profile_allocation_table()->Insert(row);
+  }
+
+  // Returns the cumulative size of the root of the native heap flamegraph
+  // at |ts|.
+  int64_t RootSize(ExperimentalFlamegraphGenerator* generator, int64_t ts) {
+    std::vector<Constraint> cs = {
+        {static_cast<uint32_t>(T::ColumnIndex::ts), FilterOp::kEq,
+         SqlValue::Long(ts)},
+        {static_cast<uint32_t>(T::ColumnIndex::upid), FilterOp::kEq,
+         SqlValue::Long(upid_)},
+        {static_cast<uint32_t>(T::ColumnIndex::profile_type), FilterOp::kEq,
+         SqlValue::String("native")},
+    };
+    std::unique_ptr<Table> table = generator->ComputeTable(cs, {});
+    if (!table)
+      return 0;
+    return table->GetColumnByName("cumulative_size")->Get(0).long_value;
+  }
+
+  TraceProcessorContext context_;
+  CallsiteId callsite_id_{0};
+  UniquePid upid_ = 0;
+};
+
+TEST_F(ExperimentalFlamegraphGeneratorTest, MemoizesLastFlamegraphs) {
+  ExperimentalFlamegraphGenerator generator(&context_);
+  AddAllocation(1, 100);
+  ASSERT_EQ(RootSize(&generator, 100), 100);
+
+  // The flamegraph is memoized: the allocations added afterwards are only
+  // seen once the memo is cleared.
+  AddAllocation(2, 10);
+  ASSERT_EQ(RootSize(&generator, 100), 100);
+  generator.ClearCache();
+  ASSERT_EQ(RootSize(&generator, 100), 110);
+
+  // The flamegraphs at other timestamps are built separately.
+  AddAllocation(3, 1);
+  ASSERT_EQ(RootSize(&generator, 101), 111);
+  ASSERT_EQ(RootSize(&generator, 100), 110);
+
+  // Only the 16 flamegraphs built last are memoized: building 15 more evicts
+  // the one at 100 but not the one at 101.
+  for (int64_t ts = 200; ts < 215; ++ts)
+    ASSERT_EQ(RootSize(&generator, ts), 111);
+  AddAllocation(4, 1000);
+  ASSERT_EQ(RootSize(&generator, 101), 111);
+  ASSERT_EQ(RootSize(&generator, 100), 1111);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
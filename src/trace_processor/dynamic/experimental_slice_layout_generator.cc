@@ -15,6 +15,9 @@
  */
 
 #include "src/trace_processor/dynamic/experimental_slice_layout_generator.h"
+
+#include <algorithm>
+
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
@@ -76,7 +79,7 @@ util::Status ExperimentalSliceLayoutGenerator::ValidateConstraints(
 std::unique_ptr<Table> ExperimentalSliceLayoutGenerator::ComputeTable(
     const std::vector<Constraint>& cs,
     const std::vector<Order>&) {
-  std::set<TrackId> selected_tracks;
+  std::vector<uint32_t> selected_tracks;
   std::string filter_string = "";
   for (const auto& c : cs) {
     bool is_filter_track_ids = c.col_idx == kFilterTrackIdsColumnIndex;
@@ -87,44 +90,108 @@ std::unique_ptr<Table> ExperimentalSliceLayoutGenerator::ComputeTable(
       for (base::StringSplitter sp(filter_string, ','); sp.Next();) {
         base::Optional<uint32_t> maybe = base::CStringToUInt32(sp.cur_token());
         if (maybe) {
-          selected_tracks.insert(TrackId{maybe.value()});
+          selected_tracks.push_back(maybe.value());
         }
       }
     }
   }
 
+  // Filters which only differ in the order (or repetition) of the track ids
+  // share the same layout.
+  std::sort(selected_tracks.begin(), selected_tracks.end());
+  selected_tracks.erase(
+      std::unique(selected_tracks.begin(), selected_tracks.end()),
+      selected_tracks.end());
+
   StringPool::Id filter_id =
       string_pool_->InternString(base::StringView(filter_string));
 
-  // Try and find the table in the cache.
-  auto it = layout_table_cache_.find(filter_id);
-  if (it != layout_table_cache_.end()) {
-    return std::unique_ptr<Table>(new Table(it->second.Copy()));
+  // Try and find an up to date layout in the cache, otherwise (re)compute it.
+  // The layout of a set of tracks is only invalidated by slices being added
+  // to (or closed on) those tracks, e.g. when more of the trace is parsed.
+  UpdateTrackIndex();
+  uint32_t row_count = 0;
+  for (uint32_t track_id : selected_tracks) {
+    if (track_id < rows_by_track_.size())
+      row_count += static_cast<uint32_t>(rows_by_track_[track_id].size());
   }
+  Layout& layout = layout_cache_[selected_tracks];
+  if (!IsLayoutUpToDate(layout, row_count)) {
+    layout.rows = GetRowsForTracks(selected_tracks);
 
-  // Find all the slices for the tracks we want to filter and create a RowMap
-  // out of them.
-  // TODO(lalitm): Update this to use iterator (as this code will be slow after
-  // the event table is implemented).
+    // Apply the row map to the table to cut down on the number of rows we have
+    // to go through.
+    Table filtered_table = slice_table_->Apply(RowMap(layout.rows));
+    layout.layout_depths = ComputeLayoutDepths(filtered_table);
+
+    const auto& dur = slice_table_->dur();
+    layout.open_rows.clear();
+    for (uint32_t row : layout.rows) {
+      if (dur[row] == -1)
+        layout.open_rows.push_back(row);
+    }
+  }
+
+  // Add the two new columns layout_depth and filter_track_ids to the slices of
+  // the tracks.
+  std::unique_ptr<NullableVector<int64_t>> layout_depth_column(
+      new NullableVector<int64_t>());
+  std::unique_ptr<NullableVector<StringPool::Id>> filter_column(
+      new NullableVector<StringPool::Id>());
+  for (int64_t layout_depth : layout.layout_depths) {
+    layout_depth_column->Append(layout_depth);
+    // We must set this to the value we got in the constraint to ensure our
+    // rows are not filtered out:
+    filter_column->Append(filter_id);
+  }
+  return std::unique_ptr<Table>(new Table(
+      slice_table_->Apply(RowMap(layout.rows))
+          .ExtendWithColumn("layout_depth", std::move(layout_depth_column),
+                            TypedColumn<int64_t>::default_flags())
+          .ExtendWithColumn("filter_track_ids", std::move(filter_column),
+                            TypedColumn<StringPool::Id>::default_flags())));
+}
+
+void ExperimentalSliceLayoutGenerator::UpdateTrackIndex() {
+  const auto& track_id = slice_table_->track_id();
+  for (uint32_t i = indexed_row_count_; i < slice_table_->row_count(); ++i) {
+    uint32_t track = track_id[i].value;
+    if (track >= rows_by_track_.size())
+      rows_by_track_.resize(track + 1);
+    rows_by_track_[track].push_back(i);
+  }
+  indexed_row_count_ = slice_table_->row_count();
+}
+
+std::vector<uint32_t> ExperimentalSliceLayoutGenerator::GetRowsForTracks(
+    const std::vector<uint32_t>& track_ids) {
   // TODO(lalitm): consider generalising this by adding OR constraint support to
   // Constraint and Table::Filter. We definitely want to wait until we have more
   // usecases before implementing that though because it will be a significant
   // amount of work.
-  RowMap rm;
-  for (uint32_t i = 0; i < slice_table_->row_count(); ++i) {
-    if (selected_tracks.count(slice_table_->track_id()[i]) > 0) {
-      rm.Insert(i);
-    }
+  std::vector<uint32_t> rows;
+  for (uint32_t track_id : track_ids) {
+    if (track_id >= rows_by_track_.size())
+      continue;
+    const std::vector<uint32_t>& track_rows = rows_by_track_[track_id];
+    rows.insert(rows.end(), track_rows.begin(), track_rows.end());
   }
+  std::sort(rows.begin(), rows.end());
+  return rows;
+}
 
-  // Apply the row map to the table to cut down on the number of rows we have to
-  // go through.
-  Table filtered_table = slice_table_->Apply(std::move(rm));
-
-  // Compute the table and add it to the cache for future use.
-  Table layout_table = ComputeLayoutTable(filtered_table, filter_id);
-  auto res = layout_table_cache_.emplace(filter_id, std::move(layout_table));
-  return std::unique_ptr<Table>(new Table(res.first->second.Copy()));
+bool ExperimentalSliceLayoutGenerator::IsLayoutUpToDate(const Layout& layout,
+                                                        uint32_t row_count) {
+  // Slices are only ever appended to the table so, if the number of slices of
+  // the tracks didn't change, neither did the slices themselves.
+  if (layout.rows.size() != row_count)
+    return false;
+  const auto& dur = slice_table_->dur();
+  for (uint32_t row : layout.open_rows) {
+    if (dur[row] != -1)
+      return false;
+  }
+  return true;
 }
 
 // Build up a table of slice id -> root slice id by observing each
@@ -172,9 +239,9 @@ tables::SliceTable::Id ExperimentalSliceLayoutGenerator::InsertSlice(
 // 3. Go though each slice and give it a layout_depth by summing it's
 //    current depth and the root layout_depth of the stalactite it belongs to.
 //
-Table ExperimentalSliceLayoutGenerator::ComputeLayoutTable(
-    const Table& table,
-    StringPool::Id filter_id) {
+// The layout_depth of each row of |table| is returned.
+std::vector<int64_t> ExperimentalSliceLayoutGenerator::ComputeLayoutDepths(
+    const Table& table) {
   std::map<tables::SliceTable::Id, GroupInfo> groups;
   // Map of id -> root_id
   std::map<tables::SliceTable::Id, tables::SliceTable::Id> id_map;
@@ -274,27 +341,17 @@ Table ExperimentalSliceLayoutGenerator::ComputeLayoutTable(
     group->layout_depth = layout_depth;
   }
 
-  // Step 3: Add the two new columns layout_depth and filter_track_ids:
-  std::unique_ptr<NullableVector<int64_t>> layout_depth_column(
-      new NullableVector<int64_t>());
-  std::unique_ptr<NullableVector<StringPool::Id>> filter_column(
-      new NullableVector<StringPool::Id>());
-
+  // Step 3: Compute the layout depth of each slice.
+  std::vector<int64_t> layout_depths;
+  layout_depths.reserve(table.row_count());
   for (uint32_t i = 0; i < table.row_count(); ++i) {
     tables::SliceTable::Id id = id_col[i];
     uint32_t depth = depth_col[i];
     // Each slice depth is it's current slice depth + root slice depth of the
     // group:
-    layout_depth_column->Append(depth + groups.at(id_map[id]).layout_depth);
-    // We must set this to the value we got in the constraint to ensure our
-    // rows are not filtered out:
-    filter_column->Append(filter_id);
+    layout_depths.push_back(depth + groups.at(id_map[id]).layout_depth);
   }
-  return table
-      .ExtendWithColumn("layout_depth", std::move(layout_depth_column),
-                        TypedColumn<int64_t>::default_flags())
-      .ExtendWithColumn("filter_track_ids", std::move(filter_column),
-                        TypedColumn<StringPool::Id>::default_flags());
+  return layout_depths;
 }
 
 }  // namespace trace_processor
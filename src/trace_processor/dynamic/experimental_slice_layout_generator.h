@@ -17,7 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_SLICE_LAYOUT_GENERATOR_H_
 #define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_SLICE_LAYOUT_GENERATOR_H_
 
-#include <set>
+#include <map>
+#include <vector>
 
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -43,15 +44,48 @@ class ExperimentalSliceLayoutGenerator
                                       const std::vector<Order>&) override;
 
  private:
-  Table ComputeLayoutTable(const Table& table, StringPool::Id filter_id);
+  // The layout of the slices of a set of tracks.
+  struct Layout {
+    // The rows of the slices in the slice table, in increasing order.
+    std::vector<uint32_t> rows;
+    // The layout depth of the slice in the same position of |rows|.
+    std::vector<int64_t> layout_depths;
+    // The rows of the slices which were still open (i.e. had a duration of
+    // -1) when the layout was computed.
+    std::vector<uint32_t> open_rows;
+  };
+
+  // Adds the slices inserted since the last call to |rows_by_track_|.
+  void UpdateTrackIndex();
+
+  // Returns the rows of the slices of |track_ids|, in increasing order.
+  std::vector<uint32_t> GetRowsForTracks(
+      const std::vector<uint32_t>& track_ids);
+
+  // Returns true if |layout| is still valid for the current slice table: the
+  // slice table is append only and the only update to existing slices which
+  // affects the layout is the closing of open slices.
+  bool IsLayoutUpToDate(const Layout& layout, uint32_t row_count);
+
+  std::vector<int64_t> ComputeLayoutDepths(const Table& table);
   tables::SliceTable::Id InsertSlice(
       std::map<tables::SliceTable::Id, tables::SliceTable::Id>& id_map,
       tables::SliceTable::Id id,
       base::Optional<tables::SliceTable::Id> parent_id);
 
+  // The layouts computed so far, keyed by the sorted and deduplicated ids of
+  // the tracks they were computed for: the UI queries the layout of the same
+  // track groups repeatedly (e.g. while scrolling), so it is computed once
+  // and then only recomputed when the slices of the tracks change.
   // TODO(lalitm): remove this cache and move to having explicitly scoped
   // lifetimes of dynamic tables.
-  std::unordered_map<StringId, Table> layout_table_cache_;
+  std::map<std::vector<uint32_t>, Layout> layout_cache_;
+
+  // The rows of the slices of each track, indexed by track id. This is
+  // extended incrementally as slices are added to the table, so that the
+  // layout of a set of tracks doesn't need to scan the whole slice table.
+  std::vector<std::vector<uint32_t>> rows_by_track_;
+  uint32_t indexed_row_count_ = 0;
 
   StringPool* string_pool_;
   const tables::SliceTable* slice_table_;
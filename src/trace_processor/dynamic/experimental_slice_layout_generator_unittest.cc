@@ -251,6 +251,45 @@ TEST(ExperimentalSliceLayoutGeneratorTest, FilterOutTracks) {
 )");
 }
 
+TEST(ExperimentalSliceLayoutGeneratorTest, UpdatedSlices) {
+  StringPool pool;
+  tables::SliceTable slice_table(&pool, nullptr);
+  StringId name1 = pool.InternString("Slice1");
+  StringId name2 = pool.InternString("Slice2");
+  StringId name3 = pool.InternString("Slice3");
+
+  auto a = Insert(&slice_table, 0 /*ts*/, -1 /*dur*/, 1 /*track_id*/, name1,
+                  base::nullopt);
+  Insert(&slice_table, 3 /*ts*/, 4 /*dur*/, 2 /*track_id*/, name2,
+         base::nullopt);
+
+  ExperimentalSliceLayoutGenerator gen(&pool, &slice_table);
+  std::unique_ptr<Table> table = gen.ComputeTable(
+      {Constraint{kColumn, FilterOp::kEq, SqlValue::String("1,2")}}, {});
+  ExpectOutput(*table, R"(
+
+   ####
+)");
+
+  // Closing the open slice should update the layout.
+  slice_table.mutable_dur()->Set(a.value, 2);
+  table = gen.ComputeTable(
+      {Constraint{kColumn, FilterOp::kEq, SqlValue::String("2,1")}}, {});
+  ExpectOutput(*table, R"(
+## ####
+)");
+
+  // And so should adding a slice to one of the tracks.
+  Insert(&slice_table, 5 /*ts*/, 3 /*dur*/, 1 /*track_id*/, name3,
+         base::nullopt);
+  table = gen.ComputeTable(
+      {Constraint{kColumn, FilterOp::kEq, SqlValue::String("1,2")}}, {});
+  ExpectOutput(*table, R"(
+## ####
+     ###
+)");
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_track_summary_generator.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// The timestamps and values of the events of a track, before they are
+// summarized.
+struct TrackEvents {
+  std::vector<int64_t> ts;
+  std::vector<double> values;
+};
+
+}  // namespace
+
+void ExperimentalTrackSummaryGenerator::Aggregate::Add(double value) {
+  count++;
+  min = std::min(min, value);
+  max = std::max(max, value);
+  sum += value;
+}
+
+void ExperimentalTrackSummaryGenerator::Aggregate::Merge(
+    const Aggregate& other) {
+  count += other.count;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+  sum += other.sum;
+}
+
+ExperimentalTrackSummaryGenerator::Summary::Summary(std::vector<int64_t> ts,
+                                                    std::vector<double> values)
+    : ts_(std::move(ts)), values_(std::move(values)) {
+  PERFETTO_DCHECK(ts_.size() == values_.size());
+  PERFETTO_DCHECK(std::is_sorted(ts_.begin(), ts_.end()));
+
+  // Only complete groups are aggregated: the aggregate of a group at a level
+  // is the merge of the aggregates of two consecutive groups of the level
+  // below.
+  uint32_t group_count = static_cast<uint32_t>(values_.size()) / kGroupSize;
+  if (group_count == 0)
+    return;
+  levels_.emplace_back(group_count);
+  for (uint32_t i = 0; i < group_count; ++i)
+    AddValues(i * kGroupSize, (i + 1) * kGroupSize, &levels_[0][i]);
+
+  for (group_count /= 2; group_count > 0; group_count /= 2) {
+    std::vector<Aggregate> level(group_count);
+    const std::vector<Aggregate>& prev = levels_.back();
+    for (uint32_t i = 0; i < group_count; ++i) {
+      level[i] = prev[2 * i];
+      level[i].Merge(prev[2 * i + 1]);
+    }
+    levels_.emplace_back(std::move(level));
+  }
+}
+
+ExperimentalTrackSummaryGenerator::Aggregate
+ExperimentalTrackSummaryGenerator::Summary::Query(int64_t start,
+                                                  int64_t end) const {
+  uint32_t begin = static_cast<uint32_t>(
+      std::lower_bound(ts_.begin(), ts_.end(), start) - ts_.begin());
+  uint32_t finish = static_cast<uint32_t>(
+      std::lower_bound(ts_.begin() + begin, ts_.end(), end) - ts_.begin());
+
+  Aggregate aggregate;
+  uint32_t first_group = (begin + kGroupSize - 1) / kGroupSize;
+  uint32_t last_group = finish / kGroupSize;
+  if (first_group >= last_group) {
+    AddValues(begin, finish, &aggregate);
+    return aggregate;
+  }
+
+  // Aggregate the events before the first and after the last complete group
+  // directly, then the groups [first_group, last_group) walking up the levels
+  // as in a segment tree.
+  AddValues(begin, first_group * kGroupSize, &aggregate);
+  AddValues(last_group * kGroupSize, finish, &aggregate);
+  uint32_t l = first_group;
+  uint32_t r = last_group;
+  for (size_t level = 0; l < r; ++level) {
+    if (l & 1)
+      aggregate.Merge(levels_[level][l++]);
+    if (r & 1)
+      aggregate.Merge(levels_[level][--r]);
+    l /= 2;
+    r /= 2;
+  }
+  return aggregate;
+}
+
+void ExperimentalTrackSummaryGenerator::Summary::AddValues(
+    uint32_t begin,
+    uint32_t end,
+    Aggregate* out) const {
+  for (uint32_t i = begin; i < end; ++i)
+    out->Add(values_[i]);
+}
+
+ExperimentalTrackSummaryGenerator::ExperimentalTrackSummaryGenerator(
+    TraceProcessorContext* context)
+    : context_(context) {}
+
+ExperimentalTrackSummaryGenerator::~ExperimentalTrackSummaryGenerator() =
+    default;
+
+Table::Schema ExperimentalTrackSummaryGenerator::CreateSchema() {
+  return tables::ExperimentalTrackSummaryTable::Schema();
+}
+
+std::string ExperimentalTrackSummaryGenerator::TableName() {
+  return "experimental_track_summary";
+}
+
+uint32_t ExperimentalTrackSummaryGenerator::EstimateRowCount() {
+  // This is the default number of buckets a UI track would ask for.
+  return 1024;
+}
+
+util::Status ExperimentalTrackSummaryGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  using CI = tables::ExperimentalTrackSummaryTable::ColumnIndex;
+  bool has_track_id = false;
+  bool has_start_bound = false;
+  bool has_end_bound = false;
+  bool has_bucket_count = false;
+  for (const auto& c : qc.constraints()) {
+    if (c.op != SQLITE_INDEX_CONSTRAINT_EQ)
+      continue;
+    has_track_id |= c.column == static_cast<int>(CI::track_id);
+    has_start_bound |= c.column == static_cast<int>(CI::start_bound);
+    has_end_bound |= c.column == static_cast<int>(CI::end_bound);
+    has_bucket_count |= c.column == static_cast<int>(CI::bucket_count);
+  }
+  return has_track_id && has_start_bound && has_end_bound && has_bucket_count
+             ? util::OkStatus()
+             : util::ErrStatus("Failed to find required constraints");
+}
+
+std::unique_ptr<Table> ExperimentalTrackSummaryGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&) {
+  using CI = tables::ExperimentalTrackSummaryTable::ColumnIndex;
+  auto get_arg = [&cs](CI column) {
+    auto it = std::find_if(cs.begin(), cs.end(), [column](const Constraint& c) {
+      return c.col_idx == static_cast<uint32_t>(column) &&
+             c.op == FilterOp::kEq;
+    });
+    return it->value.AsLong();
+  };
+  TrackId track_id(static_cast<uint32_t>(get_arg(CI::track_id)));
+  int64_t start_bound = get_arg(CI::start_bound);
+  int64_t end_bound = get_arg(CI::end_bound);
+  int64_t bucket_count = get_arg(CI::bucket_count);
+  if (bucket_count <= 0 || bucket_count > std::numeric_limits<uint32_t>::max())
+    return nullptr;
+
+  if (!summaries_built_)
+    BuildSummaries();
+
+  // Tracks without counter values or slices have an empty summary.
+  Summary empty_summary({}, {});
+  auto it = summaries_.find(track_id);
+  const Summary& summary =
+      it == summaries_.end() ? empty_summary : *it->second;
+  return ComputeSummaryTable(summary, context_->storage->mutable_string_pool(),
+                             track_id, start_bound, end_bound,
+                             static_cast<uint32_t>(bucket_count));
+}
+
+// static
+std::unique_ptr<tables::ExperimentalTrackSummaryTable>
+ExperimentalTrackSummaryGenerator::ComputeSummaryTable(const Summary& summary,
+                                                       StringPool* pool,
+                                                       TrackId track_id,
+                                                       int64_t start_bound,
+                                                       int64_t end_bound,
+                                                       uint32_t bucket_count) {
+  std::unique_ptr<tables::ExperimentalTrackSummaryTable> out(
+      new tables::ExperimentalTrackSummaryTable(pool, nullptr));
+  if (end_bound <= start_bound)
+    return out;
+
+  // Round the duration of the buckets up, so that they cover the whole range.
+  int64_t range = end_bound - start_bound;
+  int64_t bucket_dur = (range + bucket_count - 1) / bucket_count;
+  for (int64_t ts = start_bound; ts < end_bound; ts += bucket_dur) {
+    int64_t dur = std::min(bucket_dur, end_bound - ts);
+    Aggregate aggregate = summary.Query(ts, ts + dur);
+    if (aggregate.count == 0)
+      continue;
+
+    tables::ExperimentalTrackSummaryTable::Row row;
+    row.ts = ts;
+    row.dur = dur;
+    row.event_count = aggregate.count;
+    row.min_value = aggregate.min;
+    row.max_value = aggregate.max;
+    row.sum_value = aggregate.sum;
+    row.track_id = track_id;
+    row.start_bound = start_bound;
+    row.end_bound = end_bound;
+    row.bucket_count = bucket_count;
+    out->Insert(row);
+  }
+  return out;
+}
+
+void ExperimentalTrackSummaryGenerator::BuildSummaries() {
+  std::unordered_map<TrackId, TrackEvents> events;
+
+  const auto& counter = context_->storage->counter_table();
+  for (uint32_t i = 0; i < counter.row_count(); ++i) {
+    TrackEvents& track = events[counter.track_id()[i]];
+    track.ts.push_back(counter.ts()[i]);
+    track.values.push_back(counter.value()[i]);
+  }
+
+  const auto& slice = context_->storage->slice_table();
+  for (uint32_t i = 0; i < slice.row_count(); ++i) {
+    if (slice.depth()[i] != 0)
+      continue;
+    TrackEvents& track = events[slice.track_id()[i]];
+    track.ts.push_back(slice.ts()[i]);
+    track.values.push_back(static_cast<double>(slice.dur()[i]));
+  }
+
+  for (auto& track : events) {
+    TrackEvents& e = track.second;
+
+    // The counter table is sorted by timestamp but the depth 0 slices of a
+    // track are only sorted by timestamp if they don't overlap.
+    if (!std::is_sorted(e.ts.begin(), e.ts.end())) {
+      std::vector<uint32_t> order(e.ts.size());
+      std::iota(order.begin(), order.end(), 0u);
+      std::stable_sort(
+          order.begin(), order.end(),
+          [&e](uint32_t a, uint32_t b) { return e.ts[a] < e.ts[b]; });
+      TrackEvents sorted;
+      sorted.ts.reserve(order.size());
+      sorted.values.reserve(order.size());
+      for (uint32_t idx : order) {
+        sorted.ts.push_back(e.ts[idx]);
+        sorted.values.push_back(e.values[idx]);
+      }
+      e = std::move(sorted);
+    }
+    summaries_[track.first].reset(
+        new Summary(std::move(e.ts), std::move(e.values)));
+  }
+  summaries_built_ = true;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TRACK_SUMMARY_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TRACK_SUMMARY_GENERATOR_H_
+
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Dynamic table generator for the "track summary" table.
+//
+// Given a track, a time range and a number of buckets, this splits the range
+// into buckets of equal duration and returns, for each bucket containing at
+// least one event of the track, the number of events starting in the bucket
+// and the min, max and sum of their values. The events of a counter track are
+// its counter values while the events of any other track are its depth 0
+// slices, whose value is their duration (so the sum is the time covered by
+// the slices starting in the bucket, with -1 for each slice which didn't end).
+//
+// This is intended for the rendering of tracks when zoomed out: the events of
+// all the tracks are pre-aggregated (on the first query after the trace is
+// loaded or updated) so that the cost of a query only depends on the number
+// of buckets and not on the number of events in the range.
+class ExperimentalTrackSummaryGenerator
+    : public DbSqliteTable::DynamicTableGenerator {
+ public:
+  // The aggregated values of a set of events.
+  struct Aggregate {
+    void Add(double value);
+    void Merge(const Aggregate& other);
+
+    uint32_t count = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    double sum = 0;
+  };
+
+  // The events of a single track, sorted by timestamp, together with the
+  // aggregates of their values over groups of consecutive events of
+  // increasing power-of-two sizes. This allows to aggregate any range of
+  // events in O(log(n)) time.
+  class Summary {
+   public:
+    // |ts| must be sorted and have the same size as |values|.
+    Summary(std::vector<int64_t> ts, std::vector<double> values);
+
+    // Returns the aggregate of the events with |start| <= ts < |end|.
+    Aggregate Query(int64_t start, int64_t end) const;
+
+   private:
+    // The size of the smallest groups which are pre-aggregated. Smaller
+    // ranges are aggregated from the values directly: this trades a few
+    // operations per query for a much smaller memory overhead.
+    static constexpr uint32_t kGroupSize = 8;
+
+    void AddValues(uint32_t begin, uint32_t end, Aggregate* out) const;
+
+    std::vector<int64_t> ts_;
+    std::vector<double> values_;
+
+    // |levels_[i][j]| is the aggregate of the events in
+    // [j * (kGroupSize << i), (j + 1) * (kGroupSize << i)).
+    std::vector<std::vector<Aggregate>> levels_;
+  };
+
+  explicit ExperimentalTrackSummaryGenerator(TraceProcessorContext* context);
+  ~ExperimentalTrackSummaryGenerator() override;
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  util::Status ValidateConstraints(const QueryConstraints&) override;
+  std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>& cs,
+                                      const std::vector<Order>& ob) override;
+
+  // Drops the summaries of the tracks, e.g. because more of the trace has been
+  // parsed.
+  void ClearCache() {
+    summaries_.clear();
+    summaries_built_ = false;
+  }
+
+  // public + static for testing.
+  static std::unique_ptr<tables::ExperimentalTrackSummaryTable>
+  ComputeSummaryTable(const Summary& summary,
+                      StringPool* pool,
+                      TrackId track_id,
+                      int64_t start_bound,
+                      int64_t end_bound,
+                      uint32_t bucket_count);
+
+ private:
+  // Builds the summaries of all the counter and slice tracks in a single pass
+  // over the counter and slice tables.
+  void BuildSummaries();
+
+  TraceProcessorContext* context_ = nullptr;
+  std::unordered_map<TrackId, std::unique_ptr<Summary>> summaries_;
+  bool summaries_built_ = false;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_TRACK_SUMMARY_GENERATOR_H_
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_track_summary_generator.h"
+
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Summary = ExperimentalTrackSummaryGenerator::Summary;
+using Aggregate = ExperimentalTrackSummaryGenerator::Aggregate;
+
+TEST(ExperimentalTrackSummaryGeneratorTest, EmptySummary) {
+  Summary summary({}, {});
+  Aggregate aggregate = summary.Query(0, 100);
+  ASSERT_EQ(aggregate.count, 0u);
+}
+
+TEST(ExperimentalTrackSummaryGeneratorTest, QueryMatchesScan) {
+  std::minstd_rand0 rnd(0);
+  std::vector<int64_t> ts;
+  std::vector<double> values;
+  int64_t cur_ts = 0;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    // Repeat some of the timestamps.
+    cur_ts += rnd() % 3;
+    ts.push_back(cur_ts);
+    values.push_back(static_cast<double>(rnd() % 1000) - 500);
+  }
+  Summary summary(ts, values);
+
+  for (uint32_t i = 0; i < 1000; ++i) {
+    int64_t start = static_cast<int64_t>(rnd() % 1100) - 50;
+    int64_t end = start + static_cast<int64_t>(rnd() % 1100);
+
+    Aggregate expected;
+    for (uint32_t j = 0; j < ts.size(); ++j) {
+      if (ts[j] >= start && ts[j] < end)
+        expected.Add(values[j]);
+    }
+    Aggregate actual = summary.Query(start, end);
+    ASSERT_EQ(actual.count, expected.count) << start << " " << end;
+    if (expected.count == 0)
+      continue;
+    ASSERT_EQ(actual.min, expected.min) << start << " " << end;
+    ASSERT_EQ(actual.max, expected.max) << start << " " << end;
+    ASSERT_EQ(actual.sum, expected.sum) << start << " " << end;
+  }
+}
+
+TEST(ExperimentalTrackSummaryGeneratorTest, Buckets) {
+  StringPool pool;
+  std::vector<int64_t> ts;
+  std::vector<double> values;
+  for (int64_t i = 0; i < 100; ++i) {
+    ts.push_back(i);
+    values.push_back(static_cast<double>(i));
+  }
+  Summary summary(std::move(ts), std::move(values));
+
+  // The last bucket is truncated at the end bound and the buckets after the
+  // last event are skipped.
+  auto table = ExperimentalTrackSummaryGenerator::ComputeSummaryTable(
+      summary, &pool, TrackId{1u}, 50 /* start_bound */, 150 /* end_bound */,
+      3 /* bucket_count */);
+  ASSERT_EQ(table->row_count(), 2u);
+
+  ASSERT_EQ(table->ts()[0], 50);
+  ASSERT_EQ(table->dur()[0], 34);
+  ASSERT_EQ(table->event_count()[0], 34u);
+  ASSERT_EQ(table->min_value()[0], 50);
+  ASSERT_EQ(table->max_value()[0], 83);
+  ASSERT_EQ(table->sum_value()[0], (50 + 83) * 34 / 2);
+
+  ASSERT_EQ(table->ts()[1], 84);
+  ASSERT_EQ(table->dur()[1], 34);
+  ASSERT_EQ(table->event_count()[1], 16u);
+  ASSERT_EQ(table->min_value()[1], 84);
+  ASSERT_EQ(table->max_value()[1], 99);
+  ASSERT_EQ(table->sum_value()[1], (84 + 99) * 16 / 2);
+
+  table = ExperimentalTrackSummaryGenerator::ComputeSummaryTable(
+      summary, &pool, TrackId{1u}, 150 /* start_bound */, 50 /* end_bound */,
+      3 /* bucket_count */);
+  ASSERT_EQ(table->row_count(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
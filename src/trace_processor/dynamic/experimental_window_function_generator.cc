@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_window_function_generator.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using CI = tables::ExperimentalWindowFunctionTable::ColumnIndex;
+using Function = ExperimentalWindowFunctionGenerator::Function;
+
+base::Optional<Function> ParseFunction(const std::string& name) {
+  if (name == "lag")
+    return Function::kLag;
+  if (name == "lead")
+    return Function::kLead;
+  if (name == "row_number")
+    return Function::kRowNumber;
+  if (name == "running_sum")
+    return Function::kRunningSum;
+  if (name == "running_min")
+    return Function::kRunningMin;
+  if (name == "running_max")
+    return Function::kRunningMax;
+  return base::nullopt;
+}
+
+// Returns the value of the equality constraint on |col| in |cs|, if any.
+const SqlValue* FindArg(const std::vector<Constraint>& cs, CI col) {
+  auto it = std::find_if(cs.begin(), cs.end(), [col](const Constraint& c) {
+    return c.col_idx == static_cast<uint32_t>(col) && c.op == FilterOp::kEq;
+  });
+  return it == cs.end() ? nullptr : &it->value;
+}
+
+// Returns the string value of the constraint on |col|, or the empty string if
+// there is none or it is null.
+util::Status FindStringArg(const std::vector<Constraint>& cs,
+                           CI col,
+                           std::string* out) {
+  const SqlValue* value = FindArg(cs, col);
+  if (!value || value->is_null()) {
+    *out = "";
+    return util::OkStatus();
+  }
+  if (value->type != SqlValue::kString)
+    return util::ErrStatus("The arguments of the window function are strings");
+  *out = value->AsString();
+  return util::OkStatus();
+}
+
+// Reads the keys of |col| which partition or order the rows. Integer columns
+// (ids, timestamps, cpus...) are supported and, for partitioning only, string
+// columns: their values are interned so they are equal iff their pointers
+// are.
+util::Status ReadKeys(const Column& col,
+                      uint32_t row_count,
+                      bool allow_strings,
+                      std::vector<base::Optional<int64_t>>* keys) {
+  SqlValue::Type type = col.type();
+  if (type != SqlValue::kLong && !(allow_strings && type == SqlValue::kString))
+    return util::ErrStatus("Unsupported type of column %s", col.name());
+
+  keys->resize(row_count);
+  for (uint32_t i = 0; i < row_count; ++i) {
+    SqlValue value = col.Get(i);
+    if (value.type == SqlValue::kLong) {
+      (*keys)[i] = value.long_value;
+    } else if (value.type == SqlValue::kString) {
+      (*keys)[i] = static_cast<int64_t>(
+          reinterpret_cast<uintptr_t>(value.string_value));
+    } else {
+      (*keys)[i] = base::nullopt;
+    }
+  }
+  return util::OkStatus();
+}
+
+// Combines the running aggregate |a| with the value |b|.
+template <typename T>
+T Aggregate(Function function, T a, T b) {
+  switch (function) {
+    case Function::kRunningSum:
+      return a + b;
+    case Function::kRunningMin:
+      return std::min(a, b);
+    case Function::kRunningMax:
+      return std::max(a, b);
+    case Function::kLag:
+    case Function::kLead:
+    case Function::kRowNumber:
+      break;
+  }
+  PERFETTO_FATAL("Not an aggregate");
+}
+
+SqlValue Aggregate(Function function, const SqlValue& a, const SqlValue& b) {
+  if (a.is_null())
+    return b;
+  if (b.is_null())
+    return a;
+  if (a.type == SqlValue::kLong && b.type == SqlValue::kLong)
+    return SqlValue::Long(Aggregate(function, a.long_value, b.long_value));
+  double a_double = a.type == SqlValue::kLong
+                        ? static_cast<double>(a.long_value)
+                        : a.double_value;
+  double b_double = b.type == SqlValue::kLong
+                        ? static_cast<double>(b.long_value)
+                        : b.double_value;
+  return SqlValue::Double(Aggregate(function, a_double, b_double));
+}
+
+// The result of a query: the columns of |rows| extended with the values of
+// the function. Owns |rows|, which holds the storage of its columns.
+class ResultTable : public Table {
+ public:
+  ResultTable(Table table,
+              std::unique_ptr<tables::ExperimentalWindowFunctionTable> rows)
+      : Table(std::move(table)), rows_(std::move(rows)) {}
+
+ private:
+  std::unique_ptr<tables::ExperimentalWindowFunctionTable> rows_;
+};
+
+}  // namespace
+
+ExperimentalWindowFunctionGenerator::ExperimentalWindowFunctionGenerator(
+    TraceProcessorContext* context,
+    std::vector<const macros_internal::MacroTable*> tables)
+    : context_(context) {
+  for (const macros_internal::MacroTable* table : tables)
+    tables_[table->table_name()] = table;
+}
+
+ExperimentalWindowFunctionGenerator::~ExperimentalWindowFunctionGenerator() =
+    default;
+
+Table::Schema ExperimentalWindowFunctionGenerator::CreateSchema() {
+  Table::Schema schema = tables::ExperimentalWindowFunctionTable::Schema();
+  schema.columns.emplace_back(
+      Table::Schema::Column{"value", SqlValue::Type::kLong, false /* is_id */,
+                            false /* is_sorted */, false /* is_hidden */});
+  return schema;
+}
+
+std::string ExperimentalWindowFunctionGenerator::TableName() {
+  return "experimental_window_function";
+}
+
+uint32_t ExperimentalWindowFunctionGenerator::EstimateRowCount() {
+  // Most of the window functions are computed on the big tables.
+  return 1024 * 1024;
+}
+
+util::Status ExperimentalWindowFunctionGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  bool has_source_table = false;
+  bool has_function_name = false;
+  bool has_value_column = false;
+  for (const auto& c : qc.constraints()) {
+    if (c.op != SQLITE_INDEX_CONSTRAINT_EQ)
+      continue;
+    has_source_table |= c.column == static_cast<int>(CI::source_table);
+    has_function_name |= c.column == static_cast<int>(CI::function_name);
+    has_value_column |= c.column == static_cast<int>(CI::value_column);
+  }
+  return has_source_table && has_function_name && has_value_column
+             ? util::OkStatus()
+             : util::ErrStatus("Failed to find required constraints");
+}
+
+std::unique_ptr<Table> ExperimentalWindowFunctionGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&) {
+  std::string source_table;
+  std::string function_name;
+  std::string value_column;
+  std::string partition_column;
+  std::string order_column;
+  int64_t offset = 1;
+  util::Status status = FindStringArg(cs, CI::source_table, &source_table);
+  if (status.ok())
+    status = FindStringArg(cs, CI::function_name, &function_name);
+  if (status.ok())
+    status = FindStringArg(cs, CI::value_column, &value_column);
+  if (status.ok())
+    status = FindStringArg(cs, CI::partition_column, &partition_column);
+  if (status.ok())
+    status = FindStringArg(cs, CI::order_column, &order_column);
+  const SqlValue* offset_arg = FindArg(cs, CI::function_offset);
+  if (status.ok() && offset_arg && !offset_arg->is_null()) {
+    if (offset_arg->type == SqlValue::kLong && offset_arg->long_value >= 0) {
+      offset = offset_arg->long_value;
+    } else {
+      status = util::ErrStatus("The offset must be a non-negative integer");
+    }
+  }
+
+  base::Optional<Function> function = ParseFunction(function_name);
+  auto table_it = tables_.find(source_table);
+  if (status.ok() && !function)
+    status = util::ErrStatus("Unknown function %s", function_name.c_str());
+  if (status.ok() && table_it == tables_.end())
+    status = util::ErrStatus("Unknown table %s", source_table.c_str());
+
+  Partitions* partitions = nullptr;
+  if (status.ok()) {
+    const Table& table = *table_it->second;
+    std::string key =
+        source_table + "/" + partition_column + "/" + order_column;
+    partitions = &partitions_cache_[key];
+    if (partitions->rows.empty() || partitions->row_count != table.row_count())
+      status = ComputePartitions(table, partition_column, order_column,
+                                 partitions);
+    if (!status.ok())
+      partitions_cache_.erase(key);
+  }
+
+  std::vector<SqlValue> values;
+  if (status.ok()) {
+    status = ComputeValues(*table_it->second, *partitions, value_column,
+                           *function, offset, &values);
+  }
+  if (!status.ok()) {
+    // Returning null fails the query.
+    PERFETTO_ELOG("experimental_window_function: %s", status.c_message());
+    return nullptr;
+  }
+
+  // The value column has the type of the values, which is the type of the
+  // source column except for row numbers and for mixed integer and double
+  // aggregates.
+  bool is_double = std::any_of(values.begin(), values.end(),
+                               [](const SqlValue& v) {
+                                 return v.type == SqlValue::kDouble;
+                               });
+
+  StringPool* string_pool = context_->storage->mutable_string_pool();
+  tables::ExperimentalWindowFunctionTable::Row row;
+  row.source_table = string_pool->InternString(base::StringView(source_table));
+  row.function_name =
+      string_pool->InternString(base::StringView(function_name));
+  row.value_column = string_pool->InternString(base::StringView(value_column));
+  if (!partition_column.empty()) {
+    row.partition_column =
+        string_pool->InternString(base::StringView(partition_column));
+  }
+  if (!order_column.empty()) {
+    row.order_column =
+        string_pool->InternString(base::StringView(order_column));
+  }
+  if (offset_arg && !offset_arg->is_null())
+    row.function_offset = offset;
+
+  const Column* id_col = table_it->second->GetColumnByName("id");
+  std::unique_ptr<tables::ExperimentalWindowFunctionTable> out(
+      new tables::ExperimentalWindowFunctionTable(string_pool, nullptr));
+  std::unique_ptr<NullableVector<int64_t>> long_values(
+      new NullableVector<int64_t>());
+  std::unique_ptr<NullableVector<double>> double_values(
+      new NullableVector<double>());
+  for (uint32_t i = 0; i < values.size(); ++i) {
+    row.source_id = id_col->Get(i).long_value;
+    out->Insert(row);
+
+    const SqlValue& value = values[i];
+    if (is_double && value.is_null()) {
+      double_values->AppendNull();
+    } else if (is_double) {
+      double_values->Append(value.type == SqlValue::kLong
+                                ? static_cast<double>(value.long_value)
+                                : value.double_value);
+    } else if (value.is_null()) {
+      long_values->AppendNull();
+    } else {
+      long_values->Append(value.long_value);
+    }
+  }
+
+  uint32_t flags = TypedColumn<base::Optional<int64_t>>::default_flags();
+  Table table =
+      is_double
+          ? out->ExtendWithColumn("value", std::move(double_values), flags)
+          : out->ExtendWithColumn("value", std::move(long_values), flags);
+  return std::unique_ptr<Table>(new ResultTable(std::move(table),
+                                                std::move(out)));
+}
+
+// static
+util::Status ExperimentalWindowFunctionGenerator::ComputePartitions(
+    const Table& table,
+    const std::string& partition_column,
+    const std::string& order_column,
+    Partitions* partitions) {
+  const Column* partition_col = nullptr;
+  if (!partition_column.empty()) {
+    partition_col = table.GetColumnByName(partition_column.c_str());
+    if (!partition_col) {
+      return util::ErrStatus("Unknown partition column %s",
+                             partition_column.c_str());
+    }
+  }
+  const Column* order_col = nullptr;
+  if (!order_column.empty()) {
+    order_col = table.GetColumnByName(order_column.c_str());
+    if (!order_col)
+      return util::ErrStatus("Unknown order column %s", order_column.c_str());
+  }
+
+  uint32_t row_count = table.row_count();
+  partitions->row_count = row_count;
+  partitions->rows.resize(row_count);
+  std::iota(partitions->rows.begin(), partitions->rows.end(), 0u);
+  partitions->ends.clear();
+
+  // The rows of a table sorted on the order column (e.g. the ts of most
+  // tables) are already in order: they only need to be partitioned, which
+  // keeps them in order as the sort is stable.
+  std::vector<base::Optional<int64_t>> order_keys;
+  if (order_col && !order_col->IsSorted()) {
+    RETURN_IF_ERROR(ReadKeys(*order_col, row_count, false, &order_keys));
+    std::stable_sort(partitions->rows.begin(), partitions->rows.end(),
+                     [&order_keys](uint32_t a, uint32_t b) {
+                       return order_keys[a] < order_keys[b];
+                     });
+  } else if (order_col && order_col->type() != SqlValue::kLong) {
+    return util::ErrStatus("Unsupported type of column %s", order_col->name());
+  }
+
+  if (!partition_col) {
+    if (row_count > 0)
+      partitions->ends.push_back(row_count);
+    return util::OkStatus();
+  }
+
+  std::vector<base::Optional<int64_t>> partition_keys;
+  RETURN_IF_ERROR(ReadKeys(*partition_col, row_count, true, &partition_keys));
+  std::stable_sort(partitions->rows.begin(), partitions->rows.end(),
+                   [&partition_keys](uint32_t a, uint32_t b) {
+                     return partition_keys[a] < partition_keys[b];
+                   });
+  for (uint32_t i = 1; i < row_count; ++i) {
+    if (partition_keys[partitions->rows[i]] !=
+        partition_keys[partitions->rows[i - 1]]) {
+      partitions->ends.push_back(i);
+    }
+  }
+  if (row_count > 0)
+    partitions->ends.push_back(row_count);
+  return util::OkStatus();
+}
+
+// static
+util::Status ExperimentalWindowFunctionGenerator::ComputeValues(
+    const Table& table,
+    const Partitions& partitions,
+    const std::string& value_column,
+    Function function,
+    int64_t offset,
+    std::vector<SqlValue>* values) {
+  const Column* value_col = table.GetColumnByName(value_column.c_str());
+  if (!value_col)
+    return util::ErrStatus("Unknown column %s", value_column.c_str());
+  if (value_col->type() != SqlValue::kLong &&
+      value_col->type() != SqlValue::kDouble) {
+    return util::ErrStatus("The window functions are only supported on "
+                           "numeric columns");
+  }
+  PERFETTO_DCHECK(partitions.row_count == table.row_count());
+
+  const std::vector<uint32_t>& rows = partitions.rows;
+  values->assign(rows.size(), SqlValue());
+  uint32_t start = 0;
+  for (uint32_t end : partitions.ends) {
+    SqlValue running;
+    for (uint32_t i = start; i < end; ++i) {
+      SqlValue& value = (*values)[rows[i]];
+      switch (function) {
+        case Function::kLag:
+          if (static_cast<int64_t>(i - start) >= offset)
+            value = value_col->Get(rows[i - static_cast<uint32_t>(offset)]);
+          break;
+        case Function::kLead:
+          if (static_cast<int64_t>(end - i) > offset)
+            value = value_col->Get(rows[i + static_cast<uint32_t>(offset)]);
+          break;
+        case Function::kRowNumber:
+          value = SqlValue::Long(i - start + 1);
+          break;
+        case Function::kRunningSum:
+        case Function::kRunningMin:
+        case Function::kRunningMax:
+          running = Aggregate(function, running, value_col->Get(rows[i]));
+          value = running;
+          break;
+      }
+    }
+    start = end;
+  }
+  return util::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_WINDOW_FUNCTION_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_WINDOW_FUNCTION_GENERATOR_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Dynamic table generator for the "experimental_window_function" table
+// function, which computes window functions (lag, lead and running
+// aggregates) over the columns of |tables| natively instead of through the
+// window functions of SQLite, which are slow on the largest tables.
+class ExperimentalWindowFunctionGenerator
+    : public DbSqliteTable::DynamicTableGenerator {
+ public:
+  enum class Function {
+    kLag,
+    kLead,
+    kRowNumber,
+    kRunningSum,
+    kRunningMin,
+    kRunningMax,
+  };
+
+  // The rows of a table sorted by partition and then by order, with the
+  // boundaries of the partitions.
+  struct Partitions {
+    // The number of rows of the table when this was computed.
+    uint32_t row_count = 0;
+
+    // The rows of the table in partition and order.
+    std::vector<uint32_t> rows;
+
+    // The index in |rows| of the end of each partition.
+    std::vector<uint32_t> ends;
+  };
+
+  ExperimentalWindowFunctionGenerator(
+      TraceProcessorContext* context,
+      std::vector<const macros_internal::MacroTable*> tables);
+  ~ExperimentalWindowFunctionGenerator() override;
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  util::Status ValidateConstraints(const QueryConstraints&) override;
+  std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>& cs,
+                                      const std::vector<Order>& ob) override;
+
+  // public + static for testing.
+  static util::Status ComputePartitions(const Table& table,
+                                        const std::string& partition_column,
+                                        const std::string& order_column,
+                                        Partitions* partitions);
+  static util::Status ComputeValues(const Table& table,
+                                    const Partitions& partitions,
+                                    const std::string& value_column,
+                                    Function function,
+                                    int64_t offset,
+                                    std::vector<SqlValue>* values);
+
+ private:
+  TraceProcessorContext* context_ = nullptr;
+  std::map<std::string, const Table*> tables_;
+
+  // The partitions computed by the previous queries, by table, partition
+  // column and order column. As rows are only ever appended to the tables and
+  // the columns which partition and order them (ts, track_id, cpu...) are not
+  // modified, they are valid as long as the row count of the table is
+  // unchanged: different functions and values over the same partitions (e.g.
+  // the lag and lead of the ts of each track) only sort the table once.
+  std::map<std::string, Partitions> partitions_cache_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_EXPERIMENTAL_WINDOW_FUNCTION_GENERATOR_H_
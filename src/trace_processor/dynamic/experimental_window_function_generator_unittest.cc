@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/experimental_window_function_generator.h"
+
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Function = ExperimentalWindowFunctionGenerator::Function;
+using CI = tables::ExperimentalWindowFunctionTable::ColumnIndex;
+
+class ExperimentalWindowFunctionGeneratorTest : public ::testing::Test {
+ public:
+  ExperimentalWindowFunctionGeneratorTest() {
+    context_.storage.reset(new TraceStorage());
+    // Two tracks with interleaved values.
+    Insert(100, 1, 10);
+    Insert(101, 2, 2);
+    Insert(102, 1, 20);
+    Insert(105, 2, 1);
+    Insert(110, 1, 30);
+  }
+
+ protected:
+  void Insert(int64_t ts, uint32_t track_id, double value) {
+    tables::CounterTable::Row row;
+    row.ts = ts;
+    row.track_id = tables::TrackTable::Id{track_id};
+    row.value = value;
+    context_.storage->mutable_counter_table()->Insert(row);
+  }
+
+  std::vector<SqlValue> Compute(Function function,
+                                const std::string& partition_column,
+                                const std::string& order_column,
+                                const std::string& value_column,
+                                int64_t offset = 1) {
+    const Table& table = context_.storage->counter_table();
+    ExperimentalWindowFunctionGenerator::Partitions partitions;
+    EXPECT_TRUE(ExperimentalWindowFunctionGenerator::ComputePartitions(
+                    table, partition_column, order_column, &partitions)
+                    .ok());
+    std::vector<SqlValue> values;
+    EXPECT_TRUE(ExperimentalWindowFunctionGenerator::ComputeValues(
+                    table, partitions, value_column, function, offset, &values)
+                    .ok());
+    return values;
+  }
+
+  Constraint Arg(CI col, const char* value) {
+    return Constraint{static_cast<uint32_t>(col), FilterOp::kEq,
+                      SqlValue::String(value)};
+  }
+
+  TraceProcessorContext context_;
+};
+
+TEST_F(ExperimentalWindowFunctionGeneratorTest, LagAndLead) {
+  auto lead = Compute(Function::kLead, "track_id", "ts", "ts");
+  ASSERT_EQ(lead.size(), 5u);
+  ASSERT_EQ(lead[0].long_value, 102);
+  ASSERT_EQ(lead[1].long_value, 105);
+  ASSERT_EQ(lead[2].long_value, 110);
+  ASSERT_TRUE(lead[3].is_null());
+  ASSERT_TRUE(lead[4].is_null());
+
+  auto lag = Compute(Function::kLag, "track_id", "ts", "value", 2);
+  ASSERT_TRUE(lag[0].is_null());
+  ASSERT_TRUE(lag[1].is_null());
+  ASSERT_TRUE(lag[2].is_null());
+  ASSERT_TRUE(lag[3].is_null());
+  ASSERT_EQ(lag[4].double_value, 10);
+}
+
+TEST_F(ExperimentalWindowFunctionGeneratorTest, RunningAggregates) {
+  auto sum = Compute(Function::kRunningSum, "track_id", "ts", "value");
+  ASSERT_EQ(sum[0].double_value, 10);
+  ASSERT_EQ(sum[1].double_value, 2);
+  ASSERT_EQ(sum[2].double_value, 30);
+  ASSERT_EQ(sum[3].double_value, 3);
+  ASSERT_EQ(sum[4].double_value, 60);
+
+  // Without a partition or order, the rows are in the order of the table.
+  auto max = Compute(Function::kRunningMax, "", "", "value");
+  ASSERT_EQ(max[0].double_value, 10);
+  ASSERT_EQ(max[1].double_value, 10);
+  ASSERT_EQ(max[2].double_value, 20);
+  ASSERT_EQ(max[3].double_value, 20);
+  ASSERT_EQ(max[4].double_value, 30);
+
+  // The table is not sorted by track.
+  auto row_number = Compute(Function::kRowNumber, "", "track_id", "ts");
+  ASSERT_EQ(row_number[0].long_value, 1);
+  ASSERT_EQ(row_number[1].long_value, 4);
+  ASSERT_EQ(row_number[2].long_value, 2);
+  ASSERT_EQ(row_number[3].long_value, 5);
+  ASSERT_EQ(row_number[4].long_value, 3);
+}
+
+TEST_F(ExperimentalWindowFunctionGeneratorTest, ComputeTable) {
+  ExperimentalWindowFunctionGenerator generator(
+      &context_, {&context_.storage->counter_table()});
+  std::vector<Constraint> cs{Arg(CI::source_table, "counter"),
+                             Arg(CI::function_name, "lead"),
+                             Arg(CI::value_column, "ts"),
+                             Arg(CI::partition_column, "track_id"),
+                             Arg(CI::order_column, "ts")};
+
+  std::unique_ptr<Table> res = generator.ComputeTable(cs, {});
+  ASSERT_TRUE(res);
+  ASSERT_EQ(res->row_count(), 5u);
+  ASSERT_EQ(res->GetColumnByName("source_id")->Get(3).long_value, 3);
+  ASSERT_EQ(res->GetColumnByName("value")->Get(1).long_value, 105);
+
+  // The rows added after the first query are partitioned too.
+  Insert(120, 2, 3);
+  res = generator.ComputeTable(cs, {});
+  ASSERT_EQ(res->row_count(), 6u);
+  ASSERT_EQ(res->GetColumnByName("value")->Get(3).long_value, 120);
+
+  cs[1] = Arg(CI::function_name, "median");
+  ASSERT_FALSE(generator.ComputeTable(cs, {}));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
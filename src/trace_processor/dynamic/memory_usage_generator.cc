@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/memory_usage_generator.h"
+
+#include <unordered_set>
+
+#include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+MemoryUsageGenerator::MemoryUsageGenerator(
+    TraceProcessorContext* context,
+    std::vector<const macros_internal::MacroTable*> tables)
+    : context_(context), tables_(std::move(tables)) {}
+
+MemoryUsageGenerator::~MemoryUsageGenerator() = default;
+
+Table::Schema MemoryUsageGenerator::CreateSchema() {
+  return tables::MemoryUsageTable::Schema();
+}
+
+std::string MemoryUsageGenerator::TableName() {
+  return "memory_usage";
+}
+
+uint32_t MemoryUsageGenerator::EstimateRowCount() {
+  // Roughly the number of (non-shared) columns of all the tables.
+  return static_cast<uint32_t>(tables_.size()) * 8;
+}
+
+util::Status MemoryUsageGenerator::ValidateConstraints(
+    const QueryConstraints&) {
+  return util::OkStatus();
+}
+
+std::unique_ptr<Table> MemoryUsageGenerator::ComputeTable(
+    const std::vector<Constraint>&,
+    const std::vector<Order>&) {
+  StringPool* pool = context_->storage->mutable_string_pool();
+
+  // Measure the string pool before interning the names of the rows below.
+  StringPool::MemoryUsage pool_usage = pool->GetMemoryUsage();
+
+  std::unique_ptr<tables::MemoryUsageTable> out(
+      new tables::MemoryUsageTable(pool, nullptr));
+  auto insert = [&out, pool](const char* category, const char* name,
+                             const char* detail, size_t size_bytes) {
+    if (size_bytes == 0)
+      return;
+    tables::MemoryUsageTable::Row row;
+    row.category = pool->InternString(category);
+    row.name = pool->InternString(name);
+    if (detail)
+      row.detail = pool->InternString(detail);
+    row.size_bytes = static_cast<int64_t>(size_bytes);
+    out->Insert(row);
+  };
+
+  // The columns of child tables share their storage with the parent table:
+  // only account for each storage once.
+  std::unordered_set<const NullableVectorBase*> seen_storage;
+  for (const macros_internal::MacroTable* table : tables_) {
+    for (uint32_t i = 0; i < table->GetColumnCount(); ++i) {
+      const Column& col = table->GetColumn(i);
+      if (!col.storage() || !seen_storage.insert(col.storage()).second)
+        continue;
+      insert("column", table->table_name(), col.name(),
+             col.StorageSizeBytes());
+      insert("column_index", table->table_name(), col.name(),
+             col.IndexSizeBytes());
+    }
+
+    size_t row_maps_size = 0;
+    for (const RowMap& rm : table->row_maps())
+      row_maps_size += rm.SizeBytes();
+    insert("row_maps", table->table_name(), nullptr, row_maps_size);
+  }
+
+  insert("string_pool", "blocks", nullptr, pool_usage.blocks_bytes);
+  insert("string_pool", "large_strings", nullptr,
+         pool_usage.large_strings_bytes);
+  insert("string_pool", "index", nullptr, pool_usage.index_bytes);
+
+  if (context_->sorter)
+    insert("sorter", "queues", nullptr, context_->sorter->QueuesSizeBytes());
+
+  return std::move(out);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_MEMORY_USAGE_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_MEMORY_USAGE_GENERATOR_H_
+
+#include <vector>
+
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Dynamic table generator for the "memory_usage" table, which breaks down the
+// memory used by the storage of trace processor: the columns and RowMaps of
+// |tables|, the string pool and the queues of the sorter. This is computed
+// from scratch on each query so it reflects the current state of the storage
+// (e.g. after columns are compressed or spilled).
+class MemoryUsageGenerator : public DbSqliteTable::DynamicTableGenerator {
+ public:
+  MemoryUsageGenerator(TraceProcessorContext* context,
+                       std::vector<const macros_internal::MacroTable*> tables);
+  ~MemoryUsageGenerator() override;
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  util::Status ValidateConstraints(const QueryConstraints&) override;
+  std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>& cs,
+                                      const std::vector<Order>& ob) override;
+
+ private:
+  TraceProcessorContext* context_ = nullptr;
+  std::vector<const macros_internal::MacroTable*> tables_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_MEMORY_USAGE_GENERATOR_H_
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/dynamic/overlapping_generator.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// Builds the index over the [ts, ts + dur) intervals of |table|. Slices
+// which have not ended (i.e. with a negative or null dur) overlap everything
+// after their start.
+std::unique_ptr<IntervalIndex> BuildIndex(const Table& table) {
+  const Column* ts = table.GetColumnByName("ts");
+  const Column* dur = table.GetColumnByName("dur");
+  PERFETTO_CHECK(ts && dur);
+
+  std::vector<IntervalIndex::Interval> intervals(table.row_count());
+  for (uint32_t i = 0; i < table.row_count(); ++i) {
+    int64_t start = ts->Get(i).AsLong();
+    SqlValue dur_value = dur->Get(i);
+    int64_t end = std::numeric_limits<int64_t>::max();
+    if (!dur_value.is_null() && dur_value.AsLong() >= 0 &&
+        start <= end - dur_value.AsLong()) {
+      end = start + dur_value.AsLong();
+    }
+    intervals[i] = IntervalIndex::Interval{start, end};
+  }
+  return std::unique_ptr<IntervalIndex>(new IntervalIndex(intervals));
+}
+
+Table ExtendWithConstant(const Table& table, const char* name, int64_t value) {
+  std::unique_ptr<NullableVector<int64_t>> values(
+      new NullableVector<int64_t>());
+  for (uint32_t i = 0; i < table.row_count(); ++i)
+    values->Append(value);
+  return table.ExtendWithColumn(
+      name, std::move(values),
+      TypedColumn<int64_t>::default_flags() | TypedColumn<int64_t>::kHidden);
+}
+
+}  // namespace
+
+OverlappingGenerator::OverlappingGenerator(Source source,
+                                           TraceProcessorContext* context)
+    : source_(source), context_(context) {
+  start_ts_column_ = static_cast<uint32_t>(SourceSchema().columns.size());
+}
+
+OverlappingGenerator::~OverlappingGenerator() = default;
+
+Table::Schema OverlappingGenerator::SourceSchema() {
+  switch (source_) {
+    case Source::kSlice:
+      return tables::SliceTable::Schema();
+    case Source::kSchedSlice:
+      return tables::SchedSliceTable::Schema();
+    case Source::kThreadState:
+      return tables::ThreadStateTable::Schema();
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+const Table& OverlappingGenerator::SourceTable() {
+  switch (source_) {
+    case Source::kSlice:
+      return context_->storage->slice_table();
+    case Source::kSchedSlice:
+      return context_->storage->sched_slice_table();
+    case Source::kThreadState:
+      return context_->storage->thread_state_table();
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+Table::Schema OverlappingGenerator::CreateSchema() {
+  Table::Schema schema = SourceSchema();
+  schema.columns.push_back(Table::Schema::Column{
+      "start_ts", SqlValue::Type::kLong, /* is_id = */ false,
+      /* is_sorted = */ false, /* is_hidden = */ true});
+  schema.columns.push_back(Table::Schema::Column{
+      "end_ts", SqlValue::Type::kLong, /* is_id = */ false,
+      /* is_sorted = */ false, /* is_hidden = */ true});
+  return schema;
+}
+
+std::string OverlappingGenerator::TableName() {
+  switch (source_) {
+    case Source::kSlice:
+      return "overlapping_slice";
+    case Source::kSchedSlice:
+      return "overlapping_sched";
+    case Source::kThreadState:
+      return "overlapping_thread_state";
+  }
+  return "overlapping_unknown";
+}
+
+uint32_t OverlappingGenerator::EstimateRowCount() {
+  // Ranges are usually small compared to the whole trace; keep the estimate
+  // low so SQLite prefers this over scanning the source table.
+  return 1;
+}
+
+util::Status OverlappingGenerator::ValidateConstraints(
+    const QueryConstraints& qc) {
+  const auto& cs = qc.constraints();
+  auto has_eq = [&cs](uint32_t column) {
+    return std::any_of(
+        cs.begin(), cs.end(), [column](const QueryConstraints::Constraint& c) {
+          return c.column == static_cast<int>(column) &&
+                 c.op == SQLITE_INDEX_CONSTRAINT_EQ;
+        });
+  };
+  return has_eq(start_ts_column_) && has_eq(start_ts_column_ + 1)
+             ? util::OkStatus()
+             : util::ErrStatus("Failed to find required constraints");
+}
+
+std::unique_ptr<Table> OverlappingGenerator::ComputeTable(
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>&) {
+  auto find_value = [&cs](uint32_t column) -> const SqlValue* {
+    auto it = std::find_if(cs.begin(), cs.end(), [column](const Constraint& c) {
+      return c.col_idx == column && c.op == FilterOp::kEq;
+    });
+    return it == cs.end() ? nullptr : &it->value;
+  };
+  const SqlValue* start = find_value(start_ts_column_);
+  const SqlValue* end = find_value(start_ts_column_ + 1);
+  PERFETTO_DCHECK(start && end);
+  if (!start || !end || start->type != SqlValue::Type::kLong ||
+      end->type != SqlValue::Type::kLong) {
+    return nullptr;
+  }
+
+  const Table& table = SourceTable();
+  if (!index_ || index_->size() != table.row_count())
+    index_ = BuildIndex(table);
+
+  std::vector<uint32_t> rows;
+  index_->FindOverlapping(start->long_value, end->long_value, &rows);
+  Table overlapping = table.Apply(RowMap(std::move(rows)));
+  overlapping = ExtendWithConstant(overlapping, "start_ts", start->long_value);
+  overlapping = ExtendWithConstant(overlapping, "end_ts", end->long_value);
+  return std::unique_ptr<Table>(new Table(std::move(overlapping)));
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
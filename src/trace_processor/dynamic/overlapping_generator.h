@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DYNAMIC_OVERLAPPING_GENERATOR_H_
+#define SRC_TRACE_PROCESSOR_DYNAMIC_OVERLAPPING_GENERATOR_H_
+
+#include "src/trace_processor/sqlite/db_sqlite_table.h"
+
+#include "src/trace_processor/containers/interval_index.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Implements the following dynamic tables:
+// * overlapping_slice
+// * overlapping_sched
+// * overlapping_thread_state
+//
+// Each takes a (start_ts, end_ts) range and returns the rows of the source
+// table whose [ts, ts + dur) interval overlaps it, using an IntervalIndex
+// which is built on the first query and rebuilt when rows are added.
+//
+// See docs/analysis/trace-processor for usage.
+class OverlappingGenerator : public DbSqliteTable::DynamicTableGenerator {
+ public:
+  enum class Source {
+    kSlice = 1,
+    kSchedSlice = 2,
+    kThreadState = 3,
+  };
+
+  OverlappingGenerator(Source source, TraceProcessorContext* context);
+  ~OverlappingGenerator() override;
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  util::Status ValidateConstraints(const QueryConstraints&) override;
+  std::unique_ptr<Table> ComputeTable(const std::vector<Constraint>& cs,
+                                      const std::vector<Order>& ob) override;
+
+  // Drops the index, e.g. because rows of the source table have been updated
+  // in place. It is rebuilt by the next query.
+  void ClearIndex() { index_.reset(); }
+
+ private:
+  Table::Schema SourceSchema();
+  const Table& SourceTable();
+
+  Source source_;
+  TraceProcessorContext* context_ = nullptr;
+
+  // Index of the start_ts hidden column; end_ts follows it.
+  uint32_t start_ts_column_ = 0;
+
+  std::unique_ptr<IntervalIndex> index_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DYNAMIC_OVERLAPPING_GENERATOR_H_
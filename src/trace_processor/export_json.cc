@@ -18,7 +18,6 @@
 #include "src/trace_processor/export_json.h"
 
 #include <stdio.h>
-#include <sstream>
 
 #include <algorithm>
 #include <cinttypes>
@@ -27,6 +26,7 @@
 #include <deque>
 #include <limits>
 #include <memory>
+#include <string>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/string_splitter.h"
@@ -39,7 +39,7 @@
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 #include <json/reader.h>
-#include <json/writer.h>
+#include <json/value.h>
 #endif
 
 namespace perfetto {
@@ -92,6 +92,215 @@ const char* GetNonNullString(const TraceStorage* storage,
              : storage->GetString(*id).c_str();
 }
 
+// The output is built in a buffer which is written to the OutputWriter once it
+// reaches (roughly) this size.
+constexpr size_t kOutputBufferFlushSize = 1024 * 1024;
+
+// The functions below append the JSON serialization of values to |out|. They
+// write the same JSON as a Json::StreamWriter with an empty "indentation" but
+// without going through a std::ostream or any temporary string, which makes
+// them several times faster.
+
+void AppendJsonInt(int64_t value, std::string* out) {
+  char buffer[24];
+  char* end = buffer + sizeof(buffer);
+  char* p = end;
+  // Negate as an unsigned integer to handle the min int64_t value.
+  uint64_t abs = value < 0 ? 0 - static_cast<uint64_t>(value)
+                           : static_cast<uint64_t>(value);
+  do {
+    *--p = static_cast<char>('0' + abs % 10);
+    abs /= 10;
+  } while (abs);
+  if (value < 0)
+    *--p = '-';
+  out->append(p, static_cast<size_t>(end - p));
+}
+
+void AppendJsonUInt(uint64_t value, std::string* out) {
+  char buffer[24];
+  char* end = buffer + sizeof(buffer);
+  char* p = end;
+  do {
+    *--p = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  out->append(p, static_cast<size_t>(end - p));
+}
+
+void AppendJsonDouble(double value, std::string* out) {
+  if (std::isnan(value)) {
+    out->append("null");
+    return;
+  }
+  if (std::isinf(value)) {
+    out->append(value > 0 ? "1e+9999" : "-1e+9999");
+    return;
+  }
+  char buffer[32];
+  int len = snprintf(buffer, sizeof(buffer), "%.17g", value);
+  PERFETTO_DCHECK(len > 0 && static_cast<size_t>(len) < sizeof(buffer));
+  // Some locales use a comma as the decimal separator.
+  std::replace(buffer, buffer + len, ',', '.');
+  out->append(buffer, static_cast<size_t>(len));
+  // Make sure that the number is still parsed as a double.
+  if (!memchr(buffer, '.', static_cast<size_t>(len)) &&
+      !memchr(buffer, 'e', static_cast<size_t>(len))) {
+    out->append(".0");
+  }
+}
+
+// Decodes the UTF-8 sequence starting at |*s| and moves |*s| to its last byte.
+// Invalid sequences are decoded as U+FFFD (the replacement character).
+uint32_t DecodeUtf8CodePoint(const char** s, const char* end) {
+  constexpr uint32_t kReplacementCharacter = 0xFFFD;
+  const auto* p = reinterpret_cast<const uint8_t*>(*s);
+  uint32_t first = p[0];
+  if (first < 0x80)
+    return first;
+  size_t size;
+  uint32_t min;
+  uint32_t code_point;
+  if (first < 0xE0) {
+    size = 2;
+    min = 0x80;
+    code_point = first & 0x1F;
+  } else if (first < 0xF0) {
+    size = 3;
+    min = 0x800;
+    code_point = first & 0x0F;
+  } else if (first < 0xF8) {
+    size = 4;
+    min = 0x10000;
+    code_point = first & 0x07;
+  } else {
+    return kReplacementCharacter;
+  }
+  if (static_cast<size_t>(end - *s) < size)
+    return kReplacementCharacter;
+  for (size_t i = 1; i < size; ++i)
+    code_point = (code_point << 6) | (p[i] & 0x3F);
+  *s += size - 1;
+  // Overlong encodings and surrogates are invalid.
+  if (code_point < min || (code_point >= 0xD800 && code_point <= 0xDFFF))
+    return kReplacementCharacter;
+  return code_point;
+}
+
+void AppendJsonUnicodeEscape(uint32_t code_unit, std::string* out) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  char escape[6] = {'\\',
+                    'u',
+                    kHexDigits[(code_unit >> 12) & 0xF],
+                    kHexDigits[(code_unit >> 8) & 0xF],
+                    kHexDigits[(code_unit >> 4) & 0xF],
+                    kHexDigits[code_unit & 0xF]};
+  out->append(escape, sizeof(escape));
+}
+
+// Appends |str| as a quoted JSON string. As with jsoncpp, all the non-ASCII
+// characters are escaped.
+void AppendJsonString(base::StringView str, std::string* out) {
+  out->push_back('"');
+  const char* run_start = str.begin();
+  for (const char* s = str.begin(); s < str.end(); ++s) {
+    auto c = static_cast<uint8_t>(*s);
+    if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+      continue;
+    out->append(run_start, static_cast<size_t>(s - run_start));
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\b':
+        out->append("\\b");
+        break;
+      case '\f':
+        out->append("\\f");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      default: {
+        uint32_t code_point = DecodeUtf8CodePoint(&s, str.end());
+        if (code_point < 0x10000) {
+          AppendJsonUnicodeEscape(code_point, out);
+        } else {
+          // Code points outside of the BMP are escaped as surrogate pairs.
+          code_point -= 0x10000;
+          AppendJsonUnicodeEscape(0xD800 + (code_point >> 10), out);
+          AppendJsonUnicodeEscape(0xDC00 + (code_point & 0x3FF), out);
+        }
+        break;
+      }
+    }
+    run_start = s + 1;
+  }
+  out->append(run_start, static_cast<size_t>(str.end() - run_start));
+  out->push_back('"');
+}
+
+void AppendJsonValue(const Json::Value& value, std::string* out) {
+  switch (value.type()) {
+    case Json::nullValue:
+      out->append("null");
+      return;
+    case Json::intValue:
+      AppendJsonInt(value.asInt64(), out);
+      return;
+    case Json::uintValue:
+      AppendJsonUInt(value.asUInt64(), out);
+      return;
+    case Json::realValue:
+      AppendJsonDouble(value.asDouble(), out);
+      return;
+    case Json::stringValue: {
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      value.getString(&begin, &end);
+      size_t size = static_cast<size_t>(end - begin);
+      AppendJsonString(base::StringView(begin, size), out);
+      return;
+    }
+    case Json::booleanValue:
+      out->append(value.asBool() ? "true" : "false");
+      return;
+    case Json::arrayValue:
+      out->push_back('[');
+      for (Json::ArrayIndex i = 0; i < value.size(); ++i) {
+        if (i > 0)
+          out->push_back(',');
+        AppendJsonValue(value[i], out);
+      }
+      out->push_back(']');
+      return;
+    case Json::objectValue:
+      out->push_back('{');
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        if (it != value.begin())
+          out->push_back(',');
+        const char* key_end = nullptr;
+        const char* key = it.memberName(&key_end);
+        size_t key_size = static_cast<size_t>(key_end - key);
+        AppendJsonString(base::StringView(key, key_size), out);
+        out->push_back(':');
+        AppendJsonValue(*it, out);
+      }
+      out->push_back('}');
+      return;
+  }
+  PERFETTO_FATAL("Not reached");  // For gcc.
+}
+
 class JsonExporter {
  public:
   JsonExporter(const TraceStorage* storage,
@@ -152,6 +361,32 @@ class JsonExporter {
   }
 
  private:
+  // The fields of a slice event. Slices are the bulk of most traces so, unlike
+  // the other events, they are serialized without building a Json::Value
+  // first. Fields which are not set are not written.
+  struct SliceEvent {
+    int64_t ts = 0;
+    const char* cat = "";
+    const char* name = "";
+    std::string ph;
+    int32_t pid = 0;
+    int32_t tid = 0;
+    base::Optional<int64_t> dur;
+    base::Optional<int64_t> tts;
+    base::Optional<int64_t> tdur;
+    base::Optional<int64_t> ticount;
+    base::Optional<int64_t> tidelta;
+    const char* s = nullptr;
+    std::string scope;
+    std::string id;
+    std::string id2_local;
+    bool use_async_tts = false;
+
+    // Not owned, points into the ArgsBuilder. The kLegacyEventArgsKey member
+    // is not exported. If null, the args are empty.
+    const Json::Value* args = nullptr;
+  };
+
   class TraceFormatWriter {
    public:
     TraceFormatWriter(OutputWriter* output,
@@ -163,9 +398,7 @@ class JsonExporter {
           metadata_filter_(metadata_filter),
           label_filter_(label_filter),
           first_event_(true) {
-      Json::StreamWriterBuilder b;
-      b.settings_["indentation"] = "";
-      writer_.reset(b.newStreamWriter());
+      buffer_.reserve(kOutputBufferFlushSize + kOutputBufferFlushSize / 4);
       WriteHeader();
     }
 
@@ -175,28 +408,32 @@ class JsonExporter {
       if (label_filter_ && !label_filter_("traceEvents"))
         return;
 
-      DoWriteEvent(event);
+      BeginEvent();
+      SerializeEvent(event, &buffer_);
+      EndEvent();
     }
 
-    void AddAsyncBeginEvent(const Json::Value& event) {
+    void WriteCommonEvent(const SliceEvent& event) {
       if (label_filter_ && !label_filter_("traceEvents"))
         return;
 
-      async_begin_events_.push_back(event);
+      BeginEvent();
+      SerializeEvent(event, &buffer_);
+      EndEvent();
     }
 
-    void AddAsyncInstantEvent(const Json::Value& event) {
-      if (label_filter_ && !label_filter_("traceEvents"))
-        return;
-
-      async_instant_events_.push_back(event);
+    // The async events are serialized when they are added, and only written
+    // after all the other events were written.
+    void AddAsyncBeginEvent(const SliceEvent& event) {
+      AddAsyncEvent(event, &async_begin_events_);
     }
 
-    void AddAsyncEndEvent(const Json::Value& event) {
-      if (label_filter_ && !label_filter_("traceEvents"))
-        return;
+    void AddAsyncInstantEvent(const SliceEvent& event) {
+      AddAsyncEvent(event, &async_instant_events_);
+    }
 
-      async_end_events_.push_back(event);
+    void AddAsyncEndEvent(const SliceEvent& event) {
+      AddAsyncEvent(event, &async_end_events_);
     }
 
     void SortAndEmitAsyncEvents() {
@@ -212,8 +449,8 @@ class JsonExporter {
       // the same timestamp. To accomplish this, we perform a stable sort in
       // descending order and later iterate via reverse iterators.
       struct {
-        bool operator()(const Json::Value& a, const Json::Value& b) const {
-          return a["ts"].asInt64() > b["ts"].asInt64();
+        bool operator()(const AsyncEvent& a, const AsyncEvent& b) const {
+          return a.ts > b.ts;
         }
       } CompareEvents;
       std::stable_sort(async_end_events_.begin(), async_end_events_.end(),
@@ -232,25 +469,24 @@ class JsonExporter {
       auto has_begin_event = begin_event_it != async_begin_events_.end();
 
       auto emit_next_instant = [&instant_event_it, &has_instant_event, this]() {
-        DoWriteEvent(*instant_event_it);
+        WriteAsyncEvent(*instant_event_it);
         instant_event_it++;
         has_instant_event = instant_event_it != async_instant_events_.end();
       };
       auto emit_next_end = [&end_event_it, &has_end_event, this]() {
-        DoWriteEvent(*end_event_it);
+        WriteAsyncEvent(*end_event_it);
         end_event_it++;
         has_end_event = end_event_it != async_end_events_.rend();
       };
       auto emit_next_begin = [&begin_event_it, &has_begin_event, this]() {
-        DoWriteEvent(*begin_event_it);
+        WriteAsyncEvent(*begin_event_it);
         begin_event_it++;
         has_begin_event = begin_event_it != async_begin_events_.end();
       };
 
       auto emit_next_instant_or_end = [&instant_event_it, &end_event_it,
                                        &emit_next_instant, &emit_next_end]() {
-        if ((*instant_event_it)["ts"].asInt64() <=
-            (*end_event_it)["ts"].asInt64()) {
+        if (instant_event_it->ts <= end_event_it->ts) {
           emit_next_instant();
         } else {
           emit_next_end();
@@ -259,8 +495,7 @@ class JsonExporter {
       auto emit_next_instant_or_begin = [&instant_event_it, &begin_event_it,
                                          &emit_next_instant,
                                          &emit_next_begin]() {
-        if ((*instant_event_it)["ts"].asInt64() <=
-            (*begin_event_it)["ts"].asInt64()) {
+        if (instant_event_it->ts <= begin_event_it->ts) {
           emit_next_instant();
         } else {
           emit_next_begin();
@@ -268,8 +503,7 @@ class JsonExporter {
       };
       auto emit_next_end_or_begin = [&end_event_it, &begin_event_it,
                                      &emit_next_end, &emit_next_begin]() {
-        if ((*end_event_it)["ts"].asInt64() <=
-            (*begin_event_it)["ts"].asInt64()) {
+        if (end_event_it->ts <= begin_event_it->ts) {
           emit_next_end();
         } else {
           emit_next_begin();
@@ -278,8 +512,7 @@ class JsonExporter {
 
       // While we still have events in all iterators, consider each.
       while (has_instant_event && has_end_event && has_begin_event) {
-        if ((*instant_event_it)["ts"].asInt64() <=
-            (*end_event_it)["ts"].asInt64()) {
+        if (instant_event_it->ts <= end_event_it->ts) {
           emit_next_instant_or_begin();
         } else {
           emit_next_end_or_begin();
@@ -325,25 +558,19 @@ class JsonExporter {
       if (label_filter_ && !label_filter_("traceEvents"))
         return;
 
-      std::ostringstream ss;
-      if (!first_event_)
-        ss << ",\n";
-
-      Json::Value value;
-      value["ph"] = "M";
-      value["cat"] = "__metadata";
-      value["ts"] = 0;
-      value["name"] = metadata_type;
-      value["pid"] = Json::Int(pid);
-      value["tid"] = Json::Int(tid);
-
-      Json::Value args;
-      args[metadata_arg_name] = metadata_arg_value;
-      value["args"] = args;
-
-      writer_->write(value, &ss);
-      output_->AppendString(ss.str());
-      first_event_ = false;
+      BeginEvent();
+      buffer_.append("{\"args\":{");
+      AppendJsonString(metadata_arg_name, &buffer_);
+      buffer_.push_back(':');
+      AppendJsonString(metadata_arg_value, &buffer_);
+      buffer_.append("},\"cat\":\"__metadata\",\"name\":");
+      AppendJsonString(metadata_type, &buffer_);
+      buffer_.append(",\"ph\":\"M\",\"pid\":");
+      AppendJsonInt(static_cast<int32_t>(pid), &buffer_);
+      buffer_.append(",\"tid\":");
+      AppendJsonInt(static_cast<int32_t>(tid), &buffer_);
+      buffer_.append(",\"ts\":0}");
+      EndEvent();
     }
 
     void MergeMetadata(const Json::Value& value) {
@@ -405,7 +632,7 @@ class JsonExporter {
    private:
     void WriteHeader() {
       if (!label_filter_)
-        output_->AppendString("{\"traceEvents\":[\n");
+        buffer_.append("{\"traceEvents\":[\n");
     }
 
     void WriteFooter() {
@@ -440,55 +667,199 @@ class JsonExporter {
         }
       }
 
-      std::ostringstream ss;
       if (!label_filter_)
-        ss << "]";
+        buffer_.append("]");
 
       if ((!label_filter_ || label_filter_("systemTraceEvents")) &&
           !system_trace_data_.empty()) {
-        ss << ",\"systemTraceEvents\":\n";
-        writer_->write(Json::Value(system_trace_data_), &ss);
+        buffer_.append(",\"systemTraceEvents\":\n");
+        AppendJsonString(base::StringView(system_trace_data_), &buffer_);
       }
 
       if ((!label_filter_ || label_filter_("metadata")) && !metadata_.empty()) {
-        ss << ",\"metadata\":\n";
-        writer_->write(metadata_, &ss);
+        buffer_.append(",\"metadata\":\n");
+        AppendJsonValue(metadata_, &buffer_);
       }
 
       if (!label_filter_)
-        ss << "}";
+        buffer_.append("}");
 
-      output_->AppendString(ss.str());
+      Flush();
     }
 
-    void DoWriteEvent(const Json::Value& event) {
-      std::ostringstream ss;
+    void BeginEvent() {
       if (!first_event_)
-        ss << ",\n";
+        buffer_.append(",\n");
+      first_event_ = false;
+    }
+
+    void EndEvent() {
+      if (buffer_.size() >= kOutputBufferFlushSize)
+        Flush();
+    }
+
+    void Flush() {
+      if (buffer_.empty())
+        return;
+      output_->AppendString(buffer_);
+      buffer_.clear();
+    }
 
+    struct AsyncEvent {
+      int64_t ts;
+      std::string json;
+    };
+
+    void AddAsyncEvent(const SliceEvent& event,
+                       std::vector<AsyncEvent>* events) {
+      if (label_filter_ && !label_filter_("traceEvents"))
+        return;
+
+      events->emplace_back();
+      events->back().ts = event.ts;
+      SerializeEvent(event, &events->back().json);
+    }
+
+    void WriteAsyncEvent(const AsyncEvent& event) {
+      BeginEvent();
+      buffer_.append(event.json);
+      EndEvent();
+    }
+
+    // Appends |args| to |out|, replacing them (or the members rejected by
+    // |argument_name_filter|) with kStrippedArgument as requested.
+    void AppendArgs(const Json::Value& args,
+                    bool strip_args,
+                    const ArgumentNameFilterPredicate& argument_name_filter,
+                    bool skip_legacy_event,
+                    std::string* out) {
+      if (strip_args) {
+        AppendJsonString(kStrippedArgument, out);
+        return;
+      }
+      if (!args.isObject()) {
+        AppendJsonValue(args, out);
+        return;
+      }
+      out->push_back('{');
+      bool first = true;
+      for (auto it = args.begin(); it != args.end(); ++it) {
+        const char* key_end = nullptr;
+        const char* key = it.memberName(&key_end);
+        base::StringView key_view(key, static_cast<size_t>(key_end - key));
+        if (skip_legacy_event && key_view == kLegacyEventArgsKey)
+          continue;
+        if (!first)
+          out->push_back(',');
+        first = false;
+        AppendJsonString(key_view, out);
+        out->push_back(':');
+        if (argument_name_filter &&
+            !argument_name_filter(key_view.ToStdString().c_str())) {
+          AppendJsonString(kStrippedArgument, out);
+        } else {
+          AppendJsonValue(*it, out);
+        }
+      }
+      out->push_back('}');
+    }
+
+    void SerializeEvent(const Json::Value& event, std::string* out) {
       ArgumentNameFilterPredicate argument_name_filter;
       bool strip_args =
           argument_filter_ &&
           !argument_filter_(event["cat"].asCString(), event["name"].asCString(),
                             &argument_name_filter);
-      if ((strip_args || argument_name_filter) && event.isMember("args")) {
-        Json::Value event_copy = event;
-        if (strip_args) {
-          event_copy["args"] = kStrippedArgument;
+      if ((!strip_args && !argument_name_filter) || !event.isMember("args")) {
+        AppendJsonValue(event, out);
+        return;
+      }
+
+      // Same as AppendJsonValue() but with the args filtered.
+      out->push_back('{');
+      for (auto it = event.begin(); it != event.end(); ++it) {
+        if (it != event.begin())
+          out->push_back(',');
+        const char* key_end = nullptr;
+        const char* key = it.memberName(&key_end);
+        base::StringView key_view(key, static_cast<size_t>(key_end - key));
+        AppendJsonString(key_view, out);
+        out->push_back(':');
+        if (key_view == "args") {
+          AppendArgs(*it, strip_args, argument_name_filter,
+                     /*skip_legacy_event=*/false, out);
         } else {
-          auto& args = event_copy["args"];
-          for (const auto& member : event["args"].getMemberNames()) {
-            if (!argument_name_filter(member.c_str()))
-              args[member] = kStrippedArgument;
-          }
+          AppendJsonValue(*it, out);
         }
-        writer_->write(event_copy, &ss);
+      }
+      out->push_back('}');
+    }
+
+    // Writes the fields of |event| in the same (alphabetical) order as they
+    // would be written from a Json::Value.
+    void SerializeEvent(const SliceEvent& event, std::string* out) {
+      ArgumentNameFilterPredicate argument_name_filter;
+      bool strip_args =
+          argument_filter_ &&
+          !argument_filter_(event.cat, event.name, &argument_name_filter);
+
+      out->append("{\"args\":");
+      if (event.args) {
+        AppendArgs(*event.args, strip_args, argument_name_filter,
+                   /*skip_legacy_event=*/true, out);
+      } else if (strip_args) {
+        AppendJsonString(kStrippedArgument, out);
       } else {
-        writer_->write(event, &ss);
+        out->append("{}");
       }
-      first_event_ = false;
+      out->append(",\"cat\":");
+      AppendJsonString(event.cat, out);
+      AppendOptionalInt(",\"dur\":", event.dur, out);
+      AppendOptionalString(",\"id\":", event.id, out);
+      if (!event.id2_local.empty()) {
+        out->append(",\"id2\":{\"local\":");
+        AppendJsonString(base::StringView(event.id2_local), out);
+        out->push_back('}');
+      }
+      out->append(",\"name\":");
+      AppendJsonString(event.name, out);
+      AppendOptionalString(",\"ph\":", event.ph, out);
+      out->append(",\"pid\":");
+      AppendJsonInt(event.pid, out);
+      if (event.s) {
+        out->append(",\"s\":");
+        AppendJsonString(event.s, out);
+      }
+      AppendOptionalString(",\"scope\":", event.scope, out);
+      AppendOptionalInt(",\"tdur\":", event.tdur, out);
+      AppendOptionalInt(",\"ticount\":", event.ticount, out);
+      out->append(",\"tid\":");
+      AppendJsonInt(event.tid, out);
+      AppendOptionalInt(",\"tidelta\":", event.tidelta, out);
+      out->append(",\"ts\":");
+      AppendJsonInt(event.ts, out);
+      AppendOptionalInt(",\"tts\":", event.tts, out);
+      if (event.use_async_tts)
+        out->append(",\"use_async_tts\":1");
+      out->push_back('}');
+    }
 
-      output_->AppendString(ss.str());
+    static void AppendOptionalInt(const char* prefix,
+                                  base::Optional<int64_t> value,
+                                  std::string* out) {
+      if (!value)
+        return;
+      out->append(prefix);
+      AppendJsonInt(*value, out);
+    }
+
+    static void AppendOptionalString(const char* prefix,
+                                     const std::string& value,
+                                     std::string* out) {
+      if (value.empty())
+        return;
+      out->append(prefix);
+      AppendJsonString(base::StringView(value), out);
     }
 
     OutputWriter* output_;
@@ -496,14 +867,15 @@ class JsonExporter {
     MetadataFilterPredicate metadata_filter_;
     LabelFilterPredicate label_filter_;
 
-    std::unique_ptr<Json::StreamWriter> writer_;
+    // The serialized events which were not written to |output_| yet.
+    std::string buffer_;
     bool first_event_;
     Json::Value metadata_;
     std::string system_trace_data_;
     std::string user_trace_data_;
-    std::vector<Json::Value> async_begin_events_;
-    std::vector<Json::Value> async_instant_events_;
-    std::vector<Json::Value> async_end_events_;
+    std::vector<AsyncEvent> async_begin_events_;
+    std::vector<AsyncEvent> async_instant_events_;
+    std::vector<AsyncEvent> async_end_events_;
   };
 
   class ArgsBuilder {
@@ -784,20 +1156,19 @@ class JsonExporter {
       if (cat.c_str() == nullptr || cat == "binder")
         continue;
 
-      Json::Value event;
-      event["ts"] = Json::Int64(slices.ts()[i] / 1000);
-      event["cat"] = GetNonNullString(storage_, slices.category()[i]);
-      event["name"] = GetNonNullString(storage_, slices.name()[i]);
-      event["pid"] = 0;
-      event["tid"] = 0;
+      SliceEvent event;
+      event.ts = slices.ts()[i] / 1000;
+      event.cat = GetNonNullString(storage_, slices.category()[i]);
+      event.name = GetNonNullString(storage_, slices.name()[i]);
 
       base::Optional<UniqueTid> legacy_utid;
       std::string legacy_phase;
 
-      event["args"] =
-          args_builder_.GetArgs(slices.arg_set_id()[i]);  // Makes a copy.
-      if (event["args"].isMember(kLegacyEventArgsKey)) {
-        const auto& legacy_args = event["args"][kLegacyEventArgsKey];
+      // The legacy event args are skipped when the event is written.
+      const Json::Value& args = args_builder_.GetArgs(slices.arg_set_id()[i]);
+      event.args = &args;
+      if (args.isMember(kLegacyEventArgsKey)) {
+        const auto& legacy_args = args[kLegacyEventArgsKey];
 
         if (legacy_args.isMember(kLegacyEventPassthroughUtidKey)) {
           legacy_utid = legacy_args[kLegacyEventPassthroughUtidKey].asUInt();
@@ -805,8 +1176,6 @@ class JsonExporter {
         if (legacy_args.isMember(kLegacyEventPhaseKey)) {
           legacy_phase = legacy_args[kLegacyEventPhaseKey].asString();
         }
-
-        event["args"].removeMember(kLegacyEventArgsKey);
       }
 
       // To prevent duplicate export of slices, only export slices on descriptor
@@ -873,44 +1242,44 @@ class JsonExporter {
         // Synchronous (thread) slice or instant event.
         UniqueTid utid = thread_track.utid()[*opt_thread_track_row];
         auto pid_and_tid = UtidToPidAndTid(utid);
-        event["pid"] = Json::Int(pid_and_tid.first);
-        event["tid"] = Json::Int(pid_and_tid.second);
+        event.pid = static_cast<int32_t>(pid_and_tid.first);
+        event.tid = static_cast<int32_t>(pid_and_tid.second);
 
         if (duration_ns == 0) {
           if (legacy_phase.empty()) {
             // Use "I" instead of "i" phase for backwards-compat with old
             // consumers.
-            event["ph"] = "I";
+            event.ph = "I";
           } else {
-            event["ph"] = legacy_phase;
+            event.ph = legacy_phase;
           }
           if (thread_ts_ns && thread_ts_ns > 0) {
-            event["tts"] = Json::Int64(*thread_ts_ns / 1000);
+            event.tts = *thread_ts_ns / 1000;
           }
           if (thread_instruction_count && *thread_instruction_count > 0) {
-            event["ticount"] = Json::Int64(*thread_instruction_count);
+            event.ticount = *thread_instruction_count;
           }
-          event["s"] = "t";
+          event.s = "t";
         } else {
           if (duration_ns > 0) {
-            event["ph"] = "X";
-            event["dur"] = Json::Int64(duration_ns / 1000);
+            event.ph = "X";
+            event.dur = duration_ns / 1000;
           } else {
             // If the slice didn't finish, the duration may be negative. Only
             // write a begin event without end event in this case.
-            event["ph"] = "B";
+            event.ph = "B";
           }
           if (thread_ts_ns && *thread_ts_ns > 0) {
-            event["tts"] = Json::Int64(*thread_ts_ns / 1000);
+            event.tts = *thread_ts_ns / 1000;
             // Only write thread duration for completed events.
             if (duration_ns > 0 && thread_duration_ns)
-              event["tdur"] = Json::Int64(*thread_duration_ns / 1000);
+              event.tdur = *thread_duration_ns / 1000;
           }
           if (thread_instruction_count && *thread_instruction_count > 0) {
-            event["ticount"] = Json::Int64(*thread_instruction_count);
+            event.ticount = *thread_instruction_count;
             // Only write thread instruction delta for completed events.
             if (duration_ns > 0 && thread_instruction_delta)
-              event["tidelta"] = Json::Int64(*thread_instruction_delta);
+              event.tidelta = *thread_instruction_delta;
           }
         }
         writer_.WriteCommonEvent(event);
@@ -924,10 +1293,10 @@ class JsonExporter {
           PERFETTO_DCHECK(track_args);
           uint32_t upid = process_track.upid()[*opt_process_row];
           uint32_t exported_pid = UpidToPid(upid);
-          event["pid"] = Json::Int(exported_pid);
-          event["tid"] =
-              Json::Int(legacy_utid ? UtidToPidAndTid(*legacy_utid).second
-                                    : exported_pid);
+          event.pid = static_cast<int32_t>(exported_pid);
+          event.tid = static_cast<int32_t>(
+              legacy_utid ? UtidToPidAndTid(*legacy_utid).second
+                          : exported_pid);
 
           // Preserve original event IDs for legacy tracks. This is so that e.g.
           // memory dump IDs show up correctly in the JSON trace.
@@ -938,85 +1307,84 @@ class JsonExporter {
               static_cast<uint64_t>((*track_args)["source_id"].asInt64());
           std::string source_scope = (*track_args)["source_scope"].asString();
           if (!source_scope.empty())
-            event["scope"] = source_scope;
+            event.scope = source_scope;
           bool source_id_is_process_scoped =
               (*track_args)["source_id_is_process_scoped"].asBool();
           if (source_id_is_process_scoped) {
-            event["id2"]["local"] = base::Uint64ToHexString(source_id);
+            event.id2_local = base::Uint64ToHexString(source_id);
           } else {
             // Some legacy importers don't understand "id2" fields, so we use
             // the "usually" global "id" field instead. This works as long as
             // the event phase is not in {'N', 'D', 'O', '(', ')'}, see
             // "LOCAL_ID_PHASES" in catapult.
-            event["id"] = base::Uint64ToHexString(source_id);
+            event.id = base::Uint64ToHexString(source_id);
           }
         } else {
           if (opt_thread_track_row) {
             UniqueTid utid = thread_track.utid()[*opt_thread_track_row];
             auto pid_and_tid = UtidToPidAndTid(utid);
-            event["pid"] = Json::Int(pid_and_tid.first);
-            event["tid"] = Json::Int(pid_and_tid.second);
-            event["id2"]["local"] = base::Uint64ToHexString(track_id.value);
+            event.pid = static_cast<int32_t>(pid_and_tid.first);
+            event.tid = static_cast<int32_t>(pid_and_tid.second);
+            event.id2_local = base::Uint64ToHexString(track_id.value);
           } else if (opt_process_row) {
             uint32_t upid = process_track.upid()[*opt_process_row];
             uint32_t exported_pid = UpidToPid(upid);
-            event["pid"] = Json::Int(exported_pid);
-            event["tid"] =
-                Json::Int(legacy_utid ? UtidToPidAndTid(*legacy_utid).second
-                                      : exported_pid);
-            event["id2"]["local"] = base::Uint64ToHexString(track_id.value);
+            event.pid = static_cast<int32_t>(exported_pid);
+            event.tid = static_cast<int32_t>(
+                legacy_utid ? UtidToPidAndTid(*legacy_utid).second
+                            : exported_pid);
+            event.id2_local = base::Uint64ToHexString(track_id.value);
           } else {
             if (legacy_utid) {
               auto pid_and_tid = UtidToPidAndTid(*legacy_utid);
-              event["pid"] = Json::Int(pid_and_tid.first);
-              event["tid"] = Json::Int(pid_and_tid.second);
+              event.pid = static_cast<int32_t>(pid_and_tid.first);
+              event.tid = static_cast<int32_t>(pid_and_tid.second);
             }
 
             // Some legacy importers don't understand "id2" fields, so we use
             // the "usually" global "id" field instead. This works as long as
             // the event phase is not in {'N', 'D', 'O', '(', ')'}, see
             // "LOCAL_ID_PHASES" in catapult.
-            event["id"] = base::Uint64ToHexString(track_id.value);
+            event.id = base::Uint64ToHexString(track_id.value);
           }
         }
 
         if (thread_ts_ns && *thread_ts_ns > 0) {
-          event["tts"] = Json::Int64(*thread_ts_ns / 1000);
-          event["use_async_tts"] = Json::Int(1);
+          event.tts = *thread_ts_ns / 1000;
+          event.use_async_tts = true;
         }
         if (thread_instruction_count && *thread_instruction_count > 0) {
-          event["ticount"] = Json::Int64(*thread_instruction_count);
-          event["use_async_tts"] = Json::Int(1);
+          event.ticount = *thread_instruction_count;
+          event.use_async_tts = true;
         }
 
         if (duration_ns == 0) {
           if (legacy_phase.empty()) {
             // Instant async event.
-            event["ph"] = "n";
+            event.ph = "n";
             writer_.AddAsyncInstantEvent(event);
           } else {
             // Async step events.
-            event["ph"] = legacy_phase;
+            event.ph = legacy_phase;
             writer_.AddAsyncBeginEvent(event);
           }
         } else {  // Async start and end.
-          event["ph"] = legacy_phase.empty() ? "b" : legacy_phase;
+          event.ph = legacy_phase.empty() ? "b" : legacy_phase;
           writer_.AddAsyncBeginEvent(event);
           // If the slice didn't finish, the duration may be negative. Don't
           // write the end event in this case.
           if (duration_ns > 0) {
-            event["ph"] = legacy_phase.empty() ? "e" : "F";
-            event["ts"] = Json::Int64((slices.ts()[i] + duration_ns) / 1000);
+            event.ph = legacy_phase.empty() ? "e" : "F";
+            event.ts = (slices.ts()[i] + duration_ns) / 1000;
             if (thread_ts_ns && thread_duration_ns && *thread_ts_ns > 0) {
-              event["tts"] =
-                  Json::Int64((*thread_ts_ns + *thread_duration_ns) / 1000);
+              event.tts = (*thread_ts_ns + *thread_duration_ns) / 1000;
             }
             if (thread_instruction_count && thread_instruction_delta &&
                 *thread_instruction_count > 0) {
-              event["ticount"] = Json::Int64(
-                  (*thread_instruction_count + *thread_instruction_delta));
+              event.ticount =
+                  *thread_instruction_count + *thread_instruction_delta;
             }
-            event["args"].clear();
+            event.args = nullptr;
             writer_.AddAsyncEndEvent(event);
           }
         }
@@ -1032,22 +1400,22 @@ class JsonExporter {
           if (legacy_phase.empty()) {
             // Use "I" instead of "i" phase for backwards-compat with old
             // consumers.
-            event["ph"] = "I";
+            event.ph = "I";
           } else {
-            event["ph"] = legacy_phase;
+            event.ph = legacy_phase;
           }
 
           auto opt_process_row = process_track.id().IndexOf(TrackId{track_id});
           if (opt_process_row.has_value()) {
             uint32_t upid = process_track.upid()[*opt_process_row];
             uint32_t exported_pid = UpidToPid(upid);
-            event["pid"] = Json::Int(exported_pid);
-            event["tid"] =
-                Json::Int(legacy_utid ? UtidToPidAndTid(*legacy_utid).second
-                                      : exported_pid);
-            event["s"] = "p";
+            event.pid = static_cast<int32_t>(exported_pid);
+            event.tid = static_cast<int32_t>(
+                legacy_utid ? UtidToPidAndTid(*legacy_utid).second
+                            : exported_pid);
+            event.s = "p";
           } else {
-            event["s"] = "g";
+            event.s = "g";
           }
           writer_.WriteCommonEvent(event);
         }
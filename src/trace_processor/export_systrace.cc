@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/trace_processor/export_systrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
+#include "perfetto/ext/base/string_writer.h"
+#include "src/trace_processor/importers/common/system_info_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_module.h"
+#include "src/trace_processor/sqlite/sqlite_raw_table.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/trace_processor_impl.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <thread>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+namespace systrace {
+
+namespace {
+
+// The number of rows serialized as a unit by a thread.
+constexpr uint32_t kRowsPerChunk = 16 * 1024;
+
+// The number of chunks serialized per thread before the serialized chunks are
+// written out in order. Bounds the memory used for the text which hasn't been
+// written yet.
+constexpr uint32_t kChunksPerThreadPerBatch = 4;
+
+void AppendEscapedLine(base::StringView line, std::string* out) {
+  for (char c : line) {
+    switch (c) {
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\f':
+        out->append("\\f");
+        break;
+      case '\b':
+        out->append("\\b");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '"':
+        out->append("\\\"");
+        break;
+      default:
+        out->push_back(c);
+        break;
+    }
+  }
+  out->append("\\n");
+}
+
+// Appends the rows of the raw table from |first_row| which have a systrace
+// representation to |rows|. |exported_by_name| caches whether the events of
+// each name are exported.
+void AppendExportedRows(const TraceStorage& storage,
+                        uint32_t first_row,
+                        std::unordered_map<uint32_t, bool>* exported_by_name,
+                        std::vector<uint32_t>* rows) {
+  const auto& raw = storage.raw_table();
+  rows->reserve(rows->size() + raw.row_count() - first_row);
+  for (uint32_t row = first_row; row < raw.row_count(); ++row) {
+    StringId name_id = raw.name()[row];
+    auto it = exported_by_name->find(name_id.raw_id());
+    if (it == exported_by_name->end()) {
+      NullTermStringView name = storage.GetString(name_id);
+      bool exported = !name.StartsWith("chrome_event.") &&
+                      !name.StartsWith("track_event.");
+      it = exported_by_name->emplace(name_id.raw_id(), exported).first;
+    }
+    if (it->second)
+      rows->push_back(row);
+  }
+}
+
+// The args of the raw table might not have been decoded yet (see
+// Config::lazy_ftrace_raw_args) and the system info tracker is created on
+// first use: do both before the rows are serialized concurrently.
+void PrepareForSerialization(TraceProcessorContext* context) {
+  if (context->ftrace_module)
+    context->ftrace_module->MaterializeRawArgs();
+  SystemInfoTracker::GetOrCreate(context);
+}
+
+// Creates the serializers of the threads used to export events with
+// |options|. SystraceSerializer caches the layout of the args of each event,
+// so each thread uses its own.
+void CreateSerializers(
+    TraceProcessorContext* context,
+    const ExportOptions& options,
+    std::vector<std::unique_ptr<SystraceSerializer>>* serializers) {
+  uint32_t num_threads = 1;
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  num_threads = std::max(options.worker_threads, 1u);
+#else
+  base::ignore_result(options);
+#endif
+  for (uint32_t i = 0; i < num_threads; ++i)
+    serializers->emplace_back(new SystraceSerializer(context));
+}
+
+// Serializes rows[begin, end) and writes them out in order, using up to one
+// thread per serializer.
+util::Status SerializeRows(
+    const std::vector<uint32_t>& rows,
+    uint32_t begin,
+    uint32_t end,
+    bool escape_for_json,
+    const std::vector<std::unique_ptr<SystraceSerializer>>& serializers,
+    const WriteCallback& write) {
+  uint32_t chunk_count = (end - begin + kRowsPerChunk - 1) / kRowsPerChunk;
+  uint32_t num_threads = 1;
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  if (chunk_count > 1) {
+    num_threads =
+        std::min(static_cast<uint32_t>(serializers.size()), chunk_count);
+  }
+#endif
+
+  const uint32_t batch_size = num_threads * kChunksPerThreadPerBatch;
+  std::vector<std::string> chunks(std::min(batch_size, chunk_count));
+  for (uint32_t batch_begin = 0; batch_begin < chunk_count;
+       batch_begin += batch_size) {
+    uint32_t batch_end = std::min(chunk_count, batch_begin + batch_size);
+
+    std::atomic<uint32_t> next_chunk{batch_begin};
+    auto serialize_chunks = [&chunks, &serializers, &rows, &next_chunk, begin,
+                             end, batch_begin, batch_end,
+                             escape_for_json](uint32_t thread) {
+      SystraceSerializer* serializer = serializers[thread].get();
+      char line[SystraceSerializer::kMaxLineSize];
+      for (;;) {
+        uint32_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= batch_end)
+          break;
+        uint32_t chunk_begin = begin + chunk * kRowsPerChunk;
+        uint32_t chunk_end = std::min(end, chunk_begin + kRowsPerChunk);
+        std::string& out = chunks[chunk - batch_begin];
+        out.clear();
+        for (uint32_t i = chunk_begin; i < chunk_end; ++i) {
+          base::StringWriter writer(line, sizeof(line));
+          serializer->SerializeTo(rows[i], &writer);
+          if (escape_for_json) {
+            AppendEscapedLine(writer.GetStringView(), &out);
+          } else {
+            base::StringView str = writer.GetStringView();
+            out.append(str.data(), str.size());
+            out.push_back('\n');
+          }
+        }
+      }
+    };
+
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+    // The calling thread also serializes chunks, so spawn one thread less.
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (uint32_t i = 1; i < num_threads; ++i)
+      threads.emplace_back(serialize_chunks, i);
+    serialize_chunks(0);
+    for (auto& thread : threads)
+      thread.join();
+#else
+    serialize_chunks(0);
+#endif
+
+    for (uint32_t chunk = batch_begin; chunk < batch_end; ++chunk) {
+      const std::string& out = chunks[chunk - batch_begin];
+      util::Status status = write(out.data(), out.size());
+      if (!status.ok())
+        return status;
+    }
+  }
+  return util::OkStatus();
+}
+
+}  // namespace
+
+util::Status ExportRawEvents(TraceProcessor* tp,
+                             const ExportOptions& options,
+                             const WriteCallback& write) {
+  TraceProcessorContext* context =
+      static_cast<TraceProcessorImpl*>(tp)->context();
+  PrepareForSerialization(context);
+
+  std::unordered_map<uint32_t, bool> exported_by_name;
+  std::vector<uint32_t> rows;
+  AppendExportedRows(*context->storage, 0, &exported_by_name, &rows);
+  uint32_t begin = 0;
+  uint32_t end = static_cast<uint32_t>(rows.size());
+  if (options.max_events > 0 && end > options.max_events) {
+    if (options.keep_end) {
+      begin = end - options.max_events;
+    } else {
+      end = options.max_events;
+    }
+  }
+
+  std::vector<std::unique_ptr<SystraceSerializer>> serializers;
+  CreateSerializers(context, options, &serializers);
+  return SerializeRows(rows, begin, end, options.escape_for_json, serializers,
+                       write);
+}
+
+RawEventsStreamer::RawEventsStreamer(TraceProcessor* tp,
+                                     const ExportOptions& options)
+    : tp_(tp), options_(options) {
+  PERFETTO_DCHECK(options.max_events == 0);
+  CreateSerializers(static_cast<TraceProcessorImpl*>(tp_)->context(),
+                    options_, &serializers_);
+}
+
+RawEventsStreamer::~RawEventsStreamer() = default;
+
+util::Status RawEventsStreamer::ExportNewEvents(const WriteCallback& write) {
+  TraceProcessorContext* context =
+      static_cast<TraceProcessorImpl*>(tp_)->context();
+  const auto& raw = context->storage->raw_table();
+  if (next_row_ == raw.row_count())
+    return util::OkStatus();
+  PrepareForSerialization(context);
+
+  std::vector<uint32_t> rows;
+  AppendExportedRows(*context->storage, next_row_, &exported_by_name_, &rows);
+  next_row_ = raw.row_count();
+  exported_events_ += rows.size();
+  return SerializeRows(rows, 0, static_cast<uint32_t>(rows.size()),
+                       options_.escape_for_json, serializers_, write);
+}
+
+}  // namespace systrace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -22,7 +22,9 @@
 #include "src/trace_processor/importers/ninja/ninja_log_parser.h"
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
 #include "src/trace_processor/importers/proto/proto_trace_reader.h"
+#include "src/trace_processor/timestamped_trace_piece.h"
 #include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/util/status_macros.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -47,6 +49,8 @@ TraceSorter::SortingMode ConvertSortingMode(SortingMode sorting_mode) {
       return TraceSorter::SortingMode::kDefault;
     case SortingMode::kForceFullSort:
       return TraceSorter::SortingMode::kFullSort;
+    case SortingMode::kForceWindowedSort:
+      return TraceSorter::SortingMode::kWindowed;
   }
   PERFETTO_FATAL("For GCC");
 }
@@ -64,6 +68,17 @@ ForwardingTraceParser::~ForwardingTraceParser() {}
 
 util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
                                           size_t size) {
+  RETURN_IF_ERROR(MaybeCreateReader(data.get(), size));
+  return reader_->Parse(std::move(data), size);
+}
+
+util::Status ForwardingTraceParser::ParseBlob(TraceBlobView blob) {
+  RETURN_IF_ERROR(MaybeCreateReader(blob.data(), blob.length()));
+  return reader_->ParseBlob(std::move(blob));
+}
+
+util::Status ForwardingTraceParser::MaybeCreateReader(const uint8_t* data,
+                                                      size_t size) {
   // If this is the first Parse() call, guess the trace type and create the
   // appropriate parser.
   if (!reader_) {
@@ -71,18 +86,24 @@ util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
     {
       auto scoped_trace = context_->storage->TraceExecutionTimeIntoStats(
           stats::guess_trace_type_duration_ns);
-      trace_type = GuessTraceType(data.get(), size);
+      trace_type = GuessTraceType(data, size);
     }
+    // When several traces are loaded in the same storage, the sorter is
+    // created upfront and shared by all of them.
+    const bool shared_sorter = !!context_->sorter;
     switch (trace_type) {
       case kJsonTraceType: {
         PERFETTO_DLOG("JSON trace detected");
-        if (context_->json_trace_tokenizer && context_->json_trace_parser) {
-          reader_ = std::move(context_->json_trace_tokenizer);
+        if (context_->json_trace_tokenizer_factory &&
+            (shared_sorter || context_->json_trace_parser)) {
+          reader_ = context_->json_trace_tokenizer_factory();
 
           // JSON traces have no guarantees about the order of events in them.
-          context_->sorter.reset(
-              new TraceSorter(context_, std::move(context_->json_trace_parser),
-                              TraceSorter::SortingMode::kFullSort));
+          if (!shared_sorter) {
+            context_->sorter.reset(new TraceSorter(
+                context_, std::move(context_->json_trace_parser),
+                TraceSorter::SortingMode::kFullSort));
+          }
         } else {
           return util::ErrStatus("JSON support is disabled");
         }
@@ -92,10 +113,12 @@ util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
         PERFETTO_DLOG("Proto trace detected");
         auto sorting_mode = ConvertSortingMode(context_->config.sorting_mode);
         reader_.reset(new ProtoTraceReader(context_));
-        context_->sorter.reset(new TraceSorter(
-            context_,
-            std::unique_ptr<TraceParser>(new ProtoTraceParser(context_)),
-            sorting_mode));
+        if (!shared_sorter) {
+          context_->sorter.reset(new TraceSorter(
+              context_,
+              std::unique_ptr<TraceParser>(new ProtoTraceParser(context_)),
+              sorting_mode));
+        }
         context_->process_tracker->SetPidZeroIgnoredForIdleProcess();
         break;
       }
@@ -106,14 +129,16 @@ util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
       }
       case kFuchsiaTraceType: {
         PERFETTO_DLOG("Fuchsia trace detected");
-        if (context_->fuchsia_trace_parser &&
-            context_->fuchsia_trace_tokenizer) {
-          reader_ = std::move(context_->fuchsia_trace_tokenizer);
+        if (context_->fuchsia_trace_tokenizer_factory &&
+            (shared_sorter || context_->fuchsia_trace_parser)) {
+          reader_ = context_->fuchsia_trace_tokenizer_factory();
 
           // Fuschia traces can have massively out of order events.
-          context_->sorter.reset(new TraceSorter(
-              context_, std::move(context_->fuchsia_trace_parser),
-              TraceSorter::SortingMode::kFullSort));
+          if (!shared_sorter) {
+            context_->sorter.reset(new TraceSorter(
+                context_, std::move(context_->fuchsia_trace_parser),
+                TraceSorter::SortingMode::kFullSort));
+          }
         } else {
           return util::ErrStatus("Fuchsia support is disabled");
         }
@@ -122,8 +147,8 @@ util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
       case kSystraceTraceType:
         PERFETTO_DLOG("Systrace trace detected");
         context_->process_tracker->SetPidZeroIgnoredForIdleProcess();
-        if (context_->systrace_trace_parser) {
-          reader_ = std::move(context_->systrace_trace_parser);
+        if (context_->systrace_trace_parser_factory) {
+          reader_ = context_->systrace_trace_parser_factory();
           break;
         } else {
           return util::ErrStatus("Systrace support is disabled");
@@ -135,8 +160,8 @@ util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
         } else {
           PERFETTO_DLOG("ctrace trace detected");
         }
-        if (context_->gzip_trace_parser) {
-          reader_ = std::move(context_->gzip_trace_parser);
+        if (context_->gzip_trace_parser_factory) {
+          reader_ = context_->gzip_trace_parser_factory();
           break;
         } else {
           return util::ErrStatus(kNoZlibErr);
@@ -147,14 +172,49 @@ util::Status ForwardingTraceParser::Parse(std::unique_ptr<uint8_t[]> data,
         return util::ErrStatus("Unknown trace type provided (ERR:fmt)");
     }
   }
-
-  return reader_->Parse(std::move(data), size);
+  return util::OkStatus();
 }
 
 void ForwardingTraceParser::NotifyEndOfFile() {
   reader_->NotifyEndOfFile();
 }
 
+MultiFormatTraceParser::MultiFormatTraceParser(TraceProcessorContext* context)
+    : proto_parser_(new ProtoTraceParser(context)),
+      json_parser_(std::move(context->json_trace_parser)),
+      fuchsia_parser_(std::move(context->fuchsia_trace_parser)) {}
+
+MultiFormatTraceParser::~MultiFormatTraceParser() = default;
+
+void MultiFormatTraceParser::ParseTracePacket(int64_t ts,
+                                              TimestampedTracePiece ttp) {
+  // The readers only push the events of the formats whose parser exists.
+  switch (ttp.type) {
+    case TimestampedTracePiece::Type::kJsonValue:
+    case TimestampedTracePiece::Type::kSystraceLine:
+      json_parser_->ParseTracePacket(ts, std::move(ttp));
+      return;
+    case TimestampedTracePiece::Type::kFuchsiaRecord:
+      fuchsia_parser_->ParseTracePacket(ts, std::move(ttp));
+      return;
+    case TimestampedTracePiece::Type::kInvalid:
+    case TimestampedTracePiece::Type::kFtraceEvent:
+    case TimestampedTracePiece::Type::kTracePacket:
+    case TimestampedTracePiece::Type::kInlineSchedSwitch:
+    case TimestampedTracePiece::Type::kInlineSchedWaking:
+    case TimestampedTracePiece::Type::kTrackEvent:
+    case TimestampedTracePiece::Type::kPreparablePacket:
+      proto_parser_->ParseTracePacket(ts, std::move(ttp));
+      return;
+  }
+}
+
+void MultiFormatTraceParser::ParseFtracePacket(uint32_t cpu,
+                                               int64_t ts,
+                                               TimestampedTracePiece ttp) {
+  proto_parser_->ParseFtracePacket(cpu, ts, std::move(ttp));
+}
+
 TraceType GuessTraceType(const uint8_t* data, size_t size) {
   if (size == 0)
     return kUnknownTraceType;
@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_FORWARDING_TRACE_PARSER_H_
 
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
+#include "src/trace_processor/importers/common/trace_parser.h"
 
 #include "src/trace_processor/types/trace_processor_context.h"
 
@@ -37,6 +38,11 @@ enum TraceType {
 
 TraceType GuessTraceType(const uint8_t* data, size_t size);
 
+// Guesses the format of a trace from its first chunk and forwards the data to
+// the reader of that format. This creates the sorter (with the parser of the
+// format) as well, unless several traces are being loaded in the same
+// storage: in this case the sorter, which merges the events of all the traces,
+// is created upfront with a MultiFormatTraceParser.
 class ForwardingTraceParser : public ChunkedTraceReader {
  public:
   explicit ForwardingTraceParser(TraceProcessorContext*);
@@ -44,13 +50,37 @@ class ForwardingTraceParser : public ChunkedTraceReader {
 
   // ChunkedTraceReader implementation
   util::Status Parse(std::unique_ptr<uint8_t[]>, size_t) override;
+  util::Status ParseBlob(TraceBlobView) override;
   void NotifyEndOfFile() override;
 
  private:
+  // Guesses the trace type from the first chunk of data and creates the
+  // matching |reader_|. No-op after the first call.
+  util::Status MaybeCreateReader(const uint8_t* data, size_t size);
+
   TraceProcessorContext* const context_;
   std::unique_ptr<ChunkedTraceReader> reader_;
 };
 
+// Forwards the sorted events to the parser of their format, so that the
+// traces of different formats can share the same sorter.
+class MultiFormatTraceParser : public TraceParser {
+ public:
+  explicit MultiFormatTraceParser(TraceProcessorContext*);
+  ~MultiFormatTraceParser() override;
+
+  // TraceParser implementation.
+  void ParseTracePacket(int64_t timestamp, TimestampedTracePiece) override;
+  void ParseFtracePacket(uint32_t cpu,
+                         int64_t timestamp,
+                         TimestampedTracePiece) override;
+
+ private:
+  std::unique_ptr<TraceParser> proto_parser_;
+  std::unique_ptr<TraceParser> json_parser_;
+  std::unique_ptr<TraceParser> fuchsia_parser_;
+};
+
 }  // namespace trace_processor
 }  // namespace perfetto
 
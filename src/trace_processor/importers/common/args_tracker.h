@@ -92,6 +92,7 @@ class ArgsTracker {
 
   explicit ArgsTracker(TraceProcessorContext*);
   ArgsTracker(const ArgsTracker&) = default;
+  ArgsTracker(ArgsTracker&&) = default;
   virtual ~ArgsTracker();
 
   BoundInserter AddArgsTo(RawId id) {
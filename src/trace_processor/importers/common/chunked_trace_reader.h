@@ -19,11 +19,13 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <memory>
 
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/util/trace_blob_view.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -40,6 +42,17 @@ class ChunkedTraceReader {
   // The buffer size is guaranteed to be > 0.
   virtual util::Status Parse(std::unique_ptr<uint8_t[]>, size_t) = 0;
 
+  // Same as Parse() but for data which is already wrapped in a TraceBlobView,
+  // possibly referencing memory not owned by trace processor (e.g. a mapping
+  // of the trace file). Readers which can retain slices of |blob| instead of
+  // copying it should override this; the default implementation copies the
+  // data into a new heap buffer and calls Parse().
+  virtual util::Status ParseBlob(TraceBlobView blob) {
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[blob.length()]);
+    memcpy(buf.get(), blob.data(), blob.length());
+    return Parse(std::move(buf), blob.length());
+  }
+
   // Called after the last Parse() call.
   virtual void NotifyEndOfFile() = 0;
 };
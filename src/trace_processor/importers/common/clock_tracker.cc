@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cinttypes>
+#include <limits>
 #include <queue>
 
 #include "perfetto/base/logging.h"
@@ -56,7 +57,7 @@ uint32_t ClockTracker::AddSnapshot(const std::vector<ClockValue>& clocks) {
   // Add a new entry in each clock's snapshot vector.
   for (const auto& clock : clocks) {
     ClockId clock_id = clock.clock_id;
-    ClockDomain& domain = clocks_[clock_id];
+    ClockDomain& domain = clocks_[clock_id | trace_namespace_];
     if (domain.snapshots.empty()) {
       if (clock.is_incremental && !ClockIsSeqScoped(clock_id)) {
         PERFETTO_ELOG("Clock sync error: the global clock with id=%" PRIu64
@@ -128,12 +129,13 @@ uint32_t ClockTracker::AddSnapshot(const std::vector<ClockValue>& clocks) {
       // REALTIME timestamp when BOOTTIME was X?" but we can't answer the
       // opposite question because there can be two valid BOOTTIME(s) for the
       // same REALTIME instant because of the 1:many relationship.
-      non_monotonic_clocks_.insert(clock_id);
+      const ClockId namespaced_id = clock_id | trace_namespace_;
+      non_monotonic_clocks_.insert(namespaced_id);
 
       // Erase all edges from the graph that start from this clock (but keep the
       // ones that end on this clock).
-      auto begin = graph_.lower_bound(ClockGraphEdge{clock_id, 0, 0});
-      auto end = graph_.lower_bound(ClockGraphEdge{clock_id + 1, 0, 0});
+      auto begin = graph_.lower_bound(ClockGraphEdge{namespaced_id, 0, 0});
+      auto end = graph_.lower_bound(ClockGraphEdge{namespaced_id + 1, 0, 0});
       graph_.erase(begin, end);
     }
     vect.snapshot_ids.emplace_back(snapshot_id);
@@ -151,16 +153,38 @@ uint32_t ClockTracker::AddSnapshot(const std::vector<ClockValue>& clocks) {
     auto it2 = it1;
     ++it2;
     for (; it2 != clocks.end(); ++it2) {
-      if (!non_monotonic_clocks_.count(it1->clock_id))
-        graph_.emplace(it1->clock_id, it2->clock_id, snapshot_hash);
+      const ClockId id1 = it1->clock_id | trace_namespace_;
+      const ClockId id2 = it2->clock_id | trace_namespace_;
+      if (!non_monotonic_clocks_.count(id1))
+        graph_.emplace(id1, id2, snapshot_hash);
 
-      if (!non_monotonic_clocks_.count(it2->clock_id))
-        graph_.emplace(it2->clock_id, it1->clock_id, snapshot_hash);
+      if (!non_monotonic_clocks_.count(id2))
+        graph_.emplace(id2, id1, snapshot_hash);
     }
   }
   return snapshot_id;
 }
 
+void ClockTracker::SetCurrentTrace(uint32_t trace_idx) {
+  PERFETTO_CHECK(trace_idx < kMaxTraces);
+  if (trace_idx == cur_trace_idx_)
+    return;
+  other_trace_time_clocks_[cur_trace_idx_] = TraceTimeClock{
+      trace_time_clock_id_, trace_time_clock_id_used_for_conversion_};
+
+  auto it = other_trace_time_clocks_.find(trace_idx);
+  if (it != other_trace_time_clocks_.end()) {
+    trace_time_clock_id_ = it->second.clock_id;
+    trace_time_clock_id_used_for_conversion_ = it->second.used_for_conversion;
+    other_trace_time_clocks_.erase(it);
+  } else {
+    trace_time_clock_id_ = protos::pbzero::BUILTIN_CLOCK_BOOTTIME;
+    trace_time_clock_id_used_for_conversion_ = false;
+  }
+  cur_trace_idx_ = trace_idx;
+  trace_namespace_ = static_cast<ClockId>(trace_idx) << kTraceIdxShift;
+}
+
 // Finds the shortest clock resolution path in the graph that allows to
 // translate a timestamp from |src| to |target| clocks.
 // The return value looks like the following: "If you want to convert a
@@ -205,8 +229,8 @@ base::Optional<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
                                                       ClockId target_clock_id) {
   PERFETTO_DCHECK(!IsReservedSeqScopedClockId(src_clock_id));
   PERFETTO_DCHECK(!IsReservedSeqScopedClockId(target_clock_id));
-
-  context_->storage->IncrementStats(stats::clock_sync_cache_miss);
+  src_clock_id |= trace_namespace_;
+  target_clock_id |= trace_namespace_;
 
   ClockPath path = FindPath(src_clock_id, target_clock_id);
   if (!path.valid()) {
@@ -217,23 +241,34 @@ base::Optional<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
                     " at timestamp %" PRId64,
                     src_clock_id, target_clock_id, src_timestamp);
     }
+    context_->storage->IncrementStats(stats::clock_sync_cache_miss);
     context_->storage->IncrementStats(stats::clock_sync_failure);
     return base::nullopt;
   }
 
-  // We can cache only single-path resolutions between two clocks.
-  // Caching multi-path resolutions is harder because the (src,target) tuple
-  // is not enough as a cache key: at any step the |ns| value can yield to a
-  // different choice of the next snapshot. Multi-path resolutions don't seem
-  // too frequent these days, so we focus only on caching the more frequent
-  // one-step resolutions (typically from any clock to the trace clock).
-  const bool cacheable = path.len == 1;
+  int64_t ns = GetClock(src_clock_id)->ToNs(src_timestamp);
+  return ConvertAlongPath(path, src_clock_id, ns);
+}
+
+base::Optional<int64_t> ClockTracker::ConvertAlongPath(const ClockPath& path,
+                                                       ClockId src_clock_id,
+                                                       int64_t src_ns) {
+  context_->storage->IncrementStats(stats::clock_sync_cache_miss);
+
+  // The interval of source timestamps which resolve to the same snapshots as
+  // |src_ns| at every step of the path, hence share its translation. This
+  // is the intersection of the intervals between the snapshots used at each
+  // step, shifted back into the source domain.
+  constexpr int64_t kInt64Min = std::numeric_limits<int64_t>::min();
+  constexpr int64_t kInt64Max = std::numeric_limits<int64_t>::max();
   CachedClockPath cache_entry{};
+  cache_entry.min_ts_ns = kInt64Min;
+  cache_entry.max_ts_ns = kInt64Max;
+  bool cacheable = true;
 
   // Iterate trough the path found and translate timestamps onto the new clock
   // domain on each step, until the target domain is reached.
-  ClockDomain* src_domain = GetClock(src_clock_id);
-  int64_t ns = src_domain->ToNs(src_timestamp);
+  int64_t ns = src_ns;
   for (uint32_t i = 0; i < path.len; ++i) {
     const ClockGraphEdge edge = path.at(i);
     ClockDomain* cur_clock = GetClock(std::get<0>(edge));
@@ -266,6 +301,7 @@ base::Optional<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
                                     next_snap.snapshot_ids.end(), snapshot_id);
     if (next_it == next_snap.snapshot_ids.end() || *next_it != snapshot_id) {
       PERFETTO_DFATAL("Snapshot does not exist in clock domain.");
+      cacheable = false;
       continue;
     }
     size_t next_index = static_cast<size_t>(
@@ -273,34 +309,32 @@ base::Optional<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
     PERFETTO_DCHECK(next_index < next_snap.snapshot_ids.size());
     int64_t next_timestamp_ns = next_snap.timestamps_ns[next_index];
 
+    // Any timestamp between this snapshot and the next one resolves to the
+    // same snapshot. |ns - src_ns| is the translation of the previous steps.
+    const int64_t offset = ns - src_ns;
+    if (it != ts_vec.begin())
+      cache_entry.min_ts_ns = std::max(cache_entry.min_ts_ns, *it - offset);
+    if (it + 1 != ts_vec.end()) {
+      cache_entry.max_ts_ns =
+          std::min(cache_entry.max_ts_ns, *(it + 1) - offset);
+    }
+
     // The translated timestamp is the relative delta of the source timestamp
     // from the closest snapshot found (ns - *it), plus the timestamp in
     // the new clock domain for the same snapshot id.
-    const int64_t adj = next_timestamp_ns - *it;
-    ns += adj;
-
-    // On the first iteration, keep track of the bounds for the cache entry.
-    // This will allow future Convert() calls to skip the pathfinder logic
-    // as long as the query stays within the bound.
-    if (cacheable) {
-      PERFETTO_DCHECK(i == 0);
-      const int64_t kInt64Min = std::numeric_limits<int64_t>::min();
-      const int64_t kInt64Max = std::numeric_limits<int64_t>::max();
-      cache_entry.min_ts_ns = it == ts_vec.begin() ? kInt64Min : *it;
-      auto ubound = it + 1;
-      cache_entry.max_ts_ns = ubound == ts_vec.end() ? kInt64Max : *ubound;
-      cache_entry.translation_ns = adj;
-    }
+    ns += next_timestamp_ns - *it;
 
     // The last clock in the path must be the target clock.
-    PERFETTO_DCHECK(i < path.len - 1 || std::get<1>(edge) == target_clock_id);
+    PERFETTO_DCHECK(i < path.len - 1 || std::get<1>(edge) == path.last);
   }
 
   if (cacheable) {
     cache_entry.src = src_clock_id;
-    cache_entry.src_domain = src_domain;
-    cache_entry.target = target_clock_id;
-    cache_[rnd_() % cache_.size()] = cache_entry;
+    cache_entry.target = path.last;
+    cache_entry.src_domain = GetClock(src_clock_id);
+    cache_entry.translation_ns = ns - src_ns;
+    cache_entry.path = path;
+    cache_[CacheIndex(src_clock_id, path.last)] = cache_entry;
   }
 
   return ns;
@@ -22,7 +22,6 @@
 #include <array>
 #include <cinttypes>
 #include <map>
-#include <random>
 #include <set>
 #include <vector>
 
@@ -123,6 +122,7 @@ class ClockTracker {
   // passed as argument to ClockTracker functions.
   static ClockId SeqScopedClockIdToGlobal(uint32_t seq_id, uint32_t clock_id) {
     PERFETTO_DCHECK(IsReservedSeqScopedClockId(clock_id));
+    PERFETTO_DCHECK(seq_id < (1u << (kTraceIdxShift - 32)));
     return (static_cast<uint64_t>(seq_id) << 32) | clock_id;
   }
 
@@ -134,6 +134,10 @@ class ClockTracker {
     return (global_clock_id >> 32) > 0;
   }
 
+  // The maximum number of traces which can be loaded in the same storage
+  // (see SetCurrentTrace()).
+  static constexpr uint32_t kMaxTraces = 256;
+
   explicit ClockTracker(TraceProcessorContext*);
   virtual ~ClockTracker();
 
@@ -158,18 +162,26 @@ class ClockTracker {
   uint32_t AddSnapshot(const std::vector<ClockValue>&);
 
   // Converts a timestamp between two clock domains. Tries to use the cache
-  // first (only for single-path resolutions), then falls back on path finding
-  // as described in the header.
+  // first, then falls back on path finding as described in the header.
+  // The cache remembers, for each (src, target) pair, the last path found and
+  // the interval of source timestamps between the snapshots it used: as long
+  // as the timestamps stay in that interval, the conversion is an addition.
+  // When they leave it (e.g. monotonically increasing timestamps moving past
+  // the next snapshot), the cached path is reused without a new search.
   base::Optional<int64_t> Convert(ClockId src_clock_id,
                                   int64_t src_timestamp,
                                   ClockId target_clock_id) {
+    src_clock_id |= trace_namespace_;
+    target_clock_id |= trace_namespace_;
     if (PERFETTO_LIKELY(!cache_lookups_disabled_for_testing_)) {
-      for (const auto& ce : cache_) {
-        if (ce.src != src_clock_id || ce.target != target_clock_id)
-          continue;
+      const CachedClockPath& ce =
+          cache_[CacheIndex(src_clock_id, target_clock_id)];
+      if (ce.src == src_clock_id && ce.target == target_clock_id) {
         int64_t ns = ce.src_domain->ToNs(src_timestamp);
-        if (ns >= ce.min_ts_ns && ns < ce.max_ts_ns)
+        if (PERFETTO_LIKELY(ns >= ce.min_ts_ns && ns < ce.max_ts_ns))
           return ns + ce.translation_ns;
+        // The path is copied as ConvertAlongPath() overwrites |ce|.
+        return ConvertAlongPath(ClockPath(ce.path), src_clock_id, ns);
       }
     }
     return ConvertSlowpath(src_clock_id, src_timestamp, target_clock_id);
@@ -199,6 +211,15 @@ class ClockTracker {
     trace_time_clock_id_ = clock_id;
   }
 
+  // Selects the trace which the clock ids passed to the other methods belong
+  // to, when several traces are loaded in the same storage (e.g. recorded on
+  // different devices). The clocks of each trace, including its trace time
+  // clock, are kept apart from the ones with the same ids in other traces:
+  // each trace is converted to its own trace time, so e.g. the BOOTTIME
+  // timestamps of all the traces end up on the same timeline without being
+  // mixed up by their snapshots. Trace 0 is the default.
+  void SetCurrentTrace(uint32_t trace_idx);
+
   void set_cache_lookups_disabled_for_testing(bool v) {
     cache_lookups_disabled_for_testing_ = v;
   }
@@ -279,8 +300,9 @@ class ClockTracker {
     }
   };
 
-  // Holds data for cached entries. At the moment only single-path resolution
-  // are cached.
+  // Holds data for cached entries: the source timestamps in [min_ts_ns,
+  // max_ts_ns) are converted by adding |translation_ns|, as they resolve to
+  // the same snapshots at each step of |path|.
   struct CachedClockPath {
     ClockId src;
     ClockId target;
@@ -288,13 +310,39 @@ class ClockTracker {
     int64_t min_ts_ns;
     int64_t max_ts_ns;
     int64_t translation_ns;
+    ClockPath path;
   };
 
+  // The cache is direct mapped: each (src, target) pair can only be in the
+  // entry at CacheIndex(src, target).
+  static constexpr uint32_t kCacheSizeLog2 = 4;
+  static size_t CacheIndex(ClockId src, ClockId target) {
+    uint64_t hash = (src * 31 + target) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> (64 - kCacheSizeLog2));
+  }
+
   ClockTracker(const ClockTracker&) = delete;
   ClockTracker& operator=(const ClockTracker&) = delete;
 
   ClockPath FindPath(ClockId src, ClockId target);
 
+  // Converts |src_ns|, already in nanoseconds in the |src_clock_id| domain,
+  // along |path| and caches the result.
+  base::Optional<int64_t> ConvertAlongPath(const ClockPath& path,
+                                           ClockId src_clock_id,
+                                           int64_t src_ns);
+
+  // The state of the trace time clock of a trace other than the current one.
+  struct TraceTimeClock {
+    ClockId clock_id;
+    bool used_for_conversion;
+  };
+
+  // The ids of the clocks of the trace |trace_idx| are OR-ed with
+  // |trace_idx| << kTraceIdxShift, above the sequence ids of the
+  // sequence-scoped clocks.
+  static constexpr uint32_t kTraceIdxShift = 56;
+
   ClockDomain* GetClock(ClockId clock_id) {
     auto it = clocks_.find(clock_id);
     PERFETTO_DCHECK(it != clocks_.end());
@@ -306,11 +354,16 @@ class ClockTracker {
   std::map<ClockId, ClockDomain> clocks_;
   std::set<ClockGraphEdge> graph_;
   std::set<ClockId> non_monotonic_clocks_;
-  std::array<CachedClockPath, 2> cache_{};
+  std::array<CachedClockPath, 1 << kCacheSizeLog2> cache_{};
   bool cache_lookups_disabled_for_testing_ = false;
-  std::minstd_rand rnd_;  // For cache eviction.
   uint32_t cur_snapshot_id_ = 0;
   bool trace_time_clock_id_used_for_conversion_ = false;
+
+  // The namespace of the clocks of the current trace (see SetCurrentTrace()),
+  // and the trace time clocks of the other traces.
+  uint32_t cur_trace_idx_ = 0;
+  ClockId trace_namespace_ = 0;
+  std::map<uint32_t, TraceTimeClock> other_trace_time_clocks_;
 };
 
 }  // namespace trace_processor
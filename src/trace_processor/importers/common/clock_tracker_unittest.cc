@@ -285,6 +285,83 @@ TEST_F(ClockTrackerTest, CacheDoesntAffectResults) {
   }
 }
 
+// Tests that monotonically increasing timestamps only miss the cache when
+// they move past a snapshot, including for multi-step conversions.
+TEST_F(ClockTrackerTest, CacheSnapshotIntervals) {
+  ct_.AddSnapshot({{MONOTONIC, 1000}, {BOOTTIME, 100000}});
+  ct_.AddSnapshot({{MONOTONIC, 2000}, {BOOTTIME, 200000}});
+  ct_.AddSnapshot({{MONOTONIC_RAW, 50}, {BOOTTIME, 100000}});
+  ct_.AddSnapshot({{MONOTONIC_RAW, 150}, {BOOTTIME, 200000}});
+
+  auto misses = [this] {
+    return context_.storage->stats()[stats::clock_sync_cache_miss].value;
+  };
+
+  // MONOTONIC_RAW -> BOOTTIME -> MONOTONIC.
+  EXPECT_EQ(ct_.Convert(MONOTONIC_RAW, 60, MONOTONIC), 1010);
+  EXPECT_EQ(misses(), 1);
+  for (int64_t ts = 61; ts < 150; ts++)
+    EXPECT_EQ(ct_.Convert(MONOTONIC_RAW, ts, MONOTONIC), 950 + ts);
+  EXPECT_EQ(misses(), 1);
+
+  // Past the second snapshot, the translation changes.
+  EXPECT_EQ(ct_.Convert(MONOTONIC_RAW, 150, MONOTONIC), 2000);
+  EXPECT_EQ(misses(), 2);
+  for (int64_t ts = 151; ts < 1000; ts++)
+    EXPECT_EQ(ct_.Convert(MONOTONIC_RAW, ts, MONOTONIC), 1850 + ts);
+  EXPECT_EQ(misses(), 2);
+
+  // A timestamp before the interval misses again.
+  EXPECT_EQ(ct_.Convert(MONOTONIC_RAW, 100, MONOTONIC), 1050);
+  EXPECT_EQ(misses(), 3);
+}
+
+// Tests that an incremental clock only applies its delta once when the
+// conversion misses the cache.
+TEST_F(ClockTrackerTest, CacheMissWithIncrementalClock) {
+  ClockTracker::ClockId c64_1 = ct_.SeqScopedClockIdToGlobal(1, 64);
+  ct_.AddSnapshot({{MONOTONIC, 1000}, {c64_1, 10, 1, /*incremental=*/true}});
+  ct_.AddSnapshot({{MONOTONIC, 2000}, {c64_1, 20, 1, /*incremental=*/true}});
+
+  EXPECT_EQ(ct_.Convert(c64_1, 1 /* abs 21 */, MONOTONIC), 2001);
+  EXPECT_EQ(ct_.Convert(c64_1, -11 /* abs 10 */, MONOTONIC), 1000);
+  EXPECT_EQ(ct_.Convert(c64_1, 15 /* abs 25 */, MONOTONIC), 2005);
+}
+
+// Tests that the clocks of different traces are kept apart, even when they
+// have the same ids.
+TEST_F(ClockTrackerTest, PerTraceClocks) {
+  ct_.AddSnapshot({{REALTIME, 10}, {BOOTTIME, 1010}});
+
+  // The second trace uses MONOTONIC as its trace time clock.
+  ct_.SetCurrentTrace(1);
+  ct_.SetTraceTimeClock(MONOTONIC);
+  EXPECT_EQ(ct_.ToTraceTime(REALTIME, 10), base::nullopt);
+  ct_.AddSnapshot({{REALTIME, 10}, {MONOTONIC, 2010}});
+  EXPECT_EQ(ct_.ToTraceTime(REALTIME, 20), 2020);
+  EXPECT_EQ(ct_.ToTraceTime(MONOTONIC, 20), 20);
+  EXPECT_EQ(ct_.Convert(REALTIME, 20, BOOTTIME), base::nullopt);
+
+  // The first trace doesn't see the snapshot of the second one and keeps its
+  // own trace time clock.
+  ct_.SetCurrentTrace(0);
+  EXPECT_EQ(ct_.ToTraceTime(REALTIME, 20), 1020);
+  EXPECT_EQ(ct_.Convert(REALTIME, 20, MONOTONIC), base::nullopt);
+
+  // Switching back restores the state of the second trace, which can't
+  // change its trace time clock once used.
+  ct_.SetCurrentTrace(1);
+  ct_.SetTraceTimeClock(BOOTTIME);
+  EXPECT_EQ(ct_.ToTraceTime(REALTIME, 30), 2030);
+
+  // Sequence-scoped clocks are per trace as well.
+  ClockTracker::ClockId c64_1 = ct_.SeqScopedClockIdToGlobal(1, 64);
+  ct_.AddSnapshot({{MONOTONIC, 3000}, {c64_1, 30}});
+  EXPECT_EQ(ct_.ToTraceTime(c64_1, 40), 3010);
+  ct_.SetCurrentTrace(0);
+  EXPECT_EQ(ct_.ToTraceTime(c64_1, 40), base::nullopt);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
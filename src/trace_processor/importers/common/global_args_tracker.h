@@ -111,16 +111,14 @@ class GlobalArgsTracker {
       hash.Update(ArgHasher()(args[i]));
     }
 
-    auto* arg_table = context_->storage->mutable_arg_table();
-
     ArgSetHash digest = hash.digest();
-    auto it = arg_row_for_hash_.find(digest);
-    if (it != arg_row_for_hash_.end())
-      return arg_table->arg_set_id()[it->second];
+    auto it = arg_set_for_hash_.find(digest);
+    if (it != arg_set_for_hash_.end())
+      return it->second;
 
-    // The +1 ensures that nothing has an id == kInvalidArgSetId == 0.
-    ArgSetId id = static_cast<uint32_t>(arg_row_for_hash_.size()) + 1;
-    arg_row_for_hash_.emplace(digest, arg_table->row_count());
+    auto* arg_table = context_->storage->mutable_arg_table();
+    ArgSetId id = context_->storage->StartArgSet();
+    arg_set_for_hash_.emplace(digest, id);
     for (uint32_t i : valid_indexes) {
       const auto& arg = args[i];
 
@@ -160,7 +158,7 @@ class GlobalArgsTracker {
  private:
   using ArgSetHash = uint64_t;
 
-  std::unordered_map<ArgSetHash, uint32_t> arg_row_for_hash_;
+  std::unordered_map<ArgSetHash, ArgSetId> arg_set_for_hash_;
 
   TraceProcessorContext* context_;
 };
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/common/global_args_tracker.h"
+
+#include <vector>
+
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class GlobalArgsTrackerTest : public ::testing::Test {
+ public:
+  GlobalArgsTrackerTest() {
+    context_.storage.reset(new TraceStorage());
+    tracker_.reset(new GlobalArgsTracker(&context_));
+  }
+
+ protected:
+  GlobalArgsTracker::Arg IntArg(const char* key, int64_t value) {
+    GlobalArgsTracker::Arg arg;
+    arg.key = arg.flat_key = context_.storage->InternString(key);
+    arg.value = Variadic::Integer(value);
+    return arg;
+  }
+
+  ArgSetId AddArgSet(const std::vector<GlobalArgsTracker::Arg>& args) {
+    return tracker_->AddArgSet(args, 0, static_cast<uint32_t>(args.size()));
+  }
+
+  base::Optional<Variadic> Extract(ArgSetId arg_set_id, const char* key) {
+    base::Optional<Variadic> value;
+    EXPECT_TRUE(context_.storage->ExtractArg(arg_set_id, key, &value).ok());
+    return value;
+  }
+
+  TraceProcessorContext context_;
+  std::unique_ptr<GlobalArgsTracker> tracker_;
+};
+
+TEST_F(GlobalArgsTrackerTest, ArgSetRows) {
+  ArgSetId a = AddArgSet({IntArg("a", 1), IntArg("b", 2)});
+  ArgSetId b = AddArgSet({IntArg("c", 3)});
+  ArgSetId empty = AddArgSet({});
+
+  ASSERT_NE(a, kInvalidArgSetId);
+  ASSERT_EQ(context_.storage->GetArgSetRows(a), std::make_pair(0u, 2u));
+  ASSERT_EQ(context_.storage->GetArgSetRows(b), std::make_pair(2u, 3u));
+  ASSERT_EQ(context_.storage->GetArgSetRows(empty), std::make_pair(3u, 3u));
+
+  // Identical arg sets are deduplicated.
+  ASSERT_EQ(AddArgSet({IntArg("c", 3)}), b);
+  ASSERT_EQ(context_.storage->arg_table().row_count(), 3u);
+
+  ASSERT_EQ(context_.storage->GetArgSetRows(kInvalidArgSetId),
+            std::make_pair(0u, 0u));
+  ASSERT_EQ(context_.storage->GetArgSetRows(1000), std::make_pair(0u, 0u));
+}
+
+TEST_F(GlobalArgsTrackerTest, ExtractArg) {
+  ArgSetId a = AddArgSet({IntArg("a", 1), IntArg("b", 2)});
+  ArgSetId b = AddArgSet({IntArg("a", 3)});
+
+  ASSERT_EQ(Extract(a, "a")->int_value, 1);
+  ASSERT_EQ(Extract(a, "b")->int_value, 2);
+  ASSERT_EQ(Extract(b, "a")->int_value, 3);
+
+  ASSERT_FALSE(Extract(b, "b").has_value());
+  ASSERT_FALSE(Extract(a, "not_interned").has_value());
+  ASSERT_FALSE(Extract(kInvalidArgSetId, "a").has_value());
+  ASSERT_FALSE(Extract(1000, "a").has_value());
+
+  // Args added after the first lookup are found as well.
+  ArgSetId c = AddArgSet({IntArg("b", 4), IntArg("d", 5)});
+  ASSERT_EQ(Extract(c, "b")->int_value, 4);
+  ASSERT_EQ(Extract(c, "d")->int_value, 5);
+  ASSERT_FALSE(Extract(a, "d").has_value());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
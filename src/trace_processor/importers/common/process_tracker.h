@@ -19,6 +19,7 @@
 
 #include <tuple>
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/string_view.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -50,11 +51,6 @@ class ProcessTracker {
   ProcessTracker& operator=(const ProcessTracker&) = delete;
   virtual ~ProcessTracker();
 
-  using UniqueProcessIterator =
-      std::multimap<uint32_t, UniquePid>::const_iterator;
-  using UniqueProcessBounds =
-      std::pair<UniqueProcessIterator, UniqueProcessIterator>;
-
   using UniqueThreadIterator = std::vector<UniqueTid>::const_iterator;
   using UniqueThreadBounds =
       std::pair<UniqueThreadIterator, UniqueThreadIterator>;
@@ -135,10 +131,10 @@ class ProcessTracker {
   // Virtual for testing.
   virtual UniquePid GetOrCreateProcess(uint32_t pid);
 
-  // Returns the bounds of a range that includes all UniquePids that have the
-  // requested pid.
-  UniqueProcessBounds UpidsForPidForTesting(uint32_t pid) {
-    return pids_.equal_range(pid);
+  // Returns the UniquePid currently associated with |pid|, if any.
+  base::Optional<UniquePid> UpidForPidForTesting(uint32_t pid) {
+    UniquePid* upid = pids_.Find(pid);
+    return upid ? base::make_optional(*upid) : base::nullopt;
   }
 
   // Returns the bounds of a range that includes all UniqueTids that have the
@@ -188,12 +184,13 @@ class ProcessTracker {
   ArgsTracker args_tracker_;
 
   // Each tid can have multiple UniqueTid entries, a new UniqueTid is assigned
-  // each time a thread is seen in the trace.
-  std::map<uint32_t /* tid */, std::vector<UniqueTid>> tids_;
+  // each time a thread is seen in the trace. These two maps are looked up for
+  // almost every event, hence the hash maps.
+  base::FlatHashMap<uint32_t /* tid */, std::vector<UniqueTid>> tids_;
 
   // Each pid can have multiple UniquePid entries, a new UniquePid is assigned
-  // each time a process is seen in the trace.
-  std::map<uint32_t /* pid (aka tgid) */, UniquePid> pids_;
+  // each time a process is seen in the trace. Only the last one is kept here.
+  base::FlatHashMap<uint32_t /* pid (aka tgid) */, UniquePid> pids_;
 
   // Pending thread associations. The meaning of a pair<ThreadA, ThreadB> in
   // this vector is: we know that A and B belong to the same process, but we
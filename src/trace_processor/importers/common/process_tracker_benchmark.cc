@@ -0,0 +1,89 @@
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/common/process_tracker.h"
+#include "src/trace_processor/importers/common/track_tracker.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr uint32_t kNumCpus = 8;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(64);
+  } else {
+    b->RangeMultiplier(4)->Range(64, 16384);
+  }
+}
+
+// The tids of the sched_switch events of a trace with |num_threads| threads,
+// most of the switches involving a small set of busy threads.
+std::vector<uint32_t> CreateSchedTids(uint32_t num_threads) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rng(kRandomSeed);
+  std::vector<uint32_t> tids(1 << 16);
+  for (uint32_t& tid : tids) {
+    uint32_t idx = static_cast<uint32_t>(rng()) % num_threads;
+    if (rng() % 4 != 0)
+      idx %= std::max(num_threads / 16, 1u);
+    tid = 1000 + idx * 7;
+  }
+  return tids;
+}
+
+}  // namespace
+
+// Models the per-event work of the trackers for a sched_switch: the next tid
+// is resolved to a utid, whose thread track is interned, and the cpu counter
+// track of the event is interned.
+static void BM_ProcessTrackerSchedSwitch(benchmark::State& state) {
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  context.global_args_tracker.reset(new GlobalArgsTracker(&context));
+  context.args_tracker.reset(new ArgsTracker(&context));
+  context.process_tracker.reset(new ProcessTracker(&context));
+  context.track_tracker.reset(new TrackTracker(&context));
+  context.process_tracker->SetPidZeroIgnoredForIdleProcess();
+
+  std::vector<uint32_t> tids =
+      CreateSchedTids(static_cast<uint32_t>(state.range(0)));
+  StringId counter_name = context.storage->InternString("cpu_freq");
+  uint32_t i = 0;
+  for (auto _ : state) {
+    uint32_t tid = tids[i & (tids.size() - 1)];
+    UniqueTid utid = context.process_tracker->GetOrCreateThread(tid);
+    benchmark::DoNotOptimize(context.track_tracker->InternThreadTrack(utid));
+    benchmark::DoNotOptimize(context.track_tracker->InternCpuCounterTrack(
+        counter_name, i % kNumCpus));
+    i++;
+  }
+}
+BENCHMARK(BM_ProcessTrackerSchedSwitch)->Apply(BenchmarkArgs);
+
+}  // namespace trace_processor
+}  // namespace perfetto
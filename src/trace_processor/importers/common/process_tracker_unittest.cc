@@ -47,8 +47,7 @@ class ProcessTrackerTest : public ::testing::Test {
 TEST_F(ProcessTrackerTest, PushProcess) {
   context.process_tracker->SetProcessMetadata(1, base::nullopt, "test",
                                               base::StringView());
-  auto pair_it = context.process_tracker->UpidsForPidForTesting(1);
-  ASSERT_EQ(pair_it.first->second, 1u);
+  ASSERT_EQ(context.process_tracker->UpidForPidForTesting(1), 1u);
 }
 
 TEST_F(ProcessTrackerTest, GetOrCreateNewProcess) {
@@ -68,9 +67,9 @@ TEST_F(ProcessTrackerTest, PushTwoProcessEntries_SamePidAndName) {
                                               base::StringView());
   context.process_tracker->SetProcessMetadata(1, base::nullopt, "test",
                                               base::StringView());
-  auto pair_it = context.process_tracker->UpidsForPidForTesting(1);
-  ASSERT_EQ(pair_it.first->second, 1u);
-  ASSERT_EQ(++pair_it.first, pair_it.second);
+  auto upid = context.process_tracker->UpidForPidForTesting(1);
+  ASSERT_EQ(upid, 1u);
+  ASSERT_EQ(context.storage->process_table().row_count(), 2u);
 }
 
 TEST_F(ProcessTrackerTest, PushTwoProcessEntries_DifferentPid) {
@@ -78,10 +77,8 @@ TEST_F(ProcessTrackerTest, PushTwoProcessEntries_DifferentPid) {
                                               base::StringView());
   context.process_tracker->SetProcessMetadata(3, base::nullopt, "test",
                                               base::StringView());
-  auto pair_it = context.process_tracker->UpidsForPidForTesting(1);
-  ASSERT_EQ(pair_it.first->second, 1u);
-  auto second_pair_it = context.process_tracker->UpidsForPidForTesting(3);
-  ASSERT_EQ(second_pair_it.first->second, 2u);
+  ASSERT_EQ(context.process_tracker->UpidForPidForTesting(1), 1u);
+  ASSERT_EQ(context.process_tracker->UpidForPidForTesting(3), 2u);
 }
 
 TEST_F(ProcessTrackerTest, AddProcessEntry_CorrectName) {
@@ -101,8 +98,7 @@ TEST_F(ProcessTrackerTest, UpdateThreadCreate) {
   auto tid_it = context.process_tracker->UtidsForTidForTesting(12);
   ASSERT_NE(tid_it.first, tid_it.second);
   ASSERT_EQ(context.storage->thread_table().upid()[1].value(), 1u);
-  auto pid_it = context.process_tracker->UpidsForPidForTesting(2);
-  ASSERT_NE(pid_it.first, pid_it.second);
+  ASSERT_TRUE(context.process_tracker->UpidForPidForTesting(2).has_value());
   ASSERT_EQ(context.storage->process_table().row_count(), 2u);
 }
 
@@ -40,7 +40,7 @@ base::Optional<SliceId> SliceTracker::Begin(int64_t timestamp,
                                             TrackId track_id,
                                             StringId category,
                                             StringId name,
-                                            SetArgsCallback args_callback) {
+                                            SetArgsCallbackRef args_callback) {
   tables::SliceTable::Row row(timestamp, kPendingDuration, track_id, category,
                               name);
   return StartSlice(timestamp, track_id, args_callback, [this, &row]() {
@@ -49,7 +49,7 @@ base::Optional<SliceId> SliceTracker::Begin(int64_t timestamp,
 }
 
 void SliceTracker::BeginLegacyUnnestable(tables::SliceTable::Row row,
-                                         SetArgsCallback args_callback) {
+                                         SetArgsCallbackRef args_callback) {
   // Ensure that the duration is pending for this row.
   // TODO(lalitm): change this to eventually use null instead of -1.
   row.dur = kPendingDuration;
@@ -74,7 +74,7 @@ base::Optional<SliceId> SliceTracker::Scoped(int64_t timestamp,
                                              StringId category,
                                              StringId name,
                                              int64_t duration,
-                                             SetArgsCallback args_callback) {
+                                             SetArgsCallbackRef args_callback) {
   PERFETTO_DCHECK(duration >= 0);
 
   tables::SliceTable::Row row(timestamp, duration, track_id, category, name);
@@ -87,17 +87,18 @@ base::Optional<SliceId> SliceTracker::End(int64_t timestamp,
                                           TrackId track_id,
                                           StringId category,
                                           StringId name,
-                                          SetArgsCallback args_callback) {
+                                          SetArgsCallbackRef args_callback) {
   auto finder = [this, category, name](const SlicesStack& stack) {
     return MatchingIncompleteSliceIndex(stack, name, category);
   };
   return CompleteSlice(timestamp, track_id, args_callback, finder);
 }
 
-base::Optional<uint32_t> SliceTracker::AddArgs(TrackId track_id,
-                                               StringId category,
-                                               StringId name,
-                                               SetArgsCallback args_callback) {
+base::Optional<uint32_t> SliceTracker::AddArgs(
+    TrackId track_id,
+    StringId category,
+    StringId name,
+    SetArgsCallbackRef args_callback) {
   auto it = stacks_.find(track_id);
   if (it == stacks_.end())
     return base::nullopt;
@@ -123,8 +124,8 @@ base::Optional<uint32_t> SliceTracker::AddArgs(TrackId track_id,
 base::Optional<SliceId> SliceTracker::StartSlice(
     int64_t timestamp,
     TrackId track_id,
-    SetArgsCallback args_callback,
-    std::function<SliceId()> inserter) {
+    SetArgsCallbackRef args_callback,
+    FunctionRef<SliceId()> inserter) {
   // At this stage all events should be globally timestamp ordered.
   if (timestamp < prev_timestamp_) {
     context_->storage->IncrementStats(stats::slice_out_of_order);
@@ -149,7 +150,7 @@ base::Optional<SliceId> SliceTracker::StartSlice(
   }
 
   auto* slices = context_->storage->mutable_slice_table();
-  MaybeCloseStack(timestamp, stack, track_id);
+  MaybeCloseStack(timestamp, stack);
 
   const uint8_t depth = static_cast<uint8_t>(stack->size());
   if (depth >= std::numeric_limits<uint8_t>::max()) {
@@ -164,7 +165,7 @@ base::Optional<SliceId> SliceTracker::StartSlice(
 
   SliceId id = inserter();
   uint32_t slice_idx = *slices->id().IndexOf(id);
-  StackPush(track_id, slice_idx);
+  StackPush(track_id, stack, slice_idx);
 
   // Post fill all the relevant columns. All the other columns should have
   // been filled by the inserter.
@@ -185,8 +186,8 @@ base::Optional<SliceId> SliceTracker::StartSlice(
 base::Optional<SliceId> SliceTracker::CompleteSlice(
     int64_t timestamp,
     TrackId track_id,
-    SetArgsCallback args_callback,
-    std::function<base::Optional<uint32_t>(const SlicesStack&)> finder) {
+    SetArgsCallbackRef args_callback,
+    FunctionRef<base::Optional<uint32_t>(const SlicesStack&)> finder) {
   // At this stage all events should be globally timestamp ordered.
   if (timestamp < prev_timestamp_) {
     context_->storage->IncrementStats(stats::slice_out_of_order);
@@ -200,7 +201,7 @@ base::Optional<SliceId> SliceTracker::CompleteSlice(
 
   TrackInfo& track_info = it->second;
   SlicesStack& stack = track_info.slice_stack;
-  MaybeCloseStack(timestamp, &stack, track_id);
+  MaybeCloseStack(timestamp, &stack);
   if (stack.empty())
     return base::nullopt;
 
@@ -294,9 +295,7 @@ base::Optional<SliceId> SliceTracker::GetTopmostSliceOnTrack(
   return context_->storage->slice_table().id()[slice_idx];
 }
 
-void SliceTracker::MaybeCloseStack(int64_t ts,
-                                   SlicesStack* stack,
-                                   TrackId track_id) {
+void SliceTracker::MaybeCloseStack(int64_t ts, SlicesStack* stack) {
   auto* slices = context_->storage->mutable_slice_table();
   bool incomplete_descendent = false;
   for (int i = static_cast<int>(stack->size()) - 1; i >= 0; i--) {
@@ -336,18 +335,18 @@ void SliceTracker::MaybeCloseStack(int64_t ts,
         uint32_t child_idx = (*stack)[static_cast<size_t>(j)].row;
         PERFETTO_DCHECK(slices->dur()[child_idx] == kPendingDuration);
         slices->mutable_dur()->Set(child_idx, end_ts - slices->ts()[child_idx]);
-        StackPop(track_id);
+        stack->pop_back();
       }
 
       // Also pop the current row itself and reset the incomplete flag.
-      StackPop(track_id);
+      stack->pop_back();
       incomplete_descendent = false;
 
       continue;
     }
 
     if (end_ts <= ts) {
-      StackPop(track_id);
+      stack->pop_back();
     }
   }
 }
@@ -373,13 +372,10 @@ int64_t SliceTracker::GetStackHash(const SlicesStack& stack) {
   return static_cast<int64_t>(hash.digest() & kSafeBitmask);
 }
 
-void SliceTracker::StackPop(TrackId track_id) {
-  stacks_[track_id].slice_stack.pop_back();
-}
-
-void SliceTracker::StackPush(TrackId track_id, uint32_t slice_idx) {
-  stacks_[track_id].slice_stack.push_back(
-      SliceInfo{slice_idx, ArgsTracker(context_)});
+void SliceTracker::StackPush(TrackId track_id,
+                             SlicesStack* stack,
+                             uint32_t slice_idx) {
+  stack->emplace_back(slice_idx, context_);
 
   const auto& slices = context_->storage->slice_table();
   if (on_slice_begin_callback_) {
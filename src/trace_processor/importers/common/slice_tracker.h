@@ -19,8 +19,10 @@
 
 #include <stdint.h>
 
+#include "src/trace_processor/containers/small_vector.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/util/function_ref.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -33,6 +35,12 @@ class SliceTracker {
   using SetArgsCallback = std::function<void(ArgsTracker::BoundInserter*)>;
   using OnSliceBeginCallback = std::function<void(TrackId, SliceId)>;
 
+  // The type of the args callbacks taken by the methods below. The callbacks
+  // are always invoked before the methods return so they are only referenced
+  // (see FunctionRef): both lambdas and SetArgsCallbacks can be passed without
+  // being copied or allocating any memory.
+  using SetArgsCallbackRef = FunctionRef<void(ArgsTracker::BoundInserter*)>;
+
   explicit SliceTracker(TraceProcessorContext*);
   virtual ~SliceTracker();
 
@@ -42,7 +50,7 @@ class SliceTracker {
       TrackId track_id,
       StringId category,
       StringId name,
-      SetArgsCallback args_callback = SetArgsCallback());
+      SetArgsCallbackRef args_callback = SetArgsCallbackRef());
 
   // Unnestable slices are slices which do not have any concept of nesting so
   // starting a new slice when a slice already exists leads to no new slice
@@ -51,13 +59,13 @@ class SliceTracker {
   // the comment in SystraceParser::ParseSystracePoint for information on why
   // this method exists.
   void BeginLegacyUnnestable(tables::SliceTable::Row row,
-                             SetArgsCallback args_callback);
+                             SetArgsCallbackRef args_callback);
 
   template <typename Table>
   base::Optional<SliceId> BeginTyped(
       Table* table,
       typename Table::Row row,
-      SetArgsCallback args_callback = SetArgsCallback()) {
+      SetArgsCallbackRef args_callback = SetArgsCallbackRef()) {
     // Ensure that the duration is pending for this row.
     row.dur = kPendingDuration;
     return StartSlice(row.ts, row.track_id, args_callback,
@@ -71,13 +79,13 @@ class SliceTracker {
       StringId category,
       StringId name,
       int64_t duration,
-      SetArgsCallback args_callback = SetArgsCallback());
+      SetArgsCallbackRef args_callback = SetArgsCallbackRef());
 
   template <typename Table>
   base::Optional<SliceId> ScopedTyped(
       Table* table,
       const typename Table::Row& row,
-      SetArgsCallback args_callback = SetArgsCallback()) {
+      SetArgsCallbackRef args_callback = SetArgsCallbackRef()) {
     PERFETTO_DCHECK(row.dur >= 0);
     return StartSlice(row.ts, row.track_id, args_callback,
                       [table, &row]() { return table->Insert(row).id; });
@@ -89,7 +97,7 @@ class SliceTracker {
       TrackId track_id,
       StringId opt_category = {},
       StringId opt_name = {},
-      SetArgsCallback args_callback = SetArgsCallback());
+      SetArgsCallbackRef args_callback = SetArgsCallbackRef());
 
   // Usually args should be added in the Begin or End args_callback but this
   // method is for the situation where new args need to be added to an
@@ -97,7 +105,7 @@ class SliceTracker {
   base::Optional<uint32_t> AddArgs(TrackId track_id,
                                    StringId category,
                                    StringId name,
-                                   SetArgsCallback args_callback);
+                                   SetArgsCallbackRef args_callback);
 
   void FlushPendingSlices();
 
@@ -110,11 +118,18 @@ class SliceTracker {
   // with this duration placeholder.
   static constexpr int64_t kPendingDuration = -1;
 
+  // The number of slices which can be open on a track before its stack
+  // needs to allocate memory.
+  static constexpr size_t kInlineStackDepth = 4;
+
   struct SliceInfo {
+    SliceInfo(uint32_t r, TraceProcessorContext* context)
+        : row(r), args_tracker(context) {}
+
     uint32_t row;
     ArgsTracker args_tracker;
   };
-  using SlicesStack = std::vector<SliceInfo>;
+  using SlicesStack = SmallVector<SliceInfo, kInlineStackDepth>;
 
   struct TrackInfo {
     SlicesStack slice_stack;
@@ -127,18 +142,19 @@ class SliceTracker {
   using StackMap = std::unordered_map<TrackId, TrackInfo>;
 
   // virtual for testing.
-  virtual base::Optional<SliceId> StartSlice(int64_t timestamp,
-                                             TrackId track_id,
-                                             SetArgsCallback args_callback,
-                                             std::function<SliceId()> inserter);
+  virtual base::Optional<SliceId> StartSlice(
+      int64_t timestamp,
+      TrackId track_id,
+      SetArgsCallbackRef args_callback,
+      FunctionRef<SliceId()> inserter);
 
   base::Optional<SliceId> CompleteSlice(
       int64_t timestamp,
       TrackId track_id,
-      SetArgsCallback args_callback,
-      std::function<base::Optional<uint32_t>(const SlicesStack&)> finder);
+      SetArgsCallbackRef args_callback,
+      FunctionRef<base::Optional<uint32_t>(const SlicesStack&)> finder);
 
-  void MaybeCloseStack(int64_t end_ts, SlicesStack*, TrackId track_id);
+  void MaybeCloseStack(int64_t end_ts, SlicesStack*);
 
   base::Optional<uint32_t> MatchingIncompleteSliceIndex(
       const SlicesStack& stack,
@@ -147,8 +163,7 @@ class SliceTracker {
 
   int64_t GetStackHash(const SlicesStack&);
 
-  void StackPop(TrackId track_id);
-  void StackPush(TrackId track_id, uint32_t slice_idx);
+  void StackPush(TrackId track_id, SlicesStack*, uint32_t slice_idx);
   void FlowTrackerUpdate(TrackId track_id);
 
   OnSliceBeginCallback on_slice_begin_callback_;
@@ -94,6 +94,50 @@ TEST(SliceTrackerTest, NegativeTimestamps) {
   EXPECT_EQ(slices.arg_set_id()[0], kInvalidArgSetId);
 }
 
+TEST(SliceTrackerTest, DeeplyNestedSlicesWithArgs) {
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  context.global_args_tracker.reset(new GlobalArgsTracker(&context));
+  SliceTracker tracker(&context);
+
+  // Nest more slices than fit in the inline storage of the track stack so
+  // that the pending args have to be moved when the stack grows.
+  constexpr TrackId track{22u};
+  constexpr uint32_t kDepth = 10;
+  for (uint32_t i = 0; i < kDepth; ++i) {
+    tracker.Begin(i /*ts*/, track, kNullStringId /*cat*/,
+                  StringId::Raw(i + 1) /*name*/,
+                  [i](ArgsTracker::BoundInserter* inserter) {
+                    inserter->AddArg(/*flat_key=*/StringId::Raw(1),
+                                     /*key=*/StringId::Raw(2),
+                                     /*value=*/Variadic::Integer(i));
+                  });
+  }
+  for (uint32_t i = kDepth; i > 0; --i) {
+    tracker.End(100 + kDepth - i /*ts*/, track, kNullStringId /*cat*/,
+                StringId::Raw(i) /*name*/);
+  }
+
+  const auto& slices = context.storage->slice_table();
+  const auto& args = context.storage->arg_table();
+  ASSERT_EQ(slices.row_count(), kDepth);
+  for (uint32_t i = 0; i < kDepth; ++i) {
+    int64_t ts = i;
+    EXPECT_EQ(slices.ts()[i], ts);
+    EXPECT_EQ(slices.dur()[i], 100 + kDepth - 1 - 2 * ts);
+    EXPECT_EQ(slices.depth()[i], i);
+    if (i > 0) {
+      EXPECT_EQ(slices.parent_id()[i], slices.id()[i - 1]);
+    }
+
+    auto arg_set_id = slices.arg_set_id()[i];
+    ASSERT_NE(arg_set_id, kInvalidArgSetId);
+    auto row = args.arg_set_id().IndexOf(arg_set_id);
+    ASSERT_TRUE(row.has_value());
+    EXPECT_EQ(args.int_value()[*row], base::Optional<int64_t>(ts));
+  }
+}
+
 TEST(SliceTrackerTest, OneSliceWithArgs) {
   TraceProcessorContext context;
   context.storage.reset(new TraceStorage());
@@ -35,25 +35,27 @@ TrackTracker::TrackTracker(TraceProcessorContext* context)
       context_(context) {}
 
 TrackId TrackTracker::InternThreadTrack(UniqueTid utid) {
-  auto it = thread_tracks_.find(utid);
-  if (it != thread_tracks_.end())
-    return it->second;
+  if (utid < thread_tracks_.size() && thread_tracks_[utid])
+    return *thread_tracks_[utid];
 
   tables::ThreadTrackTable::Row row;
   row.utid = utid;
   auto id = context_->storage->mutable_thread_track_table()->Insert(row).id;
+  if (utid >= thread_tracks_.size())
+    thread_tracks_.resize(utid + 1);
   thread_tracks_[utid] = id;
   return id;
 }
 
 TrackId TrackTracker::InternProcessTrack(UniquePid upid) {
-  auto it = process_tracks_.find(upid);
-  if (it != process_tracks_.end())
-    return it->second;
+  if (upid < process_tracks_.size() && process_tracks_[upid])
+    return *process_tracks_[upid];
 
   tables::ProcessTrackTable::Row row;
   row.upid = upid;
   auto id = context_->storage->mutable_process_track_table()->Insert(row).id;
+  if (upid >= process_tracks_.size())
+    process_tracks_.resize(upid + 1);
   process_tracks_[upid] = id;
   return id;
 }
@@ -66,14 +68,13 @@ TrackId TrackTracker::InternFuchsiaAsyncTrack(StringId name,
 }
 
 TrackId TrackTracker::InternCpuTrack(StringId name, uint32_t cpu) {
-  auto it = cpu_tracks_.find(std::make_pair(name, cpu));
-  if (it != cpu_tracks_.end()) {
-    return it->second;
-  }
+  TrackId* existing = cpu_tracks_.Find(PairKey(name, cpu));
+  if (existing)
+    return *existing;
 
   tables::TrackTable::Row row(name);
   auto id = context_->storage->mutable_track_table()->Insert(row).id;
-  cpu_tracks_[std::make_pair(name, cpu)] = id;
+  cpu_tracks_.Insert(PairKey(name, cpu), id);
 
   return id;
 }
@@ -156,14 +157,14 @@ TrackId TrackTracker::CreateFrameTimelineAsyncTrack(StringId name,
 }
 
 TrackId TrackTracker::InternLegacyChromeProcessInstantTrack(UniquePid upid) {
-  auto it = chrome_process_instant_tracks_.find(upid);
-  if (it != chrome_process_instant_tracks_.end())
-    return it->second;
+  TrackId* existing = chrome_process_instant_tracks_.Find(upid);
+  if (existing)
+    return *existing;
 
   tables::ProcessTrackTable::Row row;
   row.upid = upid;
   auto id = context_->storage->mutable_process_track_table()->Insert(row).id;
-  chrome_process_instant_tracks_[upid] = id;
+  chrome_process_instant_tracks_.Insert(upid, id);
 
   context_->args_tracker->AddArgsTo(id).AddArg(
       source_key_, Variadic::String(chrome_source_));
@@ -195,47 +196,44 @@ TrackId TrackTracker::GetOrCreateTriggerTrack() {
 TrackId TrackTracker::InternGlobalCounterTrack(StringId name,
                                                StringId unit,
                                                StringId description) {
-  auto it = global_counter_tracks_by_name_.find(name);
-  if (it != global_counter_tracks_by_name_.end()) {
-    return it->second;
-  }
+  TrackId* existing = global_counter_tracks_by_name_.Find(name);
+  if (existing)
+    return *existing;
 
   tables::CounterTrackTable::Row row(name);
   row.unit = unit;
   row.description = description;
   TrackId track =
       context_->storage->mutable_counter_track_table()->Insert(row).id;
-  global_counter_tracks_by_name_[name] = track;
+  global_counter_tracks_by_name_.Insert(name, track);
   return track;
 }
 
 TrackId TrackTracker::InternCpuCounterTrack(StringId name, uint32_t cpu) {
-  auto it = cpu_counter_tracks_.find(std::make_pair(name, cpu));
-  if (it != cpu_counter_tracks_.end()) {
-    return it->second;
-  }
+  TrackId* existing = cpu_counter_tracks_.Find(PairKey(name, cpu));
+  if (existing)
+    return *existing;
 
   tables::CpuCounterTrackTable::Row row(name);
   row.cpu = cpu;
 
   TrackId track =
       context_->storage->mutable_cpu_counter_track_table()->Insert(row).id;
-  cpu_counter_tracks_[std::make_pair(name, cpu)] = track;
+  cpu_counter_tracks_.Insert(PairKey(name, cpu), track);
   return track;
 }
 
 TrackId TrackTracker::InternThreadCounterTrack(StringId name, UniqueTid utid) {
-  auto it = utid_counter_tracks_.find(std::make_pair(name, utid));
-  if (it != utid_counter_tracks_.end()) {
-    return it->second;
-  }
+  TrackId* existing = utid_counter_tracks_.Find(PairKey(name, utid));
+  if (existing)
+    return *existing;
 
   tables::ThreadCounterTrackTable::Row row(name);
   row.utid = utid;
 
   TrackId track =
       context_->storage->mutable_thread_counter_track_table()->Insert(row).id;
-  utid_counter_tracks_[std::make_pair(name, utid)] = track;
+  utid_counter_tracks_.Insert(PairKey(name, utid), track);
   return track;
 }
 
@@ -243,10 +241,9 @@ TrackId TrackTracker::InternProcessCounterTrack(StringId name,
                                                 UniquePid upid,
                                                 StringId unit,
                                                 StringId description) {
-  auto it = upid_counter_tracks_.find(std::make_pair(name, upid));
-  if (it != upid_counter_tracks_.end()) {
-    return it->second;
-  }
+  TrackId* existing = upid_counter_tracks_.Find(PairKey(name, upid));
+  if (existing)
+    return *existing;
 
   tables::ProcessCounterTrackTable::Row row(name);
   row.upid = upid;
@@ -255,48 +252,48 @@ TrackId TrackTracker::InternProcessCounterTrack(StringId name,
 
   TrackId track =
       context_->storage->mutable_process_counter_track_table()->Insert(row).id;
-  upid_counter_tracks_[std::make_pair(name, upid)] = track;
+  upid_counter_tracks_.Insert(PairKey(name, upid), track);
   return track;
 }
 
 TrackId TrackTracker::InternIrqCounterTrack(StringId name, int32_t irq) {
-  auto it = irq_counter_tracks_.find(std::make_pair(name, irq));
-  if (it != irq_counter_tracks_.end()) {
-    return it->second;
-  }
+  TrackId* existing =
+      irq_counter_tracks_.Find(PairKey(name, static_cast<uint32_t>(irq)));
+  if (existing)
+    return *existing;
 
   tables::IrqCounterTrackTable::Row row(name);
   row.irq = irq;
 
   TrackId track =
       context_->storage->mutable_irq_counter_track_table()->Insert(row).id;
-  irq_counter_tracks_[std::make_pair(name, irq)] = track;
+  irq_counter_tracks_.Insert(PairKey(name, static_cast<uint32_t>(irq)), track);
   return track;
 }
 
 TrackId TrackTracker::InternSoftirqCounterTrack(StringId name,
                                                 int32_t softirq) {
-  auto it = softirq_counter_tracks_.find(std::make_pair(name, softirq));
-  if (it != softirq_counter_tracks_.end()) {
-    return it->second;
-  }
+  TrackId* existing = softirq_counter_tracks_.Find(
+      PairKey(name, static_cast<uint32_t>(softirq)));
+  if (existing)
+    return *existing;
 
   tables::SoftirqCounterTrackTable::Row row(name);
   row.softirq = softirq;
 
   TrackId track =
       context_->storage->mutable_softirq_counter_track_table()->Insert(row).id;
-  softirq_counter_tracks_[std::make_pair(name, softirq)] = track;
+  softirq_counter_tracks_.Insert(
+      PairKey(name, static_cast<uint32_t>(softirq)), track);
   return track;
 }
 
 TrackId TrackTracker::InternGpuCounterTrack(StringId name, uint32_t gpu_id) {
-  auto it = gpu_counter_tracks_.find(std::make_pair(name, gpu_id));
-  if (it != gpu_counter_tracks_.end()) {
-    return it->second;
-  }
+  TrackId* existing = gpu_counter_tracks_.Find(PairKey(name, gpu_id));
+  if (existing)
+    return *existing;
   TrackId track = CreateGpuCounterTrack(name, gpu_id);
-  gpu_counter_tracks_[std::make_pair(name, gpu_id)] = track;
+  gpu_counter_tracks_.Insert(PairKey(name, gpu_id), track);
   return track;
 }
 
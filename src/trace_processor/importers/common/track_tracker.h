@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_TRACK_TRACKER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_TRACK_TRACKER_H_
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
@@ -134,23 +135,36 @@ class TrackTracker {
     }
   };
 
-  std::map<UniqueTid, TrackId> thread_tracks_;
-  std::map<UniquePid, TrackId> process_tracks_;
+  // Packs a name and a scope (e.g. a cpu or a utid) into the key of the hash
+  // maps of the tracks interned by (name, scope) below.
+  static uint64_t PairKey(StringId name, uint32_t scope) {
+    return static_cast<uint64_t>(name.raw_id()) << 32 | scope;
+  }
+
+  // Indexed by utid and upid, which are dense.
+  std::vector<base::Optional<TrackId>> thread_tracks_;
+  std::vector<base::Optional<TrackId>> process_tracks_;
   std::map<int64_t /* correlation_id */, TrackId> fuchsia_async_tracks_;
 
-  std::map<std::pair<StringId, uint32_t /* cpu */>, TrackId> cpu_tracks_;
+  base::FlatHashMap<uint64_t /* PairKey(name, cpu) */, TrackId> cpu_tracks_;
 
   std::map<GpuTrackTuple, TrackId> gpu_tracks_;
   std::map<ChromeTrackTuple, TrackId> chrome_tracks_;
-  std::map<UniquePid, TrackId> chrome_process_instant_tracks_;
-
-  std::map<StringId, TrackId> global_counter_tracks_by_name_;
-  std::map<std::pair<StringId, uint32_t>, TrackId> cpu_counter_tracks_;
-  std::map<std::pair<StringId, UniqueTid>, TrackId> utid_counter_tracks_;
-  std::map<std::pair<StringId, UniquePid>, TrackId> upid_counter_tracks_;
-  std::map<std::pair<StringId, int32_t>, TrackId> irq_counter_tracks_;
-  std::map<std::pair<StringId, int32_t>, TrackId> softirq_counter_tracks_;
-  std::map<std::pair<StringId, uint32_t>, TrackId> gpu_counter_tracks_;
+  base::FlatHashMap<UniquePid, TrackId> chrome_process_instant_tracks_;
+
+  base::FlatHashMap<StringId, TrackId> global_counter_tracks_by_name_;
+  base::FlatHashMap<uint64_t /* PairKey(name, cpu) */, TrackId>
+      cpu_counter_tracks_;
+  base::FlatHashMap<uint64_t /* PairKey(name, utid) */, TrackId>
+      utid_counter_tracks_;
+  base::FlatHashMap<uint64_t /* PairKey(name, upid) */, TrackId>
+      upid_counter_tracks_;
+  base::FlatHashMap<uint64_t /* PairKey(name, irq) */, TrackId>
+      irq_counter_tracks_;
+  base::FlatHashMap<uint64_t /* PairKey(name, softirq) */, TrackId>
+      softirq_counter_tracks_;
+  base::FlatHashMap<uint64_t /* PairKey(name, gpu_id) */, TrackId>
+      gpu_counter_tracks_;
 
   base::Optional<TrackId> chrome_global_instant_track_id_;
   base::Optional<TrackId> trigger_track_id_;
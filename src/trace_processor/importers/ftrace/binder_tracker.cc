@@ -93,25 +93,31 @@ void BinderTracker::Transaction(int64_t ts,
   UniqueTid src_utid = context_->process_tracker->GetOrCreateThread(tid);
   TrackId track_id = context_->track_tracker->InternThreadTrack(src_utid);
 
-  auto args_inserter = [this, transaction_id, dest_node, dest_tgid, is_reply,
-                        flags, code,
-                        tid](ArgsTracker::BoundInserter* inserter) {
-    inserter->AddArg(transaction_id_, Variadic::Integer(transaction_id));
-    inserter->AddArg(dest_node_, Variadic::Integer(dest_node));
-    inserter->AddArg(dest_process_, Variadic::Integer(dest_tgid));
-    inserter->AddArg(is_reply_, Variadic::Boolean(is_reply));
-    std::string flag_str =
-        base::IntToHexString(flags) + " " + BinderFlagsToHuman(flags);
-    inserter->AddArg(flags_, Variadic::String(context_->storage->InternString(
-                                 base::StringView(flag_str))));
-    inserter->AddArg(code_, Variadic::String(code));
-    inserter->AddArg(calling_tid_, Variadic::UnsignedInteger(tid));
-    // TODO(hjd): The legacy UI included the calling pid in the args,
-    // is this necessary? It's complicated in our case because process
-    // association might not happen until after the binder transaction slices
-    // have been parsed. We would need to backfill the arg.
+  bool expects_reply = !is_reply && ((flags & kOneWay) == 0);
+
+  auto* txns = context_->storage->mutable_binder_transaction_table();
+  tables::BinderTransactionTable::Row row;
+  row.ts = ts;
+  row.transaction_id = transaction_id;
+  row.is_reply = is_reply;
+  row.is_oneway = !is_reply && !expects_reply;
+  row.flags = flags;
+  row.code = code;
+  row.client_utid = src_utid;
+  row.dest_node = dest_node;
+  row.dest_tgid = dest_tgid;
+  auto id_and_row = txns->Insert(row);
+  uint32_t txn_row = id_and_row.row;
+
+  auto args_inserter = [this, txn_row](ArgsTracker::BoundInserter* inserter) {
+    AddTransactionArgs(txn_row, inserter);
   };
 
+  PendingTransaction pending;
+  pending.row = txn_row;
+  pending.track_id = track_id;
+
+  base::Optional<SliceId> slice_id;
   if (is_reply) {
     // Reply slices have accurate dest information, so we can add it.
     const auto& thread_table = context_->storage->thread_table();
@@ -125,82 +131,113 @@ void BinderTracker::Transaction(int64_t ts,
     };
     context_->slice_tracker->AddArgs(track_id, binder_category_id_, reply_id_,
                                      dest_args_inserter);
-    context_->slice_tracker->End(ts, track_id, kNullStringId, kNullStringId,
-                                 args_inserter);
-    awaiting_rcv_for_reply_.insert(transaction_id);
-    return;
-  }
-
-  bool expects_reply = !is_reply && ((flags & kOneWay) == 0);
+    slice_id = context_->slice_tracker->End(ts, track_id, kNullStringId,
+                                            kNullStringId, args_inserter);
 
-  if (expects_reply) {
-    context_->slice_tracker->Begin(ts, track_id, binder_category_id_,
-                                   transaction_slice_id_, args_inserter);
-    transaction_await_rcv[transaction_id] = track_id;
+    // The reply answers the last transaction received by this thread which
+    // was not replied to yet.
+    ThreadState& state = GetThreadState(src_utid);
+    if (!state.awaiting_reply.empty()) {
+      txns->mutable_reply_id()->Set(state.awaiting_reply.back(),
+                                    id_and_row.id);
+      state.awaiting_reply.pop_back();
+    }
+    pending.kind = PendingTransaction::Kind::kReply;
+  } else if (expects_reply) {
+    slice_id = context_->slice_tracker->Begin(
+        ts, track_id, binder_category_id_, transaction_slice_id_,
+        args_inserter);
+    pending.kind = PendingTransaction::Kind::kSync;
   } else {
-    context_->slice_tracker->Scoped(ts, track_id, binder_category_id_,
-                                    transaction_async_id_, 0, args_inserter);
-    awaiting_async_rcv_[transaction_id] = args_inserter;
+    slice_id = context_->slice_tracker->Scoped(
+        ts, track_id, binder_category_id_, transaction_async_id_, 0,
+        args_inserter);
+    pending.kind = PendingTransaction::Kind::kOneWay;
   }
+  if (slice_id)
+    txns->mutable_slice_id()->Set(txn_row, *slice_id);
+
+  auto it_and_inserted = pending_transactions_.Insert(transaction_id, pending);
+  if (!it_and_inserted.second)
+    *it_and_inserted.first = pending;
 }
 
 void BinderTracker::TransactionReceived(int64_t ts,
                                         uint32_t pid,
                                         int32_t transaction_id) {
   UniqueTid utid = context_->process_tracker->GetOrCreateThread(pid);
-  const auto& thread_table = context_->storage->thread_table();
-  StringId thread_name = thread_table.name()[utid];
   TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-  if (awaiting_rcv_for_reply_.count(transaction_id) > 0) {
-    context_->slice_tracker->End(ts, track_id);
-    awaiting_rcv_for_reply_.erase(transaction_id);
-    return;
-  }
 
-  if (transaction_await_rcv.count(transaction_id) > 0) {
-    // First begin the reply slice to get its slice id.
-    auto reply_slice_id = context_->slice_tracker->Begin(
-        ts, track_id, binder_category_id_, reply_id_);
-    // Add accurate dest info to the binder transaction slice.
-    auto args_inserter = [this, pid, &thread_name, &reply_slice_id](
-                             ArgsTracker::BoundInserter* inserter) {
-      inserter->AddArg(dest_thread_, Variadic::UnsignedInteger(pid));
-      inserter->AddArg(dest_name_, Variadic::String(thread_name));
-      if (reply_slice_id.has_value())
-        inserter->AddArg(dest_slice_id_,
-                         Variadic::UnsignedInteger(reply_slice_id->value));
-    };
-    // Add the dest args to the current transaction slice and get the slice id.
-    auto transaction_slice_id = context_->slice_tracker->AddArgs(
-        transaction_await_rcv[transaction_id], binder_category_id_,
-        transaction_slice_id_, args_inserter);
-
-    // Add the dest slice id to the reply slice that has just begun.
-    auto reply_dest_inserter =
-        [this, &transaction_slice_id](ArgsTracker::BoundInserter* inserter) {
-          if (transaction_slice_id.has_value())
-            inserter->AddArg(dest_slice_id_, Variadic::UnsignedInteger(
-                                                 transaction_slice_id.value()));
-        };
-    context_->slice_tracker->AddArgs(track_id, binder_category_id_, reply_id_,
-                                     reply_dest_inserter);
-    transaction_await_rcv.erase(transaction_id);
+  PendingTransaction* it = pending_transactions_.Find(transaction_id);
+  if (!it)
     return;
-  }
+  PendingTransaction pending = *it;
+  pending_transactions_.Erase(transaction_id);
 
-  if (awaiting_async_rcv_.count(transaction_id) > 0) {
-    auto args = awaiting_async_rcv_[transaction_id];
-    context_->slice_tracker->Scoped(ts, track_id, binder_category_id_,
-                                    async_rcv_id_, 0, args);
-    awaiting_async_rcv_.erase(transaction_id);
-    return;
+  auto* txns = context_->storage->mutable_binder_transaction_table();
+  txns->mutable_server_utid()->Set(pending.row, utid);
+  txns->mutable_received_ts()->Set(pending.row, ts);
+
+  base::Optional<SliceId> received_slice_id;
+  switch (pending.kind) {
+    case PendingTransaction::Kind::kReply: {
+      received_slice_id = context_->slice_tracker->End(ts, track_id);
+      break;
+    }
+    case PendingTransaction::Kind::kSync: {
+      const auto& thread_table = context_->storage->thread_table();
+      StringId thread_name = thread_table.name()[utid];
+
+      // First begin the reply slice to get its slice id.
+      received_slice_id = context_->slice_tracker->Begin(
+          ts, track_id, binder_category_id_, reply_id_);
+      // Add accurate dest info to the binder transaction slice.
+      auto args_inserter = [this, pid, &thread_name, &received_slice_id](
+                               ArgsTracker::BoundInserter* inserter) {
+        inserter->AddArg(dest_thread_, Variadic::UnsignedInteger(pid));
+        inserter->AddArg(dest_name_, Variadic::String(thread_name));
+        if (received_slice_id.has_value())
+          inserter->AddArg(dest_slice_id_, Variadic::UnsignedInteger(
+                                               received_slice_id->value));
+      };
+      // Add the dest args to the current transaction slice and get the slice
+      // id.
+      auto transaction_slice_id = context_->slice_tracker->AddArgs(
+          pending.track_id, binder_category_id_, transaction_slice_id_,
+          args_inserter);
+
+      // Add the dest slice id to the reply slice that has just begun.
+      auto reply_dest_inserter = [this, &transaction_slice_id](
+                                     ArgsTracker::BoundInserter* inserter) {
+        if (transaction_slice_id.has_value())
+          inserter->AddArg(dest_slice_id_, Variadic::UnsignedInteger(
+                                               transaction_slice_id.value()));
+      };
+      context_->slice_tracker->AddArgs(track_id, binder_category_id_,
+                                       reply_id_, reply_dest_inserter);
+
+      // The next reply sent by this thread answers this transaction.
+      GetThreadState(utid).awaiting_reply.push_back(pending.row);
+      break;
+    }
+    case PendingTransaction::Kind::kOneWay: {
+      uint32_t txn_row = pending.row;
+      received_slice_id = context_->slice_tracker->Scoped(
+          ts, track_id, binder_category_id_, async_rcv_id_, 0,
+          [this, txn_row](ArgsTracker::BoundInserter* inserter) {
+            AddTransactionArgs(txn_row, inserter);
+          });
+      break;
+    }
   }
+  if (received_slice_id)
+    txns->mutable_received_slice_id()->Set(pending.row, *received_slice_id);
 }
 
 void BinderTracker::Lock(int64_t ts, uint32_t pid) {
-  attempt_lock_[pid] = ts;
-
   UniqueTid utid = context_->process_tracker->GetOrCreateThread(pid);
+  GetThreadState(utid).lock_attempted = true;
+
   TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
   context_->slice_tracker->Begin(ts, track_id, binder_category_id_,
                                  lock_waiting_id_);
@@ -209,7 +246,8 @@ void BinderTracker::Lock(int64_t ts, uint32_t pid) {
 void BinderTracker::Locked(int64_t ts, uint32_t pid) {
   UniqueTid utid = context_->process_tracker->GetOrCreateThread(pid);
 
-  if (attempt_lock_.count(pid) == 0)
+  ThreadState& state = GetThreadState(utid);
+  if (!state.lock_attempted)
     return;
 
   TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
@@ -217,20 +255,21 @@ void BinderTracker::Locked(int64_t ts, uint32_t pid) {
   context_->slice_tracker->Begin(ts, track_id, binder_category_id_,
                                  lock_held_id_);
 
-  lock_acquired_[pid] = ts;
-  attempt_lock_.erase(pid);
+  state.lock_held = true;
+  state.lock_attempted = false;
 }
 
 void BinderTracker::Unlock(int64_t ts, uint32_t pid) {
   UniqueTid utid = context_->process_tracker->GetOrCreateThread(pid);
 
-  if (lock_acquired_.count(pid) == 0)
+  ThreadState& state = GetThreadState(utid);
+  if (!state.lock_held)
     return;
 
   TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
   context_->slice_tracker->End(ts, track_id, binder_category_id_,
                                lock_held_id_);
-  lock_acquired_.erase(pid);
+  state.lock_held = false;
 }
 
 void BinderTracker::TransactionAllocBuf(int64_t ts,
@@ -251,5 +290,35 @@ void BinderTracker::TransactionAllocBuf(int64_t ts,
   base::ignore_result(ts);
 }
 
+void BinderTracker::AddTransactionArgs(uint32_t row,
+                                       ArgsTracker::BoundInserter* inserter) {
+  const auto& txns = context_->storage->binder_transaction_table();
+  const auto& thread_table = context_->storage->thread_table();
+  inserter->AddArg(transaction_id_,
+                   Variadic::Integer(txns.transaction_id()[row]));
+  inserter->AddArg(dest_node_, Variadic::Integer(txns.dest_node()[row]));
+  inserter->AddArg(dest_process_, Variadic::Integer(txns.dest_tgid()[row]));
+  inserter->AddArg(is_reply_, Variadic::Boolean(txns.is_reply()[row]));
+  inserter->AddArg(flags_, Variadic::String(GetFlagsString(txns.flags()[row])));
+  inserter->AddArg(code_, Variadic::String(txns.code()[row]));
+  uint32_t calling_tid = thread_table.tid()[txns.client_utid()[row]];
+  inserter->AddArg(calling_tid_, Variadic::UnsignedInteger(calling_tid));
+  // TODO(hjd): The legacy UI included the calling pid in the args,
+  // is this necessary? It's complicated in our case because process
+  // association might not happen until after the binder transaction slices
+  // have been parsed. We would need to backfill the arg.
+}
+
+StringId BinderTracker::GetFlagsString(uint32_t flags) {
+  StringId* cached = flags_strings_.Find(flags);
+  if (cached)
+    return *cached;
+  std::string flag_str =
+      base::IntToHexString(flags) + " " + BinderFlagsToHuman(flags);
+  StringId id = context_->storage->InternString(base::StringView(flag_str));
+  flags_strings_.Insert(flags, id);
+  return id;
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -18,9 +18,9 @@
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_BINDER_TRACKER_H_
 
 #include <stdint.h>
-#include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/destructible.h"
@@ -31,9 +31,11 @@ namespace trace_processor {
 
 class TraceProcessorContext;
 
+// Turns the binder ftrace events into slices on the threads taking part in
+// the transactions and into the rows of the binder_txn table, which links
+// each transaction to its reply directly.
 class BinderTracker : public Destructible {
  public:
-  using SetArgsCallback = std::function<void(ArgsTracker::BoundInserter*)>;
   // Declared public for testing only.
   explicit BinderTracker(TraceProcessorContext*);
   BinderTracker(const BinderTracker&) = delete;
@@ -67,15 +69,49 @@ class BinderTracker : public Destructible {
                            uint64_t offsets_size);
 
  private:
-  TraceProcessorContext* const context_;
-  std::unordered_set<int32_t> awaiting_rcv_for_reply_;
+  // A transaction which was sent but not received yet.
+  struct PendingTransaction {
+    enum class Kind : uint8_t { kSync, kOneWay, kReply };
+
+    Kind kind = Kind::kSync;
+    // The row of the transaction in the binder_txn table.
+    uint32_t row = 0;
+    // The track of the sending thread.
+    TrackId track_id;
+  };
+
+  // The binder state of a thread, indexed by utid.
+  struct ThreadState {
+    bool lock_attempted = false;
+    bool lock_held = false;
+    // The rows of the synchronous transactions received by the thread which
+    // were not replied to yet. Nested transactions (i.e. the thread making a
+    // binder call while serving one) are replied to in reverse order.
+    std::vector<uint32_t> awaiting_reply;
+  };
+
+  ThreadState& GetThreadState(UniqueTid utid) {
+    if (utid >= thread_states_.size())
+      thread_states_.resize(utid + 1);
+    return thread_states_[utid];
+  }
+
+  // Adds the args common to all the slices of the transaction at |row| of the
+  // binder_txn table.
+  void AddTransactionArgs(uint32_t row, ArgsTracker::BoundInserter*);
 
-  std::unordered_map<int32_t, TrackId> transaction_await_rcv;
-  std::unordered_map<int32_t, SetArgsCallback> awaiting_async_rcv_;
+  // Returns the interned human readable description of |flags|.
+  StringId GetFlagsString(uint32_t flags);
+
+  TraceProcessorContext* const context_;
 
-  std::unordered_map<uint32_t, int64_t> attempt_lock_;
+  // Keyed by the transaction id, which is unique among the transactions in
+  // flight.
+  base::FlatHashMap<int32_t, PendingTransaction> pending_transactions_;
+  std::vector<ThreadState> thread_states_;
 
-  std::unordered_map<uint32_t, int64_t> lock_acquired_;
+  // Transactions use very few distinct combinations of flags.
+  base::FlatHashMap<uint32_t, StringId> flags_strings_;
 
   const StringId binder_category_id_;
   const StringId lock_waiting_id_;
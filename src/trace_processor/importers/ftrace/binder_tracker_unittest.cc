@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/binder_tracker.h"
+
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/common/global_args_tracker.h"
+#include "src/trace_processor/importers/common/process_tracker.h"
+#include "src/trace_processor/importers/common/slice_tracker.h"
+#include "src/trace_processor/importers/common/track_tracker.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr uint32_t kOneWay = 0x01;
+
+class BinderTrackerTest : public ::testing::Test {
+ public:
+  BinderTrackerTest() {
+    context_.storage.reset(new TraceStorage());
+    context_.global_args_tracker.reset(new GlobalArgsTracker(&context_));
+    context_.args_tracker.reset(new ArgsTracker(&context_));
+    context_.process_tracker.reset(new ProcessTracker(&context_));
+    context_.track_tracker.reset(new TrackTracker(&context_));
+    context_.slice_tracker.reset(new SliceTracker(&context_));
+    tracker_ = BinderTracker::GetOrCreate(&context_);
+    code_ = context_.storage->InternString("code");
+  }
+
+ protected:
+  void Transaction(int64_t ts,
+                   uint32_t tid,
+                   int32_t transaction_id,
+                   uint32_t dest_tid,
+                   bool is_reply,
+                   uint32_t flags = 0) {
+    tracker_->Transaction(ts, tid, transaction_id, /*dest_node=*/1,
+                          /*dest_tgid=*/1, static_cast<int32_t>(dest_tid),
+                          is_reply, flags, code_);
+  }
+
+  uint32_t Tid(base::Optional<uint32_t> utid) {
+    return context_.storage->thread_table().tid()[*utid];
+  }
+
+  int64_t SliceDur(base::Optional<SliceId> id) {
+    return context_.storage->slice_table().dur()[id->value];
+  }
+
+  TraceProcessorContext context_;
+  BinderTracker* tracker_ = nullptr;
+  StringId code_;
+};
+
+TEST_F(BinderTrackerTest, TransactionLinkedToReply) {
+  Transaction(100, /*tid=*/1, /*transaction_id=*/10, /*dest_tid=*/0, false);
+  tracker_->TransactionReceived(110, /*tid=*/2, 10);
+  Transaction(150, /*tid=*/2, /*transaction_id=*/11, /*dest_tid=*/1, true);
+  tracker_->TransactionReceived(160, /*tid=*/1, 11);
+
+  const auto& txns = context_.storage->binder_transaction_table();
+  ASSERT_EQ(txns.row_count(), 2u);
+
+  ASSERT_EQ(txns.transaction_id()[0], 10);
+  ASSERT_EQ(txns.is_reply()[0], 0u);
+  ASSERT_EQ(txns.is_oneway()[0], 0u);
+  ASSERT_EQ(Tid(txns.client_utid()[0]), 1u);
+  ASSERT_EQ(Tid(txns.server_utid()[0]), 2u);
+  ASSERT_EQ(txns.received_ts()[0], 110);
+  ASSERT_EQ(txns.reply_id()[0], txns.id()[1]);
+
+  ASSERT_EQ(txns.transaction_id()[1], 11);
+  ASSERT_EQ(txns.is_reply()[1], 1u);
+  ASSERT_EQ(Tid(txns.client_utid()[1]), 2u);
+  ASSERT_EQ(Tid(txns.server_utid()[1]), 1u);
+  ASSERT_EQ(txns.received_ts()[1], 160);
+  ASSERT_FALSE(txns.reply_id()[1].has_value());
+
+  // The transaction slice lasts until the reply is received and the reply
+  // slice from the transaction being received to the reply being sent.
+  ASSERT_EQ(SliceDur(txns.slice_id()[0]), 60);
+  ASSERT_EQ(SliceDur(txns.received_slice_id()[0]), 40);
+  ASSERT_EQ(txns.slice_id()[1], txns.received_slice_id()[0]);
+  ASSERT_EQ(txns.received_slice_id()[1], txns.slice_id()[0]);
+}
+
+TEST_F(BinderTrackerTest, NestedTransactions) {
+  // Thread 2 calls into thread 3 while serving a call from thread 1.
+  Transaction(100, /*tid=*/1, /*transaction_id=*/10, /*dest_tid=*/0, false);
+  tracker_->TransactionReceived(110, /*tid=*/2, 10);
+  Transaction(120, /*tid=*/2, /*transaction_id=*/11, /*dest_tid=*/0, false);
+  tracker_->TransactionReceived(130, /*tid=*/3, 11);
+  Transaction(140, /*tid=*/3, /*transaction_id=*/12, /*dest_tid=*/2, true);
+  tracker_->TransactionReceived(150, /*tid=*/2, 12);
+  Transaction(160, /*tid=*/2, /*transaction_id=*/13, /*dest_tid=*/1, true);
+  tracker_->TransactionReceived(170, /*tid=*/1, 13);
+
+  const auto& txns = context_.storage->binder_transaction_table();
+  ASSERT_EQ(txns.row_count(), 4u);
+  ASSERT_EQ(txns.reply_id()[0], txns.id()[3]);
+  ASSERT_EQ(txns.reply_id()[1], txns.id()[2]);
+  ASSERT_EQ(SliceDur(txns.slice_id()[0]), 70);
+  ASSERT_EQ(SliceDur(txns.slice_id()[1]), 30);
+}
+
+TEST_F(BinderTrackerTest, OneWayTransaction) {
+  Transaction(100, /*tid=*/1, /*transaction_id=*/10, /*dest_tid=*/0, false,
+              kOneWay);
+  tracker_->TransactionReceived(110, /*tid=*/2, 10);
+
+  // Receiving the same transaction again is ignored.
+  tracker_->TransactionReceived(120, /*tid=*/2, 10);
+
+  const auto& txns = context_.storage->binder_transaction_table();
+  ASSERT_EQ(txns.row_count(), 1u);
+  ASSERT_EQ(txns.is_oneway()[0], 1u);
+  ASSERT_EQ(txns.received_ts()[0], 110);
+  ASSERT_FALSE(txns.reply_id()[0].has_value());
+  ASSERT_EQ(SliceDur(txns.slice_id()[0]), 0);
+  ASSERT_EQ(SliceDur(txns.received_slice_id()[0]), 0);
+  ASSERT_EQ(context_.storage->slice_table().row_count(), 2u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
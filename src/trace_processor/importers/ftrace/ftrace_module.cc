@@ -22,5 +22,7 @@ namespace trace_processor {
 void FtraceModule::ParseFtracePacket(uint32_t /*cpu*/,
                                      const TimestampedTracePiece&) {}
 
+void FtraceModule::MaterializeRawArgs() {}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -27,6 +27,11 @@ class FtraceModule : public ProtoImporterModule {
  public:
   virtual void ParseFtracePacket(uint32_t cpu,
                                  const TimestampedTracePiece& ttp);
+
+  // Decodes the args of the raw table rows of the ftrace events parsed so far
+  // whose args were deferred (see Config::lazy_ftrace_raw_args). Must be
+  // called before the args of the raw table are read.
+  virtual void MaterializeRawArgs();
 };
 
 }  // namespace trace_processor
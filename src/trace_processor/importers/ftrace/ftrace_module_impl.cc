@@ -66,5 +66,9 @@ void FtraceModuleImpl::ParseFtracePacket(uint32_t cpu,
   }
 }
 
+void FtraceModuleImpl::MaterializeRawArgs() {
+  parser_.MaterializeRawArgs();
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
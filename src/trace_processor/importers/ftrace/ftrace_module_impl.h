@@ -48,6 +48,8 @@ class FtraceModuleImpl : public FtraceModule {
   void ParseFtracePacket(uint32_t cpu,
                          const TimestampedTracePiece& ttp) override;
 
+  void MaterializeRawArgs() override;
+
  private:
   FtraceTokenizer tokenizer_;
   FtraceParser parser_;
@@ -21,6 +21,7 @@
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/ftrace/binder_tracker.h"
+#include "src/trace_processor/importers/ftrace/thread_state_tracker.h"
 #include "src/trace_processor/importers/proto/async_track_set_tracker.h"
 #include "src/trace_processor/importers/syscalls/syscall_tracker.h"
 #include "src/trace_processor/importers/systrace/systrace_parser.h"
@@ -605,21 +606,65 @@ void FtraceParser::ParseTypedFtraceToRaw(
   if (PERFETTO_UNLIKELY(!context_->config.ingest_ftrace_in_raw_table))
     return;
 
-  ProtoDecoder decoder(blob.data, blob.size);
   if (ftrace_id >= GetDescriptorsSize()) {
     PERFETTO_DLOG("Event with id: %d does not exist and cannot be parsed.",
                   ftrace_id);
     return;
   }
 
-  MessageDescriptor* m = GetMessageDescriptorForId(ftrace_id);
   const auto& message_strings = ftrace_message_strings_[ftrace_id];
   UniqueTid utid = context_->process_tracker->GetOrCreateThread(tid);
   RawId id =
       context_->storage->mutable_raw_table()
           ->Insert({timestamp, message_strings.message_name_id, cpu, utid})
           .id;
+
+  // The kernel function fields are resolved using the interned data of the
+  // sequence, which is not kept around: these events are never deferred.
+  bool has_kernel_function_fields = std::any_of(
+      kKernelFunctionFields.begin(), kKernelFunctionFields.end(),
+      [ftrace_id](const FtraceEventAndFieldId& ev) {
+        return ev.event_id == ftrace_id;
+      });
+  if (context_->config.lazy_ftrace_raw_args && !has_kernel_function_fields) {
+    size_t offset = lazy_raw_args_bytes_.size();
+    lazy_raw_args_bytes_.insert(lazy_raw_args_bytes_.end(), blob.data,
+                                blob.data + blob.size);
+    lazy_raw_args_.push_back(LazyRawArgs{
+        id, ftrace_id, static_cast<uint32_t>(blob.size), offset});
+    return;
+  }
+
   auto inserter = context_->args_tracker->AddArgsTo(id);
+  ParseTypedFtraceArgs(ftrace_id, blob, seq_state, &inserter);
+}
+
+void FtraceParser::MaterializeRawArgs() {
+  if (lazy_raw_args_.empty())
+    return;
+
+  ArgsTracker args_tracker(context_);
+  for (const LazyRawArgs& event : lazy_raw_args_) {
+    auto inserter = args_tracker.AddArgsTo(event.raw_id);
+    ConstBytes blob{lazy_raw_args_bytes_.data() + event.offset, event.size};
+    ParseTypedFtraceArgs(event.ftrace_id, blob, nullptr, &inserter);
+  }
+  args_tracker.Flush();
+
+  lazy_raw_args_.clear();
+  lazy_raw_args_.shrink_to_fit();
+  lazy_raw_args_bytes_.clear();
+  lazy_raw_args_bytes_.shrink_to_fit();
+}
+
+void FtraceParser::ParseTypedFtraceArgs(
+    uint32_t ftrace_id,
+    ConstBytes blob,
+    PacketSequenceStateGeneration* seq_state,
+    ArgsTracker::BoundInserter* inserter) {
+  ProtoDecoder decoder(blob.data, blob.size);
+  MessageDescriptor* m = GetMessageDescriptorForId(ftrace_id);
+  const auto& message_strings = ftrace_message_strings_[ftrace_id];
 
   for (auto fld = decoder.ReadField(); fld.valid(); fld = decoder.ReadField()) {
     uint16_t field_id = fld.id();
@@ -641,6 +686,7 @@ void FtraceParser::ParseTypedFtraceToRaw(
         });
     if (it != kKernelFunctionFields.end()) {
       PERFETTO_CHECK(type == ProtoSchemaType::kUint64);
+      PERFETTO_DCHECK(seq_state);
 
       auto* interned_string = seq_state->LookupInternedMessage<
           protos::pbzero::InternedData::kKernelSymbolsFieldNumber,
@@ -653,7 +699,7 @@ void FtraceParser::ParseTypedFtraceToRaw(
         protozero::ConstBytes str = interned_string->str();
         StringId str_id = context_->storage->InternString(base::StringView(
             reinterpret_cast<const char*>(str.data), str.size));
-        inserter.AddArg(name_id, Variadic::String(str_id));
+        inserter->AddArg(name_id, Variadic::String(str_id));
         continue;
       }
     }
@@ -667,7 +713,7 @@ void FtraceParser::ParseTypedFtraceToRaw(
       case ProtoSchemaType::kSint64:
       case ProtoSchemaType::kBool:
       case ProtoSchemaType::kEnum: {
-        inserter.AddArg(name_id, Variadic::Integer(fld.as_int64()));
+        inserter->AddArg(name_id, Variadic::Integer(fld.as_int64()));
         break;
       }
       case ProtoSchemaType::kUint32:
@@ -677,21 +723,21 @@ void FtraceParser::ParseTypedFtraceToRaw(
         // Note that SQLite functions will still treat unsigned values
         // as a signed 64 bit integers (but the translation back to ftrace
         // refers to this storage directly).
-        inserter.AddArg(name_id, Variadic::UnsignedInteger(fld.as_uint64()));
+        inserter->AddArg(name_id, Variadic::UnsignedInteger(fld.as_uint64()));
         break;
       }
       case ProtoSchemaType::kString:
       case ProtoSchemaType::kBytes: {
         StringId value = context_->storage->InternString(fld.as_string());
-        inserter.AddArg(name_id, Variadic::String(value));
+        inserter->AddArg(name_id, Variadic::String(value));
         break;
       }
       case ProtoSchemaType::kDouble: {
-        inserter.AddArg(name_id, Variadic::Real(fld.as_double()));
+        inserter->AddArg(name_id, Variadic::Real(fld.as_double()));
         break;
       }
       case ProtoSchemaType::kFloat: {
-        inserter.AddArg(name_id,
+        inserter->AddArg(name_id,
                         Variadic::Real(static_cast<double>(fld.as_float())));
         break;
       }
@@ -735,6 +781,7 @@ void FtraceParser::ParseSchedWaking(int64_t timestamp, ConstBytes blob) {
       wakee_pid, name_id, ThreadNamePriority::kFtrace);
   context_->event_tracker->PushInstant(timestamp, sched_waking_name_id_, utid,
                                        RefType::kRefUtid);
+  ThreadStateTracker::GetOrCreate(context_)->PushSchedWaking(timestamp, utid);
 }
 
 void FtraceParser::ParseSchedProcessFree(int64_t timestamp, ConstBytes blob) {
@@ -1096,7 +1143,9 @@ void FtraceParser::ParseSysEvent(int64_t timestamp,
   if (is_enter) {
     syscall_tracker->Enter(timestamp, utid, syscall_num);
   } else {
-    syscall_tracker->Exit(timestamp, utid, syscall_num);
+    protos::pbzero::SysExitFtraceEvent::Decoder exit_evt(blob.data,
+                                                         blob.size);
+    syscall_tracker->Exit(timestamp, utid, syscall_num, exit_evt.ret());
   }
 
   // We are reusing the same function for sys_enter and sys_exit.
@@ -1459,12 +1508,16 @@ void FtraceParser::ParseSchedBlockedReason(
       protos::pbzero::InternedData::kKernelSymbolsFieldNumber,
       protos::pbzero::InternedString>(caller_iid);
 
+  base::Optional<StringId> blocked_function;
   if (interned_string) {
     protozero::ConstBytes str = interned_string->str();
     StringId str_id = context_->storage->InternString(
         base::StringView(reinterpret_cast<const char*>(str.data), str.size));
     inserter.AddArg(function_id_, Variadic::String(str_id));
+    blocked_function = str_id;
   }
+  ThreadStateTracker::GetOrCreate(context_)->PushSchedBlockedReason(
+      utid, evt.io_wait(), blocked_function);
 }
 
 void FtraceParser::ParseFastRpcDmaStat(int64_t timestamp,
@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_PARSER_H_
 
 #include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
 #include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
 #include "src/trace_processor/importers/ftrace/rss_stat_tracker.h"
@@ -37,6 +38,10 @@ class FtraceParser {
 
   util::Status ParseFtraceEvent(uint32_t cpu, const TimestampedTracePiece& ttp);
 
+  // Decodes the fields of the typed ftrace events whose args were deferred
+  // (see Config::lazy_ftrace_raw_args) into the args of their raw table rows.
+  void MaterializeRawArgs();
+
  private:
   void ParseGenericFtrace(int64_t timestamp,
                           uint32_t cpu,
@@ -48,6 +53,12 @@ class FtraceParser {
                              uint32_t pid,
                              protozero::ConstBytes,
                              PacketSequenceStateGeneration*);
+  // |seq_state| is only used for the events with kernel function fields, and
+  // can be null for all the other events.
+  void ParseTypedFtraceArgs(uint32_t ftrace_id,
+                            protozero::ConstBytes,
+                            PacketSequenceStateGeneration* seq_state,
+                            ArgsTracker::BoundInserter*);
   void ParseSchedSwitch(uint32_t cpu, int64_t timestamp, protozero::ConstBytes);
   void ParseSchedWakeup(int64_t timestamp, protozero::ConstBytes);
   void ParseSchedWaking(int64_t timestamp, protozero::ConstBytes);
@@ -190,6 +201,18 @@ class FtraceParser {
   };
   std::vector<FtraceMessageStrings> ftrace_message_strings_;
 
+  // A typed ftrace event whose fields are only decoded into args by
+  // MaterializeRawArgs(). The event is copied (as a proto) into
+  // |lazy_raw_args_bytes_|, which is much more compact than the args.
+  struct LazyRawArgs {
+    RawId raw_id;
+    uint32_t ftrace_id;
+    uint32_t size;
+    size_t offset;
+  };
+  std::vector<LazyRawArgs> lazy_raw_args_;
+  std::vector<uint8_t> lazy_raw_args_bytes_;
+
   struct MmEventCounterNames {
     MmEventCounterNames() = default;
     MmEventCounterNames(StringId _count, StringId _max_lat, StringId _avg_lat)
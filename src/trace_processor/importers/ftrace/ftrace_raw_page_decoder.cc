@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include "perfetto/protozero/proto_utils.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/generic.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using protozero::proto_utils::kMaxSimpleFieldEncodedSize;
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::MakeTagVarInt;
+using protozero::proto_utils::WriteVarInt;
+
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::GenericFtraceEvent;
+using RawPageFormat = protos::pbzero::FtraceEventBundle::RawPageFormat;
+using RawField = RawPageFormat::Field;
+
+// See linux/include/linux/ring_buffer.h and CpuReader::ParsePagePayload().
+constexpr uint32_t kTypeDataTypeLengthMax = 28;
+constexpr uint32_t kTypePadding = 29;
+constexpr uint32_t kTypeTimeExtend = 30;
+constexpr uint32_t kTypeTimeStamp = 31;
+
+// Mask for the data length portion of the |commit| field of the page header,
+// see CpuReader::ParsePageHeader().
+constexpr uint32_t kDataSizeMask = (1u << 27) - 1;
+
+bool ReadU32(const uint8_t** ptr, const uint8_t* end, uint32_t* value) {
+  if (static_cast<size_t>(end - *ptr) < sizeof(*value))
+    return false;
+  memcpy(value, *ptr, sizeof(*value));
+  *ptr += sizeof(*value);
+  return true;
+}
+
+void AppendVarInt(uint32_t field_id, uint64_t value, std::string* out) {
+  uint8_t buf[kMaxSimpleFieldEncodedSize];
+  uint8_t* end = WriteVarInt(MakeTagVarInt(field_id), buf);
+  end = WriteVarInt(value, end);
+  out->append(reinterpret_cast<const char*>(buf),
+              static_cast<size_t>(end - buf));
+}
+
+void AppendBytes(uint32_t field_id,
+                 const void* data,
+                 size_t size,
+                 std::string* out) {
+  uint8_t buf[kMaxSimpleFieldEncodedSize];
+  uint8_t* end = WriteVarInt(MakeTagLengthDelimited(field_id), buf);
+  end = WriteVarInt(size, end);
+  out->append(reinterpret_cast<const char*>(buf),
+              static_cast<size_t>(end - buf));
+  out->append(reinterpret_cast<const char*>(data), size);
+}
+
+// Appends the string in [start, end), stopping at the first null character.
+void AppendString(uint32_t field_id,
+                  const uint8_t* start,
+                  const uint8_t* end,
+                  std::string* out) {
+  const void* null_char = memchr(start, '\0', static_cast<size_t>(end - start));
+  if (null_char)
+    end = static_cast<const uint8_t*>(null_char);
+  AppendBytes(field_id, start, static_cast<size_t>(end - start), out);
+}
+
+// Same as CpuReader::TranslateBlockDeviceIDToUserspace().
+uint64_t TranslateBlockDeviceIDToUserspace(uint64_t kernel_dev) {
+  uint64_t maj = kernel_dev >> 20;
+  uint64_t min = kernel_dev & ((1U << 20) - 1);
+  return ((maj & 0xfffff000ULL) << 32) | ((maj & 0xfffULL) << 8) |
+         ((min & 0xffffff00ULL) << 12) | ((min & 0xffULL));
+}
+
+}  // namespace
+
+FtraceRawPageDecoder::FtraceRawPageDecoder() = default;
+FtraceRawPageDecoder::~FtraceRawPageDecoder() = default;
+
+void FtraceRawPageDecoder::SetFormat(protozero::ConstBytes format) {
+  auto parse_field = [](protozero::ConstBytes bytes) {
+    RawField::Decoder field(bytes);
+    return Field{field.name().ToStdString(), field.proto_field_id(),
+                 field.offset(), field.size(), field.type()};
+  };
+
+  RawPageFormat::Decoder decoder(format);
+  has_format_ = true;
+  page_header_size_len_ = decoder.page_header_size_len();
+  common_fields_.clear();
+  for (auto it = decoder.common_field(); it; ++it)
+    common_fields_.push_back(parse_field(*it));
+  events_by_id_.clear();
+  for (auto it = decoder.event(); it; ++it) {
+    RawPageFormat::Event::Decoder event_decoder(*it);
+    Event event{event_decoder.name().ToStdString(),
+                event_decoder.proto_field_id(),
+                {}};
+    for (auto field_it = event_decoder.field(); field_it; ++field_it)
+      event.fields.push_back(parse_field(*field_it));
+    events_by_id_[event_decoder.ftrace_event_id()] = std::move(event);
+  }
+}
+
+bool FtraceRawPageDecoder::DecodePage(protozero::ConstBytes page,
+                                      std::string* buf,
+                                      std::vector<EventRange>* events) {
+  const uint8_t* ptr = page.data;
+  const uint8_t* const page_end = page.data + page.size;
+
+  // The page header is a 64 bit timestamp followed by the 32 or 64 bit
+  // |commit| field, of which only the bottom 32 bits are relevant.
+  uint64_t timestamp;
+  uint32_t size_and_flags;
+  if (page_header_size_len_ < sizeof(size_and_flags) ||
+      page.size < sizeof(timestamp) + page_header_size_len_) {
+    return false;
+  }
+  memcpy(&timestamp, ptr, sizeof(timestamp));
+  memcpy(&size_and_flags, ptr + sizeof(timestamp), sizeof(size_and_flags));
+  ptr += sizeof(timestamp) + page_header_size_len_;
+  const size_t size = size_and_flags & kDataSizeMask;
+  if (size > static_cast<size_t>(page_end - ptr))
+    return false;
+  const uint8_t* const end = ptr + size;
+
+  while (ptr < end) {
+    uint32_t event_header;
+    if (!ReadU32(&ptr, end, &event_header))
+      return false;
+    const uint32_t type_or_length = event_header & 0x1f;
+    const uint32_t time_delta = event_header >> 5;
+    timestamp += time_delta;
+
+    switch (type_or_length) {
+      case kTypePadding: {
+        uint32_t length;
+        if (time_delta == 0 || !ReadU32(&ptr, end, &length) || length < 4 ||
+            length - 4 > static_cast<size_t>(end - ptr)) {
+          return false;
+        }
+        ptr += length - 4;
+        break;
+      }
+      case kTypeTimeExtend: {
+        uint32_t time_delta_ext;
+        if (!ReadU32(&ptr, end, &time_delta_ext))
+          return false;
+        timestamp += static_cast<uint64_t>(time_delta_ext) << 27;
+        break;
+      }
+      case kTypeTimeStamp: {
+        uint32_t time_delta_ext;
+        if (!ReadU32(&ptr, end, &time_delta_ext))
+          return false;
+        timestamp = time_delta + (static_cast<uint64_t>(time_delta_ext) << 27);
+        break;
+      }
+      default: {
+        static_assert(kTypePadding == kTypeDataTypeLengthMax + 1,
+                      "Data records are the types below padding");
+        uint32_t event_size = 4 * type_or_length;
+        if (type_or_length == 0) {
+          // Extended record, the size (which includes itself) follows.
+          if (!ReadU32(&ptr, end, &event_size) || event_size < 4)
+            return false;
+          event_size -= 4;
+        }
+        if (event_size > static_cast<size_t>(end - ptr))
+          return false;
+        DecodeEvent(ptr, ptr + event_size, timestamp, buf, events);
+        ptr += event_size;
+      }
+    }
+  }
+  return true;
+}
+
+void FtraceRawPageDecoder::DecodeEvent(const uint8_t* start,
+                                       const uint8_t* end,
+                                       uint64_t timestamp,
+                                       std::string* buf,
+                                       std::vector<EventRange>* events) {
+  uint16_t ftrace_event_id;
+  if (static_cast<size_t>(end - start) < sizeof(ftrace_event_id))
+    return;
+  memcpy(&ftrace_event_id, start, sizeof(ftrace_event_id));
+  auto it = events_by_id_.find(ftrace_event_id);
+  if (it == events_by_id_.end())
+    return;
+  const Event& event = it->second;
+
+  // Appends the value of |field| to |out|, unless it lies out of the event.
+  auto decode_field = [start, end](const Field& field, std::string* out) {
+    const size_t event_size = static_cast<size_t>(end - start);
+    if (field.offset > event_size || field.size > event_size - field.offset)
+      return;
+    const uint8_t* field_start = start + field.offset;
+    const uint8_t* field_end = field_start + field.size;
+    switch (field.type) {
+      case RawField::TYPE_UINT:
+      case RawField::TYPE_INT:
+      case RawField::TYPE_DEV_ID: {
+        if (field.size > sizeof(uint64_t))
+          return;
+        uint64_t value = 0;
+        memcpy(&value, field_start, field.size);
+        const uint32_t bits = field.size * 8;
+        if (field.type == RawField::TYPE_INT && bits > 0 && bits < 64 &&
+            (value >> (bits - 1)) & 1) {
+          value |= ~0ull << bits;
+        } else if (field.type == RawField::TYPE_DEV_ID) {
+          value = TranslateBlockDeviceIDToUserspace(value);
+        }
+        AppendVarInt(field.proto_field_id, value, out);
+        return;
+      }
+      case RawField::TYPE_FIXED_STRING:
+        AppendString(field.proto_field_id, field_start, field_end, out);
+        return;
+      case RawField::TYPE_CSTRING:
+        // Unlike the other strings, this one must be terminated.
+        if (memchr(field_start, '\0', static_cast<size_t>(end - field_start)))
+          AppendString(field.proto_field_id, field_start, end, out);
+        return;
+      case RawField::TYPE_DATA_LOC_STRING: {
+        // 16 bits offset from the start of the event, 16 bits length.
+        uint32_t data;
+        if (field.size != sizeof(data))
+          return;
+        memcpy(&data, field_start, sizeof(data));
+        const uint32_t offset = data & 0xffff;
+        const uint32_t length = data >> 16;
+        if (offset == 0 || offset > event_size ||
+            length > event_size - offset) {
+          return;
+        }
+        AppendString(field.proto_field_id, start + offset,
+                     start + offset + length, out);
+        return;
+      }
+    }
+  };
+
+  event_payload_.clear();
+  if (event.proto_field_id == FtraceEvent::kGenericFieldNumber) {
+    AppendBytes(GenericFtraceEvent::kEventNameFieldNumber, event.name.data(),
+                event.name.size(), &event_payload_);
+    for (const Field& field : event.fields) {
+      generic_field_.clear();
+      AppendBytes(GenericFtraceEvent::Field::kNameFieldNumber,
+                  field.name.data(), field.name.size(), &generic_field_);
+      decode_field(field, &generic_field_);
+      AppendBytes(GenericFtraceEvent::kFieldFieldNumber, generic_field_.data(),
+                  generic_field_.size(), &event_payload_);
+    }
+  } else {
+    for (const Field& field : event.fields)
+      decode_field(field, &event_payload_);
+  }
+
+  // The timestamp is written first, as FtraceTokenizer::TokenizeFtraceEvent()
+  // speculates on it.
+  const size_t offset = buf->size();
+  AppendVarInt(FtraceEvent::kTimestampFieldNumber, timestamp, buf);
+  for (const Field& field : common_fields_)
+    decode_field(field, buf);
+  AppendBytes(event.proto_field_id, event_payload_.data(),
+              event_payload_.size(), buf);
+  events->push_back(EventRange{offset, buf->size() - offset});
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/protozero/field.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Decodes the kernel ring buffer pages which traced_probes writes verbatim in
+// FtraceEventBundle.raw_page (see FtraceConfig.raw_page_passthrough) into
+// FtraceEvent protos, the same ones that traced_probes would have written, so
+// that the rest of the pipeline doesn't need to know about raw pages.
+// The layout of the events comes from FtraceEventBundle.raw_page_format.
+class FtraceRawPageDecoder {
+ public:
+  // The position of a decoded FtraceEvent in the output buffer.
+  struct EventRange {
+    size_t offset;
+    size_t size;
+  };
+
+  FtraceRawPageDecoder();
+  ~FtraceRawPageDecoder();
+
+  // Replaces the current layout with |format|, a serialized
+  // FtraceEventBundle.RawPageFormat.
+  void SetFormat(protozero::ConstBytes format);
+  bool has_format() const { return has_format_; }
+
+  // Appends the events of |page| to |buf|, each one serialized as a
+  // FtraceEvent, and their position in |buf| to |events|. The events not
+  // described by the format (e.g. enabled by a concurrent tracing session)
+  // are skipped, as are their fields which can't be decoded.
+  // Returns false if the page is malformed, keeping the events decoded until
+  // the error.
+  bool DecodePage(protozero::ConstBytes page,
+                  std::string* buf,
+                  std::vector<EventRange>* events);
+
+ private:
+  struct Field {
+    std::string name;
+    uint32_t proto_field_id;
+    uint32_t offset;
+    uint32_t size;
+    int32_t type;  // RawPageFormat.Field.Type.
+  };
+  struct Event {
+    std::string name;
+    uint32_t proto_field_id;
+    std::vector<Field> fields;
+  };
+
+  void DecodeEvent(const uint8_t* start,
+                   const uint8_t* end,
+                   uint64_t timestamp,
+                   std::string* buf,
+                   std::vector<EventRange>* events);
+
+  bool has_format_ = false;
+  uint32_t page_header_size_len_ = 8;
+  std::vector<Field> common_fields_;
+  std::unordered_map<uint32_t, Event> events_by_id_;
+
+  // The payload of the event being decoded and of its generic fields. Only
+  // members to reuse the allocations.
+  std::string event_payload_;
+  std::string generic_field_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
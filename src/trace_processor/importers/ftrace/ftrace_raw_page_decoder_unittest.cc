@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "protos/perfetto/trace/ftrace/ftrace.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/generic.pbzero.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::GenericFtraceEvent;
+using protos::pbzero::PrintFtraceEvent;
+using RawPageFormat = protos::pbzero::FtraceEventBundle::RawPageFormat;
+
+constexpr uint32_t kPrintId = 5;
+constexpr uint32_t kGenericId = 6;
+constexpr uint32_t kUnknownId = 7;
+
+// Builds the pages of a 64 bit kernel, i.e. with a 8 bytes |commit| field.
+class PageBuilder {
+ public:
+  explicit PageBuilder(uint64_t timestamp) { Append(timestamp); }
+
+  template <typename T>
+  void Append(T value) {
+    const char* ptr = reinterpret_cast<const char*>(&value);
+    data_.append(ptr, sizeof(T));
+  }
+
+  // |payload| is padded to a multiple of 4 bytes.
+  void AddEvent(uint32_t time_delta, std::string payload) {
+    payload.resize((payload.size() + 3) & ~3u);
+    events_.append(EventHeader(static_cast<uint32_t>(payload.size() / 4),
+                               time_delta));
+    events_.append(payload);
+  }
+
+  void AddTimeExtend(uint64_t delta) {
+    events_.append(EventHeader(30, static_cast<uint32_t>(delta) & 0x7ffffff));
+    uint32_t ext = static_cast<uint32_t>(delta >> 27);
+    events_.append(reinterpret_cast<const char*>(&ext), sizeof(ext));
+  }
+
+  std::string Build() const {
+    std::string page = data_;
+    uint64_t commit = events_.size();
+    page.append(reinterpret_cast<const char*>(&commit), sizeof(commit));
+    return page + events_;
+  }
+
+ private:
+  static std::string EventHeader(uint32_t type_or_length, uint32_t delta) {
+    uint32_t header = type_or_length | (delta << 5);
+    return std::string(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  std::string data_;
+  std::string events_;
+};
+
+// Returns the payload of an event with the common fields (type, flags,
+// preempt count, pid) followed by |fields|.
+std::string EventPayload(uint16_t type, int32_t pid, const std::string& fields) {
+  std::string payload(8, '\0');
+  memcpy(&payload[0], &type, sizeof(type));
+  memcpy(&payload[4], &pid, sizeof(pid));
+  return payload + fields;
+}
+
+template <typename T>
+std::string Bytes(T value) {
+  return std::string(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+class FtraceRawPageDecoderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    protozero::HeapBuffered<RawPageFormat> format;
+    format->set_page_header_size_len(8);
+    AddField(format->add_common_field(), "common_pid",
+             FtraceEvent::kPidFieldNumber, 4, 4, RawPageFormat::Field::TYPE_INT);
+
+    auto* print = format->add_event();
+    print->set_ftrace_event_id(kPrintId);
+    print->set_name("print");
+    print->set_proto_field_id(FtraceEvent::kPrintFieldNumber);
+    AddField(print->add_field(), "ip", PrintFtraceEvent::kIpFieldNumber, 8, 8,
+             RawPageFormat::Field::TYPE_UINT);
+    AddField(print->add_field(), "buf", PrintFtraceEvent::kBufFieldNumber, 16,
+             0, RawPageFormat::Field::TYPE_CSTRING);
+
+    auto* generic = format->add_event();
+    generic->set_ftrace_event_id(kGenericId);
+    generic->set_name("vendor_event");
+    generic->set_proto_field_id(FtraceEvent::kGenericFieldNumber);
+    AddField(generic->add_field(), "delta",
+             GenericFtraceEvent::Field::kIntValueFieldNumber, 8, 2,
+             RawPageFormat::Field::TYPE_INT);
+    AddField(generic->add_field(), "name",
+             GenericFtraceEvent::Field::kStrValueFieldNumber, 10, 6,
+             RawPageFormat::Field::TYPE_FIXED_STRING);
+
+    format_ = format.SerializeAsString();
+    decoder_.SetFormat(protozero::ConstBytes{
+        reinterpret_cast<const uint8_t*>(format_.data()), format_.size()});
+  }
+
+  static void AddField(RawPageFormat::Field* field,
+                       const char* name,
+                       uint32_t proto_field_id,
+                       uint32_t offset,
+                       uint32_t size,
+                       RawPageFormat::Field::Type type) {
+    field->set_name(name);
+    field->set_proto_field_id(proto_field_id);
+    field->set_offset(offset);
+    field->set_size(size);
+    field->set_type(type);
+  }
+
+  bool Decode(const std::string& page) {
+    return decoder_.DecodePage(
+        protozero::ConstBytes{reinterpret_cast<const uint8_t*>(page.data()),
+                              page.size()},
+        &buf_, &events_);
+  }
+
+  protozero::ConstBytes EventAt(size_t i) {
+    return protozero::ConstBytes{
+        reinterpret_cast<const uint8_t*>(buf_.data()) + events_[i].offset,
+        events_[i].size};
+  }
+
+  std::string format_;
+  FtraceRawPageDecoder decoder_;
+  std::string buf_;
+  std::vector<FtraceRawPageDecoder::EventRange> events_;
+};
+
+TEST_F(FtraceRawPageDecoderTest, DecodesKnownEvents) {
+  PageBuilder page(1000);
+  page.AddEvent(10, EventPayload(kPrintId, 42, Bytes<uint64_t>(0xabcd) +
+                                                   std::string("hello\0", 6)));
+  page.AddTimeExtend(1ull << 30);
+  page.AddEvent(5, EventPayload(kPrintId, -1, Bytes<uint64_t>(1) +
+                                                  std::string("\0", 1)));
+
+  ASSERT_TRUE(Decode(page.Build()));
+  ASSERT_EQ(events_.size(), 2u);
+
+  FtraceEvent::Decoder first(EventAt(0));
+  EXPECT_EQ(first.timestamp(), 1010u);
+  EXPECT_EQ(first.pid(), 42u);
+  PrintFtraceEvent::Decoder first_print(first.print());
+  EXPECT_EQ(first_print.ip(), 0xabcdu);
+  EXPECT_EQ(first_print.buf().ToStdString(), "hello");
+
+  FtraceEvent::Decoder second(EventAt(1));
+  EXPECT_EQ(second.timestamp(), 1010u + (1ull << 30) + 5);
+  EXPECT_EQ(static_cast<int32_t>(second.pid()), -1);
+  EXPECT_TRUE(second.has_print());
+}
+
+TEST_F(FtraceRawPageDecoderTest, DecodesGenericEvents) {
+  PageBuilder page(1000);
+  page.AddEvent(1, EventPayload(kGenericId, 42,
+                                Bytes<int16_t>(-2) + std::string("foo\0\0\0", 6)));
+
+  ASSERT_TRUE(Decode(page.Build()));
+  ASSERT_EQ(events_.size(), 1u);
+
+  FtraceEvent::Decoder event(EventAt(0));
+  GenericFtraceEvent::Decoder generic(event.generic());
+  EXPECT_EQ(generic.event_name().ToStdString(), "vendor_event");
+  auto it = generic.field();
+  ASSERT_TRUE(it);
+  GenericFtraceEvent::Field::Decoder delta(*it);
+  EXPECT_EQ(delta.name().ToStdString(), "delta");
+  EXPECT_EQ(delta.int_value(), -2);
+  ASSERT_TRUE(++it);
+  GenericFtraceEvent::Field::Decoder name(*it);
+  EXPECT_EQ(name.name().ToStdString(), "name");
+  EXPECT_EQ(name.str_value().ToStdString(), "foo");
+}
+
+TEST_F(FtraceRawPageDecoderTest, SkipsEventsNotInFormat) {
+  PageBuilder page(1000);
+  page.AddEvent(1, EventPayload(kUnknownId, 42, Bytes<uint64_t>(0)));
+  page.AddEvent(1, EventPayload(kPrintId, 42, Bytes<uint64_t>(0) +
+                                                  std::string("x\0", 2)));
+
+  ASSERT_TRUE(Decode(page.Build()));
+  ASSERT_EQ(events_.size(), 1u);
+  FtraceEvent::Decoder event(EventAt(0));
+  EXPECT_EQ(event.timestamp(), 1002u);
+  EXPECT_TRUE(event.has_print());
+}
+
+TEST_F(FtraceRawPageDecoderTest, RejectsTruncatedPage) {
+  PageBuilder page(1000);
+  page.AddEvent(1, EventPayload(kPrintId, 42, Bytes<uint64_t>(0) +
+                                                  std::string("x\0", 2)));
+  std::string data = page.Build();
+  data.resize(data.size() - 4);
+
+  EXPECT_FALSE(Decode(data));
+  EXPECT_TRUE(events_.empty());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -16,9 +16,14 @@
 
 #include "src/trace_processor/importers/ftrace/ftrace_tokenizer.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/trace_sorter.h"
@@ -50,6 +55,47 @@ PERFETTO_ALWAYS_INLINE base::Optional<int64_t> ResolveTraceTime(
   return context->clock_tracker->ToTraceTime(clock_id, ts);
 }
 
+// A column of FtraceEventBundle.CompactEvents, decoded.
+struct CompactColumn {
+  uint32_t field_id = 0;
+  bool is_string = false;
+  std::vector<uint64_t> values;
+};
+
+// Returns false if |bytes| is malformed, or doesn't have |rows| values, or
+// has string indexes out of the intern table.
+bool DecodeCompactColumn(protozero::ConstBytes bytes,
+                         size_t rows,
+                         size_t intern_table_size,
+                         CompactColumn* column) {
+  using Column = FtraceEventBundle::CompactEvents::Column;
+  Column::Decoder decoder(bytes);
+  column->field_id = decoder.field_id();
+  column->is_string = decoder.has_string_index();
+  const protozero::Field& values =
+      column->is_string ? decoder.at<Column::kStringIndexFieldNumber>()
+                        : decoder.at<Column::kValueFieldNumber>();
+  if (!protozero::DecodePackedVarInts(values.data(), values.size(),
+                                      &column->values)) {
+    return false;
+  }
+  if (column->is_string) {
+    for (uint64_t index : column->values) {
+      if (index >= intern_table_size)
+        return false;
+    }
+  }
+  return column->field_id != 0 && column->values.size() == rows;
+}
+
+// Decodes the packed varint field |field| of a CompactSched into |out|.
+template <typename T>
+bool DecodeCompactSchedField(const protozero::Field& field,
+                             std::vector<T>* out) {
+  out->clear();
+  return protozero::DecodePackedVarInts(field.data(), field.size(), out);
+}
+
 }  // namespace
 
 PERFETTO_ALWAYS_INLINE
@@ -58,6 +104,13 @@ base::Status FtraceTokenizer::TokenizeFtraceBundle(TraceBlobView bundle,
   protos::pbzero::FtraceEventBundle::Decoder decoder(bundle.data(),
                                                      bundle.length());
 
+  // The format of the raw pages is written in a bundle of its own, without
+  // cpu.
+  if (PERFETTO_UNLIKELY(decoder.has_raw_page_format())) {
+    raw_page_decoder_.SetFormat(decoder.raw_page_format());
+    return base::OkStatus();
+  }
+
   if (PERFETTO_UNLIKELY(!decoder.has_cpu())) {
     PERFETTO_ELOG("CPU field not found in FtraceEventBundle");
     context_->storage->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
@@ -85,10 +138,19 @@ base::Status FtraceTokenizer::TokenizeFtraceBundle(TraceBlobView bundle,
           "Unable to parse ftrace packets with unknown clock");
   }
 
+  if (PERFETTO_UNLIKELY(decoder.has_raw_page())) {
+    TokenizeFtraceRawPages(cpu, clock_id, decoder, state);
+  }
+
   if (decoder.has_compact_sched()) {
     TokenizeFtraceCompactSched(cpu, clock_id, decoder.compact_sched());
   }
 
+  if (decoder.has_compact_events()) {
+    TokenizeFtraceCompactEvents(cpu, clock_id, decoder.compact_events(),
+                                state);
+  }
+
   for (auto it = decoder.event(); it; ++it) {
     size_t off = bundle.offset_of(it->data());
     TokenizeFtraceEvent(cpu, clock_id, bundle.slice(off, it->size()), state);
@@ -142,6 +204,156 @@ void FtraceTokenizer::TokenizeFtraceEvent(uint32_t cpu,
   context_->sorter->PushFtraceEvent(cpu, *timestamp, std::move(event), state);
 }
 
+void FtraceTokenizer::TokenizeFtraceRawPages(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    const FtraceEventBundle::Decoder& decoder,
+    PacketSequenceState* state) {
+  if (!raw_page_decoder_.has_format()) {
+    for (auto it = decoder.raw_page(); it; ++it)
+      context_->storage->IncrementStats(stats::ftrace_raw_page_no_format);
+    return;
+  }
+
+  raw_page_events_buf_.clear();
+  raw_page_events_.clear();
+  for (auto it = decoder.raw_page(); it; ++it) {
+    if (!raw_page_decoder_.DecodePage(*it, &raw_page_events_buf_,
+                                      &raw_page_events_)) {
+      PERFETTO_ELOG("Failed to decode raw ftrace page");
+      context_->storage->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
+    }
+  }
+  if (raw_page_events_.empty())
+    return;
+
+  // The decoded events are moved into a buffer of their own, which the
+  // TraceBlobViews pushed into the sorter share.
+  std::unique_ptr<uint8_t[]> events_buf(
+      new uint8_t[raw_page_events_buf_.size()]);
+  memcpy(events_buf.get(), raw_page_events_buf_.data(),
+         raw_page_events_buf_.size());
+  TraceBlobView events(std::move(events_buf), 0, raw_page_events_buf_.size());
+  for (const FtraceRawPageDecoder::EventRange& range : raw_page_events_) {
+    TokenizeFtraceEvent(cpu, clock_id, events.slice(range.offset, range.size),
+                        state);
+  }
+}
+
+// The compact events are turned back into the FtraceEvent protos which
+// traced_probes would have written without FtraceConfig.compact_events, so that
+// the parsing doesn't need to know about them. Unlike compact_sched, which
+// covers a handful of events with a dedicated inline representation, these can
+// be of any type.
+void FtraceTokenizer::TokenizeFtraceCompactEvents(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    protozero::ConstBytes packet,
+    PacketSequenceState* state) {
+  using CompactEvents = FtraceEventBundle::CompactEvents;
+  CompactEvents::Decoder compact(packet);
+
+  std::vector<protozero::ConstChars> string_table;
+  for (auto it = compact.intern_table(); it; ++it)
+    string_table.push_back(*it);
+
+  struct EventType {
+    uint32_t event_field_id;
+    std::vector<uint64_t> timestamps;
+    std::vector<CompactColumn> common_columns;
+    std::vector<CompactColumn> columns;
+  };
+  std::vector<EventType> event_types;
+  for (auto type_it = compact.event_type(); type_it; ++type_it) {
+    CompactEvents::EventType::Decoder type_decoder(*type_it);
+    EventType event_type;
+    event_type.event_field_id = type_decoder.event_field_id();
+
+    // Delta-encoded timestamps.
+    bool parse_error = false;
+    uint64_t timestamp_acc = 0;
+    for (auto it = type_decoder.timestamp(&parse_error); it; ++it) {
+      timestamp_acc += *it;
+      event_type.timestamps.push_back(timestamp_acc);
+    }
+
+    const size_t rows = event_type.timestamps.size();
+    bool valid = !parse_error && event_type.event_field_id != 0;
+    for (auto it = type_decoder.common_column(); it && valid; ++it) {
+      event_type.common_columns.emplace_back();
+      valid = DecodeCompactColumn(*it, rows, string_table.size(),
+                                  &event_type.common_columns.back());
+    }
+    for (auto it = type_decoder.column(); it && valid; ++it) {
+      event_type.columns.emplace_back();
+      valid = DecodeCompactColumn(*it, rows, string_table.size(),
+                                  &event_type.columns.back());
+    }
+    if (!valid) {
+      PERFETTO_ELOG("Malformed compact ftrace events");
+      context_->storage->IncrementStats(stats::ftrace_bundle_tokenizer_errors);
+      continue;
+    }
+    event_types.push_back(std::move(event_type));
+  }
+
+  // The events of each type are in timestamp order, merge them so that they
+  // are pushed into the sorter in order too.
+  struct Row {
+    uint64_t timestamp;
+    uint32_t event_type;
+    uint32_t index;
+  };
+  std::vector<Row> rows;
+  for (uint32_t i = 0; i < event_types.size(); i++) {
+    const auto& timestamps = event_types[i].timestamps;
+    for (uint32_t j = 0; j < timestamps.size(); j++)
+      rows.push_back(Row{timestamps[j], i, j});
+  }
+  if (rows.empty())
+    return;
+  std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    return a.timestamp < b.timestamp;
+  });
+
+  auto append_column = [&string_table](const CompactColumn& column,
+                                        size_t index,
+                                        protozero::Message* msg) {
+    if (column.is_string) {
+      const protozero::ConstChars& str = string_table[column.values[index]];
+      msg->AppendBytes(column.field_id, str.data, str.size);
+    } else {
+      msg->AppendVarInt(column.field_id, column.values[index]);
+    }
+  };
+
+  protozero::HeapBuffered<FtraceEventBundle> bundle;
+  for (const Row& row : rows) {
+    const EventType& event_type = event_types[row.event_type];
+    // The timestamp is written first, as TokenizeFtraceEvent() speculates on
+    // it.
+    auto* event = bundle->add_event();
+    event->set_timestamp(row.timestamp);
+    for (const CompactColumn& column : event_type.common_columns)
+      append_column(column, row.index, event);
+    auto* nested = event->BeginNestedMessage<protozero::Message>(
+        event_type.event_field_id);
+    for (const CompactColumn& column : event_type.columns)
+      append_column(column, row.index, nested);
+  }
+
+  // The TraceBlobViews pushed into the sorter share the rebuilt bundle.
+  std::vector<uint8_t> serialized = bundle.SerializeAsArray();
+  std::unique_ptr<uint8_t[]> events_buf(new uint8_t[serialized.size()]);
+  memcpy(events_buf.get(), serialized.data(), serialized.size());
+  TraceBlobView events(std::move(events_buf), 0, serialized.size());
+  FtraceEventBundle::Decoder decoder(events.data(), events.length());
+  for (auto it = decoder.event(); it; ++it) {
+    size_t off = events.offset_of(it->data());
+    TokenizeFtraceEvent(cpu, clock_id, events.slice(off, it->size()), state);
+  }
+}
+
 PERFETTO_ALWAYS_INLINE
 void FtraceTokenizer::TokenizeFtraceCompactSched(uint32_t cpu,
                                                  ClockTracker::ClockId clock_id,
@@ -165,44 +377,72 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedSwitch(
     ClockTracker::ClockId clock_id,
     const FtraceEventBundle::CompactSched::Decoder& compact,
     const std::vector<StringId>& string_table) {
-  // Accumulator for timestamp deltas.
-  int64_t timestamp_acc = 0;
+  using CompactSched = FtraceEventBundle::CompactSched;
 
   // The events' fields are stored in a structure-of-arrays style, using packed
-  // repeated fields. Walk each repeated field in step to recover individual
-  // events.
+  // repeated fields. Decode each of them at once, then walk them in step to
+  // recover individual events, which are then pushed to the sorter as a
+  // single sorted run.
   bool parse_error = false;
-  auto timestamp_it = compact.switch_timestamp(&parse_error);
-  auto pstate_it = compact.switch_prev_state(&parse_error);
-  auto npid_it = compact.switch_next_pid(&parse_error);
-  auto nprio_it = compact.switch_next_prio(&parse_error);
-  auto comm_it = compact.switch_next_comm_index(&parse_error);
-  for (; timestamp_it && pstate_it && npid_it && nprio_it && comm_it;
-       ++timestamp_it, ++pstate_it, ++npid_it, ++nprio_it, ++comm_it) {
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kSwitchTimestampFieldNumber>(),
+      &compact_sched_timestamp_deltas_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kSwitchPrevStateFieldNumber>(),
+      &compact_sched_prev_states_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kSwitchNextPidFieldNumber>(),
+      &compact_sched_pids_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kSwitchNextPrioFieldNumber>(),
+      &compact_sched_prios_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kSwitchNextCommIndexFieldNumber>(),
+      &compact_sched_comm_indices_);
+  const size_t size = compact_sched_timestamp_deltas_.size();
+  const bool sizes_match = compact_sched_prev_states_.size() == size &&
+                           compact_sched_pids_.size() == size &&
+                           compact_sched_prios_.size() == size &&
+                           compact_sched_comm_indices_.size() == size;
+  const size_t num_events = std::min(
+      {size, compact_sched_prev_states_.size(), compact_sched_pids_.size(),
+       compact_sched_prios_.size(), compact_sched_comm_indices_.size()});
+
+  // Accumulator for timestamp deltas.
+  int64_t timestamp_acc = 0;
+  bool clock_error = false;
+  compact_sched_timestamps_.clear();
+  compact_sched_switches_.clear();
+  for (size_t i = 0; i < num_events; i++) {
     InlineSchedSwitch event{};
 
     // delta-encoded timestamp
-    timestamp_acc += static_cast<int64_t>(*timestamp_it);
+    timestamp_acc += static_cast<int64_t>(compact_sched_timestamp_deltas_[i]);
     int64_t event_timestamp = timestamp_acc;
 
     // index into the interned string table
-    PERFETTO_DCHECK(*comm_it < string_table.size());
-    event.next_comm = string_table[*comm_it];
+    PERFETTO_DCHECK(compact_sched_comm_indices_[i] < string_table.size());
+    event.next_comm = string_table[compact_sched_comm_indices_[i]];
 
-    event.prev_state = *pstate_it;
-    event.next_pid = *npid_it;
-    event.next_prio = *nprio_it;
+    event.prev_state = compact_sched_prev_states_[i];
+    event.next_pid = compact_sched_pids_[i];
+    event.next_prio = compact_sched_prios_[i];
 
     base::Optional<int64_t> timestamp =
         ResolveTraceTime(context_, clock_id, event_timestamp);
-    if (!timestamp)
-      return;
-    context_->sorter->PushInlineFtraceEvent(cpu, *timestamp, event);
+    if (!timestamp) {
+      clock_error = true;
+      break;
+    }
+    compact_sched_timestamps_.push_back(*timestamp);
+    compact_sched_switches_.push_back(event);
   }
+  context_->sorter->PushInlineFtraceEvents(cpu, compact_sched_timestamps_,
+                                           compact_sched_switches_);
+  if (clock_error)
+    return;
 
   // Check that all packed buffers were decoded correctly, and fully.
-  bool sizes_match =
-      !timestamp_it && !pstate_it && !npid_it && !nprio_it && !comm_it;
   if (parse_error || !sizes_match)
     context_->storage->IncrementStats(stats::compact_sched_has_parse_errors);
 }
@@ -212,45 +452,70 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedWaking(
     ClockTracker::ClockId clock_id,
     const FtraceEventBundle::CompactSched::Decoder& compact,
     const std::vector<StringId>& string_table) {
-  // Accumulator for timestamp deltas.
-  int64_t timestamp_acc = 0;
+  using CompactSched = FtraceEventBundle::CompactSched;
 
   // The events' fields are stored in a structure-of-arrays style, using packed
-  // repeated fields. Walk each repeated field in step to recover individual
-  // events.
+  // repeated fields. Decode each of them at once, then walk them in step to
+  // recover individual events.
   bool parse_error = false;
-  auto timestamp_it = compact.waking_timestamp(&parse_error);
-  auto pid_it = compact.waking_pid(&parse_error);
-  auto tcpu_it = compact.waking_target_cpu(&parse_error);
-  auto prio_it = compact.waking_prio(&parse_error);
-  auto comm_it = compact.waking_comm_index(&parse_error);
-
-  for (; timestamp_it && pid_it && tcpu_it && prio_it && comm_it;
-       ++timestamp_it, ++pid_it, ++tcpu_it, ++prio_it, ++comm_it) {
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kWakingTimestampFieldNumber>(),
+      &compact_sched_timestamp_deltas_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kWakingPidFieldNumber>(), &compact_sched_pids_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kWakingTargetCpuFieldNumber>(),
+      &compact_sched_target_cpus_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kWakingPrioFieldNumber>(),
+      &compact_sched_prios_);
+  parse_error |= !DecodeCompactSchedField(
+      compact.at<CompactSched::kWakingCommIndexFieldNumber>(),
+      &compact_sched_comm_indices_);
+  const size_t size = compact_sched_timestamp_deltas_.size();
+  const bool sizes_match = compact_sched_pids_.size() == size &&
+                           compact_sched_target_cpus_.size() == size &&
+                           compact_sched_prios_.size() == size &&
+                           compact_sched_comm_indices_.size() == size;
+  const size_t num_events = std::min(
+      {size, compact_sched_pids_.size(), compact_sched_target_cpus_.size(),
+       compact_sched_prios_.size(), compact_sched_comm_indices_.size()});
+
+  // Accumulator for timestamp deltas.
+  int64_t timestamp_acc = 0;
+  bool clock_error = false;
+  compact_sched_timestamps_.clear();
+  compact_sched_wakings_.clear();
+  for (size_t i = 0; i < num_events; i++) {
     InlineSchedWaking event{};
 
     // delta-encoded timestamp
-    timestamp_acc += static_cast<int64_t>(*timestamp_it);
+    timestamp_acc += static_cast<int64_t>(compact_sched_timestamp_deltas_[i]);
     int64_t event_timestamp = timestamp_acc;
 
     // index into the interned string table
-    PERFETTO_DCHECK(*comm_it < string_table.size());
-    event.comm = string_table[*comm_it];
+    PERFETTO_DCHECK(compact_sched_comm_indices_[i] < string_table.size());
+    event.comm = string_table[compact_sched_comm_indices_[i]];
 
-    event.pid = *pid_it;
-    event.target_cpu = *tcpu_it;
-    event.prio = *prio_it;
+    event.pid = compact_sched_pids_[i];
+    event.target_cpu = compact_sched_target_cpus_[i];
+    event.prio = compact_sched_prios_[i];
 
     base::Optional<int64_t> timestamp =
         ResolveTraceTime(context_, clock_id, event_timestamp);
-    if (!timestamp)
-      return;
-    context_->sorter->PushInlineFtraceEvent(cpu, *timestamp, event);
+    if (!timestamp) {
+      clock_error = true;
+      break;
+    }
+    compact_sched_timestamps_.push_back(*timestamp);
+    compact_sched_wakings_.push_back(event);
   }
+  context_->sorter->PushInlineFtraceEvents(cpu, compact_sched_timestamps_,
+                                           compact_sched_wakings_);
+  if (clock_error)
+    return;
 
   // Check that all packed buffers were decoded correctly, and fully.
-  bool sizes_match =
-      !timestamp_it && !pid_it && !tcpu_it && !prio_it && !comm_it;
   if (parse_error || !sizes_match)
     context_->storage->IncrementStats(stats::compact_sched_has_parse_errors);
 }
@@ -19,7 +19,9 @@
 
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
 #include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/timestamped_trace_piece.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 #include "src/trace_processor/util/trace_blob_view.h"
 
@@ -40,6 +42,15 @@ class FtraceTokenizer {
                            ClockTracker::ClockId,
                            TraceBlobView event,
                            PacketSequenceState*);
+  void TokenizeFtraceRawPages(
+      uint32_t cpu,
+      ClockTracker::ClockId,
+      const protos::pbzero::FtraceEventBundle::Decoder& bundle,
+      PacketSequenceState*);
+  void TokenizeFtraceCompactEvents(uint32_t cpu,
+                                   ClockTracker::ClockId,
+                                   protozero::ConstBytes,
+                                   PacketSequenceState*);
   void TokenizeFtraceCompactSched(uint32_t cpu,
                                   ClockTracker::ClockId,
                                   protozero::ConstBytes);
@@ -55,6 +66,28 @@ class FtraceTokenizer {
       const std::vector<StringId>& string_table);
 
   TraceProcessorContext* context_;
+
+  // The compact sched events of the block being tokenized. Kept across
+  // bundles to reuse the allocations.
+  std::vector<int64_t> compact_sched_timestamps_;
+  std::vector<InlineSchedSwitch> compact_sched_switches_;
+  std::vector<InlineSchedWaking> compact_sched_wakings_;
+  // The decoded fields of the compact sched events of the bundle being
+  // tokenized, also kept across bundles.
+  std::vector<uint64_t> compact_sched_timestamp_deltas_;
+  std::vector<int64_t> compact_sched_prev_states_;
+  std::vector<int32_t> compact_sched_pids_;
+  std::vector<int32_t> compact_sched_target_cpus_;
+  std::vector<int32_t> compact_sched_prios_;
+  std::vector<uint32_t> compact_sched_comm_indices_;
+
+  // Decodes the bundles written with FtraceConfig.raw_page_passthrough. The
+  // events of the bundle being tokenized are decoded into
+  // |raw_page_events_buf_|, both are kept across bundles to reuse the
+  // allocations.
+  FtraceRawPageDecoder raw_page_decoder_;
+  std::string raw_page_events_buf_;
+  std::vector<FtraceRawPageDecoder::EventRange> raw_page_events_;
 };
 
 }  // namespace trace_processor
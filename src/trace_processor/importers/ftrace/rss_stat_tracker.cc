@@ -18,6 +18,7 @@
 
 #include "src/trace_processor/importers/common/event_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
+#include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
 #include "protos/perfetto/trace/ftrace/kmem.pbzero.h"
@@ -77,13 +78,128 @@ void RssStatTracker::ParseRssStat(int64_t ts,
   }
 
   if (utid) {
-    context_->event_tracker->PushProcessCounterForThread(
-        ts, static_cast<double>(size), rss_members_[member], *utid);
+    PushCounter(ts, static_cast<double>(size), member, *utid);
   } else {
     context_->storage->IncrementStats(stats::rss_stat_unknown_thread_for_mm_id);
   }
 }
 
+void RssStatTracker::PushCounter(int64_t ts,
+                                 double value,
+                                 uint32_t member,
+                                 UniqueTid utid) {
+  const Config& config = context_->config;
+  int64_t resolution = config.rss_stat_resolution_ns;
+  if (!config.coalesce_rss_stat_counters && resolution <= 0) {
+    InsertCounter(ts, value, member, utid);
+    return;
+  }
+
+  // The samples are coalesced per process counter track, which is only known
+  // if the process of the thread is. Otherwise, the sample may belong to any
+  // track: keep it and start again on all of them.
+  base::Optional<UniquePid> upid =
+      context_->storage->thread_table().upid()[utid];
+  if (!upid) {
+    generation_++;
+    InsertCounter(ts, value, member, utid);
+    return;
+  }
+
+  size_t idx = *upid * rss_members_.size() + member;
+  if (idx >= counter_states_.size())
+    counter_states_.resize(idx + 1);
+  CounterState* state = &counter_states_[idx];
+  if (state->generation != generation_) {
+    base::Optional<uint32_t> row = InsertCounter(ts, value, member, utid);
+    if (!row)
+      return;
+    *state = CounterState();
+    state->generation = generation_;
+    StartBucket(state, resolution > 0 ? ts / resolution : 0, ts, value, *row);
+    return;
+  }
+
+  if (resolution > 0) {
+    PushDownsampledCounter(state, ts, value, member, utid);
+    return;
+  }
+  if (value == state->last_value) {
+    context_->storage->IncrementStats(stats::rss_stat_coalesced);
+    return;
+  }
+  if (InsertCounter(ts, value, member, utid))
+    state->last_value = value;
+}
+
+void RssStatTracker::PushDownsampledCounter(CounterState* state,
+                                            int64_t ts,
+                                            double value,
+                                            uint32_t member,
+                                            UniqueTid utid) {
+  // The first sample of each bucket is always kept.
+  int64_t bucket = ts / context_->config.rss_stat_resolution_ns;
+  if (bucket != state->bucket) {
+    base::Optional<uint32_t> row = InsertCounter(ts, value, member, utid);
+    if (row)
+      StartBucket(state, bucket, ts, value, *row);
+    return;
+  }
+
+  if (value >= state->min && value <= state->max) {
+    context_->storage->IncrementStats(stats::rss_stat_coalesced);
+    return;
+  }
+  if (state->num_rows == 1) {
+    base::Optional<uint32_t> row = InsertCounter(ts, value, member, utid);
+    if (!row)
+      return;
+    state->rows[1] = *row;
+    state->num_rows = 2;
+  } else {
+    context_->storage->IncrementStats(stats::rss_stat_coalesced);
+  }
+  if (value < state->min) {
+    state->min = value;
+    state->min_ts = ts;
+  } else {
+    state->max = value;
+    state->max_ts = ts;
+  }
+
+  // The two rows of the bucket hold its extremes in the order in which they
+  // were reached.
+  bool min_first = state->min_ts < state->max_ts;
+  auto* values = context_->storage->mutable_counter_table()->mutable_value();
+  values->Set(state->rows[0], min_first ? state->min : state->max);
+  values->Set(state->rows[1], min_first ? state->max : state->min);
+}
+
+void RssStatTracker::StartBucket(CounterState* state,
+                                 int64_t bucket,
+                                 int64_t ts,
+                                 double value,
+                                 uint32_t row) {
+  state->last_value = value;
+  state->bucket = bucket;
+  state->rows[0] = row;
+  state->num_rows = 1;
+  state->min = state->max = value;
+  state->min_ts = state->max_ts = ts;
+}
+
+base::Optional<uint32_t> RssStatTracker::InsertCounter(int64_t ts,
+                                                       double value,
+                                                       uint32_t member,
+                                                       UniqueTid utid) {
+  base::Optional<CounterId> id =
+      context_->event_tracker->PushProcessCounterForThread(
+          ts, value, rss_members_[member], utid);
+  if (!id)
+    return base::nullopt;
+  return context_->storage->counter_table().id().IndexOf(*id);
+}
+
 base::Optional<UniqueTid> RssStatTracker::FindUtidForMmId(int64_t mm_id,
                                                           bool is_curr,
                                                           uint32_t pid) {
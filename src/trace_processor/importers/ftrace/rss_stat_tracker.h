@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_RSS_STAT_TRACKER_H_
 
 #include <unordered_map>
+#include <vector>
 
 #include "perfetto/protozero/field.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -42,12 +43,58 @@ class RssStatTracker {
                     base::Optional<int64_t> mm_id);
 
  private:
+  // The samples kept for a process counter track, to coalesce and downsample
+  // the following ones (see Config::coalesce_rss_stat_counters and
+  // Config::rss_stat_resolution_ns).
+  struct CounterState {
+    // The state is only valid if this is equal to |generation_|.
+    uint64_t generation = 0;
+
+    // The value of the last row inserted for the track, when only coalescing.
+    double last_value = 0;
+
+    // The bucket of the last rows when downsampling, with their rows in the
+    // counter table and the extremes of the samples of the bucket.
+    int64_t bucket = 0;
+    uint32_t rows[2] = {};
+    uint32_t num_rows = 0;
+    double min = 0;
+    double max = 0;
+    int64_t min_ts = 0;
+    int64_t max_ts = 0;
+  };
+
   base::Optional<UniqueTid> FindUtidForMmId(int64_t mm_id,
                                             bool is_curr,
                                             uint32_t pid);
 
+  void PushCounter(int64_t ts, double value, uint32_t member, UniqueTid utid);
+  void PushDownsampledCounter(CounterState*,
+                              int64_t ts,
+                              double value,
+                              uint32_t member,
+                              UniqueTid utid);
+  void StartBucket(CounterState*,
+                   int64_t bucket,
+                   int64_t ts,
+                   double value,
+                   uint32_t row);
+  base::Optional<uint32_t> InsertCounter(int64_t ts,
+                                         double value,
+                                         uint32_t member,
+                                         UniqueTid utid);
+
   std::unordered_map<int64_t, UniqueTid> mm_id_to_utid_;
   std::vector<StringId> rss_members_;
+
+  // Indexed by upid * rss_members_.size() + member: the process counter
+  // tracks are only created at the end of the trace, once the processes of
+  // all the threads are known.
+  std::vector<CounterState> counter_states_;
+
+  // Incremented to invalidate all the |counter_states_|.
+  uint64_t generation_ = 1;
+
   TraceProcessorContext* const context_;
 };
 
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/rss_stat_tracker.h"
+
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/common/event_tracker.h"
+#include "src/trace_processor/importers/common/process_tracker.h"
+#include "src/trace_processor/importers/common/track_tracker.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr uint32_t kPid = 10;
+constexpr uint32_t kFileMember = 0;
+
+class RssStatTrackerTest : public ::testing::Test {
+ public:
+  RssStatTrackerTest() {
+    context_.storage.reset(new TraceStorage());
+    context_.global_args_tracker.reset(new GlobalArgsTracker(&context_));
+    context_.args_tracker.reset(new ArgsTracker(&context_));
+    context_.event_tracker.reset(new EventTracker(&context_));
+    context_.process_tracker.reset(new ProcessTracker(&context_));
+    context_.track_tracker.reset(new TrackTracker(&context_));
+  }
+
+  void Push(RssStatTracker* tracker, int64_t ts, int64_t size) {
+    tracker->ParseRssStat(ts, kPid, size, kFileMember, base::nullopt,
+                          base::nullopt);
+  }
+
+  std::vector<int64_t> Timestamps() {
+    const auto& counters = context_.storage->counter_table();
+    std::vector<int64_t> res;
+    for (uint32_t i = 0; i < counters.row_count(); ++i)
+      res.push_back(counters.ts()[i]);
+    return res;
+  }
+
+  std::vector<double> Values() {
+    const auto& counters = context_.storage->counter_table();
+    std::vector<double> res;
+    for (uint32_t i = 0; i < counters.row_count(); ++i)
+      res.push_back(counters.value()[i]);
+    return res;
+  }
+
+  int64_t coalesced() {
+    return context_.storage->stats()[stats::rss_stat_coalesced].value;
+  }
+
+ protected:
+  TraceProcessorContext context_;
+};
+
+TEST_F(RssStatTrackerTest, KeepsAllSamplesByDefault) {
+  context_.process_tracker->UpdateThread(kPid, kPid);
+  RssStatTracker tracker(&context_);
+  Push(&tracker, 10, 100);
+  Push(&tracker, 20, 100);
+  Push(&tracker, 30, 200);
+
+  EXPECT_THAT(Values(), ElementsAre(100, 100, 200));
+  EXPECT_EQ(coalesced(), 0);
+}
+
+TEST_F(RssStatTrackerTest, Coalesce) {
+  context_.config.coalesce_rss_stat_counters = true;
+  context_.process_tracker->UpdateThread(kPid, kPid);
+  RssStatTracker tracker(&context_);
+  Push(&tracker, 10, 100);
+  Push(&tracker, 20, 100);
+  Push(&tracker, 30, 200);
+  Push(&tracker, 40, 200);
+  Push(&tracker, 50, 100);
+
+  EXPECT_THAT(Timestamps(), ElementsAre(10, 30, 50));
+  EXPECT_THAT(Values(), ElementsAre(100, 200, 100));
+  EXPECT_EQ(coalesced(), 2);
+}
+
+TEST_F(RssStatTrackerTest, CoalesceOnlyKnownProcesses) {
+  context_.config.coalesce_rss_stat_counters = true;
+  RssStatTracker tracker(&context_);
+  Push(&tracker, 10, 100);
+  Push(&tracker, 20, 100);
+
+  // The track of the samples is not known until the end of the trace.
+  EXPECT_THAT(Values(), ElementsAre(100, 100));
+  EXPECT_EQ(coalesced(), 0);
+}
+
+TEST_F(RssStatTrackerTest, Downsample) {
+  context_.config.rss_stat_resolution_ns = 100;
+  context_.process_tracker->UpdateThread(kPid, kPid);
+  RssStatTracker tracker(&context_);
+
+  // The max of the first bucket is reached before its min.
+  Push(&tracker, 0, 100);
+  Push(&tracker, 10, 150);
+  Push(&tracker, 20, 50);
+  Push(&tracker, 30, 120);
+  Push(&tracker, 40, 150);
+
+  // A bucket with a single distinct value.
+  Push(&tracker, 150, 120);
+  Push(&tracker, 160, 120);
+
+  // The min of the third bucket is reached before its max.
+  Push(&tracker, 200, 100);
+  Push(&tracker, 210, 90);
+  Push(&tracker, 220, 80);
+  Push(&tracker, 230, 110);
+
+  EXPECT_THAT(Timestamps(), ElementsAre(0, 10, 150, 200, 210));
+  EXPECT_THAT(Values(), ElementsAre(150, 50, 120, 80, 110));
+  EXPECT_EQ(coalesced(), 6);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -24,6 +24,7 @@
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/system_info_tracker.h"
 #include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
+#include "src/trace_processor/importers/ftrace/thread_state_tracker.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/types/task_state.h"
 #include "src/trace_processor/types/trace_processor_context.h"
@@ -35,8 +36,15 @@
 namespace perfetto {
 namespace trace_processor {
 
+namespace {
+constexpr size_t kSchedBatchSize = 1024;
+}  // namespace
+
+constexpr uint16_t SchedEventTracker::kMaxTaskState;
+
 SchedEventTracker::SchedEventTracker(TraceProcessorContext* context)
-    : context_(context) {
+    : thread_state_tracker_(ThreadStateTracker::GetOrCreate(context)),
+      context_(context) {
   // pre-parse sched_switch
   auto* switch_descriptor = GetMessageDescriptorForId(
       protos::pbzero::FtraceEvent::kSchedSwitchFieldNumber);
@@ -58,6 +66,10 @@ SchedEventTracker::SchedEventTracker(TraceProcessorContext* context)
         context->storage->InternString(waking_descriptor->fields[i].name);
   }
   sched_waking_id_ = context->storage->InternString(waking_descriptor->name);
+
+  auto runnable = ftrace_utils::TaskState(ftrace_utils::TaskState::kRunnable);
+  runnable_string_id_ =
+      context->storage->InternString(runnable.ToString().data());
 }
 
 SchedEventTracker::~SchedEventTracker() = default;
@@ -94,10 +106,13 @@ void SchedEventTracker::PushSchedSwitch(uint32_t cpu,
   if (pending_slice_idx < std::numeric_limits<uint32_t>::max()) {
     prev_pid_match_prev_next_pid = prev_pid == pending_sched->last_pid;
     if (PERFETTO_LIKELY(prev_pid_match_prev_next_pid)) {
-      ClosePendingSlice(pending_slice_idx, ts, prev_state);
+      ClosePendingSlice(pending_sched, ts, prev_state);
     } else {
-      // If the pids are not consistent, make a note of this.
+      // If the pids are not consistent, make a note of this. The pending
+      // slice is left with a zero duration.
       context_->storage->IncrementStats(stats::mismatched_sched_switch_tids);
+      thread_state_tracker_->PushSchedSliceEnd(
+          pending_slice_idx, pending_sched->last_utid, 0, kNullStringId);
     }
   }
 
@@ -114,6 +129,7 @@ void SchedEventTracker::PushSchedSwitch(uint32_t cpu,
 
   // Finally, update the info for the next sched switch on this CPU.
   pending_sched->pending_slice_storage_idx = new_slice_idx;
+  pending_sched->pending_slice_ts = ts;
   pending_sched->last_pid = next_pid;
   pending_sched->last_utid = next_utid;
   pending_sched->last_prio = next_prio;
@@ -161,7 +177,7 @@ void SchedEventTracker::PushSchedSwitchCompact(uint32_t cpu,
   // two compact events for a given cpu).
   uint32_t pending_slice_idx = pending_sched->pending_slice_storage_idx;
   if (pending_slice_idx < std::numeric_limits<uint32_t>::max())
-    ClosePendingSlice(pending_slice_idx, ts, prev_state);
+    ClosePendingSlice(pending_sched, ts, prev_state);
 
   // Use the previous event's values to infer this event's "prev_*" fields.
   // There are edge cases, but this assumption should still produce sensible
@@ -180,6 +196,7 @@ void SchedEventTracker::PushSchedSwitchCompact(uint32_t cpu,
 
   // Finally, update the info for the next sched switch on this CPU.
   pending_sched->pending_slice_storage_idx = new_slice_idx;
+  pending_sched->pending_slice_ts = ts;
   pending_sched->last_pid = next_pid;
   pending_sched->last_utid = next_utid;
   pending_sched->last_prio = next_prio;
@@ -224,37 +241,105 @@ uint32_t SchedEventTracker::AddRawEventAndStartSlice(uint32_t cpu,
   }
 
   // Open a new scheduling slice, corresponding to the task that was
-  // just switched to.
-  auto* sched = context_->storage->mutable_sched_slice_table();
-  auto row_and_id = sched->Insert(
-      {ts, 0 /* duration */, cpu, next_utid, kNullStringId, next_prio});
-  SchedId sched_id = row_and_id.id;
-  return *sched->id().IndexOf(sched_id);
+  // just switched to. It is only appended to the sched table with the
+  // following ones, once the batch is full or at the end of the trace.
+  uint32_t row = context_->storage->sched_slice_table().row_count() +
+                 static_cast<uint32_t>(batch_.ts.size());
+  batch_.ts.push_back(ts);
+  batch_.dur.push_back(0);
+  batch_.cpu.push_back(cpu);
+  batch_.utid.push_back(next_utid);
+  batch_.end_state.push_back(kNullStringId);
+  batch_.priority.push_back(next_prio);
+  thread_state_tracker_->PushSchedSliceStart(row, ts, cpu, next_utid);
+  if (batch_.ts.size() >= kSchedBatchSize)
+    FlushPendingSlices();
+  return row;
 }
 
 PERFETTO_ALWAYS_INLINE
-void SchedEventTracker::ClosePendingSlice(uint32_t pending_slice_idx,
+void SchedEventTracker::ClosePendingSlice(PendingSchedInfo* pending_sched,
                                           int64_t ts,
                                           int64_t prev_state) {
-  auto* slices = context_->storage->mutable_sched_slice_table();
+  uint32_t pending_slice_idx = pending_sched->pending_slice_storage_idx;
+  int64_t duration = ts - pending_sched->pending_slice_ts;
+  StringId end_state = GetEndStateId(prev_state);
+  SetSliceEnd(pending_slice_idx, duration, end_state);
+  thread_state_tracker_->PushSchedSliceEnd(
+      pending_slice_idx, pending_sched->last_utid, duration, end_state);
+}
 
-  int64_t duration = ts - slices->ts()[pending_slice_idx];
-  slices->mutable_dur()->Set(pending_slice_idx, duration);
+PERFETTO_ALWAYS_INLINE
+void SchedEventTracker::SetSliceEnd(uint32_t slice_idx,
+                                    int64_t dur,
+                                    StringId end_state) {
+  // Only the slices which were still running when their batch was flushed
+  // (at most one per cpu) need to be updated in the table.
+  auto* slices = context_->storage->mutable_sched_slice_table();
+  if (slice_idx < slices->row_count()) {
+    slices->mutable_dur()->Set(slice_idx, dur);
+    slices->mutable_end_state()->Set(slice_idx, end_state);
+    return;
+  }
+  size_t idx = slice_idx - slices->row_count();
+  batch_.dur[idx] = dur;
+  batch_.end_state[idx] = end_state;
+}
 
+PERFETTO_ALWAYS_INLINE
+StringId SchedEventTracker::GetEndStateId(int64_t prev_state) {
   // We store the state as a uint16 as we only consider values up to 2048
   // when unpacking the information inside; this allows savings of 48 bits
   // per slice.
+  auto raw_state = static_cast<uint16_t>(prev_state);
   auto kernel_version =
       SystemInfoTracker::GetOrCreate(context_)->GetKernelVersion();
-  auto task_state = ftrace_utils::TaskState(static_cast<uint16_t>(prev_state),
-                                            kernel_version);
+  if (PERFETTO_UNLIKELY(kernel_version != end_state_kernel_version_)) {
+    end_state_ids_.fill(kNullStringId);
+    end_state_kernel_version_ = kernel_version;
+  }
+  if (PERFETTO_LIKELY(raw_state <= kMaxTaskState &&
+                      !end_state_ids_[raw_state].is_null())) {
+    return end_state_ids_[raw_state];
+  }
+
+  // Invalid states are not cached so they are all counted in the stats.
+  auto task_state = ftrace_utils::TaskState(raw_state, kernel_version);
   if (!task_state.is_valid()) {
     context_->storage->IncrementStats(stats::task_state_invalid);
+    return kNullStringId;
   }
-  auto id = task_state.is_valid()
-                ? context_->storage->InternString(task_state.ToString().data())
-                : kNullStringId;
-  slices->mutable_end_state()->Set(pending_slice_idx, id);
+  StringId id = context_->storage->InternString(task_state.ToString().data());
+  if (raw_state <= kMaxTaskState)
+    end_state_ids_[raw_state] = id;
+  return id;
+}
+
+void SchedEventTracker::Flush() {
+  FlushPendingSlices();
+  thread_state_tracker_->Flush();
+}
+
+void SchedEventTracker::FlushPendingSlices() {
+  if (batch_.ts.empty())
+    return;
+
+  tables::SchedSliceTable::ColumnSpans spans;
+  spans.ts = batch_.ts.data();
+  spans.dur = batch_.dur.data();
+  spans.cpu = batch_.cpu.data();
+  spans.utid = batch_.utid.data();
+  spans.end_state = batch_.end_state.data();
+  spans.priority = batch_.priority.data();
+  context_->storage->mutable_sched_slice_table()->AppendColumns(
+      spans, static_cast<uint32_t>(batch_.ts.size()));
+
+  batch_.ts.clear();
+  batch_.dur.clear();
+  batch_.cpu.clear();
+  batch_.utid.clear();
+  batch_.end_state.clear();
+  batch_.priority.clear();
 }
 
 // Processes a sched_waking that was decoded from a compact representation,
@@ -318,28 +403,26 @@ void SchedEventTracker::PushSchedWakingCompact(uint32_t cpu,
   auto ref_type_id = context_->storage->InternString(
       GetRefTypeStringMap()[static_cast<size_t>(RefType::kRefUtid)]);
   instants->Insert({ts, sched_waking_id_, wakee_utid, ref_type_id});
+  thread_state_tracker_->PushSchedWaking(ts, wakee_utid);
 }
 
 void SchedEventTracker::FlushPendingEvents() {
   // TODO(lalitm): the day this method is called before end of trace, don't
   // flush the sched events as they will probably be pushed in the next round
   // of ftrace events.
+  // The slices need to be in the table to compute the end of the trace.
+  FlushPendingSlices();
   int64_t end_ts = context_->storage->GetTraceTimestampBoundsNs().second;
-  auto* slices = context_->storage->mutable_sched_slice_table();
   for (const auto& pending_sched : pending_sched_per_cpu_) {
     uint32_t row = pending_sched.pending_slice_storage_idx;
     if (row == std::numeric_limits<uint32_t>::max())
       continue;
-
-    int64_t duration = end_ts - slices->ts()[row];
-    slices->mutable_dur()->Set(row, duration);
-
-    auto state = ftrace_utils::TaskState(ftrace_utils::TaskState::kRunnable);
-    auto id = context_->storage->InternString(state.ToString().data());
-    slices->mutable_end_state()->Set(row, id);
+    SetSliceEnd(row, end_ts - pending_sched.pending_slice_ts,
+                runnable_string_id_);
   }
 
   pending_sched_per_cpu_ = {};
+  thread_state_tracker_->NotifyEndOfFile();
 }
 
 }  // namespace trace_processor
@@ -19,17 +19,21 @@
 
 #include <array>
 #include <limits>
+#include <vector>
 
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/destructible.h"
 #include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/types/version_number.h"
 
 namespace perfetto {
 namespace trace_processor {
 
 class EventTracker;
+class ThreadStateTracker;
 
 // Tracks sched events and stores them into the storage as sched slices.
 class SchedEventTracker : public Destructible {
@@ -78,15 +82,28 @@ class SchedEventTracker : public Destructible {
                               StringId comm_id);
 
   // Called at the end of trace to flush any events which are pending to the
-  // storage.
+  // storage. This also fills the thread_state table.
   void FlushPendingEvents();
 
+  // Called on TraceProcessor::Flush() to add the events parsed so far to the
+  // sched and thread_state tables.
+  void Flush();
+
+  // Appends the sched slices buffered since the last flush to the sched
+  // table. The slices which are still running are updated in the table when
+  // they end. Public for testing.
+  void FlushPendingSlices();
+
  private:
   // Information retained from the preceding sched_switch seen on a given cpu.
   struct PendingSchedInfo {
-    // The pending scheduling slice that the next event will complete.
+    // The pending scheduling slice that the next event will complete, as a row
+    // number counting the rows of |batch_| after the rows of the sched table.
     uint32_t pending_slice_storage_idx = std::numeric_limits<uint32_t>::max();
 
+    // The start of the pending slice.
+    int64_t pending_slice_ts = 0;
+
     // pid/utid/prio corresponding to the last sched_switch seen on this cpu
     // (its "next_*" fields). There is some duplication with respect to the
     // slices storage, but we don't always have a slice when decoding events in
@@ -108,11 +125,37 @@ class SchedEventTracker : public Destructible {
                                     StringId next_comm_id,
                                     int32_t next_prio);
 
-  void ClosePendingSlice(uint32_t slice_idx, int64_t ts, int64_t prev_state);
+  // The sched slices started since the last flush, stored column by column
+  // so they can be appended to the sched table in a single call.
+  struct SchedBatch {
+    std::vector<int64_t> ts;
+    std::vector<int64_t> dur;
+    std::vector<uint32_t> cpu;
+    std::vector<UniqueTid> utid;
+    std::vector<StringId> end_state;
+    std::vector<int32_t> priority;
+  };
+
+  // Any raw state above this is invalid, whatever the kernel version.
+  static constexpr uint16_t kMaxTaskState = 4096;
+
+  void ClosePendingSlice(PendingSchedInfo*, int64_t ts, int64_t prev_state);
+  void SetSliceEnd(uint32_t slice_idx, int64_t dur, StringId end_state);
+  StringId GetEndStateId(int64_t prev_state);
 
   // Infromation retained from the preceding sched_switch seen on a given cpu.
   std::array<PendingSchedInfo, kMaxCpus> pending_sched_per_cpu_{};
 
+  SchedBatch batch_;
+
+  // The end_state string of each raw prev_state, or null if not computed yet:
+  // there are only a few distinct states in a trace, so each string is only
+  // formatted and interned once. As the strings depend on the kernel version,
+  // this is reset if the version changes.
+  std::array<StringId, kMaxTaskState + 1> end_state_ids_{};
+  base::Optional<VersionNumber> end_state_kernel_version_;
+  StringId runnable_string_id_;
+
   static constexpr uint8_t kSchedSwitchMaxFieldId = 7;
   std::array<StringId, kSchedSwitchMaxFieldId + 1> sched_switch_field_ids_;
   StringId sched_switch_id_;
@@ -121,6 +164,7 @@ class SchedEventTracker : public Destructible {
   std::array<StringId, kSchedWakingMaxFieldId + 1> sched_waking_field_ids_;
   StringId sched_waking_id_;
 
+  ThreadStateTracker* const thread_state_tracker_;
   TraceProcessorContext* const context_;
 };
 
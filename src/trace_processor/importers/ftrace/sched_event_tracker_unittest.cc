@@ -58,10 +58,12 @@ TEST_F(SchedEventTrackerTest, InsertSecondSched) {
 
   sched_tracker->PushSchedSwitch(cpu, timestamp, pid_1, kCommProc2, prio,
                                  prev_state, pid_2, kCommProc1, prio);
+  sched_tracker->FlushPendingSlices();
   ASSERT_EQ(context.storage->sched_slice_table().row_count(), 1ul);
 
   sched_tracker->PushSchedSwitch(cpu, timestamp + 1, pid_2, kCommProc1, prio,
                                  prev_state, pid_1, kCommProc2, prio);
+  sched_tracker->FlushPendingSlices();
 
   ASSERT_EQ(context.storage->sched_slice_table().row_count(), 2ul);
 
@@ -87,6 +89,7 @@ TEST_F(SchedEventTrackerTest, InsertThirdSched_SameThread) {
   sched_tracker->PushSchedSwitch(cpu, timestamp, /*tid=*/4, kCommProc2, prio,
                                  prev_state,
                                  /*tid=*/2, kCommProc1, prio);
+  sched_tracker->FlushPendingSlices();
   ASSERT_EQ(context.storage->sched_slice_table().row_count(), 1u);
 
   sched_tracker->PushSchedSwitch(cpu, timestamp + 1, /*tid=*/2, kCommProc1,
@@ -98,6 +101,7 @@ TEST_F(SchedEventTrackerTest, InsertThirdSched_SameThread) {
   sched_tracker->PushSchedSwitch(cpu, timestamp + 31, /*tid=*/2, kCommProc1,
                                  prio, prev_state,
                                  /*tid=*/4, kCommProc2, prio);
+  sched_tracker->FlushPendingSlices();
   ASSERT_EQ(context.storage->sched_slice_table().row_count(), 4ul);
 
   const auto& timestamps = context.storage->sched_slice_table().ts();
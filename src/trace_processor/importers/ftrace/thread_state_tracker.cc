@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/thread_state_tracker.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace perfetto {
+namespace trace_processor {
+
+ThreadStateTracker::ThreadStateTracker(TraceProcessorContext* context)
+    : running_string_id_(context->storage->InternString("Running")),
+      runnable_string_id_(context->storage->InternString("R")),
+      context_(context) {}
+
+ThreadStateTracker::~ThreadStateTracker() = default;
+
+void ThreadStateTracker::PushSchedSliceStart(uint32_t sched_row,
+                                             int64_t ts,
+                                             uint32_t cpu,
+                                             UniqueTid utid) {
+  sched_slice_count_++;
+
+  // Exclude utid == 0 which represents the idle thread.
+  if (utid == 0)
+    return;
+  StartSchedSlice(sched_row, ts, cpu, utid);
+}
+
+void ThreadStateTracker::PushSchedSliceEnd(uint32_t sched_row,
+                                           UniqueTid utid,
+                                           int64_t dur,
+                                           StringId end_state) {
+  if (utid == 0)
+    return;
+  EndSchedSlice(sched_row, utid, dur, end_state);
+}
+
+void ThreadStateTracker::PushSchedWaking(int64_t ts, UniqueTid utid) {
+  if (utid == 0)
+    return;
+  waking_count_++;
+  AddWaking(ts, utid);
+}
+
+void ThreadStateTracker::PushSchedBlockedReason(
+    UniqueTid utid,
+    base::Optional<bool> io_wait,
+    base::Optional<StringId> blocked_function) {
+  if (utid == 0)
+    return;
+  ThreadSchedInfo* info = GetThreadInfo(utid);
+  if (io_wait)
+    info->io_wait = io_wait;
+  if (blocked_function)
+    info->blocked_function = blocked_function;
+
+  // The descheduled period may already be in the table.
+  if (!info->desched_row)
+    return;
+  auto* table = context_->storage->mutable_thread_state_table();
+  if (io_wait)
+    table->mutable_io_wait()->Set(info->desched_row->idx, *io_wait);
+  if (blocked_function) {
+    table->mutable_blocked_function()->Set(info->desched_row->idx,
+                                           *blocked_function);
+  }
+}
+
+void ThreadStateTracker::Flush() {
+  // Unlike at the end of the trace, we can't know yet whether sched_wakeup
+  // will have to be used: wait for the first sched_waking.
+  const auto& sched = context_->storage->sched_slice_table();
+  if (waking_count_ == 0 || sched_slice_count_ != sched.row_count())
+    return;
+  rows_inserted_ = true;
+
+  // The descheduled and runnable periods are only added to |rows_| once they
+  // end: add the ones which have started with a duration of -1.
+  for (uint32_t utid = 0; utid < threads_.size(); ++utid) {
+    ThreadSchedInfo* info = &threads_[utid];
+    if (info->desched_ts && !info->desched_row) {
+      tables::ThreadStateTable::Row row;
+      row.ts = *info->desched_ts;
+      row.dur = -1;
+      row.state = *info->desched_end_state;
+      row.utid = utid;
+      row.io_wait = info->io_wait;
+      row.blocked_function = info->blocked_function;
+      rows_.push_back(row);
+      info->desched_row = RowRef{static_cast<uint32_t>(rows_.size() - 1),
+                                 false};
+    }
+    if (info->runnable_ts && !info->runnable_row) {
+      tables::ThreadStateTable::Row row;
+      row.ts = *info->runnable_ts;
+      row.dur = -1;
+      row.state = runnable_string_id_;
+      row.utid = utid;
+      rows_.push_back(row);
+      info->runnable_row = RowRef{static_cast<uint32_t>(rows_.size() - 1),
+                                  false};
+    }
+  }
+  InsertPendingRows();
+}
+
+void ThreadStateTracker::NotifyEndOfFile() {
+  const auto& sched = context_->storage->sched_slice_table();
+
+  // The states computed so far are only complete if all the sched slices were
+  // pushed here and if the trace has sched_waking events: otherwise, we fall
+  // back to sched_wakeup, which is only known once all the trace is parsed.
+  // Once Flush() inserted rows, the states computed here are always used.
+  bool complete = rows_inserted_ || sched_slice_count_ == sched.row_count();
+  if (complete && !rows_inserted_ && waking_count_ == 0) {
+    const auto& instants = context_->storage->instant_table();
+    complete = instants
+                   .Filter({instants.name().eq("sched_wakeup"),
+                            instants.ref().ne(0)})
+                   .row_count() == 0;
+  }
+  if (!complete) {
+    ComputeFromTables(context_->storage->GetTraceTimestampBoundsNs().second);
+    return;
+  }
+
+  // The slices which are still running were extended by SchedEventTracker to
+  // the end of the trace: keep them with a duration of -1 instead.
+  for (uint32_t utid = 0; utid < threads_.size(); ++utid) {
+    base::Optional<uint32_t> sched_row = threads_[utid].running_sched_row;
+    if (sched_row)
+      EndSchedSlice(*sched_row, utid, -1, kNullStringId);
+  }
+  InsertRows();
+}
+
+void ThreadStateTracker::ComputeFromTables(int64_t trace_end_ts) {
+  rows_.clear();
+  threads_.clear();
+
+  const auto& raw_sched = context_->storage->sched_slice_table();
+  const auto& instants = context_->storage->instant_table();
+
+  // In both tables, exclude utid == 0 which represents the idle thread.
+  Table sched = raw_sched.Filter({raw_sched.utid().ne(0)});
+  Table waking = instants.Filter(
+      {instants.name().eq("sched_waking"), instants.ref().ne(0)});
+
+  // We prefer to use waking if at all possible and fall back to wakeup if not
+  // available.
+  if (waking.row_count() == 0) {
+    waking = instants.Filter(
+        {instants.name().eq("sched_wakeup"), instants.ref().ne(0)});
+  }
+
+  Table sched_blocked_reason = instants.Filter(
+      {instants.name().eq("sched_blocked_reason"), instants.ref().ne(0)});
+
+  const auto& sched_ts_col = sched.GetTypedColumnByName<int64_t>("ts");
+  const auto& sched_dur_col = sched.GetTypedColumnByName<int64_t>("dur");
+  const auto& sched_cpu_col = sched.GetTypedColumnByName<uint32_t>("cpu");
+  const auto& sched_utid_col = sched.GetTypedColumnByName<uint32_t>("utid");
+  const auto& sched_end_state_col =
+      sched.GetTypedColumnByName<StringId>("end_state");
+  const auto& waking_ts_col = waking.GetTypedColumnByName<int64_t>("ts");
+  const auto& waking_ref_col = waking.GetTypedColumnByName<int64_t>("ref");
+  const auto& blocked_ts_col =
+      sched_blocked_reason.GetTypedColumnByName<int64_t>("ts");
+  const auto& blocked_ref_col =
+      sched_blocked_reason.GetTypedColumnByName<int64_t>("ref");
+  const auto& blocked_arg_set_id_col =
+      sched_blocked_reason.GetTypedColumnByName<uint32_t>("arg_set_id");
+
+  uint32_t sched_idx = 0;
+  uint32_t waking_idx = 0;
+  uint32_t blocked_idx = 0;
+  while (sched_idx < sched.row_count() || waking_idx < waking.row_count() ||
+         blocked_idx < sched_blocked_reason.row_count()) {
+    int64_t sched_ts = sched_idx < sched.row_count()
+                           ? sched_ts_col[sched_idx]
+                           : std::numeric_limits<int64_t>::max();
+    int64_t waking_ts = waking_idx < waking.row_count()
+                            ? waking_ts_col[waking_idx]
+                            : std::numeric_limits<int64_t>::max();
+    int64_t blocked_ts = blocked_idx < sched_blocked_reason.row_count()
+                             ? blocked_ts_col[blocked_idx]
+                             : std::numeric_limits<int64_t>::max();
+
+    // We go through all tables, picking the earliest timestamp from any
+    // to process that event.
+    int64_t min_ts = std::min({sched_ts, waking_ts, blocked_ts});
+    if (min_ts == sched_ts) {
+      UniqueTid utid = sched_utid_col[sched_idx];
+      StartSchedSlice(sched_idx, sched_ts, sched_cpu_col[sched_idx], utid);
+
+      // Undo the expansion of the final sched slice for each CPU to the end of
+      // the trace by setting the duration back to -1. This counteracts the
+      // code in SchedEventTracker::FlushPendingEvents.
+      int64_t dur = sched_dur_col[sched_idx];
+      if (sched_ts + dur == trace_end_ts) {
+        dur = -1;
+      }
+      EndSchedSlice(sched_idx, utid, dur, sched_end_state_col[sched_idx]);
+      sched_idx++;
+    } else if (min_ts == waking_ts) {
+      AddWaking(waking_ts,
+                static_cast<UniqueTid>(waking_ref_col[waking_idx++]));
+    } else /* (min_ts == blocked_ts) */ {
+      UniqueTid utid = static_cast<UniqueTid>(blocked_ref_col[blocked_idx]);
+      uint32_t arg_set_id = blocked_arg_set_id_col[blocked_idx++];
+      ThreadSchedInfo* info = GetThreadInfo(utid);
+
+      base::Optional<Variadic> opt_value;
+      util::Status status =
+          context_->storage->ExtractArg(arg_set_id, "io_wait", &opt_value);
+
+      // We can't do anything better than ignoring any errors here.
+      // TODO(lalitm): see if there's a better way to handle this.
+      if (status.ok() && opt_value) {
+        PERFETTO_CHECK(opt_value->type == Variadic::Type::kBool);
+        info->io_wait = opt_value->bool_value;
+      }
+
+      status =
+          context_->storage->ExtractArg(arg_set_id, "function", &opt_value);
+      if (status.ok() && opt_value) {
+        PERFETTO_CHECK(opt_value->type == Variadic::Type::kString);
+        info->blocked_function = opt_value->string_value;
+      }
+    }
+  }
+  InsertRows();
+}
+
+ThreadStateTracker::ThreadSchedInfo* ThreadStateTracker::GetThreadInfo(
+    UniqueTid utid) {
+  if (utid >= threads_.size())
+    threads_.resize(utid + 1);
+  return &threads_[utid];
+}
+
+int64_t ThreadStateTracker::GetRowTs(RowRef row) const {
+  if (row.in_table)
+    return context_->storage->thread_state_table().ts()[row.idx];
+  return rows_[row.idx].ts;
+}
+
+int64_t ThreadStateTracker::GetRowDur(RowRef row) const {
+  if (row.in_table)
+    return context_->storage->thread_state_table().dur()[row.idx];
+  return rows_[row.idx].dur;
+}
+
+void ThreadStateTracker::SetRowDur(RowRef row, int64_t dur) {
+  if (row.in_table) {
+    auto* table = context_->storage->mutable_thread_state_table();
+    table->mutable_dur()->Set(row.idx, dur);
+    return;
+  }
+  rows_[row.idx].dur = dur;
+}
+
+void ThreadStateTracker::StartSchedSlice(uint32_t sched_row,
+                                         int64_t ts,
+                                         uint32_t cpu,
+                                         UniqueTid utid) {
+  ThreadSchedInfo* info = GetThreadInfo(utid);
+
+  // Due to races in the kernel, it is possible for the same thread to be
+  // scheduled on different CPUs at the same time. This will manifest itself
+  // here by the thread still running in a previous slice or by having
+  // |info->desched_ts| in the future of this scheduling slice (i.e. there was
+  // a scheduling slice in the past which ended after the start of the current
+  // scheduling slice).
+  //
+  // We work around this problem by truncating the previous slice to the start
+  // of this slice and not adding the descheduled slice (i.e. we don't call
+  // |FlushPendingEventsForThread| which adds this slice).
+  //
+  // See b/186509316 for details and an example on when this happens.
+  //
+  // As the events are sorted, this can't happen once the descheduled period
+  // was inserted into the table by Flush().
+  if (info->running_sched_row ||
+      (info->desched_ts && info->desched_ts.value() > ts)) {
+    RowRef prev_row = info->scheduled_row.value();
+    int64_t prev_ts = GetRowTs(prev_row);
+
+    // Just a double check that descheduling slice would have started at the
+    // same time the scheduling slice would have ended.
+    PERFETTO_DCHECK(info->running_sched_row ||
+                    prev_ts + GetRowDur(prev_row) == info->desched_ts.value());
+    PERFETTO_DCHECK(!info->desched_row && !info->runnable_row);
+
+    // Truncate the duration of the old slice to end at the start of this
+    // scheduling slice.
+    SetRowDur(prev_row, ts - prev_ts);
+  } else {
+    FlushPendingEventsForThread(utid, *info, ts);
+  }
+
+  // Reset so we don't have any leftover data on the next round.
+  *info = {};
+
+  // Now add the sched slice itself as "Running" with the other fields
+  // unchanged. Its duration is set when the slice ends.
+  tables::ThreadStateTable::Row row;
+  row.ts = ts;
+  row.dur = -1;
+  row.cpu = cpu;
+  row.state = running_string_id_;
+  row.utid = utid;
+  rows_.push_back(row);
+
+  info->running_sched_row = sched_row;
+  info->scheduled_row = RowRef{static_cast<uint32_t>(rows_.size() - 1), false};
+}
+
+void ThreadStateTracker::EndSchedSlice(uint32_t sched_row,
+                                       UniqueTid utid,
+                                       int64_t dur,
+                                       StringId end_state) {
+  ThreadSchedInfo* info = GetThreadInfo(utid);
+
+  // The thread can already be running in another slice if the two slices
+  // raced (see StartSchedSlice), in which case the row of this slice has
+  // already been truncated.
+  if (info->running_sched_row != sched_row)
+    return;
+  info->running_sched_row = base::nullopt;
+
+  RowRef row = info->scheduled_row.value();
+  SetRowDur(row, dur);
+
+  // If the sched row had a negative duration, don't add any descheduled slice
+  // because it would be meaningless.
+  if (dur != -1) {
+    // This will be flushed to the table on the next sched slice (or at the
+    // end of the trace).
+    info->desched_ts = GetRowTs(row) + dur;
+    info->desched_end_state = end_state;
+  }
+
+  // Now that the end of the slice is known, process the waking seen while the
+  // thread was running.
+  base::Optional<int64_t> waking_ts = info->running_waking_ts;
+  info->running_waking_ts = base::nullopt;
+  if (waking_ts)
+    AddWaking(*waking_ts, utid);
+}
+
+void ThreadStateTracker::AddWaking(int64_t ts, UniqueTid utid) {
+  ThreadSchedInfo* info = GetThreadInfo(utid);
+
+  // The end of the slice the thread is running in is not known yet: we keep
+  // the waking until it is to handle it below.
+  if (info->running_sched_row) {
+    info->running_waking_ts = ts;
+    return;
+  }
+
+  // Occasionally, it is possible to get a waking event for a thread
+  // which is already in a runnable state. When this happens, we just
+  // ignore the waking event.
+  // See b/186509316 for details and an example on when this happens.
+  if (info->desched_end_state &&
+      *info->desched_end_state == runnable_string_id_) {
+    return;
+  }
+
+  // As counter-intuitive as it seems, occasionally we can get a waking
+  // event for a thread which is currently running.
+  //
+  // There are two cases when this can happen:
+  // 1. The kernel legitimately send a waking event for a "running" thread
+  //    because the thread was woken up before the kernel switched away
+  //    from it. In this case, the waking timestamp will be in the past
+  //    because we added the descheduled slice when we processed the end of
+  //    the sched slice.
+  // 2. We're close to the end of the trace or had data-loss and we missed
+  //    the switch out event for a thread but we see a waking after.
+
+  // Case 1 described above. In this situation, we should drop the waking
+  // entirely.
+  if (info->desched_ts && *info->desched_ts > ts)
+    return;
+
+  // The runnable period can't be moved once it is in the table, nor start
+  // before the rows which are already in it: this only happens for a waking
+  // seen while the thread was running, before a Flush(), when the slice is
+  // still running at the end of the trace.
+  const auto& table = context_->storage->thread_state_table();
+  if (info->runnable_row ||
+      (table.row_count() > 0 && ts < table.ts()[table.row_count() - 1])) {
+    return;
+  }
+
+  // For case 2 and otherwise, we should just note the fact that the thread
+  // became runnable at this time. Note that we cannot check if runnable is
+  // already not set because we could have data-loss which leads to us getting
+  // back to back waking for a single thread.
+  info->runnable_ts = ts;
+}
+
+void ThreadStateTracker::FlushPendingEventsForThread(
+    UniqueTid utid,
+    const ThreadSchedInfo& info,
+    base::Optional<int64_t> end_ts) {
+  // First, let's flush the descheduled period (if any) to the table.
+  if (info.desched_ts) {
+    PERFETTO_DCHECK(info.desched_end_state);
+
+    int64_t dur;
+    if (end_ts) {
+      int64_t desched_end_ts = info.runnable_ts ? *info.runnable_ts : *end_ts;
+      dur = desched_end_ts - *info.desched_ts;
+    } else {
+      dur = -1;
+    }
+
+    if (info.desched_row) {
+      SetRowDur(*info.desched_row, dur);
+    } else {
+      tables::ThreadStateTable::Row row;
+      row.ts = *info.desched_ts;
+      row.dur = dur;
+      row.state = *info.desched_end_state;
+      row.utid = utid;
+      row.io_wait = info.io_wait;
+      row.blocked_function = info.blocked_function;
+      rows_.push_back(row);
+    }
+  }
+
+  // Next, flush the runnable period (if any) to the table.
+  if (info.runnable_ts) {
+    int64_t dur = end_ts ? *end_ts - *info.runnable_ts : -1;
+    if (info.runnable_row) {
+      SetRowDur(*info.runnable_row, dur);
+    } else {
+      tables::ThreadStateTable::Row row;
+      row.ts = *info.runnable_ts;
+      row.dur = dur;
+      row.state = runnable_string_id_;
+      row.utid = utid;
+      rows_.push_back(row);
+    }
+  }
+}
+
+void ThreadStateTracker::InsertRows() {
+  // At the end, go through and flush any remaining pending events.
+  for (uint32_t utid = 0; utid < threads_.size(); ++utid) {
+    PERFETTO_DCHECK(!threads_[utid].running_sched_row);
+    FlushPendingEventsForThread(utid, threads_[utid], base::nullopt);
+  }
+  threads_.clear();
+  InsertPendingRows();
+  rows_.shrink_to_fit();
+}
+
+void ThreadStateTracker::InsertPendingRows() {
+  // The rows of different threads are not computed in ts order: sort them
+  // here as the table has a sorted ts column. The rows computed since the
+  // last flush all start after the ones already in the table, as their
+  // events are sorted and the periods which started before were inserted.
+  std::vector<uint32_t> order(rows_.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return rows_[a].ts < rows_[b].ts;
+  });
+
+  // |rows_| index -> table row, for the references of |threads_|.
+  auto* table = context_->storage->mutable_thread_state_table();
+  std::vector<uint32_t> table_rows(rows_.size());
+  for (uint32_t idx : order)
+    table_rows[idx] = table->Insert(rows_[idx]).row;
+  rows_.clear();
+
+  auto to_table = [&table_rows](base::Optional<RowRef>* row) {
+    if (*row && !(*row)->in_table)
+      *row = RowRef{table_rows[(*row)->idx], true};
+  };
+  for (ThreadSchedInfo& info : threads_) {
+    to_table(&info.scheduled_row);
+    to_table(&info.desched_row);
+    to_table(&info.runnable_row);
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_THREAD_STATE_TRACKER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_THREAD_STATE_TRACKER_H_
+
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/destructible.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Computes the thread_state table, i.e. the sched slices of each thread as
+// "Running" plus the periods in between: descheduled (with the end state of
+// the preceding slice) and runnable (from sched_waking to the next slice).
+//
+// The states are computed while parsing, from the sched slices reported by
+// SchedEventTracker and the sched_waking and sched_blocked_reason events.
+// The rows are kept here and inserted, sorted by ts, into the thread_state
+// table on TraceProcessor::Flush() and at the end of the trace. The states
+// which have not ended yet when they are inserted have a duration of -1 and
+// are updated in place when they end.
+//
+// For traces where this doesn't see all the events (e.g. the sched slices of
+// Fuchsia traces, which don't go through SchedEventTracker, or traces with
+// sched_wakeup but no sched_waking) the table is instead computed at the end
+// of the trace from the sched and instant tables.
+class ThreadStateTracker : public Destructible {
+ public:
+  explicit ThreadStateTracker(TraceProcessorContext*);
+  ThreadStateTracker(const ThreadStateTracker&) = delete;
+  ThreadStateTracker& operator=(const ThreadStateTracker&) = delete;
+  ~ThreadStateTracker() override;
+
+  static ThreadStateTracker* GetOrCreate(TraceProcessorContext* context) {
+    if (!context->thread_state_tracker) {
+      context->thread_state_tracker.reset(new ThreadStateTracker(context));
+    }
+    return static_cast<ThreadStateTracker*>(
+        context->thread_state_tracker.get());
+  }
+
+  // Called when the slice at |sched_row| of the sched table starts. The
+  // values of the slice are passed as the row may not have been appended to
+  // the table yet.
+  void PushSchedSliceStart(uint32_t sched_row,
+                           int64_t ts,
+                           uint32_t cpu,
+                           UniqueTid utid);
+
+  // Called when the slice at |sched_row| of the sched table ends.
+  void PushSchedSliceEnd(uint32_t sched_row,
+                         UniqueTid utid,
+                         int64_t dur,
+                         StringId end_state);
+
+  // Called when a sched_waking event for |utid| is seen.
+  void PushSchedWaking(int64_t ts, UniqueTid utid);
+
+  // Called when a sched_blocked_reason event for |utid| is seen.
+  void PushSchedBlockedReason(UniqueTid utid,
+                              base::Optional<bool> io_wait,
+                              base::Optional<StringId> blocked_function);
+
+  // Inserts the states computed so far into the thread_state table, the ones
+  // which have not ended yet with a duration of -1. Nothing is inserted while
+  // the table may still have to be computed from the tables at the end of the
+  // trace (i.e. until a sched_waking event is seen). Once the runnable period
+  // of a thread is inserted, the next sched_waking events for the thread are
+  // ignored until it is scheduled; the sched_waking events older than the
+  // inserted rows are ignored too.
+  void Flush();
+
+  // Called at the end of the trace, after SchedEventTracker has extended the
+  // slices which are still running to the end of the trace, to fill the
+  // thread_state table.
+  void NotifyEndOfFile();
+
+  // Fills the thread_state table from the sched and instant tables: this is
+  // the fallback used by NotifyEndOfFile. Slices ending at |trace_end_ts| are
+  // considered to be still running.
+  // Visible for testing.
+  void ComputeFromTables(int64_t trace_end_ts);
+
+ private:
+  // A row of the thread_state table which can still change: an index in
+  // |rows_| until the rows are inserted, then a row of the table.
+  struct RowRef {
+    uint32_t idx;
+    bool in_table;
+  };
+
+  struct ThreadSchedInfo {
+    // The row in the sched table of the slice the thread is running in, if it
+    // has not ended yet.
+    base::Optional<uint32_t> running_sched_row;
+
+    // The last sched_waking seen while the thread was running: whether it
+    // applies depends on the end of the slice.
+    base::Optional<int64_t> running_waking_ts;
+
+    base::Optional<int64_t> desched_ts;
+    base::Optional<StringId> desched_end_state;
+    base::Optional<RowRef> scheduled_row;
+    base::Optional<bool> io_wait;
+    base::Optional<int64_t> runnable_ts;
+    base::Optional<StringId> blocked_function;
+
+    // The rows of the descheduled and runnable periods, if they were inserted
+    // by Flush() before they ended.
+    base::Optional<RowRef> desched_row;
+    base::Optional<RowRef> runnable_row;
+  };
+
+  ThreadSchedInfo* GetThreadInfo(UniqueTid utid);
+
+  int64_t GetRowTs(RowRef row) const;
+  int64_t GetRowDur(RowRef row) const;
+  void SetRowDur(RowRef row, int64_t dur);
+
+  // |sched_row| only needs to identify the slice between the calls to
+  // StartSchedSlice and EndSchedSlice.
+  void StartSchedSlice(uint32_t sched_row,
+                       int64_t ts,
+                       uint32_t cpu,
+                       UniqueTid utid);
+  void EndSchedSlice(uint32_t sched_row,
+                     UniqueTid utid,
+                     int64_t dur,
+                     StringId end_state);
+  void AddWaking(int64_t ts, UniqueTid utid);
+  void FlushPendingEventsForThread(UniqueTid utid,
+                                   const ThreadSchedInfo&,
+                                   base::Optional<int64_t> end_ts);
+
+  // Flushes the remaining events of all threads and inserts the rows into the
+  // thread_state table.
+  void InsertRows();
+
+  // Inserts |rows_|, sorted by ts, into the thread_state table and makes the
+  // references of |threads_| to them point to the table.
+  void InsertPendingRows();
+
+  // Rows of the thread_state table, in the order they are computed.
+  std::vector<tables::ThreadStateTable::Row> rows_;
+
+  // Indexed by utid.
+  std::vector<ThreadSchedInfo> threads_;
+
+  // The number of PushSchedSliceStart and PushSchedWaking calls, used to
+  // detect whether the sched and instant tables contain events which didn't
+  // go through this class.
+  uint32_t sched_slice_count_ = 0;
+  uint32_t waking_count_ = 0;
+
+  // Whether Flush() inserted rows: the table can't be computed from the
+  // tables anymore.
+  bool rows_inserted_ = false;
+
+  const StringId running_string_id_;
+  const StringId runnable_string_id_;
+
+  TraceProcessorContext* const context_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_THREAD_STATE_TRACKER_H_
@@ -0,0 +1,697 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/thread_state_tracker.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/common/global_args_tracker.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class ThreadStateTrackerUnittest : public testing::Test {
+ public:
+  struct Ts {
+    int64_t ts;
+  };
+
+  ThreadStateTrackerUnittest() : idle_thread_(0), thread_a_(1), thread_b_(2) {
+    context_.storage.reset(new TraceStorage());
+    context_.global_args_tracker.reset(new GlobalArgsTracker(&context_));
+    context_.args_tracker.reset(new ArgsTracker(&context_));
+    thread_state_tracker_ = ThreadStateTracker::GetOrCreate(&context_);
+  }
+
+  void ForwardSchedTo(Ts ts) { sched_insert_ts_ = ts.ts; }
+
+  void AddWaking(Ts ts, UniqueTid utid) {
+    tables::InstantTable::Row row;
+    row.ts = ts.ts;
+    row.ref = utid;
+    row.name = context_.storage->InternString("sched_waking");
+    context_.storage->mutable_instant_table()->Insert(row);
+  }
+
+  void AddWakup(Ts ts, UniqueTid utid) {
+    tables::InstantTable::Row row;
+    row.ts = ts.ts;
+    row.ref = utid;
+    row.name = context_.storage->InternString("sched_wakeup");
+    context_.storage->mutable_instant_table()->Insert(row);
+  }
+
+  void AddSched(base::Optional<Ts> end, UniqueTid utid, const char* end_state) {
+    StringId end_state_id = context_.storage->InternString(end_state);
+
+    tables::SchedSliceTable::Row row;
+
+    // cpu is hardcoded because it doesn't matter for the algorithm and is
+    // just passed through unchanged.
+    row.cpu = 0;
+
+    row.ts = sched_insert_ts_;
+    row.dur = end ? end->ts - row.ts : -1;
+    row.utid = utid;
+    row.end_state = end_state_id;
+    context_.storage->mutable_sched_slice_table()->Insert(row);
+
+    sched_insert_ts_ = end ? end->ts : -1;
+  }
+
+  void AddBlockedReason(Ts ts, UniqueTid utid, bool io_wait) {
+    tables::InstantTable::Row row;
+    row.ts = ts.ts;
+    row.ref = utid;
+    row.name = context_.storage->InternString("sched_blocked_reason");
+
+    auto id = context_.storage->mutable_instant_table()->Insert(row).id;
+    auto inserter = context_.args_tracker->AddArgsTo(id);
+    inserter.AddArg(context_.storage->InternString("io_wait"),
+                    Variadic::Boolean(io_wait));
+    context_.args_tracker->Flush();
+  }
+
+  void RunThreadStateComputation(Ts trace_end_ts = Ts{
+                                     std::numeric_limits<int64_t>::max()}) {
+    thread_state_tracker_->ComputeFromTables(trace_end_ts.ts);
+    table_ = &context_.storage->thread_state_table();
+  }
+
+  void VerifyThreadState(Ts from,
+                         base::Optional<Ts> to,
+                         UniqueTid utid,
+                         const char* state,
+                         base::Optional<bool> io_wait = base::nullopt) {
+    uint32_t row = thread_state_verify_row_++;
+
+    const auto& ts_col = table_->GetTypedColumnByName<int64_t>("ts");
+    const auto& dur_col = table_->GetTypedColumnByName<int64_t>("dur");
+    const auto& utid_col = table_->GetTypedColumnByName<UniqueTid>("utid");
+    const auto& cpu_col =
+        table_->GetTypedColumnByName<base::Optional<uint32_t>>("cpu");
+    const auto& end_state_col = table_->GetTypedColumnByName<StringId>("state");
+    const auto& io_wait_col =
+        table_->GetTypedColumnByName<base::Optional<uint32_t>>("io_wait");
+
+    ASSERT_LT(row, table_->row_count());
+    ASSERT_EQ(ts_col[row], from.ts);
+    ASSERT_EQ(dur_col[row], to ? to->ts - from.ts : -1);
+    ASSERT_EQ(utid_col[row], utid);
+    if (state == kRunning) {
+      ASSERT_EQ(cpu_col[row], 0u);
+    } else {
+      ASSERT_EQ(cpu_col[row], base::nullopt);
+    }
+    ASSERT_EQ(end_state_col.GetString(row), base::StringView(state));
+
+    base::Optional<uint32_t> mapped_io_wait =
+        io_wait ? base::make_optional(static_cast<uint32_t>(*io_wait))
+                : base::nullopt;
+    ASSERT_EQ(io_wait_col[row], mapped_io_wait);
+  }
+
+  void VerifyEndOfThreadState() {
+    ASSERT_EQ(thread_state_verify_row_, table_->row_count());
+  }
+
+ protected:
+  static constexpr char kRunning[] = "Running";
+
+  const UniqueTid idle_thread_;
+  const UniqueTid thread_a_;
+  const UniqueTid thread_b_;
+
+ private:
+  TraceProcessorContext context_;
+
+  int64_t sched_insert_ts_ = 0;
+
+  uint32_t thread_state_verify_row_ = 0;
+
+  ThreadStateTracker* thread_state_tracker_ = nullptr;
+  const tables::ThreadStateTable* table_ = nullptr;
+};
+
+constexpr char ThreadStateTrackerUnittest::kRunning[];
+
+TEST_F(ThreadStateTrackerUnittest, MultipleThreadWithOnlySched) {
+  ForwardSchedTo(Ts{0});
+  AddSched(Ts{10}, thread_a_, "S");
+  AddSched(Ts{15}, thread_b_, "D");
+  AddSched(Ts{20}, thread_a_, "R");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{0}, Ts{10}, thread_a_, kRunning);
+  VerifyThreadState(Ts{10}, Ts{15}, thread_b_, kRunning);
+  VerifyThreadState(Ts{10}, Ts{15}, thread_a_, "S");
+  VerifyThreadState(Ts{15}, Ts{20}, thread_a_, kRunning);
+  VerifyThreadState(Ts{15}, base::nullopt, thread_b_, "D");
+  VerifyThreadState(Ts{20}, base::nullopt, thread_a_, "R");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, WakingFirst) {
+  AddWaking(Ts{10}, thread_a_);
+
+  ForwardSchedTo(Ts{20});
+  AddSched(Ts{30}, thread_a_, "S");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{10}, Ts{20}, thread_a_, "R");
+  VerifyThreadState(Ts{20}, Ts{30}, thread_a_, kRunning);
+  VerifyThreadState(Ts{30}, base::nullopt, thread_a_, "S");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, SchedWithWaking) {
+  ForwardSchedTo(Ts{0});
+  AddSched(Ts{10}, thread_a_, "S");
+
+  AddWaking(Ts{15}, thread_a_);
+
+  ForwardSchedTo(Ts{20});
+  AddSched(Ts{25}, thread_a_, "R");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{0}, Ts{10}, thread_a_, kRunning);
+  VerifyThreadState(Ts{10}, Ts{15}, thread_a_, "S");
+  VerifyThreadState(Ts{15}, Ts{20}, thread_a_, "R");
+  VerifyThreadState(Ts{20}, Ts{25}, thread_a_, kRunning);
+  VerifyThreadState(Ts{25}, base::nullopt, thread_a_, "R");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, SchedWithWakeup) {
+  ForwardSchedTo(Ts{0});
+  AddSched(Ts{10}, thread_a_, "S");
+
+  AddWakup(Ts{15}, thread_a_);
+
+  ForwardSchedTo(Ts{20});
+  AddSched(Ts{25}, thread_a_, "R");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{0}, Ts{10}, thread_a_, kRunning);
+  VerifyThreadState(Ts{10}, Ts{15}, thread_a_, "S");
+  VerifyThreadState(Ts{15}, Ts{20}, thread_a_, "R");
+  VerifyThreadState(Ts{20}, Ts{25}, thread_a_, kRunning);
+  VerifyThreadState(Ts{25}, base::nullopt, thread_a_, "R");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, SchedIdleIgnored) {
+  ForwardSchedTo(Ts{0});
+  AddSched(Ts{10}, idle_thread_, "R");
+  AddSched(Ts{15}, thread_a_, "R");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{10}, Ts{15}, thread_a_, kRunning);
+  VerifyThreadState(Ts{15}, base::nullopt, thread_a_, "R");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, NegativeSchedDuration) {
+  ForwardSchedTo(Ts{0});
+
+  AddSched(Ts{10}, thread_a_, "S");
+
+  AddWaking(Ts{15}, thread_a_);
+
+  ForwardSchedTo(Ts{20});
+  AddSched(base::nullopt, thread_a_, "");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{0}, Ts{10}, thread_a_, kRunning);
+  VerifyThreadState(Ts{10}, Ts{15}, thread_a_, "S");
+  VerifyThreadState(Ts{15}, Ts{20}, thread_a_, "R");
+  VerifyThreadState(Ts{20}, base::nullopt, thread_a_, kRunning);
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, WakingOnRunningThreadAtEnd) {
+  AddWaking(Ts{5}, thread_a_);
+
+  ForwardSchedTo(Ts{10});
+  AddSched(base::nullopt, thread_a_, "");
+
+  AddWaking(Ts{15}, thread_a_);
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{5}, Ts{10}, thread_a_, "R");
+  VerifyThreadState(Ts{10}, base::nullopt, thread_a_, kRunning);
+  VerifyThreadState(Ts{15}, base::nullopt, thread_a_, "R");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, SchedDataLoss) {
+  ForwardSchedTo(Ts{10});
+  AddSched(base::nullopt, thread_a_, "");
+  ForwardSchedTo(Ts{30});
+  AddSched(Ts{40}, thread_a_, "D");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{10}, base::nullopt, thread_a_, kRunning);
+  VerifyThreadState(Ts{30}, Ts{40}, thread_a_, kRunning);
+  VerifyThreadState(Ts{40}, base::nullopt, thread_a_, "D");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, StrechedSchedIgnored) {
+  ForwardSchedTo(Ts{10});
+  AddSched(Ts{100}, thread_a_, "");
+
+  RunThreadStateComputation(Ts{100});
+
+  VerifyThreadState(Ts{10}, base::nullopt, thread_a_, kRunning);
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, WakingAfterStrechedSched) {
+  ForwardSchedTo(Ts{10});
+  AddSched(Ts{100}, thread_a_, "");
+
+  AddWaking(Ts{15}, thread_a_);
+
+  RunThreadStateComputation(Ts{100});
+
+  VerifyThreadState(Ts{10}, base::nullopt, thread_a_, kRunning);
+  VerifyThreadState(Ts{15}, base::nullopt, thread_a_, "R");
+
+  VerifyEndOfThreadState();
+}
+
+TEST_F(ThreadStateTrackerUnittest, BlockedReason) {
+  ForwardSchedTo(Ts{10});
+  AddSched(Ts{12}, thread_a_, "D");
+  AddWaking(Ts{15}, thread_a_);
+  AddBlockedReason(Ts{16}, thread_a_, true);
+
+  ForwardSchedTo(Ts{18});
+  AddSched(Ts{20}, thread_a_, "S");
+  AddWaking(Ts{24}, thread_a_);
+  AddBlockedReason(Ts{26}, thread_a_, false);
+
+  ForwardSchedTo(Ts{29});
+  AddSched(Ts{30}, thread_a_, "R");
+
+  ForwardSchedTo(Ts{39});
+  AddSched(Ts{40}, thread_a_, "D");
+  AddBlockedReason(Ts{44}, thread_a_, false);
+
+  ForwardSchedTo(Ts{49});
+  AddSched(Ts{50}, thread_a_, "D");
+
+  RunThreadStateComputation();
+
+  VerifyThreadState(Ts{10}, Ts{12}, thread_a_, kRunning);
+  VerifyThreadState(Ts{12}, Ts{15}, thread_a_, "D", true);
+  VerifyThreadState(Ts{15}, Ts{18}, thread_a_, "R");
+
+  VerifyThreadState(Ts{18}, Ts{20}, thread_a_, kRunning);
+  VerifyThreadState(Ts{20}, Ts{24}, thread_a_, "S", false);
+  VerifyThreadState(Ts{24}, Ts{29}, thread_a_, "R");
+
+  VerifyThreadState(Ts{29}, Ts{30}, thread_a_, kRunning);
+  VerifyThreadState(Ts{30}, Ts{39}, thread_a_, "R", base::nullopt);
+
+  VerifyThreadState(Ts{39}, Ts{40}, thread_a_, kRunning);
+  VerifyThreadState(Ts{40}, Ts{49}, thread_a_, "D", false);
+
+  VerifyThreadState(Ts{49}, Ts{50}, thread_a_, kRunning);
+  VerifyThreadState(Ts{50}, base::nullopt, thread_a_, "D");
+
+  VerifyEndOfThreadState();
+}
+
+// Pushes events to the tracker as they are seen while parsing (like
+// SchedEventTracker and FtraceParser do) and also adds them to the sched and
+// instant tables.
+class IncrementalTrace {
+ public:
+  using StateRow = std::tuple<int64_t,
+                              int64_t,
+                              UniqueTid,
+                              base::Optional<uint32_t>,
+                              std::string,
+                              base::Optional<uint32_t>>;
+
+  IncrementalTrace() {
+    context_.storage.reset(new TraceStorage());
+    context_.global_args_tracker.reset(new GlobalArgsTracker(&context_));
+    context_.args_tracker.reset(new ArgsTracker(&context_));
+    tracker_ = ThreadStateTracker::GetOrCreate(&context_);
+  }
+
+  uint32_t StartSched(int64_t ts, uint32_t cpu, UniqueTid utid) {
+    auto* sched = context_.storage->mutable_sched_slice_table();
+    uint32_t row = sched->Insert({ts, 0, cpu, utid, kNullStringId, 0}).row;
+    tracker_->PushSchedSliceStart(row, ts, cpu, utid);
+    return row;
+  }
+
+  void EndSched(uint32_t row, int64_t ts, const char* end_state) {
+    auto* sched = context_.storage->mutable_sched_slice_table();
+    int64_t dur = ts - sched->ts()[row];
+    StringId end_state_id = context_.storage->InternString(end_state);
+    sched->mutable_dur()->Set(row, dur);
+    sched->mutable_end_state()->Set(row, end_state_id);
+    tracker_->PushSchedSliceEnd(row, sched->utid()[row], dur, end_state_id);
+  }
+
+  void AddWaking(int64_t ts, UniqueTid utid) {
+    tables::InstantTable::Row row;
+    row.ts = ts;
+    row.ref = utid;
+    row.name = context_.storage->InternString("sched_waking");
+    context_.storage->mutable_instant_table()->Insert(row);
+    tracker_->PushSchedWaking(ts, utid);
+  }
+
+  void AddWakeupToTable(int64_t ts, UniqueTid utid) {
+    tables::InstantTable::Row row;
+    row.ts = ts;
+    row.ref = utid;
+    row.name = context_.storage->InternString("sched_wakeup");
+    context_.storage->mutable_instant_table()->Insert(row);
+  }
+
+  void AddBlockedReason(int64_t ts, UniqueTid utid, bool io_wait) {
+    tables::InstantTable::Row row;
+    row.ts = ts;
+    row.ref = utid;
+    row.name = context_.storage->InternString("sched_blocked_reason");
+    auto id = context_.storage->mutable_instant_table()->Insert(row).id;
+    auto inserter = context_.args_tracker->AddArgsTo(id);
+    inserter.AddArg(context_.storage->InternString("io_wait"),
+                    Variadic::Boolean(io_wait));
+    context_.args_tracker->Flush();
+    tracker_->PushSchedBlockedReason(utid, io_wait, base::nullopt);
+  }
+
+  void Flush() { tracker_->Flush(); }
+
+  // Extends the slices in |running| to |trace_end_ts|, as done by
+  // SchedEventTracker::FlushPendingEvents, and fills the thread_state table
+  // either with the states computed incrementally or from the tables.
+  void End(int64_t trace_end_ts,
+           const std::vector<uint32_t>& running,
+           bool from_tables) {
+    auto* sched = context_.storage->mutable_sched_slice_table();
+    for (uint32_t row : running) {
+      sched->mutable_dur()->Set(row, trace_end_ts - sched->ts()[row]);
+      sched->mutable_end_state()->Set(row, context_.storage->InternString("R"));
+    }
+    if (from_tables) {
+      tracker_->ComputeFromTables(trace_end_ts);
+    } else {
+      tracker_->NotifyEndOfFile();
+    }
+  }
+
+  // Returns the rows of the thread_state table, sorted.
+  std::vector<StateRow> Rows() {
+    const auto& table = context_.storage->thread_state_table();
+    std::vector<StateRow> rows;
+    for (uint32_t i = 0; i < table.row_count(); ++i) {
+      PERFETTO_CHECK(i == 0 || table.ts()[i - 1] <= table.ts()[i]);
+      rows.emplace_back(
+          table.ts()[i], table.dur()[i], table.utid()[i], table.cpu()[i],
+          context_.storage->GetString(table.state()[i]).ToStdString(),
+          table.io_wait()[i]);
+    }
+    std::sort(rows.begin(), rows.end());
+    return rows;
+  }
+
+ private:
+  TraceProcessorContext context_;
+  ThreadStateTracker* tracker_ = nullptr;
+};
+
+TEST(ThreadStateTrackerIncrementalTest, RunningAtEndOfTrace) {
+  IncrementalTrace trace;
+  uint32_t a = trace.StartSched(10, 0, 1);
+  trace.AddWaking(15, 1);
+  uint32_t b = trace.StartSched(20, 1, 2);
+  trace.EndSched(b, 30, "S");
+  trace.End(100, {a}, /*from_tables=*/false);
+
+  using Row = IncrementalTrace::StateRow;
+  ASSERT_THAT(trace.Rows(),
+              testing::ElementsAre(Row{10, -1, 1, 0u, "Running", base::nullopt},
+                                   Row{15, -1, 1, base::nullopt, "R",
+                                       base::nullopt},
+                                   Row{20, 10, 2, 1u, "Running", base::nullopt},
+                                   Row{30, -1, 2, base::nullopt, "S",
+                                       base::nullopt}));
+}
+
+TEST(ThreadStateTrackerIncrementalTest, SameThreadOnTwoCpus) {
+  IncrementalTrace trace;
+  uint32_t a = trace.StartSched(10, 0, 1);
+  uint32_t b = trace.StartSched(15, 1, 1);
+  trace.EndSched(a, 20, "S");
+  trace.EndSched(b, 30, "D");
+  trace.End(100, {}, /*from_tables=*/false);
+
+  using Row = IncrementalTrace::StateRow;
+  ASSERT_THAT(trace.Rows(),
+              testing::ElementsAre(Row{10, 5, 1, 0u, "Running", base::nullopt},
+                                   Row{15, 15, 1, 1u, "Running", base::nullopt},
+                                   Row{30, -1, 1, base::nullopt, "D",
+                                       base::nullopt}));
+}
+
+TEST(ThreadStateTrackerIncrementalTest, FallsBackToWakeup) {
+  IncrementalTrace trace;
+  uint32_t a = trace.StartSched(10, 0, 1);
+  trace.EndSched(a, 20, "S");
+  trace.AddWakeupToTable(25, 1);
+  uint32_t b = trace.StartSched(30, 0, 1);
+
+  // The slices ending at the end of the trace are considered to be still
+  // running.
+  trace.End(40, {b}, /*from_tables=*/false);
+
+  using Row = IncrementalTrace::StateRow;
+  ASSERT_THAT(trace.Rows(),
+              testing::ElementsAre(
+                  Row{10, 10, 1, 0u, "Running", base::nullopt},
+                  Row{20, 5, 1, base::nullopt, "S", base::nullopt},
+                  Row{25, 5, 1, base::nullopt, "R", base::nullopt},
+                  Row{30, -1, 1, 0u, "Running", base::nullopt}));
+}
+
+TEST(ThreadStateTrackerIncrementalTest, Flush) {
+  IncrementalTrace trace;
+  uint32_t a = trace.StartSched(10, 0, 1);
+  trace.EndSched(a, 20, "S");
+  trace.AddWaking(25, 1);
+  uint32_t b = trace.StartSched(30, 1, 2);
+  trace.Flush();
+
+  // The states which have not ended yet are inserted with a dur of -1.
+  using Row = IncrementalTrace::StateRow;
+  ASSERT_THAT(trace.Rows(),
+              testing::ElementsAre(
+                  Row{10, 10, 1, 0u, "Running", base::nullopt},
+                  Row{20, -1, 1, base::nullopt, "S", base::nullopt},
+                  Row{25, -1, 1, base::nullopt, "R", base::nullopt},
+                  Row{30, -1, 2, 1u, "Running", base::nullopt}));
+
+  // Flushing again doesn't insert them twice.
+  trace.Flush();
+  ASSERT_EQ(trace.Rows().size(), 4u);
+
+  // The runnable period started at the first waking.
+  trace.AddWaking(35, 1);
+  trace.AddBlockedReason(36, 1, true);
+  trace.EndSched(b, 40, "D");
+  uint32_t c = trace.StartSched(45, 0, 1);
+  trace.End(100, {c}, /*from_tables=*/false);
+  ASSERT_THAT(trace.Rows(),
+              testing::ElementsAre(
+                  Row{10, 10, 1, 0u, "Running", base::nullopt},
+                  Row{20, 5, 1, base::nullopt, "S", 1u},
+                  Row{25, 20, 1, base::nullopt, "R", base::nullopt},
+                  Row{30, 10, 2, 1u, "Running", base::nullopt},
+                  Row{40, -1, 2, base::nullopt, "D", base::nullopt},
+                  Row{45, -1, 1, 0u, "Running", base::nullopt}));
+}
+
+TEST(ThreadStateTrackerIncrementalTest, FlushBeforeWaking) {
+  IncrementalTrace trace;
+  uint32_t a = trace.StartSched(10, 0, 1);
+  trace.EndSched(a, 20, "S");
+
+  // Nothing is inserted while sched_wakeup may have to be used instead.
+  trace.Flush();
+  ASSERT_TRUE(trace.Rows().empty());
+
+  trace.AddWakeupToTable(25, 1);
+  trace.End(40, {}, /*from_tables=*/false);
+  ASSERT_EQ(trace.Rows().size(), 3u);
+}
+
+TEST(ThreadStateTrackerIncrementalTest, MatchesComputeFromTables) {
+  const char* const kEndStates[] = {"S", "D", "R", "R+"};
+  const uint32_t kCpus = 3;
+  const UniqueTid kThreads = 6;
+
+  std::minstd_rand rnd(42);
+  for (int iteration = 0; iteration < 20; ++iteration) {
+    IncrementalTrace incremental;
+    IncrementalTrace from_tables;
+    std::vector<base::Optional<uint32_t>> running(kCpus);
+    std::vector<UniqueTid> running_utids(kCpus);
+    int64_t ts = 0;
+    for (int i = 0; i < 500; ++i) {
+      ts += 1 + rnd() % 10;
+      uint32_t kind = rnd() % 10;
+      if (kind < 5) {
+        uint32_t cpu = rnd() % kCpus;
+        if (running[cpu]) {
+          const char* end_state = kEndStates[rnd() % 4];
+          incremental.EndSched(*running[cpu], ts, end_state);
+          from_tables.EndSched(*running[cpu], ts, end_state);
+        }
+        // utid 0 is the idle thread. The threads are never scheduled on two
+        // CPUs at the same time: when a slice is still running at the end
+        // of the trace, ComputeFromTables doesn't truncate it.
+        running_utids[cpu] = 0;
+        UniqueTid utid = rnd() % kThreads;
+        if (std::count(running_utids.begin(), running_utids.end(), utid))
+          utid = 0;
+        running_utids[cpu] = utid;
+        running[cpu] = incremental.StartSched(ts, cpu, utid);
+        from_tables.StartSched(ts, cpu, utid);
+      } else if (kind < 8) {
+        UniqueTid utid = 1 + rnd() % (kThreads - 1);
+        incremental.AddWaking(ts, utid);
+        from_tables.AddWaking(ts, utid);
+      } else {
+        UniqueTid utid = 1 + rnd() % (kThreads - 1);
+        bool io_wait = rnd() % 2;
+        incremental.AddBlockedReason(ts, utid, io_wait);
+        from_tables.AddBlockedReason(ts, utid, io_wait);
+      }
+    }
+
+    std::vector<uint32_t> running_rows;
+    for (const auto& row : running) {
+      if (row)
+        running_rows.push_back(*row);
+    }
+    incremental.End(ts + 1, running_rows, /*from_tables=*/false);
+    from_tables.End(ts + 1, running_rows, /*from_tables=*/true);
+    ASSERT_EQ(incremental.Rows(), from_tables.Rows());
+  }
+}
+
+TEST(ThreadStateTrackerIncrementalTest, FlushMatchesEndOfTrace) {
+  const char* const kEndStates[] = {"S", "D", "R", "R+"};
+  const uint32_t kCpus = 3;
+  const UniqueTid kThreads = 6;
+
+  std::minstd_rand rnd(42);
+  for (int iteration = 0; iteration < 20; ++iteration) {
+    IncrementalTrace flushed;
+    IncrementalTrace not_flushed;
+    std::vector<base::Optional<uint32_t>> running(kCpus);
+    std::vector<UniqueTid> running_utids(kCpus);
+
+    // A thread is only woken once between two slices: after a flush, the
+    // next waking events are ignored instead of moving the runnable period.
+    std::vector<bool> woken(kThreads);
+    int64_t ts = 0;
+    for (int i = 0; i < 500; ++i) {
+      ts += 1 + rnd() % 10;
+      uint32_t kind = rnd() % 10;
+      if (kind < 5) {
+        uint32_t cpu = rnd() % kCpus;
+        if (running[cpu]) {
+          const char* end_state = kEndStates[rnd() % 4];
+          flushed.EndSched(*running[cpu], ts, end_state);
+          not_flushed.EndSched(*running[cpu], ts, end_state);
+        }
+        running_utids[cpu] = 0;
+        UniqueTid utid = rnd() % kThreads;
+        if (std::count(running_utids.begin(), running_utids.end(), utid))
+          utid = 0;
+        running_utids[cpu] = utid;
+        woken[utid] = false;
+        running[cpu] = flushed.StartSched(ts, cpu, utid);
+        not_flushed.StartSched(ts, cpu, utid);
+      } else if (kind < 8) {
+        UniqueTid utid = 1 + rnd() % (kThreads - 1);
+        if (woken[utid])
+          continue;
+        woken[utid] = true;
+        flushed.AddWaking(ts, utid);
+        not_flushed.AddWaking(ts, utid);
+      } else {
+        UniqueTid utid = 1 + rnd() % (kThreads - 1);
+        bool io_wait = rnd() % 2;
+        flushed.AddBlockedReason(ts, utid, io_wait);
+        not_flushed.AddBlockedReason(ts, utid, io_wait);
+      }
+      if (rnd() % 50 == 0)
+        flushed.Flush();
+    }
+
+    // The wakings seen before a flush while a slice was running are dropped
+    // if the slice is still running at the end of the trace: end them all.
+    for (const auto& row : running) {
+      if (!row)
+        continue;
+      flushed.EndSched(*row, ts + 1, "S");
+      not_flushed.EndSched(*row, ts + 1, "S");
+    }
+    flushed.End(ts + 2, {}, /*from_tables=*/false);
+    not_flushed.End(ts + 2, {}, /*from_tables=*/false);
+    ASSERT_EQ(flushed.Rows(), not_flushed.Rows());
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -19,16 +19,27 @@
 namespace perfetto {
 namespace trace_processor {
 
+constexpr uint32_t FuchsiaRecord::kInlineStrings;
+constexpr uint32_t FuchsiaRecord::kInlineThreads;
+
 void FuchsiaRecord::InsertString(uint32_t index, StringId string_id) {
   StringTableEntry entry;
   entry.index = index;
   entry.string_id = string_id;
 
-  string_entries_.push_back(entry);
+  if (string_count_ < kInlineStrings) {
+    inline_strings_[string_count_++] = entry;
+  } else {
+    overflow_strings_.push_back(entry);
+  }
 }
 
 StringId FuchsiaRecord::GetString(uint32_t index) {
-  for (const auto& entry : string_entries_) {
+  for (uint32_t i = 0; i < string_count_; ++i) {
+    if (inline_strings_[i].index == index)
+      return inline_strings_[i].string_id;
+  }
+  for (const auto& entry : overflow_strings_) {
     if (entry.index == index)
       return entry.string_id;
   }
@@ -41,11 +52,19 @@ void FuchsiaRecord::InsertThread(uint32_t index,
   entry.index = index;
   entry.info = info;
 
-  thread_entries_.push_back(entry);
+  if (thread_count_ < kInlineThreads) {
+    inline_threads_[thread_count_++] = entry;
+  } else {
+    overflow_threads_.push_back(entry);
+  }
 }
 
 fuchsia_trace_utils::ThreadInfo FuchsiaRecord::GetThread(uint32_t index) {
-  for (const auto& entry : thread_entries_) {
+  for (uint32_t i = 0; i < thread_count_; ++i) {
+    if (inline_threads_[i].index == index)
+      return inline_threads_[i].info;
+  }
+  for (const auto& entry : overflow_threads_) {
     if (entry.index == index)
       return entry.info;
   }
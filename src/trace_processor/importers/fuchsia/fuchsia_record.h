@@ -30,6 +30,10 @@ namespace trace_processor {
 // record. Namely, the record itself and the entries of the string table and the
 // thread table that are referenced by the record. This enables understanding
 // the binary record after arbitrary reordering.
+//
+// Records are allocated in the payload arena of the sorter. The first few
+// table entries are stored inline so that typical events (referencing a
+// thread, a category and a name) do not need any other heap allocation.
 class FuchsiaRecord {
  public:
   FuchsiaRecord(TraceBlobView record_view)
@@ -60,10 +64,18 @@ class FuchsiaRecord {
   TraceBlobView* record_view() { return &record_view_; }
 
  private:
+  static constexpr uint32_t kInlineStrings = 4;
+  static constexpr uint32_t kInlineThreads = 1;
+
   TraceBlobView record_view_;
 
-  std::vector<StringTableEntry> string_entries_;
-  std::vector<ThreadTableEntry> thread_entries_;
+  // Entries past the inline ones are stored in the overflow vectors.
+  StringTableEntry inline_strings_[kInlineStrings];
+  ThreadTableEntry inline_threads_[kInlineThreads];
+  uint32_t string_count_ = 0;
+  uint32_t thread_count_ = 0;
+  std::vector<StringTableEntry> overflow_strings_;
+  std::vector<ThreadTableEntry> overflow_threads_;
 
   uint64_t ticks_per_second_ = 1000000000;
 };
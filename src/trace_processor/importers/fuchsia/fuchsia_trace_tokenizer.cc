@@ -16,6 +16,9 @@
 
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_tokenizer.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <cinttypes>
 #include <unordered_map>
 
@@ -72,108 +75,82 @@ FuchsiaTraceTokenizer::~FuchsiaTraceTokenizer() = default;
 
 util::Status FuchsiaTraceTokenizer::Parse(std::unique_ptr<uint8_t[]> data,
                                           size_t size) {
-  // The relevant internal state is |leftover_bytes_|. Each call to Parse should
-  // maintain the following properties, unless a fatal error occurs in which
-  // case it should return false and no assumptions should be made about the
-  // resulting internal state:
-  //
-  // 1) Every byte passed to |Parse| has either been passed to |ParseRecord| or
-  // is present in |leftover_bytes_|, but not both.
-  // 2) |leftover_bytes_| does not contain a complete record.
-  //
-  // Parse is responsible for creating the "full" |TraceBlobView|s, which own
-  // the underlying data. Generally, there will be one such view. However, if
-  // there is a record that started in an earlier call, then a new buffer is
-  // created here to make the bytes in that record contiguous.
-  //
-  // Because some of the bytes in |data| might belong to the record starting in
-  // |leftover_bytes_|, we track the offset at which the following record will
-  // start.
-  size_t byte_offset = 0;
-
-  // Look for a record starting with the leftover bytes.
-  if (leftover_bytes_.size() + size < 8) {
-    // Even with the new bytes, we can't even read the header of the next
-    // record, so just add the new bytes to |leftover_bytes_| and return.
-    leftover_bytes_.insert(leftover_bytes_.end(), data.get() + byte_offset,
-                           data.get() + size);
-    return util::OkStatus();
-  }
+  // Every record is handed to |ParseRecord| as a slice of a refcounted
+  // |TraceBlobView| of the chunk it was received in, so the bytes are never
+  // copied. The only exception is a record spanning several chunks: its
+  // first bytes are buffered in |leftover_bytes_| and, once the chunk
+  // completing it arrives, it is copied into a buffer of exactly its size.
+  TraceBlobView chunk(std::move(data), 0, size);
+  size_t offset = 0;
+
   if (!leftover_bytes_.empty()) {
-    // There is a record starting from leftover bytes.
-    if (leftover_bytes_.size() < 8) {
-      // Header was previously incomplete, but we have enough now.
-      // Copy bytes into |leftover_bytes_| so that the whole header is present,
-      // and update |byte_offset| and |size| accordingly.
-      size_t needed_bytes = 8 - leftover_bytes_.size();
-      leftover_bytes_.insert(leftover_bytes_.end(), data.get() + byte_offset,
-                             data.get() + needed_bytes);
-      byte_offset += needed_bytes;
-      size -= needed_bytes;
+    // Complete the header of the partial record first, if needed, to know
+    // how many bytes are missing.
+    if (leftover_bytes_.size() < sizeof(uint64_t)) {
+      size_t needed = std::min(sizeof(uint64_t) - leftover_bytes_.size(), size);
+      leftover_bytes_.insert(leftover_bytes_.end(), chunk.data(),
+                             chunk.data() + needed);
+      offset += needed;
+      if (leftover_bytes_.size() < sizeof(uint64_t))
+        return util::OkStatus();
     }
-    // Read the record length from the header.
-    uint64_t header =
-        *reinterpret_cast<const uint64_t*>(leftover_bytes_.data());
-    uint32_t record_len_words =
-        fuchsia_trace_utils::ReadField<uint32_t>(header, 4, 15);
-    uint32_t record_len_bytes = record_len_words * sizeof(uint64_t);
-
-    // From property (2) above, leftover_bytes_ must have had less than a full
-    // record to start with. We padded leftover_bytes_ out to read the header,
-    // so it may now be a full record (in the case that the record consists of
-    // only the header word), but it still cannot have any extra bytes.
+
+    uint64_t header;
+    memcpy(&header, leftover_bytes_.data(), sizeof(header));
+    size_t record_len_bytes =
+        fuchsia_trace_utils::ReadField<uint32_t>(header, 4, 15) *
+        sizeof(uint64_t);
+    if (record_len_bytes == 0)
+      return util::ErrStatus("Unexpected record of size 0");
+
+    // |leftover_bytes_| never holds a complete record before this chunk was
+    // received but, as it may only have been padded to a full header above,
+    // it can now be one (when the record consists of only the header word).
     PERFETTO_DCHECK(leftover_bytes_.size() <= record_len_bytes);
     size_t missing_bytes = record_len_bytes - leftover_bytes_.size();
-
-    if (missing_bytes <= size) {
-      // We have enough bytes to complete the partial record. Create a new
-      // buffer for that record.
-      std::unique_ptr<uint8_t[]> buf(new uint8_t[record_len_bytes]);
-      memcpy(&buf[0], leftover_bytes_.data(), leftover_bytes_.size());
-      memcpy(&buf[leftover_bytes_.size()], &data[byte_offset], missing_bytes);
-      byte_offset += missing_bytes;
-      size -= missing_bytes;
-      leftover_bytes_.clear();
-
-      TraceBlobView leftover_record(std::move(buf), 0, record_len_bytes);
-      ParseRecord(std::move(leftover_record));
-    } else {
-      // There are not enough bytes for the full record. Add all the bytes we
-      // have to leftover_bytes_ and wait for more.
-      leftover_bytes_.insert(leftover_bytes_.end(), data.get() + byte_offset,
-                             data.get() + byte_offset + size);
+    if (missing_bytes > size - offset) {
+      leftover_bytes_.insert(leftover_bytes_.end(), chunk.data() + offset,
+                             chunk.data() + size);
       return util::OkStatus();
     }
-  }
 
-  TraceBlobView full_view(std::move(data), byte_offset, size);
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[record_len_bytes]);
+    memcpy(buf.get(), leftover_bytes_.data(), leftover_bytes_.size());
+    memcpy(buf.get() + leftover_bytes_.size(), chunk.data() + offset,
+           missing_bytes);
+    offset += missing_bytes;
+    leftover_bytes_.clear();
+    ParseRecord(TraceBlobView(std::move(buf), 0, record_len_bytes));
+  }
 
-  // |record_offset| is a number of bytes past |byte_offset| where the record
-  // under consideration starts. As a result, it must always be in the range [0,
-  // size-8]. Any larger offset means we don't have enough bytes for the header.
-  size_t record_offset = 0;
-  while (record_offset + 8 <= size) {
-    uint64_t header =
-        *reinterpret_cast<const uint64_t*>(full_view.data() + record_offset);
-    uint32_t record_len_bytes =
+  while (offset + sizeof(uint64_t) <= size) {
+    uint64_t header;
+    memcpy(&header, chunk.data() + offset, sizeof(header));
+    size_t record_len_bytes =
         fuchsia_trace_utils::ReadField<uint32_t>(header, 4, 15) *
         sizeof(uint64_t);
     if (record_len_bytes == 0)
       return util::ErrStatus("Unexpected record of size 0");
 
-    if (record_offset + record_len_bytes > size)
+    if (offset + record_len_bytes > size)
       break;
 
-    TraceBlobView record =
-        full_view.slice(byte_offset + record_offset, record_len_bytes);
-    ParseRecord(std::move(record));
-
-    record_offset += record_len_bytes;
+    ParseRecord(chunk.slice(offset, record_len_bytes));
+    offset += record_len_bytes;
   }
 
-  leftover_bytes_.insert(leftover_bytes_.end(),
-                         full_view.data() + record_offset,
-                         full_view.data() + size);
+  // Buffer the start of the record spanning into the next chunk. Reserving
+  // its full size (when known) avoids growing the buffer again and again if
+  // the record spans many small chunks.
+  if (offset + sizeof(uint64_t) <= size) {
+    uint64_t header;
+    memcpy(&header, chunk.data() + offset, sizeof(header));
+    leftover_bytes_.reserve(
+        fuchsia_trace_utils::ReadField<uint32_t>(header, 4, 15) *
+        sizeof(uint64_t));
+  }
+  leftover_bytes_.insert(leftover_bytes_.end(), chunk.data() + offset,
+                         chunk.data() + size);
   return util::OkStatus();
 }
 
@@ -253,7 +230,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
         }
         StringId id = storage->InternString(s);
 
-        current_provider_->string_table[index] = id;
+        current_provider_->SetString(index, id);
       }
       break;
     }
@@ -266,7 +243,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
           return;
         }
 
-        current_provider_->thread_table[index] = tinfo;
+        current_provider_->SetThread(index, tinfo);
       }
       break;
     }
@@ -282,7 +259,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
       // information if not inline, and any non-inline strings (name, category
       // for now, arg names and string values in the future).
       auto record =
-          std::unique_ptr<FuchsiaRecord>(new FuchsiaRecord(std::move(tbv)));
+          sorter->payload_arena()->Make<FuchsiaRecord>(std::move(tbv));
       record->set_ticks_per_second(current_provider_->ticks_per_second);
 
       uint64_t ticks;
@@ -302,14 +279,14 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
         cursor.ReadInlineThread(nullptr);
       } else {
         record->InsertThread(thread_ref,
-                             current_provider_->thread_table[thread_ref]);
+                             current_provider_->GetThread(thread_ref));
       }
 
       if (fuchsia_trace_utils::IsInlineString(cat_ref)) {
         // Skip over inline string
         cursor.ReadInlineString(cat_ref, nullptr);
       } else {
-        record->InsertString(cat_ref, current_provider_->string_table[cat_ref]);
+        record->InsertString(cat_ref, current_provider_->GetString(cat_ref));
       }
 
       if (fuchsia_trace_utils::IsInlineString(name_ref)) {
@@ -317,7 +294,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
         cursor.ReadInlineString(name_ref, nullptr);
       } else {
         record->InsertString(name_ref,
-                             current_provider_->string_table[name_ref]);
+                             current_provider_->GetString(name_ref));
       }
 
       uint32_t n_args =
@@ -341,7 +318,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
           cursor.ReadInlineString(arg_name_ref, nullptr);
         } else {
           record->InsertString(arg_name_ref,
-                               current_provider_->string_table[arg_name_ref]);
+                               current_provider_->GetString(arg_name_ref));
         }
 
         if (arg_type == kArgString) {
@@ -352,7 +329,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
             cursor.ReadInlineString(arg_value_ref, nullptr);
           } else {
             record->InsertString(
-                arg_value_ref, current_provider_->string_table[arg_value_ref]);
+                arg_value_ref, current_provider_->GetString(arg_value_ref));
           }
         }
 
@@ -383,7 +360,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
         }
         name = storage->InternString(name_view);
       } else {
-        name = current_provider_->string_table[name_ref];
+        name = current_provider_->GetString(name_ref);
       }
 
       switch (obj_type) {
@@ -425,7 +402,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
                 }
               } else {
                 arg_name = storage->GetString(
-                    current_provider_->string_table[arg_name_ref]);
+                    current_provider_->GetString(arg_name_ref));
               }
 
               if (arg_name == "process") {
@@ -483,7 +460,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
           return;
         }
       } else {
-        outgoing_thread = current_provider_->thread_table[outgoing_thread_ref];
+        outgoing_thread = current_provider_->GetThread(outgoing_thread_ref);
       }
 
       fuchsia_trace_utils::ThreadInfo incoming_thread;
@@ -493,7 +470,7 @@ void FuchsiaTraceTokenizer::ParseRecord(TraceBlobView tbv) {
           return;
         }
       } else {
-        incoming_thread = current_provider_->thread_table[incoming_thread_ref];
+        incoming_thread = current_provider_->GetThread(incoming_thread_ref);
       }
 
       // A thread with priority 0 represents an idle CPU
@@ -17,6 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FUCHSIA_FUCHSIA_TRACE_TOKENIZER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FUCHSIA_FUCHSIA_TRACE_TOKENIZER_H_
 
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_utils.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -39,11 +44,33 @@ class FuchsiaTraceTokenizer : public ChunkedTraceReader {
   void NotifyEndOfFile() override;
 
  private:
+  // The string and thread tables of a provider. String refs are 15 bit and
+  // thread refs 8 bit indices so both are stored as dense arrays, grown on
+  // demand, instead of hash maps which are looked up for every event.
   struct ProviderInfo {
+    StringId GetString(uint32_t index) const {
+      return index < string_table.size() ? string_table[index] : StringId();
+    }
+    void SetString(uint32_t index, StringId id) {
+      if (index >= string_table.size())
+        string_table.resize(index + 1);
+      string_table[index] = id;
+    }
+
+    fuchsia_trace_utils::ThreadInfo GetThread(uint32_t index) const {
+      return index < thread_table.size() ? thread_table[index]
+                                         : fuchsia_trace_utils::ThreadInfo();
+    }
+    void SetThread(uint32_t index, fuchsia_trace_utils::ThreadInfo info) {
+      if (index >= thread_table.size())
+        thread_table.resize(index + 1);
+      thread_table[index] = info;
+    }
+
     std::string name;
 
-    std::unordered_map<uint64_t, StringId> string_table;
-    std::unordered_map<uint64_t, fuchsia_trace_utils::ThreadInfo> thread_table;
+    std::vector<StringId> string_table;
+    std::vector<fuchsia_trace_utils::ThreadInfo> thread_table;
 
     uint64_t ticks_per_second = 1000000000;
   };
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/json/json_event_scanner.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <limits>
+
+#include "perfetto/ext/base/string_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+
+namespace {
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool IsHexDigit(char c) {
+  return IsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+const char* SkipSpaces(const char* s, const char* end) {
+  while (s < end && IsSpace(*s))
+    s++;
+  return s;
+}
+
+// Skips over the JSON number starting at |s|; returns nullptr if it is not a
+// valid number.
+const char* SkipNumber(const char* s, const char* end) {
+  if (s < end && *s == '-')
+    s++;
+  if (s == end || !IsDigit(*s))
+    return nullptr;
+  if (*s++ != '0') {
+    while (s < end && IsDigit(*s))
+      s++;
+  }
+  if (s < end && *s == '.') {
+    if (++s == end || !IsDigit(*s))
+      return nullptr;
+    while (s < end && IsDigit(*s))
+      s++;
+  }
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    if (++s < end && (*s == '+' || *s == '-'))
+      s++;
+    if (s == end || !IsDigit(*s))
+      return nullptr;
+    while (s < end && IsDigit(*s))
+      s++;
+  }
+  return s;
+}
+
+bool SkipLiteral(const char** s, const char* end, base::StringView literal) {
+  if (static_cast<size_t>(end - *s) < literal.size() ||
+      memcmp(*s, literal.data(), literal.size()) != 0) {
+    return false;
+  }
+  *s += literal.size();
+  return true;
+}
+
+}  // namespace
+
+// static
+constexpr uint32_t JsonObjectScanner::kMaxDepth;
+
+bool ScannedValue::is_integer() const {
+  if (type != Type::kNumber)
+    return false;
+  for (char c : data) {
+    if (c == '.' || c == 'e' || c == 'E')
+      return false;
+  }
+  return true;
+}
+
+base::Optional<int64_t> ScannedValue::AsInt64() const {
+  if (!is_integer())
+    return base::nullopt;
+  bool negative = data.at(0) == '-';
+  // Accumulate the absolute value as an uint64_t to detect overflows.
+  uint64_t abs = 0;
+  for (size_t i = negative ? 1 : 0; i < data.size(); ++i) {
+    auto digit = static_cast<uint64_t>(data.at(i) - '0');
+    if (abs > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+      return base::nullopt;
+    abs = abs * 10 + digit;
+  }
+  auto max = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+  if (!negative)
+    return abs <= max ? base::make_optional(static_cast<int64_t>(abs))
+                      : base::nullopt;
+  if (abs > max + 1)
+    return base::nullopt;
+  return abs == max + 1 ? std::numeric_limits<int64_t>::min()
+                        : -static_cast<int64_t>(abs);
+}
+
+base::Optional<double> ScannedValue::AsDouble() const {
+  if (type != Type::kNumber)
+    return base::nullopt;
+  // Numbers are not null terminated in the JSON so they need to be copied.
+  char buffer[64];
+  if (data.size() >= sizeof(buffer))
+    return base::nullopt;
+  memcpy(buffer, data.data(), data.size());
+  buffer[data.size()] = '\0';
+  base::Optional<double> value = base::CStringToDouble(buffer);
+  if (!value || !isfinite(*value))
+    return base::nullopt;
+  return value;
+}
+
+JsonObjectScanner::JsonObjectScanner(base::StringView object)
+    : end_(object.data() + object.size()) {
+  next_ = SkipSpaces(object.data(), end_);
+  if (next_ == end_ || *next_ != '{') {
+    Fail();
+    return;
+  }
+  next_++;
+}
+
+bool JsonObjectScanner::Next() {
+  if (!ok_ || done_)
+    return false;
+
+  const char* s = SkipSpaces(next_, end_);
+  if (s == end_)
+    return Fail();
+  if (*s == '}') {
+    done_ = true;
+    // Nothing but whitespace is allowed after the object.
+    if (SkipSpaces(s + 1, end_) != end_)
+      return Fail();
+    return false;
+  }
+  if (!first_) {
+    if (*s != ',')
+      return Fail();
+    s = SkipSpaces(s + 1, end_);
+  }
+  first_ = false;
+  if (s == end_ || *s != '"')
+    return Fail();
+
+  const char* key_start = ++s;
+  bool key_has_escapes = false;
+  if (!SkipString(&s, &key_has_escapes) || key_has_escapes)
+    return Fail();
+  key_ = base::StringView(key_start, static_cast<size_t>(s - 1 - key_start));
+
+  s = SkipSpaces(s, end_);
+  if (s == end_ || *s != ':')
+    return Fail();
+  s = SkipSpaces(s + 1, end_);
+  if (!ScanValue(&s, 1, &value_))
+    return Fail();
+  next_ = s;
+  return true;
+}
+
+bool JsonObjectScanner::ScanValue(const char** s,
+                                  uint32_t depth,
+                                  ScannedValue* value) {
+  const char* start = *s;
+  if (start == end_)
+    return false;
+
+  value->has_escapes = false;
+  switch (*start) {
+    case '"': {
+      *s = start + 1;
+      if (!SkipString(s, &value->has_escapes))
+        return false;
+      value->type = ScannedValue::Type::kString;
+      value->data =
+          base::StringView(start + 1, static_cast<size_t>(*s - 2 - start));
+      return true;
+    }
+    case '{':
+      if (depth >= kMaxDepth)
+        return false;
+      *s = start + 1;
+      if (!SkipObject(s, depth + 1))
+        return false;
+      value->type = ScannedValue::Type::kObject;
+      break;
+    case '[':
+      if (depth >= kMaxDepth)
+        return false;
+      *s = start + 1;
+      if (!SkipArray(s, depth + 1))
+        return false;
+      value->type = ScannedValue::Type::kArray;
+      break;
+    case 't':
+      if (!SkipLiteral(s, end_, "true"))
+        return false;
+      value->type = ScannedValue::Type::kTrue;
+      break;
+    case 'f':
+      if (!SkipLiteral(s, end_, "false"))
+        return false;
+      value->type = ScannedValue::Type::kFalse;
+      break;
+    case 'n':
+      if (!SkipLiteral(s, end_, "null"))
+        return false;
+      value->type = ScannedValue::Type::kNull;
+      break;
+    default:
+      *s = SkipNumber(start, end_);
+      if (!*s)
+        return false;
+      value->type = ScannedValue::Type::kNumber;
+      break;
+  }
+  value->data = base::StringView(start, static_cast<size_t>(*s - start));
+  return true;
+}
+
+bool JsonObjectScanner::SkipString(const char** s, bool* has_escapes) {
+  const char* p = *s;
+  for (;;) {
+    const auto* quote =
+        static_cast<const char*>(memchr(p, '"', static_cast<size_t>(end_ - p)));
+    if (!quote)
+      return false;
+    const auto* backslash = static_cast<const char*>(
+        memchr(p, '\\', static_cast<size_t>(quote - p)));
+    if (!backslash) {
+      *s = quote + 1;
+      return true;
+    }
+
+    // Validate (but do not decode) the escape sequence and carry on after it:
+    // the quote found above may be escaped.
+    *has_escapes = true;
+    p = backslash + 1;
+    if (p == end_)
+      return false;
+    switch (*p) {
+      case '"':
+      case '\\':
+      case '/':
+      case 'b':
+      case 'f':
+      case 'n':
+      case 'r':
+      case 't':
+        p++;
+        break;
+      case 'u':
+        if (end_ - p < 5)
+          return false;
+        for (int i = 1; i <= 4; ++i) {
+          if (!IsHexDigit(p[i]))
+            return false;
+        }
+        p += 5;
+        break;
+      default:
+        return false;
+    }
+  }
+}
+
+bool JsonObjectScanner::SkipObject(const char** s, uint32_t depth) {
+  const char* p = SkipSpaces(*s, end_);
+  if (p < end_ && *p == '}') {
+    *s = p + 1;
+    return true;
+  }
+  for (;;) {
+    if (p == end_ || *p != '"')
+      return false;
+    p++;
+    bool unused;
+    if (!SkipString(&p, &unused))
+      return false;
+    p = SkipSpaces(p, end_);
+    if (p == end_ || *p != ':')
+      return false;
+    p = SkipSpaces(p + 1, end_);
+    ScannedValue value;
+    if (!ScanValue(&p, depth, &value))
+      return false;
+    p = SkipSpaces(p, end_);
+    if (p == end_)
+      return false;
+    if (*p == '}') {
+      *s = p + 1;
+      return true;
+    }
+    if (*p != ',')
+      return false;
+    p = SkipSpaces(p + 1, end_);
+  }
+}
+
+bool JsonObjectScanner::SkipArray(const char** s, uint32_t depth) {
+  const char* p = SkipSpaces(*s, end_);
+  if (p < end_ && *p == ']') {
+    *s = p + 1;
+    return true;
+  }
+  for (;;) {
+    ScannedValue value;
+    if (!ScanValue(&p, depth, &value))
+      return false;
+    p = SkipSpaces(p, end_);
+    if (p == end_)
+      return false;
+    if (*p == ']') {
+      *s = p + 1;
+      return true;
+    }
+    if (*p != ',')
+      return false;
+    p = SkipSpaces(p + 1, end_);
+  }
+}
+
+bool ScanEvent(base::StringView event, ScannedEvent* out) {
+  *out = ScannedEvent();
+  JsonObjectScanner scanner(event);
+  while (scanner.Next()) {
+    base::StringView key = scanner.key();
+    ScannedValue* field = nullptr;
+    if (key == "ph") {
+      field = &out->ph;
+    } else if (key == "ts") {
+      field = &out->ts;
+    } else if (key == "pid") {
+      field = &out->pid;
+    } else if (key == "tid") {
+      field = &out->tid;
+    } else if (key == "cat") {
+      field = &out->cat;
+    } else if (key == "name") {
+      field = &out->name;
+    } else if (key == "dur") {
+      field = &out->dur;
+    } else if (key == "tts") {
+      field = &out->tts;
+    } else if (key == "tdur") {
+      field = &out->tdur;
+    } else if (key == "args") {
+      field = &out->args;
+    } else if (key == "bind_id") {
+      field = &out->bind_id;
+    } else if (key == "flow_in") {
+      field = &out->flow_in;
+    } else if (key == "flow_out") {
+      field = &out->flow_out;
+    } else {
+      continue;
+    }
+    if (!field->is_none())
+      return false;
+    *field = scanner.value();
+  }
+  return scanner.ok();
+}
+
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
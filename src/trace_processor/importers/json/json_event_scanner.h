@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_JSON_JSON_EVENT_SCANNER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_JSON_JSON_EVENT_SCANNER_H_
+
+#include <stdint.h>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/string_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+
+// A JSON value, as a view into the JSON it was scanned from.
+struct ScannedValue {
+  enum class Type {
+    kNone,  // The value is absent.
+    kNull,
+    kFalse,
+    kTrue,
+    kNumber,
+    kString,
+    kObject,
+    kArray,
+  };
+  Type type = Type::kNone;
+
+  // For strings, the characters between the quotes, which may contain escape
+  // sequences if |has_escapes| is true. For all the other types, the JSON text
+  // of the value.
+  base::StringView data;
+  bool has_escapes = false;
+
+  bool is_none() const { return type == Type::kNone; }
+
+  // Returns whether the value is a string which can be used as-is (i.e.
+  // without decoding any escape sequence).
+  bool is_plain_string() const {
+    return type == Type::kString && !has_escapes;
+  }
+
+  // Returns whether the value is an integer number (i.e. a number which
+  // jsoncpp parses as an integer rather than as a double).
+  bool is_integer() const;
+
+  // Returns the value of an integer number if it fits in an int64_t.
+  base::Optional<int64_t> AsInt64() const;
+
+  // Returns the value of a number (which is parsed as a double as jsoncpp
+  // would). Returns nullopt if it is not finite.
+  base::Optional<double> AsDouble() const;
+};
+
+// Iterates over the members of a JSON object without building a DOM: only the
+// boundaries of the keys and values are found (skipping over the contents of
+// strings with memchr, which is vectorized by the C library). This is used to
+// extract the few fields needed to import the common trace events at a small
+// fraction of the cost of parsing them with jsoncpp.
+//
+// The object is fully validated while iterating: nested values are skipped but
+// must be valid JSON too. Valid JSON which this scanner does not support (e.g.
+// values nested more than kMaxDepth levels deep) as well as the extensions
+// accepted by jsoncpp (comments, trailing commas...) are reported as errors so
+// that callers can fall back to jsoncpp for them.
+//
+// Usage:
+//   JsonObjectScanner scanner(object);
+//   while (scanner.Next()) {
+//     ... scanner.key() ... scanner.value() ...
+//   }
+//   if (!scanner.ok()) { ... }
+class JsonObjectScanner {
+ public:
+  static constexpr uint32_t kMaxDepth = 32;
+
+  explicit JsonObjectScanner(base::StringView object);
+
+  // Advances to the next member of the object. Returns false once all the
+  // members have been returned or if the object is invalid (in which case
+  // ok() returns false).
+  bool Next();
+
+  // Whether no error was found (so far) in the object.
+  bool ok() const { return ok_; }
+
+  // The key and the value of the current member. Keys with escape sequences
+  // are reported as errors.
+  base::StringView key() const { return key_; }
+  const ScannedValue& value() const { return value_; }
+
+ private:
+  // Scans the value starting at |*s|, which must be preceded by |depth|
+  // levels of objects and arrays, and points |*s| to the character after it.
+  // Returns false if the value is invalid.
+  bool ScanValue(const char** s, uint32_t depth, ScannedValue* value);
+
+  // Skips over the string starting after the quote at |*s - 1| and points
+  // |*s| to the character after its closing quote.
+  bool SkipString(const char** s, bool* has_escapes);
+
+  // Skips over the members of the object or the elements of the array
+  // starting after the brace or bracket at |*s - 1|.
+  bool SkipObject(const char** s, uint32_t depth);
+  bool SkipArray(const char** s, uint32_t depth);
+
+  bool Fail() {
+    ok_ = false;
+    return false;
+  }
+
+  const char* next_ = nullptr;
+  const char* end_ = nullptr;
+  bool ok_ = true;
+  bool first_ = true;
+  bool done_ = false;
+
+  base::StringView key_;
+  ScannedValue value_;
+};
+
+// The top level fields of a JSON trace event which are used to import it.
+struct ScannedEvent {
+  ScannedValue ph;
+  ScannedValue ts;
+  ScannedValue pid;
+  ScannedValue tid;
+  ScannedValue cat;
+  ScannedValue name;
+  ScannedValue dur;
+  ScannedValue tts;
+  ScannedValue tdur;
+  ScannedValue args;
+  ScannedValue bind_id;
+  ScannedValue flow_in;
+  ScannedValue flow_out;
+};
+
+// Scans the fields of |event| into |out|. Returns false if |event| is not a
+// JSON object accepted by JsonObjectScanner or if one of the fields of
+// ScannedEvent appears more than once (as jsoncpp keeps the last one while the
+// tokenizer looks at the first one).
+bool ScanEvent(base::StringView event, ScannedEvent* out);
+
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_JSON_JSON_EVENT_SCANNER_H_
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/json/json_event_scanner.h"
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+namespace {
+
+using Type = ScannedValue::Type;
+
+// Returns the "key=value" strings of the members of |object|, or nullopt if
+// it is not accepted by the scanner.
+base::Optional<std::vector<std::string>> Scan(const char* object) {
+  std::vector<std::string> members;
+  JsonObjectScanner scanner(object);
+  while (scanner.Next()) {
+    members.push_back(scanner.key().ToStdString() + "=" +
+                      scanner.value().data.ToStdString());
+  }
+  if (!scanner.ok())
+    return base::nullopt;
+  return members;
+}
+
+ScannedValue ScanValue(const char* json) {
+  std::string object = std::string("{\"v\":") + json + "}";
+  JsonObjectScanner scanner{base::StringView(object)};
+  EXPECT_TRUE(scanner.Next());
+  ScannedValue value = scanner.value();
+  // The data points into |object|; only keep the type and the flags.
+  value.data = base::StringView();
+  return value;
+}
+
+TEST(JsonEventScannerTest, Members) {
+  using S = std::vector<std::string>;
+  ASSERT_EQ(*Scan("{}"), S{});
+  ASSERT_EQ(*Scan(" { } "), S{});
+  ASSERT_EQ(*Scan(R"({"a": 1, "b" : "x\"y" ,"c":{"d":[1, {}, []]}})"),
+            (S{"a=1", R"(b=x\"y)", R"(c={"d":[1, {}, []]})"}));
+  ASSERT_EQ(*Scan(R"({"a":true,"b":false,"c":null,"d":-1.5e+3})"),
+            (S{"a=true", "b=false", "c=null", "d=-1.5e+3"}));
+}
+
+TEST(JsonEventScannerTest, Types) {
+  ASSERT_EQ(ScanValue("null").type, Type::kNull);
+  ASSERT_EQ(ScanValue("true").type, Type::kTrue);
+  ASSERT_EQ(ScanValue("false").type, Type::kFalse);
+  ASSERT_EQ(ScanValue("0").type, Type::kNumber);
+  ASSERT_EQ(ScanValue("\"\"").type, Type::kString);
+  ASSERT_FALSE(ScanValue("\"a\"").has_escapes);
+  ASSERT_TRUE(ScanValue(R"("\\")").has_escapes);
+  ASSERT_TRUE(ScanValue(R"("\u00e9")").has_escapes);
+  ASSERT_EQ(ScanValue("{\"a\": {}}").type, Type::kObject);
+  ASSERT_EQ(ScanValue("[[], 1]").type, Type::kArray);
+}
+
+TEST(JsonEventScannerTest, InvalidOrUnsupported) {
+  ASSERT_FALSE(Scan(""));
+  ASSERT_FALSE(Scan("[]"));
+  ASSERT_FALSE(Scan("{"));
+  ASSERT_FALSE(Scan(R"({"a":1)"));
+  ASSERT_FALSE(Scan(R"({"a":1,})"));
+  ASSERT_FALSE(Scan(R"({"a":[1,]})"));
+  ASSERT_FALSE(Scan(R"({"a":1} x)"));
+  ASSERT_FALSE(Scan(R"({"a" 1})"));
+  ASSERT_FALSE(Scan(R"({a:1})"));
+  ASSERT_FALSE(Scan(R"({"a":01})"));
+  ASSERT_FALSE(Scan(R"({"a":1.})"));
+  ASSERT_FALSE(Scan(R"({"a":tru})"));
+  ASSERT_FALSE(Scan(R"({"a":"\x"})"));
+  ASSERT_FALSE(Scan(R"({"a":"\u12"})"));
+  ASSERT_FALSE(Scan(R"({"a":"b})"));
+  ASSERT_FALSE(Scan(R"({"a":1 /* comment */})"));
+  // Keys with escape sequences are not supported.
+  ASSERT_FALSE(Scan(R"({"\u0061":1})"));
+
+  std::string deep = "{\"a\":";
+  for (uint32_t i = 0; i < JsonObjectScanner::kMaxDepth; ++i)
+    deep += "[";
+  for (uint32_t i = 0; i < JsonObjectScanner::kMaxDepth; ++i)
+    deep += "]";
+  deep += "}";
+  ASSERT_FALSE(Scan(deep.c_str()));
+}
+
+TEST(JsonEventScannerTest, Numbers) {
+  auto number = [](const char* text) {
+    ScannedValue value;
+    value.type = Type::kNumber;
+    value.data = text;
+    return value;
+  };
+  ASSERT_TRUE(number("-12").is_integer());
+  ASSERT_FALSE(number("1.0").is_integer());
+  ASSERT_FALSE(number("1e3").is_integer());
+  ASSERT_EQ(number("-12").AsInt64(), -12);
+  ASSERT_EQ(number("9223372036854775807").AsInt64(),
+            std::numeric_limits<int64_t>::max());
+  ASSERT_EQ(number("-9223372036854775808").AsInt64(),
+            std::numeric_limits<int64_t>::min());
+  ASSERT_FALSE(number("9223372036854775808").AsInt64());
+  ASSERT_FALSE(number("123456789012345678901").AsInt64());
+  ASSERT_FALSE(number("1.5").AsInt64());
+  ASSERT_EQ(number("1.5").AsDouble(), 1.5);
+  ASSERT_EQ(number("-2E2").AsDouble(), -200.0);
+  ASSERT_FALSE(number("1e999").AsDouble());
+}
+
+TEST(JsonEventScannerTest, ScanEvent) {
+  ScannedEvent event;
+  ASSERT_TRUE(ScanEvent(
+      R"({"ph":"X","ts":12.5,"pid":1,"name":"a","args":{"x":1},"other":[]})",
+      &event));
+  ASSERT_EQ(event.ph.data, "X");
+  ASSERT_EQ(event.ts.data, "12.5");
+  ASSERT_EQ(event.pid.data, "1");
+  ASSERT_TRUE(event.tid.is_none());
+  ASSERT_EQ(event.name.data, "a");
+  ASSERT_EQ(event.args.type, Type::kObject);
+  ASSERT_EQ(event.args.data, R"({"x":1})");
+
+  // Duplicated fields are rejected but other keys may be duplicated.
+  ASSERT_FALSE(ScanEvent(R"({"ts":1,"ts":2})", &event));
+  ASSERT_TRUE(ScanEvent(R"({"ts":1,"x":2,"x":3})", &event));
+}
+
+}  // namespace
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
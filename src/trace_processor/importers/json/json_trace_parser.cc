@@ -16,6 +16,9 @@
 
 #include "src/trace_processor/importers/json/json_trace_parser.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <cinttypes>
 #include <limits>
 #include <string>
@@ -55,9 +58,116 @@ base::Optional<uint64_t> MaybeExtractFlowIdentifier(const Json::Value& value,
   return base::CStringToUInt64(c_string, 16);
 }
 
+// The functions below coerce scanned values in the same way as the functions
+// with the same name coerce the corresponding Json::Value. They return false
+// for the (uncommon) values which they do not support, which then need to be
+// parsed by jsoncpp.
+
+bool CoerceToUint32(const json::ScannedValue& value,
+                    base::Optional<uint32_t>* out) {
+  using Type = json::ScannedValue::Type;
+  *out = base::nullopt;
+  if (value.type == Type::kNumber) {
+    base::Optional<int64_t> n = value.AsInt64();
+    if (!n)
+      return false;
+    if (*n >= 0 && *n <= std::numeric_limits<uint32_t>::max())
+      *out = static_cast<uint32_t>(*n);
+    return true;
+  }
+  return value.type != Type::kString;
+}
+
+bool CoerceToTs(json::TimeUnit unit,
+                const json::ScannedValue& value,
+                base::Optional<int64_t>* out) {
+  using Type = json::ScannedValue::Type;
+  *out = base::nullopt;
+  if (value.type == Type::kString) {
+    if (value.has_escapes)
+      return false;
+    *out = json::CoerceToTs(unit, value.data.ToStdString());
+    return true;
+  }
+  if (value.type != Type::kNumber)
+    return true;
+  auto factor = static_cast<int64_t>(unit);
+  if (value.is_integer()) {
+    base::Optional<int64_t> n = value.AsInt64();
+    if (!n)
+      return false;
+    *out = *n * factor;
+    return true;
+  }
+  base::Optional<double> d = value.AsDouble();
+  if (!d)
+    return false;
+  *out = static_cast<int64_t>(*d * static_cast<double>(factor));
+  return true;
+}
+
+bool CoerceToString(const json::ScannedValue& value, base::StringView* out) {
+  *out = value.is_plain_string() ? value.data : base::StringView();
+  return value.is_none() || value.is_plain_string();
+}
+
+bool CoerceToBool(const json::ScannedValue& value, bool* out) {
+  using Type = json::ScannedValue::Type;
+  *out = value.type == Type::kTrue;
+  return value.is_none() || value.type == Type::kNull ||
+         value.type == Type::kTrue || value.type == Type::kFalse;
+}
+
+bool MaybeExtractFlowIdentifier(const json::ScannedValue& value,
+                                base::Optional<uint64_t>* out) {
+  using Type = json::ScannedValue::Type;
+  *out = base::nullopt;
+  if (value.type == Type::kNumber) {
+    base::Optional<int64_t> n = value.AsInt64();
+    if (!n || *n < 0)
+      return false;
+    *out = static_cast<uint64_t>(*n);
+    return true;
+  }
+  if (value.type == Type::kString) {
+    if (value.has_escapes)
+      return false;
+    *out = base::StringToUInt64(value.data.ToStdString(), 16);
+  }
+  return true;
+}
+
+// Orders the members of JSON objects in the order in which jsoncpp iterates
+// over them.
+bool JsonKeyLess(base::StringView a, base::StringView b) {
+  int cmp = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+  return cmp < 0 || (cmp == 0 && a.size() < b.size());
+}
+
 }  // namespace
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 
+// The fields of a 'B', 'E' or 'X' event (which are the vast majority of the
+// events of JSON traces) used to import it.
+struct JsonTraceParser::SliceEvent {
+  char phase = 0;
+  uint32_t pid = 0;
+  uint32_t tid = 0;
+  base::StringView cat;
+  base::StringView name;
+  base::Optional<int64_t> dur;
+  base::Optional<int64_t> tts;
+  base::Optional<int64_t> tdur;
+
+  // Version 2 flow fields; |flow_in| and |flow_out| are only set if there is
+  // a |bind_id|.
+  base::Optional<uint64_t> bind_id;
+  bool flow_in = false;
+  bool flow_out = false;
+
+  SliceTracker::SetArgsCallback args;
+};
+
 JsonTraceParser::JsonTraceParser(TraceProcessorContext* context)
     : context_(context), systrace_line_parser_(context) {}
 
@@ -81,6 +191,19 @@ void JsonTraceParser::ParseTracePacket(int64_t timestamp,
     return;
   }
 
+  // Most events are slices which can be imported without parsing them with
+  // jsoncpp (which builds a tree of heap allocated values for each event).
+  json::ScannedEvent scanned;
+  SliceEvent slice_event;
+  if (json::ScanEvent(base::StringView(ttp.json_value), &scanned) &&
+      MaybeScanSliceEvent(scanned, &slice_event)) {
+    slice_event.args = [this, &scanned](ArgsTracker::BoundInserter* inserter) {
+      AddScannedArgs(scanned.args, inserter);
+    };
+    ParseSliceEvent(timestamp, slice_event);
+    return;
+  }
+
   auto opt_value = json::ParseJsonString(base::StringView(ttp.json_value));
   if (!opt_value) {
     context_->storage->IncrementStats(stats::json_parser_failure);
@@ -116,10 +239,6 @@ void JsonTraceParser::ParseTracePacket(int64_t timestamp,
                               ? base::StringView(value["name"].asCString())
                               : base::StringView();
 
-  StringId cat_id = storage->InternString(cat);
-  StringId name_id = storage->InternString(name);
-  UniqueTid utid = procs->UpdateThread(tid, pid);
-
   auto args_inserter = [this, &value](ArgsTracker::BoundInserter* inserter) {
     if (value.isMember("args")) {
       json::AddJsonValueToArgs(value["args"], /* flat_key = */ "args",
@@ -128,9 +247,39 @@ void JsonTraceParser::ParseTracePacket(int64_t timestamp,
     }
   };
 
-  // Only used for 'B', 'E', and 'X' events so wrap in lambda so it gets
-  // ignored in other cases. This lambda is only safe to call within the
-  // scope of this function due to the capture by reference.
+  if (phase == 'B' || phase == 'E' || phase == 'X') {
+    JsonTracker* json_tracker = JsonTracker::GetOrCreate(context_);
+    slice_event = SliceEvent();
+    slice_event.phase = phase;
+    slice_event.pid = pid;
+    slice_event.tid = tid;
+    slice_event.cat = cat;
+    slice_event.name = name;
+    slice_event.dur = json_tracker->CoerceToTs(value["dur"]);
+    slice_event.tts = json_tracker->CoerceToTs(value["tts"]);
+    slice_event.tdur = json_tracker->CoerceToTs(value["tdur"]);
+    if (phase != 'E') {
+      slice_event.bind_id =
+          MaybeExtractFlowIdentifier(value, /* version2 = */ true);
+    }
+    if (slice_event.bind_id) {
+      slice_event.flow_in =
+          value.isMember("flow_in") && value["flow_in"].asBool();
+      slice_event.flow_out =
+          value.isMember("flow_out") && value["flow_out"].asBool();
+    }
+    slice_event.args = args_inserter;
+    ParseSliceEvent(timestamp, slice_event);
+    return;
+  }
+
+  StringId cat_id = storage->InternString(cat);
+  StringId name_id = storage->InternString(name);
+  UniqueTid utid = procs->UpdateThread(tid, pid);
+
+  // Only used for 'i' events so wrap in lambda so it gets ignored in other
+  // cases. This lambda is only safe to call within the scope of this function
+  // due to the capture by reference.
   auto make_thread_slice_row = [&](TrackId track_id) {
     tables::ThreadSliceTable::Row row;
     row.ts = timestamp;
@@ -139,7 +288,6 @@ void JsonTraceParser::ParseTracePacket(int64_t timestamp,
     row.name = name_id;
     row.thread_ts =
         JsonTracker::GetOrCreate(context_)->CoerceToTs(value["tts"]);
-    // tdur will only exist on 'X' events.
     row.thread_dur =
         JsonTracker::GetOrCreate(context_)->CoerceToTs(value["tdur"]);
     // JSON traces don't report these counters as part of slices.
@@ -149,45 +297,6 @@ void JsonTraceParser::ParseTracePacket(int64_t timestamp,
   };
 
   switch (phase) {
-    case 'B': {  // TRACE_EVENT_BEGIN.
-      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      slice_tracker->BeginTyped(storage->mutable_thread_slice_table(),
-                                make_thread_slice_row(track_id), args_inserter);
-      MaybeAddFlow(track_id, value);
-      break;
-    }
-    case 'E': {  // TRACE_EVENT_END.
-      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      auto opt_slice_id = slice_tracker->End(timestamp, track_id, cat_id,
-                                             name_id, args_inserter);
-      // Now try to update thread_dur if we have a tts field.
-      auto opt_tts =
-          JsonTracker::GetOrCreate(context_)->CoerceToTs(value["tts"]);
-      if (opt_slice_id.has_value() && opt_tts) {
-        auto* thread_slice = storage->mutable_thread_slice_table();
-        auto maybe_row = thread_slice->id().IndexOf(*opt_slice_id);
-        PERFETTO_DCHECK(maybe_row.has_value());
-        auto start_tts = thread_slice->thread_ts()[*maybe_row];
-        if (start_tts) {
-          thread_slice->mutable_thread_dur()->Set(*maybe_row,
-                                                  *opt_tts - *start_tts);
-        }
-      }
-      break;
-    }
-    case 'X': {  // TRACE_EVENT (scoped event).
-      base::Optional<int64_t> opt_dur =
-          JsonTracker::GetOrCreate(context_)->CoerceToTs(value["dur"]);
-      if (!opt_dur.has_value())
-        return;
-      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      auto row = make_thread_slice_row(track_id);
-      row.dur = opt_dur.value();
-      slice_tracker->ScopedTyped(storage->mutable_thread_slice_table(),
-                                 std::move(row), args_inserter);
-      MaybeAddFlow(track_id, value);
-      break;
-    }
     case 'C': {  // TRACE_EVENT_COUNTER
       auto args = value["args"];
       if (!args.isObject()) {
@@ -332,28 +441,235 @@ void JsonTraceParser::ParseTracePacket(int64_t timestamp,
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 }
 
-void JsonTraceParser::MaybeAddFlow(TrackId track_id, const Json::Value& event) {
+bool JsonTraceParser::MaybeScanSliceEvent(const json::ScannedEvent& scanned,
+                                          SliceEvent* event) {
   PERFETTO_DCHECK(json::IsJsonSupported());
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
-  auto opt_bind_id = MaybeExtractFlowIdentifier(event, /* version2 = */ true);
-  if (opt_bind_id) {
-    FlowTracker* flow_tracker = context_->flow_tracker.get();
-    bool flow_out = event.isMember("flow_out") && event["flow_out"].asBool();
-    bool flow_in = event.isMember("flow_in") && event["flow_in"].asBool();
-    if (flow_in && flow_out) {
-      flow_tracker->Step(track_id, opt_bind_id.value());
-    } else if (flow_out) {
-      flow_tracker->Begin(track_id, opt_bind_id.value());
-    } else if (flow_in) {
-      // bind_enclosing_slice is always true for v2 flow events
-      flow_tracker->End(track_id, opt_bind_id.value(), true,
-                        /* close_flow = */ false);
-    } else {
-      context_->storage->IncrementStats(stats::flow_without_direction);
+  if (!scanned.ph.is_plain_string() || scanned.ph.data.empty())
+    return false;
+  char phase = scanned.ph.data.at(0);
+  if (phase != 'B' && phase != 'E' && phase != 'X')
+    return false;
+  event->phase = phase;
+
+  base::Optional<uint32_t> opt_pid;
+  base::Optional<uint32_t> opt_tid;
+  if (!CoerceToUint32(scanned.pid, &opt_pid) ||
+      !CoerceToUint32(scanned.tid, &opt_tid)) {
+    return false;
+  }
+  event->pid = opt_pid.value_or(0);
+  event->tid = opt_tid.value_or(event->pid);
+
+  json::TimeUnit unit = JsonTracker::GetOrCreate(context_)->time_unit();
+  if (!CoerceToString(scanned.cat, &event->cat) ||
+      !CoerceToString(scanned.name, &event->name) ||
+      !CoerceToTs(unit, scanned.dur, &event->dur) ||
+      !CoerceToTs(unit, scanned.tts, &event->tts) ||
+      !CoerceToTs(unit, scanned.tdur, &event->tdur)) {
+    return false;
+  }
+
+  if (phase != 'E' &&
+      !MaybeExtractFlowIdentifier(scanned.bind_id, &event->bind_id)) {
+    return false;
+  }
+  if (event->bind_id && (!CoerceToBool(scanned.flow_in, &event->flow_in) ||
+                         !CoerceToBool(scanned.flow_out, &event->flow_out))) {
+    return false;
+  }
+
+  // Non-object args are left to AddJsonValueToArgs.
+  return scanned.args.is_none() ||
+         scanned.args.type == json::ScannedValue::Type::kObject;
+#else
+  perfetto::base::ignore_result(scanned);
+  perfetto::base::ignore_result(event);
+  return false;
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+}
+
+void JsonTraceParser::AddScannedArgs(const json::ScannedValue& args,
+                                     ArgsTracker::BoundInserter* inserter) {
+  PERFETTO_DCHECK(json::IsJsonSupported());
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+  using Type = json::ScannedValue::Type;
+  if (args.is_none())
+    return;
+  PERFETTO_DCHECK(args.type == Type::kObject);
+
+  // Args are usually flat objects, whose members can be added directly. Any
+  // other object (e.g. with nested values or escape sequences) is parsed by
+  // jsoncpp.
+  bool is_flat = true;
+  scanned_args_.clear();
+  json::JsonObjectScanner scanner(args.data);
+  while (is_flat && scanner.Next()) {
+    const json::ScannedValue& value = scanner.value();
+    switch (value.type) {
+      case Type::kNull:
+      case Type::kFalse:
+      case Type::kTrue:
+        break;
+      case Type::kNumber:
+        is_flat = value.is_integer() ? value.AsInt64().has_value()
+                                     : value.AsDouble().has_value();
+        break;
+      case Type::kString:
+        is_flat = !value.has_escapes;
+        break;
+      case Type::kNone:
+      case Type::kObject:
+      case Type::kArray:
+        is_flat = false;
+        break;
+    }
+    scanned_args_.emplace_back(scanner.key(), value);
+  }
+  // The scanner also stops at keys with escape sequences.
+  is_flat = is_flat && scanner.ok();
+
+  TraceStorage* storage = context_->storage.get();
+  if (!is_flat) {
+    auto opt_args = json::ParseJsonString(args.data);
+    PERFETTO_DCHECK(opt_args);
+    if (opt_args) {
+      json::AddJsonValueToArgs(*opt_args, /* flat_key = */ "args",
+                               /* key = */ "args", storage, inserter);
     }
+    return;
   }
+
+  // Add the members in the order in which jsoncpp would iterate over them
+  // and, as jsoncpp does, only keep the last value of duplicated keys.
+  std::stable_sort(
+      scanned_args_.begin(), scanned_args_.end(),
+      [](const std::pair<base::StringView, json::ScannedValue>& a,
+         const std::pair<base::StringView, json::ScannedValue>& b) {
+        return JsonKeyLess(a.first, b.first);
+      });
+  for (size_t i = 0; i < scanned_args_.size(); ++i) {
+    base::StringView key = scanned_args_[i].first;
+    if (i + 1 < scanned_args_.size() && scanned_args_[i + 1].first == key)
+      continue;
+
+    args_key_.assign("args.");
+    args_key_.append(key.data(), key.size());
+    StringId key_id = storage->InternString(base::StringView(args_key_));
+
+    const json::ScannedValue& value = scanned_args_[i].second;
+    switch (value.type) {
+      case Type::kFalse:
+      case Type::kTrue:
+        inserter->AddArg(key_id, key_id,
+                         Variadic::Boolean(value.type == Type::kTrue));
+        break;
+      case Type::kNumber:
+        if (value.is_integer()) {
+          inserter->AddArg(key_id, key_id, Variadic::Integer(*value.AsInt64()));
+        } else {
+          inserter->AddArg(key_id, key_id, Variadic::Real(*value.AsDouble()));
+        }
+        break;
+      case Type::kString:
+        inserter->AddArg(key_id, key_id,
+                         Variadic::String(storage->InternString(value.data)));
+        break;
+      case Type::kNull:
+      case Type::kNone:
+      case Type::kObject:
+      case Type::kArray:
+        break;
+    }
+  }
+#else
+  perfetto::base::ignore_result(args);
+  perfetto::base::ignore_result(inserter);
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 }
 
+void JsonTraceParser::ParseSliceEvent(int64_t timestamp,
+                                      const SliceEvent& event) {
+  TraceStorage* storage = context_->storage.get();
+  SliceTracker* slice_tracker = context_->slice_tracker.get();
+
+  StringId cat_id = storage->InternString(event.cat);
+  StringId name_id = storage->InternString(event.name);
+  UniqueTid utid =
+      context_->process_tracker->UpdateThread(event.tid, event.pid);
+
+  auto make_thread_slice_row = [&](TrackId track_id) {
+    tables::ThreadSliceTable::Row row;
+    row.ts = timestamp;
+    row.track_id = track_id;
+    row.category = cat_id;
+    row.name = name_id;
+    row.thread_ts = event.tts;
+    // tdur will only exist on 'X' events.
+    row.thread_dur = event.tdur;
+    // JSON traces don't report these counters as part of slices.
+    row.thread_instruction_count = base::nullopt;
+    row.thread_instruction_delta = base::nullopt;
+    return row;
+  };
+
+  switch (event.phase) {
+    case 'B': {  // TRACE_EVENT_BEGIN.
+      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
+      slice_tracker->BeginTyped(storage->mutable_thread_slice_table(),
+                                make_thread_slice_row(track_id), event.args);
+      MaybeAddFlow(track_id, event);
+      break;
+    }
+    case 'E': {  // TRACE_EVENT_END.
+      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
+      auto opt_slice_id = slice_tracker->End(timestamp, track_id, cat_id,
+                                             name_id, event.args);
+      // Now try to update thread_dur if we have a tts field.
+      if (opt_slice_id.has_value() && event.tts) {
+        auto* thread_slice = storage->mutable_thread_slice_table();
+        auto maybe_row = thread_slice->id().IndexOf(*opt_slice_id);
+        PERFETTO_DCHECK(maybe_row.has_value());
+        auto start_tts = thread_slice->thread_ts()[*maybe_row];
+        if (start_tts) {
+          thread_slice->mutable_thread_dur()->Set(*maybe_row,
+                                                  *event.tts - *start_tts);
+        }
+      }
+      break;
+    }
+    case 'X': {  // TRACE_EVENT (scoped event).
+      if (!event.dur.has_value())
+        return;
+      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
+      auto row = make_thread_slice_row(track_id);
+      row.dur = event.dur.value();
+      slice_tracker->ScopedTyped(storage->mutable_thread_slice_table(),
+                                 std::move(row), event.args);
+      MaybeAddFlow(track_id, event);
+      break;
+    }
+    default:
+      PERFETTO_FATAL("Not a slice event");
+  }
+}
+
+void JsonTraceParser::MaybeAddFlow(TrackId track_id, const SliceEvent& event) {
+  if (!event.bind_id)
+    return;
+  FlowTracker* flow_tracker = context_->flow_tracker.get();
+  if (event.flow_in && event.flow_out) {
+    flow_tracker->Step(track_id, event.bind_id.value());
+  } else if (event.flow_out) {
+    flow_tracker->Begin(track_id, event.bind_id.value());
+  } else if (event.flow_in) {
+    // bind_enclosing_slice is always true for v2 flow events
+    flow_tracker->End(track_id, event.bind_id.value(), true,
+                      /* close_flow = */ false);
+  } else {
+    context_->storage->IncrementStats(stats::flow_without_direction);
+  }
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -20,10 +20,15 @@
 #include <stdint.h>
 
 #include <memory>
+#include <string>
 #include <tuple>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/trace_parser.h"
+#include "src/trace_processor/importers/json/json_event_scanner.h"
 #include "src/trace_processor/importers/json/json_tracker.h"
 #include "src/trace_processor/importers/systrace/systrace_line_parser.h"
 #include "src/trace_processor/timestamped_trace_piece.h"
@@ -49,10 +54,29 @@ class JsonTraceParser : public TraceParser {
   void ParseFtracePacket(uint32_t, int64_t, TimestampedTracePiece) override;
 
  private:
+  struct SliceEvent;
+
+  // Extracts the fields of the 'B', 'E' or 'X' event |event| directly from its
+  // JSON. Returns false if |event| is another type of event or if any of its
+  // fields need to be parsed by jsoncpp (e.g. because they contain escape
+  // sequences), in which case the whole event is parsed by jsoncpp instead.
+  bool MaybeScanSliceEvent(const json::ScannedEvent& scanned,
+                           SliceEvent* event);
+
+  // Adds the scanned "args" object of an event to |inserter|, as
+  // json::AddJsonValueToArgs would.
+  void AddScannedArgs(const json::ScannedValue& args,
+                      ArgsTracker::BoundInserter* inserter);
+
+  void ParseSliceEvent(int64_t timestamp, const SliceEvent& event);
+  void MaybeAddFlow(TrackId track_id, const SliceEvent& event);
+
   TraceProcessorContext* const context_;
   SystraceLineParser systrace_line_parser_;
 
-  void MaybeAddFlow(TrackId track_id, const Json::Value& event);
+  // Reused by AddScannedArgs to avoid allocating for each event.
+  std::vector<std::pair<base::StringView, json::ScannedValue>> scanned_args_;
+  std::string args_key_;
 };
 
 }  // namespace trace_processor
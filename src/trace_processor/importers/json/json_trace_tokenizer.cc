@@ -16,11 +16,14 @@
 
 #include "src/trace_processor/importers/json/json_trace_tokenizer.h"
 
+#include <string.h>
+
 #include <memory>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/string_utils.h"
 
+#include "src/trace_processor/importers/json/json_event_scanner.h"
 #include "src/trace_processor/importers/json/json_tracker.h"
 #include "src/trace_processor/importers/json/json_utils.h"
 #include "src/trace_processor/storage/stats.h"
@@ -104,6 +107,33 @@ ReadStringRes ReadOneJsonString(const char* start,
   return ReadStringRes::kNeedsMoreData;
 }
 
+// Returns a pointer to the closing quote of the JSON string whose characters
+// start at |s| or nullptr if it does not end before |end|.
+const char* FindEndOfJsonString(const char* s, const char* end) {
+  for (const char* start = s;;) {
+    const auto* quote =
+        static_cast<const char*>(memchr(s, '"', static_cast<size_t>(end - s)));
+    if (!quote)
+      return nullptr;
+
+    // The quote is escaped if it is preceded by an odd number of backslashes.
+    const char* backslashes = quote;
+    while (backslashes > start && backslashes[-1] == '\\')
+      backslashes--;
+    if ((quote - backslashes) % 2 == 0)
+      return quote;
+    s = quote + 1;
+  }
+}
+
+// Returns a scanned value in the form ExtractValueForJsonKey returns it (for
+// values without escape sequences).
+base::Optional<std::string> RawValue(const json::ScannedValue& value) {
+  if (value.is_none())
+    return base::nullopt;
+  return value.data.ToStdString();
+}
+
 }  // namespace
 
 ReadDictRes ReadOneJsonDict(const char* start,
@@ -113,21 +143,16 @@ ReadDictRes ReadOneJsonDict(const char* start,
   int braces = 0;
   int square_brackets = 0;
   const char* dict_begin = nullptr;
-  bool in_string = false;
-  bool is_escaping = false;
   for (const char* s = start; s < end; s++) {
     if (isspace(*s) || *s == ',')
       continue;
-    if (*s == '"' && !is_escaping) {
-      in_string = !in_string;
-      continue;
-    }
-    if (in_string) {
-      // If we're in a string and we see a backslash and the last character was
-      // not a backslash the next character is escaped:
-      is_escaping = *s == '\\' && !is_escaping;
-      // If we're currently parsing a string we should ignore otherwise special
-      // characters:
+    if (*s == '"') {
+      // Otherwise special characters are ignored inside strings, so skip
+      // directly to the closing quote (which is what this function spends
+      // most of its time on for typical events).
+      s = FindEndOfJsonString(s + 1, end);
+      if (!s)
+        return ReadDictRes::kNeedsMoreData;
       continue;
     }
     if (*s == '{') {
@@ -572,9 +597,10 @@ util::Status JsonTraceTokenizer::ParseInternal(const char* start,
         if (base::StartsWith(raw_line, "#") || raw_line.empty())
           continue;
 
-        std::unique_ptr<SystraceLine> line(new SystraceLine());
-        util::Status status =
-            systrace_line_tokenizer_.Tokenize(raw_line, line.get());
+        ArenaPtr<SystraceLine> line =
+            trace_sorter->payload_arena()->Make<SystraceLine>();
+        util::Status status = systrace_line_tokenizer_.Tokenize(
+            base::StringView(raw_line), line.get());
         if (!status.ok())
           return status;
         trace_sorter->PushSystraceLine(std::move(line));
@@ -616,8 +642,19 @@ util::Status JsonTraceTokenizer::ParseInternal(const char* start,
           break;
         }
 
+        // Scanning the event finds both the keys we need in a single pass; only
+        // events with unusual shapes (e.g. escaped values) are looked up key by
+        // key.
+        json::ScannedEvent event;
+        bool scanned = json::ScanEvent(unparsed, &event) &&
+                       !event.ts.has_escapes && !event.ph.has_escapes;
+
         base::Optional<std::string> opt_raw_ts;
-        RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ts", &opt_raw_ts));
+        if (scanned) {
+          opt_raw_ts = RawValue(event.ts);
+        } else {
+          RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ts", &opt_raw_ts));
+        }
         base::Optional<int64_t> opt_ts =
             opt_raw_ts ? json_tracker->CoerceToTs(*opt_raw_ts) : base::nullopt;
         int64_t ts = 0;
@@ -626,7 +663,12 @@ util::Status JsonTraceTokenizer::ParseInternal(const char* start,
         } else {
           // Metadata events may omit ts. In all other cases error:
           base::Optional<std::string> opt_raw_ph;
-          RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ph", &opt_raw_ph));
+          if (scanned) {
+            opt_raw_ph = RawValue(event.ph);
+          } else {
+            RETURN_IF_ERROR(
+                ExtractValueForJsonKey(unparsed, "ph", &opt_raw_ph));
+          }
           if (!opt_raw_ph || *opt_raw_ph != "M") {
             context_->storage->IncrementStats(stats::json_tokenizer_failure);
             continue;
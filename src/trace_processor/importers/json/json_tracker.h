@@ -43,6 +43,7 @@ class JsonTracker : public Destructible {
   }
 
   void SetTimeUnit(json::TimeUnit time_unit) { time_unit_ = time_unit; }
+  json::TimeUnit time_unit() const { return time_unit_; }
 
   base::Optional<int64_t> CoerceToTs(const Json::Value& value) {
     return json::CoerceToTs(time_unit_, value);
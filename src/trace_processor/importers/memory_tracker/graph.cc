@@ -46,14 +46,16 @@ void GlobalNodeGraph::AddNodeOwnershipEdge(Node* owner,
                                            Node* owned,
                                            int importance) {
   all_edges_.emplace_front(owner, owned, importance);
-  Edge* edge = &*all_edges_.begin();
+  Edge* edge = &all_edges_.front();
   owner->SetOwnsEdge(edge);
   owned->AddOwnedByEdge(edge);
 }
 
 Node* GlobalNodeGraph::CreateNode(Process* process_graph, Node* parent) {
   all_nodes_.emplace_front(process_graph, parent);
-  return &*all_nodes_.begin();
+  Node* node = &all_nodes_.front();
+  node->index_ = static_cast<uint32_t>(all_nodes_.size() - 1);
+  return node;
 }
 
 PreOrderIterator GlobalNodeGraph::VisitInDepthFirstPreOrder() {
@@ -199,15 +201,15 @@ Node* PreOrderIterator::next() {
     to_visit_.pop_back();
 
     // If the node has already been visited, don't visit it again.
-    if (visited_.count(node) != 0)
+    if (visited_.Contains(node))
       continue;
 
     // If we haven't visited the node which this node owns then wait for that.
-    if (node->owns_edge() && visited_.count(node->owns_edge()->target()) == 0)
+    if (node->owns_edge() && !visited_.Contains(node->owns_edge()->target()))
       continue;
 
     // If we haven't visited the node's parent then wait for that.
-    if (node->parent() && visited_.count(node->parent()) == 0)
+    if (node->parent() && !visited_.Contains(node->parent()))
       continue;
 
     // Visit all children of this node.
@@ -223,7 +225,7 @@ Node* PreOrderIterator::next() {
     }
 
     // Add this node to the visited set.
-    visited_.insert(node);
+    visited_.Insert(node);
     return node;
   }
   return nullptr;
@@ -242,14 +244,14 @@ Node* PostOrderIterator::next() {
     to_visit_.pop_back();
 
     // If the node has already been visited, don't visit it again.
-    if (visited_.count(node) != 0)
+    if (visited_.Contains(node))
       continue;
 
     // If the node is at the top of the path, we have already looked
     // at its children and owners.
     if (!path_.empty() && path_.back() == node) {
       // Mark the current node as visited so we don't visit again.
-      visited_.insert(node);
+      visited_.Insert(node);
 
       // The current node is no longer on the path.
       path_.pop_back();
@@ -17,6 +17,7 @@
 #include "perfetto/ext/trace_processor/importers/memory_tracker/graph_processor.h"
 
 #include <list>
+#include <utility>
 
 namespace perfetto {
 namespace trace_processor {
@@ -96,7 +97,7 @@ void GraphProcessor::RemoveWeakNodesFromGraph(GlobalNodeGraph* global_graph) {
   // Fourth pass: recursively mark nodes as weak if they own a node which is
   // weak or if they have a parent who is weak.
   {
-    std::set<const Node*> visited;
+    GlobalNodeGraph::VisitedSet visited;
     MarkWeakOwnersAndChildrenRecursively(global_root, &visited);
     for (const auto& pid_to_process : global_graph->process_node_graphs()) {
       MarkWeakOwnersAndChildrenRecursively(pid_to_process.second->root(),
@@ -338,103 +339,131 @@ void GraphProcessor::AddEdges(const RawProcessMemoryNode& source,
 }
 
 // static
-void GraphProcessor::MarkImplicitWeakParentsRecursively(Node* node) {
-  // Ensure that we aren't in a bad state where we have an implicit node
-  // which doesn't have any children (which is not the root node).
-  PERFETTO_DCHECK(node->is_explicit() || !node->children()->empty() ||
-                  !node->parent());
-
-  // Check that at this stage, any node which is weak is only so because
-  // it was explicitly created as such.
-  PERFETTO_DCHECK(!node->is_weak() || node->is_explicit());
-
-  // If a node is already weak then all children will be marked weak at a
-  // later stage.
-  if (node->is_weak())
-    return;
+void GraphProcessor::MarkImplicitWeakParentsRecursively(Node* root) {
+  // Visit the nodes in post-order so that all the children of a node are
+  // marked before the node itself. The second element of each pair is set
+  // once the children of the node have been pushed.
+  std::vector<std::pair<Node*, bool>> to_visit{{root, false}};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back().first;
+    if (to_visit.back().second) {
+      to_visit.pop_back();
+
+      // If all the children are weak and the parent is only an implicit one
+      // then we consider the parent as weak as well and we will later remove
+      // it.
+      bool all_children_weak = true;
+      for (const auto& path_to_child : *node->children()) {
+        all_children_weak =
+            all_children_weak && path_to_child.second->is_weak();
+      }
+      node->set_weak(!node->is_explicit() && all_children_weak);
+      continue;
+    }
 
-  // Recurse into each child and find out if all the children of this node are
-  // weak.
-  bool all_children_weak = true;
-  for (const auto& path_to_child : *node->children()) {
-    MarkImplicitWeakParentsRecursively(path_to_child.second);
-    all_children_weak = all_children_weak && path_to_child.second->is_weak();
-  }
+    // Ensure that we aren't in a bad state where we have an implicit node
+    // which doesn't have any children (which is not the root node).
+    PERFETTO_DCHECK(node->is_explicit() || !node->children()->empty() ||
+                    !node->parent());
 
-  // If all the children are weak and the parent is only an implicit one then we
-  // consider the parent as weak as well and we will later remove it.
-  node->set_weak(!node->is_explicit() && all_children_weak);
+    // Check that at this stage, any node which is weak is only so because
+    // it was explicitly created as such.
+    PERFETTO_DCHECK(!node->is_weak() || node->is_explicit());
+
+    // If a node is already weak then all children will be marked weak at a
+    // later stage.
+    if (node->is_weak()) {
+      to_visit.pop_back();
+      continue;
+    }
+
+    to_visit.back().second = true;
+    for (const auto& path_to_child : *node->children())
+      to_visit.emplace_back(path_to_child.second, false);
+  }
 }
 
 // static
 void GraphProcessor::MarkWeakOwnersAndChildrenRecursively(
-    Node* node,
-    std::set<const Node*>* visited) {
-  // If we've already visited this node then nothing to do.
-  if (visited->count(node) != 0)
-    return;
-
-  // If we haven't visited the node which this node owns then wait for that.
-  if (node->owns_edge() && visited->count(node->owns_edge()->target()) == 0)
-    return;
+    Node* root,
+    GlobalNodeGraph::VisitedSet* visited) {
+  // The nodes are pushed in reverse order so that they are visited in the
+  // same order as a recursive traversal would: owners first, then children.
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    // If we've already visited this node then nothing to do.
+    if (visited->Contains(node))
+      continue;
 
-  // If we haven't visited the node's parent then wait for that.
-  if (node->parent() && visited->count(node->parent()) == 0)
-    return;
+    // If we haven't visited the node which this node owns then wait for that.
+    if (node->owns_edge() && !visited->Contains(node->owns_edge()->target()))
+      continue;
 
-  // If either the node we own or our parent is weak, then mark this node
-  // as weak.
-  if ((node->owns_edge() && node->owns_edge()->target()->is_weak()) ||
-      (node->parent() && node->parent()->is_weak())) {
-    node->set_weak(true);
-  }
-  visited->insert(node);
+    // If we haven't visited the node's parent then wait for that.
+    if (node->parent() && !visited->Contains(node->parent()))
+      continue;
 
-  // Recurse into each owner node to mark any other nodes.
-  for (auto* owned_by_edge : *node->owned_by_edges()) {
-    MarkWeakOwnersAndChildrenRecursively(owned_by_edge->source(), visited);
-  }
+    // If either the node we own or our parent is weak, then mark this node
+    // as weak.
+    if ((node->owns_edge() && node->owns_edge()->target()->is_weak()) ||
+        (node->parent() && node->parent()->is_weak())) {
+      node->set_weak(true);
+    }
+    visited->Insert(node);
 
-  // Recurse into each child and find out if all the children of this node are
-  // weak.
-  for (const auto& path_to_child : *node->children()) {
-    MarkWeakOwnersAndChildrenRecursively(path_to_child.second, visited);
+    // Visit each child and each owner node to mark any other nodes.
+    for (auto it = node->children()->rbegin(); it != node->children()->rend();
+         ++it) {
+      to_visit.push_back(it->second);
+    }
+    for (auto it = node->owned_by_edges()->rbegin();
+         it != node->owned_by_edges()->rend(); ++it) {
+      to_visit.push_back((*it)->source());
+    }
   }
 }
 
 // static
-void GraphProcessor::RemoveWeakNodesRecursively(Node* node) {
-  auto* children = node->children();
-  for (auto child_it = children->begin(); child_it != children->end();) {
-    Node* child = child_it->second;
-
-    // If the node is weak, remove it. This automatically makes all
-    // descendents unreachable from the parents. If this node owned
-    // by another, it will have been marked earlier in
-    // |MarkWeakOwnersAndChildrenRecursively| and so will be removed
-    // by this method at some point.
-    if (child->is_weak()) {
-      child_it = children->erase(child_it);
-      continue;
-    }
-
-    // We should never be in a situation where we're about to
-    // keep a node which owns a weak node (which will be/has been
-    // removed).
-    PERFETTO_DCHECK(!child->owns_edge() ||
-                    !child->owns_edge()->target()->is_weak());
-
-    // Descend and remove all weak child nodes.
-    RemoveWeakNodesRecursively(child);
-
-    // Remove all edges with owner nodes which are weak.
-    std::vector<Edge*>* owned_by_edges = child->owned_by_edges();
-    auto new_end =
-        std::remove_if(owned_by_edges->begin(), owned_by_edges->end(),
-                       [](Edge* edge) { return edge->source()->is_weak(); });
-    owned_by_edges->erase(new_end, owned_by_edges->end());
+void GraphProcessor::RemoveWeakNodesRecursively(Node* root) {
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    auto* children = node->children();
+    for (auto child_it = children->begin(); child_it != children->end();) {
+      Node* child = child_it->second;
+
+      // If the node is weak, remove it. This automatically makes all
+      // descendents unreachable from the parents. If this node owned
+      // by another, it will have been marked earlier in
+      // |MarkWeakOwnersAndChildrenRecursively| and so will be removed
+      // by this method at some point.
+      if (child->is_weak()) {
+        child_it = children->erase(child_it);
+        continue;
+      }
 
-    ++child_it;
+      // We should never be in a situation where we're about to
+      // keep a node which owns a weak node (which will be/has been
+      // removed).
+      PERFETTO_DCHECK(!child->owns_edge() ||
+                      !child->owns_edge()->target()->is_weak());
+
+      // Remove all edges with owner nodes which are weak.
+      std::vector<Edge*>* owned_by_edges = child->owned_by_edges();
+      auto new_end =
+          std::remove_if(owned_by_edges->begin(), owned_by_edges->end(),
+                         [](Edge* edge) { return edge->source()->is_weak(); });
+      owned_by_edges->erase(new_end, owned_by_edges->end());
+
+      // Descend and remove all weak child nodes.
+      to_visit.push_back(child);
+      ++child_it;
+    }
   }
 }
 
@@ -498,34 +527,56 @@ Node::Entry GraphProcessor::AggregateNumericWithNameForNode(
 }
 
 // static
-void GraphProcessor::AggregateNumericsRecursively(Node* node) {
-  std::set<std::string> numeric_names;
+void GraphProcessor::AggregateNumericsRecursively(Node* root) {
+  // Visit the nodes in post-order so that the entries of the children of a
+  // node are aggregated before the node itself. The second element of each
+  // pair is set once the children of the node have been pushed.
+  std::vector<std::pair<Node*, bool>> to_visit{{root, false}};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back().first;
+    if (!to_visit.back().second) {
+      to_visit.back().second = true;
+      for (const auto& path_to_child : *node->children())
+        to_visit.emplace_back(path_to_child.second, false);
+      continue;
+    }
+    to_visit.pop_back();
 
-  for (const auto& path_to_child : *node->children()) {
-    AggregateNumericsRecursively(path_to_child.second);
-    for (const auto& name_to_entry : *path_to_child.second->entries()) {
-      const std::string& name = name_to_entry.first;
-      if (name_to_entry.second.type == Node::Entry::Type::kUInt64 &&
-          name != kSizeEntryName && name != kEffectiveSizeEntryName) {
-        numeric_names.insert(name);
+    std::set<std::string> numeric_names;
+    for (const auto& path_to_child : *node->children()) {
+      for (const auto& name_to_entry : *path_to_child.second->entries()) {
+        const std::string& name = name_to_entry.first;
+        if (name_to_entry.second.type == Node::Entry::Type::kUInt64 &&
+            name != kSizeEntryName && name != kEffectiveSizeEntryName) {
+          numeric_names.insert(name);
+        }
       }
     }
-  }
 
-  for (auto& name : numeric_names) {
-    node->entries()->emplace(name, AggregateNumericWithNameForNode(node, name));
+    for (auto& name : numeric_names) {
+      node->entries()->emplace(name,
+                               AggregateNumericWithNameForNode(node, name));
+    }
   }
 }
 
 // static
-void GraphProcessor::PropagateNumericsAndDiagnosticsRecursively(Node* node) {
-  for (const auto& name_to_entry : *node->entries()) {
-    for (auto* edge : *node->owned_by_edges()) {
-      edge->source()->entries()->insert(name_to_entry);
+void GraphProcessor::PropagateNumericsAndDiagnosticsRecursively(Node* root) {
+  // The children are pushed in reverse order so that they are visited in the
+  // same order as a recursive traversal would.
+  std::vector<Node*> to_visit{root};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+    for (const auto& name_to_entry : *node->entries()) {
+      for (auto* edge : *node->owned_by_edges()) {
+        edge->source()->entries()->insert(name_to_entry);
+      }
+    }
+    for (auto it = node->children()->rbegin(); it != node->children()->rend();
+         ++it) {
+      to_visit.push_back(it->second);
     }
-  }
-  for (const auto& path_to_child : *node->children()) {
-    PropagateNumericsAndDiagnosticsRecursively(path_to_child.second);
   }
 }
 
@@ -533,23 +584,26 @@ void GraphProcessor::PropagateNumericsAndDiagnosticsRecursively(Node* node) {
 base::Optional<uint64_t> GraphProcessor::AggregateSizeForDescendantNode(
     Node* root,
     Node* descendant) {
-  Edge* owns_edge = descendant->owns_edge();
-  if (owns_edge && owns_edge->target()->IsDescendentOf(*root))
-    return base::make_optional(0UL);
-
-  if (descendant->children()->empty())
-    return GetSizeEntryOfNode(descendant).value_or(0ul);
-
-  base::Optional<uint64_t> size;
-  for (const auto& path_to_child : *descendant->children()) {
-    auto c_size = AggregateSizeForDescendantNode(root, path_to_child.second);
-    if (size) {
-      *size += c_size.value_or(0);
-    } else {
-      size = std::move(c_size);
+  // Sum the sizes of the leaves under |descendant|, skipping the subtrees
+  // whose top node owns another node under |root|.
+  uint64_t size = 0;
+  std::vector<Node*> to_visit{descendant};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+
+    Edge* owns_edge = node->owns_edge();
+    if (owns_edge && owns_edge->target()->IsDescendentOf(*root))
+      continue;
+
+    if (node->children()->empty()) {
+      size += GetSizeEntryOfNode(node).value_or(0ul);
+      continue;
     }
+    for (const auto& path_to_child : *node->children())
+      to_visit.push_back(path_to_child.second);
   }
-  return size;
+  return base::make_optional(size);
 }
 
 // Assumes that this function has been called on all children and owner nodes.
@@ -45,7 +45,7 @@ class GraphProcessorTest : public testing::Test {
   }
 
   void MarkWeakOwnersAndChildrenRecursively(Node* node) {
-    std::set<const Node*> visited;
+    GlobalNodeGraph::VisitedSet visited;
     GraphProcessor::MarkWeakOwnersAndChildrenRecursively(node, &visited);
   }
 
@@ -123,6 +123,27 @@ TEST(GlobalNodeGraphTest, VisitInDepthFirstPreOrder) {
   ASSERT_EQ(iterator.next(), nullptr);
 }
 
+TEST(GlobalNodeGraphTest, VisitedSet) {
+  GlobalNodeGraph graph;
+  Process* process = graph.CreateGraphForProcess(1);
+  Node* c1 = process->CreateNode(kEmptyId, "c1", false);
+  Node* c1_c1 = process->CreateNode(kEmptyId, "c1/c1", false);
+
+  // The nodes are numbered in creation order after the roots of the shared
+  // and process graphs.
+  ASSERT_EQ(graph.shared_memory_graph()->root()->index(), 0u);
+  ASSERT_EQ(process->root()->index(), 1u);
+  ASSERT_EQ(c1->index(), 2u);
+  ASSERT_EQ(c1_c1->index(), 3u);
+
+  GlobalNodeGraph::VisitedSet visited;
+  ASSERT_FALSE(visited.Contains(c1_c1));
+  visited.Insert(c1_c1);
+  ASSERT_TRUE(visited.Contains(c1_c1));
+  ASSERT_FALSE(visited.Contains(c1));
+  ASSERT_FALSE(visited.Contains(process->root()));
+}
+
 TEST(ProcessTest, CreateAndFindNode) {
   GlobalNodeGraph global_dump_graph;
   Process graph(1, &global_dump_graph);
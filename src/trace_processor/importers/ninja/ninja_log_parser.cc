@@ -16,6 +16,12 @@
 
 #include "src/trace_processor/importers/ninja/ninja_log_parser.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
@@ -29,23 +35,54 @@ namespace trace_processor {
 
 using base::StringSplitter;
 
-NinjaLogParser::NinjaLogParser(TraceProcessorContext* ctx) : ctx_(ctx) {}
+namespace {
+
+// Worker thread ids are allocated from here, well above the pids of the
+// synthesized build processes (which are only known once the whole log has
+// been parsed) so that they never conflict (to avoid main-thread
+// auto-mapping).
+constexpr uint32_t kFirstWorkerTid = 1u << 20;
+
+}  // namespace
+
+NinjaLogParser::NinjaLogParser(TraceProcessorContext* ctx)
+    : ctx_(ctx),
+      build_name_id_(ctx->storage->InternString("Build")),
+      last_worker_tid_(kFirstWorkerTid) {}
 NinjaLogParser::~NinjaLogParser() = default;
 
 util::Status NinjaLogParser::Parse(std::unique_ptr<uint8_t[]> buf, size_t len) {
   // A trace is read in chunks of arbitrary size (for http fetch() pipeliniing),
   // not necessarily aligned on a line boundary.
-  // Here we push everything into a vector and, on each call, consume only
-  // the leading part until the last \n, keeping the rest for the next call.
-  const char* src = reinterpret_cast<const char*>(&buf[0]);
-  log_.insert(log_.end(), src, src + len);
+  // Here we parse the complete lines of the chunk in place and only copy the
+  // trailing partial line, which is completed by the head of the next chunk.
+  char* data = reinterpret_cast<char*>(&buf[0]);
+  char* end = data + len;
+  if (!partial_line_.empty()) {
+    char* eol = static_cast<char*>(memchr(data, '\n', len));
+    if (!eol) {
+      partial_line_.append(data, len);
+      return util::OkStatus();
+    }
+    // StringSplitter needs the line to end with a delimiter.
+    partial_line_.append(data, static_cast<size_t>(eol + 1 - data));
+    util::Status status = ParseLines(&partial_line_[0], partial_line_.size());
+    partial_line_.clear();
+    if (!status.ok())
+      return status;
+    data = eol + 1;
+  }
 
   // Find the last \n.
-  size_t valid_size = log_.size();
-  for (; valid_size > 0 && log_[valid_size - 1] != '\n'; --valid_size) {
+  char* valid_end = end;
+  for (; valid_end > data && valid_end[-1] != '\n'; --valid_end) {
   }
+  partial_line_.assign(valid_end, end);
+  return ParseLines(data, static_cast<size_t>(valid_end - data));
+}
 
-  for (StringSplitter line(log_.data(), valid_size, '\n'); line.Next();) {
+util::Status NinjaLogParser::ParseLines(char* data, size_t size) {
+  for (StringSplitter line(data, size, '\n'); line.Next();) {
     static const char kHeader[] = "# ninja log v";
     if (!header_parsed_) {
       if (!base::StartsWith(line.cur_token(), kHeader))
@@ -98,10 +135,11 @@ util::Status NinjaLogParser::Parse(std::unique_ptr<uint8_t[]> buf, size_t len) {
       // Create a new "process" for each build. In the UI this causes each build
       // to be nested under a track group. |cur_build_id_| is the fake pid
       // of the synthesized process.
+      FlushBuild();
       ++cur_build_id_;
-      StringId name_id = ctx_->storage->InternString("Build");
       ctx_->process_tracker->SetProcessNameIfUnset(
-          ctx_->process_tracker->GetOrCreateProcess(cur_build_id_), name_id);
+          ctx_->process_tracker->GetOrCreateProcess(cur_build_id_),
+          build_name_id_);
     }
     last_end_seen_ = *t_end;
 
@@ -109,20 +147,32 @@ util::Status NinjaLogParser::Parse(std::unique_ptr<uint8_t[]> buf, size_t len) {
     // together as they identify multiple outputs for the same build rule.
     if (!jobs_.empty() && *cmdhash == jobs_.back().hash &&
         *t_start == jobs_.back().start_ms && *t_end == jobs_.back().end_ms) {
-      jobs_.back().names.append(" ");
-      jobs_.back().names.append(name);
+      last_job_names_.append(" ");
+      last_job_names_.append(name);
       continue;
     }
 
-    jobs_.emplace_back(cur_build_id_, *t_start, *t_end, *cmdhash, name);
+    if (!jobs_.empty()) {
+      jobs_.back().names =
+          ctx_->storage->InternString(base::StringView(last_job_names_));
+    }
+    jobs_.emplace_back(Job{*t_start, *t_end, *cmdhash, kNullStringId});
+    last_job_names_.assign(name);
   }
-  log_.erase(log_.begin(), log_.begin() + static_cast<ssize_t>(valid_size));
   return util::OkStatus();
 }
 
-// This is called after the last Parase() call. At this point all |jobs_| have
-// been populated.
+// This is called after the last Parse() call. At this point only the jobs of
+// the last build are left.
 void NinjaLogParser::NotifyEndOfFile() {
+  FlushBuild();
+}
+
+void NinjaLogParser::FlushBuild() {
+  if (jobs_.empty())
+    return;
+  jobs_.back().names =
+      ctx_->storage->InternString(base::StringView(last_job_names_));
   std::sort(jobs_.begin(), jobs_.end(),
             [](const Job& x, const Job& y) { return x.start_ms < y.start_ms; });
 
@@ -140,51 +190,47 @@ void NinjaLogParser::NotifyEndOfFile() {
   // as a consequence of job2 completion (othewise it could have been started
   // earlier, soon after job 1 or Job 3). It seems to make more sense to draw
   // it next in the 2nd worker, i.e. next to job 2.
-  struct Worker {
-    int64_t busy_until;
-    TrackId track_id;
-  };
-  std::map<uint32_t /*build_id*/, std::vector<Worker>> workers_by_build;
-
-  // Assign thread ids to worker without conflicting with builds' process ids
-  // (to avoid main-thread auto-mapping).s
-  uint32_t last_worker_id = cur_build_id_;
+  //
+  // The jobs are swept in start order, keeping the workers ordered by the end
+  // time of their last job, so that the worker to pick is found in O(log N).
+  // The worker index is negated so that, among the workers which became idle
+  // at the same time, the first one created is picked.
+  std::vector<TrackId> worker_tracks;
+  std::set<std::pair<int64_t /*busy_until*/, int64_t /*-index*/>> workers;
 
   for (const auto& job : jobs_) {
-    Worker* worker = nullptr;
-    auto& workers = workers_by_build[job.build_id];
-    for (Worker& cur : workers) {
-      // Pick the worker which has the greatest end time (busy_until) <= the
-      // job's start time.
-      if (cur.busy_until <= job.start_ms) {
-        if (!worker || cur.busy_until > worker->busy_until)
-          worker = &cur;
-      }
-    }
-    if (worker) {
+    // Pick the worker which has the greatest end time (busy_until) <= the
+    // job's start time.
+    auto it = workers.upper_bound(
+        std::make_pair(job.start_ms, std::numeric_limits<int64_t>::max()));
+    size_t worker;
+    if (it != workers.begin()) {
       // Update the worker's end time with the newly assigned job.
-      worker->busy_until = job.end_ms;
+      --it;
+      worker = static_cast<size_t>(-it->second);
+      workers.erase(it);
     } else {
       // All workers are busy, allocate a new one.
-      uint32_t worker_id = ++last_worker_id;
+      worker = worker_tracks.size();
+      uint32_t worker_tid = ++last_worker_tid_;
       char name[32];
-      snprintf(name, sizeof(name), "Worker %zu", workers.size() + 1);
+      snprintf(name, sizeof(name), "Worker %zu", worker + 1);
       StringId name_id = ctx_->storage->InternString(name);
-      auto utid = ctx_->process_tracker->UpdateThread(worker_id, job.build_id);
+      auto utid =
+          ctx_->process_tracker->UpdateThread(worker_tid, cur_build_id_);
       ctx_->process_tracker->UpdateThreadNameByUtid(utid, name_id,
                                                     ThreadNamePriority::kOther);
-      TrackId track_id = ctx_->track_tracker->InternThreadTrack(utid);
-      workers.emplace_back(Worker{/*busy_until=*/job.end_ms, track_id});
-      worker = &workers.back();
+      worker_tracks.push_back(ctx_->track_tracker->InternThreadTrack(utid));
     }
+    workers.emplace(job.end_ms, -static_cast<int64_t>(worker));
 
     static constexpr int64_t kMsToNs = 1000 * 1000;
     const int64_t start_ns = job.start_ms * kMsToNs;
     const int64_t dur_ns = (job.end_ms - job.start_ms) * kMsToNs;
-    StringId name_id = ctx_->storage->InternString(base::StringView(job.names));
-    ctx_->slice_tracker->Scoped(start_ns, worker->track_id, StringId::Null(),
-                                name_id, dur_ns);
+    ctx_->slice_tracker->Scoped(start_ns, worker_tracks[worker],
+                                StringId::Null(), job.names, dur_ns);
   }
+  jobs_.clear();
 }
 
 }  // namespace trace_processor
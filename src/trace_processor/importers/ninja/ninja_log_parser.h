@@ -19,12 +19,12 @@
 
 #include <stdint.h>
 
-#include <map>
 #include <string>
 #include <vector>
 
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/common/trace_parser.h"
+#include "src/trace_processor/storage/trace_storage.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -55,25 +55,40 @@ class NinjaLogParser : public ChunkedTraceReader {
 
  private:
   struct Job {
-    Job(uint32_t b, int64_t s, int64_t e, uint64_t h, const std::string& n)
-        : build_id(b), start_ms(s), end_ms(e), hash(h), names(n) {}
-
-    uint32_t build_id;  // The synthesized PID of the build "process".
     int64_t start_ms;
     int64_t end_ms;
     uint64_t hash;  // Hash of the compiler invocation cmdline.
 
     // Typically the one output for the compiler invocation. In case of actions
     // generating multiple outputs this contains the join of all output names.
-    std::string names;
+    // Only set once the next job is seen, see |last_job_names_|.
+    StringId names;
   };
 
+  // Parses the complete lines in [data, data + size), in place.
+  util::Status ParseLines(char* data, size_t size);
+
+  // Sorts the jobs of the current build, assigns them to workers and turns
+  // them into slices. Called when the next build starts, so that only the jobs
+  // of one build are kept in memory at any time.
+  void FlushBuild();
+
   TraceProcessorContext* const ctx_;
+  const StringId build_name_id_;
   bool header_parsed_ = false;
   int64_t last_end_seen_ = 0;
   uint32_t cur_build_id_ = 0;
+  uint32_t last_worker_tid_;
+
+  // The jobs of the current build.
   std::vector<Job> jobs_;
-  std::vector<char> log_;
+
+  // The output names of the last job of |jobs_|, which more outputs can be
+  // appended to. They are only interned once the job is complete.
+  std::string last_job_names_;
+
+  // The trailing incomplete line of the last chunk passed to Parse().
+  std::string partial_line_;
 };
 
 }  // namespace trace_processor
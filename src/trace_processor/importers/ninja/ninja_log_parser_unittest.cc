@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ninja/ninja_log_parser.h"
+
+#include <string.h>
+
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/common/global_args_tracker.h"
+#include "src/trace_processor/importers/common/process_tracker.h"
+#include "src/trace_processor/importers/common/slice_tracker.h"
+#include "src/trace_processor/importers/common/track_tracker.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class NinjaLogParserTest : public ::testing::Test {
+ public:
+  NinjaLogParserTest() {
+    context_.storage.reset(new TraceStorage());
+    context_.global_args_tracker.reset(new GlobalArgsTracker(&context_));
+    context_.args_tracker.reset(new ArgsTracker(&context_));
+    context_.process_tracker.reset(new ProcessTracker(&context_));
+    context_.track_tracker.reset(new TrackTracker(&context_));
+    context_.slice_tracker.reset(new SliceTracker(&context_));
+    parser_.reset(new NinjaLogParser(&context_));
+  }
+
+ protected:
+  // Passes |log| to the parser in chunks of |chunk_size| bytes.
+  util::Status Parse(const std::string& log, size_t chunk_size) {
+    for (size_t off = 0; off < log.size(); off += chunk_size) {
+      size_t size = std::min(chunk_size, log.size() - off);
+      std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+      memcpy(buf.get(), log.data() + off, size);
+      util::Status status = parser_->Parse(std::move(buf), size);
+      if (!status.ok())
+        return status;
+    }
+    parser_->NotifyEndOfFile();
+    return util::OkStatus();
+  }
+
+  std::string SliceName(uint32_t row) {
+    auto name = context_.storage->slice_table().name()[row];
+    return context_.storage->GetString(*name).ToStdString();
+  }
+
+  // Returns the name of the worker thread of the slice at |row|.
+  std::string SliceWorker(uint32_t row) {
+    const auto& slices = context_.storage->slice_table();
+    const auto& tracks = context_.storage->thread_track_table();
+    auto track_row = tracks.id().IndexOf(slices.track_id()[row]);
+    UniqueTid utid = tracks.utid()[*track_row];
+    auto name = context_.storage->thread_table().name()[utid];
+    return context_.storage->GetString(name).ToStdString();
+  }
+
+  TraceProcessorContext context_;
+  std::unique_ptr<NinjaLogParser> parser_;
+};
+
+constexpr char kLog[] =
+    "# ninja log v5\n"
+    "0\t10\t0\ta.o\t1\n"
+    "0\t20\t0\tb.o\t2\n"
+    "0\t20\t0\tb.h\t2\n"
+    "20\t25\t0\td.o\t4\n"
+    "10\t30\t0\tc.o\t3\n"
+    "30\t40\t0\te.o\t5\n"
+    // A second build starts when the end timestamps go backwards.
+    "0\t5\t0\ta.o\t1\n";
+
+TEST_F(NinjaLogParserTest, AssignsJobsToWorkers) {
+  ASSERT_TRUE(Parse(kLog, sizeof(kLog) - 1).ok());
+
+  const auto& slices = context_.storage->slice_table();
+  ASSERT_EQ(slices.row_count(), 6u);
+
+  // Jobs with the same hash and timestamps are merged.
+  ASSERT_EQ(SliceName(1), "b.o b.h");
+
+  // The slices are sorted by start time: c.o follows a.o and d.o follows
+  // b.o. When e.o starts both workers are idle and it goes to the one which
+  // became idle last, next to c.o.
+  ASSERT_EQ(SliceWorker(0), "Worker 1");
+  ASSERT_EQ(SliceWorker(1), "Worker 2");
+  ASSERT_EQ(SliceName(2), "c.o");
+  ASSERT_EQ(SliceWorker(2), "Worker 1");
+  ASSERT_EQ(SliceWorker(3), "Worker 2");
+  ASSERT_EQ(SliceName(4), "e.o");
+  ASSERT_EQ(SliceWorker(4), "Worker 1");
+  ASSERT_EQ(slices.dur()[4], 10 * 1000 * 1000);
+
+  // The second build is a separate process with its own workers.
+  ASSERT_EQ(SliceWorker(5), "Worker 1");
+  ASSERT_EQ(context_.storage->process_table().row_count(), 3u);
+}
+
+TEST_F(NinjaLogParserTest, LinesSplitAcrossChunks) {
+  ASSERT_TRUE(Parse(kLog, 3).ok());
+  ASSERT_EQ(context_.storage->slice_table().row_count(), 6u);
+  ASSERT_EQ(SliceName(1), "b.o b.h");
+  ASSERT_EQ(context_.storage->stats()[stats::ninja_parse_errors].value, 0);
+}
+
+TEST_F(NinjaLogParserTest, BadHeader) {
+  ASSERT_FALSE(Parse("# ninja log v4\n", 16).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
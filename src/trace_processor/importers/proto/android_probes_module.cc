@@ -168,7 +168,8 @@ void AndroidProbesModule::ParsePacket(const TracePacket::Decoder& decoder,
       parser_.ParsePowerRails(ttp.timestamp, decoder.power_rails());
       return;
     case TracePacket::kAndroidLogFieldNumber:
-      parser_.ParseAndroidLogPacket(decoder.android_log());
+      parser_.ParseAndroidLogPacket(ttp.packet_data.sequence_state.get(),
+                                    decoder.android_log());
       return;
     case TracePacket::kPackagesListFieldNumber:
       parser_.ParseAndroidPackagesList(decoder.packages_list());
@@ -16,13 +16,20 @@
 
 #include "src/trace_processor/importers/proto/android_probes_parser.h"
 
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/traced/sys_stats_counters.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/proto/metadata_tracker.h"
+#include "src/trace_processor/importers/proto/packet_sequence_state.h"
 #include "src/trace_processor/importers/syscalls/syscall_tracker.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
@@ -32,8 +39,10 @@
 #include "protos/perfetto/trace/android/android_log.pbzero.h"
 #include "protos/perfetto/trace/android/initial_display_state.pbzero.h"
 #include "protos/perfetto/trace/android/packages_list.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
 #include "protos/perfetto/trace/power/battery_counters.pbzero.h"
 #include "protos/perfetto/trace/power/power_rails.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
 #include "protos/perfetto/trace/ps/process_stats.pbzero.h"
 #include "protos/perfetto/trace/ps/process_tree.pbzero.h"
 #include "protos/perfetto/trace/sys_stats/sys_stats.pbzero.h"
@@ -44,6 +53,177 @@
 namespace perfetto {
 namespace trace_processor {
 
+namespace {
+
+// The types of the args of the binary encoded events of the EVENTS buffer.
+// See system/core/liblog/include/log/log.h.
+enum AndroidEventLogType {
+  kEventTypeInt = 0,
+  kEventTypeLong = 1,
+  kEventTypeString = 2,
+  kEventTypeList = 3,
+  kEventTypeFloat = 4,
+};
+
+template <typename T>
+bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
+  if (static_cast<size_t>(end - *ptr) < sizeof(T))
+    return false;
+  memcpy(reinterpret_cast<void*>(out), *ptr, sizeof(T));
+  *ptr += sizeof(T);
+  return true;
+}
+
+// Returns the string interned with |iid| in the |FieldId| field of the
+// InternedData or an empty string if there is none.
+template <uint32_t FieldId>
+base::StringView LookupInternedString(PacketSequenceStateGeneration* seq_state,
+                                      uint64_t iid) {
+  if (!seq_state)
+    return base::StringView();
+  auto* decoder = seq_state->LookupInternedMessage<
+      FieldId, protos::pbzero::InternedString>(iid);
+  if (!decoder)
+    return base::StringView();
+  return base::StringView(reinterpret_cast<const char*>(decoder->str().data),
+                          decoder->str().size);
+}
+
+// Formats the args of a log event into its message, e.g. " foo=1 bar="baz"".
+class LogArgsWriter {
+ public:
+  void AppendName(base::StringView name) {
+    Advance(snprintf(cur(), avail(), " %.*s=", static_cast<int>(name.size()),
+                     name.data()));
+  }
+  void AppendString(base::StringView value) {
+    Advance(snprintf(cur(), avail(), "\"%.*s\"",
+                     static_cast<int>(value.size()), value.data()));
+  }
+  void AppendInt(int64_t value) {
+    Advance(snprintf(cur(), avail(), "%" PRId64, value));
+  }
+  void AppendDouble(double value) {
+    Advance(snprintf(cur(), avail(), "%f", value));
+  }
+
+  bool empty() const { return size_ == 0; }
+
+  // Returns the message, skipping the first space char (" foo=1 bar=2" ->
+  // "foo=1 bar=2"). Must not be called if empty.
+  base::StringView GetMessage() const {
+    return base::StringView(&buf_[1], size_ - 1);
+  }
+
+ private:
+  char* cur() { return &buf_[size_]; }
+  size_t avail() const { return sizeof(buf_) - size_; }
+
+  // Messages which don't fit are truncated.
+  void Advance(int res) {
+    if (res > 0)
+      size_ += std::min(static_cast<size_t>(res), avail() - 1);
+  }
+
+  char buf_[4096];
+  size_t size_ = 0;
+};
+
+// Parses the definition of the format of an event of the EVENTS buffer, as
+// found in /system/etc/event-log-tags, e.g.:
+// 2722 battery_level (level|1|6),(voltage|1|1),(temperature|1|1).
+// |name| points into |format|.
+bool ParseEventFormat(const std::string& format,
+                      base::StringView* name,
+                      std::vector<std::string>* fields) {
+  // Skip the numeric id of the event.
+  size_t name_start = format.find(' ');
+  if (name_start == std::string::npos)
+    return false;
+  name_start++;
+  size_t name_end = std::min(format.find(' ', name_start), format.size());
+  *name = base::StringView(format.data() + name_start, name_end - name_start);
+  if (name->empty())
+    return false;
+  if (name_end == format.size())
+    return true;
+
+  // Only the names of the fields are needed: the binary encoding re-states
+  // the types of the args.
+  for (base::StringSplitter field(format.substr(name_end + 1), ',');
+       field.Next();) {
+    if (field.cur_token_size() <= 2)
+      continue;
+    base::StringSplitter parts(field.cur_token() + 1,
+                               field.cur_token_size() - 1, '|');
+    if (parts.Next())
+      fields->emplace_back(parts.cur_token(), parts.cur_token_size());
+  }
+  return true;
+}
+
+// Decodes the args of a binary encoded event of the EVENTS buffer in the same
+// way as AndroidLogDataSource does when they are not passed through.
+void DecodeBinaryArgs(protozero::ConstBytes blob,
+                      const std::vector<std::string>& fields,
+                      LogArgsWriter* args) {
+  const uint8_t* buf = blob.data;
+  const uint8_t* const end = blob.data + blob.size;
+  size_t field_num = 0;
+  while (buf < end && field_num < fields.size()) {
+    uint8_t type = *(buf++);
+    switch (type) {
+      case kEventTypeInt: {
+        int32_t value;
+        if (!ReadAndAdvance(&buf, end, &value))
+          return;
+        args->AppendName(base::StringView(fields[field_num++]));
+        args->AppendInt(value);
+        break;
+      }
+      case kEventTypeLong: {
+        int64_t value;
+        if (!ReadAndAdvance(&buf, end, &value))
+          return;
+        args->AppendName(base::StringView(fields[field_num++]));
+        args->AppendInt(value);
+        break;
+      }
+      case kEventTypeFloat: {
+        float value;
+        if (!ReadAndAdvance(&buf, end, &value))
+          return;
+        args->AppendName(base::StringView(fields[field_num++]));
+        args->AppendDouble(static_cast<double>(value));
+        break;
+      }
+      case kEventTypeString: {
+        uint32_t len;
+        if (!ReadAndAdvance(&buf, end, &len) ||
+            len > static_cast<size_t>(end - buf)) {
+          return;
+        }
+        args->AppendName(base::StringView(fields[field_num++]));
+        args->AppendString(
+            base::StringView(reinterpret_cast<const char*>(buf), len));
+        buf += len;
+        break;
+      }
+      case kEventTypeList:
+        // Lists only have a one byte payload (their length) and, like in
+        // AndroidLogDataSource, are only supported as the top-level node.
+        buf++;
+        if (field_num > 0)
+          return;
+        break;
+      default:
+        return;
+    }
+  }
+}
+
+}  // namespace
+
 AndroidProbesParser::AndroidProbesParser(TraceProcessorContext* context)
     : context_(context),
       batt_charge_id_(context->storage->InternString("batt.charge_uah")),
@@ -115,59 +295,84 @@ void AndroidProbesParser::ParsePowerRails(int64_t ts, ConstBytes blob) {
   PERFETTO_DCHECK(!++it);
 }
 
-void AndroidProbesParser::ParseAndroidLogPacket(ConstBytes blob) {
+void AndroidProbesParser::ParseAndroidLogPacket(
+    PacketSequenceStateGeneration* seq_state,
+    ConstBytes blob) {
   protos::pbzero::AndroidLogPacket::Decoder packet(blob.data, blob.size);
   for (auto it = packet.events(); it; ++it)
-    ParseAndroidLogEvent(*it);
+    ParseAndroidLogEvent(seq_state, *it);
 
   if (packet.has_stats())
     ParseAndroidLogStats(packet.stats());
 }
 
-void AndroidProbesParser::ParseAndroidLogEvent(ConstBytes blob) {
+void AndroidProbesParser::ParseAndroidLogEvent(
+    PacketSequenceStateGeneration* seq_state,
+    ConstBytes blob) {
   // TODO(primiano): Add events and non-stringified fields to the "raw" table.
   protos::pbzero::AndroidLogPacket::LogEvent::Decoder evt(blob.data, blob.size);
   int64_t ts = static_cast<int64_t>(evt.timestamp());
   uint32_t pid = static_cast<uint32_t>(evt.pid());
   uint32_t tid = static_cast<uint32_t>(evt.tid());
   uint8_t prio = static_cast<uint8_t>(evt.prio());
-  StringId tag_id = context_->storage->InternString(
-      evt.has_tag() ? evt.tag() : base::StringView());
+  base::StringView tag;
+  if (evt.has_tag()) {
+    tag = evt.tag();
+  } else if (evt.has_tag_iid()) {
+    tag = LookupInternedString<
+        protos::pbzero::InternedData::kAndroidLogStringsFieldNumber>(
+        seq_state, evt.tag_iid());
+  }
   StringId msg_id = context_->storage->InternString(
       evt.has_message() ? evt.message() : base::StringView());
 
-  char arg_msg[4096];
-  char* arg_str = &arg_msg[0];
-  *arg_str = '\0';
-  auto arg_avail = [&arg_msg, &arg_str]() {
-    return sizeof(arg_msg) - static_cast<size_t>(arg_str - arg_msg);
-  };
+  LogArgsWriter args;
   for (auto it = evt.args(); it; ++it) {
     protos::pbzero::AndroidLogPacket::LogEvent::Arg::Decoder arg(*it);
-    if (!arg.has_name())
+    base::StringView name;
+    if (arg.has_name()) {
+      name = arg.name();
+    } else if (arg.has_name_iid()) {
+      name = LookupInternedString<
+          protos::pbzero::InternedData::kAndroidLogStringsFieldNumber>(
+          seq_state, arg.name_iid());
+    }
+    if (name.empty())
       continue;
-    arg_str +=
-        snprintf(arg_str, arg_avail(),
-                 " %.*s=", static_cast<int>(arg.name().size), arg.name().data);
+    args.AppendName(name);
     if (arg.has_string_value()) {
-      arg_str += snprintf(arg_str, arg_avail(), "\"%.*s\"",
-                          static_cast<int>(arg.string_value().size),
-                          arg.string_value().data);
+      args.AppendString(arg.string_value());
     } else if (arg.has_int_value()) {
-      arg_str += snprintf(arg_str, arg_avail(), "%" PRId64, arg.int_value());
+      args.AppendInt(arg.int_value());
     } else if (arg.has_float_value()) {
-      arg_str += snprintf(arg_str, arg_avail(), "%f",
-                          static_cast<double>(arg.float_value()));
+      args.AppendDouble(static_cast<double>(arg.float_value()));
     }
   }
 
+  // Events of the EVENTS buffer can be left binary encoded by the data source
+  // along with the definition of their format, decode them here instead.
+  std::string event_format;
+  if (evt.has_binary_args()) {
+    using protos::pbzero::InternedData;
+    event_format =
+        LookupInternedString<InternedData::kAndroidLogEventFormatsFieldNumber>(
+            seq_state, evt.event_format_iid())
+            .ToStdString();
+    // If the format is missing, a stat has already been recorded by the
+    // lookup: keep the event but drop its args.
+    std::vector<std::string> fields;
+    if (ParseEventFormat(event_format, &tag, &fields))
+      DecodeBinaryArgs(evt.binary_args(), fields, &args);
+  }
+  StringId tag_id = context_->storage->InternString(tag);
+
   if (prio == 0)
     prio = protos::pbzero::AndroidLogPriority::PRIO_INFO;
 
-  if (arg_str != &arg_msg[0]) {
+  if (!args.empty()) {
     PERFETTO_DCHECK(msg_id.is_null());
     // Skip the first space char (" foo=1 bar=2" -> "foo=1 bar=2").
-    msg_id = context_->storage->InternString(&arg_msg[1]);
+    msg_id = context_->storage->InternString(args.GetMessage());
   }
   UniquePid utid = tid ? context_->process_tracker->UpdateThread(tid, pid) : 0;
   base::Optional<int64_t> opt_trace_time = context_->clock_tracker->ToTraceTime(
@@ -25,6 +25,7 @@
 namespace perfetto {
 namespace trace_processor {
 
+class PacketSequenceStateGeneration;
 class TraceProcessorContext;
 
 class AndroidProbesParser {
@@ -35,8 +36,8 @@ class AndroidProbesParser {
 
   void ParseBatteryCounters(int64_t ts, ConstBytes);
   void ParsePowerRails(int64_t ts, ConstBytes);
-  void ParseAndroidLogPacket(ConstBytes);
-  void ParseAndroidLogEvent(ConstBytes);
+  void ParseAndroidLogPacket(PacketSequenceStateGeneration*, ConstBytes);
+  void ParseAndroidLogEvent(PacketSequenceStateGeneration*, ConstBytes);
   void ParseAndroidLogStats(ConstBytes);
   void ParseStatsdMetadata(ConstBytes);
   void ParseAndroidPackagesList(ConstBytes);
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/dominator_tree.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// static
+constexpr uint32_t DominatorTree::kNoNode;
+
+DominatorTree::DominatorTree(const CsrGraph& graph, uint32_t root) {
+  const uint32_t node_count = graph.node_count();
+  PERFETTO_CHECK(root < node_count);
+  immediate_dominators_.assign(node_count, kNoNode);
+
+  // Number the reachable nodes in depth-first preorder. Below, all the
+  // vectors are indexed by these numbers rather than by node, and contain
+  // numbers too.
+  std::vector<uint32_t> number(node_count, kNoNode);
+  std::vector<uint32_t> parent;
+  {
+    struct StackElem {
+      uint32_t node;
+      uint32_t next_edge;
+    };
+    std::vector<StackElem> stack{{root, graph.offsets[root]}};
+    number[root] = 0;
+    preorder_.push_back(root);
+    parent.push_back(kNoNode);
+    while (!stack.empty()) {
+      StackElem& top = stack.back();
+      if (top.next_edge == graph.offsets[top.node + 1]) {
+        stack.pop_back();
+        continue;
+      }
+      uint32_t target = graph.targets[top.next_edge++];
+      if (number[target] != kNoNode)
+        continue;
+      uint32_t top_number = number[top.node];
+      number[target] = static_cast<uint32_t>(preorder_.size());
+      preorder_.push_back(target);
+      parent.push_back(top_number);
+      stack.push_back({target, graph.offsets[target]});
+    }
+  }
+  const auto count = static_cast<uint32_t>(preorder_.size());
+
+  // The predecessors of the reachable nodes, from reachable nodes only.
+  std::vector<uint32_t> pred_offsets(count + 1, 0);
+  for (uint32_t node : preorder_) {
+    for (uint32_t e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+      pred_offsets[number[graph.targets[e]] + 1]++;
+  }
+  for (uint32_t i = 0; i < count; ++i)
+    pred_offsets[i + 1] += pred_offsets[i];
+  std::vector<uint32_t> preds(pred_offsets[count]);
+  {
+    std::vector<uint32_t> next(pred_offsets.begin(), pred_offsets.end() - 1);
+    for (uint32_t v = 0; v < count; ++v) {
+      uint32_t node = preorder_[v];
+      for (uint32_t e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e)
+        preds[next[number[graph.targets[e]]]++] = v;
+    }
+  }
+  number.clear();
+  number.shrink_to_fit();
+
+  std::vector<uint32_t> semi(count);
+  std::vector<uint32_t> label(count);
+  for (uint32_t v = 0; v < count; ++v)
+    semi[v] = label[v] = v;
+  std::vector<uint32_t> ancestor(count, kNoNode);
+  std::vector<uint32_t> idom(count, kNoNode);
+  // The buckets are linked lists of nodes with the same semidominator.
+  std::vector<uint32_t> bucket_head(count, kNoNode);
+  std::vector<uint32_t> bucket_next(count, kNoNode);
+
+  // Returns the node with the smallest semidominator on the path from |v| to
+  // the root of its tree in the forest built by linking, and compresses the
+  // path.
+  std::vector<uint32_t> path;
+  auto eval = [&ancestor, &label, &semi, &path](uint32_t v) {
+    if (ancestor[v] == kNoNode)
+      return v;
+    path.clear();
+    for (uint32_t x = v; ancestor[ancestor[x]] != kNoNode; x = ancestor[x])
+      path.push_back(x);
+    // Compress starting from the node closest to the root of the tree.
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      uint32_t x = *it;
+      uint32_t a = ancestor[x];
+      if (semi[label[a]] < semi[label[x]])
+        label[x] = label[a];
+      ancestor[x] = ancestor[a];
+    }
+    return label[v];
+  };
+
+  for (uint32_t w = count - 1; w > 0; --w) {
+    for (uint32_t e = pred_offsets[w]; e < pred_offsets[w + 1]; ++e) {
+      uint32_t u = eval(preds[e]);
+      if (semi[u] < semi[w])
+        semi[w] = semi[u];
+    }
+    bucket_next[w] = bucket_head[semi[w]];
+    bucket_head[semi[w]] = w;
+
+    uint32_t p = parent[w];
+    ancestor[w] = p;
+    for (uint32_t v = bucket_head[p]; v != kNoNode; v = bucket_next[v]) {
+      uint32_t u = eval(v);
+      idom[v] = semi[u] < semi[v] ? u : p;
+    }
+    bucket_head[p] = kNoNode;
+  }
+  for (uint32_t w = 1; w < count; ++w) {
+    if (idom[w] != semi[w])
+      idom[w] = idom[idom[w]];
+    immediate_dominators_[preorder_[w]] = preorder_[idom[w]];
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
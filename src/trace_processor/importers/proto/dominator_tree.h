@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_DOMINATOR_TREE_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_DOMINATOR_TREE_H_
+
+#include <stdint.h>
+
+#include <limits>
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+
+// A directed graph in compressed sparse row form: the successors of node i are
+// targets[offsets[i]], ..., targets[offsets[i + 1] - 1].
+struct CsrGraph {
+  uint32_t node_count() const {
+    return static_cast<uint32_t>(offsets.size() - 1);
+  }
+
+  std::vector<uint32_t> offsets{0};
+  std::vector<uint32_t> targets;
+};
+
+// The dominator tree of the nodes of a graph reachable from a root: a node d
+// dominates a node n if every path from the root to n goes through d. The
+// immediate dominator of n is the dominator of n closest to it, and is its
+// parent in the tree.
+//
+// This is computed with the Lengauer-Tarjan algorithm (the "simple" version,
+// with path compression but without balanced linking) in O(E log N) time. All
+// the traversals use explicit stacks as heap graphs can have very long chains
+// of references (e.g. linked lists).
+class DominatorTree {
+ public:
+  static constexpr uint32_t kNoNode = std::numeric_limits<uint32_t>::max();
+
+  DominatorTree(const CsrGraph& graph, uint32_t root);
+
+  // Returns the immediate dominator of |node|, or kNoNode for the root and for
+  // the nodes which are not reachable from the root.
+  uint32_t immediate_dominator(uint32_t node) const {
+    return immediate_dominators_[node];
+  }
+
+  // Returns the nodes reachable from the root in depth-first preorder. The
+  // root comes first and every node comes after its immediate dominator, so
+  // iterating this in reverse visits the dominator tree bottom-up.
+  const std::vector<uint32_t>& preorder() const { return preorder_; }
+
+ private:
+  std::vector<uint32_t> immediate_dominators_;
+  std::vector<uint32_t> preorder_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_DOMINATOR_TREE_H_
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/dominator_tree.h"
+
+#include <random>
+#include <utility>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr uint32_t kNoNode = DominatorTree::kNoNode;
+
+CsrGraph BuildGraph(uint32_t node_count,
+                    const std::vector<std::pair<uint32_t, uint32_t>>& edges) {
+  std::vector<std::vector<uint32_t>> successors(node_count);
+  for (const auto& edge : edges)
+    successors[edge.first].push_back(edge.second);
+  CsrGraph graph;
+  for (const auto& targets : successors) {
+    graph.targets.insert(graph.targets.end(), targets.begin(), targets.end());
+    graph.offsets.push_back(static_cast<uint32_t>(graph.targets.size()));
+  }
+  return graph;
+}
+
+std::vector<uint32_t> ImmediateDominators(const DominatorTree& tree,
+                                          uint32_t node_count) {
+  std::vector<uint32_t> idoms;
+  for (uint32_t i = 0; i < node_count; ++i)
+    idoms.push_back(tree.immediate_dominator(i));
+  return idoms;
+}
+
+// Returns whether |node| is reachable from |root| without going through
+// |removed|.
+bool IsReachable(const CsrGraph& graph,
+                 uint32_t root,
+                 uint32_t node,
+                 uint32_t removed) {
+  if (root == removed)
+    return false;
+  std::vector<bool> seen(graph.node_count());
+  std::vector<uint32_t> stack{root};
+  seen[root] = true;
+  while (!stack.empty()) {
+    uint32_t cur = stack.back();
+    stack.pop_back();
+    if (cur == node)
+      return true;
+    for (uint32_t e = graph.offsets[cur]; e < graph.offsets[cur + 1]; ++e) {
+      uint32_t target = graph.targets[e];
+      if (target != removed && !seen[target]) {
+        seen[target] = true;
+        stack.push_back(target);
+      }
+    }
+  }
+  return false;
+}
+
+TEST(DominatorTreeTest, Simple) {
+  // 0 -> 1 -> 2 -> 4
+  //  \-> 3 ------/
+  // 5 is not reachable and dominates nothing.
+  CsrGraph graph =
+      BuildGraph(6, {{0, 1}, {1, 2}, {2, 4}, {0, 3}, {3, 4}, {5, 4}, {4, 1}});
+  DominatorTree tree(graph, 0);
+  ASSERT_EQ(ImmediateDominators(tree, 6),
+            (std::vector<uint32_t>{kNoNode, 0, 1, 0, 0, kNoNode}));
+  ASSERT_EQ(tree.preorder(), (std::vector<uint32_t>{0, 1, 2, 4, 3}));
+}
+
+TEST(DominatorTreeTest, LongChain) {
+  // A chain deep enough to overflow the stack of a recursive implementation,
+  // with a back edge to the root from each node.
+  const uint32_t kNodes = 1000000;
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+  for (uint32_t i = 0; i + 1 < kNodes; ++i) {
+    edges.emplace_back(i, i + 1);
+    edges.emplace_back(i + 1, 0);
+  }
+  DominatorTree tree(BuildGraph(kNodes, edges), 0);
+  for (uint32_t i = 1; i < kNodes; ++i)
+    ASSERT_EQ(tree.immediate_dominator(i), i - 1);
+}
+
+TEST(DominatorTreeTest, MatchesDefinition) {
+  std::minstd_rand rnd(42);
+  for (int iteration = 0; iteration < 200; ++iteration) {
+    uint32_t node_count = 1 + rnd() % 20;
+    uint32_t edge_count = rnd() % (3 * node_count);
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    for (uint32_t i = 0; i < edge_count; ++i)
+      edges.emplace_back(rnd() % node_count, rnd() % node_count);
+    CsrGraph graph = BuildGraph(node_count, edges);
+    DominatorTree tree(graph, 0);
+
+    for (uint32_t node = 0; node < node_count; ++node) {
+      uint32_t idom = tree.immediate_dominator(node);
+      if (node == 0 || !IsReachable(graph, 0, node, kNoNode)) {
+        ASSERT_EQ(idom, kNoNode);
+        continue;
+      }
+      // The immediate dominator dominates the node...
+      ASSERT_NE(idom, kNoNode);
+      ASSERT_FALSE(IsReachable(graph, 0, node, idom));
+      // ... and is dominated by all the other dominators of the node.
+      for (uint32_t other = 0; other < node_count; ++other) {
+        if (other == node || other == idom)
+          continue;
+        if (!IsReachable(graph, 0, node, other)) {
+          ASSERT_FALSE(IsReachable(graph, 0, idom, other));
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -16,6 +16,15 @@
 
 #include "flamegraph_construction_algorithms.h"
 
+#include <algorithm>
+#include <atomic>
+
+#include "perfetto/base/build_config.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -81,6 +90,133 @@ std::vector<MergedCallsite> GetMergedCallsites(TraceStorage* storage,
   std::reverse(result.begin(), result.end());
   return result;
 }
+
+// The samples of a callsite (or of a node of the flamegraph) summed over the
+// rows of a sample table.
+struct SampleTotals {
+  int64_t size = 0;
+  int64_t count = 0;
+  int64_t alloc_size = 0;
+  int64_t alloc_count = 0;
+
+  // The last row of the sample table which was summed, or -1 if there is
+  // none.
+  int64_t last_row = -1;
+
+  void Add(const SampleTotals& o) {
+    size += o.size;
+    count += o.count;
+    alloc_size += o.alloc_size;
+    alloc_count += o.alloc_count;
+    last_row = std::max(last_row, o.last_row);
+  }
+};
+
+// Sums the samples in the rows [begin, end) of a sample table per callsite.
+// |add_row(row, &totals)| is called for each row and should add the row to
+// the entry of its callsite in |totals| (indexed by callsite id) and return
+// whether it is one of the requested samples; the number of requested samples
+// is returned in |sample_count|.
+//
+// With |worker_threads| > 1, the rows are split in chunks which are summed
+// concurrently into per-thread totals, then merged: |add_row| must therefore
+// only read the tables.
+//
+// If |should_interrupt| is set, it is called before summing each chunk and
+// the remaining chunks are skipped once it returns true.
+template <typename AddRowFn>
+std::vector<SampleTotals> SumSamplesPerCallsite(
+    uint32_t begin,
+    uint32_t end,
+    uint32_t callsite_count,
+    uint32_t worker_threads,
+    const std::function<bool()>& should_interrupt,
+    AddRowFn add_row,
+    uint32_t* sample_count) {
+  // The number of rows summed at a time by a thread. Below two chunks, the
+  // rows are always summed on the calling thread as the cost of creating the
+  // threads (and of merging their totals) dominates the sum itself.
+  constexpr uint32_t kRowsPerChunk = 128 * 1024;
+
+  const uint32_t chunk_count =
+      (end - begin + kRowsPerChunk - 1) / kRowsPerChunk;
+  size_t num_threads = 1;
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  if (worker_threads > 1 && chunk_count > 1) {
+    num_threads = std::min(static_cast<size_t>(worker_threads),
+                           static_cast<size_t>(chunk_count));
+  }
+#else
+  base::ignore_result(worker_threads);
+#endif
+
+  std::vector<std::vector<SampleTotals>> totals(num_threads);
+  std::vector<uint32_t> sample_counts(num_threads);
+  std::atomic<uint32_t> next_chunk{0};
+  auto sum_chunks = [&totals, &sample_counts, &next_chunk, &add_row,
+                     &should_interrupt, begin, end, chunk_count,
+                     callsite_count](size_t thread) {
+    std::vector<SampleTotals>& thread_totals = totals[thread];
+    thread_totals.resize(callsite_count);
+    uint32_t thread_count = 0;
+    for (;;) {
+      uint32_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= chunk_count || (should_interrupt && should_interrupt()))
+        break;
+      uint32_t chunk_begin = begin + chunk * kRowsPerChunk;
+      uint32_t chunk_end = std::min(end, chunk_begin + kRowsPerChunk);
+      for (uint32_t row = chunk_begin; row < chunk_end; ++row)
+        thread_count += add_row(row, &thread_totals);
+    }
+    sample_counts[thread] = thread_count;
+  };
+
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // The calling thread also sums chunks, so spawn one thread less.
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(sum_chunks, i);
+  sum_chunks(0);
+  for (auto& thread : threads)
+    thread.join();
+#else
+  sum_chunks(0);
+#endif
+
+  *sample_count = sample_counts[0];
+  for (size_t i = 1; i < num_threads; ++i) {
+    *sample_count += sample_counts[i];
+    for (uint32_t j = 0; j < callsite_count; ++j)
+      totals[0][j].Add(totals[i][j]);
+  }
+  return std::move(totals[0]);
+}
+
+// Sums the totals of the callsites into the nodes they were merged into,
+// then propagates them to the parents of the nodes: returns a pair of the
+// self and cumulative totals of each node.
+std::pair<std::vector<SampleTotals>, std::vector<SampleTotals>> SumPerNode(
+    const tables::ExperimentalFlamegraphNodesTable& tbl,
+    const std::vector<uint32_t>& callsite_to_merged_callsite,
+    const std::vector<SampleTotals>& callsite_totals) {
+  std::vector<SampleTotals> self(tbl.row_count());
+  for (uint32_t i = 0; i < callsite_totals.size(); ++i)
+    self[callsite_to_merged_callsite[i]].Add(callsite_totals[i]);
+
+  // BACKWARD PASS:
+  // Propagate sizes to parents. Parents always come before their children.
+  std::vector<SampleTotals> cumulative = self;
+  for (int64_t i = tbl.row_count() - 1; i >= 0; --i) {
+    auto idx = static_cast<uint32_t>(i);
+    auto parent = tbl.parent_id()[idx];
+    if (parent) {
+      uint32_t parent_idx = *tbl.id().IndexOf(*parent);
+      cumulative[parent_idx].Add(cumulative[idx]);
+    }
+  }
+  return std::make_pair(std::move(self), std::move(cumulative));
+}
 }  // namespace
 
 static FlamegraphTableAndMergedCallsites BuildFlamegraphTableTreeStructure(
@@ -183,200 +319,166 @@ static FlamegraphTableAndMergedCallsites BuildFlamegraphTableTreeStructure(
   return {std::move(tbl), callsite_to_merged_callsite};
 }
 
-static std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
-BuildFlamegraphTableHeapSizeAndCount(
-    std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl,
-    const std::vector<uint32_t>& callsite_to_merged_callsite,
-    const Table& filtered) {
-  for (auto it = filtered.IterateRows(); it; it.Next()) {
-    int64_t size =
-        it.Get(static_cast<uint32_t>(
-                   tables::HeapProfileAllocationTable::ColumnIndex::size))
-            .long_value;
-    int64_t count =
-        it.Get(static_cast<uint32_t>(
-                   tables::HeapProfileAllocationTable::ColumnIndex::count))
-            .long_value;
-    int64_t callsite_id =
-        it
-            .Get(static_cast<uint32_t>(
-                tables::HeapProfileAllocationTable::ColumnIndex::callsite_id))
-            .long_value;
+std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
+BuildNativeHeapProfileFlamegraph(
+    TraceStorage* storage,
+    UniquePid upid,
+    int64_t timestamp,
+    uint32_t worker_threads,
+    const std::function<bool()>& should_interrupt) {
+  const tables::HeapProfileAllocationTable& allocation_tbl =
+      storage->heap_profile_allocation_table();
+  const uint32_t callsite_count =
+      storage->stack_profile_callsite_table().row_count();
 
+  // PASS OVER ALLOCATIONS:
+  // Sum the allocations done until |timestamp| by |upid| per callsite.
+  auto add_row = [&allocation_tbl, upid, timestamp](
+                     uint32_t row, std::vector<SampleTotals>* totals) -> bool {
+    if (allocation_tbl.ts()[row] > timestamp ||
+        allocation_tbl.upid()[row] != upid) {
+      return false;
+    }
+    int64_t size = allocation_tbl.size()[row];
+    int64_t count = allocation_tbl.count()[row];
     PERFETTO_CHECK((size <= 0 && count <= 0) || (size >= 0 && count >= 0));
-    uint32_t merged_idx =
-        callsite_to_merged_callsite[static_cast<unsigned long>(callsite_id)];
+
+    SampleTotals& callsite =
+        (*totals)[allocation_tbl.callsite_id()[row].value];
     // On old heapprofd producers, the count field is incorrectly set and we
     // zero it in proto_trace_parser.cc.
     // As such, we cannot depend on count == 0 to imply size == 0, so we check
     // for both of them separately.
-    if (size > 0) {
-      tbl->mutable_alloc_size()->Set(merged_idx,
-                                     tbl->alloc_size()[merged_idx] + size);
-    }
-    if (count > 0) {
-      tbl->mutable_alloc_count()->Set(merged_idx,
-                                      tbl->alloc_count()[merged_idx] + count);
-    }
-
-    tbl->mutable_size()->Set(merged_idx, tbl->size()[merged_idx] + size);
-    tbl->mutable_count()->Set(merged_idx, tbl->count()[merged_idx] + count);
-  }
-
-  // BACKWARD PASS:
-  // Propagate sizes to parents.
-  for (int64_t i = tbl->row_count() - 1; i >= 0; --i) {
-    auto idx = static_cast<uint32_t>(i);
-
-    tbl->mutable_cumulative_size()->Set(
-        idx, tbl->cumulative_size()[idx] + tbl->size()[idx]);
-    tbl->mutable_cumulative_count()->Set(
-        idx, tbl->cumulative_count()[idx] + tbl->count()[idx]);
-
-    tbl->mutable_cumulative_alloc_size()->Set(
-        idx, tbl->cumulative_alloc_size()[idx] + tbl->alloc_size()[idx]);
-    tbl->mutable_cumulative_alloc_count()->Set(
-        idx, tbl->cumulative_alloc_count()[idx] + tbl->alloc_count()[idx]);
-
-    auto parent = tbl->parent_id()[idx];
-    if (parent) {
-      uint32_t parent_idx = *tbl->id().IndexOf(
-          tables::ExperimentalFlamegraphNodesTable::Id(*parent));
-      tbl->mutable_cumulative_size()->Set(
-          parent_idx,
-          tbl->cumulative_size()[parent_idx] + tbl->cumulative_size()[idx]);
-      tbl->mutable_cumulative_count()->Set(
-          parent_idx,
-          tbl->cumulative_count()[parent_idx] + tbl->cumulative_count()[idx]);
-
-      tbl->mutable_cumulative_alloc_size()->Set(
-          parent_idx, tbl->cumulative_alloc_size()[parent_idx] +
-                          tbl->cumulative_alloc_size()[idx]);
-      tbl->mutable_cumulative_alloc_count()->Set(
-          parent_idx, tbl->cumulative_alloc_count()[parent_idx] +
-                          tbl->cumulative_alloc_count()[idx]);
-    }
-  }
-
-  return tbl;
-}
-
-static std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
-BuildFlamegraphTableCallstackSizeAndCount(
-    std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl,
-    const std::vector<uint32_t>& callsite_to_merged_callsite,
-    const Table& filtered) {
-  for (auto it = filtered.IterateRows(); it; it.Next()) {
-    int64_t callsite_id =
-        it.Get(static_cast<uint32_t>(
-                   tables::PerfSampleTable::ColumnIndex::callsite_id))
-            .long_value;
-    int64_t ts =
-        it.Get(static_cast<uint32_t>(tables::PerfSampleTable::ColumnIndex::ts))
-            .long_value;
-
-    uint32_t merged_idx =
-        callsite_to_merged_callsite[static_cast<unsigned long>(callsite_id)];
-    tbl->mutable_size()->Set(merged_idx, tbl->size()[merged_idx] + 1);
-    tbl->mutable_count()->Set(merged_idx, tbl->count()[merged_idx] + 1);
-    tbl->mutable_ts()->Set(merged_idx, ts);
-  }
-
-  // BACKWARD PASS:
-  // Propagate sizes to parents.
-  for (int64_t i = tbl->row_count() - 1; i >= 0; --i) {
-    auto idx = static_cast<uint32_t>(i);
-
-    tbl->mutable_cumulative_size()->Set(
-        idx, tbl->cumulative_size()[idx] + tbl->size()[idx]);
-    tbl->mutable_cumulative_count()->Set(
-        idx, tbl->cumulative_count()[idx] + tbl->count()[idx]);
-
-    auto parent = tbl->parent_id()[idx];
-    if (parent) {
-      uint32_t parent_idx = *tbl->id().IndexOf(
-          tables::ExperimentalFlamegraphNodesTable::Id(*parent));
-      tbl->mutable_cumulative_size()->Set(
-          parent_idx,
-          tbl->cumulative_size()[parent_idx] + tbl->cumulative_size()[idx]);
-      tbl->mutable_cumulative_count()->Set(
-          parent_idx,
-          tbl->cumulative_count()[parent_idx] + tbl->cumulative_count()[idx]);
-    }
-  }
-  return tbl;
-}
-
-std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
-BuildNativeHeapProfileFlamegraph(TraceStorage* storage,
-                                 UniquePid upid,
-                                 int64_t timestamp) {
-  const tables::HeapProfileAllocationTable& allocation_tbl =
-      storage->heap_profile_allocation_table();
-  // PASS OVER ALLOCATIONS:
-  // Aggregate allocations into the newly built tree.
-  auto filtered = allocation_tbl.Filter(
-      {allocation_tbl.ts().le(timestamp), allocation_tbl.upid().eq(upid)});
-  if (filtered.row_count() == 0) {
+    if (size > 0)
+      callsite.alloc_size += size;
+    if (count > 0)
+      callsite.alloc_count += count;
+    callsite.size += size;
+    callsite.count += count;
+    return true;
+  };
+  uint32_t sample_count = 0;
+  std::vector<SampleTotals> callsite_totals = SumSamplesPerCallsite(
+      0, allocation_tbl.row_count(), callsite_count, worker_threads,
+      should_interrupt, add_row, &sample_count);
+  if (sample_count == 0 || (should_interrupt && should_interrupt())) {
     return nullptr;
   }
+
   StringId profile_type = storage->InternString("native");
   FlamegraphTableAndMergedCallsites table_and_callsites =
       BuildFlamegraphTableTreeStructure(
           storage, upid, base::make_optional(timestamp), profile_type);
-  return BuildFlamegraphTableHeapSizeAndCount(
-      std::move(table_and_callsites.tbl),
-      table_and_callsites.callsite_to_merged_callsite, filtered);
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl =
+      std::move(table_and_callsites.tbl);
+
+  auto totals = SumPerNode(
+      *tbl, table_and_callsites.callsite_to_merged_callsite, callsite_totals);
+  for (uint32_t i = 0; i < tbl->row_count(); ++i) {
+    const SampleTotals& self = totals.first[i];
+    const SampleTotals& cumulative = totals.second[i];
+    tbl->mutable_size()->Set(i, self.size);
+    tbl->mutable_count()->Set(i, self.count);
+    tbl->mutable_alloc_size()->Set(i, self.alloc_size);
+    tbl->mutable_alloc_count()->Set(i, self.alloc_count);
+    tbl->mutable_cumulative_size()->Set(i, cumulative.size);
+    tbl->mutable_cumulative_count()->Set(i, cumulative.count);
+    tbl->mutable_cumulative_alloc_size()->Set(i, cumulative.alloc_size);
+    tbl->mutable_cumulative_alloc_count()->Set(i, cumulative.alloc_count);
+  }
+  return tbl;
 }
 
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
 BuildNativeCallStackSamplingFlamegraph(
     TraceStorage* storage,
     UniquePid upid,
-    const std::vector<TimeConstraints>& time_constraints) {
-  // 1.Create set of all utids mapped to the given upid
-  std::set<tables::ThreadTable::Id> utids;
-  RowMap threads_in_pid_rm = storage->thread_table().FilterToRowMap(
-      {storage->thread_table().upid().eq(upid)});
+    const std::vector<TimeConstraints>& time_constraints,
+    uint32_t worker_threads,
+    const std::function<bool()>& should_interrupt) {
+  const tables::PerfSampleTable& samples_tbl = storage->perf_sample_table();
+  const tables::ThreadTable& thread_tbl = storage->thread_table();
+  const uint32_t callsite_count =
+      storage->stack_profile_callsite_table().row_count();
+
+  // 1.Find all the utids mapped to the given upid
+  std::vector<bool> is_thread_in_process(thread_tbl.row_count());
+  RowMap threads_in_pid_rm =
+      thread_tbl.FilterToRowMap({thread_tbl.upid().eq(upid)});
   for (auto it = threads_in_pid_rm.IterateRows(); it; it.Next()) {
-    utids.insert(storage->thread_table().id()[it.row()]);
-  }
-
-  // 2.Get all row indices in perf_sample that correspond to the requested utids
-  std::vector<uint32_t> cs_rows;
-  for (uint32_t i = 0; i < storage->perf_sample_table().row_count(); ++i) {
-    if (utids.find(static_cast<tables::ThreadTable::Id>(
-            storage->perf_sample_table().utid()[i])) != utids.end()) {
-      cs_rows.push_back(i);
-    }
+    is_thread_in_process[thread_tbl.id()[it.row()].value] = true;
   }
 
-  // 3.Filter rows that correspond to the selected utids
-  RowMap filtered_rm = RowMap(std::move(cs_rows));
-  Table filtered = storage->perf_sample_table().Apply(std::move(filtered_rm));
-
-  // 4.Filter rows by time constraints
+  // 2.Find the rows matching the time constraints: as |ts| is sorted, these
+  // are (usually) a range of the table and only this range is summed.
+  std::vector<Constraint> ts_constraints;
   for (const auto& tc : time_constraints) {
     if (!(tc.op == FilterOp::kGt || tc.op == FilterOp::kLt ||
           tc.op == FilterOp::kGe || tc.op == FilterOp::kLe)) {
       PERFETTO_FATAL("Filter operation %d not permitted for perf.", tc.op);
     }
-    Constraint cs = Constraint{
+    ts_constraints.push_back(Constraint{
         static_cast<uint32_t>(tables::PerfSampleTable::ColumnIndex::ts), tc.op,
-        SqlValue::Long(tc.value)};
-    filtered = filtered.Filter({cs});
+        SqlValue::Long(tc.value)});
+  }
+  RowMap in_time_rm = samples_tbl.FilterToRowMap(ts_constraints);
+  if (in_time_rm.empty()) {
+    return nullptr;
   }
 
-  if (filtered.row_count() == 0) {
+  // 3.Count the samples of the selected threads per callsite.
+  auto add_row = [&samples_tbl, &is_thread_in_process, &in_time_rm](
+                     uint32_t row, std::vector<SampleTotals>* totals) -> bool {
+    uint32_t utid = samples_tbl.utid()[row];
+    if (utid >= is_thread_in_process.size() || !is_thread_in_process[utid] ||
+        !in_time_rm.Contains(row)) {
+      return false;
+    }
+    // Samples without a callsite (e.g. unwinding errors) are counted in the
+    // node of the first callsite, as their callsite id reads as 0.
+    auto callsite_id = samples_tbl.callsite_id()[row];
+    uint32_t callsite_idx = callsite_id ? callsite_id->value : 0;
+    if (callsite_idx < totals->size()) {
+      SampleTotals& callsite = (*totals)[callsite_idx];
+      callsite.size++;
+      callsite.count++;
+      callsite.last_row = row;
+    }
+    return true;
+  };
+  uint32_t sample_count = 0;
+  std::vector<SampleTotals> callsite_totals = SumSamplesPerCallsite(
+      in_time_rm.Get(0), in_time_rm.Get(in_time_rm.size() - 1) + 1,
+      callsite_count, worker_threads, should_interrupt, add_row,
+      &sample_count);
+  if (sample_count == 0 || (should_interrupt && should_interrupt())) {
     return nullptr;
   }
+
   StringId profile_type = storage->InternString("perf");
   FlamegraphTableAndMergedCallsites table_and_callsites =
       BuildFlamegraphTableTreeStructure(storage, upid, base::nullopt,
                                         profile_type);
-  return BuildFlamegraphTableCallstackSizeAndCount(
-      std::move(table_and_callsites.tbl),
-      table_and_callsites.callsite_to_merged_callsite, filtered);
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl =
+      std::move(table_and_callsites.tbl);
+
+  auto totals = SumPerNode(
+      *tbl, table_and_callsites.callsite_to_merged_callsite, callsite_totals);
+  for (uint32_t i = 0; i < tbl->row_count(); ++i) {
+    const SampleTotals& self = totals.first[i];
+    const SampleTotals& cumulative = totals.second[i];
+    tbl->mutable_size()->Set(i, self.size);
+    tbl->mutable_count()->Set(i, self.count);
+    tbl->mutable_cumulative_size()->Set(i, cumulative.size);
+    tbl->mutable_cumulative_count()->Set(i, cumulative.count);
+
+    // The ts of a node is the one of its last sample.
+    if (self.last_row >= 0) {
+      tbl->mutable_ts()->Set(
+          i, samples_tbl.ts()[static_cast<uint32_t>(self.last_row)]);
+    }
+  }
+  return tbl;
 }
 
 }  // namespace trace_processor
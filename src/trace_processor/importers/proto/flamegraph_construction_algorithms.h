@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_FLAMEGRAPH_CONSTRUCTION_ALGORITHMS_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_FLAMEGRAPH_CONSTRUCTION_ALGORITHMS_H_
 
+#include <functional>
 #include <set>
 
 #include "src/trace_processor/storage/trace_storage.h"
@@ -30,16 +31,33 @@ struct TimeConstraints {
   int64_t value;
 };
 
+// Builds the flamegraph of the native heap allocations done by |upid| until
+// |timestamp|. Returns nullptr if there are no such allocations.
+//
+// The samples are first summed per callsite, on up to |worker_threads| threads
+// for large profiles, then per node of the callsite tree. If set,
+// |should_interrupt| is called from time to time while summing the samples:
+// when it returns true, this stops and returns nullptr.
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
-BuildNativeHeapProfileFlamegraph(TraceStorage* storage,
-                                 UniquePid upid,
-                                 int64_t timestamp);
+BuildNativeHeapProfileFlamegraph(
+    TraceStorage* storage,
+    UniquePid upid,
+    int64_t timestamp,
+    uint32_t worker_threads = 0,
+    const std::function<bool()>& should_interrupt = nullptr);
 
+// Builds the flamegraph of the perf samples of the threads of |upid| matching
+// |time_constraints|. Returns nullptr if there are no such samples.
+//
+// As above, samples are summed on up to |worker_threads| threads, checking
+// |should_interrupt|.
 std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
 BuildNativeCallStackSamplingFlamegraph(
     TraceStorage* storage,
     UniquePid upid,
-    const std::vector<TimeConstraints>& time_constraints);
+    const std::vector<TimeConstraints>& time_constraints,
+    uint32_t worker_threads = 0,
+    const std::function<bool()>& should_interrupt = nullptr);
 }  // namespace trace_processor
 }  // namespace perfetto
 
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/flamegraph_construction_algorithms.h"
+
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// More than two chunks of rows for the samples to be summed on threads.
+constexpr uint32_t kSampleCount = 300 * 1000;
+
+class FlamegraphConstructionAlgorithmsTest : public ::testing::Test {
+ public:
+  FlamegraphConstructionAlgorithmsTest() {
+    tables::StackProfileMappingTable::Row mapping;
+    mapping.name = storage_.InternString("libfoo.so");
+    auto mapping_id =
+        storage_.mutable_stack_profile_mapping_table()->Insert(mapping).id;
+
+    auto add_frame = [this, mapping_id](const char* name) {
+      tables::StackProfileFrameTable::Row frame;
+      frame.name = storage_.InternString(name);
+      frame.mapping = mapping_id;
+      return storage_.mutable_stack_profile_frame_table()->Insert(frame).id;
+    };
+    auto main_frame = add_frame("main");
+    auto foo_frame = add_frame("foo");
+    auto bar_frame = add_frame("bar");
+
+    // main -> foo -> bar and main -> bar.
+    auto* callsites = storage_.mutable_stack_profile_callsite_table();
+    auto main_id = callsites->Insert({0, base::nullopt, main_frame}).id;
+    auto foo_id = callsites->Insert({1, main_id, foo_frame}).id;
+    callsites->Insert({2, foo_id, bar_frame});
+    callsites->Insert({1, main_id, bar_frame});
+
+    auto add_thread = [this](uint32_t pid, UniquePid* upid, UniqueTid* utid) {
+      tables::ProcessTable::Row process;
+      process.pid = pid;
+      *upid = storage_.mutable_process_table()->Insert(process).id.value;
+      tables::ThreadTable::Row thread;
+      thread.tid = pid;
+      thread.upid = *upid;
+      *utid = storage_.mutable_thread_table()->Insert(thread).id.value;
+    };
+    add_thread(10, &upid_, &utid_);
+    add_thread(20, &other_upid_, &other_utid_);
+  }
+
+ protected:
+  // Returns the name, self and cumulative totals and ts of each node.
+  std::vector<std::vector<int64_t>> Nodes(
+      const tables::ExperimentalFlamegraphNodesTable& tbl) {
+    std::vector<std::vector<int64_t>> nodes;
+    for (uint32_t i = 0; i < tbl.row_count(); ++i) {
+      nodes.push_back({tbl.depth()[i], tbl.name()[i].raw_id(), tbl.size()[i],
+                       tbl.count()[i], tbl.cumulative_size()[i],
+                       tbl.cumulative_count()[i], tbl.alloc_size()[i],
+                       tbl.alloc_count()[i], tbl.ts()[i]});
+    }
+    return nodes;
+  }
+
+  TraceStorage storage_;
+  UniquePid upid_ = 0;
+  UniqueTid utid_ = 0;
+  UniquePid other_upid_ = 0;
+  UniqueTid other_utid_ = 0;
+};
+
+TEST_F(FlamegraphConstructionAlgorithmsTest, PerfSamplesOnThreads) {
+  auto* samples = storage_.mutable_perf_sample_table();
+  int64_t process_samples = 0;
+  for (uint32_t i = 0; i < kSampleCount; ++i) {
+    tables::PerfSampleTable::Row row;
+    row.ts = i;
+    // Every third sample is from another process.
+    row.utid = i % 3 == 0 ? other_utid_ : utid_;
+    // Some samples have no callsite (e.g. unwinding errors).
+    if (i % 7 != 0)
+      row.callsite_id = CallsiteId(i % 4);
+    samples->Insert(row);
+    process_samples += i % 3 != 0;
+  }
+
+  std::vector<TimeConstraints> constraints = {
+      {FilterOp::kGe, 0}, {FilterOp::kLt, kSampleCount}};
+  auto serial =
+      BuildNativeCallStackSamplingFlamegraph(&storage_, upid_, constraints, 0);
+  auto threaded =
+      BuildNativeCallStackSamplingFlamegraph(&storage_, upid_, constraints, 4);
+  ASSERT_TRUE(serial);
+  ASSERT_TRUE(threaded);
+  ASSERT_EQ(Nodes(*threaded), Nodes(*serial));
+
+  // The samples without a callsite are counted in the node of the first
+  // callsite (the root), so the root has all the samples of the process.
+  ASSERT_EQ(serial->depth()[0], 0u);
+  ASSERT_EQ(serial->cumulative_count()[0], process_samples);
+  int64_t self_count = 0;
+  for (uint32_t i = 0; i < serial->row_count(); ++i)
+    self_count += serial->count()[i];
+  ASSERT_EQ(self_count, process_samples);
+
+  // The time constraints select a range of the samples.
+  auto first_half = BuildNativeCallStackSamplingFlamegraph(
+      &storage_, upid_, {{FilterOp::kLt, kSampleCount / 2}}, 4);
+  ASSERT_TRUE(first_half);
+  ASSERT_LT(first_half->cumulative_count()[0], process_samples);
+}
+
+TEST_F(FlamegraphConstructionAlgorithmsTest, NativeHeapOnThreads) {
+  auto* allocations = storage_.mutable_heap_profile_allocation_table();
+  for (uint32_t i = 0; i < kSampleCount; ++i) {
+    tables::HeapProfileAllocationTable::Row row;
+    row.ts = i;
+    row.upid = i % 5 == 0 ? other_upid_ : upid_;
+    row.callsite_id = CallsiteId(i % 4);
+    // Frees are negative.
+    row.count = i % 6 == 0 ? -1 : 1;
+    row.size = row.count * (i % 100);
+    allocations->Insert(row);
+  }
+
+  const int64_t ts = kSampleCount * 3 / 4;
+  auto serial = BuildNativeHeapProfileFlamegraph(&storage_, upid_, ts, 0);
+  auto threaded = BuildNativeHeapProfileFlamegraph(&storage_, upid_, ts, 4);
+  ASSERT_TRUE(serial);
+  ASSERT_TRUE(threaded);
+  ASSERT_EQ(Nodes(*threaded), Nodes(*serial));
+  ASSERT_GT(serial->cumulative_alloc_count()[0], serial->cumulative_count()[0]);
+}
+
+TEST_F(FlamegraphConstructionAlgorithmsTest, Interrupted) {
+  auto* samples = storage_.mutable_perf_sample_table();
+  for (uint32_t i = 0; i < kSampleCount; ++i) {
+    tables::PerfSampleTable::Row row;
+    row.ts = i;
+    row.utid = utid_;
+    row.callsite_id = CallsiteId(i % 4);
+    samples->Insert(row);
+  }
+
+  auto interrupt = [] { return true; };
+  ASSERT_FALSE(BuildNativeCallStackSamplingFlamegraph(
+      &storage_, upid_, {{FilterOp::kGe, 0}}, 4, interrupt));
+  ASSERT_FALSE(BuildNativeCallStackSamplingFlamegraph(
+      &storage_, upid_, {{FilterOp::kGe, 0}}, 0, interrupt));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/importers/proto/frame_timeline_event_parser.h"
 
+#include <stdio.h>
+
 #include <cinttypes>
 
 #include "perfetto/ext/base/utils.h"
@@ -174,7 +176,26 @@ FrameTimelineEventParser::FrameTimelineEventParser(
       jank_tag_buffer_stuffing_id_(
           context->storage->InternString("Buffer Stuffing")),
       jank_tag_sf_stuffing_id_(
-          context->storage->InternString("SurfaceFlinger Stuffing")) {}
+          context->storage->InternString("SurfaceFlinger Stuffing")),
+      is_buffer_unspecified_id_(context->storage->InternString("Unspecified")),
+      is_buffer_yes_id_(context->storage->InternString("Yes")),
+      is_buffer_no_id_(context->storage->InternString("No")) {}
+
+StringId FrameTimelineEventParser::InternTokenName(int64_t token) {
+  char name[32];
+  int len = snprintf(name, sizeof(name), "%" PRId64, token);
+  return context_->storage->InternString(
+      base::StringView(name, static_cast<size_t>(len)));
+}
+
+StringId FrameTimelineEventParser::GetJankTypeId(int32_t jank_type) {
+  StringId* cached = jank_type_ids_.Find(jank_type);
+  if (cached)
+    return *cached;
+  StringId id = JankTypeBitmaskToStringId(context_, jank_type);
+  jank_type_ids_.Insert(jank_type, id);
+  return id;
+}
 
 void FrameTimelineEventParser::ParseExpectedDisplayFrameStart(
     int64_t timestamp,
@@ -200,8 +221,7 @@ void FrameTimelineEventParser::ParseExpectedDisplayFrameStart(
 
   int64_t cookie = event.cookie();
   int64_t token = event.token();
-  StringId name_id =
-      context_->storage->InternString(base::StringView(std::to_string(token)));
+  StringId name_id = InternTokenName(token);
 
   UniquePid upid = context_->process_tracker->GetOrCreateProcess(
       static_cast<uint32_t>(event.pid()));
@@ -249,8 +269,7 @@ void FrameTimelineEventParser::ParseActualDisplayFrameStart(
 
   int64_t cookie = event.cookie();
   int64_t token = event.token();
-  StringId name_id =
-      context_->storage->InternString(base::StringView(std::to_string(token)));
+  StringId name_id = InternTokenName(token);
 
   UniquePid upid = context_->process_tracker->GetOrCreateProcess(
       static_cast<uint32_t>(event.pid()));
@@ -274,7 +293,7 @@ void FrameTimelineEventParser::ParseActualDisplayFrameStart(
   actual_row.present_type = present_type;
   actual_row.on_time_finish = event.on_time_finish();
   actual_row.gpu_composition = event.gpu_composition();
-  StringId jank_type = JankTypeBitmaskToStringId(context_, event.jank_type());
+  StringId jank_type = GetJankTypeId(event.jank_type());
   actual_row.jank_type = jank_type;
   StringId prediction_type = prediction_type_ids_[0];
   if (event.has_prediction_type() &&
@@ -313,15 +332,16 @@ void FrameTimelineEventParser::ParseActualDisplayFrameStart(
   // of this it's safe to add all the flow events here and then forget the
   // surface_slice id - we shouldn't see more surfaces_slices that should be
   // connected to this slice after this point.
-  auto range = display_token_to_surface_slice_.equal_range(token);
+  std::vector<SliceId>* surface_slices =
+      display_token_to_surface_slices_.Find(token);
+  if (!surface_slices)
+    return;
   if (opt_slice_id) {
-    for (auto it = range.first; it != range.second; ++it) {
-      SliceId display_slice = *opt_slice_id;  // SurfaceFlinger
-      SliceId surface_slice = it->second;     // App
+    SliceId display_slice = *opt_slice_id;  // SurfaceFlinger
+    for (SliceId surface_slice : *surface_slices)  // App
       context_->flow_tracker->InsertFlow(display_slice, surface_slice);
-    }
   }
-  display_token_to_surface_slice_.erase(range.first, range.second);
+  display_token_to_surface_slices_.Erase(token);
 }
 
 void FrameTimelineEventParser::ParseExpectedSurfaceFrameStart(
@@ -358,26 +378,21 @@ void FrameTimelineEventParser::ParseExpectedSurfaceFrameStart(
   int64_t display_frame_token = event.display_frame_token();
   UniquePid upid = context_->process_tracker->GetOrCreateProcess(
       static_cast<uint32_t>(event.pid()));
-  auto token_set_it = expected_timeline_token_map_.find(upid);
-  if (token_set_it != expected_timeline_token_map_.end()) {
-    auto& token_set = token_set_it->second;
-    if (token_set.find(token) != token_set.end()) {
-      // If we already have an expected timeline for a token, the expectations
-      // are same for all frames that use the token. No need to add duplicate
-      // entries.
-      return;
-    }
+  if (!expected_timeline_tokens_.Insert(std::make_pair(upid, token), true)
+           .second) {
+    // If we already have an expected timeline for a token, the expectations
+    // are same for all frames that use the token. No need to add duplicate
+    // entries.
+    return;
   }
-  // This is the first time we are seeing this token for this process. Add to
-  // the map.
-  expected_timeline_token_map_[upid].insert(token);
+  // Otherwise, this is the first time we are seeing this token for this
+  // process and it was just added to the set.
 
   StringId layer_name_id = event.has_layer_name()
                                ? context_->storage->InternString(
                                      base::StringView(event.layer_name()))
                                : kNullStringId;
-  StringId name_id =
-      context_->storage->InternString(base::StringView(std::to_string(token)));
+  StringId name_id = InternTokenName(token);
 
   auto expected_track_set_id =
       context_->async_track_set_tracker->InternFrameTimelineSet(
@@ -442,8 +457,7 @@ void FrameTimelineEventParser::ParseActualSurfaceFrameStart(
   if (event.has_layer_name())
     layer_name_id =
         context_->storage->InternString(base::StringView(event.layer_name()));
-  StringId name_id =
-      context_->storage->InternString(base::StringView(std::to_string(token)));
+  StringId name_id = InternTokenName(token);
 
   auto actual_track_set_id =
       context_->async_track_set_tracker->InternFrameTimelineSet(
@@ -469,7 +483,7 @@ void FrameTimelineEventParser::ParseActualSurfaceFrameStart(
   actual_row.present_type = present_type;
   actual_row.on_time_finish = event.on_time_finish();
   actual_row.gpu_composition = event.gpu_composition();
-  StringId jank_type = JankTypeBitmaskToStringId(context_, event.jank_type());
+  StringId jank_type = GetJankTypeId(event.jank_type());
   actual_row.jank_type = jank_type;
   StringId prediction_type = prediction_type_ids_[0];
   if (event.has_prediction_type() &&
@@ -490,13 +504,9 @@ void FrameTimelineEventParser::ParseActualSurfaceFrameStart(
   } else {
     actual_row.jank_tag = jank_tag_none_id_;
   }
-  StringId is_buffer = context_->storage->InternString("Unspecified");
-  if (event.has_is_buffer()) {
-    if (event.is_buffer())
-      is_buffer = context_->storage->InternString("Yes");
-    else
-      is_buffer = context_->storage->InternString("No");
-  }
+  StringId is_buffer = is_buffer_unspecified_id_;
+  if (event.has_is_buffer())
+    is_buffer = event.is_buffer() ? is_buffer_yes_id_ : is_buffer_no_id_;
 
   base::Optional<SliceId> opt_slice_id =
       context_->slice_tracker->BeginTyped(
@@ -521,7 +531,8 @@ void FrameTimelineEventParser::ParseActualSurfaceFrameStart(
           });
 
   if (opt_slice_id) {
-    display_token_to_surface_slice_.emplace(display_frame_token, *opt_slice_id);
+    display_token_to_surface_slices_[display_frame_token].push_back(
+        *opt_slice_id);
   }
 }
 
@@ -536,13 +547,13 @@ void FrameTimelineEventParser::ParseFrameEnd(int64_t timestamp,
   }
 
   int64_t cookie = event.cookie();
-  auto it = cookie_track_set_id_map_.find(cookie);
-  if (it == cookie_track_set_id_map_.end())
+  TrackSetId* it = cookie_track_set_id_map_.Find(cookie);
+  if (!it)
     return;
-  auto track_set_id = it->second;
+  auto track_set_id = *it;
   auto track_id = context_->async_track_set_tracker->End(track_set_id, cookie);
   context_->slice_tracker->End(timestamp, track_id);
-  cookie_track_set_id_map_.erase(it);
+  cookie_track_set_id_map_.Erase(cookie);
 }
 
 void FrameTimelineEventParser::ParseFrameTimelineEvent(int64_t timestamp,
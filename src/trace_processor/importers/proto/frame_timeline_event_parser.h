@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_FRAME_TIMELINE_EVENT_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_FRAME_TIMELINE_EVENT_PARSER_H_
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/protozero/field.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/proto/async_track_set_tracker.h"
@@ -25,9 +26,8 @@
 
 #include "protos/perfetto/trace/android/frame_timeline_event.pbzero.h"
 
-#include <map>
-#include <unordered_map>
-#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace perfetto {
 
@@ -56,6 +56,20 @@ class FrameTimelineEventParser {
 
   void ParseFrameEnd(int64_t timestamp, ConstBytes);
 
+  // Returns the slice name for |token| (its decimal representation).
+  StringId InternTokenName(int64_t token);
+
+  // Returns the human readable description of the |jank_type| bitmask.
+  StringId GetJankTypeId(int32_t jank_type);
+
+  using UpidAndToken = std::pair<UniquePid, int64_t>;
+  struct UpidAndTokenHasher {
+    size_t operator()(const UpidAndToken& key) const {
+      return std::hash<int64_t>()(key.second) ^
+             (static_cast<size_t>(key.first) * 0x9E3779B9u);
+    }
+  };
+
   TraceProcessorContext* const context_;
   // Cookie -> TrackSetId map. Since cookies are globally unique per slice, this
   // helps in allowing the producer to send only the cookie as the End marker
@@ -63,7 +77,7 @@ class FrameTimelineEventParser {
   // based on any number of fields in the Start marker but the global uniqueness
   // of the cookie makes it so that we can end a slice with just the cookie and
   // the TrackSetId.
-  std::map<int64_t, TrackSetId> cookie_track_set_id_map_;
+  base::FlatHashMap<int64_t, TrackSetId> cookie_track_set_id_map_;
   std::array<StringId, 6> present_type_ids_;
   std::array<StringId, 4> prediction_type_ids_;
   StringId expected_timeline_track_name_;
@@ -86,18 +100,29 @@ class FrameTimelineEventParser {
   StringId jank_tag_buffer_stuffing_id_;
   StringId jank_tag_sf_stuffing_id_;
 
-  // upid -> set of tokens map. The expected timeline is the same for a given
+  StringId is_buffer_unspecified_id_;
+  StringId is_buffer_yes_id_;
+  StringId is_buffer_no_id_;
+
+  // Jank type bitmask -> description. Frames only use a few combinations of
+  // jank types.
+  base::FlatHashMap<int32_t, StringId> jank_type_ids_;
+
+  // Set of (upid, token) pairs. The expected timeline is the same for a given
   // token no matter how many times its seen. We can safely ignore duplicates
   // for the expected timeline slices by caching the set of tokens seen so far
   // per upid. upid is used as a dimension here because we show the timeline
   // tracks for every process group.
-  // This map is used only for SurfaceFrames because there is no way two
+  // This set is used only for SurfaceFrames because there is no way two
   // DisplayFrames use the same token unless there is something wrong with
-  // SurfaceFlinger.
-  std::unordered_map<UniquePid, std::unordered_set<int64_t>>
-      expected_timeline_token_map_;
-
-  std::multimap<int64_t, SliceId> display_token_to_surface_slice_;
+  // SurfaceFlinger. The values of the map are unused.
+  base::FlatHashMap<UpidAndToken, bool, UpidAndTokenHasher>
+      expected_timeline_tokens_;
+
+  // Display frame token -> the actual surface frame slices using it, which
+  // are connected to the display frame slice with flows once it is parsed.
+  base::FlatHashMap<int64_t, std::vector<SliceId>>
+      display_token_to_surface_slices_;
 };
 }  // namespace trace_processor
 }  // namespace perfetto
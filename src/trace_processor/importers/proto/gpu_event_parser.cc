@@ -219,30 +219,43 @@ void GpuEventParser::ParseGpuCounterEvent(int64_t ts, ConstBytes blob) {
   }
 }
 
-const StringId GpuEventParser::GetFullStageName(
+GpuEventParser::RenderStageSpecification*
+GpuEventParser::GetRenderStageSpecification(
     PacketSequenceStateGeneration* sequence_state,
-    const protos::pbzero::GpuRenderStageEvent_Decoder& event) const {
-  StringId stage_name;
-  if (event.has_stage_iid()) {
-    auto stage_iid = event.stage_iid();
-    auto* decoder = sequence_state->LookupInternedMessage<
-        protos::pbzero::InternedData::kGpuSpecificationsFieldNumber,
-        protos::pbzero::InternedGpuRenderStageSpecification>(stage_iid);
-    if (!decoder) {
-      return kNullStringId;
-    }
-    stage_name = context_->storage->InternString(decoder->name());
-  } else {
-    uint64_t stage_id = static_cast<uint64_t>(event.stage_id());
+    uint64_t iid) {
+  auto* view = sequence_state->GetInternedMessageView(
+      protos::pbzero::InternedData::kGpuSpecificationsFieldNumber, iid);
+  if (!view)
+    return nullptr;
+  auto* spec = view->GetOrCreateDerivedData<RenderStageSpecification>();
+  if (!spec->resolved) {
+    auto* decoder = view->GetOrCreateDecoder<
+        protos::pbzero::InternedGpuRenderStageSpecification>();
+    spec->name = context_->storage->InternString(decoder->name());
+    spec->description = context_->storage->InternString(decoder->description());
+    spec->resolved = true;
+  }
+  return spec;
+}
 
-    if (stage_id < gpu_render_stage_ids_.size()) {
-      stage_name = gpu_render_stage_ids_[static_cast<size_t>(stage_id)].first;
-    } else {
-      char buffer[64];
-      snprintf(buffer, sizeof(buffer), "render stage(%" PRIu64 ")", stage_id);
-      stage_name = context_->storage->InternString(buffer);
-    }
+StringId GpuEventParser::GetFullStageName(
+    PacketSequenceStateGeneration* sequence_state,
+    const protos::pbzero::GpuRenderStageEvent_Decoder& event) {
+  if (event.has_stage_iid()) {
+    auto* spec = GetRenderStageSpecification(sequence_state, event.stage_iid());
+    return spec ? spec->name : kNullStringId;
   }
+  uint64_t stage_id = static_cast<uint64_t>(event.stage_id());
+  if (stage_id < gpu_render_stage_ids_.size())
+    return gpu_render_stage_ids_[static_cast<size_t>(stage_id)].first;
+
+  StringId* cached = unknown_stage_names_.Find(stage_id);
+  if (cached)
+    return *cached;
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "render stage(%" PRIu64 ")", stage_id);
+  StringId stage_name = context_->storage->InternString(buffer);
+  unknown_stage_names_.Insert(stage_id, stage_name);
   return stage_name;
 }
 
@@ -291,20 +304,13 @@ void GpuEventParser::InsertGpuTrack(
   }
   ++gpu_hw_queue_counter_;
 }
-base::Optional<std::string> GpuEventParser::FindDebugName(
-    int32_t vk_object_type,
-    uint64_t vk_handle) const {
+StringId GpuEventParser::FindDebugName(int32_t vk_object_type,
+                                       uint64_t vk_handle) const {
   auto map = debug_marker_names_.find(vk_object_type);
-  if (map == debug_marker_names_.end()) {
-    return base::nullopt;
-  }
-
-  auto name = map->second.find(vk_handle);
-  if (name == map->second.end()) {
-    return base::nullopt;
-  } else {
-    return name->second;
-  }
+  if (map == debug_marker_names_.end())
+    return kNullStringId;
+  const StringId* name = map->second.Find(vk_handle);
+  return name ? *name : kNullStringId;
 }
 
 const StringId GpuEventParser::ParseRenderSubpasses(
@@ -365,15 +371,11 @@ void GpuEventParser::ParseGpuRenderStageEvent(
   auto args_callback = [this, &event,
                         sequence_state](ArgsTracker::BoundInserter* inserter) {
     if (event.has_stage_iid()) {
-      size_t stage_iid = static_cast<size_t>(event.stage_iid());
-      auto* decoder = sequence_state->LookupInternedMessage<
-          protos::pbzero::InternedData::kGpuSpecificationsFieldNumber,
-          protos::pbzero::InternedGpuRenderStageSpecification>(stage_iid);
-      if (decoder) {
+      auto* spec =
+          GetRenderStageSpecification(sequence_state, event.stage_iid());
+      if (spec) {
         // TODO: Add RenderStageCategory to gpu_slice table.
-        inserter->AddArg(description_id_,
-                         Variadic::String(context_->storage->InternString(
-                             decoder->description())));
+        inserter->AddArg(description_id_, Variadic::String(spec->description));
       }
     } else if (event.has_stage_id()) {
       size_t stage_id = static_cast<size_t>(event.stage_id());
@@ -398,20 +400,19 @@ void GpuEventParser::ParseGpuRenderStageEvent(
     uint64_t hw_queue_id = 0;
     if (event.has_hw_queue_iid()) {
       hw_queue_id = event.hw_queue_iid();
-      auto* decoder = sequence_state->LookupInternedMessage<
-          protos::pbzero::InternedData::kGpuSpecificationsFieldNumber,
-          protos::pbzero::InternedGpuRenderStageSpecification>(hw_queue_id);
-      if (!decoder) {
+      auto* spec = GetRenderStageSpecification(sequence_state, hw_queue_id);
+      if (!spec) {
         // Skip
         return;
       }
-      // TODO: Add RenderStageCategory to gpu_track table.
-      tables::GpuTrackTable::Row track(
-          context_->storage->InternString(decoder->name()));
-      track.scope = gpu_render_stage_scope_id_;
-      track.description =
-          context_->storage->InternString(decoder->description());
-      track_id = context_->track_tracker->InternGpuTrack(track);
+      if (!spec->track_id) {
+        // TODO: Add RenderStageCategory to gpu_track table.
+        tables::GpuTrackTable::Row track(spec->name);
+        track.scope = gpu_render_stage_scope_id_;
+        track.description = spec->description;
+        spec->track_id = context_->track_tracker->InternGpuTrack(track);
+      }
+      track_id = *spec->track_id;
     } else {
       uint32_t id = static_cast<uint32_t>(event.hw_queue_id());
       if (id < gpu_hw_queue_ids_.size() && gpu_hw_queue_ids_[id].has_value()) {
@@ -443,25 +444,6 @@ void GpuEventParser::ParseGpuRenderStageEvent(
       hw_queue_id = id;
     }
 
-    auto render_target_name =
-        FindDebugName(VK_OBJECT_TYPE_FRAMEBUFFER, event.render_target_handle());
-    auto render_target_name_id = render_target_name.has_value()
-                                     ? context_->storage->InternString(
-                                           render_target_name.value().c_str())
-                                     : kNullStringId;
-    auto render_pass_name =
-        FindDebugName(VK_OBJECT_TYPE_RENDER_PASS, event.render_pass_handle());
-    auto render_pass_name_id =
-        render_pass_name.has_value()
-            ? context_->storage->InternString(render_pass_name.value().c_str())
-            : kNullStringId;
-    auto command_buffer_name = FindDebugName(VK_OBJECT_TYPE_COMMAND_BUFFER,
-                                             event.command_buffer_handle());
-    auto command_buffer_name_id = command_buffer_name.has_value()
-                                      ? context_->storage->InternString(
-                                            command_buffer_name.value().c_str())
-                                      : kNullStringId;
-
     tables::GpuSliceTable::Row row;
     row.ts = ts;
     row.track_id = track_id;
@@ -471,12 +453,15 @@ void GpuEventParser::ParseGpuRenderStageEvent(
     // InternedGraphicsContext.
     row.context_id = static_cast<int64_t>(event.context());
     row.render_target = static_cast<int64_t>(event.render_target_handle());
-    row.render_target_name = render_target_name_id;
+    row.render_target_name =
+        FindDebugName(VK_OBJECT_TYPE_FRAMEBUFFER, event.render_target_handle());
     row.render_pass = static_cast<int64_t>(event.render_pass_handle());
-    row.render_pass_name = render_pass_name_id;
+    row.render_pass_name =
+        FindDebugName(VK_OBJECT_TYPE_RENDER_PASS, event.render_pass_handle());
     row.render_subpasses = ParseRenderSubpasses(event);
     row.command_buffer = static_cast<int64_t>(event.command_buffer_handle());
-    row.command_buffer_name = command_buffer_name_id;
+    row.command_buffer_name = FindDebugName(VK_OBJECT_TYPE_COMMAND_BUFFER,
+                                            event.command_buffer_handle());
     row.submission_id = event.submission_id();
     row.hw_queue_id = static_cast<int64_t>(hw_queue_id);
 
@@ -706,8 +691,11 @@ void GpuEventParser::ParseVulkanApiEvent(int64_t ts, ConstBytes blob) {
   if (vk_event.has_vk_debug_utils_object_name()) {
     protos::pbzero::VulkanApiEvent_VkDebugUtilsObjectName::Decoder event(
         vk_event.vk_debug_utils_object_name());
-    debug_marker_names_[event.object_type()][event.object()] =
-        event.object_name().ToStdString();
+    StringId name_id = context_->storage->InternString(event.object_name());
+    auto* names = &debug_marker_names_[event.object_type()];
+    auto it_and_inserted = names->Insert(event.object(), name_id);
+    if (!it_and_inserted.second)
+      *it_and_inserted.first = name_id;
   }
   if (vk_event.has_vk_queue_submit()) {
     protos::pbzero::VulkanApiEvent_VkQueueSubmit::Decoder event(
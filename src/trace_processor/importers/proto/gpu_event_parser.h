@@ -19,6 +19,7 @@
 
 #include <vector>
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_writer.h"
 #include "perfetto/protozero/field.h"
@@ -76,14 +77,29 @@ class GpuEventParser {
   void ParseGpuMemTotalEvent(int64_t, ConstBytes);
 
  private:
-  const StringId GetFullStageName(
+  // The values derived from an InternedGpuRenderStageSpecification, cached
+  // with the interned message so that they are resolved once per sequence
+  // rather than once per render stage event.
+  struct RenderStageSpecification {
+    bool resolved = false;
+    StringId name = kNullStringId;
+    StringId description = kNullStringId;
+    // Only set once the specification is used as a hardware queue.
+    base::Optional<TrackId> track_id;
+  };
+
+  // Returns nullptr if no specification was interned with |iid|.
+  RenderStageSpecification* GetRenderStageSpecification(
       PacketSequenceStateGeneration* sequence_state,
-      const protos::pbzero::GpuRenderStageEvent_Decoder& event) const;
+      uint64_t iid);
+  StringId GetFullStageName(
+      PacketSequenceStateGeneration* sequence_state,
+      const protos::pbzero::GpuRenderStageEvent_Decoder& event);
   void InsertGpuTrack(
       const protos::pbzero::
           GpuRenderStageEvent_Specifications_Description_Decoder& hw_queue);
-  base::Optional<std::string> FindDebugName(int32_t vk_object_type,
-                                            uint64_t vk_handle) const;
+  // Returns kNullStringId if the object has no debug name.
+  StringId FindDebugName(int32_t vk_object_type, uint64_t vk_handle) const;
   const StringId ParseRenderSubpasses(
       const protos::pbzero::GpuRenderStageEvent_Decoder& event) const;
 
@@ -98,6 +114,8 @@ class GpuEventParser {
   size_t gpu_hw_queue_counter_ = 0;
   // Map of stage ID -> pair(stage name, stage description)
   std::vector<std::pair<StringId, StringId>> gpu_render_stage_ids_;
+  // Map of stage ID without a specification -> "render stage(ID)".
+  base::FlatHashMap<uint64_t, StringId> unknown_stage_names_;
   // For VulkanMemoryEvent
   std::unordered_map<VulkanMemoryEvent::AllocationScope,
                      int64_t /*counter_value*/,
@@ -116,7 +134,7 @@ class GpuEventParser {
   // For Vulkan events.
   // For VulkanApiEvent.VkDebugUtilsObjectName.
   // Map of vk handle -> vk object name.
-  using DebugMarkerMap = std::unordered_map<uint64_t, std::string>;
+  using DebugMarkerMap = base::FlatHashMap<uint64_t, StringId>;
   // Map of VkObjectType -> DebugMarkerMap.
   std::unordered_map<int32_t, DebugMarkerMap> debug_marker_names_;
   // For VulkanApiEvent.VkQueueSubmit.
@@ -18,8 +18,10 @@
 
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/proto/heap_graph_tracker.h"
+#include "src/trace_processor/importers/proto/packet_sequence_state.h"
 #include "src/trace_processor/importers/proto/profiler_util.h"
 #include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/trace_sorter.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
 #include "protos/perfetto/trace/profiling/deobfuscation.pbzero.h"
@@ -122,49 +124,88 @@ bool ForEachVarInt(const T& decoder, F fn) {
 
 using perfetto::protos::pbzero::TracePacket;
 
+// The objects, types and roots of a HeapGraph packet, decoded by
+// PreparePacket() before they are added to the HeapGraphTracker while parsing.
+struct HeapGraphModule::PreparedHeapGraph : public PreparedPacket {
+  struct Type {
+    uint64_t id;
+    StringPool::Id class_name;
+    base::Optional<uint64_t> location_id;
+    uint64_t object_size;
+    std::vector<uint64_t> field_name_ids;
+    uint64_t superclass_id;
+    uint64_t classloader_id;
+    bool no_fields;
+    StringPool::Id kind;
+  };
+
+  HeapGraphTracker::SourceObjects objects;
+
+  // The ids of the first |num_relative_objects| objects are delta encoded
+  // relative to the last object of the previous packet of the sequence,
+  // which is only known when parsing.
+  size_t num_relative_objects = 0;
+
+  std::vector<Type> types;
+  std::vector<HeapGraphTracker::SourceRoot> roots;
+
+  // The number of malformed objects, types and roots found. Reported when
+  // parsing, as the stats are indexed by upid.
+  int64_t num_malformed = 0;
+};
+
 HeapGraphModule::HeapGraphModule(TraceProcessorContext* context)
     : context_(context) {
   RegisterForField(TracePacket::kHeapGraphFieldNumber, context);
   RegisterForField(TracePacket::kDeobfuscationMappingFieldNumber, context);
 }
 
-void HeapGraphModule::ParsePacket(
-    const protos::pbzero::TracePacket::Decoder& decoder,
-    const TimestampedTracePiece& ttp,
+ModuleResult HeapGraphModule::TokenizePacket(
+    const protos::pbzero::TracePacket::Decoder&,
+    TraceBlobView* packet,
+    int64_t packet_timestamp,
+    PacketSequenceState* state,
     uint32_t field_id) {
-  switch (field_id) {
-    case TracePacket::kHeapGraphFieldNumber:
-      ParseHeapGraph(decoder.trusted_packet_sequence_id(), ttp.timestamp,
-                     decoder.heap_graph());
-      return;
-    case TracePacket::kDeobfuscationMappingFieldNumber:
-      ParseDeobfuscationMapping(decoder.deobfuscation_mapping());
-      return;
-  }
+  if (field_id != TracePacket::kHeapGraphFieldNumber)
+    return ModuleResult::Ignored();
+
+  // Heap graphs can be several MBs each so they are decoded ahead of parsing
+  // (see PreparePacket()), on worker threads if enabled.
+  TraceSorter* sorter = context_->sorter.get();
+  sorter->PushPreparablePacket(
+      packet_timestamp,
+      sorter->payload_arena()->Make<PreparablePacketData>(
+          std::move(*packet), state->current_generation(), this));
+  return ModuleResult::Handled();
 }
 
-void HeapGraphModule::ParseHeapGraph(uint32_t seq_id,
-                                     int64_t ts,
-                                     protozero::ConstBytes blob) {
-  auto* heap_graph_tracker = HeapGraphTracker::GetOrCreate(context_);
+void HeapGraphModule::PreparePacket(PreparablePacketData* data) const {
+  TraceStorage* storage = context_->storage.get();
+  TracePacket::Decoder decoder(data->packet.data(), data->packet.length());
+  protozero::ConstBytes blob = decoder.heap_graph();
   protos::pbzero::HeapGraph::Decoder heap_graph(blob.data, blob.size);
-  UniquePid upid = context_->process_tracker->GetOrCreateProcess(
-      static_cast<uint32_t>(heap_graph.pid()));
-  heap_graph_tracker->SetPacketIndex(seq_id, heap_graph.index());
+  std::unique_ptr<PreparedHeapGraph> prepared(new PreparedHeapGraph());
+
+  HeapGraphTracker::SourceObjects& objs = prepared->objects;
+  uint64_t last_object_id = 0;
+  bool last_object_id_is_relative = true;
   for (auto it = heap_graph.objects(); it; ++it) {
     protos::pbzero::HeapGraphObject::Decoder object(*it);
-    HeapGraphTracker::SourceObject obj;
+    uint64_t object_id;
+    bool is_relative = false;
     if (object.id_delta()) {
-      obj.object_id =
-          heap_graph_tracker->GetLastObjectId(seq_id) + object.id_delta();
+      object_id = last_object_id + object.id_delta();
+      is_relative = last_object_id_is_relative;
     } else {
-      obj.object_id = object.id();
+      object_id = object.id();
     }
-    obj.self_size = object.self_size();
-    obj.type_id = object.type_id();
 
     uint64_t base_obj_id = object.reference_field_id_base();
+    size_t references_begin = objs.referred_objects.size();
 
+    // The references are decoded straight into the arrays shared by all the
+    // objects of the packet.
+    //
     // In S+ traces, this field will not be set for normal instances. It will be
     // set in the corresponding HeapGraphType instead. It will still be set for
     // class objects.
@@ -173,34 +214,49 @@ void HeapGraphModule::ParseHeapGraph(uint32_t seq_id,
     bool parse_error = ForEachVarInt<
         protos::pbzero::HeapGraphObject::kReferenceFieldIdFieldNumber>(
         object,
-        [&obj](uint64_t value) { obj.field_name_ids.push_back(value); });
+        [&objs](uint64_t value) { objs.field_name_ids.push_back(value); });
+    size_t num_field_names = objs.field_name_ids.size() - references_begin;
 
     if (!parse_error) {
       // grep-friendly: reference_object_id
       parse_error = ForEachVarInt<
           protos::pbzero::HeapGraphObject::kReferenceObjectIdFieldNumber>(
-          object, [&obj, base_obj_id](uint64_t value) {
+          object, [&objs, base_obj_id](uint64_t value) {
             if (value)
               value += base_obj_id;
-            obj.referred_objects.push_back(value);
+            objs.referred_objects.push_back(value);
           });
     }
-
-    if (parse_error) {
-      context_->storage->IncrementIndexedStats(
-          stats::heap_graph_malformed_packet, static_cast<int>(upid));
-      break;
-    }
-    if (!obj.field_name_ids.empty() &&
-        (obj.field_name_ids.size() != obj.referred_objects.size())) {
-      context_->storage->IncrementIndexedStats(
-          stats::heap_graph_malformed_packet, static_cast<int>(upid));
+    size_t num_references = objs.referred_objects.size() - references_begin;
+
+    if (parse_error ||
+        (num_field_names != 0 && num_field_names != num_references)) {
+      objs.field_name_ids.resize(references_begin);
+      objs.referred_objects.resize(references_begin);
+      prepared->num_malformed++;
+      if (parse_error)
+        break;
       continue;
     }
-    heap_graph_tracker->AddObject(seq_id, upid, ts, std::move(obj));
+    if (num_field_names == 0)
+      objs.field_name_ids.resize(objs.referred_objects.size());
+
+    objs.object_ids.push_back(object_id);
+    objs.self_sizes.push_back(object.self_size());
+    objs.type_ids.push_back(object.type_id());
+    objs.has_field_names.push_back(num_field_names != 0);
+    objs.reference_ends.push_back(
+        static_cast<uint32_t>(objs.referred_objects.size()));
+
+    // Skipped objects do not count for the delta encoding of the ids, as the
+    // last object id is only updated when an object is added to the tracker.
+    last_object_id = object_id;
+    last_object_id_is_relative = is_relative;
+    if (is_relative)
+      prepared->num_relative_objects++;
   }
   for (auto it = heap_graph.types(); it; ++it) {
-    std::vector<uint64_t> field_name_ids;
+    PreparedHeapGraph::Type type;
     protos::pbzero::HeapGraphType::Decoder entry(*it);
     const char* str = reinterpret_cast<const char*>(entry.class_name().data);
     auto str_view = base::StringView(str, entry.class_name().size);
@@ -209,29 +265,97 @@ void HeapGraphModule::ParseHeapGraph(uint32_t seq_id,
     bool parse_error = ForEachVarInt<
         protos::pbzero::HeapGraphType::kReferenceFieldIdFieldNumber>(
         entry,
-        [&field_name_ids](uint64_t value) { field_name_ids.push_back(value); });
+        [&type](uint64_t value) { type.field_name_ids.push_back(value); });
 
     if (parse_error) {
-      context_->storage->IncrementIndexedStats(
-          stats::heap_graph_malformed_packet, static_cast<int>(upid));
+      prepared->num_malformed++;
       continue;
     }
 
-    bool no_fields =
+    type.no_fields =
         entry.kind() == protos::pbzero::HeapGraphType::KIND_NOREFERENCES ||
         entry.kind() == protos::pbzero::HeapGraphType::KIND_ARRAY ||
         entry.kind() == protos::pbzero::HeapGraphType::KIND_STRING;
 
-    StringPool::Id kind = context_->storage->InternString(
-        HeapGraphTypeKindToString(entry.kind()));
-    base::Optional<uint64_t> location_id;
+    type.kind = storage->InternString(HeapGraphTypeKindToString(entry.kind()));
     if (entry.has_location_id())
-      location_id = entry.location_id();
+      type.location_id = entry.location_id();
+
+    type.id = entry.id();
+    type.class_name = storage->InternString(str_view);
+    type.object_size = entry.object_size();
+    type.superclass_id = entry.superclass_id();
+    type.classloader_id = entry.classloader_id();
+    prepared->types.emplace_back(std::move(type));
+  }
+  for (auto it = heap_graph.roots(); it; ++it) {
+    protos::pbzero::HeapGraphRoot::Decoder entry(*it);
+    const char* str = HeapGraphRootTypeToString(entry.root_type());
+    auto str_view = base::StringView(str);
+
+    HeapGraphTracker::SourceRoot src_root;
+    src_root.root_type = storage->InternString(str_view);
+    // grep-friendly: object_ids
+    bool parse_error =
+        ForEachVarInt<protos::pbzero::HeapGraphRoot::kObjectIdsFieldNumber>(
+            entry, [&src_root](uint64_t value) {
+              src_root.object_ids.emplace_back(value);
+            });
+    if (parse_error) {
+      prepared->num_malformed++;
+      break;
+    }
+    prepared->roots.emplace_back(std::move(src_root));
+  }
+  data->prepared = std::move(prepared);
+}
+
+void HeapGraphModule::ParsePacket(
+    const protos::pbzero::TracePacket::Decoder& decoder,
+    const TimestampedTracePiece& ttp,
+    uint32_t field_id) {
+  switch (field_id) {
+    case TracePacket::kHeapGraphFieldNumber: {
+      PERFETTO_DCHECK(ttp.type ==
+                      TimestampedTracePiece::Type::kPreparablePacket);
+      PreparablePacketData* data = ttp.preparable_packet.get();
+      if (!data->prepared)
+        PreparePacket(data);
+      ParseHeapGraph(decoder.trusted_packet_sequence_id(), ttp.timestamp,
+                     decoder.heap_graph(),
+                     static_cast<PreparedHeapGraph*>(data->prepared.get()));
+      return;
+    }
+    case TracePacket::kDeobfuscationMappingFieldNumber:
+      ParseDeobfuscationMapping(decoder.deobfuscation_mapping());
+      return;
+  }
+}
+
+void HeapGraphModule::ParseHeapGraph(uint32_t seq_id,
+                                     int64_t ts,
+                                     protozero::ConstBytes blob,
+                                     PreparedHeapGraph* prepared) {
+  auto* heap_graph_tracker = HeapGraphTracker::GetOrCreate(context_);
+  protos::pbzero::HeapGraph::Decoder heap_graph(blob.data, blob.size);
+  UniquePid upid = context_->process_tracker->GetOrCreateProcess(
+      static_cast<uint32_t>(heap_graph.pid()));
+  heap_graph_tracker->SetPacketIndex(seq_id, heap_graph.index());
+  if (prepared->num_malformed) {
+    context_->storage->IncrementIndexedStats(stats::heap_graph_malformed_packet,
+                                             static_cast<int>(upid),
+                                             prepared->num_malformed);
+  }
 
+  uint64_t last_object_id = heap_graph_tracker->GetLastObjectId(seq_id);
+  for (size_t i = 0; i < prepared->num_relative_objects; ++i)
+    prepared->objects.object_ids[i] += last_object_id;
+  heap_graph_tracker->AddObjects(seq_id, upid, ts, prepared->objects);
+  for (PreparedHeapGraph::Type& type : prepared->types) {
     heap_graph_tracker->AddInternedType(
-        seq_id, entry.id(), context_->storage->InternString(str_view),
-        location_id, entry.object_size(), std::move(field_name_ids),
-        entry.superclass_id(), entry.classloader_id(), no_fields, kind);
+        seq_id, type.id, type.class_name, type.location_id, type.object_size,
+        std::move(type.field_name_ids), type.superclass_id,
+        type.classloader_id, type.no_fields, type.kind);
   }
   for (auto it = heap_graph.field_names(); it; ++it) {
     protos::pbzero::InternedString::Decoder entry(*it);
@@ -248,26 +372,8 @@ void HeapGraphModule::ParseHeapGraph(uint32_t seq_id,
     heap_graph_tracker->AddInternedLocationName(
         seq_id, entry.iid(), context_->storage->InternString(str_view));
   }
-  for (auto it = heap_graph.roots(); it; ++it) {
-    protos::pbzero::HeapGraphRoot::Decoder entry(*it);
-    const char* str = HeapGraphRootTypeToString(entry.root_type());
-    auto str_view = base::StringView(str);
-
-    HeapGraphTracker::SourceRoot src_root;
-    src_root.root_type = context_->storage->InternString(str_view);
-    // grep-friendly: object_ids
-    bool parse_error =
-        ForEachVarInt<protos::pbzero::HeapGraphRoot::kObjectIdsFieldNumber>(
-            entry, [&src_root](uint64_t value) {
-              src_root.object_ids.emplace_back(value);
-            });
-    if (parse_error) {
-      context_->storage->IncrementIndexedStats(
-          stats::heap_graph_malformed_packet, static_cast<int>(upid));
-      break;
-    }
-    heap_graph_tracker->AddRoot(seq_id, upid, ts, std::move(src_root));
-  }
+  for (HeapGraphTracker::SourceRoot& root : prepared->roots)
+    heap_graph_tracker->AddRoot(seq_id, upid, ts, std::move(root));
   if (!heap_graph.continued()) {
     heap_graph_tracker->FinalizeProfile(seq_id);
   }
@@ -32,6 +32,15 @@ class HeapGraphModule : public ProtoImporterModule {
  public:
   explicit HeapGraphModule(TraceProcessorContext* context);
 
+  ModuleResult TokenizePacket(
+      const protos::pbzero::TracePacket::Decoder& decoder,
+      TraceBlobView* packet,
+      int64_t packet_timestamp,
+      PacketSequenceState* state,
+      uint32_t field_id) override;
+
+  void PreparePacket(PreparablePacketData* data) const override;
+
   void ParsePacket(const protos::pbzero::TracePacket::Decoder& decoder,
                    const TimestampedTracePiece& ttp,
                    uint32_t field_id) override;
@@ -39,7 +48,12 @@ class HeapGraphModule : public ProtoImporterModule {
   void NotifyEndOfFile() override;
 
  private:
-  void ParseHeapGraph(uint32_t seq_id, int64_t ts, protozero::ConstBytes);
+  struct PreparedHeapGraph;
+
+  void ParseHeapGraph(uint32_t seq_id,
+                      int64_t ts,
+                      protozero::ConstBytes,
+                      PreparedHeapGraph*);
   void ParseDeobfuscationMapping(protozero::ConstBytes);
   void DeobfuscateClass(base::Optional<StringPool::Id> package_name_id,
                         StringPool::Id obfuscated_class_id,
@@ -19,9 +19,12 @@
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/importers/proto/dominator_tree.h"
 #include "src/trace_processor/importers/proto/profiler_util.h"
 #include "src/trace_processor/tables/profiler_tables.h"
 
+#include <algorithm>
+#include <limits>
 #include <set>
 #include <utility>
 
@@ -30,67 +33,18 @@ namespace trace_processor {
 
 namespace {
 
-template <typename F>
-void ForReferenceSet(const TraceStorage& storage,
-                     tables::HeapGraphObjectTable::Id id,
-                     F fn) {
-  uint32_t row = *storage.heap_graph_object_table().id().IndexOf(id);
-  base::Optional<uint32_t> reference_set_id =
-      storage.heap_graph_object_table().reference_set_id()[row];
-  if (!reference_set_id)
-    return;
-  uint32_t cur_reference_set_id;
-  for (uint32_t reference_row = *reference_set_id;
-       reference_row < storage.heap_graph_reference_table().row_count();
-       ++reference_row) {
-    cur_reference_set_id =
-        storage.heap_graph_reference_table().reference_set_id()[reference_row];
-    if (cur_reference_set_id != *reference_set_id)
-      break;
-    if (!fn(reference_row))
-      break;
-  }
-}
-
-std::set<tables::HeapGraphObjectTable::Id> GetChildren(
-    const TraceStorage& storage,
-    tables::HeapGraphObjectTable::Id id) {
-  uint32_t obj_row = *storage.heap_graph_object_table().id().IndexOf(id);
-  uint32_t cls_row = *storage.heap_graph_class_table().id().IndexOf(
-      storage.heap_graph_object_table().type_id()[obj_row]);
-
-  StringPool::Id kind = storage.heap_graph_class_table().kind()[cls_row];
-  base::Optional<StringPool::Id> weakref_kind =
-      storage.string_pool().GetId("KIND_WEAK_REFERENCE");
-  base::Optional<StringPool::Id> softref_kind =
-      storage.string_pool().GetId("KIND_SOFT_REFERENCE");
-  base::Optional<StringPool::Id> finalizerref_kind =
-      storage.string_pool().GetId("KIND_FINALIZER_REFERENCE");
-  base::Optional<StringPool::Id> phantomref_kind =
-      storage.string_pool().GetId("KIND_PHANTOM_REFERENCE");
-
-  if ((weakref_kind && kind == *weakref_kind) ||
-      (softref_kind && kind == *softref_kind) ||
-      (finalizerref_kind && kind == *finalizerref_kind) ||
-      (phantomref_kind && kind == *phantomref_kind)) {
-    // Do not follow weak / soft / finalizer / phantom references.
-    return {};
+// Returns the class kinds whose references should not be followed (weak /
+// soft / finalizer / phantom references), among the ones in the storage.
+std::vector<StringPool::Id> GetWeakReferenceKinds(const TraceStorage& storage) {
+  std::vector<StringPool::Id> kinds;
+  for (const char* kind :
+       {"KIND_WEAK_REFERENCE", "KIND_SOFT_REFERENCE",
+        "KIND_FINALIZER_REFERENCE", "KIND_PHANTOM_REFERENCE"}) {
+    base::Optional<StringPool::Id> id = storage.string_pool().GetId(kind);
+    if (id)
+      kinds.push_back(*id);
   }
-
-  std::set<tables::HeapGraphObjectTable::Id> children;
-  ForReferenceSet(
-      storage, id, [&storage, &children, id](uint32_t reference_row) {
-        PERFETTO_CHECK(
-            storage.heap_graph_reference_table().owner_id()[reference_row] ==
-            id);
-        auto opt_owned =
-            storage.heap_graph_reference_table().owned_id()[reference_row];
-        if (opt_owned) {
-          children.emplace(*opt_owned);
-        }
-        return true;
-      });
-  return children;
+  return kinds;
 }
 
 struct ClassDescriptor {
@@ -183,48 +137,82 @@ BuildSuperclassMap(UniquePid upid, int64_t ts, TraceStorage* storage) {
   return superclass_map;
 }
 
-}  // namespace
+// Returns the name of the flamegraph node of the object at |row|: the
+// (deobfuscated) name of its class, followed by its root type for GC roots.
+StringPool::Id GetFlamegraphNodeName(TraceStorage* storage, uint32_t row) {
+  const auto& objects = storage->heap_graph_object_table();
+  const auto& classes = storage->heap_graph_class_table();
+  uint32_t type_row = *classes.id().IndexOf(objects.type_id()[row]);
+  base::Optional<StringPool::Id> opt_class_name_id =
+      classes.deobfuscated_name()[type_row];
+  if (!opt_class_name_id) {
+    opt_class_name_id = classes.name()[type_row];
+  }
+  PERFETTO_CHECK(opt_class_name_id);
+  StringPool::Id class_name_id = *opt_class_name_id;
+  base::Optional<StringPool::Id> root_type = objects.root_type()[row];
+  if (root_type) {
+    class_name_id = storage->InternString(base::StringView(
+        storage->GetString(class_name_id).ToStdString() + " [" +
+        storage->GetString(*root_type).ToStdString() + "]"));
+  }
+  return class_name_id;
+}
 
-void MarkRoot(TraceStorage* storage,
-              tables::HeapGraphObjectTable::Id id,
-              StringPool::Id type) {
-  uint32_t row = *storage->heap_graph_object_table().id().IndexOf(id);
-  storage->mutable_heap_graph_object_table()->mutable_root_type()->Set(row,
-                                                                       type);
-
-  // Calculate shortest distance to a GC root.
-  std::deque<std::pair<int32_t, tables::HeapGraphObjectTable::Id>>
-      reachable_nodes{{0, id}};
-  while (!reachable_nodes.empty()) {
-    tables::HeapGraphObjectTable::Id cur_node;
-    int32_t distance;
-    std::tie(distance, cur_node) = reachable_nodes.front();
-    reachable_nodes.pop_front();
-    uint32_t cur_row =
-        *storage->heap_graph_object_table().id().IndexOf(cur_node);
-    int32_t cur_distance =
-        storage->heap_graph_object_table().root_distance()[cur_row];
-    if (cur_distance == -1 || cur_distance > distance) {
-      if (cur_distance == -1) {
-        storage->mutable_heap_graph_object_table()->mutable_reachable()->Set(
-            cur_row, 1);
-      }
-      storage->mutable_heap_graph_object_table()->mutable_root_distance()->Set(
-          cur_row, distance);
-
-      for (tables::HeapGraphObjectTable::Id child_node :
-           GetChildren(*storage, cur_node)) {
-        uint32_t child_row =
-            *storage->heap_graph_object_table().id().IndexOf(child_node);
-        int32_t child_distance =
-            storage->heap_graph_object_table().root_distance()[child_row];
-        if (child_distance == -1 || child_distance > distance + 1)
-          reachable_nodes.emplace_back(distance + 1, child_node);
-      }
-    }
+// Converts |path| (without its artificial root) into a flamegraph table.
+std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
+BuildFlamegraphFromPath(TraceStorage* storage,
+                        const PathFromRoot& path,
+                        StringPool::Id profile_type,
+                        int64_t current_ts,
+                        UniquePid current_upid) {
+  auto java_mapping = storage->InternString("JAVA");
+
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl(
+      new tables::ExperimentalFlamegraphNodesTable(
+          storage->mutable_string_pool(), nullptr));
+
+  std::vector<int64_t> node_to_cumulative_size(path.nodes.size());
+  std::vector<int64_t> node_to_cumulative_count(path.nodes.size());
+  // i > 0 is to skip the artifical root node.
+  for (size_t i = path.nodes.size() - 1; i > 0; --i) {
+    const PathFromRoot::Node& node = path.nodes[i];
+
+    node_to_cumulative_size[i] += node.size;
+    node_to_cumulative_count[i] += node.count;
+    node_to_cumulative_size[node.parent_id] += node_to_cumulative_size[i];
+    node_to_cumulative_count[node.parent_id] += node_to_cumulative_count[i];
+  }
+
+  std::vector<FlamegraphId> node_to_id(path.nodes.size());
+  // i = 1 is to skip the artifical root node.
+  for (size_t i = 1; i < path.nodes.size(); ++i) {
+    const PathFromRoot::Node& node = path.nodes[i];
+    PERFETTO_CHECK(node.parent_id < i);
+    base::Optional<FlamegraphId> parent_id;
+    if (node.parent_id != 0)
+      parent_id = node_to_id[node.parent_id];
+    const uint32_t depth = node.depth;
+
+    tables::ExperimentalFlamegraphNodesTable::Row alloc_row{};
+    alloc_row.ts = current_ts;
+    alloc_row.upid = current_upid;
+    alloc_row.profile_type = profile_type;
+    alloc_row.depth = depth;
+    alloc_row.name = node.class_name_id;
+    alloc_row.map_name = java_mapping;
+    alloc_row.count = node.count;
+    alloc_row.cumulative_count = node_to_cumulative_count[i];
+    alloc_row.size = node.size;
+    alloc_row.cumulative_size = node_to_cumulative_size[i];
+    alloc_row.parent_id = parent_id;
+    node_to_id[i] = tbl->Insert(alloc_row).id;
   }
+  return tbl;
 }
 
+}  // namespace
+
 base::Optional<base::StringView> GetStaticClassTypeName(base::StringView type) {
   static const base::StringView kJavaClassTemplate("java.lang.Class<");
   if (!type.empty() && type.at(type.size() - 1) == '>' &&
@@ -336,66 +324,81 @@ tables::HeapGraphClassTable::Id HeapGraphTracker::GetOrInsertType(
   return it->second;
 }
 
+void HeapGraphTracker::SourceObjects::Append(const SourceObject& obj) {
+  object_ids.push_back(obj.object_id);
+  self_sizes.push_back(obj.self_size);
+  type_ids.push_back(obj.type_id);
+  has_field_names.push_back(!obj.field_name_ids.empty());
+  referred_objects.insert(referred_objects.end(), obj.referred_objects.begin(),
+                          obj.referred_objects.end());
+  if (obj.field_name_ids.empty()) {
+    field_name_ids.resize(referred_objects.size());
+  } else {
+    field_name_ids.insert(field_name_ids.end(), obj.field_name_ids.begin(),
+                          obj.field_name_ids.end());
+  }
+  reference_ends.push_back(static_cast<uint32_t>(referred_objects.size()));
+}
+
 void HeapGraphTracker::AddObject(uint32_t seq_id,
                                  UniquePid upid,
                                  int64_t ts,
                                  SourceObject obj) {
+  SourceObjects objs;
+  objs.Append(obj);
+  AddObjects(seq_id, upid, ts, objs);
+}
+
+void HeapGraphTracker::AddObjects(uint32_t seq_id,
+                                  UniquePid upid,
+                                  int64_t ts,
+                                  const SourceObjects& objs) {
   SequenceState& sequence_state = GetOrCreateSequence(seq_id);
 
-  if (!SetPidAndTimestamp(&sequence_state, upid, ts))
+  if (!SetPidAndTimestamp(&sequence_state, upid, ts) || objs.size() == 0)
     return;
 
-  sequence_state.last_object_id = obj.object_id;
-
-  tables::HeapGraphObjectTable::Id owner_id =
-      GetOrInsertObject(&sequence_state, obj.object_id);
-  tables::HeapGraphClassTable::Id type_id =
-      GetOrInsertType(&sequence_state, obj.type_id);
+  sequence_state.last_object_id = objs.object_ids.back();
 
   auto* hgo = context_->storage->mutable_heap_graph_object_table();
-  uint32_t row = *hgo->id().IndexOf(owner_id);
-
-  hgo->mutable_self_size()->Set(row, static_cast<int64_t>(obj.self_size));
-  hgo->mutable_type_id()->Set(row, type_id);
-
-  if (obj.self_size == 0)
-    sequence_state.deferred_size_objects_for_type_[type_id].push_back(owner_id);
-
-  uint32_t reference_set_id =
-      context_->storage->heap_graph_reference_table().row_count();
-  bool any_references = false;
-
-  for (size_t i = 0; i < obj.referred_objects.size(); ++i) {
-    uint64_t owned_object_id = obj.referred_objects[i];
-    // This is true for unset reference fields.
-    base::Optional<tables::HeapGraphObjectTable::Id> owned_id;
-    if (owned_object_id != 0)
-      owned_id = GetOrInsertObject(&sequence_state, owned_object_id);
-
-    auto ref_id_and_row =
-        context_->storage->mutable_heap_graph_reference_table()->Insert(
-            {reference_set_id,
-             owner_id,
-             owned_id,
-             {},
-             {},
-             /*deobfuscated_field_name=*/base::nullopt});
-    if (!obj.field_name_ids.empty()) {
-      sequence_state.references_for_field_name_id[obj.field_name_ids[i]]
-          .push_back(ref_id_and_row.id);
-    }
-    any_references = true;
-  }
-  if (any_references) {
-    uint32_t owner_row =
-        *context_->storage->heap_graph_object_table().id().IndexOf(owner_id);
-    context_->storage->mutable_heap_graph_object_table()
-        ->mutable_reference_set_id()
-        ->Set(owner_row, reference_set_id);
-    if (obj.field_name_ids.empty()) {
-      sequence_state.deferred_reference_objects_for_type_[type_id].push_back(
+  PendingReferences& refs = sequence_state.pending_references;
+  refs.owned_ids.reserve(refs.owned_ids.size() + objs.referred_objects.size());
+  refs.field_name_ids.reserve(refs.field_name_ids.size() +
+                              objs.field_name_ids.size());
+
+  uint32_t reference_begin = 0;
+  for (size_t i = 0; i < objs.size(); ++i) {
+    tables::HeapGraphObjectTable::Id owner_id =
+        GetOrInsertObject(&sequence_state, objs.object_ids[i]);
+    tables::HeapGraphClassTable::Id type_id =
+        GetOrInsertType(&sequence_state, objs.type_ids[i]);
+
+    uint32_t row = *hgo->id().IndexOf(owner_id);
+    hgo->mutable_self_size()->Set(row,
+                                  static_cast<int64_t>(objs.self_sizes[i]));
+    hgo->mutable_type_id()->Set(row, type_id);
+
+    if (objs.self_sizes[i] == 0) {
+      sequence_state.deferred_size_objects_for_type_[type_id].push_back(
           owner_id);
     }
+
+    uint32_t reference_end = objs.reference_ends[i];
+    if (reference_end == reference_begin)
+      continue;
+    for (uint32_t j = reference_begin; j < reference_end; ++j) {
+      uint64_t owned_object_id = objs.referred_objects[j];
+      // This is true for unset reference fields.
+      base::Optional<tables::HeapGraphObjectTable::Id> owned_id;
+      if (owned_object_id != 0)
+        owned_id = GetOrInsertObject(&sequence_state, owned_object_id);
+      refs.owned_ids.push_back(owned_id);
+      refs.field_name_ids.push_back(objs.field_name_ids[j]);
+    }
+    refs.owners.push_back(
+        {owner_id, objs.type_ids[i], objs.has_field_names[i],
+         static_cast<uint32_t>(refs.owned_ids.size())});
+    reference_begin = reference_end;
   }
 }
 
@@ -454,18 +457,6 @@ void HeapGraphTracker::AddInternedFieldName(uint32_t seq_id,
 
   sequence_state.interned_fields.emplace(intern_id,
                                          InternedField{field_name, type_name});
-
-  auto it = sequence_state.references_for_field_name_id.find(intern_id);
-  if (it != sequence_state.references_for_field_name_id.end()) {
-    auto hgr = context_->storage->mutable_heap_graph_reference_table();
-    for (const tables::HeapGraphReferenceTable::Id reference_id : it->second) {
-      uint32_t row = *hgr->id().IndexOf(reference_id);
-      hgr->mutable_field_name()->Set(row, field_name);
-      hgr->mutable_field_type_name()->Set(row, type_name);
-
-      field_to_rows_[field_name].emplace_back(row);
-    }
-  }
 }
 
 void HeapGraphTracker::SetPacketIndex(uint32_t seq_id, uint64_t index) {
@@ -551,54 +542,6 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
       sequence_state.deferred_size_objects_for_type_.erase(sz_obj_it);
     }
 
-    auto ref_obj_it =
-        sequence_state.deferred_reference_objects_for_type_.find(type_id);
-    if (ref_obj_it !=
-        sequence_state.deferred_reference_objects_for_type_.end()) {
-      for (tables::HeapGraphObjectTable::Id obj_id : ref_obj_it->second) {
-        const InternedType* current_type = &interned_type;
-        if (interned_type.no_fields) {
-          continue;
-        }
-        size_t field_offset_in_cls = 0;
-        ForReferenceSet(
-            *context_->storage, obj_id,
-            [this, &current_type, &sequence_state,
-             &field_offset_in_cls](uint32_t reference_row) {
-              while (current_type && field_offset_in_cls >=
-                                         current_type->field_name_ids.size()) {
-                size_t prev_type_size = current_type->field_name_ids.size();
-                current_type = GetSuperClass(&sequence_state, current_type);
-                field_offset_in_cls -= prev_type_size;
-              }
-
-              if (!current_type) {
-                return false;
-              }
-
-              uint64_t field_id =
-                  current_type->field_name_ids[field_offset_in_cls++];
-              auto it = sequence_state.interned_fields.find(field_id);
-              if (it == sequence_state.interned_fields.end()) {
-                PERFETTO_DLOG("Invalid field id.");
-                context_->storage->IncrementIndexedStats(
-                    stats::heap_graph_malformed_packet,
-                    static_cast<int>(sequence_state.current_upid));
-                return true;
-              }
-              const InternedField& field = it->second;
-              auto hgr =
-                  context_->storage->mutable_heap_graph_reference_table();
-              hgr->mutable_field_name()->Set(reference_row, field.name);
-              hgr->mutable_field_type_name()->Set(reference_row,
-                                                  field.type_name);
-              field_to_rows_[field.name].emplace_back(reference_row);
-              return true;
-            });
-      }
-      sequence_state.deferred_reference_objects_for_type_.erase(ref_obj_it);
-    }
-
     auto* hgc = context_->storage->mutable_heap_graph_class_table();
     uint32_t row = *hgc->id().IndexOf(type_id);
     hgc->mutable_name()->Set(row, interned_type.name);
@@ -655,12 +598,9 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
         static_cast<int>(sequence_state.current_upid));
   }
 
-  if (!sequence_state.deferred_reference_objects_for_type_.empty()) {
-    context_->storage->IncrementIndexedStats(
-        stats::heap_graph_malformed_packet,
-        static_cast<int>(sequence_state.current_upid));
-  }
+  InsertReferences(&sequence_state);
 
+  std::vector<tables::HeapGraphObjectTable::Id> roots;
   for (const SourceRoot& root : sequence_state.current_roots) {
     for (uint64_t obj_id : root.object_ids) {
       auto it = sequence_state.object_id_to_db_id.find(obj_id);
@@ -673,15 +613,236 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
       auto it_and_success = roots_[std::make_pair(sequence_state.current_upid,
                                                   sequence_state.current_ts)]
                                 .emplace(db_id);
-      if (it_and_success.second)
-        MarkRoot(context_->storage.get(), db_id, root.root_type);
+      if (it_and_success.second) {
+        auto* hgo = context_->storage->mutable_heap_graph_object_table();
+        hgo->mutable_root_type()->Set(*hgo->id().IndexOf(db_id),
+                                      root.root_type);
+        roots.push_back(db_id);
+      }
     }
   }
+  HeapGraphAdjacency adjacency = BuildAdjacency(sequence_state, roots);
+  PopulateReachabilityAndDominators(adjacency);
+  adjacencies_[std::make_pair(sequence_state.current_upid,
+                              sequence_state.current_ts)] =
+      std::move(adjacency);
 
   PopulateSuperClasses(sequence_state);
   sequence_state_.erase(seq_id);
 }
 
+void HeapGraphTracker::InsertReferences(SequenceState* seq) {
+  auto* hgo = context_->storage->mutable_heap_graph_object_table();
+  auto* hgr = context_->storage->mutable_heap_graph_reference_table();
+  const PendingReferences& refs = seq->pending_references;
+  bool missing_type = false;
+
+  uint32_t reference_begin = 0;
+  for (const PendingReferences::Owner& owner : refs.owners) {
+    // The references of the objects without field names are named by the
+    // fields of their type, followed by those of its superclasses.
+    const InternedType* current_type = nullptr;
+    size_t field_offset_in_cls = 0;
+    if (!owner.has_field_names) {
+      auto it = seq->interned_types.find(owner.type_id);
+      if (it == seq->interned_types.end()) {
+        missing_type = true;
+      } else if (!it->second.no_fields) {
+        current_type = &it->second;
+      }
+    }
+
+    uint32_t reference_set_id = hgr->row_count();
+    for (uint32_t i = reference_begin; i < owner.end; ++i) {
+      const InternedField* field = nullptr;
+      if (owner.has_field_names) {
+        auto it = seq->interned_fields.find(refs.field_name_ids[i]);
+        if (it != seq->interned_fields.end())
+          field = &it->second;
+      } else {
+        while (current_type &&
+               field_offset_in_cls >= current_type->field_name_ids.size()) {
+          size_t prev_type_size = current_type->field_name_ids.size();
+          current_type = GetSuperClass(seq, current_type);
+          field_offset_in_cls -= prev_type_size;
+        }
+        if (current_type) {
+          uint64_t field_id =
+              current_type->field_name_ids[field_offset_in_cls++];
+          auto it = seq->interned_fields.find(field_id);
+          if (it == seq->interned_fields.end()) {
+            PERFETTO_DLOG("Invalid field id.");
+            context_->storage->IncrementIndexedStats(
+                stats::heap_graph_malformed_packet,
+                static_cast<int>(seq->current_upid));
+          } else {
+            field = &it->second;
+          }
+        }
+      }
+
+      tables::HeapGraphReferenceTable::Row row;
+      row.reference_set_id = reference_set_id;
+      row.owner_id = owner.id;
+      row.owned_id = refs.owned_ids[i];
+      if (field) {
+        row.field_name = field->name;
+        row.field_type_name = field->type_name;
+      }
+      uint32_t reference_row = hgr->Insert(row).row;
+      if (field)
+        field_to_rows_[field->name].emplace_back(reference_row);
+    }
+    hgo->mutable_reference_set_id()->Set(*hgo->id().IndexOf(owner.id),
+                                         reference_set_id);
+    reference_begin = owner.end;
+  }
+
+  if (missing_type) {
+    context_->storage->IncrementIndexedStats(
+        stats::heap_graph_malformed_packet,
+        static_cast<int>(seq->current_upid));
+  }
+  seq->pending_references = PendingReferences();
+}
+
+HeapGraphAdjacency HeapGraphTracker::BuildAdjacency(
+    const SequenceState& seq,
+    const std::vector<tables::HeapGraphObjectTable::Id>& roots) {
+  const auto& objects = context_->storage->heap_graph_object_table();
+  const auto& classes = context_->storage->heap_graph_class_table();
+  const auto& references = context_->storage->heap_graph_reference_table();
+  HeapGraphAdjacency adjacency;
+
+  // Number the objects of the graph densely, in the order of their rows.
+  std::vector<uint32_t>& rows = adjacency.rows;
+  rows.reserve(seq.object_id_to_db_id.size());
+  for (const auto& p : seq.object_id_to_db_id)
+    rows.push_back(*objects.id().IndexOf(p.second));
+  std::sort(rows.begin(), rows.end());
+  const auto object_count = static_cast<uint32_t>(rows.size());
+  if (object_count > 0) {
+    adjacency.first_row = rows.front();
+    adjacency.row_to_node.assign(rows.back() - rows.front() + 1,
+                                 DominatorTree::kNoNode);
+  }
+  for (uint32_t node = 0; node < object_count; ++node)
+    adjacency.row_to_node[rows[node] - adjacency.first_row] = node;
+  auto node_for_id = [&objects,
+                      &adjacency](tables::HeapGraphObjectTable::Id id) {
+    return adjacency.NodeForRow(*objects.id().IndexOf(id));
+  };
+
+  // Build the graph of the references, plus an artificial root (the last
+  // node) referring to all the GC roots.
+  std::vector<StringPool::Id> weak_kinds =
+      GetWeakReferenceKinds(*context_->storage);
+  CsrGraph& graph = adjacency.graph;
+  graph.offsets.reserve(object_count + 2);
+  graph.targets.reserve(references.row_count());
+  for (uint32_t node = 0; node < object_count; ++node) {
+    uint32_t row = rows[node];
+    base::Optional<uint32_t> reference_set_id =
+        objects.reference_set_id()[row];
+    uint32_t cls_row = *classes.id().IndexOf(objects.type_id()[row]);
+    // Do not follow weak / soft / finalizer / phantom references.
+    if (reference_set_id &&
+        std::find(weak_kinds.begin(), weak_kinds.end(),
+                  classes.kind()[cls_row]) == weak_kinds.end()) {
+      auto first_target = static_cast<std::ptrdiff_t>(graph.targets.size());
+      for (uint32_t ref_row = *reference_set_id;
+           ref_row < references.row_count() &&
+           references.reference_set_id()[ref_row] == *reference_set_id;
+           ++ref_row) {
+        base::Optional<tables::HeapGraphObjectTable::Id> owned =
+            references.owned_id()[ref_row];
+        uint32_t target =
+            owned ? node_for_id(*owned) : DominatorTree::kNoNode;
+        if (target != DominatorTree::kNoNode)
+          graph.targets.push_back(target);
+      }
+      auto targets = graph.targets.begin() + first_target;
+      std::sort(targets, graph.targets.end());
+      graph.targets.erase(std::unique(targets, graph.targets.end()),
+                          graph.targets.end());
+    }
+    graph.offsets.push_back(static_cast<uint32_t>(graph.targets.size()));
+  }
+  for (tables::HeapGraphObjectTable::Id root : roots) {
+    uint32_t node = node_for_id(root);
+    if (node != DominatorTree::kNoNode)
+      graph.targets.push_back(node);
+  }
+  graph.offsets.push_back(static_cast<uint32_t>(graph.targets.size()));
+  graph.targets.shrink_to_fit();
+  return adjacency;
+}
+
+void HeapGraphTracker::PopulateReachabilityAndDominators(
+    const HeapGraphAdjacency& adjacency) {
+  auto* objects = context_->storage->mutable_heap_graph_object_table();
+  const std::vector<uint32_t>& rows = adjacency.rows;
+  const CsrGraph& graph = adjacency.graph;
+  const auto object_count = static_cast<uint32_t>(rows.size());
+  const uint32_t super_root = adjacency.super_root();
+
+  // Compute the shortest distance to a GC root with a breadth-first search
+  // from all the roots.
+  std::vector<int32_t> distances(object_count, -1);
+  std::vector<uint32_t> queue;
+  queue.reserve(object_count);
+  for (uint32_t e = graph.offsets[super_root];
+       e < graph.offsets[super_root + 1]; ++e) {
+    uint32_t root = graph.targets[e];
+    if (distances[root] == -1) {
+      distances[root] = 0;
+      queue.push_back(root);
+    }
+  }
+  for (size_t i = 0; i < queue.size(); ++i) {
+    uint32_t node = queue[i];
+    for (uint32_t e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e) {
+      uint32_t target = graph.targets[e];
+      if (distances[target] == -1) {
+        distances[target] = distances[node] + 1;
+        queue.push_back(target);
+      }
+    }
+  }
+  for (uint32_t node : queue) {
+    objects->mutable_reachable()->Set(rows[node], 1);
+    objects->mutable_root_distance()->Set(rows[node], distances[node]);
+  }
+  queue.clear();
+  queue.shrink_to_fit();
+  distances.clear();
+  distances.shrink_to_fit();
+
+  // Accumulate the retained sizes bottom-up in the dominator tree.
+  DominatorTree tree(graph, super_root);
+  std::vector<int64_t> retained_sizes(object_count + 1, 0);
+  std::vector<int64_t> retained_counts(object_count + 1, 0);
+  const std::vector<uint32_t>& preorder = tree.preorder();
+  for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+    uint32_t node = *it;
+    if (node == super_root)
+      continue;
+    retained_sizes[node] += objects->self_size()[rows[node]];
+    retained_counts[node]++;
+    uint32_t idom = tree.immediate_dominator(node);
+    retained_sizes[idom] += retained_sizes[node];
+    retained_counts[idom] += retained_counts[node];
+
+    uint32_t row = rows[node];
+    if (idom != super_root) {
+      objects->mutable_dominator_id()->Set(row,
+                                           objects->id()[rows[idom]].value);
+    }
+    objects->mutable_retained_size()->Set(row, retained_sizes[node]);
+    objects->mutable_retained_count()->Set(row, retained_counts[node]);
+  }
+}
+
 // TODO(fmayer): For Android S+ traces, use the superclass_id from the trace.
 void HeapGraphTracker::PopulateSuperClasses(const SequenceState& seq) {
   // Maps from normalized class name and location, to superclass.
@@ -728,50 +889,35 @@ void HeapGraphTracker::PopulateSuperClasses(const SequenceState& seq) {
 }
 
 void FindPathFromRoot(TraceStorage* storage,
+                      const HeapGraphAdjacency& adjacency,
                       tables::HeapGraphObjectTable::Id id,
                       PathFromRoot* path) {
+  const auto& objects = storage->heap_graph_object_table();
+  const CsrGraph& graph = adjacency.graph;
+  uint32_t root = adjacency.NodeForRow(*objects.id().IndexOf(id));
+  if (root == DominatorTree::kNoNode)
+    return;
+  if (path->visited.size() < graph.node_count())
+    path->visited.resize(graph.node_count());
+
   // We have long retention chains (e.g. from LinkedList). If we use the stack
   // here, we risk running out of stack space. This is why we use a vector to
   // simulate the stack.
   struct StackElem {
-    tables::HeapGraphObjectTable::Id node;  // Node in the original graph.
-    size_t parent_id;  // id of parent node in the result tree.
-    size_t i;          // Index of the next child of this node to handle.
-    uint32_t depth;    // Depth in the resulting tree
-                       // (including artifical root).
-    std::vector<tables::HeapGraphObjectTable::Id> children;
+    uint32_t node;       // Node in the original graph.
+    size_t path_id;      // id of the node in the result tree.
+    uint32_t next_edge;  // Index of the next child of this node to handle.
+    uint32_t depth;      // Depth in the resulting tree
+                         // (including artifical root).
   };
-
-  std::vector<StackElem> stack{{id, PathFromRoot::kRoot, 0, 0, {}}};
-
-  while (!stack.empty()) {
-    tables::HeapGraphObjectTable::Id n = stack.back().node;
-    uint32_t row = *storage->heap_graph_object_table().id().IndexOf(n);
-    size_t parent_id = stack.back().parent_id;
-    uint32_t depth = stack.back().depth;
-    size_t& i = stack.back().i;
-    std::vector<tables::HeapGraphObjectTable::Id>& children =
-        stack.back().children;
-
-    tables::HeapGraphClassTable::Id type_id =
-        storage->heap_graph_object_table().type_id()[row];
-
-    uint32_t type_row =
-        *storage->heap_graph_class_table().id().IndexOf(type_id);
-    base::Optional<StringPool::Id> opt_class_name_id =
-        storage->heap_graph_class_table().deobfuscated_name()[type_row];
-    if (!opt_class_name_id) {
-      opt_class_name_id = storage->heap_graph_class_table().name()[type_row];
-    }
-    PERFETTO_CHECK(opt_class_name_id);
-    StringPool::Id class_name_id = *opt_class_name_id;
-    base::Optional<StringPool::Id> root_type =
-        storage->heap_graph_object_table().root_type()[row];
-    if (root_type) {
-      class_name_id = storage->InternString(base::StringView(
-          storage->GetString(class_name_id).ToStdString() + " [" +
-          storage->GetString(*root_type).ToStdString() + "]"));
-    }
+  std::vector<StackElem> stack;
+
+  // Adds the size of |node| to the child of |parent_id| for its class in the
+  // resulting tree, and schedules the handling of its children.
+  auto visit = [storage, path, &objects, &adjacency, &stack](
+                   uint32_t node, size_t parent_id, uint32_t depth) {
+    uint32_t row = adjacency.rows[node];
+    StringPool::Id class_name_id = GetFlamegraphNodeName(storage, row);
     auto it = path->nodes[parent_id].children.find(class_name_id);
     if (it == path->nodes[parent_id].children.end()) {
       size_t path_id = path->nodes.size();
@@ -783,44 +929,28 @@ void FindPathFromRoot(TraceStorage* storage,
       path->nodes.back().parent_id = parent_id;
     }
     size_t path_id = it->second;
-    PathFromRoot::Node* output_tree_node = &path->nodes[path_id];
-
-    if (i == 0) {
-      // This is the first time we are looking at this node, so add its
-      // size to the relevant node in the resulting tree.
-      output_tree_node->size +=
-          storage->heap_graph_object_table().self_size()[row];
-      output_tree_node->count++;
-      std::set<tables::HeapGraphObjectTable::Id> children_set =
-          GetChildren(*storage, n);
-      children.assign(children_set.cbegin(), children_set.cend());
-      PERFETTO_CHECK(children.size() == children_set.size());
-    }
-    // Otherwise we have already handled this node and just need to get its
-    // i-th child.
-    if (!children.empty()) {
-      PERFETTO_CHECK(i < children.size());
-      tables::HeapGraphObjectTable::Id child = children[i];
-      uint32_t child_row =
-          *storage->heap_graph_object_table().id().IndexOf(child);
-      if (++i == children.size())
-        stack.pop_back();
-
-      int32_t child_distance =
-          storage->heap_graph_object_table().root_distance()[child_row];
-      int32_t n_distance =
-          storage->heap_graph_object_table().root_distance()[row];
-      PERFETTO_CHECK(n_distance >= 0);
-      PERFETTO_CHECK(child_distance >= 0);
-
-      bool visited = path->visited.count(child);
-
-      if (child_distance == n_distance + 1 && !visited) {
-        path->visited.emplace(child);
-        stack.emplace_back(StackElem{child, path_id, 0, depth + 1, {}});
-      }
-    } else {
+    path->nodes[path_id].size += objects.self_size()[row];
+    path->nodes[path_id].count++;
+    stack.push_back({node, path_id, adjacency.graph.offsets[node], depth});
+  };
+
+  visit(root, PathFromRoot::kRoot, 0);
+  while (!stack.empty()) {
+    StackElem& top = stack.back();
+    if (top.next_edge == graph.offsets[top.node + 1]) {
       stack.pop_back();
+      continue;
+    }
+    uint32_t child = graph.targets[top.next_edge++];
+    int32_t child_distance =
+        objects.root_distance()[adjacency.rows[child]];
+    int32_t n_distance = objects.root_distance()[adjacency.rows[top.node]];
+    PERFETTO_CHECK(n_distance >= 0);
+    PERFETTO_CHECK(child_distance >= 0);
+
+    if (child_distance == n_distance + 1 && !path->visited[child]) {
+      path->visited[child] = true;
+      visit(child, top.path_id, top.depth + 1);
     }
   }
 }
@@ -829,82 +959,120 @@ std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
 HeapGraphTracker::BuildFlamegraph(const int64_t current_ts,
                                   const UniquePid current_upid) {
   auto profile_type = context_->storage->InternString("graph");
-  auto java_mapping = context_->storage->InternString("JAVA");
-
-  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl(
-      new tables::ExperimentalFlamegraphNodesTable(
-          context_->storage->mutable_string_pool(), nullptr));
 
   auto it = roots_.find(std::make_pair(current_upid, current_ts));
-  if (it == roots_.end()) {
-    // TODO(fmayer): This should not be within the flame graph but some marker
-    // in the UI.
-    if (IsTruncated(current_upid, current_ts)) {
-      tables::ExperimentalFlamegraphNodesTable::Row alloc_row{};
-      alloc_row.ts = current_ts;
-      alloc_row.upid = current_upid;
-      alloc_row.profile_type = profile_type;
-      alloc_row.depth = 0;
-      alloc_row.name =
-          context_->storage->InternString("ERROR: INCOMPLETE GRAPH");
-      alloc_row.map_name = java_mapping;
-      alloc_row.count = 1;
-      alloc_row.cumulative_count = 1;
-      alloc_row.size = 1;
-      alloc_row.cumulative_size = 1;
-      alloc_row.parent_id = base::nullopt;
-      tbl->Insert(alloc_row);
-      return tbl;
-    }
-    // We haven't seen this graph, so we should raise an error.
-    return nullptr;
-  }
+  const HeapGraphAdjacency* adjacency = GetAdjacency(current_upid, current_ts);
+  if (it == roots_.end() || !adjacency)
+    return BuildMissingGraphFlamegraph(profile_type, current_ts, current_upid);
 
   const std::set<tables::HeapGraphObjectTable::Id>& roots = it->second;
 
   PathFromRoot init_path;
   for (tables::HeapGraphObjectTable::Id root : roots) {
-    FindPathFromRoot(context_->storage.get(), root, &init_path);
+    FindPathFromRoot(context_->storage.get(), *adjacency, root, &init_path);
   }
+  return BuildFlamegraphFromPath(context_->storage.get(), init_path,
+                                 profile_type, current_ts, current_upid);
+}
 
-  std::vector<int32_t> node_to_cumulative_size(init_path.nodes.size());
-  std::vector<int32_t> node_to_cumulative_count(init_path.nodes.size());
-  // i > 0 is to skip the artifical root node.
-  for (size_t i = init_path.nodes.size() - 1; i > 0; --i) {
-    const PathFromRoot::Node& node = init_path.nodes[i];
+std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
+HeapGraphTracker::BuildDominatorFlamegraph(const int64_t current_ts,
+                                           const UniquePid current_upid) {
+  auto profile_type = context_->storage->InternString("graph_dominator");
+
+  const HeapGraphAdjacency* adjacency = GetAdjacency(current_upid, current_ts);
+  if (!adjacency)
+    return BuildMissingGraphFlamegraph(profile_type, current_ts, current_upid);
+
+  TraceStorage* storage = context_->storage.get();
+  const auto& objects = storage->heap_graph_object_table();
+
+  // The children of each object in the dominator tree (computed in
+  // FinalizeProfile), with the objects dominated by the artificial root of the
+  // GC roots as the children of |kSuperRoot|.
+  constexpr uint32_t kSuperRoot = std::numeric_limits<uint32_t>::max();
+  std::vector<std::pair<uint32_t, uint32_t>> parent_and_rows;
+  for (uint32_t row : adjacency->rows) {
+    if (!objects.retained_size()[row])
+      continue;  // Not reachable.
+    base::Optional<uint32_t> dominator_id = objects.dominator_id()[row];
+    parent_and_rows.emplace_back(
+        dominator_id ? *objects.id().IndexOf(
+                           tables::HeapGraphObjectTable::Id(*dominator_id))
+                     : kSuperRoot,
+        row);
+  }
+  std::sort(parent_and_rows.begin(), parent_and_rows.end());
 
-    node_to_cumulative_size[i] += node.size;
-    node_to_cumulative_count[i] += node.count;
-    node_to_cumulative_size[node.parent_id] += node_to_cumulative_size[i];
-    node_to_cumulative_count[node.parent_id] += node_to_cumulative_count[i];
+  // Aggregate the dominator tree by class into the flamegraph, in the same
+  // way as FindPathFromRoot aggregates the shortest paths from the roots.
+  PathFromRoot path;
+  struct StackElem {
+    uint32_t parent;  // Row of the parent object in the dominator tree.
+    size_t parent_id;  // Id of the parent node in the resulting tree.
+    uint32_t depth;
+  };
+  std::vector<StackElem> stack{{kSuperRoot, PathFromRoot::kRoot, 0}};
+  while (!stack.empty()) {
+    StackElem elem = stack.back();
+    stack.pop_back();
+    auto children = std::equal_range(
+        parent_and_rows.begin(), parent_and_rows.end(),
+        std::make_pair(elem.parent, 0u),
+        [](const std::pair<uint32_t, uint32_t>& a,
+           const std::pair<uint32_t, uint32_t>& b) {
+          return a.first < b.first;
+        });
+    for (auto child = children.first; child != children.second; ++child) {
+      uint32_t row = child->second;
+      StringPool::Id class_name_id = GetFlamegraphNodeName(storage, row);
+      auto& parent_children = path.nodes[elem.parent_id].children;
+      auto node_it = parent_children.find(class_name_id);
+      if (node_it == parent_children.end()) {
+        size_t path_id = path.nodes.size();
+        std::tie(node_it, std::ignore) =
+            parent_children.emplace(class_name_id, path_id);
+        path.nodes.emplace_back(PathFromRoot::Node{});
+        path.nodes.back().class_name_id = class_name_id;
+        path.nodes.back().depth = elem.depth;
+        path.nodes.back().parent_id = elem.parent_id;
+      }
+      size_t path_id = node_it->second;
+      path.nodes[path_id].size += objects.self_size()[row];
+      path.nodes[path_id].count++;
+      stack.push_back({row, path_id, elem.depth + 1});
+    }
   }
+  return BuildFlamegraphFromPath(storage, path, profile_type, current_ts,
+                                 current_upid);
+}
 
-  std::vector<FlamegraphId> node_to_id(init_path.nodes.size());
-  // i = 1 is to skip the artifical root node.
-  for (size_t i = 1; i < init_path.nodes.size(); ++i) {
-    const PathFromRoot::Node& node = init_path.nodes[i];
-    PERFETTO_CHECK(node.parent_id < i);
-    base::Optional<FlamegraphId> parent_id;
-    if (node.parent_id != 0)
-      parent_id = node_to_id[node.parent_id];
-    const uint32_t depth = node.depth;
+std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
+HeapGraphTracker::BuildMissingGraphFlamegraph(StringPool::Id profile_type,
+                                              int64_t current_ts,
+                                              UniquePid current_upid) {
+  // We haven't seen this graph, so we should raise an error.
+  if (!IsTruncated(current_upid, current_ts))
+    return nullptr;
 
-    tables::ExperimentalFlamegraphNodesTable::Row alloc_row{};
-    alloc_row.ts = current_ts;
-    alloc_row.upid = current_upid;
-    alloc_row.profile_type = profile_type;
-    alloc_row.depth = depth;
-    alloc_row.name = node.class_name_id;
-    alloc_row.map_name = java_mapping;
-    alloc_row.count = static_cast<int64_t>(node.count);
-    alloc_row.cumulative_count =
-        static_cast<int64_t>(node_to_cumulative_count[i]);
-    alloc_row.size = static_cast<int64_t>(node.size);
-    alloc_row.cumulative_size =
-        static_cast<int64_t>(node_to_cumulative_size[i]);
-    alloc_row.parent_id = parent_id;
-    node_to_id[i] = tbl->Insert(alloc_row).id;
-  }
+  // TODO(fmayer): This should not be within the flame graph but some marker
+  // in the UI.
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> tbl(
+      new tables::ExperimentalFlamegraphNodesTable(
+          context_->storage->mutable_string_pool(), nullptr));
+  tables::ExperimentalFlamegraphNodesTable::Row alloc_row{};
+  alloc_row.ts = current_ts;
+  alloc_row.upid = current_upid;
+  alloc_row.profile_type = profile_type;
+  alloc_row.depth = 0;
+  alloc_row.name = context_->storage->InternString("ERROR: INCOMPLETE GRAPH");
+  alloc_row.map_name = context_->storage->InternString("JAVA");
+  alloc_row.count = 1;
+  alloc_row.cumulative_count = 1;
+  alloc_row.size = 1;
+  alloc_row.cumulative_size = 1;
+  alloc_row.parent_id = base::nullopt;
+  tbl->Insert(alloc_row);
   return tbl;
 }
 
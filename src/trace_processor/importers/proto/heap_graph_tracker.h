@@ -26,6 +26,7 @@
 #include "perfetto/ext/base/string_view.h"
 
 #include "protos/perfetto/trace/profiling/heap_graph.pbzero.h"
+#include "src/trace_processor/importers/proto/dominator_tree.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
@@ -40,6 +41,31 @@ struct NormalizedType {
   size_t number_of_arrays;
 };
 
+// The strong references between the objects of a heap graph in compressed
+// sparse row form. This is built once when the graph is finalized, so that
+// traversals do not have to filter the heap_graph_reference table for each
+// object. The objects are numbered densely in the order of their rows and the
+// last node is an artificial root which refers to all the GC roots.
+struct HeapGraphAdjacency {
+  uint32_t super_root() const { return static_cast<uint32_t>(rows.size()); }
+
+  // Returns the node of the object in |row|, or DominatorTree::kNoNode if it
+  // is not part of this graph.
+  uint32_t NodeForRow(uint32_t row) const {
+    return row >= first_row && row - first_row < row_to_node.size()
+               ? row_to_node[row - first_row]
+               : DominatorTree::kNoNode;
+  }
+
+  // The row of the object of each node.
+  std::vector<uint32_t> rows;
+  uint32_t first_row = 0;
+  std::vector<uint32_t> row_to_node;
+  // The successors of each node are sorted and unique. The references of
+  // weak / soft / finalizer / phantom reference objects are not included.
+  CsrGraph graph;
+};
+
 struct PathFromRoot {
   static constexpr size_t kRoot = 0;
   struct Node {
@@ -52,13 +78,12 @@ struct PathFromRoot {
     std::map<StringId, size_t> children;
   };
   std::vector<Node> nodes{Node{}};
-  std::set<tables::HeapGraphObjectTable::Id> visited;
+  // Indexed by the nodes of the HeapGraphAdjacency.
+  std::vector<bool> visited;
 };
 
-void MarkRoot(TraceStorage* s,
-              tables::HeapGraphObjectTable::Id id,
-              StringPool::Id type);
 void FindPathFromRoot(TraceStorage* storage,
+                      const HeapGraphAdjacency& adjacency,
                       tables::HeapGraphObjectTable::Id id,
                       PathFromRoot* path);
 
@@ -82,6 +107,29 @@ class HeapGraphTracker : public Destructible {
     std::vector<uint64_t> referred_objects;
   };
 
+  // The objects of a HeapGraph packet, decoded column by column: the
+  // references of all the objects share flat arrays instead of two vectors
+  // per object, which dominated the decoding time of large heap dumps.
+  struct SourceObjects {
+    size_t size() const { return object_ids.size(); }
+    void Append(const SourceObject& obj);
+
+    // All ids in this are in the trace iid space, not in the trace processor
+    // id space.
+    std::vector<uint64_t> object_ids;
+    std::vector<uint64_t> self_sizes;
+    std::vector<uint64_t> type_ids;
+    // False for the objects whose references are named by the fields of
+    // their type (S+ traces), rather than by |field_name_ids|.
+    std::vector<bool> has_field_names;
+    // The references of the i-th object are in [reference_ends[i - 1],
+    // reference_ends[i]) of |referred_objects| and |field_name_ids|.
+    std::vector<uint32_t> reference_ends;
+    std::vector<uint64_t> referred_objects;
+    // 0 for the references of the objects without |has_field_names|.
+    std::vector<uint64_t> field_name_ids;
+  };
+
   struct SourceRoot {
     StringPool::Id root_type;
     std::vector<uint64_t> object_ids;
@@ -98,6 +146,10 @@ class HeapGraphTracker : public Destructible {
 
   void AddRoot(uint32_t seq_id, UniquePid upid, int64_t ts, SourceRoot root);
   void AddObject(uint32_t seq_id, UniquePid upid, int64_t ts, SourceObject obj);
+  void AddObjects(uint32_t seq_id,
+                  UniquePid upid,
+                  int64_t ts,
+                  const SourceObjects& objs);
   void AddInternedType(uint32_t seq_id,
                        uint64_t intern_id,
                        StringPool::Id strid,
@@ -136,10 +188,26 @@ class HeapGraphTracker : public Destructible {
     return &it->second;
   }
 
+  // Returns the references between the objects of the graph dumped at |ts|
+  // for |upid|, or nullptr if there is no such (finalized) graph.
+  const HeapGraphAdjacency* GetAdjacency(UniquePid upid, int64_t ts) const {
+    auto it = adjacencies_.find(std::make_pair(upid, ts));
+    return it == adjacencies_.end() ? nullptr : &it->second;
+  }
+
+  // Builds the flamegraph of the shortest paths from the GC roots to each
+  // object, with the objects aggregated by class.
   std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> BuildFlamegraph(
       const int64_t current_ts,
       const UniquePid current_upid);
 
+  // Builds the flamegraph of the dominator tree, with the objects aggregated
+  // by class: the cumulative size of a node is the memory retained by its
+  // objects.
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
+  BuildDominatorFlamegraph(const int64_t current_ts,
+                           const UniquePid current_upid);
+
   uint64_t GetLastObjectId(uint32_t seq_id) {
     return GetOrCreateSequence(seq_id).last_object_id;
   }
@@ -159,6 +227,23 @@ class HeapGraphTracker : public Destructible {
     uint64_t classloader_id;
     StringPool::Id kind;
   };
+  // The references of the objects of a graph. Their rows are only inserted
+  // when the graph is finalized, once the field names and the types (which
+  // come after the objects in the dump) are known, instead of being inserted
+  // with empty names and updated row by row.
+  struct PendingReferences {
+    struct Owner {
+      tables::HeapGraphObjectTable::Id id;
+      uint64_t type_id;
+      bool has_field_names;
+      // The end of the references of this object in |owned_ids| and
+      // |field_name_ids|.
+      uint32_t end;
+    };
+    std::vector<Owner> owners;
+    std::vector<base::Optional<tables::HeapGraphObjectTable::Id>> owned_ids;
+    std::vector<uint64_t> field_name_ids;
+  };
   struct SequenceState {
     UniquePid current_upid = 0;
     int64_t current_ts = 0;
@@ -168,12 +253,8 @@ class HeapGraphTracker : public Destructible {
     std::map<uint64_t, StringPool::Id> interned_location_names;
     std::map<uint64_t, tables::HeapGraphObjectTable::Id> object_id_to_db_id;
     std::map<uint64_t, tables::HeapGraphClassTable::Id> type_id_to_db_id;
-    std::map<uint64_t, std::vector<tables::HeapGraphReferenceTable::Id>>
-        references_for_field_name_id;
     std::map<uint64_t, InternedField> interned_fields;
-    std::map<tables::HeapGraphClassTable::Id,
-             std::vector<tables::HeapGraphObjectTable::Id>>
-        deferred_reference_objects_for_type_;
+    PendingReferences pending_references;
     base::Optional<uint64_t> prev_index;
     // For most objects, we need not store the size in the object's message
     // itself, because all instances of the type have the same type. In this
@@ -192,10 +273,22 @@ class HeapGraphTracker : public Destructible {
   tables::HeapGraphClassTable::Id GetOrInsertType(SequenceState* sequence_state,
                                                   uint64_t type_id);
   bool SetPidAndTimestamp(SequenceState* seq, UniquePid upid, int64_t ts);
+  // Inserts the rows of the pending references of |seq|.
+  void InsertReferences(SequenceState* seq);
+  HeapGraphAdjacency BuildAdjacency(
+      const SequenceState& seq,
+      const std::vector<tables::HeapGraphObjectTable::Id>& roots);
+  // Computes the reachable, root_distance, dominator_id, retained_size and
+  // retained_count columns of the objects of |adjacency|.
+  void PopulateReachabilityAndDominators(const HeapGraphAdjacency& adjacency);
   void PopulateSuperClasses(const SequenceState& seq);
   InternedType* GetSuperClass(SequenceState* sequence_state,
                               const InternedType* current_type);
   bool IsTruncated(UniquePid upid, int64_t ts);
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable>
+  BuildMissingGraphFlamegraph(StringPool::Id profile_type,
+                              int64_t current_ts,
+                              UniquePid current_upid);
 
   TraceProcessorContext* const context_;
   std::map<uint32_t, SequenceState> sequence_state_;
@@ -211,6 +304,7 @@ class HeapGraphTracker : public Destructible {
   std::map<std::pair<UniquePid, int64_t>,
            std::set<tables::HeapGraphObjectTable::Id>>
       roots_;
+  std::map<std::pair<UniquePid, int64_t>, HeapGraphAdjacency> adjacencies_;
   std::set<std::pair<UniquePid, int64_t>> truncated_graphs_;
 };
 
@@ -25,6 +25,7 @@ namespace perfetto {
 namespace trace_processor {
 namespace {
 
+using ::testing::ElementsAre;
 using ::testing::UnorderedElementsAre;
 
 TEST(HeapGraphTrackerTest, PackageFromLocationApp) {
@@ -187,6 +188,97 @@ TEST(HeapGraphTrackerTest, BuildFlamegraph) {
   EXPECT_THAT(counts, UnorderedElementsAre(1, 2, 1, 1, 1));
 }
 
+TEST(HeapGraphTrackerTest, DominatorTree) {
+  // 1@R -> 2@A -> 4@C
+  //    \--> 3@B --/
+  //
+  // The shortest path to 4 goes through 2 (or 3), but 4 is only dominated by
+  // the root, so it is retained by neither 2 nor 3.
+
+  constexpr uint64_t kSeqId = 1;
+  constexpr UniquePid kPid = 1;
+  constexpr int64_t kTimestamp = 1;
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+
+  HeapGraphTracker tracker(&context);
+
+  constexpr uint64_t kField = 1;
+  constexpr uint64_t kLocation = 0;
+  tracker.AddInternedFieldName(kSeqId, kField, base::StringView("foo"));
+  tracker.AddInternedLocationName(kSeqId, kLocation,
+                                  context.storage->InternString("location"));
+
+  StringPool::Id normal_kind = context.storage->InternString("KIND_NORMAL");
+  const char* kTypeNames[] = {"R", "A", "B", "C"};
+  for (uint64_t type_id = 1; type_id <= 4; ++type_id) {
+    tracker.AddInternedType(
+        kSeqId, type_id, context.storage->InternString(kTypeNames[type_id - 1]),
+        kLocation, /*object_size=*/0,
+        /*field_name_ids=*/{}, /*superclass_id=*/0,
+        /*classloader_id=*/0, /*no_fields=*/false,
+        /*kind=*/normal_kind);
+  }
+
+  const std::vector<std::vector<uint64_t>> kReferences = {
+      {2, 3}, {4}, {4}, {}};
+  for (uint64_t object_id = 1; object_id <= 4; ++object_id) {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = object_id;
+    obj.self_size = object_id;
+    obj.type_id = object_id;
+    obj.referred_objects = kReferences[object_id - 1];
+    obj.field_name_ids.assign(obj.referred_objects.size(), kField);
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  }
+
+  HeapGraphTracker::SourceRoot root;
+  root.root_type = context.storage->InternString("ROOT");
+  root.object_ids.emplace_back(1);
+  tracker.AddRoot(kSeqId, kPid, kTimestamp, root);
+
+  tracker.FinalizeProfile(kSeqId);
+
+  // Objects are inserted in the order of their ids, so row i is object i + 1,
+  // and node 4 is the artificial root of the graph.
+  const HeapGraphAdjacency* adjacency = tracker.GetAdjacency(kPid, kTimestamp);
+  ASSERT_NE(adjacency, nullptr);
+  EXPECT_THAT(adjacency->rows, ElementsAre(0, 1, 2, 3));
+  EXPECT_THAT(adjacency->graph.offsets, ElementsAre(0, 2, 3, 4, 4, 5));
+  EXPECT_THAT(adjacency->graph.targets, ElementsAre(1, 2, 3, 3, 0));
+
+  const auto& objects = context.storage->heap_graph_object_table();
+  ASSERT_EQ(objects.row_count(), 4u);
+  EXPECT_EQ(objects.dominator_id()[0], base::nullopt);
+  EXPECT_EQ(objects.dominator_id()[1], objects.id()[0].value);
+  EXPECT_EQ(objects.dominator_id()[2], objects.id()[0].value);
+  EXPECT_EQ(objects.dominator_id()[3], objects.id()[0].value);
+  EXPECT_THAT(objects.retained_size().ToVectorForTesting(),
+              ElementsAre(10, 2, 3, 4));
+  EXPECT_THAT(objects.retained_count().ToVectorForTesting(),
+              ElementsAre(4, 1, 1, 1));
+  EXPECT_THAT(objects.root_distance().ToVectorForTesting(),
+              ElementsAre(0, 1, 1, 2));
+
+  std::unique_ptr<tables::ExperimentalFlamegraphNodesTable> flame =
+      tracker.BuildDominatorFlamegraph(kTimestamp, kPid);
+  ASSERT_NE(flame, nullptr);
+  ASSERT_EQ(flame->row_count(), 4u);
+  for (uint32_t i = 0; i < flame->row_count(); ++i) {
+    NullTermStringView name = context.storage->GetString(flame->name()[i]);
+    if (name == "R [ROOT]") {
+      EXPECT_EQ(flame->depth()[i], 0u);
+      EXPECT_EQ(flame->cumulative_size()[i], 10);
+      EXPECT_EQ(flame->cumulative_count()[i], 4);
+    } else {
+      EXPECT_EQ(flame->depth()[i], 1u);
+      EXPECT_EQ(flame->cumulative_size()[i], flame->size()[i]);
+      EXPECT_EQ(flame->cumulative_count()[i], 1);
+    }
+  }
+}
+
 static const char kArray[] = "X[]";
 static const char kDoubleArray[] = "X[][]";
 static const char kNoArray[] = "X";
@@ -194,6 +286,88 @@ static const char kLongNoArray[] = "ABCDE";
 static const char kStaticClassNoArray[] = "java.lang.Class<abc>";
 static const char kStaticClassArray[] = "java.lang.Class<abc[]>";
 
+TEST(HeapGraphTrackerTest, AddObjectsWithFieldsOfType) {
+  // 1@Sub has the fields of Sub ("sub") and then of its superclass Base
+  // ("base"). 2@Base has its field names in the trace.
+  constexpr uint64_t kSeqId = 1;
+  constexpr UniquePid kPid = 1;
+  constexpr int64_t kTimestamp = 1;
+  constexpr uint64_t kBaseField = 1;
+  constexpr uint64_t kSubField = 2;
+  constexpr uint64_t kBase = 1;
+  constexpr uint64_t kSub = 2;
+  constexpr uint64_t kLocation = 0;
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+
+  HeapGraphTracker tracker(&context);
+
+  HeapGraphTracker::SourceObjects objs;
+  {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = 1;
+    obj.self_size = 1;
+    obj.type_id = kSub;
+    obj.referred_objects = {2, 0};
+    objs.Append(obj);
+  }
+  {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = 2;
+    obj.self_size = 2;
+    obj.type_id = kBase;
+    obj.field_name_ids = {kBaseField};
+    obj.referred_objects = {1};
+    objs.Append(obj);
+  }
+  tracker.AddObjects(kSeqId, kPid, kTimestamp, objs);
+
+  // The references are only inserted once the graph is finalized, as the
+  // types and field names come after the objects.
+  EXPECT_EQ(context.storage->heap_graph_reference_table().row_count(), 0u);
+
+  StringPool::Id normal_kind = context.storage->InternString("KIND_NORMAL");
+  tracker.AddInternedType(kSeqId, kBase, context.storage->InternString("Base"),
+                          kLocation, /*object_size=*/0,
+                          /*field_name_ids=*/{kBaseField},
+                          /*superclass_id=*/0,
+                          /*classloader_id=*/0, /*no_fields=*/false,
+                          /*kind=*/normal_kind);
+  tracker.AddInternedType(kSeqId, kSub, context.storage->InternString("Sub"),
+                          kLocation, /*object_size=*/0,
+                          /*field_name_ids=*/{kSubField},
+                          /*superclass_id=*/kBase,
+                          /*classloader_id=*/0, /*no_fields=*/false,
+                          /*kind=*/normal_kind);
+  tracker.AddInternedFieldName(kSeqId, kBaseField, "Sub Base.base");
+  tracker.AddInternedFieldName(kSeqId, kSubField, "Base Sub.sub");
+  tracker.AddInternedLocationName(kSeqId, kLocation,
+                                  context.storage->InternString("location"));
+  tracker.FinalizeProfile(kSeqId);
+
+  const auto& refs = context.storage->heap_graph_reference_table();
+  ASSERT_EQ(refs.row_count(), 3u);
+  EXPECT_THAT(refs.reference_set_id().ToVectorForTesting(),
+              ElementsAre(0u, 0u, 2u));
+  auto field_name = [&](uint32_t row) {
+    return context.storage->GetString(refs.field_name()[row]).ToStdString();
+  };
+  EXPECT_EQ(field_name(0), "Sub.sub");
+  EXPECT_EQ(field_name(1), "Base.base");
+  EXPECT_EQ(field_name(2), "Base.base");
+  EXPECT_FALSE(refs.owned_id()[1].has_value());
+
+  const auto& objects = context.storage->heap_graph_object_table();
+  EXPECT_EQ(objects.reference_set_id()[0], 0u);
+  EXPECT_EQ(objects.reference_set_id()[1], 2u);
+
+  const std::vector<int64_t>* base_rows =
+      tracker.RowsForField(context.storage->InternString("Base.base"));
+  ASSERT_NE(base_rows, nullptr);
+  EXPECT_THAT(*base_rows, UnorderedElementsAre(1, 2));
+}
+
 TEST(HeapGraphTrackerTest, NormalizeTypeName) {
   // sizeof(...) - 1 below to get rid of the null-byte.
   EXPECT_EQ(NormalizeTypeName(base::StringView(kArray, sizeof(kArray) - 1))
@@ -290,20 +290,17 @@ MemoryTrackerSnapshotParser::EmitNode(
         } else if (entry.first == "effective_size") {
           node_table->mutable_effective_size()->Set(node_row_index, value_int);
         } else {
-          args.AddArg(context_->storage->InternString(
-                          base::StringView(entry.first + ".value")),
-                      Variadic::Integer(value_int));
+          const EntryArgKeys& keys = GetEntryArgKeys(entry.first);
+          args.AddArg(keys.value, Variadic::Integer(value_int));
           if (entry.second.units < unit_ids_.size()) {
-            args.AddArg(context_->storage->InternString(
-                            base::StringView(entry.first + ".unit")),
+            args.AddArg(keys.unit,
                         Variadic::String(unit_ids_[entry.second.units]));
           }
         }
         break;
       }
       case GlobalNodeGraph::Node::Entry::Type::kString: {
-        args.AddArg(context_->storage->InternString(
-                        base::StringView(entry.first + ".value")),
+        args.AddArg(GetEntryArgKeys(entry.first).value,
                     Variadic::String(context_->storage->InternString(
                         base::StringView(entry.second.value_string))));
         break;
@@ -314,6 +311,17 @@ MemoryTrackerSnapshotParser::EmitNode(
   return node_row_id;
 }
 
+const MemoryTrackerSnapshotParser::EntryArgKeys&
+MemoryTrackerSnapshotParser::GetEntryArgKeys(const std::string& name) {
+  auto it = entry_arg_keys_.find(name);
+  if (it != entry_arg_keys_.end())
+    return it->second;
+  EntryArgKeys keys{
+      context_->storage->InternString(base::StringView(name + ".value")),
+      context_->storage->InternString(base::StringView(name + ".unit"))};
+  return entry_arg_keys_.emplace(name, keys).first->second;
+}
+
 void MemoryTrackerSnapshotParser::GenerateGraphFromRawNodesAndEmitRows() {
   std::unique_ptr<GlobalNodeGraph> graph = GenerateGraph(aggregate_raw_nodes_);
   EmitRows(last_snapshot_timestamp_, *graph, last_snapshot_level_of_detail_);
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_MEMORY_TRACKER_SNAPSHOT_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_MEMORY_TRACKER_SNAPSHOT_PARSER_H_
 
+#include <unordered_map>
+
 #include "perfetto/ext/trace_processor/importers/memory_tracker/graph_processor.h"
 #include "protos/perfetto/trace/memory_graph.pbzero.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
@@ -106,6 +108,17 @@ class MemoryTrackerSnapshotParser {
       ProcessMemorySnapshotId& proc_snapshot_row_id,
       IdNodeMap& id_node_map);
 
+  // The keys of the args of a node for one of its entries.
+  struct EntryArgKeys {
+    StringId value;
+    StringId unit;
+  };
+
+  // Returns the keys of the args for the entry called |name|. As the nodes
+  // of consecutive snapshots have the same entries, the keys are only built
+  // and interned once per trace.
+  const EntryArgKeys& GetEntryArgKeys(const std::string& name);
+
   void GenerateGraphFromRawNodesAndEmitRows();
 
   TraceProcessorContext* context_;
@@ -114,6 +127,7 @@ class MemoryTrackerSnapshotParser {
   RawMemoryNodeMap aggregate_raw_nodes_;
   int64_t last_snapshot_timestamp_;
   LevelOfDetail last_snapshot_level_of_detail_;
+  std::unordered_map<std::string, EntryArgKeys> entry_arg_keys_;
 };
 
 }  // namespace trace_processor
@@ -19,6 +19,31 @@
 namespace perfetto {
 namespace trace_processor {
 
+InternedMessageTable::InternedMessageTable() = default;
+InternedMessageTable::~InternedMessageTable() = default;
+
+InternedMessageTable::InternedMessageTable(const InternedMessageTable&) =
+    default;
+InternedMessageTable& InternedMessageTable::operator=(
+    const InternedMessageTable&) = default;
+
+std::pair<InternedMessageView*, bool> InternedMessageTable::Insert(
+    uint64_t iid,
+    InternedMessageView view) {
+  std::shared_ptr<InternedMessageView>* slot;
+  if (iid < kMaxDenseIid) {
+    if (dense_.size() <= iid)
+      dense_.resize(static_cast<size_t>(iid) + 1);
+    slot = &dense_[static_cast<size_t>(iid)];
+  } else {
+    slot = &sparse_[iid];
+  }
+  if (*slot)
+    return std::make_pair(slot->get(), false);
+  slot->reset(new InternedMessageView(std::move(view)));
+  return std::make_pair(slot->get(), true);
+}
+
 void PacketSequenceStateGeneration::InternMessage(uint32_t field_id,
                                                   TraceBlobView message) {
   constexpr auto kIidFieldNumber = 1;
@@ -37,8 +62,21 @@ void PacketSequenceStateGeneration::InternMessage(uint32_t field_id,
   }
   iid = field.as_uint64();
 
-  auto res = interned_data_[field_id].emplace(
-      iid, InternedMessageView(std::move(message)));
+  if (PERFETTO_UNLIKELY(field_id >= kMaxInternedFieldId)) {
+    PERFETTO_DLOG("Interned message with unknown field id %u", field_id);
+    return;
+  }
+  if (interned_data_.size() <= field_id)
+    interned_data_.resize(field_id + 1);
+  std::shared_ptr<InternedMessageTable>& table = interned_data_[field_id];
+  if (!table) {
+    table = std::make_shared<InternedMessageTable>();
+  } else if (table.use_count() > 1) {
+    // The table is shared with another generation: copy it before changing
+    // it.
+    table = std::make_shared<InternedMessageTable>(*table);
+  }
+  auto res = table->Insert(iid, InternedMessageView(std::move(message)));
 
   // If a message with this ID is already interned in the same generation,
   // its data should not have changed (this is forbidden by the InternedData
@@ -46,22 +84,17 @@ void PacketSequenceStateGeneration::InternMessage(uint32_t field_id,
   // TODO(eseckler): This DCHECK assumes that the message is encoded the
   // same way if it is re-emitted.
   PERFETTO_DCHECK(res.second ||
-                  (res.first->second.message().length() == message_size &&
-                   memcmp(res.first->second.message().data(), message_start,
+                  (res.first->message().length() == message_size &&
+                   memcmp(res.first->message().data(), message_start,
                           message_size) == 0));
 }
 
 InternedMessageView* PacketSequenceStateGeneration::GetInternedMessageView(
     uint32_t field_id,
     uint64_t iid) {
-  auto field_it = interned_data_.find(field_id);
-  if (field_it != interned_data_.end()) {
-    auto* message_map = &field_it->second;
-    auto it = message_map->find(iid);
-    if (it != message_map->end()) {
-      return &it->second;
-    }
-  }
+  InternedMessageView* view = FindInternedMessageView(field_id, iid);
+  if (view)
+    return view;
   state_->context()->storage->IncrementStats(
       stats::interned_data_tokenizer_errors);
   return nullptr;
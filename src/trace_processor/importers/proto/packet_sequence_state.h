@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -36,10 +37,46 @@
 namespace perfetto {
 namespace trace_processor {
 
-using InternedMessageMap =
-    std::unordered_map<uint64_t /*iid*/, InternedMessageView>;
-using InternedFieldMap =
-    std::unordered_map<uint32_t /*field_id*/, InternedMessageMap>;
+// The interned messages of one field of InternedData, by iid. Producers
+// allocate iids sequentially from 1, so small iids index a vector and only
+// the other ones go to a map.
+//
+// The views are shared with the tables copied from this one (see
+// PacketSequenceStateGeneration), so that the decoders they cache are reused
+// by the following generations.
+class InternedMessageTable {
+ public:
+  InternedMessageTable();
+  ~InternedMessageTable();
+
+  // Copies the pointers to the views, not the views.
+  InternedMessageTable(const InternedMessageTable&);
+  InternedMessageTable& operator=(const InternedMessageTable&);
+
+  // Returns nullptr if no message was interned with |iid|.
+  InternedMessageView* Find(uint64_t iid) const {
+    if (iid < dense_.size())
+      return dense_[iid].get();
+    auto it = sparse_.find(iid);
+    return it == sparse_.end() ? nullptr : it->second.get();
+  }
+
+  // Interns |view| with |iid| unless a message was already interned with
+  // |iid|. Returns the view of |iid| and whether it was inserted.
+  std::pair<InternedMessageView*, bool> Insert(uint64_t iid,
+                                               InternedMessageView view);
+
+ private:
+  // Iids up to this value are stored in |dense_|.
+  static constexpr uint64_t kMaxDenseIid = 1 << 16;
+
+  std::vector<std::shared_ptr<InternedMessageView>> dense_;
+  std::unordered_map<uint64_t, std::shared_ptr<InternedMessageView>> sparse_;
+};
+
+// The tables of the fields of InternedData, indexed by field id. The tables
+// are shared between generations and copied on write.
+using InternedFieldTables = std::vector<std::shared_ptr<InternedMessageTable>>;
 
 class PacketSequenceState;
 
@@ -51,6 +88,15 @@ class PacketSequenceStateGeneration {
   typename MessageType::Decoder* LookupInternedMessage(uint64_t iid);
 
   InternedMessageView* GetInternedMessageView(uint32_t field_id, uint64_t iid);
+
+  // Like GetInternedMessageView() but doesn't record a stat if the message is
+  // not found.
+  InternedMessageView* FindInternedMessageView(uint32_t field_id,
+                                               uint64_t iid) const {
+    if (field_id >= interned_data_.size() || !interned_data_[field_id])
+      return nullptr;
+    return interned_data_[field_id]->Find(iid);
+  }
   // Returns |nullptr| if no defaults were set.
   InternedMessageView* GetTracePacketDefaultsView() {
     if (!trace_packet_defaults_)
@@ -95,11 +141,11 @@ class PacketSequenceStateGeneration {
 
   PacketSequenceStateGeneration(PacketSequenceState* state,
                                 size_t generation_index,
-                                InternedFieldMap interned_data,
+                                InternedFieldTables interned_data,
                                 TraceBlobView defaults)
       : state_(state),
         generation_index_(generation_index),
-        interned_data_(interned_data),
+        interned_data_(std::move(interned_data)),
         trace_packet_defaults_(InternedMessageView(std::move(defaults))) {}
 
   void InternMessage(uint32_t field_id, TraceBlobView message);
@@ -110,9 +156,13 @@ class PacketSequenceStateGeneration {
     trace_packet_defaults_ = InternedMessageView(std::move(defaults));
   }
 
+  // InternedData field ids past this one are ignored. The fields defined
+  // so far have ids < 32.
+  static constexpr uint32_t kMaxInternedFieldId = 1024;
+
   PacketSequenceState* state_;
   size_t generation_index_;
-  InternedFieldMap interned_data_;
+  InternedFieldTables interned_data_;
   base::Optional<InternedMessageView> trace_packet_defaults_;
 };
 
@@ -158,7 +208,8 @@ class PacketSequenceState {
 
     // The new defaults should only apply to subsequent messages on the
     // sequence. Add a new generation with the updated defaults but the
-    // current generation's interned data state.
+    // current generation's interned data state. The tables of interned
+    // messages are shared, and copied when a message is interned into them.
     current_generation_.reset(new PacketSequenceStateGeneration(
         this, generation_index_++, current_generation_->interned_data_,
         std::move(defaults)));
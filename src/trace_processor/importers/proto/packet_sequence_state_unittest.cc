@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/packet_sequence_state.h"
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr uint32_t kEventNamesFieldId = 2;
+constexpr uint32_t kDebugAnnotationNamesFieldId = 3;
+
+// Returns an interned message with the given |iid| (field 1).
+TraceBlobView CreateInternedMessage(uint64_t iid) {
+  protozero::HeapBuffered<protozero::Message> msg;
+  msg->AppendVarInt(1, iid);
+  std::vector<uint8_t> data = msg.SerializeAsArray();
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[data.size()]);
+  memcpy(buf.get(), data.data(), data.size());
+  return TraceBlobView(std::move(buf), 0, data.size());
+}
+
+TraceBlobView CreateDefaults() {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[1]);
+  return TraceBlobView(std::move(buf), 0, 0);
+}
+
+class PacketSequenceStateTest : public ::testing::Test {
+ public:
+  PacketSequenceStateTest() {
+    context_.storage.reset(new TraceStorage());
+    state_.reset(new PacketSequenceState(&context_));
+  }
+
+ protected:
+  TraceProcessorContext context_;
+  std::unique_ptr<PacketSequenceState> state_;
+};
+
+TEST_F(PacketSequenceStateTest, LookupSmallAndLargeIids) {
+  state_->InternMessage(kEventNamesFieldId, CreateInternedMessage(1));
+  state_->InternMessage(kEventNamesFieldId, CreateInternedMessage(1ull << 40));
+
+  auto generation = state_->current_generation();
+  EXPECT_NE(generation->GetInternedMessageView(kEventNamesFieldId, 1), nullptr);
+  EXPECT_NE(generation->GetInternedMessageView(kEventNamesFieldId, 1ull << 40),
+            nullptr);
+  EXPECT_EQ(generation->GetInternedMessageView(kEventNamesFieldId, 2), nullptr);
+  EXPECT_EQ(generation->GetInternedMessageView(kDebugAnnotationNamesFieldId, 1),
+            nullptr);
+  EXPECT_EQ(context_.storage->stats()[stats::interned_data_tokenizer_errors]
+                .value,
+            2);
+}
+
+// A new generation started by new defaults shares the interned messages of
+// the previous one, but messages interned afterwards are only visible in the
+// new generation.
+TEST_F(PacketSequenceStateTest, NewDefaultsCopyTablesOnWrite) {
+  state_->InternMessage(kEventNamesFieldId, CreateInternedMessage(1));
+  state_->InternMessage(kDebugAnnotationNamesFieldId, CreateInternedMessage(1));
+  state_->UpdateTracePacketDefaults(CreateDefaults());
+  auto old_generation = state_->current_generation();
+
+  state_->UpdateTracePacketDefaults(CreateDefaults());
+  state_->InternMessage(kEventNamesFieldId, CreateInternedMessage(2));
+  auto new_generation = state_->current_generation();
+  ASSERT_NE(old_generation, new_generation);
+
+  EXPECT_EQ(old_generation->GetInternedMessageView(kEventNamesFieldId, 2),
+            nullptr);
+  EXPECT_NE(new_generation->GetInternedMessageView(kEventNamesFieldId, 2),
+            nullptr);
+
+  // The views interned before the new generation are shared.
+  EXPECT_EQ(old_generation->GetInternedMessageView(kEventNamesFieldId, 1),
+            new_generation->GetInternedMessageView(kEventNamesFieldId, 1));
+  EXPECT_EQ(
+      old_generation->GetInternedMessageView(kDebugAnnotationNamesFieldId, 1),
+      new_generation->GetInternedMessageView(kDebugAnnotationNamesFieldId, 1));
+}
+
+// Data derived from an interned message is computed once and reused by the
+// following generations.
+TEST_F(PacketSequenceStateTest, DerivedDataSharedBetweenGenerations) {
+  state_->InternMessage(kEventNamesFieldId, CreateInternedMessage(1));
+  auto* view =
+      state_->current_generation()->GetInternedMessageView(kEventNamesFieldId,
+                                                           1);
+  ASSERT_NE(view, nullptr);
+  *view->GetOrCreateDerivedData<int64_t>() = 42;
+
+  state_->UpdateTracePacketDefaults(CreateDefaults());
+  auto* new_view =
+      state_->current_generation()->GetInternedMessageView(kEventNamesFieldId,
+                                                           1);
+  ASSERT_NE(new_view, nullptr);
+  EXPECT_EQ(*new_view->GetOrCreateDerivedData<int64_t>(), 42);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/importers/proto/profile_module.h"
 
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
@@ -46,6 +48,24 @@ namespace trace_processor {
 using perfetto::protos::pbzero::TracePacket;
 using protozero::ConstBytes;
 
+// The interned data and the samples of a ProfilePacket, decoded by
+// PreparePacket() before they are added to the trackers while parsing.
+struct ProfileModule::PreparedProfilePacket : public PreparedPacket {
+  std::vector<std::pair<SequenceStackProfileTracker::SourceMappingId,
+                        SequenceStackProfileTracker::SourceMapping>>
+      mappings;
+  std::vector<std::pair<SequenceStackProfileTracker::SourceFrameId,
+                        SequenceStackProfileTracker::SourceFrame>>
+      frames;
+  std::vector<std::pair<SequenceStackProfileTracker::SourceCallstackId,
+                        SequenceStackProfileTracker::SourceCallstack>>
+      callstacks;
+
+  // The samples of each process dump, in order. Their timestamp is only set
+  // while parsing as it needs the clock snapshots.
+  std::vector<std::vector<HeapProfileTracker::SourceAllocation>> allocations;
+};
+
 ProfileModule::ProfileModule(TraceProcessorContext* context)
     : context_(context) {
   RegisterForField(TracePacket::kStreamingProfilePacketFieldNumber, context);
@@ -61,17 +81,89 @@ ProfileModule::~ProfileModule() = default;
 
 ModuleResult ProfileModule::TokenizePacket(const TracePacket::Decoder& decoder,
                                            TraceBlobView* packet,
-                                           int64_t /*packet_timestamp*/,
+                                           int64_t packet_timestamp,
                                            PacketSequenceState* state,
                                            uint32_t field_id) {
   switch (field_id) {
     case TracePacket::kStreamingProfilePacketFieldNumber:
       return TokenizeStreamingProfilePacket(state, packet,
                                             decoder.streaming_profile_packet());
+    case TracePacket::kProfilePacketFieldNumber: {
+      // The profiles of processes with many allocation sites can be several
+      // MBs so they are decoded ahead of parsing (see PreparePacket()), on
+      // worker threads if enabled.
+      TraceSorter* sorter = context_->sorter.get();
+      sorter->PushPreparablePacket(
+          packet_timestamp,
+          sorter->payload_arena()->Make<PreparablePacketData>(
+              std::move(*packet), state->current_generation(), this));
+      return ModuleResult::Handled();
+    }
   }
   return ModuleResult::Ignored();
 }
 
+void ProfileModule::PreparePacket(PreparablePacketData* data) const {
+  TraceStorage* storage = context_->storage.get();
+  TracePacket::Decoder decoder(data->packet.data(), data->packet.length());
+  protozero::ConstBytes blob = decoder.profile_packet();
+  protos::pbzero::ProfilePacket::Decoder packet(blob.data, blob.size);
+  std::unique_ptr<PreparedProfilePacket> prepared(new PreparedProfilePacket());
+
+  for (auto it = packet.mappings(); it; ++it) {
+    protos::pbzero::Mapping::Decoder entry(*it);
+    prepared->mappings.emplace_back(
+        entry.iid(), ProfilePacketUtils::MakeSourceMapping(entry));
+  }
+
+  for (auto it = packet.frames(); it; ++it) {
+    protos::pbzero::Frame::Decoder entry(*it);
+    prepared->frames.emplace_back(entry.iid(),
+                                  ProfilePacketUtils::MakeSourceFrame(entry));
+  }
+
+  for (auto it = packet.callstacks(); it; ++it) {
+    protos::pbzero::Callstack::Decoder entry(*it);
+    prepared->callstacks.emplace_back(
+        entry.iid(), ProfilePacketUtils::MakeSourceCallstack(entry));
+  }
+
+  for (auto it = packet.process_dumps(); it; ++it) {
+    protos::pbzero::ProfilePacket::ProcessHeapSamples::Decoder entry(*it);
+    StringId heap_name = entry.heap_name().size != 0
+                             ? storage->InternString(entry.heap_name())
+                             : storage->InternString("malloc");
+
+    // orig_sampling_interval_bytes was introduced slightly after a bug with
+    // self_max_count was fixed in the producer. We use this as a proxy
+    // whether or not we are getting this data from a fixed producer or not.
+    bool trustworthy_max_count = entry.orig_sampling_interval_bytes() > 0;
+
+    prepared->allocations.emplace_back();
+    auto& allocations = prepared->allocations.back();
+    for (auto sample_it = entry.samples(); sample_it; ++sample_it) {
+      protos::pbzero::ProfilePacket::HeapSample::Decoder sample(*sample_it);
+
+      HeapProfileTracker::SourceAllocation src_allocation;
+      src_allocation.pid = entry.pid();
+      src_allocation.heap_name = heap_name;
+      src_allocation.callstack_id = sample.callstack_id();
+      if (sample.has_self_max()) {
+        src_allocation.self_allocated = sample.self_max();
+        if (trustworthy_max_count)
+          src_allocation.alloc_count = sample.self_max_count();
+      } else {
+        src_allocation.self_allocated = sample.self_allocated();
+        src_allocation.self_freed = sample.self_freed();
+        src_allocation.alloc_count = sample.alloc_count();
+        src_allocation.free_count = sample.free_count();
+      }
+      allocations.push_back(src_allocation);
+    }
+  }
+  data->prepared = std::move(prepared);
+}
+
 void ProfileModule::ParsePacket(const TracePacket::Decoder& decoder,
                                 const TimestampedTracePiece& ttp,
                                 uint32_t field_id) {
@@ -87,12 +179,18 @@ void ProfileModule::ParsePacket(const TracePacket::Decoder& decoder,
       ParsePerfSample(ttp.timestamp, ttp.packet_data.sequence_state.get(),
                       decoder);
       return;
-    case TracePacket::kProfilePacketFieldNumber:
-      PERFETTO_DCHECK(ttp.type == TimestampedTracePiece::Type::kTracePacket);
-      ParseProfilePacket(ttp.timestamp, ttp.packet_data.sequence_state.get(),
-                         decoder.trusted_packet_sequence_id(),
-                         decoder.profile_packet());
+    case TracePacket::kProfilePacketFieldNumber: {
+      PERFETTO_DCHECK(ttp.type ==
+                      TimestampedTracePiece::Type::kPreparablePacket);
+      PreparablePacketData* data = ttp.preparable_packet.get();
+      if (!data->prepared)
+        PreparePacket(data);
+      ParseProfilePacket(
+          ttp.timestamp, data->sequence_state.get(),
+          decoder.trusted_packet_sequence_id(), decoder.profile_packet(),
+          static_cast<PreparedProfilePacket*>(data->prepared.get()));
       return;
+    }
     case TracePacket::kModuleSymbolsFieldNumber:
       PERFETTO_DCHECK(ttp.type == TimestampedTracePiece::Type::kTracePacket);
       ParseModuleSymbols(decoder.module_symbols());
@@ -286,45 +384,35 @@ void ProfileModule::ParseProfilePacket(
     int64_t ts,
     PacketSequenceStateGeneration* sequence_state,
     uint32_t seq_id,
-    ConstBytes blob) {
+    ConstBytes blob,
+    PreparedProfilePacket* prepared) {
   protos::pbzero::ProfilePacket::Decoder packet(blob.data, blob.size);
   context_->heap_profile_tracker->SetProfilePacketIndex(seq_id, packet.index());
+  SequenceStackProfileTracker& stack_profile_tracker =
+      sequence_state->state()->sequence_stack_profile_tracker();
 
   for (auto it = packet.strings(); it; ++it) {
     protos::pbzero::InternedString::Decoder entry(*it);
 
     const char* str = reinterpret_cast<const char*>(entry.str().data);
     auto str_view = base::StringView(str, entry.str().size);
-    sequence_state->state()->sequence_stack_profile_tracker().AddString(
-        entry.iid(), str_view);
+    stack_profile_tracker.AddString(entry.iid(), str_view);
   }
 
-  for (auto it = packet.mappings(); it; ++it) {
-    protos::pbzero::Mapping::Decoder entry(*it);
-    SequenceStackProfileTracker::SourceMapping src_mapping =
-        ProfilePacketUtils::MakeSourceMapping(entry);
-    sequence_state->state()->sequence_stack_profile_tracker().AddMapping(
-        entry.iid(), src_mapping);
-  }
+  for (const auto& mapping : prepared->mappings)
+    stack_profile_tracker.AddMapping(mapping.first, mapping.second);
 
-  for (auto it = packet.frames(); it; ++it) {
-    protos::pbzero::Frame::Decoder entry(*it);
-    SequenceStackProfileTracker::SourceFrame src_frame =
-        ProfilePacketUtils::MakeSourceFrame(entry);
-    sequence_state->state()->sequence_stack_profile_tracker().AddFrame(
-        entry.iid(), src_frame);
-  }
+  for (const auto& frame : prepared->frames)
+    stack_profile_tracker.AddFrame(frame.first, frame.second);
 
-  for (auto it = packet.callstacks(); it; ++it) {
-    protos::pbzero::Callstack::Decoder entry(*it);
-    SequenceStackProfileTracker::SourceCallstack src_callstack =
-        ProfilePacketUtils::MakeSourceCallstack(entry);
-    sequence_state->state()->sequence_stack_profile_tracker().AddCallstack(
-        entry.iid(), src_callstack);
-  }
+  for (const auto& callstack : prepared->callstacks)
+    stack_profile_tracker.AddCallstack(callstack.first, callstack.second);
 
+  size_t dump_idx = 0;
   for (auto it = packet.process_dumps(); it; ++it) {
     protos::pbzero::ProfilePacket::ProcessHeapSamples::Decoder entry(*it);
+    std::vector<HeapProfileTracker::SourceAllocation>& allocations =
+        prepared->allocations[dump_idx++];
 
     auto maybe_timestamp = context_->clock_tracker->ToTraceTime(
         protos::pbzero::BUILTIN_CLOCK_MONOTONIC_COARSE,
@@ -364,9 +452,13 @@ void ProfileModule::ParseProfilePacket(
       context_->storage->IncrementIndexedStats(stats::heapprofd_hit_guardrail,
                                                pid);
     if (entry.orig_sampling_interval_bytes()) {
+      // With adaptive_sampling_restore_interval, the interval at the time of
+      // the dump can be lower than the ones the samples were taken with.
+      uint64_t interval = std::max(entry.sampling_interval_bytes(),
+                                   entry.max_sampling_interval_bytes());
       context_->storage->SetIndexedStats(
           stats::heapprofd_sampling_interval_adjusted, pid,
-          static_cast<int64_t>(entry.sampling_interval_bytes()) -
+          static_cast<int64_t>(interval) -
               static_cast<int64_t>(entry.orig_sampling_interval_bytes()));
     }
 
@@ -381,35 +473,8 @@ void ProfileModule::ParseProfilePacket(
         stats::heapprofd_client_spinlock_blocked, static_cast<int>(entry.pid()),
         static_cast<int64_t>(stats.client_spinlock_blocked_us()));
 
-    // orig_sampling_interval_bytes was introduced slightly after a bug with
-    // self_max_count was fixed in the producer. We use this as a proxy
-    // whether or not we are getting this data from a fixed producer or not.
-    bool trustworthy_max_count = entry.orig_sampling_interval_bytes() > 0;
-
-    for (auto sample_it = entry.samples(); sample_it; ++sample_it) {
-      protos::pbzero::ProfilePacket::HeapSample::Decoder sample(*sample_it);
-
-      HeapProfileTracker::SourceAllocation src_allocation;
-      src_allocation.pid = entry.pid();
-      if (entry.heap_name().size != 0) {
-        src_allocation.heap_name =
-            context_->storage->InternString(entry.heap_name());
-      } else {
-        src_allocation.heap_name = context_->storage->InternString("malloc");
-      }
+    for (HeapProfileTracker::SourceAllocation& src_allocation : allocations) {
       src_allocation.timestamp = timestamp;
-      src_allocation.callstack_id = sample.callstack_id();
-      if (sample.has_self_max()) {
-        src_allocation.self_allocated = sample.self_max();
-        if (trustworthy_max_count)
-          src_allocation.alloc_count = sample.self_max_count();
-      } else {
-        src_allocation.self_allocated = sample.self_allocated();
-        src_allocation.self_freed = sample.self_freed();
-        src_allocation.alloc_count = sample.alloc_count();
-        src_allocation.free_count = sample.free_count();
-      }
-
       context_->heap_profile_tracker->StoreAllocation(seq_id, src_allocation);
     }
   }
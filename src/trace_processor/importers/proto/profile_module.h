@@ -40,6 +40,8 @@ class ProfileModule : public ProtoImporterModule {
       PacketSequenceState* state,
       uint32_t field_id) override;
 
+  void PreparePacket(PreparablePacketData* data) const override;
+
   void ParsePacket(const protos::pbzero::TracePacket::Decoder& decoder,
                    const TimestampedTracePiece& ttp,
                    uint32_t field_id) override;
@@ -61,10 +63,12 @@ class ProfileModule : public ProtoImporterModule {
                        const protos::pbzero::TracePacket::Decoder& decoder);
 
   // heap profiling:
+  struct PreparedProfilePacket;
   void ParseProfilePacket(int64_t ts,
                           PacketSequenceStateGeneration*,
                           uint32_t seq_id,
-                          protozero::ConstBytes);
+                          protozero::ConstBytes,
+                          PreparedProfilePacket*);
   void ParseDeobfuscationMapping(int64_t ts,
                                  PacketSequenceStateGeneration*,
                                  uint32_t seq_id,
@@ -20,6 +20,8 @@
 namespace perfetto {
 namespace trace_processor {
 
+PreparedPacket::~PreparedPacket() = default;
+
 ProtoImporterModule::ProtoImporterModule() {}
 
 ProtoImporterModule::~ProtoImporterModule() {}
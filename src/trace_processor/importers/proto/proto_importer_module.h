@@ -33,6 +33,7 @@ class TracePacket_Decoder;
 namespace trace_processor {
 
 class PacketSequenceState;
+struct PreparablePacketData;
 struct TimestampedTracePiece;
 class TraceProcessorContext;
 
@@ -91,6 +92,14 @@ class ModuleResult {
   base::Optional<std::string> error_;
 };
 
+// Base class for the data decoded from a packet ahead of parsing by
+// ProtoImporterModule::PreparePacket(). Each module subclasses it with the
+// data it needs.
+class PreparedPacket {
+ public:
+  virtual ~PreparedPacket();
+};
+
 // Base class for modules.
 class ProtoImporterModule {
  public:
@@ -110,6 +119,17 @@ class ProtoImporterModule {
       PacketSequenceState*,
       uint32_t field_id);
 
+  // Called by TraceSorter, before the sorted packets are parsed, for the
+  // packets that the module pushed with TraceSorter::PushPreparablePacket().
+  // This can be used to move the decoding of big packets off the parsing
+  // stage: packets of different sequences are prepared concurrently on worker
+  // threads (those of a sequence are prepared in order on the same thread),
+  // so this must not touch any tracker or table, only the packet itself and
+  // the (thread-safe) string pool. The result is stored in |data->prepared|.
+  // Packets which were not prepared ahead (e.g. when the trace is too small
+  // to use threads) are left for ParsePacket() to handle.
+  virtual void PreparePacket(PreparablePacketData* /*data*/) const {}
+
   // Called by ProtoTraceReader during the tokenization stage i.e. before
   // sorting. Indicates that sequence with id |packet_sequence_id| has cleared
   // its incremental state. This should be used to clear any cached state the
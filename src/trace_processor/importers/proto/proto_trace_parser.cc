@@ -81,6 +81,8 @@ void ProtoTraceParser::ParseTracePacket(int64_t ts, TimestampedTracePiece ttp) {
   const TracePacketData* data = nullptr;
   if (ttp.type == TimestampedTracePiece::Type::kTracePacket) {
     data = &ttp.packet_data;
+  } else if (ttp.type == TimestampedTracePiece::Type::kPreparablePacket) {
+    data = ttp.preparable_packet.get();
   } else {
     PERFETTO_DCHECK(ttp.type == TimestampedTracePiece::Type::kTrackEvent);
     data = ttp.track_event_data.get();
@@ -28,6 +28,7 @@
 #include "src/trace_processor/importers/common/slice_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
 #include "src/trace_processor/importers/default_modules.h"
+#include "src/trace_processor/importers/ftrace/ftrace_module.h"
 #include "src/trace_processor/importers/ftrace/sched_event_tracker.h"
 #include "src/trace_processor/importers/proto/metadata_tracker.h"
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
@@ -195,25 +196,25 @@ class MockSliceTracker : public SliceTracker {
                                        TrackId track_id,
                                        StringId cat,
                                        StringId name,
-                                       SetArgsCallback args_callback));
+                                       SetArgsCallbackRef args_callback));
   MOCK_METHOD5(End,
                base::Optional<SliceId>(int64_t timestamp,
                                        TrackId track_id,
                                        StringId cat,
                                        StringId name,
-                                       SetArgsCallback args_callback));
+                                       SetArgsCallbackRef args_callback));
   MOCK_METHOD6(Scoped,
                base::Optional<SliceId>(int64_t timestamp,
                                        TrackId track_id,
                                        StringId cat,
                                        StringId name,
                                        int64_t duration,
-                                       SetArgsCallback args_callback));
+                                       SetArgsCallbackRef args_callback));
   MOCK_METHOD4(StartSlice,
                base::Optional<SliceId>(int64_t timestamp,
                                        TrackId track_id,
-                                       SetArgsCallback args_callback,
-                                       std::function<SliceId()> inserter));
+                                       SetArgsCallbackRef args_callback,
+                                       FunctionRef<SliceId()> inserter));
 };
 
 class MockFlowTracker : public FlowTracker {
@@ -390,6 +391,59 @@ TEST_F(ProtoTraceParserTest, LoadEventsIntoRaw) {
   // and test here.
 }
 
+TEST_F(ProtoTraceParserTest, LoadEventsIntoRawLazily) {
+  context_.config.lazy_ftrace_raw_args = true;
+
+  auto* bundle = trace_->add_packet()->set_ftrace_events();
+  bundle->set_cpu(10);
+
+  auto* event = bundle->add_event();
+  event->set_timestamp(1000);
+  event->set_pid(12);
+  auto* task = event->set_task_newtask();
+  task->set_pid(123);
+  static const char task_newtask[] = "task_newtask";
+  task->set_comm(task_newtask);
+  task->set_clone_flags(12);
+  task->set_oom_score_adj(15);
+
+  event = bundle->add_event();
+  event->set_timestamp(1001);
+  event->set_pid(12);
+  auto* print = event->set_print();
+  print->set_ip(20);
+  static const char buf_value[] = "This is a print event";
+  print->set_buf(buf_value);
+
+  EXPECT_CALL(*process_, GetOrCreateProcess(123));
+
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+  context_.args_tracker->Flush();
+
+  // The rows are inserted while parsing but their args are deferred.
+  const auto& raw = context_.storage->raw_table();
+  ASSERT_EQ(raw.row_count(), 2u);
+  const auto& args = context_.storage->arg_table();
+  ASSERT_EQ(args.row_count(), 0u);
+  ASSERT_EQ(raw.arg_set_id()[0], kInvalidArgSetId);
+
+  context_.ftrace_module->MaterializeRawArgs();
+  ASSERT_EQ(args.row_count(), 6u);
+  ASSERT_NE(raw.arg_set_id()[0], kInvalidArgSetId);
+  ASSERT_NE(raw.arg_set_id()[1], kInvalidArgSetId);
+  ASSERT_EQ(args.key()[0], context_.storage->InternString("comm"));
+  ASSERT_STREQ(args.string_value().GetString(0).c_str(), task_newtask);
+  ASSERT_EQ(args.key()[3], context_.storage->InternString("clone_flags"));
+  ASSERT_EQ(args.int_value()[3], 12);
+  ASSERT_EQ(args.key()[5], context_.storage->InternString("buf"));
+  ASSERT_STREQ(args.string_value().GetString(5).c_str(), buf_value);
+
+  // All the args have been decoded: this is a no-op.
+  context_.ftrace_module->MaterializeRawArgs();
+  ASSERT_EQ(args.row_count(), 6u);
+}
+
 TEST_F(ProtoTraceParserTest, LoadGenericFtrace) {
   auto* packet = trace_->add_packet();
   packet->set_timestamp(100);
@@ -52,7 +52,7 @@ namespace perfetto {
 namespace trace_processor {
 
 ProtoTraceReader::ProtoTraceReader(TraceProcessorContext* ctx)
-    : context_(ctx) {}
+    : context_(ctx), tokenizer_(ctx->config.decompression_worker_threads) {}
 ProtoTraceReader::~ProtoTraceReader() = default;
 
 util::Status ProtoTraceReader::Parse(std::unique_ptr<uint8_t[]> owned_buf,
@@ -62,6 +62,12 @@ util::Status ProtoTraceReader::Parse(std::unique_ptr<uint8_t[]> owned_buf,
       [this](TraceBlobView packet) { return ParsePacket(std::move(packet)); });
 }
 
+util::Status ProtoTraceReader::ParseBlob(TraceBlobView blob) {
+  return tokenizer_.Tokenize(std::move(blob), [this](TraceBlobView packet) {
+    return ParsePacket(std::move(packet));
+  });
+}
+
 util::Status ProtoTraceReader::ParseExtensionDescriptor(ConstBytes descriptor) {
   protos::pbzero::ExtensionDescriptor::Decoder decoder(descriptor.data,
                                                        descriptor.size);
@@ -74,6 +80,10 @@ util::Status ProtoTraceReader::ParseExtensionDescriptor(ConstBytes descriptor) {
 }
 
 util::Status ProtoTraceReader::ParsePacket(TraceBlobView packet) {
+  // Packets are tokenized one at a time so, at this point, the previous packet
+  // has been fully tokenized and it's safe to extract events.
+  context_->sorter->MaybeExtractEventsOutsideWindow();
+
   protos::pbzero::TracePacket::Decoder decoder(packet.data(), packet.length());
   if (PERFETTO_UNLIKELY(decoder.bytes_left())) {
     return util::ErrStatus(
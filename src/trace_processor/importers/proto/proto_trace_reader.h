@@ -59,6 +59,7 @@ class ProtoTraceReader : public ChunkedTraceReader {
 
   // ChunkedTraceReader implementation.
   util::Status Parse(std::unique_ptr<uint8_t[]>, size_t size) override;
+  util::Status ParseBlob(TraceBlobView) override;
   void NotifyEndOfFile() override;
 
  private:
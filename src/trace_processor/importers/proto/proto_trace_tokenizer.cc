@@ -16,42 +16,133 @@
 
 #include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
 
+#include <algorithm>
+#include <atomic>
+
+#include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/utils.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
 ProtoTraceTokenizer::ProtoTraceTokenizer() = default;
 
-util::Status ProtoTraceTokenizer::Decompress(TraceBlobView input,
-                                             TraceBlobView* output) {
-  PERFETTO_DCHECK(util::IsGzipSupported());
+ProtoTraceTokenizer::ProtoTraceTokenizer(uint32_t decompression_threads) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // Threads are not available (e.g. in WASM builds without pthreads).
+  base::ignore_result(decompression_threads);
+#else
+  decompression_threads_ = decompression_threads;
+#endif
+}
+
+void ProtoTraceTokenizer::DecompressPendingPackets() {
+  std::vector<PendingPacket*> compressed;
+  for (auto& pending_packet : pending_packets_) {
+    if (pending_packet.compressed)
+      compressed.push_back(&pending_packet);
+  }
+
+  auto decompress = [](util::GzipDecompressor* decompressor,
+                       PendingPacket* pending_packet) {
+    pending_packet->status = Decompress(decompressor, pending_packet->packet,
+                                        &pending_packet->decompressed);
+  };
+
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  size_t num_threads =
+      std::min(static_cast<size_t>(decompression_threads_), compressed.size());
+  if (num_threads > 1) {
+    // Packets are handed out dynamically as their sizes can vary a lot.
+    std::atomic<size_t> next_packet{0};
+    auto decompress_packets = [&compressed, &next_packet,
+                               &decompress](util::GzipDecompressor* d) {
+      for (;;) {
+        size_t idx = next_packet.fetch_add(1, std::memory_order_relaxed);
+        if (idx >= compressed.size())
+          return;
+        decompress(d, compressed[idx]);
+      }
+    };
+
+    // The calling thread also takes part in the decompression, so spawn one
+    // thread less. Each thread needs its own decompressor as they are
+    // stateful.
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (size_t i = 1; i < num_threads; ++i) {
+      threads.emplace_back([&decompress_packets] {
+        util::GzipDecompressor decompressor;
+        decompress_packets(&decompressor);
+      });
+    }
+    decompress_packets(&decompressor_);
+    for (auto& thread : threads)
+      thread.join();
+  } else {
+    for (PendingPacket* pending_packet : compressed)
+      decompress(&decompressor_, pending_packet);
+  }
+#else
+  for (PendingPacket* pending_packet : compressed)
+    decompress(&decompressor_, pending_packet);
+#endif
 
-  uint8_t out[4096];
+  // The compressed packets are slices of the same chunk, whose refcount is not
+  // thread safe: release them here rather than on the threads above.
+  for (PendingPacket* pending_packet : compressed)
+    pending_packet->packet = TraceBlobView(nullptr, 0, 0);
+}
+
+// static
+util::Status ProtoTraceTokenizer::Decompress(
+    util::GzipDecompressor* decompressor,
+    const TraceBlobView& input,
+    TraceBlobView* output) {
+  PERFETTO_DCHECK(util::IsGzipSupported());
 
-  std::vector<uint8_t> data;
-  data.reserve(input.length());
+  // Decompress directly into the output buffer, growing it as needed, to
+  // avoid copying the decompressed data around. Packets are usually compressed
+  // with a ratio of at least 4x.
+  size_t capacity = std::max(input.length() * 4, static_cast<size_t>(4096));
+  std::unique_ptr<uint8_t[]> data(new uint8_t[capacity]);
+  size_t size = 0;
 
   // Ensure that the decompressor is able to cope with a new stream of data.
-  decompressor_.Reset();
-  decompressor_.SetInput(input.data(), input.length());
+  decompressor->Reset();
+  decompressor->SetInput(input.data(), input.length());
 
   using ResultCode = util::GzipDecompressor::ResultCode;
   for (auto ret = ResultCode::kOk; ret != ResultCode::kEof;) {
-    auto res = decompressor_.Decompress(out, base::ArraySize(out));
+    if (size == capacity) {
+      capacity *= 2;
+      std::unique_ptr<uint8_t[]> grown(new uint8_t[capacity]);
+      memcpy(grown.get(), data.get(), size);
+      data = std::move(grown);
+    }
+
+    auto res = decompressor->Decompress(data.get() + size, capacity - size);
     ret = res.ret;
     if (ret == ResultCode::kError || ret == ResultCode::kNoProgress ||
         ret == ResultCode::kNeedsMoreInput) {
       return util::ErrStatus("Failed to decompress (error code: %d)",
                              static_cast<int>(ret));
     }
-
-    data.insert(data.end(), out, out + res.bytes_written);
+    size += res.bytes_written;
   }
 
-  std::unique_ptr<uint8_t[]> out_data(new uint8_t[data.size()]);
-  memcpy(out_data.get(), data.data(), data.size());
-  *output = TraceBlobView(std::move(out_data), 0, data.size());
+  // The buffer is kept alive for as long as any of the packets in it are, so
+  // don't waste too much memory if the guess above was way off.
+  if (capacity - size > size / 4) {
+    std::unique_ptr<uint8_t[]> shrunk(new uint8_t[size]);
+    memcpy(shrunk.get(), data.get(), size);
+    data = std::move(shrunk);
+  }
+  *output = TraceBlobView(std::move(data), 0, size);
   return util::OkStatus();
 }
 
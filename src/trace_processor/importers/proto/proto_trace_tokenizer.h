@@ -33,15 +33,35 @@ namespace trace_processor {
 
 // Reads a protobuf trace in chunks and extracts boundaries of trace packets
 // (or subfields, for the case of ftrace) with their timestamps.
+//
+// Packets containing |compressed_packets| are inflated and the packets they
+// contain are passed to the callback in place of the compressed one. When
+// more than one decompression thread is allowed, the compressed packets of
+// each chunk are inflated, in groups, concurrently on short-lived worker
+// threads; packets are still passed to the callback in trace order on the
+// calling thread.
 class ProtoTraceTokenizer {
  public:
   ProtoTraceTokenizer();
 
+  // |decompression_threads| is the max number of threads used to inflate
+  // compressed packets. Values <= 1 disable parallel decompression.
+  explicit ProtoTraceTokenizer(uint32_t decompression_threads);
+
   template <typename Callback = util::Status(TraceBlobView)>
   util::Status Tokenize(std::unique_ptr<uint8_t[]> owned_buf,
                         size_t size,
                         Callback callback) {
-    uint8_t* data = &owned_buf[0];
+    return Tokenize(TraceBlobView(std::move(owned_buf), 0, size), callback);
+  }
+
+  // Same as above but |blob| can reference memory which is not owned by the
+  // trace processor (e.g. a file mapping). Packets passed to |callback| are
+  // slices of |blob| unless they span across two calls.
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status Tokenize(TraceBlobView blob, Callback callback) {
+    const uint8_t* data = blob.data();
+    size_t size = blob.length();
     if (!partial_buf_.empty()) {
       // It takes ~5 bytes for a proto preamble + the varint size.
       const size_t kHeaderBytes = 5;
@@ -96,14 +116,15 @@ class ProtoTraceTokenizer {
         size -= size_missing;
         partial_buf_.clear();
         uint8_t* buf_start = &buf[0];  // Note that buf is std::moved below.
-        RETURN_IF_ERROR(ParseInternal(std::move(buf), buf_start,
-                                      size_incl_header, callback));
+        RETURN_IF_ERROR(ParseInternal(
+            TraceBlobView(std::move(buf), 0, size_incl_header), buf_start,
+            size_incl_header, callback));
       } else {
         partial_buf_.insert(partial_buf_.end(), data, &data[size]);
         return util::OkStatus();
       }
     }
-    return ParseInternal(std::move(owned_buf), data, size, callback);
+    return ParseInternal(std::move(blob), data, size, callback);
   }
 
  private:
@@ -111,23 +132,26 @@ class ProtoTraceTokenizer {
       protozero::proto_utils::MakeTagLengthDelimited(
           protos::pbzero::Trace::kPacketFieldNumber);
 
+  // |data| and |size| identify the not-yet-consumed tail of |blob|.
   template <typename Callback = util::Status(TraceBlobView)>
-  util::Status ParseInternal(std::unique_ptr<uint8_t[]> owned_buf,
-                             uint8_t* data,
+  util::Status ParseInternal(TraceBlobView blob,
+                             const uint8_t* data,
                              size_t size,
                              Callback callback) {
-    PERFETTO_DCHECK(data >= &owned_buf[0]);
-    const uint8_t* start = &owned_buf[0];
-    const size_t data_off = static_cast<size_t>(data - start);
-    TraceBlobView whole_buf(std::move(owned_buf), data_off, size);
+    TraceBlobView whole_buf = blob.slice(blob.offset_of(data), size);
 
     protos::pbzero::Trace::Decoder decoder(data, size);
     for (auto it = decoder.packet(); it; ++it) {
       protozero::ConstBytes packet = *it;
       size_t field_offset = whole_buf.offset_of(packet.data);
       TraceBlobView sliced = whole_buf.slice(field_offset, packet.size);
-      RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
+      if (decompression_threads_ > 1) {
+        RETURN_IF_ERROR(AddPendingPacket(std::move(sliced), callback));
+      } else {
+        RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
+      }
     }
+    RETURN_IF_ERROR(FlushPendingPackets(callback));
 
     const size_t bytes_left = decoder.bytes_left();
     if (bytes_left > 0) {
@@ -153,32 +177,119 @@ class ProtoTraceTokenizer {
       TraceBlobView compressed_packets = packet.slice(field_off, field.size);
       TraceBlobView packets(nullptr, 0, 0);
 
-      RETURN_IF_ERROR(Decompress(std::move(compressed_packets), &packets));
-
-      const uint8_t* start = packets.data();
-      const uint8_t* end = packets.data() + packets.length();
-      const uint8_t* ptr = start;
-      while ((end - ptr) > 2) {
-        const uint8_t* packet_start = ptr;
-        if (PERFETTO_UNLIKELY(*ptr != kTracePacketTag))
-          return util::ErrStatus("Expected TracePacket tag");
-        uint64_t packet_size = 0;
-        ptr = protozero::proto_utils::ParseVarInt(++ptr, end, &packet_size);
-        size_t packet_offset = static_cast<size_t>(ptr - start);
-        ptr += packet_size;
-        if (PERFETTO_UNLIKELY((ptr - packet_start) < 2 || ptr > end))
-          return util::ErrStatus("Invalid packet size");
-
-        TraceBlobView sliced =
-            packets.slice(packet_offset, static_cast<size_t>(packet_size));
-        RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
-      }
-      return util::OkStatus();
+      RETURN_IF_ERROR(Decompress(&decompressor_, compressed_packets, &packets));
+      return ParseDecompressedPackets(std::move(packets), callback);
     }
     return callback(std::move(packet));
   }
 
-  util::Status Decompress(TraceBlobView input, TraceBlobView* output);
+  // Splits the decompressed content of a |compressed_packets| field into
+  // packets and parses them.
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status ParseDecompressedPackets(TraceBlobView packets,
+                                        Callback callback) {
+    const uint8_t* start = packets.data();
+    const uint8_t* end = packets.data() + packets.length();
+    const uint8_t* ptr = start;
+    while ((end - ptr) > 2) {
+      const uint8_t* packet_start = ptr;
+      if (PERFETTO_UNLIKELY(*ptr != kTracePacketTag))
+        return util::ErrStatus("Expected TracePacket tag");
+      uint64_t packet_size = 0;
+      ptr = protozero::proto_utils::ParseVarInt(++ptr, end, &packet_size);
+      size_t packet_offset = static_cast<size_t>(ptr - start);
+      ptr += packet_size;
+      if (PERFETTO_UNLIKELY((ptr - packet_start) < 2 || ptr > end))
+        return util::ErrStatus("Invalid packet size");
+
+      TraceBlobView sliced =
+          packets.slice(packet_offset, static_cast<size_t>(packet_size));
+      RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
+    }
+    return util::OkStatus();
+  }
+
+  // Used instead of ParsePacket() when decompressing in parallel: compressed
+  // packets are queued in |pending_packets_| (together with all the packets
+  // following them, to preserve ordering) until enough of them have been
+  // collected to be worth decompressing concurrently.
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status AddPendingPacket(TraceBlobView packet, Callback callback) {
+    protos::pbzero::TracePacket::Decoder decoder(packet.data(),
+                                                 packet.length());
+    if (!decoder.has_compressed_packets()) {
+      if (pending_packets_.empty())
+        return callback(std::move(packet));
+      pending_packets_.emplace_back(std::move(packet), false);
+      return util::OkStatus();
+    }
+
+    if (!util::IsGzipSupported())
+      return util::Status("Cannot decode compressed packets. Zlib not enabled");
+
+    protozero::ConstBytes field = decoder.compressed_packets();
+    const size_t field_off = packet.offset_of(field.data);
+    pending_packets_.emplace_back(packet.slice(field_off, field.size), true);
+    if (++pending_compressed_packets_ >= MaxPendingCompressedPackets())
+      return FlushPendingPackets(callback);
+    return util::OkStatus();
+  }
+
+  // Decompresses all the packets in |pending_packets_| and parses them in
+  // order.
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status FlushPendingPackets(Callback callback) {
+    if (pending_packets_.empty())
+      return util::OkStatus();
+
+    DecompressPendingPackets();
+
+    std::vector<PendingPacket> pending;
+    pending.swap(pending_packets_);
+    pending_compressed_packets_ = 0;
+    for (auto& pending_packet : pending) {
+      if (!pending_packet.compressed) {
+        RETURN_IF_ERROR(callback(std::move(pending_packet.packet)));
+        continue;
+      }
+      RETURN_IF_ERROR(pending_packet.status);
+      RETURN_IF_ERROR(ParseDecompressedPackets(
+          std::move(pending_packet.decompressed), callback));
+    }
+    return util::OkStatus();
+  }
+
+  // A packet which has been tokenized but not yet passed to the callback.
+  struct PendingPacket {
+    PendingPacket(TraceBlobView p, bool c)
+        : packet(std::move(p)), compressed(c) {}
+
+    // For compressed packets, this is the contents of the
+    // |compressed_packets| field.
+    TraceBlobView packet;
+    bool compressed;
+
+    // Only set for compressed packets, after decompression.
+    TraceBlobView decompressed{nullptr, 0, 0};
+    util::Status status;
+  };
+
+  size_t MaxPendingCompressedPackets() const {
+    // Allow a few packets per thread so that uneven packet sizes don't leave
+    // threads idle while still bounding the memory used by the packets
+    // decompressed ahead.
+    return decompression_threads_ * 4;
+  }
+
+  // Decompresses all the compressed packets in |pending_packets_|, using
+  // up to |decompression_threads_| threads.
+  void DecompressPendingPackets();
+
+  // Takes |input| by reference as it can be called on other threads: see
+  // DecompressPendingPackets().
+  static util::Status Decompress(util::GzipDecompressor* decompressor,
+                                 const TraceBlobView& input,
+                                 TraceBlobView* output);
 
   // Used to glue together trace packets that span across two (or more)
   // Parse() boundaries.
@@ -186,6 +297,14 @@ class ProtoTraceTokenizer {
 
   // Allows support for compressed trace packets.
   util::GzipDecompressor decompressor_;
+
+  // The max number of threads used to decompress packets.
+  uint32_t decompression_threads_ = 0;
+
+  // Only used when decompressing in parallel: the packets waiting for the
+  // compressed packets in them to be decompressed.
+  std::vector<PendingPacket> pending_packets_;
+  size_t pending_compressed_packets_ = 0;
 };
 
 }  // namespace trace_processor
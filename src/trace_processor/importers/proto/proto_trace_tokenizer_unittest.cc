@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/config/trace_config.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+std::string Compress(const std::vector<uint8_t>& data) {
+  uLongf size = compressBound(static_cast<uLong>(data.size()));
+  std::string out(size, '\0');
+  EXPECT_EQ(compress(reinterpret_cast<Bytef*>(&out[0]), &size, data.data(),
+                     static_cast<uLong>(data.size())),
+            Z_OK);
+  out.resize(size);
+  return out;
+}
+
+// Builds a trace where every |compressed_every| packets are wrapped in a
+// single packet containing |compressed_packets|. Packets have increasing
+// timestamps starting at 0.
+std::vector<uint8_t> BuildTrace(uint64_t num_packets,
+                                uint64_t compressed_every) {
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  for (uint64_t ts = 0; ts < num_packets;) {
+    if (ts % 3 == 0) {
+      trace->add_packet()->set_timestamp(ts++);
+      continue;
+    }
+    protozero::HeapBuffered<protos::pbzero::Trace> compressed;
+    for (uint64_t i = 0; i < compressed_every && ts < num_packets; ++i) {
+      auto* packet = compressed->add_packet();
+      packet->set_timestamp(ts++);
+      // Pad the packets so that they are worth compressing.
+      packet->set_trace_config()->set_unique_session_name(std::string(64, 'x'));
+    }
+    trace->add_packet()->set_compressed_packets(
+        Compress(compressed.SerializeAsArray()));
+  }
+  return trace.SerializeAsArray();
+}
+
+util::Status Tokenize(ProtoTraceTokenizer* tokenizer,
+                      const std::vector<uint8_t>& trace,
+                      size_t chunk_size,
+                      std::vector<uint64_t>* timestamps) {
+  for (size_t off = 0; off < trace.size(); off += chunk_size) {
+    size_t size = std::min(chunk_size, trace.size() - off);
+    std::unique_ptr<uint8_t[]> chunk(new uint8_t[size]);
+    memcpy(chunk.get(), trace.data() + off, size);
+    util::Status status = tokenizer->Tokenize(
+        std::move(chunk), size, [timestamps](TraceBlobView packet) {
+          protos::pbzero::TracePacket::Decoder decoder(packet.data(),
+                                                       packet.length());
+          timestamps->push_back(decoder.timestamp());
+          return util::OkStatus();
+        });
+    if (!status.ok())
+      return status;
+  }
+  return util::OkStatus();
+}
+
+std::vector<uint64_t> Iota(uint64_t count) {
+  std::vector<uint64_t> res;
+  for (uint64_t i = 0; i < count; ++i)
+    res.push_back(i);
+  return res;
+}
+
+TEST(ProtoTraceTokenizerTest, CompressedPackets) {
+  std::vector<uint8_t> trace = BuildTrace(1000, 10);
+
+  ProtoTraceTokenizer tokenizer;
+  std::vector<uint64_t> timestamps;
+  ASSERT_TRUE(Tokenize(&tokenizer, trace, trace.size(), &timestamps).ok());
+  ASSERT_EQ(timestamps, Iota(1000));
+}
+
+TEST(ProtoTraceTokenizerTest, ParallelDecompression) {
+  std::vector<uint8_t> trace = BuildTrace(10000, 10);
+
+  ProtoTraceTokenizer tokenizer(4);
+  std::vector<uint64_t> timestamps;
+  ASSERT_TRUE(Tokenize(&tokenizer, trace, trace.size(), &timestamps).ok());
+  ASSERT_EQ(timestamps, Iota(10000));
+}
+
+TEST(ProtoTraceTokenizerTest, ParallelDecompressionSmallChunks) {
+  // Packets spanning across chunks go through a different path.
+  std::vector<uint8_t> trace = BuildTrace(10000, 10);
+
+  ProtoTraceTokenizer tokenizer(4);
+  std::vector<uint64_t> timestamps;
+  ASSERT_TRUE(Tokenize(&tokenizer, trace, 1000, &timestamps).ok());
+  ASSERT_EQ(timestamps, Iota(10000));
+}
+
+TEST(ProtoTraceTokenizerTest, ParallelDecompressionError) {
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  trace->add_packet()->set_timestamp(0);
+  trace->add_packet()->set_compressed_packets("not compressed");
+  trace->add_packet()->set_timestamp(1);
+
+  ProtoTraceTokenizer tokenizer(4);
+  std::vector<uint64_t> timestamps;
+  util::Status status =
+      Tokenize(&tokenizer, trace.SerializeAsArray(), 1024 * 1024, &timestamps);
+  ASSERT_FALSE(status.ok());
+
+  // Packets before the broken one should still have been tokenized.
+  ASSERT_EQ(timestamps, std::vector<uint64_t>{0});
+}
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
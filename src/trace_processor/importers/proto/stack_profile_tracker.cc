@@ -43,7 +43,7 @@ StringId SequenceStackProfileTracker::GetEmptyStringId() {
 
 void SequenceStackProfileTracker::AddString(SourceStringId id,
                                             base::StringView str) {
-  string_map_.emplace(id, str.ToStdString());
+  string_map_.Insert(id, str.ToStdString());
 }
 
 base::Optional<MappingId> SequenceStackProfileTracker::AddMapping(
@@ -127,7 +127,7 @@ base::Optional<MappingId> SequenceStackProfileTracker::AddMapping(
     }
     mapping_idx_.emplace(row, *cur_id);
   }
-  mapping_ids_.emplace(id, *cur_id);
+  mapping_ids_.Insert(id, *cur_id);
   return cur_id;
 }
 
@@ -203,7 +203,7 @@ base::Optional<FrameId> SequenceStackProfileTracker::AddFrame(
     }
     frame_idx_.emplace(row, *cur_id);
   }
-  frame_ids_.emplace(id, *cur_id);
+  frame_ids_.Insert(id, *cur_id);
   return cur_id;
 }
 
@@ -237,18 +237,18 @@ base::Optional<CallsiteId> SequenceStackProfileTracker::AddCallstack(
     parent_id = self_id;
   }
   PERFETTO_DCHECK(parent_id);  // The loop ran at least once.
-  callstack_ids_.emplace(id, *parent_id);
+  callstack_ids_.Insert(id, *parent_id);
   return parent_id;
 }
 
 FrameId SequenceStackProfileTracker::GetDatabaseFrameIdForTesting(
     SourceFrameId frame_id) {
-  auto it = frame_ids_.find(frame_id);
-  if (it == frame_ids_.end()) {
+  const FrameId* id = frame_ids_.Find(frame_id);
+  if (!id) {
     PERFETTO_DLOG("Invalid frame.");
     return {};
   }
-  return it->second;
+  return *id;
 }
 
 base::Optional<StringId> SequenceStackProfileTracker::FindAndInternString(
@@ -272,8 +272,8 @@ base::Optional<std::string> SequenceStackProfileTracker::FindOrInsertString(
   if (id == 0)
     return "";
 
-  auto it = string_map_.find(id);
-  if (it == string_map_.end()) {
+  const std::string* str = string_map_.Find(id);
+  if (!str) {
     if (intern_lookup) {
       auto str = intern_lookup->GetString(id, type);
       if (!str) {
@@ -287,15 +287,15 @@ base::Optional<std::string> SequenceStackProfileTracker::FindOrInsertString(
     return base::nullopt;
   }
 
-  return it->second;
+  return *str;
 }
 
 base::Optional<MappingId> SequenceStackProfileTracker::FindOrInsertMapping(
     SourceMappingId mapping_id,
     const InternLookup* intern_lookup) {
   base::Optional<MappingId> res;
-  auto it = mapping_ids_.find(mapping_id);
-  if (it == mapping_ids_.end()) {
+  const MappingId* id = mapping_ids_.Find(mapping_id);
+  if (!id) {
     if (intern_lookup) {
       auto interned_mapping = intern_lookup->GetMapping(mapping_id);
       if (interned_mapping) {
@@ -306,7 +306,7 @@ base::Optional<MappingId> SequenceStackProfileTracker::FindOrInsertMapping(
     context_->storage->IncrementStats(stats::stackprofile_invalid_mapping_id);
     return res;
   }
-  res = it->second;
+  res = *id;
   return res;
 }
 
@@ -314,8 +314,8 @@ base::Optional<FrameId> SequenceStackProfileTracker::FindOrInsertFrame(
     SourceFrameId frame_id,
     const InternLookup* intern_lookup) {
   base::Optional<FrameId> res;
-  auto it = frame_ids_.find(frame_id);
-  if (it == frame_ids_.end()) {
+  const FrameId* id = frame_ids_.Find(frame_id);
+  if (!id) {
     if (intern_lookup) {
       auto interned_frame = intern_lookup->GetFrame(frame_id);
       if (interned_frame) {
@@ -328,7 +328,7 @@ base::Optional<FrameId> SequenceStackProfileTracker::FindOrInsertFrame(
                   frame_ids_.size());
     return res;
   }
-  res = it->second;
+  res = *id;
   return res;
 }
 
@@ -336,8 +336,8 @@ base::Optional<CallsiteId> SequenceStackProfileTracker::FindOrInsertCallstack(
     SourceCallstackId callstack_id,
     const InternLookup* intern_lookup) {
   base::Optional<CallsiteId> res;
-  auto it = callstack_ids_.find(callstack_id);
-  if (it == callstack_ids_.end()) {
+  const CallsiteId* id = callstack_ids_.Find(callstack_id);
+  if (!id) {
     auto interned_callstack = intern_lookup->GetCallstack(callstack_id);
     if (interned_callstack) {
       res = AddCallstack(callstack_id, *interned_callstack, intern_lookup);
@@ -348,15 +348,15 @@ base::Optional<CallsiteId> SequenceStackProfileTracker::FindOrInsertCallstack(
                   callstack_ids_.size());
     return res;
   }
-  res = it->second;
+  res = *id;
   return res;
 }
 
 void SequenceStackProfileTracker::ClearIndices() {
-  string_map_.clear();
-  mapping_ids_.clear();
-  callstack_ids_.clear();
-  frame_ids_.clear();
+  string_map_.Clear();
+  mapping_ids_.Clear();
+  callstack_ids_.Clear();
+  frame_ids_.Clear();
 }
 
 }  // namespace trace_processor
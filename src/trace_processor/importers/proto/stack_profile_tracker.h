@@ -17,8 +17,10 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_STACK_PROFILE_TRACKER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_STACK_PROFILE_TRACKER_H_
 
+#include <algorithm>
 #include <deque>
 #include <unordered_map>
+#include <vector>
 
 #include "perfetto/ext/base/optional.h"
 
@@ -260,15 +262,72 @@ class SequenceStackProfileTracker {
   void ClearIndices();
 
  private:
+  // Map from the source (i.e. interning) ID of a string / mapping / frame /
+  // callstack to |V|. Producers assign these IDs sequentially on each
+  // sequence so they are stored in a vector indexed by ID, which is much
+  // cheaper to look up for every sample than a hash map. IDs too big compared
+  // to the number of entries (i.e. not assigned sequentially) are stored in
+  // a hash map instead to bound the memory used.
+  template <typename V>
+  class SourceIdMap {
+   public:
+    const V* Find(uint64_t id) const {
+      if (id < dense_.size() && dense_[id])
+        return &*dense_[id];
+      // IDs stored here before the vector grew past them are never moved.
+      if (sparse_.empty())
+        return nullptr;
+      auto it = sparse_.find(id);
+      return it == sparse_.end() ? nullptr : &it->second;
+    }
+
+    // Like std::unordered_map::emplace, does nothing if |id| is already in
+    // the map.
+    void Insert(uint64_t id, V value) {
+      if (Find(id))
+        return;
+      size_++;
+      if (id < dense_.size()) {
+        dense_[id] = std::move(value);
+        return;
+      }
+      // Grow the vector geometrically, up to twice the number of entries.
+      uint64_t max_dense = std::max<uint64_t>(1024, 2 * size_);
+      if (id >= max_dense) {
+        sparse_.emplace(id, std::move(value));
+        return;
+      }
+      dense_.resize(static_cast<size_t>(
+          std::min(max_dense, std::max<uint64_t>(id + 1, 2 * dense_.size()))));
+      dense_[id] = std::move(value);
+    }
+
+    size_t size() const { return size_; }
+
+    void Clear() {
+      dense_.clear();
+      sparse_.clear();
+      size_ = 0;
+    }
+
+   private:
+    std::vector<base::Optional<V>> dense_;
+    std::unordered_map<uint64_t, V> sparse_;
+    size_t size_ = 0;
+  };
+
   StringId GetEmptyStringId();
 
-  std::unordered_map<SourceStringId, std::string> string_map_;
+  SourceIdMap<std::string> string_map_;
 
   // Mapping from ID of mapping / frame / callstack in original trace and the
-  // index in the respective table it was inserted into.
-  std::unordered_map<SourceMappingId, MappingId> mapping_ids_;
-  std::unordered_map<SourceFrameId, FrameId> frame_ids_;
-  std::unordered_map<SourceCallstackId, CallsiteId> callstack_ids_;
+  // index in the respective table it was inserted into. Frames are decoded
+  // (i.e. their strings and mapping resolved) only the first time they are
+  // seen on a sequence; after that, every sample referencing them only costs
+  // a vector lookup.
+  SourceIdMap<MappingId> mapping_ids_;
+  SourceIdMap<FrameId> frame_ids_;
+  SourceIdMap<CallsiteId> callstack_ids_;
 
   // TODO(oysteine): Share these indices between the StackProfileTrackers,
   // since they're not sequence-specific.
@@ -37,6 +37,7 @@
 
 #include "protos/perfetto/trace/extension_descriptor.pbzero.h"
 #include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
 #include "protos/perfetto/trace/track_event/chrome_compositor_scheduler_state.pbzero.h"
 #include "protos/perfetto/trace/track_event/chrome_histogram_sample.pbzero.h"
 #include "protos/perfetto/trace/track_event/chrome_legacy_ipc.pbzero.h"
@@ -188,8 +189,13 @@ class TrackEventParser::EventImporter {
     if (PERFETTO_UNLIKELY(!event_.type() && !legacy_event_.has_phase()))
       return util::ErrStatus("TrackEvent without type or phase");
 
-    category_id_ = ParseTrackEventCategory();
-    name_id_ = ParseTrackEventName();
+    if (event_data_->prepared) {
+      category_id_ = event_data_->category_id;
+      name_id_ = event_data_->name_id;
+    } else {
+      category_id_ = ParseTrackEventCategory();
+      name_id_ = ParseTrackEventName();
+    }
 
     RETURN_IF_ERROR(ParseTrackAssociation());
 
@@ -1565,5 +1571,56 @@ void TrackEventParser::ParseTrackEvent(int64_t ts,
   }
 }
 
+// static
+void TrackEventParser::PrepareTrackEvent(TraceStorage* storage,
+                                         TrackEventData* event_data) {
+  const TraceBlobView& packet_blob = event_data->packet;
+  protos::pbzero::TracePacket::Decoder packet(packet_blob.data(),
+                                              packet_blob.length());
+  TrackEvent::Decoder event(packet.track_event());
+  PacketSequenceStateGeneration* sequence_state =
+      event_data->sequence_state.get();
+
+  // Only the common cases of (at most) a single category are handled here.
+  StringId category_id = kNullStringId;
+  auto category_iid_it = event.category_iids();
+  auto category_it = event.categories();
+  if (category_iid_it) {
+    uint64_t iid = *category_iid_it;
+    if (++category_iid_it || category_it)
+      return;
+    InternedMessageView* view = sequence_state->FindInternedMessageView(
+        protos::pbzero::InternedData::kEventCategoriesFieldNumber, iid);
+    if (!view)
+      return;
+    category_id = storage->InternString(
+        view->GetOrCreateDecoder<protos::pbzero::EventCategory>()->name());
+  } else if (category_it) {
+    protozero::ConstChars category = *category_it;
+    if (++category_it)
+      return;
+    category_id = storage->InternString(category);
+  }
+
+  StringId name_id = kNullStringId;
+  uint64_t name_iid = event.name_iid();
+  if (!name_iid && event.has_legacy_event())
+    name_iid = LegacyEvent::Decoder(event.legacy_event()).name_iid();
+  if (name_iid) {
+    InternedMessageView* view = sequence_state->FindInternedMessageView(
+        protos::pbzero::InternedData::kEventNamesFieldNumber, name_iid);
+    if (!view)
+      return;
+    name_id = storage->InternString(
+        view->GetOrCreateDecoder<protos::pbzero::EventName>()->name());
+  } else if (event.has_name()) {
+    name_id = storage->InternString(event.name());
+  }
+
+  event_data->category_id = category_id;
+  event_data->name_id = name_id;
+  event_data->prepared = true;
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
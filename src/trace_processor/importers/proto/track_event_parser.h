@@ -61,6 +61,15 @@ class TrackEventParser {
                        TrackEventData* event_data,
                        protozero::ConstBytes);
 
+  // Decodes the TrackEvent of |event_data| and interns its name and category
+  // ahead of ParseTrackEvent(), which then doesn't need to. Only reads the
+  // sequence state of the event and interns strings in |storage|: it can run
+  // concurrently for events of different packet sequences, as long as no
+  // event is parsed at the same time. Events whose interned data is missing
+  // are left for ParseTrackEvent() to handle (and report).
+  static void PrepareTrackEvent(TraceStorage* storage,
+                                TrackEventData* event_data);
+
  private:
   class EventImporter;
 
@@ -209,8 +209,9 @@ void TrackEventTokenizer::TokenizeTrackEventPacket(
       state->current_generation()->GetTrackEventDefaults();
 
   int64_t timestamp;
-  std::unique_ptr<TrackEventData> data(
-      new TrackEventData(std::move(*packet_blob), state->current_generation()));
+  ArenaPtr<TrackEventData> data =
+      context_->sorter->payload_arena()->Make<TrackEventData>(
+          std::move(*packet_blob), state->current_generation());
 
   // TODO(eseckler): Remove handling of timestamps relative to ThreadDescriptors
   // once all producers have switched to clock-domain timestamps (e.g.
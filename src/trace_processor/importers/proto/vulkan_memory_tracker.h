@@ -39,17 +39,30 @@ class VulkanMemoryTracker {
   explicit VulkanMemoryTracker(TraceProcessorContext* context);
   ~VulkanMemoryTracker() = default;
 
+  // The id of an interned string in the string pool, cached with the interned
+  // message so that it is only interned once per sequence.
+  struct InternedStringId {
+    bool resolved = false;
+    StringId id = kNullStringId;
+  };
+
   template <int32_t FieldId>
   StringId GetInternedString(PacketSequenceStateGeneration* state,
                              uint64_t iid) {
-    auto* decoder =
-        state->LookupInternedMessage<FieldId, protos::pbzero::InternedString>(
-            iid);
-    if (!decoder)
+    auto* view =
+        state->GetInternedMessageView(static_cast<uint32_t>(FieldId), iid);
+    if (!view)
       return kNullStringId;
-    return context_->storage->InternString(
-        base::StringView(reinterpret_cast<const char*>(decoder->str().data),
-                         decoder->str().size));
+    auto* cached = view->GetOrCreateDerivedData<InternedStringId>();
+    if (!cached->resolved) {
+      auto* decoder =
+          view->GetOrCreateDecoder<protos::pbzero::InternedString>();
+      cached->id = context_->storage->InternString(
+          base::StringView(reinterpret_cast<const char*>(decoder->str().data),
+                           decoder->str().size));
+      cached->resolved = true;
+    }
+    return cached->id;
   }
 
   StringId FindSourceString(VulkanMemoryEvent::Source);
@@ -32,6 +32,10 @@ namespace perfetto {
 namespace trace_processor {
 namespace {
 
+// The number of syscalls buffered before they are appended to the syscall
+// table.
+constexpr size_t kSyscallBatchSize = 1024;
+
 template <typename T>
 constexpr size_t GetSyscalls(const T&) {
   static_assert(std::extent<T>::value <= kMaxSyscalls,
@@ -41,6 +45,8 @@ constexpr size_t GetSyscalls(const T&) {
 
 }  // namespace
 
+constexpr uint32_t SyscallTracker::kNoSyscall;
+
 // TODO(primiano): The current design is broken in case of 32-bit processes
 // running on 64-bit kernel. At least on ARM, the syscal numbers don't match
 // and we should use the kSyscalls_Aarch32 table for those processes. But this
@@ -102,5 +108,89 @@ void SyscallTracker::SetArchitecture(Architecture arch) {
   }
 }
 
+void SyscallTracker::Enter(int64_t ts, UniqueTid utid, uint32_t syscall_num) {
+  if (context_->config.ingest_syscalls_as_slices) {
+    StringId name = SyscallNumberToSliceName(syscall_num);
+    if (!name.is_null()) {
+      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
+      context_->slice_tracker->Begin(ts, track_id, kNullStringId /* cat */,
+                                     name);
+    }
+  }
+
+  // If the thread is still in a syscall, its sys_exit event was lost and the
+  // previous syscall keeps a duration of -1.
+  if (utid >= open_syscalls_.size())
+    open_syscalls_.resize(utid + 1, kNoSyscall);
+  const auto& table = context_->storage->syscall_table();
+  open_syscalls_[utid] =
+      table.row_count() + static_cast<uint32_t>(batch_.ts.size());
+
+  batch_.ts.push_back(ts);
+  batch_.dur.push_back(-1);
+  batch_.utid.push_back(utid);
+  batch_.nr.push_back(syscall_num);
+  batch_.name.push_back(SyscallNumberToStringId(syscall_num));
+  batch_.ret.push_back(base::nullopt);
+  if (batch_.ts.size() >= kSyscallBatchSize)
+    FlushPendingSyscalls();
+}
+
+void SyscallTracker::Exit(int64_t ts,
+                          UniqueTid utid,
+                          uint32_t syscall_num,
+                          int64_t ret) {
+  if (context_->config.ingest_syscalls_as_slices) {
+    StringId name = SyscallNumberToSliceName(syscall_num);
+    if (!name.is_null()) {
+      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
+      context_->slice_tracker->End(ts, track_id, kNullStringId /* cat */, name);
+    }
+  }
+
+  if (utid >= open_syscalls_.size() || open_syscalls_[utid] == kNoSyscall)
+    return;
+  uint32_t row = open_syscalls_[utid];
+  open_syscalls_[utid] = kNoSyscall;
+
+  // Only the rows which did not return by the time they were flushed need to
+  // be updated in the table.
+  auto* table = context_->storage->mutable_syscall_table();
+  if (row < table->row_count()) {
+    if (table->nr()[row] != syscall_num)
+      return;
+    table->mutable_dur()->Set(row, ts - table->ts()[row]);
+    table->mutable_ret()->Set(row, ret);
+    return;
+  }
+  size_t idx = row - table->row_count();
+  if (batch_.nr[idx] != syscall_num)
+    return;
+  batch_.dur[idx] = ts - batch_.ts[idx];
+  batch_.ret[idx] = ret;
+}
+
+void SyscallTracker::FlushPendingSyscalls() {
+  if (batch_.ts.empty())
+    return;
+
+  tables::SyscallTable::ColumnSpans spans;
+  spans.ts = batch_.ts.data();
+  spans.dur = batch_.dur.data();
+  spans.utid = batch_.utid.data();
+  spans.nr = batch_.nr.data();
+  spans.name = batch_.name.data();
+  spans.ret = batch_.ret.data();
+  context_->storage->mutable_syscall_table()->AppendColumns(
+      spans, static_cast<uint32_t>(batch_.ts.size()));
+
+  batch_.ts.clear();
+  batch_.dur.clear();
+  batch_.utid.clear();
+  batch_.nr.clear();
+  batch_.name.clear();
+  batch_.ret.clear();
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
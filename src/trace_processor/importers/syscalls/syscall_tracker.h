@@ -19,7 +19,9 @@
 
 #include <limits>
 #include <tuple>
+#include <vector>
 
+#include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/string_view.h"
 #include "src/trace_processor/importers/common/slice_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
@@ -55,41 +57,61 @@ class SyscallTracker : public Destructible {
 
   void SetArchitecture(Architecture architecture);
 
-  void Enter(int64_t ts, UniqueTid utid, uint32_t syscall_num) {
-    StringId name = SyscallNumberToStringId(syscall_num);
-    if (!name.is_null()) {
-      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      context_->slice_tracker->Begin(ts, track_id, kNullStringId /* cat */,
-                                     name);
-    }
-  }
+  // Records the start of a syscall made by |utid|. Unless disabled in the
+  // config, this also begins a slice on the track of the thread.
+  void Enter(int64_t ts, UniqueTid utid, uint32_t syscall_num);
 
-  void Exit(int64_t ts, UniqueTid utid, uint32_t syscall_num) {
-    StringId name = SyscallNumberToStringId(syscall_num);
-    if (!name.is_null()) {
-      TrackId track_id = context_->track_tracker->InternThreadTrack(utid);
-      context_->slice_tracker->End(ts, track_id, kNullStringId /* cat */, name);
-    }
-  }
+  // Records the end of the last syscall entered by |utid| with its return
+  // value.
+  void Exit(int64_t ts, UniqueTid utid, uint32_t syscall_num, int64_t ret);
+
+  // Appends the syscalls buffered since the last flush to the syscall table.
+  // Called when the batch is full, on TraceProcessor::Flush() and at the end
+  // of the trace: the syscalls which did not return by then keep a duration
+  // of -1.
+  void FlushPendingSyscalls();
 
  private:
   explicit SyscallTracker(TraceProcessorContext*);
 
-  TraceProcessorContext* const context_;
+  // The syscalls entered since the last flush, stored column by column so
+  // they can be appended to the syscall table in a single call.
+  struct SyscallBatch {
+    std::vector<int64_t> ts;
+    std::vector<int64_t> dur;
+    std::vector<uint32_t> utid;
+    std::vector<uint32_t> nr;
+    std::vector<StringId> name;
+    std::vector<base::Optional<int64_t>> ret;
+  };
+
+  static constexpr uint32_t kNoSyscall = std::numeric_limits<uint32_t>::max();
 
   inline StringId SyscallNumberToStringId(uint32_t syscall_num) {
-    if (syscall_num > kMaxSyscalls)
+    if (syscall_num >= kMaxSyscalls)
       return kNullStringId;
+    return arch_syscall_to_string_id_[syscall_num];
+  }
+
+  inline StringId SyscallNumberToSliceName(uint32_t syscall_num) {
     // We see two write sys calls around each userspace slice that is going via
     // trace_marker, this violates the assumption that userspace slices are
     // perfectly nested. For the moment ignore all write sys calls.
     // TODO(hjd): Remove this limitation.
-    StringId id = arch_syscall_to_string_id_[syscall_num];
+    StringId id = SyscallNumberToStringId(syscall_num);
     if (id == sys_write_string_id_)
       return kNullStringId;
     return id;
   }
 
+  TraceProcessorContext* const context_;
+
+  SyscallBatch batch_;
+
+  // The row number (counting the rows of |batch_| after the rows of the
+  // table) of the syscall each thread is in, indexed by utid, or kNoSyscall.
+  std::vector<uint32_t> open_syscalls_;
+
   // This is table from platform specific syscall number directly to
   // the relevant StringId (this avoids having to always do two conversions).
   std::array<StringId, kMaxSyscalls> arch_syscall_to_string_id_{};
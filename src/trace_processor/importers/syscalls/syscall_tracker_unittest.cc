@@ -38,13 +38,13 @@ class MockSliceTracker : public SliceTracker {
                                        TrackId track_id,
                                        StringId cat,
                                        StringId name,
-                                       SetArgsCallback args_callback));
+                                       SetArgsCallbackRef args_callback));
   MOCK_METHOD5(End,
                base::Optional<SliceId>(int64_t timestamp,
                                        TrackId track_id,
                                        StringId cat,
                                        StringId name,
-                                       SetArgsCallback args_callback));
+                                       SetArgsCallbackRef args_callback));
 };
 
 class SyscallTrackerTest : public ::testing::Test {
@@ -74,7 +74,7 @@ TEST_F(SyscallTrackerTest, ReportUnknownSyscalls) {
 
   SyscallTracker* syscall_tracker = SyscallTracker::GetOrCreate(&context);
   syscall_tracker->Enter(100 /*ts*/, 42 /*utid*/, 57 /*sys_read*/);
-  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 57 /*sys_read*/);
+  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 57 /*sys_read*/, 0 /*ret*/);
   EXPECT_EQ(context.storage->GetString(begin_name), "sys_57");
   EXPECT_EQ(context.storage->GetString(end_name), "sys_57");
 }
@@ -86,7 +86,7 @@ TEST_F(SyscallTrackerTest, IgnoreWriteSyscalls) {
   EXPECT_CALL(*slice_tracker, End(_, _, _, _, _)).Times(0);
 
   syscall_tracker->Enter(100 /*ts*/, 42 /*utid*/, 64 /*sys_write*/);
-  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 64 /*sys_write*/);
+  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 64 /*sys_write*/, 0 /*ret*/);
 }
 
 TEST_F(SyscallTrackerTest, Aarch64) {
@@ -101,7 +101,7 @@ TEST_F(SyscallTrackerTest, Aarch64) {
   SyscallTracker* syscall_tracker = SyscallTracker::GetOrCreate(&context);
   syscall_tracker->SetArchitecture(kAarch64);
   syscall_tracker->Enter(100 /*ts*/, 42 /*utid*/, 63 /*sys_read*/);
-  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 63 /*sys_read*/);
+  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 63 /*sys_read*/, 0 /*ret*/);
   EXPECT_EQ(context.storage->GetString(begin_name), "sys_read");
   EXPECT_EQ(context.storage->GetString(end_name), "sys_read");
 }
@@ -118,7 +118,7 @@ TEST_F(SyscallTrackerTest, x8664) {
   SyscallTracker* syscall_tracker = SyscallTracker::GetOrCreate(&context);
   syscall_tracker->SetArchitecture(kX86_64);
   syscall_tracker->Enter(100 /*ts*/, 42 /*utid*/, 0 /*sys_read*/);
-  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 0 /*sys_read*/);
+  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 0 /*sys_read*/, 0 /*ret*/);
   EXPECT_EQ(context.storage->GetString(begin_name), "sys_read");
   EXPECT_EQ(context.storage->GetString(end_name), "sys_read");
 }
@@ -130,7 +130,65 @@ TEST_F(SyscallTrackerTest, SyscallNumberTooLarge) {
   SyscallTracker* syscall_tracker = SyscallTracker::GetOrCreate(&context);
   syscall_tracker->SetArchitecture(kAarch64);
   syscall_tracker->Enter(100 /*ts*/, 42 /*utid*/, 9999);
-  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 9999);
+  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 9999, 0 /*ret*/);
+}
+
+TEST_F(SyscallTrackerTest, SyscallTable) {
+  context.config.ingest_syscalls_as_slices = false;
+  EXPECT_CALL(*slice_tracker, Begin(_, _, _, _, _)).Times(0);
+  EXPECT_CALL(*slice_tracker, End(_, _, _, _, _)).Times(0);
+
+  SyscallTracker* syscall_tracker = SyscallTracker::GetOrCreate(&context);
+  syscall_tracker->SetArchitecture(kAarch64);
+  syscall_tracker->Enter(100 /*ts*/, 42 /*utid*/, 63 /*sys_read*/);
+  syscall_tracker->Enter(105 /*ts*/, 43 /*utid*/, 64 /*sys_write*/);
+  syscall_tracker->Exit(110 /*ts*/, 42 /*utid*/, 63 /*sys_read*/, 8 /*ret*/);
+  syscall_tracker->Enter(120 /*ts*/, 42 /*utid*/, 63 /*sys_read*/);
+
+  // Nothing is in the table until the syscalls are flushed.
+  const auto& syscalls = context.storage->syscall_table();
+  ASSERT_EQ(syscalls.row_count(), 0u);
+  syscall_tracker->FlushPendingSyscalls();
+  ASSERT_EQ(syscalls.row_count(), 3u);
+
+  EXPECT_EQ(syscalls.ts()[0], 100);
+  EXPECT_EQ(syscalls.dur()[0], 10);
+  EXPECT_EQ(syscalls.utid()[0], 42u);
+  EXPECT_EQ(syscalls.nr()[0], 63u);
+  EXPECT_EQ(context.storage->GetString(syscalls.name()[0]), "sys_read");
+  EXPECT_EQ(syscalls.ret()[0], 8);
+
+  // Writes are not turned into slices but are in the table.
+  EXPECT_EQ(context.storage->GetString(syscalls.name()[1]), "sys_write");
+
+  // Syscalls which did not return are updated in the table when they do.
+  EXPECT_EQ(syscalls.dur()[1], -1);
+  EXPECT_FALSE(syscalls.ret()[1].has_value());
+  syscall_tracker->Exit(125 /*ts*/, 43 /*utid*/, 64 /*sys_write*/, 1 /*ret*/);
+  EXPECT_EQ(syscalls.dur()[1], 20);
+  EXPECT_EQ(syscalls.ret()[1], 1);
+  EXPECT_EQ(syscalls.dur()[2], -1);
+}
+
+TEST_F(SyscallTrackerTest, SyscallTableLostExit) {
+  context.config.ingest_syscalls_as_slices = false;
+
+  SyscallTracker* syscall_tracker = SyscallTracker::GetOrCreate(&context);
+  syscall_tracker->SetArchitecture(kAarch64);
+
+  // The sys_exit of the first syscall was lost.
+  syscall_tracker->Enter(100 /*ts*/, 42 /*utid*/, 63 /*sys_read*/);
+  syscall_tracker->Enter(110 /*ts*/, 42 /*utid*/, 64 /*sys_write*/);
+  syscall_tracker->Exit(120 /*ts*/, 42 /*utid*/, 64 /*sys_write*/, 0 /*ret*/);
+
+  // Exiting a syscall which was not entered is ignored.
+  syscall_tracker->Exit(130 /*ts*/, 42 /*utid*/, 63 /*sys_read*/, 0 /*ret*/);
+  syscall_tracker->FlushPendingSyscalls();
+
+  const auto& syscalls = context.storage->syscall_table();
+  ASSERT_EQ(syscalls.row_count(), 2u);
+  EXPECT_EQ(syscalls.dur()[0], -1);
+  EXPECT_EQ(syscalls.dur()[1], 10);
 }
 
 }  // namespace
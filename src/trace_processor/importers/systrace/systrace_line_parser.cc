@@ -16,7 +16,6 @@
 
 #include "src/trace_processor/importers/systrace/systrace_line_parser.h"
 
-#include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
@@ -25,13 +24,13 @@
 #include "src/trace_processor/importers/common/track_tracker.h"
 #include "src/trace_processor/importers/ftrace/binder_tracker.h"
 #include "src/trace_processor/importers/ftrace/sched_event_tracker.h"
+#include "src/trace_processor/importers/ftrace/thread_state_tracker.h"
 #include "src/trace_processor/importers/systrace/systrace_parser.h"
 #include "src/trace_processor/types/task_state.h"
 
 #include <cctype>
 #include <cinttypes>
 #include <string>
-#include <unordered_map>
 
 namespace perfetto {
 namespace trace_processor {
@@ -44,7 +43,9 @@ SystraceLineParser::SystraceLineParser(TraceProcessorContext* ctx)
       workqueue_name_id_(ctx->storage->InternString("workqueue")),
       sched_blocked_reason_id_(
           ctx->storage->InternString("sched_blocked_reason")),
-      io_wait_id_(ctx->storage->InternString("io_wait")) {}
+      io_wait_id_(ctx->storage->InternString("io_wait")),
+      sched_waking_name_id_(ctx->storage->InternString("sched_waking")),
+      cpu_freq_name_id_(ctx->storage->InternString("cpufreq")) {}
 
 util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
   auto utid = context_->process_tracker->UpdateThreadName(
@@ -58,36 +59,26 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
     }
   }
 
-  std::unordered_map<std::string, std::string> args;
-  for (base::StringSplitter ss(line.args_str, ' '); ss.Next();) {
-    std::string key;
-    std::string value;
-    if (!base::Contains(ss.cur_token(), "=")) {
-      key = "name";
-      value = ss.cur_token();
-      args.emplace(std::move(key), std::move(value));
-      continue;
-    }
-    for (base::StringSplitter inner(ss.cur_token(), '='); inner.Next();) {
-      if (key.empty()) {
-        key = inner.cur_token();
-      } else {
-        value = inner.cur_token();
-      }
-    }
-    args.emplace(std::move(key), std::move(value));
+  // Print events are the most common events and do not have "key=value"
+  // args so they are handled before splitting the args.
+  if (line.event_name == "tracing_mark_write" || line.event_name == "0" ||
+      line.event_name == "print") {
+    SystraceParser::GetOrCreate(context_)->ParsePrintEvent(
+        line.ts, line.pid, base::StringView(line.args_str));
+    return util::OkStatus();
   }
+
+  SplitArgs(base::StringView(line.args_str));
   if (line.event_name == "sched_switch") {
-    auto prev_state_str = args["prev_state"];
     int64_t prev_state =
-        ftrace_utils::TaskState(prev_state_str.c_str()).raw_state();
+        ftrace_utils::TaskState(GetArgCStr("prev_state")).raw_state();
 
-    auto prev_pid = base::StringToUInt32(args["prev_pid"]);
-    auto prev_comm = base::StringView(args["prev_comm"]);
-    auto prev_prio = base::StringToInt32(args["prev_prio"]);
-    auto next_pid = base::StringToUInt32(args["next_pid"]);
-    auto next_comm = base::StringView(args["next_comm"]);
-    auto next_prio = base::StringToInt32(args["next_prio"]);
+    auto prev_pid = base::CStringToUInt32(GetArgCStr("prev_pid"));
+    auto prev_comm = GetArg("prev_comm");
+    auto prev_prio = base::CStringToInt32(GetArgCStr("prev_prio"));
+    auto next_pid = base::CStringToUInt32(GetArgCStr("next_pid"));
+    auto next_comm = GetArg("next_comm");
+    auto next_prio = base::CStringToInt32(GetArgCStr("next_prio"));
 
     if (!(prev_pid.has_value() && prev_prio.has_value() &&
           next_pid.has_value() && next_prio.has_value())) {
@@ -97,25 +88,47 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
     SchedEventTracker::GetOrCreate(context_)->PushSchedSwitch(
         line.cpu, line.ts, prev_pid.value(), prev_comm, prev_prio.value(),
         prev_state, next_pid.value(), next_comm, next_prio.value());
-  } else if (line.event_name == "tracing_mark_write" ||
-             line.event_name == "0" || line.event_name == "print") {
-    SystraceParser::GetOrCreate(context_)->ParsePrintEvent(
-        line.ts, line.pid, line.args_str.c_str());
-  } else if (line.event_name == "sched_wakeup") {
-    auto comm = args["comm"];
-    base::Optional<uint32_t> wakee_pid = base::StringToUInt32(args["pid"]);
+  } else if (line.event_name == "sched_wakeup" ||
+             line.event_name == "sched_waking") {
+    base::Optional<uint32_t> wakee_pid =
+        base::CStringToUInt32(GetArgCStr("pid"));
     if (!wakee_pid.has_value()) {
       return util::Status("Could not convert wakee_pid");
     }
 
-    StringId name_id = context_->storage->InternString(base::StringView(comm));
+    StringId name_id = context_->storage->InternString(GetArg("comm"));
     auto wakee_utid = context_->process_tracker->UpdateThreadName(
         wakee_pid.value(), name_id, ThreadNamePriority::kFtrace);
-    context_->event_tracker->PushInstant(line.ts, sched_wakeup_name_id_,
-                                         wakee_utid, RefType::kRefUtid);
+    StringId event_name_id = line.event_name == "sched_wakeup"
+                                 ? sched_wakeup_name_id_
+                                 : sched_waking_name_id_;
+    context_->event_tracker->PushInstant(line.ts, event_name_id, wakee_utid,
+                                         RefType::kRefUtid);
+    if (event_name_id == sched_waking_name_id_) {
+      ThreadStateTracker::GetOrCreate(context_)->PushSchedWaking(line.ts,
+                                                                 wakee_utid);
+    }
+  } else if (line.event_name == "cpu_frequency") {
+    // Format: cpu_frequency: state=1900800 cpu_id=0
+    base::Optional<uint32_t> new_freq =
+        base::CStringToUInt32(GetArgCStr("state"));
+    base::Optional<uint32_t> event_cpu =
+        base::CStringToUInt32(GetArgCStr("cpu_id"));
+    if (!new_freq.has_value()) {
+      return util::Status("Could not convert state");
+    }
+    if (!event_cpu.has_value()) {
+      return util::Status("Could not convert event cpu");
+    }
+
+    TrackId track = context_->track_tracker->InternCpuCounterTrack(
+        cpu_freq_name_id_, event_cpu.value());
+    context_->event_tracker->PushCounter(line.ts, new_freq.value(), track);
   } else if (line.event_name == "cpu_idle") {
-    base::Optional<uint32_t> event_cpu = base::StringToUInt32(args["cpu_id"]);
-    base::Optional<double> new_state = base::StringToDouble(args["state"]);
+    base::Optional<uint32_t> event_cpu =
+        base::CStringToUInt32(GetArgCStr("cpu_id"));
+    base::Optional<double> new_state =
+        base::CStringToDouble(GetArgCStr("state"));
     if (!event_cpu.has_value()) {
       return util::Status("Could not convert event cpu");
     }
@@ -127,15 +140,16 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
         cpuidle_name_id_, event_cpu.value());
     context_->event_tracker->PushCounter(line.ts, new_state.value(), track);
   } else if (line.event_name == "binder_transaction") {
-    auto id = base::StringToInt32(args["transaction"]);
-    auto dest_node = base::StringToInt32(args["dest_node"]);
-    auto dest_tgid = base::StringToInt32(args["dest_proc"]);
-    auto dest_tid = base::StringToInt32(args["dest_thread"]);
-    auto is_reply = base::StringToInt32(args["reply"]).value() == 1;
-    auto flags_str = args["flags"];
+    auto id = base::CStringToInt32(GetArgCStr("transaction"));
+    auto dest_node = base::CStringToInt32(GetArgCStr("dest_node"));
+    auto dest_tgid = base::CStringToInt32(GetArgCStr("dest_proc"));
+    auto dest_tid = base::CStringToInt32(GetArgCStr("dest_thread"));
+    auto is_reply = base::CStringToInt32(GetArgCStr("reply")).value() == 1;
     char* end;
-    uint32_t flags = static_cast<uint32_t>(strtol(flags_str.c_str(), &end, 16));
-    std::string code_str = args["code"] + " Java Layer Dependent";
+    uint32_t flags =
+        static_cast<uint32_t>(strtol(GetArgCStr("flags"), &end, 16));
+    std::string code_str =
+        GetArg("code").ToStdString() + " Java Layer Dependent";
     StringId code = context_->storage->InternString(base::StringView(code_str));
     if (!dest_tgid.has_value()) {
       return util::Status("Could not convert dest_tgid");
@@ -153,7 +167,7 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
         line.ts, line.pid, id.value(), dest_node.value(), dest_tgid.value(),
         dest_tid.value(), is_reply, flags, code);
   } else if (line.event_name == "binder_transaction_received") {
-    auto id = base::StringToInt32(args["transaction"]);
+    auto id = base::CStringToInt32(GetArgCStr("transaction"));
     if (!id.has_value()) {
       return util::Status("Could not convert transaction id");
     }
@@ -166,8 +180,8 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
   } else if (line.event_name == "binder_unlock") {
     BinderTracker::GetOrCreate(context_)->Unlock(line.ts, line.pid);
   } else if (line.event_name == "binder_transaction_alloc_buf") {
-    auto data_size = base::StringToUInt64(args["data_size"]);
-    auto offsets_size = base::StringToUInt64(args["offsets_size"]);
+    auto data_size = base::CStringToUInt64(GetArgCStr("data_size"));
+    auto offsets_size = base::CStringToUInt64(GetArgCStr("offsets_size"));
     if (!data_size.has_value()) {
       return util::Status("Could not convert data size");
     }
@@ -181,11 +195,11 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
              line.event_name == "clock_disable") {
     std::string subtitle =
         line.event_name == "clock_set_rate" ? " Frequency" : " State";
-    auto rate = base::StringToUInt32(args["state"]);
+    auto rate = base::CStringToUInt32(GetArgCStr("state"));
     if (!rate.has_value()) {
       return util::Status("Could not convert state");
     }
-    std::string clock_name_str = args["name"] + subtitle;
+    std::string clock_name_str = GetArg("name").ToStdString() + subtitle;
     StringId clock_name =
         context_->storage->InternString(base::StringView(clock_name_str));
     TrackId track =
@@ -201,29 +215,30 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
     TrackId track = context_->track_tracker->InternThreadTrack(utid);
     context_->slice_tracker->End(line.ts, track, workqueue_name_id_);
   } else if (line.event_name == "thermal_temperature") {
-    std::string thermal_zone = args["thermal_zone"] + " Temperature";
+    std::string thermal_zone =
+        GetArg("thermal_zone").ToStdString() + " Temperature";
     StringId track_name =
         context_->storage->InternString(base::StringView(thermal_zone));
     TrackId track =
         context_->track_tracker->InternGlobalCounterTrack(track_name);
-    auto temp = base::StringToInt32(args["temp"]);
+    auto temp = base::CStringToInt32(GetArgCStr("temp"));
     if (!temp.has_value()) {
       return util::Status("Could not convert temp");
     }
     context_->event_tracker->PushCounter(line.ts, temp.value(), track);
   } else if (line.event_name == "cdev_update") {
-    std::string type = args["type"] + " Cooling Device";
+    std::string type = GetArg("type").ToStdString() + " Cooling Device";
     StringId track_name =
         context_->storage->InternString(base::StringView(type));
     TrackId track =
         context_->track_tracker->InternGlobalCounterTrack(track_name);
-    auto target = base::StringToDouble(args["target"]);
+    auto target = base::CStringToDouble(GetArgCStr("target"));
     if (!target.has_value()) {
       return util::Status("Could not convert target");
     }
     context_->event_tracker->PushCounter(line.ts, target.value(), track);
   } else if (line.event_name == "sched_blocked_reason") {
-    auto wakee_pid = base::StringToUInt32(args["pid"]);
+    auto wakee_pid = base::CStringToUInt32(GetArgCStr("pid"));
     if (!wakee_pid.has_value()) {
       return util::Status("sched_blocked_reason: could not parse wakee_pid");
     }
@@ -234,18 +249,20 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
         false);
 
     auto inserter = context_->args_tracker->AddArgsTo(id);
-    auto io_wait = base::StringToInt32(args["iowait"]);
+    auto io_wait = base::CStringToInt32(GetArgCStr("iowait"));
     if (!io_wait.has_value()) {
       return util::Status("sched_blocked_reason: could not parse io_wait");
     }
     inserter.AddArg(io_wait_id_, Variadic::Boolean(*io_wait));
     context_->args_tracker->Flush();
+    ThreadStateTracker::GetOrCreate(context_)->PushSchedBlockedReason(
+        wakee_utid, *io_wait != 0, base::nullopt);
   } else if (line.event_name == "rss_stat") {
     // Format: rss_stat: size=8437760 member=1 curr=1 mm_id=2824390453
-    auto size = base::StringToInt64(args["size"]);
-    auto member = base::StringToUInt32(args["member"]);
-    auto mm_id = base::StringToInt64(args["mm_id"]);
-    auto opt_curr = base::StringToUInt32(args["curr"]);
+    auto size = base::CStringToInt64(GetArgCStr("size"));
+    auto member = base::CStringToUInt32(GetArgCStr("member"));
+    auto mm_id = base::CStringToInt64(GetArgCStr("mm_id"));
+    auto opt_curr = base::CStringToUInt32(GetArgCStr("curr"));
     if (!size.has_value()) {
       return util::Status("rss_stat: could not parse size");
     }
@@ -263,5 +280,58 @@ util::Status SystraceLineParser::ParseLine(const SystraceLine& line) {
   return util::OkStatus();
 }
 
+void SystraceLineParser::SplitArgs(base::StringView args_str) {
+  args_.clear();
+  size_t pos = 0;
+  while (pos < args_str.size()) {
+    size_t token_end = args_str.find(' ', pos);
+    if (token_end == base::StringView::npos)
+      token_end = args_str.size();
+    base::StringView token = args_str.substr(pos, token_end - pos);
+    pos = token_end + 1;
+    if (token.empty())
+      continue;
+
+    // Tokens without an '=' are names. Otherwise the key is the first
+    // non-empty part of the token and the value the last one (if any).
+    if (token.find('=') == base::StringView::npos) {
+      args_.emplace_back("name", token);
+      continue;
+    }
+    base::StringView key;
+    base::StringView value;
+    size_t part_start = 0;
+    while (part_start <= token.size()) {
+      size_t part_end = token.find('=', part_start);
+      if (part_end == base::StringView::npos)
+        part_end = token.size();
+      if (part_end > part_start) {
+        base::StringView part = token.substr(part_start, part_end - part_start);
+        if (key.empty()) {
+          key = part;
+        } else {
+          value = part;
+        }
+      }
+      part_start = part_end + 1;
+    }
+    args_.emplace_back(key, value);
+  }
+}
+
+base::StringView SystraceLineParser::GetArg(base::StringView key) const {
+  for (const auto& arg : args_) {
+    if (arg.first == key)
+      return arg.second;
+  }
+  return base::StringView();
+}
+
+const char* SystraceLineParser::GetArgCStr(base::StringView key) {
+  base::StringView value = GetArg(key);
+  arg_buf_.assign(value.data(), value.size());
+  return arg_buf_.c_str();
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -17,6 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_LINE_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_LINE_PARSER_H_
 
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/trace_processor/status.h"
 
 #include "src/trace_processor/importers/common/trace_parser.h"
@@ -34,6 +39,17 @@ class SystraceLineParser {
   util::Status ParseLine(const SystraceLine&);
 
  private:
+  // Splits the "key=value" args of a line into |args_|.
+  void SplitArgs(base::StringView args_str);
+
+  // Returns the value of the first arg called |key| or an empty string if
+  // there is no such arg.
+  base::StringView GetArg(base::StringView key) const;
+
+  // Same as GetArg() but returns a null terminated copy of the value, which is
+  // valid until the next call.
+  const char* GetArgCStr(base::StringView key);
+
   TraceProcessorContext* const context_;
   RssStatTracker rss_stat_tracker_;
   const StringId sched_wakeup_name_id_ = kNullStringId;
@@ -41,6 +57,13 @@ class SystraceLineParser {
   const StringId workqueue_name_id_ = kNullStringId;
   const StringId sched_blocked_reason_id_ = kNullStringId;
   const StringId io_wait_id_ = kNullStringId;
+  const StringId sched_waking_name_id_ = kNullStringId;
+  const StringId cpu_freq_name_id_ = kNullStringId;
+
+  // The args of the line being parsed, as views into its args_str. These are
+  // members, rather than locals, to reuse their memory across lines.
+  std::vector<std::pair<base::StringView, base::StringView>> args_;
+  std::string arg_buf_;
 };
 
 }  // namespace trace_processor
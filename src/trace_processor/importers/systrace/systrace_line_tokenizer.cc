@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/importers/systrace/systrace_line_tokenizer.h"
 
+#include <string.h>
+
 #include "perfetto/ext/base/string_utils.h"
 
 // On windows std::isspace if overloaded in <locale>. MSBUILD via bazel
@@ -27,26 +29,158 @@ namespace perfetto {
 namespace trace_processor {
 
 namespace {
-std::string SubstrTrim(const std::string& input) {
-  std::string s = input;
-  s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-                                  [](char ch) { return !std::isspace(ch); }));
-  s.erase(std::find_if(s.rbegin(), s.rend(),
-                       [](char ch) { return !std::isspace(ch); })
-              .base(),
-          s.end());
-  return s;
+
+bool IsSpace(char c) {
+  return std::isspace(static_cast<unsigned char>(c));
+}
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool IsIrqFlag(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '.';
 }
-}  // namespace
 
-SystraceLineTokenizer::SystraceLineTokenizer()
-    : line_matcher_(std::regex(R"(-(\d+)\s+\(?\s*(\d+|-+)?\)?\s?\[(\d+)\]\s*)"
-                               R"([a-zA-Z0-9.]{0,5}\s+(\d+\.\d+):\s+(\S+):)")) {
+base::StringView Trim(base::StringView str) {
+  const char* begin = str.begin();
+  const char* end = str.end();
+  while (begin < end && IsSpace(*begin))
+    begin++;
+  while (end > begin && IsSpace(end[-1]))
+    end--;
+  return base::StringView(begin, static_cast<size_t>(end - begin));
 }
 
+// The fields of a line, as views into the line.
+struct LineMatch {
+  base::StringView pid;
+  base::StringView tgid;
+  base::StringView cpu;
+  base::StringView ts;
+  base::StringView event_name;
+
+  // The offset of the character after the colon following the event name.
+  size_t end = 0;
+};
+
+// Matches the fields of a line, following the task name, against
+//   -(\d+)\s+\(?\s*(\d+|-+)?\)?\s?\[(\d+)\]\s*[a-zA-Z0-9.]{0,5}\s+
+//   (\d+\.\d+):\s+(\S+):
+// (where the groups are the fields of LineMatch) and returns the same match as
+// std::regex would, without the (large) cost of std::regex. Each component of
+// this pattern can be matched greedily, except for the irq flags and the event
+// name which need to be backtracked over; this is done explicitly below.
+class LineMatcher {
+ public:
+  explicit LineMatcher(base::StringView line)
+      : data_(line.data()), size_(line.size()) {}
+
+  // Matches the pattern starting at the dash at |pos|.
+  bool MatchAt(size_t pos, LineMatch* match) {
+    size_t p = pos + 1;
+    size_t q = SkipDigits(p);
+    if (q == p)
+      return false;
+    match->pid = View(p, q);
+
+    p = SkipSpaces(q);
+    if (p == q)
+      return false;
+    if (p < size_ && data_[p] == '(')
+      p++;
+    p = SkipSpaces(p);
+    q = SkipDigits(p);
+    if (q == p) {
+      while (q < size_ && data_[q] == '-')
+        q++;
+    }
+    match->tgid = View(p, q);
+    p = q;
+    if (p < size_ && data_[p] == ')')
+      p++;
+    if (p < size_ && IsSpace(data_[p]))
+      p++;
+
+    if (p == size_ || data_[p] != '[')
+      return false;
+    q = SkipDigits(++p);
+    if (q == p)
+      return false;
+    match->cpu = View(p, q);
+    p = q;
+    if (p == size_ || data_[p] != ']')
+      return false;
+
+    // Either the spaces after the cpu are followed by (at most 5) irq flags
+    // and more spaces, or there are no irq flags.
+    p = SkipSpaces(p + 1);
+    q = p;
+    while (q < size_ && q - p < 5 && IsIrqFlag(data_[q]))
+      q++;
+    if (q < size_ && IsSpace(data_[q]) && MatchFromTs(SkipSpaces(q), match))
+      return true;
+    return data_[p - 1] != ']' && MatchFromTs(p, match);
+  }
+
+ private:
+  // Matches (\d+\.\d+):\s+(\S+): starting at |p|.
+  bool MatchFromTs(size_t p, LineMatch* match) {
+    size_t q = SkipDigits(p);
+    if (q == p || q == size_ || data_[q] != '.')
+      return false;
+    size_t r = SkipDigits(q + 1);
+    if (r == q + 1)
+      return false;
+    match->ts = View(p, r);
+
+    if (r == size_ || data_[r] != ':')
+      return false;
+    p = SkipSpaces(r + 1);
+    if (p == r + 1)
+      return false;
+
+    // The event name is the longest run of non-spaces followed by a colon.
+    q = p;
+    while (q < size_ && !IsSpace(data_[q]))
+      q++;
+    for (r = q - 1; r > p; --r) {
+      if (data_[r] == ':') {
+        match->event_name = View(p, r);
+        match->end = r + 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t SkipDigits(size_t p) const {
+    while (p < size_ && IsDigit(data_[p]))
+      p++;
+    return p;
+  }
+
+  size_t SkipSpaces(size_t p) const {
+    while (p < size_ && IsSpace(data_[p]))
+      p++;
+    return p;
+  }
+
+  base::StringView View(size_t start, size_t end) const {
+    return base::StringView(data_ + start, end - start);
+  }
+
+  const char* data_;
+  size_t size_;
+};
+
+}  // namespace
+
+SystraceLineTokenizer::SystraceLineTokenizer() = default;
+
 // TODO(hjd): This should be more robust to being passed random input.
 // This can happen if we mess up detecting a gzip trace for example.
-util::Status SystraceLineTokenizer::Tokenize(const std::string& buffer,
+util::Status SystraceLineTokenizer::Tokenize(base::StringView buffer,
                                              SystraceLine* line) {
   // An example line from buffer looks something like the following:
   // kworker/u16:1-77    (   77) [004] ....   316.196720: 0:
@@ -59,38 +193,45 @@ util::Status SystraceLineTokenizer::Tokenize(const std::string& buffer,
   // <idle>-0     [000]  0.002188: task_newtask: pid=1 ...
   //
   // The task name can contain any characters e.g -:[(/ and for this reason
-  // it is much easier to use a regex (even though it is slower than parsing
-  // manually)
-
-  std::smatch matches;
-  bool matched = std::regex_search(buffer, matches, line_matcher_);
+  // the fields are matched starting from each dash in turn until one matches.
+  LineMatcher matcher(buffer);
+  LineMatch match;
+  bool matched = false;
+  for (size_t pos = buffer.find('-'); pos != base::StringView::npos;
+       pos = buffer.find('-', pos + 1)) {
+    if (matcher.MatchAt(pos, &match)) {
+      matched = true;
+      base::StringView task = Trim(buffer.substr(0, pos));
+      line->task.assign(task.data(), task.size());
+      break;
+    }
+  }
   if (!matched) {
-    return util::ErrStatus("Not a known systrace event format (line: %s)",
-                           buffer.c_str());
+    return util::ErrStatus("Not a known systrace event format (line: %.*s)",
+                           static_cast<int>(buffer.size()), buffer.data());
   }
 
-  std::string pid_str = matches[1].str();
-  std::string cpu_str = matches[3].str();
-  std::string ts_str = matches[4].str();
-
-  line->task = SubstrTrim(matches.prefix());
-  line->tgid_str = matches[2].str();
-  line->event_name = matches[5].str();
-  line->args_str = SubstrTrim(matches.suffix());
+  base::StringView args = Trim(buffer.substr(match.end));
+  line->tgid_str.assign(match.tgid.data(), match.tgid.size());
+  line->event_name.assign(match.event_name.data(), match.event_name.size());
+  line->args_str.assign(args.data(), args.size());
 
-  base::Optional<uint32_t> maybe_pid = base::StringToUInt32(pid_str);
+  number_buf_.assign(match.pid.data(), match.pid.size());
+  base::Optional<uint32_t> maybe_pid = base::StringToUInt32(number_buf_);
   if (!maybe_pid.has_value()) {
-    return util::Status("Could not convert pid " + pid_str);
+    return util::Status("Could not convert pid " + number_buf_);
   }
   line->pid = maybe_pid.value();
 
-  base::Optional<uint32_t> maybe_cpu = base::StringToUInt32(cpu_str);
+  number_buf_.assign(match.cpu.data(), match.cpu.size());
+  base::Optional<uint32_t> maybe_cpu = base::StringToUInt32(number_buf_);
   if (!maybe_cpu.has_value()) {
-    return util::Status("Could not convert cpu " + cpu_str);
+    return util::Status("Could not convert cpu " + number_buf_);
   }
   line->cpu = maybe_cpu.value();
 
-  base::Optional<double> maybe_ts = base::StringToDouble(ts_str);
+  number_buf_.assign(match.ts.data(), match.ts.size());
+  base::Optional<double> maybe_ts = base::StringToDouble(number_buf_);
   if (!maybe_ts.has_value()) {
     return util::Status("Could not convert ts");
   }
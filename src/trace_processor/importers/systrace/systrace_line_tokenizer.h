@@ -17,8 +17,9 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_LINE_TOKENIZER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_LINE_TOKENIZER_H_
 
-#include <regex>
+#include <string>
 
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/trace_processor/status.h"
 
 #include "src/trace_processor/importers/systrace/systrace_line.h"
@@ -30,10 +31,14 @@ class SystraceLineTokenizer {
  public:
   SystraceLineTokenizer();
 
-  util::Status Tokenize(const std::string& line, SystraceLine*);
+  // Splits |buffer| into the fields of |line|. The strings of |line| are
+  // assigned (rather than created) so that reusing the same SystraceLine for
+  // all the lines of a trace does not allocate memory for each line.
+  util::Status Tokenize(base::StringView buffer, SystraceLine*);
 
  private:
-  const std::regex line_matcher_;
+  // Used to null terminate the numbers of a line before converting them.
+  std::string number_buf_;
 };
 
 }  // namespace trace_processor
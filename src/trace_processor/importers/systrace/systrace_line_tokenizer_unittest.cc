@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/systrace/systrace_line_tokenizer.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(SystraceLineTokenizerTest, WithTgid) {
+  SystraceLineTokenizer tokenizer;
+  SystraceLine line;
+  ASSERT_TRUE(tokenizer
+                  .Tokenize("kworker/u16:1-77    (   77) [004] ....   "
+                            "316.196720: 0: B|77|__scm_call_armv8_64|0",
+                            &line)
+                  .ok());
+  EXPECT_EQ(line.task, "kworker/u16:1");
+  EXPECT_EQ(line.pid, 77u);
+  EXPECT_EQ(line.tgid_str, "77");
+  EXPECT_EQ(line.cpu, 4u);
+  EXPECT_EQ(line.ts, 316196720000);
+  EXPECT_EQ(line.event_name, "0");
+  EXPECT_EQ(line.args_str, "B|77|__scm_call_armv8_64|0");
+
+  ASSERT_TRUE(tokenizer
+                  .Tokenize("<...>-1234  (-----) [001] d..3  1.500000: "
+                            "sched_switch: prev_comm=a prev_pid=1234",
+                            &line)
+                  .ok());
+  EXPECT_EQ(line.task, "<...>");
+  EXPECT_EQ(line.pid, 1234u);
+  EXPECT_EQ(line.tgid_str, "-----");
+  EXPECT_EQ(line.event_name, "sched_switch");
+  EXPECT_EQ(line.args_str, "prev_comm=a prev_pid=1234");
+}
+
+TEST(SystraceLineTokenizerTest, WithoutTgidOrIrqFlags) {
+  SystraceLineTokenizer tokenizer;
+  SystraceLine line;
+  ASSERT_TRUE(tokenizer
+                  .Tokenize("<idle>-0     [000] ...2     0.002188: "
+                            "task_newtask: pid=1",
+                            &line)
+                  .ok());
+  EXPECT_EQ(line.task, "<idle>");
+  EXPECT_EQ(line.pid, 0u);
+  EXPECT_EQ(line.tgid_str, "");
+  EXPECT_EQ(line.cpu, 0u);
+  EXPECT_EQ(line.ts, 2188000);
+  EXPECT_EQ(line.event_name, "task_newtask");
+  EXPECT_EQ(line.args_str, "pid=1");
+
+  ASSERT_TRUE(
+      tokenizer.Tokenize("<idle>-0   [002]  0.002188: cpu_idle: state=1", &line)
+          .ok());
+  EXPECT_EQ(line.cpu, 2u);
+  EXPECT_EQ(line.ts, 2188000);
+  EXPECT_EQ(line.event_name, "cpu_idle");
+  EXPECT_EQ(line.args_str, "state=1");
+}
+
+TEST(SystraceLineTokenizerTest, TaskNamesWithSeparators) {
+  SystraceLineTokenizer tokenizer;
+  SystraceLine line;
+  ASSERT_TRUE(tokenizer
+                  .Tokenize("a-1 b-2 [3] (4)-5 ( 6) [007] .... 8.000000: "
+                            "x:y: z",
+                            &line)
+                  .ok());
+  EXPECT_EQ(line.task, "a-1 b-2 [3] (4)");
+  EXPECT_EQ(line.pid, 5u);
+  EXPECT_EQ(line.tgid_str, "6");
+  EXPECT_EQ(line.cpu, 7u);
+  EXPECT_EQ(line.event_name, "x:y");
+  EXPECT_EQ(line.args_str, "z");
+}
+
+TEST(SystraceLineTokenizerTest, Invalid) {
+  SystraceLineTokenizer tokenizer;
+  SystraceLine line;
+  EXPECT_FALSE(tokenizer.Tokenize("", &line).ok());
+  EXPECT_FALSE(tokenizer.Tokenize("task-1 [000] 1.0 name: args", &line).ok());
+  EXPECT_FALSE(tokenizer.Tokenize("task-1 [000] 1.0: name args", &line).ok());
+  EXPECT_FALSE(
+      tokenizer.Tokenize("task-1 [000] ...... 1.0: name: args", &line).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
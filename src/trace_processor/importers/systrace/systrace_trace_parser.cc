@@ -17,15 +17,16 @@
 #include "src/trace_processor/importers/systrace/systrace_trace_parser.h"
 
 #include "perfetto/base/logging.h"
-#include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/util/status_macros.h"
+
+#include <string.h>
 
 #include <cctype>
 #include <cinttypes>
 #include <string>
-#include <unordered_map>
 
 namespace perfetto {
 namespace trace_processor {
@@ -68,121 +69,139 @@ util::Status SystraceTraceParser::Parse(std::unique_ptr<uint8_t[]> owned_buf,
                                         size_t size) {
   if (state_ == ParseState::kEndOfSystrace)
     return util::OkStatus();
-  partial_buf_.insert(partial_buf_.end(), &owned_buf[0], &owned_buf[size]);
 
-  if (state_ == ParseState::kBeforeParse) {
-    state_ = partial_buf_[0] == '<' ? ParseState::kHtmlBeforeSystrace
-                                    : ParseState::kSystrace;
+  // Lines are parsed directly from |owned_buf|: only the lines which span
+  // across Parse() boundaries are copied into |partial_buf_|.
+  const char* start = reinterpret_cast<const char*>(owned_buf.get());
+  const char* end = start + size;
+  if (state_ == ParseState::kBeforeParse && size > 0) {
+    state_ = start[0] == '<' ? ParseState::kHtmlBeforeSystrace
+                             : ParseState::kSystrace;
+  }
+
+  if (!partial_buf_.empty()) {
+    const char* line_end = static_cast<const char*>(memchr(start, '\n', size));
+    if (!line_end) {
+      partial_buf_.insert(partial_buf_.end(), start, end);
+      return util::OkStatus();
+    }
+    partial_buf_.insert(partial_buf_.end(), start, line_end);
+    RETURN_IF_ERROR(ParseSingleLine(
+        base::StringView(partial_buf_.data(), partial_buf_.size())));
+    partial_buf_.clear();
+    start = line_end + 1;
+  }
+
+  while (state_ != ParseState::kEndOfSystrace) {
+    const char* line_end = static_cast<const char*>(
+        memchr(start, '\n', static_cast<size_t>(end - start)));
+    if (!line_end)
+      break;
+    RETURN_IF_ERROR(ParseSingleLine(
+        base::StringView(start, static_cast<size_t>(line_end - start))));
+    start = line_end + 1;
   }
+  if (state_ != ParseState::kEndOfSystrace)
+    partial_buf_.insert(partial_buf_.end(), start, end);
+  return util::OkStatus();
+}
 
+util::Status SystraceTraceParser::ParseSingleLine(base::StringView buffer) {
   // There can be multiple trace data sections in an HTML trace, we want to
   // ignore any that don't contain systrace data. In the future it would be
   // good to also parse the process dump section.
   const char kTraceDataSection[] =
       R"(<script class="trace-data" type="application/text">)";
-  auto start_it = partial_buf_.begin();
-  for (;;) {
-    auto line_it = std::find(start_it, partial_buf_.end(), '\n');
-    if (line_it == partial_buf_.end())
-      break;
-
-    std::string buffer(start_it, line_it);
-
-    if (state_ == ParseState::kHtmlBeforeSystrace) {
-      if (base::Contains(buffer, kTraceDataSection)) {
-        state_ = ParseState::kTraceDataSection;
+  const char kScriptEnd[] = R"(</script>)";
+  auto contains = [&buffer](const char* needle) {
+    return buffer.find(needle) != base::StringView::npos;
+  };
+
+  if (state_ == ParseState::kHtmlBeforeSystrace) {
+    if (contains(kTraceDataSection)) {
+      state_ = ParseState::kTraceDataSection;
+    }
+  } else if (state_ == ParseState::kTraceDataSection) {
+    if (buffer.StartsWith("#") && contains("TASK-PID")) {
+      state_ = ParseState::kSystrace;
+    } else if (buffer.StartsWith("PROCESS DUMP")) {
+      state_ = ParseState::kProcessDumpLong;
+    } else if (buffer.StartsWith("CGROUP DUMP")) {
+      state_ = ParseState::kCgroupDump;
+    } else if (contains(kScriptEnd)) {
+      state_ = ParseState::kHtmlBeforeSystrace;
+    }
+  } else if (state_ == ParseState::kSystrace) {
+    if (contains(kScriptEnd)) {
+      state_ = ParseState::kEndOfSystrace;
+    } else if (!buffer.StartsWith("#") && !buffer.empty()) {
+      util::Status status = line_tokenizer_.Tokenize(buffer, &line_);
+      if (status.ok()) {
+        line_parser_.ParseLine(line_);
+      } else {
+        ctx_->storage->IncrementStats(stats::systrace_parse_failure);
       }
-    } else if (state_ == ParseState::kTraceDataSection) {
-      if (base::StartsWith(buffer, "#") && base::Contains(buffer, "TASK-PID")) {
-        state_ = ParseState::kSystrace;
-      } else if (base::StartsWith(buffer, "PROCESS DUMP")) {
+    }
+  } else if (state_ == ParseState::kProcessDumpLong ||
+             state_ == ParseState::kProcessDumpShort) {
+    if (contains(kScriptEnd)) {
+      state_ = ParseState::kHtmlBeforeSystrace;
+    } else {
+      std::vector<base::StringView> tokens = SplitOnSpaces(buffer);
+      if (IsProcessDumpShortHeader(tokens)) {
+        state_ = ParseState::kProcessDumpShort;
+      } else if (IsProcessDumpLongHeader(tokens)) {
         state_ = ParseState::kProcessDumpLong;
-      } else if (base::StartsWith(buffer, "CGROUP DUMP")) {
-        state_ = ParseState::kCgroupDump;
-      } else if (base::Contains(buffer, R"(</script>)")) {
-        state_ = ParseState::kHtmlBeforeSystrace;
-      }
-    } else if (state_ == ParseState::kSystrace) {
-      if (base::Contains(buffer, R"(</script>)")) {
-        state_ = ParseState::kEndOfSystrace;
-        break;
-      } else if (!base::StartsWith(buffer, "#") && !buffer.empty()) {
-        SystraceLine line;
-        util::Status status = line_tokenizer_.Tokenize(buffer, &line);
-        if (status.ok()) {
-          line_parser_.ParseLine(std::move(line));
-        } else {
-          ctx_->storage->IncrementStats(stats::systrace_parse_failure);
+      } else if (state_ == ParseState::kProcessDumpLong &&
+                 tokens.size() >= 10) {
+        // Format is:
+        // user pid ppid vsz rss wchan pc s name my cmd line
+        const base::Optional<uint32_t> pid =
+            base::StringToUInt32(tokens[1].ToStdString());
+        const base::Optional<uint32_t> ppid =
+            base::StringToUInt32(tokens[2].ToStdString());
+        base::StringView name = tokens[8];
+        // Command line may contain spaces, merge all remaining tokens:
+        const char* cmd_start = tokens[9].data();
+        base::StringView cmd(cmd_start,
+                             static_cast<size_t>(buffer.end() - cmd_start));
+        if (!pid || !ppid) {
+          PERFETTO_ELOG("Could not parse line '%s'",
+                        buffer.ToStdString().c_str());
+          return util::ErrStatus("Could not parse PROCESS DUMP line");
         }
-      }
-    } else if (state_ == ParseState::kProcessDumpLong ||
-               state_ == ParseState::kProcessDumpShort) {
-      if (base::Contains(buffer, R"(</script>)")) {
-        state_ = ParseState::kHtmlBeforeSystrace;
-      } else {
-        std::vector<base::StringView> tokens =
-            SplitOnSpaces(base::StringView(buffer));
-        if (IsProcessDumpShortHeader(tokens)) {
-          state_ = ParseState::kProcessDumpShort;
-        } else if (IsProcessDumpLongHeader(tokens)) {
-          state_ = ParseState::kProcessDumpLong;
-        } else if (state_ == ParseState::kProcessDumpLong &&
-                   tokens.size() >= 10) {
-          // Format is:
-          // user pid ppid vsz rss wchan pc s name my cmd line
-          const base::Optional<uint32_t> pid =
-              base::StringToUInt32(tokens[1].ToStdString());
-          const base::Optional<uint32_t> ppid =
-              base::StringToUInt32(tokens[2].ToStdString());
-          base::StringView name = tokens[8];
-          // Command line may contain spaces, merge all remaining tokens:
-          const char* cmd_start = tokens[9].data();
-          base::StringView cmd(
-              cmd_start,
-              static_cast<size_t>((buffer.data() + buffer.size()) - cmd_start));
-          if (!pid || !ppid) {
-            PERFETTO_ELOG("Could not parse line '%s'", buffer.c_str());
-            return util::ErrStatus("Could not parse PROCESS DUMP line");
-          }
-          ctx_->process_tracker->SetProcessMetadata(pid.value(), ppid, name,
-                                                    base::StringView());
-        } else if (state_ == ParseState::kProcessDumpShort &&
-                   tokens.size() >= 4) {
-          // Format is:
-          // username pid tid my cmd line
-          const base::Optional<uint32_t> tgid =
-              base::StringToUInt32(tokens[1].ToStdString());
-          const base::Optional<uint32_t> tid =
-              base::StringToUInt32(tokens[2].ToStdString());
-          // Command line may contain spaces, merge all remaining tokens:
-          const char* cmd_start = tokens[3].data();
-          base::StringView cmd(
-              cmd_start,
-              static_cast<size_t>((buffer.data() + buffer.size()) - cmd_start));
-          StringId cmd_id =
-              ctx_->storage->mutable_string_pool()->InternString(cmd);
-          if (!tid || !tgid) {
-            PERFETTO_ELOG("Could not parse line '%s'", buffer.c_str());
-            return util::ErrStatus("Could not parse PROCESS DUMP line");
-          }
-          UniqueTid utid =
-              ctx_->process_tracker->UpdateThread(tid.value(), tgid.value());
-          ctx_->process_tracker->UpdateThreadNameByUtid(
-              utid, cmd_id, ThreadNamePriority::kOther);
+        ctx_->process_tracker->SetProcessMetadata(pid.value(), ppid, name,
+                                                  base::StringView());
+      } else if (state_ == ParseState::kProcessDumpShort &&
+                 tokens.size() >= 4) {
+        // Format is:
+        // username pid tid my cmd line
+        const base::Optional<uint32_t> tgid =
+            base::StringToUInt32(tokens[1].ToStdString());
+        const base::Optional<uint32_t> tid =
+            base::StringToUInt32(tokens[2].ToStdString());
+        // Command line may contain spaces, merge all remaining tokens:
+        const char* cmd_start = tokens[3].data();
+        base::StringView cmd(cmd_start,
+                             static_cast<size_t>(buffer.end() - cmd_start));
+        StringId cmd_id =
+            ctx_->storage->mutable_string_pool()->InternString(cmd);
+        if (!tid || !tgid) {
+          PERFETTO_ELOG("Could not parse line '%s'",
+                        buffer.ToStdString().c_str());
+          return util::ErrStatus("Could not parse PROCESS DUMP line");
         }
+        UniqueTid utid =
+            ctx_->process_tracker->UpdateThread(tid.value(), tgid.value());
+        ctx_->process_tracker->UpdateThreadNameByUtid(
+            utid, cmd_id, ThreadNamePriority::kOther);
       }
-    } else if (state_ == ParseState::kCgroupDump) {
-      if (base::Contains(buffer, R"(</script>)")) {
-        state_ = ParseState::kHtmlBeforeSystrace;
-      }
-      // TODO(lalitm): see if it is important to parse this.
     }
-    start_it = line_it + 1;
-  }
-  if (state_ == ParseState::kEndOfSystrace) {
-    partial_buf_.clear();
-  } else {
-    partial_buf_.erase(partial_buf_.begin(), start_it);
+  } else if (state_ == ParseState::kCgroupDump) {
+    if (contains(kScriptEnd)) {
+      state_ = ParseState::kHtmlBeforeSystrace;
+    }
+    // TODO(lalitm): see if it is important to parse this.
   }
   return util::OkStatus();
 }
@@ -17,8 +17,9 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_TRACE_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_TRACE_PARSER_H_
 
-#include <deque>
-#include <regex>
+#include <vector>
+
+#include "perfetto/ext/base/string_view.h"
 
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/systrace/systrace_line_parser.h"
@@ -50,13 +51,21 @@ class SystraceTraceParser : public ChunkedTraceReader {
     kEndOfSystrace,
   };
 
+  // Parses a single line of the trace (without its trailing newline).
+  util::Status ParseSingleLine(base::StringView line);
+
   ParseState state_ = ParseState::kBeforeParse;
 
-  // Used to glue together trace packets that span across two (or more)
-  // Parse() boundaries.
-  std::deque<uint8_t> partial_buf_;
+  // Used to glue together lines that span across two (or more) Parse()
+  // boundaries.
+  std::vector<char> partial_buf_;
 
   SystraceLineTokenizer line_tokenizer_;
+
+  // Reused for all the lines of the trace to avoid allocating its strings for
+  // each line.
+  SystraceLine line_;
+
   SystraceLineParser line_parser_;
   TraceProcessorContext* ctx_;
 };
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks of the end-to-end ingestion (tokenization, sorting and parsing)
+// of synthetic traces which are representative of the main importers.
+// Each benchmark reports the ingestion throughput (bytes/s and events/s) and
+// the peak RSS of the process.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_processor.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/profiling/heap_graph.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_packet.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/track_event/thread_descriptor.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_descriptor.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// Traces are passed to the trace processor in chunks of this size, like the
+// shell does when reading a trace file.
+constexpr size_t kChunkSize = 512 * 1024;
+
+constexpr uint32_t kNumCpus = 8;
+constexpr uint32_t kSeqFlagsCleared = 1;  // SEQ_INCREMENTAL_STATE_CLEARED.
+constexpr uint32_t kSeqFlagsNeedsState = 2;  // SEQ_NEEDS_INCREMENTAL_STATE.
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// The argument is the number of events in the synthetic trace.
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(1024);
+  } else {
+    b->RangeMultiplier(8)->Range(1 << 12, 1 << 18);
+  }
+  b->Unit(benchmark::kMillisecond);
+}
+
+// Returns the peak resident set size of the process in bytes or 0 if it is
+// not available on this platform.
+uint64_t GetPeakRssBytes() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  FILE* f = fopen("/proc/self/status", "r");
+  if (!f)
+    return 0;
+  uint64_t peak_kb = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "VmHWM:", 6) == 0) {
+      peak_kb = strtoull(line + 6, nullptr, 10);
+      break;
+    }
+  }
+  fclose(f);
+  return peak_kb * 1024;
+#else
+  return 0;
+#endif
+}
+
+struct SyntheticTrace {
+  std::vector<uint8_t> data;
+  uint64_t num_events = 0;
+};
+
+SyntheticTrace ToTrace(protozero::HeapBuffered<protos::pbzero::Trace>* trace,
+                       uint64_t num_events) {
+  SyntheticTrace res;
+  res.data = trace->SerializeAsArray();
+  res.num_events = num_events;
+  return res;
+}
+
+// Parses |trace| in a fresh TraceProcessor instance on each iteration and
+// reports the throughput and the peak RSS.
+void RunIngestionBenchmark(benchmark::State& state,
+                           const SyntheticTrace& trace) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<TraceProcessor> tp =
+        TraceProcessor::CreateInstance(Config());
+    std::vector<std::pair<std::unique_ptr<uint8_t[]>, size_t>> chunks;
+    for (size_t off = 0; off < trace.data.size(); off += kChunkSize) {
+      size_t size = std::min(kChunkSize, trace.data.size() - off);
+      std::unique_ptr<uint8_t[]> chunk(new uint8_t[size]);
+      memcpy(chunk.get(), trace.data.data() + off, size);
+      chunks.emplace_back(std::move(chunk), size);
+    }
+    state.ResumeTiming();
+
+    for (auto& chunk : chunks) {
+      util::Status status = tp->Parse(std::move(chunk.first), chunk.second);
+      if (!status.ok()) {
+        state.SkipWithError(status.c_message());
+        break;
+      }
+    }
+    tp->NotifyEndOfFile();
+
+    state.PauseTiming();
+    tp.reset();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(trace.data.size()));
+  state.counters["events/s"] = benchmark::Counter(
+      static_cast<double>(trace.num_events) *
+          static_cast<double>(state.iterations()),
+      benchmark::Counter::kIsRate);
+  state.counters["peak_rss_mb"] =
+      static_cast<double>(GetPeakRssBytes()) / (1024 * 1024);
+}
+
+// sched_switch and sched_waking events in the compact format used by
+// traced_probes, spread across |num_cpus| CPUs.
+SyntheticTrace CreateCompactSchedTrace(uint32_t num_events,
+                                       uint32_t num_cpus = kNumCpus) {
+  static constexpr uint32_t kEventsPerBundle = 1024;
+  static constexpr uint32_t kNumThreads = 256;
+
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  uint64_t ts = 1000;
+  for (uint32_t i = 0; i < num_events; i += kEventsPerBundle) {
+    uint32_t cpu = (i / kEventsPerBundle) % num_cpus;
+    uint32_t count = std::min(kEventsPerBundle, num_events - i);
+
+    protozero::PackedVarInt switch_ts, prev_state, next_pid, next_prio, comm;
+    protozero::PackedVarInt waking_ts, waking_pid, target_cpu, waking_prio,
+        waking_comm;
+    uint32_t num_switches = count / 2;
+    for (uint32_t j = 0; j < num_switches; ++j) {
+      uint32_t tid = 1000 + (i + j) * 7 % kNumThreads;
+      // Timestamps are delta encoded, the first one relative to 0.
+      switch_ts.Append(j == 0 ? ts : 1000);
+      prev_state.Append(j % 3 == 0 ? 0 : 1);
+      next_pid.Append(tid);
+      next_prio.Append(120);
+      comm.Append(tid % 16);
+    }
+    for (uint32_t j = num_switches; j < count; ++j) {
+      uint32_t tid = 1000 + (i + j) * 13 % kNumThreads;
+      waking_ts.Append(j == num_switches ? ts + 500 : 1000);
+      waking_pid.Append(tid);
+      target_cpu.Append(j % num_cpus);
+      waking_prio.Append(120);
+      waking_comm.Append(tid % 16);
+    }
+
+    auto* packet = trace->add_packet();
+    auto* bundle = packet->set_ftrace_events();
+    bundle->set_cpu(cpu);
+    auto* compact = bundle->set_compact_sched();
+    for (uint32_t c = 0; c < 16; ++c)
+      compact->add_intern_table("thread_" + std::to_string(c));
+    compact->set_switch_timestamp(switch_ts);
+    compact->set_switch_prev_state(prev_state);
+    compact->set_switch_next_pid(next_pid);
+    compact->set_switch_next_prio(next_prio);
+    compact->set_switch_next_comm_index(comm);
+    compact->set_waking_timestamp(waking_ts);
+    compact->set_waking_pid(waking_pid);
+    compact->set_waking_target_cpu(target_cpu);
+    compact->set_waking_prio(waking_prio);
+    compact->set_waking_comm_index(waking_comm);
+    ts += 1000 * num_switches;
+  }
+  return ToTrace(&trace, num_events);
+}
+
+// Nested begin/end slices on a few threads, with interned names and
+// categories.
+SyntheticTrace CreateTrackEventTrace(uint32_t num_events) {
+  static constexpr uint32_t kNumThreads = 16;
+  static constexpr uint32_t kNumNames = 64;
+  static constexpr uint32_t kDepth = 8;
+
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  for (uint32_t t = 0; t < kNumThreads; ++t) {
+    auto* packet = trace->add_packet();
+    packet->set_trusted_packet_sequence_id(t + 1);
+    packet->set_sequence_flags(kSeqFlagsCleared);
+    auto* desc = packet->set_track_descriptor();
+    desc->set_uuid(t + 1);
+    auto* thread = desc->set_thread();
+    thread->set_pid(1);
+    thread->set_tid(static_cast<int32_t>(t + 2));
+
+    auto* interned = packet->set_interned_data();
+    auto* cat = interned->add_event_categories();
+    cat->set_iid(1);
+    cat->set_name("cat");
+    for (uint32_t n = 0; n < kNumNames; ++n) {
+      auto* name = interned->add_event_names();
+      name->set_iid(n + 1);
+      name->set_name("slice_" + std::to_string(n));
+    }
+  }
+
+  uint64_t ts = 1000;
+  uint32_t emitted = 0;
+  while (emitted < num_events) {
+    uint32_t t = (emitted / (2 * kDepth)) % kNumThreads;
+    for (uint32_t d = 0; d < 2 * kDepth && emitted < num_events; ++d) {
+      bool begin = d < kDepth;
+      auto* packet = trace->add_packet();
+      packet->set_timestamp(ts++);
+      packet->set_trusted_packet_sequence_id(t + 1);
+      packet->set_sequence_flags(kSeqFlagsNeedsState);
+      auto* event = packet->set_track_event();
+      event->set_track_uuid(t + 1);
+      if (begin) {
+        event->set_type(protos::pbzero::TrackEvent::TYPE_SLICE_BEGIN);
+        event->add_category_iids(1);
+        event->set_name_iid((emitted + d) % kNumNames + 1);
+      } else {
+        event->set_type(protos::pbzero::TrackEvent::TYPE_SLICE_END);
+      }
+      emitted++;
+    }
+  }
+  return ToTrace(&trace, num_events);
+}
+
+// A Java heap graph of |num_objects| objects where each object references
+// the next two ones.
+SyntheticTrace CreateHeapGraphTrace(uint32_t num_objects) {
+  static constexpr uint32_t kObjectsPerPacket = 4096;
+  static constexpr uint32_t kNumTypes = 128;
+
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  uint32_t num_packets =
+      std::max((num_objects + kObjectsPerPacket - 1) / kObjectsPerPacket, 1u);
+  for (uint32_t p = 0; p < num_packets; ++p) {
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(1000);
+    packet->set_trusted_packet_sequence_id(1);
+    auto* graph = packet->set_heap_graph();
+    graph->set_pid(2);
+    graph->set_index(p);
+    graph->set_continued(p + 1 < num_packets);
+
+    if (p == 0) {
+      for (uint32_t t = 0; t < kNumTypes; ++t) {
+        auto* type = graph->add_types();
+        type->set_id(t + 1);
+        type->set_class_name("com.example.Class" + std::to_string(t));
+        type->set_object_size(16 + t % 8 * 8);
+      }
+      auto* field = graph->add_field_names();
+      field->set_iid(1);
+      field->set_str("Object next");
+      auto* root = graph->add_roots();
+      protozero::PackedVarInt root_ids;
+      root_ids.Append(1);
+      root->set_object_ids(root_ids);
+      root->set_root_type(protos::pbzero::HeapGraphRoot::ROOT_JAVA_FRAME);
+    }
+
+    uint32_t start = p * kObjectsPerPacket;
+    uint32_t end = std::min(start + kObjectsPerPacket, num_objects);
+    for (uint32_t o = start; o < end; ++o) {
+      auto* object = graph->add_objects();
+      object->set_id(o + 1);
+      object->set_type_id(o % kNumTypes + 1);
+      object->set_self_size(32);
+      protozero::PackedVarInt field_ids, object_ids;
+      for (uint32_t r = 1; r <= 2; ++r) {
+        if (o + r < num_objects) {
+          field_ids.Append(1);
+          object_ids.Append(o + r + 1);
+        }
+      }
+      object->set_reference_field_id(field_ids);
+      object->set_reference_object_id(object_ids);
+    }
+  }
+  return ToTrace(&trace, num_objects);
+}
+
+// Perf samples of a few processes with interned callstacks.
+SyntheticTrace CreatePerfSampleTrace(uint32_t num_events) {
+  static constexpr uint32_t kNumFrames = 256;
+  static constexpr uint32_t kNumCallstacks = 512;
+  static constexpr uint32_t kStackDepth = 16;
+
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  {
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(1000);
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_sequence_flags(kSeqFlagsCleared);
+    auto* interned = packet->set_interned_data();
+
+    auto* build_id = interned->add_build_ids();
+    build_id->set_iid(1);
+    build_id->set_str("0123456789abcdef");
+    auto* path = interned->add_mapping_paths();
+    path->set_iid(1);
+    path->set_str("libexample.so");
+    auto* mapping = interned->add_mappings();
+    mapping->set_iid(1);
+    mapping->set_build_id(1);
+    mapping->add_path_string_ids(1);
+    mapping->set_start(0x10000);
+    mapping->set_end(0x90000);
+
+    for (uint32_t f = 0; f < kNumFrames; ++f) {
+      auto* name = interned->add_function_names();
+      name->set_iid(f + 1);
+      name->set_str("Function" + std::to_string(f));
+      auto* frame = interned->add_frames();
+      frame->set_iid(f + 1);
+      frame->set_function_name_id(f + 1);
+      frame->set_mapping_id(1);
+      frame->set_rel_pc(0x100 + f * 0x10);
+    }
+    for (uint32_t c = 0; c < kNumCallstacks; ++c) {
+      auto* callstack = interned->add_callstacks();
+      callstack->set_iid(c + 1);
+      for (uint32_t d = 0; d < kStackDepth; ++d)
+        callstack->add_frame_ids((c * 7 + d * 13) % kNumFrames + 1);
+    }
+  }
+
+  for (uint32_t i = 0; i < num_events; ++i) {
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(2000 + i * 100);
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_sequence_flags(kSeqFlagsNeedsState);
+    auto* sample = packet->set_perf_sample();
+    uint32_t pid = 100 + i % 4;
+    sample->set_cpu(i % kNumCpus);
+    sample->set_pid(pid);
+    sample->set_tid(pid + i % 8);
+    sample->set_callstack_iid(i % kNumCallstacks + 1);
+    sample->set_cpu_mode(protos::pbzero::Profiling::MODE_USER);
+    sample->set_timebase_count(i);
+  }
+  return ToTrace(&trace, num_events);
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+// Nested begin/end slices in the Chrome JSON format.
+SyntheticTrace CreateJsonTrace(uint32_t num_events) {
+  std::string json = "{\"traceEvents\":[\n";
+  for (uint32_t i = 0; i < num_events; ++i) {
+    bool begin = i % 8 < 4;
+    uint32_t tid = 2 + (i / 8) % 16;
+    if (i > 0)
+      json += ",\n";
+    json += "{\"name\":\"slice_" + std::to_string(i % 64) +
+            "\",\"cat\":\"cat\",\"ph\":\"" + (begin ? "B" : "E") +
+            "\",\"ts\":" + std::to_string(1000 + i) +
+            ",\"pid\":1,\"tid\":" + std::to_string(tid) + "}";
+  }
+  json += "\n]}\n";
+  SyntheticTrace res;
+  res.data.assign(json.begin(), json.end());
+  res.num_events = num_events;
+  return res;
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+
+// sched_switch events and atrace slices in the ftrace text format.
+SyntheticTrace CreateSystraceTrace(uint32_t num_events) {
+  std::string text =
+      "# tracer: nop\n"
+      "#\n"
+      "#           TASK-PID    TGID   CPU#  ||||    TIMESTAMP  FUNCTION\n";
+  char line[512];
+  for (uint32_t i = 0; i < num_events; ++i) {
+    uint32_t cpu = i % kNumCpus;
+    uint32_t prev_pid = 1000 + i % 64;
+    uint32_t next_pid = 1000 + (i + 1) % 64;
+    double ts = 1000.0 + i * 1e-5;
+    int len;
+    if (i % 2 == 0) {
+      len = snprintf(line, sizeof(line),
+                     "     thread-%u  ( %u) [%03u] d..2 %.6f: sched_switch: "
+                     "prev_comm=thread-%u prev_pid=%u prev_prio=120 "
+                     "prev_state=S ==> next_comm=thread-%u next_pid=%u "
+                     "next_prio=120\n",
+                     prev_pid, 1, cpu, ts, prev_pid, prev_pid, next_pid,
+                     next_pid);
+    } else if (i % 4 == 1) {
+      len = snprintf(line, sizeof(line),
+                     "     thread-%u  ( %u) [%03u] ...1 %.6f: "
+                     "tracing_mark_write: B|%u|slice_%u\n",
+                     next_pid, 1, cpu, ts, next_pid, i % 64);
+    } else {
+      len = snprintf(line, sizeof(line),
+                     "     thread-%u  ( %u) [%03u] ...1 %.6f: "
+                     "tracing_mark_write: E|%u\n",
+                     next_pid, 1, cpu, ts, next_pid);
+    }
+    PERFETTO_CHECK(len > 0 && static_cast<size_t>(len) < sizeof(line));
+    text.append(line, static_cast<size_t>(len));
+  }
+  SyntheticTrace res;
+  res.data.assign(text.begin(), text.end());
+  res.num_events = num_events;
+  return res;
+}
+
+}  // namespace
+
+static void BM_IngestCompactSched(benchmark::State& state) {
+  RunIngestionBenchmark(
+      state, CreateCompactSchedTrace(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_IngestCompactSched)->Apply(BenchmarkArgs);
+
+// Same as above on a large server, with up to 64 sched slices pending at once.
+static void BM_IngestCompactSched64Cpus(benchmark::State& state) {
+  RunIngestionBenchmark(
+      state,
+      CreateCompactSchedTrace(static_cast<uint32_t>(state.range(0)), 64));
+}
+BENCHMARK(BM_IngestCompactSched64Cpus)->Apply(BenchmarkArgs);
+
+static void BM_IngestTrackEvent(benchmark::State& state) {
+  RunIngestionBenchmark(
+      state, CreateTrackEventTrace(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_IngestTrackEvent)->Apply(BenchmarkArgs);
+
+static void BM_IngestHeapGraph(benchmark::State& state) {
+  RunIngestionBenchmark(
+      state, CreateHeapGraphTrace(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_IngestHeapGraph)->Apply(BenchmarkArgs);
+
+static void BM_IngestPerfSample(benchmark::State& state) {
+  RunIngestionBenchmark(
+      state, CreatePerfSampleTrace(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_IngestPerfSample)->Apply(BenchmarkArgs);
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+static void BM_IngestJson(benchmark::State& state) {
+  RunIngestionBenchmark(
+      state, CreateJsonTrace(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_IngestJson)->Apply(BenchmarkArgs);
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+
+static void BM_IngestSystrace(benchmark::State& state) {
+  RunIngestionBenchmark(
+      state, CreateSystraceTrace(static_cast<uint32_t>(state.range(0))));
+}
+BENCHMARK(BM_IngestSystrace)->Apply(BenchmarkArgs);
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -29,30 +29,63 @@ IteratorImpl::IteratorImpl(TraceProcessorImpl* trace_processor,
                            ScopedStmt stmt,
                            uint32_t column_count,
                            util::Status status,
-                           uint32_t sql_stats_row)
+                           uint32_t sql_stats_row,
+                           std::unique_ptr<DirectTableQuery> direct_query,
+                           QueryInterrupter* interrupter,
+                           uint64_t interrupter_query_id,
+                           std::unique_ptr<QueryProfiler> profiler)
     : trace_processor_(trace_processor),
       db_(db),
       stmt_(std::move(stmt)),
       column_count_(column_count),
+      direct_query_(std::move(direct_query)),
       status_(std::move(status)),
-      sql_stats_row_(sql_stats_row) {}
+      sql_stats_row_(sql_stats_row),
+      interrupter_(interrupter),
+      interrupter_query_id_(interrupter_query_id),
+      profiler_(std::move(profiler)) {}
 
 IteratorImpl::~IteratorImpl() {
   if (trace_processor_) {
+    // |trace_processor_| is only null for moved-from iterators.
+    if (interrupter_)
+      interrupter_->Stop(interrupter_query_id_);
+    // Statements which failed are not reused as they could fail again.
+    if (statement_cache_ &&
+        (status_.ok() ||
+         interruption_ != QueryInterrupter::Reason::kNone)) {
+      direct_query_.reset();
+      statement_cache_->Put(std::move(cache_sql_), std::move(stmt_));
+    }
     base::TimeNanos t_end = base::GetWallTimeNs();
-    auto* sql_stats =
-        trace_processor_.get()->context_.storage->mutable_sql_stats();
+    auto* sql_stats = trace_processor_.get()->sql_stats_;
     sql_stats->RecordQueryEnd(sql_stats_row_, t_end.count());
+    if (profiler_)
+      FinishProfile();
   }
 }
 
+void IteratorImpl::FinishProfile() {
+  trace_processor_.get()->last_query_profile_ = std::move(profiler_);
+}
+
+void IteratorImpl::ReturnStatementToCache(StatementCache* cache,
+                                          std::string sql) {
+  statement_cache_ = cache;
+  cache_sql_ = std::move(sql);
+}
+
 void IteratorImpl::RecordFirstNextInSqlStats() {
   base::TimeNanos t_first_next = base::GetWallTimeNs();
-  auto* sql_stats =
-      trace_processor_.get()->context_.storage->mutable_sql_stats();
+  auto* sql_stats = trace_processor_.get()->sql_stats_;
   sql_stats->RecordQueryFirstNext(sql_stats_row_, t_first_next.count());
 }
 
+void IteratorImpl::OnInterrupted() {
+  interruption_ = interrupter_->reason();
+  status_ = interrupter_->InterruptionStatus();
+}
+
 Iterator::Iterator(std::unique_ptr<IteratorImpl> iterator)
     : iterator_(std::move(iterator)) {}
 Iterator::~Iterator() = default;
@@ -80,5 +113,9 @@ util::Status Iterator::Status() {
   return iterator_->Status();
 }
 
+bool Iterator::IsReadOnly() {
+  return iterator_->IsReadOnly();
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -20,6 +20,7 @@
 #include <sqlite3.h>
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "perfetto/base/build_config.h"
@@ -27,7 +28,11 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/iterator.h"
 #include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/db/query_profiler.h"
+#include "src/trace_processor/sqlite/direct_table_query.h"
+#include "src/trace_processor/sqlite/query_interrupter.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/statement_cache.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -41,7 +46,11 @@ class IteratorImpl {
                ScopedStmt,
                uint32_t column_count,
                util::Status,
-               uint32_t sql_stats_row);
+               uint32_t sql_stats_row,
+               std::unique_ptr<DirectTableQuery> direct_query = nullptr,
+               QueryInterrupter* interrupter = nullptr,
+               uint64_t interrupter_query_id = 0,
+               std::unique_ptr<QueryProfiler> profiler = nullptr);
   ~IteratorImpl();
 
   IteratorImpl(IteratorImpl&) noexcept = delete;
@@ -61,15 +70,37 @@ class IteratorImpl {
     if (!status_.ok())
       return false;
 
-    int ret = sqlite3_step(*stmt_);
-    if (PERFETTO_UNLIKELY(ret != SQLITE_ROW && ret != SQLITE_DONE)) {
-      status_ = util::ErrStatus("%s", sqlite3_errmsg(db_));
+    // The work done by SQLite for the query is recorded in its profile.
+    QueryProfiler::ScopedActivation profile(profiler_.get());
+    bool has_row;
+    if (direct_query_) {
+      has_row = direct_query_->Next();
+    } else {
+      int ret = sqlite3_step(*stmt_);
+      if (PERFETTO_UNLIKELY(ret != SQLITE_ROW && ret != SQLITE_DONE)) {
+        status_ = util::ErrStatus("%s", sqlite3_errmsg(db_));
+        // The error is usually a consequence of the interruption.
+        if (interrupter_ && interrupter_->reason() !=
+                                QueryInterrupter::Reason::kNone) {
+          OnInterrupted();
+        }
+        return false;
+      }
+      has_row = ret == SQLITE_ROW;
+    }
+    if (PERFETTO_UNLIKELY(interrupter_) && has_row && !interrupter_->AddRow()) {
+      OnInterrupted();
       return false;
     }
-    return ret == SQLITE_ROW;
+    if (PERFETTO_UNLIKELY(profiler_) && !has_row)
+      FinishProfile();
+    return has_row;
   }
 
   SqlValue Get(uint32_t col) {
+    if (direct_query_)
+      return direct_query_->Get(col);
+
     auto column = static_cast<int>(col);
     auto col_type = sqlite3_column_type(*stmt_, column);
     SqlValue value;
@@ -108,6 +139,17 @@ class IteratorImpl {
 
   util::Status Status() { return status_; }
 
+  bool IsReadOnly() {
+    return status_.ok() && stmt_ && sqlite3_stmt_readonly(*stmt_) != 0;
+  }
+
+  // Why the query was interrupted, if it was started with a budget.
+  QueryInterrupter::Reason interruption() const { return interruption_; }
+
+  // Makes the iterator give its statement, prepared from |sql|, back to
+  // |cache| when it is destroyed.
+  void ReturnStatementToCache(StatementCache* cache, std::string sql);
+
  private:
   // Dummy function to pass to ScopedResource.
   static int DummyClose(TraceProcessorImpl*) { return 0; }
@@ -122,15 +164,36 @@ class IteratorImpl {
       base::ScopedResource<TraceProcessorImpl*, &DummyClose, nullptr>;
 
   void RecordFirstNextInSqlStats();
+  void OnInterrupted();
+
+  // Makes |profiler_| the last query profile of |trace_processor_|.
+  void FinishProfile();
 
   ScopedTraceProcessor trace_processor_;
   sqlite3* db_ = nullptr;
   ScopedStmt stmt_;
   uint32_t column_count_ = 0;
+
+  // If set, the rows are read from here and |stmt_| is never stepped.
+  std::unique_ptr<DirectTableQuery> direct_query_;
   util::Status status_;
 
   uint32_t sql_stats_row_ = 0;
   bool called_next_ = false;
+
+  // Set for the queries run with a budget. It is stopped when the iterator is
+  // destroyed, unless another query has been started with it since.
+  QueryInterrupter* interrupter_ = nullptr;
+  uint64_t interrupter_query_id_ = 0;
+  QueryInterrupter::Reason interruption_ = QueryInterrupter::Reason::kNone;
+
+  // Set for the profiled queries until all the rows have been read or the
+  // iterator is destroyed, see FinishProfile().
+  std::unique_ptr<QueryProfiler> profiler_;
+
+  // Set for the queries run with args, see ReturnStatementToCache().
+  StatementCache* statement_cache_ = nullptr;
+  std::string cache_sql_;
 };
 
 }  // namespace trace_processor
@@ -282,9 +282,8 @@ CREATE TABLE binder_to_destination_process AS
 SELECT
   s.slice_id, process.name AS destination_process
 FROM long_binder_transactions s
-JOIN args USING(arg_set_id)
-JOIN process ON(args.int_value = process.pid)
-WHERE args.key = 'destination process';
+JOIN binder_txn USING(slice_id)
+JOIN process ON(binder_txn.dest_tgid = process.pid);
 
 -- Enriched binder transactions.
 DROP TABLE IF EXISTS long_binder_transactions_enriched;
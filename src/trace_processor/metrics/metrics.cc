@@ -16,12 +16,18 @@
 
 #include "src/trace_processor/metrics/metrics.h"
 
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
 #include <regex>
 #include <unordered_map>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "src/trace_processor/metrics/sql_metrics.h"
 #include "src/trace_processor/tp_metatrace.h"
@@ -30,6 +36,19 @@
 #include "protos/perfetto/common/descriptor.pbzero.h"
 #include "protos/perfetto/trace_processor/metrics_impl.pbzero.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <dirent.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/pipe.h"
+#include "perfetto/ext/base/scoped_file.h"
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 namespace metrics {
@@ -124,6 +143,17 @@ base::Status ValidateSingleNonEmptyMessage(const uint8_t* ptr,
   return base::OkStatus();
 }
 
+// Returns the size of the |field_id| tag and of the varint |value| following
+// it (e.g. the length of a length-delimited field).
+size_t TagAndVarIntSize(uint32_t field_id, uint64_t value) {
+  size_t size = 2;
+  for (uint32_t tag = field_id << 3; tag >= 0x80; tag >>= 7)
+    size++;
+  for (; value >= 0x80; value >>= 7)
+    size++;
+  return size;
+}
+
 }  // namespace
 
 ProtoBuilder::ProtoBuilder(const DescriptorPool* pool,
@@ -161,28 +191,32 @@ base::Status ProtoBuilder::AppendLong(const std::string& field_name,
                            descriptor_->full_name().c_str());
   }
 
-  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
   if (field->is_repeated() && !is_inside_repeated) {
     return base::ErrStatus(
         "Unexpected long value for repeated field %s in proto type %s",
         field_name.c_str(), descriptor_->full_name().c_str());
   }
+  return AppendLongField(*field, value);
+}
 
-  switch (field->type()) {
+base::Status ProtoBuilder::AppendLongField(const FieldDescriptor& field,
+                                           int64_t value) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+  switch (field.type()) {
     case FieldDescriptorProto::TYPE_INT32:
     case FieldDescriptorProto::TYPE_INT64:
     case FieldDescriptorProto::TYPE_UINT32:
     case FieldDescriptorProto::TYPE_BOOL:
-      message_->AppendVarInt(field->number(), value);
+      message_->AppendVarInt(field.number(), value);
       break;
     case FieldDescriptorProto::TYPE_ENUM: {
       auto opt_enum_descriptor_idx =
-          pool_->FindDescriptorIdx(field->resolved_type_name());
+          pool_->FindDescriptorIdx(field.resolved_type_name());
       if (!opt_enum_descriptor_idx) {
         return base::ErrStatus(
             "Unable to find enum type %s to fill field %s (in proto message "
             "%s)",
-            field->resolved_type_name().c_str(), field->name().c_str(),
+            field.resolved_type_name().c_str(), field.name().c_str(),
             descriptor_->full_name().c_str());
       }
       const auto& enum_desc = pool_->descriptors()[*opt_enum_descriptor_idx];
@@ -192,35 +226,35 @@ base::Status ProtoBuilder::AppendLong(const std::string& field_name,
                                " "
                                "in enum type %s; encountered while filling "
                                "field %s (in proto message %s)",
-                               value, field->resolved_type_name().c_str(),
-                               field->name().c_str(),
+                               value, field.resolved_type_name().c_str(),
+                               field.name().c_str(),
                                descriptor_->full_name().c_str());
       }
-      message_->AppendVarInt(field->number(), value);
+      message_->AppendVarInt(field.number(), value);
       break;
     }
     case FieldDescriptorProto::TYPE_SINT32:
     case FieldDescriptorProto::TYPE_SINT64:
-      message_->AppendSignedVarInt(field->number(), value);
+      message_->AppendSignedVarInt(field.number(), value);
       break;
     case FieldDescriptorProto::TYPE_FIXED32:
     case FieldDescriptorProto::TYPE_SFIXED32:
     case FieldDescriptorProto::TYPE_FIXED64:
     case FieldDescriptorProto::TYPE_SFIXED64:
-      message_->AppendFixed(field->number(), value);
+      message_->AppendFixed(field.number(), value);
       break;
     case FieldDescriptorProto::TYPE_UINT64:
       return base::ErrStatus(
           "Field %s (in proto message %s) is using a uint64 type. uint64 in "
           "metric messages is not supported by trace processor; use an int64 "
           "field instead.",
-          field->name().c_str(), descriptor_->full_name().c_str());
+          field.name().c_str(), descriptor_->full_name().c_str());
     default: {
       return base::ErrStatus(
           "Tried to write value of type long into field %s (in proto type %s) "
           "which has type %d",
-          field->name().c_str(), descriptor_->full_name().c_str(),
-          field->type());
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.type());
     }
   }
   return base::OkStatus();
@@ -236,20 +270,24 @@ base::Status ProtoBuilder::AppendDouble(const std::string& field_name,
                            descriptor_->full_name().c_str());
   }
 
-  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
   if (field->is_repeated() && !is_inside_repeated) {
     return base::ErrStatus(
         "Unexpected double value for repeated field %s in proto type %s",
         field_name.c_str(), descriptor_->full_name().c_str());
   }
+  return AppendDoubleField(*field, value);
+}
 
-  switch (field->type()) {
+base::Status ProtoBuilder::AppendDoubleField(const FieldDescriptor& field,
+                                             double value) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+  switch (field.type()) {
     case FieldDescriptorProto::TYPE_FLOAT:
     case FieldDescriptorProto::TYPE_DOUBLE: {
-      if (field->type() == FieldDescriptorProto::TYPE_FLOAT) {
-        message_->AppendFixed(field->number(), static_cast<float>(value));
+      if (field.type() == FieldDescriptorProto::TYPE_FLOAT) {
+        message_->AppendFixed(field.number(), static_cast<float>(value));
       } else {
-        message_->AppendFixed(field->number(), value);
+        message_->AppendFixed(field.number(), value);
       }
       break;
     }
@@ -257,8 +295,8 @@ base::Status ProtoBuilder::AppendDouble(const std::string& field_name,
       return base::ErrStatus(
           "Tried to write value of type double into field %s (in proto type "
           "%s) which has type %d",
-          field->name().c_str(), descriptor_->full_name().c_str(),
-          field->type());
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.type());
     }
   }
   return base::OkStatus();
@@ -274,26 +312,30 @@ base::Status ProtoBuilder::AppendString(const std::string& field_name,
                            descriptor_->full_name().c_str());
   }
 
-  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
   if (field->is_repeated() && !is_inside_repeated) {
     return base::ErrStatus(
         "Unexpected string value for repeated field %s in proto type %s",
         field_name.c_str(), descriptor_->full_name().c_str());
   }
+  return AppendStringField(*field, data);
+}
 
-  switch (field->type()) {
+base::Status ProtoBuilder::AppendStringField(const FieldDescriptor& field,
+                                             base::StringView data) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+  switch (field.type()) {
     case FieldDescriptorProto::TYPE_STRING: {
-      message_->AppendBytes(field->number(), data.data(), data.size());
+      message_->AppendBytes(field.number(), data.data(), data.size());
       break;
     }
     case FieldDescriptorProto::TYPE_ENUM: {
       auto opt_enum_descriptor_idx =
-          pool_->FindDescriptorIdx(field->resolved_type_name());
+          pool_->FindDescriptorIdx(field.resolved_type_name());
       if (!opt_enum_descriptor_idx) {
         return base::ErrStatus(
             "Unable to find enum type %s to fill field %s (in proto message "
             "%s)",
-            field->resolved_type_name().c_str(), field->name().c_str(),
+            field.resolved_type_name().c_str(), field.name().c_str(),
             descriptor_->full_name().c_str());
       }
       const auto& enum_desc = pool_->descriptors()[*opt_enum_descriptor_idx];
@@ -304,18 +346,18 @@ base::Status ProtoBuilder::AppendString(const std::string& field_name,
             "Invalid enum string %s "
             "in enum type %s; encountered while filling "
             "field %s (in proto message %s)",
-            enum_str.c_str(), field->resolved_type_name().c_str(),
-            field->name().c_str(), descriptor_->full_name().c_str());
+            enum_str.c_str(), field.resolved_type_name().c_str(),
+            field.name().c_str(), descriptor_->full_name().c_str());
       }
-      message_->AppendVarInt(field->number(), *opt_enum_value);
+      message_->AppendVarInt(field.number(), *opt_enum_value);
       break;
     }
     default: {
       return base::ErrStatus(
           "Tried to write value of type string into field %s (in proto type "
           "%s) which has type %d",
-          field->name().c_str(), descriptor_->full_name().c_str(),
-          field->type());
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.type());
     }
   }
   return base::OkStatus();
@@ -332,12 +374,17 @@ base::Status ProtoBuilder::AppendBytes(const std::string& field_name,
                            descriptor_->full_name().c_str());
   }
 
-  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
   if (field->is_repeated() && !is_inside_repeated)
     return AppendRepeated(*field, ptr, size);
+  return AppendBytesField(*field, ptr, size);
+}
 
-  if (field->type() == FieldDescriptorProto::TYPE_MESSAGE)
-    return AppendSingleMessage(*field, ptr, size);
+base::Status ProtoBuilder::AppendBytesField(const FieldDescriptor& field,
+                                            const uint8_t* ptr,
+                                            size_t size) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+  if (field.type() == FieldDescriptorProto::TYPE_MESSAGE)
+    return AppendSingleMessage(field, ptr, size);
 
   if (size == 0) {
     return base::ErrStatus(
@@ -345,13 +392,13 @@ base::Status ProtoBuilder::AppendBytes(const std::string& field_name,
         "%s). Nulls are only supported for message protos; all other types "
         "should ensure that nulls are not passed to proto builder functions by "
         "using the SQLite IFNULL/COALESCE functions.",
-        field->name().c_str(), descriptor_->full_name().c_str());
+        field.name().c_str(), descriptor_->full_name().c_str());
   }
 
   return base::ErrStatus(
       "Tried to write value of type bytes into field %s (in proto type %s) "
       "which has type %d",
-      field->name().c_str(), descriptor_->full_name().c_str(), field->type());
+      field.name().c_str(), descriptor_->full_name().c_str(), field.type());
 }
 
 base::Status ProtoBuilder::AppendSingleMessage(const FieldDescriptor& field,
@@ -400,19 +447,46 @@ base::Status ProtoBuilder::AppendRepeated(const FieldDescriptor& field,
   const auto& rep = decoder.repeated();
   protos::pbzero::RepeatedBuilderResult::Decoder repeated(rep.data, rep.size);
 
+  // All the |message_value|s share the same type so it is checked only once
+  // here rather than for each element.
+  if (repeated.has_message_type_name()) {
+    using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+    if (field.type() != FieldDescriptorProto::TYPE_MESSAGE) {
+      return base::ErrStatus(
+          "Tried to write value of type bytes into field %s (in proto type "
+          "%s) which has type %d",
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.type());
+    }
+    base::StringView actual_type(repeated.message_type_name());
+    if (actual_type != base::StringView(field.resolved_type_name())) {
+      return base::ErrStatus(
+          "[Field %s in message %s]: Field has wrong type (expected %s, was "
+          "%s)",
+          field.name().c_str(), descriptor_->full_name().c_str(),
+          field.resolved_type_name().c_str(),
+          actual_type.ToStdString().c_str());
+    }
+  }
+
   for (auto it = repeated.value(); it; ++it) {
     protos::pbzero::RepeatedBuilderResult::Value::Decoder value(*it);
     base::Status status;
-    if (value.has_int_value()) {
-      status = AppendLong(field.name(), value.int_value(), true);
+    if (value.has_message_value()) {
+      if (!repeated.has_message_type_name())
+        return base::ErrStatus("Message in repeated field has no type");
+      const auto& bytes = value.message_value();
+      message_->AppendBytes(field.number(), bytes.data, bytes.size);
+    } else if (value.has_int_value()) {
+      status = AppendLongField(field, value.int_value());
     } else if (value.has_double_value()) {
-      status = AppendDouble(field.name(), value.double_value(), true);
+      status = AppendDoubleField(field, value.double_value());
     } else if (value.has_string_value()) {
-      status = AppendString(field.name(),
-                            base::StringView(value.string_value()), true);
+      status =
+          AppendStringField(field, base::StringView(value.string_value()));
     } else if (value.has_bytes_value()) {
       const auto& bytes = value.bytes_value();
-      status = AppendBytes(field.name(), bytes.data, bytes.size, true);
+      status = AppendBytesField(field, bytes.data, bytes.size);
     } else {
       status = base::ErrStatus("Unknown type in repeated field");
     }
@@ -424,20 +498,71 @@ base::Status ProtoBuilder::AppendRepeated(const FieldDescriptor& field,
 }
 
 std::vector<uint8_t> ProtoBuilder::SerializeToProtoBuilderResult() {
-  std::vector<uint8_t> serialized = SerializeRaw();
-  if (serialized.empty())
-    return serialized;
-
-  const auto& type_name = descriptor_->full_name();
+  size_t size = 0;
+  auto blob = SerializeToProtoBuilderResultBlob(&size);
+  if (!blob)
+    return std::vector<uint8_t>();
+  return std::vector<uint8_t>(blob.get(), blob.get() + size);
+}
 
-  protozero::HeapBuffered<protos::pbzero::ProtoBuilderResult> result;
-  result->set_is_repeated(false);
+std::unique_ptr<uint8_t[], base::FreeDeleter>
+ProtoBuilder::SerializeToProtoBuilderResultBlob(size_t* size) {
+  using protos::pbzero::ProtoBuilderResult;
+  using protos::pbzero::SingleBuilderResult;
+  namespace pu = protozero::proto_utils;
+
+  *size = 0;
+  const size_t proto_size = message_.SerializedSize();
+  if (proto_size == 0)
+    return nullptr;
+
+  // The ProtoBuilderResult wrapping the message is written by hand, so that
+  // the message is copied only once, straight into the returned buffer.
+  // Re-serializing it as the |protobuf| field of a HeapBuffered
+  // ProtoBuilderResult would instead copy it three times.
+  const std::string& type_name = descriptor_->full_name();
+  const uint32_t type = protos::pbzero::FieldDescriptorProto_Type_TYPE_MESSAGE;
+  const size_t single_size =
+      TagAndVarIntSize(SingleBuilderResult::kTypeFieldNumber, type) +
+      TagAndVarIntSize(SingleBuilderResult::kTypeNameFieldNumber,
+                       type_name.size()) +
+      type_name.size() +
+      TagAndVarIntSize(SingleBuilderResult::kProtobufFieldNumber,
+                       proto_size) +
+      proto_size;
+  const size_t total_size =
+      TagAndVarIntSize(ProtoBuilderResult::kIsRepeatedFieldNumber, 0) +
+      TagAndVarIntSize(ProtoBuilderResult::kSingleFieldNumber, single_size) +
+      single_size;
 
-  auto* single = result->set_single();
-  single->set_type(protos::pbzero::FieldDescriptorProto_Type_TYPE_MESSAGE);
-  single->set_type_name(type_name.c_str(), type_name.size());
-  single->set_protobuf(serialized.data(), serialized.size());
-  return result.SerializeAsArray();
+  std::unique_ptr<uint8_t[], base::FreeDeleter> data(
+      static_cast<uint8_t*>(malloc(total_size)));
+  uint8_t* ptr = data.get();
+  ptr = pu::WriteVarInt(
+      pu::MakeTagVarInt(ProtoBuilderResult::kIsRepeatedFieldNumber), ptr);
+  ptr = pu::WriteVarInt(0u, ptr);
+  ptr = pu::WriteVarInt(
+      pu::MakeTagLengthDelimited(ProtoBuilderResult::kSingleFieldNumber), ptr);
+  ptr = pu::WriteVarInt(single_size, ptr);
+  ptr = pu::WriteVarInt(
+      pu::MakeTagVarInt(SingleBuilderResult::kTypeFieldNumber), ptr);
+  ptr = pu::WriteVarInt(type, ptr);
+  ptr = pu::WriteVarInt(
+      pu::MakeTagLengthDelimited(SingleBuilderResult::kTypeNameFieldNumber),
+      ptr);
+  ptr = pu::WriteVarInt(type_name.size(), ptr);
+  memcpy(ptr, type_name.data(), type_name.size());
+  ptr += type_name.size();
+  ptr = pu::WriteVarInt(
+      pu::MakeTagLengthDelimited(SingleBuilderResult::kProtobufFieldNumber),
+      ptr);
+  ptr = pu::WriteVarInt(proto_size, ptr);
+  message_.SerializeTo(ptr);
+  ptr += proto_size;
+  PERFETTO_DCHECK(ptr == data.get() + total_size);
+
+  *size = total_size;
+  return data;
 }
 
 std::vector<uint8_t> ProtoBuilder::SerializeRaw() {
@@ -487,18 +612,69 @@ void RepeatedFieldBuilder::AddString(base::StringView value) {
 
 void RepeatedFieldBuilder::AddBytes(const uint8_t* data, size_t size) {
   has_data_ = true;
+
+  // Unwrap the (non-empty) messages built by BuildProto; anything else is
+  // kept as is and validated by the ProtoBuilder of the parent message.
+  protozero::ConstBytes message{};
+  base::StringView type_name;
+  if (size > 0 && size <= protozero::proto_utils::kMaxMessageLength) {
+    protos::pbzero::ProtoBuilderResult::Decoder decoder(data, size);
+    if (!decoder.is_repeated() && decoder.has_single()) {
+      protos::pbzero::SingleBuilderResult::Decoder single(decoder.single());
+      const uint32_t kMessageType =
+          protos::pbzero::FieldDescriptorProto_Type_TYPE_MESSAGE;
+      if (single.type() == kMessageType && single.has_protobuf()) {
+        message = single.protobuf();
+        type_name = base::StringView(single.type_name());
+      }
+    }
+  }
+
+  if (message.size > 0 && type_name.size() > 0) {
+    if (message_type_name_.empty())
+      message_type_name_ = type_name.ToStdString();
+    if (type_name == base::StringView(message_type_name_)) {
+      repeated_->add_value()->set_message_value(message.data, message.size);
+      return;
+    }
+  }
   repeated_->add_value()->set_bytes_value(data, size);
 }
 
-std::vector<uint8_t> RepeatedFieldBuilder::SerializeToProtoBuilderResult() {
+void RepeatedFieldBuilder::Finalize() {
+  if (!repeated_)
+    return;
+
+  // |repeated_| is still the message being written, so the type can be
+  // appended after all the values.
+  if (!message_type_name_.empty())
+    repeated_->set_message_type_name(message_type_name_);
   repeated_ = nullptr;
+  if (has_data_)
+    message_->set_is_repeated(true);
+}
+
+std::vector<uint8_t> RepeatedFieldBuilder::SerializeToProtoBuilderResult() {
+  Finalize();
   if (!has_data_)
     return std::vector<uint8_t>();
-
-  message_->set_is_repeated(true);
   return message_.SerializeAsArray();
 }
 
+std::unique_ptr<uint8_t[], base::FreeDeleter>
+RepeatedFieldBuilder::SerializeToProtoBuilderResultBlob(size_t* size) {
+  Finalize();
+  if (!has_data_) {
+    *size = 0;
+    return nullptr;
+  }
+  *size = message_.SerializedSize();
+  std::unique_ptr<uint8_t[], base::FreeDeleter> data(
+      static_cast<uint8_t*>(malloc(*size)));
+  message_.SerializeTo(data.get());
+  return data;
+}
+
 int TemplateReplace(
     const std::string& raw_text,
     const std::unordered_map<std::string, std::string>& substitutions,
@@ -584,16 +760,13 @@ void RepeatedFieldFinal(sqlite3_context* ctx) {
   // Capture the context pointer so that it will be freed at the end of this
   // function.
   std::unique_ptr<RepeatedFieldBuilder> builder(*builder_ptr_ptr);
-  std::vector<uint8_t> raw = builder->SerializeToProtoBuilderResult();
-  if (raw.empty()) {
+  size_t size = 0;
+  auto data = builder->SerializeToProtoBuilderResultBlob(&size);
+  if (!data) {
     sqlite3_result_null(ctx);
     return;
   }
-
-  std::unique_ptr<uint8_t[], base::FreeDeleter> data(
-      static_cast<uint8_t*>(malloc(raw.size())));
-  memcpy(data.get(), raw.data(), raw.size());
-  sqlite3_result_blob(ctx, data.release(), static_cast<int>(raw.size()), free);
+  sqlite3_result_blob(ctx, data.release(), static_cast<int>(size), free);
 }
 
 // SQLite function implementation used to build a proto directly in SQL. The
@@ -633,20 +806,175 @@ void BuildProto(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
 
   // Even if the message is empty, we don't return null here as we want the
   // existence of the message to be respected.
-  std::vector<uint8_t> raw = builder.SerializeToProtoBuilderResult();
-  if (raw.empty()) {
+  size_t size = 0;
+  auto data = builder.SerializeToProtoBuilderResultBlob(&size);
+  if (!data) {
     // Passing nullptr to SQLite feels dangerous so just pass an empty string
     // and zero as the size so we don't deref nullptr accidentially somewhere.
     sqlite3_result_blob(ctx, "", 0, nullptr);
     return;
   }
+  sqlite3_result_blob(ctx, data.release(), static_cast<int>(size), free);
+}
 
-  std::unique_ptr<uint8_t[], base::FreeDeleter> data(
-      static_cast<uint8_t*>(malloc(raw.size())));
-  memcpy(data.get(), raw.data(), raw.size());
-  sqlite3_result_blob(ctx, data.release(), static_cast<int>(raw.size()), free);
+void RunMetricMemo::DisableAndClear() {
+  enabled_ = false;
+  args_by_path_.clear();
+  owners_by_name_.clear();
+  running_.clear();
 }
 
+bool RunMetricMemo::IsMemoized(const std::string& path,
+                               const std::string& args) const {
+  if (!enabled_)
+    return false;
+  auto it = args_by_path_.find(path);
+  return it != args_by_path_.end() && it->second == args;
+}
+
+bool RunMetricMemo::SkipFile(const std::string& path,
+                             const std::string& args) {
+  if (!IsMemoized(path, args))
+    return false;
+  for (auto& name_and_owners : owners_by_name_) {
+    std::set<std::string>& owners = name_and_owners.second;
+    if (owners.count(path))
+      owners.insert(running_.begin(), running_.end());
+  }
+  return true;
+}
+
+void RunMetricMemo::BeginFile(const std::string& path) {
+  if (!enabled_)
+    return;
+  args_by_path_.erase(path);
+  running_.push_back(path);
+}
+
+void RunMetricMemo::EndFile(const std::string& path,
+                            const std::string& args,
+                            bool ok) {
+  if (!enabled_)
+    return;
+  PERFETTO_DCHECK(!running_.empty() && running_.back() == path);
+  running_.pop_back();
+  if (ok)
+    args_by_path_[path] = args;
+}
+
+void RunMetricMemo::OnStatement(const std::string& sql) {
+  if (!enabled_)
+    return;
+  std::string name = GetWrittenObjectName(sql);
+  if (name.empty())
+    return;
+  std::set<std::string>& owners = owners_by_name_[name];
+  for (const std::string& owner : owners) {
+    if (std::find(running_.begin(), running_.end(), owner) == running_.end())
+      args_by_path_.erase(owner);
+  }
+  owners = std::set<std::string>(running_.begin(), running_.end());
+}
+
+std::string GetWrittenObjectName(const std::string& sql) {
+  size_t i = 0;
+  // Returns the next word of |sql| in lowercase, skipping the comments.
+  auto next_word = [&sql, &i]() -> std::string {
+    for (;;) {
+      while (i < sql.size() && isspace(static_cast<unsigned char>(sql[i])))
+        i++;
+      if (sql.compare(i, 2, "--") == 0) {
+        i = std::min(sql.find('\n', i), sql.size());
+      } else if (sql.compare(i, 2, "/*") == 0) {
+        size_t end = sql.find("*/", i + 2);
+        i = end == std::string::npos ? sql.size() : end + 2;
+      } else {
+        break;
+      }
+    }
+    size_t start = i;
+    while (i < sql.size() && (isalnum(static_cast<unsigned char>(sql[i])) ||
+                              sql[i] == '_' || sql[i] == '.')) {
+      i++;
+    }
+    return base::ToLower(sql.substr(start, i - start));
+  };
+
+  std::string word = next_word();
+  if (word == "insert" || word == "replace" || word == "update") {
+    word = next_word();
+    if (word == "or") {
+      next_word();  // The conflict resolution, e.g. INSERT OR REPLACE.
+      word = next_word();
+    }
+    if (word == "into")
+      word = next_word();
+    return word;
+  }
+  if (word == "delete") {
+    word = next_word();
+    return word == "from" ? next_word() : "";
+  }
+  if (word != "create" && word != "drop")
+    return "";
+  word = next_word();
+  while (word == "temp" || word == "temporary" || word == "virtual" ||
+         word == "unique") {
+    word = next_word();
+  }
+  if (word != "table" && word != "view" && word != "index" &&
+      word != "trigger") {
+    return "";
+  }
+  word = next_word();
+  if (word == "if") {
+    word = next_word();
+    if (word == "not")
+      word = next_word();
+    if (word != "exists")
+      return "";
+    word = next_word();
+  }
+  return word;
+}
+
+namespace {
+
+base::Status RunMetricQueries(
+    TraceProcessor* tp,
+    RunMetricMemo* memo,
+    const char* path,
+    const std::string& sql,
+    const std::unordered_map<std::string, std::string>& substitutions) {
+  for (const auto& query : base::SplitString(sql, ";\n")) {
+    const auto& trimmed = base::TrimLeading(query);
+    if (trimmed.empty())
+      continue;
+
+    std::string buffer;
+    int ret = TemplateReplace(trimmed, substitutions, &buffer);
+    if (ret) {
+      return base::ErrStatus(
+          "RUN_METRIC: Error when performing substitutions: %s", query.c_str());
+    }
+
+    PERFETTO_DLOG("RUN_METRIC: Executing query: %s", buffer.c_str());
+    if (memo)
+      memo->OnStatement(buffer);
+    auto it = tp->ExecuteQuery(buffer);
+    it.Next();
+
+    base::Status status = it.Status();
+    if (!status.ok()) {
+      return base::ErrStatus("RUN_METRIC: Error when running file %s: %s", path,
+                             status.c_message());
+    }
+  }
+  return base::OkStatus();
+}
+
+}  // namespace
+
 void RunMetric(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
   auto* fn_ctx = static_cast<RunMetricContext*>(sqlite3_user_data(ctx));
   if (argc == 0 || sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
@@ -665,6 +993,8 @@ void RunMetric(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
   const auto& sql = metric_it->sql;
 
   std::unordered_map<std::string, std::string> substitutions;
+  // The arguments, in order, as the key of the RunMetricMemo.
+  std::string args;
   for (int i = 1; i < argc; i += 2) {
     if (sqlite3_value_type(argv[i]) != SQLITE_TEXT) {
       sqlite3_result_error(ctx, "RUN_METRIC: all keys must be strings", -1);
@@ -681,36 +1011,27 @@ void RunMetric(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
           ctx, "RUN_METRIC: all values must be convertible to strings", -1);
       return;
     }
+    args.append(*key_str).append(1, '\0');
+    args.append(*value_str).append(1, '\0');
     substitutions[*key_str] = *value_str;
   }
 
-  for (const auto& query : base::SplitString(sql, ";\n")) {
-    const auto& trimmed = base::TrimLeading(query);
-    if (trimmed.empty())
-      continue;
-
-    std::string buffer;
-    int ret = TemplateReplace(trimmed, substitutions, &buffer);
-    if (ret) {
-      char* error = sqlite3_mprintf(
-          "RUN_METRIC: Error when performing substitutions: %s", query.c_str());
-      sqlite3_result_error(ctx, error, -1);
-      return;
-    }
-
-    PERFETTO_DLOG("RUN_METRIC: Executing query: %s", buffer.c_str());
-    auto it = fn_ctx->tp->ExecuteQuery(buffer);
-    it.Next();
+  RunMetricMemo* memo = fn_ctx->memo;
+  if (memo && memo->SkipFile(path, args)) {
+    PERFETTO_DLOG("RUN_METRIC: Skipping %s, already run", path);
+    sqlite3_result_null(ctx);
+    return;
+  }
 
-    base::Status status = it.Status();
-    if (!status.ok()) {
-      char* error =
-          sqlite3_mprintf("RUN_METRIC: Error when running file %s: %s", path,
-                          status.c_message());
-      sqlite3_result_error(ctx, error, -1);
-      sqlite3_free(error);
-      return;
-    }
+  if (memo)
+    memo->BeginFile(path);
+  base::Status status =
+      RunMetricQueries(fn_ctx->tp, memo, path, sql, substitutions);
+  if (memo)
+    memo->EndFile(path, args, status.ok());
+  if (!status.ok()) {
+    sqlite3_result_error(ctx, status.c_message(), -1);
+    return;
   }
   sqlite3_result_null(ctx);
 }
@@ -768,6 +1089,7 @@ base::Status ComputeMetrics(TraceProcessor* tp,
                             const std::vector<SqlMetricFile>& sql_metrics,
                             const DescriptorPool& pool,
                             const ProtoDescriptor& root_descriptor,
+                            RunMetricMemo* memo,
                             std::vector<uint8_t>* metrics_proto) {
   ProtoBuilder metric_builder(&pool, &root_descriptor);
   for (const auto& name : metrics_to_compute) {
@@ -784,6 +1106,8 @@ base::Status ComputeMetrics(TraceProcessor* tp,
     auto queries = base::SplitString(sql_metric.sql, ";\n");
     for (const auto& query : queries) {
       PERFETTO_DLOG("Executing query: %s", query.c_str());
+      if (memo)
+        memo->OnStatement(query);
       auto prep_it = tp->ExecuteQuery(query);
       prep_it.Next();
       RETURN_IF_ERROR(prep_it.Status());
@@ -832,6 +1156,283 @@ base::Status ComputeMetrics(TraceProcessor* tp,
   return base::OkStatus();
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+namespace {
+
+// The result of a single metric is sent by worker processes to the parent as:
+// a byte which is 1 if the metric was computed successfully, followed by the
+// size and then the contents of either the serialized metric (i.e. the
+// TraceMetrics field) or the error message.
+void WriteWorkerResult(int fd,
+                       const base::Status& status,
+                       const std::vector<uint8_t>& proto) {
+  uint8_t ok = status.ok();
+  std::string payload =
+      ok ? std::string(proto.begin(), proto.end()) : status.message();
+  uint64_t size = payload.size();
+  base::WriteAll(fd, &ok, sizeof(ok));
+  base::WriteAll(fd, &size, sizeof(size));
+  base::WriteAll(fd, payload.data(), payload.size());
+}
+
+// Reads the result written by WriteWorkerResult() at |*offset| in |data|.
+// Returns false if |data| is truncated (e.g. the worker crashed).
+bool ReadWorkerResult(const std::string& data,
+                      size_t* offset,
+                      bool* ok,
+                      std::string* payload) {
+  uint8_t ok_byte;
+  uint64_t size;
+  if (data.size() - *offset < sizeof(ok_byte) + sizeof(size))
+    return false;
+  memcpy(&ok_byte, data.data() + *offset, sizeof(ok_byte));
+  *offset += sizeof(ok_byte);
+  memcpy(&size, data.data() + *offset, sizeof(size));
+  *offset += sizeof(size);
+  if (data.size() - *offset < size)
+    return false;
+  payload->assign(data, *offset, static_cast<size_t>(size));
+  *offset += static_cast<size_t>(size);
+  *ok = ok_byte != 0;
+  return true;
+}
+
+// Returns whether the calling process runs a single thread. Forking a process
+// which runs other threads is not safe: the child only gets the calling
+// thread, so e.g. the locks held by the other threads are never released.
+bool IsSingleThreaded() {
+  base::ScopedDir dir(opendir("/proc/self/task"));
+  if (!dir)
+    return false;
+  size_t threads = 0;
+  while (struct dirent* entry = readdir(*dir)) {
+    if (entry->d_name[0] != '.')
+      threads++;
+  }
+  return threads == 1;
+}
+
+// A RUN_METRIC call with literal arguments: the path of the file followed by
+// the arguments.
+using RunMetricCall = std::vector<std::string>;
+
+// Appends to |calls| the RUN_METRIC calls with literal arguments in |sql|
+// which are not in |calls| yet, each followed by the calls in the file it
+// runs.
+void FindRunMetricCalls(const std::string& sql,
+                        const std::vector<SqlMetricFile>& sql_metrics,
+                        std::vector<RunMetricCall>* calls) {
+  // Calls with arguments which are not string literals, or which contain
+  // substitutions (e.g. {{table_name}}), are ignored.
+  static const std::regex kCallRegex(
+      R"(RUN_METRIC\(\s*('[^'{]*'(?:\s*,\s*'[^'{]*')*)\s*\))",
+      std::regex::icase);
+  static const std::regex kArgRegex("'([^']*)'");
+  for (auto it = std::sregex_iterator(sql.begin(), sql.end(), kCallRegex);
+       it != std::sregex_iterator(); ++it) {
+    RunMetricCall call;
+    const std::string args = (*it)[1].str();
+    for (auto arg_it =
+             std::sregex_iterator(args.begin(), args.end(), kArgRegex);
+         arg_it != std::sregex_iterator(); ++arg_it) {
+      call.push_back((*arg_it)[1].str());
+    }
+    // The arguments are key value pairs.
+    if (call.size() % 2 != 1)
+      continue;
+    if (std::find(calls->begin(), calls->end(), call) != calls->end())
+      continue;
+    calls->push_back(call);
+
+    auto file_it = std::find_if(
+        sql_metrics.begin(), sql_metrics.end(),
+        [&call](const SqlMetricFile& file) { return file.path == call[0]; });
+    if (file_it != sql_metrics.end())
+      FindRunMetricCalls(file_it->sql, sql_metrics, calls);
+  }
+}
+
+// Runs the files which more than one of |metrics_to_compute| run through
+// RUN_METRIC, so that the worker processes inherit the objects they create
+// and skip them (thanks to |memo|) rather than running them again.
+void RunSharedDependencies(TraceProcessor* tp,
+                           const std::vector<std::string>& metrics_to_compute,
+                           const std::vector<SqlMetricFile>& sql_metrics,
+                           RunMetricMemo* memo) {
+  // The calls of all the metrics, in the order they are first made.
+  std::vector<RunMetricCall> calls;
+  std::map<RunMetricCall, uint32_t> metrics_by_call;
+  for (const std::string& name : metrics_to_compute) {
+    auto metric_it =
+        std::find_if(sql_metrics.begin(), sql_metrics.end(),
+                     [&name](const SqlMetricFile& metric) {
+                       return metric.proto_field_name.has_value() &&
+                              name == metric.proto_field_name.value();
+                     });
+    if (metric_it == sql_metrics.end())
+      continue;
+
+    std::vector<RunMetricCall> metric_calls;
+    FindRunMetricCalls(metric_it->sql, sql_metrics, &metric_calls);
+    for (RunMetricCall& call : metric_calls) {
+      if (metrics_by_call[call]++ == 0)
+        calls.push_back(std::move(call));
+    }
+  }
+
+  for (const RunMetricCall& call : calls) {
+    if (metrics_by_call[call] < 2)
+      continue;
+    std::string sql = "SELECT RUN_METRIC(";
+    for (size_t i = 0; i < call.size(); ++i)
+      sql += (i ? ", '" : "'") + call[i] + "'";
+    sql += ");";
+    memo->OnStatement(sql);
+    auto it = tp->ExecuteQuery(sql);
+    it.Next();
+    // The failed runs are not memoized: the metrics which depend on them run
+    // them again and report the error in the usual order.
+    if (!it.Status().ok())
+      PERFETTO_DLOG("%s failed: %s", sql.c_str(), it.Status().c_message());
+  }
+}
+
+}  // namespace
+#endif
+
+base::Status ComputeMetricsInProcesses(
+    TraceProcessor* tp,
+    const std::vector<std::string>& metrics_to_compute,
+    const std::vector<SqlMetricFile>& sql_metrics,
+    const DescriptorPool& pool,
+    const ProtoDescriptor& root_descriptor,
+    RunMetricMemo* memo,
+    uint32_t max_processes,
+    std::vector<uint8_t>* metrics_proto) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  const size_t num_workers =
+      std::min<size_t>(max_processes, metrics_to_compute.size());
+  if (num_workers > 1 && IsSingleThreaded()) {
+    if (memo && memo->enabled())
+      RunSharedDependencies(tp, metrics_to_compute, sql_metrics, memo);
+
+    // Metric i is computed by worker i % |num_workers|.
+    struct Worker {
+      pid_t pid = -1;
+      base::ScopedFile rd;
+      std::string output;
+      size_t offset = 0;
+    };
+    std::vector<Worker> workers(num_workers);
+    for (size_t w = 0; w < num_workers; ++w) {
+      base::Pipe pipe = base::Pipe::Create();
+      pid_t pid = fork();
+      if (pid < 0) {
+        // The metrics of this worker are computed in this process below.
+        PERFETTO_PLOG("fork() failed, computing metrics in-process");
+        continue;
+      }
+      if (pid == 0) {
+        // Worker process: compute the metrics, send them back to the parent
+        // and exit without running any destructor or atexit handler which
+        // could affect the state shared with the parent (e.g. files).
+        pipe.rd.reset();
+        for (size_t i = w; i < metrics_to_compute.size(); i += num_workers) {
+          std::vector<uint8_t> proto;
+          base::Status status =
+              ComputeMetrics(tp, {metrics_to_compute[i]}, sql_metrics, pool,
+                             root_descriptor, memo, &proto);
+          WriteWorkerResult(*pipe.wr, status, proto);
+          if (!status.ok())
+            break;
+        }
+        _exit(0);
+      }
+      workers[w].pid = pid;
+      workers[w].rd = std::move(pipe.rd);
+    }
+
+    // The workers block as soon as their pipe is full: read from all the
+    // pipes as data comes in, until all the workers close them.
+    std::vector<struct pollfd> fds;
+    std::vector<Worker*> polled_workers;
+    for (Worker& worker : workers) {
+      if (worker.pid < 0)
+        continue;
+      fds.push_back({*worker.rd, POLLIN, 0});
+      polled_workers.push_back(&worker);
+    }
+    char buf[16 * 1024];
+    while (!fds.empty()) {
+      int res = PERFETTO_EINTR(poll(fds.data(), fds.size(), -1));
+      if (res < 0) {
+        // The results of the workers which are not done yet are missing.
+        PERFETTO_PLOG("poll() failed");
+        break;
+      }
+      for (size_t i = 0; i < fds.size();) {
+        if (fds[i].revents == 0) {
+          ++i;
+          continue;
+        }
+        ssize_t rsize = PERFETTO_EINTR(read(fds[i].fd, buf, sizeof(buf)));
+        if (rsize > 0) {
+          polled_workers[i]->output.append(buf, static_cast<size_t>(rsize));
+          ++i;
+          continue;
+        }
+        // The worker closed the pipe (or it can't be read anymore).
+        fds.erase(fds.begin() + static_cast<ptrdiff_t>(i));
+        polled_workers.erase(polled_workers.begin() +
+                             static_cast<ptrdiff_t>(i));
+      }
+    }
+    for (Worker& worker : workers) {
+      if (worker.pid < 0)
+        continue;
+      // Closing the pipe makes the workers which are still running exit as
+      // soon as they write to it.
+      worker.rd.reset();
+      int wstatus;
+      PERFETTO_EINTR(waitpid(worker.pid, &wstatus, 0));
+    }
+
+    // Merge the results in the order of |metrics_to_compute|: as
+    // ComputeMetrics() also appends one TraceMetrics field per metric, this
+    // gives the same output (and the same error, if any).
+    metrics_proto->clear();
+    for (size_t i = 0; i < metrics_to_compute.size(); ++i) {
+      Worker& worker = workers[i % num_workers];
+      std::vector<uint8_t> proto;
+      if (worker.pid < 0) {
+        RETURN_IF_ERROR(ComputeMetrics(tp, {metrics_to_compute[i]},
+                                       sql_metrics, pool, root_descriptor,
+                                       memo, &proto));
+      } else {
+        bool ok = false;
+        std::string payload;
+        if (!ReadWorkerResult(worker.output, &worker.offset, &ok, &payload)) {
+          return base::ErrStatus(
+              "Metric worker process exited before computing %s",
+              metrics_to_compute[i].c_str());
+        }
+        if (!ok)
+          return base::ErrStatus("%s", payload.c_str());
+        proto.assign(payload.begin(), payload.end());
+      }
+      metrics_proto->insert(metrics_proto->end(), proto.begin(), proto.end());
+    }
+    return base::OkStatus();
+  }
+#else
+  base::ignore_result(max_processes);
+#endif
+  return ComputeMetrics(tp, metrics_to_compute, sql_metrics, pool,
+                        root_descriptor, memo, metrics_proto);
+}
+
 }  // namespace metrics
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -19,10 +19,15 @@
 
 #include <sqlite3.h>
 
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/field.h"
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
@@ -89,6 +94,15 @@ class ProtoBuilder {
   // is called.
   std::vector<uint8_t> SerializeToProtoBuilderResult();
 
+  // Same as |SerializeToProtoBuilderResult()| but writes the result directly
+  // into a malloc-ed buffer, which can be handed over to SQLite without any
+  // further copy. Returns nullptr (and sets |size| to 0) if the message is
+  // empty.
+  // Note: no other functions should be called on this class after this method
+  // is called.
+  std::unique_ptr<uint8_t[], base::FreeDeleter>
+  SerializeToProtoBuilderResultBlob(size_t* size);
+
   // Returns the serialized version of the raw message being built.
   // This function should only be used at the top level where type checking is
   // no longer important because the proto will be returned as is. In all other
@@ -98,6 +112,17 @@ class ProtoBuilder {
   std::vector<uint8_t> SerializeRaw();
 
  private:
+  // The Append*Field() functions write the value into the already looked up
+  // |field|. They are used by AppendRepeated() to avoid looking up the field
+  // again for each element.
+  base::Status AppendLongField(const FieldDescriptor& field, int64_t value);
+  base::Status AppendDoubleField(const FieldDescriptor& field, double value);
+  base::Status AppendStringField(const FieldDescriptor& field,
+                                 base::StringView value);
+  base::Status AppendBytesField(const FieldDescriptor& field,
+                                const uint8_t* data,
+                                size_t size);
+
   base::Status AppendSingleMessage(const FieldDescriptor& field,
                                    const uint8_t* ptr,
                                    size_t size);
@@ -131,9 +156,26 @@ class RepeatedFieldBuilder {
   // is called.
   std::vector<uint8_t> SerializeToProtoBuilderResult();
 
+  // Same as |SerializeToProtoBuilderResult()| but writes the result directly
+  // into a malloc-ed buffer. Returns nullptr (and sets |size| to 0) if no
+  // value was added.
+  // Note: no other functions should be called on this class after this method
+  // is called.
+  std::unique_ptr<uint8_t[], base::FreeDeleter>
+  SerializeToProtoBuilderResultBlob(size_t* size);
+
  private:
+  void Finalize();
+
   bool has_data_ = false;
 
+  // Messages which are all of the same type (the common case of a
+  // RepeatedField over the result of a proto builder function) are stored
+  // unwrapped as |message_value|s, with their type stored once in
+  // |message_type_name|. This avoids keeping, and later parsing, a
+  // ProtoBuilderResult for each element.
+  std::string message_type_name_;
+
   protozero::HeapBuffered<protos::pbzero::ProtoBuilderResult> message_;
   protos::pbzero::RepeatedBuilderResult* repeated_ = nullptr;
 };
@@ -165,10 +207,62 @@ struct BuildProtoContext {
 // This function implements all the proto creation functions.
 void BuildProto(sqlite3_context* ctx, int argc, sqlite3_value** argv);
 
+// Memoizes the files run by RUN_METRIC while computing metrics. Many metrics
+// run the same files to build the intermediate tables they share (e.g.
+// android/process_metadata.sql): a file which was already run with the same
+// arguments is skipped, as long as none of the tables, views and indexes it
+// created or wrote was created, dropped or written since by another file.
+class RunMetricMemo {
+ public:
+  // Memoization is enabled only while computing metrics: outside of it, the
+  // intermediate tables can be changed by any query.
+  void Enable() { enabled_ = true; }
+  void DisableAndClear();
+  bool enabled() const { return enabled_; }
+
+  // Returns true if |path| was already run with |args| and the objects it
+  // created are still the ones it created.
+  bool IsMemoized(const std::string& path, const std::string& args) const;
+
+  // Called by RUN_METRIC before running |path|: returns IsMemoized(). If the
+  // run is skipped, the files being run become owners of the objects of
+  // |path|, as if they had run it.
+  bool SkipFile(const std::string& path, const std::string& args);
+
+  // Called around each run of the file |path| by RUN_METRIC.
+  void BeginFile(const std::string& path);
+  void EndFile(const std::string& path, const std::string& args, bool ok);
+
+  // Called for each statement run while computing metrics. If it creates,
+  // drops or writes an object, invalidates the files that did it before
+  // (unless they are running the statement) and makes the running files the
+  // owners of the object.
+  void OnStatement(const std::string& sql);
+
+ private:
+  bool enabled_ = false;
+
+  // The arguments each memoized file was run with.
+  std::map<std::string, std::string> args_by_path_;
+
+  // The files which created or wrote (directly, or through nested RUN_METRIC
+  // calls) each object, by object name.
+  std::map<std::string, std::set<std::string>> owners_by_name_;
+
+  // The files being run by the nested RUN_METRIC calls, outermost first.
+  std::vector<std::string> running_;
+};
+
+// Returns the name of the table, view, index or trigger created or dropped by
+// the statement |sql|, or of the table it writes (INSERT, REPLACE, UPDATE or
+// DELETE). Returns an empty string for the other statements.
+std::string GetWrittenObjectName(const std::string& sql);
+
 // Context struct for the below function.
 struct RunMetricContext {
   TraceProcessor* tp;
   std::vector<SqlMetricFile>* metrics;
+  RunMetricMemo* memo;
 };
 
 // Implements the RUN_METRIC SQL function.
@@ -177,13 +271,36 @@ void RunMetric(sqlite3_context* ctx, int argc, sqlite3_value** argv);
 // Implements the UNWRAP_METRIC_PROTO SQL function.
 void UnwrapMetricProto(sqlite3_context* ctx, int argc, sqlite3_value** argv);
 
+// |memo|, if not null, is the RunMetricMemo of the RUN_METRIC function of
+// |impl|. It must be enabled by the caller for the RUN_METRIC calls to be
+// memoized across the metrics.
 base::Status ComputeMetrics(TraceProcessor* impl,
                             const std::vector<std::string> metrics_to_compute,
                             const std::vector<SqlMetricFile>& metrics,
                             const DescriptorPool& pool,
                             const ProtoDescriptor& root_descriptor,
+                            RunMetricMemo* memo,
                             std::vector<uint8_t>* metrics_proto);
 
+// Same as ComputeMetrics but splits the metrics between up to |max_processes|
+// worker processes forked from the current one and merges their results.
+// Each worker computes its share of the metrics sequentially (so RUN_METRIC
+// dependencies are honoured within each worker) on a copy-on-write snapshot
+// of the trace processor. If |memo| is enabled, the RUN_METRIC files shared
+// by several metrics are run once before forking rather than in each worker.
+// The output is identical to ComputeMetrics. Falls back to ComputeMetrics
+// when forking is not supported, not safe (i.e. the process runs other
+// threads) or not worthwhile.
+base::Status ComputeMetricsInProcesses(
+    TraceProcessor* impl,
+    const std::vector<std::string>& metrics_to_compute,
+    const std::vector<SqlMetricFile>& metrics,
+    const DescriptorPool& pool,
+    const ProtoDescriptor& root_descriptor,
+    RunMetricMemo* memo,
+    uint32_t max_processes,
+    std::vector<uint8_t>* metrics_proto);
+
 }  // namespace metrics
 }  // namespace trace_processor
 }  // namespace perfetto
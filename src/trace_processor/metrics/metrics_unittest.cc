@@ -50,6 +50,85 @@ TEST(MetricsTest, TemplateReplace) {
   ASSERT_NE(TemplateReplace("{{missing}}", {{}}, &unused), 0);
 }
 
+TEST(MetricsTest, GetWrittenObjectName) {
+  ASSERT_EQ(GetWrittenObjectName("SELECT * FROM slice"), "");
+  ASSERT_EQ(GetWrittenObjectName("CREATE TABLE foo AS SELECT 1"), "foo");
+  ASSERT_EQ(GetWrittenObjectName("create view Foo_Bar as select 1"),
+            "foo_bar");
+  ASSERT_EQ(GetWrittenObjectName("DROP VIEW IF EXISTS foo"), "foo");
+  ASSERT_EQ(GetWrittenObjectName(
+                "CREATE VIRTUAL TABLE IF NOT EXISTS foo USING SPAN_JOIN"),
+            "foo");
+  ASSERT_EQ(GetWrittenObjectName("CREATE UNIQUE INDEX foo ON bar(ts)"),
+            "foo");
+  ASSERT_EQ(GetWrittenObjectName(
+                "-- A comment.\n/* Another one. */ DROP TABLE foo"),
+            "foo");
+  ASSERT_EQ(GetWrittenObjectName("INSERT INTO foo SELECT 1"), "foo");
+  ASSERT_EQ(GetWrittenObjectName("INSERT OR REPLACE INTO foo VALUES (1)"),
+            "foo");
+  ASSERT_EQ(GetWrittenObjectName("UPDATE foo SET ts = 0"), "foo");
+  ASSERT_EQ(GetWrittenObjectName("DELETE FROM foo"), "foo");
+  ASSERT_EQ(GetWrittenObjectName("SELECT RUN_METRIC('foo.sql')"), "");
+}
+
+TEST(MetricsTest, RunMetricMemo) {
+  RunMetricMemo memo;
+  auto run = [&memo](const std::string& path, const std::string& args,
+                     const std::vector<std::string>& statements) {
+    memo.BeginFile(path);
+    for (const std::string& statement : statements)
+      memo.OnStatement(statement);
+    memo.EndFile(path, args, true);
+  };
+
+  // Nothing is memoized until the memo is enabled.
+  run("a.sql", "", {"CREATE TABLE a AS SELECT 1"});
+  ASSERT_FALSE(memo.IsMemoized("a.sql", ""));
+
+  memo.Enable();
+  run("a.sql", "", {"CREATE TABLE a AS SELECT 1"});
+  ASSERT_TRUE(memo.IsMemoized("a.sql", ""));
+  ASSERT_FALSE(memo.IsMemoized("a.sql", "x"));
+
+  // Running a file again with other arguments replaces the memoized ones.
+  run("a.sql", "x", {"CREATE TABLE a AS SELECT 1"});
+  ASSERT_FALSE(memo.IsMemoized("a.sql", ""));
+  ASSERT_TRUE(memo.IsMemoized("a.sql", "x"));
+
+  // b.sql runs a.sql: recreating one of the tables of a.sql invalidates both.
+  memo.BeginFile("b.sql");
+  run("a.sql", "", {"CREATE TABLE a AS SELECT 1"});
+  memo.OnStatement("CREATE VIEW b AS SELECT * FROM a");
+  memo.EndFile("b.sql", "", true);
+  ASSERT_TRUE(memo.IsMemoized("a.sql", ""));
+  ASSERT_TRUE(memo.IsMemoized("b.sql", ""));
+
+  memo.OnStatement("SELECT * FROM a");
+  ASSERT_TRUE(memo.IsMemoized("a.sql", ""));
+  run("c.sql", "", {"DROP TABLE IF EXISTS a", "CREATE TABLE a AS SELECT 2"});
+  ASSERT_FALSE(memo.IsMemoized("a.sql", ""));
+  ASSERT_FALSE(memo.IsMemoized("b.sql", ""));
+  ASSERT_TRUE(memo.IsMemoized("c.sql", ""));
+
+  // e.sql skips c.sql, which it runs again: it still depends on table a.
+  memo.BeginFile("e.sql");
+  ASSERT_TRUE(memo.SkipFile("c.sql", ""));
+  memo.EndFile("e.sql", "", true);
+  ASSERT_TRUE(memo.IsMemoized("e.sql", ""));
+  run("a.sql", "", {"CREATE TABLE a AS SELECT 1"});
+  ASSERT_FALSE(memo.IsMemoized("c.sql", ""));
+  ASSERT_FALSE(memo.IsMemoized("e.sql", ""));
+
+  // Failed runs are not memoized.
+  memo.BeginFile("d.sql");
+  memo.EndFile("d.sql", "", false);
+  ASSERT_FALSE(memo.IsMemoized("d.sql", ""));
+
+  memo.DisableAndClear();
+  ASSERT_FALSE(memo.IsMemoized("c.sql", ""));
+}
+
 class ProtoBuilderTest : public ::testing::Test {
  protected:
   template <bool repeated>
@@ -220,6 +299,75 @@ TEST_F(ProtoBuilderTest, AppendRepeatedPrimitive) {
   ASSERT_FALSE(++it);
 }
 
+TEST_F(ProtoBuilderTest, AppendRepeatedMessage) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+
+  // Create the descriptor version of the following message:
+  // message TestProto {
+  //   message NestedProto {
+  //     optional int64 nested_int_value = 1;
+  //   }
+  //   repeated NestedProto rep_nested_value = 1;
+  //   repeated OtherProto rep_other_value = 2;
+  // }
+  DescriptorPool pool;
+  ProtoDescriptor nested("file.proto", ".perfetto.protos",
+                         ".perfetto.protos.TestProto.NestedProto",
+                         ProtoDescriptor::Type::kMessage, base::nullopt);
+  nested.AddField(FieldDescriptor("nested_int_value", 1,
+                                  FieldDescriptorProto::TYPE_INT64, "", false));
+
+  ProtoDescriptor descriptor("file.proto", ".perfetto.protos",
+                             ".perfetto.protos.TestProto",
+                             ProtoDescriptor::Type::kMessage, base::nullopt);
+  auto field =
+      FieldDescriptor("rep_nested_value", 1, FieldDescriptorProto::TYPE_MESSAGE,
+                      ".perfetto.protos.TestProto.NestedProto", true);
+  field.set_resolved_type_name(".perfetto.protos.TestProto.NestedProto");
+  descriptor.AddField(field);
+  auto other_field =
+      FieldDescriptor("rep_other_value", 2, FieldDescriptorProto::TYPE_MESSAGE,
+                      ".perfetto.protos.OtherProto", true);
+  other_field.set_resolved_type_name(".perfetto.protos.OtherProto");
+  descriptor.AddField(other_field);
+
+  RepeatedFieldBuilder rep_builder;
+  for (int64_t i : {123, 456}) {
+    ProtoBuilder nest_builder(&pool, &nested);
+    ASSERT_TRUE(nest_builder.AppendLong("nested_int_value", i).ok());
+    auto nest_ser = nest_builder.SerializeToProtoBuilderResult();
+    rep_builder.AddBytes(nest_ser.data(), nest_ser.size());
+  }
+  // A null (i.e. an empty message).
+  rep_builder.AddBytes(nullptr, 0);
+
+  std::vector<uint8_t> rep_ser = rep_builder.SerializeToProtoBuilderResult();
+
+  ProtoBuilder other_builder(&pool, &descriptor);
+  ASSERT_FALSE(
+      other_builder
+          .AppendBytes("rep_other_value", rep_ser.data(), rep_ser.size())
+          .ok());
+
+  ProtoBuilder builder(&pool, &descriptor);
+  ASSERT_TRUE(
+      builder.AppendBytes("rep_nested_value", rep_ser.data(), rep_ser.size())
+          .ok());
+
+  auto result_ser = builder.SerializeToProtoBuilderResult();
+  auto proto = DecodeSingleFieldProto<true>(result_ser);
+  auto it = proto.GetRepeated<protozero::ConstBytes>(1);
+  for (int64_t i : {123, 456}) {
+    ASSERT_TRUE(it);
+    protozero::TypedProtoDecoder<1, false> nest((*it).data, (*it).size);
+    ASSERT_EQ(nest.Get(1).as_int64(), i);
+    ++it;
+  }
+  ASSERT_TRUE(it);
+  ASSERT_EQ((*it).size, 0u);
+  ASSERT_FALSE(++it);
+}
+
 TEST_F(ProtoBuilderTest, AppendEnums) {
   using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
 
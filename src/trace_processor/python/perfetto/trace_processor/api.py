@@ -12,6 +12,8 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import sys
+from array import array
 from urllib.parse import urlparse
 
 from .http import TraceProcessorHttp
@@ -163,6 +165,203 @@ class TraceProcessor:
       self.__current_index += 1
       return result
 
+  # Iterator over the rows of a query result returned as ColumnarBatch
+  # messages. Exposes the same interface as QueryResultIterator but, as the
+  # values come column by column, integer and double columns are decoded as
+  # whole arrays rather than one cell at a time. The batches are only decoded
+  # when the rows are first iterated or converted to a dataframe.
+  class ColumnarQueryResultIterator:
+
+    def __init__(self, column_names, batches):
+      self.__column_names = list(column_names)
+      self.__batches = []
+      self.__columns = None
+      self.__count = 0
+      self.__current_index = 0
+
+      for batch in batches:
+        if len(batch.columns) != len(self.__column_names):
+          raise TraceProcessorException(
+              "Column count " + str(len(batch.columns)) +
+              " does not match the number of column names " +
+              str(len(self.__column_names)))
+        for column in batch.columns:
+          if column.type == column.COLUMN_INVALID:
+            raise TraceProcessorException('Invalid column type')
+        self.__batches.append(batch)
+        self.__count += batch.num_rows
+        if batch.is_last_batch:
+          break
+
+    def __decode_typed_array(self, typecode, data):
+      values = array(typecode)
+      values.frombytes(data)
+      if sys.byteorder != 'little':
+        values.byteswap()
+      return values.tolist()
+
+    def __decode_column(self, column, num_rows):
+      # Values of these constants correspond to the ColumnarBatch.Column.Type
+      # enum at protos/perfetto/trace_processor/trace_processor.proto
+      type = column.type
+      if type == column.COLUMN_NULL:
+        return [None] * num_rows
+      if type == column.COLUMN_MIXED:
+        return self.__decode_cells(column.mixed_cells)
+
+      if type == column.COLUMN_INT64:
+        values = self.__decode_typed_array('q', column.int64_values)
+      elif type == column.COLUMN_FLOAT64:
+        values = self.__decode_typed_array('d', column.float64_values)
+      elif type == column.COLUMN_STRING:
+        values = column.string_values.split('\0')[:-1]
+      elif type == column.COLUMN_BLOB:
+        values = list(column.blob_values)
+      else:
+        raise TraceProcessorException('Invalid column type')
+
+      self.__check_value_count(len(values), num_rows)
+      if column.validity:
+        for i in range(num_rows):
+          if not (column.validity[i // 8] >> (i % 8)) & 1:
+            values[i] = None
+      return values
+
+    # Returns the values of |column| as a NumPy array, or None for a
+    # COLUMN_NULL column. Integer and double values are wrapped in place
+    # rather than copied. As when building a dataframe from Python lists,
+    # integer columns with NULLs become float64 columns with NaNs.
+    def __decode_column_as_array(self, np, column, num_rows):
+      type = column.type
+      if type == column.COLUMN_NULL:
+        return None
+      if type == column.COLUMN_MIXED:
+        return self.__object_array(np, self.__decode_cells(column.mixed_cells))
+
+      if type == column.COLUMN_INT64:
+        values = np.frombuffer(column.int64_values, dtype='<i8')
+      elif type == column.COLUMN_FLOAT64:
+        values = np.frombuffer(column.float64_values, dtype='<f8')
+      elif type == column.COLUMN_STRING:
+        values = self.__object_array(np,
+                                     column.string_values.split('\0')[:-1])
+      elif type == column.COLUMN_BLOB:
+        values = self.__object_array(np, column.blob_values)
+      else:
+        raise TraceProcessorException('Invalid column type')
+
+      self.__check_value_count(len(values), num_rows)
+      if column.validity:
+        valid = np.unpackbits(
+            np.frombuffer(column.validity, dtype=np.uint8),
+            bitorder='little')[:num_rows].astype(bool)
+        if values.dtype == object:
+          values = values.copy()
+          values[~valid] = None
+        else:
+          values = values.astype(np.float64)
+          values[~valid] = np.nan
+      return values
+
+    def __object_array(self, np, values):
+      # Built element by element so that NumPy never tries to interpret the
+      # values (e.g. bytes) as nested sequences.
+      result = np.empty(len(values), dtype=object)
+      result[:] = list(values)
+      return result
+
+    def __check_value_count(self, value_count, num_rows):
+      if value_count != num_rows:
+        raise TraceProcessorException("Value count " + str(value_count) +
+                                      " does not match row count " +
+                                      str(num_rows))
+
+    def __decode_cells(self, batch):
+      data_lists = {
+          TraceProcessor.QUERY_CELL_VARINT_FIELD_ID: iter(batch.varint_cells),
+          TraceProcessor.QUERY_CELL_FLOAT64_FIELD_ID: iter(batch.float64_cells),
+          TraceProcessor.QUERY_CELL_STRING_FIELD_ID:
+              iter(batch.string_cells.split('\0')[:-1]),
+          TraceProcessor.QUERY_CELL_BLOB_FIELD_ID: iter(batch.blob_cells),
+      }
+      values = []
+      for cell_type in batch.cells:
+        if cell_type == TraceProcessor.QUERY_CELL_NULL_FIELD_ID:
+          values.append(None)
+        elif cell_type in data_lists:
+          values.append(next(data_lists[cell_type]))
+        else:
+          raise TraceProcessorException('Invalid cell type')
+      return values
+
+    # Returns the values of the column at |index| across all the batches as a
+    # single NumPy array.
+    def __column_as_array(self, np, index):
+      arrays = [
+          self.__decode_column_as_array(np, batch.columns[index],
+                                        batch.num_rows)
+          for batch in self.__batches
+      ]
+      # The batches where all the values are NULL are filled with NaNs if the
+      # other batches are numeric, so that the column stays numeric.
+      numeric = any(a is not None for a in arrays) and all(
+          a is None or a.dtype != object for a in arrays)
+      for i, batch in enumerate(self.__batches):
+        if arrays[i] is None:
+          if numeric:
+            arrays[i] = np.full(batch.num_rows, np.nan)
+          else:
+            arrays[i] = np.full(batch.num_rows, None, dtype=object)
+      if not arrays:
+        return np.empty(0, dtype=object)
+      if len(arrays) == 1:
+        return arrays[0]
+      return np.concatenate(arrays)
+
+    def __column_lists(self):
+      if self.__columns is None:
+        self.__columns = [[] for _ in self.__column_names]
+        for batch in self.__batches:
+          for values, column in zip(self.__columns, batch.columns):
+            values.extend(self.__decode_column(column, batch.num_rows))
+      return self.__columns
+
+    # To use the query result as a populated Pandas dataframe, this
+    # function must be called directly after calling query inside
+    # TraceProcesor.
+    def as_pandas_dataframe(self):
+      try:
+        import numpy as np
+        import pandas as pd
+
+        columns = [
+            self.__column_as_array(np, i)
+            for i in range(len(self.__column_names))
+        ]
+        return pd.DataFrame(
+            dict(zip(self.__column_names, columns)),
+            columns=self.__column_names)
+
+      except ModuleNotFoundError:
+        raise TraceProcessorException(
+            'The sufficient libraries are not installed')
+
+    def __len__(self):
+      return self.__count
+
+    def __iter__(self):
+      return self
+
+    def __next__(self):
+      if self.__current_index == self.__count:
+        raise StopIteration
+      result = TraceProcessor.Row()
+      for column_name, values in zip(self.__column_names,
+                                     self.__column_lists()):
+        setattr(result, column_name, values[self.__current_index])
+      self.__current_index += 1
+      return result
+
   def __init__(self,
                addr=None,
                file_path=None,
@@ -197,12 +396,17 @@ class TraceProcessor:
       can also be converted to a pandas dataframe by calling the
       as_pandas_dataframe() function after calling query.
     """
-    response = self.http.execute_query(sql)
+    response = self.http.execute_query(sql, columnar=True)
     if response.error:
       raise TraceProcessorException(response.error)
 
-    return TraceProcessor.QueryResultIterator(response.column_names,
-                                              response.batch)
+    # Older versions of trace_processor ignore the request for a columnar
+    # result and return CellsBatch messages instead.
+    if response.batch:
+      return TraceProcessor.QueryResultIterator(response.column_names,
+                                                response.batch)
+    return TraceProcessor.ColumnarQueryResultIterator(response.column_names,
+                                                      response.columnar_batch)
 
   def metric(self, metrics):
     """Returns the metrics data corresponding to the passed in trace metric.
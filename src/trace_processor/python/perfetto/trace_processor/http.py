@@ -24,9 +24,10 @@ class TraceProcessorHttp:
     self.protos = ProtoFactory()
     self.conn = http.client.HTTPConnection(url)
 
-  def execute_query(self, query):
-    args = self.protos.RawQueryArgs()
+  def execute_query(self, query, columnar=False):
+    args = self.protos.QueryArgs()
     args.sql_query = query
+    args.columnar_result = columnar
     byte_data = args.SerializeToString()
     self.conn.request('POST', '/query', body=byte_data)
     with self.conn.getresponse() as f:
@@ -53,9 +53,12 @@ class ProtoFactory:
     self.ComputeMetricResult = create_message_factory(
         'perfetto.protos.ComputeMetricResult')
     self.RawQueryArgs = create_message_factory('perfetto.protos.RawQueryArgs')
+    self.QueryArgs = create_message_factory('perfetto.protos.QueryArgs')
     self.QueryResult = create_message_factory('perfetto.protos.QueryResult')
     self.TraceMetrics = create_message_factory('perfetto.protos.TraceMetrics')
     self.DisableAndReadMetatraceResult = create_message_factory(
         'perfetto.protos.DisableAndReadMetatraceResult')
     self.CellsBatch = create_message_factory(
         'perfetto.protos.QueryResult.CellsBatch')
+    self.ColumnarBatch = create_message_factory(
+        'perfetto.protos.QueryResult.ColumnarBatch')
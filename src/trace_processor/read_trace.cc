@@ -16,9 +16,18 @@
 
 #include "perfetto/trace_processor/read_trace.h"
 
+#include <algorithm>
+#include <cinttypes>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/trace_processor/trace_processor.h"
@@ -28,6 +37,7 @@
 #include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/status_macros.h"
+#include "src/trace_processor/util/trace_index.h"
 
 #include "protos/perfetto/trace/trace.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
@@ -43,6 +53,25 @@
 #include <aio.h>
 #endif
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
+#define PERFETTO_HAS_MMAP() 1
+#else
+#define PERFETTO_HAS_MMAP() 0
+#endif
+
+#if PERFETTO_HAS_MMAP()
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 namespace {
@@ -77,56 +106,89 @@ util::Status ReadTraceUsingRead(
   return util::OkStatus();
 }
 
-class SerializingProtoTraceReader : public ChunkedTraceReader {
- public:
-  SerializingProtoTraceReader(std::vector<uint8_t>* output) : output_(output) {}
-
-  util::Status Parse(std::unique_ptr<uint8_t[]> data, size_t size) override {
-    return tokenizer_.Tokenize(
-        std::move(data), size, [this](TraceBlobView packet) {
-          uint8_t buffer[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+#if PERFETTO_HAS_MMAP()
+// Size of the slices of the file mapping passed to TraceProcessor. Slices are
+// not copied; this only bounds the size of each TraceBlobView (which uses 32
+// bit offsets) and how often the progress callback is invoked.
+constexpr size_t kMmapChunkSize = 64 * 1024 * 1024;
 
-          uint8_t* pos = buffer;
-          pos = protozero::proto_utils::WriteVarInt(kTracePacketTag, pos);
-          pos = protozero::proto_utils::WriteVarInt(packet.length(), pos);
-          output_->insert(output_->end(), buffer, pos);
+// A read-only mapping of a whole trace file. Shared by all the TraceBlobViews
+// pointing into it: the mapping goes away when the last packet referencing it
+// has been parsed.
+class FileMapping {
+ public:
+  FileMapping(void* addr, size_t size) : addr_(addr), size_(size) {}
+  ~FileMapping() { munmap(addr_, size_); }
 
-          output_->insert(output_->end(), packet.data(),
-                          packet.data() + packet.length());
-          return util::OkStatus();
-        });
-  }
+  FileMapping(const FileMapping&) = delete;
+  FileMapping& operator=(const FileMapping&) = delete;
 
-  void NotifyEndOfFile() override {}
+  const uint8_t* data() const { return static_cast<const uint8_t*>(addr_); }
+  size_t size() const { return size_; }
 
  private:
-  static constexpr uint8_t kTracePacketTag =
-      protozero::proto_utils::MakeTagLengthDelimited(
-          protos::pbzero::Trace::kPacketFieldNumber);
-
-  ProtoTraceTokenizer tokenizer_;
-  std::vector<uint8_t>* output_;
+  void* const addr_;
+  const size_t size_;
 };
 
-}  // namespace
-
-util::Status ReadTrace(
+// Loads the trace by mapping the whole file in memory and passing slices of
+// the mapping to TraceProcessor, which avoids copying packets into heap
+// buffers and lets the page cache back the trace data.
+// Sets |*mapped| to false and does nothing if the file cannot be mapped (e.g.
+// it's a pipe or doesn't fit in the address space); the caller is expected to
+// fall back on read() in this case.
+// Note: truncating the file while it's being loaded will cause a SIGBUS.
+util::Status ReadTraceUsingMmap(
     TraceProcessor* tp,
-    const char* filename,
+    int fd,
+    bool* mapped,
+    uint64_t* file_size,
     const std::function<void(uint64_t parsed_size)>& progress_callback) {
-  base::ScopedFile fd(base::OpenFile(filename, O_RDONLY));
-  if (!fd)
-    return util::ErrStatus("Could not open trace file (path: %s)", filename);
+  *mapped = false;
+  struct stat stat_buf {};
+  if (fstat(fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode) ||
+      stat_buf.st_size <= 0) {
+    return util::OkStatus();
+  }
+  uint64_t map_size = static_cast<uint64_t>(stat_buf.st_size);
+  if (map_size > std::numeric_limits<size_t>::max())
+    return util::OkStatus();
 
-  uint64_t file_size = 0;
+  void* addr = mmap(nullptr, static_cast<size_t>(map_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED)
+    return util::OkStatus();
+  *mapped = true;
 
+  auto mapping =
+      std::make_shared<FileMapping>(addr, static_cast<size_t>(map_size));
+  for (size_t off = 0; off < mapping->size(); off += kMmapChunkSize) {
+    if (progress_callback)
+      progress_callback(*file_size);
+
+    size_t chunk_size = std::min(kMmapChunkSize, mapping->size() - off);
+    // Aliasing constructor: the chunk shares ownership of the whole mapping.
+    std::shared_ptr<const uint8_t> chunk(mapping, mapping->data() + off);
+    *file_size += chunk_size;
+    RETURN_IF_ERROR(tp->ParseShared(std::move(chunk), chunk_size));
+  }
+  return util::OkStatus();
+}
+#endif  // PERFETTO_HAS_MMAP()
+
+// Loads the trace using async IO where available, falling back on read().
+util::Status ReadTraceUsingAioOrRead(
+    TraceProcessor* tp,
+    int fd,
+    uint64_t* file_size,
+    const std::function<void(uint64_t parsed_size)>& progress_callback) {
 #if PERFETTO_HAS_AIO_H()
   // Load the trace in chunks using async IO. We create a simple pipeline where,
   // at each iteration, we parse the current chunk and asynchronously start
   // reading the next chunk.
   struct aiocb cb {};
   cb.aio_nbytes = kChunkSize;
-  cb.aio_fildes = *fd;
+  cb.aio_fildes = fd;
 
   std::unique_ptr<uint8_t[]> aio_buf(new uint8_t[kChunkSize]);
 #if defined(MEMORY_SANITIZER)
@@ -141,14 +203,14 @@ util::Status ReadTrace(
 
   for (int i = 0;; i++) {
     if (progress_callback && i % 128 == 0)
-      progress_callback(file_size);
+      progress_callback(*file_size);
 
     // Block waiting for the pending read to complete.
     PERFETTO_CHECK(aio_suspend(aio_list, 1, nullptr) == 0);
     auto rsize = aio_return(&cb);
     if (rsize <= 0)
       break;
-    file_size += static_cast<uint64_t>(rsize);
+    *file_size += static_cast<uint64_t>(rsize);
 
     // Take ownership of the completed buffer and enqueue a new async read
     // with a fresh buffer.
@@ -167,15 +229,120 @@ util::Status ReadTrace(
     RETURN_IF_ERROR(tp->Parse(std::move(buf), static_cast<size_t>(rsize)));
   }
 
-  if (file_size == 0) {
+  if (*file_size == 0) {
     PERFETTO_ILOG(
         "Failed to read any data using AIO. This is expected and not an error "
         "on WSL. Falling back to read()");
-    RETURN_IF_ERROR(ReadTraceUsingRead(tp, *fd, &file_size, progress_callback));
+    RETURN_IF_ERROR(ReadTraceUsingRead(tp, fd, file_size, progress_callback));
   }
 #else   // PERFETTO_HAS_AIO_H()
-  RETURN_IF_ERROR(ReadTraceUsingRead(tp, *fd, &file_size, progress_callback));
+  RETURN_IF_ERROR(ReadTraceUsingRead(tp, fd, file_size, progress_callback));
 #endif  // PERFETTO_HAS_AIO_H()
+  return util::OkStatus();
+}
+
+// Reads |size| bytes at |offset| of |fd| into |dst|.
+util::Status ReadFileRange(int fd, uint64_t offset, uint8_t* dst, size_t size) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  bool seeked = _lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) >= 0;
+#else
+  bool seeked = lseek(fd, static_cast<off_t>(offset), SEEK_SET) >= 0;
+#endif
+  if (!seeked) {
+    return util::ErrStatus("Seeking in trace file failed (errno: %d, %s)",
+                           errno, strerror(errno));
+  }
+  while (size > 0) {
+    auto rsize = base::Read(fd, dst, size);
+    if (rsize <= 0) {
+      return util::ErrStatus("Reading trace file failed (errno: %d, %s)",
+                             errno, strerror(errno));
+    }
+    dst += rsize;
+    size -= static_cast<size_t>(rsize);
+  }
+  return util::OkStatus();
+}
+
+// A trace file read by ReadTraces(), in chunks of kChunkSize bytes.
+struct TraceFile {
+  std::vector<std::pair<std::unique_ptr<uint8_t[]>, size_t>> chunks;
+  util::Status status;
+  std::thread reader;
+};
+
+util::Status ReadTraceFile(const std::string& filename, TraceFile* file) {
+  base::ScopedFile fd(base::OpenFile(filename, O_RDONLY));
+  if (!fd) {
+    return util::ErrStatus("Could not open trace file (path: %s)",
+                           filename.c_str());
+  }
+  for (;;) {
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[kChunkSize]);
+    auto rsize = base::Read(*fd, buf.get(), kChunkSize);
+    if (rsize == 0)
+      break;
+    if (rsize < 0) {
+      return util::ErrStatus("Reading trace file failed (errno: %d, %s)",
+                             errno, strerror(errno));
+    }
+    file->chunks.emplace_back(std::move(buf), static_cast<size_t>(rsize));
+  }
+  return util::OkStatus();
+}
+
+class SerializingProtoTraceReader : public ChunkedTraceReader {
+ public:
+  SerializingProtoTraceReader(std::vector<uint8_t>* output) : output_(output) {}
+
+  util::Status Parse(std::unique_ptr<uint8_t[]> data, size_t size) override {
+    return tokenizer_.Tokenize(
+        std::move(data), size, [this](TraceBlobView packet) {
+          uint8_t buffer[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+
+          uint8_t* pos = buffer;
+          pos = protozero::proto_utils::WriteVarInt(kTracePacketTag, pos);
+          pos = protozero::proto_utils::WriteVarInt(packet.length(), pos);
+          output_->insert(output_->end(), buffer, pos);
+
+          output_->insert(output_->end(), packet.data(),
+                          packet.data() + packet.length());
+          return util::OkStatus();
+        });
+  }
+
+  void NotifyEndOfFile() override {}
+
+ private:
+  static constexpr uint8_t kTracePacketTag =
+      protozero::proto_utils::MakeTagLengthDelimited(
+          protos::pbzero::Trace::kPacketFieldNumber);
+
+  ProtoTraceTokenizer tokenizer_;
+  std::vector<uint8_t>* output_;
+};
+
+}  // namespace
+
+util::Status ReadTrace(
+    TraceProcessor* tp,
+    const char* filename,
+    const std::function<void(uint64_t parsed_size)>& progress_callback) {
+  base::ScopedFile fd(base::OpenFile(filename, O_RDONLY));
+  if (!fd)
+    return util::ErrStatus("Could not open trace file (path: %s)", filename);
+
+  uint64_t file_size = 0;
+
+  bool mapped = false;
+#if PERFETTO_HAS_MMAP()
+  RETURN_IF_ERROR(
+      ReadTraceUsingMmap(tp, *fd, &mapped, &file_size, progress_callback));
+#endif
+  if (!mapped) {
+    RETURN_IF_ERROR(
+        ReadTraceUsingAioOrRead(tp, *fd, &file_size, progress_callback));
+  }
 
   tp->NotifyEndOfFile();
   tp->SetCurrentTraceName(filename);
@@ -185,6 +352,105 @@ util::Status ReadTrace(
   return util::OkStatus();
 }
 
+util::Status ReadTraces(
+    TraceProcessor* tp,
+    const std::vector<std::string>& filenames,
+    const std::function<void(uint64_t parsed_size)>& progress_callback) {
+  // The tokenizers share the trackers and the sorter and can't run
+  // concurrently: only the reads are parallelized.
+  std::vector<TraceFile> files(filenames.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    TraceFile* file = &files[i];
+    const std::string* filename = &filenames[i];
+    file->reader = std::thread(
+        [file, filename] { file->status = ReadTraceFile(*filename, file); });
+  }
+
+  // All the readers must be joined, even after an error.
+  util::Status status = util::OkStatus();
+  uint64_t parsed_size = 0;
+  for (uint32_t i = 0; i < files.size(); i++) {
+    files[i].reader.join();
+    if (status.ok())
+      status = files[i].status;
+    for (size_t j = 0; j < files[i].chunks.size() && status.ok(); j++) {
+      if (progress_callback && j % 128 == 0)
+        progress_callback(parsed_size);
+      auto& chunk = files[i].chunks[j];
+      parsed_size += chunk.second;
+      status = tp->ParseTrace(i, std::move(chunk.first), chunk.second);
+    }
+    files[i].chunks.clear();
+  }
+  RETURN_IF_ERROR(status);
+
+  tp->NotifyEndOfFile();
+  tp->SetCurrentTraceName(base::Join(filenames, " + "));
+
+  if (progress_callback)
+    progress_callback(parsed_size);
+  return util::OkStatus();
+}
+
+util::Status ReadTraceSections(
+    TraceProcessor* tp,
+    const char* filename,
+    const TraceSectionFilter& filter,
+    const std::function<void(uint64_t parsed_size)>& progress_callback) {
+  base::ScopedFile fd(base::OpenFile(filename, O_RDONLY));
+  if (!fd)
+    return util::ErrStatus("Could not open trace file (path: %s)", filename);
+
+  // The index, if any, is found from the last bytes of the file.
+  base::Optional<size_t> file_size = base::GetFileSize(filename);
+  uint64_t index_size = 0;
+  if (file_size && *file_size >= util::kTraceIndexFooterSize) {
+    uint8_t footer[util::kTraceIndexFooterSize];
+    RETURN_IF_ERROR(ReadFileRange(*fd, *file_size - sizeof(footer), footer,
+                                  sizeof(footer)));
+    index_size = util::ParseTraceIndexFooter(footer);
+  }
+  if (index_size == 0 || index_size > *file_size) {
+    PERFETTO_ILOG("The trace has no index, loading all of it");
+    fd.reset();
+    return ReadTrace(tp, filename, progress_callback);
+  }
+
+  std::unique_ptr<uint8_t[]> index(new uint8_t[index_size]);
+  RETURN_IF_ERROR(ReadFileRange(*fd, *file_size - index_size, index.get(),
+                                static_cast<size_t>(index_size)));
+  std::vector<util::TraceFileRange> ranges;
+  RETURN_IF_ERROR(util::SelectTraceSections(index.get(),
+                                            static_cast<size_t>(index_size),
+                                            *file_size, filter, &ranges));
+
+  // The ranges start and end at packet boundaries: they are parsed as if
+  // they were contiguous.
+  uint64_t parsed_size = 0;
+  for (const util::TraceFileRange& range : ranges) {
+    for (uint64_t off = 0; off < range.size; off += kChunkSize) {
+      if (progress_callback)
+        progress_callback(parsed_size);
+      size_t chunk_size = static_cast<size_t>(
+          std::min<uint64_t>(kChunkSize, range.size - off));
+      std::unique_ptr<uint8_t[]> buf(new uint8_t[chunk_size]);
+      RETURN_IF_ERROR(
+          ReadFileRange(*fd, range.offset + off, buf.get(), chunk_size));
+      parsed_size += chunk_size;
+      RETURN_IF_ERROR(tp->Parse(std::move(buf), chunk_size));
+    }
+  }
+  PERFETTO_ILOG("Loaded %" PRIu64 " KB out of %zu KB of the indexed trace",
+                parsed_size / 1024, *file_size / 1024);
+
+  tp->NotifyEndOfFile();
+  tp->SetCurrentTraceName(filename);
+
+  if (progress_callback)
+    progress_callback(parsed_size);
+  return util::OkStatus();
+}
+
 util::Status DecompressTrace(const uint8_t* data,
                              size_t size,
                              std::vector<uint8_t>* output) {
@@ -20,17 +20,24 @@
 
 #include "src/trace_processor/rpc/httpd.h"
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/base/unix_task_runner.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/protozero/proto_ring_buffer.h"
 #include "src/trace_processor/rpc/rpc.h"
+#include "src/trace_processor/rpc/websocket.h"
 
 #include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
 
@@ -54,29 +61,143 @@ const char* kAllowedCORSOrigins[] = {
 // 32 MiB payload + 128K for HTTP headers.
 constexpr size_t kMaxRequestSize = (32 * 1024 + 128) * 1024;
 
+// The size of the query results, produced on a query thread, which can be
+// posted to the main thread but not sent yet before the query thread waits.
+constexpr size_t kMaxPendingQueryReplyBytes = 4 * 1024 * 1024;
+
+using RpcProto = protos::pbzero::TraceProcessorRpc;
+
+// Bounds the size of the results of a query which have been posted to the main
+// thread but not sent to the client yet, so that a query producing rows faster
+// than its client reads them doesn't buffer its whole result in memory.
+class QueryFlowControl {
+ public:
+  // Called on the query thread before posting |size| bytes.
+  void Acquire(size_t size) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] {
+      return pending_bytes_ < kMaxPendingQueryReplyBytes || aborted_;
+    });
+    pending_bytes_ += size;
+  }
+
+  // Called on the main thread once the bytes have been sent (or dropped).
+  void Release(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_bytes_ -= size;
+    cv_.notify_all();
+  }
+
+  // Makes Acquire() return immediately from now on. Called before the main
+  // thread waits for the query threads, as it won't send anything meanwhile.
+  void Abort() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    aborted_ = true;
+    cv_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t pending_bytes_ = 0;
+  bool aborted_ = false;
+};
+
+// A query session serving the queries of a WebSocket client.
+struct WebSocketSession {
+  std::shared_ptr<Rpc> rpc;
+  std::shared_ptr<QueryFlowControl> flow_control;
+
+  // The number of entries of WebSocketState::replay_log already run on |rpc|.
+  size_t replayed = 0;
+
+  // Set while a query runs on |rpc|.
+  bool busy = false;
+};
+
+// The state of a client connection upgraded to a WebSocket.
+//
+// The WebSocket carries the same TraceProcessorRpcStream as /rpc, split in
+// binary messages of any size. The TPM_QUERY_STREAMING requests are served on
+// query sessions when the server has query threads, the other requests on the
+// main instance. As the sessions are distinct SQLite connections, the queries
+// which are not read only (see QueryArgs.read_only) run in order on the primary
+// session, sessions[0], and are replayed on the other sessions before these
+// run their next read only query. Read only queries run concurrently, on any
+// idle session, once all the previous queries which are not read only are done.
+// The responses of concurrent queries are interleaved: their QueryResult has
+// the query_id of their QueryArgs.
+struct WebSocketState {
+  // Tokenizes the stream received in the data frames.
+  protozero::ProtoRingBuffer rpc_rxbuf;
+
+  std::vector<WebSocketSession> sessions;
+
+  // The QueryArgs of the successful queries which were not read only, in the
+  // order they ran on sessions[0].
+  std::vector<std::string> replay_log;
+
+  // The TraceProcessorRpc messages of the queries waiting for a session.
+  struct PendingQuery {
+    std::string rpc_msg;
+    bool read_only = false;
+  };
+  std::deque<PendingQuery> pending_queries;
+
+  // Set while a query which is not read only runs on sessions[0].
+  bool read_write_query_in_flight = false;
+
+  // Incremented when |sessions| are destroyed, to ignore the completion of the
+  // queries which were running on them.
+  uint64_t generation = 0;
+
+  // The |seq| of the responses sent on behalf of the sessions. The main
+  // instance numbers its own responses.
+  int64_t tx_seq_id = 0;
+};
+
 // Owns the socket and data for one HTTP client connection.
 struct Client {
-  Client(std::unique_ptr<base::UnixSocket> s)
+  Client(std::unique_ptr<base::UnixSocket> s, uint64_t i)
       : sock(std::move(s)),
-        rxbuf(base::PagedMemory::Allocate(kMaxRequestSize)) {}
+        rxbuf(base::PagedMemory::Allocate(kMaxRequestSize)),
+        id(i) {}
   size_t rxbuf_avail() { return rxbuf.size() - rxbuf_used; }
 
   std::unique_ptr<base::UnixSocket> sock;
   base::PagedMemory rxbuf;
   size_t rxbuf_used = 0;
+
+  // Identifies the client in the tasks posted back by the query threads, as
+  // the client can disconnect while its request is being served.
+  const uint64_t id;
+
+  // The query session serving the query requests of this client when the
+  // server uses query threads. Created by the first query request.
+  std::shared_ptr<Rpc> query_session;
+
+  // Set while a request of this client is served by a query thread: the
+  // following (pipelined) requests are only parsed once it is done.
+  bool query_in_flight = false;
+
+  // Non-null once the connection has been upgraded to a WebSocket by a request
+  // to /websocket: |rxbuf| then contains WebSocket frames.
+  std::unique_ptr<WebSocketState> websocket;
 };
 
 struct HttpRequest {
   base::StringView method;
   base::StringView uri;
   base::StringView origin;
+  base::StringView upgrade;
+  base::StringView websocket_key;
   base::StringView body;
   int id = 0;
 };
 
 class HttpServer : public base::UnixSocket::EventListener {
  public:
-  explicit HttpServer(std::unique_ptr<TraceProcessor>);
+  HttpServer(std::unique_ptr<TraceProcessor>, uint32_t query_threads);
   ~HttpServer() override;
   void Run(const char*, const char*);
 
@@ -84,9 +205,63 @@ class HttpServer : public base::UnixSocket::EventListener {
   Client* active_client() { return active_client_; }
 
  private:
+  void ParseHttpRequests(Client* client);
   size_t ParseOneHttpRequest(Client* client);
   void HandleRequest(Client*, const HttpRequest&);
   void ServeHelpPage(Client*);
+  Client* FindClient(uint64_t client_id);
+
+  // Replies to the WebSocket handshake |req| and upgrades the connection.
+  void UpgradeToWebSocket(Client*, const HttpRequest& req);
+
+  // Parses the WebSocket frame at the start of |rxbuf|. Returns its size or 0
+  // if the frame isn't complete yet (or the connection is being closed).
+  size_t ParseOneWebSocketFrame(Client* client);
+
+  // Serves one TraceProcessorRpc message received over a WebSocket.
+  void HandleWebSocketRpc(Client* client, const uint8_t* data, size_t len);
+
+  // Serves |rpc_msg| on the main instance, sending its responses to |client|.
+  void ServeWebSocketRpcOnMainInstance(Client* client,
+                                       const uint8_t* rpc_msg,
+                                       size_t len);
+
+  // Runs the pending queries of the WebSocket |client| which can start now.
+  void DispatchWebSocketQueries(Client* client);
+
+  // Runs |rpc_msg| on the query session |session_index| of |client|, on a
+  // query thread.
+  void RunWebSocketQuery(Client* client,
+                         size_t session_index,
+                         std::string rpc_msg,
+                         bool read_only);
+
+  // Called on the main thread once a query posted by RunWebSocketQuery() is
+  // done.
+  void OnWebSocketQueryDone(uint64_t client_id,
+                            uint64_t generation,
+                            size_t session_index,
+                            const std::string& query_args,
+                            bool read_only,
+                            bool succeeded);
+
+  // Destroys the query sessions of the WebSocket |client|.
+  void ResetWebSocketSessions(Client* client);
+
+  // Serves the query request |req| of |client| on a query session, on one of
+  // the query threads. Returns false if there is no query session, i.e. the
+  // trace has not been loaded yet.
+  bool PostToQuerySession(Client* client, const HttpRequest& req);
+
+  // Called on the query threads to send the chunk |data| of the reply to the
+  // client identified by |client_id|.
+  void SendQueryReplyChunk(uint64_t client_id, const void* data, size_t len);
+
+  // Called on the main thread once the request of |client_id| is done.
+  void OnQueryDone(uint64_t client_id);
+
+  // Waits for the query threads to be idle and destroys the query sessions.
+  void DestroyQuerySessions();
 
   void OnNewIncomingConnection(base::UnixSocket*,
                                std::unique_ptr<base::UnixSocket>) override;
@@ -101,6 +276,18 @@ class HttpServer : public base::UnixSocket::EventListener {
   std::list<Client> clients_;
   Client* active_client_ = nullptr;
   bool origin_error_logged_ = false;
+  uint64_t next_client_id_ = 0;
+
+  // When non-empty, the query requests (/query, /raw_query, /compute_metric
+  // and /restore_initial_tables) of each client are served on a query session
+  // of its own, on the query thread client id % size(), so that queries of
+  // different clients run concurrently.
+  std::vector<base::ThreadTaskRunner> query_threads_;
+
+  // The number of requests posted to |query_threads_| which are not done.
+  std::mutex query_tasks_mutex_;
+  std::condition_variable query_tasks_cv_;
+  uint32_t pending_query_tasks_ = 0;
 };
 
 HttpServer* g_httpd_instance;
@@ -146,9 +333,41 @@ void ShutdownBadRequest(base::UnixSocket* sock, const char* reason) {
   sock->Shutdown(/*notify=*/true);
 }
 
-HttpServer::HttpServer(std::unique_ptr<TraceProcessor> preloaded_instance)
-    : trace_processor_rpc_(std::move(preloaded_instance)) {}
-HttpServer::~HttpServer() = default;
+void SendWebSocketFrame(base::UnixSocket* sock,
+                        uint8_t opcode,
+                        const void* payload,
+                        size_t size) {
+  uint8_t hdr[kMaxWebSocketFrameHeaderSize];
+  size_t hdr_size = WriteWebSocketFrameHeader(opcode, size, hdr);
+  sock->Send(hdr, hdr_size);
+  if (size > 0)
+    sock->Send(payload, size);
+}
+
+// Closes the WebSocket with the given status code (see RFC 6455 7.4.1).
+void ShutdownWebSocket(base::UnixSocket* sock, uint16_t status_code) {
+  uint8_t payload[2] = {static_cast<uint8_t>(status_code >> 8),
+                        static_cast<uint8_t>(status_code & 0xff)};
+  SendWebSocketFrame(sock, kWebSocketClose, payload, sizeof(payload));
+  sock->Shutdown(/*notify=*/true);
+}
+
+HttpServer::HttpServer(std::unique_ptr<TraceProcessor> preloaded_instance,
+                       uint32_t query_threads)
+    : trace_processor_rpc_(std::move(preloaded_instance)) {
+  if (query_threads <= 1)
+    return;
+  for (uint32_t i = 0; i < query_threads; ++i) {
+    query_threads_.emplace_back(base::ThreadTaskRunner::CreateAndStart(
+        "TPQuery" + std::to_string(i)));
+  }
+  trace_processor_rpc_.SetTraceChangeCallback(
+      [this] { DestroyQuerySessions(); });
+}
+
+HttpServer::~HttpServer() {
+  DestroyQuerySessions();
+}
 
 void HttpServer::Run(const char* kBindAddr4, const char* kBindAddr6) {
   PERFETTO_ILOG("[HTTP] Starting RPC server on %s and %s", kBindAddr4,
@@ -184,7 +403,7 @@ void HttpServer::OnNewIncomingConnection(
     base::UnixSocket*,
     std::unique_ptr<base::UnixSocket> sock) {
   PERFETTO_LOG("[HTTP] New connection");
-  clients_.emplace_back(std::move(sock));
+  clients_.emplace_back(std::move(sock), next_client_id_++);
 }
 
 void HttpServer::OnConnect(base::UnixSocket*, bool) {}
@@ -218,11 +437,18 @@ void HttpServer::OnDataAvailable(base::UnixSocket* sock) {
       break;
   }
 
+  ParseHttpRequests(client);
+}
+
+void HttpServer::ParseHttpRequests(Client* client) {
+  char* rxbuf = reinterpret_cast<char*>(client->rxbuf.Get());
+
   // At this point |rxbuf| can contain a partial HTTP request, a full one or
   // more (in case of HTTP Keepalive pipelining).
-  for (;;) {
+  while (!client->query_in_flight) {
     active_client_ = client;
-    size_t bytes_consumed = ParseOneHttpRequest(client);
+    size_t bytes_consumed = client->websocket ? ParseOneWebSocketFrame(client)
+                                              : ParseOneHttpRequest(client);
     active_client_ = nullptr;
     if (bytes_consumed == 0)
       break;
@@ -275,6 +501,10 @@ size_t HttpServer::ParseOneHttpRequest(Client* client) {
         http_req.origin = hdr_value;
       } else if (hdr_name.CaseInsensitiveEq("x-seq-id")) {
         http_req.id = atoi(hdr_value.ToStdString().c_str());
+      } else if (hdr_name.CaseInsensitiveEq("upgrade")) {
+        http_req.upgrade = hdr_value;
+      } else if (hdr_name.CaseInsensitiveEq("sec-websocket-key")) {
+        http_req.websocket_key = hdr_value;
       }
     }
     pos = next + 2;
@@ -291,6 +521,403 @@ size_t HttpServer::ParseOneHttpRequest(Client* client) {
   return http_req_size;
 }
 
+Client* HttpServer::FindClient(uint64_t client_id) {
+  for (Client& client : clients_) {
+    if (client.id == client_id)
+      return &client;
+  }
+  return nullptr;
+}
+
+bool HttpServer::PostToQuerySession(Client* client, const HttpRequest& req) {
+  if (!client->query_session) {
+    std::unique_ptr<Rpc> session = trace_processor_rpc_.CreateQuerySession();
+    if (!session)
+      return false;
+    client->query_session.reset(session.release());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(query_tasks_mutex_);
+    pending_query_tasks_++;
+  }
+  client->query_in_flight = true;
+
+  // The request is copied as |rxbuf| is reused for the following requests.
+  uint64_t client_id = client->id;
+  std::shared_ptr<Rpc> session = client->query_session;
+  std::string uri = req.uri.ToStdString();
+  std::shared_ptr<std::string> body(new std::string(req.body.ToStdString()));
+  base::ThreadTaskRunner& runner =
+      query_threads_[client_id % query_threads_.size()];
+  runner.PostTask([this, client_id, session, uri, body]() mutable {
+    const auto* data = reinterpret_cast<const uint8_t*>(body->data());
+    if (uri == "/query") {
+      session->Query(data, body->size(),
+                     [this, client_id](const uint8_t* buf, size_t len, bool) {
+                       SendQueryReplyChunk(client_id, buf, len);
+                     });
+    } else if (uri == "/raw_query") {
+      std::vector<uint8_t> res = session->RawQuery(data, body->size());
+      SendQueryReplyChunk(client_id, res.data(), res.size());
+    } else if (uri == "/compute_metric") {
+      std::vector<uint8_t> res = session->ComputeMetric(data, body->size());
+      SendQueryReplyChunk(client_id, res.data(), res.size());
+    } else {
+      PERFETTO_DCHECK(uri == "/restore_initial_tables");
+      session->RestoreInitialTables();
+    }
+    task_runner_.PostTask([this, client_id] { OnQueryDone(client_id); });
+
+    // The session must not outlive DestroyQuerySessions().
+    session.reset();
+    std::lock_guard<std::mutex> lock(query_tasks_mutex_);
+    pending_query_tasks_--;
+    query_tasks_cv_.notify_all();
+  });
+  return true;
+}
+
+void HttpServer::SendQueryReplyChunk(uint64_t client_id,
+                                     const void* data,
+                                     size_t len) {
+  // An empty chunk would terminate the chunked stream.
+  if (len == 0)
+    return;
+  char chunk_hdr[32];
+  auto hdr_len = static_cast<size_t>(sprintf(chunk_hdr, "%zx\r\n", len));
+  std::shared_ptr<std::vector<char>> chunk(new std::vector<char>());
+  chunk->reserve(hdr_len + len + 2);
+  chunk->insert(chunk->end(), chunk_hdr, chunk_hdr + hdr_len);
+  const char* chars = static_cast<const char*>(data);
+  chunk->insert(chunk->end(), chars, chars + len);
+  Append(*chunk, "\r\n");
+  task_runner_.PostTask([this, client_id, chunk] {
+    Client* client = FindClient(client_id);
+    if (client)
+      client->sock->Send(chunk->data(), chunk->size());
+  });
+}
+
+void HttpServer::OnQueryDone(uint64_t client_id) {
+  Client* client = FindClient(client_id);
+  if (!client)
+    return;
+  // Terminate chunked stream.
+  client->sock->Send("0\r\n\r\n", 5);
+  client->query_in_flight = false;
+  ParseHttpRequests(client);
+}
+
+void HttpServer::DestroyQuerySessions() {
+  // The queries waiting for their results to be sent would never finish, as
+  // this thread doesn't send anything until they do.
+  for (Client& client : clients_) {
+    if (!client.websocket)
+      continue;
+    for (WebSocketSession& session : client.websocket->sessions)
+      session.flow_control->Abort();
+  }
+  {
+    std::unique_lock<std::mutex> lock(query_tasks_mutex_);
+    query_tasks_cv_.wait(lock, [this] { return pending_query_tasks_ == 0; });
+  }
+  for (Client& client : clients_) {
+    client.query_session.reset();
+    if (client.websocket)
+      ResetWebSocketSessions(&client);
+  }
+}
+
+void HttpServer::UpgradeToWebSocket(Client* client, const HttpRequest& req) {
+  if (req.method != "GET" || !req.upgrade.CaseInsensitiveEq("websocket") ||
+      req.websocket_key.empty()) {
+    return HttpReply(client->sock.get(), "400 Bad Request");
+  }
+  std::string accept_hdr =
+      "Sec-WebSocket-Accept: " + ComputeWebSocketAccept(req.websocket_key);
+  HttpReply(client->sock.get(), "101 Switching Protocols",
+            {"Upgrade: websocket", "Connection: Upgrade", accept_hdr.c_str()},
+            nullptr, kOmitContentLength);
+  client->websocket.reset(new WebSocketState());
+}
+
+size_t HttpServer::ParseOneWebSocketFrame(Client* client) {
+  auto* rxbuf = reinterpret_cast<uint8_t*>(client->rxbuf.Get());
+  base::UnixSocket* sock = client->sock.get();
+  WebSocketFrame frame;
+  base::Optional<size_t> frame_size =
+      ParseWebSocketFrame(rxbuf, client->rxbuf_used, &frame);
+  // The server must close the connection when a client frame is not masked
+  // (RFC 6455 5.1).
+  if (!frame_size || (*frame_size > 0 && !frame.masked)) {
+    ShutdownWebSocket(sock, 1002);  // Protocol error.
+    return 0;
+  }
+  if (*frame_size == 0)
+    return 0;
+
+  switch (frame.opcode) {
+    case kWebSocketContinuation:
+    case kWebSocketBinary: {
+      // The messages are just a transport for the TraceProcessorRpcStream,
+      // their boundaries don't matter.
+      WebSocketState* ws = client->websocket.get();
+      ws->rpc_rxbuf.Append(frame.payload, frame.payload_size);
+      for (;;) {
+        auto msg = ws->rpc_rxbuf.ReadMessage();
+        if (msg.fatal_framing_error) {
+          ShutdownWebSocket(sock, 1007);  // Invalid message data.
+          return 0;
+        }
+        if (!msg.valid())
+          break;
+        HandleWebSocketRpc(client, msg.start, msg.len);
+      }
+      break;
+    }
+    case kWebSocketPing:
+      SendWebSocketFrame(sock, kWebSocketPong, frame.payload,
+                         frame.payload_size);
+      break;
+    case kWebSocketPong:
+      break;
+    case kWebSocketClose:
+      SendWebSocketFrame(sock, kWebSocketClose, nullptr, 0);
+      sock->Shutdown(/*notify=*/true);
+      return 0;
+    default:
+      ShutdownWebSocket(sock, 1003);  // Unsupported data, e.g. text.
+      return 0;
+  }
+  return *frame_size;
+}
+
+void HttpServer::HandleWebSocketRpc(Client* client,
+                                    const uint8_t* data,
+                                    size_t len) {
+  WebSocketState* ws = client->websocket.get();
+  RpcProto::Decoder req(data, len);
+  switch (req.request()) {
+    case RpcProto::TPM_QUERY_STREAMING:
+      if (query_threads_.empty())
+        break;
+      {
+        protos::pbzero::QueryArgs::Decoder args(req.query_args());
+        ws->pending_queries.emplace_back();
+        ws->pending_queries.back().rpc_msg.assign(
+            reinterpret_cast<const char*>(data), len);
+        // QueryArgs.cache_result implies read_only.
+        ws->pending_queries.back().read_only =
+            args.read_only() || args.cache_result();
+      }
+      return DispatchWebSocketQueries(client);
+    case RpcProto::TPM_CANCEL_QUERY: {
+      auto args = req.cancel_query_args();
+      for (WebSocketSession& session : ws->sessions)
+        session.rpc->CancelQuery(args.data, args.size);
+      break;
+    }
+    case RpcProto::TPM_RESTORE_INITIAL_TABLES:
+      // The following queries will run on new sessions. The queries still
+      // running on the current ones are not affected.
+      ResetWebSocketSessions(client);
+      break;
+    default:
+      break;
+  }
+  ServeWebSocketRpcOnMainInstance(client, data, len);
+}
+
+void HttpServer::ServeWebSocketRpcOnMainInstance(Client* client,
+                                                 const uint8_t* rpc_msg,
+                                                 size_t len) {
+  static auto resp_fn = [](const void* data, uint32_t size) {
+    auto* ws_client = g_httpd_instance->active_client();
+    PERFETTO_CHECK(ws_client);
+    if (data == nullptr) {
+      // Unrecoverable RPC error case.
+      ShutdownWebSocket(ws_client->sock.get(), 1011);  // Internal error.
+      return;
+    }
+    SendWebSocketFrame(ws_client->sock.get(), kWebSocketBinary, data, size);
+  };
+
+  // This can be called outside of ParseHttpRequests(), when dispatching the
+  // pending queries of |client|.
+  Client* prev_active_client = active_client_;
+  active_client_ = client;
+  trace_processor_rpc_.SetRpcResponseFunction(resp_fn);
+  trace_processor_rpc_.OnRpcMessage(rpc_msg, len);
+  trace_processor_rpc_.SetRpcResponseFunction(nullptr);
+  active_client_ = prev_active_client;
+}
+
+void HttpServer::DispatchWebSocketQueries(Client* client) {
+  WebSocketState* ws = client->websocket.get();
+  while (!ws->pending_queries.empty()) {
+    if (ws->sessions.empty()) {
+      std::unique_ptr<Rpc> session = trace_processor_rpc_.CreateQuerySession();
+      if (!session) {
+        // There is no trace yet: serve the query on the main instance.
+        std::string rpc_msg = std::move(ws->pending_queries.front().rpc_msg);
+        ws->pending_queries.pop_front();
+        ServeWebSocketRpcOnMainInstance(
+            client, reinterpret_cast<const uint8_t*>(rpc_msg.data()),
+            rpc_msg.size());
+        continue;
+      }
+      ws->sessions.emplace_back();
+      ws->sessions.back().rpc.reset(session.release());
+      ws->sessions.back().flow_control.reset(new QueryFlowControl());
+    }
+
+    bool read_only = ws->pending_queries.front().read_only;
+    size_t session_index = 0;
+    if (!read_only) {
+      // These queries can change the schema seen by the next ones, so they run
+      // one at a time, in order, on the primary session.
+      if (ws->sessions[0].busy)
+        return;
+    } else {
+      if (ws->read_write_query_in_flight)
+        return;
+      while (session_index < ws->sessions.size() &&
+             ws->sessions[session_index].busy) {
+        session_index++;
+      }
+      if (session_index == ws->sessions.size()) {
+        if (ws->sessions.size() >= query_threads_.size())
+          return;
+        std::unique_ptr<Rpc> session =
+            trace_processor_rpc_.CreateQuerySession();
+        if (!session)
+          return;
+        ws->sessions.emplace_back();
+        ws->sessions.back().rpc.reset(session.release());
+        ws->sessions.back().flow_control.reset(new QueryFlowControl());
+      }
+    }
+
+    std::string rpc_msg = std::move(ws->pending_queries.front().rpc_msg);
+    ws->pending_queries.pop_front();
+    RunWebSocketQuery(client, session_index, std::move(rpc_msg), read_only);
+  }
+}
+
+void HttpServer::RunWebSocketQuery(Client* client,
+                                   size_t session_index,
+                                   std::string rpc_msg,
+                                   bool read_only) {
+  WebSocketState* ws = client->websocket.get();
+  WebSocketSession& session = ws->sessions[session_index];
+  session.busy = true;
+  if (!read_only)
+    ws->read_write_query_in_flight = true;
+
+  // The queries which ran on the primary session since the last query of this
+  // session.
+  std::shared_ptr<std::vector<std::string>> replay(
+      new std::vector<std::string>(
+          ws->replay_log.begin() + static_cast<ptrdiff_t>(session.replayed),
+          ws->replay_log.end()));
+  session.replayed = ws->replay_log.size();
+
+  {
+    std::lock_guard<std::mutex> lock(query_tasks_mutex_);
+    pending_query_tasks_++;
+  }
+
+  uint64_t client_id = client->id;
+  uint64_t generation = ws->generation;
+  std::shared_ptr<Rpc> rpc = session.rpc;
+  std::shared_ptr<QueryFlowControl> flow_control = session.flow_control;
+  std::shared_ptr<std::string> msg(new std::string(std::move(rpc_msg)));
+  base::ThreadTaskRunner& runner =
+      query_threads_[(client_id + session_index) % query_threads_.size()];
+  runner.PostTask([this, client_id, generation, session_index, read_only, rpc,
+                   flow_control, replay, msg]() mutable {
+    for (const std::string& query : *replay) {
+      rpc->Query(reinterpret_cast<const uint8_t*>(query.data()), query.size(),
+                 [](const uint8_t*, size_t, bool) {});
+    }
+
+    RpcProto::Decoder req(reinterpret_cast<const uint8_t*>(msg->data()),
+                          msg->size());
+    auto args = req.query_args();
+    bool succeeded = true;
+    rpc->Query(args.data, args.size, [&](const uint8_t* buf, size_t len, bool) {
+      protos::pbzero::QueryResult::Decoder result(buf, len);
+      succeeded = succeeded && !result.has_error();
+
+      flow_control->Acquire(len);
+      std::shared_ptr<std::vector<uint8_t>> batch(
+          new std::vector<uint8_t>(buf, buf + len));
+      task_runner_.PostTask([this, client_id, flow_control, batch] {
+        Client* ws_client = FindClient(client_id);
+        if (ws_client && ws_client->websocket) {
+          protozero::HeapBuffered<protos::pbzero::TraceProcessorRpcStream>
+              stream;
+          auto* resp = stream->add_msg();
+          resp->set_seq(ws_client->websocket->tx_seq_id++);
+          resp->set_response(RpcProto::TPM_QUERY_STREAMING);
+          resp->AppendBytes(RpcProto::kQueryResultFieldNumber, batch->data(),
+                            batch->size());
+          std::vector<uint8_t> data = stream.SerializeAsArray();
+          SendWebSocketFrame(ws_client->sock.get(), kWebSocketBinary,
+                             data.data(), data.size());
+        }
+        flow_control->Release(batch->size());
+      });
+    });
+
+    std::string query_args(reinterpret_cast<const char*>(args.data),
+                           args.size);
+    task_runner_.PostTask([this, client_id, generation, session_index,
+                           query_args, read_only, succeeded] {
+      OnWebSocketQueryDone(client_id, generation, session_index, query_args,
+                           read_only, succeeded);
+    });
+
+    // The session must not outlive DestroyQuerySessions().
+    rpc.reset();
+    std::lock_guard<std::mutex> lock(query_tasks_mutex_);
+    pending_query_tasks_--;
+    query_tasks_cv_.notify_all();
+  });
+}
+
+void HttpServer::OnWebSocketQueryDone(uint64_t client_id,
+                                      uint64_t generation,
+                                      size_t session_index,
+                                      const std::string& query_args,
+                                      bool read_only,
+                                      bool succeeded) {
+  Client* client = FindClient(client_id);
+  if (!client || !client->websocket)
+    return;
+  WebSocketState* ws = client->websocket.get();
+  if (generation == ws->generation) {
+    ws->sessions[session_index].busy = false;
+    if (!read_only) {
+      ws->read_write_query_in_flight = false;
+      if (succeeded) {
+        ws->replay_log.push_back(query_args);
+        ws->sessions[0].replayed = ws->replay_log.size();
+      }
+    }
+  }
+  DispatchWebSocketQueries(client);
+}
+
+void HttpServer::ResetWebSocketSessions(Client* client) {
+  WebSocketState* ws = client->websocket.get();
+  ws->sessions.clear();
+  ws->replay_log.clear();
+  ws->read_write_query_in_flight = false;
+  ws->generation++;
+}
+
 void HttpServer::HandleRequest(Client* client, const HttpRequest& req) {
   if (req.uri == "/") {
     // If a user tries to open http://127.0.0.1:9001/ show a minimal help page.
@@ -337,6 +964,13 @@ void HttpServer::HandleRequest(Client* client, const HttpRequest& req) {
       allow_origin_hdr.c_str(),
   };
 
+  if (req.uri == "/websocket") {
+    // Browsers don't apply CORS to WebSockets: the origin is checked here.
+    if (!req.origin.empty() && allow_origin_hdr.empty())
+      return HttpReply(client->sock.get(), "403 Forbidden");
+    return UpgradeToWebSocket(client, req);
+  }
+
   if (req.method == "OPTIONS") {
     // CORS headers.
     return HttpReply(client->sock.get(), "204 No Content",
@@ -349,6 +983,23 @@ void HttpServer::HandleRequest(Client* client, const HttpRequest& req) {
                      });
   }
 
+  if (!query_threads_.empty() &&
+      (req.uri == "/query" || req.uri == "/raw_query" ||
+       req.uri == "/compute_metric" || req.uri == "/restore_initial_tables")) {
+    // The reply is always chunked, as its size is only known once the request
+    // has been served.
+    strncpy(transfer_encoding_hdr, "Transfer-Encoding: chunked",
+            sizeof(transfer_encoding_hdr));
+    if (PostToQuerySession(client, req)) {
+      HttpReply(client->sock.get(), "200 OK", headers, nullptr,
+                kOmitContentLength);
+      return;
+    }
+    // There is no trace yet: serve the request on the main instance.
+    strncpy(transfer_encoding_hdr, "Transfer-Encoding: identity",
+            sizeof(transfer_encoding_hdr));
+  }
+
   if (req.uri == "/rpc") {
     // Start the chunked reply.
     strncpy(transfer_encoding_hdr, "Transfer-Encoding: chunked",
@@ -387,6 +1038,11 @@ void HttpServer::HandleRequest(Client* client, const HttpRequest& req) {
     return HttpReply(client->sock.get(), "200 OK", headers);
   }
 
+  if (req.uri == "/flush") {
+    trace_processor_rpc_.Flush();
+    return HttpReply(client->sock.get(), "200 OK", headers);
+  }
+
   if (req.uri == "/notify_eof") {
     trace_processor_rpc_.NotifyEndOfFile();
     return HttpReply(client->sock.get(), "200 OK", headers);
@@ -440,6 +1096,23 @@ void HttpServer::HandleRequest(Client* client, const HttpRequest& req) {
                      response.size());
   }
 
+  // Cancels the query with the given query id, whichever client runs it. This
+  // is only useful with query threads: otherwise the queries are run on this
+  // thread, so this request is only served once they are done.
+  if (req.uri == "/cancel_query") {
+    const auto* data = reinterpret_cast<const uint8_t*>(req.body.data());
+    trace_processor_rpc_.CancelQuery(data, req.body.size());
+    for (Client& other : clients_) {
+      if (other.query_session)
+        other.query_session->CancelQuery(data, req.body.size());
+      if (!other.websocket)
+        continue;
+      for (WebSocketSession& session : other.websocket->sessions)
+        session.rpc->CancelQuery(data, req.body.size());
+    }
+    return HttpReply(client->sock.get(), "200 OK", headers);
+  }
+
   if (req.uri == "/status") {
     auto status = trace_processor_rpc_.GetStatus();
     return HttpReply(client->sock.get(), "200 OK", headers, status.data(),
@@ -470,8 +1143,9 @@ void HttpServer::HandleRequest(Client* client, const HttpRequest& req) {
 }  // namespace
 
 void RunHttpRPCServer(std::unique_ptr<TraceProcessor> preloaded_instance,
-                      std::string port_number) {
-  HttpServer srv(std::move(preloaded_instance));
+                      std::string port_number,
+                      uint32_t query_threads) {
+  HttpServer srv(std::move(preloaded_instance), query_threads);
   g_httpd_instance = &srv;
   std::string port = port_number.empty() ? kBindPort : port_number;
   std::string ipv4_addr = "127.0.0.1:" + port;
@@ -499,6 +1173,13 @@ Example: perfetto.TraceProcessor(addr='localhost:9001')
 See https://perfetto.dev/docs/analysis/trace-processor#python-api for more.
 
 
+3. WebSocket.
+
+ws://localhost:9001/websocket carries the same TraceProcessorRpcStream as
+/rpc, in binary messages. With --http-query-threads, the queries marked as
+read_only in their QueryArgs run concurrently.
+
+
 For questions:
 https://perfetto.dev/docs/contributing/getting-started#community
 )";
@@ -20,6 +20,8 @@
 #include <memory>
 #include <string>
 
+#include <stdint.h>
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -30,7 +32,13 @@ class TraceProcessor;
 // The unique_ptr argument is optional. If non-null, the HTTP server will adopt
 // an existing instance with a pre-loaded trace. If null, it will create a new
 // instance when pushing data into the /parse endpoint.
-void RunHttpRPCServer(std::unique_ptr<TraceProcessor>, std::string);
+// If |query_threads| is greater than 1, the query requests of each HTTP client
+// connection are served on a query session of its own (see
+// TraceProcessor::CreateQuerySession()) on one of |query_threads| threads, so
+// that the queries of different clients run concurrently.
+void RunHttpRPCServer(std::unique_ptr<TraceProcessor>,
+                      std::string,
+                      uint32_t query_threads = 0);
 
 }  // namespace trace_processor
 }  // namespace perfetto
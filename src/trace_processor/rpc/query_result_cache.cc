@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/query_result_cache.h"
+
+#include "perfetto/protozero/proto_utils.h"
+
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+// Appends |data|, prefixed with its size, to |key|.
+void AppendField(const void* data, size_t size, std::string* key) {
+  uint8_t size_buf[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  uint8_t* end = protozero::proto_utils::WriteVarInt(size, size_buf);
+  key->append(reinterpret_cast<const char*>(size_buf),
+              static_cast<size_t>(end - size_buf));
+  key->append(static_cast<const char*>(data), size);
+}
+
+}  // namespace
+
+constexpr size_t QueryResultCache::kDefaultMaxBytes;
+
+QueryResultCache::QueryResultCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+QueryResultCache::~QueryResultCache() = default;
+
+// static
+std::string QueryResultCache::NormalizeSql(base::StringView sql) {
+  std::string res;
+  res.reserve(sql.size());
+  const char* const end = sql.data() + sql.size();
+  bool pending_space = false;
+  for (const char* c = sql.data(); c < end;) {
+    if (IsSpace(*c)) {
+      pending_space = true;
+      c++;
+      continue;
+    }
+    if (pending_space && !res.empty())
+      res.push_back(' ');
+    pending_space = false;
+
+    // Finds the end of the token starting at |c| which must be kept as is.
+    const char* token_end = c + 1;
+    if (*c == '\'' || *c == '"' || *c == '`' || *c == '[') {
+      const char quote = *c == '[' ? ']' : *c;
+      while (token_end < end && *token_end != quote)
+        token_end++;
+      token_end = token_end < end ? token_end + 1 : end;
+    } else if (*c == '-' && c + 1 < end && c[1] == '-') {
+      // Keeps the newline, which ends the comment.
+      while (token_end < end && *token_end != '\n')
+        token_end++;
+      token_end = token_end < end ? token_end + 1 : end;
+    } else if (*c == '/' && c + 1 < end && c[1] == '*') {
+      token_end = c + 2;
+      while (token_end + 1 < end &&
+             !(token_end[0] == '*' && token_end[1] == '/')) {
+        token_end++;
+      }
+      token_end = token_end + 1 < end ? token_end + 2 : end;
+    }
+    res.append(c, static_cast<size_t>(token_end - c));
+    c = token_end;
+  }
+  return res;
+}
+
+// static
+std::string QueryResultCache::GetKey(const uint8_t* args, size_t len) {
+  protos::pbzero::QueryArgs::Decoder query(args, len);
+  if (!query.cache_result() || query.profile())
+    return std::string();
+
+  std::string key;
+  key.push_back(query.columnar_result() ? 'c' : 'r');
+  uint64_t max_rows = query.max_rows();
+  AppendField(&max_rows, sizeof(max_rows), &key);
+  std::string sql = NormalizeSql(
+      base::StringView(query.sql_query().data, query.sql_query().size));
+  AppendField(sql.data(), sql.size(), &key);
+  for (auto it = query.args(); it; ++it)
+    AppendField(it->data(), it->size(), &key);
+  return key;
+}
+
+std::shared_ptr<const QueryResultCache::Batches> QueryResultCache::Find(
+    const std::string& key) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    stats_.misses++;
+    return nullptr;
+  }
+  stats_.hits++;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->batches;
+}
+
+void QueryResultCache::Insert(std::string key,
+                              std::shared_ptr<const Batches> batches) {
+  size_t size = key.size();
+  for (const std::vector<uint8_t>& batch : *batches)
+    size += batch.size();
+  if (size > max_bytes_)
+    return;
+
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    bytes_ -= it->second->size;
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  EvictToFit(max_bytes_ - size);
+  entries_.push_front(Entry{key, std::move(batches), size});
+  index_.emplace(std::move(key), entries_.begin());
+  bytes_ += size;
+}
+
+void QueryResultCache::Clear() {
+  entries_.clear();
+  index_.clear();
+  bytes_ = 0;
+}
+
+void QueryResultCache::SetMaxBytes(size_t max_bytes) {
+  max_bytes_ = max_bytes;
+  EvictToFit(max_bytes);
+}
+
+void QueryResultCache::EvictToFit(size_t max_bytes) {
+  while (bytes_ > max_bytes) {
+    const Entry& entry = entries_.back();
+    bytes_ -= entry.size;
+    index_.erase(entry.key);
+    entries_.pop_back();
+    stats_.evictions++;
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
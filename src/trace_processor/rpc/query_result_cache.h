@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_RPC_QUERY_RESULT_CACHE_H_
+#define SRC_TRACE_PROCESSOR_RPC_QUERY_RESULT_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/ext/base/string_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Caches the serialized results of the queries run by Rpc::Query() with
+// QueryArgs.cache_result set, so that the queries the UI repeats while
+// panning and zooming (e.g. the same track query over the same window) are
+// answered without running the SQL again.
+//
+// The key is the SQL text with its insignificant whitespace collapsed, the
+// values bound to its parameters and the options which change the result
+// (format and max rows). The value is the list of QueryResult batches,
+// serialized without their query_id.
+//
+// Entries are evicted in least recently used order once the batches of all
+// the entries exceed the byte budget. Results larger than the budget are not
+// cached. The cache does not know when the result of a query changes: the
+// owner must Clear() it whenever the trace or the tables may have changed.
+class QueryResultCache {
+ public:
+  static constexpr size_t kDefaultMaxBytes = 32 * 1024 * 1024;
+
+  using Batches = std::vector<std::vector<uint8_t>>;
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  explicit QueryResultCache(size_t max_bytes = kDefaultMaxBytes);
+  ~QueryResultCache();
+
+  QueryResultCache(const QueryResultCache&) = delete;
+  QueryResultCache& operator=(const QueryResultCache&) = delete;
+
+  // Returns |sql| with the runs of whitespace outside of string literals,
+  // quoted identifiers and comments replaced by a single space, and without
+  // leading and trailing whitespace.
+  static std::string NormalizeSql(base::StringView sql);
+
+  // Returns the key of the QueryArgs message |args|, or an empty string if
+  // its result must not be cached (i.e. |cache_result| is not set or the
+  // query is profiled).
+  static std::string GetKey(const uint8_t* args, size_t len);
+
+  // Returns the batches cached for |key|, or nullptr if there are none. The
+  // batches remain valid after the entry is evicted.
+  std::shared_ptr<const Batches> Find(const std::string& key);
+
+  // Caches |batches| for |key|, evicting the least recently used entries to
+  // stay within the budget.
+  void Insert(std::string key, std::shared_ptr<const Batches> batches);
+
+  // Removes all the entries. The stats are preserved.
+  void Clear();
+
+  // Changes the budget, evicting entries if needed. 0 disables the cache.
+  void SetMaxBytes(size_t max_bytes);
+
+  size_t max_bytes() const { return max_bytes_; }
+  size_t bytes() const { return bytes_; }
+  size_t entry_count() const { return entries_.size(); }
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const Batches> batches;
+    size_t size;
+  };
+
+  void EvictToFit(size_t max_bytes);
+
+  size_t max_bytes_;
+  size_t bytes_ = 0;
+  Stats stats_;
+
+  // Most recently used entries are at the front.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_RPC_QUERY_RESULT_CACHE_H_
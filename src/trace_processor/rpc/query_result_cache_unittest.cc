@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/query_result_cache.h"
+
+#include <string>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/rpc/rpc.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using QueryArgsProto = protos::pbzero::QueryArgs;
+using StatusProto = protos::pbzero::StatusResult;
+
+std::string NormalizeSql(const char* sql) {
+  return QueryResultCache::NormalizeSql(base::StringView(sql));
+}
+
+std::vector<uint8_t> SerializeQueryArgs(const std::string& sql,
+                                        bool cache_result,
+                                        uint64_t query_id = 0,
+                                        int64_t arg = 0) {
+  protozero::HeapBuffered<QueryArgsProto> args;
+  args->set_sql_query(sql);
+  args->set_cache_result(cache_result);
+  if (query_id)
+    args->set_query_id(query_id);
+  if (arg)
+    args->add_args()->set_long_value(arg);
+  return args.SerializeAsArray();
+}
+
+std::string GetKey(const std::string& sql, int64_t arg = 0) {
+  std::vector<uint8_t> args = SerializeQueryArgs(sql, true, 0, arg);
+  return QueryResultCache::GetKey(args.data(), args.size());
+}
+
+std::shared_ptr<const QueryResultCache::Batches> MakeBatches(size_t size) {
+  return std::make_shared<QueryResultCache::Batches>(
+      1, std::vector<uint8_t>(size));
+}
+
+TEST(QueryResultCacheTest, NormalizeSql) {
+  EXPECT_EQ(NormalizeSql("  select\n\t ts,  dur \nfrom  slice  "),
+            "select ts, dur from slice");
+  // Literals, quoted identifiers and comments are kept as they are.
+  EXPECT_EQ(NormalizeSql("select 'a  b', \"c  d\", [e  f] from x"),
+            "select 'a  b', \"c  d\", [e  f] from x");
+  EXPECT_EQ(NormalizeSql("select 1 --  a\n  , 2 /*  b  */  from x"),
+            "select 1 --  a\n , 2 /*  b  */ from x");
+  EXPECT_EQ(NormalizeSql("select 'a  "), "select 'a  ");
+}
+
+TEST(QueryResultCacheTest, Key) {
+  EXPECT_EQ(GetKey("select  ts from slice"), GetKey(" select ts\nfrom slice"));
+  EXPECT_NE(GetKey("select ts from slice"), GetKey("select dur from slice"));
+  EXPECT_EQ(GetKey("select ?", 1), GetKey("select ?", 1));
+  EXPECT_NE(GetKey("select ?", 1), GetKey("select ?", 2));
+
+  std::vector<uint8_t> args = SerializeQueryArgs("select 1", false);
+  EXPECT_TRUE(QueryResultCache::GetKey(args.data(), args.size()).empty());
+}
+
+TEST(QueryResultCacheTest, Eviction) {
+  QueryResultCache cache(100);
+  cache.Insert("a", MakeBatches(40));
+  cache.Insert("b", MakeBatches(40));
+  EXPECT_EQ(cache.bytes(), 82u);
+  EXPECT_EQ(cache.entry_count(), 2u);
+
+  // "b" is the least recently used entry once "a" is found.
+  EXPECT_TRUE(cache.Find("a"));
+  cache.Insert("c", MakeBatches(40));
+  EXPECT_FALSE(cache.Find("b"));
+  EXPECT_TRUE(cache.Find("a"));
+  EXPECT_TRUE(cache.Find("c"));
+  EXPECT_EQ(cache.stats().hits, 3u);
+  EXPECT_EQ(cache.stats().misses, 1u);
+  EXPECT_EQ(cache.stats().evictions, 1u);
+
+  // Results larger than the budget are not cached.
+  cache.Insert("d", MakeBatches(200));
+  EXPECT_FALSE(cache.Find("d"));
+
+  cache.SetMaxBytes(50);
+  EXPECT_EQ(cache.entry_count(), 1u);
+  cache.Clear();
+  EXPECT_EQ(cache.entry_count(), 0u);
+  EXPECT_EQ(cache.bytes(), 0u);
+}
+
+class QueryResultCacheRpcTest : public ::testing::Test {
+ protected:
+  QueryResultCacheRpcTest() : rpc_(TraceProcessor::CreateInstance(Config())) {}
+
+  // Returns the concatenated batches of the result of |sql|.
+  std::vector<uint8_t> Query(const std::string& sql,
+                             bool cache_result,
+                             uint64_t query_id = 0) {
+    std::vector<uint8_t> args = SerializeQueryArgs(sql, cache_result, query_id);
+    std::vector<uint8_t> res;
+    rpc_.Query(args.data(), args.size(),
+               [&res](const uint8_t* buf, size_t len, bool) {
+                 res.insert(res.end(), buf, buf + len);
+               });
+    return res;
+  }
+
+  std::vector<uint8_t> GetStatus() { return rpc_.GetStatus(); }
+
+  Rpc rpc_;
+};
+
+TEST_F(QueryResultCacheRpcTest, Query) {
+  Query("create table t as select 1 as x", false);
+  std::vector<uint8_t> res = Query("select x from t", true);
+  EXPECT_EQ(Query("select x\n  from t", true), res);
+
+  // The query id is appended to the cached batches.
+  std::vector<uint8_t> res_with_id = Query("select x from t", true, 42);
+  protos::pbzero::QueryResult::Decoder with_id(res_with_id.data(),
+                                               res_with_id.size());
+  EXPECT_EQ(with_id.query_id(), 42u);
+
+  std::vector<uint8_t> status = GetStatus();
+  StatusProto::Decoder status_decoder(status.data(), status.size());
+  StatusProto::QueryResultCacheStats::Decoder stats(
+      status_decoder.query_result_cache_stats());
+  EXPECT_EQ(stats.hits(), 2u);
+  EXPECT_EQ(stats.misses(), 1u);
+  EXPECT_EQ(stats.entries(), 1u);
+
+  // Queries which can modify the tables clear the cache.
+  Query("insert into t values (2)", false);
+  EXPECT_NE(Query("select x from t", true), res);
+}
+
+TEST_F(QueryResultCacheRpcTest, ErrorsAreNotCached) {
+  Query("select x from missing_table", true);
+  Query("select x from missing_table", true);
+
+  std::vector<uint8_t> status = GetStatus();
+  StatusProto::Decoder status_decoder(status.data(), status.size());
+  StatusProto::QueryResultCacheStats::Decoder stats(
+      status_decoder.query_result_cache_stats());
+  EXPECT_EQ(stats.hits(), 0u);
+  EXPECT_EQ(stats.misses(), 2u);
+  EXPECT_EQ(stats.entries(), 0u);
+}
+
+TEST_F(QueryResultCacheRpcTest, WritesAreNotCached) {
+  // Replaying these from the cache would skip their side effects.
+  Query("create table u(x)", true);
+  Query("insert into u values (1)", true);
+  Query("insert into u values (1)", true);
+
+  std::vector<uint8_t> status = GetStatus();
+  StatusProto::Decoder status_decoder(status.data(), status.size());
+  StatusProto::QueryResultCacheStats::Decoder stats(
+      status_decoder.query_result_cache_stats());
+  EXPECT_EQ(stats.hits(), 0u);
+  EXPECT_EQ(stats.misses(), 3u);
+  EXPECT_EQ(stats.entries(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
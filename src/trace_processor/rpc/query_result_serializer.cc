@@ -16,6 +16,9 @@
 
 #include "src/trace_processor/rpc/query_result_serializer.h"
 
+#include <string.h>
+
+#include <string>
 #include <vector>
 
 #include "perfetto/protozero/packed_repeated_fields.h"
@@ -32,6 +35,8 @@ namespace {
 
 namespace pu = ::protozero::proto_utils;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnarBatchProto = protos::pbzero::QueryResult::ColumnarBatch;
+using ColumnProto = ColumnarBatchProto::Column;
 using ResultProto = protos::pbzero::QueryResult;
 
 // The reserved field in trace_processor.proto.
@@ -43,10 +48,162 @@ uint8_t MakeLenDelimTag(uint32_t field_num) {
   return static_cast<uint8_t>(tag);
 }
 
+// The values of one column of a ColumnarBatch, buffered until the end of the
+// batch. The non-NULL values are stored in one array per type: usually only
+// one of them is used and the column is written as a typed array. Columns
+// which turn out to have values of different types are written in the
+// CellsBatch format instead.
+class ColumnBuffer {
+ public:
+  // Returns (roughly) the number of bytes |value| adds to the batch.
+  uint32_t Append(const SqlValue& value) {
+    switch (value.type) {
+      case SqlValue::Type::kNull:
+        cell_types_.push_back(BatchProto::CELL_NULL);
+        has_nulls_ = true;
+        return 1;
+      case SqlValue::Type::kLong:
+        cell_types_.push_back(BatchProto::CELL_VARINT);
+        longs_.push_back(value.long_value);
+        return sizeof(int64_t);
+      case SqlValue::Type::kDouble:
+        cell_types_.push_back(BatchProto::CELL_FLOAT64);
+        doubles_.push_back(value.double_value);
+        return sizeof(double);
+      case SqlValue::Type::kString: {
+        cell_types_.push_back(BatchProto::CELL_STRING);
+        size_t len_with_nul = strlen(value.string_value) + 1;
+        strings_.append(value.string_value, len_with_nul);
+        return static_cast<uint32_t>(len_with_nul);
+      }
+      case SqlValue::Type::kBytes: {
+        cell_types_.push_back(BatchProto::CELL_BLOB);
+        auto* src = static_cast<const uint8_t*>(value.bytes_value);
+        blobs_.emplace_back(src, src + value.bytes_count);
+        return static_cast<uint32_t>(value.bytes_count) + 4;
+      }
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+
+  void Serialize(ColumnProto* column) const {
+    const size_t num_types = !longs_.empty() + !doubles_.empty() +
+                             !strings_.empty() + !blobs_.empty();
+    if (num_types == 0) {
+      column->set_type(ColumnProto::COLUMN_NULL);
+      return;
+    }
+    if (num_types > 1) {
+      column->set_type(ColumnProto::COLUMN_MIXED);
+      SerializeMixedCells(column->set_mixed_cells());
+      return;
+    }
+
+    if (has_nulls_) {
+      std::vector<uint8_t> validity((cell_types_.size() + 7) / 8);
+      for (size_t i = 0; i < cell_types_.size(); ++i) {
+        if (cell_types_[i] != BatchProto::CELL_NULL)
+          validity[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+      }
+      column->set_validity(validity.data(), validity.size());
+    }
+
+    if (!longs_.empty()) {
+      column->set_type(ColumnProto::COLUMN_INT64);
+      std::vector<int64_t> rows = ExpandNulls(longs_);
+      column->set_int64_values(reinterpret_cast<const uint8_t*>(rows.data()),
+                               rows.size() * sizeof(int64_t));
+    } else if (!doubles_.empty()) {
+      column->set_type(ColumnProto::COLUMN_FLOAT64);
+      std::vector<double> rows = ExpandNulls(doubles_);
+      column->set_float64_values(reinterpret_cast<const uint8_t*>(rows.data()),
+                                 rows.size() * sizeof(double));
+    } else if (!strings_.empty()) {
+      column->set_type(ColumnProto::COLUMN_STRING);
+      if (!has_nulls_) {
+        column->set_string_values(strings_.data(), strings_.size());
+        return;
+      }
+      std::string rows;
+      rows.reserve(strings_.size() + cell_types_.size());
+      const char* next = strings_.data();
+      for (uint8_t cell_type : cell_types_) {
+        size_t len_with_nul =
+            cell_type == BatchProto::CELL_NULL ? 0 : strlen(next) + 1;
+        if (len_with_nul == 0) {
+          rows.push_back('\0');
+          continue;
+        }
+        rows.append(next, len_with_nul);
+        next += len_with_nul;
+      }
+      column->set_string_values(rows.data(), rows.size());
+    } else {
+      column->set_type(ColumnProto::COLUMN_BLOB);
+      size_t next = 0;
+      for (uint8_t cell_type : cell_types_) {
+        if (cell_type == BatchProto::CELL_NULL) {
+          column->add_blob_values(nullptr, 0);
+          continue;
+        }
+        const std::vector<uint8_t>& blob = blobs_[next++];
+        column->add_blob_values(blob.data(), blob.size());
+      }
+    }
+  }
+
+ private:
+  // Returns |values| with a zero inserted for each NULL row.
+  template <typename T>
+  std::vector<T> ExpandNulls(const std::vector<T>& values) const {
+    if (!has_nulls_)
+      return values;
+    std::vector<T> rows(cell_types_.size());
+    size_t next = 0;
+    for (size_t i = 0; i < cell_types_.size(); ++i) {
+      if (cell_types_[i] != BatchProto::CELL_NULL)
+        rows[i] = values[next++];
+    }
+    return rows;
+  }
+
+  void SerializeMixedCells(BatchProto* cells) const {
+    cells->AppendBytes(BatchProto::kCellsFieldNumber, cell_types_.data(),
+                       cell_types_.size());
+    if (!longs_.empty()) {
+      protozero::PackedVarInt varints;
+      varints.Append(longs_.data(), longs_.size());
+      cells->set_varint_cells(varints);
+    }
+    if (!doubles_.empty()) {
+      protozero::PackedFixedSizeInt<double> doubles;
+      for (double value : doubles_)
+        doubles.Append(value);
+      cells->set_float64_cells(doubles);
+    }
+    for (const std::vector<uint8_t>& blob : blobs_)
+      cells->add_blob_cells(blob.data(), blob.size());
+    if (!strings_.empty())
+      cells->set_string_cells(strings_.data(), strings_.size());
+  }
+
+  // The CellsBatch::CellType of each row.
+  std::vector<uint8_t> cell_types_;
+  bool has_nulls_ = false;
+
+  std::vector<int64_t> longs_;
+  std::vector<double> doubles_;
+  // NUL-terminated, as in CellsBatch::string_cells.
+  std::string strings_;
+  std::vector<std::vector<uint8_t>> blobs_;
+};
+
 }  // namespace
 
-QueryResultSerializer::QueryResultSerializer(Iterator iter)
-    : iter_(iter.take_impl()), num_cols_(iter_->ColumnCount()) {}
+QueryResultSerializer::QueryResultSerializer(Iterator iter, BatchFormat format)
+    : iter_(iter.take_impl()),
+      num_cols_(iter_->ColumnCount()),
+      format_(format) {}
 
 QueryResultSerializer::~QueryResultSerializer() = default;
 
@@ -62,6 +219,9 @@ bool QueryResultSerializer::Serialize(std::vector<uint8_t>* buf) {
 bool QueryResultSerializer::Serialize(protos::pbzero::QueryResult* res) {
   PERFETTO_CHECK(!eof_reached_);
 
+  if (query_id_)
+    res->set_query_id(query_id_);
+
   if (!did_write_column_names_) {
     SerializeColumnNames(res);
     did_write_column_names_ = true;
@@ -71,7 +231,11 @@ bool QueryResultSerializer::Serialize(protos::pbzero::QueryResult* res) {
   // write an empty batch with the EOF marker. Errors can happen also in the
   // middle of a query, not just before starting it.
 
-  SerializeBatch(res);
+  if (format_ == BatchFormat::kColumnar) {
+    SerializeColumnarBatch(res);
+  } else {
+    SerializeBatch(res);
+  }
   MaybeSerializeError(res);
   return !eof_reached_;
 }
@@ -246,6 +410,46 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   batch->Finalize();
 }
 
+void QueryResultSerializer::SerializeColumnarBatch(ResultProto* res) {
+  // Unlike SerializeBatch(), the whole batch needs to be buffered before
+  // writing it, as the values are written column by column.
+  std::vector<ColumnBuffer> columns(num_cols_);
+  uint32_t num_rows = 0;
+  uint32_t approx_batch_size = 16;
+  bool batch_full = false;
+
+  for (;; ++num_rows) {
+    // As in SerializeBatch(), the next row is fetched only once all the
+    // columns of the current one have been appended. A row fetched when the
+    // batch is already full is kept for the next batch.
+    if (col_ >= num_cols_) {
+      col_ = 0;
+      if (!iter_->Next())
+        break;  // EOF or error.
+
+      PERFETTO_DCHECK(num_cols_ > 0);
+      if ((num_rows + 1) * num_cols_ > cells_per_batch_ ||
+          approx_batch_size > batch_split_threshold_) {
+        batch_full = true;
+        break;
+      }
+    }
+    for (; col_ < num_cols_; ++col_)
+      approx_batch_size += columns[col_].Append(iter_->Get(col_));
+  }
+
+  auto* batch = res->add_columnar_batch();
+  batch->set_num_rows(num_rows);
+  for (const ColumnBuffer& column : columns)
+    column.Serialize(batch->add_columns());
+
+  if (!batch_full) {
+    eof_reached_ = true;
+    batch->set_is_last_batch(true);
+  }
+  batch->Finalize();
+}
+
 void QueryResultSerializer::MaybeSerializeError(
     protos::pbzero::QueryResult* res) {
   if (iter_->Status().ok())
@@ -256,6 +460,24 @@ void QueryResultSerializer::MaybeSerializeError(
   if (err.empty())
     err = "Unknown error";
   res->set_error(err);
+
+  using Interruption = protos::pbzero::QueryResult::Interruption;
+  switch (iter_->interruption()) {
+    case QueryInterrupter::Reason::kNone:
+      break;
+    case QueryInterrupter::Reason::kCancelled:
+      res->set_interruption(Interruption::INTERRUPTION_CANCELLED);
+      break;
+    case QueryInterrupter::Reason::kDurationExceeded:
+      res->set_interruption(Interruption::INTERRUPTION_DURATION_EXCEEDED);
+      break;
+    case QueryInterrupter::Reason::kRowsExceeded:
+      res->set_interruption(Interruption::INTERRUPTION_ROWS_EXCEEDED);
+      break;
+    case QueryInterrupter::Reason::kMemoryExceeded:
+      res->set_interruption(Interruption::INTERRUPTION_MEMORY_EXCEEDED);
+      break;
+  }
 }
 
 void QueryResultSerializer::SerializeColumnNames(
@@ -54,7 +54,17 @@ class IteratorImpl;
 class QueryResultSerializer {
  public:
   static constexpr uint32_t kDefaultBatchSplitThreshold = 128 * 1024;
-  explicit QueryResultSerializer(Iterator);
+
+  enum class BatchFormat {
+    // Row-major, one cell at a time (QueryResult.CellsBatch).
+    kCells,
+    // Column-major (QueryResult.ColumnarBatch). Cheaper to decode for clients
+    // which deal with whole columns, e.g. dataframes.
+    kColumnar,
+  };
+
+  explicit QueryResultSerializer(Iterator,
+                                 BatchFormat format = BatchFormat::kCells);
   ~QueryResultSerializer();
 
   // No copy or move.
@@ -70,6 +80,9 @@ class QueryResultSerializer {
   // extra copies.
   bool Serialize(std::vector<uint8_t>*);
 
+  // Sets the QueryResult.query_id of the batches. 0 means not set.
+  void set_query_id(uint64_t query_id) { query_id_ = query_id; }
+
   void set_batch_size_for_testing(uint32_t cells_per_batch, uint32_t thres) {
     cells_per_batch_ = cells_per_batch;
     batch_split_threshold_ = thres;
@@ -78,13 +91,16 @@ class QueryResultSerializer {
  private:
   void SerializeColumnNames(protos::pbzero::QueryResult*);
   void SerializeBatch(protos::pbzero::QueryResult*);
+  void SerializeColumnarBatch(protos::pbzero::QueryResult*);
   void MaybeSerializeError(protos::pbzero::QueryResult*);
 
   std::unique_ptr<IteratorImpl> iter_;
   const uint32_t num_cols_;
+  const BatchFormat format_;
   bool did_write_column_names_ = false;
   bool eof_reached_ = false;
   uint32_t col_ = UINT32_MAX;
+  uint64_t query_id_ = 0;
 
   // These params specify the thresholds for splitting the results in batches,
   // in terms of: (1) max cells (row x cols); (2) serialized batch size in
@@ -71,7 +71,9 @@ namespace {
 
 using ::testing::ElementsAre;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnarBatchProto = protos::pbzero::QueryResult::ColumnarBatch;
 using ResultProto = protos::pbzero::QueryResult;
+using BatchFormat = QueryResultSerializer::BatchFormat;
 
 void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
   auto iter = tp->ExecuteQuery(query);
@@ -91,9 +93,29 @@ class TestDeserializer {
   bool eof_reached = false;
 
  private:
+  void DeserializeCells(protozero::ConstBytes, std::vector<SqlValue>* out);
+  void DeserializeColumn(protozero::ConstBytes,
+                         uint32_t num_rows,
+                         std::vector<SqlValue>* out);
+  SqlValue CopyString(const std::string&);
+  SqlValue CopyBytes(const std::string&);
+
   std::vector<std::unique_ptr<char[]>> copied_buf_;
 };
 
+SqlValue TestDeserializer::CopyString(const std::string& str) {
+  copied_buf_.emplace_back(new char[str.size() + 1]);
+  char* new_buf = copied_buf_.back().get();
+  memcpy(new_buf, str.c_str(), str.size() + 1);
+  return SqlValue::String(new_buf);
+}
+
+SqlValue TestDeserializer::CopyBytes(const std::string& bytes) {
+  copied_buf_.emplace_back(new char[bytes.size()]);
+  memcpy(copied_buf_.back().get(), bytes.data(), bytes.size());
+  return SqlValue::Bytes(copied_buf_.back().get(), bytes.size());
+}
+
 void TestDeserializer::SerializeAndDeserialize(
     QueryResultSerializer* serializer) {
   std::vector<uint8_t> buf;
@@ -117,78 +139,165 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
 
     ResultProto::CellsBatch::Decoder batch(batch_bytes.data, batch_bytes.size);
     eof_reached = batch.is_last_batch();
-    std::deque<int64_t> varints;
-    std::deque<double> doubles;
-    std::deque<std::string> blobs;
+    size_t num_cells = cells.size();
+    DeserializeCells(batch_bytes, &cells);
+    num_cells = cells.size() - num_cells;
+    if (columns.empty()) {
+      EXPECT_EQ(num_cells, 0u);
+    } else {
+      EXPECT_EQ(num_cells % columns.size(), 0u);
+    }
+  }
+
+  for (auto batch_it = result.columnar_batch(); batch_it; ++batch_it) {
+    ASSERT_FALSE(eof_reached);
+    ColumnarBatchProto::Decoder batch(batch_it->as_bytes());
+    eof_reached = batch.is_last_batch();
+
+    // Deserialize each column and then transpose them back to rows.
+    std::vector<std::vector<SqlValue>> batch_columns;
+    for (auto it = batch.columns(); it; ++it) {
+      batch_columns.emplace_back();
+      DeserializeColumn(it->as_bytes(), batch.num_rows(),
+                        &batch_columns.back());
+      ASSERT_EQ(batch_columns.back().size(), batch.num_rows());
+    }
+    ASSERT_EQ(batch_columns.size(), columns.size());
+    for (uint32_t row = 0; row < batch.num_rows(); ++row) {
+      for (const auto& column : batch_columns)
+        cells.push_back(column[row]);
+    }
+  }
+}
 
-    bool parse_error = false;
-    for (auto it = batch.varint_cells(&parse_error); it; ++it)
-      varints.emplace_back(*it);
+void TestDeserializer::DeserializeCells(protozero::ConstBytes batch_bytes,
+                                        std::vector<SqlValue>* out) {
+  ResultProto::CellsBatch::Decoder batch(batch_bytes.data, batch_bytes.size);
+  std::deque<int64_t> varints;
+  std::deque<double> doubles;
+  std::deque<std::string> blobs;
+
+  bool parse_error = false;
+  for (auto it = batch.varint_cells(&parse_error); it; ++it)
+    varints.emplace_back(*it);
+
+  for (auto it = batch.float64_cells(&parse_error); it; ++it)
+    doubles.emplace_back(*it);
+
+  for (auto it = batch.blob_cells(); it; ++it)
+    blobs.emplace_back((*it).ToStdString());
+
+  std::string merged_strings = batch.string_cells().ToStdString();
+  std::deque<std::string> strings;
+  for (size_t pos = 0; pos < merged_strings.size();) {
+    // Will return npos for the last string, but it's fine
+    size_t next_sep = merged_strings.find('\0', pos);
+    strings.emplace_back(merged_strings.substr(pos, next_sep - pos));
+    pos = next_sep == std::string::npos ? next_sep : next_sep + 1;
+  }
+
+  for (auto it = batch.cells(&parse_error); it; ++it) {
+    uint8_t cell_type = static_cast<uint8_t>(*it);
+    switch (cell_type) {
+      case BatchProto::CELL_INVALID:
+        break;
+      case BatchProto::CELL_NULL:
+        out->emplace_back(SqlValue());
+        break;
+      case BatchProto::CELL_VARINT:
+        ASSERT_GT(varints.size(), 0u);
+        out->emplace_back(SqlValue::Long(varints.front()));
+        varints.pop_front();
+        break;
+      case BatchProto::CELL_FLOAT64:
+        ASSERT_GT(doubles.size(), 0u);
+        out->emplace_back(SqlValue::Double(doubles.front()));
+        doubles.pop_front();
+        break;
+      case BatchProto::CELL_STRING: {
+        ASSERT_GT(strings.size(), 0u);
+        out->emplace_back(CopyString(strings.front()));
+        strings.pop_front();
+        break;
+      }
+      case BatchProto::CELL_BLOB: {
+        ASSERT_GT(blobs.size(), 0u);
+        out->emplace_back(CopyBytes(blobs.front()));
+        blobs.pop_front();
+        break;
+      }
+      default:
+        FAIL() << "Unknown cell type " << cell_type;
+    }
 
-    for (auto it = batch.float64_cells(&parse_error); it; ++it)
-      doubles.emplace_back(*it);
+    EXPECT_FALSE(parse_error);
+  }
+}
 
-    for (auto it = batch.blob_cells(); it; ++it)
-      blobs.emplace_back((*it).ToStdString());
+void TestDeserializer::DeserializeColumn(protozero::ConstBytes column_bytes,
+                                         uint32_t num_rows,
+                                         std::vector<SqlValue>* out) {
+  using ColumnProto = ColumnarBatchProto::Column;
+  ColumnProto::Decoder column(column_bytes);
+  if (column.type() == ColumnProto::COLUMN_MIXED) {
+    DeserializeCells(column.mixed_cells(), out);
+    return;
+  }
+
+  bool all_null = column.type() == ColumnProto::COLUMN_NULL;
+  std::vector<bool> is_null(num_rows, all_null);
+  if (column.has_validity()) {
+    ASSERT_EQ(column.validity().size, (num_rows + 7) / 8);
+    for (uint32_t row = 0; row < num_rows; ++row)
+      is_null[row] = !((column.validity().data[row / 8] >> (row % 8)) & 1);
+  }
 
-    std::string merged_strings = batch.string_cells().ToStdString();
-    std::deque<std::string> strings;
+  // Each row, including the NULL ones, has a NUL-terminated string.
+  std::deque<std::string> strings;
+  if (column.type() == ColumnProto::COLUMN_STRING) {
+    std::string merged_strings = column.string_values().ToStdString();
     for (size_t pos = 0; pos < merged_strings.size();) {
-      // Will return npos for the last string, but it's fine
       size_t next_sep = merged_strings.find('\0', pos);
+      ASSERT_NE(next_sep, std::string::npos);
       strings.emplace_back(merged_strings.substr(pos, next_sep - pos));
-      pos = next_sep == std::string::npos ? next_sep : next_sep + 1;
+      pos = next_sep + 1;
     }
-
-    uint32_t num_cells = 0;
-    for (auto it = batch.cells(&parse_error); it; ++it, ++num_cells) {
-      uint8_t cell_type = static_cast<uint8_t>(*it);
-      switch (cell_type) {
-        case BatchProto::CELL_INVALID:
-          break;
-        case BatchProto::CELL_NULL:
-          cells.emplace_back(SqlValue());
-          break;
-        case BatchProto::CELL_VARINT:
-          ASSERT_GT(varints.size(), 0u);
-          cells.emplace_back(SqlValue::Long(varints.front()));
-          varints.pop_front();
-          break;
-        case BatchProto::CELL_FLOAT64:
-          ASSERT_GT(doubles.size(), 0u);
-          cells.emplace_back(SqlValue::Double(doubles.front()));
-          doubles.pop_front();
-          break;
-        case BatchProto::CELL_STRING: {
-          ASSERT_GT(strings.size(), 0u);
-          const std::string& str = strings.front();
-          copied_buf_.emplace_back(new char[str.size() + 1]);
-          char* new_buf = copied_buf_.back().get();
-          memcpy(new_buf, str.c_str(), str.size() + 1);
-          cells.emplace_back(SqlValue::String(new_buf));
-          strings.pop_front();
-          break;
-        }
-        case BatchProto::CELL_BLOB: {
-          ASSERT_GT(blobs.size(), 0u);
-          auto bytes = blobs.front();
-          copied_buf_.emplace_back(new char[bytes.size()]);
-          memcpy(copied_buf_.back().get(), bytes.data(), bytes.size());
-          cells.emplace_back(
-              SqlValue::Bytes(copied_buf_.back().get(), bytes.size()));
-          blobs.pop_front();
-          break;
-        }
-        default:
-          FAIL() << "Unknown cell type " << cell_type;
+    ASSERT_EQ(strings.size(), num_rows);
+  }
+  std::vector<std::string> blobs;
+  for (auto it = column.blob_values(); it; ++it)
+    blobs.emplace_back((*it).ToStdString());
+
+  for (uint32_t row = 0; row < num_rows; ++row) {
+    switch (column.type()) {
+      case ColumnProto::COLUMN_INT64: {
+        ASSERT_EQ(column.int64_values().size, num_rows * sizeof(int64_t));
+        int64_t value;
+        memcpy(&value, column.int64_values().data + row * sizeof(int64_t),
+               sizeof(value));
+        out->push_back(is_null[row] ? SqlValue() : SqlValue::Long(value));
+        break;
       }
-
-      EXPECT_FALSE(parse_error);
-    }
-    if (columns.empty()) {
-      EXPECT_EQ(num_cells, 0u);
-    } else {
-      EXPECT_EQ(num_cells % columns.size(), 0u);
+      case ColumnProto::COLUMN_FLOAT64: {
+        ASSERT_EQ(column.float64_values().size, num_rows * sizeof(double));
+        double value;
+        memcpy(&value, column.float64_values().data + row * sizeof(double),
+               sizeof(value));
+        out->push_back(is_null[row] ? SqlValue() : SqlValue::Double(value));
+        break;
+      }
+      case ColumnProto::COLUMN_STRING:
+        out->push_back(is_null[row] ? SqlValue() : CopyString(strings[row]));
+        break;
+      case ColumnProto::COLUMN_BLOB:
+        ASSERT_EQ(blobs.size(), num_rows);
+        out->push_back(is_null[row] ? SqlValue() : CopyBytes(blobs[row]));
+        break;
+      case ColumnProto::COLUMN_NULL:
+        out->push_back(SqlValue());
+        break;
+      default:
+        FAIL() << "Unknown column type " << column.type();
     }
   }
 }
@@ -385,10 +494,12 @@ TEST(QueryResultSerializerTest, RandomSizes) {
     }
   }
 
-  // Serialize and de-serialize with different batch and payload sizes.
+  // Serialize and de-serialize with different batch and payload sizes, in
+  // both formats.
   for (int rep = 0; rep < 10; rep++) {
     auto iter = tp->ExecuteQuery("select * from tab");
-    QueryResultSerializer ser(std::move(iter));
+    BatchFormat format = rep % 2 ? BatchFormat::kColumnar : BatchFormat::kCells;
+    QueryResultSerializer ser(std::move(iter), format);
     uint32_t cells_per_batch = 1 << (rnd_engine() % 8 + 2);
     uint32_t binary_payload_size = 1 << (rnd_engine() % 8 + 8);
     ser.set_batch_size_for_testing(cells_per_batch, binary_payload_size);
@@ -450,6 +561,91 @@ TEST(QueryResultSerializerTest, NoResultQuery) {
   }
 }
 
+TEST(QueryResultSerializerTest, ColumnarTypedColumns) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+  RunQueryChecked(tp.get(), "create table tab (i, d, s, b, n, m)");
+  RunQueryChecked(tp.get(),
+                  "insert into tab values "
+                  "(1, 1.5, 'a', X'01', NULL, 1), "
+                  "(NULL, NULL, NULL, NULL, NULL, 'x'), "
+                  "(3, 3.5, '', X'', NULL, NULL)");
+
+  auto iter = tp->ExecuteQuery("select * from tab");
+  QueryResultSerializer ser(std::move(iter), BatchFormat::kColumnar);
+  std::vector<uint8_t> buf;
+  ASSERT_FALSE(ser.Serialize(&buf));
+
+  ResultProto::Decoder result(buf.data(), buf.size());
+  ASSERT_FALSE(result.has_batch());
+  ColumnarBatchProto::Decoder batch(*result.columnar_batch());
+  EXPECT_EQ(batch.num_rows(), 3u);
+  EXPECT_TRUE(batch.is_last_batch());
+
+  using ColumnProto = ColumnarBatchProto::Column;
+  std::vector<int32_t> types;
+  std::vector<std::string> validity;
+  for (auto it = batch.columns(); it; ++it) {
+    ColumnProto::Decoder column(*it);
+    types.push_back(column.type());
+    validity.push_back(column.validity().ToStdString());
+  }
+  EXPECT_THAT(types, ElementsAre(ColumnProto::COLUMN_INT64,
+                                 ColumnProto::COLUMN_FLOAT64,
+                                 ColumnProto::COLUMN_STRING,
+                                 ColumnProto::COLUMN_BLOB,
+                                 ColumnProto::COLUMN_NULL,
+                                 ColumnProto::COLUMN_MIXED));
+  EXPECT_THAT(validity, ElementsAre("\x05", "\x05", "\x05", "\x05", "", ""));
+
+  TestDeserializer deser;
+  deser.DeserializeBuffer(buf.data(), buf.size());
+  EXPECT_TRUE(deser.eof_reached);
+  EXPECT_THAT(
+      deser.cells,
+      ElementsAre(SqlValue::Long(1), SqlValue::Double(1.5),
+                  SqlValue::String("a"), SqlValue::Bytes("\x01", 1),
+                  SqlValue(), SqlValue::Long(1), SqlValue(), SqlValue(),
+                  SqlValue(), SqlValue(), SqlValue(), SqlValue::String("x"),
+                  SqlValue::Long(3), SqlValue::Double(3.5),
+                  SqlValue::String(""), SqlValue::Bytes("", 0), SqlValue(),
+                  SqlValue()));
+}
+
+TEST(QueryResultSerializerTest, ColumnarBatchSaturatingNumCells) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+
+  RunQueryChecked(tp.get(), "create virtual table win using window;");
+  RunQueryChecked(tp.get(),
+                  "update win set window_start=0, window_dur=1024, quantum=1 "
+                  "where rowid = 0");
+  auto iter = tp->ExecuteQuery("select ts, dur * 1.0 as dur from win");
+  QueryResultSerializer ser(std::move(iter), BatchFormat::kColumnar);
+  ser.set_batch_size_for_testing(16, 4096);
+
+  TestDeserializer deser;
+  deser.SerializeAndDeserialize(&ser);
+  ASSERT_THAT(deser.columns, ElementsAre("ts", "dur"));
+  ASSERT_EQ(deser.cells.size(), 1024 * 2u);
+  for (uint32_t row = 0; row < 1024; row++) {
+    ASSERT_EQ(deser.cells[row * 2], SqlValue::Long(row));
+    ASSERT_EQ(deser.cells[row * 2 + 1], SqlValue::Double(1.0));
+  }
+}
+
+TEST(QueryResultSerializerTest, ColumnarErrorAfterSomeResults) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+  RunQueryChecked(tp.get(), "create table tab (x)");
+  RunQueryChecked(tp.get(), "insert into tab (x) values (0), (1), ('error')");
+  auto iter = tp->ExecuteQuery("select str_split('a;b', ';', x) as s from tab");
+  QueryResultSerializer ser(std::move(iter), BatchFormat::kColumnar);
+  TestDeserializer deser;
+  deser.SerializeAndDeserialize(&ser);
+  EXPECT_NE(deser.error, "");
+  EXPECT_THAT(deser.cells,
+              ElementsAre(SqlValue::String("a"), SqlValue::String("b")));
+  EXPECT_TRUE(deser.eof_reached);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -18,12 +18,17 @@
 
 #include <string.h>
 
+#include <deque>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/version.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/protozero/scattered_stream_writer.h"
 #include "perfetto/trace_processor/trace_processor.h"
@@ -33,6 +38,10 @@
 
 #include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) && PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -48,6 +57,52 @@ using RpcProto = protos::pbzero::TraceProcessorRpc;
 constexpr auto kSliceSize =
     QueryResultSerializer::kDefaultBatchSplitThreshold + 4096;
 
+// Returns the batch format requested by the QueryArgs |args|.
+QueryResultSerializer::BatchFormat GetBatchFormat(const uint8_t* args,
+                                                  size_t len) {
+  protos::pbzero::QueryArgs::Decoder query(args, len);
+  return query.columnar_result()
+             ? QueryResultSerializer::BatchFormat::kColumnar
+             : QueryResultSerializer::BatchFormat::kCells;
+}
+
+// Returns the config of the instances created by the RPC.
+Config GetRpcConfig() {
+  Config config;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) && PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // In the UI, the trace is loaded using the workers spawned along with the
+  // module (see enable_perfetto_wasm_threads), one per core. At most one
+  // parallel stage runs next to the parser thread at a time, and the threads
+  // calling them also do part of the work, so this never needs more workers
+  // than the pool has.
+  uint32_t threads = std::thread::hardware_concurrency();
+  config.pipelined_parsing = threads > 1;
+  config.sorting_worker_threads = threads > 1 ? threads - 1 : 0;
+  config.decompression_worker_threads = config.sorting_worker_threads;
+  config.track_event_worker_threads = config.sorting_worker_threads;
+  config.packet_preparation_worker_threads = config.sorting_worker_threads;
+#endif
+  return config;
+}
+
+uint64_t GetQueryId(const uint8_t* args, size_t len) {
+  protos::pbzero::QueryArgs::Decoder query(args, len);
+  return query.query_id();
+}
+
+// Appends QueryResult.query_id to the serialized QueryResult |batch|, unless
+// |query_id| is 0. Fields can come in any order.
+void AppendQueryId(uint64_t query_id, std::vector<uint8_t>* batch) {
+  namespace pu = protozero::proto_utils;
+  if (!query_id)
+    return;
+  uint8_t buf[pu::kMaxSimpleFieldEncodedSize];
+  uint8_t* wptr = pu::WriteVarInt(
+      pu::MakeTagVarInt(protos::pbzero::QueryResult::kQueryIdFieldNumber), buf);
+  wptr = pu::WriteVarInt(query_id, wptr);
+  batch->insert(batch->end(), buf, wptr);
+}
+
 // Holds a trace_processor::TraceProcessorRpc pbzero message. Avoids extra
 // copies by doing direct scattered calls from the fragmented heap buffer onto
 // the RpcResponseFunction (the receiver is expected to deal with arbitrary
@@ -90,6 +145,8 @@ void Response::Send(Rpc::RpcResponseFunction send_fn) {
 
 Rpc::Rpc(std::unique_ptr<TraceProcessor> preloaded_instance)
     : trace_processor_(std::move(preloaded_instance)) {
+  // A preloaded instance has already seen the whole trace.
+  eof_ = !!trace_processor_;
   if (!trace_processor_)
     ResetTraceProcessor();
 }
@@ -98,7 +155,8 @@ Rpc::Rpc() : Rpc(nullptr) {}
 Rpc::~Rpc() = default;
 
 void Rpc::ResetTraceProcessor() {
-  trace_processor_ = TraceProcessor::CreateInstance(Config());
+  NotifyTraceChange();
+  trace_processor_ = TraceProcessor::CreateInstance(GetRpcConfig());
   bytes_parsed_ = bytes_last_progress_ = 0;
   t_parse_started_ = base::GetWallTimeNs().count();
   // Deliberately not resetting the RPC channel state (rxbuf_, {tx,rx}_seq_id_).
@@ -107,6 +165,19 @@ void Rpc::ResetTraceProcessor() {
   // message numbering continues regardless of the reset.
 }
 
+void Rpc::NotifyTraceChange() {
+  query_result_cache_.Clear();
+  if (trace_change_callback_)
+    trace_change_callback_();
+}
+
+std::unique_ptr<Rpc> Rpc::CreateQuerySession() {
+  if (!eof_)
+    return nullptr;
+  return std::unique_ptr<Rpc>(
+      new Rpc(trace_processor_->CreateQuerySession()));
+}
+
 void Rpc::OnRpcRequest(const void* data, size_t len) {
   rxbuf_.Append(data, len);
   for (;;) {
@@ -125,6 +196,12 @@ void Rpc::OnRpcRequest(const void* data, size_t len) {
   }
 }
 
+void Rpc::OnRpcMessage(const uint8_t* data, size_t len) {
+  // ParseRpcRequest() doesn't check the order after a |rx_seq_id_| of 0.
+  rx_seq_id_ = 0;
+  ParseRpcRequest(data, len);
+}
+
 // [data, len] here is a tokenized TraceProcessorRpc proto message, without the
 // size header.
 void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
@@ -174,6 +251,12 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       resp.Send(rpc_response_fn_);
       break;
     }
+    case RpcProto::TPM_FLUSH_TRACE_DATA: {
+      Response resp(tx_seq_id_++, req_type);
+      Flush();
+      resp.Send(rpc_response_fn_);
+      break;
+    }
     case RpcProto::TPM_QUERY_STREAMING: {
       if (!req.has_query_args()) {
         Response resp(tx_seq_id_++, req_type);
@@ -182,16 +265,37 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
         resp.Send(rpc_response_fn_);
       } else {
         protozero::ConstBytes args = req.query_args();
+        std::string cache_key = QueryResultCache::GetKey(args.data, args.size);
+        if (!cache_key.empty()) {
+          QueryWithResultCache(
+              args.data, args.size, std::move(cache_key),
+              [&](const uint8_t* buf, size_t len, bool) {
+                Response resp(tx_seq_id_++, req_type);
+                resp->set_query_result()->AppendRawProtoBytes(buf, len);
+                resp.Send(rpc_response_fn_);
+              });
+          break;
+        }
         auto it = QueryInternal(args.data, args.size);
-        QueryResultSerializer serializer(std::move(it));
+        QueryResultSerializer serializer(std::move(it),
+                                         GetBatchFormat(args.data, args.size));
+        serializer.set_query_id(GetQueryId(args.data, args.size));
         for (bool has_more = true; has_more;) {
           Response resp(tx_seq_id_++, req_type);
           has_more = serializer.Serialize(resp->set_query_result());
           resp.Send(rpc_response_fn_);
         }
+        SetRunningQueryId(0);
       }
       break;
     }
+    case RpcProto::TPM_CANCEL_QUERY: {
+      Response resp(tx_seq_id_++, req_type);
+      protozero::ConstBytes args = req.cancel_query_args();
+      CancelQuery(args.data, args.size);
+      resp.Send(rpc_response_fn_);
+      break;
+    }
     case RpcProto::TPM_QUERY_RAW_DEPRECATED: {
       Response resp(tx_seq_id_++, req_type);
       auto* result = resp->set_raw_query_result();
@@ -225,7 +329,7 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       break;
     }
     case RpcProto::TPM_RESTORE_INITIAL_TABLES: {
-      trace_processor_->RestoreInitialTables();
+      RestoreInitialTables();
       Response resp(tx_seq_id_++, req_type);
       resp.Send(rpc_response_fn_);
       break;
@@ -270,6 +374,7 @@ util::Status Rpc::Parse(const uint8_t* data, size_t len) {
     ResetTraceProcessor();
   }
 
+  NotifyTraceChange();
   eof_ = false;
   bytes_parsed_ += len;
   MaybePrintProgress();
@@ -283,7 +388,13 @@ util::Status Rpc::Parse(const uint8_t* data, size_t len) {
   return trace_processor_->Parse(std::move(data_copy), len);
 }
 
+void Rpc::Flush() {
+  NotifyTraceChange();
+  trace_processor_->Flush();
+}
+
 void Rpc::NotifyEndOfFile() {
+  NotifyTraceChange();
   trace_processor_->NotifyEndOfFile();
   eof_ = true;
   MaybePrintProgress();
@@ -306,25 +417,133 @@ void Rpc::MaybePrintProgress() {
 void Rpc::Query(const uint8_t* args,
                 size_t len,
                 QueryResultBatchCallback result_callback) {
+  std::string cache_key = QueryResultCache::GetKey(args, len);
+  if (!cache_key.empty()) {
+    QueryWithResultCache(args, len, std::move(cache_key), result_callback);
+    return;
+  }
+
   auto it = QueryInternal(args, len);
-  QueryResultSerializer serializer(std::move(it));
+  QueryResultSerializer serializer(std::move(it), GetBatchFormat(args, len));
+  serializer.set_query_id(GetQueryId(args, len));
+
+  std::vector<uint8_t> res;
+  for (bool has_more = true; has_more;) {
+    has_more = serializer.Serialize(&res);
+    result_callback(res.data(), res.size(), has_more);
+    res.clear();
+  }
+  SetRunningQueryId(0);
+}
 
+void Rpc::QueryWithResultCache(
+    const uint8_t* args,
+    size_t len,
+    std::string cache_key,
+    const QueryResultBatchCallback& result_callback) {
+  const uint64_t query_id = GetQueryId(args, len);
+  std::shared_ptr<const QueryResultCache::Batches> cached =
+      query_result_cache_.Find(cache_key);
   std::vector<uint8_t> res;
+  if (cached) {
+    PERFETTO_DLOG("[RPC] Query result cache hit");
+    for (size_t i = 0; i < cached->size(); i++) {
+      res = (*cached)[i];
+      AppendQueryId(query_id, &res);
+      result_callback(res.data(), res.size(), i + 1 < cached->size());
+    }
+    return;
+  }
+
+  // The batches are cached without their query id, which is appended to the
+  // ones sent, so that they can be reused by the queries with other ids.
+  // Only the statements which don't write are cached: replaying the others
+  // would skip their side effects, which can also change the cached results.
+  auto it = QueryInternal(args, len);
+  bool cacheable = it.IsReadOnly();
+  if (!cacheable)
+    query_result_cache_.Clear();
+  QueryResultSerializer serializer(std::move(it), GetBatchFormat(args, len));
+  auto batches = std::make_shared<QueryResultCache::Batches>();
+  size_t size = 0;
   for (bool has_more = true; has_more;) {
     has_more = serializer.Serialize(&res);
+    size += res.size();
+    protos::pbzero::QueryResult::Decoder batch(res.data(), res.size());
+    cacheable = cacheable && !batch.has_error() &&
+                size <= query_result_cache_.max_bytes();
+    if (cacheable) {
+      batches->push_back(res);
+    } else {
+      batches->clear();
+    }
+    AppendQueryId(query_id, &res);
     result_callback(res.data(), res.size(), has_more);
     res.clear();
   }
+  SetRunningQueryId(0);
+  if (cacheable)
+    query_result_cache_.Insert(std::move(cache_key), std::move(batches));
 }
 
 Iterator Rpc::QueryInternal(const uint8_t* args, size_t len) {
-  protos::pbzero::RawQueryArgs::Decoder query(args, len);
+  protos::pbzero::QueryArgs::Decoder query(args, len);
   std::string sql = query.sql_query().ToStdString();
   PERFETTO_DLOG("[RPC] Query < %s", sql.c_str());
   PERFETTO_TP_TRACE("RPC_QUERY",
                     [&](metatrace::Record* r) { r->AddArg("SQL", sql); });
 
-  return trace_processor_->ExecuteQuery(sql.c_str());
+  QueryBudget budget;
+  budget.max_duration_ms = query.max_duration_ms();
+  budget.max_rows = query.max_rows();
+  budget.max_memory_bytes = query.max_memory_bytes();
+  trace_processor_->EnableQueryProfiling(query.profile());
+
+  // Any other query may modify the tables the cached results come from.
+  if (!query.read_only() && !query.cache_result())
+    query_result_cache_.Clear();
+
+  if (!query.has_args() && !query.cache_statement()) {
+    Iterator it = trace_processor_->ExecuteQueryWithBudget(sql, budget);
+    SetRunningQueryId(query.query_id());
+    return it;
+  }
+
+  // The strings are copied as SqlValue needs them to be null terminated. A
+  // deque keeps their address stable as more strings are appended.
+  std::deque<std::string> strings;
+  std::vector<SqlValue> values;
+  for (auto it = query.args(); it; ++it) {
+    protos::pbzero::QueryArgs::Arg::Decoder arg(*it);
+    if (arg.has_long_value()) {
+      values.push_back(SqlValue::Long(arg.long_value()));
+    } else if (arg.has_double_value()) {
+      values.push_back(SqlValue::Double(arg.double_value()));
+    } else if (arg.has_string_value()) {
+      strings.push_back(arg.string_value().ToStdString());
+      values.push_back(SqlValue::String(strings.back().c_str()));
+    } else if (arg.has_bytes_value()) {
+      protozero::ConstBytes bytes = arg.bytes_value();
+      values.push_back(SqlValue::Bytes(bytes.data, bytes.size));
+    } else {
+      values.push_back(SqlValue());
+    }
+  }
+  Iterator it = trace_processor_->ExecuteQueryWithArgs(sql, values, budget);
+  SetRunningQueryId(query.query_id());
+  return it;
+}
+
+void Rpc::SetRunningQueryId(uint64_t query_id) {
+  std::lock_guard<std::mutex> lock(running_query_mutex_);
+  running_query_id_ = query_id;
+}
+
+void Rpc::CancelQuery(const uint8_t* args, size_t len) {
+  protos::pbzero::CancelQueryArgs::Decoder cancel(args, len);
+  std::lock_guard<std::mutex> lock(running_query_mutex_);
+  if (running_query_id_ && running_query_id_ == cancel.query_id())
+    trace_processor_->InterruptQuery();
 }
 
 std::vector<uint8_t> Rpc::RawQuery(const uint8_t* args, size_t len) {
@@ -344,6 +563,7 @@ void Rpc::RawQueryInternal(const uint8_t* args,
   PERFETTO_DLOG("[RPC] RawQuery < %s", sql.c_str());
   PERFETTO_TP_TRACE("RPC_RAW_QUERY",
                     [&](metatrace::Record* r) { r->AddArg("SQL", sql); });
+  query_result_cache_.Clear();
 
   auto it = trace_processor_->ExecuteQuery(sql.c_str());
 
@@ -462,6 +682,7 @@ void Rpc::RawQueryInternal(const uint8_t* args,
 }
 
 void Rpc::RestoreInitialTables() {
+  query_result_cache_.Clear();
   trace_processor_->RestoreInitialTables();
 }
 
@@ -490,6 +711,8 @@ void Rpc::ComputeMetricInternal(const uint8_t* data,
   PERFETTO_DLOG("[RPC] ComputeMetrics(%zu, %s), format=%d", metric_names.size(),
                 metric_names.empty() ? "" : metric_names.front().c_str(),
                 args.format());
+  // Metrics create the tables and views of their outputs.
+  query_result_cache_.Clear();
   switch (args.format()) {
     case protos::pbzero::ComputeMetricArgs::BINARY_PROTOBUF: {
       std::vector<uint8_t> metrics_proto;
@@ -543,6 +766,14 @@ std::vector<uint8_t> Rpc::GetStatus() {
   status->set_loaded_trace_name(trace_processor_->GetCurrentTraceName());
   status->set_human_readable_version(base::GetVersionString());
   status->set_api_version(protos::pbzero::TRACE_PROCESSOR_CURRENT_API_VERSION);
+  const QueryResultCache::Stats& cache_stats = query_result_cache_.stats();
+  auto* cache = status->set_query_result_cache_stats();
+  cache->set_hits(cache_stats.hits);
+  cache->set_misses(cache_stats.misses);
+  cache->set_evictions(cache_stats.evictions);
+  cache->set_entries(query_result_cache_.entry_count());
+  cache->set_bytes(query_result_cache_.bytes());
+  cache->set_max_bytes(query_result_cache_.max_bytes());
   return status.SerializeAsArray();
 }
 
@@ -19,6 +19,8 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include <stddef.h>
@@ -26,6 +28,7 @@
 
 #include "perfetto/trace_processor/status.h"
 #include "src/protozero/proto_ring_buffer.h"
+#include "src/trace_processor/rpc/query_result_cache.h"
 
 namespace perfetto {
 
@@ -79,6 +82,12 @@ class Rpc {
   // Responses are sent throught the RpcResponseFunction (below).
   void OnRpcRequest(const void* data, size_t len);
 
+  // Like OnRpcRequest(), but |data| is exactly one TraceProcessorRpc message,
+  // without the preamble of the stream. Its |seq| is not checked: this is for
+  // transports which tokenize the stream themselves and already guarantee the
+  // order of the messages, e.g. the WebSocket endpoint of httpd.cc.
+  void OnRpcMessage(const uint8_t* data, size_t len);
+
   // The size argument is a uint32_t and not size_t to avoid ABI mismatches
   // with Wasm, where size_t = uint32_t.
   // (nullptr, 0) has the semantic of "close the channel" and is issued when an
@@ -101,6 +110,7 @@ class Rpc {
   // the corresponding names in trace_processor.h . See that header for docs.
 
   util::Status Parse(const uint8_t* data, size_t len);
+  void Flush();
   void NotifyEndOfFile();
   std::string GetCurrentTraceName();
   std::vector<uint8_t> ComputeMetric(const uint8_t* data, size_t len);
@@ -115,6 +125,14 @@ class Rpc {
 
   // Runs a query and returns results in batch. Each batch is a proto-encoded
   // TraceProcessor.QueryResult message and contains a variable number of rows.
+  // |args| is a QueryArgs message: if its |columnar_result| is set, the rows
+  // are returned as ColumnarBatch rather than CellsBatch. The query is
+  // interrupted when it exceeds the budget set in |args|, or when it is
+  // cancelled with CancelQuery() if |args| has a |query_id|. The values of
+  // |args.args| are bound to the parameters of the SQL, whose prepared
+  // statement is then cached for the next queries with the same SQL. The
+  // batches have the |query_id| of |args|, if any. If |args.cache_result| is
+  // set, the batches are served from (or added to) the result cache.
   // The callbacks are called inline, so the whole callstack looks as follows:
   // Query(..., callback)
   //   callback(..., has_more=true)
@@ -133,11 +151,42 @@ class Rpc {
   // DEPRECATED, only for legacy clients. Use |Query()| above.
   std::vector<uint8_t> RawQuery(const uint8_t* args, size_t len);
 
+  // Cancels the query with the |query_id| of the CancelQueryArgs message
+  // |args|, if it is running. Can be called from any thread.
+  void CancelQuery(const uint8_t* args, size_t len);
+
+  // Returns an Rpc wrapping a query session of the current trace processor
+  // instance (see TraceProcessor::CreateQuerySession()), which can serve the
+  // query methods above on another thread. Returns nullptr if no trace has
+  // been fully loaded yet.
+  std::unique_ptr<Rpc> CreateQuerySession();
+
+  // Sets a callback invoked before the trace processor instance is modified
+  // or replaced, i.e. before parsing or flushing data or loading a new trace.
+  // The query sessions created by CreateQuerySession() must all be destroyed
+  // by the callback.
+  void SetTraceChangeCallback(std::function<void()> cb) {
+    trace_change_callback_ = std::move(cb);
+  }
+
+  // Sets the memory budget of the cache of the query results (see
+  // QueryArgs.cache_result). 0 disables the cache. Each query session has its
+  // own cache, with the default budget.
+  void SetQueryResultCacheMaxBytes(size_t max_bytes) {
+    query_result_cache_.SetMaxBytes(max_bytes);
+  }
+
  private:
   void ParseRpcRequest(const uint8_t* data, size_t len);
   void ResetTraceProcessor();
+  void NotifyTraceChange();
   void MaybePrintProgress();
   Iterator QueryInternal(const uint8_t* args, size_t len);
+  void SetRunningQueryId(uint64_t query_id);
+  void QueryWithResultCache(const uint8_t* args,
+                            size_t len,
+                            std::string cache_key,
+                            const QueryResultBatchCallback&);
   void RawQueryInternal(const uint8_t* args,
                         size_t len,
                         protos::pbzero::RawQueryResult*);
@@ -149,6 +198,7 @@ class Rpc {
 
   std::unique_ptr<TraceProcessor> trace_processor_;
   RpcResponseFunction rpc_response_fn_;
+  std::function<void()> trace_change_callback_;
   protozero::ProtoRingBuffer rxbuf_;
   int64_t tx_seq_id_ = 0;
   int64_t rx_seq_id_ = 0;
@@ -156,6 +206,13 @@ class Rpc {
   int64_t t_parse_started_ = 0;
   size_t bytes_last_progress_ = 0;
   size_t bytes_parsed_ = 0;
+
+  // The results of the queries with QueryArgs.cache_result set.
+  QueryResultCache query_result_cache_;
+
+  // The QueryArgs.query_id of the query being run by Query(), if any.
+  std::mutex running_query_mutex_;
+  uint64_t running_query_id_ = 0;
 };
 
 }  // namespace trace_processor
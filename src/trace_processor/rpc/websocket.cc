@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/websocket.h"
+
+#include <string.h>
+
+#include <array>
+
+#include "perfetto/ext/base/string_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Appended to the Sec-WebSocket-Key of the handshake, see RFC 6455 1.3.
+constexpr char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+uint32_t RotateLeft(uint32_t x, uint32_t n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+// SHA-1 (RFC 3174), only used for the handshake.
+std::array<uint8_t, 20> Sha1(const std::string& data) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                   0xC3D2E1F0};
+
+  // The message is padded with 0x80, zeros and its size in bits (big endian)
+  // to a multiple of 64 bytes.
+  std::string msg = data;
+  msg.push_back(static_cast<char>(0x80));
+  while (msg.size() % 64 != 56)
+    msg.push_back(0);
+  uint64_t size_bits = static_cast<uint64_t>(data.size()) * 8;
+  for (int i = 7; i >= 0; --i)
+    msg.push_back(static_cast<char>((size_bits >> (i * 8)) & 0xff));
+
+  for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&msg[chunk]);
+    uint32_t w[80];
+    for (uint32_t i = 0; i < 16; ++i) {
+      w[i] = static_cast<uint32_t>(bytes[i * 4]) << 24 |
+             static_cast<uint32_t>(bytes[i * 4 + 1]) << 16 |
+             static_cast<uint32_t>(bytes[i * 4 + 2]) << 8 |
+             static_cast<uint32_t>(bytes[i * 4 + 3]);
+    }
+    for (uint32_t i = 16; i < 80; ++i)
+      w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (uint32_t i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t tmp = RotateLeft(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = RotateLeft(b, 30);
+      b = a;
+      a = tmp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::array<uint8_t, 20> digest;
+  for (size_t i = 0; i < 20; ++i)
+    digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - (i % 4) * 8));
+  return digest;
+}
+
+}  // namespace
+
+std::string ComputeWebSocketAccept(base::StringView key) {
+  std::array<uint8_t, 20> digest = Sha1(key.ToStdString() + kWebSocketGuid);
+  return base::Base64Encode(digest.data(), digest.size());
+}
+
+base::Optional<size_t> ParseWebSocketFrame(uint8_t* buf,
+                                           size_t size,
+                                           WebSocketFrame* frame) {
+  if (size < 2)
+    return 0;
+  // The RSV bits must be 0 as no extension is negotiated.
+  if (buf[0] & 0x70)
+    return base::nullopt;
+  frame->fin = buf[0] & 0x80;
+  frame->opcode = buf[0] & 0x0f;
+  frame->masked = buf[1] & 0x80;
+
+  size_t pos = 2;
+  uint64_t payload_size = buf[1] & 0x7f;
+  if (payload_size >= 126) {
+    size_t size_bytes = payload_size == 126 ? 2 : 8;
+    if (size < pos + size_bytes)
+      return 0;
+    payload_size = 0;
+    for (size_t i = 0; i < size_bytes; ++i)
+      payload_size = payload_size << 8 | buf[pos + i];
+    pos += size_bytes;
+  }
+  // Control frames can't be fragmented and have at most 125 bytes.
+  if ((frame->opcode & 0x8) && (!frame->fin || payload_size > 125))
+    return base::nullopt;
+
+  uint8_t mask[4] = {};
+  if (frame->masked) {
+    if (size < pos + sizeof(mask))
+      return 0;
+    memcpy(mask, &buf[pos], sizeof(mask));
+    pos += sizeof(mask);
+  }
+  if (payload_size > size - pos)
+    return 0;
+
+  frame->payload = &buf[pos];
+  frame->payload_size = static_cast<size_t>(payload_size);
+  if (frame->masked) {
+    for (size_t i = 0; i < frame->payload_size; ++i)
+      frame->payload[i] ^= mask[i % 4];
+  }
+  return pos + frame->payload_size;
+}
+
+size_t WriteWebSocketFrameHeader(uint8_t opcode,
+                                 uint64_t payload_size,
+                                 uint8_t* out) {
+  out[0] = 0x80 | opcode;
+  if (payload_size < 126) {
+    out[1] = static_cast<uint8_t>(payload_size);
+    return 2;
+  }
+  size_t size_bytes = payload_size <= 0xffff ? 2 : 8;
+  out[1] = size_bytes == 2 ? 126 : 127;
+  for (size_t i = 0; i < size_bytes; ++i) {
+    size_t shift = (size_bytes - 1 - i) * 8;
+    out[2 + i] = static_cast<uint8_t>(payload_size >> shift);
+  }
+  return 2 + size_bytes;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
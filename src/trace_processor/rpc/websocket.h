@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_RPC_WEBSOCKET_H_
+#define SRC_TRACE_PROCESSOR_RPC_WEBSOCKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/string_view.h"
+
+// The subset of the WebSocket protocol (RFC 6455) needed by the server side
+// of the /websocket endpoint of the HTTP RPC server (see httpd.cc).
+
+namespace perfetto {
+namespace trace_processor {
+
+enum WebSocketOpcode : uint8_t {
+  kWebSocketContinuation = 0x0,
+  kWebSocketText = 0x1,
+  kWebSocketBinary = 0x2,
+  kWebSocketClose = 0x8,
+  kWebSocketPing = 0x9,
+  kWebSocketPong = 0xA,
+};
+
+struct WebSocketFrame {
+  // False if the message continues in the next (kWebSocketContinuation)
+  // frames.
+  bool fin = false;
+  bool masked = false;
+  uint8_t opcode = 0;
+
+  // Points into the buffer passed to ParseWebSocketFrame(). Already unmasked.
+  uint8_t* payload = nullptr;
+  size_t payload_size = 0;
+};
+
+// The largest header written by WriteWebSocketFrameHeader().
+constexpr size_t kMaxWebSocketFrameHeaderSize = 10;
+
+// Returns the Sec-WebSocket-Accept header value of the handshake reply to a
+// request with the given Sec-WebSocket-Key.
+std::string ComputeWebSocketAccept(base::StringView key);
+
+// Parses the frame at the start of [buf, buf + size), unmasking its payload in
+// place. Returns the size of the frame, 0 if the buffer does not contain the
+// whole frame yet, or nullopt if the frame is malformed. Both masked and
+// unmasked frames are parsed: a server must reject the client frames which are
+// not |masked|.
+base::Optional<size_t> ParseWebSocketFrame(uint8_t* buf,
+                                           size_t size,
+                                           WebSocketFrame* frame);
+
+// Writes in |out| (which must have room for kMaxWebSocketFrameHeaderSize
+// bytes) the header of an unfragmented, unmasked server to client frame with
+// |payload_size| bytes of payload. Returns the size of the header.
+size_t WriteWebSocketFrameHeader(uint8_t opcode,
+                                 uint64_t payload_size,
+                                 uint8_t* out);
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_RPC_WEBSOCKET_H_
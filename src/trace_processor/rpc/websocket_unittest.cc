@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/websocket.h"
+
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(WebSocketTest, Accept) {
+  // The example of RFC 6455 1.3.
+  ASSERT_EQ(ComputeWebSocketAccept("dGhlIHNhbXBsZSBub25jZQ=="),
+            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
+
+TEST(WebSocketTest, ParseMaskedFrame) {
+  // A masked "Hello" text frame, from RFC 6455 5.7.
+  std::vector<uint8_t> buf = {0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f,
+                              0x9f, 0x4d, 0x51, 0x58};
+  WebSocketFrame frame;
+  for (size_t size = 0; size < buf.size(); ++size)
+    ASSERT_EQ(ParseWebSocketFrame(buf.data(), size, &frame), 0u);
+
+  ASSERT_EQ(ParseWebSocketFrame(buf.data(), buf.size(), &frame), buf.size());
+  ASSERT_TRUE(frame.fin);
+  ASSERT_TRUE(frame.masked);
+  ASSERT_EQ(frame.opcode, kWebSocketText);
+  ASSERT_EQ(std::string(reinterpret_cast<char*>(frame.payload),
+                        frame.payload_size),
+            "Hello");
+}
+
+TEST(WebSocketTest, ParseFragmentedFrames) {
+  // An unmasked "Hel" + "lo" text message followed by a ping.
+  std::vector<uint8_t> buf = {0x01, 0x03, 0x48, 0x65, 0x6c, 0x80,
+                              0x02, 0x6c, 0x6f, 0x89, 0x00};
+  WebSocketFrame frame;
+  ASSERT_EQ(ParseWebSocketFrame(buf.data(), buf.size(), &frame), 5u);
+  ASSERT_FALSE(frame.fin);
+  ASSERT_EQ(frame.opcode, kWebSocketText);
+  ASSERT_EQ(frame.payload_size, 3u);
+
+  ASSERT_EQ(ParseWebSocketFrame(&buf[5], buf.size() - 5, &frame), 4u);
+  ASSERT_TRUE(frame.fin);
+  ASSERT_EQ(frame.opcode, kWebSocketContinuation);
+  ASSERT_EQ(frame.payload_size, 2u);
+
+  ASSERT_EQ(ParseWebSocketFrame(&buf[9], buf.size() - 9, &frame), 2u);
+  ASSERT_EQ(frame.opcode, kWebSocketPing);
+  ASSERT_EQ(frame.payload_size, 0u);
+}
+
+TEST(WebSocketTest, ParseMalformedFrames) {
+  WebSocketFrame frame;
+  // RSV1 set.
+  std::vector<uint8_t> rsv = {0xc2, 0x00};
+  ASSERT_FALSE(ParseWebSocketFrame(rsv.data(), rsv.size(), &frame));
+  // Fragmented ping.
+  std::vector<uint8_t> ping = {0x09, 0x00};
+  ASSERT_FALSE(ParseWebSocketFrame(ping.data(), ping.size(), &frame));
+}
+
+TEST(WebSocketTest, FrameHeaderRoundTrip) {
+  for (size_t size : {0u, 125u, 126u, 65535u, 65536u, 100000u}) {
+    std::vector<uint8_t> buf(kMaxWebSocketFrameHeaderSize + size, 'x');
+    size_t hdr_size = WriteWebSocketFrameHeader(kWebSocketBinary, size, &buf[0]);
+    buf.resize(hdr_size + size);
+
+    WebSocketFrame frame;
+    ASSERT_EQ(ParseWebSocketFrame(buf.data(), buf.size(), &frame),
+              buf.size());
+    ASSERT_TRUE(frame.fin);
+    ASSERT_FALSE(frame.masked);
+    ASSERT_EQ(frame.opcode, kWebSocketBinary);
+    ASSERT_EQ(frame.payload_size, size);
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
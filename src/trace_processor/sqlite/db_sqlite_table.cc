@@ -16,6 +16,9 @@
 
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
 
+#include <tuple>
+
+#include "perfetto/base/time.h"
 #include "perfetto/ext/base/string_writer.h"
 #include "src/trace_processor/sqlite/query_cache.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
@@ -46,14 +49,39 @@ base::Optional<FilterOp> SqliteOpToFilterOp(int sqlite_op) {
       return FilterOp::kIsNull;
     case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
       return FilterOp::kIsNotNull;
-    case SQLITE_INDEX_CONSTRAINT_LIKE:
     case SQLITE_INDEX_CONSTRAINT_GLOB:
+      return FilterOp::kGlob;
+    case SQLITE_INDEX_CONSTRAINT_LIKE:
       return base::nullopt;
+#if defined(SQLITE_INDEX_CONSTRAINT_LIMIT)
+    // SQLite still applies LIMIT and OFFSET itself; the cursor only uses them
+    // to avoid sorting the whole table.
+    case SQLITE_INDEX_CONSTRAINT_LIMIT:
+    case SQLITE_INDEX_CONSTRAINT_OFFSET:
+      return base::nullopt;
+#endif
     default:
       PERFETTO_FATAL("Currently unsupported constraint");
   }
 }
 
+// Returns the FilterOp to use for the constraint |sqlite_op| on the column
+// |col| of |schema| or nullopt if SQLite should handle the constraint.
+base::Optional<FilterOp> SqliteConstraintToFilterOp(
+    const Table::Schema& schema,
+    int col,
+    int sqlite_op) {
+  base::Optional<FilterOp> opt_op = SqliteOpToFilterOp(sqlite_op);
+
+  // Globbing is only implemented for string columns: for other columns, let
+  // SQLite convert the values to strings and do the matching.
+  if (opt_op == FilterOp::kGlob &&
+      schema.columns[static_cast<size_t>(col)].type != SqlValue::kString) {
+    return base::nullopt;
+  }
+  return opt_op;
+}
+
 SqlValue SqliteValueToSqlValue(sqlite3_value* sqlite_val) {
   auto col_type = sqlite3_value_type(sqlite_val);
   SqlValue value;
@@ -83,6 +111,54 @@ SqlValue SqliteValueToSqlValue(sqlite3_value* sqlite_val) {
   return value;
 }
 
+// The order in which constraints are applied: constraints with a lower |tier|
+// are cheaper to apply and, within a tier, constraints keeping fewer rows (i.e.
+// with a lower |selectivity|) are applied first to reduce the number of rows
+// the following constraints have to look at.
+struct ConstraintRank {
+  uint32_t tier;
+  double selectivity;
+
+  bool operator<(const ConstraintRank& other) const {
+    return std::tie(tier, selectivity) <
+           std::tie(other.tier, other.selectivity);
+  }
+};
+
+// Returns the rank of the constraint |op| with |value| (null if not known yet)
+// on the column |col|. |op| is nullopt if SQLite handles the constraint.
+ConstraintRank RankConstraint(const Table::Schema& schema,
+                              const std::vector<ColumnStatistics>* stats,
+                              uint32_t col,
+                              base::Optional<FilterOp> op,
+                              const SqlValue* value) {
+  const auto& col_schema = schema.columns[col];
+  const ColumnStatistics* col_stats = stats ? &(*stats)[col] : nullptr;
+  double selectivity =
+      op && col_stats ? col_stats->EstimateSelectivity(*op, value) : 1.0;
+
+  // Id columns are always very cheap to filter on so try and get them first.
+  if (col_schema.is_id)
+    return ConstraintRank{0, selectivity};
+
+  // Sorted columns are also quite cheap to filter as we can binary search
+  // them so order them after any id columns.
+  if (col_schema.is_sorted)
+    return ConstraintRank{1, selectivity};
+
+  // Equality constraints which can be answered by looking up the equality
+  // index of the column only need to look at the matching rows.
+  if (op == FilterOp::kEq && col_stats && col_stats->has_eq_index)
+    return ConstraintRank{2, selectivity};
+
+  // Everything else needs a scan of the remaining rows; globbing is the most
+  // expensive comparison so leave it (and the constraints SQLite applies after
+  // us anyway) to the end.
+  if (!op || op == FilterOp::kGlob)
+    return ConstraintRank{4, selectivity};
+  return ConstraintRank{3, selectivity};
+}
+
 }  // namespace
 
 DbSqliteTable::DbSqliteTable(sqlite3*, Context context)
@@ -90,7 +166,12 @@ DbSqliteTable::DbSqliteTable(sqlite3*, Context context)
       schema_(std::move(context.schema)),
       computation_(context.computation),
       static_table_(context.static_table),
-      generator_(std::move(context.generator)) {}
+      generator_(std::move(context.generator)) {
+  // The schema of dynamic tables is only created when SQLite first connects
+  // to the table, so that the unused ones don't add to the startup time.
+  if (computation_ == TableComputation::kDynamic)
+    schema_ = generator_->CreateSchema();
+}
 DbSqliteTable::~DbSqliteTable() = default;
 
 void DbSqliteTable::RegisterTable(sqlite3* db,
@@ -106,7 +187,6 @@ void DbSqliteTable::RegisterTable(
     sqlite3* db,
     QueryCache* cache,
     std::unique_ptr<DynamicTableGenerator> generator) {
-  Table::Schema schema = generator->CreateSchema();
   std::string name = generator->TableName();
 
   // Figure out if the table needs explicit args (in the form of constraints
@@ -114,7 +194,7 @@ void DbSqliteTable::RegisterTable(
   util::Status status = generator->ValidateConstraints({});
   bool requires_args = !status.ok();
 
-  Context context{cache, std::move(schema), TableComputation::kDynamic, nullptr,
+  Context context{cache, Table::Schema(), TableComputation::kDynamic, nullptr,
                   std::move(generator)};
   SqliteTable::Register<DbSqliteTable, Context>(db, std::move(context), name,
                                                 false, requires_args);
@@ -153,7 +233,8 @@ SqliteTable::Schema DbSqliteTable::ComputeSchema(const Table::Schema& schema,
 int DbSqliteTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
   switch (computation_) {
     case TableComputation::kStatic:
-      BestIndex(schema_, static_table_->row_count(), qc, info);
+      BestIndex(schema_, static_table_->row_count(), qc, info,
+                GetColumnStatistics());
       break;
     case TableComputation::kDynamic:
       util::Status status = generator_->ValidateConstraints(qc);
@@ -168,17 +249,19 @@ int DbSqliteTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
 void DbSqliteTable::BestIndex(const Table::Schema& schema,
                               uint32_t row_count,
                               const QueryConstraints& qc,
-                              BestIndexInfo* info) {
-  auto cost_and_rows = EstimateCost(schema, row_count, qc);
+                              BestIndexInfo* info,
+                              const std::vector<ColumnStatistics>* stats) {
+  auto cost_and_rows = EstimateCost(schema, row_count, qc, stats);
   info->estimated_cost = cost_and_rows.cost;
   info->estimated_rows = cost_and_rows.rows;
 
   const auto& cs = qc.constraints();
   for (uint32_t i = 0; i < cs.size(); ++i) {
-    // SqliteOpToFilterOp will return nullopt for any constraint which we don't
-    // support filtering ourselves. Only omit filtering by SQLite when we can
-    // handle filtering.
-    base::Optional<FilterOp> opt_op = SqliteOpToFilterOp(cs[i].op);
+    // SqliteConstraintToFilterOp will return nullopt for any constraint which
+    // we don't support filtering ourselves. Only omit filtering by SQLite when
+    // we can handle filtering.
+    base::Optional<FilterOp> opt_op =
+        SqliteConstraintToFilterOp(schema, cs[i].column, cs[i].op);
     info->sqlite_omit_constraint[i] = opt_op.has_value();
   }
 
@@ -187,35 +270,31 @@ void DbSqliteTable::BestIndex(const Table::Schema& schema,
 }
 
 int DbSqliteTable::ModifyConstraints(QueryConstraints* qc) {
-  ModifyConstraints(schema_, qc);
+  ModifyConstraints(schema_, qc, GetColumnStatistics());
   return SQLITE_OK;
 }
 
-void DbSqliteTable::ModifyConstraints(const Table::Schema& schema,
-                                      QueryConstraints* qc) {
+void DbSqliteTable::ModifyConstraints(
+    const Table::Schema& schema,
+    QueryConstraints* qc,
+    const std::vector<ColumnStatistics>* stats) {
   using C = QueryConstraints::Constraint;
 
   // Reorder constraints to consider the constraints on columns which are
-  // cheaper to filter first.
+  // cheaper to filter first. The values of the constraints are not known
+  // yet: Cursor::Filter refines this order once they are.
   auto* cs = qc->mutable_constraints();
-  std::sort(cs->begin(), cs->end(), [&schema](const C& a, const C& b) {
-    uint32_t a_idx = static_cast<uint32_t>(a.column);
-    uint32_t b_idx = static_cast<uint32_t>(b.column);
-    const auto& a_col = schema.columns[a_idx];
-    const auto& b_col = schema.columns[b_idx];
-
-    // Id columns are always very cheap to filter on so try and get them
-    // first.
-    if (a_col.is_id && !b_col.is_id)
-      return true;
-
-    // Sorted columns are also quite cheap to filter so order them after
-    // any id columns.
-    if (a_col.is_sorted && !b_col.is_sorted)
-      return true;
-
-    // TODO(lalitm): introduce more orderings here based on empirical data.
-    return false;
+  auto rank = [&schema, stats](const C& c) {
+    // Limit and offset constraints are not on any column.
+    if (sqlite_utils::IsOpLimit(c.op) || sqlite_utils::IsOpOffset(c.op))
+      return ConstraintRank{5, 1.0};
+    base::Optional<FilterOp> op =
+        SqliteConstraintToFilterOp(schema, c.column, c.op);
+    return RankConstraint(schema, stats, static_cast<uint32_t>(c.column), op,
+                          nullptr);
+  };
+  std::stable_sort(cs->begin(), cs->end(), [&rank](const C& a, const C& b) {
+    return rank(a) < rank(b);
   });
 
   // Remove any order by constraints which also have an equality constraint.
@@ -248,7 +327,8 @@ void DbSqliteTable::ModifyConstraints(const Table::Schema& schema,
 DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
     const Table::Schema& schema,
     uint32_t row_count,
-    const QueryConstraints& qc) {
+    const QueryConstraints& qc,
+    const std::vector<ColumnStatistics>* stats) {
   // Currently our cost estimation algorithm is quite simplistic but is good
   // enough for the simplest cases.
   // TODO(lalitm): replace hardcoded constants with either more heuristics
@@ -276,12 +356,42 @@ DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
   for (const auto& c : cs) {
     if (current_row_count < 2)
       break;
+    if (sqlite_utils::IsOpLimit(c.op) || sqlite_utils::IsOpOffset(c.op))
+      continue;
     const auto& col_schema = schema.columns[static_cast<uint32_t>(c.column)];
     if (sqlite_utils::IsOpEq(c.op) && col_schema.is_id) {
       // If we have an id equality constraint, it's a bit expensive to find
       // the exact row but it filters down to a single row.
       filter_cost += 100;
       current_row_count = 1;
+    } else if (stats) {
+      // With statistics about the column, estimate the number of rows kept
+      // from the selectivity of the constraint.
+      base::Optional<FilterOp> op =
+          SqliteConstraintToFilterOp(schema, c.column, c.op);
+      const ColumnStatistics& col_stats =
+          (*stats)[static_cast<uint32_t>(c.column)];
+      double selectivity =
+          op ? col_stats.EstimateSelectivity(*op, nullptr) : 0.5;
+      double estimated_rows = current_row_count * selectivity;
+
+      // Lookups in the equality index and binary searches on sorted columns
+      // only need to look at the matching rows; the single equality
+      // constraint is handled as above; otherwise, we'll need to do a full
+      // table scan.
+      bool is_lookup = op == FilterOp::kEq && col_stats.has_eq_index;
+      bool is_binary_search =
+          col_schema.is_sorted &&
+          (op == FilterOp::kEq || op == FilterOp::kLt ||
+           op == FilterOp::kLe || op == FilterOp::kGt || op == FilterOp::kGe);
+      if (is_lookup || is_binary_search) {
+        filter_cost += log2(current_row_count) + estimated_rows;
+      } else if (op == FilterOp::kEq && cs.size() == 1) {
+        filter_cost += (2 * current_row_count) / log2(current_row_count);
+      } else {
+        filter_cost += current_row_count;
+      }
+      current_row_count = std::max(static_cast<uint32_t>(estimated_rows), 1u);
     } else if (sqlite_utils::IsOpEq(c.op)) {
       // If there is only a single equality constraint, we have special logic
       // to sort by that column and then binary search if we see the constraint
@@ -323,6 +433,23 @@ DbSqliteTable::QueryCost DbSqliteTable::EstimateCost(
   return QueryCost{final_cost, current_row_count};
 }
 
+const std::vector<ColumnStatistics>* DbSqliteTable::GetColumnStatistics() {
+  if (computation_ != TableComputation::kStatic)
+    return nullptr;
+
+  // The tables are not expected to change once the trace is loaded but, if
+  // rows are added, the statistics are recomputed to account for them.
+  if (column_stats_.empty() ||
+      column_stats_.front().row_count != static_table_->row_count()) {
+    PERFETTO_TP_TRACE("DB_TABLE_COMPUTE_STATISTICS",
+                      [this](metatrace::Record* r) {
+                        r->AddArg("Table", name());
+                      });
+    column_stats_ = ColumnStatistics::ComputeForTable(*static_table_);
+  }
+  return &column_stats_;
+}
+
 std::unique_ptr<SqliteTable::Cursor> DbSqliteTable::CreateCursor() {
   return std::unique_ptr<Cursor>(new Cursor(this, cache_));
 }
@@ -332,9 +459,7 @@ DbSqliteTable::Cursor::Cursor(DbSqliteTable* sqlite_table, QueryCache* cache)
       db_sqlite_table_(sqlite_table),
       cache_(cache) {}
 
-void DbSqliteTable::Cursor::TryCacheCreateSortedTable(
-    const QueryConstraints& qc,
-    FilterHistory history) {
+void DbSqliteTable::Cursor::TryCacheCreateSortedTable(FilterHistory history) {
   // Check if we have a cache. Some subclasses (e.g. the flamegraph table) may
   // pass nullptr to disable caching.
   if (!cache_)
@@ -345,7 +470,7 @@ void DbSqliteTable::Cursor::TryCacheCreateSortedTable(
 
     // Check if the new constraint set is cached by another cursor.
     sorted_cache_table_ =
-        cache_->GetIfCached(upstream_table_, qc.constraints());
+        cache_->GetIfCached(upstream_table_, constraints_);
     return;
   }
 
@@ -363,23 +488,23 @@ void DbSqliteTable::Cursor::TryCacheCreateSortedTable(
 
   // If we have more than one constraint, we can't cache the table using
   // this method.
-  if (qc.constraints().size() != 1)
+  if (constraints_.size() != 1)
     return;
 
   // If the constraing is not an equality constraint, there's little
   // benefit to caching
-  const auto& c = qc.constraints().front();
-  if (!sqlite_utils::IsOpEq(c.op))
+  const Constraint& c = constraints_.front();
+  if (c.op != FilterOp::kEq)
     return;
 
   // If the column is already sorted, we don't need to cache at all.
-  uint32_t col = static_cast<uint32_t>(c.column);
+  uint32_t col = c.col_idx;
   if (upstream_table_->GetColumn(col).IsSorted())
     return;
 
   // Try again to get the result or start caching it.
   sorted_cache_table_ =
-      cache_->GetOrCache(upstream_table_, qc.constraints(), [this, col]() {
+      cache_->GetOrCache(upstream_table_, constraints_, [this, col]() {
         return upstream_table_->Sort({Order{col, false}});
       });
 }
@@ -395,24 +520,79 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
   // before the table's destructor.
   iterator_ = base::nullopt;
 
+  QueryProfiler::OperatorStats* profile_stats =
+      db_sqlite_table_->GetProfileStats();
+
   // We reuse this vector to reduce memory allocations on nested subqueries.
   constraints_.resize(qc.constraints().size());
   uint32_t constraints_pos = 0;
+  base::Optional<int64_t> limit;
+  int64_t offset = 0;
+  bool sqlite_filters_rows = false;
   for (size_t i = 0; i < qc.constraints().size(); ++i) {
     const auto& cs = qc.constraints()[i];
     uint32_t col = static_cast<uint32_t>(cs.column);
 
+    if (sqlite_utils::IsOpLimit(cs.op) || sqlite_utils::IsOpOffset(cs.op)) {
+      // SQLite only allows integer limits and offsets; it treats negative
+      // limits as no limit and negative offsets as no offset.
+      if (sqlite3_value_type(argv[i]) != SQLITE_INTEGER) {
+        sqlite_filters_rows = true;
+        continue;
+      }
+      int64_t value = sqlite3_value_int64(argv[i]);
+      if (sqlite_utils::IsOpOffset(cs.op)) {
+        offset = std::max<int64_t>(value, 0);
+      } else if (value >= 0) {
+        limit = value;
+      }
+      continue;
+    }
+
     // If we get a nullopt FilterOp, that means we should allow SQLite
     // to handle the constraint.
-    base::Optional<FilterOp> opt_op = SqliteOpToFilterOp(cs.op);
-    if (!opt_op)
+    base::Optional<FilterOp> opt_op =
+        SqliteConstraintToFilterOp(db_sqlite_table_->schema_, cs.column, cs.op);
+    if (!opt_op) {
+      sqlite_filters_rows = true;
       continue;
+    }
 
     SqlValue value = SqliteValueToSqlValue(argv[i]);
+    if (*opt_op == FilterOp::kGlob && !value.is_null() &&
+        value.type != SqlValue::kString) {
+      // SQLite converts non-string patterns to strings before matching.
+      value = SqlValue::String(
+          reinterpret_cast<const char*>(sqlite3_value_text(argv[i])));
+    }
     constraints_[constraints_pos++] = Constraint{col, *opt_op, value};
   }
   constraints_.resize(constraints_pos);
 
+  // Now that the values of the constraints are known, use them to refine the
+  // order chosen in ModifyConstraints (e.g. a range constraint covering most
+  // of the table should come after one keeping only a few rows).
+  const std::vector<ColumnStatistics>* stats =
+      db_sqlite_table_->GetColumnStatistics();
+  if (stats && constraints_.size() > 1) {
+    const Table::Schema& schema = db_sqlite_table_->schema_;
+    auto rank = [&schema, stats](const Constraint& c) {
+      return RankConstraint(schema, stats, c.col_idx, c.op, &c.value);
+    };
+    std::stable_sort(constraints_.begin(), constraints_.end(),
+                     [&rank](const Constraint& a, const Constraint& b) {
+                       return rank(a) < rank(b);
+                     });
+  }
+
+  // If SQLite returns the first rows of the result as they are, only those
+  // need to be sorted.
+  base::Optional<uint32_t> sort_limit;
+  if (limit && !sqlite_filters_rows &&
+      *limit + offset <= std::numeric_limits<uint32_t>::max()) {
+    sort_limit = static_cast<uint32_t>(*limit + offset);
+  }
+
   // We reuse this vector to reduce memory allocations on nested subqueries.
   orders_.resize(qc.order_by().size());
   for (size_t i = 0; i < qc.order_by().size(); ++i) {
@@ -430,7 +610,7 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
 
       // Tries to create a sorted cached table which can be used to speed up
       // filters below.
-      TryCacheCreateSortedTable(qc, history);
+      TryCacheCreateSortedTable(history);
       break;
     case TableComputation::kDynamic: {
       PERFETTO_TP_TRACE("DYNAMIC_TABLE_GENERATE", [this](metatrace::Record* r) {
@@ -438,8 +618,13 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
       });
       // If we have a dynamically created table, regenerate the table based on
       // the new constraints.
+      base::TimeNanos compute_start = base::GetWallTimeNs();
       dynamic_table_ =
           db_sqlite_table_->generator_->ComputeTable(constraints_, orders_);
+      if (PERFETTO_UNLIKELY(profile_stats)) {
+        profile_stats->compute_ns +=
+            (base::GetWallTimeNs() - compute_start).count();
+      }
       upstream_table_ = dynamic_table_.get();
       if (!upstream_table_)
         return SQLITE_CONSTRAINT;
@@ -480,6 +665,9 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
         case FilterOp::kIsNotNull:
           writer.AppendString("IS NOT");
           break;
+        case FilterOp::kGlob:
+          writer.AppendString("GLOB");
+          break;
       }
       writer.AppendChar(' ');
 
@@ -514,6 +702,24 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
     }
   });
 
+  // Static tables don't change between queries so, if we've seen this exact
+  // query before, we may be able to reuse its result.
+  bool use_result_cache =
+      cache_ && db_sqlite_table_->computation_ == TableComputation::kStatic;
+  if (use_result_cache) {
+    std::shared_ptr<Table> cached =
+        cache_->GetIfCachedResult(upstream_table_, constraints_, orders_);
+    if (cached) {
+      if (PERFETTO_UNLIKELY(profile_stats))
+        profile_stats->cache_hits++;
+      mode_ = Mode::kTable;
+      db_table_ = std::move(cached);
+      iterator_ = db_table_->IterateRows();
+      eof_ = !*iterator_;
+      return SQLITE_OK;
+    }
+  }
+
   // Attempt to filter into a RowMap first - weall figure out whether to apply
   // this to the table or we should use the RowMap directly. Also, if we are
   // going to sort on the RowMap, it makes sense that we optimize for lookup
@@ -522,6 +728,11 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
                                          ? RowMap::OptimizeFor::kMemory
                                          : RowMap::OptimizeFor::kLookupSpeed;
   RowMap filter_map = SourceTable()->FilterToRowMap(constraints_, optimize_for);
+  if (PERFETTO_UNLIKELY(profile_stats)) {
+    profile_stats->rows_scanned += SourceTable()->row_count();
+    if (sorted_cache_table_)
+      profile_stats->cache_hits++;
+  }
 
   // If we have no order by constraints and it's cheap for us to use the
   // RowMap, just use the RowMap directoy.
@@ -543,9 +754,20 @@ int DbSqliteTable::Cursor::Filter(const QueryConstraints& qc,
   } else {
     mode_ = Mode::kTable;
 
-    db_table_ = SourceTable()->Apply(std::move(filter_map));
-    if (!orders_.empty())
-      db_table_ = db_table_->Sort(orders_);
+    Table filtered = SourceTable()->Apply(std::move(filter_map));
+    if (orders_.empty()) {
+      db_table_.reset(new Table(std::move(filtered)));
+    } else if (sort_limit) {
+      db_table_.reset(new Table(filtered.SortAndLimit(orders_, *sort_limit)));
+    } else {
+      db_table_.reset(new Table(filtered.Sort(orders_)));
+    }
+
+    // Only the complete result can be reused by other queries.
+    if (use_result_cache && !sort_limit) {
+      cache_->MaybeCacheResult(upstream_table_, constraints_, orders_,
+                               db_table_);
+    }
 
     iterator_ = db_table_->IterateRows();
 
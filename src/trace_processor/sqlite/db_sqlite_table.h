@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_SQLITE_DB_SQLITE_TABLE_H_
 #define SRC_TRACE_PROCESSOR_SQLITE_DB_SQLITE_TABLE_H_
 
+#include "src/trace_processor/db/column_statistics.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/sqlite/query_cache.h"
 #include "src/trace_processor/sqlite/sqlite_table.h"
@@ -91,7 +92,7 @@ class DbSqliteTable : public SqliteTable {
 
     // Tries to create a sorted table to cache in |sorted_cache_table_| if the
     // constraint set matches the requirements.
-    void TryCacheCreateSortedTable(const QueryConstraints&, FilterHistory);
+    void TryCacheCreateSortedTable(FilterHistory);
 
     const Table* SourceTable() const {
       // Try and use the sorted cache table (if it exists) to speed up the
@@ -114,8 +115,9 @@ class DbSqliteTable : public SqliteTable {
     // Only valid for Mode::kSingleRow.
     base::Optional<uint32_t> single_row_;
 
-    // Only valid for Mode::kTable.
-    base::Optional<Table> db_table_;
+    // Only valid for Mode::kTable. May be shared with |cache_| if the result
+    // of the filter was cached.
+    std::shared_ptr<Table> db_table_;
     base::Optional<Table::Iterator> iterator_;
 
     bool eof_ = true;
@@ -140,6 +142,9 @@ class DbSqliteTable : public SqliteTable {
   };
   struct Context {
     QueryCache* cache;
+
+    // Only valid when computation == TableComputation::kStatic: the schema of
+    // dynamic tables is created by their generator.
     Table::Schema schema;
     TableComputation computation;
 
@@ -175,16 +180,26 @@ class DbSqliteTable : public SqliteTable {
   // of them.
   static SqliteTable::Schema ComputeSchema(const Table::Schema&,
                                            const char* table_name);
-  static void ModifyConstraints(const Table::Schema&, QueryConstraints*);
+  //
+  // |stats|, if not null, are the statistics of the columns of the table (see
+  // ColumnStatistics) and are used to order the constraints and estimate the
+  // cost of the query more precisely.
+  static void ModifyConstraints(
+      const Table::Schema&,
+      QueryConstraints*,
+      const std::vector<ColumnStatistics>* stats = nullptr);
   static void BestIndex(const Table::Schema&,
                         uint32_t row_count,
                         const QueryConstraints&,
-                        BestIndexInfo*);
+                        BestIndexInfo*,
+                        const std::vector<ColumnStatistics>* stats = nullptr);
 
   // static for testing.
-  static QueryCost EstimateCost(const Table::Schema&,
-                                uint32_t row_count,
-                                const QueryConstraints& qc);
+  static QueryCost EstimateCost(
+      const Table::Schema&,
+      uint32_t row_count,
+      const QueryConstraints& qc,
+      const std::vector<ColumnStatistics>* stats = nullptr);
 
  private:
   QueryCache* cache_ = nullptr;
@@ -192,9 +207,17 @@ class DbSqliteTable : public SqliteTable {
 
   TableComputation computation_ = TableComputation::kStatic;
 
+  // Returns the statistics of the columns of the table, computing them if the
+  // table changed since they were last computed, or null for dynamic tables.
+  const std::vector<ColumnStatistics>* GetColumnStatistics();
+
   // Only valid when computation_ == TableComputation::kStatic.
   const Table* static_table_ = nullptr;
 
+  // Only valid when computation_ == TableComputation::kStatic. Computed when
+  // the table is first queried once the trace is loaded.
+  std::vector<ColumnStatistics> column_stats_;
+
   // Only valid when computation_ == TableComputation::kDynamic.
   std::unique_ptr<DynamicTableGenerator> generator_;
 };
@@ -153,6 +153,73 @@ TEST(DbSqliteTable, OrderByOnSortedCheaper) {
   ASSERT_EQ(sorted_cost.rows, a_cost.rows);
 }
 
+std::vector<ColumnStatistics> CreateStatistics(uint32_t row_count) {
+  std::vector<ColumnStatistics> stats(CreateSchema().columns.size());
+  for (auto& col : stats) {
+    col.row_count = row_count;
+    col.distinct_count = row_count;
+  }
+  // |type| has a few distinct values and an equality index.
+  stats[1].distinct_count = 10;
+  stats[1].has_eq_index = true;
+  return stats;
+}
+
+TEST(DbSqliteTable, ModifyConstraintsUsesStatistics) {
+  auto schema = CreateSchema();
+  auto stats = CreateStatistics(1234);
+
+  auto create_qc = []() {
+    QueryConstraints qc;
+    qc.AddConstraint(4u, SQLITE_INDEX_CONSTRAINT_LT, 0u);
+    qc.AddConstraint(3u, SQLITE_INDEX_CONSTRAINT_EQ, 1u);
+    qc.AddConstraint(1u, SQLITE_INDEX_CONSTRAINT_EQ, 2u);
+    return qc;
+  };
+
+  // Without statistics, the order of constraints on unsorted columns is kept.
+  QueryConstraints no_stats_qc = create_qc();
+  DbSqliteTable::ModifyConstraints(schema, &no_stats_qc);
+  ASSERT_EQ(no_stats_qc.constraints()[0].column, 4);
+  ASSERT_EQ(no_stats_qc.constraints()[1].column, 3);
+  ASSERT_EQ(no_stats_qc.constraints()[2].column, 1);
+
+  // With statistics, the index lookup comes first followed by the most
+  // selective scan.
+  QueryConstraints qc = create_qc();
+  DbSqliteTable::ModifyConstraints(schema, &qc, &stats);
+  ASSERT_EQ(qc.constraints()[0].column, 1);
+  ASSERT_EQ(qc.constraints()[1].column, 3);
+  ASSERT_EQ(qc.constraints()[2].column, 4);
+}
+
+TEST(DbSqliteTable, IndexedEqCheaperWithStatistics) {
+  auto schema = CreateSchema();
+  constexpr uint32_t kRowCount = 1234;
+  auto stats = CreateStatistics(kRowCount);
+
+  QueryConstraints indexed_eq;
+  indexed_eq.AddConstraint(1u, SQLITE_INDEX_CONSTRAINT_EQ, 0u);
+  indexed_eq.AddConstraint(4u, SQLITE_INDEX_CONSTRAINT_LT, 1u);
+
+  auto indexed_cost =
+      DbSqliteTable::EstimateCost(schema, kRowCount, indexed_eq, &stats);
+
+  QueryConstraints unindexed_eq;
+  unindexed_eq.AddConstraint(3u, SQLITE_INDEX_CONSTRAINT_EQ, 0u);
+  unindexed_eq.AddConstraint(4u, SQLITE_INDEX_CONSTRAINT_LT, 1u);
+
+  auto unindexed_cost =
+      DbSqliteTable::EstimateCost(schema, kRowCount, unindexed_eq, &stats);
+
+  // The number of rows is estimated from the number of distinct values: the
+  // unindexed column has more of them so the query returns fewer rows, but
+  // the lookup in the index is cheaper than the full table scan.
+  ASSERT_LT(indexed_cost.cost, unindexed_cost.cost);
+  ASSERT_EQ(indexed_cost.rows, 41u);
+  ASSERT_EQ(unindexed_cost.rows, 1u);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
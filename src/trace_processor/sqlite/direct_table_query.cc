@@ -0,0 +1,703 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/direct_table_query.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/db/group_by.h"
+#include "src/trace_processor/db/query_profiler.h"
+#include "src/trace_processor/sqlite/query_cache.h"
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/tp_metatrace.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+constexpr char kSchemaSql[] =
+    "SELECT sql FROM sqlite_master WHERE name = ?1 COLLATE NOCASE "
+    "UNION ALL "
+    "SELECT sql FROM sqlite_temp_master WHERE name = ?1 COLLATE NOCASE";
+
+struct Token {
+  enum class Type {
+    kIdentifier,
+    kInteger,
+    kString,
+    kSymbol,
+  };
+  Type type;
+
+  // The lowercase name for identifiers, the unescaped value for strings and
+  // the symbol itself for symbols.
+  std::string text;
+  int64_t integer;
+};
+
+// Splits |sql| into tokens. Returns false if |sql| contains anything this
+// class does not handle (comments, quoted identifiers, floating point or
+// blob literals...).
+bool Tokenize(const std::string& sql, std::vector<Token>* tokens) {
+  const char* c = sql.c_str();
+  while (*c) {
+    if (isspace(static_cast<unsigned char>(*c))) {
+      ++c;
+    } else if (isalpha(static_cast<unsigned char>(*c)) || *c == '_') {
+      const char* begin = c;
+      while (isalnum(static_cast<unsigned char>(*c)) || *c == '_')
+        ++c;
+      tokens->push_back(Token{Token::Type::kIdentifier,
+                              base::ToLower(std::string(begin, c)), 0});
+    } else if (isdigit(static_cast<unsigned char>(*c))) {
+      uint64_t value = 0;
+      for (; isdigit(static_cast<unsigned char>(*c)); ++c) {
+        value = value * 10 + static_cast<uint64_t>(*c - '0');
+        if (value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+          return false;
+      }
+      // Reject floating point (1.5, 1e3) and hex (0x10) literals.
+      if (isalnum(static_cast<unsigned char>(*c)) || *c == '_' || *c == '.')
+        return false;
+      tokens->push_back(
+          Token{Token::Type::kInteger, "", static_cast<int64_t>(value)});
+    } else if (*c == '\'') {
+      std::string value;
+      for (++c;; ++c) {
+        if (*c == '\0')
+          return false;
+        if (*c == '\'') {
+          if (c[1] != '\'')
+            break;
+          ++c;
+        }
+        value.push_back(*c);
+      }
+      ++c;
+      tokens->push_back(Token{Token::Type::kString, std::move(value), 0});
+    } else {
+      static const char* const kSymbols[] = {"==", "!=", "<>", "<=", ">=",
+                                             "=",  "<",  ">",  "*",  ",",
+                                             ";",  "-",  "(",  ")"};
+      const char* symbol = nullptr;
+      for (const char* s : kSymbols) {
+        if (strncmp(c, s, strlen(s)) == 0) {
+          symbol = s;
+          break;
+        }
+      }
+      // "--" starts a comment.
+      if (!symbol || strncmp(c, "--", 2) == 0)
+        return false;
+      tokens->push_back(Token{Token::Type::kSymbol, symbol, 0});
+      c += strlen(symbol);
+    }
+  }
+  return true;
+}
+
+// The parsed form of the queries recognized by DirectTableQueryPlanner.
+struct ParsedQuery {
+  struct Condition {
+    std::string column;
+    FilterOp op;
+    // Only set for ops which take a value.
+    base::Optional<Token> value;
+  };
+
+  struct ResultColumn {
+    // The returned or aggregated column; empty for COUNT(*).
+    std::string column;
+    // Only set for aggregate functions.
+    base::Optional<Aggregate::Type> aggregate;
+    // Empty if the column has no alias.
+    std::string alias;
+  };
+
+  // Empty for "SELECT *".
+  std::vector<ResultColumn> columns;
+  std::string table;
+  std::vector<Condition> conditions;
+  std::vector<std::string> group_by;
+  std::vector<std::pair<std::string, bool /* desc */>> orders;
+  base::Optional<uint32_t> limit;
+  uint32_t offset = 0;
+};
+
+class Parser {
+ public:
+  explicit Parser(const std::vector<Token>& tokens) : tokens_(tokens) {}
+
+  bool Parse(ParsedQuery* query) {
+    if (!ConsumeKeyword("select"))
+      return false;
+    if (!ConsumeSymbol("*")) {
+      do {
+        ParsedQuery::ResultColumn column;
+        if (!ParseResultColumn(&column))
+          return false;
+        query->columns.push_back(std::move(column));
+      } while (ConsumeSymbol(","));
+    }
+
+    if (!ConsumeKeyword("from"))
+      return false;
+    const Token* table = ConsumeIdentifier();
+    if (!table)
+      return false;
+    query->table = table->text;
+
+    if (ConsumeKeyword("where")) {
+      do {
+        ParsedQuery::Condition condition;
+        if (!ParseCondition(&condition))
+          return false;
+        query->conditions.push_back(condition);
+      } while (ConsumeKeyword("and"));
+    }
+
+    if (ConsumeKeyword("group")) {
+      if (!ConsumeKeyword("by"))
+        return false;
+      do {
+        const Token* column = ConsumeIdentifier();
+        if (!column)
+          return false;
+        query->group_by.push_back(column->text);
+      } while (ConsumeSymbol(","));
+    }
+
+    if (ConsumeKeyword("order")) {
+      if (!ConsumeKeyword("by"))
+        return false;
+      do {
+        const Token* column = ConsumeIdentifier();
+        if (!column)
+          return false;
+        bool desc = ConsumeKeyword("desc");
+        if (!desc)
+          ConsumeKeyword("asc");
+        query->orders.emplace_back(column->text, desc);
+      } while (ConsumeSymbol(","));
+    }
+
+    if (ConsumeKeyword("limit")) {
+      uint32_t limit;
+      if (!ConsumeCount(&limit))
+        return false;
+      query->limit = limit;
+      if (ConsumeKeyword("offset") && !ConsumeCount(&query->offset))
+        return false;
+    }
+
+    ConsumeSymbol(";");
+    return pos_ == tokens_.size();
+  }
+
+ private:
+  static constexpr const char* kKeywords[] = {
+      "select", "from",   "where", "and", "group", "order", "by",  "asc",
+      "desc",   "limit",  "offset", "is", "not",   "null",  "glob", "as"};
+
+  // Parses "<column> [[AS] <alias>]" or "<function>(<column> | *) [[AS]
+  // <alias>]" for the aggregate functions supported by GroupBy.
+  bool ParseResultColumn(ParsedQuery::ResultColumn* column) {
+    const Token* name = ConsumeIdentifier();
+    if (!name)
+      return false;
+
+    if (ConsumeSymbol("(")) {
+      if (name->text == "count") {
+        column->aggregate = Aggregate::Type::kCount;
+      } else if (name->text == "sum") {
+        column->aggregate = Aggregate::Type::kSum;
+      } else if (name->text == "min") {
+        column->aggregate = Aggregate::Type::kMin;
+      } else if (name->text == "max") {
+        column->aggregate = Aggregate::Type::kMax;
+      } else {
+        return false;
+      }
+      if (column->aggregate == Aggregate::Type::kCount && ConsumeSymbol("*")) {
+        // COUNT(*) has no column.
+      } else {
+        const Token* arg = ConsumeIdentifier();
+        if (!arg)
+          return false;
+        column->column = arg->text;
+      }
+      if (!ConsumeSymbol(")"))
+        return false;
+    } else {
+      column->column = name->text;
+    }
+
+    bool has_as = ConsumeKeyword("as");
+    const Token* alias = ConsumeIdentifier();
+    if (has_as && !alias)
+      return false;
+    if (alias)
+      column->alias = alias->text;
+    return true;
+  }
+
+  bool ParseCondition(ParsedQuery::Condition* condition) {
+    const Token* column = ConsumeIdentifier();
+    if (!column)
+      return false;
+    condition->column = column->text;
+
+    if (ConsumeKeyword("is")) {
+      condition->op =
+          ConsumeKeyword("not") ? FilterOp::kIsNotNull : FilterOp::kIsNull;
+      return ConsumeKeyword("null");
+    }
+
+    if (ConsumeKeyword("glob")) {
+      condition->op = FilterOp::kGlob;
+    } else if (ConsumeSymbol("=") || ConsumeSymbol("==")) {
+      condition->op = FilterOp::kEq;
+    } else if (ConsumeSymbol("!=") || ConsumeSymbol("<>")) {
+      condition->op = FilterOp::kNe;
+    } else if (ConsumeSymbol("<")) {
+      condition->op = FilterOp::kLt;
+    } else if (ConsumeSymbol("<=")) {
+      condition->op = FilterOp::kLe;
+    } else if (ConsumeSymbol(">")) {
+      condition->op = FilterOp::kGt;
+    } else if (ConsumeSymbol(">=")) {
+      condition->op = FilterOp::kGe;
+    } else {
+      return false;
+    }
+
+    bool negative = ConsumeSymbol("-");
+    if (pos_ >= tokens_.size())
+      return false;
+    const Token& value = tokens_[pos_++];
+    if (value.type == Token::Type::kInteger) {
+      condition->value = value;
+      if (negative)
+        condition->value->integer = -value.integer;
+      return true;
+    }
+    condition->value = value;
+    return value.type == Token::Type::kString && !negative;
+  }
+
+  bool ConsumeKeyword(const char* keyword) {
+    if (pos_ >= tokens_.size() ||
+        tokens_[pos_].type != Token::Type::kIdentifier ||
+        tokens_[pos_].text != keyword) {
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  bool ConsumeSymbol(const char* symbol) {
+    if (pos_ >= tokens_.size() || tokens_[pos_].type != Token::Type::kSymbol ||
+        tokens_[pos_].text != symbol) {
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  // Consumes an identifier which is not one of the keywords above (so that
+  // e.g. "SELECT * FROM t LIMIT" is not parsed as a table named "limit").
+  const Token* ConsumeIdentifier() {
+    if (pos_ >= tokens_.size() ||
+        tokens_[pos_].type != Token::Type::kIdentifier) {
+      return nullptr;
+    }
+    for (const char* keyword : kKeywords) {
+      if (tokens_[pos_].text == keyword)
+        return nullptr;
+    }
+    return &tokens_[pos_++];
+  }
+
+  bool ConsumeCount(uint32_t* count) {
+    if (pos_ >= tokens_.size() || tokens_[pos_].type != Token::Type::kInteger ||
+        tokens_[pos_].integer > std::numeric_limits<uint32_t>::max()) {
+      return false;
+    }
+    *count = static_cast<uint32_t>(tokens_[pos_++].integer);
+    return true;
+  }
+
+  const std::vector<Token>& tokens_;
+  size_t pos_ = 0;
+};
+
+constexpr const char* Parser::kKeywords[];
+
+// Returns whether GroupBy can compute |aggregate| on |table| with the same
+// result as SQLite.
+bool IsAggregatable(const Table& table, const Aggregate& aggregate) {
+  if (!aggregate.col_idx)
+    return aggregate.type == Aggregate::Type::kCount;
+  SqlValue::Type type = table.GetColumn(*aggregate.col_idx).type();
+  switch (aggregate.type) {
+    case Aggregate::Type::kCount:
+      return true;
+    case Aggregate::Type::kSum:
+      return type == SqlValue::kLong;
+    case Aggregate::Type::kMin:
+    case Aggregate::Type::kMax:
+      return type == SqlValue::kLong || type == SqlValue::kDouble;
+  }
+  return false;
+}
+
+// Sorts |table| using |ob| for a query with |limit| and |offset|: only the
+// rows which are returned are sorted. |is_partial| is set if the other rows
+// have been dropped.
+Table SortForQuery(Table table,
+                   const std::vector<Order>& ob,
+                   base::Optional<uint32_t> limit,
+                   uint32_t offset,
+                   bool* is_partial) {
+  uint64_t sort_limit = limit ? uint64_t{*limit} + offset
+                              : std::numeric_limits<uint64_t>::max();
+  *is_partial = !ob.empty() && sort_limit < table.row_count();
+  if (ob.empty())
+    return table;
+  if (*is_partial)
+    return table.SortAndLimit(ob, static_cast<uint32_t>(sort_limit));
+  return table.Sort(ob);
+}
+
+// Returns whether |value| is a literal which |column| filters the same way
+// as the value SQLite would pass to DbSqliteTable for it.
+bool IsFilterableValue(const Column& column,
+                       FilterOp op,
+                       const Token& value) {
+  if (op == FilterOp::kGlob)
+    return column.type() == SqlValue::kString &&
+           value.type == Token::Type::kString;
+  switch (column.type()) {
+    case SqlValue::kLong:
+      return value.type == Token::Type::kInteger;
+    case SqlValue::kString:
+      return value.type == Token::Type::kString;
+    case SqlValue::kDouble:
+    case SqlValue::kBytes:
+    case SqlValue::kNull:
+      return false;
+  }
+  return false;
+}
+
+}  // namespace
+
+DirectTableQuery::DirectTableQuery(std::shared_ptr<Table> table,
+                                   std::vector<uint32_t> columns,
+                                   base::Optional<uint32_t> limit,
+                                   uint32_t offset)
+    : table_(std::move(table)),
+      it_(table_->IterateRows()),
+      columns_(std::move(columns)),
+      remaining_(limit ? *limit : std::numeric_limits<uint64_t>::max()),
+      offset_(offset) {}
+
+DirectTableQuery::~DirectTableQuery() = default;
+
+DirectTableQueryPlanner::DirectTableQueryPlanner(sqlite3* db,
+                                                 QueryCache* cache)
+    : db_(db), cache_(cache) {}
+
+DirectTableQueryPlanner::~DirectTableQueryPlanner() = default;
+
+void DirectTableQueryPlanner::AddTable(const std::string& name,
+                                       const Table* table) {
+  Target target;
+  target.table = table;
+  for (uint32_t i = 0; i < table->GetColumnCount(); ++i) {
+    const Column& column = table->GetColumn(i);
+    if (!column.IsHidden())
+      target.star_columns.emplace_back(column.name(), i);
+    target.columns[base::ToLower(column.name())] = i;
+  }
+  target.schema.emplace_back(name, "");
+  targets_[base::ToLower(name)] = std::move(target);
+}
+
+void DirectTableQueryPlanner::AddView(const std::string& name,
+                                      const std::string& source,
+                                      const std::vector<Alias>& before,
+                                      const std::vector<Alias>& after) {
+  auto source_it = targets_.find(base::ToLower(source));
+  PERFETTO_CHECK(source_it != targets_.end());
+  const Target& source_target = source_it->second;
+
+  Target target;
+  target.table = source_target.table;
+  target.columns = source_target.columns;
+  auto add_aliases = [&target, &source_target](const std::vector<Alias>& as) {
+    for (const Alias& alias : as) {
+      uint32_t column =
+          source_target.columns.at(base::ToLower(alias.column));
+      target.star_columns.emplace_back(alias.name, column);
+      target.columns[base::ToLower(alias.name)] = column;
+    }
+  };
+  add_aliases(before);
+  target.star_columns.insert(target.star_columns.end(),
+                             source_target.star_columns.begin(),
+                             source_target.star_columns.end());
+  add_aliases(after);
+
+  base::Optional<std::string> sql = GetSchemaSql(name);
+  PERFETTO_CHECK(sql && !sql->empty());
+  target.schema = source_target.schema;
+  target.schema.emplace_back(name, *sql);
+  targets_[base::ToLower(name)] = std::move(target);
+}
+
+std::unique_ptr<DirectTableQuery> DirectTableQueryPlanner::Plan(
+    const std::string& sql,
+    sqlite3_stmt* stmt) {
+  std::vector<Token> tokens;
+  if (!Tokenize(sql, &tokens))
+    return nullptr;
+
+  ParsedQuery query;
+  Parser parser(tokens);
+  if (!parser.Parse(&query))
+    return nullptr;
+
+  auto target_it = targets_.find(query.table);
+  if (target_it == targets_.end())
+    return nullptr;
+  const Target& target = target_it->second;
+
+  auto find_column = [&target](const std::string& name) {
+    auto it = target.columns.find(name);
+    return it == target.columns.end() ? base::nullopt
+                                      : base::make_optional(it->second);
+  };
+
+  std::vector<Constraint> cs;
+  for (const auto& condition : query.conditions) {
+    base::Optional<uint32_t> column = find_column(condition.column);
+    if (!column)
+      return nullptr;
+    // String values point into |query|, which outlives the filtering below.
+    SqlValue value;
+    if (condition.value) {
+      const Token& token = *condition.value;
+      if (!IsFilterableValue(target.table->GetColumn(*column), condition.op,
+                             token)) {
+        return nullptr;
+      }
+      value = token.type == Token::Type::kInteger
+                  ? SqlValue::Long(token.integer)
+                  : SqlValue::String(token.text.c_str());
+    }
+    cs.push_back(Constraint{*column, condition.op, value});
+  }
+
+  // Queries with aggregate functions or a GROUP BY are computed with GroupBy,
+  // which returns a table with the columns of |target.table| followed by the
+  // aggregates.
+  bool is_aggregate = !query.group_by.empty();
+  for (const auto& column : query.columns)
+    is_aggregate |= column.aggregate.has_value();
+
+  std::vector<uint32_t> group_by;
+  for (const std::string& name : query.group_by) {
+    base::Optional<uint32_t> column = find_column(name);
+    // Doubles can compare equal without being identical (e.g. 0.0 and -0.0)
+    // so leave grouping them to SQLite.
+    if (!column ||
+        target.table->GetColumn(*column).type() == SqlValue::kDouble) {
+      return nullptr;
+    }
+    group_by.push_back(*column);
+  }
+  auto is_grouped = [&group_by](uint32_t column) {
+    return std::find(group_by.begin(), group_by.end(), column) !=
+           group_by.end();
+  };
+
+  // SQLite has already resolved the result columns when preparing the
+  // statement: double check that we agree on them.
+  std::vector<uint32_t> columns;
+  std::vector<Aggregate> aggregates;
+  uint32_t column_count = static_cast<uint32_t>(sqlite3_column_count(stmt));
+  if (query.columns.empty()) {
+    if (is_aggregate || target.star_columns.size() != column_count)
+      return nullptr;
+    for (uint32_t i = 0; i < column_count; ++i) {
+      const auto& star_column = target.star_columns[i];
+      const char* name = sqlite3_column_name(stmt, static_cast<int>(i));
+      if (!name || !base::CaseInsensitiveEqual(name, star_column.first))
+        return nullptr;
+      columns.push_back(star_column.second);
+    }
+  } else {
+    if (query.columns.size() != column_count)
+      return nullptr;
+    for (const auto& result_column : query.columns) {
+      base::Optional<uint32_t> column;
+      if (!result_column.column.empty()) {
+        column = find_column(result_column.column);
+        if (!column)
+          return nullptr;
+      }
+      if (!result_column.aggregate) {
+        // SQLite returns the value of an arbitrary row of the group for
+        // columns which are not grouped.
+        if (is_aggregate && !is_grouped(*column))
+          return nullptr;
+        columns.push_back(*column);
+        continue;
+      }
+      Aggregate aggregate{*result_column.aggregate, column};
+      if (!IsAggregatable(*target.table, aggregate))
+        return nullptr;
+      columns.push_back(target.table->GetColumnCount() +
+                        static_cast<uint32_t>(aggregates.size()));
+      aggregates.push_back(aggregate);
+    }
+  }
+
+  // As in SQLite, ORDER BY refers to the aliases of the result columns before
+  // the columns of the table.
+  std::vector<Order> ob;
+  for (const auto& order : query.orders) {
+    base::Optional<uint32_t> column;
+    for (uint32_t i = 0; i < query.columns.size(); ++i) {
+      if (query.columns[i].alias != order.first)
+        continue;
+      if (column)
+        return nullptr;
+      column = columns[i];
+    }
+    if (!column) {
+      column = find_column(order.first);
+      if (!column || (is_aggregate && !is_grouped(*column)))
+        return nullptr;
+    }
+    ob.push_back(Order{*column, order.second});
+  }
+
+  if (!IsSchemaUnchanged(target))
+    return nullptr;
+
+  PERFETTO_TP_TRACE("DIRECT_TABLE_QUERY");
+
+  // Without a cursor, the query is profiled as a single filter of the table.
+  QueryProfiler* profiler = QueryProfiler::current();
+  QueryProfiler::ScopedOperator profiled_op(profiler, &query.table);
+  base::TimeNanos start = base::GetWallTimeNs();
+  bool is_cache_hit = false;
+
+  const Table* source = target.table;
+  std::shared_ptr<Table> result;
+  if (is_aggregate) {
+    Table filtered = source->Filter(cs);
+
+    // Without GROUP BY, SQLite returns a row even if there are no groups.
+    if (group_by.empty() && filtered.row_count() == 0)
+      return nullptr;
+
+    base::Optional<Table> groups = GroupBy(filtered, group_by, aggregates);
+    if (!groups)
+      return nullptr;
+    bool is_partial;
+    result.reset(new Table(SortForQuery(std::move(*groups), ob, query.limit,
+                                        query.offset, &is_partial)));
+  } else {
+    if (cache_)
+      result = cache_->GetIfCachedResult(source, cs, ob);
+    is_cache_hit = result != nullptr;
+    if (!result) {
+      RowMap::OptimizeFor optimize_for =
+          ob.empty() ? RowMap::OptimizeFor::kMemory
+                     : RowMap::OptimizeFor::kLookupSpeed;
+      Table filtered =
+          source->Apply(source->FilterToRowMap(cs, optimize_for));
+
+      // As with DbSqliteTable, partially sorted results are not cached.
+      bool is_partial;
+      result.reset(new Table(SortForQuery(std::move(filtered), ob, query.limit,
+                                          query.offset, &is_partial)));
+      if (cache_ && !is_partial)
+        cache_->MaybeCacheResult(source, cs, ob, result);
+    }
+  }
+
+  if (PERFETTO_UNLIKELY(profiler)) {
+    QueryProfiler::OperatorStats* stats =
+        profiler->GetOperatorStats(query.table);
+    stats->filters++;
+    stats->rows_scanned += is_cache_hit ? 0 : source->row_count();
+    stats->rows_returned += result->row_count();
+    stats->cache_hits += is_cache_hit;
+    stats->filter_ns += (base::GetWallTimeNs() - start).count();
+  }
+  return std::unique_ptr<DirectTableQuery>(new DirectTableQuery(
+      std::move(result), std::move(columns), query.limit, query.offset));
+}
+
+bool DirectTableQueryPlanner::IsSchemaUnchanged(const Target& target) {
+  for (const auto& object : target.schema) {
+    base::Optional<std::string> sql = GetSchemaSql(object.first);
+    if (!sql || *sql != object.second)
+      return false;
+  }
+  return true;
+}
+
+base::Optional<std::string> DirectTableQueryPlanner::GetSchemaSql(
+    const std::string& name) {
+  if (!schema_stmt_) {
+    sqlite3_stmt* stmt = nullptr;
+    int ret = sqlite3_prepare_v2(db_, kSchemaSql, -1, &stmt, nullptr);
+    PERFETTO_CHECK(ret == SQLITE_OK);
+    schema_stmt_.reset(stmt);
+  }
+  sqlite3_stmt* stmt = schema_stmt_.get();
+  sqlite3_reset(stmt);
+  sqlite3_bind_text(stmt, 1, name.c_str(), static_cast<int>(name.size()),
+                    sqlite_utils::kSqliteTransient);
+
+  std::string sql;
+  uint32_t rows = 0;
+  int ret;
+  for (; (ret = sqlite3_step(stmt)) == SQLITE_ROW; ++rows) {
+    const unsigned char* text = sqlite3_column_text(stmt, 0);
+    sql = text ? reinterpret_cast<const char*>(text) : "";
+  }
+  sqlite3_reset(stmt);
+  if (ret != SQLITE_DONE || rows > 1)
+    return base::nullopt;
+  return sql;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
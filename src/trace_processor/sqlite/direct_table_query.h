@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_DIRECT_TABLE_QUERY_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_DIRECT_TABLE_QUERY_H_
+
+#include <sqlite3.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/sqlite/scoped_db.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class QueryCache;
+
+// Result of a query which is computed directly on a db::Table, bypassing the
+// SQLite virtual machine and the DbSqliteTable cursor: the rows are read from
+// a Table::Iterator instead of being copied into SQLite cell by cell.
+class DirectTableQuery {
+ public:
+  DirectTableQuery(std::shared_ptr<Table> table,
+                   std::vector<uint32_t> columns,
+                   base::Optional<uint32_t> limit,
+                   uint32_t offset);
+  ~DirectTableQuery();
+
+  // Advances to the next row; returns false once all the rows have been
+  // returned.
+  bool Next() {
+    if (started_) {
+      it_.Next();
+    } else {
+      started_ = true;
+      for (uint32_t i = 0; i < offset_ && it_; ++i)
+        it_.Next();
+    }
+    if (!it_ || remaining_ == 0)
+      return false;
+    --remaining_;
+    return true;
+  }
+
+  // Returns the value of the |col|-th result column at the current row.
+  SqlValue Get(uint32_t col) const { return it_.Get(columns_[col]); }
+
+ private:
+  std::shared_ptr<Table> table_;
+  Table::Iterator it_;
+
+  // Index in |table_| of each result column.
+  std::vector<uint32_t> columns_;
+
+  uint64_t remaining_ = 0;
+  uint32_t offset_ = 0;
+  bool started_ = false;
+};
+
+// Recognizes queries which only select, filter, group and sort the columns of
+// a single db table (or of a view which only renames some of them) and
+// computes them as a DirectTableQuery. These are queries of the form:
+//
+//   SELECT * | <result>[, <result>...] FROM <table>
+//   [WHERE <column> <op> <literal> [AND ...]]
+//   [GROUP BY <column>[, ...]]
+//   [ORDER BY <column> | <alias> [ASC | DESC][, ...]]
+//   [LIMIT <n> [OFFSET <m>]]
+//
+// where <result> is a column or one of COUNT(*), COUNT(<column>),
+// SUM(<column>), MIN(<column>) and MAX(<column>), optionally followed by an
+// alias, <op> is one of =, ==, !=, <>, <, <=, >, >=, GLOB, IS NULL and
+// IS NOT NULL and <literal> is an integer or a string. Literals are only
+// accepted when they have the type of the column, so that the table filters
+// them exactly as they would be filtered when SQLite passes the same
+// constraints to DbSqliteTable. Similarly, aggregates are only computed (by
+// GroupBy) when their result is the one of SQLite. Anything else
+// (expressions, joins, other literals, comments...) is left to SQLite.
+class DirectTableQueryPlanner {
+ public:
+  // A column of a view which renames the column |column| of its source.
+  struct Alias {
+    std::string name;
+    std::string column;
+  };
+
+  DirectTableQueryPlanner(sqlite3* db, QueryCache* cache);
+  ~DirectTableQueryPlanner();
+
+  // Makes |table| queryable as |name|.
+  void AddTable(const std::string& name, const Table* table);
+
+  // Makes the view |name| queryable. The view must already exist and be
+  // defined as "SELECT <before>, *, <after> FROM <source>", where |source| has
+  // already been added and |before| and |after| are lists of aliases of its
+  // columns.
+  void AddView(const std::string& name,
+               const std::string& source,
+               const std::vector<Alias>& before,
+               const std::vector<Alias>& after);
+
+  // Returns the result of |sql| (which has been prepared into |stmt|) if it
+  // can be computed directly, nullptr otherwise.
+  std::unique_ptr<DirectTableQuery> Plan(const std::string& sql,
+                                         sqlite3_stmt* stmt);
+
+ private:
+  struct Target {
+    const Table* table = nullptr;
+
+    // Name and table column of the columns returned by "SELECT *", in order.
+    std::vector<std::pair<std::string, uint32_t>> star_columns;
+
+    // All the columns (including hidden ones and aliases) which can be
+    // referenced by name, keyed by their lowercase name.
+    std::unordered_map<std::string, uint32_t> columns;
+
+    // The names which must resolve to the objects they were registered as
+    // (i.e. not have been dropped, redefined or shadowed by a temporary
+    // object) for the target to be used, with the SQL which defines them
+    // (empty for tables).
+    std::vector<std::pair<std::string, std::string>> schema;
+  };
+
+  // Returns whether the schema objects |target| was created from are still
+  // the ones visible to queries.
+  bool IsSchemaUnchanged(const Target& target);
+
+  // Returns the SQL of the schema object |name|, an empty string if it has
+  // no SQL (e.g. for eponymous virtual tables) or nullopt if there is more
+  // than one object with that name.
+  base::Optional<std::string> GetSchemaSql(const std::string& name);
+
+  sqlite3* db_ = nullptr;
+  QueryCache* cache_ = nullptr;
+  std::unordered_map<std::string, Target> targets_;
+  ScopedStmt schema_stmt_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_DIRECT_TABLE_QUERY_H_
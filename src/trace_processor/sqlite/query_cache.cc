@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_cache.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/ext/base/hash.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+QueryCache::QueryCache(TraceStorage* storage,
+                       uint32_t max_entries,
+                       uint64_t max_bytes)
+    : storage_(storage), max_entries_(max_entries), max_bytes_(max_bytes) {}
+
+QueryCache::~QueryCache() = default;
+
+std::shared_ptr<Table> QueryCache::GetIfCached(
+    const Table* source,
+    const std::vector<Constraint>& cs) {
+  auto it = Find(Kind::kSorted, source, cs, {});
+  RecordLookup(it != entries_.end());
+  return it == entries_.end() ? nullptr : it->table;
+}
+
+std::shared_ptr<Table> QueryCache::GetOrCache(
+    const Table* source,
+    const std::vector<Constraint>& cs,
+    std::function<Table()> fn) {
+  auto it = Find(Kind::kSorted, source, cs, {});
+  if (it != entries_.end())
+    return it->table;
+
+  std::shared_ptr<Table> table(new Table(fn()));
+
+  Entry entry;
+  entry.kind = Kind::kSorted;
+  entry.source = source;
+  entry.source_mutation_count = source->mutation_count();
+  for (const Constraint& c : cs) {
+    // The values of the constraints are not part of the key for sorted tables.
+    entry.constraints.emplace_back(
+        KeyConstraint{c.col_idx, c.op, SqlValue::Type::kNull, 0, 0, {}});
+  }
+  entry.table = table;
+  entry.bytes = EstimateBytes(*table);
+  Insert(std::move(entry));
+  return table;
+}
+
+std::shared_ptr<Table> QueryCache::GetIfCachedResult(
+    const Table* source,
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>& ob) {
+  if (source->row_count() < kMinRowsForResultCache)
+    return nullptr;
+
+  auto it = Find(Kind::kResult, source, cs, ob);
+  RecordLookup(it != entries_.end());
+  return it == entries_.end() ? nullptr : it->table;
+}
+
+void QueryCache::MaybeCacheResult(const Table* source,
+                                  const std::vector<Constraint>& cs,
+                                  const std::vector<Order>& ob,
+                                  std::shared_ptr<Table> result) {
+  if (!result || source->row_count() < kMinRowsForResultCache)
+    return;
+
+  Entry entry;
+  entry.kind = Kind::kResult;
+  entry.source = source;
+  entry.source_mutation_count = source->mutation_count();
+  for (const Constraint& c : cs) {
+    KeyConstraint key{c.col_idx, c.op, c.value.type, 0, 0, {}};
+    switch (c.value.type) {
+      case SqlValue::Type::kNull:
+        break;
+      case SqlValue::Type::kLong:
+        key.long_value = c.value.long_value;
+        break;
+      case SqlValue::Type::kDouble:
+        key.double_value = c.value.double_value;
+        break;
+      case SqlValue::Type::kString:
+        key.string_value = c.value.string_value;
+        break;
+      case SqlValue::Type::kBytes:
+        // Constraints on bytes are rare enough that it's not worth the
+        // complexity of supporting them.
+        return;
+    }
+    entry.constraints.emplace_back(std::move(key));
+  }
+
+  // Only cache the result the second time we see the key: this avoids
+  // evicting useful entries for queries which are only executed once.
+  uint64_t hash = HashResultKey(source, cs, ob);
+  auto miss_it = std::find(recent_misses_.begin(), recent_misses_.end(), hash);
+  if (miss_it == recent_misses_.end()) {
+    recent_misses_[next_recent_miss_] = hash;
+    next_recent_miss_ = (next_recent_miss_ + 1) % recent_misses_.size();
+    return;
+  }
+  *miss_it = 0;
+
+  entry.orders = ob;
+  entry.table = std::move(result);
+  entry.bytes = EstimateBytes(*entry.table);
+  Insert(std::move(entry));
+}
+
+std::list<QueryCache::Entry>::iterator QueryCache::Find(
+    Kind kind,
+    const Table* source,
+    const std::vector<Constraint>& cs,
+    const std::vector<Order>& ob) {
+  const uint64_t mutation_count = source->mutation_count();
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->kind != kind || it->source != source) {
+      ++it;
+      continue;
+    }
+
+    // If the source table changed since the entry was created, the entry is
+    // out of date and can never be used again.
+    if (it->source_mutation_count != mutation_count) {
+      bytes_ -= it->bytes;
+      it = entries_.erase(it);
+      evictions_++;
+      if (storage_)
+        storage_->IncrementStats(stats::query_cache_evictions);
+      continue;
+    }
+
+    bool matches =
+        it->constraints.size() == cs.size() && it->orders.size() == ob.size();
+    for (uint32_t i = 0; matches && i < cs.size(); ++i) {
+      matches = Matches(kind, it->constraints[i], cs[i]);
+    }
+    for (uint32_t i = 0; matches && i < ob.size(); ++i) {
+      matches = it->orders[i].col_idx == ob[i].col_idx &&
+                it->orders[i].desc == ob[i].desc;
+    }
+    if (!matches) {
+      ++it;
+      continue;
+    }
+
+    // Move the entry to the front as it's now the most recently used.
+    entries_.splice(entries_.begin(), entries_, it);
+    return entries_.begin();
+  }
+  return entries_.end();
+}
+
+void QueryCache::Insert(Entry entry) {
+  // Tables which would by themselves go over the limit are never cached.
+  if (entry.bytes > max_bytes_ || max_entries_ == 0)
+    return;
+
+  bytes_ += entry.bytes;
+  entries_.emplace_front(std::move(entry));
+
+  while (entries_.size() > max_entries_ || bytes_ > max_bytes_) {
+    bytes_ -= entries_.back().bytes;
+    entries_.pop_back();
+    evictions_++;
+    if (storage_)
+      storage_->IncrementStats(stats::query_cache_evictions);
+  }
+}
+
+void QueryCache::RecordLookup(bool hit) {
+  if (hit) {
+    hits_++;
+  } else {
+    misses_++;
+  }
+  if (storage_) {
+    storage_->IncrementStats(hit ? stats::query_cache_hits
+                                 : stats::query_cache_misses);
+  }
+}
+
+bool QueryCache::Matches(Kind kind,
+                         const KeyConstraint& key,
+                         const Constraint& c) {
+  if (key.col_idx != c.col_idx || key.op != c.op)
+    return false;
+
+  // Sorted tables can be used for any value of the constraints.
+  if (kind == Kind::kSorted)
+    return true;
+
+  if (key.type != c.value.type)
+    return false;
+
+  switch (c.value.type) {
+    case SqlValue::Type::kNull:
+      return true;
+    case SqlValue::Type::kLong:
+      return key.long_value == c.value.long_value;
+    case SqlValue::Type::kDouble:
+      // Compare the bit patterns so that NaN matches NaN (and 0.0 is distinct
+      // from -0.0); this is fine as we are only looking for identical queries.
+      return memcmp(&key.double_value, &c.value.double_value,
+                    sizeof(double)) == 0;
+    case SqlValue::Type::kString:
+      return key.string_value == c.value.string_value;
+    case SqlValue::Type::kBytes:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+uint64_t QueryCache::HashResultKey(const Table* source,
+                                   const std::vector<Constraint>& cs,
+                                   const std::vector<Order>& ob) {
+  base::Hash hash;
+  hash.Update(reinterpret_cast<uintptr_t>(source));
+  hash.Update(source->row_count());
+  for (const Constraint& c : cs) {
+    hash.Update(c.col_idx);
+    hash.Update(static_cast<uint32_t>(c.op));
+    hash.Update(static_cast<uint32_t>(c.value.type));
+    switch (c.value.type) {
+      case SqlValue::Type::kNull:
+      case SqlValue::Type::kBytes:
+        break;
+      case SqlValue::Type::kLong:
+        hash.Update(c.value.long_value);
+        break;
+      case SqlValue::Type::kDouble:
+        hash.Update(c.value.double_value);
+        break;
+      case SqlValue::Type::kString:
+        hash.Update(c.value.string_value, strlen(c.value.string_value));
+        break;
+    }
+  }
+  for (const Order& o : ob) {
+    hash.Update(o.col_idx);
+    hash.Update(o.desc);
+  }
+  return hash.digest();
+}
+
+uint64_t QueryCache::EstimateBytes(const Table& table) {
+  // This is an upper bound as it assumes every RowMap is an index vector;
+  // in practice, many of them will be ranges or BitVectors.
+  uint64_t bytes = sizeof(Table) + table.GetColumnCount() * sizeof(Column);
+  bytes += static_cast<uint64_t>(table.row_count()) *
+           table.row_maps().size() * sizeof(uint32_t);
+  return bytes;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -17,62 +17,164 @@
 #ifndef SRC_TRACE_PROCESSOR_SQLITE_QUERY_CACHE_H_
 #define SRC_TRACE_PROCESSOR_SQLITE_QUERY_CACHE_H_
 
-#include "perfetto/ext/base/optional.h"
+#include <stdint.h>
+
+#include <array>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "src/trace_processor/db/table.h"
-#include "src/trace_processor/sqlite/query_constraints.h"
 
 namespace perfetto {
 namespace trace_processor {
 
+class TraceStorage;
+
 // Implements a simple caching strategy for commonly executed queries.
 // TODO(lalitm): the design of this class is very experimental. It was mainly
 // introduced to solve a specific problem (slow process summary tracks in the
 // Perfetto UI) and should not be modified without a full design discussion.
+//
+// The cache holds two kinds of tables derived from a source table:
+//  * sorted tables: a copy of the source table sorted on a column which is
+//    repeatedly filtered with an equality constraint (see
+//    DbSqliteTable::Cursor::TryCacheCreateSortedTable). These can be reused
+//    for any value of the constraint so are keyed only on the columns and
+//    operators of the constraints.
+//  * filter results: the result of filtering and sorting the source table.
+//    These are keyed on the full constraints (including the values) and
+//    order bys and are only cached the second time a key is seen to avoid
+//    churning the cache with one-off queries.
+//
+// Entries are evicted in least recently used order when either the number of
+// entries or the (approximate) memory used by the cached tables exceed the
+// limits passed to the constructor. Entries are also dropped if rows were
+// inserted into the source table or values were set in it since they were
+// created (see Table::mutation_count).
+//
+// Hits, misses and evictions are reported in the stats table (if a
+// TraceStorage is passed to the constructor).
 class QueryCache {
  public:
-  using Constraint = QueryConstraints::Constraint;
+  static constexpr uint32_t kDefaultMaxEntries = 32;
+  static constexpr uint64_t kDefaultMaxBytes = 256 * 1024 * 1024;
+
+  explicit QueryCache(TraceStorage* storage = nullptr,
+                      uint32_t max_entries = kDefaultMaxEntries,
+                      uint64_t max_bytes = kDefaultMaxBytes);
+  ~QueryCache();
 
-  // Returns a cached table if the passed query set are currenly cached or
-  // nullptr otherwise.
+  // Returns a cached sorted table if a table for the passed constraint
+  // columns and operators is currently cached or nullptr otherwise.
   std::shared_ptr<Table> GetIfCached(const Table* source,
-                                     const std::vector<Constraint>& cs) const {
-    if (cached_.source != source || cs.size() != cached_.constraints.size())
-      return nullptr;
-
-    auto p = [](const Constraint& a, const Constraint& b) {
-      return a.column == b.column && a.op == b.op;
-    };
-    bool same_cs =
-        std::equal(cs.begin(), cs.end(), cached_.constraints.begin(), p);
-    return same_cs ? cached_.table : nullptr;
-  }
+                                     const std::vector<Constraint>& cs);
+
+  // Caches the sorted table returned by |fn| for the given source and
+  // constraint set (unless it is already cached). Returns a pointer to the
+  // cached table.
+  std::shared_ptr<Table> GetOrCache(const Table* source,
+                                    const std::vector<Constraint>& cs,
+                                    std::function<Table()> fn);
+
+  // Returns the cached result of filtering |source| with |cs| and sorting it
+  // with |ob| or nullptr if it is not cached.
+  std::shared_ptr<Table> GetIfCachedResult(const Table* source,
+                                           const std::vector<Constraint>& cs,
+                                           const std::vector<Order>& ob);
 
-  // Caches the table with the given source, constraint and order set. Returns
-  // a pointer to the newly cached table.
-  std::shared_ptr<Table> GetOrCache(
-      const Table* source,
-      const std::vector<QueryConstraints::Constraint>& cs,
-      std::function<Table()> fn) {
-    std::shared_ptr<Table> cached = GetIfCached(source, cs);
-    if (cached)
-      return cached;
-
-    cached_.source = source;
-    cached_.constraints = cs;
-    cached_.table.reset(new Table(fn()));
-    return cached_.table;
+  // Offers |result|, the result of filtering |source| with |cs| and sorting
+  // it with |ob|, to the cache. The cache decides whether it is worth
+  // retaining.
+  void MaybeCacheResult(const Table* source,
+                        const std::vector<Constraint>& cs,
+                        const std::vector<Order>& ob,
+                        std::shared_ptr<Table> result);
+
+  uint32_t entry_count() const {
+    return static_cast<uint32_t>(entries_.size());
   }
+  uint64_t bytes() const { return bytes_; }
+
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+  uint64_t evictions() const { return evictions_; }
 
  private:
-  struct CachedTable {
-    std::shared_ptr<Table> table;
+  enum class Kind {
+    kSorted,
+    kResult,
+  };
 
-    const Table* source = nullptr;
-    std::vector<Constraint> constraints;
+  // A copy of a Constraint which owns the memory of its value: the values of
+  // the constraints passed in by callers usually point to memory owned by
+  // SQLite which is only valid for the duration of the call.
+  struct KeyConstraint {
+    uint32_t col_idx;
+    FilterOp op;
+    SqlValue::Type type;
+    int64_t long_value;
+    double double_value;
+    std::string string_value;
   };
 
-  CachedTable cached_;
+  struct Entry {
+    Kind kind;
+    const Table* source;
+    uint64_t source_mutation_count;
+    std::vector<KeyConstraint> constraints;
+    std::vector<Order> orders;
+
+    std::shared_ptr<Table> table;
+    uint64_t bytes;
+  };
+
+  // The minimum number of rows a source table needs to have for filter
+  // results to be cached: below this, filtering is cheap anyway.
+  static constexpr uint32_t kMinRowsForResultCache = 1024;
+
+  // Number of recently missed filter result keys to remember: a filter
+  // result is only cached if its key was among these.
+  static constexpr size_t kRecentMissCount = 64;
+
+  // Returns an iterator to the matching entry (moving it to the front of the
+  // LRU list) or entries_.end() if there is no match.
+  std::list<Entry>::iterator Find(Kind kind,
+                                  const Table* source,
+                                  const std::vector<Constraint>& cs,
+                                  const std::vector<Order>& ob);
+
+  // Inserts a new entry at the front of the LRU list and evicts entries if
+  // this caused the limits to be exceeded.
+  void Insert(Entry entry);
+
+  // Records a hit or miss in the stats.
+  void RecordLookup(bool hit);
+
+  static bool Matches(Kind kind,
+                      const KeyConstraint& key,
+                      const Constraint& c);
+  static uint64_t HashResultKey(const Table* source,
+                                const std::vector<Constraint>& cs,
+                                const std::vector<Order>& ob);
+  static uint64_t EstimateBytes(const Table& table);
+
+  TraceStorage* const storage_;
+  const uint32_t max_entries_;
+  const uint64_t max_bytes_;
+
+  // Most recently used entries are at the front.
+  std::list<Entry> entries_;
+  uint64_t bytes_ = 0;
+
+  std::array<uint64_t, kRecentMissCount> recent_misses_{};
+  size_t next_recent_miss_ = 0;
+
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
 };
 
 }  // namespace trace_processor
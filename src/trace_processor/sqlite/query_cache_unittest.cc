@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_cache.h"
+
+#include "src/trace_processor/tables/macros.h"
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+#define PERFETTO_TP_TEST_CACHE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestCacheTable, "cache")                           \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)            \
+  C(int64_t, ts, Column::Flag::kSorted)                   \
+  C(uint32_t, cpu)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_CACHE_TABLE_DEF);
+
+TestCacheTable::~TestCacheTable() = default;
+
+class QueryCacheTest : public ::testing::Test {
+ protected:
+  QueryCacheTest() : table_(&pool_, nullptr) {
+    for (uint32_t i = 0; i < 2048; ++i)
+      table_.Insert(TestCacheTable::Row(i, i % 8));
+  }
+
+  std::shared_ptr<Table> FilterAndOffer(QueryCache* cache, uint32_t cpu) {
+    std::vector<Constraint> cs{table_.cpu().eq(cpu)};
+    std::shared_ptr<Table> cached = cache->GetIfCachedResult(&table_, cs, {});
+    if (cached)
+      return cached;
+    std::shared_ptr<Table> result(new Table(table_.Filter(cs)));
+    cache->MaybeCacheResult(&table_, cs, {}, result);
+    return result;
+  }
+
+  StringPool pool_;
+  TestCacheTable table_;
+};
+
+TEST_F(QueryCacheTest, SortedTableIgnoresValue) {
+  QueryCache cache;
+  std::vector<Constraint> cs{table_.cpu().eq(1)};
+  ASSERT_EQ(cache.GetIfCached(&table_, cs), nullptr);
+
+  uint32_t calls = 0;
+  auto sort_fn = [this, &calls]() {
+    calls++;
+    return table_.Sort({table_.cpu().ascending()});
+  };
+  std::shared_ptr<Table> sorted = cache.GetOrCache(&table_, cs, sort_fn);
+  ASSERT_EQ(calls, 1u);
+
+  // A different value for the same column and operator should hit.
+  std::vector<Constraint> other{table_.cpu().eq(5)};
+  ASSERT_EQ(cache.GetIfCached(&table_, other), sorted);
+  ASSERT_EQ(cache.GetOrCache(&table_, other, sort_fn), sorted);
+  ASSERT_EQ(calls, 1u);
+
+  // A different operator should miss.
+  std::vector<Constraint> gt{table_.cpu().gt(5)};
+  ASSERT_EQ(cache.GetIfCached(&table_, gt), nullptr);
+}
+
+TEST_F(QueryCacheTest, ResultCachedOnSecondMiss) {
+  QueryCache cache;
+
+  std::shared_ptr<Table> first = FilterAndOffer(&cache, 3);
+  ASSERT_EQ(cache.entry_count(), 0u);
+
+  std::shared_ptr<Table> second = FilterAndOffer(&cache, 3);
+  ASSERT_NE(first, second);
+  ASSERT_EQ(cache.entry_count(), 1u);
+
+  std::shared_ptr<Table> third = FilterAndOffer(&cache, 3);
+  ASSERT_EQ(second, third);
+  ASSERT_EQ(third->row_count(), 256u);
+  ASSERT_EQ(cache.hits(), 1u);
+  ASSERT_EQ(cache.misses(), 2u);
+
+  // Different values and orders should not hit.
+  std::vector<Constraint> cs{table_.cpu().eq(4)};
+  ASSERT_EQ(cache.GetIfCachedResult(&table_, cs, {}), nullptr);
+
+  std::vector<Constraint> same{table_.cpu().eq(3)};
+  ASSERT_EQ(cache.GetIfCachedResult(&table_, same, {table_.ts().descending()}),
+            nullptr);
+}
+
+TEST_F(QueryCacheTest, EvictsLeastRecentlyUsed) {
+  QueryCache cache(nullptr, 2);
+
+  for (uint32_t cpu = 0; cpu < 3; ++cpu) {
+    FilterAndOffer(&cache, cpu);
+    FilterAndOffer(&cache, cpu);
+
+    // Keep the first entry as the most recently used one.
+    if (cpu == 1)
+      FilterAndOffer(&cache, 0);
+  }
+  ASSERT_EQ(cache.entry_count(), 2u);
+  ASSERT_EQ(cache.evictions(), 1u);
+
+  std::vector<Constraint> cpu0{table_.cpu().eq(0)};
+  std::vector<Constraint> cpu1{table_.cpu().eq(1)};
+  std::vector<Constraint> cpu2{table_.cpu().eq(2)};
+  ASSERT_NE(cache.GetIfCachedResult(&table_, cpu0, {}), nullptr);
+  ASSERT_EQ(cache.GetIfCachedResult(&table_, cpu1, {}), nullptr);
+  ASSERT_NE(cache.GetIfCachedResult(&table_, cpu2, {}), nullptr);
+}
+
+TEST_F(QueryCacheTest, EvictsOnByteLimit) {
+  uint64_t entry_bytes;
+  {
+    QueryCache cache;
+    FilterAndOffer(&cache, 0);
+    FilterAndOffer(&cache, 0);
+    entry_bytes = cache.bytes();
+  }
+
+  // Only leave space for one entry.
+  QueryCache cache(nullptr, QueryCache::kDefaultMaxEntries,
+                   entry_bytes + entry_bytes / 2);
+  FilterAndOffer(&cache, 0);
+  FilterAndOffer(&cache, 0);
+  ASSERT_EQ(cache.entry_count(), 1u);
+
+  FilterAndOffer(&cache, 1);
+  FilterAndOffer(&cache, 1);
+  ASSERT_EQ(cache.entry_count(), 1u);
+  ASSERT_EQ(cache.evictions(), 1u);
+
+  // Tables larger than the limit are never cached.
+  QueryCache tiny(nullptr, QueryCache::kDefaultMaxEntries, entry_bytes - 1);
+  FilterAndOffer(&tiny, 0);
+  FilterAndOffer(&tiny, 0);
+  ASSERT_EQ(tiny.entry_count(), 0u);
+}
+
+TEST_F(QueryCacheTest, DropsEntriesWhenSourceChanges) {
+  QueryCache cache;
+  FilterAndOffer(&cache, 3);
+  FilterAndOffer(&cache, 3);
+  ASSERT_EQ(cache.entry_count(), 1u);
+
+  table_.Insert(TestCacheTable::Row(2048, 3));
+
+  std::vector<Constraint> cs{table_.cpu().eq(3)};
+  ASSERT_EQ(cache.GetIfCachedResult(&table_, cs, {}), nullptr);
+  ASSERT_EQ(cache.entry_count(), 0u);
+  ASSERT_EQ(cache.bytes(), 0u);
+}
+
+TEST_F(QueryCacheTest, DropsEntriesWhenValuesAreSet) {
+  QueryCache cache;
+  FilterAndOffer(&cache, 3);
+  FilterAndOffer(&cache, 3);
+  std::vector<Constraint> cs{table_.cpu().eq(3)};
+  cache.GetOrCache(&table_, cs, [this]() {
+    return table_.Sort({table_.cpu().ascending()});
+  });
+  ASSERT_EQ(cache.entry_count(), 2u);
+
+  // The row count doesn't change but the cached tables are out of date.
+  table_.mutable_cpu()->Set(0, 3);
+  ASSERT_EQ(cache.GetIfCachedResult(&table_, cs, {}), nullptr);
+  ASSERT_EQ(cache.GetIfCached(&table_, cs), nullptr);
+  ASSERT_EQ(cache.entry_count(), 0u);
+  ASSERT_EQ(cache.evictions(), 2u);
+
+  // The new result is cached again.
+  FilterAndOffer(&cache, 3);
+  std::shared_ptr<Table> result = FilterAndOffer(&cache, 3);
+  ASSERT_EQ(result->row_count(), 257u);
+  ASSERT_EQ(FilterAndOffer(&cache, 3), result);
+}
+
+TEST_F(QueryCacheTest, SmallTablesNotCached) {
+  TestCacheTable small(&pool_, nullptr);
+  for (uint32_t i = 0; i < 16; ++i)
+    small.Insert(TestCacheTable::Row(i, i % 8));
+
+  QueryCache cache;
+  std::vector<Constraint> cs{small.cpu().eq(3)};
+  for (uint32_t i = 0; i < 3; ++i) {
+    ASSERT_EQ(cache.GetIfCachedResult(&small, cs, {}), nullptr);
+    std::shared_ptr<Table> result(new Table(small.Filter(cs)));
+    cache.MaybeCacheResult(&small, cs, {}, result);
+  }
+  ASSERT_EQ(cache.entry_count(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_interrupter.h"
+
+#include <inttypes.h>
+
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// The number of SQLite VM instructions between two calls of the progress
+// handler.
+constexpr int kInstructionsPerProgressCheck = 10000;
+
+constexpr int64_t kMemoryCheckIntervalNs = 10 * 1000 * 1000;
+
+}  // namespace
+
+QueryInterrupter::QueryInterrupter() = default;
+QueryInterrupter::~QueryInterrupter() = default;
+
+void QueryInterrupter::RegisterProgressHandler(sqlite3* db) {
+  sqlite3_progress_handler(
+      db, kInstructionsPerProgressCheck,
+      [](void* arg) {
+        return static_cast<QueryInterrupter*>(arg)->ShouldInterrupt() ? 1 : 0;
+      },
+      this);
+}
+
+uint64_t QueryInterrupter::Start(const QueryBudget& budget) {
+  budget_ = budget;
+  int64_t now_ns = base::GetWallTimeNs().count();
+  deadline_ns_ =
+      budget.max_duration_ms
+          ? now_ns + static_cast<int64_t>(budget.max_duration_ms) * 1000 * 1000
+          : 0;
+  max_rss_bytes_ = 0;
+  if (budget.max_memory_bytes) {
+    uint64_t rss = base::GetCurrentProcessRssBytes();
+    if (rss)
+      max_rss_bytes_ = rss + budget.max_memory_bytes;
+  }
+  rows_ = 0;
+  next_memory_check_ns_.store(0, std::memory_order_relaxed);
+  reason_.store(Reason::kNone, std::memory_order_relaxed);
+  running_.store(true, std::memory_order_release);
+  return ++last_query_id_;
+}
+
+void QueryInterrupter::Stop(uint64_t query_id) {
+  if (query_id == last_query_id_)
+    running_.store(false, std::memory_order_relaxed);
+}
+
+void QueryInterrupter::Cancel() {
+  if (running_.load(std::memory_order_acquire))
+    Interrupt(Reason::kCancelled);
+}
+
+bool QueryInterrupter::ShouldInterrupt() {
+  if (!running_.load(std::memory_order_acquire))
+    return false;
+  if (reason() != Reason::kNone)
+    return true;
+  if (!deadline_ns_ && !max_rss_bytes_)
+    return false;
+
+  int64_t now_ns = base::GetWallTimeNs().count();
+  if (deadline_ns_ && now_ns >= deadline_ns_)
+    return Interrupt(Reason::kDurationExceeded);
+  if (max_rss_bytes_ &&
+      now_ns >= next_memory_check_ns_.load(std::memory_order_relaxed)) {
+    next_memory_check_ns_.store(now_ns + kMemoryCheckIntervalNs,
+                                std::memory_order_relaxed);
+    if (base::GetCurrentProcessRssBytes() > max_rss_bytes_)
+      return Interrupt(Reason::kMemoryExceeded);
+  }
+  return false;
+}
+
+bool QueryInterrupter::Interrupt(Reason reason) {
+  Reason none = Reason::kNone;
+  reason_.compare_exchange_strong(none, reason, std::memory_order_relaxed);
+  return true;
+}
+
+util::Status QueryInterrupter::InterruptionStatus() const {
+  switch (reason()) {
+    case Reason::kNone:
+      break;
+    case Reason::kCancelled:
+      return util::ErrStatus("Query cancelled");
+    case Reason::kDurationExceeded:
+      return util::ErrStatus(
+          "Query interrupted: exceeded its time budget of %" PRIu64 " ms",
+          budget_.max_duration_ms);
+    case Reason::kRowsExceeded:
+      return util::ErrStatus(
+          "Query interrupted: exceeded its budget of %" PRIu64 " rows",
+          budget_.max_rows);
+    case Reason::kMemoryExceeded:
+      return util::ErrStatus(
+          "Query interrupted: exceeded its memory budget of %" PRIu64 " bytes",
+          budget_.max_memory_bytes);
+  }
+  return util::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_QUERY_INTERRUPTER_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_QUERY_INTERRUPTER_H_
+
+#include <sqlite3.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/status.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Decides when the query running on a SQLite connection should be
+// interrupted: because it has been cancelled or because it exceeded its
+// QueryBudget.
+//
+// Once a query is started with Start(), ShouldInterrupt() is checked by the
+// progress handler of the connection (every few thousand SQLite VM
+// instructions) and by the operators which do a lot of work outside of the
+// SQLite VM, e.g. SPAN_JOIN when joining on worker threads or the
+// experimental_flamegraph table. These should abort, returning an error to
+// SQLite, as soon as it returns true.
+class QueryInterrupter {
+ public:
+  enum class Reason : uint32_t {
+    kNone = 0,
+    kCancelled,
+    kDurationExceeded,
+    kRowsExceeded,
+    kMemoryExceeded,
+  };
+
+  QueryInterrupter();
+  ~QueryInterrupter();
+
+  QueryInterrupter(const QueryInterrupter&) = delete;
+  QueryInterrupter& operator=(const QueryInterrupter&) = delete;
+
+  // Installs the progress handler on |db|.
+  void RegisterProgressHandler(sqlite3* db);
+
+  // Starts tracking a query with the given budget, replacing the previous
+  // one. Returns an id to pass to Stop().
+  uint64_t Start(const QueryBudget&);
+
+  // Stops tracking the query |query_id| returned by Start(), unless another
+  // query has been started since: ShouldInterrupt() then returns false until
+  // the next Start().
+  void Stop(uint64_t query_id);
+
+  // Interrupts the current query, if any. Can be called from any thread.
+  void Cancel();
+
+  // Called for each row returned by the query. Returns false if the query
+  // should be interrupted instead of returning the row.
+  bool AddRow() {
+    // The duration and memory are also checked from time to time, for the
+    // queries which don't run in the SQLite VM (see DirectTableQuery).
+    constexpr uint64_t kRowsPerCheck = 1024;
+    if (budget_.max_rows && rows_ >= budget_.max_rows)
+      return !Interrupt(Reason::kRowsExceeded);
+    return ++rows_ % kRowsPerCheck != 0 || !ShouldInterrupt();
+  }
+
+  // Returns true if the current query should be interrupted. Thread-safe.
+  bool ShouldInterrupt();
+
+  Reason reason() const { return reason_.load(std::memory_order_relaxed); }
+
+  // Returns the error describing why the query was interrupted.
+  util::Status InterruptionStatus() const;
+
+ private:
+  // Records |reason| as the reason of the interruption, unless there is one
+  // already. Returns true.
+  bool Interrupt(Reason reason);
+
+  std::atomic<bool> running_{false};
+  std::atomic<Reason> reason_{Reason::kNone};
+
+  // The limits of the current query. They are set by Start() before
+  // |running_|, so are safe to read from other threads once it is true.
+  QueryBudget budget_;
+  int64_t deadline_ns_ = 0;
+  uint64_t max_rss_bytes_ = 0;
+
+  // Only accessed by the thread running the query.
+  uint64_t rows_ = 0;
+  uint64_t last_query_id_ = 0;
+
+  // Reading the memory usage is a system call, so it is only done every few
+  // milliseconds.
+  std::atomic<int64_t> next_memory_check_ns_{0};
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_QUERY_INTERRUPTER_H_
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/query_profile_table.h"
+
+#include "src/trace_processor/sqlite/sqlite_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+QueryProfileTable::QueryProfileTable(
+    sqlite3*,
+    const std::unique_ptr<QueryProfiler>* profile)
+    : profile_(profile) {}
+
+void QueryProfileTable::RegisterTable(
+    sqlite3* db,
+    const std::unique_ptr<QueryProfiler>* profile) {
+  SqliteTable::Register<QueryProfileTable>(db, profile, "query_profile");
+}
+
+util::Status QueryProfileTable::Init(int, const char* const*, Schema* schema) {
+  using SqlType = SqlValue::Type;
+  *schema = Schema(
+      {
+          SqliteTable::Column(Column::kOperator, "operator", SqlType::kString),
+          SqliteTable::Column(Column::kColumnName, "column_name",
+                              SqlType::kString),
+          SqliteTable::Column(Column::kCursors, "cursors", SqlType::kLong),
+          SqliteTable::Column(Column::kFilters, "filters", SqlType::kLong),
+          SqliteTable::Column(Column::kRowsScanned, "rows_scanned",
+                              SqlType::kLong),
+          SqliteTable::Column(Column::kRowsReturned, "rows_returned",
+                              SqlType::kLong),
+          SqliteTable::Column(Column::kCacheHits, "cache_hits",
+                              SqlType::kLong),
+          SqliteTable::Column(Column::kFilterDur, "filter_dur",
+                              SqlType::kLong),
+          SqliteTable::Column(Column::kNextDur, "next_dur", SqlType::kLong),
+          SqliteTable::Column(Column::kComputeDur, "compute_dur",
+                              SqlType::kLong),
+      },
+      {Column::kOperator, Column::kColumnName});
+  return util::OkStatus();
+}
+
+std::unique_ptr<SqliteTable::Cursor> QueryProfileTable::CreateCursor() {
+  return std::unique_ptr<SqliteTable::Cursor>(new Cursor(this));
+}
+
+int QueryProfileTable::BestIndex(const QueryConstraints&, BestIndexInfo*) {
+  return SQLITE_OK;
+}
+
+QueryProfileTable::Cursor::Cursor(QueryProfileTable* table)
+    : SqliteTable::Cursor(table), table_(table) {}
+
+QueryProfileTable::Cursor::~Cursor() = default;
+
+int QueryProfileTable::Cursor::Filter(const QueryConstraints&,
+                                      sqlite3_value**,
+                                      FilterHistory) {
+  rows_.clear();
+  row_ = 0;
+  const QueryProfiler* profile = table_->profile_->get();
+  if (!profile)
+    return SQLITE_OK;
+
+  for (const auto& op : profile->operators()) {
+    Row row;
+    row.op = op.first;
+    row.op_stats = op.second;
+    rows_.emplace_back(std::move(row));
+  }
+  for (const auto& column : profile->columns()) {
+    Row row;
+    row.op = column.first.first;
+    row.column = column.first.second;
+    row.column_stats = column.second;
+    rows_.emplace_back(std::move(row));
+  }
+  return SQLITE_OK;
+}
+
+int QueryProfileTable::Cursor::Next() {
+  row_++;
+  return SQLITE_OK;
+}
+
+int QueryProfileTable::Cursor::Eof() {
+  return row_ >= rows_.size();
+}
+
+int QueryProfileTable::Cursor::Column(sqlite3_context* context, int col) {
+  const Row& row = rows_[row_];
+  const QueryProfiler::OperatorStats& op = row.op_stats;
+  const QueryProfiler::ColumnStats& column = row.column_stats;
+  bool is_column = row.column.has_value();
+
+  // The columns which only make sense for operators are NULL for the rows of
+  // the columns.
+  base::Optional<int64_t> value;
+  switch (col) {
+    case Column::kOperator:
+      sqlite3_result_text(context, row.op.c_str(), -1,
+                          sqlite_utils::kSqliteStatic);
+      return SQLITE_OK;
+    case Column::kColumnName:
+      if (is_column) {
+        sqlite3_result_text(context, row.column->c_str(), -1,
+                            sqlite_utils::kSqliteStatic);
+      } else {
+        sqlite3_result_null(context);
+      }
+      return SQLITE_OK;
+    case Column::kCursors:
+      if (!is_column)
+        value = static_cast<int64_t>(op.cursors);
+      break;
+    case Column::kFilters:
+      value = static_cast<int64_t>(is_column ? column.filters : op.filters);
+      break;
+    case Column::kRowsScanned:
+      value = static_cast<int64_t>(is_column ? column.rows_scanned
+                                             : op.rows_scanned);
+      break;
+    case Column::kRowsReturned:
+      value = static_cast<int64_t>(is_column ? column.rows_returned
+                                             : op.rows_returned);
+      break;
+    case Column::kCacheHits:
+      if (!is_column)
+        value = static_cast<int64_t>(op.cache_hits);
+      break;
+    case Column::kFilterDur:
+      value = is_column ? column.filter_ns : op.filter_ns;
+      break;
+    case Column::kNextDur:
+      if (!is_column)
+        value = op.next_ns;
+      break;
+    case Column::kComputeDur:
+      if (!is_column)
+        value = op.compute_ns;
+      break;
+  }
+  if (value) {
+    sqlite3_result_int64(context, *value);
+  } else {
+    sqlite3_result_null(context);
+  }
+  return SQLITE_OK;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
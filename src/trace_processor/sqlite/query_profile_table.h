@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_QUERY_PROFILE_TABLE_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_QUERY_PROFILE_TABLE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/optional.h"
+#include "src/trace_processor/db/query_profiler.h"
+#include "src/trace_processor/sqlite/sqlite_table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class QueryConstraints;
+
+// A virtual table exposing the profile of the last profiled query (see
+// TraceProcessor::EnableQueryProfiling): one row per operator followed by
+// one row per filtered column, whose operator-only columns are NULL.
+class QueryProfileTable : public SqliteTable {
+ public:
+  enum Column {
+    kOperator = 0,
+    kColumnName = 1,
+    kCursors = 2,
+    kFilters = 3,
+    kRowsScanned = 4,
+    kRowsReturned = 5,
+    kCacheHits = 6,
+    kFilterDur = 7,
+    kNextDur = 8,
+    kComputeDur = 9,
+  };
+
+  // Implementation of the SQLite cursor interface.
+  class Cursor : public SqliteTable::Cursor {
+   public:
+    Cursor(QueryProfileTable* table);
+    ~Cursor() override;
+
+    // Implementation of SqliteTable::Cursor.
+    int Filter(const QueryConstraints&,
+               sqlite3_value**,
+               FilterHistory) override;
+    int Next() override;
+    int Eof() override;
+    int Column(sqlite3_context*, int N) override;
+
+   private:
+    // The rows are copied as the profile can be replaced, by the end of
+    // another profiled query, while the cursor is open.
+    struct Row {
+      std::string op;
+      // Only set for the rows of the columns.
+      base::Optional<std::string> column;
+      QueryProfiler::OperatorStats op_stats;
+      QueryProfiler::ColumnStats column_stats;
+    };
+
+    Cursor(Cursor&) = delete;
+    Cursor& operator=(const Cursor&) = delete;
+
+    std::vector<Row> rows_;
+    size_t row_ = 0;
+    QueryProfileTable* table_ = nullptr;
+  };
+
+  QueryProfileTable(sqlite3*, const std::unique_ptr<QueryProfiler>* profile);
+
+  static void RegisterTable(sqlite3* db,
+                            const std::unique_ptr<QueryProfiler>* profile);
+
+  // Table implementation.
+  util::Status Init(int, const char* const*, Schema*) override;
+  std::unique_ptr<SqliteTable::Cursor> CreateCursor() override;
+  int BestIndex(const QueryConstraints&, BestIndexInfo*) override;
+
+ private:
+  const std::unique_ptr<QueryProfiler>* const profile_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_QUERY_PROFILE_TABLE_H_
@@ -20,16 +20,25 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <set>
+#include <tuple>
 #include <utility>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/sqlite/query_interrupter.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 #include "src/trace_processor/tp_metatrace.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -102,22 +111,31 @@ std::string EscapedSqliteValueAsString(sqlite3_value* value) {
 
 }  // namespace
 
-SpanJoinOperatorTable::SpanJoinOperatorTable(sqlite3* db, const TraceStorage*)
-    : db_(db) {}
-
-void SpanJoinOperatorTable::RegisterTable(sqlite3* db,
-                                          const TraceStorage* storage) {
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_join",
-                                               /* read_write */ false,
-                                               /* requires_args */ true);
+constexpr uint32_t SpanJoinOperatorTable::OutputRow::kNoRow;
 
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_left_join",
-                                               /* read_write */ false,
-                                               /* requires_args */ true);
+SpanJoinOperatorTable::SpanJoinOperatorTable(sqlite3* db, Context context)
+    : db_(db),
+      worker_threads_(context.worker_threads),
+      interrupter_(context.interrupter) {}
 
-  SqliteTable::Register<SpanJoinOperatorTable>(db, storage, "span_outer_join",
-                                               /* read_write */ false,
-                                               /* requires_args */ true);
+void SpanJoinOperatorTable::RegisterTable(sqlite3* db,
+                                          uint32_t worker_threads,
+                                          QueryInterrupter* interrupter) {
+  Context context{worker_threads, interrupter};
+  SqliteTable::Register<SpanJoinOperatorTable, Context>(
+      db, context, "span_join",
+      /* read_write */ false,
+      /* requires_args */ true);
+
+  SqliteTable::Register<SpanJoinOperatorTable, Context>(
+      db, context, "span_left_join",
+      /* read_write */ false,
+      /* requires_args */ true);
+
+  SqliteTable::Register<SpanJoinOperatorTable, Context>(
+      db, context, "span_outer_join",
+      /* read_write */ false,
+      /* requires_args */ true);
 }
 
 util::Status SpanJoinOperatorTable::Init(int argc,
@@ -411,43 +429,288 @@ std::string SpanJoinOperatorTable::GetNameForGlobalColumnIndex(
 }
 
 SpanJoinOperatorTable::Cursor::Cursor(SpanJoinOperatorTable* table, sqlite3* db)
-    : SqliteTable::Cursor(table),
-      t1_(table, &table->t1_defn_, db),
-      t2_(table, &table->t2_defn_, db),
-      table_(table) {}
+    : SqliteTable::Cursor(table), db_(db), table_(table) {}
 
 int SpanJoinOperatorTable::Cursor::Filter(const QueryConstraints& qc,
                                           sqlite3_value** argv,
                                           FilterHistory) {
   PERFETTO_TP_TRACE("SPAN_JOIN_XFILTER");
 
-  util::Status status =
-      t1_.Initialize(qc, argv, Query::InitialEofBehavior::kTreatAsEof);
+  joiner_.reset();
+  range_output_.clear();
+  output_range_ = 0;
+  output_row_ = 0;
+
+  const TableDefinition& t1_defn = table_->t1_defn_;
+  std::string t1_sql = CreateSqlQuery(
+      t1_defn, table_->ComputeSqlConstraintsForDefinition(t1_defn, qc, argv));
+
+  const TableDefinition& t2_defn = table_->t2_defn_;
+  std::string t2_sql = CreateSqlQuery(
+      t2_defn, table_->ComputeSqlConstraintsForDefinition(t2_defn, qc, argv));
+
+  if (ShouldJoinInParallel()) {
+    util::Status status = t1_rows_.Fill(db_, t1_defn, t1_sql);
+    if (!status.ok())
+      return SQLITE_ERROR;
+
+    status = t2_rows_.Fill(db_, t2_defn, t2_sql);
+    if (!status.ok())
+      return SQLITE_ERROR;
+
+    if (JoinInParallel()) {
+      // The join stops early when the query is interrupted.
+      if (table_->interrupter_ && table_->interrupter_->ShouldInterrupt())
+        return SQLITE_INTERRUPT;
+      SkipFinishedRanges();
+      return SQLITE_OK;
+    }
+
+    // The rows are already read: join them on this thread rather than
+    // running the queries again.
+    joiner_.reset(new Joiner(table_, Query(&t1_defn, &t1_rows_),
+                             Query(&t2_defn, &t2_rows_)));
+  } else {
+    // Release the rows of a previous parallel join, if any.
+    t1_rows_ = Rows();
+    t2_rows_ = Rows();
+    joiner_.reset(new Joiner(table_, Query(&t1_defn, db_, std::move(t1_sql)),
+                             Query(&t2_defn, db_, std::move(t2_sql))));
+  }
+
+  util::Status status = joiner_->Initialize(
+      std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
   if (!status.ok())
     return SQLITE_ERROR;
+  if (!joiner_->IsEof())
+    current_ = joiner_->Current();
+  return SQLITE_OK;
+}
+
+bool SpanJoinOperatorTable::Cursor::ShouldJoinInParallel() const {
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // Threads are not available (e.g. in WASM builds without pthreads).
+  return false;
+#else
+  // Only partitions are joined on different threads.
+  return table_->worker_threads_ > 1 &&
+         table_->partitioning_ != PartitioningType::kNoPartitioning;
+#endif
+}
+
+bool SpanJoinOperatorTable::Cursor::JoinInParallel() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  return false;
+#else
+  // The minimum number of rows in the two child tables to join them on
+  // worker threads. Below this, the cost of creating and joining the threads
+  // dominates the join itself.
+  constexpr uint32_t kMinRowsForParallelJoin = 64 * 1024;
+
+  const uint32_t worker_threads = table_->worker_threads_;
+  PERFETTO_DCHECK(ShouldJoinInParallel());
+  if (t1_rows_.size() + t2_rows_.size() < kMinRowsForParallelJoin ||
+      !t1_rows_.sorted_by_partition() || !t2_rows_.sorted_by_partition()) {
+    return false;
+  }
+
+  // The partitions of all the rows, in order. In the mixed partitioning case,
+  // the table without partitions is joined in full with each range of
+  // partitions of the other table.
+  std::vector<int64_t> partitions;
+  partitions.reserve(t1_rows_.partitions().size() +
+                     t2_rows_.partitions().size());
+  std::merge(t1_rows_.partitions().begin(), t1_rows_.partitions().end(),
+             t2_rows_.partitions().begin(), t2_rows_.partitions().end(),
+             std::back_inserter(partitions));
+
+  // Split the partitions in ranges with roughly the same number of rows.
+  // There are a few ranges per thread as the rows of some partitions can
+  // take much longer to join than others (e.g. mixed partitioning).
+  const size_t rows_per_range = partitions.size() / (worker_threads * 4) + 1;
+  std::vector<int64_t> range_starts{std::numeric_limits<int64_t>::min()};
+  size_t range_rows = 0;
+  for (size_t i = 0; i < partitions.size(); ++i, ++range_rows) {
+    if (range_rows >= rows_per_range && partitions[i] != partitions[i - 1]) {
+      range_starts.push_back(partitions[i]);
+      range_rows = 0;
+    }
+  }
+  if (range_starts.size() <= 1)
+    return false;
+
+  // The number of rows joined between two checks of the interrupter.
+  constexpr uint32_t kRowsPerInterruptCheck = 4096;
+
+  range_output_.resize(range_starts.size());
+  std::atomic<size_t> next_range{0};
+  QueryInterrupter* interrupter = table_->interrupter_;
+  auto join_ranges = [this, &range_starts, &next_range, interrupter] {
+    for (;;) {
+      size_t idx = next_range.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= range_starts.size())
+        return;
+      int64_t range_end = idx + 1 < range_starts.size()
+                              ? range_starts[idx + 1]
+                              : std::numeric_limits<int64_t>::max();
+      Joiner joiner(table_, Query(&table_->t1_defn_, &t1_rows_),
+                    Query(&table_->t2_defn_, &t2_rows_));
+      // Joining |Rows| doesn't fail.
+      joiner.Initialize(range_starts[idx], range_end);
+      for (uint32_t rows = 1; !joiner.IsEof(); joiner.Next(), ++rows) {
+        if (interrupter && rows % kRowsPerInterruptCheck == 0 &&
+            interrupter->ShouldInterrupt()) {
+          return;
+        }
+        range_output_[idx].push_back(joiner.Current());
+      }
+    }
+  };
+
+  // The calling thread also takes part in the join, so spawn one thread less.
+  size_t num_threads =
+      std::min(static_cast<size_t>(worker_threads), range_starts.size());
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(join_ranges);
+  join_ranges();
+  for (auto& thread : threads)
+    thread.join();
+  return true;
+#endif
+}
+
+void SpanJoinOperatorTable::Cursor::SkipFinishedRanges() {
+  for (; output_range_ < range_output_.size(); ++output_range_) {
+    if (output_row_ < range_output_[output_range_].size()) {
+      current_ = range_output_[output_range_][output_row_];
+      return;
+    }
+    output_row_ = 0;
+  }
+}
+
+int SpanJoinOperatorTable::Cursor::Next() {
+  if (joiner_) {
+    util::Status status = joiner_->Next();
+    if (!status.ok())
+      return SQLITE_ERROR;
+    if (!joiner_->IsEof())
+      current_ = joiner_->Current();
+  } else {
+    ++output_row_;
+    SkipFinishedRanges();
+  }
+  return SQLITE_OK;
+}
+
+int SpanJoinOperatorTable::Cursor::Eof() {
+  return joiner_ ? joiner_->IsEof() : output_range_ >= range_output_.size();
+}
+
+int SpanJoinOperatorTable::Cursor::Column(sqlite3_context* context, int N) {
+  switch (N) {
+    case Column::kTimestamp: {
+      sqlite3_result_int64(context, static_cast<sqlite3_int64>(current_.ts));
+      break;
+    }
+    case Column::kDuration: {
+      sqlite3_result_int64(context, static_cast<sqlite3_int64>(current_.dur));
+      break;
+    }
+    case Column::kPartition: {
+      if (table_->partitioning_ != PartitioningType::kNoPartitioning) {
+        sqlite3_result_int64(context,
+                             static_cast<sqlite3_int64>(current_.partition));
+        break;
+      }
+      [[clang::fallthrough]];
+    }
+    default: {
+      size_t index = static_cast<size_t>(N);
+      const auto& locator = table_->global_index_to_column_locator_[index];
+      if (joiner_) {
+        joiner_->ReportSqliteResult(context, locator.defn, locator.col_index);
+        break;
+      }
+      bool is_t1 = locator.defn == &table_->t1_defn_;
+      uint32_t row = is_t1 ? current_.t1_row : current_.t2_row;
+      if (row == OutputRow::kNoRow) {
+        sqlite3_result_null(context);
+        break;
+      }
+      const Rows& rows = is_t1 ? t1_rows_ : t2_rows_;
+      rows.ReportSqliteResult(context, row, locator.col_index);
+    }
+  }
+  return SQLITE_OK;
+}
+
+SpanJoinOperatorTable::Joiner::Joiner(const SpanJoinOperatorTable* table,
+                                      Query t1,
+                                      Query t2)
+    : t1_(std::move(t1)), t2_(std::move(t2)), table_(table) {}
+
+util::Status SpanJoinOperatorTable::Joiner::Initialize(int64_t partition_begin,
+                                                       int64_t partition_end) {
+  util::Status status = t1_.Initialize(partition_begin, partition_end,
+                                       Query::InitialEofBehavior::kTreatAsEof);
+  if (!status.ok())
+    return status;
 
   status = t2_.Initialize(
-      qc, argv,
+      partition_begin, partition_end,
       table_->IsLeftJoin()
           ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
           : Query::InitialEofBehavior::kTreatAsEof);
   if (!status.ok())
-    return SQLITE_ERROR;
+    return status;
 
-  status = FindOverlappingSpan();
-  return status.ok() ? SQLITE_OK : SQLITE_ERROR;
+  return FindOverlappingSpan();
 }
 
-int SpanJoinOperatorTable::Cursor::Next() {
+util::Status SpanJoinOperatorTable::Joiner::Next() {
   util::Status status = next_query_->Next();
   if (!status.ok())
-    return SQLITE_ERROR;
+    return status;
+  return FindOverlappingSpan();
+}
+
+SpanJoinOperatorTable::OutputRow SpanJoinOperatorTable::Joiner::Current()
+    const {
+  PERFETTO_DCHECK(t1_.IsReal() || t2_.IsReal());
 
-  status = FindOverlappingSpan();
-  return status.ok() ? SQLITE_OK : SQLITE_ERROR;
+  OutputRow row;
+  row.ts = std::max(t1_.ts(), t2_.ts());
+  row.dur = std::min(t1_.raw_ts_end(), t2_.raw_ts_end()) - row.ts;
+  switch (table_->partitioning_) {
+    case PartitioningType::kMixedPartitioning:
+      row.partition = last_mixed_partition_;
+      break;
+    case PartitioningType::kSamePartitioning:
+      row.partition = t1_.IsReal() ? t1_.partition() : t2_.partition();
+      break;
+    case PartitioningType::kNoPartitioning:
+      row.partition = 0;
+      break;
+  }
+  row.t1_row = t1_.IsReal() && t1_.rows() ? t1_.row() : OutputRow::kNoRow;
+  row.t2_row = t2_.IsReal() && t2_.rows() ? t2_.row() : OutputRow::kNoRow;
+  return row;
 }
 
-bool SpanJoinOperatorTable::Cursor::IsOverlappingSpan() {
+void SpanJoinOperatorTable::Joiner::ReportSqliteResult(
+    sqlite3_context* context,
+    const TableDefinition* defn,
+    size_t index) {
+  if (defn == t1_.definition())
+    t1_.ReportSqliteResult(context, index);
+  else
+    t2_.ReportSqliteResult(context, index);
+}
+
+bool SpanJoinOperatorTable::Joiner::IsOverlappingSpan() {
   // If either of the tables are eof, then we cannot possibly have an
   // overlapping span.
   if (t1_.IsEof() || t2_.IsEof())
@@ -477,7 +740,7 @@ bool SpanJoinOperatorTable::Cursor::IsOverlappingSpan() {
          (t2_.ts() >= t1_.ts() && t2_.ts() < t1_.AdjustedTsEnd());
 }
 
-util::Status SpanJoinOperatorTable::Cursor::FindOverlappingSpan() {
+util::Status SpanJoinOperatorTable::Joiner::FindOverlappingSpan() {
   // We loop until we find a slice which overlaps from the two tables.
   while (true) {
     if (table_->partitioning_ == PartitioningType::kMixedPartitioning) {
@@ -522,7 +785,7 @@ util::Status SpanJoinOperatorTable::Cursor::FindOverlappingSpan() {
 }
 
 SpanJoinOperatorTable::Query*
-SpanJoinOperatorTable::Cursor::FindEarliestFinishQuery() {
+SpanJoinOperatorTable::Joiner::FindEarliestFinishQuery() {
   int64_t t1_part;
   int64_t t2_part;
 
@@ -563,55 +826,17 @@ SpanJoinOperatorTable::Cursor::FindEarliestFinishQuery() {
   return t1_less ? &t1_ : &t2_;
 }
 
-int SpanJoinOperatorTable::Cursor::Eof() {
-  return t1_.IsEof() || t2_.IsEof();
-}
-
-int SpanJoinOperatorTable::Cursor::Column(sqlite3_context* context, int N) {
-  PERFETTO_DCHECK(t1_.IsReal() || t2_.IsReal());
-
-  switch (N) {
-    case Column::kTimestamp: {
-      auto max_ts = std::max(t1_.ts(), t2_.ts());
-      sqlite3_result_int64(context, static_cast<sqlite3_int64>(max_ts));
-      break;
-    }
-    case Column::kDuration: {
-      auto max_start = std::max(t1_.ts(), t2_.ts());
-      auto min_end = std::min(t1_.raw_ts_end(), t2_.raw_ts_end());
-      auto dur = min_end - max_start;
-      sqlite3_result_int64(context, static_cast<sqlite3_int64>(dur));
-      break;
-    }
-    case Column::kPartition: {
-      if (table_->partitioning_ != PartitioningType::kNoPartitioning) {
-        int64_t partition;
-        if (table_->partitioning_ == PartitioningType::kMixedPartitioning) {
-          partition = last_mixed_partition_;
-        } else {
-          partition = t1_.IsReal() ? t1_.partition() : t2_.partition();
-        }
-        sqlite3_result_int64(context, static_cast<sqlite3_int64>(partition));
-        break;
-      }
-      [[clang::fallthrough]];
-    }
-    default: {
-      size_t index = static_cast<size_t>(N);
-      const auto& locator = table_->global_index_to_column_locator_[index];
-      if (locator.defn == t1_.definition())
-        t1_.ReportSqliteResult(context, locator.col_index);
-      else
-        t2_.ReportSqliteResult(context, locator.col_index);
-    }
-  }
-  return SQLITE_OK;
+SpanJoinOperatorTable::Query::Query(const TableDefinition* definition,
+                                    sqlite3* db,
+                                    std::string sql)
+    : defn_(definition), db_(db), sql_query_(std::move(sql)) {
+  PERFETTO_DCHECK(!defn_->IsPartitioned() ||
+                  defn_->partition_idx() < defn_->columns().size());
 }
 
-SpanJoinOperatorTable::Query::Query(SpanJoinOperatorTable* table,
-                                    const TableDefinition* definition,
-                                    sqlite3* db)
-    : defn_(definition), db_(db), table_(table) {
+SpanJoinOperatorTable::Query::Query(const TableDefinition* definition,
+                                    const Rows* rows)
+    : defn_(definition), rows_(rows) {
   PERFETTO_DCHECK(!defn_->IsPartitioned() ||
                   defn_->partition_idx() < defn_->columns().size());
 }
@@ -619,12 +844,24 @@ SpanJoinOperatorTable::Query::Query(SpanJoinOperatorTable* table,
 SpanJoinOperatorTable::Query::~Query() = default;
 
 util::Status SpanJoinOperatorTable::Query::Initialize(
-    const QueryConstraints& qc,
-    sqlite3_value** argv,
+    int64_t partition_begin,
+    int64_t partition_end,
     InitialEofBehavior eof_behavior) {
-  *this = Query(table_, definition(), db_);
-  sql_query_ = CreateSqlQuery(
-      table_->ComputeSqlConstraintsForDefinition(*defn_, qc, argv));
+  if (defn_->IsPartitioned()) {
+    partition_begin_ = partition_begin;
+    partition_end_ = partition_end;
+    if (rows_) {
+      std::tie(begin_row_, end_row_) =
+          rows_->PartitionRows(partition_begin, partition_end);
+    } else {
+      PERFETTO_DCHECK(partition_begin == std::numeric_limits<int64_t>::min());
+      PERFETTO_DCHECK(partition_end == std::numeric_limits<int64_t>::max());
+    }
+  } else if (rows_) {
+    // The partitions don't matter for tables without partitions.
+    begin_row_ = 0;
+    end_row_ = rows_->size();
+  }
   util::Status status = Rewind();
   if (!status.ok())
     return status;
@@ -702,16 +939,15 @@ util::Status SpanJoinOperatorTable::Query::NextSliceState() {
     case State::kPresentPartitionShadow: {
       if (ts_end_ == std::numeric_limits<int64_t>::max()) {
         // If the shadow is to the end of the slice, create a missing partition
-        // shadow to the start of the partition of the next slice or to the max
-        // partition if we hit eof.
+        // shadow to the start of the partition of the next slice or to the end
+        // of the partitions of this query if we hit eof.
         state_ = State::kMissingPartitionShadow;
         ts_ = 0;
         ts_end_ = std::numeric_limits<int64_t>::max();
 
         missing_partition_start_ = partition_ + 1;
-        missing_partition_end_ = cursor_eof_
-                                     ? std::numeric_limits<int64_t>::max()
-                                     : CursorPartition();
+        missing_partition_end_ =
+            cursor_eof_ ? partition_end_ : CursorPartition();
       } else {
         // If the shadow is not to the end, we must have another slice on the
         // current partition.
@@ -725,11 +961,11 @@ util::Status SpanJoinOperatorTable::Query::NextSliceState() {
       return util::OkStatus();
     }
     case State::kMissingPartitionShadow: {
-      if (missing_partition_end_ == std::numeric_limits<int64_t>::max()) {
+      if (missing_partition_end_ == partition_end_) {
         PERFETTO_DCHECK(cursor_eof_);
 
-        // If we have a missing partition to the max partition, we must have hit
-        // eof.
+        // If we have a missing partition to the last partition, we must have
+        // hit eof.
         state_ = State::kEof;
       } else {
         PERFETTO_DCHECK(!defn_->IsPartitioned() ||
@@ -753,19 +989,24 @@ util::Status SpanJoinOperatorTable::Query::NextSliceState() {
 }
 
 util::Status SpanJoinOperatorTable::Query::Rewind() {
-  sqlite3_stmt* stmt = nullptr;
-  int res =
-      sqlite3_prepare_v2(db_, sql_query_.c_str(),
-                         static_cast<int>(sql_query_.size()), &stmt, nullptr);
-  stmt_.reset(stmt);
+  if (rows_) {
+    row_ = begin_row_;
+    cursor_eof_ = row_ >= end_row_;
+  } else {
+    sqlite3_stmt* stmt = nullptr;
+    int res =
+        sqlite3_prepare_v2(db_, sql_query_.c_str(),
+                           static_cast<int>(sql_query_.size()), &stmt, nullptr);
+    stmt_.reset(stmt);
 
-  cursor_eof_ = res != SQLITE_OK;
-  if (res != SQLITE_OK)
-    return util::ErrStatus("%s", sqlite3_errmsg(db_));
+    cursor_eof_ = res != SQLITE_OK;
+    if (res != SQLITE_OK)
+      return util::ErrStatus("%s", sqlite3_errmsg(db_));
 
-  util::Status status = CursorNext();
-  if (!status.ok())
-    return status;
+    util::Status status = CursorNext();
+    if (!status.ok())
+      return status;
+  }
 
   // Setup the first slice as a missing partition shadow from the lowest
   // partition until the first slice partition. We will handle finding the real
@@ -773,10 +1014,10 @@ util::Status SpanJoinOperatorTable::Query::Rewind() {
   state_ = State::kMissingPartitionShadow;
   ts_ = 0;
   ts_end_ = std::numeric_limits<int64_t>::max();
-  missing_partition_start_ = std::numeric_limits<int64_t>::min();
+  missing_partition_start_ = partition_begin_;
 
   if (cursor_eof_) {
-    missing_partition_end_ = std::numeric_limits<int64_t>::max();
+    missing_partition_end_ = partition_end_;
   } else if (defn_->IsPartitioned()) {
     missing_partition_end_ = CursorPartition();
   } else {
@@ -788,6 +1029,12 @@ util::Status SpanJoinOperatorTable::Query::Rewind() {
 }
 
 util::Status SpanJoinOperatorTable::Query::CursorNext() {
+  if (rows_) {
+    PERFETTO_DCHECK(!cursor_eof_);
+    cursor_eof_ = ++row_ >= end_row_;
+    return util::OkStatus();
+  }
+
   auto* stmt = stmt_.get();
   int res;
   if (defn_->IsPartitioned()) {
@@ -807,27 +1054,6 @@ util::Status SpanJoinOperatorTable::Query::CursorNext() {
              : util::ErrStatus("%s", sqlite3_errmsg(db_));
 }
 
-std::string SpanJoinOperatorTable::Query::CreateSqlQuery(
-    const std::vector<std::string>& cs) const {
-  std::vector<std::string> col_names;
-  for (const SqliteTable::Column& c : defn_->columns()) {
-    col_names.push_back("`" + c.name() + "`");
-  }
-
-  std::string sql = "SELECT " + base::Join(col_names, ", ");
-  sql += " FROM " + defn_->name();
-  if (!cs.empty()) {
-    sql += " WHERE " + base::Join(cs, " AND ");
-  }
-  sql += " ORDER BY ";
-  sql += defn_->IsPartitioned()
-             ? base::Join({"`" + defn_->partition_col() + "`", "ts"}, ", ")
-             : "ts";
-  sql += ";";
-  PERFETTO_DLOG("%s", sql.c_str());
-  return sql;
-}
-
 void SpanJoinOperatorTable::Query::ReportSqliteResult(sqlite3_context* context,
                                                       size_t index) {
   if (state_ != State::kReal) {
@@ -835,6 +1061,11 @@ void SpanJoinOperatorTable::Query::ReportSqliteResult(sqlite3_context* context,
     return;
   }
 
+  if (rows_) {
+    rows_->ReportSqliteResult(context, row_, index);
+    return;
+  }
+
   sqlite3_stmt* stmt = stmt_.get();
   int idx = static_cast<int>(index);
   switch (sqlite3_column_type(stmt, idx)) {
@@ -845,18 +1076,140 @@ void SpanJoinOperatorTable::Query::ReportSqliteResult(sqlite3_context* context,
       sqlite3_result_double(context, sqlite3_column_double(stmt, idx));
       break;
     case SQLITE_TEXT: {
-      // TODO(lalitm): note for future optimizations: if we knew the addresses
-      // of the string intern pool, we could check if the string returned here
-      // comes from the pool, and pass it as non-transient.
-      const auto kSqliteTransient =
-          reinterpret_cast<sqlite3_destructor_type>(-1);
       auto ptr = reinterpret_cast<const char*>(sqlite3_column_text(stmt, idx));
-      sqlite3_result_text(context, ptr, -1, kSqliteTransient);
+      sqlite3_result_text(context, ptr, -1, sqlite_utils::kSqliteTransient);
       break;
     }
   }
 }
 
+std::string SpanJoinOperatorTable::CreateSqlQuery(
+    const TableDefinition& defn,
+    const std::vector<std::string>& cs) {
+  std::vector<std::string> col_names;
+  for (const SqliteTable::Column& c : defn.columns()) {
+    col_names.push_back("`" + c.name() + "`");
+  }
+
+  std::string sql = "SELECT " + base::Join(col_names, ", ");
+  sql += " FROM " + defn.name();
+  if (!cs.empty()) {
+    sql += " WHERE " + base::Join(cs, " AND ");
+  }
+  sql += " ORDER BY ";
+  sql += defn.IsPartitioned()
+             ? base::Join({"`" + defn.partition_col() + "`", "ts"}, ", ")
+             : "ts";
+  sql += ";";
+  PERFETTO_DLOG("%s", sql.c_str());
+  return sql;
+}
+
+util::Status SpanJoinOperatorTable::Rows::Fill(sqlite3* db,
+                                               const TableDefinition& defn,
+                                               const std::string& sql) {
+  *this = Rows();
+  num_cols_ = defn.columns().size();
+
+  sqlite3_stmt* raw_stmt = nullptr;
+  int res = sqlite3_prepare_v2(db, sql.c_str(), static_cast<int>(sql.size()),
+                               &raw_stmt, nullptr);
+  ScopedStmt stmt(raw_stmt);
+  if (res != SQLITE_OK)
+    return util::ErrStatus("%s", sqlite3_errmsg(db));
+
+  const auto ts_idx = static_cast<int>(defn.ts_idx());
+  const auto dur_idx = static_cast<int>(defn.dur_idx());
+  const auto partition_idx = static_cast<int>(defn.partition_idx());
+  while ((res = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+    if (defn.IsPartitioned()) {
+      // Skip any rows with null partition keys.
+      if (sqlite3_column_type(stmt.get(), partition_idx) == SQLITE_NULL)
+        continue;
+      int64_t partition = sqlite3_column_int64(stmt.get(), partition_idx);
+      if (!partition_.empty() && partition < partition_.back())
+        sorted_by_partition_ = false;
+      partition_.push_back(partition);
+    }
+    ts_.push_back(sqlite3_column_int64(stmt.get(), ts_idx));
+    dur_.push_back(sqlite3_column_int64(stmt.get(), dur_idx));
+
+    for (int i = 0; i < static_cast<int>(num_cols_); ++i) {
+      switch (sqlite3_column_type(stmt.get(), i)) {
+        case SQLITE_INTEGER:
+          values_.push_back(
+              SqlValue::Long(sqlite3_column_int64(stmt.get(), i)));
+          break;
+        case SQLITE_FLOAT:
+          values_.push_back(
+              SqlValue::Double(sqlite3_column_double(stmt.get(), i)));
+          break;
+        case SQLITE_TEXT: {
+          // |strings_| can still be reallocated: store the offset of the
+          // string for now and set the pointer once all the rows are read.
+          SqlValue value;
+          value.type = SqlValue::kString;
+          value.long_value = static_cast<int64_t>(strings_.size());
+          auto* str = reinterpret_cast<const char*>(
+              sqlite3_column_text(stmt.get(), i));
+          strings_.append(str, strlen(str) + 1);
+          values_.push_back(value);
+          break;
+        }
+        default:
+          // Blobs are not supported and are returned as NULL.
+          values_.emplace_back();
+          break;
+      }
+    }
+  }
+  if (res != SQLITE_DONE)
+    return util::ErrStatus("%s", sqlite3_errmsg(db));
+
+  for (SqlValue& value : values_) {
+    if (value.type == SqlValue::kString)
+      value.string_value = strings_.data() + value.long_value;
+  }
+  return util::OkStatus();
+}
+
+std::pair<uint32_t, uint32_t> SpanJoinOperatorTable::Rows::PartitionRows(
+    int64_t begin,
+    int64_t end) const {
+  auto first = std::lower_bound(partition_.begin(), partition_.end(), begin);
+  // The last range of partitions also contains the rows with the max
+  // partition.
+  auto last = end == std::numeric_limits<int64_t>::max()
+                  ? partition_.end()
+                  : std::lower_bound(first, partition_.end(), end);
+  return std::make_pair(static_cast<uint32_t>(first - partition_.begin()),
+                        static_cast<uint32_t>(last - partition_.begin()));
+}
+
+void SpanJoinOperatorTable::Rows::ReportSqliteResult(sqlite3_context* context,
+                                                     uint32_t row,
+                                                     size_t index) const {
+  const SqlValue& value = values_[row * num_cols_ + index];
+  switch (value.type) {
+    case SqlValue::kLong:
+      sqlite3_result_int64(context, value.long_value);
+      break;
+    case SqlValue::kDouble:
+      sqlite3_result_double(context, value.double_value);
+      break;
+    case SqlValue::kString:
+      // The strings are freed when the cursor is filtered again, which can
+      // happen before SQLite is done with the value.
+      sqlite3_result_text(context, value.string_value, -1,
+                          sqlite_utils::kSqliteTransient);
+      break;
+    case SqlValue::kNull:
+    case SqlValue::kBytes:
+      sqlite3_result_null(context);
+      break;
+  }
+}
+
 SpanJoinOperatorTable::TableDefinition::TableDefinition(
     std::string name,
     std::string partition_col,
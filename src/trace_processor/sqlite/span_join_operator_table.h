@@ -26,6 +26,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "perfetto/trace_processor/basic_types.h"
@@ -36,6 +37,8 @@
 namespace perfetto {
 namespace trace_processor {
 
+class QueryInterrupter;
+
 // Implements the SPAN JOIN operation between two tables on a particular column.
 //
 // Span:
@@ -134,6 +137,57 @@ class SpanJoinOperatorTable : public SqliteTable {
     uint32_t partition_idx_ = std::numeric_limits<uint32_t>::max();
   };
 
+  // The rows returned by the query on one of the child tables, sorted by
+  // partition and ts. When the span join is computed on worker threads, each
+  // child table is queried only once per Filter() call and the join then
+  // works on these columns rather than on SQLite cursors: this allows ranges
+  // of partitions to be joined independently of each other, without using
+  // SQLite on the worker threads.
+  class Rows {
+   public:
+    // Runs |sql| (which should return the columns of |defn|) and stores all
+    // the rows it returns, apart from the ones with a NULL partition.
+    util::Status Fill(sqlite3* db,
+                      const TableDefinition& defn,
+                      const std::string& sql);
+
+    // Returns the range of rows with a partition in [begin, end).
+    std::pair<uint32_t, uint32_t> PartitionRows(int64_t begin,
+                                                int64_t end) const;
+
+    // Reports the value of the column at the given index to given context.
+    void ReportSqliteResult(sqlite3_context* context,
+                            uint32_t row,
+                            size_t index) const;
+
+    uint32_t size() const { return static_cast<uint32_t>(ts_.size()); }
+
+    int64_t ts(uint32_t row) const { return ts_[row]; }
+    int64_t dur(uint32_t row) const { return dur_[row]; }
+    int64_t partition(uint32_t row) const { return partition_[row]; }
+
+    // Empty if the table is not partitioned.
+    const std::vector<int64_t>& partitions() const { return partition_; }
+
+    // Returns whether the rows are sorted by partition when comparing the
+    // partitions as integers (which is not the case if e.g. the partition
+    // column contains strings).
+    bool sorted_by_partition() const { return sorted_by_partition_; }
+
+   private:
+    size_t num_cols_ = 0;
+    std::vector<int64_t> ts_;
+    std::vector<int64_t> dur_;
+    std::vector<int64_t> partition_;
+    bool sorted_by_partition_ = true;
+
+    // The values of all the columns of the table, row by row.
+    std::vector<SqlValue> values_;
+
+    // Storage for the string values, which point into it.
+    std::string strings_;
+  };
+
   // Stores information about a single subquery into one of the two child
   // tables.
   //
@@ -159,8 +213,13 @@ class SpanJoinOperatorTable : public SqliteTable {
       kEof,
     };
 
-    Query(SpanJoinOperatorTable*, const TableDefinition*, sqlite3* db);
-    virtual ~Query();
+    // Steps through the rows returned by |sql| as SQLite returns them.
+    Query(const TableDefinition*, sqlite3* db, std::string sql);
+
+    // Steps through the rows of |rows|.
+    Query(const TableDefinition*, const Rows*);
+
+    ~Query();
 
     Query(Query&&) noexcept = default;
     Query& operator=(Query&&) = default;
@@ -170,10 +229,12 @@ class SpanJoinOperatorTable : public SqliteTable {
       kTreatAsMissingPartitionShadow
     };
 
-    // Initializes the query with the given constraints and query parameters.
+    // Initializes the query to step through the rows with a partition in
+    // [partition_begin, partition_end) (or all the rows if the table is not
+    // partitioned). Queries running SQL always step through all the rows.
     util::Status Initialize(
-        const QueryConstraints& qc,
-        sqlite3_value** argv,
+        int64_t partition_begin,
+        int64_t partition_end,
         InitialEofBehavior eof_behavior = InitialEofBehavior::kTreatAsEof);
 
     // Forwards the query to the next valid slice.
@@ -234,6 +295,17 @@ class SpanJoinOperatorTable : public SqliteTable {
       return ts_end_;
     }
 
+    // Returns the rows the query steps through, or nullptr if the query
+    // steps through the rows returned by SQLite.
+    const Rows* rows() const { return rows_; }
+
+    // Returns the row of |Rows| of the current slice. Only valid for real
+    // slices of queries stepping through |Rows|.
+    uint32_t row() const {
+      PERFETTO_DCHECK(IsReal() && rows_);
+      return row_;
+    }
+
     const TableDefinition* definition() const { return defn_; }
 
    private:
@@ -252,9 +324,6 @@ class SpanJoinOperatorTable : public SqliteTable {
     // Forwards the cursor to point to the next real slice.
     util::Status CursorNext();
 
-    // Creates an SQL query from the given set of constraint strings.
-    std::string CreateSqlQuery(const std::vector<std::string>& cs) const;
-
     // Returns whether the current slice pointed to is a present partition
     // shadow.
     bool IsPresentPartitionShadow() const {
@@ -277,12 +346,16 @@ class SpanJoinOperatorTable : public SqliteTable {
 
     int64_t CursorTs() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (rows_)
+        return rows_->ts(row_);
       auto ts_idx = static_cast<int>(defn_->ts_idx());
       return sqlite3_column_int64(stmt_.get(), ts_idx);
     }
 
     int64_t CursorDur() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (rows_)
+        return rows_->dur(row_);
       auto dur_idx = static_cast<int>(defn_->dur_idx());
       return sqlite3_column_int64(stmt_.get(), dur_idx);
     }
@@ -290,6 +363,8 @@ class SpanJoinOperatorTable : public SqliteTable {
     int64_t CursorPartition() const {
       PERFETTO_DCHECK(!cursor_eof_);
       PERFETTO_DCHECK(defn_->IsPartitioned());
+      if (rows_)
+        return rows_->partition(row_);
       auto partition_idx = static_cast<int>(defn_->partition_idx());
       return sqlite3_column_int64(stmt_.get(), partition_idx);
     }
@@ -297,6 +372,14 @@ class SpanJoinOperatorTable : public SqliteTable {
     State state_ = State::kMissingPartitionShadow;
     bool cursor_eof_ = false;
 
+    // The rows the cursor steps through and the partitions they are part of.
+    // The rows are only used when stepping through |rows_|.
+    uint32_t row_ = 0;
+    uint32_t begin_row_ = 0;
+    uint32_t end_row_ = 0;
+    int64_t partition_begin_ = std::numeric_limits<int64_t>::min();
+    int64_t partition_end_ = std::numeric_limits<int64_t>::max();
+
     // Only valid when |state_| != kEof.
     int64_t ts_ = 0;
     int64_t ts_end_ = std::numeric_limits<int64_t>::max();
@@ -308,12 +391,77 @@ class SpanJoinOperatorTable : public SqliteTable {
     int64_t missing_partition_start_ = 0;
     int64_t missing_partition_end_ = 0;
 
+    const TableDefinition* defn_ = nullptr;
+
+    // Only one of these is set.
+    const Rows* rows_ = nullptr;
+    sqlite3* db_ = nullptr;
+
     std::string sql_query_;
     ScopedStmt stmt_;
+  };
 
-    const TableDefinition* defn_ = nullptr;
-    sqlite3* db_ = nullptr;
-    SpanJoinOperatorTable* table_ = nullptr;
+  // A row of the span join.
+  struct OutputRow {
+    static constexpr uint32_t kNoRow = std::numeric_limits<uint32_t>::max();
+
+    int64_t ts;
+    int64_t dur;
+    int64_t partition;
+
+    // The rows of |Rows| of the two child tables which are joined, or kNoRow
+    // if the row of the span join comes from a shadow of the table (or if
+    // the queries don't step through |Rows|).
+    uint32_t t1_row;
+    uint32_t t2_row;
+  };
+
+  // Computes the span join of the rows of the two child tables which are part
+  // of a range of partitions. As the partitions are joined independently of
+  // each other, concatenating the output of joiners on consecutive ranges of
+  // partitions gives the same result as joining all the partitions at once.
+  class Joiner {
+   public:
+    Joiner(const SpanJoinOperatorTable*, Query t1, Query t2);
+
+    // Steps to the first row of the span join of the partitions in
+    // [partition_begin, partition_end).
+    util::Status Initialize(int64_t partition_begin, int64_t partition_end);
+
+    // Forwards the joiner to the next row of the span join.
+    util::Status Next();
+
+    // Returns whether all the rows have been returned.
+    bool IsEof() const { return t1_.IsEof() || t2_.IsEof(); }
+
+    // Returns the current row of the span join.
+    OutputRow Current() const;
+
+    // Reports the column of the current row at the given index of the table
+    // of |defn| to given context.
+    void ReportSqliteResult(sqlite3_context* context,
+                            const TableDefinition* defn,
+                            size_t index);
+
+   private:
+    Joiner(const Joiner&) = delete;
+    Joiner& operator=(const Joiner&) = delete;
+
+    bool IsOverlappingSpan();
+
+    util::Status FindOverlappingSpan();
+
+    Query* FindEarliestFinishQuery();
+
+    Query t1_;
+    Query t2_;
+
+    Query* next_query_ = nullptr;
+
+    // Only valid for kMixedPartition.
+    int64_t last_mixed_partition_ = std::numeric_limits<int64_t>::min();
+
+    const SpanJoinOperatorTable* table_;
   };
 
   // Base class for a cursor on the span table.
@@ -333,29 +481,51 @@ class SpanJoinOperatorTable : public SqliteTable {
     Cursor(Cursor&) = delete;
     Cursor& operator=(const Cursor&) = delete;
 
-    Cursor(Cursor&&) noexcept = default;
-    Cursor& operator=(Cursor&&) = default;
+    // Returns whether the child tables should be read into |t1_rows_| and
+    // |t2_rows_| to be joined on worker threads.
+    bool ShouldJoinInParallel() const;
 
-    bool IsOverlappingSpan();
+    // Splits the partitions of |t1_rows_| and |t2_rows_| in ranges which are
+    // joined on worker threads, filling |range_output_|. Returns false if the
+    // rows should rather be joined lazily on the calling thread.
+    bool JoinInParallel();
 
-    util::Status FindOverlappingSpan();
+    // Skips the ranges of |range_output_| which have no rows left.
+    void SkipFinishedRanges();
 
-    Query* FindEarliestFinishQuery();
+    Rows t1_rows_;
+    Rows t2_rows_;
 
-    Query t1_;
-    Query t2_;
-
-    Query* next_query_ = nullptr;
+    // Only one of these is used, depending on whether the span join is
+    // computed lazily (as rows are requested by SQLite) or all at once. The
+    // lazy join steps through SQLite statements on the child tables unless
+    // the rows were already read for a parallel join.
+    std::unique_ptr<Joiner> joiner_;
+    std::vector<std::vector<OutputRow>> range_output_;
+    size_t output_range_ = 0;
+    size_t output_row_ = 0;
 
-    // Only valid for kMixedPartition.
-    int64_t last_mixed_partition_ = std::numeric_limits<int64_t>::min();
+    OutputRow current_;
 
+    sqlite3* db_;
     SpanJoinOperatorTable* table_;
   };
 
-  SpanJoinOperatorTable(sqlite3*, const TraceStorage*);
+  struct Context {
+    uint32_t worker_threads;
+    QueryInterrupter* interrupter;
+  };
+
+  SpanJoinOperatorTable(sqlite3*, Context);
 
-  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+  // |worker_threads| is the maximum number of threads which can be used to
+  // join independent partitions of the child tables concurrently. 0 or 1
+  // means that all the rows are joined on the thread running the query.
+  // If |interrupter| is not null, the joins on worker threads stop as soon as
+  // it interrupts the query.
+  static void RegisterTable(sqlite3* db,
+                            uint32_t worker_threads = 0,
+                            QueryInterrupter* interrupter = nullptr);
 
   // Table implementation.
   util::Status Init(int, const char* const*, SqliteTable::Schema*) override;
@@ -422,6 +592,11 @@ class SpanJoinOperatorTable : public SqliteTable {
   std::string GetNameForGlobalColumnIndex(const TableDefinition& defn,
                                           int global_column);
 
+  // Creates an SQL query on the table of |defn| from the given set of
+  // constraint strings.
+  static std::string CreateSqlQuery(const TableDefinition& defn,
+                                    const std::vector<std::string>& cs);
+
   void CreateSchemaColsForDefn(const TableDefinition& defn,
                                std::vector<SqliteTable::Column>* cols);
 
@@ -431,6 +606,8 @@ class SpanJoinOperatorTable : public SqliteTable {
   std::unordered_map<size_t, ColumnLocator> global_index_to_column_locator_;
 
   sqlite3* const db_;
+  const uint32_t worker_threads_;
+  QueryInterrupter* const interrupter_;
 };
 
 }  // namespace trace_processor
@@ -16,6 +16,9 @@
 
 #include "src/trace_processor/sqlite/span_join_operator_table.h"
 
+#include <string>
+#include <vector>
+
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
@@ -30,7 +33,7 @@ class SpanJoinOperatorTableTest : public ::testing::Test {
     PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
     db_.reset(db);
 
-    SpanJoinOperatorTable::RegisterTable(db_.get(), nullptr);
+    SpanJoinOperatorTable::RegisterTable(db_.get());
   }
 
   void PrepareValidStatement(const std::string& sql) {
@@ -340,6 +343,79 @@ TEST_F(SpanJoinOperatorTableTest, LeftJoinTwoSpanTables_EmptyRight) {
   ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
 }
 
+TEST_F(SpanJoinOperatorTableTest, ParallelJoinMatchesSerialJoin) {
+  ScopedDb parallel_db;
+  {
+    sqlite3* db = nullptr;
+    ASSERT_EQ(sqlite3_open(":memory:", &db), SQLITE_OK);
+    parallel_db.reset(db);
+  }
+  SpanJoinOperatorTable::RegisterTable(parallel_db.get(), 4);
+
+  // Large enough tables for the joins to be split between threads, with
+  // partitions which are present in only one of them.
+  const char* kSetup[] = {
+      "CREATE TABLE f(ts BIG INT, dur BIG INT, cpu BIG INT, f_val BIG INT);",
+      "CREATE TABLE s(ts BIG INT, dur BIG INT, cpu BIG INT, s_val TEXT);",
+      "CREATE TABLE u(ts BIG INT, dur BIG INT, u_val BIG INT);",
+      "WITH RECURSIVE c(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM c "
+      "WHERE x < 40000) "
+      "INSERT INTO f SELECT x / 64 * 100, (x * 13) % 90 + 1, x % 64, x FROM c;",
+      "WITH RECURSIVE c(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM c "
+      "WHERE x < 40000) "
+      "INSERT INTO s SELECT x / 70 * 100 + 50, (x * 7) % 120 + 1, x % 70, "
+      "'s' || x FROM c;",
+      "WITH RECURSIVE c(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM c "
+      "WHERE x < 30000) "
+      "INSERT INTO u SELECT x * 20, (x * 11) % 30 + 1, x FROM c;",
+      "CREATE VIRTUAL TABLE sj USING span_join(f PARTITIONED cpu, "
+      "s PARTITIONED cpu);",
+      "CREATE VIRTUAL TABLE slj USING span_left_join(f PARTITIONED cpu, "
+      "s PARTITIONED cpu);",
+      "CREATE VIRTUAL TABLE soj USING span_outer_join(f PARTITIONED cpu, "
+      "s PARTITIONED cpu);",
+      "CREATE VIRTUAL TABLE mixed USING span_join(f PARTITIONED cpu, u);",
+      "CREATE VIRTUAL TABLE mixed_left USING span_left_join(f PARTITIONED cpu, "
+      "u);",
+  };
+  for (sqlite3* db : {db_.get(), parallel_db.get()}) {
+    for (const char* sql : kSetup)
+      ASSERT_EQ(sqlite3_exec(db, sql, nullptr, nullptr, nullptr), SQLITE_OK)
+          << sql;
+  }
+
+  auto query_rows = [](sqlite3* db, const std::string& sql) {
+    std::vector<std::string> rows;
+    sqlite3_stmt* stmt = nullptr;
+    EXPECT_EQ(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr),
+              SQLITE_OK);
+    ScopedStmt scoped_stmt(stmt);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      std::string row;
+      for (int i = 0; i < sqlite3_column_count(stmt); ++i) {
+        const unsigned char* value = sqlite3_column_text(stmt, i);
+        row += value ? reinterpret_cast<const char*>(value) : "NULL";
+        row += ",";
+      }
+      rows.push_back(std::move(row));
+    }
+    return rows;
+  };
+
+  for (const char* table : {"sj", "slj", "soj", "mixed", "mixed_left"}) {
+    std::string sql = std::string("SELECT * FROM ") + table;
+    std::vector<std::string> serial = query_rows(db_.get(), sql);
+    ASSERT_GT(serial.size(), 1000u) << table;
+    ASSERT_EQ(query_rows(parallel_db.get(), sql), serial) << table;
+
+    // Too few rows to use the worker threads.
+    sql += " WHERE ts < 20000";
+    serial = query_rows(db_.get(), sql);
+    ASSERT_GT(serial.size(), 10u) << table;
+    ASSERT_EQ(query_rows(parallel_db.get(), sql), serial) << table;
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
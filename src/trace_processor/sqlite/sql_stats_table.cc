@@ -23,16 +23,17 @@
 #include <numeric>
 
 #include "src/trace_processor/sqlite/sqlite_utils.h"
-#include "src/trace_processor/storage/trace_storage.h"
 
 namespace perfetto {
 namespace trace_processor {
 
-SqlStatsTable::SqlStatsTable(sqlite3*, const TraceStorage* storage)
-    : storage_(storage) {}
+SqlStatsTable::SqlStatsTable(sqlite3*,
+                             const TraceStorage::SqlStats* sql_stats)
+    : sql_stats_(sql_stats) {}
 
-void SqlStatsTable::RegisterTable(sqlite3* db, const TraceStorage* storage) {
-  SqliteTable::Register<SqlStatsTable>(db, storage, "sqlstats");
+void SqlStatsTable::RegisterTable(sqlite3* db,
+                                  const TraceStorage::SqlStats* sql_stats) {
+  SqliteTable::Register<SqlStatsTable>(db, sql_stats, "sqlstats");
 }
 
 util::Status SqlStatsTable::Init(int, const char* const*, Schema* schema) {
@@ -61,7 +62,9 @@ int SqlStatsTable::BestIndex(const QueryConstraints&, BestIndexInfo*) {
 }
 
 SqlStatsTable::Cursor::Cursor(SqlStatsTable* table)
-    : SqliteTable::Cursor(table), storage_(table->storage_), table_(table) {}
+    : SqliteTable::Cursor(table),
+      sql_stats_(table->sql_stats_),
+      table_(table) {}
 
 SqlStatsTable::Cursor::~Cursor() = default;
 
@@ -69,7 +72,7 @@ int SqlStatsTable::Cursor::Filter(const QueryConstraints&,
                                   sqlite3_value**,
                                   FilterHistory) {
   *this = Cursor(table_);
-  num_rows_ = storage_->sql_stats().size();
+  num_rows_ = sql_stats_->size();
   return SQLITE_OK;
 }
 
@@ -83,7 +86,7 @@ int SqlStatsTable::Cursor::Eof() {
 }
 
 int SqlStatsTable::Cursor::Column(sqlite3_context* context, int col) {
-  const TraceStorage::SqlStats& stats = storage_->sql_stats();
+  const TraceStorage::SqlStats& stats = *sql_stats_;
   switch (col) {
     case Column::kQuery:
       sqlite3_result_text(context, stats.queries()[row_].c_str(), -1,
@@ -21,15 +21,15 @@
 #include <memory>
 
 #include "src/trace_processor/sqlite/sqlite_table.h"
+#include "src/trace_processor/storage/trace_storage.h"
 
 namespace perfetto {
 namespace trace_processor {
 
 class QueryConstraints;
-class TraceStorage;
 
 // A virtual table that allows to introspect performances of the SQL engine
-// for the kMaxLogEntries queries.
+// for the kMaxLogEntries queries, as recorded in |sql_stats|.
 class SqlStatsTable : public SqliteTable {
  public:
   enum Column {
@@ -63,13 +63,14 @@ class SqlStatsTable : public SqliteTable {
 
     size_t row_ = 0;
     size_t num_rows_ = 0;
-    const TraceStorage* storage_ = nullptr;
+    const TraceStorage::SqlStats* sql_stats_ = nullptr;
     SqlStatsTable* table_ = nullptr;
   };
 
-  SqlStatsTable(sqlite3*, const TraceStorage* storage);
+  SqlStatsTable(sqlite3*, const TraceStorage::SqlStats* sql_stats);
 
-  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+  static void RegisterTable(sqlite3* db,
+                            const TraceStorage::SqlStats* sql_stats);
 
   // Table implementation.
   util::Status Init(int, const char* const*, Schema*) override;
@@ -77,7 +78,7 @@ class SqlStatsTable : public SqliteTable {
   int BestIndex(const QueryConstraints&, BestIndexInfo*) override;
 
  private:
-  const TraceStorage* const storage_;
+  const TraceStorage::SqlStats* const sql_stats_;
 };
 
 }  // namespace trace_processor
@@ -22,6 +22,7 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/importers/common/system_info_tracker.h"
 #include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
+#include "src/trace_processor/importers/ftrace/ftrace_module.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 #include "src/trace_processor/types/gfp_flags.h"
 #include "src/trace_processor/types/softirq_action.h"
@@ -150,12 +151,10 @@ ArgsSerializer::ArgsSerializer(
       writer_(writer) {
   storage_ = context_->storage.get();
   const auto& args = storage_->arg_table();
-  const auto& set_ids = args.arg_set_id();
 
-  // We assume that the row map is a contiguous range (which is always the case
-  // because arg_set_ids are contiguous by definition).
-  row_map_ = args.FilterToRowMap({set_ids.eq(arg_set_id_)});
-  start_row_ = row_map_.empty() ? 0 : row_map_.Get(0);
+  std::pair<uint32_t, uint32_t> rows = storage_->GetArgSetRows(arg_set_id_);
+  row_map_ = RowMap(rows.first, rows.second);
+  start_row_ = rows.first;
 
   // If the vector already has entries, we've previously cached the mapping
   // from field id to arg index.
@@ -518,6 +517,11 @@ void ArgsSerializer::WriteValue(const Variadic& value) {
   }
 }
 
+void MaterializeRawArgs(TraceProcessorContext* context) {
+  if (context->ftrace_module)
+    context->ftrace_module->MaterializeRawArgs();
+}
+
 }  // namespace
 
 SqliteRawTable::SqliteRawTable(sqlite3* db, Context context)
@@ -525,6 +529,7 @@ SqliteRawTable::SqliteRawTable(sqlite3* db, Context context)
           db,
           {context.cache, tables::RawTable::Schema(), TableComputation::kStatic,
            &context.context->storage->raw_table(), nullptr}),
+      context_(context.context),
       serializer_(context.context) {
   auto fn = [](sqlite3_context* ctx, int argc, sqlite3_value** argv) {
     auto* thiz = static_cast<SqliteRawTable*>(sqlite3_user_data(ctx));
@@ -544,6 +549,13 @@ void SqliteRawTable::RegisterTable(sqlite3* db,
                                                  "raw");
 }
 
+std::unique_ptr<SqliteTable::Cursor> SqliteRawTable::CreateCursor() {
+  // The arg_set_id of the rows whose args are decoded lazily is only set
+  // once they are decoded.
+  MaterializeRawArgs(context_);
+  return DbSqliteTable::CreateCursor();
+}
+
 void SqliteRawTable::ToSystrace(sqlite3_context* ctx,
                                 int argc,
                                 sqlite3_value** argv) {
@@ -553,6 +565,8 @@ void SqliteRawTable::ToSystrace(sqlite3_context* ctx,
   }
   uint32_t row = static_cast<uint32_t>(sqlite3_value_int64(argv[0]));
 
+  MaterializeRawArgs(context_);
+
   auto str = serializer_.SerializeToString(row);
   if (str.get() == nullptr) {
     char buffer[1024];
@@ -565,6 +579,27 @@ void SqliteRawTable::ToSystrace(sqlite3_context* ctx,
   sqlite3_result_text(ctx, str.release(), -1, str.get_deleter());
 }
 
+SqliteArgsTable::SqliteArgsTable(sqlite3* db, Context context)
+    : DbSqliteTable(
+          db,
+          {context.cache, tables::ArgTable::Schema(), TableComputation::kStatic,
+           &context.context->storage->arg_table(), nullptr}),
+      context_(context.context) {}
+
+SqliteArgsTable::~SqliteArgsTable() = default;
+
+void SqliteArgsTable::RegisterTable(sqlite3* db,
+                                    QueryCache* cache,
+                                    TraceProcessorContext* context) {
+  SqliteTable::Register<SqliteArgsTable, Context>(
+      db, Context{cache, context}, context->storage->arg_table().table_name());
+}
+
+std::unique_ptr<SqliteTable::Cursor> SqliteArgsTable::CreateCursor() {
+  MaterializeRawArgs(context_);
+  return DbSqliteTable::CreateCursor();
+}
+
 SystraceSerializer::SystraceSerializer(TraceProcessorContext* context)
     : context_(context) {
   storage_ = context_->storage.get();
@@ -572,35 +607,40 @@ SystraceSerializer::SystraceSerializer(TraceProcessorContext* context)
 
 SystraceSerializer::ScopedCString SystraceSerializer::SerializeToString(
     uint32_t raw_row) {
-  const auto& raw = storage_->raw_table();
-
-  char line[4096];
+  char line[kMaxLineSize];
   base::StringWriter writer(line, sizeof(line));
+  if (!SerializeTo(raw_row, &writer))
+    return ScopedCString(nullptr, nullptr);
+  return ScopedCString(writer.CreateStringCopy(), free);
+}
+
+bool SystraceSerializer::SerializeTo(uint32_t raw_row,
+                                     base::StringWriter* writer) {
+  const auto& raw = storage_->raw_table();
 
   StringId event_name_id = raw.name()[raw_row];
   NullTermStringView event_name = storage_->GetString(event_name_id);
   if (event_name.StartsWith("chrome_event.") ||
       event_name.StartsWith("track_event.")) {
-    return ScopedCString(nullptr, nullptr);
+    return false;
   }
 
-  SerializePrefix(raw_row, &writer);
+  SerializePrefix(raw_row, writer);
 
-  writer.AppendChar(' ');
+  writer->AppendChar(' ');
   if (event_name == "print" || event_name == "g2d_tracing_mark_write" ||
       event_name == "dpu_tracing_mark_write") {
-    writer.AppendString("tracing_mark_write");
+    writer->AppendString("tracing_mark_write");
   } else {
-    writer.AppendString(event_name.c_str(), event_name.size());
+    writer->AppendString(event_name.c_str(), event_name.size());
   }
-  writer.AppendChar(':');
+  writer->AppendChar(':');
 
   ArgsSerializer serializer(context_, raw.arg_set_id()[raw_row], event_name,
                             &proto_id_to_arg_index_by_event_[event_name_id],
-                            &writer);
+                            writer);
   serializer.SerializeArgs();
-
-  return ScopedCString(writer.CreateStringCopy(), free);
+  return true;
 }
 
 void SystraceSerializer::SerializePrefix(uint32_t raw_row,
@@ -35,6 +35,14 @@ class SystraceSerializer {
 
   ScopedCString SerializeToString(uint32_t raw_row);
 
+  // Appends the line of |raw_row| (without a trailing newline) to |writer|.
+  // Returns false, without writing anything, for the chrome_event.* and
+  // track_event.* rows which have no systrace representation.
+  bool SerializeTo(uint32_t raw_row, base::StringWriter* writer);
+
+  // The longest line which can be serialized, including the null terminator.
+  static constexpr size_t kMaxLineSize = 4096;
+
  private:
   using StringIdMap =
       std::unordered_map<StringId, std::vector<base::Optional<uint32_t>>>;
@@ -58,12 +66,37 @@ class SqliteRawTable : public DbSqliteTable {
 
   static void RegisterTable(sqlite3* db, QueryCache*, TraceProcessorContext*);
 
+  std::unique_ptr<SqliteTable::Cursor> CreateCursor() override;
+
  private:
   void ToSystrace(sqlite3_context* ctx, int argc, sqlite3_value** argv);
 
+  TraceProcessorContext* context_ = nullptr;
   SystraceSerializer serializer_;
 };
 
+// The args table. Only used instead of registering the table directly when
+// the args of the raw table are decoded lazily (see
+// Config::lazy_ftrace_raw_args): they are decoded into the table before it is
+// first read.
+class SqliteArgsTable : public DbSqliteTable {
+ public:
+  struct Context {
+    QueryCache* cache;
+    TraceProcessorContext* context;
+  };
+
+  SqliteArgsTable(sqlite3*, Context);
+  ~SqliteArgsTable() override;
+
+  static void RegisterTable(sqlite3* db, QueryCache*, TraceProcessorContext*);
+
+  std::unique_ptr<SqliteTable::Cursor> CreateCursor() override;
+
+ private:
+  TraceProcessorContext* context_ = nullptr;
+};
+
 }  // namespace trace_processor
 }  // namespace perfetto
 
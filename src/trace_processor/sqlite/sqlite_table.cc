@@ -57,6 +57,9 @@ SqliteTable::~SqliteTable() = default;
 int SqliteTable::OpenInternal(sqlite3_vtab_cursor** ppCursor) {
   // Freed in xClose().
   *ppCursor = static_cast<sqlite3_vtab_cursor*>(CreateCursor().release());
+  QueryProfiler::OperatorStats* stats = GetProfileStats();
+  if (PERFETTO_UNLIKELY(stats))
+    stats->cursors++;
   return SQLITE_OK;
 }
 
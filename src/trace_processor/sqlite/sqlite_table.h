@@ -25,10 +25,12 @@
 #include <string>
 #include <vector>
 
+#include "perfetto/base/time.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/db/query_profiler.h"
 #include "src/trace_processor/sqlite/query_constraints.h"
 
 namespace perfetto {
@@ -73,6 +75,19 @@ class SqliteTable : public sqlite3_vtab {
   // Public for unique_ptr destructor calls.
   virtual ~SqliteTable();
 
+  // Returns the stats of this table in the profiler of the query running on
+  // the current thread, null if the query is not profiled.
+  QueryProfiler::OperatorStats* GetProfileStats() {
+    QueryProfiler* profiler = QueryProfiler::current();
+    if (PERFETTO_LIKELY(!profiler))
+      return nullptr;
+    if (profiler->id() != profiler_id_) {
+      profiler_id_ = profiler->id();
+      profile_stats_ = profiler->GetOperatorStats(name_);
+    }
+    return profile_stats_;
+  }
+
   // Abstract base class representing an SQLite Cursor. Presents a friendlier
   // API for subclasses to implement.
   class Cursor : public sqlite3_vtab_cursor {
@@ -270,13 +285,46 @@ class SqliteTable : public sqlite3_vtab {
 
       auto history = is_cached ? Cursor::FilterHistory::kSame
                                : Cursor::FilterHistory::kDifferent;
-      return static_cast<TCursor*>(c)->Filter(c->table_->qc_cache_, v, history);
+      QueryProfiler::OperatorStats* stats = c->table_->GetProfileStats();
+      if (PERFETTO_LIKELY(!stats)) {
+        return static_cast<TCursor*>(c)->Filter(c->table_->qc_cache_, v,
+                                                history);
+      }
+
+      // The columns filtered by the table are attributed to it.
+      QueryProfiler::ScopedOperator op(QueryProfiler::current(),
+                                       &c->table_->name_);
+      base::TimeNanos start = base::GetWallTimeNs();
+      int ret =
+          static_cast<TCursor*>(c)->Filter(c->table_->qc_cache_, v, history);
+      stats->filters++;
+      stats->filter_ns += (base::GetWallTimeNs() - start).count();
+      return ret;
     };
     module->xNext = [](sqlite3_vtab_cursor* c) {
-      return static_cast<TCursor*>(c)->Next();
+      auto* cursor = static_cast<TCursor*>(c);
+      QueryProfiler::OperatorStats* stats =
+          static_cast<Cursor*>(c)->table_->GetProfileStats();
+      if (PERFETTO_LIKELY(!stats))
+        return cursor->Next();
+
+      base::TimeNanos start = base::GetWallTimeNs();
+      int ret = cursor->Next();
+      stats->next_ns += (base::GetWallTimeNs() - start).count();
+      return ret;
     };
     module->xEof = [](sqlite3_vtab_cursor* c) {
-      return static_cast<TCursor*>(c)->Eof();
+      int eof = static_cast<TCursor*>(c)->Eof();
+
+      // SQLite checks for the end after xFilter and after each xNext so this
+      // is called once for each row returned.
+      if (!eof) {
+        QueryProfiler::OperatorStats* stats =
+            static_cast<Cursor*>(c)->table_->GetProfileStats();
+        if (PERFETTO_UNLIKELY(stats))
+          stats->rows_returned++;
+      }
+      return eof;
     };
     module->xColumn = [](sqlite3_vtab_cursor* c, sqlite3_context* a, int b) {
       return static_cast<TCursor*>(c)->Column(a, b);
@@ -366,6 +414,11 @@ class SqliteTable : public sqlite3_vtab {
   QueryConstraints qc_cache_;
   int qc_hash_ = 0;
   int best_index_num_ = 0;
+
+  // The stats of this table in the profiler with id |profiler_id_|, cached to
+  // avoid looking them up for each row.
+  uint64_t profiler_id_ = 0;
+  QueryProfiler::OperatorStats* profile_stats_ = nullptr;
 };
 
 }  // namespace trace_processor
@@ -76,6 +76,25 @@ inline bool IsOpIsNotNull(int op) {
   return op == SQLITE_INDEX_CONSTRAINT_ISNOTNULL;
 }
 
+// LIMIT and OFFSET are only passed to xBestIndex by SQLite 3.38 and later.
+inline bool IsOpLimit(int op) {
+#ifdef SQLITE_INDEX_CONSTRAINT_LIMIT
+  return op == SQLITE_INDEX_CONSTRAINT_LIMIT;
+#else
+  base::ignore_result(op);
+  return false;
+#endif
+}
+
+inline bool IsOpOffset(int op) {
+#ifdef SQLITE_INDEX_CONSTRAINT_OFFSET
+  return op == SQLITE_INDEX_CONSTRAINT_OFFSET;
+#else
+  base::ignore_result(op);
+  return false;
+#endif
+}
+
 template <typename T>
 T ExtractSqliteValue(sqlite3_value* value);
 
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/statement_cache.h"
+
+#include <sqlite3.h>
+
+namespace perfetto {
+namespace trace_processor {
+
+constexpr uint32_t StatementCache::kDefaultMaxEntries;
+
+StatementCache::StatementCache(uint32_t max_entries)
+    : max_entries_(max_entries) {}
+
+StatementCache::~StatementCache() = default;
+
+ScopedStmt StatementCache::Take(const std::string& sql) {
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->sql != sql)
+      continue;
+    ScopedStmt stmt = std::move(it->stmt);
+    entries_.erase(it);
+    return stmt;
+  }
+  return ScopedStmt();
+}
+
+void StatementCache::Put(std::string sql, ScopedStmt stmt) {
+  if (max_entries_ == 0)
+    return;
+  sqlite3_reset(*stmt);
+  sqlite3_clear_bindings(*stmt);
+
+  // The same SQL can have been prepared again while |stmt| was in use.
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (it->sql == sql) {
+      entries_.erase(it);
+      break;
+    }
+  }
+  entries_.push_front(Entry{std::move(sql), std::move(stmt)});
+  if (entries_.size() > max_entries_)
+    entries_.pop_back();
+}
+
+void StatementCache::Clear() {
+  entries_.clear();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_STATEMENT_CACHE_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_STATEMENT_CACHE_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <string>
+
+#include "src/trace_processor/sqlite/scoped_db.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Caches the statements prepared on a SQLite connection, keyed on their SQL
+// text, so that queries which only differ by the values bound to their
+// parameters are only parsed and planned once.
+//
+// A statement is owned by the cache only while it is not in use: Take()
+// removes it from the cache and Put() gives it back once the query is done.
+// The same SQL text running in two queries at the same time is therefore
+// prepared twice, and only one of the statements is kept.
+//
+// Entries are evicted in least recently used order. The cache must be cleared
+// (or destroyed) before the connection is closed.
+class StatementCache {
+ public:
+  static constexpr uint32_t kDefaultMaxEntries = 64;
+
+  explicit StatementCache(uint32_t max_entries = kDefaultMaxEntries);
+  ~StatementCache();
+
+  StatementCache(const StatementCache&) = delete;
+  StatementCache& operator=(const StatementCache&) = delete;
+
+  // Returns the cached statement for |sql|, removing it from the cache, or an
+  // invalid statement if there is none.
+  ScopedStmt Take(const std::string& sql);
+
+  // Resets |stmt|, prepared from |sql|, and adds it to the cache.
+  void Put(std::string sql, ScopedStmt stmt);
+
+  // Finalizes all the cached statements.
+  void Clear();
+
+  uint32_t entry_count() const {
+    return static_cast<uint32_t>(entries_.size());
+  }
+
+ private:
+  struct Entry {
+    std::string sql;
+    ScopedStmt stmt;
+  };
+
+  const uint32_t max_entries_;
+
+  // Most recently used entries are at the front.
+  std::list<Entry> entries_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_STATEMENT_CACHE_H_
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks of the fixed cost of a TraceProcessor instance: the time from
+// creating it to the first query or metric on a tiny trace. This dominates
+// the latency of tools which load many small traces.
+
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/trace_processor/trace_processor.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr char kTinyTrace[] =
+    "# tracer: nop\n"
+    "#\n"
+    "          <idle>-0     (-----) [000] d..3 1000.000000: sched_switch: "
+    "prev_comm=swapper/0 prev_pid=0 prev_prio=120 prev_state=R ==> "
+    "next_comm=app next_pid=42 next_prio=120\n"
+    "             app-42    (   42) [000] d..3 1000.001000: sched_switch: "
+    "prev_comm=app prev_pid=42 prev_prio=120 prev_state=S ==> "
+    "next_comm=swapper/0 next_pid=0 next_prio=120\n";
+
+void LoadTinyTrace(benchmark::State& state, TraceProcessor* tp) {
+  size_t size = sizeof(kTinyTrace) - 1;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+  memcpy(buf.get(), kTinyTrace, size);
+  util::Status status = tp->Parse(std::move(buf), size);
+  if (!status.ok())
+    state.SkipWithError(status.c_message());
+  tp->NotifyEndOfFile();
+}
+
+static void BM_StartupCreateInstance(benchmark::State& state) {
+  for (auto _ : state) {
+    std::unique_ptr<TraceProcessor> tp =
+        TraceProcessor::CreateInstance(Config());
+    benchmark::DoNotOptimize(tp);
+  }
+}
+BENCHMARK(BM_StartupCreateInstance)->Unit(benchmark::kMillisecond);
+
+static void BM_StartupFirstQuery(benchmark::State& state) {
+  for (auto _ : state) {
+    std::unique_ptr<TraceProcessor> tp =
+        TraceProcessor::CreateInstance(Config());
+    LoadTinyTrace(state, tp.get());
+    auto it = tp->ExecuteQuery("select count(1) from sched");
+    while (it.Next()) {
+    }
+    if (!it.Status().ok())
+      state.SkipWithError(it.Status().c_message());
+  }
+}
+BENCHMARK(BM_StartupFirstQuery)->Unit(benchmark::kMillisecond);
+
+static void BM_StartupFirstMetric(benchmark::State& state) {
+  for (auto _ : state) {
+    std::unique_ptr<TraceProcessor> tp =
+        TraceProcessor::CreateInstance(Config());
+    LoadTinyTrace(state, tp.get());
+    std::vector<uint8_t> metrics_proto;
+    util::Status status = tp->ComputeMetric({"trace_stats"}, &metrics_proto);
+    if (!status.ok())
+      state.SkipWithError(status.c_message());
+  }
+}
+BENCHMARK(BM_StartupFirstMetric)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
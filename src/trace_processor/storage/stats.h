@@ -71,6 +71,10 @@ namespace stats {
   F(rss_stat_unknown_keys,              kSingle,  kError,    kAnalysis, ""),   \
   F(rss_stat_negative_size,             kSingle,  kInfo,     kAnalysis, ""),   \
   F(rss_stat_unknown_thread_for_mm_id,  kSingle,  kInfo,     kAnalysis, ""),   \
+  F(rss_stat_coalesced,                 kSingle,  kInfo,     kAnalysis,        \
+      "Number of rss_stat samples which were not inserted into the counter "   \
+      "table because of Config::coalesce_rss_stat_counters or "                \
+      "Config::rss_stat_resolution_ns."),                                      \
   F(sched_switch_out_of_order,          kSingle,  kError,    kAnalysis, ""),   \
   F(slice_out_of_order,                 kSingle,  kError,    kAnalysis, ""),   \
   F(flow_duplicate_id,                  kSingle,  kError,    kTrace,    ""),   \
@@ -121,6 +125,16 @@ namespace stats {
                                         kSingle,  kError,    kTrace,    ""),   \
   F(clock_sync_failure,                 kSingle,  kError,    kAnalysis, ""),   \
   F(clock_sync_cache_miss,              kSingle,  kInfo,     kAnalysis, ""),   \
+  F(query_cache_hits,                   kSingle,  kInfo,     kAnalysis, ""),   \
+  F(query_cache_misses,                 kSingle,  kInfo,     kAnalysis, ""),   \
+  F(query_cache_evictions,              kSingle,  kInfo,     kAnalysis, ""),   \
+  F(statement_cache_hits,               kSingle,  kInfo,     kAnalysis,        \
+      "Number of queries with args which reused a cached statement."),         \
+  F(statement_cache_misses,             kSingle,  kInfo,     kAnalysis,        \
+      "Number of queries with args which prepared a new statement."),          \
+  F(direct_table_queries,               kSingle,  kInfo,     kAnalysis,        \
+      "Number of queries computed directly on a table without going through "  \
+      "SQLite."),                                                              \
   F(process_tracker_errors,             kSingle,  kError,    kAnalysis, ""),   \
   F(json_tokenizer_failure,             kSingle,  kError,    kTrace,    ""),   \
   F(json_parser_failure,                kSingle,  kError,    kTrace,    ""),   \
@@ -154,7 +168,7 @@ namespace stats {
   F(heapprofd_sampling_interval_adjusted,                                      \
       kIndexed, kInfo,    kTrace,                                              \
       "By how many byes the interval for PID was increased "                   \
-      "by adaptive sampling."),                                                \
+      "by adaptive sampling, at most."),                                       \
   F(heapprofd_unwind_time_us,           kIndexed, kInfo,     kTrace,           \
       "Time spent unwinding callstacks."),                                     \
   F(heapprofd_unwind_samples,           kIndexed, kInfo,     kTrace,           \
@@ -185,11 +199,19 @@ namespace stats {
       "the tracing service. This happens if the ftrace buffers were not "      \
       "cleared properly. These packets are silently dropped by trace "         \
       "processor."),                                                           \
+  F(ftrace_raw_page_no_format,          kSingle,  kDataLoss, kTrace,           \
+      "Raw ftrace pages (FtraceConfig.raw_page_passthrough) were dropped "     \
+      "because they preceded their format in the trace, e.g. because the "     \
+      "format was overwritten in a ring buffer."),                             \
   F(perf_guardrail_stop_ts,             kIndexed, kDataLoss, kTrace,    ""),   \
   F(sorter_push_event_out_of_order,     kSingle, kError,     kTrace,           \
        "Trace events are out of order event after sorting. This can happen "   \
        "due to many factors including clock sync drift, producers emitting "   \
-       "events out of order or a bug in trace processor's logic of sorting.")
+       "events out of order or a bug in trace processor's logic of sorting."), \
+  F(sorter_window_late_events,          kSingle, kDataLoss,  kTrace,           \
+       "Trace events dropped because they arrived after the sorting window "   \
+       "they belonged to had already been extracted. Consider increasing "     \
+       "Config::sorting_window_ns (--sort-window-ns in the shell).")
 // clang-format on
 
 enum Type {
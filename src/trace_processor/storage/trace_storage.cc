@@ -19,14 +19,20 @@
 #include <string.h>
 #include <algorithm>
 #include <limits>
+#include <memory>
 
 #include "perfetto/ext/base/no_destructor.h"
+#include "src/trace_processor/containers/spill_file.h"
 
 namespace perfetto {
 namespace trace_processor {
 
 namespace {
 
+uint64_t ArgIndexKey(uint32_t arg_set_id, StringId key) {
+  return (static_cast<uint64_t>(arg_set_id) << 32) | key.raw_id();
+}
+
 void DbTableMaybeUpdateMinMax(const TypedColumn<int64_t>& ts_col,
                               int64_t* min_value,
                               int64_t* max_value,
@@ -146,5 +152,193 @@ std::pair<int64_t, int64_t> TraceStorage::GetTraceTimestampBoundsNs() const {
   return std::make_pair(start_ns, end_ns);
 }
 
+// static
+constexpr uint32_t TraceStorage::kMultipleArgRows;
+
+util::Status TraceStorage::ExtractArg(uint32_t arg_set_id,
+                                      const char* key,
+                                      base::Optional<Variadic>* result) {
+  *result = base::nullopt;
+  base::Optional<StringId> key_id = string_pool_.GetId(key);
+  if (!key_id)
+    return util::OkStatus();
+
+  // Args are only ever appended so the index just needs to be extended with
+  // the rows added since the last call. Once the index is up to date, it is
+  // read without taking the lock.
+  uint32_t row_count = arg_table_.row_count();
+  if (arg_index_row_count_.load(std::memory_order_acquire) < row_count) {
+    std::lock_guard<std::mutex> lock(derived_index_mutex_);
+    const auto& set_ids = arg_table_.arg_set_id();
+    const auto& keys = arg_table_.key();
+    arg_index_.reserve(row_count);
+    uint32_t indexed_rows =
+        arg_index_row_count_.load(std::memory_order_relaxed);
+    for (uint32_t row = indexed_rows; row < row_count; ++row) {
+      auto it_and_inserted =
+          arg_index_.emplace(ArgIndexKey(set_ids[row], keys[row]), row);
+      if (!it_and_inserted.second)
+        it_and_inserted.first->second = kMultipleArgRows;
+    }
+    arg_index_row_count_.store(row_count, std::memory_order_release);
+  }
+
+  auto it = arg_index_.find(ArgIndexKey(arg_set_id, *key_id));
+  if (it == arg_index_.end())
+    return util::OkStatus();
+  if (it->second == kMultipleArgRows) {
+    return util::ErrStatus(
+        "EXTRACT_ARG: received multiple args matching arg set id and key");
+  }
+  *result = GetArgValue(it->second);
+  return util::OkStatus();
+}
+
+const NestedSetIndex& TraceStorage::GetSliceNestingIndex() {
+  std::lock_guard<std::mutex> lock(derived_index_mutex_);
+  uint32_t row_count = slice_table_.row_count();
+  if (slice_nesting_index_.size() == row_count)
+    return slice_nesting_index_;
+
+  std::vector<uint32_t> parents(row_count);
+  const auto& parent_ids = slice_table_.parent_id();
+  for (uint32_t row = 0; row < row_count; ++row) {
+    base::Optional<SliceId> parent_id = parent_ids[row];
+    parents[row] = parent_id ? *slice_table_.id().IndexOf(*parent_id)
+                             : NestedSetIndex::kNoParent;
+  }
+  slice_nesting_index_ = NestedSetIndex(parents);
+  return slice_nesting_index_;
+}
+
+const TraceStorage::FlowIndex& TraceStorage::GetFlowIndex() {
+  std::lock_guard<std::mutex> lock(derived_index_mutex_);
+  uint32_t slice_count = slice_table_.row_count();
+  uint32_t flow_count = flow_table_.row_count();
+  if (flow_index_.out_offsets.size() == slice_count + 1 &&
+      flow_index_flow_count_ == flow_count) {
+    return flow_index_;
+  }
+
+  // Counting sort of the flows by slice, which keeps the flows of each slice
+  // in increasing order of flow row.
+  std::vector<uint32_t> out_rows(flow_count);
+  std::vector<uint32_t> in_rows(flow_count);
+  FlowIndex index;
+  index.out_offsets.assign(slice_count + 1, 0);
+  index.in_offsets.assign(slice_count + 1, 0);
+  for (uint32_t row = 0; row < flow_count; ++row) {
+    out_rows[row] = *slice_table_.id().IndexOf(flow_table_.slice_out()[row]);
+    in_rows[row] = *slice_table_.id().IndexOf(flow_table_.slice_in()[row]);
+    ++index.out_offsets[out_rows[row] + 1];
+    ++index.in_offsets[in_rows[row] + 1];
+  }
+  for (uint32_t i = 0; i < slice_count; ++i) {
+    index.out_offsets[i + 1] += index.out_offsets[i];
+    index.in_offsets[i + 1] += index.in_offsets[i];
+  }
+
+  index.out_flows.resize(flow_count);
+  index.in_flows.resize(flow_count);
+  std::vector<uint32_t> out_next(index.out_offsets.begin(),
+                                 index.out_offsets.end() - 1);
+  std::vector<uint32_t> in_next(index.in_offsets.begin(),
+                                index.in_offsets.end() - 1);
+  for (uint32_t row = 0; row < flow_count; ++row) {
+    index.out_flows[out_next[out_rows[row]]++] = {row, in_rows[row]};
+    index.in_flows[in_next[in_rows[row]]++] = {row, out_rows[row]};
+  }
+
+  flow_index_ = std::move(index);
+  flow_index_flow_count_ = flow_count;
+  return flow_index_;
+}
+
+void TraceStorage::CompressEventTables() {
+  raw_table_.CompressStorage();
+  sched_slice_table_.CompressStorage();
+  syscall_table_.CompressStorage();
+  counter_table_.CompressStorage();
+  slice_table_.CompressStorage();
+  thread_slice_table_.CompressStorage();
+  flow_table_.CompressStorage();
+  instant_table_.CompressStorage();
+  arg_table_.CompressStorage();
+  android_log_table_.CompressStorage();
+  binder_transaction_table_.CompressStorage();
+  heap_profile_allocation_table_.CompressStorage();
+  heap_graph_object_table_.CompressStorage();
+  heap_graph_reference_table_.CompressStorage();
+  perf_sample_table_.CompressStorage();
+  cpu_profile_stack_sample_table_.CompressStorage();
+  stack_profile_callsite_table_.CompressStorage();
+}
+
+uint64_t TraceStorage::SpillEventTables(uint64_t max_bytes) {
+  std::vector<Column*> columns;
+  raw_table_.GetSpillableColumns(&columns);
+  sched_slice_table_.GetSpillableColumns(&columns);
+  syscall_table_.GetSpillableColumns(&columns);
+  counter_table_.GetSpillableColumns(&columns);
+  slice_table_.GetSpillableColumns(&columns);
+  thread_slice_table_.GetSpillableColumns(&columns);
+  flow_table_.GetSpillableColumns(&columns);
+  instant_table_.GetSpillableColumns(&columns);
+  arg_table_.GetSpillableColumns(&columns);
+  android_log_table_.GetSpillableColumns(&columns);
+  binder_transaction_table_.GetSpillableColumns(&columns);
+  heap_profile_allocation_table_.GetSpillableColumns(&columns);
+  heap_graph_object_table_.GetSpillableColumns(&columns);
+  heap_graph_reference_table_.GetSpillableColumns(&columns);
+  perf_sample_table_.GetSpillableColumns(&columns);
+  cpu_profile_stack_sample_table_.GetSpillableColumns(&columns);
+  stack_profile_callsite_table_.GetSpillableColumns(&columns);
+  if (columns.empty())
+    return 0;
+
+  std::unique_ptr<SpillFile> file = SpillFile::Create();
+  if (!file)
+    return 0;
+
+  std::stable_sort(columns.begin(), columns.end(),
+                   [](const Column* a, const Column* b) {
+                     return a->SpillableStorageSizeBytes() >
+                            b->SpillableStorageSizeBytes();
+                   });
+
+  // Columns of child tables share their storage with the parent table so
+  // the same storage can appear multiple times: spilling it again is a no-op.
+  uint64_t spilled = 0;
+  for (Column* col : columns) {
+    if (spilled >= max_bytes)
+      break;
+    spilled += col->SpillStorage(file.get());
+  }
+  return spilled;
+}
+
+void TraceStorage::BuildRankSelectIndexes() {
+  thread_table_.BuildRankSelectIndexes();
+  process_table_.BuildRankSelectIndexes();
+  track_table_.BuildRankSelectIndexes();
+  process_track_table_.BuildRankSelectIndexes();
+  thread_track_table_.BuildRankSelectIndexes();
+  counter_track_table_.BuildRankSelectIndexes();
+  thread_counter_track_table_.BuildRankSelectIndexes();
+  process_counter_track_table_.BuildRankSelectIndexes();
+  cpu_counter_track_table_.BuildRankSelectIndexes();
+  slice_table_.BuildRankSelectIndexes();
+  thread_slice_table_.BuildRankSelectIndexes();
+  gpu_slice_table_.BuildRankSelectIndexes();
+  flow_table_.BuildRankSelectIndexes();
+  sched_slice_table_.BuildRankSelectIndexes();
+  counter_table_.BuildRankSelectIndexes();
+  instant_table_.BuildRankSelectIndexes();
+  arg_table_.BuildRankSelectIndexes();
+  raw_table_.BuildRankSelectIndexes();
+  stack_profile_frame_table_.BuildRankSelectIndexes();
+  stack_profile_callsite_table_.BuildRankSelectIndexes();
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
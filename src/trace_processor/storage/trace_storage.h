@@ -18,8 +18,11 @@
 #define SRC_TRACE_PROCESSOR_STORAGE_TRACE_STORAGE_H_
 
 #include <array>
+#include <atomic>
 #include <deque>
+#include <limits>
 #include <map>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -33,6 +36,7 @@
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
+#include "src/trace_processor/containers/nested_set_index.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/storage/metadata.h"
 #include "src/trace_processor/storage/stats.h"
@@ -394,6 +398,16 @@ class TraceStorage {
     return &sched_slice_table_;
   }
 
+  const tables::ThreadStateTable& thread_state_table() const {
+    return thread_state_table_;
+  }
+  tables::ThreadStateTable* mutable_thread_state_table() {
+    return &thread_state_table_;
+  }
+
+  const tables::SyscallTable& syscall_table() const { return syscall_table_; }
+  tables::SyscallTable* mutable_syscall_table() { return &syscall_table_; }
+
   const tables::SliceTable& slice_table() const { return slice_table_; }
   tables::SliceTable* mutable_slice_table() { return &slice_table_; }
 
@@ -435,6 +449,13 @@ class TraceStorage {
     return &android_log_table_;
   }
 
+  const tables::BinderTransactionTable& binder_transaction_table() const {
+    return binder_transaction_table_;
+  }
+  tables::BinderTransactionTable* mutable_binder_transaction_table() {
+    return &binder_transaction_table_;
+  }
+
   const StatsMap& stats() const { return stats_; }
 
   const tables::MetadataTable& metadata_table() const {
@@ -452,6 +473,28 @@ class TraceStorage {
   const tables::ArgTable& arg_table() const { return arg_table_; }
   tables::ArgTable* mutable_arg_table() { return &arg_table_; }
 
+  // Starts a new arg set whose args will be inserted at the end of the arg
+  // table. Returns the id of the new arg set. Only the args of this set should
+  // be inserted into the arg table until the next call.
+  ArgSetId StartArgSet() {
+    arg_set_first_rows_.push_back(arg_table_.row_count());
+    return static_cast<ArgSetId>(arg_set_first_rows_.size() - 1);
+  }
+
+  // Returns the rows [first, second) of the arg table which hold the args of
+  // |arg_set_id|. As the args of each arg set are stored contiguously, this
+  // allows to decode the args of a set on demand without filtering the table.
+  std::pair<uint32_t, uint32_t> GetArgSetRows(ArgSetId arg_set_id) const {
+    if (arg_set_id == kInvalidArgSetId ||
+        arg_set_id >= arg_set_first_rows_.size()) {
+      return std::make_pair(0u, 0u);
+    }
+    uint32_t end = arg_set_id + 1 < arg_set_first_rows_.size()
+                       ? arg_set_first_rows_[arg_set_id + 1]
+                       : arg_table_.row_count();
+    return std::make_pair(arg_set_first_rows_[arg_set_id], end);
+  }
+
   const tables::RawTable& raw_table() const { return raw_table_; }
   tables::RawTable* mutable_raw_table() { return &raw_table_; }
 
@@ -636,24 +679,62 @@ class TraceStorage {
   // Returns (0, 0) if the trace is empty.
   std::pair<int64_t, int64_t> GetTraceTimestampBoundsNs() const;
 
+  // Compresses the integer columns of the tables whose size scales with the
+  // size of the trace (see Table::CompressStorage). Should be called once the
+  // trace is fully parsed.
+  void CompressEventTables();
+
+  // Moves the compressed integer columns of the tables which scale with the
+  // size of the trace to a temporary file which is memory mapped back (see
+  // Column::SpillStorage) until |max_bytes| of memory have been freed. The
+  // largest columns are spilled first. Returns the number of bytes of memory
+  // freed. Should be called after CompressEventTables().
+  uint64_t SpillEventTables(uint64_t max_bytes);
+
+  // Builds rank/select indexes for the tables which are most often looked up
+  // by row (e.g. when joining on the nullable columns of slices, threads and
+  // tracks); see Table::BuildRankSelectIndexes. Should be called once the
+  // trace is fully parsed.
+  void BuildRankSelectIndexes();
+
+  // Looks up the value of |key| in the arg set |arg_set_id|. The first call
+  // builds an index of the arg table on (arg_set_id, key), which is extended
+  // on the following calls if args were added in the meantime, so that
+  // lookups are O(1).
   util::Status ExtractArg(uint32_t arg_set_id,
                           const char* key,
-                          base::Optional<Variadic>* result) {
-    const auto& args = arg_table();
-    RowMap filtered = args.FilterToRowMap(
-        {args.arg_set_id().eq(arg_set_id), args.key().eq(key)});
-    if (filtered.empty()) {
-      *result = base::nullopt;
-      return util::OkStatus();
-    }
-    if (filtered.size() > 1) {
-      return util::ErrStatus(
-          "EXTRACT_ARG: received multiple args matching arg set id and key");
-    }
-    uint32_t idx = filtered.Get(0);
-    *result = GetArgValue(idx);
-    return util::OkStatus();
-  }
+                          base::Optional<Variadic>* result);
+
+  // Returns an index of the nesting of the slices of |slice_table()|, whose
+  // nodes are the rows of the table, to look up the descendants of a slice.
+  // The index is built by the first call and rebuilt if slices were added in
+  // the meantime (the parent of a slice never changes once it is inserted).
+  const NestedSetIndex& GetSliceNestingIndex();
+
+  // Adjacency index of the flow table, returned by GetFlowIndex(). The flows
+  // going out of the slice at row |r| of |slice_table()| are
+  // |out_flows[out_offsets[r]]| to |out_flows[out_offsets[r + 1] - 1]| and
+  // its incoming flows are laid out in the same way in |in_flows|. The flows
+  // of each slice are in increasing order of flow row.
+  struct FlowIndex {
+    struct Flow {
+      // The row of the flow in |flow_table()|.
+      uint32_t flow_row;
+      // The row in |slice_table()| of the slice at the other end of the flow.
+      uint32_t slice_row;
+    };
+
+    std::vector<uint32_t> out_offsets;
+    std::vector<Flow> out_flows;
+    std::vector<uint32_t> in_offsets;
+    std::vector<Flow> in_flows;
+  };
+
+  // Returns the adjacency index of the flows between the slices, to look up
+  // the flows of a slice in constant time. The index is built by the first
+  // call and rebuilt if slices or flows were added in the meantime (flows are
+  // never modified once they are inserted).
+  const FlowIndex& GetFlowIndex();
 
   Variadic GetArgValue(uint32_t row) const {
     Variadic v;
@@ -756,6 +837,32 @@ class TraceStorage {
   // Args for all other tables.
   tables::ArgTable arg_table_{&string_pool_, nullptr};
 
+  // The first row in |arg_table_| of each arg set, indexed by arg set id. The
+  // entry for kInvalidArgSetId is unused.
+  std::vector<uint32_t> arg_set_first_rows_ = std::vector<uint32_t>(1);
+
+  // Index of the arg table used by ExtractArg(): maps (arg_set_id, key) to
+  // the row holding the arg (or kMultipleArgRows). Only covers the first
+  // |arg_index_row_count_| rows of the table.
+  static constexpr uint32_t kMultipleArgRows =
+      std::numeric_limits<uint32_t>::max();
+  std::unordered_map<uint64_t, uint32_t> arg_index_;
+  std::atomic<uint32_t> arg_index_row_count_{0};
+
+  // Guards the lazily built indexes above and below (|arg_index_|,
+  // |slice_nesting_index_| and |flow_index_|), which can be requested
+  // concurrently by several query sessions once the trace is loaded.
+  std::mutex derived_index_mutex_;
+
+  // Index returned by GetSliceNestingIndex(); covers the first
+  // |slice_nesting_index_.size()| rows of |slice_table_|.
+  NestedSetIndex slice_nesting_index_;
+
+  // Index returned by GetFlowIndex(); covers the first
+  // |flow_index_flow_count_| rows of |flow_table_|.
+  FlowIndex flow_index_;
+  uint32_t flow_index_flow_count_ = 0;
+
   // Information about all the threads and processes in the trace.
   tables::ThreadTable thread_table_{&string_pool_, nullptr};
   tables::ProcessTable process_table_{&string_pool_, nullptr};
@@ -769,6 +876,13 @@ class TraceStorage {
   // Slices from CPU scheduling data.
   tables::SchedSliceTable sched_slice_table_{&string_pool_, nullptr};
 
+  // The states of threads (running, runnable, sleeping, ...) over time, derived
+  // from the sched slices and the sched_waking/sched_blocked_reason events.
+  tables::ThreadStateTable thread_state_table_{&string_pool_, nullptr};
+
+  // Syscalls, paired from the sys_enter and sys_exit ftrace events.
+  tables::SyscallTable syscall_table_{&string_pool_, nullptr};
+
   // Additional attributes for threads slices (sub-type of NestableSlices).
   tables::ThreadSliceTable thread_slice_table_{&string_pool_, &slice_table_};
 
@@ -803,6 +917,9 @@ class TraceStorage {
 
   tables::AndroidLogTable android_log_table_{&string_pool_, nullptr};
 
+  tables::BinderTransactionTable binder_transaction_table_{&string_pool_,
+                                                           nullptr};
+
   tables::StackProfileMappingTable stack_profile_mapping_table_{&string_pool_,
                                                                 nullptr};
   tables::StackProfileFrameTable stack_profile_frame_table_{&string_pool_,
@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_TABLES_ANDROID_TABLES_H_
 
 #include "src/trace_processor/tables/macros.h"
+#include "src/trace_processor/tables/slice_tables.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -45,6 +46,53 @@ namespace tables {
 
 PERFETTO_TP_TABLE(PERFETTO_TP_ANDROID_LOG_TABLE_DEF);
 
+// Binder transactions and replies, filled in as the binder ftrace events are
+// parsed. Each synchronous transaction is linked directly to its reply and
+// both are linked to their slices so latency queries don't need to match them
+// through the args of the slices.
+//
+// @param ts timestamp of the binder_transaction event.
+// @param transaction_id id of the transaction in the binder driver.
+// @param is_reply whether the transaction is the reply to another one.
+// @param is_oneway whether the transaction is one-way (i.e. asynchronous,
+//        without reply).
+// @param flags flags of the transaction.
+// @param code code of the transaction.
+// @param client_utid thread sending the transaction {@joinable thread.utid}.
+// @param dest_node binder node the transaction is sent to.
+// @param dest_tgid pid of the process the transaction is sent to.
+// @param server_utid thread receiving the transaction, null if it was not
+//        received in the trace {@joinable thread.utid}.
+// @param received_ts timestamp of the binder_transaction_received event,
+//        null if it was not received in the trace.
+// @param slice_id slice emitted for the transaction on the sending thread
+//        {@joinable slice.id}.
+// @param received_slice_id slice emitted for the transaction on the receiving
+//        thread {@joinable slice.id}.
+// @param reply_id the reply to the transaction, null for one-way transactions,
+//        replies and transactions not replied to in the trace
+//        {@joinable binder_txn.id}.
+// @tablegroup Events
+#define PERFETTO_TP_BINDER_TRANSACTION_TABLE_DEF(NAME, PARENT, C) \
+  NAME(BinderTransactionTable, "binder_txn")                      \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                               \
+  C(int64_t, ts, Column::Flag::kSorted)                           \
+  C(int64_t, transaction_id)                                      \
+  C(uint32_t, is_reply)                                           \
+  C(uint32_t, is_oneway)                                          \
+  C(uint32_t, flags)                                              \
+  C(StringPool::Id, code)                                         \
+  C(uint32_t, client_utid)                                        \
+  C(int64_t, dest_node)                                           \
+  C(int64_t, dest_tgid)                                           \
+  C(base::Optional<uint32_t>, server_utid)                        \
+  C(base::Optional<int64_t>, received_ts)                         \
+  C(base::Optional<SliceTable::Id>, slice_id)                     \
+  C(base::Optional<SliceTable::Id>, received_slice_id)            \
+  C(base::Optional<BinderTransactionTable::Id>, reply_id)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_BINDER_TRANSACTION_TABLE_DEF);
+
 }  // namespace tables
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -91,6 +91,27 @@ static void BM_TableInsert(benchmark::State& state) {
 }
 BENCHMARK(BM_TableInsert);
 
+static void BM_TableAppendColumns(benchmark::State& state) {
+  StringPool pool;
+  RootTestTable root(&pool, nullptr);
+
+  constexpr uint32_t kBatchSize = 1024;
+  std::vector<uint32_t> values(kBatchSize);
+  for (uint32_t i = 0; i < kBatchSize; ++i)
+    values[i] = i;
+  RootTestTable::ColumnSpans spans;
+  spans.root_sorted = values.data();
+  spans.root_non_null = values.data();
+  spans.root_non_null_2 = values.data();
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(root.AppendColumns(spans, kBatchSize));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          kBatchSize);
+}
+BENCHMARK(BM_TableAppendColumns);
+
 static void BM_TableIteratorChild(benchmark::State& state) {
   StringPool pool;
   RootTestTable root(&pool, nullptr);
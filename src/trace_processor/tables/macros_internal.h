@@ -49,6 +49,18 @@ class RootParentTable : public Table {
     uint32_t row;
   };
   IdAndRow Insert(const Row&) { PERFETTO_FATAL("Should not be called"); }
+
+  // Same as Row, for AppendColumns() below.
+  struct ColumnSpans {
+   public:
+    const char* type() const { return type_; }
+
+   protected:
+    const char* type_ = nullptr;
+  };
+  IdAndRow AppendColumns(const ColumnSpans&, uint32_t) {
+    PERFETTO_FATAL("Should not be called");
+  }
 };
 
 // IdHelper is used to figure out the Id type for a table.
@@ -120,6 +132,20 @@ class MacroTable : public Table {
     row_maps_.back().Insert(row_count_++);
   }
 
+  // Same as UpdateRowMapsAfterParentInsert() after |count| rows were
+  // appended at once.
+  void UpdateRowMapsAfterParentBulkInsert(uint32_t count) {
+    if (parent_ != nullptr) {
+      for (uint32_t i = 0; i < parent_->row_maps().size(); ++i) {
+        const RowMap& parent_rm = parent_->row_maps()[i];
+        for (uint32_t j = parent_rm.size() - count; j < parent_rm.size(); ++j)
+          row_maps_[i].Insert(parent_rm.Get(j));
+      }
+    }
+    row_maps_.back().InsertRange(row_count_, row_count_ + count);
+    row_count_ += count;
+  }
+
   // Stores the most specific "derived" type of this row in the table.
   //
   // For example, suppose a row is inserted into the gpu_slice table. This will
@@ -208,6 +234,20 @@ class MacroTable : public Table {
 #define PERFETTO_TP_ROW_EQUALS(type, name, ...) \
   TypedColumn<type>::Equals(other.name, name)&&
 
+// Defines the pointer to the values of a column in Table::ColumnSpans.
+#define PERFETTO_TP_COLUMN_SPAN_DEFINITION(type, name, ...) \
+  const type* name = nullptr;
+
+// Appends the values of a column in AppendColumns(), or default values if
+// they were not provided.
+#define PERFETTO_TP_COLUMN_APPEND_SPAN(type, name, ...) \
+  if (spans.name) {                                     \
+    mutable_##name()->AppendRange(spans.name, count);   \
+  } else {                                              \
+    for (uint32_t i = 0; i < count; ++i)                \
+      mutable_##name()->Append(type{});                 \
+  }
+
 // Defines the parent row field in Insert.
 #define PERFETTO_TP_PARENT_ROW_INSERT(type, name, ...) row.name,
 
@@ -351,6 +391,22 @@ class MacroTable : public Table {
       uint32_t row;                                                           \
     };                                                                        \
                                                                               \
+    /*                                                                        \
+     * The values of a batch of rows for AppendColumns(), one array per       \
+     * column. Columns left null are filled with default values.              \
+     */                                                                       \
+    struct ColumnSpans : parent_class_name::ColumnSpans {                     \
+      ColumnSpans() { type_ = table_name; }                                   \
+                                                                              \
+      /*                                                                      \
+       * Expands to                                                           \
+       * const col_type1* col1 = nullptr;                                     \
+       * const base::Optional<col_type2>* col2 = nullptr;                     \
+       * ...                                                                  \
+       */                                                                     \
+      PERFETTO_TP_TABLE_COLUMNS(DEF, PERFETTO_TP_COLUMN_SPAN_DEFINITION)      \
+    };                                                                        \
+                                                                              \
     class_name(StringPool* pool, parent_class_name* parent)                   \
         : macros_internal::MacroTable(table_name, pool, parent),              \
           parent_(parent) {                                                   \
@@ -393,6 +449,35 @@ class MacroTable : public Table {
       return {id, row_number};                                                \
     }                                                                         \
                                                                               \
+    /*                                                                        \
+     * Appends |count| rows whose values are given column by column. This is  \
+     * equivalent to (but much faster than) calling Insert() for each row.    \
+     * Returns the id and row number of the first row.                        \
+     */                                                                       \
+    IdAndRow AppendColumns(const ColumnSpans& spans, uint32_t count) {        \
+      PERFETTO_DCHECK(count > 0);                                             \
+      Id id;                                                                  \
+      uint32_t row_number = row_count();                                      \
+      if (parent_ == nullptr) {                                               \
+        id = Id{row_number};                                                  \
+        StringPool::Id type_id = string_pool_->InternString(spans.type());    \
+        for (uint32_t i = 0; i < count; ++i)                                  \
+          type_.Append(type_id);                                              \
+      } else {                                                                \
+        id = Id{parent_->AppendColumns(spans, count).id};                     \
+      }                                                                       \
+      UpdateRowMapsAfterParentBulkInsert(count);                              \
+                                                                              \
+      /*                                                                      \
+       * Expands to                                                           \
+       * col1_.AppendRange(spans.col1, count);                                \
+       * col2_.AppendRange(spans.col2, count);                                \
+       * ...                                                                  \
+       */                                                                     \
+      PERFETTO_TP_TABLE_COLUMNS(DEF, PERFETTO_TP_COLUMN_APPEND_SPAN);         \
+      return {id, row_number};                                                \
+    }                                                                         \
+                                                                              \
     const IdColumn<Id>& id() const {                                          \
       return static_cast<const IdColumn<Id>&>(                                \
           columns_[static_cast<uint32_t>(ColumnIndex::id)]);                  \
@@ -51,10 +51,18 @@ PERFETTO_TP_TABLE(PERFETTO_TP_TEST_SLICE_TABLE_DEF);
   C(StringPool::Id, end_state)
 PERFETTO_TP_TABLE(PERFETTO_TP_TEST_CPU_SLICE_TABLE_DEF);
 
+#define PERFETTO_TP_TEST_DENSE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(TestDenseTable, "dense")                           \
+  PARENT(PERFETTO_TP_ROOT_TABLE_PARENT_DEF, C)            \
+  C(base::Optional<int64_t>, value, Column::Flag::kDense) \
+  C(base::Optional<double>, fraction, Column::Flag::kDense)
+PERFETTO_TP_TABLE(PERFETTO_TP_TEST_DENSE_TABLE_DEF);
+
 TestEventTable::~TestEventTable() = default;
 TestCounterTable::~TestCounterTable() = default;
 TestSliceTable::~TestSliceTable() = default;
 TestCpuSliceTable::~TestCpuSliceTable() = default;
+TestDenseTable::~TestDenseTable() = default;
 
 class TableMacrosUnittest : public ::testing::Test {
  protected:
@@ -134,6 +142,52 @@ TEST_F(TableMacrosUnittest, InsertChild) {
   ASSERT_EQ(cpu_slice_.end_state().GetString(0), "R");
 }
 
+TEST_F(TableMacrosUnittest, AppendColumns) {
+  event_.Insert(TestEventTable::Row(100, 0));
+  cpu_slice_.Insert(TestCpuSliceTable::Row(150, 1, 5, 0, 1, 1));
+
+  auto reason = pool_.InternString("R");
+  int64_t ts[] = {200, 210, 220};
+  base::Optional<int64_t> dur[] = {10, base::nullopt, 30};
+  int64_t cpu[] = {3, 4, 5};
+  StringPool::Id end_state[] = {reason, reason, StringPool::Id::Null()};
+
+  TestCpuSliceTable::ColumnSpans spans;
+  spans.ts = ts;
+  spans.dur = dur;
+  spans.cpu = cpu;
+  spans.end_state = end_state;
+  auto id_and_row = cpu_slice_.AppendColumns(spans, 3);
+  ASSERT_EQ(id_and_row.id.value, 2u);
+  ASSERT_EQ(id_and_row.row, 1u);
+
+  ASSERT_EQ(event_.row_count(), 5u);
+  ASSERT_EQ(slice_.row_count(), 4u);
+  ASSERT_EQ(cpu_slice_.row_count(), 4u);
+  for (uint32_t i = 0; i < 3; ++i) {
+    ASSERT_EQ(event_.type().GetString(2 + i), "cpu_slice");
+    ASSERT_EQ(event_.ts()[2 + i], ts[i]);
+    ASSERT_EQ(slice_.ts()[1 + i], ts[i]);
+    ASSERT_EQ(cpu_slice_.id()[1 + i].value, 2 + i);
+    ASSERT_EQ(cpu_slice_.ts()[1 + i], ts[i]);
+    ASSERT_EQ(cpu_slice_.dur()[1 + i], dur[i]);
+    ASSERT_EQ(cpu_slice_.cpu()[1 + i], cpu[i]);
+    ASSERT_EQ(cpu_slice_.end_state()[1 + i], end_state[i]);
+
+    // Columns without values are filled with defaults.
+    ASSERT_EQ(cpu_slice_.arg_set_id()[1 + i], 0);
+    ASSERT_EQ(cpu_slice_.depth()[1 + i], 0);
+    ASSERT_EQ(cpu_slice_.priority()[1 + i], 0);
+  }
+
+  // The table can still be filtered and inserted into as usual.
+  ASSERT_EQ(cpu_slice_.Filter({cpu_slice_.dur().is_null()}).row_count(), 1u);
+  ASSERT_EQ(cpu_slice_.Filter({cpu_slice_.ts().ge(210)}).row_count(), 2u);
+  auto id = cpu_slice_.Insert(TestCpuSliceTable::Row(300, 0, 5, 0, 6, 1)).id;
+  ASSERT_EQ(id.value, 5u);
+  ASSERT_EQ(cpu_slice_.cpu()[4], 6);
+}
+
 TEST_F(TableMacrosUnittest, NullableLongComparision) {
   slice_.Insert({});
 
@@ -426,6 +480,222 @@ TEST_F(TableMacrosUnittest, FilterIdThenOther) {
   ASSERT_STREQ(end_state->Get(0).string_value, "D");
 }
 
+TEST_F(TableMacrosUnittest, FilterEqUnsortedColumn) {
+  // Insert enough rows for the equality index to be used, interleaving events
+  // and slices so the columns of |slice_| are backed by a BitVector RowMap.
+  constexpr uint32_t kRows = 4096;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    int64_t arg_set_id = i % 16;
+    if (i % 2 == 0) {
+      event_.Insert(TestEventTable::Row(i, arg_set_id));
+    } else {
+      slice_.Insert(TestSliceTable::Row(i, arg_set_id, 10, 0));
+    }
+  }
+
+  Table out = event_.Filter({event_.arg_set_id().eq(3)});
+  ASSERT_EQ(out.row_count(), kRows / 16);
+  for (uint32_t i = 0; i < out.row_count(); ++i) {
+    ASSERT_EQ(out.GetColumnByName("arg_set_id")->Get(i).long_value, 3);
+    ASSERT_EQ(out.GetColumnByName("ts")->Get(i).long_value, 3 + 16 * i);
+  }
+
+  out = slice_.Filter({slice_.arg_set_id().eq(3)});
+  ASSERT_EQ(out.row_count(), kRows / 16);
+  for (uint32_t i = 0; i < out.row_count(); ++i)
+    ASSERT_EQ(out.GetColumnByName("ts")->Get(i).long_value, 3 + 16 * i);
+
+  // Values with no rows and values of the wrong type should match nothing.
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().eq(100)}).row_count(), 0u);
+  ASSERT_EQ(
+      event_.Filter({event_.arg_set_id().eq_value(SqlValue::Double(3.5))})
+          .row_count(),
+      0u);
+
+  // Combining with a previous constraint should intersect the rows.
+  out = event_.Filter({event_.ts().ge(2048), event_.arg_set_id().eq(3)});
+  ASSERT_EQ(out.row_count(), kRows / 32);
+  ASSERT_EQ(out.GetColumnByName("ts")->Get(0).long_value, 2051);
+
+  // Changing a value should be reflected in the next filter.
+  event_.mutable_arg_set_id()->Set(3, 100);
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().eq(3)}).row_count(),
+            kRows / 16 - 1);
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().eq(100)}).row_count(), 1u);
+
+  // As should adding new rows.
+  event_.Insert(TestEventTable::Row(kRows, 3));
+  slice_.Insert(TestSliceTable::Row(kRows + 1, 3, 10, 0));
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().eq(3)}).row_count(),
+            kRows / 16 + 1);
+  // The row changed above is also a slice so the count is exactly kRows / 16.
+  ASSERT_EQ(slice_.Filter({slice_.arg_set_id().eq(3)}).row_count(),
+            kRows / 16);
+}
+
+TEST_F(TableMacrosUnittest, FilterEqUnsortedStringColumn) {
+  constexpr uint32_t kRows = 4096;
+  StringPool::Id states[] = {pool_.InternString("R"), pool_.InternString("S"),
+                             StringPool::Id::Null()};
+  for (uint32_t i = 0; i < kRows; ++i) {
+    TestCpuSliceTable::Row row;
+    row.end_state = states[i % 3];
+    cpu_slice_.Insert(row);
+  }
+
+  Table out = cpu_slice_.Filter({cpu_slice_.end_state().eq("S")});
+  ASSERT_EQ(out.row_count(), kRows / 3);
+  for (uint32_t i = 0; i < out.row_count(); ++i)
+    ASSERT_STREQ(out.GetColumnByName("end_state")->Get(i).string_value, "S");
+
+  // A string which was never interned cannot be in the column.
+  ASSERT_EQ(cpu_slice_.Filter({cpu_slice_.end_state().eq("D")}).row_count(),
+            0u);
+}
+
+TEST_F(TableMacrosUnittest, FilterStringColumnDictionary) {
+  constexpr uint32_t kRows = 4000;
+  StringPool::Id states[] = {pool_.InternString("D"), pool_.InternString("R"),
+                             pool_.InternString("S"), StringPool::Id::Null()};
+  for (uint32_t i = 0; i < kRows; ++i) {
+    TestCpuSliceTable::Row row;
+    row.cpu = i % 2;
+    row.end_state = states[i % 4];
+    cpu_slice_.Insert(row);
+  }
+
+  const auto& end_state = cpu_slice_.end_state();
+  ASSERT_EQ(cpu_slice_.Filter({end_state.lt("R")}).row_count(), kRows / 4);
+  ASSERT_EQ(cpu_slice_.Filter({end_state.le("R")}).row_count(), kRows / 2);
+  ASSERT_EQ(cpu_slice_.Filter({end_state.gt("R")}).row_count(), kRows / 4);
+  ASSERT_EQ(cpu_slice_.Filter({end_state.ge("Q")}).row_count(), kRows / 2);
+
+  // Nulls should never match.
+  ASSERT_EQ(cpu_slice_.Filter({end_state.ne("R")}).row_count(), kRows / 2);
+
+  // Combining with other constraints should also work.
+  Table out = cpu_slice_.Filter({cpu_slice_.cpu().eq(1), end_state.ne("D")});
+  ASSERT_EQ(out.row_count(), kRows / 4);
+  for (uint32_t i = 0; i < out.row_count(); ++i)
+    ASSERT_STREQ(out.GetColumnByName("end_state")->Get(i).string_value, "R");
+
+  // Changing a value should be taken into account.
+  cpu_slice_.mutable_end_state()->Set(0, states[1]);
+  ASSERT_EQ(cpu_slice_.Filter({end_state.lt("R")}).row_count(),
+            kRows / 4 - 1);
+}
+
+TEST_F(TableMacrosUnittest, FilterStringColumnGlob) {
+  StringPool::Id names[] = {
+      pool_.InternString("binder transaction"),
+      pool_.InternString("binder reply"), pool_.InternString("Choreographer"),
+      StringPool::Id::Null()};
+  const auto& end_state = cpu_slice_.end_state();
+  auto glob = [&end_state](const char* pattern) {
+    return end_state.glob_value(SqlValue::String(pattern));
+  };
+
+  // With only a few rows, the pattern is matched against every row.
+  for (uint32_t i = 0; i < 8; ++i) {
+    TestCpuSliceTable::Row row;
+    row.end_state = names[i % 4];
+    cpu_slice_.Insert(row);
+  }
+  ASSERT_EQ(cpu_slice_.Filter({glob("binder*")}).row_count(), 4u);
+  ASSERT_EQ(cpu_slice_.Filter({glob("*re*")}).row_count(), 4u);
+  ASSERT_EQ(cpu_slice_.Filter({glob("*")}).row_count(), 6u);
+
+  // With many rows per string, the pattern is matched once per string.
+  constexpr uint32_t kRows = 4000;
+  for (uint32_t i = 8; i < kRows; ++i) {
+    TestCpuSliceTable::Row row;
+    row.end_state = names[i % 4];
+    cpu_slice_.Insert(row);
+  }
+  ASSERT_EQ(cpu_slice_.Filter({glob("binder*")}).row_count(), kRows / 2);
+  ASSERT_EQ(cpu_slice_.Filter({glob("*re*")}).row_count(), kRows / 2);
+  ASSERT_EQ(cpu_slice_.Filter({glob("[A-Z]*")}).row_count(), kRows / 4);
+  ASSERT_EQ(cpu_slice_.Filter({glob("binder")}).row_count(), 0u);
+
+  // Nulls should never match.
+  ASSERT_EQ(cpu_slice_.Filter({glob("*")}).row_count(), kRows / 4 * 3);
+}
+
+TEST_F(TableMacrosUnittest, FilterNumericBatches) {
+  // Use a row count which is not a multiple of the batch size to also check
+  // the handling of the last partial batch.
+  constexpr uint32_t kRows = 10001;
+  for (uint32_t i = 0; i < kRows; ++i)
+    event_.Insert(TestEventTable::Row(i, (i * 7919) % kRows));
+
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().lt(100)}).row_count(), 100u);
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().gt(100)}).row_count(),
+            kRows - 101);
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().le(100)}).row_count(), 101u);
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().ge(100)}).row_count(),
+            kRows - 100);
+  ASSERT_EQ(event_.Filter({event_.arg_set_id().ne(100)}).row_count(),
+            kRows - 1);
+
+  // As 7919 is coprime with |kRows|, every value in [0, kRows) appears once.
+  Table out = event_.Filter({event_.arg_set_id().lt(5000)});
+  ASSERT_EQ(out.row_count(), 5000u);
+  const auto* arg_set_id = out.GetColumnByName("arg_set_id");
+  for (uint32_t i = 0; i < out.row_count(); ++i)
+    ASSERT_LT(arg_set_id->Get(i).long_value, 5000);
+}
+
+TEST_F(TableMacrosUnittest, FilterNullableNumericBatches) {
+  constexpr uint32_t kRows = 5000;
+  TestDenseTable table{&pool_, nullptr};
+  for (uint32_t i = 0; i < kRows; ++i) {
+    TestDenseTable::Row row;
+    if (i % 5 != 0) {
+      row.value = i;
+      row.fraction = i * 0.5;
+    }
+    table.Insert(row);
+  }
+
+  // Every fifth row is null and nulls should never match.
+  ASSERT_EQ(table.Filter({table.value().lt(1000)}).row_count(), 800u);
+  ASSERT_EQ(table.Filter({table.value().ge(4000)}).row_count(), 800u);
+  ASSERT_EQ(table.Filter({table.value().ne(7)}).row_count(), 3999u);
+  ASSERT_EQ(table.Filter({table.fraction().gt(100.0)}).row_count(), 3840u);
+  ASSERT_EQ(table.Filter({table.fraction().le(0.5)}).row_count(), 1u);
+
+  // Comparing against a value of a different type should still work.
+  ASSERT_EQ(table.Filter({table.value().lt_value(SqlValue::Double(999.5))})
+                .row_count(),
+            800u);
+}
+
+TEST_F(TableMacrosUnittest, FilterCompressedTable) {
+  constexpr uint32_t kRows = 5000;
+  TestDenseTable table{&pool_, nullptr};
+  for (uint32_t i = 0; i < kRows; ++i) {
+    TestDenseTable::Row row;
+    if (i % 5 != 0)
+      row.value = i;
+    table.Insert(row);
+  }
+  table.CompressStorage();
+
+  ASSERT_EQ(table.value()[1], 1);
+  ASSERT_EQ(table.value()[4999], 4999);
+  ASSERT_EQ(table.value()[5], base::nullopt);
+
+  // Filtering should give the same results as on an uncompressed table.
+  ASSERT_EQ(table.Filter({table.value().lt(1000)}).row_count(), 800u);
+  ASSERT_EQ(table.Filter({table.value().ge(4000)}).row_count(), 800u);
+  ASSERT_EQ(table.Filter({table.value().eq(4001)}).row_count(), 1u);
+
+  // Modifying the table should still work.
+  table.mutable_value()->Set(5, 4001);
+  ASSERT_EQ(table.Filter({table.value().eq(4001)}).row_count(), 2u);
+  ASSERT_EQ(table.value()[4999], 4999);
+}
+
 TEST_F(TableMacrosUnittest, Sort) {
   ASSERT_TRUE(event_.ts().IsSorted());
 
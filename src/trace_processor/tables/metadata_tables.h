@@ -135,6 +135,60 @@ PERFETTO_TP_TABLE(PERFETTO_TP_CPU_FREQ_TABLE_DEF);
 
 PERFETTO_TP_TABLE(PERFETTO_TP_CLOCK_SNAPSHOT_TABLE_DEF);
 
+// The memory used by the tables, the string pool and the sorter of trace
+// processor, as returned by the memory_usage table. The storage of the
+// columns which are shared with a parent table is only accounted for in the
+// parent table.
+//
+// @param category the kind of memory: 'column' (the values of a column),
+//        'column_index' (the equality index of a column), 'row_maps' (the
+//        RowMaps selecting the rows of a table from its storage),
+//        'string_pool' or 'sorter'.
+// @param name the name of the table, or the part of the string pool or sorter.
+// @param detail the name of the column, if any.
+// @param size_bytes the number of bytes of memory used.
+#define PERFETTO_TP_MEMORY_USAGE_TABLE_DEF(NAME, PARENT, C) \
+  NAME(MemoryUsageTable, "memory_usage")                    \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                         \
+  C(StringPool::Id, category)                               \
+  C(StringPool::Id, name)                                   \
+  C(base::Optional<StringPool::Id>, detail)                 \
+  C(int64_t, size_bytes)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_MEMORY_USAGE_TABLE_DEF);
+
+// The result of the experimental_window_function table function: a window
+// function computed over a column of another table, like
+// |function_name(value_column) OVER (PARTITION BY partition_column ORDER BY
+// order_column)| in SQL but without going through SQLite. The rows are in the
+// order of the rows of the source table and, besides the columns below, there
+// is a |value| column with the result of the function.
+//
+// @param source_id the id of the row of |source_table|.
+// @param source_table the name of the table (e.g. 'counter' or 'sched_slice').
+// @param function_name one of 'lag', 'lead', 'row_number', 'running_sum',
+//        'running_min' or 'running_max'. E.g. the next timestamp of each row
+//        of its track is |lead| of the ts column partitioned by track_id.
+// @param value_column the column the function is computed on.
+// @param partition_column an integer or string column partitioning the rows.
+//        Optional: if null or empty, all the rows are in the same partition.
+// @param order_column an integer column ordering the rows in each
+//        partition. Optional: if null or empty, the rows are in the order of
+//        the table.
+// @param function_offset the offset of 'lag' and 'lead'. Optional: 1 if null.
+#define PERFETTO_TP_EXPERIMENTAL_WINDOW_FUNCTION_TABLE_DEF(NAME, PARENT, C) \
+  NAME(ExperimentalWindowFunctionTable, "experimental_window_function")     \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                                         \
+  C(int64_t, source_id)                                                     \
+  C(StringPool::Id, source_table, Column::Flag::kHidden)                    \
+  C(StringPool::Id, function_name, Column::Flag::kHidden)                   \
+  C(StringPool::Id, value_column, Column::Flag::kHidden)                    \
+  C(base::Optional<StringPool::Id>, partition_column, Column::Flag::kHidden) \
+  C(base::Optional<StringPool::Id>, order_column, Column::Flag::kHidden)    \
+  C(base::Optional<int64_t>, function_offset, Column::Flag::kHidden)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_EXPERIMENTAL_WINDOW_FUNCTION_TABLE_DEF);
+
 }  // namespace tables
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -328,6 +328,15 @@ PERFETTO_TP_TABLE(PERFETTO_TP_HEAP_GRAPH_CLASS_DEF);
 // false, this object is uncollected garbage.
 // @param type_id class this object is an instance of.
 // @param root_type if not NULL, this object is a GC root.
+// @param dominator_id the immediate dominator of this object: the object
+// closest to it through which all the paths from the GC roots to it go. NULL
+// if the object is not reachable or if it is reachable from several GC roots
+// without any common object. {@joinable heap_graph_object.id}
+// @param retained_size the sum of the self_size of the objects dominated by
+// this object (including itself), i.e. the memory which would be freed if this
+// object was collected. NULL if the object is not reachable.
+// @param retained_count the number of objects dominated by this object
+// (including itself). NULL if the object is not reachable.
 // @tablegroup ART Heap Graphs
 #define PERFETTO_TP_HEAP_GRAPH_OBJECT_DEF(NAME, PARENT, C)            \
   NAME(HeapGraphObjectTable, "heap_graph_object")                     \
@@ -339,7 +348,10 @@ PERFETTO_TP_TABLE(PERFETTO_TP_HEAP_GRAPH_CLASS_DEF);
   C(int32_t, reachable)                                               \
   C(HeapGraphClassTable::Id, type_id)                                 \
   C(base::Optional<StringPool::Id>, root_type)                        \
-  C(int32_t, root_distance, Column::Flag::kHidden)
+  C(int32_t, root_distance, Column::Flag::kHidden)                    \
+  C(base::Optional<uint32_t>, dominator_id, Column::Flag::kDense)     \
+  C(base::Optional<int64_t>, retained_size, Column::Flag::kDense)     \
+  C(base::Optional<int64_t>, retained_count, Column::Flag::kDense)
 
 PERFETTO_TP_TABLE(PERFETTO_TP_HEAP_GRAPH_OBJECT_DEF);
 
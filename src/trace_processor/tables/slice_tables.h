@@ -76,11 +76,14 @@ PERFETTO_TP_TABLE(PERFETTO_TP_INSTANT_TABLE_DEF);
 PERFETTO_TP_TABLE(PERFETTO_TP_SCHED_SLICE_TABLE_DEF);
 
 // @tablegroup Events
+// @param ts timestamp of the start of the state (in nanoseconds)
+// @param dur duration of the state (in nanoseconds), -1 if the thread is still
+//        in this state at the end of the trace
 // @param utid {@joinable thread.utid}
 #define PERFETTO_TP_THREAD_STATE_TABLE_DEF(NAME, PARENT, C) \
   NAME(ThreadStateTable, "thread_state")                    \
   PERFETTO_TP_ROOT_TABLE(PARENT, C)                         \
-  C(int64_t, ts)                                            \
+  C(int64_t, ts, Column::Flag::kSorted)                     \
   C(int64_t, dur)                                           \
   C(base::Optional<uint32_t>, cpu)                          \
   C(uint32_t, utid)                                         \
@@ -90,6 +93,30 @@ PERFETTO_TP_TABLE(PERFETTO_TP_SCHED_SLICE_TABLE_DEF);
 
 PERFETTO_TP_TABLE(PERFETTO_TP_THREAD_STATE_TABLE_DEF);
 
+// Syscalls made by threads, paired from the sys_enter and sys_exit ftrace
+// events.
+//
+// @tablegroup Events
+// @param ts timestamp of the sys_enter event (in nanoseconds)
+// @param dur duration of the syscall (in nanoseconds), -1 if it did not
+//        return before the end of the trace
+// @param utid thread making the syscall {@joinable thread.utid}
+// @param nr number of the syscall, which depends on the architecture
+// @param name name of the syscall (e.g. "sys_read")
+// @param ret value returned by the syscall, null if it did not return before
+//        the end of the trace
+#define PERFETTO_TP_SYSCALL_TABLE_DEF(NAME, PARENT, C) \
+  NAME(SyscallTable, "syscall")                        \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                    \
+  C(int64_t, ts, Column::Flag::kSorted)                \
+  C(int64_t, dur)                                      \
+  C(uint32_t, utid)                                    \
+  C(uint32_t, nr)                                      \
+  C(StringPool::Id, name)                              \
+  C(base::Optional<int64_t>, ret)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_SYSCALL_TABLE_DEF);
+
 // @tablegroup Events
 #define PERFETTO_TP_GPU_SLICES_DEF(NAME, PARENT, C) \
   NAME(GpuSliceTable, "gpu_slice")                  \
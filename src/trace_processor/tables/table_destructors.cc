@@ -33,6 +33,7 @@ MacroTable::~MacroTable() = default;
 namespace tables {
 // android_tables.h
 AndroidLogTable::~AndroidLogTable() = default;
+BinderTransactionTable::~BinderTransactionTable() = default;
 
 // counter_tables.h
 CounterTable::~CounterTable() = default;
@@ -46,6 +47,9 @@ CpuFreqTable::~CpuFreqTable() = default;
 ThreadTable::~ThreadTable() = default;
 ProcessTable::~ProcessTable() = default;
 ClockSnapshotTable::~ClockSnapshotTable() = default;
+MemoryUsageTable::~MemoryUsageTable() = default;
+ExperimentalWindowFunctionTable::~ExperimentalWindowFunctionTable() =
+    default;
 
 // profiler_tables.h
 StackProfileMappingTable::~StackProfileMappingTable() = default;
@@ -75,6 +79,7 @@ GpuSliceTable::~GpuSliceTable() = default;
 GraphicsFrameSliceTable::~GraphicsFrameSliceTable() = default;
 DescribeSliceTable::~DescribeSliceTable() = default;
 ThreadStateTable::~ThreadStateTable() = default;
+SyscallTable::~SyscallTable() = default;
 ExpectedFrameTimelineSliceTable::~ExpectedFrameTimelineSliceTable() = default;
 ActualFrameTimelineSliceTable::~ActualFrameTimelineSliceTable() = default;
 ExperimentalFlatSliceTable::~ExperimentalFlatSliceTable() = default;
@@ -92,6 +97,7 @@ IrqCounterTrackTable::~IrqCounterTrackTable() = default;
 SoftirqCounterTrackTable::~SoftirqCounterTrackTable() = default;
 GpuCounterTrackTable::~GpuCounterTrackTable() = default;
 PerfCounterTrackTable::~PerfCounterTrackTable() = default;
+ExperimentalTrackSummaryTable::~ExperimentalTrackSummaryTable() = default;
 
 // memory_tables.h
 MemorySnapshotTable::~MemorySnapshotTable() = default;
@@ -133,6 +133,31 @@ PERFETTO_TP_TABLE(PERFETTO_TP_GPU_COUNTER_TRACK_DEF);
 
 PERFETTO_TP_TABLE(PERFETTO_TP_PERF_COUNTER_TRACK_DEF);
 
+// Buckets of the events of a track, as returned by the
+// experimental_track_summary table function.
+//
+// @param ts the start of the bucket.
+// @param dur the duration of the bucket.
+// @param event_count the number of events starting in the bucket.
+// @param min_value the minimum value of the events starting in the bucket.
+// @param max_value the maximum value of the events starting in the bucket.
+// @param sum_value the sum of the values of the events starting in the bucket.
+#define PERFETTO_TP_EXPERIMENTAL_TRACK_SUMMARY_DEF(NAME, PARENT, C) \
+  NAME(ExperimentalTrackSummaryTable, "experimental_track_summary") \
+  PERFETTO_TP_ROOT_TABLE(PARENT, C)                                 \
+  C(int64_t, ts)                                                    \
+  C(int64_t, dur)                                                   \
+  C(uint32_t, event_count)                                          \
+  C(double, min_value)                                              \
+  C(double, max_value)                                              \
+  C(double, sum_value)                                              \
+  C(TrackTable::Id, track_id, Column::Flag::kHidden)                \
+  C(int64_t, start_bound, Column::Flag::kHidden)                    \
+  C(int64_t, end_bound, Column::Flag::kHidden)                      \
+  C(uint32_t, bucket_count, Column::Flag::kHidden)
+
+PERFETTO_TP_TABLE(PERFETTO_TP_EXPERIMENTAL_TRACK_SUMMARY_DEF);
+
 }  // namespace tables
 }  // namespace trace_processor
 }  // namespace perfetto
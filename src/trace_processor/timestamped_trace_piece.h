@@ -19,8 +19,10 @@
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/arena.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_record.h"
 #include "src/trace_processor/importers/json/json_utils.h"
+#include "src/trace_processor/importers/proto/proto_importer_module.h"
 #include "src/trace_processor/importers/proto/packet_sequence_state.h"
 #include "src/trace_processor/importers/systrace/systrace_line.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -74,6 +76,27 @@ struct TrackEventData : public TracePacketData {
   base::Optional<int64_t> thread_instruction_count;
   double counter_value = 0;
   std::array<double, kMaxNumExtraCounters> extra_counter_values = {};
+
+  // Set if the name and category of the event were interned ahead of parsing
+  // by TrackEventParser::PrepareTrackEvent().
+  bool prepared = false;
+  StringId name_id = kNullStringId;
+  StringId category_id = kNullStringId;
+};
+
+// A TracePacket pushed by |module| which can be decoded ahead of parsing, see
+// ProtoImporterModule::PreparePacket().
+struct PreparablePacketData : public TracePacketData {
+  PreparablePacketData(
+      TraceBlobView pv,
+      std::shared_ptr<PacketSequenceStateGeneration> generation,
+      const ProtoImporterModule* m)
+      : TracePacketData{std::move(pv), std::move(generation)}, module(m) {}
+
+  const ProtoImporterModule* module;
+
+  // Set if the packet was prepared ahead of parsing.
+  std::unique_ptr<PreparedPacket> prepared;
 };
 
 // A TimestampedTracePiece is (usually a reference to) a piece of a trace that
@@ -89,6 +112,7 @@ struct TimestampedTracePiece {
     kFuchsiaRecord,
     kTrackEvent,
     kSystraceLine,
+    kPreparablePacket,
   };
 
   TimestampedTracePiece(
@@ -115,7 +139,7 @@ struct TimestampedTracePiece {
 
   TimestampedTracePiece(int64_t ts,
                         uint64_t idx,
-                        std::unique_ptr<FuchsiaRecord> fr)
+                        ArenaPtr<FuchsiaRecord> fr)
       : fuchsia_record(std::move(fr)),
         timestamp(ts),
         packet_idx(idx),
@@ -123,7 +147,7 @@ struct TimestampedTracePiece {
 
   TimestampedTracePiece(int64_t ts,
                         uint64_t idx,
-                        std::unique_ptr<TrackEventData> ted)
+                        ArenaPtr<TrackEventData> ted)
       : track_event_data(std::move(ted)),
         timestamp(ts),
         packet_idx(idx),
@@ -131,12 +155,20 @@ struct TimestampedTracePiece {
 
   TimestampedTracePiece(int64_t ts,
                         uint64_t idx,
-                        std::unique_ptr<SystraceLine> ted)
+                        ArenaPtr<SystraceLine> ted)
       : systrace_line(std::move(ted)),
         timestamp(ts),
         packet_idx(idx),
         type(Type::kSystraceLine) {}
 
+  TimestampedTracePiece(int64_t ts,
+                        uint64_t idx,
+                        ArenaPtr<PreparablePacketData> ppd)
+      : preparable_packet(std::move(ppd)),
+        timestamp(ts),
+        packet_idx(idx),
+        type(Type::kPreparablePacket) {}
+
   TimestampedTracePiece(int64_t ts, uint64_t idx, InlineSchedSwitch iss)
       : sched_switch(std::move(iss)),
         timestamp(ts),
@@ -173,15 +205,20 @@ struct TimestampedTracePiece {
         break;
       case Type::kFuchsiaRecord:
         new (&fuchsia_record)
-            std::unique_ptr<FuchsiaRecord>(std::move(ttp.fuchsia_record));
+            ArenaPtr<FuchsiaRecord>(std::move(ttp.fuchsia_record));
         break;
       case Type::kTrackEvent:
         new (&track_event_data)
-            std::unique_ptr<TrackEventData>(std::move(ttp.track_event_data));
+            ArenaPtr<TrackEventData>(std::move(ttp.track_event_data));
         break;
       case Type::kSystraceLine:
         new (&systrace_line)
-            std::unique_ptr<SystraceLine>(std::move(ttp.systrace_line));
+            ArenaPtr<SystraceLine>(std::move(ttp.systrace_line));
+        break;
+      case Type::kPreparablePacket:
+        new (&preparable_packet)
+            ArenaPtr<PreparablePacketData>(std::move(ttp.preparable_packet));
+        break;
     }
     timestamp = ttp.timestamp;
     packet_idx = ttp.packet_idx;
@@ -228,6 +265,9 @@ struct TimestampedTracePiece {
       case Type::kSystraceLine:
         systrace_line.~unique_ptr();
         break;
+      case Type::kPreparablePacket:
+        preparable_packet.~unique_ptr();
+        break;
     }
   }
 
@@ -251,9 +291,10 @@ struct TimestampedTracePiece {
     InlineSchedSwitch sched_switch;
     InlineSchedWaking sched_waking;
     std::string json_value;
-    std::unique_ptr<FuchsiaRecord> fuchsia_record;
-    std::unique_ptr<TrackEventData> track_event_data;
-    std::unique_ptr<SystraceLine> systrace_line;
+    ArenaPtr<FuchsiaRecord> fuchsia_record;
+    ArenaPtr<TrackEventData> track_event_data;
+    ArenaPtr<SystraceLine> systrace_line;
+    ArenaPtr<PreparablePacketData> preparable_packet;
   };
 
   int64_t timestamp;
@@ -16,8 +16,11 @@
 
 #include <algorithm>
 #include <map>
+#include <memory>
 #include <random>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/optional.h"
@@ -124,6 +127,42 @@ TEST_F(TraceProcessorIntegrationTest, AndroidSchedAndPs) {
   ASSERT_FALSE(it.Next());
 }
 
+// Same as above but the trace is passed as slices of a single buffer which
+// trace processor retains instead of copying.
+TEST_F(TraceProcessorIntegrationTest, AndroidSchedAndPsSharedBuffer) {
+  base::ScopedFstream f(fopen(
+      base::GetTestDataPath("test/data/android_sched_and_ps.pb").c_str(),
+      "rb"));
+  std::vector<uint8_t> raw;
+  while (!feof(*f)) {
+    uint8_t buf[4096];
+    auto rsize = fread(reinterpret_cast<char*>(buf), 1, sizeof(buf), *f);
+    raw.insert(raw.end(), buf, buf + rsize);
+  }
+  std::shared_ptr<std::vector<uint8_t>> whole(
+      new std::vector<uint8_t>(std::move(raw)));
+
+  std::minstd_rand0 rnd_engine(0);
+  std::uniform_int_distribution<size_t> dist(512, kMaxChunkSize);
+  for (size_t off = 0; off < whole->size();) {
+    size_t chunk_size = std::min(dist(rnd_engine), whole->size() - off);
+    std::shared_ptr<const uint8_t> chunk(whole, whole->data() + off);
+    ASSERT_TRUE(Processor()->ParseShared(std::move(chunk), chunk_size).ok());
+    off += chunk_size;
+  }
+  Processor()->NotifyEndOfFile();
+
+  auto it = Query(
+      "select count(*), max(ts) - min(ts) from sched "
+      "where dur != 0 and utid != 0");
+  ASSERT_TRUE(it.Next());
+  ASSERT_EQ(it.Get(0).type, SqlValue::kLong);
+  ASSERT_EQ(it.Get(0).long_value, 139787);
+  ASSERT_EQ(it.Get(1).type, SqlValue::kLong);
+  ASSERT_EQ(it.Get(1).long_value, 19684308497);
+  ASSERT_FALSE(it.Next());
+}
+
 TEST_F(TraceProcessorIntegrationTest, TraceBounds) {
   ASSERT_TRUE(LoadTrace("android_sched_and_ps.pb").ok());
   auto it = Query("select start_ts, end_ts from trace_bounds");
@@ -379,6 +418,55 @@ TEST_F(TraceProcessorIntegrationTest, RestoreInitialTables) {
   }
 }
 
+TEST_F(TraceProcessorIntegrationTest, QuerySessions) {
+  std::string json = "[";
+  for (int i = 0; i < 1000; i++) {
+    json += (i ? "," : "") + std::string("{\"ph\":\"X\",\"name\":\"s\",") +
+            "\"pid\":1,\"tid\":" + std::to_string(i % 10) +
+            ",\"ts\":" + std::to_string(i * 10) + ",\"dur\":5}";
+  }
+  json += "]";
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[json.size()]);
+  memcpy(buf.get(), json.data(), json.size());
+  ASSERT_TRUE(Processor()->Parse(std::move(buf), json.size()).ok());
+  Processor()->NotifyEndOfFile();
+
+  std::unique_ptr<TraceProcessor> sessions[] = {
+      Processor()->CreateQuerySession(), Processor()->CreateQuerySession()};
+
+  // Tables created by a session are only visible to that session.
+  auto it = sessions[0]->ExecuteQuery("CREATE TABLE user1(unused text);");
+  it.Next();
+  ASSERT_TRUE(it.Status().ok());
+  it = sessions[1]->ExecuteQuery("SELECT * FROM user1");
+  it.Next();
+  ASSERT_FALSE(it.Status().ok());
+  ASSERT_EQ(sessions[0]->RestoreInitialTables(), 1u);
+
+  // The sessions can run queries concurrently.
+  int64_t counts[2] = {};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; i++) {
+    threads.emplace_back([&sessions, &counts, i] {
+      for (int j = 0; j < 10; j++) {
+        auto query_it = sessions[i]->ExecuteQuery(
+            "select count(*) from slice join thread_track "
+            "on slice.track_id = thread_track.id");
+        query_it.Next();
+        counts[i] = query_it.Get(0).long_value;
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  ASSERT_EQ(counts[0], 1000);
+  ASSERT_EQ(counts[1], 1000);
+
+  it = Query("select count(*) from slice");
+  ASSERT_TRUE(it.Next());
+  ASSERT_EQ(it.Get(0).long_value, 1000);
+}
+
 // This test checks that a ninja trace is tokenized properly even if read in
 // small chunks of 1KB each. The values used in the test have been cross-checked
 // with opening the same trace with ninjatracing + chrome://tracing.
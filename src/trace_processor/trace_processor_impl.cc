@@ -18,11 +18,13 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <limits>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/dynamic/ancestor_generator.h"
 #include "src/trace_processor/dynamic/connected_flow_generator.h"
 #include "src/trace_processor/dynamic/descendant_generator.h"
@@ -33,19 +35,27 @@
 #include "src/trace_processor/dynamic/experimental_flat_slice_generator.h"
 #include "src/trace_processor/dynamic/experimental_sched_upid_generator.h"
 #include "src/trace_processor/dynamic/experimental_slice_layout_generator.h"
-#include "src/trace_processor/dynamic/thread_state_generator.h"
+#include "src/trace_processor/dynamic/experimental_track_summary_generator.h"
+#include "src/trace_processor/dynamic/experimental_window_function_generator.h"
+#include "src/trace_processor/dynamic/memory_usage_generator.h"
+#include "src/trace_processor/dynamic/overlapping_generator.h"
 #include "src/trace_processor/export_json.h"
 #include "src/trace_processor/importers/additional_modules.h"
+#include "src/trace_processor/importers/common/system_info_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_module.h"
 #include "src/trace_processor/importers/ftrace/sched_event_tracker.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_parser.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_tokenizer.h"
 #include "src/trace_processor/importers/gzip/gzip_trace_parser.h"
 #include "src/trace_processor/importers/json/json_trace_parser.h"
 #include "src/trace_processor/importers/json/json_trace_tokenizer.h"
+#include "src/trace_processor/importers/proto/heap_graph_tracker.h"
 #include "src/trace_processor/importers/proto/metadata_tracker.h"
+#include "src/trace_processor/importers/syscalls/syscall_tracker.h"
 #include "src/trace_processor/importers/systrace/systrace_trace_parser.h"
 #include "src/trace_processor/iterator_impl.h"
 #include "src/trace_processor/sqlite/span_join_operator_table.h"
+#include "src/trace_processor/sqlite/query_profile_table.h"
 #include "src/trace_processor/sqlite/sql_stats_table.h"
 #include "src/trace_processor/sqlite/sqlite3_str_split.h"
 #include "src/trace_processor/sqlite/sqlite_raw_table.h"
@@ -225,6 +235,28 @@ void CreateBuiltinViews(sqlite3* db) {
     sqlite3_free(error);
   }
 
+  // Exposes the syscalls with the columns of the slice table, for the queries
+  // written against the syscall slices of the thread tracks.
+  sqlite3_exec(db,
+               "CREATE VIEW syscall_slice AS "
+               "SELECT "
+               "  id, "
+               "  ts, "
+               "  dur, "
+               "  NULL AS category, "
+               "  NULL AS cat, "
+               "  name, "
+               "  0 AS depth, "
+               "  utid, "
+               "  nr, "
+               "  ret "
+               "FROM syscall;",
+               0, 0, &error);
+  if (error) {
+    PERFETTO_ELOG("Error initializing: %s", error);
+    sqlite3_free(error);
+  }
+
   sqlite3_exec(db,
                "CREATE VIEW instants AS "
                "SELECT "
@@ -648,8 +680,6 @@ std::vector<std::string> SanitizeMetricMountPaths(
 }
 
 void SetupMetrics(TraceProcessor* tp,
-                  sqlite3* db,
-                  std::vector<metrics::SqlMetricFile>* sql_metrics,
                   const std::vector<std::string>& extension_paths) {
   const std::vector<std::string> sanitized_extension_paths =
       SanitizeMetricMountPaths(extension_paths);
@@ -668,12 +698,18 @@ void SetupMetrics(TraceProcessor* tp,
       continue;
     tp->RegisterMetric(file_to_sql.path, file_to_sql.sql);
   }
+}
 
+void CreateMetricFunctions(TraceProcessor* tp,
+                           sqlite3* db,
+                           std::vector<metrics::SqlMetricFile>* sql_metrics,
+                           metrics::RunMetricMemo* run_metric_memo) {
   {
     std::unique_ptr<metrics::RunMetricContext> ctx(
         new metrics::RunMetricContext());
     ctx->tp = tp;
     ctx->metrics = sql_metrics;
+    ctx->memo = run_metric_memo;
     auto ret = sqlite3_create_function_v2(
         db, "RUN_METRIC", -1, SQLITE_UTF8, ctx.release(), metrics::RunMetric,
         nullptr, nullptr,
@@ -719,103 +755,240 @@ void InsertIntoTraceMetricsTable(sqlite3* db, const std::string& metric_name) {
   }
 }
 
+// Whether |sql| might see the builtin metrics before they are registered:
+// through RUN_METRIC or the list of metrics in the trace_metrics table.
+bool MayUseBuiltinMetrics(const std::string& sql) {
+  std::string lower_sql = base::ToLower(sql);
+  return base::Contains(lower_sql, "run_metric") ||
+         base::Contains(lower_sql, "trace_metrics");
+}
+
+// Binds |args| to the first parameters of |stmt|.
+util::Status BindArgs(sqlite3_stmt* stmt, const std::vector<SqlValue>& args) {
+  int param_count = sqlite3_bind_parameter_count(stmt);
+  if (args.size() > static_cast<size_t>(param_count)) {
+    return util::ErrStatus("Query has %d parameters but %zu args were passed",
+                           param_count, args.size());
+  }
+  for (size_t i = 0; i < args.size(); ++i) {
+    const SqlValue& arg = args[i];
+    int idx = static_cast<int>(i + 1);
+    int ret = SQLITE_OK;
+    switch (arg.type) {
+      case SqlValue::kNull:
+        ret = sqlite3_bind_null(stmt, idx);
+        break;
+      case SqlValue::kLong:
+        ret = sqlite3_bind_int64(stmt, idx, arg.long_value);
+        break;
+      case SqlValue::kDouble:
+        ret = sqlite3_bind_double(stmt, idx, arg.double_value);
+        break;
+      case SqlValue::kString:
+        ret = sqlite3_bind_text(stmt, idx, arg.string_value, -1,
+                                SQLITE_TRANSIENT);
+        break;
+      case SqlValue::kBytes:
+        ret = sqlite3_bind_blob64(stmt, idx, arg.bytes_value, arg.bytes_count,
+                                  SQLITE_TRANSIENT);
+        break;
+    }
+    if (ret != SQLITE_OK) {
+      return util::ErrStatus("Failed to bind arg %zu: %s", i,
+                             sqlite3_errstr(ret));
+    }
+  }
+  return util::OkStatus();
+}
+
 }  // namespace
 
 TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
-    : TraceProcessorStorageImpl(cfg) {
-  context_.fuchsia_trace_tokenizer.reset(new FuchsiaTraceTokenizer(&context_));
+    : TraceProcessorStorageImpl(cfg),
+      storage_context_(&context_),
+      sql_stats_(context_.storage->mutable_sql_stats()) {
+  TraceProcessorContext* context = &context_;
+  context_.fuchsia_trace_tokenizer_factory = [context] {
+    return std::unique_ptr<ChunkedTraceReader>(
+        new FuchsiaTraceTokenizer(context));
+  };
   context_.fuchsia_trace_parser.reset(new FuchsiaTraceParser(&context_));
 
-  context_.systrace_trace_parser.reset(new SystraceTraceParser(&context_));
+  context_.systrace_trace_parser_factory = [context] {
+    return std::unique_ptr<ChunkedTraceReader>(
+        new SystraceTraceParser(context));
+  };
 
-  if (util::IsGzipSupported())
-    context_.gzip_trace_parser.reset(new GzipTraceParser(&context_));
+  if (util::IsGzipSupported()) {
+    context_.gzip_trace_parser_factory = [context] {
+      return std::unique_ptr<ChunkedTraceReader>(new GzipTraceParser(context));
+    };
+  }
 
   if (json::IsJsonSupported()) {
-    context_.json_trace_tokenizer.reset(new JsonTraceTokenizer(&context_));
+    context_.json_trace_tokenizer_factory = [context] {
+      return std::unique_ptr<ChunkedTraceReader>(
+          new JsonTraceTokenizer(context));
+    };
     context_.json_trace_parser.reset(new JsonTraceParser(&context_));
   }
 
   RegisterAdditionalModules(&context_);
 
+  InitializeDb();
+}
+
+void TraceProcessorImpl::EnsureBuiltinMetricsRegistered() {
+  if (builtin_metrics_registered_)
+    return;
+  // Set first, as registering the metrics goes through the public methods
+  // which call this.
+  builtin_metrics_registered_ = true;
+  SetupMetrics(this, storage_context_->config.skip_builtin_metric_paths);
+}
+
+TraceProcessorImpl::TraceProcessorImpl(TraceProcessorImpl* parent)
+    : TraceProcessorStorageImpl(parent->context_.config),
+      parent_(parent),
+      storage_context_(&parent->context_),
+      sql_stats_(&session_sql_stats_) {
+  // These trackers are otherwise created by the first query which needs them:
+  // create them now so that concurrent sessions don't race to do it.
+  HeapGraphTracker::GetOrCreate(storage_context_);
+  SystemInfoTracker::GetOrCreate(storage_context_);
+
+  // Likewise, the lazily decoded args of the raw table are decoded now, as
+  // concurrent sessions can't decode them into the shared tables.
+  if (storage_context_->ftrace_module)
+    storage_context_->ftrace_module->MaterializeRawArgs();
+
+  InitializeDb();
+  BuildBoundsTable(*db_,
+                   storage_context_->storage->GetTraceTimestampBoundsNs());
+
+  // The session has the metrics of |parent| at the time it is created.
+  parent->EnsureBuiltinMetricsRegistered();
+  builtin_metrics_registered_ = true;
+  std::vector<uint8_t> descriptors = parent->pool_.SerializeAsDescriptorSet();
+  util::Status status =
+      pool_.AddFromFileDescriptorSet(descriptors.data(), descriptors.size());
+  PERFETTO_CHECK(status.ok());
+  status = CreateProtoBuilderFunctions();
+  PERFETTO_CHECK(status.ok());
+  sql_metrics_ = parent->sql_metrics_;
+  for (const metrics::SqlMetricFile& metric : sql_metrics_) {
+    if (metric.proto_field_name)
+      InsertIntoTraceMetricsTable(*db_, *metric.proto_field_name);
+  }
+
+  for (auto it = ExecuteQuery(kAllTablesQuery); it.Next();)
+    initial_tables_.push_back(it.Get(0).string_value);
+}
+
+void TraceProcessorImpl::InitializeDb() {
+  const Config& cfg = storage_context_->config;
+  TraceProcessorContext* context = storage_context_;
+
   sqlite3* db = nullptr;
   EnsureSqliteInitialized();
   PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
   InitializeSqlite(db);
+  query_interrupter_.RegisterProgressHandler(db);
   CreateBuiltinTables(db);
   CreateBuiltinViews(db);
   db_.reset(std::move(db));
 
-  CreateJsonExportFunction(context_.storage.get(), db);
+  CreateJsonExportFunction(context->storage.get(), db);
   CreateHashFunction(db);
   CreateDemangledNameFunction(db);
   CreateLastNonNullFunction(db);
-  CreateExtractArgFunction(context_.storage.get(), db);
+  CreateExtractArgFunction(context->storage.get(), db);
   CreateSourceGeqFunction(db);
   CreateValueAtMaxTsFunction(db);
   CreateUnwrapMetricProtoFunction(db);
+  CreateMetricFunctions(this, db, &sql_metrics_, &run_metric_memo_);
 
-  SetupMetrics(this, *db_, &sql_metrics_, cfg.skip_builtin_metric_paths);
-
-  // Setup the query cache.
-  query_cache_.reset(new QueryCache());
+  // Setup the query cache. The stats of the trace are only updated by the
+  // instance which parsed it, as query sessions can run concurrently.
+  query_cache_.reset(
+      new QueryCache(parent_ ? nullptr : context->storage.get()));
+  direct_query_planner_.reset(
+      new DirectTableQueryPlanner(*db_, query_cache_.get()));
 
-  const TraceStorage* storage = context_.storage.get();
+  const TraceStorage* storage = context->storage.get();
 
-  SqlStatsTable::RegisterTable(*db_, storage);
+  SqlStatsTable::RegisterTable(*db_, sql_stats_);
+  QueryProfileTable::RegisterTable(*db_, &last_query_profile_);
   StatsTable::RegisterTable(*db_, storage);
 
   // Operator tables.
-  SpanJoinOperatorTable::RegisterTable(*db_, storage);
+  SpanJoinOperatorTable::RegisterTable(*db_, cfg.span_join_worker_threads,
+                                       &query_interrupter_);
   WindowOperatorTable::RegisterTable(*db_, storage);
 
   // New style tables but with some custom logic.
-  SqliteRawTable::RegisterTable(*db_, query_cache_.get(), &context_);
+  SqliteRawTable::RegisterTable(*db_, query_cache_.get(), context);
 
   // Tables dynamically generated at query time.
-  RegisterDynamicTable(std::unique_ptr<ExperimentalFlamegraphGenerator>(
-      new ExperimentalFlamegraphGenerator(&context_)));
+  flamegraph_generator_ =
+      new ExperimentalFlamegraphGenerator(context, &query_interrupter_);
+  RegisterDynamicTable(
+      std::unique_ptr<ExperimentalFlamegraphGenerator>(flamegraph_generator_));
   RegisterDynamicTable(std::unique_ptr<ExperimentalCounterDurGenerator>(
       new ExperimentalCounterDurGenerator(storage->counter_table())));
   RegisterDynamicTable(std::unique_ptr<DescribeSliceGenerator>(
-      new DescribeSliceGenerator(&context_)));
+      new DescribeSliceGenerator(context)));
   RegisterDynamicTable(std::unique_ptr<ExperimentalSliceLayoutGenerator>(
       new ExperimentalSliceLayoutGenerator(
-          context_.storage.get()->mutable_string_pool(),
+          context->storage.get()->mutable_string_pool(),
           &storage->slice_table())));
   RegisterDynamicTable(std::unique_ptr<AncestorGenerator>(
-      new AncestorGenerator(AncestorGenerator::Ancestor::kSlice, &context_)));
+      new AncestorGenerator(AncestorGenerator::Ancestor::kSlice, context)));
   RegisterDynamicTable(std::unique_ptr<AncestorGenerator>(new AncestorGenerator(
-      AncestorGenerator::Ancestor::kStackProfileCallsite, &context_)));
+      AncestorGenerator::Ancestor::kStackProfileCallsite, context)));
   RegisterDynamicTable(std::unique_ptr<AncestorGenerator>(new AncestorGenerator(
-      AncestorGenerator::Ancestor::kSliceByStack, &context_)));
+      AncestorGenerator::Ancestor::kSliceByStack, context)));
   RegisterDynamicTable(
       std::unique_ptr<DescendantGenerator>(new DescendantGenerator(
-          DescendantGenerator::Descendant::kSlice, &context_)));
+          DescendantGenerator::Descendant::kSlice, context)));
   RegisterDynamicTable(
       std::unique_ptr<DescendantGenerator>(new DescendantGenerator(
-          DescendantGenerator::Descendant::kSliceByStack, &context_)));
+          DescendantGenerator::Descendant::kSliceByStack, context)));
   RegisterDynamicTable(
       std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
-          ConnectedFlowGenerator::Mode::kDirectlyConnectedFlow, &context_)));
+          ConnectedFlowGenerator::Mode::kDirectlyConnectedFlow, context)));
   RegisterDynamicTable(
       std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
-          ConnectedFlowGenerator::Mode::kPrecedingFlow, &context_)));
+          ConnectedFlowGenerator::Mode::kPrecedingFlow, context)));
   RegisterDynamicTable(
       std::unique_ptr<ConnectedFlowGenerator>(new ConnectedFlowGenerator(
-          ConnectedFlowGenerator::Mode::kFollowingFlow, &context_)));
+          ConnectedFlowGenerator::Mode::kFollowingFlow, context)));
   RegisterDynamicTable(std::unique_ptr<ExperimentalSchedUpidGenerator>(
       new ExperimentalSchedUpidGenerator(storage->sched_slice_table(),
                                          storage->thread_table())));
-  RegisterDynamicTable(std::unique_ptr<ThreadStateGenerator>(
-      new ThreadStateGenerator(&context_)));
+  for (auto source : {OverlappingGenerator::Source::kSlice,
+                      OverlappingGenerator::Source::kSchedSlice,
+                      OverlappingGenerator::Source::kThreadState}) {
+    auto* generator = new OverlappingGenerator(source, context);
+    overlapping_generators_.push_back(generator);
+    RegisterDynamicTable(std::unique_ptr<OverlappingGenerator>(generator));
+  }
   RegisterDynamicTable(std::unique_ptr<ExperimentalAnnotatedStackGenerator>(
-      new ExperimentalAnnotatedStackGenerator(&context_)));
+      new ExperimentalAnnotatedStackGenerator(context)));
   RegisterDynamicTable(std::unique_ptr<ExperimentalFlatSliceGenerator>(
-      new ExperimentalFlatSliceGenerator(&context_)));
+      new ExperimentalFlatSliceGenerator(context)));
+  track_summary_generator_ = new ExperimentalTrackSummaryGenerator(context);
+  RegisterDynamicTable(std::unique_ptr<ExperimentalTrackSummaryGenerator>(
+      track_summary_generator_));
 
   // New style db-backed tables.
-  RegisterDbTable(storage->arg_table());
+  if (cfg.lazy_ftrace_raw_args) {
+    // Not registered with |direct_query_planner_|, which would read the table
+    // without going through SqliteArgsTable.
+    SqliteArgsTable::RegisterTable(*db_, query_cache_.get(), context);
+  } else {
+    RegisterDbTable(storage->arg_table());
+  }
   RegisterDbTable(storage->thread_table());
   RegisterDbTable(storage->process_table());
 
@@ -824,6 +997,8 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   RegisterDbTable(storage->thread_slice_table());
   RegisterDbTable(storage->sched_slice_table());
   RegisterDbTable(storage->instant_table());
+  RegisterDbTable(storage->thread_state_table());
+  RegisterDbTable(storage->syscall_table());
   RegisterDbTable(storage->gpu_slice_table());
 
   RegisterDbTable(storage->track_table());
@@ -858,6 +1033,7 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   RegisterDbTable(storage->profiler_smaps_table());
 
   RegisterDbTable(storage->android_log_table());
+  RegisterDbTable(storage->binder_transaction_table());
 
   RegisterDbTable(storage->vulkan_memory_allocations_table());
 
@@ -875,17 +1051,68 @@ TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
   RegisterDbTable(storage->process_memory_snapshot_table());
   RegisterDbTable(storage->memory_snapshot_node_table());
   RegisterDbTable(storage->memory_snapshot_edge_table());
+
+  // The raw table (and the args table with lazy_ftrace_raw_args) are not
+  // registered with RegisterDbTable() but are accounted for too.
+  std::vector<const macros_internal::MacroTable*> memory_usage_tables =
+      db_tables_;
+  memory_usage_tables.push_back(&storage->raw_table());
+  if (cfg.lazy_ftrace_raw_args)
+    memory_usage_tables.push_back(&storage->arg_table());
+  RegisterDynamicTable(std::unique_ptr<MemoryUsageGenerator>(
+      new MemoryUsageGenerator(context, std::move(memory_usage_tables))));
+  RegisterDynamicTable(std::unique_ptr<ExperimentalWindowFunctionGenerator>(
+      new ExperimentalWindowFunctionGenerator(context, db_tables_)));
+
+  // The views from CreateBuiltinViews() which only rename columns of a table
+  // can also be queried directly.
+  using Alias = DirectTableQueryPlanner::Alias;
+  direct_query_planner_->AddView("slice", "internal_slice", {},
+                                 {Alias{"cat", "category"},
+                                  Alias{"slice_id", "id"}});
+  direct_query_planner_->AddView("slices", "slice", {}, {});
+  direct_query_planner_->AddView("thread", "internal_thread",
+                                 {Alias{"utid", "id"}}, {});
+  direct_query_planner_->AddView("process", "internal_process",
+                                 {Alias{"upid", "id"}}, {});
+  direct_query_planner_->AddView("counter_values", "counter", {},
+                                 {Alias{"counter_id", "track_id"}});
+  direct_query_planner_->AddView("counter_definitions", "counter_track", {},
+                                 {Alias{"counter_id", "id"}});
 }
 
 TraceProcessorImpl::~TraceProcessorImpl() = default;
 
 util::Status TraceProcessorImpl::Parse(std::unique_ptr<uint8_t[]> data,
                                        size_t size) {
+  if (parent_)
+    return util::ErrStatus("Query sessions cannot parse data");
   bytes_parsed_ += size;
   return TraceProcessorStorageImpl::Parse(std::move(data), size);
 }
 
+util::Status TraceProcessorImpl::ParseShared(
+    std::shared_ptr<const uint8_t> data,
+    size_t size) {
+  if (parent_)
+    return util::ErrStatus("Query sessions cannot parse data");
+  bytes_parsed_ += size;
+  return TraceProcessorStorageImpl::ParseShared(std::move(data), size);
+}
+
+util::Status TraceProcessorImpl::ParseTrace(uint32_t trace_idx,
+                                            std::unique_ptr<uint8_t[]> data,
+                                            size_t size) {
+  if (parent_)
+    return util::ErrStatus("Query sessions cannot parse data");
+  bytes_parsed_ += size;
+  return TraceProcessorStorageImpl::ParseTrace(trace_idx, std::move(data),
+                                               size);
+}
+
 std::string TraceProcessorImpl::GetCurrentTraceName() {
+  if (parent_)
+    return parent_->GetCurrentTraceName();
   if (current_trace_name_.empty())
     return "";
   auto size = " (" + std::to_string(bytes_parsed_ / 1024 / 1024) + " MB)";
@@ -896,17 +1123,53 @@ void TraceProcessorImpl::SetCurrentTraceName(const std::string& name) {
   current_trace_name_ = name;
 }
 
+void TraceProcessorImpl::Flush() {
+  if (parent_) {
+    PERFETTO_DFATAL_OR_ELOG("Query sessions cannot parse data");
+    return;
+  }
+  TraceProcessorStorageImpl::Flush();
+
+  // The sched slices, thread states and syscalls which are still running are
+  // added too and updated in place when they end.
+  SchedEventTracker::GetOrCreate(&context_)->Flush();
+  if (context_.syscall_tracker)
+    SyscallTracker::GetOrCreate(&context_)->FlushPendingSyscalls();
+  UpdateDerivedState();
+}
+
 void TraceProcessorImpl::NotifyEndOfFile() {
+  if (parent_) {
+    PERFETTO_DFATAL_OR_ELOG("Query sessions cannot parse data");
+    return;
+  }
   if (current_trace_name_.empty())
     current_trace_name_ = "Unnamed trace";
 
   TraceProcessorStorageImpl::NotifyEndOfFile();
 
   SchedEventTracker::GetOrCreate(&context_)->FlushPendingEvents();
-  context_.metadata_tracker->SetMetadata(
-      metadata::trace_size_bytes,
-      Variadic::Integer(static_cast<int64_t>(bytes_parsed_)));
-  BuildBoundsTable(*db_, context_.storage->GetTraceTimestampBoundsNs());
+  if (context_.syscall_tracker)
+    SyscallTracker::GetOrCreate(&context_)->FlushPendingSyscalls();
+  UpdateDerivedState();
+
+  // This needs to happen after all the trackers have flushed their events as
+  // any modification of a table decompresses the modified columns (and drops
+  // their rank/select indexes).
+  uint64_t spill_budget = context_.config.spill_memory_budget_bytes;
+  if (context_.config.compress_integer_columns || spill_budget > 0)
+    context_.storage->CompressEventTables();
+  if (spill_budget > 0) {
+    // 0 means that the RSS is not known: spill everything then.
+    uint64_t rss = base::GetCurrentProcessRssBytes();
+    if (rss == 0 || rss > spill_budget) {
+      uint64_t to_spill =
+          rss ? rss - spill_budget : std::numeric_limits<uint64_t>::max();
+      uint64_t spilled = context_.storage->SpillEventTables(to_spill);
+      PERFETTO_DLOG("Spilled %" PRIu64 " bytes of table storage", spilled);
+    }
+  }
+  context_.storage->BuildRankSelectIndexes();
 
   // Create a snapshot of all tables and views created so far. This is so later
   // we can drop all extra tables created by the UI and reset to the original
@@ -920,7 +1183,21 @@ void TraceProcessorImpl::NotifyEndOfFile() {
   }
 }
 
+void TraceProcessorImpl::UpdateDerivedState() {
+  context_.metadata_tracker->SetMetadata(
+      metadata::trace_size_bytes,
+      Variadic::Integer(static_cast<int64_t>(bytes_parsed_)));
+  BuildBoundsTable(*db_, context_.storage->GetTraceTimestampBoundsNs());
+  for (OverlappingGenerator* generator : overlapping_generators_)
+    generator->ClearIndex();
+  flamegraph_generator_->ClearCache();
+  track_summary_generator_->ClearCache();
+}
+
 size_t TraceProcessorImpl::RestoreInitialTables() {
+  // The cached statements can refer to the tables which are deleted.
+  statement_cache_.Clear();
+
   // Step 1: figure out what tables/views/indices we need to delete.
   std::vector<std::pair<std::string, std::string>> deletion_list;
   std::string msg = "Resetting DB to initial state, deleting table/views:";
@@ -954,12 +1231,59 @@ size_t TraceProcessorImpl::RestoreInitialTables() {
 
 Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql,
                                           int64_t time_queued) {
-  sqlite3_stmt* raw_stmt;
-  int err;
-  {
+  return ExecuteQueryInternal(sql, time_queued, nullptr, 0, nullptr);
+}
+
+Iterator TraceProcessorImpl::ExecuteQueryWithBudget(const std::string& sql,
+                                                    const QueryBudget& budget,
+                                                    int64_t time_queued) {
+  uint64_t query_id = query_interrupter_.Start(budget);
+  return ExecuteQueryInternal(sql, time_queued, &query_interrupter_, query_id,
+                              nullptr);
+}
+
+Iterator TraceProcessorImpl::ExecuteQueryWithArgs(
+    const std::string& sql,
+    const std::vector<SqlValue>& args,
+    const QueryBudget& budget,
+    int64_t time_queued) {
+  uint64_t query_id = query_interrupter_.Start(budget);
+  return ExecuteQueryInternal(sql, time_queued, &query_interrupter_, query_id,
+                              &args);
+}
+
+Iterator TraceProcessorImpl::ExecuteQueryInternal(
+    const std::string& sql,
+    int64_t time_queued,
+    QueryInterrupter* interrupter,
+    uint64_t interrupter_query_id,
+    const std::vector<SqlValue>* args) {
+  if (!builtin_metrics_registered_ && MayUseBuiltinMetrics(sql))
+    EnsureBuiltinMetricsRegistered();
+
+  ScopedStmt stmt;
+  if (args) {
+    stmt = statement_cache_.Take(sql);
+    if (!parent_) {
+      context_.storage->IncrementStats(stmt ? stats::statement_cache_hits
+                                            : stats::statement_cache_misses);
+    }
+  }
+  int err = SQLITE_OK;
+  if (!stmt) {
     PERFETTO_TP_TRACE("QUERY_PREPARE");
+    sqlite3_stmt* raw_stmt = nullptr;
     err = sqlite3_prepare_v2(*db_, sql.c_str(), static_cast<int>(sql.size()),
                              &raw_stmt, nullptr);
+    // The query might call the proto builder function of a builtin metric.
+    if (err != SQLITE_OK && !builtin_metrics_registered_ &&
+        base::StartsWith(sqlite3_errmsg(*db_), "no such function")) {
+      EnsureBuiltinMetricsRegistered();
+      err = sqlite3_prepare_v2(*db_, sql.c_str(),
+                               static_cast<int>(sql.size()), &raw_stmt,
+                               nullptr);
+    }
+    stmt.reset(raw_stmt);
   }
 
   util::Status status;
@@ -967,16 +1291,37 @@ Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql,
   if (err != SQLITE_OK) {
     status = util::ErrStatus("%s", sqlite3_errmsg(*db_));
   } else {
-    col_count = static_cast<uint32_t>(sqlite3_column_count(raw_stmt));
+    col_count = static_cast<uint32_t>(sqlite3_column_count(*stmt));
+    if (args)
+      status = BindArgs(*stmt, *args);
   }
 
   base::TimeNanos t_start = base::GetWallTimeNs();
   uint32_t sql_stats_row =
-      context_.storage->mutable_sql_stats()->RecordQueryBegin(sql, time_queued,
-                                                              t_start.count());
-
-  std::unique_ptr<IteratorImpl> impl(new IteratorImpl(
-      this, *db_, ScopedStmt(raw_stmt), col_count, status, sql_stats_row));
+      sql_stats_->RecordQueryBegin(sql, time_queued, t_start.count());
+
+  std::unique_ptr<QueryProfiler> profiler;
+  if (query_profiling_enabled_)
+    profiler.reset(new QueryProfiler());
+
+  // Simple queries on a single table are computed without stepping through
+  // the statement, which is then only used for its column names. The
+  // planner only understands literals, not parameters.
+  std::unique_ptr<DirectTableQuery> direct_query;
+  if (status.ok() && sqlite3_bind_parameter_count(*stmt) == 0) {
+    QueryProfiler::ScopedActivation profile(profiler.get());
+    direct_query = direct_query_planner_->Plan(sql, *stmt);
+    if (direct_query && !parent_)
+      context_.storage->IncrementStats(stats::direct_table_queries);
+  }
+
+  bool cache_stmt = args && status.ok();
+  std::unique_ptr<IteratorImpl> impl(
+      new IteratorImpl(this, *db_, std::move(stmt), col_count, status,
+                       sql_stats_row, std::move(direct_query), interrupter,
+                       interrupter_query_id, std::move(profiler)));
+  if (cache_stmt)
+    impl->ReturnStatementToCache(&statement_cache_, sql);
   return Iterator(std::move(impl));
 }
 
@@ -984,6 +1329,7 @@ void TraceProcessorImpl::InterruptQuery() {
   if (!db_)
     return;
   query_interrupted_.store(true);
+  query_interrupter_.Cancel();
   sqlite3_interrupt(db_.get());
 }
 
@@ -998,6 +1344,7 @@ bool TraceProcessorImpl::IsRootMetricField(const std::string& metric_name) {
 
 util::Status TraceProcessorImpl::RegisterMetric(const std::string& path,
                                                 const std::string& sql) {
+  EnsureBuiltinMetricsRegistered();
   std::string stripped_sql;
   for (base::StringSplitter sp(sql, '\n'); sp.Next();) {
     if (strncmp(sp.cur_token(), "--", 2) != 0) {
@@ -1049,11 +1396,15 @@ util::Status TraceProcessorImpl::ExtendMetricsProto(
     const uint8_t* data,
     size_t size,
     const std::vector<std::string>& skip_prefixes) {
+  EnsureBuiltinMetricsRegistered();
   util::Status status =
       pool_.AddFromFileDescriptorSet(data, size, skip_prefixes);
   if (!status.ok())
     return status;
+  return CreateProtoBuilderFunctions();
+}
 
+util::Status TraceProcessorImpl::CreateProtoBuilderFunctions() {
   for (const auto& desc : pool_.descriptors()) {
     // Convert the full name (e.g. .perfetto.protos.TraceMetrics.SubMetric)
     // into a function name of the form (TraceMetrics_SubMetric).
@@ -1080,13 +1431,26 @@ util::Status TraceProcessorImpl::ExtendMetricsProto(
 util::Status TraceProcessorImpl::ComputeMetric(
     const std::vector<std::string>& metric_names,
     std::vector<uint8_t>* metrics_proto) {
+  EnsureBuiltinMetricsRegistered();
   auto opt_idx = pool_.FindDescriptorIdx(".perfetto.protos.TraceMetrics");
   if (!opt_idx.has_value())
     return util::Status("Root metrics proto descriptor not found");
 
+  // Forking is not safe while other sessions may be running queries on
+  // other threads: query sessions compute all the metrics in-process.
+  // Otherwise, the metrics are still computed in-process if any other
+  // thread is running when they are computed.
   const auto& root_descriptor = pool_.descriptors()[opt_idx.value()];
-  return metrics::ComputeMetrics(this, metric_names, sql_metrics_, pool_,
-                                 root_descriptor, metrics_proto);
+  uint32_t worker_processes =
+      parent_ ? 0 : context_.config.metric_worker_processes;
+  // The files run by RUN_METRIC are shared by the metrics of this call only,
+  // the queries run in between calls can change the tables they create.
+  run_metric_memo_.Enable();
+  util::Status status = metrics::ComputeMetricsInProcesses(
+      this, metric_names, sql_metrics_, pool_, root_descriptor,
+      &run_metric_memo_, worker_processes, metrics_proto);
+  run_metric_memo_.DisableAndClear();
+  return status;
 }
 
 util::Status TraceProcessorImpl::ComputeMetricText(
@@ -1113,9 +1477,15 @@ util::Status TraceProcessorImpl::ComputeMetricText(
 }
 
 std::vector<uint8_t> TraceProcessorImpl::GetMetricDescriptors() {
+  EnsureBuiltinMetricsRegistered();
   return pool_.SerializeAsDescriptorSet();
 }
 
+std::unique_ptr<TraceProcessor> TraceProcessorImpl::CreateQuerySession() {
+  TraceProcessorImpl* root = parent_ ? parent_ : this;
+  return std::unique_ptr<TraceProcessor>(new TraceProcessorImpl(root));
+}
+
 void TraceProcessorImpl::EnableMetatrace() {
   metatrace::Enable();
 }
@@ -1148,5 +1518,9 @@ util::Status TraceProcessorImpl::DisableAndReadMetatrace(
   return util::OkStatus();
 }
 
+void TraceProcessorImpl::EnableQueryProfiling(bool enabled) {
+  query_profiling_enabled_ = enabled;
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
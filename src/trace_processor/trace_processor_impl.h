@@ -28,9 +28,14 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/db/query_profiler.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/direct_table_query.h"
 #include "src/trace_processor/sqlite/query_cache.h"
+#include "src/trace_processor/sqlite/query_interrupter.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/statement_cache.h"
+#include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/trace_processor_storage_impl.h"
 
 #include "src/trace_processor/metrics/metrics.h"
@@ -39,6 +44,10 @@
 namespace perfetto {
 namespace trace_processor {
 
+class ExperimentalFlamegraphGenerator;
+class ExperimentalTrackSummaryGenerator;
+class OverlappingGenerator;
+
 // Coordinates the loading of traces from an arbitrary source and allows
 // execution of SQL queries on the events in these traces.
 class TraceProcessorImpl : public TraceProcessor,
@@ -50,12 +59,26 @@ class TraceProcessorImpl : public TraceProcessor,
 
   // TraceProcessorStorage implementation:
   util::Status Parse(std::unique_ptr<uint8_t[]>, size_t) override;
+  util::Status ParseShared(std::shared_ptr<const uint8_t>, size_t) override;
+  util::Status ParseTrace(uint32_t trace_idx,
+                          std::unique_ptr<uint8_t[]>,
+                          size_t) override;
+  void Flush() override;
   void NotifyEndOfFile() override;
 
   // TraceProcessor implementation:
   Iterator ExecuteQuery(const std::string& sql,
                         int64_t time_queued = 0) override;
 
+  Iterator ExecuteQueryWithBudget(const std::string& sql,
+                                  const QueryBudget& budget,
+                                  int64_t time_queued = 0) override;
+
+  Iterator ExecuteQueryWithArgs(const std::string& sql,
+                                const std::vector<SqlValue>& args,
+                                const QueryBudget& budget = {},
+                                int64_t time_queued = 0) override;
+
   util::Status RegisterMetric(const std::string& path,
                               const std::string& sql) override;
 
@@ -87,14 +110,39 @@ class TraceProcessorImpl : public TraceProcessor,
   util::Status DisableAndReadMetatrace(
       std::vector<uint8_t>* trace_proto) override;
 
+  void EnableQueryProfiling(bool enabled) override;
+
+  std::unique_ptr<TraceProcessor> CreateQuerySession() override;
+
  private:
   // Needed for iterators to be able to access the context.
   friend class IteratorImpl;
 
+  // Creates a query session over the data of |parent|.
+  explicit TraceProcessorImpl(TraceProcessorImpl* parent);
+
+  // Opens |db_| and registers the tables and functions on the data of
+  // |storage_context_|.
+  void InitializeDb();
+
+  // Creates the proto builder functions for all the descriptors of |pool_|.
+  util::Status CreateProtoBuilderFunctions();
+
+  // If |interrupter| is not null, it has been started for this query and
+  // returned |interrupter_query_id|. If |args| is not null, they are bound to
+  // the statement, which is taken from and returned to |statement_cache_|.
+  Iterator ExecuteQueryInternal(const std::string& sql,
+                                int64_t time_queued,
+                                QueryInterrupter* interrupter,
+                                uint64_t interrupter_query_id,
+                                const std::vector<SqlValue>* args);
+
   template <typename Table>
   void RegisterDbTable(const Table& table) {
     DbSqliteTable::RegisterTable(*db_, query_cache_.get(), Table::Schema(),
                                  &table, table.table_name());
+    direct_query_planner_->AddTable(table.table_name(), &table);
+    db_tables_.push_back(&table);
   }
 
   void RegisterDynamicTable(
@@ -104,11 +152,60 @@ class TraceProcessorImpl : public TraceProcessor,
   }
 
   bool IsRootMetricField(const std::string& metric_name);
+
+  // Registers the metrics built into trace processor, unless it has already
+  // been done. This is deferred until the metrics are first needed as
+  // decoding their descriptors and registering their functions and files is a
+  // large part of the startup time.
+  void EnsureBuiltinMetricsRegistered();
+
+  // Updates the metadata, tables and caches which depend on all the data
+  // parsed so far. Called whenever new data becomes queryable.
+  void UpdateDerivedState();
+
+  // The instance which created this query session, or null if this is not a
+  // query session.
+  TraceProcessorImpl* const parent_ = nullptr;
+
+  // The context holding the data which is queried: |context_| or, for query
+  // sessions, the context of |parent_|.
+  TraceProcessorContext* const storage_context_;
+
+  // Where the statistics of the queries run on |db_| are recorded: in the
+  // storage for instances which parse the trace, in |session_sql_stats_| for
+  // query sessions.
+  TraceStorage::SqlStats session_sql_stats_;
+  TraceStorage::SqlStats* const sql_stats_;
+
+  // Interrupts the queries run by ExecuteQueryWithBudget() on |db_|.
+  QueryInterrupter query_interrupter_;
+
+  // Whether the queries are profiled and the profile of the last profiled
+  // query, read by the query_profile table.
+  bool query_profiling_enabled_ = false;
+  std::unique_ptr<QueryProfiler> last_query_profile_;
+
   ScopedDb db_;
+
+  // The statements prepared by ExecuteQueryWithArgs(). Declared after |db_|
+  // as they must be finalized before it is closed.
+  StatementCache statement_cache_;
   std::unique_ptr<QueryCache> query_cache_;
+  std::unique_ptr<DirectTableQueryPlanner> direct_query_planner_;
+
+  // Owned by their tables in |db_|; their interval indices (and the memoized
+  // flamegraphs) are cleared along with |query_cache_|.
+  std::vector<OverlappingGenerator*> overlapping_generators_;
+  ExperimentalFlamegraphGenerator* flamegraph_generator_ = nullptr;
+  ExperimentalTrackSummaryGenerator* track_summary_generator_ = nullptr;
+
+  // The tables registered by RegisterDbTable(), for the memory_usage table.
+  std::vector<const macros_internal::MacroTable*> db_tables_;
 
   DescriptorPool pool_;
   std::vector<metrics::SqlMetricFile> sql_metrics_;
+  bool builtin_metrics_registered_ = false;
+  metrics::RunMetricMemo run_metric_memo_;
 
   // This is atomic because it is set by the CTRL-C signal handler and we need
   // to prevent single-flow compiler optimizations in ExecuteQuery().
@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/trace_processor_impl.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/trace_processor/export_systrace.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/trace_processor/importers/json/json_utils.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/power.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// Returns a chunk of proto trace with one cpu_frequency event for each of the
+// timestamps in [start_ts, end_ts).
+std::vector<uint8_t> CpuFreqEvents(uint64_t start_ts, uint64_t end_ts) {
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  for (uint64_t ts = start_ts; ts < end_ts; ++ts) {
+    auto* bundle = trace->add_packet()->set_ftrace_events();
+    bundle->set_cpu(0);
+    auto* event = bundle->add_event();
+    event->set_timestamp(ts);
+    event->set_pid(0);
+    auto* freq = event->set_cpu_frequency();
+    freq->set_cpu_id(0);
+    freq->set_state(static_cast<uint32_t>(ts));
+  }
+  return trace.SerializeAsArray();
+}
+
+util::Status Parse(TraceProcessor* tp, const std::vector<uint8_t>& data) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[data.size()]);
+  memcpy(buf.get(), data.data(), data.size());
+  return tp->Parse(std::move(buf), data.size());
+}
+
+util::Status ParseTrace(TraceProcessor* tp,
+                        uint32_t trace_idx,
+                        const std::vector<uint8_t>& data) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[data.size()]);
+  memcpy(buf.get(), data.data(), data.size());
+  return tp->ParseTrace(trace_idx, std::move(buf), data.size());
+}
+
+int64_t QueryLong(TraceProcessor* tp, const std::string& query) {
+  auto it = tp->ExecuteQuery(query);
+  EXPECT_TRUE(it.Next());
+  EXPECT_TRUE(it.Status().ok()) << it.Status().message();
+  return it.Get(0).long_value;
+}
+
+// Returns all the rows of |query| with their values formatted as strings.
+std::vector<std::vector<std::string>> QueryRows(TraceProcessor* tp,
+                                                const std::string& query) {
+  std::vector<std::vector<std::string>> rows;
+  auto it = tp->ExecuteQuery(query);
+  while (it.Next()) {
+    std::vector<std::string> row;
+    for (uint32_t i = 0; i < it.ColumnCount(); ++i) {
+      SqlValue value = it.Get(i);
+      switch (value.type) {
+        case SqlValue::kNull:
+          row.push_back("[NULL]");
+          break;
+        case SqlValue::kLong:
+          row.push_back(std::to_string(value.long_value));
+          break;
+        case SqlValue::kDouble:
+          row.push_back(std::to_string(value.double_value));
+          break;
+        case SqlValue::kString:
+          row.push_back(value.string_value);
+          break;
+        case SqlValue::kBytes:
+          row.push_back("[BYTES]");
+          break;
+      }
+    }
+    rows.push_back(std::move(row));
+  }
+  EXPECT_TRUE(it.Status().ok()) << it.Status().message();
+  return rows;
+}
+
+TEST(TraceProcessorImplTest, FlushAndAppend) {
+  TraceProcessorImpl tp{Config()};
+
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1100)).ok());
+  tp.Flush();
+  ASSERT_EQ(QueryLong(&tp, "SELECT COUNT(*) FROM counter"), 100);
+  ASSERT_EQ(QueryLong(&tp, "SELECT end_ts FROM trace_bounds"), 1099);
+
+  // Tables keep growing as more data is appended.
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1100, 1300)).ok());
+  tp.Flush();
+  ASSERT_EQ(QueryLong(&tp, "SELECT COUNT(*) FROM counter"), 300);
+  ASSERT_EQ(QueryLong(&tp, "SELECT end_ts FROM trace_bounds"), 1299);
+
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1300, 1400)).ok());
+  tp.NotifyEndOfFile();
+  ASSERT_EQ(QueryLong(&tp, "SELECT COUNT(*) FROM counter"), 400);
+  ASSERT_EQ(QueryLong(&tp, "SELECT end_ts FROM trace_bounds"), 1399);
+}
+
+TEST(TraceProcessorImplTest, FlushLateEventsOutOfOrder) {
+  TraceProcessorImpl tp{Config()};
+
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(2000, 2100)).ok());
+  tp.Flush();
+
+  // Events older than the flushed ones can't be sorted anymore: they are
+  // parsed out of order and so dropped by the counter tracking.
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1010)).ok());
+  tp.Flush();
+  ASSERT_EQ(QueryLong(&tp, "SELECT COUNT(*) FROM counter"), 100);
+  ASSERT_EQ(QueryLong(&tp,
+                      "SELECT value FROM stats "
+                      "WHERE name = 'sorter_push_event_out_of_order'"),
+            10);
+}
+
+TEST(TraceProcessorImplTest, DirectTableQueries) {
+  TraceProcessorImpl tp{Config()};
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1100)).ok());
+  tp.NotifyEndOfFile();
+
+  const char* kQueries[] = {
+      "SELECT * FROM counter",
+      "select ts, value from counter where ts >= 1050 order by ts desc limit 7",
+      "SELECT ts FROM counter WHERE ts > 1010 AND ts != 1020 LIMIT 5 OFFSET 3",
+      "SELECT id, ts FROM counter WHERE arg_set_id IS NULL LIMIT 3",
+      "SELECT * FROM counter_values ORDER BY counter_id, ts DESC LIMIT 4",
+      "SELECT name, counter_id FROM counter_definitions WHERE name GLOB '*'",
+      "SELECT utid, tid FROM thread",
+      "SELECT * FROM process WHERE upid = 0",
+      "SELECT ts AS x, value FROM counter ORDER BY x DESC LIMIT 3",
+      "SELECT track_id, COUNT(*), SUM(ts), MIN(value), max(value) AS m "
+      "FROM counter GROUP BY track_id ORDER BY m",
+      "SELECT count(*) AS c, MAX(ts) FROM counter WHERE ts > 1050",
+      "SELECT arg_set_id, COUNT(arg_set_id) FROM counter GROUP BY arg_set_id",
+      "SELECT upid, COUNT(*) FROM thread GROUP BY upid",
+      "SELECT ts FROM counter WHERE ts = 'abc'",
+      "SELECT SUM(value) FROM counter",
+      "SELECT ts, COUNT(*) FROM counter",
+  };
+  int64_t direct_queries =
+      QueryLong(&tp,
+                "SELECT value FROM stats WHERE name = 'direct_table_queries'");
+  for (const char* query : kQueries) {
+    // Wrapping the query in a subquery makes SQLite compute it.
+    std::string wrapped = std::string("SELECT * FROM (") + query + ")";
+    auto expected = QueryRows(&tp, wrapped);
+    ASSERT_EQ(QueryRows(&tp, query), expected) << query;
+  }
+  ASSERT_EQ(QueryLong(&tp,
+                      "SELECT value FROM stats "
+                      "WHERE name = 'direct_table_queries'"),
+            direct_queries + 13);
+
+  // Shadowing a table with a temporary view is seen by the queries.
+  auto it = tp.ExecuteQuery(
+      "CREATE TEMP VIEW counter AS SELECT 1 AS ts, 2 AS value");
+  ASSERT_FALSE(it.Next());
+  ASSERT_TRUE(it.Status().ok()) << it.Status().message();
+  auto rows = QueryRows(&tp, "SELECT ts, value FROM counter");
+  ASSERT_EQ(rows.size(), 1u);
+  ASSERT_EQ(rows[0], (std::vector<std::string>{"1", "2"}));
+}
+
+TEST(TraceProcessorImplTest, QueryBudget) {
+  TraceProcessorImpl tp{Config()};
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1100)).ok());
+  tp.NotifyEndOfFile();
+
+  // The rows returned before the row budget is exceeded are still valid.
+  QueryBudget budget;
+  budget.max_rows = 10;
+  auto it = tp.ExecuteQueryWithBudget("SELECT ts FROM counter ORDER BY ts",
+                                      budget);
+  for (int64_t ts = 1000; ts < 1010; ++ts) {
+    ASSERT_TRUE(it.Next());
+    ASSERT_EQ(it.Get(0).long_value, ts);
+  }
+  ASSERT_FALSE(it.Next());
+  ASSERT_FALSE(it.Status().ok());
+
+  // A query returning exactly |max_rows| rows is not interrupted.
+  budget.max_rows = 100;
+  ASSERT_EQ(QueryRows(&tp, "SELECT ts FROM counter").size(), 100u);
+  it = tp.ExecuteQueryWithBudget("SELECT ts FROM counter", budget);
+  uint32_t rows = 0;
+  for (; it.Next(); ++rows) {
+  }
+  ASSERT_EQ(rows, 100u);
+  ASSERT_TRUE(it.Status().ok()) << it.Status().message();
+
+  // An endless query is interrupted by the time budget.
+  budget = QueryBudget();
+  budget.max_duration_ms = 50;
+  it = tp.ExecuteQueryWithBudget(
+      "WITH RECURSIVE x(n) AS (SELECT 1 UNION ALL SELECT n + 1 FROM x) "
+      "SELECT COUNT(*) FROM x",
+      budget);
+  ASSERT_FALSE(it.Next());
+  ASSERT_FALSE(it.Status().ok());
+
+  // The budget does not apply to the following queries.
+  ASSERT_EQ(QueryLong(&tp, "SELECT COUNT(*) FROM counter"), 100);
+}
+
+TEST(TraceProcessorImplTest, QueryWithArgs) {
+  TraceProcessorImpl tp{Config()};
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1100)).ok());
+  tp.NotifyEndOfFile();
+
+  const std::string kQuery =
+      "SELECT COUNT(*), MIN(ts) FROM counter WHERE ts >= ? AND ts < ?";
+  auto count_in_range = [&](int64_t start, int64_t end) {
+    auto it = tp.ExecuteQueryWithArgs(
+        kQuery, {SqlValue::Long(start), SqlValue::Long(end)});
+    EXPECT_TRUE(it.Next());
+    EXPECT_TRUE(it.Status().ok()) << it.Status().message();
+    return it.Get(0).long_value;
+  };
+  int64_t hits = QueryLong(
+      &tp, "SELECT value FROM stats WHERE name = 'statement_cache_hits'");
+  ASSERT_EQ(count_in_range(1000, 1010), 10);
+  ASSERT_EQ(count_in_range(1050, 1100), 50);
+  ASSERT_EQ(count_in_range(2000, 3000), 0);
+  ASSERT_EQ(QueryLong(&tp,
+                      "SELECT value FROM stats "
+                      "WHERE name = 'statement_cache_hits'"),
+            hits + 2);
+
+  // Strings are copied and the parameters without args are NULL.
+  std::string name = "cpufreq";
+  auto it = tp.ExecuteQueryWithArgs("SELECT ? || 'x', ? IS NULL",
+                                    {SqlValue::String(name.c_str())});
+  name = "changed";
+  ASSERT_TRUE(it.Next());
+  ASSERT_STREQ(it.Get(0).string_value, "cpufreqx");
+  ASSERT_EQ(it.Get(1).long_value, 1);
+
+  // Too many args.
+  it = tp.ExecuteQueryWithArgs("SELECT ?", {SqlValue::Long(1),
+                                            SqlValue::Long(2)});
+  ASSERT_FALSE(it.Next());
+  ASSERT_FALSE(it.Status().ok());
+
+  // Creating and dropping tables does not break the cached statements.
+  it = tp.ExecuteQuery("CREATE TABLE t AS SELECT 1 AS x");
+  ASSERT_FALSE(it.Next());
+  ASSERT_EQ(count_in_range(1000, 1001), 1);
+  tp.RestoreInitialTables();
+  ASSERT_EQ(count_in_range(1000, 1001), 1);
+}
+
+TEST(TraceProcessorImplTest, MergeTraces) {
+  TraceProcessorImpl tp{Config()};
+
+  // The chunks of the traces can be interleaved and overlap in time.
+  ASSERT_TRUE(ParseTrace(&tp, 1, CpuFreqEvents(1050, 1100)).ok());
+  ASSERT_TRUE(ParseTrace(&tp, 0, CpuFreqEvents(1000, 1050)).ok());
+  ASSERT_TRUE(ParseTrace(&tp, 1, CpuFreqEvents(1100, 1150)).ok());
+
+  // The traces can have different formats.
+  const bool json_supported = json::IsJsonSupported();
+  if (json_supported) {
+    std::string json =
+        R"([{"name":"a","ph":"X","ts":1.1,"dur":1,"pid":1,"tid":1}])";
+    ASSERT_TRUE(ParseTrace(&tp, 2, std::vector<uint8_t>(json.begin(),
+                                                        json.end()))
+                    .ok());
+  }
+
+  // Parse() appends to the trace 0.
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1150, 1160)).ok());
+  tp.NotifyEndOfFile();
+
+  ASSERT_EQ(QueryLong(&tp, "SELECT COUNT(*) FROM counter"), 160);
+  ASSERT_EQ(QueryLong(&tp, "SELECT end_ts FROM trace_bounds"), 1159);
+  if (json_supported) {
+    ASSERT_EQ(QueryLong(&tp, "SELECT ts FROM slice WHERE name = 'a'"), 1100);
+  }
+}
+
+TEST(TraceProcessorImplTest, MergeTracesAfterParse) {
+  TraceProcessorImpl tp{Config()};
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1100)).ok());
+  ASSERT_FALSE(ParseTrace(&tp, 1, CpuFreqEvents(1000, 1100)).ok());
+}
+
+TEST(TraceProcessorImplTest, MetricsInWorkerProcesses) {
+  Config config;
+  config.metric_worker_processes = 2;
+  TraceProcessorImpl tp{config};
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1100)).ok());
+  tp.NotifyEndOfFile();
+
+  // A single metric is always computed in-process.
+  std::vector<uint8_t> expected;
+  for (const char* metric : {"trace_metadata", "trace_stats"}) {
+    std::vector<uint8_t> proto;
+    ASSERT_TRUE(tp.ComputeMetric({metric}, &proto).ok());
+    ASSERT_FALSE(proto.empty());
+    expected.insert(expected.end(), proto.begin(), proto.end());
+  }
+
+  std::vector<uint8_t> parallel;
+  ASSERT_TRUE(
+      tp.ComputeMetric({"trace_metadata", "trace_stats"}, &parallel).ok());
+  ASSERT_EQ(parallel, expected);
+
+  util::Status status = tp.ComputeMetric({"trace_stats", "unknown"}, &parallel);
+  ASSERT_FALSE(status.ok());
+}
+
+TEST(TraceProcessorImplTest, MetricsInWorkerProcessesShareDependencies) {
+  const std::vector<std::string> metrics = {"android_task_names",
+                                            "android_lmk_reason"};
+  TraceProcessorImpl serial_tp{Config()};
+  ASSERT_TRUE(Parse(&serial_tp, CpuFreqEvents(1000, 1100)).ok());
+  serial_tp.NotifyEndOfFile();
+  std::vector<uint8_t> expected;
+  ASSERT_TRUE(serial_tp.ComputeMetric(metrics, &expected).ok());
+
+  Config config;
+  config.metric_worker_processes = 2;
+  TraceProcessorImpl tp{config};
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 1100)).ok());
+  tp.NotifyEndOfFile();
+  std::vector<uint8_t> parallel;
+  ASSERT_TRUE(tp.ComputeMetric(metrics, &parallel).ok());
+  ASSERT_EQ(parallel, expected);
+
+  // Both metrics run android/process_metadata.sql: it is run once before
+  // forking, so the table it creates is also in this process.
+  auto it = tp.ExecuteQuery("SELECT * FROM process_metadata_table");
+  it.Next();
+  ASSERT_TRUE(it.Status().ok());
+}
+
+TEST(TraceProcessorImplTest, ExportRawEventsInParallel) {
+  TraceProcessorImpl tp{Config()};
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 41000)).ok());
+  tp.NotifyEndOfFile();
+
+  std::vector<std::string> lines;
+  for (const auto& row : QueryRows(&tp, "SELECT to_ftrace(id) FROM raw"))
+    lines.push_back(row[0]);
+  ASSERT_EQ(lines.size(), 40000u);
+
+  auto export_raw = [&tp](const systrace::ExportOptions& options) {
+    std::string text;
+    auto write = [&text](const char* data, size_t size) {
+      text.append(data, size);
+      return util::OkStatus();
+    };
+    EXPECT_TRUE(systrace::ExportRawEvents(&tp, options, write).ok());
+    return text;
+  };
+  auto join = [&lines](size_t begin, size_t end) {
+    std::string text;
+    for (size_t i = begin; i < end; ++i)
+      text += lines[i] + "\n";
+    return text;
+  };
+
+  // The lines are written in order, whatever the number of threads.
+  systrace::ExportOptions options;
+  ASSERT_EQ(export_raw(options), join(0, lines.size()));
+  options.worker_threads = 4;
+  ASSERT_EQ(export_raw(options), join(0, lines.size()));
+
+  options.max_events = 30000;
+  ASSERT_EQ(export_raw(options), join(0, 30000));
+  options.keep_end = true;
+  ASSERT_EQ(export_raw(options), join(10000, lines.size()));
+
+  options.max_events = 1;
+  options.escape_for_json = true;
+  ASSERT_EQ(export_raw(options), lines.back() + "\\n");
+}
+
+TEST(TraceProcessorImplTest, StreamRawEvents) {
+  TraceProcessorImpl tp{Config()};
+  systrace::ExportOptions options;
+  options.worker_threads = 4;
+  systrace::RawEventsStreamer streamer(&tp, options);
+  std::string text;
+  auto write = [&text](const char* data, size_t size) {
+    text.append(data, size);
+    return util::OkStatus();
+  };
+
+  // The events are exported as soon as they are parsed.
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(1000, 21000)).ok());
+  tp.Flush();
+  ASSERT_TRUE(streamer.ExportNewEvents(write).ok());
+  ASSERT_EQ(streamer.exported_events(), 20000u);
+  size_t first_size = text.size();
+  ASSERT_GT(first_size, 0u);
+  ASSERT_TRUE(streamer.ExportNewEvents(write).ok());
+  ASSERT_EQ(text.size(), first_size);
+
+  ASSERT_TRUE(Parse(&tp, CpuFreqEvents(21000, 41000)).ok());
+  tp.NotifyEndOfFile();
+  ASSERT_TRUE(streamer.ExportNewEvents(write).ok());
+  ASSERT_EQ(streamer.exported_events(), 40000u);
+
+  std::string expected;
+  for (const auto& row : QueryRows(&tp, "SELECT to_ftrace(id) FROM raw"))
+    expected += row[0] + "\n";
+  ASSERT_EQ(text, expected);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -54,6 +54,7 @@
 #include "src/trace_processor/rpc/httpd.h"
 #endif
 #include "src/profiling/deobfuscator.h"
+#include "src/profiling/symbolizer/caching_symbolizer.h"
 #include "src/profiling/symbolizer/local_symbolizer.h"
 #include "src/profiling/symbolizer/symbolize_database.h"
 #include "src/profiling/symbolizer/symbolizer.h"
@@ -62,8 +63,10 @@
     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
     PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
 #define PERFETTO_HAS_SIGNAL_H() 1
+#define PERFETTO_HAS_FORK() 1
 #else
 #define PERFETTO_HAS_SIGNAL_H() 0
+#define PERFETTO_HAS_FORK() 0
 #endif
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_LINENOISE)
@@ -76,6 +79,14 @@
 #include <signal.h>
 #endif
 
+#if PERFETTO_HAS_FORK()
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perfetto/ext/base/pipe.h"
+#endif
+
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #include <io.h>
 #define ftruncate _chsize
@@ -94,6 +105,9 @@ namespace trace_processor {
 namespace {
 TraceProcessor* g_tp;
 
+// Set by --profile-queries.
+bool g_profile_queries = false;
+
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_LINENOISE)
 
 bool EnsureDir(const std::string& path) {
@@ -244,6 +258,88 @@ util::Status PrintStats() {
   return util::OkStatus();
 }
 
+util::Status PrintMemoryUsage() {
+  auto it = g_tp->ExecuteQuery(
+      "SELECT category, name, SUM(size_bytes) AS size_bytes "
+      "FROM memory_usage GROUP BY category, name "
+      "ORDER BY size_bytes DESC");
+
+  uint64_t total_bytes = 0;
+  uint32_t rows = 0;
+  fprintf(stderr, "Memory usage (largest first):\n");
+  for (; it.Next(); rows++) {
+    uint64_t size_bytes = static_cast<uint64_t>(it.Get(2).long_value);
+    total_bytes += size_bytes;
+    // The rest are aggregated in the total.
+    if (rows >= 30)
+      continue;
+    fprintf(stderr, "%-16s %-40s %10.2f MB\n", it.Get(0).string_value,
+            it.Get(1).string_value, static_cast<double>(size_bytes) / 1e6);
+  }
+
+  util::Status status = it.Status();
+  if (!status.ok()) {
+    return util::ErrStatus("Error while iterating memory usage (%s)",
+                           status.c_message());
+  }
+  fprintf(stderr, "%-57s %10.2f MB\n", "Total",
+          static_cast<double>(total_bytes) / 1e6);
+  return util::OkStatus();
+}
+
+// Prints the profile of the last query if --profile-queries was passed.
+void MaybePrintQueryProfile() {
+  if (!g_profile_queries)
+    return;
+
+  // The query reading the profile must not replace it.
+  g_tp->EnableQueryProfiling(false);
+  auto it = g_tp->ExecuteQuery(
+      "SELECT operator, column_name, cursors, filters, rows_scanned, "
+      "rows_returned, cache_hits, filter_dur, next_dur "
+      "FROM query_profile "
+      "ORDER BY operator, column_name IS NOT NULL, column_name");
+  fprintf(stderr, "Query profile:\n%-48s %8s %8s %12s %12s %6s %10s %10s\n",
+          "operator / column", "cursors", "filters", "scanned", "returned",
+          "cache", "filter ms", "next ms");
+  auto print_long = [&it](uint32_t col, int width) {
+    SqlValue value = it.Get(col);
+    if (value.is_null()) {
+      fprintf(stderr, " %*s", width, "-");
+    } else {
+      fprintf(stderr, " %*" PRId64, width, value.long_value);
+    }
+  };
+  auto print_ms = [&it](uint32_t col) {
+    SqlValue value = it.Get(col);
+    if (value.is_null()) {
+      fprintf(stderr, " %10s", "-");
+    } else {
+      fprintf(stderr, " %10.3f", static_cast<double>(value.long_value) / 1e6);
+    }
+  };
+  while (it.Next()) {
+    // The columns are listed, indented, below their operator.
+    SqlValue column = it.Get(1);
+    std::string name = column.is_null()
+                           ? it.Get(0).string_value
+                           : std::string("  ") + column.string_value;
+    fprintf(stderr, "%-48s", name.c_str());
+    print_long(2, 8);
+    print_long(3, 8);
+    print_long(4, 12);
+    print_long(5, 12);
+    print_long(6, 6);
+    print_ms(7);
+    print_ms(8);
+    fprintf(stderr, "\n");
+  }
+  util::Status status = it.Status();
+  if (!status.ok())
+    PERFETTO_ELOG("Error reading the query profile: %s", status.c_message());
+  g_tp->EnableQueryProfiling(true);
+}
+
 util::Status ExportTraceToDatabase(const std::string& output_name) {
   PERFETTO_CHECK(output_name.find('\'') == std::string::npos);
   {
@@ -505,7 +601,25 @@ void PrintQueryResultInteractively(Iterator* it,
          static_cast<double>((t_end - t_start).count()) / 1E6);
 }
 
-util::Status PrintQueryResultAsCsv(Iterator* it, FILE* output) {
+// Prints |value| as a quoted CSV field, doubling its quotes, so that commas,
+// quotes and newlines in it do not break the row.
+void PrintCsvQuotedField(FILE* output, const std::string& value) {
+  fputc('"', output);
+  for (char c : value) {
+    if (c == '"')
+      fputc('"', output);
+    fputc(c, output);
+  }
+  fputc('"', output);
+}
+
+// If |trace_path| is not empty, it is printed as an extra first column of each
+// row (used to tell apart the rows of the different traces in --batch mode).
+util::Status PrintQueryResultAsCsv(Iterator* it,
+                                   FILE* output,
+                                   const std::string& trace_path) {
+  if (!trace_path.empty())
+    fprintf(output, "\"trace_path\",");
   for (uint32_t c = 0; c < it->ColumnCount(); c++) {
     if (c > 0)
       fprintf(output, ",");
@@ -514,6 +628,10 @@ util::Status PrintQueryResultAsCsv(Iterator* it, FILE* output) {
   fprintf(output, "\n");
 
   for (uint32_t rows = 0; it->Next(); rows++) {
+    if (!trace_path.empty()) {
+      PrintCsvQuotedField(output, trace_path);
+      fputc(',', output);
+    }
     for (uint32_t c = 0; c < it->ColumnCount(); c++) {
       if (c > 0)
         fprintf(output, ",");
@@ -598,7 +716,8 @@ util::Status RunQueriesWithoutOutput(const std::vector<std::string>& queries) {
 }
 
 util::Status RunQueriesAndPrintResult(const std::vector<std::string>& queries,
-                                      FILE* output) {
+                                      FILE* output,
+                                      const std::string& trace_path = "") {
   bool is_first_query = true;
   bool has_output = false;
   for (const auto& sql_query : queries) {
@@ -615,6 +734,7 @@ util::Status RunQueriesAndPrintResult(const std::vector<std::string>& queries,
       bool it_has_more = it.Next();
       RETURN_IF_ERROR(it.Status());
       PERFETTO_DCHECK(!it_has_more);
+      MaybePrintQueryProfile();
       continue;
     }
 
@@ -634,6 +754,7 @@ util::Status RunQueriesAndPrintResult(const std::vector<std::string>& queries,
       has_next = it.Next();
       RETURN_IF_ERROR(it.Status());
       PERFETTO_DCHECK(!has_next);
+      MaybePrintQueryProfile();
       continue;
     }
 
@@ -642,7 +763,8 @@ util::Status RunQueriesAndPrintResult(const std::vector<std::string>& queries,
           "More than one query generated result rows. This is unsupported.");
     }
     has_output = true;
-    RETURN_IF_ERROR(PrintQueryResultAsCsv(&it, output));
+    RETURN_IF_ERROR(PrintQueryResultAsCsv(&it, output, trace_path));
+    MaybePrintQueryProfile();
   }
   return util::OkStatus();
 }
@@ -701,12 +823,35 @@ struct CommandLineOptions {
   std::string metric_names;
   std::string metric_output;
   std::string trace_file_path;
+  std::vector<std::string> merged_trace_file_paths;
   std::string port_number;
   std::vector<std::string> raw_metric_extensions;
   bool launch_shell = false;
   bool enable_httpd = false;
   bool wide = false;
   bool force_full_sort = false;
+  bool print_memory = false;
+  bool profile_queries = false;
+  int64_t sorting_window_ns = 0;
+  uint32_t sorting_worker_threads = 0;
+  bool compress_columns = false;
+  bool lazy_ftrace_args = false;
+  bool no_syscall_slices = false;
+  bool coalesce_rss_stat = false;
+  int64_t rss_stat_resolution_ns = 0;
+  bool load_sections = false;
+  TraceSectionFilter section_filter;
+  uint64_t spill_budget_mb = 0;
+  bool pipelined_parsing = false;
+  uint32_t decompression_worker_threads = 0;
+  uint32_t metric_worker_processes = 0;
+  uint32_t span_join_worker_threads = 0;
+  uint32_t flamegraph_worker_threads = 0;
+  uint32_t track_event_worker_threads = 0;
+  uint32_t packet_preparation_worker_threads = 0;
+  uint32_t http_query_threads = 0;
+  std::string batch_file_path;
+  uint32_t batch_jobs = 1;
   std::string metatrace_path;
 };
 
@@ -735,6 +880,11 @@ Options:
                                       metrics and can't output any results.
  -D, --httpd                          Enables the HTTP RPC server.
  --http-port PORT                     Specify what port to run HTTP RPC server.
+ --http-query-threads N               Serves the queries of each HTTP client
+                                      connection on a query session of its
+                                      own, on up to N threads, so that the
+                                      queries of different clients run
+                                      concurrently.
  -i, --interactive                    Starts interactive mode even after a query
                                       file is specified with -q or
                                       --run-metrics.
@@ -755,6 +905,78 @@ Options:
  --full-sort                          Forces the trace processor into performing
                                       a full sort ignoring any windowing
                                       logic.
+ --print-memory                       Prints the memory used by the tables,
+                                      string pool and sorter of trace processor
+                                      once the trace is loaded (see the
+                                      memory_usage table).
+ --profile-queries                    Prints, after each query, the time spent
+                                      in each table and in the filtering of
+                                      each column and the rows they scanned and
+                                      returned (see the query_profile table).
+ --sort-window-ns N                   Only sorts events within a sliding window
+                                      of N nanoseconds, bounding the memory
+                                      used by sorting.
+ --sort-threads N                     Uses up to N threads to sort the per-CPU
+                                      event queues while loading the trace.
+ --compress-columns                   Compresses the integer columns of large
+                                      tables once the trace is loaded to
+                                      reduce memory usage.
+ --lazy-ftrace-args                   Only decodes the fields of the ftrace
+                                      events into the args table when the raw
+                                      or args table is first queried.
+ --no-syscall-slices                  Only stores the syscalls in the syscall
+                                      table instead of also turning them into
+                                      slices.
+ --coalesce-rss-stat                  Drops the rss_stat samples which have the
+                                      same value as the previous sample of
+                                      their counter track.
+ --rss-stat-resolution-ns N           Keeps at most two rss_stat samples, with
+                                      the min and max values, per N ns of
+                                      each counter track.
+ --load-window-ns START,END           Only reads the parts of an indexed trace
+                                      (see TraceConfig.write_trace_index)
+                                      needed for the events between START
+                                      and END ns.
+ --load-packet-types ID[,ID...]       Only reads the parts of an indexed trace
+                                      with these TracePacket field ids (e.g.
+                                      1 for ftrace_events).
+ --spill-budget-mb N                  Once the trace is loaded, moves the
+                                      compressed columns of large tables to a
+                                      memory mapped temporary file until the
+                                      memory used by the process is below N
+                                      MB. Implies --compress-columns.
+ --pipelined-parsing                  Parses the sorted events on a separate
+                                      thread while loading the trace.
+ --decompression-threads N            Uses up to N threads to decompress the
+                                      compressed packets of the trace.
+ --metric-processes N                 Computes the metrics passed to
+                                      --run-metrics in up to N forked
+                                      processes (Linux and Android only).
+                                      The tables created by the metrics are
+                                      then not available to -q.
+ --span-join-threads N                Uses up to N threads to join the
+                                      partitions of SPAN_JOIN tables.
+ --flamegraph-threads N               Uses up to N threads to sum the samples
+                                      of the experimental_flamegraph table.
+ --track-event-threads N              Uses up to N threads to decode track
+                                      events and intern their names before
+                                      they are parsed.
+ --profile-threads N                  Uses up to N threads to decode heap
+                                      graphs and heapprofd profiles before
+                                      they are parsed.
+ --batch FILE                         Processes each of the traces listed in
+                                      FILE (one path per line) instead of a
+                                      single trace. Requires -q: the results
+                                      of all the traces are printed as a
+                                      single CSV table, with an extra first
+                                      column holding the trace path.
+ --batch-jobs N                       Number of traces processed in parallel
+                                      in --batch mode (default: 1).
+ --merge-trace FILE                   Loads FILE along with the trace file
+                                      into the same instance, merging their
+                                      events. Each file is read on a thread of
+                                      its own and has its own clock domains.
+                                      Can be repeated.
  --metric-extension DISK_PATH@VIRTUAL_PATH
                                       Loads metric proto and sql files from
                                       DISK_PATH/protos and DISK_PATH/sql
@@ -772,6 +994,29 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_FORCE_FULL_SORT,
     OPT_HTTP_PORT,
     OPT_METRIC_EXTENSION,
+    OPT_SORT_THREADS,
+    OPT_COMPRESS_COLUMNS,
+    OPT_LAZY_FTRACE_ARGS,
+    OPT_NO_SYSCALL_SLICES,
+    OPT_COALESCE_RSS_STAT,
+    OPT_RSS_STAT_RESOLUTION_NS,
+    OPT_LOAD_WINDOW_NS,
+    OPT_LOAD_PACKET_TYPES,
+    OPT_SPILL_BUDGET_MB,
+    OPT_PIPELINED_PARSING,
+    OPT_DECOMPRESSION_THREADS,
+    OPT_SORT_WINDOW_NS,
+    OPT_METRIC_PROCESSES,
+    OPT_BATCH,
+    OPT_BATCH_JOBS,
+    OPT_SPAN_JOIN_THREADS,
+    OPT_FLAMEGRAPH_THREADS,
+    OPT_TRACK_EVENT_THREADS,
+    OPT_PROFILE_THREADS,
+    OPT_HTTP_QUERY_THREADS,
+    OPT_PRINT_MEMORY,
+    OPT_PROFILE_QUERIES,
+    OPT_MERGE_TRACE,
   };
 
   static const option long_options[] = {
@@ -789,8 +1034,37 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"pre-metrics", required_argument, nullptr, OPT_PRE_METRICS},
       {"metrics-output", required_argument, nullptr, OPT_METRICS_OUTPUT},
       {"full-sort", no_argument, nullptr, OPT_FORCE_FULL_SORT},
+      {"print-memory", no_argument, nullptr, OPT_PRINT_MEMORY},
+      {"profile-queries", no_argument, nullptr, OPT_PROFILE_QUERIES},
       {"http-port", required_argument, nullptr, OPT_HTTP_PORT},
+      {"http-query-threads", required_argument, nullptr,
+       OPT_HTTP_QUERY_THREADS},
       {"metric-extension", required_argument, nullptr, OPT_METRIC_EXTENSION},
+      {"sort-threads", required_argument, nullptr, OPT_SORT_THREADS},
+      {"compress-columns", no_argument, nullptr, OPT_COMPRESS_COLUMNS},
+      {"lazy-ftrace-args", no_argument, nullptr, OPT_LAZY_FTRACE_ARGS},
+      {"no-syscall-slices", no_argument, nullptr, OPT_NO_SYSCALL_SLICES},
+      {"coalesce-rss-stat", no_argument, nullptr, OPT_COALESCE_RSS_STAT},
+      {"rss-stat-resolution-ns", required_argument, nullptr,
+       OPT_RSS_STAT_RESOLUTION_NS},
+      {"load-window-ns", required_argument, nullptr, OPT_LOAD_WINDOW_NS},
+      {"load-packet-types", required_argument, nullptr,
+       OPT_LOAD_PACKET_TYPES},
+      {"spill-budget-mb", required_argument, nullptr, OPT_SPILL_BUDGET_MB},
+      {"pipelined-parsing", no_argument, nullptr, OPT_PIPELINED_PARSING},
+      {"decompression-threads", required_argument, nullptr,
+       OPT_DECOMPRESSION_THREADS},
+      {"sort-window-ns", required_argument, nullptr, OPT_SORT_WINDOW_NS},
+      {"metric-processes", required_argument, nullptr, OPT_METRIC_PROCESSES},
+      {"batch", required_argument, nullptr, OPT_BATCH},
+      {"batch-jobs", required_argument, nullptr, OPT_BATCH_JOBS},
+      {"span-join-threads", required_argument, nullptr, OPT_SPAN_JOIN_THREADS},
+      {"flamegraph-threads", required_argument, nullptr,
+       OPT_FLAMEGRAPH_THREADS},
+      {"track-event-threads", required_argument, nullptr,
+       OPT_TRACK_EVENT_THREADS},
+      {"profile-threads", required_argument, nullptr, OPT_PROFILE_THREADS},
+      {"merge-trace", required_argument, nullptr, OPT_MERGE_TRACE},
       {nullptr, 0, nullptr, 0}};
 
   bool explicit_interactive = false;
@@ -872,16 +1146,212 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_PRINT_MEMORY) {
+      command_line_options.print_memory = true;
+      continue;
+    }
+
+    if (option == OPT_PROFILE_QUERIES) {
+      command_line_options.profile_queries = true;
+      continue;
+    }
+
     if (option == OPT_HTTP_PORT) {
       command_line_options.port_number = optarg;
       continue;
     }
 
+    if (option == OPT_HTTP_QUERY_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --http-query-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.http_query_threads = *threads;
+      continue;
+    }
+
     if (option == OPT_METRIC_EXTENSION) {
       command_line_options.raw_metric_extensions.push_back(optarg);
       continue;
     }
 
+    if (option == OPT_SORT_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --sort-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.sorting_worker_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_COMPRESS_COLUMNS) {
+      command_line_options.compress_columns = true;
+      continue;
+    }
+
+    if (option == OPT_LAZY_FTRACE_ARGS) {
+      command_line_options.lazy_ftrace_args = true;
+      continue;
+    }
+
+    if (option == OPT_NO_SYSCALL_SLICES) {
+      command_line_options.no_syscall_slices = true;
+      continue;
+    }
+
+    if (option == OPT_COALESCE_RSS_STAT) {
+      command_line_options.coalesce_rss_stat = true;
+      continue;
+    }
+
+    if (option == OPT_RSS_STAT_RESOLUTION_NS) {
+      base::Optional<int64_t> resolution = base::CStringToInt64(optarg);
+      if (!resolution || *resolution <= 0) {
+        PERFETTO_ELOG("Invalid value for --rss-stat-resolution-ns: %s",
+                      optarg);
+        exit(1);
+      }
+      command_line_options.rss_stat_resolution_ns = *resolution;
+      continue;
+    }
+
+    if (option == OPT_LOAD_WINDOW_NS) {
+      std::vector<std::string> parts = base::SplitString(optarg, ",");
+      base::Optional<int64_t> start, end;
+      if (parts.size() == 2) {
+        start = base::StringToInt64(parts[0]);
+        end = base::StringToInt64(parts[1]);
+      }
+      if (!start || !end || *start > *end) {
+        PERFETTO_ELOG("Invalid value for --load-window-ns: %s", optarg);
+        exit(1);
+      }
+      command_line_options.load_sections = true;
+      command_line_options.section_filter.start_ts = *start;
+      command_line_options.section_filter.end_ts = *end;
+      continue;
+    }
+
+    if (option == OPT_LOAD_PACKET_TYPES) {
+      for (base::StringSplitter ss(optarg, ','); ss.Next();) {
+        base::Optional<uint32_t> type = base::CStringToUInt32(ss.cur_token());
+        if (!type) {
+          PERFETTO_ELOG("Invalid value for --load-packet-types: %s", optarg);
+          exit(1);
+        }
+        command_line_options.section_filter.packet_types.push_back(*type);
+      }
+      command_line_options.load_sections = true;
+      continue;
+    }
+
+    if (option == OPT_SPILL_BUDGET_MB) {
+      base::Optional<uint32_t> budget_mb = base::CStringToUInt32(optarg);
+      if (!budget_mb || *budget_mb == 0) {
+        PERFETTO_ELOG("Invalid value for --spill-budget-mb: %s", optarg);
+        exit(1);
+      }
+      command_line_options.spill_budget_mb = *budget_mb;
+      continue;
+    }
+
+    if (option == OPT_PIPELINED_PARSING) {
+      command_line_options.pipelined_parsing = true;
+      continue;
+    }
+
+    if (option == OPT_DECOMPRESSION_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --decompression-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.decompression_worker_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_SORT_WINDOW_NS) {
+      base::Optional<int64_t> window = base::CStringToInt64(optarg);
+      if (!window || *window <= 0) {
+        PERFETTO_ELOG("Invalid value for --sort-window-ns: %s", optarg);
+        exit(1);
+      }
+      command_line_options.sorting_window_ns = *window;
+      continue;
+    }
+
+    if (option == OPT_METRIC_PROCESSES) {
+      base::Optional<uint32_t> processes = base::CStringToUInt32(optarg);
+      if (!processes) {
+        PERFETTO_ELOG("Invalid value for --metric-processes: %s", optarg);
+        exit(1);
+      }
+      command_line_options.metric_worker_processes = *processes;
+      continue;
+    }
+
+    if (option == OPT_BATCH) {
+      command_line_options.batch_file_path = optarg;
+      continue;
+    }
+
+    if (option == OPT_BATCH_JOBS) {
+      base::Optional<uint32_t> jobs = base::CStringToUInt32(optarg);
+      if (!jobs || *jobs == 0) {
+        PERFETTO_ELOG("Invalid value for --batch-jobs: %s", optarg);
+        exit(1);
+      }
+      command_line_options.batch_jobs = *jobs;
+      continue;
+    }
+
+    if (option == OPT_SPAN_JOIN_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --span-join-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.span_join_worker_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_FLAMEGRAPH_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --flamegraph-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.flamegraph_worker_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_TRACK_EVENT_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --track-event-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.track_event_worker_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_PROFILE_THREADS) {
+      base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads) {
+        PERFETTO_ELOG("Invalid value for --profile-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.packet_preparation_worker_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_MERGE_TRACE) {
+      command_line_options.merged_trace_file_paths.push_back(optarg);
+      continue;
+    }
+
     PrintUsage(argv);
     exit(option == 'h' ? 0 : 1);
   }
@@ -899,12 +1369,36 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     exit(1);
   }
 
-  // The only case where we allow omitting the trace file path is when running
-  // in --http mode. In all other cases, the last argument must be the trace
-  // file.
+  // The only cases where we allow omitting the trace file path are when running
+  // in --http or --batch mode. In all other cases, the last argument must be
+  // the trace file.
   if (optind == argc - 1 && argv[optind]) {
     command_line_options.trace_file_path = argv[optind];
-  } else if (!command_line_options.enable_httpd) {
+  } else if (!command_line_options.enable_httpd &&
+             command_line_options.batch_file_path.empty()) {
+    PrintUsage(argv);
+    exit(1);
+  }
+
+  // The traces passed to --merge-trace are merged into the trace file.
+  if (!command_line_options.merged_trace_file_paths.empty() &&
+      command_line_options.trace_file_path.empty()) {
+    PrintUsage(argv);
+    exit(1);
+  }
+
+  // --batch only supports printing the results of -q and the traces are
+  // processed in their own processes, so there is no single instance to
+  // export, serve or query interactively.
+  if (!command_line_options.batch_file_path.empty() &&
+      (command_line_options.query_file_path.empty() ||
+       !command_line_options.trace_file_path.empty() ||
+       !command_line_options.merged_trace_file_paths.empty() ||
+       command_line_options.launch_shell || command_line_options.enable_httpd ||
+       !command_line_options.sqlite_file_path.empty() ||
+       !command_line_options.perf_file_path.empty() ||
+       !command_line_options.metatrace_path.empty() ||
+       command_line_options.metric_worker_processes > 0)) {
     PrintUsage(argv);
     exit(1);
   }
@@ -925,20 +1419,36 @@ void ExtendPoolWithBinaryDescriptor(google::protobuf::DescriptorPool& pool,
   }
 }
 
-util::Status LoadTrace(const std::string& trace_file_path, double* size_mb) {
-  util::Status read_status =
-      ReadTrace(g_tp, trace_file_path.c_str(), [&size_mb](size_t parsed_size) {
-        *size_mb = static_cast<double>(parsed_size) / 1E6;
-        fprintf(stderr, "\rLoading trace: %.2f MB\r", *size_mb);
-      });
+util::Status LoadTrace(
+    const std::string& trace_file_path,
+    double* size_mb,
+    const std::vector<std::string>& merged_trace_file_paths = {},
+    const TraceSectionFilter* section_filter = nullptr) {
+  auto progress_callback = [&size_mb](size_t parsed_size) {
+    *size_mb = static_cast<double>(parsed_size) / 1E6;
+    fprintf(stderr, "\rLoading trace: %.2f MB\r", *size_mb);
+  };
+  util::Status read_status;
+  if (merged_trace_file_paths.empty() && section_filter) {
+    read_status = ReadTraceSections(g_tp, trace_file_path.c_str(),
+                                    *section_filter, progress_callback);
+  } else if (merged_trace_file_paths.empty()) {
+    read_status = ReadTrace(g_tp, trace_file_path.c_str(), progress_callback);
+  } else {
+    std::vector<std::string> paths{trace_file_path};
+    paths.insert(paths.end(), merged_trace_file_paths.begin(),
+                 merged_trace_file_paths.end());
+    read_status = ReadTraces(g_tp, paths, progress_callback);
+  }
   if (!read_status.ok()) {
     return util::ErrStatus("Could not read trace file (path: %s): %s",
                            trace_file_path.c_str(), read_status.c_message());
   }
 
   std::unique_ptr<profiling::Symbolizer> symbolizer =
-      profiling::LocalSymbolizerOrDie(profiling::GetPerfettoBinaryPath(),
-                                      getenv("PERFETTO_SYMBOLIZER_MODE"));
+      profiling::MaybeCachingSymbolizer(profiling::LocalSymbolizerOrDie(
+          profiling::GetPerfettoBinaryPath(),
+          getenv("PERFETTO_SYMBOLIZER_MODE")));
 
   if (symbolizer) {
     profiling::SymbolizeDatabase(
@@ -972,15 +1482,20 @@ util::Status LoadTrace(const std::string& trace_file_path, double* size_mb) {
   return util::OkStatus();
 }
 
-util::Status RunQueries(const std::string& query_file_path,
-                        bool expect_output) {
-  std::vector<std::string> queries;
+util::Status LoadQueryFile(const std::string& query_file_path,
+                           std::vector<std::string>* queries) {
   base::ScopedFstream file(fopen(query_file_path.c_str(), "r"));
   if (!file) {
     return util::ErrStatus("Could not open query file (path: %s)",
                            query_file_path.c_str());
   }
-  RETURN_IF_ERROR(LoadQueries(file.get(), &queries));
+  return LoadQueries(file.get(), queries);
+}
+
+util::Status RunQueries(const std::string& query_file_path,
+                        bool expect_output) {
+  std::vector<std::string> queries;
+  RETURN_IF_ERROR(LoadQueryFile(query_file_path, &queries));
 
   util::Status status;
   if (expect_output) {
@@ -1123,13 +1638,13 @@ base::Status LoadMetricExtension(const MetricExtension& extension) {
   return base::OkStatus();
 }
 
-util::Status RunMetrics(const CommandLineOptions& options,
-                        std::vector<MetricExtension>& metric_extensions) {
-  // Descriptor pool used for printing output as textproto. Building on top of
-  // generated pool so default protos in google.protobuf.descriptor.proto are
-  // available.
-  google::protobuf::DescriptorPool pool(
-      google::protobuf::DescriptorPool::generated_pool());
+// Registers the metrics of |options.metric_names| which are files, extending
+// |pool| with their protos, and returns in |metrics| the names of all the
+// metrics to compute.
+util::Status LoadMetrics(const CommandLineOptions& options,
+                         std::vector<MetricExtension>& metric_extensions,
+                         google::protobuf::DescriptorPool* pool,
+                         std::vector<std::string>* metrics_out) {
   // TODO(b/182165266): There is code duplication here with trace_processor_impl
   // SetupMetrics. This will be removed when we switch the output formatter to
   // use internal DescriptorPool.
@@ -1138,9 +1653,9 @@ util::Status RunMetrics(const CommandLineOptions& options,
   for (const auto& ext : metric_extensions) {
     skip_prefixes.push_back(kMetricProtoRoot + ext.virtual_path());
   }
-  ExtendPoolWithBinaryDescriptor(pool, kMetricsDescriptor.data(),
+  ExtendPoolWithBinaryDescriptor(*pool, kMetricsDescriptor.data(),
                                  kMetricsDescriptor.size(), skip_prefixes);
-  ExtendPoolWithBinaryDescriptor(pool, kAllChromeMetricsDescriptor.data(),
+  ExtendPoolWithBinaryDescriptor(*pool, kAllChromeMetricsDescriptor.data(),
                                  kAllChromeMetricsDescriptor.size(),
                                  skip_prefixes);
 
@@ -1162,7 +1677,7 @@ util::Status RunMetrics(const CommandLineOptions& options,
     std::string no_ext_name = metric_or_path.substr(0, ext_idx);
 
     // The proto must be extended before registering the metric.
-    util::Status status = ExtendMetricsProto(no_ext_name + ".proto", &pool);
+    util::Status status = ExtendMetricsProto(no_ext_name + ".proto", pool);
     if (!status.ok()) {
       return util::ErrStatus("Unable to extend metrics proto %s: %s",
                              metric_or_path.c_str(), status.c_message());
@@ -1176,6 +1691,19 @@ util::Status RunMetrics(const CommandLineOptions& options,
 
     metrics[i] = BaseName(no_ext_name);
   }
+  *metrics_out = std::move(metrics);
+  return util::OkStatus();
+}
+
+util::Status RunMetrics(const CommandLineOptions& options,
+                        std::vector<MetricExtension>& metric_extensions) {
+  // Descriptor pool used for printing output as textproto. Building on top of
+  // generated pool so default protos in google.protobuf.descriptor.proto are
+  // available.
+  google::protobuf::DescriptorPool pool(
+      google::protobuf::DescriptorPool::generated_pool());
+  std::vector<std::string> metrics;
+  RETURN_IF_ERROR(LoadMetrics(options, metric_extensions, &pool, &metrics));
 
   OutputFormat format;
   if (!options.query_file_path.empty()) {
@@ -1191,6 +1719,167 @@ util::Status RunMetrics(const CommandLineOptions& options,
   return RunMetrics(std::move(metrics), format, pool);
 }
 
+#if PERFETTO_HAS_FORK()
+// A trace being processed in --batch mode by a child process.
+struct BatchJob {
+  std::string trace_path;
+  pid_t pid = -1;
+  // Read end of the pipe the child writes its CSV output to.
+  base::ScopedFile rd;
+  std::string output;
+};
+
+util::Status ProcessBatchTrace(const std::string& trace_path,
+                               const std::vector<std::string>& pre_metrics,
+                               const std::vector<std::string>& metrics,
+                               const google::protobuf::DescriptorPool& pool,
+                               const std::vector<std::string>& queries,
+                               FILE* output) {
+  double size_mb = 0;
+  RETURN_IF_ERROR(LoadTrace(trace_path, &size_mb));
+  RETURN_IF_ERROR(PrintStats());
+  RETURN_IF_ERROR(RunQueriesWithoutOutput(pre_metrics));
+  if (!metrics.empty())
+    RETURN_IF_ERROR(RunMetrics(metrics, OutputFormat::kNone, pool));
+  return RunQueriesAndPrintResult(queries, output, trace_path);
+}
+
+// Prints the output of a completed job to stdout, omitting the CSV header if
+// it was already printed for a previous trace. Returns false if the columns
+// don't match the ones of the previous traces.
+bool PrintBatchOutput(const BatchJob& job, std::string* header) {
+  // RunQueriesAndPrintResult() separates the results of the queries with empty
+  // lines.
+  size_t start = job.output.find_first_not_of('\n');
+  if (start == std::string::npos)
+    return true;
+  size_t rows = job.output.find('\n', start);
+  rows = rows == std::string::npos ? job.output.size() : rows + 1;
+  std::string job_header = job.output.substr(start, rows - start);
+  if (header->empty()) {
+    *header = std::move(job_header);
+    fwrite(header->data(), sizeof(char), header->size(), stdout);
+  } else if (job_header != *header) {
+    PERFETTO_ELOG("Columns of %s don't match the previous traces",
+                  job.trace_path.c_str());
+    return false;
+  }
+  fwrite(job.output.data() + rows, sizeof(char), job.output.size() - rows,
+         stdout);
+  return true;
+}
+
+// Processes all the traces listed in the --batch file. The expensive setup
+// which doesn't depend on the trace (builtin tables and metrics, metric
+// extensions, query files) is done once in g_tp, which is then forked into a
+// child process for each trace. Up to --batch-jobs children run at the same
+// time and their outputs are printed whole, as soon as they complete.
+util::Status RunBatch(const CommandLineOptions& options,
+                      std::vector<MetricExtension>& metric_extensions) {
+  std::string batch_file;
+  if (!base::ReadFile(options.batch_file_path, &batch_file)) {
+    return util::ErrStatus("Could not read batch file (path: %s)",
+                           options.batch_file_path.c_str());
+  }
+  std::vector<std::string> traces;
+  for (base::StringSplitter ss(std::move(batch_file), '\n'); ss.Next();) {
+    std::string trace_path = base::TrimLeading(ss.cur_token());
+    if (!trace_path.empty() && trace_path.back() == '\r')
+      trace_path.pop_back();
+    if (!trace_path.empty())
+      traces.emplace_back(std::move(trace_path));
+  }
+
+  std::vector<std::string> pre_metrics;
+  if (!options.pre_metrics_path.empty())
+    RETURN_IF_ERROR(LoadQueryFile(options.pre_metrics_path, &pre_metrics));
+  std::vector<std::string> queries;
+  RETURN_IF_ERROR(LoadQueryFile(options.query_file_path, &queries));
+  google::protobuf::DescriptorPool pool(
+      google::protobuf::DescriptorPool::generated_pool());
+  std::vector<std::string> metrics;
+  if (!options.metric_names.empty())
+    RETURN_IF_ERROR(LoadMetrics(options, metric_extensions, &pool, &metrics));
+
+  base::TimeNanos t_start = base::GetWallTimeNs();
+  std::vector<BatchJob> jobs;
+  std::string header;
+  size_t next_trace = 0;
+  size_t failed = 0;
+  while (next_trace < traces.size() || !jobs.empty()) {
+    while (next_trace < traces.size() && jobs.size() < options.batch_jobs) {
+      BatchJob job;
+      job.trace_path = traces[next_trace++];
+      base::Pipe pipe = base::Pipe::Create();
+
+      // Otherwise the buffered output would be flushed by the child as well.
+      fflush(stdout);
+      fflush(stderr);
+      job.pid = fork();
+      if (job.pid < 0) {
+        PERFETTO_PLOG("fork() failed for %s", job.trace_path.c_str());
+        failed++;
+        continue;
+      }
+      if (job.pid == 0) {
+        pipe.rd.reset();
+        FILE* output = fdopen(pipe.wr.release(), "w");
+        util::Status status =
+            ProcessBatchTrace(job.trace_path, pre_metrics, metrics, pool,
+                              queries, output);
+        if (!status.ok())
+          PERFETTO_ELOG("%s: %s", job.trace_path.c_str(), status.c_message());
+        fclose(output);
+        _exit(status.ok() ? 0 : 1);
+      }
+      job.rd = std::move(pipe.rd);
+      jobs.emplace_back(std::move(job));
+    }
+    if (jobs.empty())
+      continue;
+
+    std::vector<struct pollfd> fds(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      fds[i].fd = *jobs[i].rd;
+      fds[i].events = POLLIN;
+    }
+    nfds_t nfds = static_cast<nfds_t>(fds.size());
+    if (PERFETTO_EINTR(poll(fds.data(), nfds, -1)) < 0)
+      return util::ErrStatus("poll() failed: %s", strerror(errno));
+
+    // Iterate backwards so that completed jobs can be erased.
+    for (size_t i = jobs.size(); i-- > 0;) {
+      if (fds[i].revents == 0)
+        continue;
+      char buf[4096];
+      ssize_t rsize = PERFETTO_EINTR(read(fds[i].fd, buf, sizeof(buf)));
+      if (rsize > 0) {
+        jobs[i].output.append(buf, static_cast<size_t>(rsize));
+        continue;
+      }
+      int wstatus = 0;
+      PERFETTO_EINTR(waitpid(jobs[i].pid, &wstatus, 0));
+      bool ok = rsize == 0 && WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+      if (!ok || !PrintBatchOutput(jobs[i], &header)) {
+        PERFETTO_ELOG("Failed to process trace %s", jobs[i].trace_path.c_str());
+        failed++;
+      }
+      jobs.erase(jobs.begin() + static_cast<ptrdiff_t>(i));
+    }
+  }
+  fflush(stdout);
+
+  double t_batch_s =
+      static_cast<double>((base::GetWallTimeNs() - t_start).count()) / 1E9;
+  PERFETTO_ILOG("Processed %zu traces in %.1f s", traces.size(), t_batch_s);
+  if (failed > 0) {
+    return util::ErrStatus("Failed to process %zu out of %zu traces", failed,
+                           traces.size());
+  }
+  return util::OkStatus();
+}
+#endif  // PERFETTO_HAS_FORK()
+
 void PrintShellUsage() {
   PERFETTO_ELOG(
       "Available commands:\n"
@@ -1239,6 +1928,7 @@ util::Status StartInteractiveShell(uint32_t column_width) {
     base::TimeNanos t_start = base::GetWallTimeNs();
     auto it = g_tp->ExecuteQuery(line.get());
     PrintQueryResultInteractively(&it, t_start, column_width);
+    MaybePrintQueryProfile();
   }
   return util::OkStatus();
 }
@@ -1247,9 +1937,29 @@ util::Status TraceProcessorMain(int argc, char** argv) {
   CommandLineOptions options = ParseCommandLineOptions(argc, argv);
 
   Config config;
-  config.sorting_mode = options.force_full_sort
-                            ? SortingMode::kForceFullSort
-                            : SortingMode::kDefaultHeuristics;
+  if (options.force_full_sort) {
+    config.sorting_mode = SortingMode::kForceFullSort;
+  } else if (options.sorting_window_ns > 0) {
+    config.sorting_mode = SortingMode::kForceWindowedSort;
+    config.sorting_window_ns = options.sorting_window_ns;
+  } else {
+    config.sorting_mode = SortingMode::kDefaultHeuristics;
+  }
+  config.sorting_worker_threads = options.sorting_worker_threads;
+  config.compress_integer_columns = options.compress_columns;
+  config.lazy_ftrace_raw_args = options.lazy_ftrace_args;
+  config.ingest_syscalls_as_slices = !options.no_syscall_slices;
+  config.coalesce_rss_stat_counters = options.coalesce_rss_stat;
+  config.rss_stat_resolution_ns = options.rss_stat_resolution_ns;
+  config.spill_memory_budget_bytes = options.spill_budget_mb * 1024 * 1024;
+  config.pipelined_parsing = options.pipelined_parsing;
+  config.decompression_worker_threads = options.decompression_worker_threads;
+  config.metric_worker_processes = options.metric_worker_processes;
+  config.span_join_worker_threads = options.span_join_worker_threads;
+  config.flamegraph_worker_threads = options.flamegraph_worker_threads;
+  config.track_event_worker_threads = options.track_event_worker_threads;
+  config.packet_preparation_worker_threads =
+      options.packet_preparation_worker_threads;
 
   std::vector<MetricExtension> metric_extensions;
   RETURN_IF_ERROR(ParseMetricExtensionPaths(options.raw_metric_extensions,
@@ -1267,6 +1977,11 @@ util::Status TraceProcessorMain(int argc, char** argv) {
     tp->EnableMetatrace();
   }
 
+  if (options.profile_queries) {
+    g_profile_queries = true;
+    tp->EnableQueryProfiling(true);
+  }
+
   // We load all the metric extensions even when --run-metrics arg is not there,
   // because we want the metrics to be available in interactive mode or when
   // used in UI using httpd.
@@ -1274,11 +1989,21 @@ util::Status TraceProcessorMain(int argc, char** argv) {
     RETURN_IF_ERROR(LoadMetricExtension(extension));
   }
 
+  if (!options.batch_file_path.empty()) {
+#if PERFETTO_HAS_FORK()
+    return RunBatch(options, metric_extensions);
+#else
+    return util::ErrStatus("--batch is not supported on this platform");
+#endif
+  }
+
   base::TimeNanos t_load{};
   if (!options.trace_file_path.empty()) {
     base::TimeNanos t_load_start = base::GetWallTimeNs();
     double size_mb = 0;
-    RETURN_IF_ERROR(LoadTrace(options.trace_file_path, &size_mb));
+    RETURN_IF_ERROR(LoadTrace(
+        options.trace_file_path, &size_mb, options.merged_trace_file_paths,
+        options.load_sections ? &options.section_filter : nullptr));
     t_load = base::GetWallTimeNs() - t_load_start;
 
     double t_load_s = static_cast<double>(t_load.count()) / 1E9;
@@ -1286,11 +2011,14 @@ util::Status TraceProcessorMain(int argc, char** argv) {
                   size_mb / t_load_s);
 
     RETURN_IF_ERROR(PrintStats());
+    if (options.print_memory)
+      RETURN_IF_ERROR(PrintMemoryUsage());
   }
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_HTTPD)
   if (options.enable_httpd) {
-    RunHttpRPCServer(std::move(tp), options.port_number);
+    RunHttpRPCServer(std::move(tp), options.port_number,
+                     options.http_query_threads);
     PERFETTO_FATAL("Should never return");
   }
 #endif
@@ -16,6 +16,8 @@
 
 #include "perfetto/trace_processor/trace_processor_storage.h"
 
+#include <string.h>
+
 #include "src/trace_processor/trace_processor_storage_impl.h"
 
 namespace perfetto {
@@ -30,5 +32,21 @@ std::unique_ptr<TraceProcessorStorage> TraceProcessorStorage::CreateInstance(
 
 TraceProcessorStorage::~TraceProcessorStorage() = default;
 
+util::Status TraceProcessorStorage::ParseShared(
+    std::shared_ptr<const uint8_t> data,
+    size_t size) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+  memcpy(buf.get(), data.get(), size);
+  return Parse(std::move(buf), size);
+}
+
+util::Status TraceProcessorStorage::ParseTrace(uint32_t trace_idx,
+                                              std::unique_ptr<uint8_t[]> data,
+                                              size_t size) {
+  if (trace_idx != 0)
+    return util::ErrStatus("Loading several traces is not supported");
+  return Parse(std::move(data), size);
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/trace_processor_storage_impl.h"
 
+#include <cinttypes>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/uuid.h"
 #include "src/trace_processor/forwarding_trace_parser.h"
@@ -38,6 +40,7 @@
 #include "src/trace_processor/importers/track_event.descriptor.h"
 #include "src/trace_processor/trace_sorter.h"
 #include "src/trace_processor/util/descriptors.h"
+#include "src/trace_processor/util/status_macros.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -59,18 +62,13 @@ TraceProcessorStorageImpl::TraceProcessorStorageImpl(const Config& cfg) {
   context_.global_stack_profile_tracker.reset(new GlobalStackProfileTracker());
   context_.metadata_tracker.reset(new MetadataTracker(&context_));
   context_.global_args_tracker.reset(new GlobalArgsTracker(&context_));
-  {
-    context_.descriptor_pool_.reset(new DescriptorPool());
-    auto status = context_.descriptor_pool_->AddFromFileDescriptorSet(
-        kTrackEventDescriptor.data(), kTrackEventDescriptor.size());
-
-    PERFETTO_DCHECK(status.ok());
-
-    status = context_.descriptor_pool_->AddFromFileDescriptorSet(
-        kChromeTrackEventDescriptor.data(), kChromeTrackEventDescriptor.size());
-
-    PERFETTO_DCHECK(status.ok());
-  }
+  // The descriptors are only decoded when a trace with typed TrackEvent
+  // arguments needs them.
+  context_.descriptor_pool_.reset(new DescriptorPool());
+  context_.descriptor_pool_->AddFromFileDescriptorSetLazily(
+      kTrackEventDescriptor.data(), kTrackEventDescriptor.size());
+  context_.descriptor_pool_->AddFromFileDescriptorSetLazily(
+      kChromeTrackEventDescriptor.data(), kChromeTrackEventDescriptor.size());
 
   context_.slice_tracker->SetOnSliceBeginCallback(
       [this](TrackId track_id, SliceId slice_id) {
@@ -86,37 +84,124 @@ util::Status TraceProcessorStorageImpl::Parse(std::unique_ptr<uint8_t[]> data,
                                               size_t size) {
   if (size == 0)
     return util::OkStatus();
+  if (multi_trace_)
+    return TraceProcessorStorageImpl::ParseTrace(0, std::move(data), size);
+  RETURN_IF_ERROR(PrepareForParse(data.get(), size));
+
+  auto scoped_trace = context_.storage->TraceExecutionTimeIntoStats(
+      stats::parse_trace_duration_ns);
+  util::Status status = context_.chunk_reader->Parse(std::move(data), size);
+  unrecoverable_parse_error_ |= !status.ok();
+  return status;
+}
+
+util::Status TraceProcessorStorageImpl::ParseTrace(
+    uint32_t trace_idx,
+    std::unique_ptr<uint8_t[]> data,
+    size_t size) {
+  if (size == 0)
+    return util::OkStatus();
+  if (trace_idx >= ClockTracker::kMaxTraces) {
+    return util::ErrStatus("Too many traces (max %" PRIu32 ")",
+                           ClockTracker::kMaxTraces);
+  }
+  if (!multi_trace_) {
+    if (context_.chunk_reader)
+      return util::ErrStatus("ParseTrace() called after Parse()");
+
+    // The events of all the traces are merged by the same sorter. As the
+    // traces can be pushed in any order, only a full sort can merge them.
+    context_.sorter.reset(new TraceSorter(
+        &context_,
+        std::unique_ptr<TraceParser>(new MultiFormatTraceParser(&context_)),
+        TraceSorter::SortingMode::kFullSort));
+    multi_trace_ = true;
+  }
+  RETURN_IF_ERROR(PrepareForParse(data.get(), size));
+
+  ChunkedTraceReader* reader = context_.chunk_reader.get();
+  if (trace_idx > 0) {
+    if (other_trace_readers_.size() < trace_idx)
+      other_trace_readers_.resize(trace_idx);
+    std::unique_ptr<ChunkedTraceReader>& other_reader =
+        other_trace_readers_[trace_idx - 1];
+    if (!other_reader)
+      other_reader.reset(new ForwardingTraceParser(&context_));
+    reader = other_reader.get();
+  }
+  context_.clock_tracker->SetCurrentTrace(trace_idx);
+
+  auto scoped_trace = context_.storage->TraceExecutionTimeIntoStats(
+      stats::parse_trace_duration_ns);
+  util::Status status = reader->Parse(std::move(data), size);
+  unrecoverable_parse_error_ |= !status.ok();
+  return status;
+}
+
+util::Status TraceProcessorStorageImpl::ParseShared(
+    std::shared_ptr<const uint8_t> data,
+    size_t size) {
+  return ParseBlob(TraceBlobView::FromSharedBuffer(std::move(data), 0, size));
+}
+
+util::Status TraceProcessorStorageImpl::ParseBlob(TraceBlobView blob) {
+  if (blob.length() == 0)
+    return util::OkStatus();
+  RETURN_IF_ERROR(PrepareForParse(blob.data(), blob.length()));
+  if (multi_trace_)
+    context_.clock_tracker->SetCurrentTrace(0);
+
+  auto scoped_trace = context_.storage->TraceExecutionTimeIntoStats(
+      stats::parse_trace_duration_ns);
+  util::Status status = context_.chunk_reader->ParseBlob(std::move(blob));
+  unrecoverable_parse_error_ |= !status.ok();
+  return status;
+}
+
+util::Status TraceProcessorStorageImpl::PrepareForParse(const uint8_t* data,
+                                                        size_t size) {
   if (unrecoverable_parse_error_)
     return util::ErrStatus(
         "Failed unrecoverably while parsing in a previous Parse call");
   if (!context_.chunk_reader)
     context_.chunk_reader.reset(new ForwardingTraceParser(&context_));
 
-  auto scoped_trace = context_.storage->TraceExecutionTimeIntoStats(
-      stats::parse_trace_duration_ns);
-
   if (hash_input_size_remaining_ > 0 && !context_.uuid_found_in_trace) {
     const size_t hash_size = std::min(hash_input_size_remaining_, size);
     hash_input_size_remaining_ -= hash_size;
 
-    trace_hash_.Update(reinterpret_cast<const char*>(data.get()), hash_size);
+    trace_hash_.Update(reinterpret_cast<const char*>(data), hash_size);
     base::Uuid uuid(static_cast<int64_t>(trace_hash_.digest()), 0);
     const StringId id_for_uuid =
         context_.storage->InternString(base::StringView(uuid.ToPrettyString()));
     context_.metadata_tracker->SetMetadata(metadata::trace_uuid,
                                            Variadic::String(id_for_uuid));
   }
+  return util::OkStatus();
+}
 
-  util::Status status = context_.chunk_reader->Parse(std::move(data), size);
-  unrecoverable_parse_error_ |= !status.ok();
-  return status;
+void TraceProcessorStorageImpl::Flush() {
+  if (unrecoverable_parse_error_ || !context_.chunk_reader)
+    return;
+
+  if (context_.sorter)
+    context_.sorter->ExtractEventsForced();
+  context_.args_tracker->Flush();
 }
 
 void TraceProcessorStorageImpl::NotifyEndOfFile() {
   if (unrecoverable_parse_error_ || !context_.chunk_reader)
     return;
 
+  if (multi_trace_)
+    context_.clock_tracker->SetCurrentTrace(0);
   context_.chunk_reader->NotifyEndOfFile();
+  for (uint32_t i = 0; i < other_trace_readers_.size(); i++) {
+    if (!other_trace_readers_[i])
+      continue;
+    context_.clock_tracker->SetCurrentTrace(i + 1);
+    other_trace_readers_[i]->NotifyEndOfFile();
+  }
   if (context_.sorter)
     context_.sorter->ExtractEventsForced();
   context_.event_tracker->FlushPendingEvents();
@@ -18,12 +18,14 @@
 #define SRC_TRACE_PROCESSOR_TRACE_PROCESSOR_STORAGE_IMPL_H_
 
 #include <memory>
+#include <vector>
 
 #include "perfetto/ext/base/hash.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
 #include "perfetto/trace_processor/trace_processor_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/util/trace_blob_view.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -34,15 +36,33 @@ class TraceProcessorStorageImpl : public TraceProcessorStorage {
   ~TraceProcessorStorageImpl() override;
 
   util::Status Parse(std::unique_ptr<uint8_t[]>, size_t) override;
+  util::Status ParseShared(std::shared_ptr<const uint8_t>, size_t) override;
+  util::Status ParseTrace(uint32_t trace_idx,
+                          std::unique_ptr<uint8_t[]>,
+                          size_t) override;
+  void Flush() override;
   void NotifyEndOfFile() override;
 
   TraceProcessorContext* context() { return &context_; }
 
  protected:
+  util::Status ParseBlob(TraceBlobView);
+
   base::Hash trace_hash_;
   TraceProcessorContext context_;
   bool unrecoverable_parse_error_ = false;
   size_t hash_input_size_remaining_ = 4096;
+
+  // Set by the first ParseTrace() call. The reader of the trace 0 is
+  // |context_.chunk_reader|, the one of the trace N is
+  // |other_trace_readers_[N - 1]|.
+  bool multi_trace_ = false;
+  std::vector<std::unique_ptr<ChunkedTraceReader>> other_trace_readers_;
+
+ private:
+  // Common checks and bookkeeping (trace hashing) done before passing any
+  // chunk of data to the |chunk_reader|.
+  util::Status PrepareForParse(const uint8_t* data, size_t size);
 };
 
 }  // namespace trace_processor
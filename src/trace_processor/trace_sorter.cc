@@ -15,25 +15,214 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
+#include "src/trace_processor/importers/proto/track_event_parser.h"
 #include "src/trace_processor/trace_sorter.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
+namespace {
+
+void ParseEvent(TraceParser* parser,
+                size_t queue_idx,
+                TimestampedTracePiece ttp) {
+  int64_t timestamp = ttp.timestamp;
+  if (queue_idx == 0) {
+    // queues_[0] is for non-ftrace packets.
+    parser->ParseTracePacket(timestamp, std::move(ttp));
+  } else {
+    // Ftrace queues start at offset 1. So queues_[1] = cpu[0] and so on.
+    uint32_t cpu = static_cast<uint32_t>(queue_idx - 1);
+    parser->ParseFtracePacket(cpu, timestamp, std::move(ttp));
+  }
+}
+
+}  // namespace
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+
+// Threads are not available (e.g. in WASM builds without pthreads): pipelined
+// parsing is ignored and this class is never instantiated.
+class TraceSorter::ParserThread {
+ public:
+  void Push(size_t, TimestampedTracePiece) { PERFETTO_FATAL("Not reached"); }
+  void Flush() { PERFETTO_FATAL("Not reached"); }
+};
+
+#else
+
+// Parses the events extracted by the sorter on a dedicated thread. Events are
+// grouped in batches to amortize the cost of the synchronization and the
+// number of batches waiting to be parsed is bounded to limit the memory used
+// by events which have been extracted but not parsed yet.
+class TraceSorter::ParserThread {
+ public:
+  explicit ParserThread(TraceParser* parser)
+      : parser_(parser), thread_(&ParserThread::Run, this) {
+    batch_.reserve(kBatchSize);
+  }
+
+  ~ParserThread() {
+    Flush();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    work_cv_.notify_one();
+    thread_.join();
+  }
+
+  // Queues |ttp| to be parsed. Blocks if too many batches are waiting to be
+  // parsed.
+  void Push(size_t queue_idx, TimestampedTracePiece ttp) {
+    batch_.emplace_back(queue_idx, std::move(ttp));
+    if (batch_.size() >= kBatchSize)
+      SubmitBatch();
+  }
+
+  // Blocks until all the events pushed so far have been parsed.
+  void Flush() {
+    if (!batch_.empty())
+      SubmitBatch();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_.empty() && !parsing_; });
+  }
+
+ private:
+  struct Event {
+    Event(size_t idx, TimestampedTracePiece piece)
+        : queue_idx(idx), ttp(std::move(piece)) {}
+
+    size_t queue_idx;
+    TimestampedTracePiece ttp;
+  };
+  using Batch = std::vector<Event>;
+
+  static constexpr size_t kBatchSize = 4096;
+  static constexpr size_t kMaxPendingBatches = 4;
+
+  void SubmitBatch() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_cv_.wait(lock,
+                    [this] { return pending_.size() < kMaxPendingBatches; });
+      pending_.emplace_back(std::move(batch_));
+    }
+    work_cv_.notify_one();
+    batch_ = Batch();
+    batch_.reserve(kBatchSize);
+  }
+
+  void Run() {
+    for (;;) {
+      Batch batch;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock, [this] { return quit_ || !pending_.empty(); });
+        if (pending_.empty())
+          return;
+        batch = std::move(pending_.front());
+        pending_.pop_front();
+        parsing_ = true;
+      }
+      done_cv_.notify_one();
+
+      for (auto& event : batch)
+        ParseEvent(parser_, event.queue_idx, std::move(event.ttp));
+      // Destroy the events before signalling that the batch has been parsed:
+      // they hold references to the sequence state which must not be touched
+      // concurrently by the tokenizer.
+      batch.clear();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        parsing_ = false;
+      }
+      done_cv_.notify_one();
+    }
+  }
+
+  TraceParser* const parser_;
+
+  // The batch being filled by the sorting thread. Only accessed by the
+  // sorting thread.
+  Batch batch_;
+
+  // Guards all the members below.
+  std::mutex mutex_;
+
+  // Signalled when a batch is submitted or when quitting.
+  std::condition_variable work_cv_;
+
+  // Signalled when a batch is dequeued or has been fully parsed.
+  std::condition_variable done_cv_;
+
+  std::deque<Batch> pending_;
+  bool parsing_ = false;
+  bool quit_ = false;
+
+  std::thread thread_;
+};
+
+constexpr size_t TraceSorter::ParserThread::kBatchSize;
+constexpr size_t TraceSorter::ParserThread::kMaxPendingBatches;
+
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+
 TraceSorter::TraceSorter(TraceProcessorContext* context,
                          std::unique_ptr<TraceParser> parser,
                          SortingMode sorting_mode)
     : context_(context),
       parser_(std::move(parser)),
-      sorting_mode_(sorting_mode) {
+      sorting_mode_(sorting_mode),
+      worker_threads_(context->config.sorting_worker_threads),
+      track_event_worker_threads_(context->config.track_event_worker_threads),
+      packet_preparation_worker_threads_(
+          context->config.packet_preparation_worker_threads) {
   const char* env = getenv("TRACE_PROCESSOR_SORT_ONLY");
   bypass_next_stage_for_testing_ = env && !strcmp(env, "1");
   if (bypass_next_stage_for_testing_)
     PERFETTO_ELOG("TEST MODE: bypassing protobuf parsing stage");
+
+  if (sorting_mode_ == SortingMode::kWindowed) {
+    // Clamp the window to avoid overflows when comparing it with timestamp
+    // ranges.
+    constexpr int64_t kMaxWindowNs = std::numeric_limits<int64_t>::max() / 4;
+    window_ns_ = std::min(std::max(context->config.sorting_window_ns,
+                                   static_cast<int64_t>(1)),
+                          kMaxWindowNs);
+  }
+
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  if (context->config.pipelined_parsing && !bypass_next_stage_for_testing_)
+    parser_thread_.reset(new ParserThread(parser_.get()));
+#endif
+}
+
+TraceSorter::~TraceSorter() = default;
+
+size_t TraceSorter::QueuesSizeBytes() const {
+  size_t size = queues_.capacity() * sizeof(Queue);
+  for (const Queue& queue : queues_) {
+    size += queue.events_.capacity() * sizeof(TimestampedTracePiece) +
+            queue.run_starts_.capacity() * sizeof(size_t);
+  }
+  return size;
 }
 
 void TraceSorter::Queue::Sort() {
@@ -51,14 +240,231 @@ void TraceSorter::Queue::Sort() {
   PERFETTO_DCHECK(std::is_sorted(events_.begin(), sort_end));
   auto sort_begin = std::lower_bound(events_.begin(), sort_end, sort_min_ts_,
                                      &TimestampedTracePiece::Compare);
-  std::sort(sort_begin, events_.end());
+  if (too_many_runs_) {
+    std::sort(sort_begin, events_.end());
+  } else {
+    // The tail is made of a few sorted runs (e.g. the compact sched events
+    // and the other ftrace events of a bundle): merge them pairwise, which
+    // is O(n log(runs)) rather than O(n log(n)).
+    PERFETTO_DCHECK(!run_starts_.empty() &&
+                    run_starts_[0] == sort_start_idx_);
+    std::vector<decltype(sort_begin)> bounds;
+    bounds.reserve(run_starts_.size() + 2);
+    bounds.push_back(sort_begin);
+    for (size_t run_start : run_starts_)
+      bounds.push_back(events_.begin() + static_cast<ssize_t>(run_start));
+    bounds.push_back(events_.end());
+    while (bounds.size() > 2) {
+      size_t out = 0;
+      size_t i = 0;
+      for (; i + 2 < bounds.size(); i += 2) {
+        std::inplace_merge(bounds[i], bounds[i + 1], bounds[i + 2]);
+        bounds[out++] = bounds[i];
+      }
+      // Carry over the last run if there is an odd number of runs.
+      if (i + 1 < bounds.size())
+        bounds[out++] = bounds[i];
+      bounds[out++] = bounds.back();
+      bounds.resize(out);
+    }
+  }
   sort_start_idx_ = 0;
   sort_min_ts_ = 0;
+  last_ts_ = max_ts_;
+  run_starts_.clear();
+  too_many_runs_ = false;
 
   // At this point |events_| must be fully sorted.
   PERFETTO_DCHECK(std::is_sorted(events_.begin(), events_.end()));
 }
 
+void TraceSorter::SortQueuesInParallel() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // Threads are not available (e.g. in WASM builds without pthreads); queues
+  // will be sorted lazily by SortAndExtractEventsUntilPacket().
+#else
+  // The minimum number of events which need to be sorted across all queues
+  // before spawning threads. Below this, the cost of creating and joining the
+  // threads dominates the sort itself.
+  constexpr size_t kMinEventsForParallelSort = 64 * 1024;
+
+  if (worker_threads_ <= 1)
+    return;
+
+  std::vector<Queue*> queues_to_sort;
+  size_t events_to_sort = 0;
+  for (auto& queue : queues_) {
+    if (!queue.needs_sorting())
+      continue;
+    queues_to_sort.push_back(&queue);
+    events_to_sort += queue.events_.size() - queue.sort_start_idx_;
+  }
+  if (queues_to_sort.size() <= 1 || events_to_sort < kMinEventsForParallelSort)
+    return;
+
+  // Queues are handed out dynamically (rather than statically partitioned)
+  // because their sizes are usually very unbalanced (e.g. a busy CPU vs an
+  // idle one).
+  std::atomic<size_t> next_queue{0};
+  auto sort_queues = [&queues_to_sort, &next_queue] {
+    for (;;) {
+      size_t idx = next_queue.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= queues_to_sort.size())
+        return;
+      queues_to_sort[idx]->Sort();
+    }
+  };
+
+  // The calling thread also takes part in the sort, so spawn one thread less.
+  size_t num_threads =
+      std::min(static_cast<size_t>(worker_threads_), queues_to_sort.size());
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(sort_queues);
+  sort_queues();
+  for (auto& thread : threads)
+    thread.join();
+#endif
+}
+
+void TraceSorter::PrepareTrackEventsInParallel(uint64_t limit_packet_idx,
+                                               int64_t limit_ts) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // Threads are not available (e.g. in WASM builds without pthreads); track
+  // events are fully parsed by the parser.
+  base::ignore_result(limit_packet_idx);
+  base::ignore_result(limit_ts);
+#else
+  // The minimum number of events to prepare before spawning threads.
+  constexpr size_t kMinEventsForParallelPreparation = 4096;
+
+  if (track_event_worker_threads_ <= 1 || queues_.empty() ||
+      bypass_next_stage_for_testing_) {
+    return;
+  }
+
+  // Groups the events by packet sequence: the events of a sequence share
+  // their interned data, whose decoders are lazily created, so they must be
+  // prepared by the same thread.
+  std::unordered_map<const PacketSequenceState*, std::vector<TrackEventData*>>
+      events_by_sequence;
+  size_t num_events = 0;
+  for (auto& event : queues_[0].events_) {
+    if (event.type != TimestampedTracePiece::Type::kTrackEvent ||
+        event.packet_idx >= limit_packet_idx || event.timestamp > limit_ts) {
+      continue;
+    }
+    TrackEventData* data = event.track_event_data.get();
+    if (data->prepared)
+      continue;
+    events_by_sequence[data->sequence_state->state()].push_back(data);
+    num_events++;
+  }
+  if (events_by_sequence.size() <= 1 ||
+      num_events < kMinEventsForParallelPreparation) {
+    return;
+  }
+
+  std::vector<const std::vector<TrackEventData*>*> sequences;
+  sequences.reserve(events_by_sequence.size());
+  for (const auto& it : events_by_sequence)
+    sequences.push_back(&it.second);
+
+  TraceStorage* storage = context_->storage.get();
+  std::atomic<size_t> next_sequence{0};
+  auto prepare_sequences = [&sequences, &next_sequence, storage] {
+    for (;;) {
+      size_t idx = next_sequence.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= sequences.size())
+        return;
+      for (TrackEventData* data : *sequences[idx])
+        TrackEventParser::PrepareTrackEvent(storage, data);
+    }
+  };
+
+  // The calling thread also takes part, so spawn one thread less.
+  size_t num_threads = std::min(
+      static_cast<size_t>(track_event_worker_threads_), sequences.size());
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(prepare_sequences);
+  prepare_sequences();
+  for (auto& thread : threads)
+    thread.join();
+#endif
+}
+
+void TraceSorter::PreparePacketsInParallel(uint64_t limit_packet_idx,
+                                           int64_t limit_ts) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  // Threads are not available (e.g. in WASM builds without pthreads); packets
+  // are fully decoded by the parser.
+  base::ignore_result(limit_packet_idx);
+  base::ignore_result(limit_ts);
+#else
+  // The minimum number of bytes to prepare before spawning threads.
+  constexpr size_t kMinBytesForParallelPreparation = 1024 * 1024;
+
+  if (packet_preparation_worker_threads_ <= 1 || queues_.empty() ||
+      bypass_next_stage_for_testing_) {
+    return;
+  }
+
+  // Groups the packets by packet sequence: the packets of a sequence can
+  // depend on each other (e.g. the ids of heap graph objects are delta
+  // encoded across packets) so they are prepared in order by the same thread.
+  std::unordered_map<const PacketSequenceState*,
+                     std::vector<PreparablePacketData*>>
+      packets_by_sequence;
+  size_t num_bytes = 0;
+  for (auto& event : queues_[0].events_) {
+    if (event.type != TimestampedTracePiece::Type::kPreparablePacket ||
+        event.packet_idx >= limit_packet_idx || event.timestamp > limit_ts) {
+      continue;
+    }
+    PreparablePacketData* data = event.preparable_packet.get();
+    if (data->prepared)
+      continue;
+    packets_by_sequence[data->sequence_state->state()].push_back(data);
+    num_bytes += data->packet.length();
+  }
+  if (packets_by_sequence.size() <= 1 ||
+      num_bytes < kMinBytesForParallelPreparation) {
+    return;
+  }
+
+  std::vector<const std::vector<PreparablePacketData*>*> sequences;
+  sequences.reserve(packets_by_sequence.size());
+  for (const auto& it : packets_by_sequence)
+    sequences.push_back(&it.second);
+
+  std::atomic<size_t> next_sequence{0};
+  auto prepare_sequences = [&sequences, &next_sequence] {
+    for (;;) {
+      size_t idx = next_sequence.fetch_add(1, std::memory_order_relaxed);
+      if (idx >= sequences.size())
+        return;
+      for (PreparablePacketData* data : *sequences[idx])
+        data->module->PreparePacket(data);
+    }
+  };
+
+  // The calling thread also takes part, so spawn one thread less.
+  size_t num_threads =
+      std::min(static_cast<size_t>(packet_preparation_worker_threads_),
+               sequences.size());
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(prepare_sequences);
+  prepare_sequences();
+  for (auto& thread : threads)
+    thread.join();
+#endif
+}
+
 // Removes all the events in |queues_| that are earlier than the given
 // packet index and moves them to the next parser stages, respecting global
 // timestamp order. This function is a "extract min from N sorted queues", with
@@ -79,8 +485,13 @@ void TraceSorter::Queue::Sort() {
 // to avoid re-scanning all the queues all the times) but doesn't seem worth it.
 // With Android traces (that have 8 CPUs) this function accounts for ~1-3% cpu
 // time in a profiler.
-void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
+void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx,
+                                                  int64_t limit_ts) {
   constexpr int64_t kTsMax = std::numeric_limits<int64_t>::max();
+  SortQueuesInParallel();
+  PrepareTrackEventsInParallel(limit_packet_idx, limit_ts);
+  PreparePacketsInParallel(limit_packet_idx, limit_ts);
+
   size_t iterations = 0;
   for (;; iterations++) {
     size_t min_queue_idx = 0;  // The index of the queue with the min(ts).
@@ -126,7 +537,7 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
     size_t num_extracted = 0;
     for (auto& event : events) {
       if (event.packet_idx >= limit_packet_idx ||
-          event.timestamp > min_queue_ts[1]) {
+          event.timestamp > min_queue_ts[1] || event.timestamp > limit_ts) {
         break;
       }
 
@@ -148,6 +559,7 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
     if (events.empty()) {
       queue.min_ts_ = kTsMax;
       queue.max_ts_ = 0;
+      queue.last_ts_ = 0;
       global_min_ts_ = min_queue_ts[1];
 
       // If we extraced the max entry from a queue (i.e. we emptied the queue)
@@ -173,26 +585,44 @@ void TraceSorter::SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx) {
   PERFETTO_DCHECK(global_min_ts_ == dbg_min_ts);
   PERFETTO_DCHECK(global_max_ts_ == dbg_max_ts);
 #endif
+
+  // Wait for the parser thread to be done before returning: the caller is
+  // about to resume tokenizing, which is not safe to do concurrently with
+  // parsing.
+  if (parser_thread_)
+    parser_thread_->Flush();
+
+  if (out_of_order_events_ > 0) {
+    context_->storage->IncrementStats(stats::sorter_push_event_out_of_order,
+                                      out_of_order_events_);
+    out_of_order_events_ = 0;
+  }
+}
+
+void TraceSorter::ExtractEventsOutsideWindow() {
+  PERFETTO_DCHECK(sorting_mode_ == SortingMode::kWindowed);
+  if (global_max_ts_ - global_min_ts_ <= window_ns_)
+    return;
+  int64_t limit_ts = global_max_ts_ - window_ns_;
+  SortAndExtractEventsUntilPacket(packet_idx_, limit_ts);
+  window_extracted_ts_ = std::max(window_extracted_ts_, limit_ts);
 }
 
 void TraceSorter::MaybePushEvent(size_t queue_idx, TimestampedTracePiece ttp) {
   int64_t timestamp = ttp.timestamp;
   if (timestamp < latest_pushed_event_ts_)
-    context_->storage->IncrementStats(stats::sorter_push_event_out_of_order);
+    out_of_order_events_++;
 
   latest_pushed_event_ts_ = std::max(latest_pushed_event_ts_, timestamp);
 
   if (PERFETTO_UNLIKELY(bypass_next_stage_for_testing_))
     return;
 
-  if (queue_idx == 0) {
-    // queues_[0] is for non-ftrace packets.
-    parser_->ParseTracePacket(timestamp, std::move(ttp));
-  } else {
-    // Ftrace queues start at offset 1. So queues_[1] = cpu[0] and so on.
-    uint32_t cpu = static_cast<uint32_t>(queue_idx - 1);
-    parser_->ParseFtracePacket(cpu, timestamp, std::move(ttp));
+  if (parser_thread_) {
+    parser_thread_->Push(queue_idx, std::move(ttp));
+    return;
   }
+  ParseEvent(parser_.get(), queue_idx, std::move(ttp));
 }
 
 }  // namespace trace_processor
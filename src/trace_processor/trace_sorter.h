@@ -17,10 +17,13 @@
 #ifndef SRC_TRACE_PROCESSOR_TRACE_SORTER_H_
 #define SRC_TRACE_PROCESSOR_TRACE_SORTER_H_
 
+#include <algorithm>
+#include <memory>
 #include <vector>
 
 #include "perfetto/ext/base/circular_queue.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/arena.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/timestamped_trace_piece.h"
 #include "src/trace_processor/util/trace_blob_view.h"
@@ -57,6 +60,17 @@ struct SystraceLine;
 // The algorithm for incremental extraction is explained in detail at
 // go/trace-sorting-is-complicated.
 //
+// Windowed extraction
+//
+// When using SortingMode::kWindowed, events are instead extracted based on
+// their timestamps: once the queues span more than twice the sorting window,
+// all the events older than (max timestamp - window) are extracted. This
+// also happens on every read buffer event. Events older than the ones which
+// have already been extracted are dropped (and counted in the
+// |sorter_window_late_events| stat) instead of being parsed out of order.
+// This bounds the number of events held by the sorter regardless of the
+// length of the trace.
+//
 // Sorting algorithm
 //
 // The sorting algorithm is designed around the assumption that:
@@ -82,44 +96,116 @@ struct SystraceLine;
 // We use a logarithmic bound search operation to figure out what is the index
 // within the first partition where sorting should start, and sort all events
 // from there to the end.
+//
+// The unordered partition is usually made of a few sorted runs (e.g. the
+// compact sched events of a bundle, which are pushed as a whole by
+// PushInlineFtraceEvents(), followed by its other events). The starts of the
+// runs are recorded while appending so that they can be merged instead of
+// sorting the whole partition.
+//
+// Parallel sorting
+//
+// When |Config::sorting_worker_threads| > 1, before starting the
+// merge-sort-extract, all the queues which lost ordering are sorted
+// concurrently on a set of short-lived worker threads. The merge itself (and
+// thus the parsing stage) still happens on the calling thread in global
+// timestamp order. Queues are fully independent of each other so no locking is
+// required: each worker owns the queues it picked for the duration of the
+// sort.
+//
+// Pipelined parsing
+//
+// When |Config::pipelined_parsing| is set, the events extracted by the
+// merge-sort are handed, in batches, to a dedicated parser thread through a
+// bounded queue instead of being parsed inline. This overlaps the merge with
+// the parsing (and the table insertions) of the previous batches. Parsers are
+// not thread-safe w.r.t. the tokenizers (e.g. both touch the sequence state
+// and the trackers) so the extraction waits for all the batches to be parsed
+// before returning: the tokenizer never runs concurrently with the parsers.
+//
+// Track event preparation
+//
+// When |Config::track_event_worker_threads| > 1, before the merge, the
+// TrackEvents of the general queue which are about to be extracted are
+// decoded and their names and categories interned (see
+// TrackEventParser::PrepareTrackEvent()) on a set of short-lived worker
+// threads. The events of a packet sequence share their interned data, so each
+// sequence is prepared by a single thread. The insertion of the events into
+// the tables still happens serially, in timestamp order, while parsing.
+//
+// Packet preparation
+//
+// Likewise, when |Config::packet_preparation_worker_threads| > 1, the packets
+// pushed through PushPreparablePacket() (e.g. heap graphs and heapprofd
+// profiles, which can be several MBs each) are decoded ahead of parsing by the
+// module which pushed them (see ProtoImporterModule::PreparePacket()), on
+// short-lived worker threads, one packet sequence per thread.
+//
+// Payload allocation
+//
+// The payloads of the events which do not fit inline in a
+// TimestampedTracePiece (e.g. TrackEventData, FuchsiaRecord) are allocated by
+// the tokenizers from |payload_arena()|. As events are extracted in roughly
+// the order they were pushed, the arena chunks are freed in bulk as parsing
+// progresses instead of calling malloc/free for every event.
 class TraceSorter {
  public:
   enum class SortingMode {
     kDefault,
     kFullSort,
+    kWindowed,
   };
 
   TraceSorter(TraceProcessorContext* context,
               std::unique_ptr<TraceParser> parser,
               SortingMode);
+  ~TraceSorter();
 
   inline void PushTracePacket(int64_t timestamp,
                               PacketSequenceState* state,
                               TraceBlobView packet) {
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     AppendNonFtraceEvent(TimestampedTracePiece(timestamp, packet_idx_++,
                                                std::move(packet),
                                                state->current_generation()));
   }
 
   inline void PushJsonValue(int64_t timestamp, std::string json_value) {
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     AppendNonFtraceEvent(
         TimestampedTracePiece(timestamp, packet_idx_++, std::move(json_value)));
   }
 
   inline void PushFuchsiaRecord(int64_t timestamp,
-                                std::unique_ptr<FuchsiaRecord> record) {
+                                ArenaPtr<FuchsiaRecord> record) {
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     AppendNonFtraceEvent(
         TimestampedTracePiece(timestamp, packet_idx_++, std::move(record)));
   }
 
-  inline void PushSystraceLine(std::unique_ptr<SystraceLine> systrace_line) {
+  inline void PushSystraceLine(ArenaPtr<SystraceLine> systrace_line) {
     int64_t timestamp = systrace_line->ts;
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     AppendNonFtraceEvent(TimestampedTracePiece(timestamp, packet_idx_++,
                                                std::move(systrace_line)));
   }
 
   inline void PushTrackEventPacket(int64_t timestamp,
-                                   std::unique_ptr<TrackEventData> data) {
+                                   ArenaPtr<TrackEventData> data) {
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
+    AppendNonFtraceEvent(
+        TimestampedTracePiece(timestamp, packet_idx_++, std::move(data)));
+  }
+
+  inline void PushPreparablePacket(int64_t timestamp,
+                                   ArenaPtr<PreparablePacketData> data) {
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     AppendNonFtraceEvent(
         TimestampedTracePiece(timestamp, packet_idx_++, std::move(data)));
   }
@@ -128,6 +214,8 @@ class TraceSorter {
                               int64_t timestamp,
                               TraceBlobView event,
                               PacketSequenceState* state) {
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     auto* queue = GetQueue(cpu + 1);
     queue->Append(TimestampedTracePiece(
         timestamp, packet_idx_++,
@@ -137,12 +225,8 @@ class TraceSorter {
   inline void PushInlineFtraceEvent(uint32_t cpu,
                                     int64_t timestamp,
                                     InlineSchedSwitch inline_sched_switch) {
-    // TODO(rsavitski): if a trace has a mix of normal & "compact" events (being
-    // pushed through this function), the ftrace batches will no longer be fully
-    // sorted by timestamp. In such situations, we will have to sort at the end
-    // of the batch. We can do better as both sub-sequences are sorted however.
-    // Consider adding extra queues, or pushing them in a merge-sort fashion
-    // instead.
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     auto* queue = GetQueue(cpu + 1);
     queue->Append(
         TimestampedTracePiece(timestamp, packet_idx_++, inline_sched_switch));
@@ -151,12 +235,56 @@ class TraceSorter {
   inline void PushInlineFtraceEvent(uint32_t cpu,
                                     int64_t timestamp,
                                     InlineSchedWaking inline_sched_waking) {
+    if (PERFETTO_UNLIKELY(IsLateEvent(timestamp)))
+      return;
     auto* queue = GetQueue(cpu + 1);
     queue->Append(
         TimestampedTracePiece(timestamp, packet_idx_++, inline_sched_waking));
     UpdateGlobalTs(queue);
   }
 
+  // Pushes the compact sched events of |cpu| decoded from a single
+  // FtraceEventBundle. As the timestamps of a compact sched block are delta
+  // encoded, they are (almost always) sorted and the events are appended as a
+  // single run.
+  //
+  // If a bundle also contains non-compact events, or both sched_switch and
+  // sched_waking events, the queue of |cpu| loses its ordering but is made of
+  // a few sorted runs, which Queue::Sort() merges rather than fully sorting.
+  template <typename InlineEvent>
+  inline void PushInlineFtraceEvents(uint32_t cpu,
+                                     const std::vector<int64_t>& timestamps,
+                                     const std::vector<InlineEvent>& events) {
+    PERFETTO_DCHECK(timestamps.size() == events.size());
+
+    // The conversion from a non-boottime ftrace clock can break the ordering
+    // of the timestamps.
+    if (PERFETTO_UNLIKELY(
+            !std::is_sorted(timestamps.begin(), timestamps.end()))) {
+      for (size_t i = 0; i < timestamps.size(); ++i)
+        PushInlineFtraceEvent(cpu, timestamps[i], events[i]);
+      return;
+    }
+
+    // Only a prefix of the run can be late.
+    size_t begin = 0;
+    while (begin < timestamps.size() && IsLateEvent(timestamps[begin]))
+      begin++;
+    if (begin == timestamps.size())
+      return;
+
+    auto* queue = GetQueue(cpu + 1);
+    queue->AppendSortedRun(timestamps.size() - begin, [&](size_t i) {
+      return TimestampedTracePiece(timestamps[begin + i], packet_idx_++,
+                                   events[begin + i]);
+    });
+    UpdateGlobalTs(queue);
+  }
+
+  // Returns the number of bytes of memory used by the queues of the events
+  // waiting to be sorted. This doesn't include the payloads of the events.
+  size_t QueuesSizeBytes() const;
+
   void ExtractEventsForced() {
     SortAndExtractEventsUntilPacket(packet_idx_);
     queues_.resize(0);
@@ -168,6 +296,10 @@ class TraceSorter {
   void NotifyFlushEvent() { flushes_since_extraction_++; }
 
   void NotifyReadBufferEvent() {
+    if (sorting_mode_ == SortingMode::kWindowed) {
+      ExtractEventsOutsideWindow();
+      return;
+    }
     if (sorting_mode_ == SortingMode::kFullSort ||
         flushes_since_extraction_ < 2) {
       return;
@@ -178,11 +310,30 @@ class TraceSorter {
     flushes_since_extraction_ = 0;
   }
 
+  // When using windowed sorting, extracts the events older than the sorting
+  // window if the queues have grown too much. Should be called between
+  // packets (i.e. not while a packet is being tokenized).
+  inline void MaybeExtractEventsOutsideWindow() {
+    if (sorting_mode_ != SortingMode::kWindowed)
+      return;
+    // Let the queues grow to twice the window before extracting so that
+    // events are extracted in bulk rather than one at a time.
+    if (global_max_ts_ - global_min_ts_ <= 2 * window_ns_)
+      return;
+    ExtractEventsOutsideWindow();
+  }
+
   int64_t max_timestamp() const { return global_max_ts_; }
 
+  // The arena the payloads of the events pushed to the sorter should be
+  // allocated from. Only usable from the tokenizer thread.
+  Arena* payload_arena() { return &payload_arena_; }
+
  private:
   static constexpr uint32_t kNoBatch = std::numeric_limits<uint32_t>::max();
 
+  class ParserThread;
+
   struct Queue {
     inline void Append(TimestampedTracePiece ttp) {
       const int64_t timestamp = ttp.timestamp;
@@ -205,22 +356,94 @@ class TraceSorter {
         } else {
           sort_min_ts_ = std::min(sort_min_ts_, timestamp);
         }
+        if (timestamp < last_ts_)
+          AddRunStart(events_.size() - 1);
       }
+      last_ts_ = timestamp;
 
       PERFETTO_DCHECK(min_ts_ <= max_ts_);
     }
 
+    // Appends |count| events sorted by timestamp, the i-th one being
+    // |make_event(i)|. Only the first event can break the ordering of the
+    // queue so the checks of Append() are skipped for the others.
+    template <typename MakeEventFn>
+    inline void AppendSortedRun(size_t count, const MakeEventFn& make_event) {
+      if (count == 0)
+        return;
+      Append(make_event(0));
+      for (size_t i = 1; i < count; ++i) {
+        events_.emplace_back(make_event(i));
+        PERFETTO_DCHECK(events_.back().timestamp >= last_ts_);
+        last_ts_ = events_.back().timestamp;
+      }
+      max_ts_ = std::max(max_ts_, last_ts_);
+    }
+
     bool needs_sorting() const { return sort_start_idx_ != 0; }
     void Sort();
 
+    // Records that a new sorted run starts at |idx|. Runs are only tracked
+    // while there are few of them; past that, Sort() falls back to sorting
+    // the whole unsorted tail.
+    inline void AddRunStart(size_t idx) {
+      if (run_starts_.size() < kMaxSortedRuns)
+        run_starts_.push_back(idx);
+      else
+        too_many_runs_ = true;
+    }
+
+    static constexpr size_t kMaxSortedRuns = 1024;
+
     base::CircularQueue<TimestampedTracePiece> events_;
     int64_t min_ts_ = std::numeric_limits<int64_t>::max();
     int64_t max_ts_ = 0;
+    int64_t last_ts_ = 0;
     size_t sort_start_idx_ = 0;
     int64_t sort_min_ts_ = std::numeric_limits<int64_t>::max();
+
+    // The indices (in |events_|) at which the events stop being sorted, i.e.
+    // the starts of the sorted runs following the first one. The first one
+    // is always |sort_start_idx_|.
+    std::vector<size_t> run_starts_;
+    bool too_many_runs_ = false;
   };
 
-  void SortAndExtractEventsUntilPacket(uint64_t limit_packet_idx);
+  // Extracts all the events before |limit_packet_idx| which have a timestamp
+  // <= |limit_ts|.
+  void SortAndExtractEventsUntilPacket(
+      uint64_t limit_packet_idx,
+      int64_t limit_ts = std::numeric_limits<int64_t>::max());
+
+  // Extracts all the events older than the sorting window.
+  void ExtractEventsOutsideWindow();
+
+  // Returns true (and records the event as dropped) if an event with the
+  // given timestamp is older than the events which have already been
+  // extracted by windowed sorting.
+  inline bool IsLateEvent(int64_t timestamp) {
+    if (PERFETTO_LIKELY(timestamp >= window_extracted_ts_))
+      return false;
+    context_->storage->IncrementStats(stats::sorter_window_late_events);
+    return true;
+  }
+
+  // Sorts all the queues which need sorting using up to |worker_threads_|
+  // threads. This is a no-op if parallel sorting is disabled or if there is
+  // not enough work to amortize the cost of spinning up the threads.
+  void SortQueuesInParallel();
+
+  // Prepares the track events of queues_[0] which can be extracted given
+  // |limit_packet_idx| and |limit_ts| using up to
+  // |track_event_worker_threads_| threads. Like SortQueuesInParallel(), a
+  // no-op unless there are enough events (and sequences) to split.
+  void PrepareTrackEventsInParallel(uint64_t limit_packet_idx,
+                                    int64_t limit_ts);
+
+  // Same as PrepareTrackEventsInParallel() for the packets pushed with
+  // PushPreparablePacket(), using up to |packet_preparation_worker_threads_|
+  // threads.
+  void PreparePacketsInParallel(uint64_t limit_packet_idx, int64_t limit_ts);
 
   inline Queue* GetQueue(size_t index) {
     if (PERFETTO_UNLIKELY(index >= queues_.size()))
@@ -245,6 +468,10 @@ class TraceSorter {
   TraceProcessorContext* context_;
   std::unique_ptr<TraceParser> parser_;
 
+  // Set only if pipelined parsing is enabled. Must be destroyed before
+  // |parser_| as it parses events using it.
+  std::unique_ptr<ParserThread> parser_thread_;
+
   // Whether we should ignore incremental extraction and just wait for
   // forced extractionn at the end of the trace.
   SortingMode sorting_mode_ = SortingMode::kDefault;
@@ -257,11 +484,21 @@ class TraceSorter {
   // extraction.
   uint32_t flushes_since_extraction_ = 0;
 
+  // The size of the sorting window when using windowed sorting.
+  int64_t window_ns_ = 0;
+
+  // The timestamp until which events have been extracted by windowed sorting.
+  // Events older than this are dropped.
+  int64_t window_extracted_ts_ = std::numeric_limits<int64_t>::min();
+
   // queues_[0] is the general (non-ftrace) queue.
   // queues_[1] is the ftrace queue for CPU(0).
   // queues_[x] is the ftrace queue for CPU(x - 1).
   std::vector<Queue> queues_;
 
+  // See "Payload allocation" above. Payloads can safely outlive the arena.
+  Arena payload_arena_;
+
   // max(e.timestamp for e in queues_).
   int64_t global_max_ts_ = 0;
 
@@ -271,11 +508,29 @@ class TraceSorter {
   // Monotonic increasing value used to index timestamped trace pieces.
   uint64_t packet_idx_ = 0;
 
+  // The max number of threads used by SortQueuesInParallel(). Values <= 1
+  // disable parallel sorting.
+  uint32_t worker_threads_ = 0;
+
+  // The max number of threads used by PrepareTrackEventsInParallel(). Values
+  // <= 1 disable the preparation of track events.
+  uint32_t track_event_worker_threads_ = 0;
+
+  // The max number of threads used by PreparePacketsInParallel(). Values <= 1
+  // leave the preparation of the packets to the parsing stage.
+  uint32_t packet_preparation_worker_threads_ = 0;
+
   // Used for performance tests. True when setting TRACE_PROCESSOR_SORT_ONLY=1.
   bool bypass_next_stage_for_testing_ = false;
 
   // max(e.ts for e pushed to next stage)
   int64_t latest_pushed_event_ts_ = std::numeric_limits<int64_t>::min();
+
+  // The number of events pushed out of order during the current extraction.
+  // Accumulated locally and added to the stats at the end of the extraction
+  // because, with pipelined parsing, the stats are concurrently updated by the
+  // parser thread.
+  int64_t out_of_order_events_ = 0;
 };
 
 }  // namespace trace_processor
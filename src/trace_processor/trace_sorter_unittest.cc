@@ -15,16 +15,22 @@
  */
 #include "src/trace_processor/importers/proto/proto_trace_parser.h"
 
+#include <algorithm>
 #include <map>
+#include <mutex>
 #include <random>
 #include <vector>
 
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/timestamped_trace_piece.h"
 #include "src/trace_processor/trace_sorter.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 #include "test/gtest_and_gmock.h"
 
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
+
 namespace perfetto {
 namespace trace_processor {
 namespace {
@@ -57,12 +63,48 @@ class MockTraceParser : public ProtoTraceParser {
   MOCK_METHOD3(MOCK_ParseTracePacket,
                void(int64_t ts, const uint8_t* data, size_t length));
 
+  MOCK_METHOD2(MOCK_ParseTrackEvent,
+               void(int64_t ts, const TrackEventData* data));
+
+  MOCK_METHOD2(MOCK_ParsePreparablePacket,
+               void(int64_t ts, const PreparablePacketData* data));
+
   void ParseTracePacket(int64_t ts, TimestampedTracePiece ttp) override {
+    if (ttp.type == TimestampedTracePiece::Type::kTrackEvent) {
+      MOCK_ParseTrackEvent(ts, ttp.track_event_data.get());
+      return;
+    }
+    if (ttp.type == TimestampedTracePiece::Type::kPreparablePacket) {
+      MOCK_ParsePreparablePacket(ts, ttp.preparable_packet.get());
+      return;
+    }
     TraceBlobView& tbv = ttp.packet_data.packet;
     MOCK_ParseTracePacket(ts, tbv.data(), tbv.length());
   }
 };
 
+// Records the order in which the packets of each sequence were prepared.
+class FakePreparingModule : public ProtoImporterModule {
+ public:
+  struct Prepared : public PreparedPacket {
+    size_t index_in_sequence;
+  };
+
+  void PreparePacket(PreparablePacketData* data) const override {
+    std::unique_ptr<Prepared> prepared(new Prepared());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      prepared->index_in_sequence = num_prepared_[data->sequence_state.get()]++;
+    }
+    data->prepared = std::move(prepared);
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  mutable std::map<const PacketSequenceStateGeneration*, size_t>
+      num_prepared_;
+};
+
 class MockTraceStorage : public TraceStorage {
  public:
   MockTraceStorage() : TraceStorage() {}
@@ -80,10 +122,13 @@ class TraceSorterTest : public ::testing::Test {
   }
 
   void CreateSorter(bool full_sort = true) {
+    CreateSorter(full_sort ? TraceSorter::SortingMode::kFullSort
+                           : TraceSorter::SortingMode::kDefault);
+  }
+
+  void CreateSorter(TraceSorter::SortingMode sorting_mode) {
     std::unique_ptr<MockTraceParser> parser(new MockTraceParser(&context_));
     parser_ = parser.get();
-    auto sorting_mode = full_sort ? TraceSorter::SortingMode::kFullSort
-                                  : TraceSorter::SortingMode::kDefault;
     context_.sorter.reset(
         new TraceSorter(&context_, std::move(parser), sorting_mode));
   }
@@ -297,6 +342,317 @@ TEST_F(TraceSorterTest, MultiQueueSorting) {
   EXPECT_TRUE(expectations.empty());
 }
 
+TEST_F(TraceSorterTest, PipelinedParsing) {
+  context_.config.pipelined_parsing = true;
+  CreateSorter(false);
+
+  PacketSequenceState state(&context_);
+  std::minstd_rand0 rnd_engine(0);
+  std::vector<int64_t> parsed_ts;
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(_, _, _, _))
+      .WillRepeatedly(
+          Invoke([&parsed_ts](uint32_t, int64_t ts, const uint8_t*, size_t) {
+            parsed_ts.push_back(ts);
+          }));
+  EXPECT_CALL(*parser_, MOCK_ParseTracePacket(_, _, _))
+      .WillRepeatedly(Invoke([&parsed_ts](int64_t ts, const uint8_t*, size_t) {
+        parsed_ts.push_back(ts);
+      }));
+
+  // Pushes |count| events in random order with timestamps in
+  // [min_ts, min_ts + 1000000).
+  size_t num_pushed = 0;
+  auto push_events = [&](int64_t min_ts, int count) {
+    for (int i = 0; i < count; i++, num_pushed++) {
+      int64_t ts = min_ts + static_cast<int64_t>(rnd_engine() % 1000000);
+      if (i % 5 == 0) {
+        context_.sorter->PushTracePacket(ts, &state, test_buffer_.slice(0, 1));
+      } else {
+        uint32_t cpu = static_cast<uint32_t>(rnd_engine() % 4);
+        context_.sorter->PushFtraceEvent(cpu, ts, TraceBlobView(nullptr, 0, 0),
+                                         &state);
+      }
+    }
+  };
+
+  // All the extracted events must have been parsed by the time the
+  // extraction returns.
+  push_events(1000000, 30000);
+  context_.sorter->NotifyFlushEvent();
+  context_.sorter->NotifyFlushEvent();
+  context_.sorter->NotifyReadBufferEvent();
+  ASSERT_EQ(parsed_ts.size(), 0u);
+
+  push_events(2000000, 30000);
+  context_.sorter->NotifyFlushEvent();
+  context_.sorter->NotifyFlushEvent();
+  context_.sorter->NotifyReadBufferEvent();
+  ASSERT_EQ(parsed_ts.size(), 30000u);
+
+  push_events(3000000, 30000);
+  context_.sorter->ExtractEventsForced();
+  ASSERT_EQ(parsed_ts.size(), num_pushed);
+  ASSERT_TRUE(std::is_sorted(parsed_ts.begin(), parsed_ts.end()));
+}
+
+// Same as MultiQueueSorting but with enough out-of-order events on multiple
+// CPUs to trigger sorting the queues on worker threads.
+TEST_F(TraceSorterTest, ParallelMultiQueueSorting) {
+  context_.config.sorting_worker_threads = 4;
+  CreateSorter();
+
+  PacketSequenceState state(&context_);
+  std::minstd_rand0 rnd_engine(0);
+  std::map<int64_t /*ts*/, std::vector<uint32_t /*cpu*/>> expectations;
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(_, _, _, _))
+      .WillRepeatedly(Invoke([&expectations](uint32_t cpu, int64_t timestamp,
+                                             const uint8_t*, size_t) {
+        EXPECT_EQ(expectations.begin()->first, timestamp);
+        auto& cpus = expectations.begin()->second;
+        auto it = std::find(cpus.begin(), cpus.end(), cpu);
+        EXPECT_TRUE(it != cpus.end());
+        if (it != cpus.end())
+          cpus.erase(it);
+        if (cpus.empty())
+          expectations.erase(expectations.begin());
+      }));
+
+  for (int i = 0; i < 100000; i++) {
+    int64_t ts = abs(static_cast<int64_t>(rnd_engine()));
+    uint32_t cpu = static_cast<uint32_t>(rnd_engine() % 8);
+    expectations[ts].push_back(cpu);
+    context_.sorter->PushFtraceEvent(cpu, ts, TraceBlobView(nullptr, 0, 0),
+                                     &state);
+  }
+
+  context_.sorter->ExtractEventsForced();
+  EXPECT_TRUE(expectations.empty());
+}
+
+// Checks that the runs of compact sched events and the other ftrace events of
+// a bundle, which overlap in time, are merged in timestamp order.
+TEST_F(TraceSorterTest, InlineFtraceEventRuns) {
+  PacketSequenceState state(&context_);
+  std::minstd_rand0 rnd_engine(0);
+  std::map<int64_t /*ts*/, std::vector<uint32_t /*cpu*/>> expectations;
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(_, _, _, _))
+      .WillRepeatedly(Invoke([&expectations](uint32_t cpu, int64_t timestamp,
+                                             const uint8_t*, size_t) {
+        EXPECT_EQ(expectations.begin()->first, timestamp);
+        auto& cpus = expectations.begin()->second;
+        auto it = std::find(cpus.begin(), cpus.end(), cpu);
+        EXPECT_TRUE(it != cpus.end());
+        if (it != cpus.end())
+          cpus.erase(it);
+        if (cpus.empty())
+          expectations.erase(expectations.begin());
+      }));
+
+  // Returns |count| sorted timestamps in [start, start + 1000).
+  auto sorted_timestamps = [&](int64_t start, size_t count) {
+    std::vector<int64_t> timestamps;
+    for (size_t i = 0; i < count; i++)
+      timestamps.push_back(start + static_cast<int64_t>(rnd_engine() % 1000));
+    std::sort(timestamps.begin(), timestamps.end());
+    return timestamps;
+  };
+
+  for (int64_t bundle = 0; bundle < 100; bundle++) {
+    for (uint32_t cpu = 0; cpu < 4; cpu++) {
+      int64_t start = bundle * 1000;
+      std::vector<int64_t> switch_ts = sorted_timestamps(start, 50);
+      std::vector<int64_t> waking_ts = sorted_timestamps(start, 20);
+      std::vector<int64_t> event_ts = sorted_timestamps(start, 10);
+
+      context_.sorter->PushInlineFtraceEvents(
+          cpu, switch_ts, std::vector<InlineSchedSwitch>(switch_ts.size()));
+      context_.sorter->PushInlineFtraceEvents(
+          cpu, waking_ts, std::vector<InlineSchedWaking>(waking_ts.size()));
+      for (int64_t ts : event_ts) {
+        context_.sorter->PushFtraceEvent(cpu, ts, TraceBlobView(nullptr, 0, 0),
+                                         &state);
+      }
+      for (const auto* timestamps : {&switch_ts, &waking_ts, &event_ts}) {
+        for (int64_t ts : *timestamps)
+          expectations[ts].push_back(cpu);
+      }
+    }
+  }
+
+  context_.sorter->ExtractEventsForced();
+  EXPECT_TRUE(expectations.empty());
+}
+
+// Checks that the names of the track events of multiple sequences are
+// interned on worker threads before the events are parsed.
+TEST_F(TraceSorterTest, ParallelTrackEventPreparation) {
+  context_.config.track_event_worker_threads = 4;
+  CreateSorter();
+  StringPool* pool = storage_->mutable_string_pool();
+  ON_CALL(*storage_, InternString(_))
+      .WillByDefault(Invoke(
+          [pool](base::StringView str) { return pool->InternString(str); }));
+
+  constexpr int kNumSequences = 8;
+  constexpr int kNumEvents = 10000;
+  std::vector<std::unique_ptr<PacketSequenceState>> states;
+  for (int i = 0; i < kNumSequences; i++)
+    states.emplace_back(new PacketSequenceState(&context_));
+
+  for (int i = 0; i < kNumEvents; i++) {
+    protozero::HeapBuffered<protos::pbzero::TracePacket> packet;
+    packet->set_track_event()->set_name("event" + std::to_string(i % 100));
+    std::vector<uint8_t> data = packet.SerializeAsArray();
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[data.size()]);
+    memcpy(buf.get(), data.data(), data.size());
+    auto* state = states[static_cast<size_t>(i % kNumSequences)].get();
+    context_.sorter->PushTrackEventPacket(
+        i, context_.sorter->payload_arena()->Make<TrackEventData>(
+               TraceBlobView(std::move(buf), 0, data.size()),
+               state->current_generation()));
+  }
+
+  int64_t num_parsed = 0;
+  EXPECT_CALL(*parser_, MOCK_ParseTrackEvent(_, _))
+      .WillRepeatedly(Invoke([&](int64_t ts, const TrackEventData* data) {
+        EXPECT_EQ(ts, num_parsed++);
+        ASSERT_TRUE(data->prepared);
+        EXPECT_EQ(pool->Get(data->name_id).ToStdString(),
+                  "event" + std::to_string(ts % 100));
+        EXPECT_EQ(data->category_id, kNullStringId);
+      }));
+  context_.sorter->ExtractEventsForced();
+  EXPECT_EQ(num_parsed, kNumEvents);
+}
+
+// Checks that the preparable packets of multiple sequences are prepared, in
+// order for each sequence, before they are parsed.
+TEST_F(TraceSorterTest, ParallelPacketPreparation) {
+  context_.config.packet_preparation_worker_threads = 4;
+  CreateSorter();
+  FakePreparingModule module;
+
+  constexpr int kNumSequences = 8;
+  constexpr int kNumPackets = 128;
+  constexpr size_t kPacketSize = 16 * 1024;
+  std::vector<std::unique_ptr<PacketSequenceState>> states;
+  for (int i = 0; i < kNumSequences; i++)
+    states.emplace_back(new PacketSequenceState(&context_));
+
+  for (int i = 0; i < kNumPackets; i++) {
+    auto* state = states[static_cast<size_t>(i % kNumSequences)].get();
+    context_.sorter->PushPreparablePacket(
+        i, context_.sorter->payload_arena()->Make<PreparablePacketData>(
+               TraceBlobView(std::unique_ptr<uint8_t[]>(
+                                 new uint8_t[kPacketSize]()),
+                             0, kPacketSize),
+               state->current_generation(), &module));
+  }
+
+  int64_t num_parsed = 0;
+  EXPECT_CALL(*parser_, MOCK_ParsePreparablePacket(_, _))
+      .WillRepeatedly(
+          Invoke([&](int64_t ts, const PreparablePacketData* data) {
+            EXPECT_EQ(ts, num_parsed++);
+            ASSERT_TRUE(data->prepared);
+            using Prepared = FakePreparingModule::Prepared;
+            auto* prepared = static_cast<Prepared*>(data->prepared.get());
+            EXPECT_EQ(prepared->index_in_sequence,
+                      static_cast<size_t>(ts / kNumSequences));
+          }));
+  context_.sorter->ExtractEventsForced();
+  EXPECT_EQ(num_parsed, kNumPackets);
+}
+
+// Checks that packets are left to the parser when there are not enough bytes
+// to prepare.
+TEST_F(TraceSorterTest, NoPacketPreparationForSmallTraces) {
+  context_.config.packet_preparation_worker_threads = 4;
+  CreateSorter();
+  FakePreparingModule module;
+  PacketSequenceState state_a(&context_);
+  PacketSequenceState state_b(&context_);
+  for (int i = 0; i < 4; i++) {
+    PacketSequenceState& state = i % 2 ? state_a : state_b;
+    context_.sorter->PushPreparablePacket(
+        i, context_.sorter->payload_arena()->Make<PreparablePacketData>(
+               test_buffer_.slice(0, 1), state.current_generation(), &module));
+  }
+  EXPECT_CALL(*parser_, MOCK_ParsePreparablePacket(_, _))
+      .Times(4)
+      .WillRepeatedly(Invoke([](int64_t, const PreparablePacketData* data) {
+        EXPECT_FALSE(data->prepared);
+      }));
+  context_.sorter->ExtractEventsForced();
+}
+
+TEST_F(TraceSorterTest, WindowedSorting) {
+  context_.config.sorting_window_ns = 1000;
+  CreateSorter(TraceSorter::SortingMode::kWindowed);
+
+  PacketSequenceState state(&context_);
+  std::vector<int64_t> parsed_ts;
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(_, _, _, _))
+      .WillRepeatedly(
+          Invoke([&parsed_ts](uint32_t, int64_t ts, const uint8_t*, size_t) {
+            parsed_ts.push_back(ts);
+          }));
+
+  // Push events slightly out of order: each event is at most 100ns late
+  // which is well within the window.
+  std::minstd_rand0 rnd_engine(0);
+  size_t max_pending = 0;
+  for (int64_t i = 0; i < 100000; i++) {
+    int64_t ts = 1000 + i * 10 - static_cast<int64_t>(rnd_engine() % 100);
+    uint32_t cpu = static_cast<uint32_t>(rnd_engine() % 4);
+    context_.sorter->PushFtraceEvent(cpu, ts, TraceBlobView(nullptr, 0, 0),
+                                     &state);
+    context_.sorter->MaybeExtractEventsOutsideWindow();
+    max_pending = std::max(max_pending,
+                           static_cast<size_t>(i + 1) - parsed_ts.size());
+  }
+
+  // Events are extracted while being pushed and the sorter only holds ~2
+  // windows worth of events (i.e. 200 events) at any time.
+  ASSERT_LE(max_pending, 300u);
+
+  context_.sorter->ExtractEventsForced();
+  ASSERT_EQ(parsed_ts.size(), 100000u);
+  ASSERT_TRUE(std::is_sorted(parsed_ts.begin(), parsed_ts.end()));
+  ASSERT_EQ(context_.storage->stats()[stats::sorter_window_late_events].value,
+            0);
+}
+
+TEST_F(TraceSorterTest, WindowedSortingLateEvents) {
+  context_.config.sorting_window_ns = 100;
+  CreateSorter(TraceSorter::SortingMode::kWindowed);
+
+  PacketSequenceState state(&context_);
+  std::vector<int64_t> parsed_ts;
+  EXPECT_CALL(*parser_, MOCK_ParseTracePacket(_, _, _))
+      .WillRepeatedly(Invoke([&parsed_ts](int64_t ts, const uint8_t*, size_t) {
+        parsed_ts.push_back(ts);
+      }));
+
+  context_.sorter->PushTracePacket(1000, &state, test_buffer_.slice(0, 1));
+  context_.sorter->PushTracePacket(1500, &state, test_buffer_.slice(0, 1));
+
+  // A read buffer event extracts everything older than the window.
+  context_.sorter->NotifyReadBufferEvent();
+  ASSERT_EQ(parsed_ts, std::vector<int64_t>{1000});
+
+  // Events older than the ones which have been extracted are dropped.
+  context_.sorter->PushTracePacket(1300, &state, test_buffer_.slice(0, 1));
+  context_.sorter->PushTracePacket(1450, &state, test_buffer_.slice(0, 1));
+  context_.sorter->ExtractEventsForced();
+  ASSERT_EQ(parsed_ts, (std::vector<int64_t>{1000, 1450, 1500}));
+  ASSERT_EQ(context_.storage->stats()[stats::sorter_window_late_events].value,
+            1);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
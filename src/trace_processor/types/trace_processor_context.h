@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_TYPES_TRACE_PROCESSOR_CONTEXT_H_
 #define SRC_TRACE_PROCESSOR_TYPES_TRACE_PROCESSOR_CONTEXT_H_
 
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -89,19 +90,23 @@ class TraceProcessorContext {
   std::unique_ptr<Destructible> android_probes_tracker;  // AndroidProbesTracker
   std::unique_ptr<Destructible> syscall_tracker;         // SyscallTracker
   std::unique_ptr<Destructible> sched_tracker;           // SchedEventTracker
+  std::unique_ptr<Destructible> thread_state_tracker;    // ThreadStateTracker
   std::unique_ptr<Destructible> binder_tracker;          // BinderTracker
   std::unique_ptr<Destructible> systrace_parser;         // SystraceParser
   std::unique_ptr<Destructible> heap_graph_tracker;      // HeapGraphTracker
   std::unique_ptr<Destructible> json_tracker;            // JsonTracker
   std::unique_ptr<Destructible> system_info_tracker;     // SystemInfoTracker
 
-  // These fields are trace readers which will be called by |forwarding_parser|
-  // once the format of the trace is discovered. They are placed here as they
-  // are only available in the storage_full target.
-  std::unique_ptr<ChunkedTraceReader> json_trace_tokenizer;
-  std::unique_ptr<ChunkedTraceReader> fuchsia_trace_tokenizer;
-  std::unique_ptr<ChunkedTraceReader> systrace_trace_parser;
-  std::unique_ptr<ChunkedTraceReader> gzip_trace_parser;
+  // These fields create the trace readers which will be called by
+  // |forwarding_parser| once the format of the trace is discovered, one for
+  // each trace loaded. They are placed here as they are only available in the
+  // storage_full target.
+  using ChunkedTraceReaderFactory =
+      std::function<std::unique_ptr<ChunkedTraceReader>()>;
+  ChunkedTraceReaderFactory json_trace_tokenizer_factory;
+  ChunkedTraceReaderFactory fuchsia_trace_tokenizer_factory;
+  ChunkedTraceReaderFactory systrace_trace_parser_factory;
+  ChunkedTraceReaderFactory gzip_trace_parser_factory;
 
   // These fields are trace parsers which will be called by |forwarding_parser|
   // once the format of the trace is discovered. They are placed here as they
@@ -32,6 +32,12 @@ struct VersionNumber {
   bool operator>=(const VersionNumber& other) {
     return std::tie(major, minor) >= std::tie(other.major, other.minor);
   }
+  bool operator==(const VersionNumber& other) const {
+    return std::tie(major, minor) == std::tie(other.major, other.minor);
+  }
+  bool operator!=(const VersionNumber& other) const {
+    return !(*this == other);
+  }
 };
 
 }  // namespace trace_processor
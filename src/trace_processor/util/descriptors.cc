@@ -118,7 +118,7 @@ util::Status DescriptorPool::AddNestedProtoDescriptors(
     ProtoDescriptor proto_descriptor(file_name, package_name, full_name,
                                      ProtoDescriptor::Type::kMessage,
                                      parent_idx);
-    descriptors_.emplace_back(std::move(proto_descriptor));
+    AddDescriptor(std::move(proto_descriptor));
   }
   ProtoDescriptor& proto_descriptor = descriptors_[*prev_idx];
   if (proto_descriptor.type() != ProtoDescriptor::Type::kMessage) {
@@ -190,7 +190,7 @@ util::Status DescriptorPool::AddEnumProtoDescriptors(
     ProtoDescriptor proto_descriptor(file_name, package_name, full_name,
                                      ProtoDescriptor::Type::kEnum,
                                      base::nullopt);
-    descriptors_.emplace_back(std::move(proto_descriptor));
+    AddDescriptor(std::move(proto_descriptor));
   }
   ProtoDescriptor& proto_descriptor = descriptors_[*prev_idx];
   if (proto_descriptor.type() != ProtoDescriptor::Type::kEnum) {
@@ -213,8 +213,12 @@ util::Status DescriptorPool::AddFromFileDescriptorSet(
     size_t size,
     const std::vector<std::string>& skip_prefixes,
     bool merge_existing_messages) {
+  LoadPendingDescriptorSets();
   protos::pbzero::FileDescriptorSet::Decoder proto(file_descriptor_set_proto,
                                                    size);
+  // The fields of existing descriptors can change (e.g. extensions).
+  parse_plans_.clear();
+
   std::vector<ExtensionInfo> extensions;
   for (auto it = proto.file(); it; ++it) {
     protos::pbzero::FileDescriptorProto::Decoder file(*it);
@@ -274,15 +278,70 @@ util::Status DescriptorPool::AddFromFileDescriptorSet(
   return util::OkStatus();
 }
 
+void DescriptorPool::AddFromFileDescriptorSetLazily(
+    const uint8_t* file_descriptor_set_proto,
+    size_t size) {
+  pending_descriptor_sets_.emplace_back(file_descriptor_set_proto, size);
+}
+
+void DescriptorPool::LoadPendingDescriptorSetsSlow() {
+  std::vector<std::pair<const uint8_t*, size_t>> pending;
+  pending.swap(pending_descriptor_sets_);
+  for (const auto& set : pending) {
+    base::Status status = AddFromFileDescriptorSet(set.first, set.second);
+    PERFETTO_DCHECK(status.ok());
+  }
+}
+
+uint32_t DescriptorPool::AddDescriptor(ProtoDescriptor descriptor) {
+  auto idx = static_cast<uint32_t>(descriptors_.size());
+  descriptor_idx_by_name_.emplace(descriptor.full_name(), idx);
+  descriptors_.emplace_back(std::move(descriptor));
+  parse_plans_.clear();
+  return idx;
+}
+
 base::Optional<uint32_t> DescriptorPool::FindDescriptorIdx(
     const std::string& full_name) const {
-  auto it = std::find_if(descriptors_.begin(), descriptors_.end(),
-                         [full_name](const ProtoDescriptor& desc) {
-                           return desc.full_name() == full_name;
-                         });
-  auto idx = static_cast<uint32_t>(std::distance(descriptors_.begin(), it));
-  return idx < descriptors_.size() ? base::Optional<uint32_t>(idx)
-                                   : base::nullopt;
+  LoadPendingDescriptorSets();
+  auto it = descriptor_idx_by_name_.find(full_name);
+  return it == descriptor_idx_by_name_.end() ? base::nullopt
+                                             : base::make_optional(it->second);
+}
+
+const MessageParsePlan& DescriptorPool::GetParsePlan(
+    uint32_t descriptor_idx) const {
+  LoadPendingDescriptorSets();
+  PERFETTO_DCHECK(descriptor_idx < descriptors_.size());
+  if (parse_plans_.size() <= descriptor_idx)
+    parse_plans_.resize(descriptors_.size());
+  std::unique_ptr<MessageParsePlan>& plan = parse_plans_[descriptor_idx];
+  if (plan)
+    return *plan;
+
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+  plan.reset(new MessageParsePlan());
+  for (const auto& entry : descriptors_[descriptor_idx].fields()) {
+    const FieldDescriptor& field_descriptor = entry.second;
+    MessageParsePlan::Field field;
+    field.descriptor = &field_descriptor;
+    if (field_descriptor.type() == FieldDescriptorProto::TYPE_MESSAGE ||
+        field_descriptor.type() == FieldDescriptorProto::TYPE_ENUM) {
+      field.type_idx = FindDescriptorIdx(field_descriptor.resolved_type_name());
+    }
+    if (field_descriptor.is_repeated())
+      field.repeated_idx = plan->num_repeated_fields_++;
+
+    uint32_t id = field_descriptor.number();
+    if (id <= MessageParsePlan::kMaxDenseFieldId) {
+      if (plan->dense_fields_.size() <= id)
+        plan->dense_fields_.resize(id + 1);
+      plan->dense_fields_[id] = field;
+    } else {
+      plan->sparse_fields_[id] = field;
+    }
+  }
+  return *plan;
 }
 
 std::vector<uint8_t> DescriptorPool::SerializeAsDescriptorSet() {
@@ -18,11 +18,13 @@
 #define SRC_TRACE_PROCESSOR_UTIL_DESCRIPTORS_H_
 
 #include <algorithm>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/optional.h"
 #include "protos/perfetto/common/descriptor.pbzero.h"
@@ -114,6 +116,14 @@ class ProtoDescriptor {
     return &it->second;
   }
 
+  // Like FindEnumString() but without copying the string. Returns nullptr if
+  // |value| is not a value of the enum.
+  const std::string* FindEnumName(const int32_t value) const {
+    PERFETTO_DCHECK(type_ == Type::kEnum);
+    auto it = enum_names_by_value_.find(value);
+    return it == enum_names_by_value_.end() ? nullptr : &it->second;
+  }
+
   base::Optional<std::string> FindEnumString(const int32_t value) const {
     PERFETTO_DCHECK(type_ == Type::kEnum);
     auto it = enum_names_by_value_.find(value);
@@ -156,6 +166,46 @@ class ProtoDescriptor {
 
 using ExtensionInfo = std::pair<std::string, protozero::ConstBytes>;
 
+// The fields of a message descriptor flattened for decoding: the descriptor of
+// each field is found by indexing a vector with the field id, and the types of
+// message and enum fields are already resolved to descriptor indices. Built
+// lazily by DescriptorPool::GetParsePlan().
+class MessageParsePlan {
+ public:
+  struct Field {
+    const FieldDescriptor* descriptor = nullptr;
+
+    // For message and enum fields, the index of the descriptor of their type
+    // in the pool (unset if the type is not in the pool).
+    base::Optional<uint32_t> type_idx;
+
+    // For repeated fields, the index of the field among the repeated fields
+    // of the message, used to count their entries while decoding.
+    uint32_t repeated_idx = 0;
+  };
+
+  // Returns nullptr if the message has no field with id |id|.
+  const Field* FindField(uint32_t id) const {
+    if (id < dense_fields_.size())
+      return dense_fields_[id].descriptor ? &dense_fields_[id] : nullptr;
+    auto it = sparse_fields_.find(id);
+    return it == sparse_fields_.end() ? nullptr : &it->second;
+  }
+
+  uint32_t num_repeated_fields() const { return num_repeated_fields_; }
+
+ private:
+  friend class DescriptorPool;
+
+  // Field ids up to this value are stored in |dense_fields_|. Larger ids
+  // (usually extensions) go to |sparse_fields_|.
+  static constexpr uint32_t kMaxDenseFieldId = 255;
+
+  std::vector<Field> dense_fields_;
+  std::unordered_map<uint32_t, Field> sparse_fields_;
+  uint32_t num_repeated_fields_ = 0;
+};
+
 class DescriptorPool {
  public:
   // Adds Descriptors from file_descriptor_set_proto. Ignores any FileDescriptor
@@ -166,20 +216,43 @@ class DescriptorPool {
       const std::vector<std::string>& skip_prefixes = {},
       bool merge_existing_messages = false);
 
+  // Like AddFromFileDescriptorSet(), but the descriptors are only decoded when
+  // the pool is first looked up, so that large descriptors which might never
+  // be used don't slow down startup. |file_descriptor_set_proto| must outlive
+  // the pool (e.g. a descriptor compiled into the binary) and must be valid.
+  void AddFromFileDescriptorSetLazily(const uint8_t* file_descriptor_set_proto,
+                                      size_t size);
+
   base::Optional<uint32_t> FindDescriptorIdx(
       const std::string& full_name) const;
 
+  // Returns the parse plan of the message descriptor at |descriptor_idx|,
+  // building it on first use. The plans are dropped when descriptors are
+  // added, so the returned reference is only valid until then. Like the
+  // other methods of the pool, this is not thread-safe.
+  const MessageParsePlan& GetParsePlan(uint32_t descriptor_idx) const;
+
   std::vector<uint8_t> SerializeAsDescriptorSet();
 
   void AddProtoDescriptorForTesting(ProtoDescriptor descriptor) {
-    descriptors_.emplace_back(std::move(descriptor));
+    LoadPendingDescriptorSets();
+    AddDescriptor(std::move(descriptor));
   }
 
   const std::vector<ProtoDescriptor>& descriptors() const {
+    LoadPendingDescriptorSets();
     return descriptors_;
   }
 
  private:
+  // Decodes the descriptor sets passed to AddFromFileDescriptorSetLazily().
+  // Lookups are logically const, even when they decode them.
+  void LoadPendingDescriptorSets() const {
+    if (PERFETTO_UNLIKELY(!pending_descriptor_sets_.empty()))
+      const_cast<DescriptorPool*>(this)->LoadPendingDescriptorSetsSlow();
+  }
+  void LoadPendingDescriptorSetsSlow();
+
   base::Status AddNestedProtoDescriptors(const std::string& file_name,
                                          const std::string& package_name,
                                          base::Optional<uint32_t> parent_idx,
@@ -200,8 +273,16 @@ class DescriptorPool {
   base::Optional<uint32_t> ResolveShortType(const std::string& parent_path,
                                             const std::string& short_type);
 
+  uint32_t AddDescriptor(ProtoDescriptor descriptor);
+
   std::vector<ProtoDescriptor> descriptors_;
+  std::unordered_map<std::string, uint32_t> descriptor_idx_by_name_;
   std::set<std::string> processed_files_;
+
+  // Indexed by descriptor index; null until the plan is first requested.
+  mutable std::vector<std::unique_ptr<MessageParsePlan>> parse_plans_;
+
+  std::vector<std::pair<const uint8_t*, size_t>> pending_descriptor_sets_;
 };
 
 }  // namespace trace_processor
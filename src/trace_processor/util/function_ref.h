@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_FUNCTION_REF_H_
+#define SRC_TRACE_PROCESSOR_UTIL_FUNCTION_REF_H_
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace perfetto {
+namespace trace_processor {
+
+template <typename Fn>
+class FunctionRef;
+
+// A non-owning reference to a callable object, similar to std::function but
+// without any allocation or copy of the callable: it's just a pointer to the
+// callable and a pointer to a function invoking it.
+//
+// As the callable is not copied, a FunctionRef must not outlive it: it
+// should only be used for parameters of functions which invoke the callback
+// before returning (e.g. passing a lambda to a function taking a FunctionRef
+// is always safe) and never be stored.
+//
+// An empty std::function converts to an empty FunctionRef so that APIs
+// which used to take std::function can switch to FunctionRef without
+// changing their callers.
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+ public:
+  FunctionRef() = default;
+  FunctionRef(std::nullptr_t) {}
+
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<F>::type,
+                FunctionRef>::value>::type>
+  FunctionRef(F&& f) {
+    if (IsNull(f))
+      return;
+    using Callable = typename std::remove_reference<F>::type;
+    obj_ = const_cast<void*>(static_cast<const void*>(std::addressof(f)));
+    invoke_ = &Invoke<Callable>;
+  }
+
+  R operator()(Args... args) const {
+    return invoke_(obj_, std::forward<Args>(args)...);
+  }
+
+  explicit operator bool() const { return invoke_ != nullptr; }
+
+ private:
+  template <typename Callable>
+  static R Invoke(void* obj, Args... args) {
+    return (*static_cast<Callable*>(obj))(std::forward<Args>(args)...);
+  }
+
+  static bool IsNull(const std::function<R(Args...)>& f) { return !f; }
+  template <typename F>
+  static bool IsNull(const F&) {
+    return false;
+  }
+
+  void* obj_ = nullptr;
+  R (*invoke_)(void*, Args...) = nullptr;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_FUNCTION_REF_H_
@@ -19,6 +19,7 @@
 
 #include "src/trace_processor/util/trace_blob_view.h"
 
+#include <functional>
 #include <unordered_map>
 
 namespace perfetto {
@@ -49,6 +50,8 @@ class InternedMessageView {
     this->decoder_ = nullptr;
     this->decoder_type_ = nullptr;
     this->submessages_.clear();
+    this->derived_data_ = nullptr;
+    this->derived_data_type_ = nullptr;
     return *this;
   }
 
@@ -103,6 +106,30 @@ class InternedMessageView {
     return submessage_view;
   }
 
+  // Lazily default-constructs and returns an object of type T stored with the
+  // message. Importers use it to cache values derived from the message (e.g.
+  // the ids of its interned strings) so that they are only computed once per
+  // interned message rather than once per event referencing it.
+  template <typename T>
+  T* GetOrCreateDerivedData() {
+    if (!derived_data_) {
+      derived_data_ = std::unique_ptr<void, std::function<void(void*)>>(
+          new T(), [](void* obj) { delete reinterpret_cast<T*>(obj); });
+      derived_data_type_ = PERFETTO_TYPE_IDENTIFIER;
+    }
+    // Verify that the type of the derived data didn't change.
+    if (PERFETTO_TYPE_IDENTIFIER &&
+        strcmp(derived_data_type_,
+               // GCC complains if this arg can be null.
+               PERFETTO_TYPE_IDENTIFIER ? PERFETTO_TYPE_IDENTIFIER : "") != 0) {
+      PERFETTO_FATAL(
+          "Derived data accessed under different types! previous type: "
+          "%s. new type: %s.",
+          derived_data_type_, PERFETTO_DEBUG_FUNCTION_IDENTIFIER());
+    }
+    return reinterpret_cast<T*>(derived_data_.get());
+  }
+
   const TraceBlobView& message() { return message_; }
 
  private:
@@ -130,6 +157,12 @@ class InternedMessageView {
   // decoders, we avoid having to decode submessages multiple times if they
   // looked up often.
   SubMessageViewMap submessages_;
+
+  // Data derived from the message by importers, see GetOrCreateDerivedData().
+  // Like |decoder_|, it is type-erased and the type is only checked in debug
+  // builds.
+  std::unique_ptr<void, std::function<void(void*)>> derived_data_;
+  const char* derived_data_type_ = nullptr;
 };
 
 }  // namespace trace_processor
@@ -32,6 +32,19 @@ void AppendProtoType(std::string& target, const std::string& value) {
   target += value;
 }
 
+// Appends "[index]" to |target| without going through a temporary string.
+void AppendArrayIndex(std::string& target, size_t index) {
+  char buf[24];
+  size_t pos = sizeof(buf);
+  do {
+    buf[--pos] = static_cast<char>('0' + index % 10);
+    index /= 10;
+  } while (index);
+  target += '[';
+  target.append(&buf[pos], sizeof(buf) - pos);
+  target += ']';
+}
+
 }  // namespace
 
 ProtoToArgsParser::Key::Key() = default;
@@ -99,15 +112,25 @@ base::Status ProtoToArgsParser::ParseMessageInternal(
   if (!idx) {
     return base::Status("Failed to find proto descriptor");
   }
+  return ParseMessageWithPlan(pool_.GetParsePlan(*idx), cb, allowed_fields,
+                              delegate);
+}
 
-  auto& descriptor = pool_.descriptors()[*idx];
-
-  std::unordered_map<size_t, int> repeated_field_index;
+base::Status ProtoToArgsParser::ParseMessageWithPlan(
+    const MessageParsePlan& plan,
+    const protozero::ConstBytes& cb,
+    const std::vector<uint16_t>* allowed_fields,
+    Delegate& delegate) {
+  // The number of entries seen so far for each repeated field of the message,
+  // stacked on top of the counts of the enclosing messages.
+  size_t repeated_base = repeated_field_counts_.size();
+  repeated_field_counts_.resize(repeated_base + plan.num_repeated_fields());
 
+  base::Status status;
   protozero::ProtoDecoder decoder(cb);
   for (protozero::Field f = decoder.ReadField(); f.valid();
        f = decoder.ReadField()) {
-    auto field = descriptor.FindFieldByTag(f.id());
+    const MessageParsePlan::Field* field = plan.FindField(f.id());
     if (!field) {
       // Unknown field, possibly an unknown extension.
       continue;
@@ -115,7 +138,7 @@ base::Status ProtoToArgsParser::ParseMessageInternal(
 
     // If allowlist is not provided, reflect all fields. Otherwise, check if the
     // current field either an extension or is in allowlist.
-    bool is_allowed = field->is_extension() || !allowed_fields ||
+    bool is_allowed = field->descriptor->is_extension() || !allowed_fields ||
                       std::find(allowed_fields->begin(), allowed_fields->end(),
                                 f.id()) != allowed_fields->end();
 
@@ -124,41 +147,42 @@ base::Status ProtoToArgsParser::ParseMessageInternal(
       // reflected.
       continue;
     }
-    RETURN_IF_ERROR(
-        ParseField(*field, repeated_field_index[f.id()], f, delegate));
-    if (field->is_repeated()) {
-      repeated_field_index[f.id()]++;
+    int repeated_field_number = 0;
+    if (field->descriptor->is_repeated()) {
+      repeated_field_number =
+          repeated_field_counts_[repeated_base + field->repeated_idx]++;
     }
+    status = ParseField(*field, repeated_field_number, f, delegate);
+    if (!status.ok())
+      break;
   }
 
-  return base::OkStatus();
+  repeated_field_counts_.resize(repeated_base);
+  return status;
 }
 
 base::Status ProtoToArgsParser::ParseField(
-    const FieldDescriptor& field_descriptor,
+    const MessageParsePlan::Field& field,
     int repeated_field_number,
-    protozero::Field field,
+    protozero::Field proto_field,
     Delegate& delegate) {
-  std::string prefix_part = field_descriptor.name();
-  if (field_descriptor.is_repeated()) {
-    std::string number = std::to_string(repeated_field_number);
-    prefix_part.reserve(prefix_part.length() + number.length() + 2);
-    prefix_part.append("[");
-    prefix_part.append(number);
-    prefix_part.append("]");
-  }
+  const FieldDescriptor& field_descriptor = *field.descriptor;
 
   // In the args table we build up message1.message2.field1 as the column
   // name. This will append the ".field1" suffix to |key_prefix| and then
   // remove it when it goes out of scope.
   ScopedNestedKeyContext key_context(key_prefix_);
   AppendProtoType(key_prefix_.flat_key, field_descriptor.name());
-  AppendProtoType(key_prefix_.key, prefix_part);
+  AppendProtoType(key_prefix_.key, field_descriptor.name());
+  if (field_descriptor.is_repeated()) {
+    AppendArrayIndex(key_prefix_.key,
+                     static_cast<size_t>(repeated_field_number));
+  }
 
   // If we have an override parser then use that instead and move onto the
   // next loop.
   if (base::Optional<base::Status> status =
-          MaybeApplyOverrideForField(field, delegate)) {
+          MaybeApplyOverrideForField(proto_field, delegate)) {
     return *status;
   }
 
@@ -167,12 +191,19 @@ base::Status ProtoToArgsParser::ParseField(
   // recurse into it.
   if (field_descriptor.type() ==
       protos::pbzero::FieldDescriptorProto::TYPE_MESSAGE) {
-    return ParseMessageInternal(key_context, field.as_bytes(),
-                                field_descriptor.resolved_type_name(), nullptr,
-                                delegate);
+    const std::string& type = field_descriptor.resolved_type_name();
+    if (auto override_result = MaybeApplyOverrideForType(
+            type, key_context, proto_field.as_bytes(), delegate)) {
+      return override_result.value();
+    }
+    if (!field.type_idx) {
+      return base::Status("Failed to find proto descriptor");
+    }
+    return ParseMessageWithPlan(pool_.GetParsePlan(*field.type_idx),
+                                proto_field.as_bytes(), nullptr, delegate);
   }
 
-  return ParseSimpleField(field_descriptor, field, delegate);
+  return ParseSimpleField(field, proto_field, delegate);
 }
 
 void ProtoToArgsParser::AddParsingOverrideForField(
@@ -207,10 +238,11 @@ base::Optional<base::Status> ProtoToArgsParser::MaybeApplyOverrideForType(
 }
 
 base::Status ProtoToArgsParser::ParseSimpleField(
-    const FieldDescriptor& descriptor,
+    const MessageParsePlan::Field& plan_field,
     const protozero::Field& field,
     Delegate& delegate) {
   using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+  const FieldDescriptor& descriptor = *plan_field.descriptor;
   switch (descriptor.type()) {
     case FieldDescriptorProto::TYPE_INT32:
     case FieldDescriptorProto::TYPE_SFIXED32:
@@ -247,23 +279,18 @@ base::Status ProtoToArgsParser::ParseSimpleField(
       delegate.AddString(key_prefix_, field.as_string());
       return base::OkStatus();
     case FieldDescriptorProto::TYPE_ENUM: {
-      auto opt_enum_descriptor_idx =
-          pool_.FindDescriptorIdx(descriptor.resolved_type_name());
-      if (!opt_enum_descriptor_idx) {
-        delegate.AddInteger(key_prefix_, field.as_int32());
-        return base::OkStatus();
-      }
-      auto opt_enum_string =
-          pool_.descriptors()[*opt_enum_descriptor_idx].FindEnumString(
-              field.as_int32());
-      if (!opt_enum_string) {
+      const std::string* enum_name =
+          plan_field.type_idx
+              ? pool_.descriptors()[*plan_field.type_idx].FindEnumName(
+                    field.as_int32())
+              : nullptr;
+      if (!enum_name) {
         // Fall back to the integer representation of the field.
         delegate.AddInteger(key_prefix_, field.as_int32());
         return base::OkStatus();
       }
-      delegate.AddString(key_prefix_,
-                         protozero::ConstChars{opt_enum_string->data(),
-                                               opt_enum_string->size()});
+      delegate.AddString(key_prefix_, protozero::ConstChars{enum_name->data(),
+                                                            enum_name->size()});
       return base::OkStatus();
     }
     default:
@@ -233,9 +233,9 @@ class ProtoToArgsParser {
                                  ParsingOverrideForType parsing_override);
 
  private:
-  base::Status ParseField(const FieldDescriptor& field_descriptor,
+  base::Status ParseField(const MessageParsePlan::Field& field,
                           int repeated_field_number,
-                          protozero::Field field,
+                          protozero::Field proto_field,
                           Delegate& delegate);
 
   base::Optional<base::Status> MaybeApplyOverrideForField(
@@ -256,14 +256,24 @@ class ProtoToArgsParser {
                                     const std::vector<uint16_t>* fields,
                                     Delegate& delegate);
 
-  base::Status ParseSimpleField(const FieldDescriptor& desciptor,
-                                const protozero::Field& field,
+  // Decodes the fields of a message using the parse plan of its descriptor,
+  // after the type overrides have been checked.
+  base::Status ParseMessageWithPlan(const MessageParsePlan& plan,
+                                    const protozero::ConstBytes& cb,
+                                    const std::vector<uint16_t>* fields,
+                                    Delegate& delegate);
+
+  base::Status ParseSimpleField(const MessageParsePlan::Field& field,
+                                const protozero::Field& proto_field,
                                 Delegate& delegate);
 
   std::unordered_map<std::string, ParsingOverrideForField> field_overrides_;
   std::unordered_map<std::string, ParsingOverrideForType> type_overrides_;
   const DescriptorPool& pool_;
   Key key_prefix_;
+  // Entry counts of the repeated fields of the messages being parsed, see
+  // ParseMessageWithPlan().
+  std::vector<int> repeated_field_counts_;
 };
 
 }  // namespace util
@@ -212,6 +212,30 @@ TEST_F(ProtoToArgsParserTest, NestedProto) {
                           "super_nested.value_c super_nested.value_c 3"));
 }
 
+TEST_F(ProtoToArgsParserTest, LazilyLoadedDescriptors) {
+  using namespace protozero::test::protos::pbzero;
+  protozero::HeapBuffered<NestedA> msg{kChunkSize, kChunkSize};
+  msg->set_super_nested()->set_value_c(3);
+
+  auto binary_proto = msg.SerializeAsArray();
+
+  // The descriptors are decoded by the first lookup of the parser.
+  DescriptorPool pool;
+  pool.AddFromFileDescriptorSetLazily(kTestMessagesDescriptor.data(),
+                                      kTestMessagesDescriptor.size());
+  ProtoToArgsParser parser(pool);
+
+  auto status = parser.ParseMessage(
+      protozero::ConstBytes{binary_proto.data(), binary_proto.size()},
+      ".protozero.test.protos.NestedA", nullptr, *this);
+  EXPECT_TRUE(status.ok())
+      << "InternProtoFieldsIntoArgsTable failed with error: "
+      << status.message();
+  EXPECT_THAT(args(), testing::ElementsAre(
+                          "super_nested.value_c super_nested.value_c 3"));
+  EXPECT_TRUE(pool.FindDescriptorIdx(".protozero.test.protos.EveryField"));
+}
+
 TEST_F(ProtoToArgsParserTest, CamelCaseFieldsProto) {
   using namespace protozero::test::protos::pbzero;
   protozero::HeapBuffered<CamelCaseFields> msg{kChunkSize, kChunkSize};
@@ -439,6 +463,50 @@ TEST_F(ProtoToArgsParserTest, FieldOverrideTakesPrecedence) {
   EXPECT_THAT(args(), testing::ElementsAre("arg arg override-for-field"));
 }
 
+// Checks the indices of repeated fields in nested messages, which are counted
+// separately for each message, and fields with ids outside of the dense part
+// of the parse plan.
+TEST_F(ProtoToArgsParserTest, RepeatedFieldsInNestedMessages) {
+  using FieldDescriptorProto = protos::pbzero::FieldDescriptorProto;
+  DescriptorPool pool;
+  ProtoDescriptor inner("file.proto", ".test", ".test.Inner",
+                        ProtoDescriptor::Type::kMessage, base::nullopt);
+  inner.AddField(FieldDescriptor("value", 1, FieldDescriptorProto::TYPE_INT32,
+                                 "", /*is_repeated=*/true));
+  inner.AddField(FieldDescriptor("far", 1000, FieldDescriptorProto::TYPE_STRING,
+                                 "", /*is_repeated=*/false));
+  ProtoDescriptor outer("file.proto", ".test", ".test.Outer",
+                        ProtoDescriptor::Type::kMessage, base::nullopt);
+  FieldDescriptor inner_field("inner", 1, FieldDescriptorProto::TYPE_MESSAGE,
+                              ".test.Inner", /*is_repeated=*/true);
+  inner_field.set_resolved_type_name(".test.Inner");
+  outer.AddField(std::move(inner_field));
+  pool.AddProtoDescriptorForTesting(std::move(inner));
+  pool.AddProtoDescriptorForTesting(std::move(outer));
+
+  protozero::HeapBuffered<protozero::Message> msg{kChunkSize, kChunkSize};
+  for (int i = 0; i < 2; i++) {
+    auto* nested = msg->BeginNestedMessage<protozero::Message>(1);
+    nested->AppendVarInt(1, 10 + i);
+    nested->AppendVarInt(1, 20 + i);
+    nested->AppendString(1000, "x");
+  }
+  auto binary_proto = msg.SerializeAsArray();
+
+  ProtoToArgsParser parser(pool);
+  auto status = parser.ParseMessage(
+      protozero::ConstBytes{binary_proto.data(), binary_proto.size()},
+      ".test.Outer", nullptr, *this);
+  EXPECT_TRUE(status.ok()) << status.message();
+  EXPECT_THAT(args(),
+              testing::ElementsAre(
+                  "inner.value inner[0].value[0] 10",
+                  "inner.value inner[0].value[1] 20", "inner.far inner[0].far x",
+                  "inner.value inner[1].value[0] 11",
+                  "inner.value inner[1].value[1] 21",
+                  "inner.far inner[1].far x"));
+}
+
 }  // namespace
 }  // namespace util
 }  // namespace trace_processor
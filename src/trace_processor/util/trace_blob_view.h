@@ -43,6 +43,18 @@ class TraceBlobView {
     PERFETTO_DCHECK(length <= std::numeric_limits<uint32_t>::max());
   }
 
+  // Creates a view on memory which is owned by someone else (e.g. a read-only
+  // mapping of the trace file). |buffer| is retained until all the
+  // TraceBlobViews sliced from this one are destroyed. Use the aliasing
+  // constructor of std::shared_ptr to point inside a larger allocation.
+  static TraceBlobView FromSharedBuffer(std::shared_ptr<const uint8_t> buffer,
+                                        size_t offset,
+                                        size_t length) {
+    PERFETTO_DCHECK(offset <= std::numeric_limits<uint32_t>::max());
+    PERFETTO_DCHECK(length <= std::numeric_limits<uint32_t>::max());
+    return TraceBlobView(SharedBuf(std::move(buffer)), offset, length);
+  }
+
   // Allow std::move().
   TraceBlobView(TraceBlobView&&) noexcept = default;
   TraceBlobView& operator=(TraceBlobView&&) = default;
@@ -83,6 +95,10 @@ class TraceBlobView {
       rcbuf_ = new RefCountedBuf(std::move(mem));
     }
 
+    explicit SharedBuf(std::shared_ptr<const uint8_t> external_mem) {
+      rcbuf_ = new RefCountedBuf(std::move(external_mem));
+    }
+
     SharedBuf(const SharedBuf& copy) : rcbuf_(copy.rcbuf_) {
       PERFETTO_DCHECK(rcbuf_->refcount > 0);
       rcbuf_->refcount++;
@@ -117,14 +133,22 @@ class TraceBlobView {
 
     bool operator==(const SharedBuf& x) const { return x.rcbuf_ == rcbuf_; }
     bool operator!=(const SharedBuf& x) const { return !(x == *this); }
-    const uint8_t* data() const { return rcbuf_->mem.get(); }
+    const uint8_t* data() const { return rcbuf_->data; }
 
    private:
+    // Exactly one of |mem| and |external_mem| is set. |data| caches the start
+    // of whichever one is set to avoid a branch on every access.
     struct RefCountedBuf {
       explicit RefCountedBuf(std::unique_ptr<uint8_t[]> buf)
-          : refcount(1), mem(std::move(buf)) {}
+          : refcount(1), data(buf.get()), mem(std::move(buf)) {}
+      explicit RefCountedBuf(std::shared_ptr<const uint8_t> buf)
+          : refcount(1), data(buf.get()), external_mem(std::move(buf)) {}
       int refcount;
+      const uint8_t* data;
       std::unique_ptr<uint8_t[]> mem;
+      // The std::shared_ptr refcount is only touched when the RefCountedBuf
+      // is created and destroyed, not on every slice().
+      std::shared_ptr<const uint8_t> external_mem;
     };
 
     RefCountedBuf* rcbuf_ = nullptr;
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/trace_index.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <utility>
+
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_index.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace util {
+
+namespace {
+
+using IndexPb = protos::pbzero::TraceIndex;
+using PacketPb = protos::pbzero::TracePacket;
+
+// The packets which describe the whole trace, rather than a point in time.
+constexpr uint32_t kAlwaysLoadedPacketTypes[] = {
+    PacketPb::kProcessTreeFieldNumber,
+    PacketPb::kClockSnapshotFieldNumber,
+    PacketPb::kTraceConfigFieldNumber,
+    PacketPb::kSystemInfoFieldNumber,
+    PacketPb::kExtensionDescriptorFieldNumber,
+};
+
+struct Section {
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  bool from_service = false;
+  bool has_timestamps = false;
+  uint64_t min_timestamp = 0;
+  uint64_t max_timestamp = 0;
+  bool has_untimed_packets = false;
+  std::vector<uint32_t> sequence_ids;
+  std::vector<uint32_t> incremental_state_cleared_sequence_ids;
+  std::vector<uint32_t> packet_types;
+};
+
+bool Contains(const std::vector<uint32_t>& values, uint32_t value) {
+  return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+bool ContainsAny(const std::vector<uint32_t>& values,
+                 const uint32_t* begin,
+                 const uint32_t* end) {
+  return std::find_first_of(values.begin(), values.end(), begin, end) !=
+         values.end();
+}
+
+bool MatchesFilter(const Section& section, const TraceSectionFilter& filter) {
+  if (section.from_service ||
+      ContainsAny(section.packet_types, std::begin(kAlwaysLoadedPacketTypes),
+                  std::end(kAlwaysLoadedPacketTypes))) {
+    return true;
+  }
+  if (!filter.packet_types.empty() &&
+      !ContainsAny(section.packet_types, filter.packet_types.data(),
+                   filter.packet_types.data() + filter.packet_types.size())) {
+    return false;
+  }
+  if (section.has_untimed_packets || !section.has_timestamps)
+    return true;
+  return static_cast<int64_t>(section.min_timestamp) <= filter.end_ts &&
+         static_cast<int64_t>(section.max_timestamp) >= filter.start_ts;
+}
+
+}  // namespace
+
+uint64_t ParseTraceIndexFooter(const uint8_t* footer) {
+  using protozero::proto_utils::MakeTagFixed;
+  if (footer[0] != MakeTagFixed<uint32_t>(IndexPb::kMagicFieldNumber) ||
+      footer[5] != MakeTagFixed<uint64_t>(IndexPb::kPacketSizeFieldNumber)) {
+    return 0;
+  }
+  uint32_t magic = 0;
+  for (size_t i = 0; i < sizeof(magic); i++)
+    magic |= static_cast<uint32_t>(footer[1 + i]) << (8 * i);
+  if (magic != IndexPb::MAGIC_TRACE_INDEX)
+    return 0;
+  uint64_t packet_size = 0;
+  for (size_t i = 0; i < sizeof(packet_size); i++)
+    packet_size |= static_cast<uint64_t>(footer[6 + i]) << (8 * i);
+  return packet_size;
+}
+
+util::Status SelectTraceSections(const uint8_t* index,
+                                 size_t index_size,
+                                 uint64_t file_size,
+                                 const TraceSectionFilter& filter,
+                                 std::vector<TraceFileRange>* ranges) {
+  // Skip the preamble of the packet within the Trace message.
+  const uint8_t* end = index + index_size;
+  uint64_t packet_size = 0;
+  const uint8_t* packet = nullptr;
+  if (index_size > 0 &&
+      index[0] == protozero::proto_utils::MakeTagLengthDelimited(
+                      protos::pbzero::Trace::kPacketFieldNumber)) {
+    packet = protozero::proto_utils::ParseVarInt(index + 1, end, &packet_size);
+  }
+  if (!packet || packet == index + 1 ||
+      packet_size != static_cast<uint64_t>(end - packet)) {
+    return util::ErrStatus("Invalid trace index packet");
+  }
+  PacketPb::Decoder packet_decoder(packet, static_cast<size_t>(packet_size));
+  if (!packet_decoder.has_trace_index())
+    return util::ErrStatus("Invalid trace index packet");
+  IndexPb::Decoder index_decoder(packet_decoder.trace_index());
+  if (index_size > file_size ||
+      index_decoder.data_size() > file_size - index_size) {
+    return util::ErrStatus("Invalid trace index data size");
+  }
+  const uint64_t data_start =
+      file_size - index_size - index_decoder.data_size();
+
+  std::vector<Section> sections;
+  for (auto it = index_decoder.sections(); it; ++it) {
+    IndexPb::Section::Decoder decoder(*it);
+    Section section;
+    section.offset = decoder.offset();
+    section.size = decoder.size();
+    if (section.offset > index_decoder.data_size() ||
+        section.size > index_decoder.data_size() - section.offset ||
+        (!sections.empty() &&
+         section.offset < sections.back().offset + sections.back().size)) {
+      return util::ErrStatus("Invalid trace index section");
+    }
+    section.from_service = !decoder.has_buffer();
+    section.has_timestamps = decoder.has_min_timestamp();
+    section.min_timestamp = decoder.min_timestamp();
+    section.max_timestamp = decoder.max_timestamp();
+    section.has_untimed_packets = decoder.has_untimed_packets();
+    const protozero::Field& sequence_ids =
+        decoder.at<IndexPb::Section::kSequenceIdsFieldNumber>();
+    const protozero::Field& cleared_sequence_ids = decoder.at<
+        IndexPb::Section::kIncrementalStateClearedSequenceIdsFieldNumber>();
+    const protozero::Field& packet_types =
+        decoder.at<IndexPb::Section::kPacketTypesFieldNumber>();
+    if (!protozero::DecodePackedVarInts(sequence_ids.data(),
+                                        sequence_ids.size(),
+                                        &section.sequence_ids) ||
+        !protozero::DecodePackedVarInts(
+            cleared_sequence_ids.data(), cleared_sequence_ids.size(),
+            &section.incremental_state_cleared_sequence_ids) ||
+        !protozero::DecodePackedVarInts(packet_types.data(),
+                                        packet_types.size(),
+                                        &section.packet_types)) {
+      return util::ErrStatus("Invalid trace index section");
+    }
+    sections.emplace_back(std::move(section));
+  }
+
+  std::vector<bool> selected(sections.size());
+  // The sections of each sequence in file order, and whether the sequence
+  // clears its incremental state in each.
+  std::map<uint32_t, std::vector<std::pair<size_t, bool>>> sequences;
+  for (size_t i = 0; i < sections.size(); i++) {
+    const Section& section = sections[i];
+    selected[i] = MatchesFilter(section, filter);
+    for (uint32_t sequence_id : section.sequence_ids) {
+      sequences[sequence_id].emplace_back(
+          i, Contains(section.incremental_state_cleared_sequence_ids,
+                      sequence_id));
+    }
+  }
+
+  // Walk each sequence backwards to load the sections it needs before the
+  // selected ones. These can add other sequences, hence the fixed point.
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const auto& sequence : sequences) {
+      bool needed = false;
+      for (auto it = sequence.second.rbegin(); it != sequence.second.rend();
+           ++it) {
+        if (selected[it->first]) {
+          needed = true;
+        } else if (needed) {
+          selected[it->first] = true;
+          changed = true;
+        }
+        if (it->second)
+          needed = false;
+      }
+    }
+  }
+
+  // The data before the first byte written by the service is unknown, load
+  // it too. Coalesce contiguous sections.
+  ranges->clear();
+  if (data_start > 0)
+    ranges->push_back({0, data_start});
+  for (size_t i = 0; i < sections.size(); i++) {
+    if (!selected[i] || sections[i].size == 0)
+      continue;
+    const uint64_t offset = data_start + sections[i].offset;
+    if (!ranges->empty() &&
+        ranges->back().offset + ranges->back().size == offset) {
+      ranges->back().size += sections[i].size;
+    } else {
+      ranges->push_back({offset, sections[i].size});
+    }
+  }
+  return util::OkStatus();
+}
+
+}  // namespace util
+}  // namespace trace_processor
+}  // namespace perfetto
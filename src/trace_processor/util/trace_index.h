@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_TRACE_INDEX_H_
+#define SRC_TRACE_PROCESSOR_UTIL_TRACE_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/trace_processor/read_trace.h"
+#include "perfetto/trace_processor/status.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace util {
+
+// Size of the tail of a trace file which locates its TraceIndex, if any: the
+// tag and the value of TraceIndex.magic followed by the tag and the value of
+// TraceIndex.packet_size.
+constexpr size_t kTraceIndexFooterSize = 14;
+
+// Returns the size of the TraceIndex packet (including its preamble) at the
+// end of the file given the last kTraceIndexFooterSize bytes of the file, or
+// 0 if the file doesn't end with an index.
+uint64_t ParseTraceIndexFooter(const uint8_t* footer);
+
+// A range of bytes of the trace file.
+struct TraceFileRange {
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Decodes the TraceIndex packet |index| (including its preamble) found at
+// the end of a file of |file_size| bytes and returns in |ranges| the parts of
+// the file to load for |filter|, in file order:
+// - The sections of the packets emitted by the service and of the packets
+//   which describe the whole trace (e.g. process trees, clock snapshots) are
+//   always loaded.
+// - The other sections are loaded if their time range overlaps the one of
+//   |filter| (or if they have untimed packets) and if they contain one of
+//   the packet types of |filter|, if any.
+// - The packets of a sequence can only be decoded from the last point where
+//   its incremental state was cleared: the previous sections of the sequences
+//   of the loaded sections are loaded back to that point.
+// The index itself is not part of |ranges|.
+util::Status SelectTraceSections(const uint8_t* index,
+                                 size_t index_size,
+                                 uint64_t file_size,
+                                 const TraceSectionFilter& filter,
+                                 std::vector<TraceFileRange>* ranges);
+
+}  // namespace util
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_TRACE_INDEX_H_
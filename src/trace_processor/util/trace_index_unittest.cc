@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/trace_index.h"
+
+#include <limits>
+#include <vector>
+
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/trace_index.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace util {
+namespace {
+
+using IndexPb = protos::pbzero::TraceIndex;
+using PacketPb = protos::pbzero::TracePacket;
+
+constexpr uint32_t kService = std::numeric_limits<uint32_t>::max();
+
+struct TestSection {
+  uint32_t buffer;
+  uint64_t size;
+  uint64_t min_ts;
+  uint64_t max_ts;
+  std::vector<uint32_t> sequence_ids;
+  std::vector<uint32_t> cleared_sequence_ids;
+  std::vector<uint32_t> packet_types;
+};
+
+bool operator==(const TraceFileRange& a, const TraceFileRange& b) {
+  return a.offset == b.offset && a.size == b.size;
+}
+
+// Returns the TraceIndex packet of |sections|, as written by the service.
+std::vector<uint8_t> WriteIndex(const std::vector<TestSection>& sections) {
+  protozero::HeapBuffered<PacketPb> packet;
+  auto* index = packet->set_trace_index();
+  uint64_t offset = 0;
+  for (const TestSection& section : sections) {
+    auto* section_pb = index->add_sections();
+    section_pb->set_offset(offset);
+    section_pb->set_size(section.size);
+    if (section.buffer != kService)
+      section_pb->set_buffer(section.buffer);
+    section_pb->set_min_timestamp(section.min_ts);
+    section_pb->set_max_timestamp(section.max_ts);
+    protozero::PackedVarInt packed;
+    packed.Append(section.sequence_ids.data(), section.sequence_ids.size());
+    section_pb->set_sequence_ids(packed);
+    packed.Reset();
+    packed.Append(section.cleared_sequence_ids.data(),
+                  section.cleared_sequence_ids.size());
+    section_pb->set_incremental_state_cleared_sequence_ids(packed);
+    packed.Reset();
+    packed.Append(section.packet_types.data(), section.packet_types.size());
+    section_pb->set_packet_types(packed);
+    offset += section.size;
+  }
+  index->set_data_size(offset);
+  index->set_magic(IndexPb::MAGIC_TRACE_INDEX);
+  index->set_packet_size(0);
+  std::vector<uint8_t> packet_bytes = packet.SerializeAsArray();
+
+  uint8_t preamble[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  uint8_t* wptr = protozero::proto_utils::WriteVarInt(
+      protozero::proto_utils::MakeTagLengthDelimited(1), preamble);
+  wptr = protozero::proto_utils::WriteVarInt(packet_bytes.size(), wptr);
+  std::vector<uint8_t> res(preamble, wptr);
+  res.insert(res.end(), packet_bytes.begin(), packet_bytes.end());
+  uint64_t size = res.size();
+  for (size_t i = 0; i < sizeof(size); i++)
+    res[res.size() - sizeof(size) + i] = static_cast<uint8_t>(size >> (8 * i));
+  return res;
+}
+
+class TraceIndexTest : public ::testing::Test {
+ protected:
+  std::vector<TraceFileRange> Select(const TraceSectionFilter& filter) {
+    std::vector<uint8_t> index = WriteIndex(sections_);
+    uint64_t data_size = 0;
+    for (const TestSection& section : sections_)
+      data_size += section.size;
+    EXPECT_EQ(ParseTraceIndexFooter(&index[index.size() - 14]),
+              index.size());
+    std::vector<TraceFileRange> ranges;
+    util::Status status = SelectTraceSections(
+        index.data(), index.size(), data_size + index.size(), filter,
+        &ranges);
+    EXPECT_TRUE(status.ok()) << status.message();
+    return ranges;
+  }
+
+  std::vector<TestSection> sections_;
+};
+
+TEST_F(TraceIndexTest, NoFooter) {
+  uint8_t footer[kTraceIndexFooterSize] = {};
+  EXPECT_EQ(ParseTraceIndexFooter(footer), 0u);
+}
+
+TEST_F(TraceIndexTest, TimeWindow) {
+  sections_ = {
+      {kService, 10, 0, 0, {1}, {1}, {PacketPb::kTraceConfigFieldNumber}},
+      {0, 20, 100, 200, {2}, {2}, {11}},
+      {0, 20, 300, 400, {2}, {}, {11}},
+      {1, 20, 1000, 1100, {3}, {3}, {11}},
+  };
+  TraceSectionFilter filter;
+  EXPECT_THAT(Select(filter), ::testing::ElementsAre(TraceFileRange{0, 70}));
+
+  // The sections of the window and the ones before it back to the last
+  // incremental state clear of their sequences.
+  filter.start_ts = 350;
+  filter.end_ts = 500;
+  EXPECT_THAT(Select(filter), ::testing::ElementsAre(TraceFileRange{0, 50}));
+  filter.start_ts = 1000;
+  filter.end_ts = 2000;
+  EXPECT_THAT(Select(filter), ::testing::ElementsAre(TraceFileRange{0, 10},
+                                                     TraceFileRange{50, 20}));
+}
+
+TEST_F(TraceIndexTest, PacketTypes) {
+  sections_ = {
+      {kService, 10, 0, 0, {1}, {1}, {PacketPb::kTraceConfigFieldNumber}},
+      {0, 20, 100, 200, {2}, {2}, {11}},
+      {1, 20, 100, 200, {3}, {3}, {PacketPb::kFtraceEventsFieldNumber}},
+      {0, 20, 300, 400, {2, 4}, {4}, {11}},
+      {1, 20, 300, 400, {3}, {}, {PacketPb::kFtraceEventsFieldNumber}},
+  };
+  TraceSectionFilter filter;
+  filter.end_ts = 200;
+  filter.packet_types = {PacketPb::kFtraceEventsFieldNumber};
+  EXPECT_THAT(Select(filter), ::testing::ElementsAre(TraceFileRange{0, 10},
+                                                     TraceFileRange{30, 20}));
+
+  // The process tree is always loaded, which pulls in the previous track
+  // events of its sequence.
+  sections_[3].packet_types.push_back(PacketPb::kProcessTreeFieldNumber);
+  EXPECT_THAT(Select(filter), ::testing::ElementsAre(TraceFileRange{0, 70}));
+}
+
+TEST_F(TraceIndexTest, InvalidIndex) {
+  sections_ = {{0, 20, 100, 200, {2}, {2}, {11}}};
+  std::vector<uint8_t> index = WriteIndex(sections_);
+  std::vector<TraceFileRange> ranges;
+  // The file is too small for the data described by the index.
+  EXPECT_FALSE(SelectTraceSections(index.data(), index.size(), index.size(),
+                                   TraceSectionFilter(), &ranges)
+                   .ok());
+  index[0] = 0;
+  EXPECT_FALSE(SelectTraceSections(index.data(), index.size(),
+                                   index.size() + 20, TraceSectionFilter(),
+                                   &ranges)
+                   .ok());
+}
+
+}  // namespace
+}  // namespace util
+}  // namespace trace_processor
+}  // namespace perfetto
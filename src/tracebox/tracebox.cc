@@ -19,7 +19,16 @@
 #include "perfetto/ext/base/subprocess.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/traced/traced.h"
+#include "perfetto/ext/tracing/core/tracing_service.h"
 #include "src/perfetto_cmd/perfetto_cmd.h"
+#include "src/traced/probes/ftrace/ftrace_controller.h"
+#include "src/traced/probes/probes_producer.h"
+#include "src/traced/service/builtin_producer.h"
+#include "src/tracing/ipc/posix_shared_memory.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include "src/tracing/core/zlib_compressor.h"
+#endif
 
 #include <stdio.h>
 
@@ -53,6 +62,12 @@ Usage in autostart mode:
   tracebox -t 10s -o trace_file.perfetto-trace sched/sched_switch
   See tracebox --help for more options.
 
+Usage in all-in-one mode:
+  tracebox --all-in-one -t 10s -o trace_file.perfetto-trace sched/sched_switch
+  Like the autostart mode, but the tracing service and traced_probes run in
+  the tracebox process itself, without IPC sockets. This starts faster, but
+  other processes can't connect to the tracing service.
+
 Usage in manual mode:
   tracebox applet_name [args ...]  (e.g. ./tracebox traced --help)
   Applets:)");
@@ -68,6 +83,31 @@ See also:
 )");
 }
 
+// Runs the tracing service, traced_probes and the cmdline client in this
+// process, all on the task runner of the cmdline client. They talk to each
+// other through in-process endpoints, so neither IPC sockets nor subprocesses
+// are needed.
+int RunAllInOne(PerfettoCmd* perfetto_cmd) {
+  base::TaskRunner* task_runner = perfetto_cmd->task_runner();
+  std::unique_ptr<TracingService> svc = TracingService::CreateInstance(
+      std::unique_ptr<SharedMemory::Factory>(new PosixSharedMemory::Factory()),
+      task_runner);
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  svc->SetCompressorFn(&ZlibCompressFn);
+#endif
+
+  BuiltinProducer builtin_producer(task_runner, /*lazy_stop_delay_ms=*/30000);
+  builtin_producer.ConnectInProcess(svc.get());
+
+  if (!HardResetFtraceState())
+    PERFETTO_DLOG("Failed to reset ftrace");
+  ProbesProducer probes_producer;
+  probes_producer.ConnectInProcess(svc.get(), task_runner);
+
+  perfetto_cmd->set_in_process_service(svc.get());
+  return perfetto_cmd->ConnectToServiceAndRun();
+}
+
 int TraceboxMain(int argc, char** argv) {
   // Manual mode: if either the 1st argument (argv[1]) or the exe name (argv[0])
   // match the name of an applet, directly invoke that without further
@@ -95,6 +135,26 @@ int TraceboxMain(int argc, char** argv) {
     return 1;
   }
 
+  // --all-in-one is consumed here, the cmdline client doesn't know about it.
+  bool all_in_one = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--all-in-one"))
+      continue;
+    all_in_one = true;
+    for (int j = i; j < argc; j++)
+      argv[j] = argv[j + 1];  // argv[argc] is nullptr.
+    argc--;
+    break;
+  }
+
+  if (all_in_one) {
+    PerfettoCmd perfetto_cmd;
+    auto opt_res = perfetto_cmd.ParseCmdlineAndMaybeDaemonize(argc, argv);
+    if (opt_res.has_value())
+      return *opt_res;
+    return RunAllInOne(&perfetto_cmd);
+  }
+
   auto pid_str = std::to_string(static_cast<uint64_t>(base::GetProcessId()));
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
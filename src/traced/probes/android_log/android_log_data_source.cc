@@ -16,6 +16,16 @@
 
 #include "src/traced/probes/android_log/android_log_data_source.h"
 
+#include <string.h>
+
+#include "perfetto/base/build_config.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
 #include "perfetto/base/logging.h"
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/time.h"
@@ -25,6 +35,7 @@
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/unix_socket.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/tracing/core/data_source_config.h"
@@ -32,6 +43,8 @@
 #include "protos/perfetto/common/android_log_constants.pbzero.h"
 #include "protos/perfetto/config/android/android_log_config.pbzero.h"
 #include "protos/perfetto/trace/android/android_log.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 
 namespace perfetto {
@@ -88,9 +101,13 @@ inline bool ReadAndAdvance(const char** ptr, const char* end, T* out) {
 // static
 const ProbesDataSource::Descriptor AndroidLogDataSource::descriptor = {
     /*name*/ "android.log",
-    /*flags*/ Descriptor::kFlagsNone,
+    /*flags*/ Descriptor::kHandlesIncrementalState |
+        Descriptor::kCanRunOnWorkerThread,
 };
 
+// static
+constexpr size_t AndroidLogDataSource::kRecvBatchSize;
+
 AndroidLogDataSource::AndroidLogDataSource(DataSourceConfig ds_config,
                                            base::TaskRunner* task_runner,
                                            TracingSessionID session_id,
@@ -143,7 +160,9 @@ AndroidLogDataSource::AndroidLogDataSource(DataSourceConfig ds_config,
     filter_tags_.emplace(&filter_tags_strbuf_[it.first], it.second);
 
   min_prio_ = cfg.min_prio();
-  buf_ = base::PagedMemory::Allocate(kBufSize);
+  intern_strings_ = cfg.intern_strings();
+  passthrough_binary_events_ = cfg.passthrough_binary_events();
+  buf_ = base::PagedMemory::Allocate(kBufSize * kRecvBatchSize);
 }
 
 AndroidLogDataSource::~AndroidLogDataSource() {
@@ -220,86 +239,87 @@ void AndroidLogDataSource::OnSocketDataAvailable() {
       delay_ms);
 }
 
+size_t AndroidLogDataSource::ReceiveBatch() {
+  char* buf = reinterpret_cast<char*>(buf_.Get());
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  // Chatty devices can log thousands of entries per second: receive as many
+  // of them as possible with each syscall.
+  struct iovec iovs[kRecvBatchSize];
+  struct mmsghdr msgs[kRecvBatchSize];
+  memset(msgs, 0, sizeof(msgs));
+  for (size_t i = 0; i < kRecvBatchSize; i++) {
+    iovs[i].iov_base = buf + i * kBufSize;
+    iovs[i].iov_len = kBufSize;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  int res = PERFETTO_EINTR(recvmmsg(logdr_sock_.fd(), msgs, kRecvBatchSize,
+                                    MSG_DONTWAIT, nullptr));
+  if (res <= 0)
+    return 0;
+
+  size_t num_received = 0;
+  for (; num_received < static_cast<size_t>(res); num_received++) {
+    // An empty message means that logd closed the socket.
+    if (msgs[num_received].msg_len == 0)
+      break;
+    recv_sizes_[num_received] = msgs[num_received].msg_len;
+  }
+  return num_received;
+#else
+  ssize_t rsize = logdr_sock_.Receive(buf, kBufSize);
+  if (rsize <= 0)
+    return 0;
+  recv_sizes_[0] = static_cast<size_t>(rsize);
+  return 1;
+#endif
+}
+
 void AndroidLogDataSource::ReadLogSocket() {
   TraceWriter::TracePacketHandle packet;
   protos::pbzero::AndroidLogPacket* log_packet = nullptr;
   size_t num_events = 0;
-  bool stop = false;
-  ssize_t rsize;
-  while (!stop && (rsize = logdr_sock_.Receive(buf_.Get(), kBufSize)) > 0) {
-    num_events++;
-    stats_.num_total++;
-    // Don't hold the message loop for too long. If there are so many events
-    // in the queue, stop at some point and parse the remaining ones in another
-    // task (posted after this while loop).
-    if (num_events > 500) {
-      stop = true;
-      auto weak_this = weak_factory_.GetWeakPtr();
-      task_runner_->PostTask([weak_this] {
-        if (weak_this)
-          weak_this->ReadLogSocket();
-      });
-    }
-    char* buf = reinterpret_cast<char*>(buf_.Get());
-    PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(buf) % 16 == 0);
-    size_t payload_size = reinterpret_cast<logger_entry_v4*>(buf)->len;
-    size_t hdr_size = reinterpret_cast<logger_entry_v4*>(buf)->hdr_size;
-    if (payload_size + hdr_size > static_cast<size_t>(rsize)) {
-      PERFETTO_DLOG(
-          "Invalid Android log frame (hdr: %zu, payload: %zu, rsize: %zd)",
-          hdr_size, payload_size, rsize);
-      stats_.num_failed++;
-      continue;
-    }
-    char* const end = buf + hdr_size + payload_size;
-
-    // In older versions of Android the logger_entry struct can contain less
-    // fields. Copy that in a temporary struct, so that unset fields are
-    // always zero-initialized.
-    logger_entry_v4 entry{};
-    memcpy(&entry, buf, std::min(hdr_size, sizeof(entry)));
-    buf += hdr_size;
-
+  size_t num_received;
+  while ((num_received = ReceiveBatch()) > 0) {
     if (!packet) {
       // Lazily add the packet on the first event. This is to avoid creating
       // empty packets if there are no events in a task.
       packet = writer_->NewTracePacket();
       packet->set_timestamp(
           static_cast<uint64_t>(base::GetBootTimeNs().count()));
+      if (intern_strings_ || passthrough_binary_events_) {
+        packet->set_sequence_flags(
+            incremental_state_cleared_
+                ? protos::pbzero::TracePacket::SEQ_INCREMENTAL_STATE_CLEARED
+                : protos::pbzero::TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
+        incremental_state_cleared_ = false;
+      }
       log_packet = packet->set_android_log();
     }
 
-    protos::pbzero::AndroidLogPacket::LogEvent* evt = nullptr;
+    char* buf = reinterpret_cast<char*>(buf_.Get());
+    for (size_t i = 0; i < num_received; i++)
+      ParseLogEntry(buf + i * kBufSize, recv_sizes_[i], log_packet);
+    num_events += num_received;
 
-    if (entry.lid == AndroidLogId::LID_EVENTS) {
-      // Entries in the EVENTS buffer are special, they are binary encoded.
-      // See https://developer.android.com/reference/android/util/EventLog.
-      if (!ParseBinaryEvent(buf, end, log_packet, &evt)) {
-        PERFETTO_DLOG("Failed to parse Android log binary event");
-        stats_.num_failed++;
-        continue;
-      }
-    } else {
-      if (!ParseTextEvent(buf, end, log_packet, &evt)) {
-        PERFETTO_DLOG("Failed to parse Android log text event");
-        stats_.num_failed++;
-        continue;
-      }
-    }
-    if (!evt) {
-      // Parsing succeeded but the event was skipped due to filters.
-      stats_.num_skipped++;
-      continue;
+    // Don't hold the message loop for too long. If there are so many events
+    // in the queue, stop at some point and parse the remaining ones in another
+    // task.
+    if (num_events > 500) {
+      auto weak_this = weak_factory_.GetWeakPtr();
+      task_runner_->PostTask([weak_this] {
+        if (weak_this)
+          weak_this->ReadLogSocket();
+      });
+      break;
     }
+  }
 
-    // Add the common fields to the event.
-    uint64_t ts = entry.sec * 1000000000ULL + entry.nsec;
-    evt->set_timestamp(ts);
-    evt->set_log_id(static_cast<protos::pbzero::AndroidLogId>(entry.lid));
-    evt->set_pid(entry.pid);
-    evt->set_tid(static_cast<int32_t>(entry.tid));
-    evt->set_uid(static_cast<int32_t>(entry.uid));
-  }  // while(logdr_sock_.Receive())
+  // The entries interned while parsing the events are written after them, in
+  // the same packet.
+  if (packet)
+    WriteInternedData(&*packet);
 
   // Only print the log message if we have seen a bunch of events. This is to
   // avoid that we keep re-triggering the log socket by writing into the log
@@ -308,6 +328,62 @@ void AndroidLogDataSource::ReadLogSocket() {
     PERFETTO_DLOG("Seen %zu Android log events", num_events);
 }
 
+void AndroidLogDataSource::ParseLogEntry(
+    char* buf,
+    size_t size,
+    protos::pbzero::AndroidLogPacket* log_packet) {
+  stats_.num_total++;
+  PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(buf) % 16 == 0);
+  size_t payload_size = reinterpret_cast<logger_entry_v4*>(buf)->len;
+  size_t hdr_size = reinterpret_cast<logger_entry_v4*>(buf)->hdr_size;
+  if (payload_size + hdr_size > size) {
+    PERFETTO_DLOG(
+        "Invalid Android log frame (hdr: %zu, payload: %zu, rsize: %zu)",
+        hdr_size, payload_size, size);
+    stats_.num_failed++;
+    return;
+  }
+  char* const end = buf + hdr_size + payload_size;
+
+  // In older versions of Android the logger_entry struct can contain less
+  // fields. Copy that in a temporary struct, so that unset fields are
+  // always zero-initialized.
+  logger_entry_v4 entry{};
+  memcpy(&entry, buf, std::min(hdr_size, sizeof(entry)));
+  buf += hdr_size;
+
+  protos::pbzero::AndroidLogPacket::LogEvent* evt = nullptr;
+
+  if (entry.lid == AndroidLogId::LID_EVENTS) {
+    // Entries in the EVENTS buffer are special, they are binary encoded.
+    // See https://developer.android.com/reference/android/util/EventLog.
+    if (!ParseBinaryEvent(buf, end, log_packet, &evt)) {
+      PERFETTO_DLOG("Failed to parse Android log binary event");
+      stats_.num_failed++;
+      return;
+    }
+  } else {
+    if (!ParseTextEvent(buf, end, log_packet, &evt)) {
+      PERFETTO_DLOG("Failed to parse Android log text event");
+      stats_.num_failed++;
+      return;
+    }
+  }
+  if (!evt) {
+    // Parsing succeeded but the event was skipped due to filters.
+    stats_.num_skipped++;
+    return;
+  }
+
+  // Add the common fields to the event.
+  uint64_t ts = entry.sec * 1000000000ULL + entry.nsec;
+  evt->set_timestamp(ts);
+  evt->set_log_id(static_cast<protos::pbzero::AndroidLogId>(entry.lid));
+  evt->set_pid(entry.pid);
+  evt->set_tid(static_cast<int32_t>(entry.tid));
+  evt->set_uid(static_cast<int32_t>(entry.uid));
+}
+
 bool AndroidLogDataSource::ParseTextEvent(
     const char* start,
     const char* end,
@@ -343,7 +419,11 @@ bool AndroidLogDataSource::ParseTextEvent(
   auto* evt = packet->add_events();
   *out_evt = evt;
   evt->set_prio(static_cast<protos::pbzero::AndroidLogPriority>(prio));
-  evt->set_tag(tag.data(), tag.size());
+  if (intern_strings_) {
+    evt->set_tag_iid(InternString(tag));
+  } else {
+    evt->set_tag(tag.data(), tag.size());
+  }
 
   buf = str_end + 1;  // Move |buf| to the start of the message.
   size_t msg_len = static_cast<size_t>(end - buf);
@@ -384,21 +464,41 @@ bool AndroidLogDataSource::ParseBinaryEvent(
 
   auto* evt = packet->add_events();
   *out_evt = evt;
-  evt->set_tag(fmt->name.c_str());
+
+  // Leave the decoding of the arguments to the trace processor.
+  if (passthrough_binary_events_) {
+    evt->set_event_format_iid(InternEventFormat(eid, fmt));
+    evt->set_binary_args(reinterpret_cast<const uint8_t*>(buf),
+                         static_cast<size_t>(end - buf));
+    return true;
+  }
+
+  if (intern_strings_) {
+    evt->set_tag_iid(InternString(base::StringView(fmt->name)));
+  } else {
+    evt->set_tag(fmt->name.c_str());
+  }
+  auto add_arg = [this, evt](const std::string& name) {
+    auto* arg = evt->add_args();
+    if (intern_strings_) {
+      arg->set_name_iid(InternString(base::StringView(name)));
+    } else {
+      arg->set_name(name);
+    }
+    return arg;
+  };
   size_t field_num = 0;
   while (buf < end) {
     char type = *(buf++);
     if (field_num >= fmt->fields.size())
       return true;
-    const char* field_name = fmt->fields[field_num].c_str();
+    const std::string& field_name = fmt->fields[field_num];
     switch (type) {
       case EVENT_TYPE_INT: {
         int32_t value;
         if (!ReadAndAdvance(&buf, end, &value))
           return false;
-        auto* arg = evt->add_args();
-        arg->set_name(field_name);
-        arg->set_int_value(value);
+        add_arg(field_name)->set_int_value(value);
         field_num++;
         break;
       }
@@ -406,9 +506,7 @@ bool AndroidLogDataSource::ParseBinaryEvent(
         int64_t value;
         if (!ReadAndAdvance(&buf, end, &value))
           return false;
-        auto* arg = evt->add_args();
-        arg->set_name(field_name);
-        arg->set_int_value(value);
+        add_arg(field_name)->set_int_value(value);
         field_num++;
         break;
       }
@@ -416,9 +514,7 @@ bool AndroidLogDataSource::ParseBinaryEvent(
         float value;
         if (!ReadAndAdvance(&buf, end, &value))
           return false;
-        auto* arg = evt->add_args();
-        arg->set_name(field_name);
-        arg->set_float_value(value);
+        add_arg(field_name)->set_float_value(value);
         field_num++;
         break;
       }
@@ -426,9 +522,7 @@ bool AndroidLogDataSource::ParseBinaryEvent(
         uint32_t len;
         if (!ReadAndAdvance(&buf, end, &len) || buf + len > end)
           return false;
-        auto* arg = evt->add_args();
-        arg->set_name(field_name);
-        arg->set_string_value(buf, len);
+        add_arg(field_name)->set_string_value(buf, len);
         buf += len;
         field_num++;
         break;
@@ -473,6 +567,65 @@ void AndroidLogDataSource::Flush(FlushRequestID,
   writer_->Flush(callback);
 }
 
+void AndroidLogDataSource::ClearIncrementalState() {
+  interned_strings_.clear();
+  interned_string_iids_.clear();
+  interned_event_formats_.clear();
+  interned_event_format_iids_.clear();
+  num_strings_written_ = 0;
+  num_event_formats_written_ = 0;
+  incremental_state_cleared_ = true;
+}
+
+uint64_t AndroidLogDataSource::InternString(base::StringView str) {
+  auto it = interned_string_iids_.find(str);
+  if (it != interned_string_iids_.end())
+    return it->second;
+
+  // The keys of |interned_string_iids_| point into |interned_strings_|, whose
+  // entries never move.
+  interned_strings_.emplace_back(str.ToStdString());
+  uint64_t iid = interned_strings_.size();
+  interned_string_iids_.emplace(base::StringView(interned_strings_.back()),
+                                iid);
+  return iid;
+}
+
+uint64_t AndroidLogDataSource::InternEventFormat(int id,
+                                                 const EventFormat* fmt) {
+  auto it = interned_event_format_iids_.find(id);
+  if (it != interned_event_format_iids_.end())
+    return it->second;
+
+  interned_event_formats_.push_back(fmt);
+  uint64_t iid = interned_event_formats_.size();
+  interned_event_format_iids_.emplace(id, iid);
+  return iid;
+}
+
+void AndroidLogDataSource::WriteInternedData(
+    protos::pbzero::TracePacket* packet) {
+  if (num_strings_written_ == interned_strings_.size() &&
+      num_event_formats_written_ == interned_event_formats_.size()) {
+    return;
+  }
+
+  auto* interned_data = packet->set_interned_data();
+  for (; num_strings_written_ < interned_strings_.size();
+       num_strings_written_++) {
+    auto* str = interned_data->add_android_log_strings();
+    str->set_iid(num_strings_written_ + 1);
+    str->set_str(interned_strings_[num_strings_written_]);
+  }
+  for (; num_event_formats_written_ < interned_event_formats_.size();
+       num_event_formats_written_++) {
+    auto* fmt = interned_data->add_android_log_event_formats();
+    fmt->set_iid(num_event_formats_written_ + 1);
+    fmt->set_str(interned_event_formats_[num_event_formats_written_]
+                     ->definition);
+  }
+}
+
 void AndroidLogDataSource::ParseEventLogDefinitions() {
   std::string event_log_tags = ReadEventLogDefinitions();
   for (base::StringSplitter ss(std::move(event_log_tags), '\n'); ss.Next();) {
@@ -483,6 +636,8 @@ void AndroidLogDataSource::ParseEventLogDefinitions() {
 }
 
 bool AndroidLogDataSource::ParseEventLogDefinitionLine(char* line, size_t len) {
+  // Keep a copy of the line before it's split in place below.
+  std::string definition(line, strnlen(line, len));
   base::StringSplitter tok(line, len, ' ');
   if (!tok.Next())
     return false;
@@ -490,7 +645,10 @@ bool AndroidLogDataSource::ParseEventLogDefinitionLine(char* line, size_t len) {
   if (!tok.Next())
     return false;
   std::string name(tok.cur_token(), tok.cur_token_size());
-  auto it = event_formats_.emplace(id, EventFormat{std::move(name), {}}).first;
+  auto it = event_formats_
+                .emplace(id, EventFormat{std::move(name), {},
+                                         std::move(definition)})
+                .first;
   char* format = tok.cur_token() + tok.cur_token_size() + 1;
   if (format >= line + len || !*format || *format == '\n') {
     return true;
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACED_PROBES_ANDROID_LOG_ANDROID_LOG_DATA_SOURCE_H_
 #define SRC_TRACED_PROBES_ANDROID_LOG_ANDROID_LOG_DATA_SOURCE_H_
 
+#include <array>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -40,6 +42,7 @@ namespace protos {
 namespace pbzero {
 class AndroidLogPacket;
 class AndroidLogPacket_LogEvent;
+class TracePacket;
 }  // namespace pbzero
 }  // namespace protos
 
@@ -57,6 +60,10 @@ class AndroidLogDataSource : public ProbesDataSource {
   struct EventFormat {
     std::string name;
     std::vector<std::string> fields;
+
+    // The whole line, interned when passing binary events through (see
+    // AndroidLogConfig.passthrough_binary_events).
+    std::string definition;
   };
 
   AndroidLogDataSource(DataSourceConfig,
@@ -69,6 +76,7 @@ class AndroidLogDataSource : public ProbesDataSource {
   // ProbesDataSource implementation.
   void Start() override;
   void Flush(FlushRequestID, std::function<void()> callback) override;
+  void ClearIncrementalState() override;
 
   // Reads the contents of /system/etc/event-log-tags. Virtual for testing.
   virtual std::string ReadEventLogDefinitions();
@@ -84,10 +92,35 @@ class AndroidLogDataSource : public ProbesDataSource {
   base::WeakPtr<AndroidLogDataSource> GetWeakPtr() const;
 
  private:
+  // The maximum number of log entries received with a single syscall.
+  static constexpr size_t kRecvBatchSize = 32;
+
   void EnableSocketWatchTask(bool);
   void OnSocketDataAvailable();
   void ReadLogSocket();
 
+  // Receives up to kRecvBatchSize log entries from |logdr_sock_| into |buf_|,
+  // one every kBufSize bytes, with a single recvmmsg() where available.
+  // Returns the number of entries received and sets their sizes in
+  // |recv_sizes_|.
+  size_t ReceiveBatch();
+
+  // Parses the log entry of |size| bytes at |buf| and adds it to |packet|.
+  void ParseLogEntry(char* buf,
+                     size_t size,
+                     protos::pbzero::AndroidLogPacket* packet);
+
+  // Returns the iid of |str| in InternedData.android_log_strings, interning
+  // it if needed.
+  uint64_t InternString(base::StringView str);
+
+  // Returns the iid of the format |fmt| of the binary event |id| in
+  // InternedData.android_log_event_formats, interning it if needed.
+  uint64_t InternEventFormat(int id, const EventFormat* fmt);
+
+  // Writes the entries interned since the last call into |packet|.
+  void WriteInternedData(protos::pbzero::TracePacket* packet);
+
   // Parses one line of /system/etc/event-log-tags.
   bool ParseEventLogDefinitionLine(char* line, size_t len);
 
@@ -118,6 +151,8 @@ class AndroidLogDataSource : public ProbesDataSource {
 
   // Config parameters coming from the data source section in the trace config.
   int min_prio_ = 0;
+  bool intern_strings_ = false;
+  bool passthrough_binary_events_ = false;
   std::string mode_;
 
   // For filtering events based on tags.
@@ -129,9 +164,22 @@ class AndroidLogDataSource : public ProbesDataSource {
   // /system/etc/event-log-tags when starting.
   std::unordered_map<int, EventFormat> event_formats_;
 
+  // Interning state, reset by ClearIncrementalState(). The iid of each entry
+  // is its index in the deque/vector + 1. The entries past
+  // |num_*_written_| have not been written in the trace yet.
+  std::deque<std::string> interned_strings_;
+  std::unordered_map<base::StringView, uint64_t> interned_string_iids_;
+  std::vector<const EventFormat*> interned_event_formats_;
+  std::unordered_map<int, uint64_t> interned_event_format_iids_;
+  size_t num_strings_written_ = 0;
+  size_t num_event_formats_written_ = 0;
+  bool incremental_state_cleared_ = true;
+
   // Buffer used for parsing. It's safer (read: fails sooner) than using the
-  // stack, due to red zones around the boundaries.
+  // stack, due to red zones around the boundaries. Holds kRecvBatchSize
+  // entries of kBufSize bytes.
   base::PagedMemory buf_;
+  std::array<size_t, kRecvBatchSize> recv_sizes_{};
   Stats stats_;
   bool fd_watch_task_enabled_ = false;
 
@@ -24,6 +24,8 @@
 #include "protos/perfetto/common/android_log_constants.gen.h"
 #include "protos/perfetto/config/android/android_log_config.gen.h"
 #include "protos/perfetto/trace/android/android_log.gen.h"
+#include "protos/perfetto/trace/interned_data/interned_data.gen.h"
+#include "protos/perfetto/trace/profiling/profile_common.gen.h"
 
 using ::perfetto::protos::gen::AndroidLogConfig;
 using ::perfetto::protos::gen::AndroidLogId;
@@ -407,5 +409,79 @@ TEST_F(AndroidLogDataSourceTest, BinaryEventsWithTagFiltering) {
   EXPECT_EQ(decoded[0].tag(), "am_uid_stopped");
 }
 
+
+TEST_F(AndroidLogDataSourceTest, TextEventsWithInternedStrings) {
+  DataSourceConfig cfg;
+  AndroidLogConfig acfg;
+  acfg.set_intern_strings(true);
+  cfg.set_android_log_config_raw(acfg.SerializeAsString());
+  CreateInstance(cfg);
+  EXPECT_CALL(*data_source_, ReadEventLogDefinitions()).WillOnce(Return(""));
+  StartAndSimulateLogd(kValidTextEvents);
+
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_TRUE(packets.size() == 2);
+  auto event_packet = packets[0];
+  EXPECT_EQ(event_packet.sequence_flags(),
+            static_cast<uint32_t>(
+                protos::gen::TracePacket::SEQ_INCREMENTAL_STATE_CLEARED));
+
+  ASSERT_EQ(event_packet.android_log().events_size(), 3);
+  const auto& decoded = event_packet.android_log().events();
+  EXPECT_FALSE(decoded[0].has_tag());
+  EXPECT_EQ(decoded[0].tag_iid(), 1u);
+  EXPECT_EQ(decoded[1].tag_iid(), 2u);
+  EXPECT_EQ(decoded[2].tag_iid(), 3u);
+  EXPECT_EQ(decoded[2].message(), "Process 11660 exited due to signal (9)");
+
+  const auto& strings = event_packet.interned_data().android_log_strings();
+  ASSERT_EQ(strings.size(), 3u);
+  EXPECT_EQ(strings[0].iid(), 1u);
+  EXPECT_EQ(strings[0].str(), "ActivityManager");
+  EXPECT_EQ(strings[1].iid(), 2u);
+  EXPECT_EQ(strings[1].str(), "libprocessgroup");
+  EXPECT_EQ(strings[2].iid(), 3u);
+  EXPECT_EQ(strings[2].str(), "Zygote");
+}
+
+TEST_F(AndroidLogDataSourceTest, BinaryEventsPassthrough) {
+  DataSourceConfig cfg;
+  AndroidLogConfig acfg;
+  acfg.set_passthrough_binary_events(true);
+  cfg.set_android_log_config_raw(acfg.SerializeAsString());
+  CreateInstance(cfg);
+  static const char kDefs[] = R"(
+30023 am_kill (User|1|5),(PID|1|5),(Process Name|3),(OomAdj|1|5),(Reason|3)
+30053 am_uid_stopped (UID|1|5)
+)";
+  EXPECT_CALL(*data_source_, ReadEventLogDefinitions()).WillOnce(Return(kDefs));
+  StartAndSimulateLogd(kValidBinaryEvents);
+
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_TRUE(packets.size() == 2);
+  auto event_packet = packets[0];
+  auto stats_packet = packets[1];
+  EXPECT_EQ(stats_packet.android_log().stats().num_failed(), 1u);
+
+  // The am_pss event is dropped as its format is unknown.
+  ASSERT_EQ(event_packet.android_log().events_size(), 2);
+  const auto& decoded = event_packet.android_log().events();
+  EXPECT_EQ(decoded[1].timestamp(), 1546165328946231844ULL);
+  EXPECT_FALSE(decoded[1].has_tag());
+  EXPECT_EQ(decoded[1].args_size(), 0);
+  EXPECT_EQ(decoded[1].event_format_iid(), 2u);
+  EXPECT_EQ(decoded[1].binary_args(), std::string("\x00\x22\x27\x00\x00", 5));
+
+  const auto& formats =
+      event_packet.interned_data().android_log_event_formats();
+  ASSERT_EQ(formats.size(), 2u);
+  EXPECT_EQ(formats[0].iid(), 1u);
+  EXPECT_EQ(formats[0].str(),
+            "30023 am_kill (User|1|5),(PID|1|5),(Process Name|3),(OomAdj|1|5),"
+            "(Reason|3)");
+  EXPECT_EQ(formats[1].iid(), 2u);
+  EXPECT_EQ(formats[1].str(), "30053 am_uid_stopped (UID|1|5)");
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <queue>
 #include <unordered_map>
 
@@ -38,6 +39,7 @@ namespace {
 constexpr uint32_t kScanIntervalMs = 10000;  // 10s
 constexpr uint32_t kScanDelayMs = 10000;     // 10s
 constexpr uint32_t kScanBatchSize = 15000;
+constexpr uint32_t kMaxScanThreads = 8;
 
 uint32_t OrDefault(uint32_t value, uint32_t def) {
   return value ? value : def;
@@ -135,6 +137,7 @@ InodeFileDataSource::InodeFileDataSource(
   scan_delay_ms_ = OrDefault(cfg.scan_delay_ms(), kScanDelayMs);
   scan_batch_size_ = OrDefault(cfg.scan_batch_size(), kScanBatchSize);
   do_not_scan_ = cfg.do_not_scan();
+  scan_threads_ = std::min(cfg.scan_threads(), kMaxScanThreads);
 }
 
 InodeFileDataSource::~InodeFileDataSource() = default;
@@ -190,6 +193,31 @@ void InodeFileDataSource::AddInodesFromLRUCache(
     PERFETTO_DLOG("%" PRIu64 " inodes found in cache", cache_found_count);
 }
 
+void InodeFileDataSource::AddInodesFromIndex(BlockDeviceID block_device_id,
+                                             std::set<Inode>* inode_numbers) {
+  if (!inode_index_)
+    return;
+  uint64_t index_found_count = 0;
+  std::string path;
+  InodeFileMap_Entry_Type type;
+  for (auto it = inode_numbers->begin(); it != inode_numbers->end();) {
+    Inode inode_number = *it;
+    if (!inode_index_->Lookup(block_device_id, inode_number, &path, &type)) {
+      ++it;
+      continue;
+    }
+    index_found_count++;
+    it = inode_numbers->erase(it);
+    InodeMapValue value(type, {path});
+    FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
+                   value);
+    cache_->Insert(std::make_pair(block_device_id, inode_number),
+                   std::move(value));
+  }
+  if (index_found_count > 0)
+    PERFETTO_DLOG("%" PRIu64 " inodes found in index", index_found_count);
+}
+
 void InodeFileDataSource::Flush(FlushRequestID,
                                 std::function<void()> callback) {
   ResetTracePacket();
@@ -221,6 +249,7 @@ void InodeFileDataSource::OnInodes(
     // paths/type
     AddInodesFromStaticMap(block_device_id, &inode_numbers);
     AddInodesFromLRUCache(block_device_id, &inode_numbers);
+    AddInodesFromIndex(block_device_id, &inode_numbers);
 
     if (do_not_scan_)
       inode_numbers.clear();
@@ -313,6 +342,8 @@ bool InodeFileDataSource::OnInodeFound(BlockDeviceID block_device_id,
     missing_inodes_.erase(it);
 
   RemoveFromNextMissingInodes(block_device_id, inode_number);
+  if (inode_index_)
+    inode_index_->Insert(block_device_id, inode_number, path, inode_type);
 
   std::pair<BlockDeviceID, Inode> key{block_device_id, inode_number};
   auto cur_val = cache_->Get(key);
@@ -342,6 +373,9 @@ void InodeFileDataSource::OnInodeScanDone() {
   // Finalize the accumulated trace packets.
   ResetTracePacket();
   file_scanner_.reset();
+  parallel_file_scanner_.reset();
+  if (inode_index_)
+    inode_index_->Save();
   if (!missing_inodes_.empty()) {
     // At least write mount point mapping for inodes that are not found.
     for (const auto& p : missing_inodes_) {
@@ -392,8 +426,17 @@ void InodeFileDataSource::FindMissingInodes() {
     AddRootsForBlockDevice(p.first, &roots);
 
   PERFETTO_DCHECK(file_scanner_.get() == nullptr);
+  PERFETTO_DCHECK(parallel_file_scanner_.get() == nullptr);
   auto weak_this = GetWeakPtr();
   PERFETTO_DLOG("Starting scan of %s", DbgFmt(roots).c_str());
+  if (scan_threads_ > 0) {
+    // The workers only look for the inodes missing at this point, the ones
+    // seen during the scan are left for the next one.
+    parallel_file_scanner_.reset(new ParallelFileScanner(
+        std::move(roots), missing_inodes_, this, scan_threads_));
+    parallel_file_scanner_->Scan(task_runner_);
+    return;
+  }
   file_scanner_ = std::unique_ptr<FileScanner>(new FileScanner(
       std::move(roots), this, scan_interval_ms_, scan_batch_size_));
 
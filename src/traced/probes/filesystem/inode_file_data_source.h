@@ -34,7 +34,9 @@
 #include "perfetto/tracing/core/data_source_config.h"
 #include "src/traced/probes/filesystem/file_scanner.h"
 #include "src/traced/probes/filesystem/fs_mount.h"
+#include "src/traced/probes/filesystem/inode_index.h"
 #include "src/traced/probes/filesystem/lru_inode_cache.h"
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
 #include "src/traced/probes/probes_data_source.h"
 
 #include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
@@ -68,6 +70,9 @@ class InodeFileDataSource : public ProbesDataSource,
 
   base::WeakPtr<InodeFileDataSource> GetWeakPtr() const;
 
+  // Optional, shared by the data sources of all sessions.
+  void set_inode_index(InodeIndex* inode_index) { inode_index_ = inode_index; }
+
   // Called when Inodes are seen in the FtraceEventBundle
   void OnInodes(const base::FlatSet<InodeBlockPair>& inodes);
 
@@ -79,6 +84,11 @@ class InodeFileDataSource : public ProbesDataSource,
   void AddInodesFromLRUCache(BlockDeviceID block_device_id,
                              std::set<Inode>* inode_numbers);
 
+  // Search in the persistent InodeIndex and add inodes to InodeFileMap if
+  // found
+  void AddInodesFromIndex(BlockDeviceID block_device_id,
+                          std::set<Inode>* inode_numbers);
+
   virtual void FillInodeEntry(InodeFileMap* destination,
                               Inode inode_number,
                               const InodeMapValue& inode_map_value);
@@ -114,6 +124,7 @@ class InodeFileDataSource : public ProbesDataSource,
   std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>*
       static_file_map_;
   LRUInodeCache* cache_;
+  InodeIndex* inode_index_ = nullptr;
   std::unique_ptr<TraceWriter> writer_;
   std::map<BlockDeviceID, std::set<Inode>> missing_inodes_;
   std::map<BlockDeviceID, std::set<Inode>> next_missing_inodes_;
@@ -127,7 +138,9 @@ class InodeFileDataSource : public ProbesDataSource,
   uint32_t scan_interval_ms_ = 0;
   uint32_t scan_delay_ms_ = 0;
   uint32_t scan_batch_size_ = 0;
+  uint32_t scan_threads_ = 0;
   std::unique_ptr<FileScanner> file_scanner_;
+  std::unique_ptr<ParallelFileScanner> parallel_file_scanner_;
   base::WeakPtrFactory<InodeFileDataSource> weak_factory_;  // Keep last.
 };
 
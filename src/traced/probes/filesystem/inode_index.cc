@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/inode_index.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+
+namespace perfetto {
+
+namespace {
+
+// Bump the version when changing the layout of the records.
+constexpr char kMagic[8] = {'P', 'F', 'I', 'N', 'O', 'D', 'E', '1'};
+
+// The records are written in the host byte order, the file is never moved
+// across machines:
+// [u64 block_device_id][u64 inode][i32 type][u32 path_size][path].
+struct RecordHeader {
+  uint64_t block_device_id;
+  uint64_t inode;
+  int32_t type;
+  uint32_t path_size;
+};
+
+}  // namespace
+
+constexpr size_t InodeIndex::kDefaultMaxEntries;
+
+InodeIndex::InodeIndex(std::string file_path, size_t max_entries)
+    : file_path_(std::move(file_path)), max_entries_(max_entries) {}
+
+InodeIndex::~InodeIndex() = default;
+
+bool InodeIndex::Load() {
+  entries_.clear();
+  keys_by_path_.clear();
+  dirty_ = false;
+  std::string data;
+  if (!base::ReadFile(file_path_, &data))
+    return false;
+  if (data.size() < sizeof(kMagic) ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    PERFETTO_ELOG("Ignoring malformed inode index %s", file_path_.c_str());
+    return false;
+  }
+  size_t offset = sizeof(kMagic);
+  while (offset < data.size()) {
+    RecordHeader hdr;
+    if (data.size() - offset < sizeof(hdr)) {
+      entries_.clear();
+      keys_by_path_.clear();
+      return false;
+    }
+    memcpy(&hdr, data.data() + offset, sizeof(hdr));
+    offset += sizeof(hdr);
+    if (data.size() - offset < hdr.path_size) {
+      entries_.clear();
+      keys_by_path_.clear();
+      return false;
+    }
+    if (entries_.size() < max_entries_) {
+      Key key(static_cast<BlockDeviceID>(hdr.block_device_id),
+              static_cast<Inode>(hdr.inode));
+      std::string path = data.substr(offset, hdr.path_size);
+      // Saved indexes have at most one entry per path.
+      if (keys_by_path_.emplace(path, key).second)
+        entries_[key] = Value(hdr.type, std::move(path));
+    }
+    offset += hdr.path_size;
+  }
+  PERFETTO_DLOG("Loaded %zu entries from inode index %s", entries_.size(),
+                file_path_.c_str());
+  return true;
+}
+
+bool InodeIndex::Save() {
+  if (!dirty_)
+    return true;
+  std::string data(kMagic, sizeof(kMagic));
+  for (const auto& entry : entries_) {
+    const std::string& path = entry.second.second;
+    RecordHeader hdr{};
+    hdr.block_device_id = static_cast<uint64_t>(entry.first.first);
+    hdr.inode = static_cast<uint64_t>(entry.first.second);
+    hdr.type = entry.second.first;
+    hdr.path_size = static_cast<uint32_t>(path.size());
+    data.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    data.append(path);
+  }
+
+  // Write to a temporary file and rename it, so that a crash never leaves a
+  // truncated index behind.
+  std::string tmp_path = file_path_ + ".tmp";
+  {
+    base::ScopedFile fd = base::OpenFile(
+        tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (!fd || base::WriteAll(*fd, data.data(), data.size()) !=
+                   static_cast<ssize_t>(data.size())) {
+      PERFETTO_PLOG("Failed to write inode index %s", tmp_path.c_str());
+      return false;
+    }
+  }
+  if (rename(tmp_path.c_str(), file_path_.c_str()) != 0) {
+    PERFETTO_PLOG("Failed to rename inode index to %s", file_path_.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  dirty_ = false;
+  return true;
+}
+
+bool InodeIndex::Lookup(BlockDeviceID block_device_id,
+                        Inode inode,
+                        std::string* path,
+                        InodeFileMap_Entry_Type* type) {
+  auto it = entries_.find(Key(block_device_id, inode));
+  if (it == entries_.end())
+    return false;
+  // The file might have been deleted or replaced since it was indexed, and
+  // its inode reused.
+  struct stat buf;
+  if (lstat(it->second.second.c_str(), &buf) != 0 || buf.st_ino != inode ||
+      buf.st_dev != block_device_id) {
+    Erase(it);
+    return false;
+  }
+  *type = it->second.first;
+  *path = it->second.second;
+  return true;
+}
+
+void InodeIndex::Insert(BlockDeviceID block_device_id,
+                        Inode inode,
+                        const std::string& path,
+                        InodeFileMap_Entry_Type type) {
+  Key key(block_device_id, inode);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    if (it->second.first == type && it->second.second == path)
+      return;
+    Erase(it);
+  }
+  // The path now refers to |inode|, its previous inode is stale.
+  ErasePath(path);
+  if (entries_.size() >= max_entries_) {
+    // Bounded by the number of entries rather than by recency: the index is
+    // a best effort, a missing inode only costs a scan.
+    Erase(entries_.begin());
+  }
+  entries_[key] = Value(type, path);
+  keys_by_path_[path] = key;
+  dirty_ = true;
+}
+
+void InodeIndex::ErasePath(const std::string& path) {
+  auto it = keys_by_path_.find(path);
+  if (it != keys_by_path_.end())
+    Erase(entries_.find(it->second));
+}
+
+std::vector<std::string> InodeIndex::GetDirectories(
+    size_t max_directories) const {
+  std::map<std::string, size_t> entries_by_directory;
+  for (const auto& p : keys_by_path_) {
+    size_t slash = p.first.rfind('/');
+    if (slash != std::string::npos)
+      entries_by_directory[p.first.substr(0, std::max<size_t>(slash, 1))]++;
+  }
+  std::vector<std::pair<size_t, std::string>> directories;
+  directories.reserve(entries_by_directory.size());
+  for (const auto& p : entries_by_directory)
+    directories.emplace_back(p.second, p.first);
+  std::stable_sort(directories.begin(), directories.end(),
+                   [](const std::pair<size_t, std::string>& a,
+                      const std::pair<size_t, std::string>& b) {
+                     return a.first > b.first;
+                   });
+  std::vector<std::string> res;
+  for (size_t i = 0; i < directories.size() && i < max_directories; ++i)
+    res.emplace_back(std::move(directories[i].second));
+  return res;
+}
+
+void InodeIndex::Erase(std::map<Key, Value>::iterator it) {
+  keys_by_path_.erase(it->second.second);
+  entries_.erase(it);
+  dirty_ = true;
+}
+
+}  // namespace perfetto
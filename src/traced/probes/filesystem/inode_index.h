@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_INODE_INDEX_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_INODE_INDEX_H_
+
+#include <stddef.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/ext/traced/data_source_types.h"
+
+namespace perfetto {
+
+// A map from inodes to paths, persisted in a file, so that the inodes
+// resolved by a filesystem scan don't need another one in the following
+// tracing sessions, or after a restart of traced_probes.
+// The entries are validated on lookup by checking that the path still refers
+// to the same inode: a stale entry is dropped and its inode scanned for again.
+class InodeIndex {
+ public:
+  static constexpr size_t kDefaultMaxEntries = 100000;
+
+  explicit InodeIndex(std::string file_path,
+                      size_t max_entries = kDefaultMaxEntries);
+  ~InodeIndex();
+
+  // Replaces the entries with the ones of the index file. Returns false if
+  // the file doesn't exist or is malformed, leaving the index empty.
+  bool Load();
+
+  // Writes the index file, if the entries changed since the last Load() or
+  // Save(). The file is replaced atomically.
+  bool Save();
+
+  // Returns true and fills |path| and |type| if |inode| is indexed and its
+  // path still refers to it.
+  bool Lookup(BlockDeviceID block_device_id,
+              Inode inode,
+              std::string* path,
+              InodeFileMap_Entry_Type* type);
+
+  void Insert(BlockDeviceID block_device_id,
+              Inode inode,
+              const std::string& path,
+              InodeFileMap_Entry_Type type);
+
+  // Drops the entry of |path|, if any. Used to apply the changes of the
+  // filesystem without waiting for the entry to be found stale on lookup.
+  void ErasePath(const std::string& path);
+
+  // Returns the directories containing the indexed paths, the ones with the
+  // most entries first, up to |max_directories|.
+  std::vector<std::string> GetDirectories(size_t max_directories) const;
+
+  size_t size() const { return entries_.size(); }
+  bool dirty() const { return dirty_; }
+
+ private:
+  using Key = std::pair<BlockDeviceID, Inode>;
+  using Value = std::pair<InodeFileMap_Entry_Type, std::string>;
+
+  void Erase(std::map<Key, Value>::iterator it);
+
+  const std::string file_path_;
+  const size_t max_entries_;
+  std::map<Key, Value> entries_;
+  // The key of the entry of each path, at most one per path.
+  std::map<std::string, Key> keys_by_path_;
+  bool dirty_ = false;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_INODE_INDEX_H_
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/inode_index.h"
+
+#include <sys/stat.h>
+
+#include <string>
+
+#include "perfetto/base/logging.h"
+#include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+constexpr InodeFileMap_Entry_Type kFile =
+    protos::pbzero::InodeFileMap_Entry_Type_FILE;
+
+struct stat CheckStat(const std::string& path) {
+  struct stat buf;
+  PERFETTO_CHECK(lstat(path.c_str(), &buf) != -1);
+  return buf;
+}
+
+TEST(InodeIndexTest, SaveAndLoad) {
+  base::TmpDirTree tree;
+  tree.AddFile("a", "");
+  tree.AddFile("b", "");
+  // Tracked by |tree|, so that it's deleted at the end of the test.
+  tree.AddFile("index", "");
+  struct stat a = CheckStat(tree.AbsolutePath("a"));
+  struct stat b = CheckStat(tree.AbsolutePath("b"));
+
+  {
+    InodeIndex index(tree.AbsolutePath("index"));
+    index.Insert(a.st_dev, a.st_ino, tree.AbsolutePath("a"), kFile);
+    index.Insert(b.st_dev, b.st_ino, tree.AbsolutePath("b"), kFile);
+    ASSERT_TRUE(index.Save());
+  }
+
+  InodeIndex index(tree.AbsolutePath("index"));
+  ASSERT_TRUE(index.Load());
+  EXPECT_EQ(index.size(), 2u);
+  std::string path;
+  InodeFileMap_Entry_Type type = 0;
+  ASSERT_TRUE(index.Lookup(a.st_dev, a.st_ino, &path, &type));
+  EXPECT_EQ(path, tree.AbsolutePath("a"));
+  EXPECT_EQ(type, kFile);
+  ASSERT_TRUE(index.Lookup(b.st_dev, b.st_ino, &path, &type));
+  EXPECT_EQ(path, tree.AbsolutePath("b"));
+  EXPECT_FALSE(index.Lookup(a.st_dev, a.st_ino + b.st_ino, &path, &type));
+}
+
+TEST(InodeIndexTest, DropStaleEntries) {
+  base::TmpDirTree tree;
+  tree.AddFile("a", "");
+  struct stat a = CheckStat(tree.AbsolutePath("a"));
+
+  InodeIndex index(tree.AbsolutePath("index"));
+  // The path now refers to another inode.
+  index.Insert(a.st_dev, a.st_ino + 1, tree.AbsolutePath("a"), kFile);
+  // The path doesn't exist anymore.
+  index.Insert(a.st_dev, a.st_ino + 2, tree.AbsolutePath("deleted"), kFile);
+  ASSERT_EQ(index.size(), 2u);
+
+  std::string path;
+  InodeFileMap_Entry_Type type = 0;
+  EXPECT_FALSE(index.Lookup(a.st_dev, a.st_ino + 1, &path, &type));
+  EXPECT_FALSE(index.Lookup(a.st_dev, a.st_ino + 2, &path, &type));
+  EXPECT_EQ(index.size(), 0u);
+}
+
+TEST(InodeIndexTest, BoundedSize) {
+  InodeIndex index("/nonexistent", /*max_entries=*/2);
+  index.Insert(1, 1, "/1", kFile);
+  index.Insert(1, 2, "/2", kFile);
+  index.Insert(1, 3, "/3", kFile);
+  EXPECT_EQ(index.size(), 2u);
+}
+
+TEST(InodeIndexTest, IgnoreMalformedFile) {
+  base::TmpDirTree tree;
+  tree.AddFile("index", "not an index");
+  InodeIndex index(tree.AbsolutePath("index"));
+  EXPECT_FALSE(index.Load());
+  EXPECT_EQ(index.size(), 0u);
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/inode_index_watcher.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/utils.h"
+#include "src/traced/probes/filesystem/inode_index.h"
+
+#include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
+
+namespace perfetto {
+
+namespace {
+
+// Large enough for several events with the longest file names.
+constexpr size_t kBufSize = 16 * 1024;
+
+// Don't hold the task runner for too long when many files change at once,
+// e.g. while installing an app: read the remaining events in another task.
+constexpr size_t kMaxReadsPerTask = 16;
+
+constexpr uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_MOVE_SELF | IN_ONLYDIR;
+
+}  // namespace
+
+constexpr size_t InodeIndexWatcher::kDefaultMaxWatches;
+constexpr uint32_t InodeIndexWatcher::kSaveDelayMs;
+
+// static
+std::unique_ptr<InodeIndexWatcher> InodeIndexWatcher::Create(
+    base::TaskRunner* task_runner,
+    InodeIndex* index,
+    size_t max_watches) {
+  base::ScopedFile inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+  if (!inotify_fd) {
+    PERFETTO_PLOG("Failed to initialize inotify for the inode index");
+    return nullptr;
+  }
+  return std::unique_ptr<InodeIndexWatcher>(new InodeIndexWatcher(
+      task_runner, index, max_watches, std::move(inotify_fd)));
+}
+
+InodeIndexWatcher::InodeIndexWatcher(base::TaskRunner* task_runner,
+                                     InodeIndex* index,
+                                     size_t max_watches,
+                                     base::ScopedFile inotify_fd)
+    : task_runner_(task_runner),
+      index_(index),
+      max_watches_(max_watches),
+      inotify_fd_(std::move(inotify_fd)),
+      buf_(base::PagedMemory::Allocate(kBufSize)),
+      weak_factory_(this) {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->AddFileDescriptorWatch(*inotify_fd_, [weak_this] {
+    if (weak_this)
+      weak_this->OnEventsAvailable();
+  });
+}
+
+InodeIndexWatcher::~InodeIndexWatcher() {
+  task_runner_->RemoveFileDescriptorWatch(*inotify_fd_);
+}
+
+void InodeIndexWatcher::WatchIndexedDirectories() {
+  if (directories_by_wd_.size() >= max_watches_)
+    return;
+  for (std::string& dir : index_->GetDirectories(max_watches_)) {
+    if (directories_by_wd_.size() >= max_watches_)
+      break;
+    // Don't retry the directories which couldn't be watched, e.g. because of
+    // missing permissions.
+    if (!watched_directories_.insert(dir).second)
+      continue;
+    int wd = inotify_add_watch(*inotify_fd_, dir.c_str(), kWatchMask);
+    if (wd < 0) {
+      PERFETTO_DPLOG("Failed to watch %s", dir.c_str());
+      continue;
+    }
+    // The same directory might be reachable through several paths.
+    directories_by_wd_.emplace(wd, std::move(dir));
+  }
+  PERFETTO_DLOG("Watching %zu directories of the inode index",
+                directories_by_wd_.size());
+}
+
+void InodeIndexWatcher::OnEventsAvailable() {
+  char* buf = static_cast<char*>(buf_.Get());
+  for (size_t i = 0; i < kMaxReadsPerTask; i++) {
+    ssize_t rsize = PERFETTO_EINTR(read(*inotify_fd_, buf, kBufSize));
+    if (rsize <= 0) {
+      if (rsize < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        PERFETTO_PLOG("Failed to read the inode index events");
+      break;
+    }
+    const auto size = static_cast<size_t>(rsize);
+    size_t offset = 0;
+    while (size - offset >= sizeof(struct inotify_event)) {
+      struct inotify_event event;
+      memcpy(&event, buf + offset, sizeof(event));
+      const char* name = buf + offset + sizeof(event);
+      offset += sizeof(event) + event.len;
+      if (offset > size)
+        break;
+      // The name is null-padded, if any.
+      OnEvent(event.wd, event.mask, event.len ? name : "");
+    }
+  }
+  // The fd watch fires again if there are events left.
+
+  if (index_->dirty() && !save_pending_) {
+    save_pending_ = true;
+    auto weak_this = weak_factory_.GetWeakPtr();
+    task_runner_->PostDelayedTask(
+        [weak_this] {
+          if (weak_this)
+            weak_this->SaveIndex();
+        },
+        kSaveDelayMs);
+  }
+}
+
+void InodeIndexWatcher::OnEvent(int wd, uint32_t mask, const char* name) {
+  if (mask & IN_Q_OVERFLOW) {
+    // The stale entries are still dropped on lookup.
+    PERFETTO_ELOG("Inode index events lost");
+    return;
+  }
+  auto it = directories_by_wd_.find(wd);
+  if (it == directories_by_wd_.end())
+    return;
+  if (mask & IN_IGNORED) {
+    // The directory was deleted or is not watched anymore. Watch it again in
+    // case it's created again.
+    watched_directories_.erase(it->second);
+    directories_by_wd_.erase(it);
+    return;
+  }
+  if (mask & IN_MOVE_SELF) {
+    // The paths of its entries are not known anymore. This is followed by an
+    // IN_IGNORED event.
+    inotify_rm_watch(*inotify_fd_, wd);
+    return;
+  }
+  if (!*name)
+    return;
+
+  const std::string& dir = it->second;
+  std::string path = dir == "/" ? dir + name : dir + "/" + name;
+  if (mask & (IN_DELETE | IN_MOVED_FROM))
+    index_->ErasePath(path);
+  if (mask & (IN_CREATE | IN_MOVED_TO)) {
+    struct stat buf;
+    if (lstat(path.c_str(), &buf) != 0)
+      return;
+    InodeFileMap_Entry_Type type =
+        protos::pbzero::InodeFileMap_Entry_Type_UNKNOWN;
+    if (S_ISDIR(buf.st_mode)) {
+      type = protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY;
+    } else if (S_ISREG(buf.st_mode)) {
+      type = protos::pbzero::InodeFileMap_Entry_Type_FILE;
+    }
+    index_->Insert(buf.st_dev, buf.st_ino, path, type);
+  }
+}
+
+void InodeIndexWatcher::SaveIndex() {
+  save_pending_ = false;
+  index_->Save();
+}
+
+}  // namespace perfetto
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_INODE_INDEX_WATCHER_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_INODE_INDEX_WATCHER_H_
+
+#include <stddef.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/weak_ptr.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}
+
+class InodeIndex;
+
+// Keeps an InodeIndex up to date between tracing sessions with the inotify
+// events of the directories of its entries: the files created in or moved
+// into them are indexed before they show up in a trace, and the deleted or
+// moved away ones are dropped. This way the sessions of devices which are
+// traced periodically rarely need a filesystem scan to resolve the inodes.
+// The changes are saved to the index file shortly after they happen.
+class InodeIndexWatcher {
+ public:
+  static constexpr size_t kDefaultMaxWatches = 1024;
+  static constexpr uint32_t kSaveDelayMs = 10000;
+
+  // Returns nullptr if inotify isn't available.
+  static std::unique_ptr<InodeIndexWatcher> Create(
+      base::TaskRunner*,
+      InodeIndex*,
+      size_t max_watches = kDefaultMaxWatches);
+
+  ~InodeIndexWatcher();
+
+  // Watches the directories of the entries of the index, the ones with the
+  // most entries first, up to the max number of watches. Called again to
+  // watch the directories of the entries added since.
+  void WatchIndexedDirectories();
+
+  size_t num_watches() const { return directories_by_wd_.size(); }
+
+  // Reads and applies the pending events. Public for testing.
+  void OnEventsAvailable();
+
+ private:
+  InodeIndexWatcher(base::TaskRunner*,
+                    InodeIndex*,
+                    size_t max_watches,
+                    base::ScopedFile inotify_fd);
+  InodeIndexWatcher(const InodeIndexWatcher&) = delete;
+  InodeIndexWatcher& operator=(const InodeIndexWatcher&) = delete;
+
+  void OnEvent(int wd, uint32_t mask, const char* name);
+  void SaveIndex();
+
+  base::TaskRunner* const task_runner_;
+  InodeIndex* const index_;
+  const size_t max_watches_;
+  base::ScopedFile inotify_fd_;
+  base::PagedMemory buf_;
+  std::map<int, std::string> directories_by_wd_;
+  std::set<std::string> watched_directories_;
+  bool save_pending_ = false;
+
+  base::WeakPtrFactory<InodeIndexWatcher> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_INODE_INDEX_WATCHER_H_
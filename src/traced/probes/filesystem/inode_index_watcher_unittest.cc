@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/inode_index_watcher.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "src/traced/probes/filesystem/inode_index.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+constexpr InodeFileMap_Entry_Type kFile =
+    protos::pbzero::InodeFileMap_Entry_Type_FILE;
+
+struct stat CheckStat(const std::string& path) {
+  struct stat buf;
+  PERFETTO_CHECK(lstat(path.c_str(), &buf) != -1);
+  return buf;
+}
+
+TEST(InodeIndexWatcherTest, ApplyChanges) {
+  base::TmpDirTree tree;
+  tree.AddDir("dir");
+  tree.AddFile("dir/a", "");
+  struct stat a = CheckStat(tree.AbsolutePath("dir/a"));
+
+  base::TestTaskRunner task_runner;
+  InodeIndex index(tree.AbsolutePath("index"));
+  index.Insert(a.st_dev, a.st_ino, tree.AbsolutePath("dir/a"), kFile);
+  std::unique_ptr<InodeIndexWatcher> watcher =
+      InodeIndexWatcher::Create(&task_runner, &index);
+  ASSERT_TRUE(watcher);
+  watcher->WatchIndexedDirectories();
+  EXPECT_EQ(watcher->num_watches(), 1u);
+
+  std::string path;
+  InodeFileMap_Entry_Type type = 0;
+
+  // Created files are indexed before they are looked up.
+  tree.AddFile("dir/b", "");
+  watcher->OnEventsAvailable();
+  struct stat b = CheckStat(tree.AbsolutePath("dir/b"));
+  ASSERT_TRUE(index.Lookup(b.st_dev, b.st_ino, &path, &type));
+  EXPECT_EQ(path, tree.AbsolutePath("dir/b"));
+  EXPECT_EQ(type, kFile);
+
+  // Moved files keep their inode.
+  ASSERT_EQ(rename(tree.AbsolutePath("dir/a").c_str(),
+                   tree.AbsolutePath("dir/c").c_str()),
+            0);
+  watcher->OnEventsAvailable();
+  ASSERT_TRUE(index.Lookup(a.st_dev, a.st_ino, &path, &type));
+  EXPECT_EQ(path, tree.AbsolutePath("dir/c"));
+  ASSERT_EQ(rename(tree.AbsolutePath("dir/c").c_str(),
+                   tree.AbsolutePath("dir/a").c_str()),
+            0);
+  watcher->OnEventsAvailable();
+
+  // Deleted files are dropped.
+  std::string d_path = tree.AbsolutePath("dir/d");
+  base::ScopedFile fd(base::OpenFile(d_path, O_WRONLY | O_CREAT, 0600));
+  ASSERT_TRUE(fd);
+  fd.reset();
+  watcher->OnEventsAvailable();
+  EXPECT_EQ(index.size(), 3u);
+  ASSERT_EQ(unlink(d_path.c_str()), 0);
+  watcher->OnEventsAvailable();
+  EXPECT_EQ(index.size(), 2u);
+}
+
+TEST(InodeIndexWatcherTest, MaxWatches) {
+  base::TmpDirTree tree;
+  tree.AddDir("x");
+  tree.AddDir("y");
+  tree.AddFile("x/1", "");
+  tree.AddFile("y/1", "");
+  tree.AddFile("y/2", "");
+
+  base::TestTaskRunner task_runner;
+  InodeIndex index(tree.AbsolutePath("index"));
+  for (const char* file : {"x/1", "y/1", "y/2"}) {
+    struct stat buf = CheckStat(tree.AbsolutePath(file));
+    index.Insert(buf.st_dev, buf.st_ino, tree.AbsolutePath(file), kFile);
+  }
+  EXPECT_EQ(index.GetDirectories(1),
+            std::vector<std::string>{tree.AbsolutePath("y")});
+
+  std::unique_ptr<InodeIndexWatcher> watcher =
+      InodeIndexWatcher::Create(&task_runner, &index, /*max_watches=*/1);
+  ASSERT_TRUE(watcher);
+  watcher->WatchIndexedDirectories();
+  EXPECT_EQ(watcher->num_watches(), 1u);
+
+  // Only the directory with the most entries is watched.
+  tree.AddFile("x/2", "");
+  watcher->OnEventsAvailable();
+  EXPECT_EQ(index.size(), 3u);
+  tree.AddFile("y/3", "");
+  watcher->OnEventsAvailable();
+  EXPECT_EQ(index.size(), 4u);
+}
+
+}  // namespace
+}  // namespace perfetto
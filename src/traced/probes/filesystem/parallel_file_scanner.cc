@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <mutex>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
+
+namespace perfetto {
+
+struct ParallelFileScanner::SharedState {
+  const WantedInodes wanted_inodes;
+  // Set by Scan(), constant afterwards.
+  std::vector<base::TaskRunner*> workers;
+  base::TaskRunner* task_runner = nullptr;
+  base::WeakPtr<ParallelFileScanner> scanner;
+
+  std::mutex mutex;
+  // The directories left to scan, shared by all the workers. Guarded by
+  // |mutex|, as all the fields below.
+  std::vector<std::string> queue;
+  // Whether each worker is waiting to be woken up by new directories.
+  std::vector<bool> idle;
+  size_t num_active = 0;
+  bool stopped = false;
+
+  explicit SharedState(WantedInodes wanted) : wanted_inodes(std::move(wanted)) {}
+};
+
+namespace {
+
+std::string JoinPaths(const std::string& one, const std::string& other) {
+  std::string result;
+  result.reserve(one.size() + other.size() + 1);
+  result += one;
+  if (!result.empty() && result.back() != '/')
+    result += '/';
+  result += other;
+  return result;
+}
+
+}  // namespace
+
+ParallelFileScanner::ParallelFileScanner(
+    std::vector<std::string> root_directories,
+    WantedInodes wanted_inodes,
+    FileScanner::Delegate* delegate,
+    uint32_t num_threads)
+    : delegate_(delegate),
+      state_(new SharedState(std::move(wanted_inodes))),
+      weak_factory_(this) {
+  state_->queue = std::move(root_directories);
+  for (uint32_t i = 0; i < std::max(num_threads, 1u); i++)
+    workers_.emplace_back(base::ThreadTaskRunner::CreateAndStart("inode_scan"));
+}
+
+ParallelFileScanner::~ParallelFileScanner() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stopped = true;
+  }
+  // Joins the threads, once they notice |stopped|.
+  workers_.clear();
+}
+
+void ParallelFileScanner::Scan(base::TaskRunner* task_runner) {
+  state_->task_runner = task_runner;
+  state_->scanner = weak_factory_.GetWeakPtr();
+  for (const auto& worker : workers_)
+    state_->workers.push_back(worker.get());
+
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->idle.assign(workers_.size(), false);
+  state_->num_active = workers_.size();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    std::shared_ptr<SharedState> state = state_;
+    workers_[i].PostTask([state, i] { Work(state, i); });
+  }
+}
+
+// static
+void ParallelFileScanner::Work(std::shared_ptr<SharedState> state,
+                               size_t worker) {
+  for (;;) {
+    std::string directory;
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->stopped || state->queue.empty()) {
+        state->idle[worker] = true;
+        if (--state->num_active == 0) {
+          auto scanner = state->scanner;
+          state->task_runner->PostTask([scanner] {
+            if (scanner)
+              scanner->OnScanDone();
+          });
+        }
+        return;
+      }
+      directory = std::move(state->queue.back());
+      state->queue.pop_back();
+    }
+
+    base::ScopedDir dir(opendir(directory.c_str()));
+    if (!dir) {
+      PERFETTO_DPLOG("opendir %s", directory.c_str());
+      continue;
+    }
+    struct stat buf;
+    if (fstat(dirfd(dir.get()), &buf) != 0) {
+      PERFETTO_DPLOG("fstat %s", directory.c_str());
+      continue;
+    }
+    const BlockDeviceID block_device_id = buf.st_dev;
+    auto wanted_it = state->wanted_inodes.find(block_device_id);
+    const std::set<Inode>* wanted = wanted_it == state->wanted_inodes.end()
+                                        ? nullptr
+                                        : &wanted_it->second;
+
+    std::vector<std::string> subdirectories;
+    std::vector<FoundInode> found;
+    while (struct dirent* entry = readdir(dir.get())) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+      InodeFileMap_Entry_Type type =
+          protos::pbzero::InodeFileMap_Entry_Type_UNKNOWN;
+      if (entry->d_type == DT_DIR) {
+        subdirectories.push_back(JoinPaths(directory, entry->d_name));
+        type = protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY;
+      } else if (entry->d_type == DT_REG) {
+        type = protos::pbzero::InodeFileMap_Entry_Type_FILE;
+      }
+      if (wanted && wanted->count(entry->d_ino)) {
+        found.push_back(FoundInode{block_device_id, entry->d_ino,
+                                   JoinPaths(directory, entry->d_name), type});
+      }
+    }
+
+    if (!found.empty()) {
+      auto scanner = state->scanner;
+      // Moved into a shared_ptr, as std::function needs copyable closures.
+      auto found_ptr =
+          std::make_shared<std::vector<FoundInode>>(std::move(found));
+      state->task_runner->PostTask([scanner, found_ptr] {
+        if (scanner)
+          scanner->OnInodesFound(std::move(*found_ptr));
+      });
+    }
+    if (subdirectories.empty())
+      continue;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->stopped)
+      continue;
+    size_t num_to_wake = subdirectories.size();
+    for (auto& subdirectory : subdirectories)
+      state->queue.push_back(std::move(subdirectory));
+    for (size_t i = 0; i < state->idle.size() && num_to_wake > 0; i++) {
+      if (!state->idle[i])
+        continue;
+      state->idle[i] = false;
+      state->num_active++;
+      num_to_wake--;
+      state->workers[i]->PostTask([state, i] { Work(state, i); });
+    }
+  }
+}
+
+void ParallelFileScanner::OnInodesFound(std::vector<FoundInode> found) {
+  for (const FoundInode& inode : found) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->stopped)
+        return;
+    }
+    if (!delegate_->OnInodeFound(inode.block_device_id, inode.inode,
+                                 inode.path, inode.type)) {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->stopped = true;
+      return;
+    }
+  }
+}
+
+void ParallelFileScanner::OnScanDone() {
+  // Might destroy |this|.
+  delegate_->OnInodeScanDone();
+}
+
+}  // namespace perfetto
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
+#define SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/weak_ptr.h"
+#include "perfetto/ext/traced/data_source_types.h"
+#include "src/traced/probes/filesystem/file_scanner.h"
+
+namespace perfetto {
+
+// Like FileScanner, but walks the directories on worker threads rather than
+// in batches on the main thread. The workers only report the inodes in
+// |wanted_inodes|, so that the main thread isn't flooded with the whole
+// filesystem: the delegate is called on |task_runner| as they are found.
+class ParallelFileScanner {
+ public:
+  using WantedInodes = std::map<BlockDeviceID, std::set<Inode>>;
+
+  ParallelFileScanner(std::vector<std::string> root_directories,
+                      WantedInodes wanted_inodes,
+                      FileScanner::Delegate* delegate,
+                      uint32_t num_threads);
+
+  // Stops the scan, if still running, and joins the workers.
+  ~ParallelFileScanner();
+
+  ParallelFileScanner(const ParallelFileScanner&) = delete;
+  ParallelFileScanner& operator=(const ParallelFileScanner&) = delete;
+
+  void Scan(base::TaskRunner* task_runner);
+
+ private:
+  struct FoundInode {
+    BlockDeviceID block_device_id;
+    Inode inode;
+    std::string path;
+    InodeFileMap_Entry_Type type;
+  };
+  struct SharedState;
+
+  static void Work(std::shared_ptr<SharedState>, size_t worker);
+  void OnInodesFound(std::vector<FoundInode>);
+  void OnScanDone();
+
+  FileScanner::Delegate* const delegate_;
+  std::shared_ptr<SharedState> state_;
+  std::vector<base::ThreadTaskRunner> workers_;
+  base::WeakPtrFactory<ParallelFileScanner> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FILESYSTEM_PARALLEL_FILE_SCANNER_H_
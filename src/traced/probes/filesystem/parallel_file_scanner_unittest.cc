@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/filesystem/parallel_file_scanner.h"
+
+#include <sys/stat.h>
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/base/test/utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::UnorderedElementsAre;
+
+using FoundInode = std::tuple<Inode, std::string, InodeFileMap_Entry_Type>;
+
+class TestDelegate : public FileScanner::Delegate {
+ public:
+  TestDelegate(bool keep_going, std::function<void()> done_callback)
+      : keep_going_(keep_going), done_callback_(std::move(done_callback)) {}
+
+  bool OnInodeFound(BlockDeviceID,
+                    Inode inode,
+                    const std::string& path,
+                    InodeFileMap_Entry_Type type) override {
+    found_.emplace_back(inode, path, type);
+    return keep_going_;
+  }
+
+  void OnInodeScanDone() override { done_callback_(); }
+
+  const std::vector<FoundInode>& found() const { return found_; }
+
+ private:
+  const bool keep_going_;
+  std::function<void()> done_callback_;
+  std::vector<FoundInode> found_;
+};
+
+struct stat CheckStat(const std::string& path) {
+  struct stat buf;
+  PERFETTO_CHECK(lstat(path.c_str(), &buf) != -1);
+  return buf;
+}
+
+std::string TestDataPath(const std::string& path) {
+  return base::GetTestDataPath("src/traced/probes/filesystem/testdata" + path);
+}
+
+TEST(ParallelFileScannerTest, FindWantedInodes) {
+  struct stat dir1 = CheckStat(TestDataPath("/dir1"));
+  struct stat file1 = CheckStat(TestDataPath("/dir1/file1"));
+  ParallelFileScanner::WantedInodes wanted;
+  wanted[dir1.st_dev] = {dir1.st_ino, file1.st_ino};
+
+  base::TestTaskRunner task_runner;
+  TestDelegate delegate(true, task_runner.CreateCheckpoint("done"));
+  ParallelFileScanner scanner({TestDataPath("")}, std::move(wanted), &delegate,
+                              /*num_threads=*/3);
+  scanner.Scan(&task_runner);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(
+      delegate.found(),
+      UnorderedElementsAre(
+          FoundInode(dir1.st_ino, TestDataPath("/dir1"),
+                     protos::pbzero::InodeFileMap_Entry_Type_DIRECTORY),
+          FoundInode(file1.st_ino, TestDataPath("/dir1/file1"),
+                     protos::pbzero::InodeFileMap_Entry_Type_FILE)));
+}
+
+TEST(ParallelFileScannerTest, Stop) {
+  struct stat dir1 = CheckStat(TestDataPath("/dir1"));
+  struct stat file1 = CheckStat(TestDataPath("/dir1/file1"));
+  struct stat file2 = CheckStat(TestDataPath("/file2"));
+  ParallelFileScanner::WantedInodes wanted;
+  wanted[dir1.st_dev] = {dir1.st_ino, file1.st_ino, file2.st_ino};
+
+  base::TestTaskRunner task_runner;
+  TestDelegate delegate(false, task_runner.CreateCheckpoint("done"));
+  ParallelFileScanner scanner({TestDataPath("")}, std::move(wanted), &delegate,
+                              /*num_threads=*/2);
+  scanner.Scan(&task_runner);
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_EQ(delegate.found().size(), 1u);
+}
+
+}  // namespace
+}  // namespace perfetto
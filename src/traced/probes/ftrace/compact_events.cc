@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ftrace/compact_events.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+
+namespace perfetto {
+
+namespace {
+
+using CompactEventsProto = protos::pbzero::FtraceEventBundle::CompactEvents;
+
+}  // namespace
+
+CompactEventsBuffer::EventType::EventType(
+    uint32_t ftrace_event_id,
+    uint32_t event_field_id,
+    const std::vector<Field>& common_fields,
+    const std::vector<Field>& fields)
+    : ftrace_event_id_(ftrace_event_id), event_field_id_(event_field_id) {
+  common_columns_.reserve(common_fields.size());
+  for (const Field& field : common_fields)
+    common_columns_.emplace_back(field.proto_field_id);
+  columns_.reserve(fields.size());
+  for (const Field& field : fields)
+    columns_.emplace_back(field.proto_field_id);
+}
+
+CompactEventsBuffer::CompactEventsBuffer() = default;
+CompactEventsBuffer::~CompactEventsBuffer() = default;
+
+// static
+bool CompactEventsBuffer::IsEventSupported(const Event& event) {
+  return event.proto_field_id !=
+             protos::pbzero::FtraceEvent::kGenericFieldNumber &&
+         event.proto_field_id != protos::pbzero::FtraceEvent::kPrintFieldNumber;
+}
+
+CompactEventsBuffer::EventType* CompactEventsBuffer::GetOrCreateEventType(
+    const Event& event,
+    const std::vector<Field>& common_fields) {
+  if (PERFETTO_LIKELY(last_event_type_ &&
+                      last_event_type_->ftrace_event_id_ ==
+                          event.ftrace_event_id)) {
+    return last_event_type_;
+  }
+  for (const auto& event_type : event_types_) {
+    if (event_type->ftrace_event_id_ == event.ftrace_event_id) {
+      last_event_type_ = event_type.get();
+      return last_event_type_;
+    }
+  }
+  event_types_.emplace_back(new EventType(
+      event.ftrace_event_id, event.proto_field_id, common_fields, event.fields));
+  last_event_type_ = event_types_.back().get();
+  return last_event_type_;
+}
+
+uint32_t CompactEventsBuffer::InternString(base::StringView str) {
+  uint32_t* index = string_indexes_.Find(str);
+  if (index)
+    return *index;
+  auto new_index = static_cast<uint32_t>(interned_strings_.size());
+  interned_strings_.emplace_back(str.data(), str.size());
+  const std::string& stored = interned_strings_.back();
+  string_indexes_.Insert(base::StringView(stored), new_index);
+  return new_index;
+}
+
+// static
+void CompactEventsBuffer::WriteColumn(const Column& column,
+                                      CompactEventsProto::Column* out) {
+  out->set_field_id(column.field_id_);
+  out->AppendBytes(column.is_string_
+                       ? CompactEventsProto::Column::kStringIndexFieldNumber
+                       : CompactEventsProto::Column::kValueFieldNumber,
+                   column.packed_.data(), column.packed_.size());
+}
+
+void CompactEventsBuffer::WriteAndReset(
+    protos::pbzero::FtraceEventBundle* bundle) {
+  if (!event_types_.empty()) {
+    auto* compact_out = bundle->set_compact_events();
+    for (const std::string& str : interned_strings_)
+      compact_out->add_intern_table(str);
+    for (const auto& event_type : event_types_) {
+      auto* type_out = compact_out->add_event_type();
+      type_out->set_event_field_id(event_type->event_field_id_);
+      type_out->AppendBytes(
+          CompactEventsProto::EventType::kTimestampFieldNumber,
+          event_type->timestamp_.packed_.data(),
+          event_type->timestamp_.packed_.size());
+      for (const Column& column : event_type->common_columns_)
+        WriteColumn(column, type_out->add_common_column());
+      for (const Column& column : event_type->columns_)
+        WriteColumn(column, type_out->add_column());
+    }
+  }
+
+  event_types_.clear();
+  last_event_type_ = nullptr;
+  interned_strings_.clear();
+  string_indexes_.Clear();
+}
+
+}  // namespace perfetto
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_FTRACE_COMPACT_EVENTS_H_
+#define SRC_TRACED_PROBES_FTRACE_COMPACT_EVENTS_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "src/traced/probes/ftrace/event_info_constants.h"
+
+namespace perfetto {
+
+// Collects the events encoded in the compact form enabled by
+// FtraceConfig.compact_events, to be written out as
+// FtraceEventBundle.CompactEvents. As CompactSchedBuffer, it stores the events
+// in columns with delta-encoded timestamps and interned strings, but the
+// columns are derived at runtime from the ProtoTranslationTable's description
+// of each event type, rather than hardcoded.
+class CompactEventsBuffer {
+ public:
+  // The values of one field, for all the events of a type.
+  class Column {
+   public:
+    explicit Column(uint32_t field_id) : field_id_(field_id) {}
+
+    // |value| is the varint the field would have in the normal encoding.
+    void AppendValue(uint64_t value) { AppendVarInt(value); }
+    void AppendStringIndex(uint32_t index) {
+      is_string_ = true;
+      AppendVarInt(index);
+    }
+
+   private:
+    friend class CompactEventsBuffer;
+
+    void AppendVarInt(uint64_t value) {
+      uint8_t buf[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+      uint8_t* end = protozero::proto_utils::WriteVarInt(value, buf);
+      packed_.insert(packed_.end(), buf, end);
+    }
+
+    const uint32_t field_id_;
+    bool is_string_ = false;
+    std::vector<uint8_t> packed_;
+  };
+
+  // The columns of an event type. The caller must append exactly one value to
+  // each column for every timestamp.
+  class EventType {
+   public:
+    EventType(uint32_t ftrace_event_id,
+              uint32_t event_field_id,
+              const std::vector<Field>& common_fields,
+              const std::vector<Field>& fields);
+
+    void AppendTimestamp(uint64_t timestamp) {
+      timestamp_.AppendValue(timestamp - last_timestamp_);
+      last_timestamp_ = timestamp;
+    }
+
+    Column* common_column(size_t i) { return &common_columns_[i]; }
+    Column* column(size_t i) { return &columns_[i]; }
+
+   private:
+    friend class CompactEventsBuffer;
+
+    const uint32_t ftrace_event_id_;
+    const uint32_t event_field_id_;
+    uint64_t last_timestamp_ = 0;
+    Column timestamp_{0};
+    std::vector<Column> common_columns_;
+    std::vector<Column> columns_;
+  };
+
+  CompactEventsBuffer();
+  ~CompactEventsBuffer();
+
+  // Returns true if the events of this type can be written in the compact
+  // form. This excludes the events not known at build time (which are written
+  // as GenericFtraceEvent, with the name of their fields) and print events
+  // (whose strings are rarely repeated, hence not worth interning).
+  static bool IsEventSupported(const Event& event);
+
+  // Returns the columns of |event|, creating them the first time the type is
+  // seen since the last WriteAndReset().
+  EventType* GetOrCreateEventType(const Event& event,
+                                  const std::vector<Field>& common_fields);
+
+  uint32_t InternString(base::StringView str);
+  size_t interned_strings_size() const { return interned_strings_.size(); }
+
+  // Writes out the currently buffered events, and starts the next batch
+  // internally.
+  void WriteAndReset(protos::pbzero::FtraceEventBundle* bundle);
+
+ private:
+  static void WriteColumn(
+      const Column& column,
+      protos::pbzero::FtraceEventBundle_CompactEvents_Column* out);
+
+  // In order of first occurrence in the batch. Usually a handful of types,
+  // with the same ones repeating: the last one looked up is checked first.
+  std::vector<std::unique_ptr<EventType>> event_types_;
+  EventType* last_event_type_ = nullptr;
+
+  // The keys point into |interned_strings_|, a deque so that they stay valid
+  // as it grows.
+  std::deque<std::string> interned_strings_;
+  base::FlatHashMap<base::StringView, uint32_t> string_indexes_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_FTRACE_COMPACT_EVENTS_H_
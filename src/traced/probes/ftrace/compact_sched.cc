@@ -279,6 +279,8 @@ void CompactSchedBuffer::WriteAndReset(
   interner_.Reset();
   switch_.Reset();
   waking_.Reset();
+
+  events_.WriteAndReset(bundle);
 }
 
 }  // namespace perfetto
@@ -27,6 +27,7 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/metatrace.h"
 #include "perfetto/ext/base/optional.h"
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "src/kallsyms/kernel_symbol_map.h"
@@ -52,6 +53,10 @@ namespace {
 // TODO(rsavitski): consider making part of compact_sched config.
 constexpr size_t kCompactSchedInternerThreshold = 64;
 
+// Same as above, for the strings of the events encoded as compact_events. The
+// threshold is higher as the strings of all the event types share the table.
+constexpr size_t kCompactEventsInternerThreshold = 256;
+
 // For further documentation of these constants see the kernel source:
 // linux/include/linux/ring_buffer.h
 // Some information about the values of these constants are exposed to user
@@ -130,6 +135,188 @@ static int64_t ReadSignedFtraceValue(const uint8_t* ptr,
   PERFETTO_FATAL("unexpected ftrace type");
 }
 
+// The CpuReader::FieldParser of each translation strategy, see
+// CpuReader::GetFieldParser(). The caller guarantees that the field fits in
+// the range, as for CpuReader::ParseField().
+template <typename T>
+bool ParseVarIntField(const Field& field,
+                      const uint8_t* start,
+                      const uint8_t*,
+                      const ProtoTranslationTable*,
+                      protozero::Message* message,
+                      FtraceMetadata*) {
+  CpuReader::ReadIntoVarInt<T>(start + field.ftrace_offset,
+                               field.proto_field_id, message);
+  return true;
+}
+
+bool ParseFixedCStringField(const Field& field,
+                            const uint8_t* start,
+                            const uint8_t*,
+                            const ProtoTranslationTable*,
+                            protozero::Message* message,
+                            FtraceMetadata*) {
+  // TODO(hjd): Add AppendMaxLength string to protozero.
+  const uint8_t* field_start = start + field.ftrace_offset;
+  return ReadIntoString(field_start, field_start + field.ftrace_size,
+                        field.proto_field_id, message);
+}
+
+bool ParseCStringField(const Field& field,
+                       const uint8_t* start,
+                       const uint8_t* end,
+                       const ProtoTranslationTable*,
+                       protozero::Message* message,
+                       FtraceMetadata*) {
+  // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
+  return ReadIntoString(start + field.ftrace_offset, end, field.proto_field_id,
+                        message);
+}
+
+bool ParseStringPtrField(const Field& field,
+                         const uint8_t* start,
+                         const uint8_t*,
+                         const ProtoTranslationTable* table,
+                         protozero::Message* message,
+                         FtraceMetadata*) {
+  uint64_t n = 0;
+  // The ftrace field may be 8 or 4 bytes and we need to copy it into the
+  // bottom of n. In the unlikely case where the field is >8 bytes we
+  // should avoid making things worse by corrupting the stack but we
+  // don't need to handle it correctly.
+  size_t size = std::min<size_t>(field.ftrace_size, sizeof(n));
+  memcpy(base::AssumeLittleEndian(&n),
+         reinterpret_cast<const void*>(start + field.ftrace_offset), size);
+  // Look up the adddress in the printk format map and write it into the
+  // proto.
+  base::StringView name = table->LookupTraceString(n);
+  message->AppendBytes(field.proto_field_id, name.begin(), name.size());
+  return true;
+}
+
+bool ParseDataLocField(const Field& field,
+                       const uint8_t* start,
+                       const uint8_t* end,
+                       const ProtoTranslationTable*,
+                       protozero::Message* message,
+                       FtraceMetadata*) {
+  return ReadDataLoc(start, start + field.ftrace_offset, end, field, message);
+}
+
+template <typename T>
+bool ParseInodeField(const Field& field,
+                     const uint8_t* start,
+                     const uint8_t*,
+                     const ProtoTranslationTable*,
+                     protozero::Message* message,
+                     FtraceMetadata* metadata) {
+  CpuReader::ReadInode<T>(start + field.ftrace_offset, field.proto_field_id,
+                          message, metadata);
+  return true;
+}
+
+bool ParsePidField(const Field& field,
+                   const uint8_t* start,
+                   const uint8_t*,
+                   const ProtoTranslationTable*,
+                   protozero::Message* message,
+                   FtraceMetadata* metadata) {
+  CpuReader::ReadPid(start + field.ftrace_offset, field.proto_field_id,
+                     message, metadata);
+  return true;
+}
+
+bool ParseCommonPidField(const Field& field,
+                         const uint8_t* start,
+                         const uint8_t*,
+                         const ProtoTranslationTable*,
+                         protozero::Message* message,
+                         FtraceMetadata* metadata) {
+  CpuReader::ReadCommonPid(start + field.ftrace_offset, field.proto_field_id,
+                           message, metadata);
+  return true;
+}
+
+template <typename T>
+bool ParseDevIdField(const Field& field,
+                     const uint8_t* start,
+                     const uint8_t*,
+                     const ProtoTranslationTable*,
+                     protozero::Message* message,
+                     FtraceMetadata* metadata) {
+  CpuReader::ReadDevId<T>(start + field.ftrace_offset, field.proto_field_id,
+                          message, metadata);
+  return true;
+}
+
+template <typename T>
+bool ParseSymbolAddrField(const Field& field,
+                          const uint8_t* start,
+                          const uint8_t*,
+                          const ProtoTranslationTable*,
+                          protozero::Message* message,
+                          FtraceMetadata* metadata) {
+  CpuReader::ReadSymbolAddr<T>(start + field.ftrace_offset,
+                               field.proto_field_id, message, metadata);
+  return true;
+}
+
+using RawField = protos::pbzero::FtraceEventBundle_RawPageFormat_Field;
+
+// Returns how TraceProcessor should decode a field of a raw page, or
+// TYPE_UNSPECIFIED if it can't be decoded offline.
+RawField::Type GetRawFieldType(TranslationStrategy strategy) {
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+    case kUint64ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+    case kInode32ToUint64:
+    case kInode64ToUint64:
+      return RawField::TYPE_UINT;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+    case kInt64ToInt64:
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      return RawField::TYPE_INT;
+    case kFixedCStringToString:
+      return RawField::TYPE_FIXED_STRING;
+    case kCStringToString:
+      return RawField::TYPE_CSTRING;
+    case kDataLocToString:
+      return RawField::TYPE_DATA_LOC_STRING;
+    case kDevId32ToUint64:
+    case kDevId64ToUint64:
+      return RawField::TYPE_DEV_ID;
+    case kStringPtrToString:
+    case kFtraceSymAddr64ToUint64:
+    case kInvalidTranslationStrategy:
+      // These need the printk formats or the kernel symbols of the device.
+      break;
+  }
+  return RawField::TYPE_UNSPECIFIED;
+}
+
+void WriteRawField(const Field& field, RawField::Type type, RawField* out) {
+  out->set_name(field.ftrace_name);
+  out->set_proto_field_id(field.proto_field_id);
+  out->set_offset(field.ftrace_offset);
+  out->set_size(field.ftrace_size);
+  out->set_type(type);
+}
+
 bool SetBlocking(int fd, bool is_blocking) {
   int flags = fcntl(fd, F_GETFL, 0);
   flags = (is_blocking) ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
@@ -159,6 +346,20 @@ size_t CpuReader::ReadCycle(
     size_t parsing_buf_size_pages,
     size_t max_pages,
     const std::set<FtraceDataSource*>& started_data_sources) {
+  std::vector<DataSourceSink> sinks;
+  sinks.reserve(started_data_sources.size());
+  for (FtraceDataSource* data_source : started_data_sources) {
+    sinks.push_back(DataSourceSink{data_source->trace_writer(),
+                                   data_source->mutable_metadata(),
+                                   data_source->parsing_config()});
+  }
+  return ReadCycle(parsing_buf, parsing_buf_size_pages, max_pages, sinks);
+}
+
+size_t CpuReader::ReadCycle(uint8_t* parsing_buf,
+                            size_t parsing_buf_size_pages,
+                            size_t max_pages,
+                            const std::vector<DataSourceSink>& sinks) {
   PERFETTO_DCHECK(max_pages > 0 && parsing_buf_size_pages > 0);
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_CPU_READ_CYCLE);
@@ -167,8 +368,8 @@ size_t CpuReader::ReadCycle(
   size_t batch_pages = std::min(parsing_buf_size_pages, max_pages);
   size_t total_pages_read = 0;
   for (bool is_first_batch = true;; is_first_batch = false) {
-    size_t pages_read = ReadAndProcessBatch(
-        parsing_buf, batch_pages, is_first_batch, started_data_sources);
+    size_t pages_read =
+        ReadAndProcessBatch(parsing_buf, batch_pages, is_first_batch, sinks);
 
     PERFETTO_DCHECK(pages_read <= batch_pages);
     total_pages_read += pages_read;
@@ -194,7 +395,7 @@ size_t CpuReader::ReadAndProcessBatch(
     uint8_t* parsing_buf,
     size_t max_pages,
     bool first_batch_in_cycle,
-    const std::set<FtraceDataSource*>& started_data_sources) {
+    const std::vector<DataSourceSink>& sinks) {
   size_t pages_read = 0;
   {
     metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
@@ -267,11 +468,16 @@ size_t CpuReader::ReadAndProcessBatch(
   if (pages_read == 0)
     return pages_read;
 
-  for (FtraceDataSource* data_source : started_data_sources) {
-    bool pages_parsed_ok = ProcessPagesForDataSource(
-        data_source->trace_writer(), data_source->mutable_metadata(), cpu_,
-        data_source->parsing_config(), parsing_buf, pages_read, table_,
-        symbolizer_, ftrace_clock_);
+  for (const DataSourceSink& sink : sinks) {
+    bool pages_parsed_ok;
+    if (sink.parsing_config->raw_page_passthrough) {
+      pages_parsed_ok = WriteRawPages(sink.trace_writer, cpu_, parsing_buf,
+                                      pages_read, table_, ftrace_clock_);
+    } else {
+      pages_parsed_ok = ProcessPagesForDataSource(
+          sink.trace_writer, sink.metadata, cpu_, sink.parsing_config,
+          parsing_buf, pages_read, table_, symbolizer_, ftrace_clock_);
+    }
     // If this CHECK fires, it means that we did not know how to parse the
     // kernel binary format. This is a bug in either perfetto or the kernel, and
     // must be investigated. Hence we CHECK instead of recording a bit
@@ -297,6 +503,7 @@ bool CpuReader::ProcessPagesForDataSource(
   // the compact option isn't enabled).
   CompactSchedBuffer compact_sched;
   bool compact_sched_enabled = ds_config->compact_sched.enabled;
+  bool compact_events_enabled = ds_config->compact_events;
 
   TraceWriter::TracePacketHandle packet;
   protos::pbzero::FtraceEventBundle* bundle = nullptr;
@@ -304,15 +511,17 @@ bool CpuReader::ProcessPagesForDataSource(
   // This function is called after the contents of a FtraceBundle are written.
   auto finalize_cur_packet = [&] {
     PERFETTO_DCHECK(packet);
-    if (compact_sched_enabled)
+    if (compact_sched_enabled || compact_events_enabled)
       compact_sched.WriteAndReset(bundle);
 
     bundle->Finalize();
     bundle = nullptr;
 
     // Write the kernel symbol index (mangled address) -> name table.
-    // |metadata| is shared across all cpus, is distinct per |data_source| (i.e.
-    // tracing session) and is cleared after each FtraceController::ReadTick().
+    // |metadata| is shared across all cpus (of the same reader thread, if
+    // any), is distinct per |data_source| (i.e. tracing session) and is
+    // cleared after each FtraceController::ReadTick() (or read cycle of the
+    // reader thread).
     if (ds_config->symbolize_ksyms) {
       // Symbol indexes are assigned mononically as |kernel_addrs.size()|,
       // starting from index 1 (no symbol has index 0). Here we remember the
@@ -322,11 +531,23 @@ bool CpuReader::ProcessPagesForDataSource(
       PERFETTO_DCHECK(max_index_at_start <= metadata->kernel_addrs.size());
       protos::pbzero::InternedData* interned_data = nullptr;
       auto* ksyms_map = symbolizer->GetOrCreateKernelSymbolMap();
-      bool wrote_at_least_one_symbol = false;
+
+      // |kernel_addrs| is sorted by address, so the new ones can be looked up
+      // in a single pass over the symbol table.
+      std::vector<uint64_t> addrs;
+      std::vector<uint32_t> indexes;
       for (const FtraceMetadata::KernelAddr& kaddr : metadata->kernel_addrs) {
         if (kaddr.index <= max_index_at_start)
           continue;
-        std::string sym_name = ksyms_map->Lookup(kaddr.addr);
+        addrs.push_back(kaddr.addr);
+        indexes.push_back(kaddr.index);
+      }
+      KernelSymbolMap::SymbolNames sym_names;
+      ksyms_map->LookupSorted(addrs.data(), addrs.size(), &sym_names);
+
+      bool wrote_at_least_one_symbol = false;
+      for (size_t i = 0; i < addrs.size(); i++) {
+        base::StringView sym_name = sym_names.at(i);
         if (sym_name.empty()) {
           // Lookup failed. This can genuinely happen in many occasions. E.g.,
           // workqueue_execute_start has two pointers: one is a pointer to a
@@ -349,8 +570,8 @@ bool CpuReader::ProcessPagesForDataSource(
           interned_data = packet->set_interned_data();
         }
         auto* interned_sym = interned_data->add_kernel_symbols();
-        interned_sym->set_iid(kaddr.index);
-        interned_sym->set_str(sym_name);
+        interned_sym->set_iid(indexes[i]);
+        interned_sym->set_str(sym_name.data(), sym_name.size());
         wrote_at_least_one_symbol = true;
       }
 
@@ -358,7 +579,7 @@ bool CpuReader::ProcessPagesForDataSource(
 
       // Rationale for the if (wrote_at_least_one_symbol) check: in rare cases,
       // all symbols seen in a ProcessPagesForDataSource() call can fail the
-      // ksyms_map->Lookup(). If that happens we don't want to bump the
+      // ksyms_map->LookupSorted(). If that happens we don't want to bump the
       // last_kernel_addr_index_written watermark, as that would cause the next
       // call to NOT emit the SEQ_INCREMENTAL_STATE_CLEARED.
       if (wrote_at_least_one_symbol)
@@ -403,13 +624,16 @@ bool CpuReader::ProcessPagesForDataSource(
     // * The page we're about to read indicates that there was a kernel ring
     //   buffer overrun since our last read from that per-cpu buffer. We have
     //   a single |lost_events| field per bundle, so start a new packet.
-    // * The compact_sched buffer is holding more unique interned strings than
-    //   a threshold. We need to flush the compact buffer to make the
-    //   interning lookups cheap again.
+    // * The compact_sched (or compact_events) buffer is holding more unique
+    //   interned strings than a threshold. We need to flush the compact
+    //   buffer to make the interning lookups cheap again.
     bool interner_past_threshold =
-        compact_sched_enabled &&
-        compact_sched.interner().interned_comms_size() >
-            kCompactSchedInternerThreshold;
+        (compact_sched_enabled &&
+         compact_sched.interner().interned_comms_size() >
+             kCompactSchedInternerThreshold) ||
+        (compact_events_enabled &&
+         compact_sched.events().interned_strings_size() >
+             kCompactEventsInternerThreshold);
 
     if (page_header->lost_events || interner_past_threshold)
       start_new_packet(page_header->lost_events);
@@ -428,6 +652,64 @@ bool CpuReader::ProcessPagesForDataSource(
   return pages_parsed_ok;
 }
 
+// static
+bool CpuReader::WriteRawPages(TraceWriter* trace_writer,
+                              size_t cpu,
+                              const uint8_t* parsing_buf,
+                              const size_t pages_read,
+                              const ProtoTranslationTable* table,
+                              protos::pbzero::FtraceClock ftrace_clock) {
+  auto packet = trace_writer->NewTracePacket();
+  auto* bundle = packet->set_ftrace_events();
+  if (ftrace_clock)
+    bundle->set_ftrace_clock(ftrace_clock);
+  bundle->set_cpu(static_cast<uint32_t>(cpu));
+
+  // The lost events flag of each page is kept in its header, TraceProcessor
+  // decodes it from there.
+  for (size_t i = 0; i < pages_read; i++) {
+    const uint8_t* curr_page = parsing_buf + (i * base::kPageSize);
+    const uint8_t* parse_pos = curr_page;
+    base::Optional<PageHeader> page_header =
+        ParsePageHeader(&parse_pos, table->page_header_size_len());
+    size_t header_size = static_cast<size_t>(parse_pos - curr_page);
+    if (!page_header.has_value() ||
+        header_size + page_header->size > base::kPageSize) {
+      PERFETTO_DFATAL("invalid page header");
+      return false;
+    }
+    bundle->add_raw_page(curr_page, header_size + page_header->size);
+  }
+  return true;
+}
+
+// static
+void CpuReader::WriteRawPageFormat(
+    const ProtoTranslationTable* table,
+    const FtraceDataSourceConfig* ds_config,
+    protos::pbzero::FtraceEventBundle_RawPageFormat* out) {
+  out->set_page_header_size_len(table->page_header_size_len());
+  for (const Field& field : table->common_fields()) {
+    RawField::Type type = GetRawFieldType(field.strategy);
+    if (type != RawField::TYPE_UNSPECIFIED)
+      WriteRawField(field, type, out->add_common_field());
+  }
+  for (size_t id : ds_config->event_filter.GetEnabledEvents()) {
+    const Event* event = table->GetEventById(id);
+    if (!event)
+      continue;
+    auto* out_event = out->add_event();
+    out_event->set_ftrace_event_id(event->ftrace_event_id);
+    out_event->set_name(event->name);
+    out_event->set_proto_field_id(event->proto_field_id);
+    for (const Field& field : event->fields) {
+      RawField::Type type = GetRawFieldType(field.strategy);
+      if (type != RawField::TYPE_UNSPECIFIED)
+        WriteRawField(field, type, out_event->add_field());
+    }
+  }
+}
+
 // A page header consists of:
 // * timestamp: 8 bytes
 // * commit: 8 bytes on 64 bit, 4 bytes on 32 bit kernels
@@ -597,12 +879,28 @@ size_t CpuReader::ParsePagePayload(const uint8_t* start_of_payload,
             ParseSchedWakingCompact(start, timestamp, &sched_waking_format,
                                     compact_sched_buffer, metadata);
 
+            // columnar encoding of the other events
+          } else if (ds_config->compact_events &&
+                     CompactEventsBuffer::IsEventSupported(
+                         *table->GetEventById(ftrace_event_id))) {
+            if (!ParseEventCompact(ftrace_event_id, start, next, timestamp,
+                                   table, &compact_sched_buffer->events(),
+                                   metadata))
+              return 0;
+
           } else {
             // Common case: parse all other types of enabled events.
             protos::pbzero::FtraceEvent* event = bundle->add_event();
             event->set_timestamp(timestamp);
-            if (!ParseEvent(ftrace_event_id, start, next, table, event,
-                            metadata))
+            const CompiledEvent* compiled =
+                ds_config->compiled_events.Get(ftrace_event_id);
+            bool parsed =
+                compiled ? ParseCompiledEvent(ds_config->compiled_events,
+                                              *compiled, start, next, table,
+                                              event, metadata)
+                         : ParseEvent(ftrace_event_id, start, next, table,
+                                      event, metadata);
+            if (!parsed)
               return 0;
           }
         }
@@ -688,90 +986,308 @@ bool CpuReader::ParseField(const Field& field,
                            protozero::Message* message,
                            FtraceMetadata* metadata) {
   PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
+  return GetFieldParser(field.strategy)(field, start, end, table, message,
+                                        metadata);
+}
+
+// static
+CpuReader::FieldParser CpuReader::GetFieldParser(
+    TranslationStrategy strategy) {
+  switch (strategy) {
+    case kUint8ToUint32:
+    case kUint8ToUint64:
+    case kBoolToUint32:
+    case kBoolToUint64:
+      return &ParseVarIntField<uint8_t>;
+    case kUint16ToUint32:
+    case kUint16ToUint64:
+      return &ParseVarIntField<uint16_t>;
+    case kUint32ToUint32:
+    case kUint32ToUint64:
+      return &ParseVarIntField<uint32_t>;
+    case kUint64ToUint64:
+      return &ParseVarIntField<uint64_t>;
+    case kInt8ToInt32:
+    case kInt8ToInt64:
+      return &ParseVarIntField<int8_t>;
+    case kInt16ToInt32:
+    case kInt16ToInt64:
+      return &ParseVarIntField<int16_t>;
+    case kInt32ToInt32:
+    case kInt32ToInt64:
+      return &ParseVarIntField<int32_t>;
+    case kInt64ToInt64:
+      return &ParseVarIntField<int64_t>;
+    case kFixedCStringToString:
+      return &ParseFixedCStringField;
+    case kCStringToString:
+      return &ParseCStringField;
+    case kStringPtrToString:
+      return &ParseStringPtrField;
+    case kDataLocToString:
+      return &ParseDataLocField;
+    case kInode32ToUint64:
+      return &ParseInodeField<uint32_t>;
+    case kInode64ToUint64:
+      return &ParseInodeField<uint64_t>;
+    case kPid32ToInt32:
+    case kPid32ToInt64:
+      return &ParsePidField;
+    case kCommonPid32ToInt32:
+    case kCommonPid32ToInt64:
+      return &ParseCommonPidField;
+    case kDevId32ToUint64:
+      return &ParseDevIdField<uint32_t>;
+    case kDevId64ToUint64:
+      return &ParseDevIdField<uint64_t>;
+    case kFtraceSymAddr64ToUint64:
+      return &ParseSymbolAddrField<uint64_t>;
+    case kInvalidTranslationStrategy:
+      break;
+  }
+  PERFETTO_FATAL("Unexpected translation strategy");
+}
+
+// static
+CpuReader::CompiledEvents CpuReader::CompileEvents(
+    const ProtoTranslationTable* table,
+    const EventFilter& filter) {
+  auto compile_field = [](const Field& field) {
+    return CompiledField{GetFieldParser(field.strategy), field};
+  };
+
+  CompiledEvents compiled;
+  for (const Field& field : table->common_fields())
+    compiled.common_fields.push_back(compile_field(field));
+  for (size_t id : filter.GetEnabledEvents()) {
+    const Event* event = table->GetEventById(id);
+    if (!event || !event->proto_field_id ||
+        event->proto_field_id ==
+            protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+      continue;
+    }
+    if (id >= compiled.events.size())
+      compiled.events.resize(id + 1);
+    CompiledEvent& compiled_event = compiled.events[id];
+    compiled_event.proto_field_id = event->proto_field_id;
+    compiled_event.size = event->size;
+    for (const Field& field : event->fields)
+      compiled_event.fields.push_back(compile_field(field));
+  }
+  return compiled;
+}
+
+// static
+bool CpuReader::ParseCompiledEvent(const CompiledEvents& compiled_events,
+                                   const CompiledEvent& event,
+                                   const uint8_t* start,
+                                   const uint8_t* end,
+                                   const ProtoTranslationTable* table,
+                                   protozero::Message* message,
+                                   FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(start < end);
+  if (event.size > static_cast<size_t>(end - start)) {
+    PERFETTO_DFATAL("Buffer overflowed.");
+    return false;
+  }
+
+  bool success = true;
+  for (const CompiledField& field : compiled_events.common_fields)
+    success &= field.parse(field.field, start, end, table, message, metadata);
+
+  protozero::Message* nested =
+      message->BeginNestedMessage<protozero::Message>(event.proto_field_id);
+  for (const CompiledField& field : event.fields)
+    success &= field.parse(field.field, start, end, table, nested, metadata);
+
+  // See ParseEvent().
+  if (PERFETTO_UNLIKELY(event.proto_field_id ==
+                        protos::pbzero::FtraceEvent::kTaskRenameFieldNumber)) {
+    PERFETTO_DCHECK(metadata->last_seen_common_pid);
+    metadata->AddRenamePid(metadata->last_seen_common_pid);
+  }
+
+  message->Finalize();
+  metadata->FinishEvent();
+  return success;
+}
+
+// Same as ParseEvent(), but appends the fields to the columns of the event's
+// type in |compact_buf| rather than writing them as a proto.
+bool CpuReader::ParseEventCompact(uint16_t ftrace_event_id,
+                                  const uint8_t* start,
+                                  const uint8_t* end,
+                                  uint64_t timestamp,
+                                  const ProtoTranslationTable* table,
+                                  CompactEventsBuffer* compact_buf,
+                                  FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(start < end);
+  const size_t length = static_cast<size_t>(end - start);
+  const Event& info = *table->GetEventById(ftrace_event_id);
+  if (info.size > length) {
+    PERFETTO_DFATAL("Buffer overflowed.");
+    return false;
+  }
+
+  const std::vector<Field>& common_fields = table->common_fields();
+  CompactEventsBuffer::EventType* event_type =
+      compact_buf->GetOrCreateEventType(info, common_fields);
+  event_type->AppendTimestamp(timestamp);
+
+  bool success = true;
+  for (size_t i = 0; i < common_fields.size(); i++) {
+    success &= ParseFieldCompact(common_fields[i], start, end, table,
+                                 compact_buf, event_type->common_column(i),
+                                 metadata);
+  }
+  for (size_t i = 0; i < info.fields.size(); i++) {
+    success &= ParseFieldCompact(info.fields[i], start, end, table,
+                                 compact_buf, event_type->column(i), metadata);
+  }
+
+  if (PERFETTO_UNLIKELY(info.proto_field_id ==
+                        protos::pbzero::FtraceEvent::kTaskRenameFieldNumber)) {
+    PERFETTO_DCHECK(metadata->last_seen_common_pid);
+    metadata->AddRenamePid(metadata->last_seen_common_pid);
+  }
+
+  metadata->FinishEvent();
+  return success;
+}
+
+// Same as ParseField(), but appends the value to |column|. Exactly one value
+// is appended even on failure (an empty string, for the strings which can't
+// be read), to keep the columns of the event type aligned.
+bool CpuReader::ParseFieldCompact(const Field& field,
+                                  const uint8_t* start,
+                                  const uint8_t* end,
+                                  const ProtoTranslationTable* table,
+                                  CompactEventsBuffer* compact_buf,
+                                  CompactEventsBuffer::Column* column,
+                                  FtraceMetadata* metadata) {
+  PERFETTO_DCHECK(start + field.ftrace_offset + field.ftrace_size <= end);
   const uint8_t* field_start = start + field.ftrace_offset;
-  uint32_t field_id = field.proto_field_id;
 
+  // Appends the string in [str_start, str_end), up to its terminator.
+  auto append_string = [compact_buf, column](const uint8_t* str_start,
+                                             const uint8_t* str_end) {
+    const void* terminator = memchr(str_start, '\0',
+                                    static_cast<size_t>(str_end - str_start));
+    if (!terminator) {
+      column->AppendStringIndex(compact_buf->InternString(base::StringView()));
+      return false;
+    }
+    base::StringView str(
+        reinterpret_cast<const char*>(str_start),
+        static_cast<size_t>(static_cast<const uint8_t*>(terminator) -
+                            str_start));
+    column->AppendStringIndex(compact_buf->InternString(str));
+    return true;
+  };
+
+  // Signed values are sign extended, as protozero does for int32 and int64.
   switch (field.strategy) {
     case kUint8ToUint32:
     case kUint8ToUint64:
-      ReadIntoVarInt<uint8_t>(field_start, field_id, message);
+    case kBoolToUint32:
+    case kBoolToUint64:
+      column->AppendValue(ReadValue<uint8_t>(field_start));
       return true;
     case kUint16ToUint32:
     case kUint16ToUint64:
-      ReadIntoVarInt<uint16_t>(field_start, field_id, message);
+      column->AppendValue(ReadValue<uint16_t>(field_start));
       return true;
     case kUint32ToUint32:
     case kUint32ToUint64:
-      ReadIntoVarInt<uint32_t>(field_start, field_id, message);
+      column->AppendValue(ReadValue<uint32_t>(field_start));
       return true;
     case kUint64ToUint64:
-      ReadIntoVarInt<uint64_t>(field_start, field_id, message);
+      column->AppendValue(ReadValue<uint64_t>(field_start));
       return true;
     case kInt8ToInt32:
     case kInt8ToInt64:
-      ReadIntoVarInt<int8_t>(field_start, field_id, message);
+      column->AppendValue(static_cast<uint64_t>(ReadValue<int8_t>(field_start)));
       return true;
     case kInt16ToInt32:
     case kInt16ToInt64:
-      ReadIntoVarInt<int16_t>(field_start, field_id, message);
+      column->AppendValue(
+          static_cast<uint64_t>(ReadValue<int16_t>(field_start)));
       return true;
     case kInt32ToInt32:
     case kInt32ToInt64:
-      ReadIntoVarInt<int32_t>(field_start, field_id, message);
+      column->AppendValue(
+          static_cast<uint64_t>(ReadValue<int32_t>(field_start)));
       return true;
     case kInt64ToInt64:
-      ReadIntoVarInt<int64_t>(field_start, field_id, message);
+      column->AppendValue(
+          static_cast<uint64_t>(ReadValue<int64_t>(field_start)));
       return true;
     case kFixedCStringToString:
-      // TODO(hjd): Add AppendMaxLength string to protozero.
-      return ReadIntoString(field_start, field_start + field.ftrace_size,
-                            field_id, message);
+      return append_string(field_start, field_start + field.ftrace_size);
     case kCStringToString:
-      // TODO(hjd): Kernel-dive to check this how size:0 char fields work.
-      return ReadIntoString(field_start, end, field_id, message);
+      return append_string(field_start, end);
     case kStringPtrToString: {
       uint64_t n = 0;
-      // The ftrace field may be 8 or 4 bytes and we need to copy it into the
-      // bottom of n. In the unlikely case where the field is >8 bytes we
-      // should avoid making things worse by corrupting the stack but we
-      // don't need to handle it correctly.
       size_t size = std::min<size_t>(field.ftrace_size, sizeof(n));
       memcpy(base::AssumeLittleEndian(&n),
              reinterpret_cast<const void*>(field_start), size);
-      // Look up the adddress in the printk format map and write it into the
-      // proto.
-      base::StringView name = table->LookupTraceString(n);
-      message->AppendBytes(field_id, name.begin(), name.size());
+      column->AppendStringIndex(
+          compact_buf->InternString(table->LookupTraceString(n)));
       return true;
     }
-    case kDataLocToString:
-      return ReadDataLoc(start, field_start, end, field, message);
-    case kBoolToUint32:
-    case kBoolToUint64:
-      ReadIntoVarInt<uint8_t>(field_start, field_id, message);
+    case kDataLocToString: {
+      // See ReadDataLoc().
+      const uint32_t data = ReadValue<uint32_t>(field_start);
+      const uint8_t* const string_start = start + (data & 0xffff);
+      const uint8_t* const string_end = string_start + ((data >> 16) & 0xffff);
+      if (string_start <= start || string_end > end) {
+        PERFETTO_DFATAL("Buffer overflowed.");
+        column->AppendStringIndex(
+            compact_buf->InternString(base::StringView()));
+        return false;
+      }
+      // As ParseField(), a missing terminator only drops the value.
+      append_string(string_start, string_end);
       return true;
+    }
     case kInode32ToUint64:
-      ReadInode<uint32_t>(field_start, field_id, message, metadata);
-      return true;
-    case kInode64ToUint64:
-      ReadInode<uint64_t>(field_start, field_id, message, metadata);
+    case kInode64ToUint64: {
+      uint64_t inode = field.strategy == kInode32ToUint64
+                           ? ReadValue<uint32_t>(field_start)
+                           : ReadValue<uint64_t>(field_start);
+      column->AppendValue(inode);
+      metadata->AddInode(static_cast<Inode>(inode));
       return true;
+    }
     case kPid32ToInt32:
     case kPid32ToInt64:
-      ReadPid(field_start, field_id, message, metadata);
-      return true;
     case kCommonPid32ToInt32:
-    case kCommonPid32ToInt64:
-      ReadCommonPid(field_start, field_id, message, metadata);
+    case kCommonPid32ToInt64: {
+      int32_t pid = ReadValue<int32_t>(field_start);
+      column->AppendValue(static_cast<uint64_t>(pid));
+      if (field.strategy == kCommonPid32ToInt32 ||
+          field.strategy == kCommonPid32ToInt64) {
+        metadata->AddCommonPid(pid);
+      } else {
+        metadata->AddPid(pid);
+      }
       return true;
+    }
     case kDevId32ToUint64:
-      ReadDevId<uint32_t>(field_start, field_id, message, metadata);
-      return true;
-    case kDevId64ToUint64:
-      ReadDevId<uint64_t>(field_start, field_id, message, metadata);
+    case kDevId64ToUint64: {
+      BlockDeviceID dev_id =
+          field.strategy == kDevId32ToUint64
+              ? TranslateBlockDeviceIDToUserspace<uint32_t>(
+                    ReadValue<uint32_t>(field_start))
+              : TranslateBlockDeviceIDToUserspace<uint64_t>(
+                    ReadValue<uint64_t>(field_start));
+      column->AppendValue(dev_id);
+      metadata->AddDevice(dev_id);
       return true;
+    }
     case kFtraceSymAddr64ToUint64:
-      ReadSymbolAddr<uint64_t>(field_start, field_id, message, metadata);
+      column->AppendValue(
+          metadata->AddSymbolAddr(ReadValue<uint64_t>(field_start)));
       return true;
     case kInvalidTranslationStrategy:
       break;
@@ -25,6 +25,7 @@
 #include <memory>
 #include <set>
 #include <thread>
+#include <vector>
 
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/paged_memory.h"
@@ -35,6 +36,7 @@
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/message_handle.h"
+#include "src/traced/probes/ftrace/compact_events.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
 #include "src/traced/probes/ftrace/proto_translation_table.h"
@@ -49,6 +51,7 @@ struct FtraceDataSourceConfig;
 namespace protos {
 namespace pbzero {
 class FtraceEventBundle;
+class FtraceEventBundle_RawPageFormat;
 enum FtraceClock : int32_t;
 }  // namespace pbzero
 }  // namespace protos
@@ -65,6 +68,54 @@ class CpuReader {
     bool lost_events;
   };
 
+  // Parses one field of an event (see ParseField()), specialized for the
+  // field's translation strategy.
+  using FieldParser = bool (*)(const Field& field,
+                               const uint8_t* start,
+                               const uint8_t* end,
+                               const ProtoTranslationTable* table,
+                               protozero::Message* message,
+                               FtraceMetadata* metadata);
+
+  struct CompiledField {
+    FieldParser parse;
+    Field field;
+  };
+
+  struct CompiledEvent {
+    // 0 if the event isn't compiled.
+    uint32_t proto_field_id = 0;
+    uint16_t size = 0;
+    std::vector<CompiledField> fields;
+  };
+
+  // The field parsers of the events enabled by a data source, resolved once
+  // when the data source is set up (kernel event formats don't change while
+  // tracing) rather than switching on the translation strategy of every field
+  // of every event parsed.
+  struct CompiledEvents {
+    const CompiledEvent* Get(size_t ftrace_event_id) const {
+      if (ftrace_event_id >= events.size() ||
+          !events[ftrace_event_id].proto_field_id) {
+        return nullptr;
+      }
+      return &events[ftrace_event_id];
+    }
+
+    std::vector<CompiledField> common_fields;
+    // Indexed by ftrace event id.
+    std::vector<CompiledEvent> events;
+  };
+
+  // Where the parsed events of a data source go. The data sources themselves
+  // are used when reading on the main thread, the ftrace reader threads have
+  // their own writer and metadata for each data source instead.
+  struct DataSourceSink {
+    TraceWriter* trace_writer;
+    FtraceMetadata* metadata;
+    const FtraceDataSourceConfig* parsing_config;
+  };
+
   CpuReader(size_t cpu,
             const ProtoTranslationTable* table,
             LazyKernelSymbolizer* symbolizer,
@@ -77,6 +128,10 @@ class CpuReader {
                    size_t parsing_buf_size_pages,
                    size_t max_pages,
                    const std::set<FtraceDataSource*>& started_data_sources);
+  size_t ReadCycle(uint8_t* parsing_buf,
+                   size_t parsing_buf_size_pages,
+                   size_t max_pages,
+                   const std::vector<DataSourceSink>& sinks);
 
   template <typename T>
   static bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
@@ -213,6 +268,42 @@ class CpuReader {
                          protozero::Message* message,
                          FtraceMetadata* metadata);
 
+  static FieldParser GetFieldParser(TranslationStrategy strategy);
+
+  // Compiles the events enabled in |filter|. The generic events (i.e. unknown
+  // at build time) are left to ParseEvent(), their field names are written
+  // with every event anyway.
+  static CompiledEvents CompileEvents(const ProtoTranslationTable* table,
+                                      const EventFilter& filter);
+
+  // Same as ParseEvent(), for an event compiled by CompileEvents().
+  static bool ParseCompiledEvent(const CompiledEvents& compiled_events,
+                                 const CompiledEvent& event,
+                                 const uint8_t* start,
+                                 const uint8_t* end,
+                                 const ProtoTranslationTable* table,
+                                 protozero::Message* message,
+                                 FtraceMetadata* metadata);
+
+  // Same as ParseEvent() and ParseField(), for the events encoded as
+  // FtraceEventBundle.CompactEvents: the fields are buffered in the columns of
+  // the event's type in |compact_buf|.
+  static bool ParseEventCompact(uint16_t ftrace_event_id,
+                                const uint8_t* start,
+                                const uint8_t* end,
+                                uint64_t timestamp,
+                                const ProtoTranslationTable* table,
+                                CompactEventsBuffer* compact_buf,
+                                FtraceMetadata* metadata);
+
+  static bool ParseFieldCompact(const Field& field,
+                                const uint8_t* start,
+                                const uint8_t* end,
+                                const ProtoTranslationTable* table,
+                                CompactEventsBuffer* compact_buf,
+                                CompactEventsBuffer::Column* column,
+                                FtraceMetadata* metadata);
+
   // Parse a sched_switch event according to pre-validated format, and buffer
   // the individual fields in the given compact encoding batch.
   static void ParseSchedSwitchCompact(const uint8_t* start,
@@ -243,23 +334,46 @@ class CpuReader {
                                         LazyKernelSymbolizer* symbolizer,
                                         protos::pbzero::FtraceClock);
 
+  // Writes the given range of contiguous tracing pages verbatim, trimmed to
+  // the end of their data. Called by |ReadAndProcessBatch|, instead of
+  // |ProcessPagesForDataSource|, for the data sources with
+  // raw_page_passthrough. Returns false if a page header is invalid.
+  //
+  // public and static for testing
+  static bool WriteRawPages(TraceWriter* trace_writer,
+                            size_t cpu,
+                            const uint8_t* parsing_buf,
+                            const size_t pages_read,
+                            const ProtoTranslationTable* table,
+                            protos::pbzero::FtraceClock);
+
+  // Writes the layout of the common fields and of the events enabled by
+  // |ds_config|, which TraceProcessor needs to decode the raw pages.
+  static void WriteRawPageFormat(
+      const ProtoTranslationTable* table,
+      const FtraceDataSourceConfig* ds_config,
+      protos::pbzero::FtraceEventBundle_RawPageFormat* out);
+
   void set_ftrace_clock(protos::pbzero::FtraceClock clock) {
     ftrace_clock_ = clock;
   }
 
+  // The trace_pipe_raw fd of this cpu, which can be polled for data above
+  // the buffer_percent watermark.
+  int trace_fd() const { return *trace_fd_; }
+
  private:
   CpuReader(const CpuReader&) = delete;
   CpuReader& operator=(const CpuReader&) = delete;
 
   // Reads at most |max_pages| of ftrace data, parses it, and writes it
-  // into |started_data_sources|. Returns number of pages read.
+  // into |sinks|. Returns number of pages read.
   // See comment on ftrace_controller.cc:kMaxParsingWorkingSetPages for
   // rationale behind the batching.
-  size_t ReadAndProcessBatch(
-      uint8_t* parsing_buf,
-      size_t max_pages,
-      bool first_batch_in_cycle,
-      const std::set<FtraceDataSource*>& started_data_sources);
+  size_t ReadAndProcessBatch(uint8_t* parsing_buf,
+                             size_t max_pages,
+                             bool first_batch_in_cycle,
+                             const std::vector<DataSourceSink>& sinks);
 
   const size_t cpu_;
   const ProtoTranslationTable* const table_;
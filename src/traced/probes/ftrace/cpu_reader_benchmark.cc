@@ -306,7 +306,8 @@ using protozero::ScatteredStreamWriter;
 using protozero::ScatteredStreamWriterNullDelegate;
 
 // Benchmark for the core logic of the ftrace binary format decoding.
-static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
+static void ParsePageFullOfSchedSwitch(benchmark::State& state,
+                                       bool compiled) {
   const ExamplePage* test_case = &g_full_page_sched_switch;
 
   ScatteredStreamWriterNullDelegate delegate(perfetto::base::kPageSize);
@@ -323,6 +324,10 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
                                    false /*symbolize_ksyms*/};
   ds_config.event_filter.AddEnabledEvent(
       table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+  if (compiled) {
+    ds_config.compiled_events =
+        CpuReader::CompileEvents(table, ds_config.event_filter);
+  }
 
   FtraceMetadata metadata{};
   while (state.KeepRunning()) {
@@ -343,4 +348,15 @@ static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
     metadata.Clear();
   }
 }
+
+static void BM_ParsePageFullOfSchedSwitch(benchmark::State& state) {
+  ParsePageFullOfSchedSwitch(state, /*compiled=*/false);
+}
 BENCHMARK(BM_ParsePageFullOfSchedSwitch);
+
+// Same as above, with the field parsers resolved ahead of time as
+// FtraceConfigMuxer does.
+static void BM_ParsePageFullOfSchedSwitchCompiled(benchmark::State& state) {
+  ParsePageFullOfSchedSwitch(state, /*compiled=*/true);
+}
+BENCHMARK(BM_ParsePageFullOfSchedSwitchCompiled);
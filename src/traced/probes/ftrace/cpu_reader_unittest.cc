@@ -809,6 +809,50 @@ TEST(CpuReaderTest, ParseSixSchedSwitch) {
   }
 }
 
+TEST(CpuReaderTest, ParseSixSchedSwitchCompiled) {
+  const ExamplePage* test_case = &g_six_sched_switch;
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  // Parses the page with and without compiling the events first.
+  auto parse = [&](bool compiled) {
+    BundleProvider bundle_provider(base::kPageSize);
+    FtraceDataSourceConfig ds_config = EmptyConfig();
+    ds_config.event_filter.AddEnabledEvent(
+        table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+    if (compiled) {
+      ds_config.compiled_events =
+          CpuReader::CompileEvents(table, ds_config.event_filter);
+    }
+
+    FtraceMetadata metadata{};
+    CompactSchedBuffer compact_buffer;
+    const uint8_t* parse_pos = page.get();
+    base::Optional<CpuReader::PageHeader> page_header =
+        CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+    EXPECT_TRUE(page_header.has_value());
+    size_t evt_bytes = CpuReader::ParsePagePayload(
+        parse_pos, &page_header.value(), table, &ds_config, &compact_buffer,
+        bundle_provider.writer(), &metadata);
+    EXPECT_EQ(evt_bytes, page_header->size);
+    EXPECT_THAT(metadata.pids, Contains(3733));
+    return bundle_provider.ParseProto();
+  };
+
+  auto bundle = parse(/*compiled=*/true);
+  ASSERT_TRUE(bundle);
+  ASSERT_EQ(bundle->event().size(), 6u);
+  const protos::gen::FtraceEvent& event = bundle->event()[1];
+  EXPECT_EQ(event.pid(), 3733ul);
+  EXPECT_EQ(event.sched_switch().prev_comm(), "sleep");
+  EXPECT_EQ(event.sched_switch().next_comm(), "rcuop/0");
+  EXPECT_EQ(event.sched_switch().next_pid(), 10);
+
+  auto expected = parse(/*compiled=*/false);
+  ASSERT_TRUE(expected);
+  EXPECT_EQ(bundle->SerializeAsString(), expected->SerializeAsString());
+}
+
 TEST(CpuReaderTest, ParseSixSchedSwitchCompactFormat) {
   const ExamplePage* test_case = &g_six_sched_switch;
 
@@ -880,6 +924,84 @@ TEST(CpuReaderTest, ParseSixSchedSwitchCompactFormat) {
   EXPECT_EQ("sleep", next_comm);
 }
 
+TEST(CpuReaderTest, ParseSixSchedSwitchCompactEvents) {
+  const ExamplePage* test_case = &g_six_sched_switch;
+
+  BundleProvider bundle_provider(base::kPageSize);
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  ds_config.compact_events = true;
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  FtraceMetadata metadata{};
+  CompactSchedBuffer compact_buffer;
+  const uint8_t* parse_pos = page.get();
+  base::Optional<CpuReader::PageHeader> page_header =
+      CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+  ASSERT_TRUE(page_header.has_value());
+
+  size_t evt_bytes = CpuReader::ParsePagePayload(
+      parse_pos, &page_header.value(), table, &ds_config, &compact_buffer,
+      bundle_provider.writer(), &metadata);
+
+  EXPECT_LT(0u, evt_bytes);
+
+  // Nothing written into the proto yet:
+  auto bundle = bundle_provider.ParseProto();
+  ASSERT_TRUE(bundle);
+  EXPECT_EQ(0u, bundle->event().size());
+  EXPECT_FALSE(bundle->has_compact_events());
+  bundle_provider.ResetWriter();
+
+  // Write the buffer out & check the serialized format:
+  EXPECT_LT(0u, compact_buffer.events().interned_strings_size());
+  compact_buffer.WriteAndReset(bundle_provider.writer());
+  bundle_provider.writer()->Finalize();
+  bundle = bundle_provider.ParseProto();
+  ASSERT_TRUE(bundle);
+  EXPECT_FALSE(bundle->has_compact_sched());
+
+  const auto& compact_events = bundle->compact_events();
+  ASSERT_EQ(1u, compact_events.event_type().size());
+  const auto& event_type = compact_events.event_type()[0];
+  EXPECT_EQ(static_cast<uint32_t>(
+                protos::gen::FtraceEvent::kSchedSwitchFieldNumber),
+            event_type.event_field_id());
+
+  // Delta-encoded timestamps, the first one is absolute:
+  ASSERT_EQ(6u, event_type.timestamp().size());
+  EXPECT_TRUE(
+      WithinOneMicrosecond(event_type.timestamp()[0], 1045157, 722134));
+  uint64_t second_ts = event_type.timestamp()[0] + event_type.timestamp()[1];
+  EXPECT_TRUE(WithinOneMicrosecond(second_ts, 1045157, 725035));
+
+  // The common pid:
+  ASSERT_EQ(1u, event_type.common_column().size());
+  EXPECT_EQ(static_cast<uint32_t>(protos::gen::FtraceEvent::kPidFieldNumber),
+            event_type.common_column()[0].field_id());
+  EXPECT_THAT(event_type.common_column()[0].value(),
+              ElementsAre(3u, 3733u, 7u, 3733u, 3513u, 3733u));
+
+  // One column per field, each with one value per event:
+  ASSERT_EQ(7u, event_type.column().size());
+  for (const auto& column : event_type.column()) {
+    EXPECT_EQ(6u, column.value().size() + column.string_index().size());
+    if (column.field_id() ==
+        protos::gen::SchedSwitchFtraceEvent::kNextCommFieldNumber) {
+      ASSERT_EQ(6u, column.string_index().size());
+      EXPECT_EQ("rcuop/0",
+                compact_events.intern_table()[column.string_index()[1]]);
+    } else if (column.field_id() ==
+               protos::gen::SchedSwitchFtraceEvent::kNextPidFieldNumber) {
+      ASSERT_EQ(6u, column.value().size());
+      EXPECT_EQ(10u, column.value()[1]);
+    }
+  }
+}
+
 TEST_F(CpuReaderTableTest, ParseAllFields) {
   using FakeEventProvider =
       ProtoProvider<pbzero::FakeFtraceEvent, gen::FakeFtraceEvent>;
@@ -1202,6 +1324,72 @@ TEST(CpuReaderTest, NewPacketOnLostEvents) {
   EXPECT_EQ(4u, packets[2].ftrace_events().event().size());
 }
 
+TEST(CpuReaderTest, WriteRawPages) {
+  auto page_ok = PageFromXxd(g_switch_page);
+  auto page_loss = PageFromXxd(g_switch_page_lost_events);
+  static constexpr size_t kTestPages = 2;
+  uint8_t buf[base::kPageSize * kTestPages] = {};
+  memcpy(buf, page_ok.get(), base::kPageSize);
+  memcpy(buf + base::kPageSize, page_loss.get(), base::kPageSize);
+
+  ProtoTranslationTable* table = GetTable("synthetic");
+  TraceWriterForTesting trace_writer;
+  ASSERT_TRUE(CpuReader::WriteRawPages(&trace_writer, /*cpu=*/1, buf,
+                                       kTestPages, table,
+                                       protos::pbzero::FTRACE_CLOCK_UNSPECIFIED));
+
+  // The pages are written verbatim, lost events flag included, up to the end
+  // of their data.
+  auto packets = trace_writer.GetAllTracePackets();
+  ASSERT_EQ(1u, packets.size());
+  const auto& bundle = packets[0].ftrace_events();
+  EXPECT_EQ(1u, bundle.cpu());
+  EXPECT_EQ(0u, bundle.event().size());
+  ASSERT_EQ(kTestPages, bundle.raw_page().size());
+  for (size_t i = 0; i < kTestPages; i++) {
+    const uint8_t* page = buf + i * base::kPageSize;
+    const uint8_t* parse_pos = page;
+    auto page_header =
+        CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+    ASSERT_TRUE(page_header.has_value());
+    size_t size = static_cast<size_t>(parse_pos - page) + page_header->size;
+    EXPECT_EQ(bundle.raw_page()[i],
+              std::string(reinterpret_cast<const char*>(page), size));
+  }
+}
+
+TEST(CpuReaderTest, WriteRawPageFormat) {
+  ProtoTranslationTable* table = GetTable("synthetic");
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  ds_config.event_filter.AddEnabledEvent(
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch")));
+
+  protozero::HeapBuffered<protos::pbzero::FtraceEventBundle::RawPageFormat>
+      writer;
+  CpuReader::WriteRawPageFormat(table, &ds_config, writer.get());
+  protos::gen::FtraceEventBundle::RawPageFormat format;
+  ASSERT_TRUE(format.ParseFromString(writer.SerializeAsString()));
+
+  EXPECT_EQ(format.page_header_size_len(), table->page_header_size_len());
+  ASSERT_EQ(format.common_field().size(), 1u);
+  EXPECT_EQ(format.common_field()[0].name(), "common_pid");
+  EXPECT_EQ(format.common_field()[0].proto_field_id(),
+            static_cast<uint32_t>(protos::pbzero::FtraceEvent::kPidFieldNumber));
+
+  // Only the enabled events are described.
+  ASSERT_EQ(format.event().size(), 1u);
+  const auto& event = format.event()[0];
+  EXPECT_EQ(event.name(), "sched_switch");
+  EXPECT_EQ(event.proto_field_id(),
+            static_cast<uint32_t>(
+                protos::pbzero::FtraceEvent::kSchedSwitchFieldNumber));
+  std::vector<std::string> field_names;
+  for (const auto& field : event.field())
+    field_names.push_back(field.name());
+  EXPECT_THAT(field_names, Contains("next_comm"));
+  EXPECT_THAT(field_names, Contains("next_pid"));
+}
+
 // Page containing an absolute timestamp (RINGBUF_TYPE_TIME_STAMP).
 static char g_abs_timestamp[] =
     R"(
@@ -528,10 +528,42 @@ FtraceConfigId FtraceConfigMuxer::SetupConfig(const FtraceConfig& request) {
   std::vector<std::string> apps(request.atrace_apps());
   std::vector<std::string> categories(request.atrace_categories());
   FtraceConfigId id = ++last_id_;
-  ds_configs_.emplace(
+  // Filters on the events which aren't enabled would be dropped when merging,
+  // warn about them here.
+  std::map<size_t, std::string> kernel_filters;
+  for (const auto& kernel_filter : request.kernel_filters()) {
+    std::string group;
+    std::string name;
+    std::tie(group, name) = EventToStringGroupAndName(kernel_filter.event());
+    const Event* event = table_->GetEvent(GroupAndName(group, name));
+    if (!event || !filter.IsEventEnabled(event->ftrace_event_id)) {
+      PERFETTO_ELOG("Ignoring the kernel filter of %s, event not enabled",
+                    kernel_filter.event().c_str());
+      continue;
+    }
+    if (kernel_filter.filter().empty())
+      continue;
+    // Several filters of the same event are alternatives.
+    std::string& expr = kernel_filters[event->ftrace_event_id];
+    if (!expr.empty())
+      expr += " || ";
+    expr += "(" + kernel_filter.filter() + ")";
+  }
+
+  CpuReader::CompiledEvents compiled_events =
+      CpuReader::CompileEvents(table_, filter);
+  auto it_and_inserted = ds_configs_.emplace(
       std::piecewise_construct, std::forward_as_tuple(id),
       std::forward_as_tuple(std::move(filter), compact_sched, std::move(apps),
                             std::move(categories), request.symbolize_ksyms()));
+  it_and_inserted.first->second.raw_page_passthrough =
+      request.raw_page_passthrough();
+  it_and_inserted.first->second.compact_events = request.compact_events();
+  it_and_inserted.first->second.compiled_events = std::move(compiled_events);
+  it_and_inserted.first->second.kernel_filters = std::move(kernel_filters);
+  it_and_inserted.first->second.kernel_filter_pids =
+      request.kernel_filter_pids();
+  UpdateKernelFilters();
   return id;
 }
 
@@ -598,6 +630,9 @@ bool FtraceConfigMuxer::RemoveConfig(FtraceConfigId config_id) {
       current_state_.ftrace_events.DisableEvent(event->ftrace_event_id);
   }
 
+  // Relax the kernel filters which were needed only by this config.
+  UpdateKernelFilters();
+
   // If there aren't any more active configs, disable ftrace.
   auto active_it = active_configs_.find(config_id);
   if (active_it != active_configs_.end()) {
@@ -645,6 +680,84 @@ const FtraceDataSourceConfig* FtraceConfigMuxer::GetDataSourceConfig(
   return &ds_configs_.at(id);
 }
 
+void FtraceConfigMuxer::UpdateKernelFilters() {
+  // Every data source must get at least the events it asked for: an event is
+  // filtered only if all the data sources enabling it filter it, by the
+  // disjunction of their filters. Same for the pids.
+  std::map<size_t, std::string> filters;
+  std::set<size_t> unfiltered;
+  std::vector<int32_t> pids;
+  bool filter_pids = !ds_configs_.empty();
+  for (const auto& id_config : ds_configs_) {
+    const FtraceDataSourceConfig& config = id_config.second;
+    for (size_t id : config.event_filter.GetEnabledEvents()) {
+      auto it = config.kernel_filters.find(id);
+      if (it == config.kernel_filters.end()) {
+        unfiltered.insert(id);
+        continue;
+      }
+      std::string& expr = filters[id];
+      if (!expr.empty())
+        expr += " || ";
+      expr += it->second;
+    }
+    if (config.kernel_filter_pids.empty())
+      filter_pids = false;
+    pids.insert(pids.end(), config.kernel_filter_pids.begin(),
+                config.kernel_filter_pids.end());
+  }
+  for (size_t id : unfiltered)
+    filters.erase(id);
+
+  for (auto it = current_state_.kernel_filters.begin();
+       it != current_state_.kernel_filters.end();) {
+    if (filters.count(it->first)) {
+      ++it;
+      continue;
+    }
+    const Event* event = table_->GetEventById(it->first);
+    if (event && !ftrace_->SetEventFilter(event->group, event->name, "")) {
+      PERFETTO_ELOG("Failed to clear the kernel filter of %s/%s",
+                    event->group, event->name);
+    }
+    it = current_state_.kernel_filters.erase(it);
+  }
+  for (const auto& id_filter : filters) {
+    auto it = current_state_.kernel_filters.find(id_filter.first);
+    if (it != current_state_.kernel_filters.end() &&
+        it->second == id_filter.second) {
+      continue;
+    }
+    const Event* event = table_->GetEventById(id_filter.first);
+    if (!event)
+      continue;
+    if (ftrace_->SetEventFilter(event->group, event->name, id_filter.second)) {
+      current_state_.kernel_filters[id_filter.first] = id_filter.second;
+      continue;
+    }
+    // The kernel keeps the previous filter when rejecting an expression, which
+    // might drop the events of the new data source: don't filter instead.
+    PERFETTO_ELOG("Invalid kernel filter for %s/%s: %s", event->group,
+                  event->name, id_filter.second.c_str());
+    ftrace_->SetEventFilter(event->group, event->name, "");
+    current_state_.kernel_filters.erase(id_filter.first);
+  }
+
+  if (!filter_pids)
+    pids.clear();
+  std::sort(pids.begin(), pids.end());
+  pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+  if (pids != current_state_.kernel_filter_pids) {
+    if (ftrace_->SetEventPids(pids)) {
+      current_state_.kernel_filter_pids = std::move(pids);
+    } else {
+      PERFETTO_ELOG("Failed to set the kernel pid filter");
+      ftrace_->SetEventPids({});
+      current_state_.kernel_filter_pids.clear();
+    }
+  }
+}
+
 void FtraceConfigMuxer::SetupClock(const FtraceConfig&) {
   std::string current_clock = ftrace_->GetClock();
   std::set<std::string> clocks = ftrace_->AvailableClocks();
@@ -21,6 +21,7 @@
 #include <set>
 
 #include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
@@ -61,6 +62,24 @@ struct FtraceDataSourceConfig {
 
   // When enabled will turn on the kallsyms symbolizer in CpuReader.
   const bool symbolize_ksyms;
+
+  // When enabled the pages are written verbatim rather than parsed, see
+  // FtraceConfig.raw_page_passthrough.
+  bool raw_page_passthrough = false;
+
+  // When enabled the events are written in the columnar encoding of
+  // FtraceEventBundle.CompactEvents, see FtraceConfig.compact_events.
+  bool compact_events = false;
+
+  // The filters of FtraceConfig.kernel_filters, by ftrace event id, and the
+  // pids of FtraceConfig.kernel_filter_pids. FtraceConfigMuxer merges them
+  // with those of the other data sources before writing them to the kernel.
+  std::map<size_t, std::string> kernel_filters;
+  std::vector<int32_t> kernel_filter_pids;
+
+  // The field parsers of the events in |event_filter|. The events which
+  // aren't compiled are parsed by CpuReader::ParseEvent().
+  CpuReader::CompiledEvents compiled_events;
 };
 
 // Ftrace is a bunch of globally modifiable persistent state.
@@ -141,6 +160,10 @@ class FtraceConfigMuxer {
     size_t cpu_buffer_size_pages = 0;
     bool atrace_on = false;
     protos::pbzero::FtraceClock ftrace_clock{};
+    // The filters written to the kernel, by ftrace event id, and the pids
+    // written to set_event_pid (sorted).
+    std::map<size_t, std::string> kernel_filters;
+    std::vector<int32_t> kernel_filter_pids;
   };
 
   FtraceConfigMuxer(const FtraceConfigMuxer&) = delete;
@@ -151,6 +174,10 @@ class FtraceConfigMuxer {
   void UpdateAtrace(const FtraceConfig& request);
   void DisableAtrace();
 
+  // Writes to the kernel the merge of the kernel filters of all the data
+  // sources in |ds_configs_|, see FtraceConfig.kernel_filters.
+  void UpdateKernelFilters();
+
   // This processes the config to get the exact events.
   // group/* -> Will read the fs and add all events in group.
   // event -> Will look up the event to find the group.
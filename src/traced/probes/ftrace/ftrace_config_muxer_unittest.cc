@@ -29,6 +29,7 @@ using testing::AnyNumber;
 using testing::Contains;
 using testing::ElementsAreArray;
 using testing::Eq;
+using testing::InSequence;
 using testing::IsEmpty;
 using testing::MatchesRegex;
 using testing::NiceMock;
@@ -938,5 +939,71 @@ TEST_F(FtraceConfigMuxerTest, CompactSchedConfigWithInvalidFormat) {
   EXPECT_FALSE(ds_config->compact_sched.enabled);
 }
 
+TEST_F(FtraceConfigMuxerTest, KernelFiltersAreMerged) {
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer model(&ftrace, table_.get(), {});
+
+  FtraceConfig config_a = CreateFtraceConfig({"sched/sched_switch"});
+  auto* filter_a = config_a.add_kernel_filters();
+  filter_a->set_event("sched/sched_switch");
+  filter_a->set_filter("prev_pid == 1");
+
+  FtraceConfig config_b = CreateFtraceConfig({"sched/sched_switch"});
+  auto* filter_b = config_b.add_kernel_filters();
+  filter_b->set_event("sched/sched_switch");
+  filter_b->set_filter("next_pid == 2");
+
+  const char kFilterPath[] = "/root/events/sched/sched_switch/filter";
+  EXPECT_CALL(ftrace, WriteToFile(_, _)).Times(AnyNumber());
+  {
+    InSequence seq;
+    EXPECT_CALL(ftrace, WriteToFile(kFilterPath, "(prev_pid == 1)"));
+    EXPECT_CALL(ftrace, WriteToFile(kFilterPath,
+                                    "(prev_pid == 1) || (next_pid == 2)"));
+    EXPECT_CALL(ftrace, WriteToFile(kFilterPath, "(prev_pid == 1)"));
+    EXPECT_CALL(ftrace, WriteToFile(kFilterPath, "0"));
+  }
+
+  FtraceConfigId id_a = model.SetupConfig(config_a);
+  ASSERT_TRUE(id_a);
+  const FtraceDataSourceConfig* ds_config = model.GetDataSourceConfig(id_a);
+  ASSERT_TRUE(ds_config);
+  EXPECT_EQ(ds_config->kernel_filters.size(), 1u);
+
+  FtraceConfigId id_b = model.SetupConfig(config_b);
+  ASSERT_TRUE(id_b);
+  ASSERT_TRUE(model.RemoveConfig(id_b));
+  ASSERT_TRUE(model.RemoveConfig(id_a));
+}
+
+TEST_F(FtraceConfigMuxerTest, KernelFiltersAreDroppedIfAnyConfigIsUnfiltered) {
+  NiceMock<MockFtraceProcfs> ftrace;
+  FtraceConfigMuxer model(&ftrace, table_.get(), {});
+
+  FtraceConfig config_filtered = CreateFtraceConfig({"sched/sched_switch"});
+  auto* filter = config_filtered.add_kernel_filters();
+  filter->set_event("sched/sched_switch");
+  filter->set_filter("prev_pid == 1");
+  config_filtered.add_kernel_filter_pids(2);
+  config_filtered.add_kernel_filter_pids(1);
+
+  // Sees all the events of sched_switch, hence of every pid.
+  FtraceConfig config_unfiltered = CreateFtraceConfig({"sched/sched_switch"});
+
+  const char kFilterPath[] = "/root/events/sched/sched_switch/filter";
+  EXPECT_CALL(ftrace, WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(ftrace, ClearFile(_)).Times(AnyNumber());
+  {
+    InSequence seq;
+    EXPECT_CALL(ftrace, WriteToFile(kFilterPath, "(prev_pid == 1)"));
+    EXPECT_CALL(ftrace, WriteToFile("/root/set_event_pid", "1 2"));
+    EXPECT_CALL(ftrace, WriteToFile(kFilterPath, "0"));
+    EXPECT_CALL(ftrace, ClearFile("/root/set_event_pid"));
+  }
+
+  ASSERT_TRUE(model.SetupConfig(config_filtered));
+  ASSERT_TRUE(model.SetupConfig(config_unfiltered));
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -24,6 +24,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <string>
 #include <utility>
@@ -34,6 +35,7 @@
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/metatrace.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "src/kallsyms/kernel_symbol_map.h"
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
@@ -72,6 +74,9 @@ constexpr size_t kMaxPagesPerCpuPerReadTick = 256;  // 1 MB per cpu
 // should be a single counter in the cpu_reader, similar to lost_events case.
 constexpr size_t kParsingBufferSizePages = 32;
 
+// The kernel default for tracefs buffer_percent, restored when tracing stops.
+constexpr uint32_t kDefaultBufferPercent = 50;
+
 uint32_t ClampDrainPeriodMs(uint32_t drain_period_ms) {
   if (drain_period_ms == 0) {
     return kDefaultDrainPeriodMs;
@@ -113,6 +118,8 @@ bool HardResetFtraceState() {
     // We deliberately don't check for this as on some older versions of Android
     // events/enable was not writable by the shell user.
     WriteToFile((prefix + "events/enable").c_str(), "0");
+    // Not present on kernels older than 5.1.
+    WriteToFile((prefix + "buffer_percent").c_str(), "50");
     res &= ClearFile((prefix + "trace").c_str());
     if (res)
       return true;
@@ -120,19 +127,226 @@ bool HardResetFtraceState() {
   return false;
 }
 
+// Reads and parses the ftrace buffers of a group of cpus on a dedicated thread.
+// For each started data source it has its own TraceWriter (i.e. its own packet
+// sequence, which also scopes the interned kernel symbols) and FtraceMetadata.
+// The metadata is handed over to the main thread after every read cycle and
+// merged there into the data source's one, where the ProbesProducer consumes
+// it as usual.
+// Other than the constructor, destructor and Flush(), which are called on the
+// main thread, everything runs on the reader thread.
+class FtraceController::ReaderThread {
+ public:
+  struct Sink {
+    Sink(FtraceDataSource* ds, std::unique_ptr<TraceWriter> w)
+        : data_source(ds),
+          writer(std::move(w)),
+          parsing_config(ds->parsing_config()) {}
+
+    FtraceDataSource* data_source;  // Dereferenced only on the main thread.
+    std::unique_ptr<TraceWriter> writer;
+    const FtraceDataSourceConfig* parsing_config;
+    FtraceMetadata metadata;
+  };
+
+  ReaderThread(std::vector<PerCpuState> per_cpu,
+               std::vector<Sink> sinks,
+               protos::pbzero::FtraceClock ftrace_clock,
+               size_t period_page_quota,
+               uint32_t drain_period_ms,
+               bool watch_buffers,
+               base::TaskRunner* main_task_runner,
+               base::WeakPtr<FtraceController> controller,
+               int generation)
+      : per_cpu_(std::move(per_cpu)),
+        sinks_(std::move(sinks)),
+        period_page_quota_(period_page_quota),
+        drain_period_ms_(drain_period_ms),
+        watch_buffers_(watch_buffers),
+        main_task_runner_(main_task_runner),
+        controller_(std::move(controller)),
+        generation_(generation),
+        parsing_mem_(base::PagedMemory::Allocate(base::kPageSize *
+                                                 kParsingBufferSizePages)),
+        task_runner_(base::ThreadTaskRunner::CreateAndStart("ftrace_reader")) {
+    for (PerCpuState& per_cpu_state : per_cpu_)
+      per_cpu_state.reader->set_ftrace_clock(ftrace_clock);
+    for (Sink& sink : sinks_) {
+      cpu_reader_sinks_.push_back(CpuReader::DataSourceSink{
+          sink.writer.get(), &sink.metadata, sink.parsing_config});
+    }
+    task_runner_.PostTask([this] { UpdateCpuBufferWatches(); });
+    task_runner_.PostDelayedTask([this] { ReadTick(); }, NextTickDelayMs());
+  }
+
+  void Flush(FlushRequestID flush_id) {
+    task_runner_.PostTask([this, flush_id] {
+      // Like the main thread Flush(), this ignores the per-period quota.
+      for (PerCpuState& per_cpu : per_cpu_)
+        ReadCpu(&per_cpu, period_page_quota_);
+      PostMetadata();
+      for (Sink& sink : sinks_)
+        sink.writer->Flush();
+      base::WeakPtr<FtraceController> controller = controller_;
+      int generation = generation_;
+      main_task_runner_->PostTask([controller, flush_id, generation] {
+        if (controller)
+          controller->OnReaderThreadFlushed(flush_id, generation);
+      });
+    });
+  }
+
+ private:
+  // Unlike the main thread ReadTick() there is no need to yield to other tasks
+  // here, each cpu is read until it catches up with the writer or exhausts
+  // its quota for the drain period.
+  void ReadTick() {
+    metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
+                               metatrace::FTRACE_READ_TICK);
+    for (PerCpuState& per_cpu : per_cpu_) {
+      if (per_cpu.period_page_quota > 0)
+        ReadCpu(&per_cpu, per_cpu.period_page_quota);
+      per_cpu.period_page_quota = period_page_quota_;
+    }
+    PostMetadata();
+    UpdateCpuBufferWatches();
+    task_runner_.PostDelayedTask([this] { ReadTick(); }, NextTickDelayMs());
+  }
+
+  void OnCpuBufferWatermark(size_t cpu) {
+    PerCpuState& per_cpu = per_cpu_[cpu];
+    if (per_cpu.period_page_quota > 0) {
+      size_t pages_read = ReadCpu(&per_cpu, per_cpu.period_page_quota);
+      per_cpu.period_page_quota -=
+          std::min(pages_read, per_cpu.period_page_quota);
+      PostMetadata();
+    }
+    UpdateCpuBufferWatches();
+  }
+
+  // Same as FtraceController::UpdateCpuBufferWatches().
+  void UpdateCpuBufferWatches() {
+    for (size_t cpu = 0; cpu < per_cpu_.size(); cpu++) {
+      PerCpuState& per_cpu = per_cpu_[cpu];
+      bool watch = watch_buffers_ && per_cpu.period_page_quota > 0;
+      if (watch == per_cpu.watched)
+        continue;
+      per_cpu.watched = watch;
+      int fd = per_cpu.reader->trace_fd();
+      if (watch) {
+        task_runner_.AddFileDescriptorWatch(
+            fd, [this, cpu] { OnCpuBufferWatermark(cpu); });
+      } else {
+        task_runner_.RemoveFileDescriptorWatch(fd);
+      }
+    }
+  }
+
+  size_t ReadCpu(PerCpuState* per_cpu, size_t max_pages) {
+    uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
+    return per_cpu->reader->ReadCycle(parsing_buf, kParsingBufferSizePages,
+                                      max_pages, cpu_reader_sinks_);
+  }
+
+  // Moves the metadata collected in the last read cycle to the main thread.
+  void PostMetadata() {
+    struct Update {
+      FtraceDataSource* data_source;
+      base::FlatSet<InodeBlockPair> inode_and_device;
+      base::FlatSet<int32_t> rename_pids;
+      base::FlatSet<int32_t> pids;
+    };
+    std::vector<Update> updates;
+    for (Sink& sink : sinks_) {
+      FtraceMetadata& metadata = sink.metadata;
+      if (!metadata.inode_and_device.empty() || !metadata.pids.empty() ||
+          !metadata.rename_pids.empty()) {
+        updates.push_back(Update{sink.data_source,
+                                 std::move(metadata.inode_and_device),
+                                 std::move(metadata.rename_pids),
+                                 std::move(metadata.pids)});
+      }
+      // Also resets the kernel symbols, which are re-emitted (on this thread's
+      // writers) after each read cycle like on the main thread.
+      metadata.Clear();
+    }
+    if (updates.empty())
+      return;
+
+    base::WeakPtr<FtraceController> controller = controller_;
+    main_task_runner_->PostTask([controller, updates] {
+      if (!controller)
+        return;
+      for (const Update& update : updates) {
+        // The data source might have been removed in the meantime.
+        if (!controller->started_data_sources_.count(update.data_source))
+          continue;
+        FtraceMetadata* metadata = update.data_source->mutable_metadata();
+        for (const InodeBlockPair& inode : update.inode_and_device)
+          metadata->inode_and_device.insert(inode);
+        for (int32_t pid : update.rename_pids)
+          metadata->AddRenamePid(pid);
+        for (int32_t pid : update.pids)
+          metadata->AddPid(pid);
+      }
+      controller->observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
+    });
+  }
+
+  uint32_t NextTickDelayMs() const {
+    auto now_ms = static_cast<uint64_t>(base::GetWallTimeMs().count());
+    return drain_period_ms_ -
+           static_cast<uint32_t>(now_ms % drain_period_ms_);
+  }
+
+  // |period_page_quota| is the quota left for the current drain period.
+  std::vector<PerCpuState> per_cpu_;
+  std::vector<Sink> sinks_;
+  std::vector<CpuReader::DataSourceSink> cpu_reader_sinks_;
+  const size_t period_page_quota_;
+  const uint32_t drain_period_ms_;
+  const bool watch_buffers_;
+  base::TaskRunner* const main_task_runner_;
+  const base::WeakPtr<FtraceController> controller_;
+  const int generation_;
+  base::PagedMemory parsing_mem_;
+
+  // Keep last: destroying it joins the thread (and drops the fd watches),
+  // before the state it uses goes.
+  base::ThreadTaskRunner task_runner_;
+};
+
 // static
 std::unique_ptr<FtraceController> FtraceController::Create(
     base::TaskRunner* runner,
-    Observer* observer) {
+    Observer* observer,
+    const std::string& format_cache_file) {
   std::unique_ptr<FtraceProcfs> ftrace_procfs =
       FtraceProcfs::CreateGuessingMountPoint();
 
   if (!ftrace_procfs)
     return nullptr;
 
+  // The event ids of the kernel modules can change across boots, so the
+  // cached formats are only valid for the same boot and set of modules.
+  std::string cache_key;
+  bool cache_loaded = false;
+  if (!format_cache_file.empty()) {
+    cache_key = GetKernelCacheKey();
+    if (!cache_key.empty()) {
+      cache_loaded =
+          ftrace_procfs->LoadFormatCache(format_cache_file, cache_key);
+    }
+  }
+
   auto table = ProtoTranslationTable::Create(
       ftrace_procfs.get(), GetStaticEventInfo(), GetStaticCommonFieldsInfo());
 
+  if (table && !cache_key.empty() && !cache_loaded)
+    ftrace_procfs->SaveFormatCache(format_cache_file, cache_key);
+  // The events that are not in the table are read lazily later, from tracefs.
+  ftrace_procfs->ClearFormatCache();
+
   if (!table)
     return nullptr;
 
@@ -161,6 +375,7 @@ FtraceController::FtraceController(std::unique_ptr<FtraceProcfs> ftrace_procfs,
       weak_factory_(this) {}
 
 FtraceController::~FtraceController() {
+  StopReaderThreads();
   for (const auto* data_source : data_sources_)
     ftrace_config_muxer_->RemoveConfig(data_source->config_id());
   data_sources_.clear();
@@ -173,10 +388,17 @@ uint64_t FtraceController::NowMs() const {
 }
 
 void FtraceController::StartIfNeeded() {
-  if (started_data_sources_.size() > 1)
+  if (started_data_sources_.empty())
+    return;
+  UpdateBufferPercent();
+  if (GetNumReaderThreads() > 0) {
+    StartReaderThreads();
+    return;
+  }
+  if (!per_cpu_.empty()) {
+    UpdateCpuBufferWatches();
     return;
-  PERFETTO_DCHECK(!started_data_sources_.empty());
-  PERFETTO_DCHECK(per_cpu_.empty());
+  }
 
   // Lazily allocate the memory used for reading & parsing ftrace.
   if (!parsing_mem_.IsValid()) {
@@ -204,6 +426,15 @@ void FtraceController::StartIfNeeded() {
           weak_this->ReadTick(generation);
       },
       drain_period_ms - (NowMs() % drain_period_ms));
+  UpdateCpuBufferWatches();
+
+  // Flushes that the reader threads didn't get to complete, when no data source
+  // wants them anymore.
+  while (!pending_thread_flushes_.empty()) {
+    FlushRequestID flush_id = pending_thread_flushes_.begin()->first;
+    pending_thread_flushes_.erase(pending_thread_flushes_.begin());
+    Flush(flush_id);
+  }
 }
 
 // We handle the ftrace buffers in a repeating task (ReadTick). On a given tick,
@@ -290,6 +521,7 @@ void FtraceController::ReadTick(int generation) {
     size_t period_page_quota = ftrace_config_muxer_->GetPerCpuBufferSizePages();
     for (auto& per_cpu : per_cpu_)
       per_cpu.period_page_quota = period_page_quota;
+    UpdateCpuBufferWatches();
 
     auto drain_period_ms = GetDrainPeriodMs();
     task_runner_->PostDelayedTask(
@@ -301,6 +533,174 @@ void FtraceController::ReadTick(int generation) {
   }
 }
 
+// With FtraceConfig.drain_buffer_percent the per-cpu buffers are polled and
+// the kernel reports them as readable once they cross the watermark, in
+// addition to the periodic ReadTick(). A buffer which exhausted its quota for
+// the drain period is not polled until the next period, as it could stay
+// readable (and hence wake us up in a loop).
+void FtraceController::UpdateCpuBufferWatches() {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  int generation = generation_;
+  for (size_t cpu = 0; cpu < per_cpu_.size(); cpu++) {
+    PerCpuState& per_cpu = per_cpu_[cpu];
+    bool watch = buffer_percent_ > 0 && per_cpu.period_page_quota > 0;
+    if (watch == per_cpu.watched)
+      continue;
+    per_cpu.watched = watch;
+    int fd = per_cpu.reader->trace_fd();
+    if (watch) {
+      task_runner_->AddFileDescriptorWatch(fd, [weak_this, cpu, generation] {
+        if (weak_this)
+          weak_this->OnCpuBufferWatermark(cpu, generation);
+      });
+    } else {
+      task_runner_->RemoveFileDescriptorWatch(fd);
+    }
+  }
+}
+
+void FtraceController::OnCpuBufferWatermark(size_t cpu, int generation) {
+  metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
+                             metatrace::FTRACE_READ_TICK);
+  if (generation != generation_ || cpu >= per_cpu_.size())
+    return;
+
+  // As in ReadTick(), read at most |kMaxPagesPerCpuPerReadTick| in one go. If
+  // there is more, the fd stays readable and we get called again after the
+  // other pending tasks.
+  PerCpuState& per_cpu = per_cpu_[cpu];
+  if (per_cpu.period_page_quota > 0) {
+    size_t max_pages =
+        std::min(per_cpu.period_page_quota, kMaxPagesPerCpuPerReadTick);
+    uint8_t* parsing_buf = reinterpret_cast<uint8_t*>(parsing_mem_.Get());
+    per_cpu.reader->set_ftrace_clock(ftrace_config_muxer_->ftrace_clock());
+    size_t pages_read = per_cpu.reader->ReadCycle(
+        parsing_buf, kParsingBufferSizePages, max_pages, started_data_sources_);
+    per_cpu.period_page_quota -=
+        std::min(pages_read, per_cpu.period_page_quota);
+    observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
+  }
+  UpdateCpuBufferWatches();
+}
+
+// Sets the kernel buffers watermark to the lowest drain_buffer_percent of the
+// started data sources.
+void FtraceController::UpdateBufferPercent() {
+  uint32_t percent = GetDrainBufferPercent();
+  if (percent == buffer_percent_)
+    return;
+  if (percent == 0) {
+    ftrace_procfs_->SetBufferPercent(kDefaultBufferPercent);
+    buffer_percent_ = 0;
+    return;
+  }
+  if (!ftrace_procfs_->SetBufferPercent(percent)) {
+    PERFETTO_ELOG(
+        "Failed to set the ftrace buffer_percent (requires Linux 5.1+), the "
+        "ftrace buffers are drained only every drain_period_ms");
+    return;
+  }
+  buffer_percent_ = percent;
+}
+
+void FtraceController::ClearPerCpuState() {
+  for (PerCpuState& per_cpu : per_cpu_) {
+    if (per_cpu.watched)
+      task_runner_->RemoveFileDescriptorWatch(per_cpu.reader->trace_fd());
+  }
+  per_cpu_.clear();
+}
+
+void FtraceController::StartReaderThreads() {
+  PERFETTO_DCHECK(reader_threads_.empty());
+
+  // The main thread readers, if any, are stopped by the generation change.
+  ClearPerCpuState();
+  auto generation = ++generation_;
+
+  // The reader threads can't create the symbol map, see LazyKernelSymbolizer.
+  for (const FtraceDataSource* data_source : started_data_sources_) {
+    if (data_source->config().symbolize_ksyms()) {
+      symbolizer_->GetOrCreateKernelSymbolMap();
+      break;
+    }
+  }
+
+  const size_t num_cpus = ftrace_procfs_->NumberOfCpus();
+  const size_t num_threads = GetNumReaderThreads();
+  const size_t period_page_quota =
+      ftrace_config_muxer_->GetPerCpuBufferSizePages();
+  for (size_t thread = 0; thread < num_threads; thread++) {
+    std::vector<PerCpuState> per_cpu;
+    for (size_t cpu = thread; cpu < num_cpus; cpu += num_threads) {
+      per_cpu.emplace_back(
+          std::unique_ptr<CpuReader>(
+              new CpuReader(cpu, table_.get(), symbolizer_.get(),
+                            ftrace_procfs_->OpenPipeForCpu(cpu))),
+          period_page_quota);
+    }
+    std::vector<ReaderThread::Sink> sinks;
+    for (FtraceDataSource* data_source : started_data_sources_)
+      sinks.emplace_back(data_source, data_source->CreateTraceWriter());
+    reader_threads_.emplace_back(new ReaderThread(
+        std::move(per_cpu), std::move(sinks),
+        ftrace_config_muxer_->ftrace_clock(), period_page_quota,
+        GetDrainPeriodMs(), /*watch_buffers=*/buffer_percent_ > 0,
+        task_runner_, weak_factory_.GetWeakPtr(), generation));
+  }
+
+  // Re-issue the flushes which the previous threads didn't get to ack.
+  for (auto& flush_id_and_acks : pending_thread_flushes_) {
+    flush_id_and_acks.second = reader_threads_.size();
+    for (auto& reader_thread : reader_threads_)
+      reader_thread->Flush(flush_id_and_acks.first);
+  }
+}
+
+void FtraceController::StopReaderThreads() {
+  // Joins the threads. Their data still in the kernel buffers is read by the
+  // next readers, if any.
+  reader_threads_.clear();
+}
+
+void FtraceController::OnReaderThreadFlushed(FlushRequestID flush_id,
+                                             int generation) {
+  if (generation != generation_)
+    return;  // Re-issued to the new threads, see StartReaderThreads().
+  auto it = pending_thread_flushes_.find(flush_id);
+  if (it == pending_thread_flushes_.end())
+    return;
+  PERFETTO_DCHECK(it->second > 0);
+  if (--it->second > 0)
+    return;
+  pending_thread_flushes_.erase(it);
+  CompleteFlush(flush_id);
+}
+
+// The reader threads are used only if all the data sources can create the
+// writers for them.
+size_t FtraceController::GetNumReaderThreads() {
+  uint32_t num_threads = 0;
+  for (const FtraceDataSource* data_source : started_data_sources_) {
+    if (!data_source->can_create_trace_writers())
+      return 0;
+    num_threads = std::max(num_threads, data_source->config().reader_threads());
+  }
+  return std::min(static_cast<size_t>(num_threads),
+                  ftrace_procfs_->NumberOfCpus());
+}
+
+uint32_t FtraceController::GetDrainBufferPercent() {
+  uint32_t min_percent = 0;
+  for (const FtraceDataSource* data_source : started_data_sources_) {
+    uint32_t percent =
+        std::min(data_source->config().drain_buffer_percent(), 100u);
+    if (percent > 0 && (min_percent == 0 || percent < min_percent))
+      min_percent = percent;
+  }
+  return min_percent;
+}
+
 uint32_t FtraceController::GetDrainPeriodMs() {
   if (data_sources_.empty())
     return kDefaultDrainPeriodMs;
@@ -324,10 +724,26 @@ void FtraceController::WriteTraceMarker(const std::string& s) {
   ftrace_procfs_->WriteTraceMarker(s);
 }
 
+void FtraceController::SetKallsymsCacheFile(std::string path) {
+  symbolizer_->set_cache_file(std::move(path));
+}
+
 void FtraceController::Flush(FlushRequestID flush_id) {
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_CPU_FLUSH);
 
+  // With reader threads the flush completes once all of them have read their
+  // cpus and flushed their writers. Several data sources of the same session
+  // can ask for the same flush, the threads need to do it only once.
+  if (!reader_threads_.empty()) {
+    if (pending_thread_flushes_.count(flush_id))
+      return;
+    pending_thread_flushes_[flush_id] = reader_threads_.size();
+    for (auto& reader_thread : reader_threads_)
+      reader_thread->Flush(flush_id);
+    return;
+  }
+
   // Read all cpus in one go, limiting the per-cpu read amount to make sure we
   // don't get stuck chasing the writer if there's a very high bandwidth of
   // events.
@@ -339,6 +755,10 @@ void FtraceController::Flush(FlushRequestID flush_id) {
                                   per_cpu_buf_size_pages,
                                   started_data_sources_);
   }
+  CompleteFlush(flush_id);
+}
+
+void FtraceController::CompleteFlush(FlushRequestID flush_id) {
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
 
   for (FtraceDataSource* data_source : started_data_sources_)
@@ -353,7 +773,10 @@ void FtraceController::StopIfNeeded() {
   // ask for an explicit flush before stopping, unless it needs to perform a
   // non-graceful stop.
 
-  per_cpu_.clear();
+  PERFETTO_DCHECK(reader_threads_.empty());
+  pending_thread_flushes_.clear();
+  ClearPerCpuState();
+  UpdateBufferPercent();
   symbolizer_->Destroy();
 
   if (parsing_mem_.IsValid()) {
@@ -365,7 +788,9 @@ bool FtraceController::AddDataSource(FtraceDataSource* data_source) {
   if (!ValidConfig(data_source->config()))
     return false;
 
+  StopReaderThreads();
   auto config_id = ftrace_config_muxer_->SetupConfig(data_source->config());
+  StartIfNeeded();
   if (!config_id)
     return false;
 
@@ -383,8 +808,11 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
   FtraceConfigId config_id = data_source->config_id();
   PERFETTO_CHECK(config_id);
 
-  if (!ftrace_config_muxer_->ActivateConfig(config_id))
+  StopReaderThreads();
+  if (!ftrace_config_muxer_->ActivateConfig(config_id)) {
+    StartIfNeeded();
     return false;
+  }
 
   started_data_sources_.insert(data_source);
   StartIfNeeded();
@@ -409,12 +837,14 @@ bool FtraceController::StartDataSource(FtraceDataSource* data_source) {
 }
 
 void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
-  started_data_sources_.erase(data_source);
-  size_t removed = data_sources_.erase(data_source);
-  if (!removed)
+  if (!data_sources_.count(data_source))
     return;  // Can happen if AddDataSource failed (e.g. too many sessions).
+  StopReaderThreads();
+  started_data_sources_.erase(data_source);
+  data_sources_.erase(data_source);
   ftrace_config_muxer_->RemoveConfig(data_source->config_id());
   StopIfNeeded();
+  StartIfNeeded();
 }
 
 void FtraceController::DumpFtraceStats(FtraceStats* stats) {
@@ -428,6 +858,13 @@ void FtraceController::DumpFtraceStats(FtraceStats* stats) {
   }
 }
 
+void FtraceController::DumpRawPageFormat(
+    const FtraceDataSource* data_source,
+    protos::pbzero::FtraceEventBundle_RawPageFormat* format) {
+  CpuReader::WriteRawPageFormat(table_.get(), data_source->parsing_config(),
+                                format);
+}
+
 FtraceController::Observer::~Observer() = default;
 
 }  // namespace perfetto
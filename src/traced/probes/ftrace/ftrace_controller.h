@@ -58,11 +58,20 @@ class FtraceController {
   };
 
   // The passed Observer must outlive the returned FtraceController instance.
-  static std::unique_ptr<FtraceController> Create(base::TaskRunner*, Observer*);
+  // If |format_cache_file| is not empty, the tracefs formats the translation
+  // table is built from are kept in that file, see
+  // FtraceProcfs::LoadFormatCache().
+  static std::unique_ptr<FtraceController> Create(
+      base::TaskRunner*,
+      Observer*,
+      const std::string& format_cache_file = "");
   virtual ~FtraceController();
 
   void DisableAllEvents();
   void WriteTraceMarker(const std::string& s);
+
+  // See LazyKernelSymbolizer::set_cache_file().
+  void SetKallsymsCacheFile(std::string path);
   void ClearTrace();
 
   bool AddDataSource(FtraceDataSource*) PERFETTO_WARN_UNUSED_RESULT;
@@ -75,6 +84,11 @@ class FtraceController {
 
   void DumpFtraceStats(FtraceStats*);
 
+  // Writes the format descriptor of the raw pages of |data_source|, see
+  // FtraceConfig.raw_page_passthrough.
+  void DumpRawPageFormat(const FtraceDataSource* data_source,
+                         protos::pbzero::FtraceEventBundle_RawPageFormat*);
+
   base::WeakPtr<FtraceController> GetWeakPtr() {
     return weak_factory_.GetWeakPtr();
   }
@@ -93,11 +107,16 @@ class FtraceController {
  private:
   friend class TestFtraceController;
 
+  // Reads the ftrace buffers of a group of cpus on a dedicated thread, see
+  // FtraceConfig.reader_threads. Defined in the .cc file.
+  class ReaderThread;
+
   struct PerCpuState {
     PerCpuState(std::unique_ptr<CpuReader> _reader, size_t _period_page_quota)
         : reader(std::move(_reader)), period_page_quota(_period_page_quota) {}
     std::unique_ptr<CpuReader> reader;
     size_t period_page_quota = 0;
+    bool watched = false;  // See UpdateCpuBufferWatches().
   };
 
   FtraceController(const FtraceController&) = delete;
@@ -106,11 +125,28 @@ class FtraceController {
   // Periodic task that reads all per-cpu ftrace buffers.
   void ReadTick(int generation);
 
+  // Reads a cpu buffer which crossed the FtraceConfig.drain_buffer_percent
+  // watermark before the next ReadTick().
+  void OnCpuBufferWatermark(size_t cpu, int generation);
+  void UpdateCpuBufferWatches();
+  void UpdateBufferPercent();
+  void ClearPerCpuState();
+
   uint32_t GetDrainPeriodMs();
+  uint32_t GetDrainBufferPercent();
+  size_t GetNumReaderThreads();
 
   void StartIfNeeded();
   void StopIfNeeded();
 
+  // The reader threads are recreated (and hence stopped first) whenever the
+  // set of data sources changes, as they own a writer for each of them and the
+  // configuration changes can mutate the translation table they parse with.
+  void StartReaderThreads();
+  void StopReaderThreads();
+  void OnReaderThreadFlushed(FlushRequestID, int generation);
+  void CompleteFlush(FlushRequestID);
+
   base::TaskRunner* const task_runner_;
   Observer* const observer_;
   base::PagedMemory parsing_mem_;
@@ -120,7 +156,13 @@ class FtraceController {
   std::unique_ptr<FtraceConfigMuxer> ftrace_config_muxer_;
   int generation_ = 0;
   bool atrace_running_ = false;
+  uint32_t buffer_percent_ = 0;  // 0 if the cpu buffers aren't polled.
   std::vector<PerCpuState> per_cpu_;  // empty if tracing isn't active
+  // Empty unless tracing is active and FtraceConfig.reader_threads is set,
+  // in which case |per_cpu_| is empty instead.
+  std::vector<std::unique_ptr<ReaderThread>> reader_threads_;
+  // Flushes waiting for the reader threads, with the number of acks left.
+  std::map<FlushRequestID, size_t> pending_thread_flushes_;
   std::set<FtraceDataSource*> data_sources_;
   std::set<FtraceDataSource*> started_data_sources_;
   base::WeakPtrFactory<FtraceController> weak_factory_;  // Keep last.
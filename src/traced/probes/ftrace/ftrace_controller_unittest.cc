@@ -20,6 +20,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <chrono>
+#include <mutex>
+#include <thread>
+
 #include "perfetto/ext/base/file_utils.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
@@ -472,6 +476,96 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, ReaderThreads) {
+  auto controller =
+      CreateTestController(true /* nice procfs */, 4 /* num cpus */);
+
+  // The reader threads post the metadata and the flush acks back to the main
+  // thread, which here is the test body.
+  std::mutex mutex;
+  std::vector<std::function<void()>> main_thread_tasks;
+  ON_CALL(*controller->runner(), PostTask(_))
+      .WillByDefault(Invoke([&](std::function<void()> task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        main_thread_tasks.push_back(std::move(task));
+      }));
+
+  // Nothing is read on the main thread.
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(0);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_reader_threads(2);
+  std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
+      controller->GetWeakPtr(), 0 /* session id */, config,
+      std::unique_ptr<TraceWriter>(new TraceWriterForTesting())));
+  size_t num_writers = 0;
+  data_source->set_trace_writer_factory([&num_writers] {
+    num_writers++;
+    return std::unique_ptr<TraceWriter>(new TraceWriterForTesting());
+  });
+  ASSERT_TRUE(controller->AddDataSource(data_source.get()));
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+
+  // One writer for each of the two threads, which read two cpus each.
+  EXPECT_EQ(num_writers, 2u);
+
+  // The flush completes once both threads acked it.
+  bool flushed = false;
+  data_source->Flush(1, [&flushed] { flushed = true; });
+  for (int i = 0; i < 1000 && !flushed; i++) {
+    std::vector<std::function<void()>> tasks;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.swap(main_thread_tasks);
+    }
+    for (auto& task : tasks)
+      task();
+    if (!flushed)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(flushed);
+
+  // Joins the threads.
+  data_source.reset();
+}
+
+TEST(FtraceControllerTest, DrainOnBufferWatermark) {
+  auto controller =
+      CreateTestController(true /* nice procfs */, 2 /* num cpus */);
+  EXPECT_CALL(*controller->procfs(), WriteToFile(_, _)).Times(AnyNumber());
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_buffer_percent(30);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+
+  // Both cpu buffers are polled, on top of the periodic read task.
+  std::vector<std::function<void()>> watch_callbacks;
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", "30"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(*controller->runner(), PostDelayedTask(_, _)).Times(1);
+  EXPECT_CALL(*controller->runner(), AddFileDescriptorWatch(_, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([&](int, std::function<void()> callback) {
+        watch_callbacks.push_back(std::move(callback));
+      }));
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  Mock::VerifyAndClearExpectations(controller->runner());
+  ASSERT_EQ(watch_callbacks.size(), 2u);
+
+  // A buffer above the watermark is read straight away, and stays polled
+  // while it has quota left for the drain period.
+  EXPECT_CALL(*controller->runner(), RemoveFileDescriptorWatch(_)).Times(0);
+  watch_callbacks[1]();
+  Mock::VerifyAndClearExpectations(controller->runner());
+
+  // The watches are removed and the default watermark restored on teardown.
+  EXPECT_CALL(*controller->runner(), RemoveFileDescriptorWatch(_)).Times(2);
+  EXPECT_CALL(*controller->procfs(), WriteToFile("/root/buffer_percent", "50"))
+      .WillOnce(Return(true));
+  data_source.reset();
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.insert(std::make_pair(1, 1));
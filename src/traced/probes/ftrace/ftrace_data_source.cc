@@ -59,6 +59,12 @@ void FtraceDataSource::Start() {
   if (!ftrace)
     return;
   PERFETTO_CHECK(config_id_);  // Must be initialized at this point.
+  // The format is committed before any page is read, so that it precedes the
+  // pages in the trace buffer even when they are written by reader threads.
+  if (parsing_config_->raw_page_passthrough) {
+    WriteRawPageFormat();
+    writer_->Flush();
+  }
   if (!ftrace->StartDataSource(this))
     return;
   DumpFtraceStats(&stats_before_);
@@ -97,11 +103,23 @@ void FtraceDataSource::OnFtraceFlushComplete(FlushRequestID flush_request_id) {
   auto callback = std::move(it->second);
   pending_flushes_.erase(it);
   if (writer_) {
+    // Written again on every flush, as the one written on start might have
+    // been overwritten in a ring buffer.
+    if (parsing_config_->raw_page_passthrough)
+      WriteRawPageFormat();
     WriteStats();
     writer_->Flush(std::move(callback));
   }
 }
 
+void FtraceDataSource::WriteRawPageFormat() {
+  if (!controller_weak_)
+    return;
+  auto packet = writer_->NewTracePacket();
+  controller_weak_->DumpRawPageFormat(
+      this, packet->set_ftrace_events()->set_raw_page_format());
+}
+
 void FtraceDataSource::WriteStats() {
   {
     auto before_packet = writer_->NewTracePacket();
@@ -83,6 +83,18 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceMetadata* mutable_metadata() { return &metadata_; }
   TraceWriter* trace_writer() { return writer_.get(); }
 
+  // Sets the factory for the additional writers used by the ftrace reader
+  // threads (see FtraceConfig.reader_threads), which write into the same
+  // target buffer. Without it the data source is read on the main thread.
+  using TraceWriterFactory = std::function<std::unique_ptr<TraceWriter>()>;
+  void set_trace_writer_factory(TraceWriterFactory factory) {
+    trace_writer_factory_ = std::move(factory);
+  }
+  bool can_create_trace_writers() const { return !!trace_writer_factory_; }
+  std::unique_ptr<TraceWriter> CreateTraceWriter() {
+    return trace_writer_factory_();
+  }
+
  private:
   // Hands out internal pointers to callbacks.
   FtraceDataSource(const FtraceDataSource&) = delete;
@@ -91,12 +103,14 @@ class FtraceDataSource : public ProbesDataSource {
   FtraceDataSource& operator=(FtraceDataSource&&) = delete;
 
   void WriteStats();
+  void WriteRawPageFormat();
   void DumpFtraceStats(FtraceStats*);
 
   const FtraceConfig config_;
   FtraceMetadata metadata_;
   FtraceStats stats_before_ = {};
   std::map<FlushRequestID, std::function<void()>> pending_flushes_;
+  TraceWriterFactory trace_writer_factory_;
 
   // -- Fields initialized by the Initialize() call:
   FtraceConfigId config_id_ = 0;
@@ -16,6 +16,8 @@
 
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -27,6 +29,7 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
@@ -119,6 +122,30 @@ bool FtraceProcfs::DisableEvent(const std::string& group,
   return AppendToFile(path, "!" + group + ":" + name);
 }
 
+bool FtraceProcfs::SetEventFilter(const std::string& group,
+                                  const std::string& name,
+                                  const std::string& filter) {
+  std::string path = root_ + "events/" + group + "/" + name + "/filter";
+  // Writing "0" clears the filter.
+  return WriteToFile(path, filter.empty() ? "0" : filter);
+}
+
+bool FtraceProcfs::SetEventPids(const std::vector<int32_t>& pids) {
+  std::string path = root_ + "set_event_pid";
+  // Writes add to the list, which only truncating clears.
+  if (!ClearFile(path))
+    return false;
+  if (pids.empty())
+    return true;
+  std::string pids_str;
+  for (int32_t pid : pids) {
+    if (!pids_str.empty())
+      pids_str += " ";
+    pids_str += std::to_string(pid);
+  }
+  return WriteToFile(path, pids_str);
+}
+
 bool FtraceProcfs::DisableAllEvents() {
   std::string path = root_ + "events/enable";
   return WriteToFile(path, "0");
@@ -127,12 +154,112 @@ bool FtraceProcfs::DisableAllEvents() {
 std::string FtraceProcfs::ReadEventFormat(const std::string& group,
                                           const std::string& name) const {
   std::string path = root_ + "events/" + group + "/" + name + "/format";
-  return ReadFileIntoString(path);
+  return ReadFormatFile(path);
 }
 
 std::string FtraceProcfs::ReadPrintkFormats() const {
   std::string path = root_ + "printk_formats";
-  return ReadFileIntoString(path);
+  return ReadFormatFile(path);
+}
+
+std::string FtraceProcfs::ReadFormatFile(const std::string& path) const {
+  if (!format_cache_)
+    return ReadFileIntoString(path);
+  auto it = format_cache_->find(path);
+  if (it != format_cache_->end())
+    return it->second;
+  std::string contents = ReadFileIntoString(path);
+  // The missing events aren't recorded, they might show up later with a
+  // kernel module.
+  if (recording_formats_ && !contents.empty())
+    (*format_cache_)[path] = contents;
+  return contents;
+}
+
+// The cache file contains the cache key, NUL terminated, followed by a
+// sequence of [u32 size][path][u32 size][contents] records.
+bool FtraceProcfs::LoadFormatCache(const std::string& path,
+                                   const std::string& cache_key) {
+  format_cache_.reset(new std::map<std::string, std::string>());
+  recording_formats_ = true;
+
+  std::string data;
+  if (!base::ReadFile(path, &data))
+    return false;
+  if (data.size() <= cache_key.size() ||
+      data.compare(0, cache_key.size(), cache_key) != 0 ||
+      data[cache_key.size()] != '\0') {
+    PERFETTO_DLOG("Ignoring the stale ftrace format cache %s", path.c_str());
+    return false;
+  }
+  std::map<std::string, std::string> formats;
+  size_t offset = cache_key.size() + 1;
+  auto read_string = [&data, &offset](std::string* out) {
+    uint32_t size;
+    if (data.size() - offset < sizeof(size))
+      return false;
+    memcpy(&size, data.data() + offset, sizeof(size));
+    offset += sizeof(size);
+    if (data.size() - offset < size)
+      return false;
+    out->assign(data, offset, size);
+    offset += size;
+    return true;
+  };
+  while (offset < data.size()) {
+    std::string file_path;
+    std::string contents;
+    if (!read_string(&file_path) || !read_string(&contents)) {
+      PERFETTO_ELOG("Ignoring the invalid ftrace format cache %s",
+                    path.c_str());
+      return false;
+    }
+    formats[std::move(file_path)] = std::move(contents);
+  }
+  *format_cache_ = std::move(formats);
+  recording_formats_ = false;
+  return true;
+}
+
+void FtraceProcfs::SaveFormatCache(const std::string& path,
+                                   const std::string& cache_key) {
+  if (!format_cache_ || !recording_formats_)
+    return;
+  recording_formats_ = false;
+  std::string data = cache_key;
+  data.push_back('\0');
+  auto append_string = [&data](const std::string& str) {
+    uint32_t size = static_cast<uint32_t>(str.size());
+    data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    data.append(str);
+  };
+  for (const auto& path_and_contents : *format_cache_) {
+    append_string(path_and_contents.first);
+    append_string(path_and_contents.second);
+  }
+  // Written to a temporary file first and then renamed, so that a crash
+  // doesn't leave a truncated cache behind.
+  std::string tmp_path = path + ".tmp";
+  unlink(tmp_path.c_str());
+  base::ScopedFile fd =
+      base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (!fd || base::WriteAll(*fd, data.data(), data.size()) !=
+                 static_cast<ssize_t>(data.size())) {
+    PERFETTO_PLOG("Failed to write the ftrace format cache %s",
+                  tmp_path.c_str());
+    unlink(tmp_path.c_str());
+    return;
+  }
+  fd.reset();
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+    unlink(tmp_path.c_str());
+  }
+}
+
+void FtraceProcfs::ClearFormatCache() {
+  format_cache_.reset();
+  recording_formats_ = false;
 }
 
 std::vector<std::string> FtraceProcfs::ReadEnabledEvents() {
@@ -151,7 +278,7 @@ std::vector<std::string> FtraceProcfs::ReadEnabledEvents() {
 
 std::string FtraceProcfs::ReadPageHeaderFormat() const {
   std::string path = root_ + "events/header_page";
-  return ReadFileIntoString(path);
+  return ReadFormatFile(path);
 }
 
 std::string FtraceProcfs::ReadCpuStats(size_t cpu) const {
@@ -201,6 +328,11 @@ bool FtraceProcfs::SetCpuBufferSizeInPages(size_t pages) {
   return WriteNumberToFile(path, pages * (base::kPageSize / 1024ul));
 }
 
+bool FtraceProcfs::SetBufferPercent(uint32_t percent) {
+  std::string path = root_ + "buffer_percent";
+  return WriteNumberToFile(path, percent);
+}
+
 bool FtraceProcfs::EnableTracing() {
   KernelLogWrite("perfetto: enabled ftrace\n");
   PERFETTO_LOG("enabled ftrace in %s", root_.c_str());
@@ -17,6 +17,7 @@
 #ifndef SRC_TRACED_PROBES_FTRACE_FTRACE_PROCFS_H_
 #define SRC_TRACED_PROBES_FTRACE_FTRACE_PROCFS_H_
 
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -51,6 +52,16 @@ class FtraceProcfs {
   // Disable all events by writing to the global enable file.
   bool DisableAllEvents();
 
+  // Sets the filter expression of the event with the given |group| and
+  // |name|. An empty |filter| removes the event's filter.
+  bool SetEventFilter(const std::string& group,
+                      const std::string& name,
+                      const std::string& filter);
+
+  // Only records the events emitted by |pids|. An empty |pids| removes the
+  // restriction.
+  bool SetEventPids(const std::vector<int32_t>& pids);
+
   // Read the format for event with the given |group| and |name|.
   // virtual for testing.
   virtual std::string ReadEventFormat(const std::string& group,
@@ -61,6 +72,18 @@ class FtraceProcfs {
   // Read the printk formats file.
   std::string ReadPrintkFormats() const;
 
+  // Serves the event formats, the page header format and the printk formats
+  // from |path|, if it was written by SaveFormatCache() with the same
+  // |cache_key|. Returns false otherwise, in which case the formats read from
+  // tracefs are recorded, for SaveFormatCache().
+  bool LoadFormatCache(const std::string& path, const std::string& cache_key);
+
+  // Writes the formats recorded since LoadFormatCache() to |path|.
+  void SaveFormatCache(const std::string& path, const std::string& cache_key);
+
+  // Drops the cached formats, they are read from tracefs again afterwards.
+  void ClearFormatCache();
+
   // Read the "/per_cpu/cpuXX/stats" file for the given |cpu|.
   std::string ReadCpuStats(size_t cpu) const;
 
@@ -69,6 +92,11 @@ class FtraceProcfs {
   // by the number of CPUs.
   bool SetCpuBufferSizeInPages(size_t pages);
 
+  // Sets how full (in percent) a per-cpu buffer has to be before poll()-ing
+  // its trace_pipe_raw reports it readable. Fails on kernels older than 5.1,
+  // which don't have the buffer_percent file.
+  bool SetBufferPercent(uint32_t percent);
+
   // Returns the number of CPUs.
   // This will match the number of tracing/per_cpu/cpuXX directories.
   size_t virtual NumberOfCpus() const;
@@ -136,7 +164,15 @@ class FtraceProcfs {
 
   bool WriteNumberToFile(const std::string& path, size_t value);
 
+  // Reads |path| through |format_cache_|, if set.
+  std::string ReadFormatFile(const std::string& path) const;
+
   const std::string root_;
+
+  // The format files read through the cache, keyed by path. Mutable as the
+  // const readers record the files they read when |recording_formats_|.
+  mutable std::unique_ptr<std::map<std::string, std::string>> format_cache_;
+  bool recording_formats_ = false;
 };
 
 }  // namespace perfetto
@@ -16,8 +16,10 @@
 
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 
+#include "src/base/test/tmp_dir_tree.h"
 #include "test/gtest_and_gmock.h"
 
+using testing::_;
 using testing::AnyNumber;
 using testing::IsEmpty;
 using testing::Return;
@@ -95,5 +97,49 @@ TEST(FtraceProcfsTest, ParseAvailableClocks) {
   EXPECT_THAT(ftrace.AvailableClocks(), IsEmpty());
 }
 
+TEST(FtraceProcfsTest, FormatCache) {
+  base::TmpDirTree tree;
+  tree.AddFile("formats", "");
+  std::string path = tree.AbsolutePath("formats");
+
+  {
+    MockFtraceProcfs ftrace;
+    EXPECT_FALSE(ftrace.LoadFormatCache(path, "key"));
+    EXPECT_CALL(ftrace, ReadFileIntoString("/root/events/header_page"))
+        .WillOnce(Return("header"));
+    EXPECT_CALL(ftrace, ReadFileIntoString("/root/events/sched/foo/format"))
+        .WillOnce(Return("foo format"));
+    EXPECT_CALL(ftrace, ReadFileIntoString("/root/events/sched/bar/format"))
+        .WillOnce(Return(""));
+    EXPECT_EQ(ftrace.ReadPageHeaderFormat(), "header");
+    EXPECT_EQ(ftrace.ReadEventFormat("sched", "foo"), "foo format");
+    EXPECT_EQ(ftrace.ReadEventFormat("sched", "bar"), "");
+    ftrace.SaveFormatCache(path, "key");
+  }
+
+  {
+    MockFtraceProcfs ftrace;
+    ASSERT_TRUE(ftrace.LoadFormatCache(path, "key"));
+    // The missing events are read again.
+    EXPECT_CALL(ftrace, ReadFileIntoString("/root/events/sched/bar/format"))
+        .WillOnce(Return("bar format"));
+    EXPECT_EQ(ftrace.ReadPageHeaderFormat(), "header");
+    EXPECT_EQ(ftrace.ReadEventFormat("sched", "foo"), "foo format");
+    EXPECT_EQ(ftrace.ReadEventFormat("sched", "bar"), "bar format");
+
+    ftrace.ClearFormatCache();
+    EXPECT_CALL(ftrace, ReadFileIntoString("/root/events/header_page"))
+        .WillOnce(Return("header"));
+    EXPECT_EQ(ftrace.ReadPageHeaderFormat(), "header");
+  }
+
+  {
+    MockFtraceProcfs ftrace;
+    EXPECT_FALSE(ftrace.LoadFormatCache(path, "other key"));
+    EXPECT_CALL(ftrace, ReadFileIntoString(_)).WillOnce(Return("header"));
+    EXPECT_EQ(ftrace.ReadPageHeaderFormat(), "header");
+  }
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -31,7 +31,7 @@ namespace perfetto {
 // static
 const ProbesDataSource::Descriptor PackagesListDataSource::descriptor = {
     /*name*/ "android.packages_list",
-    /*flags*/ Descriptor::kFlagsNone,
+    /*flags*/ Descriptor::kCanRunOnWorkerThread,
 };
 
 bool ParsePackagesListStream(protos::pbzero::PackagesList* packages_list_packet,
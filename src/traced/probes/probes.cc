@@ -19,8 +19,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <string>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/getopt.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/unix_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/version.h"
@@ -39,15 +42,29 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
     OPT_VERSION,
     OPT_BACKGROUND,
     OPT_RESET_FTRACE,
+    OPT_INODE_INDEX_FILE,
+    OPT_KALLSYMS_CACHE_FILE,
+    OPT_FTRACE_FORMAT_CACHE_FILE,
+    OPT_WORKER_THREADS,
   };
 
   bool background = false;
   bool reset_ftrace = false;
+  std::string inode_index_file;
+  std::string kallsyms_cache_file;
+  std::string ftrace_format_cache_file;
+  uint32_t worker_threads = 0;
 
   static const option long_options[] = {
       {"background", no_argument, nullptr, OPT_BACKGROUND},
       {"cleanup-after-crash", no_argument, nullptr, OPT_CLEANUP_AFTER_CRASH},
       {"reset-ftrace", no_argument, nullptr, OPT_RESET_FTRACE},
+      {"inode-index-file", required_argument, nullptr, OPT_INODE_INDEX_FILE},
+      {"kallsyms-cache-file", required_argument, nullptr,
+       OPT_KALLSYMS_CACHE_FILE},
+      {"ftrace-format-cache-file", required_argument, nullptr,
+       OPT_FTRACE_FORMAT_CACHE_FILE},
+      {"worker-threads", required_argument, nullptr, OPT_WORKER_THREADS},
       {"version", no_argument, nullptr, OPT_VERSION},
       {nullptr, 0, nullptr, 0}};
 
@@ -68,6 +85,24 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
         // This is like --cleanup-after-crash but doesn't quit.
         reset_ftrace = true;
         break;
+      case OPT_INODE_INDEX_FILE:
+        inode_index_file = optarg;
+        break;
+      case OPT_KALLSYMS_CACHE_FILE:
+        kallsyms_cache_file = optarg;
+        break;
+      case OPT_FTRACE_FORMAT_CACHE_FILE:
+        ftrace_format_cache_file = optarg;
+        break;
+      case OPT_WORKER_THREADS: {
+        base::Optional<uint32_t> threads = base::CStringToUInt32(optarg);
+        if (!threads) {
+          PERFETTO_ELOG("Invalid value for --worker-threads: %s", optarg);
+          return 1;
+        }
+        worker_threads = *threads;
+        break;
+      }
       case OPT_VERSION:
         printf("%s\n", base::GetVersionString());
         return 0;
@@ -75,6 +110,8 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
         fprintf(
             stderr,
             "Usage: %s [--background] [--reset-ftrace] [--cleanup-after-crash] "
+            "[--inode-index-file=PATH] [--kallsyms-cache-file=PATH] "
+            "[--ftrace-format-cache-file=PATH] [--worker-threads=N] "
             "[--version]\n",
             argv[0]);
         return 1;
@@ -116,6 +153,10 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
 
   base::UnixTaskRunner task_runner;
   ProbesProducer producer;
+  producer.set_inode_index_file(std::move(inode_index_file));
+  producer.set_kallsyms_cache_file(std::move(kallsyms_cache_file));
+  producer.set_ftrace_format_cache_file(std::move(ftrace_format_cache_file));
+  producer.set_num_worker_threads(worker_threads);
   producer.ConnectWithRetries(GetProducerSocket(), &task_runner);
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
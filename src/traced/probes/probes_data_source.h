@@ -34,6 +34,11 @@ class ProbesDataSource {
     enum Flags : uint32_t {
       kFlagsNone = 0,
       kHandlesIncrementalState = 1 << 0,
+      // The data source doesn't share state with the main thread or with the
+      // other data sources, and can run on a worker thread with its own task
+      // runner (see ProbesProducer::set_num_worker_threads()). All its methods
+      // are then called on that thread, including its destructor.
+      kCanRunOnWorkerThread = 1 << 1,
     };
     const char* const name;
     uint32_t flags;
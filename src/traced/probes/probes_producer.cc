@@ -20,9 +20,12 @@
 #include <sys/stat.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include <queue>
 #include <string>
 
+#include "perfetto/base/flat_set.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/watchdog.h"
@@ -77,6 +80,21 @@ ProbesDataSource::Descriptor const* const kAllDataSources[]{
     &SystemInfoDataSource::descriptor,           //
     &InitialDisplayStateDataSource::descriptor,  //
 };
+
+// Waits for the tasks posted to |worker| so far to run.
+void DrainWorker(base::ThreadTaskRunner* worker) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  worker->PostTask([&mutex, &cv, &done] {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    cv.notify_one();
+  });
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&done] { return done; });
+}
+
 }  // namespace
 
 // State transition diagram:
@@ -100,6 +118,20 @@ ProbesProducer::ProbesProducer() : weak_factory_(this) {
 
 ProbesProducer::~ProbesProducer() {
   instance_ = nullptr;
+  // The data sources running on the workers are deleted there, and the
+  // workers are drained before being joined, so that none of their tasks
+  // outlives the endpoint.
+  for (auto it = data_sources_.begin(); it != data_sources_.end();) {
+    if (data_source_workers_.count(it->second.get())) {
+      DeleteDataSource(std::move(it->second));
+      it = data_sources_.erase(it);
+    } else {
+      it++;
+    }
+  }
+  for (base::ThreadTaskRunner& worker : workers_)
+    DrainWorker(&worker);
+  workers_.clear();
   // The ftrace data sources must be deleted before the ftrace controller.
   data_sources_.clear();
   ftrace_.reset();
@@ -126,6 +158,9 @@ void ProbesProducer::OnConnect() {
 
 void ProbesProducer::OnDisconnect() {
   PERFETTO_DCHECK(state_ == kConnected || state_ == kConnecting);
+  // An in-process service goes away only together with this process.
+  if (!socket_name_)
+    return;
   PERFETTO_LOG("Disconnected from tracing service");
   if (state_ == kConnected)
     return task_runner_->PostTask([this] { this->Restart(); });
@@ -144,11 +179,20 @@ void ProbesProducer::Restart() {
 
   base::TaskRunner* task_runner = task_runner_;
   const char* socket_name = socket_name_;
+  std::string inode_index_file = std::move(inode_index_file_);
+  std::string kallsyms_cache_file = std::move(kallsyms_cache_file_);
+  std::string ftrace_format_cache_file = std::move(ftrace_format_cache_file_);
+  uint32_t num_worker_threads = num_worker_threads_;
 
   // Invoke destructor and then the constructor again.
   this->~ProbesProducer();
   new (this) ProbesProducer();
 
+  set_inode_index_file(std::move(inode_index_file));
+  set_kallsyms_cache_file(std::move(kallsyms_cache_file));
+  set_ftrace_format_cache_file(std::move(ftrace_format_cache_file));
+  set_num_worker_threads(num_worker_threads);
+
   ConnectWithRetries(socket_name, task_runner);
 }
 
@@ -160,19 +204,32 @@ void ProbesProducer::SetupDataSource(DataSourceInstanceID instance_id,
   TracingSessionID session_id = config.tracing_session_id();
   PERFETTO_CHECK(session_id > 0);
 
+  base::ThreadTaskRunner* worker = nullptr;
+  for (const ProbesDataSource::Descriptor* desc : kAllDataSources) {
+    using Flags = ProbesDataSource::Descriptor::Flags;
+    if (config.name() == desc->name &&
+        (desc->flags & Flags::kCanRunOnWorkerThread)) {
+      worker = GetNextWorker();
+    }
+  }
+  base::TaskRunner* ds_task_runner =
+      worker ? static_cast<base::TaskRunner*>(worker) : task_runner_;
+
   std::unique_ptr<ProbesDataSource> data_source;
   if (config.name() == FtraceDataSource::descriptor.name) {
     data_source = CreateFtraceDataSource(session_id, config);
   } else if (config.name() == InodeFileDataSource::descriptor.name) {
     data_source = CreateInodeFileDataSource(session_id, config);
   } else if (config.name() == ProcessStatsDataSource::descriptor.name) {
-    data_source = CreateProcessStatsDataSource(session_id, config);
+    data_source =
+        CreateProcessStatsDataSource(session_id, config, ds_task_runner);
   } else if (config.name() == SysStatsDataSource::descriptor.name) {
-    data_source = CreateSysStatsDataSource(session_id, config);
+    data_source = CreateSysStatsDataSource(session_id, config, ds_task_runner);
   } else if (config.name() == AndroidPowerDataSource::descriptor.name) {
     data_source = CreateAndroidPowerDataSource(session_id, config);
   } else if (config.name() == AndroidLogDataSource::descriptor.name) {
-    data_source = CreateAndroidLogDataSource(session_id, config);
+    data_source =
+        CreateAndroidLogDataSource(session_id, config, ds_task_runner);
   } else if (config.name() == PackagesListDataSource::descriptor.name) {
     data_source = CreatePackagesListDataSource(session_id, config);
   } else if (config.name() == MetatraceDataSource::descriptor.name) {
@@ -188,6 +245,8 @@ void ProbesProducer::SetupDataSource(DataSourceInstanceID instance_id,
     return;
   }
 
+  if (worker)
+    data_source_workers_.emplace(data_source.get(), worker);
   session_data_sources_.emplace(session_id, data_source.get());
   data_sources_[instance_id] = std::move(data_source);
 }
@@ -211,7 +270,7 @@ void ProbesProducer::StartDataSource(DataSourceInstanceID instance_id,
         instance_id, base::Watchdog::GetInstance()->CreateFatalTimer(timeout));
   }
   data_source->started = true;
-  data_source->Start();
+  RunOnDataSourceThread(data_source, [data_source] { data_source->Start(); });
   endpoint_->NotifyDataSourceStarted(instance_id);
 }
 
@@ -226,7 +285,8 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateFtraceDataSource(
 
   // Lazily create on the first instance.
   if (!ftrace_) {
-    ftrace_ = FtraceController::Create(task_runner_, this);
+    ftrace_ =
+        FtraceController::Create(task_runner_, this, ftrace_format_cache_file_);
 
     if (!ftrace_) {
       PERFETTO_ELOG("Failed to create FtraceController");
@@ -236,6 +296,8 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateFtraceDataSource(
 
     ftrace_->DisableAllEvents();
     ftrace_->ClearTrace();
+    if (!kallsyms_cache_file_.empty())
+      ftrace_->SetKallsymsCacheFile(kallsyms_cache_file_);
   }
 
   PERFETTO_LOG("Ftrace setup (target_buf=%" PRIu32 ")", config.target_buffer());
@@ -245,6 +307,8 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateFtraceDataSource(
   std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
       ftrace_->GetWeakPtr(), session_id, std::move(ftrace_config),
       endpoint_->CreateTraceWriter(buffer_id)));
+  data_source->set_trace_writer_factory(
+      [this, buffer_id] { return endpoint_->CreateTraceWriter(buffer_id); });
   if (!ftrace_->AddDataSource(data_source.get())) {
     PERFETTO_ELOG("Failed to setup ftrace");
     return nullptr;
@@ -260,17 +324,30 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateInodeFileDataSource(
   auto buffer_id = static_cast<BufferID>(source_config.target_buffer());
   if (system_inodes_.empty())
     CreateStaticDeviceToInodeMap("/system", &system_inodes_);
-  return std::unique_ptr<InodeFileDataSource>(new InodeFileDataSource(
+  if (!inode_index_file_.empty() && !inode_index_) {
+    inode_index_.reset(new InodeIndex(inode_index_file_));
+    inode_index_->Load();
+    inode_index_watcher_ =
+        InodeIndexWatcher::Create(task_runner_, inode_index_.get());
+  }
+  // Also watches the directories of the inodes resolved by the scans of the
+  // previous sessions.
+  if (inode_index_watcher_)
+    inode_index_watcher_->WatchIndexedDirectories();
+  std::unique_ptr<InodeFileDataSource> data_source(new InodeFileDataSource(
       std::move(source_config), task_runner_, session_id, &system_inodes_,
       &cache_, endpoint_->CreateTraceWriter(buffer_id)));
+  data_source->set_inode_index(inode_index_.get());
+  return std::unique_ptr<ProbesDataSource>(std::move(data_source));
 }
 
 std::unique_ptr<ProbesDataSource> ProbesProducer::CreateProcessStatsDataSource(
     TracingSessionID session_id,
-    const DataSourceConfig& config) {
+    const DataSourceConfig& config,
+    base::TaskRunner* task_runner) {
   auto buffer_id = static_cast<BufferID>(config.target_buffer());
   return std::unique_ptr<ProcessStatsDataSource>(new ProcessStatsDataSource(
-      task_runner_, session_id, endpoint_->CreateTraceWriter(buffer_id), config,
+      task_runner, session_id, endpoint_->CreateTraceWriter(buffer_id), config,
       std::unique_ptr<CpuFreqInfo>(new CpuFreqInfo())));
 }
 
@@ -285,10 +362,11 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreateAndroidPowerDataSource(
 
 std::unique_ptr<ProbesDataSource> ProbesProducer::CreateAndroidLogDataSource(
     TracingSessionID session_id,
-    const DataSourceConfig& config) {
+    const DataSourceConfig& config,
+    base::TaskRunner* task_runner) {
   auto buffer_id = static_cast<BufferID>(config.target_buffer());
   return std::unique_ptr<ProbesDataSource>(
-      new AndroidLogDataSource(config, task_runner_, session_id,
+      new AndroidLogDataSource(config, task_runner, session_id,
                                endpoint_->CreateTraceWriter(buffer_id)));
 }
 
@@ -302,10 +380,11 @@ std::unique_ptr<ProbesDataSource> ProbesProducer::CreatePackagesListDataSource(
 
 std::unique_ptr<ProbesDataSource> ProbesProducer::CreateSysStatsDataSource(
     TracingSessionID session_id,
-    const DataSourceConfig& config) {
+    const DataSourceConfig& config,
+    base::TaskRunner* task_runner) {
   auto buffer_id = static_cast<BufferID>(config.target_buffer());
   return std::unique_ptr<SysStatsDataSource>(
-      new SysStatsDataSource(task_runner_, session_id,
+      new SysStatsDataSource(task_runner, session_id,
                              endpoint_->CreateTraceWriter(buffer_id), config));
 }
 
@@ -361,6 +440,7 @@ void ProbesProducer::StopDataSource(DataSourceInstanceID id) {
     session_data_sources_.erase(kv);
     break;
   }
+  DeleteDataSource(std::move(it->second));
   data_sources_.erase(it);
   watchdogs_.erase(id);
 }
@@ -389,11 +469,19 @@ void ProbesProducer::Flush(FlushRequestID flush_request_id,
       continue;
     pending_flushes_.emplace(flush_request_id, ds_id);
     flush_queued = true;
-    auto flush_callback = [weak_this, flush_request_id, ds_id] {
-      if (weak_this)
-        weak_this->OnDataSourceFlushComplete(flush_request_id, ds_id);
+    base::TaskRunner* task_runner = task_runner_;
+    // Can be invoked on a worker thread.
+    auto flush_callback = [task_runner, weak_this, flush_request_id, ds_id] {
+      task_runner->PostTask([weak_this, flush_request_id, ds_id] {
+        if (weak_this)
+          weak_this->OnDataSourceFlushComplete(flush_request_id, ds_id);
+      });
     };
-    it->second->Flush(flush_request_id, flush_callback);
+    ProbesDataSource* data_source = it->second.get();
+    auto flush = [data_source, flush_request_id, flush_callback] {
+      data_source->Flush(flush_request_id, flush_callback);
+    };
+    RunOnDataSourceThread(data_source, flush);
   }
 
   // If there is nothing to flush, ack immediately.
@@ -447,7 +535,10 @@ void ProbesProducer::ClearIncrementalState(
     if (it == data_sources_.end() || !it->second->started)
       continue;
 
-    it->second->ClearIncrementalState();
+    ProbesDataSource* data_source = it->second.get();
+    RunOnDataSourceThread(data_source, [data_source] {
+      data_source->ClearIncrementalState();
+    });
   }
 }
 
@@ -474,10 +565,25 @@ void ProbesProducer::OnFtraceDataWrittenIntoDataSourceBuffers() {
         inode_data_source->OnInodes(metadata->inode_and_device);
       // Ordering the rename pids before the seen pids is important so that any
       // renamed processes get scraped in the OnPids call.
-      if (has_rename_pids && ps_data_source)
-        ps_data_source->OnRenamePids(metadata->rename_pids);
-      if (has_pids && ps_data_source)
-        ps_data_source->OnPids(metadata->pids);
+      if ((has_rename_pids || has_pids) && ps_data_source) {
+        if (data_source_workers_.count(ps_data_source)) {
+          // The metadata is cleared below: pass a copy to the worker.
+          base::FlatSet<int32_t> rename_pids = metadata->rename_pids;
+          base::FlatSet<int32_t> pids = metadata->pids;
+          auto on_pids = [ps_data_source, rename_pids, pids] {
+            if (!rename_pids.empty())
+              ps_data_source->OnRenamePids(rename_pids);
+            if (!pids.empty())
+              ps_data_source->OnPids(pids);
+          };
+          RunOnDataSourceThread(ps_data_source, on_pids);
+        } else {
+          if (has_rename_pids)
+            ps_data_source->OnRenamePids(metadata->rename_pids);
+          if (has_pids)
+            ps_data_source->OnPids(metadata->pids);
+        }
+      }
       if (metadata)
         metadata->Clear();
       metadata = nullptr;
@@ -501,13 +607,53 @@ void ProbesProducer::OnFtraceDataWrittenIntoDataSourceBuffers() {
       // targeting a dedicated buffer) and another one for on-demand dumps
       // targeting the main buffer.
       // Only use the one that has on-demand dumps enabled, if any.
+      // The proc connector of the ones running on a worker is set up there:
+      // OnPids() checks again whether on-demand dumps are enabled.
       auto ps = static_cast<ProcessStatsDataSource*>(ds);
-      if (ps->on_demand_dumps_enabled())
+      bool on_demand_dumps = data_source_workers_.count(ps)
+                                 ? ps->on_demand_dumps_configured()
+                                 : ps->on_demand_dumps_enabled();
+      if (on_demand_dumps)
         ps_data_source = ps;
     }
   }  // for (session_data_sources_)
 }
 
+base::ThreadTaskRunner* ProbesProducer::GetNextWorker() {
+  if (num_worker_threads_ == 0)
+    return nullptr;
+  if (workers_.empty()) {
+    workers_.reserve(num_worker_threads_);
+    for (uint32_t i = 0; i < num_worker_threads_; i++)
+      workers_.emplace_back(base::ThreadTaskRunner::CreateAndStart("probes"));
+  }
+  base::ThreadTaskRunner* worker = &workers_[next_worker_];
+  next_worker_ = (next_worker_ + 1) % workers_.size();
+  return worker;
+}
+
+void ProbesProducer::RunOnDataSourceThread(ProbesDataSource* data_source,
+                                           std::function<void()> fn) {
+  auto it = data_source_workers_.find(data_source);
+  if (it == data_source_workers_.end()) {
+    fn();
+    return;
+  }
+  it->second->PostTask(std::move(fn));
+}
+
+void ProbesProducer::DeleteDataSource(
+    std::unique_ptr<ProbesDataSource> data_source) {
+  auto it = data_source_workers_.find(data_source.get());
+  if (it == data_source_workers_.end())
+    return;  // Deleted on return.
+  // The tasks posted by the main thread for the data source run before this
+  // one, and the ones it posted itself use weak pointers.
+  ProbesDataSource* raw_data_source = data_source.release();
+  it->second->PostTask([raw_data_source] { delete raw_data_source; });
+  data_source_workers_.erase(it);
+}
+
 void ProbesProducer::ConnectWithRetries(const char* socket_name,
                                         base::TaskRunner* task_runner) {
   PERFETTO_DCHECK(state_ == kNotStarted);
@@ -519,6 +665,18 @@ void ProbesProducer::ConnectWithRetries(const char* socket_name,
   Connect();
 }
 
+void ProbesProducer::ConnectInProcess(TracingService* service,
+                                      base::TaskRunner* task_runner) {
+  PERFETTO_DCHECK(state_ == kNotStarted);
+  state_ = kConnecting;
+  task_runner_ = task_runner;
+  endpoint_ = service->ConnectProducer(
+      this, base::GetCurrentUserId(), "perfetto.traced_probes",
+      kTracingSharedMemSizeHintBytes, /*in_process=*/true,
+      TracingService::ProducerSMBScrapingMode::kDisabled,
+      kTracingSharedMemPageSizeHintBytes);
+}
+
 void ProbesProducer::Connect() {
   PERFETTO_DCHECK(state_ == kNotConnected);
   state_ = kConnecting;
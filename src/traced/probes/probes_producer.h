@@ -17,17 +17,22 @@
 #ifndef SRC_TRACED_PROBES_PROBES_PRODUCER_H_
 #define SRC_TRACED_PROBES_PROBES_PRODUCER_H_
 
+#include <functional>
 #include <memory>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/watchdog.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/producer.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/ext/tracing/core/tracing_service.h"
 #include "src/traced/probes/filesystem/inode_file_data_source.h"
+#include "src/traced/probes/filesystem/inode_index.h"
+#include "src/traced/probes/filesystem/inode_index_watcher.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
 
@@ -65,18 +70,23 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
   // Our Impl
   void ConnectWithRetries(const char* socket_name,
                           base::TaskRunner* task_runner);
+  // Connects to |service|, a tracing service running on |task_runner| in this
+  // same process, rather than to traced over IPC. See tracebox --all-in-one.
+  void ConnectInProcess(TracingService* service, base::TaskRunner* task_runner);
   std::unique_ptr<ProbesDataSource> CreateFtraceDataSource(
       TracingSessionID session_id,
       const DataSourceConfig& config);
   std::unique_ptr<ProbesDataSource> CreateProcessStatsDataSource(
       TracingSessionID session_id,
-      const DataSourceConfig& config);
+      const DataSourceConfig& config,
+      base::TaskRunner* task_runner);
   std::unique_ptr<ProbesDataSource> CreateInodeFileDataSource(
       TracingSessionID session_id,
       DataSourceConfig config);
   std::unique_ptr<ProbesDataSource> CreateSysStatsDataSource(
       TracingSessionID session_id,
-      const DataSourceConfig& config);
+      const DataSourceConfig& config,
+      base::TaskRunner* task_runner);
   std::unique_ptr<ProbesDataSource> CreateAndroidPowerDataSource(
       TracingSessionID session_id,
       const DataSourceConfig& config);
@@ -85,7 +95,8 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
       const DataSourceConfig& config);
   std::unique_ptr<ProbesDataSource> CreateAndroidLogDataSource(
       TracingSessionID session_id,
-      const DataSourceConfig& config);
+      const DataSourceConfig& config,
+      base::TaskRunner* task_runner);
   std::unique_ptr<ProbesDataSource> CreatePackagesListDataSource(
       TracingSessionID session_id,
       const DataSourceConfig& config);
@@ -100,6 +111,34 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
       const DataSourceConfig& config);
   void ActivateTrigger(std::string trigger);
 
+  // If set, the inodes resolved by the inode file data sources are persisted
+  // in this file across tracing sessions and restarts, and kept up to date
+  // with the changes of the filesystem (see InodeIndexWatcher).
+  void set_inode_index_file(std::string path) {
+    inode_index_file_ = std::move(path);
+  }
+
+  // If set, the kernel symbol map is kept in this file across tracing sessions
+  // and restarts. See LazyKernelSymbolizer::set_cache_file().
+  void set_kallsyms_cache_file(std::string path) {
+    kallsyms_cache_file_ = std::move(path);
+  }
+
+  // If set, the tracefs event formats are kept in this file across restarts.
+  // See FtraceController::Create().
+  void set_ftrace_format_cache_file(std::string path) {
+    ftrace_format_cache_file_ = std::move(path);
+  }
+
+  // If not 0, the data sources with the kCanRunOnWorkerThread flag run on a
+  // pool of this many worker threads, assigned round-robin, rather than on
+  // the main thread. This way a slow data source, e.g. a large /proc scan,
+  // doesn't delay the ftrace reads, which stay on the main thread with the
+  // IPC. Must be called before connecting.
+  void set_num_worker_threads(uint32_t num_worker_threads) {
+    num_worker_threads_ = num_worker_threads;
+  }
+
  private:
   static ProbesProducer* instance_;
 
@@ -120,6 +159,18 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
   void OnDataSourceFlushComplete(FlushRequestID, DataSourceInstanceID);
   void OnFlushTimeout(FlushRequestID);
 
+  // Returns the worker for the next data source with the
+  // kCanRunOnWorkerThread flag, or nullptr if there are no worker threads.
+  base::ThreadTaskRunner* GetNextWorker();
+
+  // Runs |fn| on the thread of |data_source|: synchronously if it runs on the
+  // main thread, in a task posted to its worker otherwise.
+  void RunOnDataSourceThread(ProbesDataSource* data_source,
+                             std::function<void()> fn);
+
+  // Deletes |data_source| on its thread.
+  void DeleteDataSource(std::unique_ptr<ProbesDataSource> data_source);
+
   State state_ = kNotStarted;
   base::TaskRunner* task_runner_ = nullptr;
   std::unique_ptr<TracingService::ProducerEndpoint> endpoint_;
@@ -143,6 +194,20 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
   LRUInodeCache cache_{kLRUInodeCacheSize};
   std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>
       system_inodes_;
+  std::string inode_index_file_;
+  std::string kallsyms_cache_file_;
+  std::string ftrace_format_cache_file_;
+  std::unique_ptr<InodeIndex> inode_index_;
+  std::unique_ptr<InodeIndexWatcher> inode_index_watcher_;
+
+  uint32_t num_worker_threads_ = 0;
+  // Created all at once on the first use, so that the pointers to them stay
+  // valid.
+  std::vector<base::ThreadTaskRunner> workers_;
+  size_t next_worker_ = 0;
+  // The worker of each data source which doesn't run on the main thread.
+  std::unordered_map<const ProbesDataSource*, base::ThreadTaskRunner*>
+      data_source_workers_;
 
   base::WeakPtrFactory<ProbesProducer> weak_factory_;  // Keep last.
 };
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <errno.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/utils.h"
+
+namespace perfetto {
+
+namespace {
+
+// Large enough for the datagrams of the proc connector, which contain a
+// single event each.
+constexpr size_t kBufSize = 4096;
+
+// Don't hold the task runner for too long in case of fork storms, read the
+// remaining datagrams in another task.
+constexpr size_t kMaxDatagramsPerTask = 500;
+
+constexpr size_t kEventDataOffset = offsetof(struct proc_event, event_data);
+
+}  // namespace
+
+ProcConnector::Delegate::~Delegate() = default;
+
+// static
+std::unique_ptr<ProcConnector> ProcConnector::Create(
+    base::TaskRunner* task_runner,
+    Delegate* delegate) {
+  base::ScopedFile sock(socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                               NETLINK_CONNECTOR));
+  if (!sock) {
+    PERFETTO_PLOG("Failed to create the proc connector socket");
+    return nullptr;
+  }
+  struct sockaddr_nl addr {};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(*sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) {
+    PERFETTO_PLOG("Failed to bind the proc connector socket");
+    return nullptr;
+  }
+  std::unique_ptr<ProcConnector> connector(
+      new ProcConnector(task_runner, delegate, std::move(sock)));
+  if (!connector->SetListening(true))
+    return nullptr;
+  return connector;
+}
+
+ProcConnector::ProcConnector(base::TaskRunner* task_runner,
+                             Delegate* delegate,
+                             base::ScopedFile sock)
+    : task_runner_(task_runner),
+      delegate_(delegate),
+      sock_(std::move(sock)),
+      buf_(base::PagedMemory::Allocate(kBufSize)),
+      weak_factory_(this) {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->AddFileDescriptorWatch(*sock_, [weak_this] {
+    if (weak_this)
+      weak_this->OnSocketDataAvailable();
+  });
+}
+
+ProcConnector::~ProcConnector() {
+  task_runner_->RemoveFileDescriptorWatch(*sock_);
+  SetListening(false);
+}
+
+bool ProcConnector::SetListening(bool listen) {
+  alignas(struct nlmsghdr) uint8_t
+      buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+  auto* hdr = reinterpret_cast<struct nlmsghdr*>(buf);
+  hdr->nlmsg_len = static_cast<uint32_t>(
+      NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(proc_cn_mcast_op)));
+  hdr->nlmsg_type = NLMSG_DONE;
+  auto* msg = reinterpret_cast<struct cn_msg*>(NLMSG_DATA(hdr));
+  msg->id.idx = CN_IDX_PROC;
+  msg->id.val = CN_VAL_PROC;
+  msg->len = sizeof(proc_cn_mcast_op);
+  proc_cn_mcast_op op = listen ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+  memcpy(msg->data, &op, sizeof(op));
+  if (PERFETTO_EINTR(send(*sock_, buf, hdr->nlmsg_len, 0)) < 0) {
+    PERFETTO_PLOG("Failed to %s the proc connector",
+                  listen ? "subscribe to" : "unsubscribe from");
+    return false;
+  }
+  return true;
+}
+
+void ProcConnector::OnSocketDataAvailable() {
+  uint8_t* buf = static_cast<uint8_t*>(buf_.Get());
+  for (size_t i = 0; i < kMaxDatagramsPerTask; i++) {
+    struct sockaddr_nl addr {};
+    socklen_t addr_len = sizeof(addr);
+    ssize_t rsize = PERFETTO_EINTR(
+        recvfrom(*sock_, buf, kBufSize, MSG_DONTWAIT,
+                 reinterpret_cast<struct sockaddr*>(&addr), &addr_len));
+    if (rsize < 0) {
+      // ENOBUFS means that the socket buffer overflowed and some events were
+      // lost, the following ones can still be read.
+      if (errno == ENOBUFS) {
+        PERFETTO_ELOG("Proc connector events lost");
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        PERFETTO_PLOG("Failed to read from the proc connector");
+      return;
+    }
+    // Only trust the kernel.
+    if (addr.nl_pid != 0)
+      continue;
+    ParseDatagram(buf, static_cast<size_t>(rsize), delegate_);
+  }
+  // The fd watch fires again if there is data left.
+}
+
+// static
+void ProcConnector::ParseDatagram(const uint8_t* buf,
+                                  size_t size,
+                                  Delegate* delegate) {
+  size_t offset = 0;
+  while (size - offset >= sizeof(struct nlmsghdr)) {
+    struct nlmsghdr hdr;
+    memcpy(&hdr, buf + offset, sizeof(hdr));
+    if (hdr.nlmsg_len < sizeof(hdr) || hdr.nlmsg_len > size - offset)
+      return;
+    const uint8_t* payload = buf + offset + NLMSG_HDRLEN;
+    const size_t payload_size = hdr.nlmsg_len - NLMSG_HDRLEN;
+    offset += std::min(static_cast<size_t>(NLMSG_ALIGN(hdr.nlmsg_len)),
+                       size - offset);
+
+    if (hdr.nlmsg_type == NLMSG_ERROR || hdr.nlmsg_type == NLMSG_NOOP ||
+        hdr.nlmsg_type == NLMSG_OVERRUN) {
+      continue;
+    }
+    struct cn_msg msg;
+    if (payload_size < sizeof(msg))
+      continue;
+    memcpy(&msg, payload, sizeof(msg));
+    if (msg.id.idx != CN_IDX_PROC || msg.id.val != CN_VAL_PROC ||
+        msg.len > payload_size - sizeof(msg)) {
+      continue;
+    }
+
+    // Older kernels have smaller events: copy the available part and check
+    // that it covers the fields of the event type.
+    struct proc_event event {};
+    memcpy(&event, payload + sizeof(msg),
+           std::min(static_cast<size_t>(msg.len), sizeof(event)));
+    auto has_data = [&msg](size_t data_size) {
+      return msg.len >= kEventDataOffset + data_size;
+    };
+    switch (event.what) {
+      case proc_event::PROC_EVENT_FORK: {
+        const auto& fork = event.event_data.fork;
+        if (has_data(sizeof(fork))) {
+          delegate->OnProcessFork(fork.parent_tgid, fork.child_pid,
+                                  fork.child_tgid);
+        }
+        break;
+      }
+      case proc_event::PROC_EVENT_EXEC: {
+        const auto& exec = event.event_data.exec;
+        if (has_data(sizeof(exec)))
+          delegate->OnProcessExec(exec.process_pid, exec.process_tgid);
+        break;
+      }
+      case proc_event::PROC_EVENT_COMM: {
+        const auto& comm = event.event_data.comm;
+        if (has_data(sizeof(comm))) {
+          char name[sizeof(comm.comm) + 1] = {};
+          memcpy(name, comm.comm, sizeof(comm.comm));
+          delegate->OnProcessComm(comm.process_pid, comm.process_tgid, name);
+        }
+        break;
+      }
+      case proc_event::PROC_EVENT_EXIT: {
+        // Only the first fields, present on all kernels, are needed.
+        const auto& exit = event.event_data.exit;
+        if (has_data(sizeof(exit.process_pid) + sizeof(exit.process_tgid)))
+          delegate->OnProcessExit(exit.process_pid, exit.process_tgid);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+}  // namespace perfetto
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+#define SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/weak_ptr.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}
+
+// Receives the process lifecycle events of the kernel proc connector
+// (CONFIG_PROC_EVENTS) from a NETLINK_CONNECTOR socket, which requires
+// CAP_NET_ADMIN. Unlike the ftrace events, these come with the pids and
+// tgids of the processes involved, so that most of them don't need a /proc
+// lookup at all.
+class ProcConnector {
+ public:
+  // As in the kernel, |pid| is the thread id and |tgid| the process id.
+  class Delegate {
+   public:
+    virtual ~Delegate();
+    virtual void OnProcessFork(int32_t parent_tgid,
+                               int32_t pid,
+                               int32_t tgid) = 0;
+    virtual void OnProcessExec(int32_t pid, int32_t tgid) = 0;
+    virtual void OnProcessComm(int32_t pid,
+                               int32_t tgid,
+                               const char* comm) = 0;
+    virtual void OnProcessExit(int32_t pid, int32_t tgid) = 0;
+  };
+
+  // Returns nullptr if the proc connector isn't available, e.g. because of
+  // missing permissions.
+  static std::unique_ptr<ProcConnector> Create(base::TaskRunner*, Delegate*);
+
+  ~ProcConnector();
+
+  // Dispatches to |delegate| the events of |buf|, a datagram received from
+  // the socket. Ignores the malformed and unknown messages.
+  static void ParseDatagram(const uint8_t* buf, size_t size, Delegate*);
+
+ private:
+  ProcConnector(base::TaskRunner*, Delegate*, base::ScopedFile sock);
+  ProcConnector(const ProcConnector&) = delete;
+  ProcConnector& operator=(const ProcConnector&) = delete;
+
+  bool SetListening(bool listen);
+  void OnSocketDataAvailable();
+
+  base::TaskRunner* const task_runner_;
+  Delegate* const delegate_;
+  base::ScopedFile sock_;
+  base::PagedMemory buf_;
+
+  base::WeakPtrFactory<ProcConnector> weak_factory_;  // Keep last.
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <string.h>
+
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+using ::testing::InSequence;
+using ::testing::StrEq;
+using ::testing::_;
+
+namespace perfetto {
+namespace {
+
+class MockDelegate : public ProcConnector::Delegate {
+ public:
+  MOCK_METHOD3(OnProcessFork,
+               void(int32_t parent_tgid, int32_t pid, int32_t tgid));
+  MOCK_METHOD2(OnProcessExec, void(int32_t pid, int32_t tgid));
+  MOCK_METHOD3(OnProcessComm,
+               void(int32_t pid, int32_t tgid, const char* comm));
+  MOCK_METHOD2(OnProcessExit, void(int32_t pid, int32_t tgid));
+};
+
+// Appends a netlink message carrying |event| to |buf|, with the event
+// truncated to |event_size| bytes.
+void AppendEvent(const proc_event& event,
+                 size_t event_size,
+                 std::vector<uint8_t>* buf) {
+  const size_t len = NLMSG_LENGTH(sizeof(cn_msg) + event_size);
+  const size_t offset = buf->size();
+  buf->resize(offset + NLMSG_ALIGN(len));
+
+  nlmsghdr hdr{};
+  hdr.nlmsg_len = static_cast<uint32_t>(len);
+  hdr.nlmsg_type = NLMSG_DONE;
+  memcpy(&(*buf)[offset], &hdr, sizeof(hdr));
+
+  cn_msg msg{};
+  msg.id.idx = CN_IDX_PROC;
+  msg.id.val = CN_VAL_PROC;
+  msg.len = static_cast<uint16_t>(event_size);
+  memcpy(&(*buf)[offset + NLMSG_HDRLEN], &msg, sizeof(msg));
+  memcpy(&(*buf)[offset + NLMSG_HDRLEN + sizeof(msg)], &event, event_size);
+}
+
+void AppendEvent(const proc_event& event, std::vector<uint8_t>* buf) {
+  AppendEvent(event, sizeof(event), buf);
+}
+
+TEST(ProcConnectorTest, ParseEvents) {
+  std::vector<uint8_t> buf;
+  proc_event event{};
+  event.what = proc_event::PROC_EVENT_FORK;
+  event.event_data.fork.parent_pid = 10;
+  event.event_data.fork.parent_tgid = 1;
+  event.event_data.fork.child_pid = 42;
+  event.event_data.fork.child_tgid = 42;
+  AppendEvent(event, &buf);
+
+  event = proc_event{};
+  event.what = proc_event::PROC_EVENT_EXEC;
+  event.event_data.exec.process_pid = 42;
+  event.event_data.exec.process_tgid = 42;
+  AppendEvent(event, &buf);
+
+  event = proc_event{};
+  event.what = proc_event::PROC_EVENT_COMM;
+  event.event_data.comm.process_pid = 43;
+  event.event_data.comm.process_tgid = 42;
+  // Not null terminated.
+  memcpy(event.event_data.comm.comm, "0123456789abcdef", 16);
+  AppendEvent(event, &buf);
+
+  event = proc_event{};
+  event.what = proc_event::PROC_EVENT_EXIT;
+  event.event_data.exit.process_pid = 42;
+  event.event_data.exit.process_tgid = 42;
+  AppendEvent(event, &buf);
+
+  MockDelegate delegate;
+  InSequence seq;
+  EXPECT_CALL(delegate, OnProcessFork(1, 42, 42));
+  EXPECT_CALL(delegate, OnProcessExec(42, 42));
+  EXPECT_CALL(delegate, OnProcessComm(43, 42, StrEq("0123456789abcdef")));
+  EXPECT_CALL(delegate, OnProcessExit(42, 42));
+  ProcConnector::ParseDatagram(buf.data(), buf.size(), &delegate);
+}
+
+TEST(ProcConnectorTest, IgnoreMalformedEvents) {
+  const size_t kEventDataOffset = offsetof(proc_event, event_data);
+  std::vector<uint8_t> buf;
+
+  // Too short for the fork fields.
+  proc_event event{};
+  event.what = proc_event::PROC_EVENT_FORK;
+  AppendEvent(event, kEventDataOffset + 4, &buf);
+
+  // Unknown event type.
+  event = proc_event{};
+  event.what = proc_event::PROC_EVENT_UID;
+  AppendEvent(event, &buf);
+
+  // An exit event of an older kernel, without the parent fields.
+  event = proc_event{};
+  event.what = proc_event::PROC_EVENT_EXIT;
+  event.event_data.exit.process_pid = 7;
+  event.event_data.exit.process_tgid = 5;
+  AppendEvent(event, kEventDataOffset + 16, &buf);
+
+  // A message whose length exceeds the datagram.
+  std::vector<uint8_t> truncated;
+  AppendEvent(event, &truncated);
+  truncated.resize(truncated.size() - 8);
+  buf.insert(buf.end(), truncated.begin(), truncated.end());
+
+  MockDelegate delegate;
+  EXPECT_CALL(delegate, OnProcessFork(_, _, _)).Times(0);
+  EXPECT_CALL(delegate, OnProcessExit(7, 5));
+  ProcConnector::ParseDatagram(buf.data(), buf.size(), &delegate);
+}
+
+}  // namespace
+}  // namespace perfetto
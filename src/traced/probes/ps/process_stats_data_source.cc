@@ -16,7 +16,10 @@
 
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <utility>
@@ -54,6 +57,13 @@ namespace {
 // was provided in the config. The cache is trimmed if it exceeds this size.
 const size_t kThreadTimeInStateCacheSize = 10000;
 
+// The fds cached per process by GetCachedProcPidFile().
+const size_t kFdsPerCachedProc = 4;
+
+// Upper bound on the number of processes whose files are kept open across
+// polls, when RLIMIT_NOFILE is unlimited.
+const size_t kMaxCachedProcs = 16384;
+
 int32_t ReadNextNumericDir(DIR* dirp) {
   while (struct dirent* dir_ent = readdir(dirp)) {
     if (dir_ent->d_type != DT_DIR)
@@ -73,12 +83,36 @@ inline uint32_t ToU32(const char* str) {
   return static_cast<uint32_t>(strtol(str, nullptr, 10));
 }
 
+// Reads the whole file from the start, as procfs regenerates the contents
+// on every read at offset 0. Returns false if the read fails, e.g. because
+// the process died.
+bool PreadWholeFile(int fd, std::string* out) {
+  out->resize(4096);
+  size_t size = 0;
+  for (;;) {
+    if (out->size() - size < 1024)
+      out->resize(out->size() * 2);
+    ssize_t rsize = PERFETTO_EINTR(pread(fd, &(*out)[size], out->size() - size,
+                                         static_cast<off_t>(size)));
+    if (rsize < 0) {
+      out->clear();
+      return false;
+    }
+    if (rsize == 0)
+      break;
+    size += static_cast<size_t>(rsize);
+  }
+  out->resize(size);
+  return true;
+}
+
 }  // namespace
 
 // static
 const ProbesDataSource::Descriptor ProcessStatsDataSource::descriptor = {
     /*name*/ "linux.process_stats",
-    /*flags*/ Descriptor::kHandlesIncrementalState,
+    /*flags*/ Descriptor::kHandlesIncrementalState |
+        Descriptor::kCanRunOnWorkerThread,
 };
 
 ProcessStatsDataSource::ProcessStatsDataSource(
@@ -96,6 +130,7 @@ ProcessStatsDataSource::ProcessStatsDataSource(
   ProcessStatsConfig::Decoder cfg(ds_config.process_stats_config_raw());
   record_thread_names_ = cfg.record_thread_names();
   dump_all_procs_on_start_ = cfg.scan_all_processes_on_start();
+  use_proc_connector_ = cfg.use_proc_connector();
 
   enable_on_demand_dumps_ = true;
   for (auto quirk = cfg.quirks(); quirk; ++quirk) {
@@ -115,6 +150,16 @@ ProcessStatsDataSource::ProcessStatsDataSource(
     auto proc_stats_ttl_ms = cfg.proc_stats_cache_ttl_ms();
     process_stats_cache_ttl_ticks_ =
         std::max(proc_stats_ttl_ms / poll_period_ms_, 1u);
+
+    // Leave at least half of the fds to the rest of traced_probes.
+    struct rlimit nofile {};
+    max_cached_proc_fds_ = kMaxCachedProcs;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 &&
+        nofile.rlim_cur != RLIM_INFINITY) {
+      max_cached_proc_fds_ =
+          std::min(static_cast<size_t>(nofile.rlim_cur) / 2 / kFdsPerCachedProc,
+                   kMaxCachedProcs);
+    }
   }
 
   record_thread_time_in_state_ = cfg.record_thread_time_in_state();
@@ -127,6 +172,13 @@ ProcessStatsDataSource::ProcessStatsDataSource(
 ProcessStatsDataSource::~ProcessStatsDataSource() = default;
 
 void ProcessStatsDataSource::Start() {
+  // Before the full dump, so that no process created meanwhile is missed.
+  if (use_proc_connector_) {
+    proc_connector_ = ProcConnector::Create(task_runner_, this);
+    if (!proc_connector_)
+      PERFETTO_ELOG("Proc connector unavailable, using on-demand dumps");
+  }
+
   if (dump_all_procs_on_start_)
     WriteAllProcesses();
 
@@ -175,7 +227,7 @@ void ProcessStatsDataSource::WriteAllProcesses() {
 }
 
 void ProcessStatsDataSource::OnPids(const base::FlatSet<int32_t>& pids) {
-  if (!enable_on_demand_dumps_)
+  if (!on_demand_dumps_enabled())
     return;
   WriteProcessTree(pids);
 }
@@ -197,19 +249,117 @@ void ProcessStatsDataSource::WriteProcessTree(
 
 void ProcessStatsDataSource::OnRenamePids(const base::FlatSet<int32_t>& pids) {
   PERFETTO_METATRACE_SCOPED(TAG_PROC_POLLERS, PS_ON_RENAME_PIDS);
-  if (!enable_on_demand_dumps_)
+  if (!on_demand_dumps_enabled())
     return;
   PERFETTO_DCHECK(!cur_ps_tree_);
   for (int32_t pid : pids)
     seen_pids_.erase(pid);
 }
 
+void ProcessStatsDataSource::OnProcessFork(int32_t parent_tgid,
+                                           int32_t pid,
+                                           int32_t tgid) {
+  if (pid == tgid) {
+    // A new process, possibly reusing the pid of an exited one.
+    seen_pids_.erase(pid);
+    AddPendingPid(pid, parent_tgid);
+  } else if (record_thread_names_) {
+    AddPendingPid(pid, 0);
+  } else {
+    // No need to read /proc for threads, unless for their name.
+    pending_threads_[pid] = std::make_pair(tgid, std::string());
+    AddPendingPid(tgid, 0);
+  }
+}
+
+void ProcessStatsDataSource::OnProcessExec(int32_t, int32_t tgid) {
+  // The cmdline has changed.
+  seen_pids_.erase(tgid);
+  AddPendingPid(tgid, 0);
+}
+
+void ProcessStatsDataSource::OnProcessComm(int32_t pid,
+                                           int32_t tgid,
+                                           const char* comm) {
+  seen_pids_.erase(pid);
+  if (pid == tgid) {
+    // As for OnRenamePids(), the process might need to be rescanned.
+    AddPendingPid(pid, 0);
+  } else if (record_thread_names_) {
+    pending_threads_[pid] = std::make_pair(tgid, std::string(comm));
+    SchedulePendingPidsWrite();
+  }
+}
+
+void ProcessStatsDataSource::OnProcessExit(int32_t pid, int32_t) {
+  // Pending processes are still written, see WritePendingPids().
+  seen_pids_.erase(pid);
+  pending_threads_.erase(pid);
+}
+
+void ProcessStatsDataSource::AddPendingPid(int32_t pid, int32_t ppid) {
+  // Keeps the parent of the fork if already pending.
+  pending_pids_.emplace(pid, ppid);
+  SchedulePendingPidsWrite();
+}
+
+void ProcessStatsDataSource::SchedulePendingPidsWrite() {
+  if (pending_pids_write_posted_)
+    return;
+  pending_pids_write_posted_ = true;
+
+  // Batch the /proc reads of the processes reported in the next (at most)
+  // 100 ms, aligned so that the wakeup is likely packed together with the
+  // other periodic tasks of traced_probes.
+  const uint32_t kBatchMs = 100;
+  uint32_t delay_ms =
+      kBatchMs - static_cast<uint32_t>(base::GetWallTimeMs().count() % kBatchMs);
+  auto weak_this = GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this] {
+        if (weak_this)
+          weak_this->WritePendingPids();
+      },
+      delay_ms);
+}
+
+void ProcessStatsDataSource::WritePendingPids() {
+  PERFETTO_DCHECK(!cur_ps_tree_);
+  pending_pids_write_posted_ = false;
+  CacheProcFsScanStartTimestamp();
+  for (const auto& pid_and_ppid : pending_pids_) {
+    int32_t pid = pid_and_ppid.first;
+    if (seen_pids_.count(pid))
+      continue;
+    WriteProcessOrThread(pid);
+    // If the process exited before its /proc files could be read, keep at
+    // least its parent. Not added to |seen_pids_|, as the pid is gone.
+    if (!seen_pids_.count(pid) && pid_and_ppid.second > 0) {
+      auto* proc = GetOrCreatePsTree()->add_processes();
+      proc->set_pid(pid);
+      proc->set_ppid(pid_and_ppid.second);
+    }
+  }
+  for (const auto& thread : pending_threads_) {
+    if (seen_pids_.count(thread.first))
+      continue;
+    const std::string& name = thread.second.second;
+    WriteThread(thread.first, thread.second.first,
+                name.empty() ? nullptr : name.c_str());
+  }
+  pending_pids_.clear();
+  pending_threads_.clear();
+  FinalizeCurPacket();
+}
+
 void ProcessStatsDataSource::Flush(FlushRequestID,
                                    std::function<void()> callback) {
   // We shouldn't get this in the middle of WriteAllProcesses() or OnPids().
   PERFETTO_DCHECK(!cur_ps_tree_);
   PERFETTO_DCHECK(!cur_ps_stats_);
   PERFETTO_DCHECK(!cur_ps_stats_process_);
+  if (!pending_pids_.empty() || !pending_threads_.empty())
+    WritePendingPids();
   writer_->Flush(callback);
 }
 
@@ -280,6 +430,15 @@ base::ScopedDir ProcessStatsDataSource::OpenProcDir() {
 std::string ProcessStatsDataSource::ReadProcPidFile(int32_t pid,
                                                     const std::string& file) {
   std::string contents;
+  if (cache_proc_fds_) {
+    if (base::ScopedFile* fd = GetCachedProcPidFile(pid, file)) {
+      // Once the process is gone its files can't be read anymore, even if
+      // the pid is reused: drop them, to be reopened by the next poll.
+      if (!PreadWholeFile(**fd, &contents))
+        proc_fds_cache_.erase(pid);
+      return contents;
+    }
+  }
   contents.reserve(4096);
   if (!base::ReadFile("/proc/" + std::to_string(pid) + "/" + file, &contents))
     return "";
@@ -292,6 +451,38 @@ base::ScopedDir ProcessStatsDataSource::OpenProcTaskDir(int32_t pid) {
   return base::ScopedDir(opendir(task_path));
 }
 
+base::ScopedFile* ProcessStatsDataSource::GetCachedProcPidFile(
+    int32_t pid,
+    const std::string& file) {
+  base::ScopedFile CachedProcFds::*member = nullptr;
+  if (file == "status") {
+    member = &CachedProcFds::status;
+  } else if (file == "oom_score_adj") {
+    member = &CachedProcFds::oom_score_adj;
+  } else if (file == "stat") {
+    member = &CachedProcFds::stat;
+  } else {
+    return nullptr;
+  }
+
+  auto it = proc_fds_cache_.find(pid);
+  if (it == proc_fds_cache_.end()) {
+    if (proc_fds_cache_.size() >= max_cached_proc_fds_)
+      return nullptr;
+    base::ScopedFile dir = base::OpenFile("/proc/" + std::to_string(pid),
+                                          O_RDONLY | O_DIRECTORY);
+    if (!dir)
+      return nullptr;
+    it = proc_fds_cache_.emplace(pid, CachedProcFds()).first;
+    it->second.dir = std::move(dir);
+  }
+  CachedProcFds& fds = it->second;
+  base::ScopedFile* fd = &(fds.*member);
+  if (!*fd)
+    fd->reset(openat(*fds.dir, file.c_str(), O_RDONLY | O_CLOEXEC));
+  return *fd ? fd : nullptr;
+}
+
 std::string ProcessStatsDataSource::ReadProcStatusEntry(const std::string& buf,
                                                         const char* key) {
   auto begin = buf.find(key);
@@ -397,6 +588,7 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
   if (!proc_dir)
     return;
   base::FlatSet<int32_t> pids;
+  cache_proc_fds_ = true;
   while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
     cur_ps_stats_process_ = nullptr;
 
@@ -439,8 +631,18 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
 
     pids.insert(pid);
   }
+  cache_proc_fds_ = false;
   FinalizeCurPacket();
 
+  // Close the files of the processes which are gone or no longer polled.
+  for (auto it = proc_fds_cache_.begin(); it != proc_fds_cache_.end();) {
+    if (pids.count(it->first)) {
+      ++it;
+    } else {
+      it = proc_fds_cache_.erase(it);
+    }
+  }
+
   // Ensure that we write once long-term process info (e.g., name) for new pids
   // that we haven't seen before.
   WriteProcessTree(pids);
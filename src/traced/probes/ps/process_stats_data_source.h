@@ -18,9 +18,12 @@
 #define SRC_TRACED_PROBES_PS_PROCESS_STATS_DATA_SOURCE_H_
 
 #include <limits>
+#include <map>
 #include <memory>
 #include <set>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/flat_set.h"
@@ -31,6 +34,7 @@
 #include "perfetto/tracing/core/forward_decls.h"
 #include "src/traced/probes/common/cpu_freq_info.h"
 #include "src/traced/probes/probes_data_source.h"
+#include "src/traced/probes/ps/proc_connector.h"
 
 namespace perfetto {
 
@@ -47,7 +51,8 @@ class ProcessStats_Process;
 }  // namespace protos
 
 
-class ProcessStatsDataSource : public ProbesDataSource {
+class ProcessStatsDataSource : public ProbesDataSource,
+                               public ProcConnector::Delegate {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
@@ -68,7 +73,20 @@ class ProcessStatsDataSource : public ProbesDataSource {
   void Flush(FlushRequestID, std::function<void()> callback) override;
   void ClearIncrementalState() override;
 
-  bool on_demand_dumps_enabled() const { return enable_on_demand_dumps_; }
+  // The ftrace-driven dumps are superseded by the proc connector, if any.
+  bool on_demand_dumps_enabled() const {
+    return enable_on_demand_dumps_ && !proc_connector_;
+  }
+
+  // Same as above, but only depends on the config, and can be called from
+  // another thread than the one of the data source.
+  bool on_demand_dumps_configured() const { return enable_on_demand_dumps_; }
+
+  // ProcConnector::Delegate implementation.
+  void OnProcessFork(int32_t parent_tgid, int32_t pid, int32_t tgid) override;
+  void OnProcessExec(int32_t pid, int32_t tgid) override;
+  void OnProcessComm(int32_t pid, int32_t tgid, const char* comm) override;
+  void OnProcessExit(int32_t pid, int32_t tgid) override;
 
   // Virtual for testing.
   virtual base::ScopedDir OpenProcDir();
@@ -91,6 +109,15 @@ class ProcessStatsDataSource : public ProbesDataSource {
     uint64_t cpu_time = std::numeric_limits<uint64_t>::max();
   };
 
+  // The /proc/pid files read on every poll, kept open across polls so that
+  // they are re-read with pread() rather than looked up again in procfs.
+  struct CachedProcFds {
+    base::ScopedFile dir;
+    base::ScopedFile status;
+    base::ScopedFile oom_score_adj;
+    base::ScopedFile stat;
+  };
+
   // Common functions.
   ProcessStatsDataSource(const ProcessStatsDataSource&) = delete;
   ProcessStatsDataSource& operator=(const ProcessStatsDataSource&) = delete;
@@ -114,9 +141,18 @@ class ProcessStatsDataSource : public ProbesDataSource {
   bool ShouldWriteThreadStats(int32_t pid);
   void WriteThreadStats(int32_t pid, int32_t tid);
 
+  // Returns the cached fd of /proc/|pid|/|file|, opening it if needed, or
+  // nullptr if |file| isn't cached or the cache is full.
+  base::ScopedFile* GetCachedProcPidFile(int32_t pid, const std::string& file);
+
   // Scans /proc/pid/status and writes the ProcessTree packet for input pids.
   void WriteProcessTree(const base::FlatSet<int32_t>&);
 
+  // Functions for batching the processes reported by the proc connector.
+  void AddPendingPid(int32_t pid, int32_t ppid);
+  void SchedulePendingPidsWrite();
+  void WritePendingPids();
+
   // Read and "latch" the current procfs scan-start timestamp, which
   // we reset only in FinalizeCurPacket.
   uint64_t CacheProcFsScanStartTimestamp();
@@ -143,12 +179,25 @@ class ProcessStatsDataSource : public ProbesDataSource {
   bool enable_on_demand_dumps_ = true;
   bool dump_all_procs_on_start_ = false;
   bool record_thread_time_in_state_ = false;
+  bool use_proc_connector_ = false;
 
   // This set contains PIDs as per the Linux kernel notion of a PID (which is
   // really a TID). In practice this set will contain all TIDs for all processes
   // seen, not just the main thread id (aka thread group ID).
   base::FlatSet<int32_t> seen_pids_;
 
+  // Set in Start() if ProcessStatsConfig.use_proc_connector and the kernel
+  // allows it.
+  std::unique_ptr<ProcConnector> proc_connector_;
+
+  // What |proc_connector_| reported since the last WritePendingPids():
+  // the pids to read from /proc, with their parent if known (0 otherwise),
+  // and the threads to write without reading /proc, with their tgid and
+  // name (empty if unknown).
+  std::map<int32_t, int32_t> pending_pids_;
+  std::map<int32_t, std::pair<int32_t, std::string>> pending_threads_;
+  bool pending_pids_write_posted_ = false;
+
   // Fields for keeping track of the periodic stats/counters.
   uint32_t poll_period_ms_ = 0;
   uint64_t cache_ticks_ = 0;
@@ -161,6 +210,13 @@ class ProcessStatsDataSource : public ProbesDataSource {
   uint32_t process_stats_cache_ttl_ticks_ = 0;
   std::unordered_map<int32_t, CachedProcessStats> process_stats_cache_;
 
+  // Open files of the processes seen by the last poll, used by
+  // ReadProcPidFile() while |cache_proc_fds_| is set, i.e. while polling.
+  // Bounded by |max_cached_proc_fds_| pids, derived from RLIMIT_NOFILE.
+  std::unordered_map<int32_t, CachedProcFds> proc_fds_cache_;
+  size_t max_cached_proc_fds_ = 0;
+  bool cache_proc_fds_ = false;
+
   using TimeInStateCacheEntry = std::tuple</* tid */ int32_t,
                                            /* cpu_freq_index */ uint32_t,
                                            /* ticks */ uint64_t>;
@@ -17,6 +17,7 @@
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
 #include <dirent.h>
+#include <unistd.h>
 
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/temp_file.h"
@@ -121,6 +122,42 @@ TEST_F(ProcessStatsDataSourceTest, NonNulTerminatedCmdline) {
   ASSERT_THAT(first_process.cmdline(), ElementsAreArray({"surfaceflinger"}));
 }
 
+TEST_F(ProcessStatsDataSourceTest, ProcConnectorEvents) {
+  auto data_source = GetProcessStatsDataSource(DataSourceConfig());
+  EXPECT_CALL(*data_source, ReadProcPidFile(42, "status"))
+      .WillOnce(Return(
+          "Name: foo\nTgid:\t42\nPid:   42\nPPid:  17\nUid:  43 44 45 56\n"));
+  EXPECT_CALL(*data_source, ReadProcPidFile(42, "cmdline"))
+      .WillOnce(Return(std::string("foo\0bar\0", 8)));
+  // Exits before its /proc files are read.
+  EXPECT_CALL(*data_source, ReadProcPidFile(50, "status")).WillOnce(Return(""));
+
+  data_source->OnProcessFork(17, 42, 42);
+  data_source->OnProcessFork(42, 43, 42);
+  data_source->OnProcessFork(42, 50, 50);
+  data_source->OnProcessExit(50, 50);
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  auto trace = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(trace.size(), 1u);
+  auto ps_tree = trace[0].process_tree();
+  ASSERT_EQ(ps_tree.processes_size(), 2);
+  EXPECT_EQ(ps_tree.processes()[0].pid(), 42);
+  EXPECT_EQ(ps_tree.processes()[0].ppid(), 17);
+  EXPECT_THAT(ps_tree.processes()[0].cmdline(), ElementsAre("foo", "bar"));
+  EXPECT_EQ(ps_tree.processes()[1].pid(), 50);
+  EXPECT_EQ(ps_tree.processes()[1].ppid(), 42);
+  ASSERT_EQ(ps_tree.threads_size(), 1);
+  EXPECT_EQ(ps_tree.threads()[0].tid(), 43);
+  EXPECT_EQ(ps_tree.threads()[0].tgid(), 42);
+
+  // Thread names are recorded only with record_thread_names.
+  data_source->OnProcessComm(43, 42, "worker");
+  data_source->Flush(2 /* FlushRequestId */, []() {});
+  trace = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(trace.size(), 1u);
+}
+
 TEST_F(ProcessStatsDataSourceTest, DontRescanCachedPIDsAndTIDs) {
   // assertion helpers
   auto expected_process = [](int pid) {
@@ -397,6 +434,59 @@ TEST_F(ProcessStatsDataSourceTest, ProcessStats) {
     base::Rmdir(path);
 }
 
+TEST_F(ProcessStatsDataSourceTest, ProcessStatsFromCachedFds) {
+  DataSourceConfig ds_config;
+  ProcessStatsConfig cfg;
+  cfg.set_proc_stats_poll_ms(1);
+  cfg.add_quirks(ProcessStatsConfig::DISABLE_ON_DEMAND);
+  ds_config.set_process_stats_config_raw(cfg.SerializeAsString());
+  auto data_source = GetProcessStatsDataSource(ds_config);
+
+  // A fake /proc/ directory listing only this process, whose files are then
+  // read from the real /proc/ through the fds kept open across polls.
+  auto fake_proc = base::TempDir::Create();
+  const int32_t pid = static_cast<int32_t>(getpid());
+  std::string pid_dir = fake_proc.path() + "/" + std::to_string(pid);
+  mkdir(pid_dir.c_str(), 0755);
+
+  EXPECT_CALL(*data_source, OpenProcDir()).WillRepeatedly(Invoke([&fake_proc] {
+    return base::ScopedDir(opendir(fake_proc.path().c_str()));
+  }));
+  ProcessStatsDataSource* real = data_source.get();
+  EXPECT_CALL(*data_source, ReadProcPidFile(pid, "status"))
+      .WillRepeatedly(Invoke([real](int32_t p, const std::string& file) {
+        return real->ProcessStatsDataSource::ReadProcPidFile(p, file);
+      }));
+
+  const int kNumIters = 3;
+  int iter = 0;
+  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
+  EXPECT_CALL(*data_source, ReadProcPidFile(pid, "oom_score_adj"))
+      .WillRepeatedly(
+          Invoke([real, checkpoint, &iter](int32_t p, const std::string& file) {
+            std::string contents =
+                real->ProcessStatsDataSource::ReadProcPidFile(p, file);
+            EXPECT_FALSE(contents.empty());
+            if (++iter == kNumIters)
+              checkpoint();
+            return contents;
+          }));
+
+  data_source->Start();
+  task_runner_.RunUntilCheckpoint("all_done");
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  auto trace = writer_raw_->GetAllTracePackets();
+  ASSERT_FALSE(trace.empty());
+  ASSERT_EQ(trace[0].process_stats().processes_size(), 1);
+  const auto& process = trace[0].process_stats().processes()[0];
+  EXPECT_EQ(process.pid(), pid);
+  EXPECT_GT(process.vm_size_kb(), 0u);
+  EXPECT_GT(process.vm_rss_kb(), 0u);
+
+  base::Rmdir(pid_dir);
+}
+
 TEST_F(ProcessStatsDataSourceTest, CacheProcessStats) {
   DataSourceConfig ds_config;
   ProcessStatsConfig cfg;
@@ -46,6 +46,20 @@ using protos::pbzero::SysStatsConfig;
 namespace {
 constexpr size_t kReadBufSize = 1024 * 16;
 
+// With changed_counters_only, how often all the counters are written anyway.
+constexpr int64_t kFullPollPeriodMs = 10000;
+
+// With adaptive_polling, the maximum factor applied to the polling periods.
+constexpr uint32_t kMaxPollBackoff = 8;
+
+constexpr size_t kNumCpuTimes = 7;
+
+constexpr uint64_t kUnsetCounter = std::numeric_limits<uint64_t>::max();
+
+// Bounds the memory used to remember the last values in case of bogus cpu or
+// irq numbers. The counters beyond it are always written.
+constexpr size_t kMaxTrackedCounters = 1 << 16;
+
 base::ScopedFile OpenReadOnly(const char* path) {
   base::ScopedFile fd(base::OpenFile(path, O_RDONLY));
   if (!fd)
@@ -63,12 +77,30 @@ uint32_t ClampTo10Ms(uint32_t period_ms, const char* counter_name) {
   return period_ms;
 }
 
+// Parses the next unsigned decimal number in [*pos, end), skipping any
+// separator before it, and advances |pos| past it. This walks each line of
+// /proc/stat once, unlike strtoll() over the tokens of a StringSplitter, and
+// doesn't deal with signs, bases or locales.
+inline bool ParseNextUint64(const char** pos, const char* end, uint64_t* out) {
+  const char* p = *pos;
+  while (p < end && (*p < '0' || *p > '9'))
+    p++;
+  if (p == end)
+    return false;
+  uint64_t value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    value = value * 10 + static_cast<uint64_t>(*p - '0');
+  *pos = p;
+  *out = value;
+  return true;
+}
+
 }  // namespace
 
 // static
 const ProbesDataSource::Descriptor SysStatsDataSource::descriptor = {
     /*name*/ "linux.sys_stats",
-    /*flags*/ Descriptor::kFlagsNone,
+    /*flags*/ Descriptor::kCanRunOnWorkerThread,
 };
 
 SysStatsDataSource::SysStatsDataSource(base::TaskRunner* task_runner,
@@ -132,6 +164,9 @@ SysStatsDataSource::SysStatsDataSource(base::TaskRunner* task_runner,
       vmstat_counters_.emplace(k.str, k.id);
   }
 
+  changed_counters_only_ = cfg.changed_counters_only();
+  adaptive_polling_ = cfg.adaptive_polling();
+
   if (!cfg.has_stat_counters())
     stat_enabled_fields_ = ~0u;
   for (auto counter = cfg.stat_counters(); counter; ++counter) {
@@ -181,13 +216,15 @@ void SysStatsDataSource::Tick(base::WeakPtr<SysStatsDataSource> weak_this) {
     return;
   SysStatsDataSource& thiz = *weak_this;
 
-  uint32_t period_ms = thiz.tick_period_ms_;
+  thiz.ReadSysStats();
+
+  // With adaptive_polling, ReadSysStats() updates the backoff.
+  uint32_t period_ms = thiz.tick_period_ms_ * thiz.poll_backoff_;
   uint32_t delay_ms =
       period_ms -
       static_cast<uint32_t>(base::GetWallTimeMs().count() % period_ms);
   thiz.task_runner_->PostDelayedTask(
       std::bind(&SysStatsDataSource::Tick, weak_this), delay_ms);
-  thiz.ReadSysStats();
 }
 
 SysStatsDataSource::~SysStatsDataSource() = default;
@@ -199,6 +236,21 @@ void SysStatsDataSource::ReadSysStats() {
   packet->set_timestamp(static_cast<uint64_t>(base::GetBootTimeNs().count()));
   auto* sys_stats = packet->set_sys_stats();
 
+  // Forget the last values once in a while, so that all counters are written.
+  if (changed_counters_only_) {
+    int64_t now_ms = base::GetBootTimeNs().count() / 1000000;
+    if (tick_ == 0 || now_ms - last_full_poll_ms_ >= kFullPollPeriodMs) {
+      last_full_poll_ms_ = now_ms;
+      last_meminfo_values_.clear();
+      last_vmstat_values_.clear();
+      last_cpu_times_.clear();
+      last_irq_counts_.clear();
+      last_softirq_counts_.clear();
+      last_stat_totals_.clear();
+    }
+  }
+  num_changed_counters_ = 0;
+
   if (meminfo_ticks_ && tick_ % meminfo_ticks_ == 0)
     ReadMeminfo(sys_stats);
 
@@ -214,9 +266,34 @@ void SysStatsDataSource::ReadSysStats() {
   sys_stats->set_collection_end_timestamp(
       static_cast<uint64_t>(base::GetBootTimeNs().count()));
 
+  if (adaptive_polling_) {
+    poll_backoff_ = num_changed_counters_
+                        ? 1
+                        : std::min(poll_backoff_ * 2, kMaxPollBackoff);
+  }
+
   tick_++;
 }
 
+bool SysStatsDataSource::UpdateCounter(std::vector<uint64_t>* last_values,
+                                       size_t index,
+                                       uint64_t value) {
+  if ((!changed_counters_only_ && !adaptive_polling_) ||
+      index >= kMaxTrackedCounters) {
+    return true;
+  }
+  if (index >= last_values->size())
+    last_values->resize(index + 1, kUnsetCounter);
+  uint64_t& last_value = (*last_values)[index];
+  // The first value of a counter isn't a change, so that the values written
+  // again every kFullPollPeriodMs don't reset the adaptive polling backoff.
+  bool changed = last_value != value;
+  if (changed && last_value != kUnsetCounter)
+    num_changed_counters_++;
+  last_value = value;
+  return changed || !changed_counters_only_;
+}
+
 void SysStatsDataSource::ReadDevfreq(protos::pbzero::SysStats* sys_stats) {
   base::ScopedDir devfreq_dir = OpenDevfreqDir();
   if (devfreq_dir) {
@@ -281,6 +358,10 @@ void SysStatsDataSource::ReadMeminfo(protos::pbzero::SysStats* sys_stats) {
     if (!words.Next())
       continue;
     auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+    if (!UpdateCounter(&last_meminfo_values_, static_cast<size_t>(counter_id),
+                       value)) {
+      continue;
+    }
     auto* meminfo = sys_stats->add_meminfo();
     meminfo->set_key(static_cast<protos::pbzero::MeminfoCounters>(counter_id));
     meminfo->set_value(value);
@@ -303,6 +384,10 @@ void SysStatsDataSource::ReadVmstat(protos::pbzero::SysStats* sys_stats) {
     if (!words.Next())
       continue;
     auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+    if (!UpdateCounter(&last_vmstat_values_, static_cast<size_t>(counter_id),
+                       value)) {
+      continue;
+    }
     auto* vmstat = sys_stats->add_vmstat();
     vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(counter_id));
     vmstat->set_value(value);
@@ -318,16 +403,31 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     base::StringSplitter words(&lines, ' ');
     if (!words.Next())
       continue;
+    // The numbers following the first word are parsed in place.
+    const char* pos = words.cur_token() + words.cur_token_size();
+    const char* line_end = lines.cur_token() + lines.cur_token_size();
+    uint64_t v = 0;
 
     // Per-CPU stats.
     if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_CPU_TIMES)) &&
         words.cur_token_size() > 3 && !strncmp(words.cur_token(), "cpu", 3)) {
-      long cpu_id = strtol(words.cur_token() + 3, nullptr, 10);
-      std::array<uint64_t, 7> cpu_times{};
-      for (size_t i = 0; i < cpu_times.size() && words.Next(); i++) {
-        cpu_times[i] =
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+      const char* cpu_pos = words.cur_token() + 3;
+      uint64_t cpu_id = 0;
+      if (!ParseNextUint64(&cpu_pos, pos, &cpu_id))
+        continue;
+      std::array<uint64_t, kNumCpuTimes> cpu_times{};
+      bool changed = false;
+      for (size_t i = 0; i < cpu_times.size(); i++) {
+        if (!ParseNextUint64(&pos, line_end, &cpu_times[i]))
+          break;
+      }
+      // All the times of a CPU are written if any of them changed.
+      for (size_t i = 0; i < cpu_times.size(); i++) {
+        changed |= UpdateCounter(&last_cpu_times_,
+                                 cpu_id * kNumCpuTimes + i, cpu_times[i]);
       }
+      if (!changed)
+        continue;
       auto* cpu_stat = sys_stats->add_cpu_stat();
       cpu_stat->set_cpu_id(static_cast<uint32_t>(cpu_id));
       cpu_stat->set_user_ns(cpu_times[0] * ns_per_user_hz_);
@@ -341,11 +441,11 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     // IRQ counters
     else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_IRQ_COUNTS)) &&
              !strcmp(words.cur_token(), "intr")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+      for (size_t i = 0; ParseNextUint64(&pos, line_end, &v); i++) {
         if (i == 0) {
-          sys_stats->set_num_irq_total(v);
-        } else if (v > 0) {
+          if (UpdateCounter(&last_stat_totals_, 0, v))
+            sys_stats->set_num_irq_total(v);
+        } else if (v > 0 && UpdateCounter(&last_irq_counts_, i - 1, v)) {
           auto* irq_stat = sys_stats->add_num_irq();
           irq_stat->set_irq(static_cast<int32_t>(i - 1));
           irq_stat->set_count(v);
@@ -356,11 +456,11 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     else if ((stat_enabled_fields_ &
               (1 << SysStatsConfig::STAT_SOFTIRQ_COUNTS)) &&
              !strcmp(words.cur_token(), "softirq")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+      for (size_t i = 0; ParseNextUint64(&pos, line_end, &v); i++) {
         if (i == 0) {
-          sys_stats->set_num_softirq_total(v);
-        } else {
+          if (UpdateCounter(&last_stat_totals_, 1, v))
+            sys_stats->set_num_softirq_total(v);
+        } else if (UpdateCounter(&last_softirq_counts_, i - 1, v)) {
           auto* softirq_stat = sys_stats->add_num_softirq();
           softirq_stat->set_irq(static_cast<int32_t>(i - 1));
           softirq_stat->set_count(v);
@@ -370,9 +470,9 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     // Number of forked processes since boot.
     else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_FORK_COUNT)) &&
              !strcmp(words.cur_token(), "processes")) {
-      if (words.Next()) {
-        sys_stats->set_num_forks(
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10)));
+      if (ParseNextUint64(&pos, line_end, &v) &&
+          UpdateCounter(&last_stat_totals_, 2, v)) {
+        sys_stats->set_num_forks(v);
       }
     }
 
@@ -22,6 +22,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -63,6 +64,7 @@ class SysStatsDataSource : public ProbesDataSource {
 
   void set_ns_per_user_hz_for_testing(uint64_t ns) { ns_per_user_hz_ = ns; }
   uint32_t tick_for_testing() const { return tick_; }
+  uint32_t poll_backoff_for_testing() const { return poll_backoff_; }
 
   // Virtual for testing
   virtual base::ScopedDir OpenDevfreqDir();
@@ -86,6 +88,12 @@ class SysStatsDataSource : public ProbesDataSource {
   void ReadDevfreq(protos::pbzero::SysStats* sys_stats);
   size_t ReadFile(base::ScopedFile*, const char* path);
 
+  // Remembers |value| as the last one of the counter at |index| of
+  // |last_values|, and returns whether it should be written into the trace.
+  bool UpdateCounter(std::vector<uint64_t>* last_values,
+                     size_t index,
+                     uint64_t value);
+
   base::TaskRunner* const task_runner_;
   std::unique_ptr<TraceWriter> writer_;
   base::ScopedFile meminfo_fd_;
@@ -105,6 +113,20 @@ class SysStatsDataSource : public ProbesDataSource {
   uint32_t devfreq_ticks_ = 0;
   bool devfreq_error_logged_ = false;
 
+  // State of changed_counters_only and adaptive_polling. The last values are
+  // indexed by counter enum, cpu id * kNumCpuTimes + time, and irq number.
+  bool changed_counters_only_ = false;
+  bool adaptive_polling_ = false;
+  std::vector<uint64_t> last_meminfo_values_;
+  std::vector<uint64_t> last_vmstat_values_;
+  std::vector<uint64_t> last_cpu_times_;
+  std::vector<uint64_t> last_irq_counts_;
+  std::vector<uint64_t> last_softirq_counts_;
+  std::vector<uint64_t> last_stat_totals_;
+  int64_t last_full_poll_ms_ = 0;
+  uint32_t num_changed_counters_ = 0;
+  uint32_t poll_backoff_ = 1;
+
   base::WeakPtrFactory<SysStatsDataSource> weak_factory_;  // Keep last.
 };
 
@@ -236,17 +236,22 @@ class SysStatsDataSourceTest : public ::testing::Test {
     return instance;
   }
 
-  void Poller(SysStatsDataSource* ds, std::function<void()> checkpoint) {
-    if (ds->tick_for_testing())
+  void Poller(SysStatsDataSource* ds,
+              uint32_t num_ticks,
+              std::function<void()> checkpoint) {
+    if (ds->tick_for_testing() >= num_ticks)
       checkpoint();
     else
       task_runner_.PostDelayedTask(
-          [ds, checkpoint, this] { Poller(ds, checkpoint); }, 1);
+          [ds, num_ticks, checkpoint, this] {
+            Poller(ds, num_ticks, checkpoint);
+          },
+          1);
   }
 
-  void WaitTick(SysStatsDataSource* data_source) {
+  void WaitTick(SysStatsDataSource* data_source, uint32_t num_ticks = 1) {
     auto checkpoint = task_runner_.CreateCheckpoint("on_tick");
-    Poller(data_source, checkpoint);
+    Poller(data_source, num_ticks, checkpoint);
     task_runner_.RunUntilCheckpoint("on_tick");
   }
 
@@ -482,5 +487,50 @@ TEST_F(SysStatsDataSourceTest, StatForksOnly) {
   ASSERT_EQ(sys_stats.num_softirq_size(), 0);
 }
 
+TEST_F(SysStatsDataSourceTest, ChangedCountersOnly) {
+  DataSourceConfig config;
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.set_stat_period_ms(10);
+  sys_cfg.set_changed_counters_only(true);
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  auto data_source = GetSysStatsDataSource(config);
+
+  WaitTick(data_source.get(), 2);
+
+  // The mock files don't change, so only the first poll has counters.
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_GE(packets.size(), 2u);
+  const auto& first = packets[0].sys_stats();
+  EXPECT_GE(first.meminfo_size(), 10);
+  EXPECT_EQ(first.cpu_stat_size(), 8);
+  EXPECT_EQ(first.num_forks(), 243320u);
+  EXPECT_EQ(first.num_irq_size(), 102);
+  const auto& second = packets[1].sys_stats();
+  EXPECT_EQ(second.meminfo_size(), 0);
+  EXPECT_EQ(second.cpu_stat_size(), 0);
+  EXPECT_FALSE(second.has_num_forks());
+  EXPECT_EQ(second.num_irq_size(), 0);
+  EXPECT_EQ(second.num_softirq_size(), 0);
+}
+
+TEST_F(SysStatsDataSourceTest, AdaptivePolling) {
+  DataSourceConfig config;
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.set_adaptive_polling(true);
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  auto data_source = GetSysStatsDataSource(config);
+
+  // Without changes, the polling slows down after each poll.
+  WaitTick(data_source.get(), 2);
+  EXPECT_GE(data_source->poll_backoff_for_testing(), 4u);
+
+  // All the counters are still written.
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_GE(packets.size(), 2u);
+  EXPECT_GE(packets[1].sys_stats().meminfo_size(), 10);
+}
+
 }  // namespace
 }  // namespace perfetto
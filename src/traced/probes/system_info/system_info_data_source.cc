@@ -41,7 +41,7 @@ const char kProcessor[] = "processor";
 // static
 const ProbesDataSource::Descriptor SystemInfoDataSource::descriptor = {
     /* name */ "linux.system_info",
-    /* flags */ Descriptor::kFlagsNone,
+    /* flags */ Descriptor::kCanRunOnWorkerThread,
 };
 
 SystemInfoDataSource::SystemInfoDataSource(
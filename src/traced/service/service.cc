@@ -26,9 +26,14 @@
 #include "perfetto/ext/base/watchdog.h"
 #include "perfetto/ext/traced/traced.h"
 #include "perfetto/ext/tracing/ipc/default_socket.h"
+#include "perfetto/ext/tracing/core/tracing_service.h"
 #include "perfetto/ext/tracing/ipc/service_ipc_host.h"
 #include "src/traced/service/builtin_producer.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include "src/tracing/core/zlib_compressor.h"
+#endif
+
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
 #define PERFETTO_SET_SOCKET_PERMISSIONS
@@ -41,6 +46,11 @@
 
 namespace perfetto {
 namespace {
+
+// Number of threads used by default to read the trace buffers of the
+// sessions written into a file. See TracingService::SetBufferReadWorkers().
+constexpr uint32_t kDefaultBufferReadWorkers = 2;
+
 #if defined(PERFETTO_SET_SOCKET_PERMISSIONS)
 void SetSocketPermissions(const std::string& socket_name,
                           const std::string& group_name,
@@ -81,6 +91,9 @@ Usage: %s [option] ...
 Options and arguments
     --background : Exits immediately and continues running in the background
     --version : print the version number and exit.
+    --buffer-read-workers <num> : number of threads used to read the buffers of
+        the tracing sessions which are written into a file (default: %u).
+        0 reads them on the main thread.
     --set-socket-permissions <permissions> : sets group ownership and permission
         mode bits of the producer and consumer sockets.
         <permissions> format: <prod_group>:<prod_mode>:<cons_group>:<cons_mode>,
@@ -95,7 +108,7 @@ Example:
     sockets to "traced-producer" and "traced-consumer", respectively. Both
     producer and consumer sockets are chmod with 0660 (rw-rw----) mode bits.
 )",
-          prog_name, prog_name);
+          prog_name, kDefaultBufferReadWorkers, prog_name);
 }
 }  // namespace
 
@@ -104,13 +117,17 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
     OPT_VERSION = 1000,
     OPT_SET_SOCKET_PERMISSIONS = 1001,
     OPT_BACKGROUND,
+    OPT_BUFFER_READ_WORKERS,
   };
 
   bool background = false;
+  uint32_t buffer_read_workers = kDefaultBufferReadWorkers;
 
   static const option long_options[] = {
       {"background", no_argument, nullptr, OPT_BACKGROUND},
       {"version", no_argument, nullptr, OPT_VERSION},
+      {"buffer-read-workers", required_argument, nullptr,
+       OPT_BUFFER_READ_WORKERS},
       {"set-socket-permissions", required_argument, nullptr,
        OPT_SET_SOCKET_PERMISSIONS},
       {nullptr, 0, nullptr, 0}};
@@ -129,6 +146,15 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
       case OPT_VERSION:
         printf("%s\n", base::GetVersionString());
         return 0;
+      case OPT_BUFFER_READ_WORKERS: {
+        auto num_workers = base::CStringToUInt32(optarg);
+        if (!num_workers.has_value()) {
+          PrintUsage(argv[0]);
+          return 1;
+        }
+        buffer_read_workers = *num_workers;
+        break;
+      }
       case OPT_SET_SOCKET_PERMISSIONS: {
         // Check that the socket permission argument is well formed.
         auto parts = base::SplitString(std::string(optarg), ":");
@@ -195,6 +221,11 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
     return 1;
   }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  svc->service()->SetCompressorFn(&ZlibCompressFn);
+#endif
+  svc->service()->SetBufferReadWorkers(buffer_read_workers);
+
   BuiltinProducer builtin_producer(&task_runner, /*lazy_stop_delay_ms=*/30000);
   builtin_producer.ConnectInProcess(svc->service());
 
@@ -30,6 +30,36 @@ class BenchmarkDataSource : public perfetto::DataSource<BenchmarkDataSource> {
   void OnStop(const StopArgs&) override {}
 };
 
+struct BenchmarkTlsState;
+
+struct BenchmarkTlsDataSourceTraits : public perfetto::DefaultDataSourceTraits {
+  using CustomTlsStateType = BenchmarkTlsState;
+};
+
+// Caches its config in a custom TLS state, instead of reading it from the
+// locked data source instance on every trace point.
+class BenchmarkTlsDataSource
+    : public perfetto::DataSource<BenchmarkTlsDataSource,
+                                  BenchmarkTlsDataSourceTraits> {
+ public:
+  void OnSetup(const SetupArgs& args) override {
+    emit_str = args.config->legacy_config().empty();
+  }
+  void OnStart(const StartArgs&) override {}
+  void OnStop(const StopArgs&) override {}
+
+  bool emit_str = false;
+};
+
+struct BenchmarkTlsState {
+  explicit BenchmarkTlsState(BenchmarkTlsDataSource::TraceContext& ctx) {
+    auto ds = ctx.GetDataSourceLocked();
+    emit_str = ds && ds->emit_str;
+  }
+
+  bool emit_str;
+};
+
 static void BM_TracingDataSourceDisabled(benchmark::State& state) {
   while (state.KeepRunning()) {
     BenchmarkDataSource::Trace([&](BenchmarkDataSource::TraceContext) {});
@@ -46,6 +76,8 @@ std::unique_ptr<perfetto::TracingSession> StartTracing(
   perfetto::DataSourceDescriptor dsd;
   dsd.set_name("benchmark");
   BenchmarkDataSource::Register(dsd);
+  dsd.set_name("benchmark_tls");
+  BenchmarkTlsDataSource::Register(dsd);
   perfetto::TrackEvent::Register();
 
   perfetto::TraceConfig cfg;
@@ -75,6 +107,47 @@ static void BM_TracingDataSourceLambda(benchmark::State& state) {
   PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
 }
 
+static void BM_TracingDataSourceLockedConfig(benchmark::State& state) {
+  auto tracing_session = StartTracing("benchmark_tls");
+
+  while (state.KeepRunning()) {
+    BenchmarkTlsDataSource::Trace(
+        [&](BenchmarkTlsDataSource::TraceContext ctx) {
+          bool emit_str;
+          {
+            auto ds = ctx.GetDataSourceLocked();
+            emit_str = ds && ds->emit_str;
+          }
+          auto packet = ctx.NewTracePacket();
+          packet->set_timestamp(42);
+          if (emit_str)
+            packet->set_for_testing()->set_str("benchmark");
+        });
+    benchmark::ClobberMemory();
+  }
+
+  tracing_session->StopBlocking();
+  PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
+}
+
+static void BM_TracingDataSourceCustomTlsConfig(benchmark::State& state) {
+  auto tracing_session = StartTracing("benchmark_tls");
+
+  while (state.KeepRunning()) {
+    BenchmarkTlsDataSource::Trace(
+        [&](BenchmarkTlsDataSource::TraceContext ctx) {
+          auto packet = ctx.NewTracePacket();
+          packet->set_timestamp(42);
+          if (ctx.GetCustomTlsState()->emit_str)
+            packet->set_for_testing()->set_str("benchmark");
+        });
+    benchmark::ClobberMemory();
+  }
+
+  tracing_session->StopBlocking();
+  PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
+}
+
 static void BM_TracingTrackEventDisabled(benchmark::State& state) {
   while (state.KeepRunning()) {
     TRACE_EVENT_BEGIN("benchmark", "DisabledEvent");
@@ -94,6 +167,22 @@ static void BM_TracingTrackEventBasic(benchmark::State& state) {
   PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
 }
 
+// Cycles through several event names, which are interned by pointer.
+static void BM_TracingTrackEventManyNames(benchmark::State& state) {
+  auto tracing_session = StartTracing("track_event");
+
+  static const char* const kNames[] = {"Event1", "Event2", "Event3", "Event4",
+                                       "Event5", "Event6", "Event7", "Event8"};
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    TRACE_EVENT_BEGIN("benchmark", perfetto::StaticString{kNames[i++ % 8]});
+    benchmark::ClobberMemory();
+  }
+
+  tracing_session->StopBlocking();
+  PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
+}
+
 static void BM_TracingTrackEventDebugAnnotations(benchmark::State& state) {
   auto tracing_session = StartTracing("track_event");
 
@@ -106,6 +195,36 @@ static void BM_TracingTrackEventDebugAnnotations(benchmark::State& state) {
   PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
 }
 
+// Primitive values are written following a plan computed at compile time.
+static void BM_TracingTrackEventPrimitiveDebugAnnotations(
+    benchmark::State& state) {
+  auto tracing_session = StartTracing("track_event");
+
+  while (state.KeepRunning()) {
+    TRACE_EVENT_BEGIN("benchmark", "Event", "int", 42, "uint", 42u, "bool",
+                      true, "double", 4.2);
+    benchmark::ClobberMemory();
+  }
+
+  tracing_session->StopBlocking();
+  PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
+}
+
+// Strings go through a TracedValue, for comparison with the above.
+static void BM_TracingTrackEventStringDebugAnnotations(
+    benchmark::State& state) {
+  auto tracing_session = StartTracing("track_event");
+
+  while (state.KeepRunning()) {
+    TRACE_EVENT_BEGIN("benchmark", "Event", "str1", "a", "str2", "b", "str3",
+                      "c", "str4", "d");
+    benchmark::ClobberMemory();
+  }
+
+  tracing_session->StopBlocking();
+  PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
+}
+
 static void BM_TracingTrackEventLambda(benchmark::State& state) {
   auto tracing_session = StartTracing("track_event");
 
@@ -126,7 +245,12 @@ static void BM_TracingTrackEventLambda(benchmark::State& state) {
 
 BENCHMARK(BM_TracingDataSourceDisabled);
 BENCHMARK(BM_TracingDataSourceLambda);
+BENCHMARK(BM_TracingDataSourceLockedConfig);
+BENCHMARK(BM_TracingDataSourceCustomTlsConfig);
 BENCHMARK(BM_TracingTrackEventBasic);
+BENCHMARK(BM_TracingTrackEventManyNames);
 BENCHMARK(BM_TracingTrackEventDebugAnnotations);
+BENCHMARK(BM_TracingTrackEventPrimitiveDebugAnnotations);
+BENCHMARK(BM_TracingTrackEventStringDebugAnnotations);
 BENCHMARK(BM_TracingTrackEventDisabled);
 BENCHMARK(BM_TracingTrackEventLambda);
@@ -21,6 +21,11 @@
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/utils.h"
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+#include "perfetto/ext/base/thread_task_runner.h"
+#define PERFETTO_CONSOLE_ASYNC_OUTPUT_SUPPORTED
+#endif
 #include "perfetto/tracing/internal/track_event_internal.h"
 
 #include "protos/perfetto/common/interceptor_descriptor.gen.h"
@@ -35,8 +40,12 @@
 #include "protos/perfetto/trace/track_event/track_descriptor.pbzero.h"
 #include "protos/perfetto/trace/track_event/track_event.pbzero.h"
 
+#include <string.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <mutex>
 #include <tuple>
 
 namespace perfetto {
@@ -110,8 +119,133 @@ uint32_t CounterToHue(uint32_t counter) {
   return reversed * kMaxHue / 8;
 }
 
+constexpr size_t kDefaultAsyncBufferSize = 64 * 1024;
+constexpr size_t kMinAsyncBufferSize = 4096;
+#if defined(PERFETTO_CONSOLE_ASYNC_OUTPUT_SUPPORTED)
+constexpr uint32_t kAsyncDrainPeriodMs = 20;
+#endif
+
 }  // namespace
 
+// A single producer single consumer ring buffer of formatted messages. The
+// producer is the thread which emits the events, the consumer the async output
+// thread (or the thread stopping the session). A message is either queued as a
+// whole or dropped, hence messages are never interleaved in the output.
+class ConsoleOutputRing {
+ public:
+  explicit ConsoleOutputRing(size_t size)
+      : data_(new char[size]), size_(size) {
+    PERFETTO_DCHECK(size && (size & (size - 1)) == 0);
+  }
+
+  // Called on the producer thread. Never blocks.
+  void Write(const char* data, size_t size) {
+    uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    uint64_t read_pos = read_pos_.load(std::memory_order_acquire);
+    if (size > size_ - static_cast<size_t>(write_pos - read_pos)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    size_t offset = static_cast<size_t>(write_pos) & (size_ - 1);
+    size_t first = std::min(size, size_ - offset);
+    memcpy(&data_[offset], data, first);
+    memcpy(&data_[0], data + first, size - first);
+    write_pos_.store(write_pos + size, std::memory_order_release);
+  }
+
+  // Called on the consumer thread. Returns false if the ring was empty.
+  bool Drain(int fd) {
+    uint64_t read_pos = read_pos_.load(std::memory_order_relaxed);
+    uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+    size_t size = static_cast<size_t>(write_pos - read_pos);
+    size_t offset = static_cast<size_t>(read_pos) & (size_ - 1);
+    size_t first = std::min(size, size_ - offset);
+    if (first)
+      base::WriteAll(fd, &data_[offset], first);
+    if (size > first)
+      base::WriteAll(fd, &data_[0], size - first);
+    read_pos_.store(write_pos, std::memory_order_release);
+
+    uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+      char message[64];
+      int len = snprintf(message, sizeof(message),
+                         "[console: %" PRIu64 " events dropped]\n", dropped);
+      base::WriteAll(fd, message, static_cast<size_t>(len));
+    }
+    return size || dropped;
+  }
+
+ private:
+  std::unique_ptr<char[]> data_;
+  const size_t size_;  // A power of two.
+  std::atomic<uint64_t> write_pos_{0};
+  std::atomic<uint64_t> read_pos_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+// Owns the rings of the threads which emitted events during a session, and
+// periodically writes their contents to the output on a background thread.
+class ConsoleAsyncOutput {
+ public:
+  ConsoleAsyncOutput(int fd, size_t ring_size)
+      : fd_(fd), ring_size_(ring_size) {
+#if defined(PERFETTO_CONSOLE_ASYNC_OUTPUT_SUPPORTED)
+    task_runner_.reset(new base::ThreadTaskRunner(
+        base::ThreadTaskRunner::CreateAndStart("ConsoleOutput")));
+    ScheduleDrain();
+#endif
+  }
+
+  // Writes out whatever is left in the rings.
+  ~ConsoleAsyncOutput() {
+#if defined(PERFETTO_CONSOLE_ASYNC_OUTPUT_SUPPORTED)
+    task_runner_.reset();
+#endif
+    Drain();
+  }
+
+  std::shared_ptr<ConsoleOutputRing> CreateRing() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.emplace_back(new ConsoleOutputRing(ring_size_));
+    return rings_.back();
+  }
+
+  void Drain() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = rings_.begin(); it != rings_.end();) {
+      bool was_empty = !(*it)->Drain(fd_);
+      // The thread which owned the ring has exited.
+      if (was_empty && it->use_count() == 1) {
+        it = rings_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+ private:
+#if defined(PERFETTO_CONSOLE_ASYNC_OUTPUT_SUPPORTED)
+  void ScheduleDrain() {
+    // The tasks are destroyed with |task_runner_|, which is reset first.
+    task_runner_->PostDelayedTask(
+        [this] {
+          Drain();
+          ScheduleDrain();
+        },
+        kAsyncDrainPeriodMs);
+  }
+#endif
+
+  const int fd_;
+  const size_t ring_size_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<ConsoleOutputRing>> rings_;
+#if defined(PERFETTO_CONSOLE_ASYNC_OUTPUT_SUPPORTED)
+  std::unique_ptr<base::ThreadTaskRunner> task_runner_;
+#endif
+};
+
 class ConsoleInterceptor::Delegate : public TrackEventStateTracker::Delegate {
  public:
   explicit Delegate(InterceptorContext&);
@@ -129,6 +263,7 @@ class ConsoleInterceptor::Delegate : public TrackEventStateTracker::Delegate {
   base::Optional<SelfHandle> locked_self_;
 };
 
+ConsoleInterceptor::ConsoleInterceptor() = default;
 ConsoleInterceptor::~ConsoleInterceptor() = default;
 
 ConsoleInterceptor::ThreadLocalState::ThreadLocalState(
@@ -137,6 +272,8 @@ ConsoleInterceptor::ThreadLocalState::ThreadLocalState(
     start_time_ns = self->start_time_ns_;
     use_colors = self->use_colors_;
     fd = self->fd_;
+    if (self->async_output_)
+      async_ring = self->async_output_->CreateRing();
   }
 }
 
@@ -199,6 +336,7 @@ void ConsoleInterceptor::Delegate::OnTrackEvent(
   // Start printing.
   auto& tls = context_.GetThreadLocalState();
   tls.buffer_pos = 0;
+  tls.message_truncated = false;
 
   // Print timestamp and track identifier.
   SetColor(context_, kDim);
@@ -283,13 +421,27 @@ void ConsoleInterceptor::OnSetup(const SetupArgs& args) {
   }
   fd_ = fd;
   use_colors_ = use_colors;
+
+  async_output_enabled_ = config.async_output();
+  size_t buffer_size = config.has_async_buffer_size_kb()
+                           ? config.async_buffer_size_kb() * 1024u
+                           : kDefaultAsyncBufferSize;
+  async_buffer_size_ = kMinAsyncBufferSize;
+  while (async_buffer_size_ < buffer_size)
+    async_buffer_size_ <<= 1;
 }
 
 void ConsoleInterceptor::OnStart(const StartArgs&) {
   start_time_ns_ = internal::TrackEventInternal::GetTimeNs();
+  if (async_output_enabled_)
+    async_output_.reset(new ConsoleAsyncOutput(fd_, async_buffer_size_));
 }
 
-void ConsoleInterceptor::OnStop(const StopArgs&) {}
+void ConsoleInterceptor::OnStop(const StopArgs&) {
+  // Writes out the pending messages. The rings stay alive until their threads
+  // exit, but nothing drains them anymore.
+  async_output_.reset();
+}
 
 // static
 void ConsoleInterceptor::OnTracePacket(InterceptorContext context) {
@@ -321,6 +473,14 @@ void ConsoleInterceptor::Printf(InterceptorContext& context,
     va_end(args);
   }
 
+  // With async output, the messages which don't fit into the buffer are
+  // truncated, as the thread can't write to the output itself.
+  if (tls.async_ring && (remaining <= 0 || written >= remaining)) {
+    tls.buffer_pos = tls.message_buffer.size();
+    tls.message_truncated = true;
+    return;
+  }
+
   // In case of buffer overflow, flush to the fd and write the latest message to
   // it directly instead.
   if (remaining <= 0 || written > remaining) {
@@ -344,6 +504,16 @@ void ConsoleInterceptor::Printf(InterceptorContext& context,
 // static
 void ConsoleInterceptor::Flush(InterceptorContext& context) {
   auto& tls = context.GetThreadLocalState();
+  if (tls.async_ring) {
+    if (tls.message_truncated) {
+      tls.message_buffer[tls.buffer_pos - 1] = '\n';
+      tls.message_truncated = false;
+    }
+    if (tls.buffer_pos)
+      tls.async_ring->Write(&tls.message_buffer[0], tls.buffer_pos);
+    tls.buffer_pos = 0;
+    return;
+  }
   ssize_t res = base::WriteAll(tls.fd, &tls.message_buffer[0], tls.buffer_pos);
   PERFETTO_DCHECK(res == static_cast<ssize_t>(tls.buffer_pos));
   tls.buffer_pos = 0;
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/latency_histogram.h"
+
+#include <limits>
+
+#include "perfetto/base/logging.h"
+
+#include "protos/perfetto/common/tracing_service_state.gen.h"
+
+namespace perfetto {
+
+namespace {
+
+// Returns the index of the most significant bit set. |value| must be != 0.
+uint32_t GetMsb(uint64_t value) {
+  PERFETTO_DCHECK(value);
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - static_cast<uint32_t>(__builtin_clzll(value));
+#else
+  uint32_t msb = 0;
+  while (value >>= 1)
+    msb++;
+  return msb;
+#endif
+}
+
+}  // namespace
+
+// static
+constexpr uint32_t LatencyHistogram::kSubBucketBits;
+constexpr uint32_t LatencyHistogram::kSubBuckets;
+constexpr uint32_t LatencyHistogram::kMaxBits;
+constexpr size_t LatencyHistogram::kNumBuckets;
+
+// static
+size_t LatencyHistogram::GetBucket(uint64_t duration_ns) {
+  // The first kSubBuckets buckets hold one duration each.
+  if (duration_ns < kSubBuckets)
+    return static_cast<size_t>(duration_ns);
+  // The others are identified by the position of the MSB (i.e. the power of
+  // two) and the kSubBucketBits that follow it (i.e. the sub-bucket).
+  uint32_t shift = GetMsb(duration_ns) - kSubBucketBits;
+  size_t sub_bucket = static_cast<size_t>(duration_ns >> shift) - kSubBuckets;
+  size_t bucket = (shift + 1) * kSubBuckets + sub_bucket;
+  return std::min(bucket, kNumBuckets - 1);
+}
+
+// static
+uint64_t LatencyHistogram::GetBucketUpperBound(size_t bucket) {
+  PERFETTO_DCHECK(bucket < kNumBuckets);
+  if (bucket == kNumBuckets - 1)
+    return std::numeric_limits<uint64_t>::max();
+  if (bucket < kSubBuckets)
+    return bucket + 1;
+  uint64_t shift = bucket / kSubBuckets - 1;
+  uint64_t sub_bucket = bucket % kSubBuckets;
+  return (kSubBuckets + sub_bucket + 1) << shift;
+}
+
+void LatencyHistogram::Serialize(protos::gen::LatencyHistogram* proto) const {
+  proto->set_count(count_);
+  proto->set_sum_ns(sum_ns_);
+  proto->set_max_ns(max_ns_);
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    if (!buckets_[i])
+      continue;
+    auto* bucket = proto->add_buckets();
+    bucket->set_upper_bound_ns(GetBucketUpperBound(i));
+    bucket->set_count(buckets_[i]);
+  }
+}
+
+}  // namespace perfetto
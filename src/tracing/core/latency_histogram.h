@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_LATENCY_HISTOGRAM_H_
+#define SRC_TRACING_CORE_LATENCY_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+
+#include "perfetto/base/time.h"
+
+namespace perfetto {
+
+namespace protos {
+namespace gen {
+class LatencyHistogram;
+}  // namespace gen
+}  // namespace protos
+
+// Histogram of the durations of an operation of the tracing service, see the
+// LatencyHistogram proto. As in HdrHistogram, the buckets are exponential and
+// each power of two is split into kSubBuckets linear sub-buckets. Adding a
+// duration is a handful of arithmetic operations, cheap enough to always keep
+// track of the operations of the service.
+class LatencyHistogram {
+ public:
+  static constexpr uint32_t kSubBucketBits = 2;
+  static constexpr uint32_t kSubBuckets = 1 << kSubBucketBits;
+
+  // The last bucket also counts all the durations >= 2^kMaxBits ns, i.e.
+  // longer than ~18 minutes.
+  static constexpr uint32_t kMaxBits = 40;
+  static constexpr size_t kNumBuckets =
+      (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+  void Add(uint64_t duration_ns) {
+    count_++;
+    sum_ns_ += duration_ns;
+    max_ns_ = std::max(max_ns_, duration_ns);
+    buckets_[GetBucket(duration_ns)]++;
+  }
+
+  void Add(base::TimeNanos duration) {
+    Add(static_cast<uint64_t>(std::max(duration.count(), int64_t(0))));
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t sum_ns() const { return sum_ns_; }
+  uint64_t max_ns() const { return max_ns_; }
+
+  // Writes the counters and the non-empty buckets into |proto|.
+  void Serialize(protos::gen::LatencyHistogram* proto) const;
+
+  static size_t GetBucket(uint64_t duration_ns);
+
+  // Returns the (exclusive) upper bound of the durations counted by |bucket|.
+  static uint64_t GetBucketUpperBound(size_t bucket);
+
+ private:
+  uint64_t count_ = 0;
+  uint64_t sum_ns_ = 0;
+  uint64_t max_ns_ = 0;
+  std::array<uint64_t, kNumBuckets> buckets_{};
+};
+
+// Adds the time elapsed between its construction and its destruction to a
+// LatencyHistogram.
+class ScopedLatencyRecorder {
+ public:
+  explicit ScopedLatencyRecorder(LatencyHistogram* histogram)
+      : histogram_(histogram), start_(base::GetWallTimeNs()) {}
+  ~ScopedLatencyRecorder() { histogram_->Add(base::GetWallTimeNs() - start_); }
+
+ private:
+  ScopedLatencyRecorder(const ScopedLatencyRecorder&) = delete;
+  ScopedLatencyRecorder& operator=(const ScopedLatencyRecorder&) = delete;
+
+  LatencyHistogram* const histogram_;
+  const base::TimeNanos start_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/latency_histogram.h"
+
+#include <limits>
+
+#include "protos/perfetto/common/tracing_service_state.gen.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+TEST(LatencyHistogramTest, Buckets) {
+  EXPECT_EQ(LatencyHistogram::GetBucket(0), 0u);
+  EXPECT_EQ(LatencyHistogram::GetBucket(3), 3u);
+  EXPECT_EQ(LatencyHistogram::GetBucket(4), 4u);
+  EXPECT_EQ(LatencyHistogram::GetBucket(7), 7u);
+  EXPECT_EQ(LatencyHistogram::GetBucket(8), 8u);
+  EXPECT_EQ(LatencyHistogram::GetBucket(9), 8u);
+  EXPECT_EQ(LatencyHistogram::GetBucket(10), 9u);
+  EXPECT_EQ(LatencyHistogram::GetBucket(std::numeric_limits<uint64_t>::max()),
+            LatencyHistogram::kNumBuckets - 1);
+
+  // Each bucket starts where the previous one ends and is at most 25% wider
+  // than the durations it counts.
+  uint64_t lower_bound = 0;
+  for (size_t i = 0; i < LatencyHistogram::kNumBuckets - 1; i++) {
+    uint64_t upper_bound = LatencyHistogram::GetBucketUpperBound(i);
+    ASSERT_GT(upper_bound, lower_bound);
+    ASSERT_EQ(LatencyHistogram::GetBucket(lower_bound), i);
+    ASSERT_EQ(LatencyHistogram::GetBucket(upper_bound - 1), i);
+    if (lower_bound >= LatencyHistogram::kSubBuckets) {
+      ASSERT_LE((upper_bound - lower_bound) * 4, lower_bound);
+    }
+    lower_bound = upper_bound;
+  }
+  EXPECT_EQ(lower_bound, 7ull << 37);
+}
+
+TEST(LatencyHistogramTest, Serialize) {
+  LatencyHistogram histogram;
+  histogram.Add(5);
+  histogram.Add(1000);
+  histogram.Add(1001);
+  histogram.Add(base::TimeNanos(-1));  // Clock adjustments count as 0.
+
+  protos::gen::LatencyHistogram proto;
+  histogram.Serialize(&proto);
+  EXPECT_EQ(proto.count(), 4u);
+  EXPECT_EQ(proto.sum_ns(), 2006u);
+  EXPECT_EQ(proto.max_ns(), 1001u);
+  ASSERT_EQ(proto.buckets_size(), 3);
+  EXPECT_EQ(proto.buckets()[0].upper_bound_ns(), 1u);
+  EXPECT_EQ(proto.buckets()[0].count(), 1u);
+  EXPECT_EQ(proto.buckets()[1].upper_bound_ns(), 6u);
+  EXPECT_EQ(proto.buckets()[1].count(), 1u);
+  // 1000 and 1001 are in [896, 1024).
+  EXPECT_EQ(proto.buckets()[2].upper_bound_ns(), 1024u);
+  EXPECT_EQ(proto.buckets()[2].count(), 2u);
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_downsampler.h"
+
+#include <algorithm>
+
+#include "perfetto/ext/tracing/core/shared_memory_abi.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+using protos::pbzero::TracePacket;
+
+constexpr uint8_t kFirstPacketContinuesFromPrevChunk =
+    SharedMemoryABI::ChunkHeader::kFirstPacketContinuesFromPrevChunk;
+constexpr uint8_t kLastPacketContinuesOnNextChunk =
+    SharedMemoryABI::ChunkHeader::kLastPacketContinuesOnNextChunk;
+
+// Returns true if the packet sets or clears state which the following packets
+// of the same sequence depend on.
+bool HasSequenceState(const uint8_t* data, size_t size) {
+  protozero::ProtoDecoder decoder(data, size);
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    switch (field.id()) {
+      case TracePacket::kInternedDataFieldNumber:
+      case TracePacket::kSequenceFlagsFieldNumber:
+      case TracePacket::kIncrementalStateClearedFieldNumber:
+      case TracePacket::kTracePacketDefaultsFieldNumber:
+      case TracePacket::kTrackDescriptorFieldNumber:
+      case TracePacket::kProcessDescriptorFieldNumber:
+      case TracePacket::kThreadDescriptorFieldNumber:
+      case TracePacket::kClockSnapshotFieldNumber:
+        return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+PacketDownsampler::PacketDownsampler(TraceBuffer* target,
+                                     uint32_t keep_one_every_n)
+    : target_(target), keep_one_every_n_(std::max(keep_one_every_n, 1u)) {}
+
+PacketDownsampler::~PacketDownsampler() = default;
+
+void PacketDownsampler::OnChunkOverwritten(
+    const TraceBuffer::OverwrittenChunk& chunk) {
+  const TraceBuffer::PacketSequenceProperties& seq_props =
+      chunk.sequence_properties;
+  SequenceState& seq = sequences_[static_cast<uint32_t>(
+      (seq_props.producer_id_trusted << 16) | seq_props.writer_id)];
+
+  // The kept packets are copied verbatim, including their size header, hence
+  // the new chunk is never larger than the original one.
+  chunk_.clear();
+  uint16_t num_kept = 0;
+  const uint8_t* ptr = chunk.fragments;
+  const uint8_t* const end = chunk.fragments + chunk.size;
+  for (uint16_t i = 0; i < chunk.num_fragments && ptr < end; i++) {
+    uint64_t packet_size = 0;
+    const uint8_t* header_end = std::min(
+        ptr + protozero::proto_utils::kMessageLengthFieldSize, end);
+    const uint8_t* packet_data =
+        protozero::proto_utils::ParseVarInt(ptr, header_end, &packet_size);
+    if (packet_data == ptr ||
+        packet_size > static_cast<uint64_t>(end - packet_data)) {
+      break;  // Invalid or dropped packet, the rest of the chunk is unusable.
+    }
+    const uint8_t* next = packet_data + packet_size;
+
+    bool is_fragment =
+        (i == 0 && (chunk.flags & kFirstPacketContinuesFromPrevChunk)) ||
+        (i == chunk.num_fragments - 1 &&
+         (chunk.flags & kLastPacketContinuesOnNextChunk));
+    if (!is_fragment && packet_size > 0 &&
+        ShouldKeepPacket(packet_data, static_cast<size_t>(packet_size), &seq)) {
+      chunk_.insert(chunk_.end(), ptr, next);
+      num_kept++;
+    } else {
+      packets_dropped_++;
+    }
+    ptr = next;
+  }
+  if (num_kept == 0)
+    return;
+
+  packets_kept_ += num_kept;
+  target_->CopyChunkUntrusted(
+      seq_props.producer_id_trusted, seq_props.producer_uid_trusted,
+      seq_props.writer_id, seq.next_chunk_id++, num_kept, /*chunk_flags=*/0,
+      /*chunk_complete=*/true, chunk_.data(), chunk_.size());
+}
+
+bool PacketDownsampler::ShouldKeepPacket(const uint8_t* data,
+                                         size_t size,
+                                         SequenceState* seq) {
+  if (HasSequenceState(data, size))
+    return true;
+  return seq->packets_seen++ % keep_one_every_n_ == 0;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_PACKET_DOWNSAMPLER_H_
+#define SRC_TRACING_CORE_PACKET_DOWNSAMPLER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/tracing/core/basic_types.h"
+#include "src/tracing/core/trace_buffer.h"
+
+namespace perfetto {
+
+// Implements TraceConfig.BufferConfig.downsample_on_overwrite: receives the
+// chunks which are about to be overwritten in a ring buffer (see
+// TraceBuffer::set_overwrite_callback()) and copies a decimated version of
+// them into an older tier buffer, which hence covers a longer time window at a
+// lower resolution.
+// Only one packet every |keep_one_every_n| of each sequence is kept, with the
+// exception of the packets that carry sequence state (interned data,
+// incremental state clears, packet defaults, track descriptors and clock
+// snapshots): those are always kept, so that the kept packets can still be
+// decoded. Packets fragmented across chunks are dropped.
+class PacketDownsampler {
+ public:
+  // |target| must outlive this object. A |keep_one_every_n| of 0 is treated
+  // as 1, i.e. no decimation.
+  PacketDownsampler(TraceBuffer* target, uint32_t keep_one_every_n);
+  ~PacketDownsampler();
+
+  void OnChunkOverwritten(const TraceBuffer::OverwrittenChunk&);
+
+  uint64_t packets_kept() const { return packets_kept_; }
+  uint64_t packets_dropped() const { return packets_dropped_; }
+
+ private:
+  struct SequenceState {
+    // The chunks copied into |target_| are renumbered, so that the sequence
+    // doesn't look like it lost packets when a chunk is dropped altogether.
+    ChunkID next_chunk_id = 0;
+    uint64_t packets_seen = 0;
+  };
+
+  bool ShouldKeepPacket(const uint8_t* data, size_t size, SequenceState*);
+
+  TraceBuffer* const target_;
+  const uint32_t keep_one_every_n_;
+
+  // Keyed by {ProducerID, WriterID}.
+  base::FlatHashMap<uint32_t, SequenceState> sequences_;
+
+  // The payload of the chunk being copied into |target_|. Only a member to
+  // avoid allocating it for every chunk.
+  std::vector<uint8_t> chunk_;
+
+  uint64_t packets_kept_ = 0;
+  uint64_t packets_dropped_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_PACKET_DOWNSAMPLER_H_
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/packet_downsampler.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/tracing/core/shared_memory_abi.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using protos::gen::TracePacket;
+
+constexpr size_t kSourceBufferSize = 4096;
+constexpr size_t kTargetBufferSize = 64 * 1024;
+
+class PacketDownsamplerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    source_ = TraceBuffer::Create(kSourceBufferSize);
+    target_ = TraceBuffer::Create(kTargetBufferSize);
+    downsampler_.reset(new PacketDownsampler(target_.get(), 4));
+    source_->set_overwrite_callback(
+        [this](const TraceBuffer::OverwrittenChunk& chunk) {
+          downsampler_->OnChunkOverwritten(chunk);
+        });
+  }
+
+  static TracePacket MakePacket(uint64_t timestamp) {
+    TracePacket packet;
+    packet.set_timestamp(timestamp);
+    // Makes the packets large enough to quickly wrap the source buffer.
+    packet.mutable_for_testing()->set_str(std::string(200, 'x'));
+    return packet;
+  }
+
+  void CopyChunk(WriterID writer_id,
+                 ChunkID chunk_id,
+                 const std::vector<TracePacket>& packets,
+                 uint8_t chunk_flags = 0) {
+    std::string payload;
+    for (const TracePacket& packet : packets) {
+      std::string data = packet.SerializeAsString();
+      uint8_t header[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+      uint8_t* header_end =
+          protozero::proto_utils::WriteVarInt(data.size(), header);
+      payload.append(reinterpret_cast<char*>(header),
+                     static_cast<size_t>(header_end - header));
+      payload.append(data);
+    }
+    source_->CopyChunkUntrusted(
+        /*producer_id_trusted=*/1, /*producer_uid_trusted=*/0, writer_id,
+        chunk_id, static_cast<uint16_t>(packets.size()), chunk_flags,
+        /*chunk_complete=*/true,
+        reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+  }
+
+  static std::vector<TracePacket> ReadPackets(TraceBuffer* buf) {
+    std::vector<TracePacket> res;
+    buf->BeginRead();
+    TracePacket proto;
+    perfetto::TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties;
+    bool previous_packet_dropped;
+    while (buf->ReadNextTracePacket(&packet, &sequence_properties,
+                                    &previous_packet_dropped)) {
+      EXPECT_TRUE(proto.ParseFromString(packet.GetRawBytesForTesting()));
+      res.push_back(proto);
+      packet = perfetto::TracePacket();
+    }
+    return res;
+  }
+
+  std::unique_ptr<TraceBuffer> source_;
+  std::unique_ptr<TraceBuffer> target_;
+  std::unique_ptr<PacketDownsampler> downsampler_;
+};
+
+TEST_F(PacketDownsamplerTest, DecimatesOverwrittenPackets) {
+  uint64_t ts = 0;
+  for (ChunkID chunk_id = 0; chunk_id < 20; chunk_id++) {
+    std::vector<TracePacket> packets;
+    for (int i = 0; i < 4; i++)
+      packets.push_back(MakePacket(ts++));
+    CopyChunk(/*writer_id=*/1, chunk_id, packets);
+  }
+
+  std::vector<TracePacket> old_packets = ReadPackets(target_.get());
+  std::vector<TracePacket> recent_packets = ReadPackets(source_.get());
+  ASSERT_FALSE(old_packets.empty());
+  ASSERT_FALSE(recent_packets.empty());
+  EXPECT_EQ(old_packets.size(), downsampler_->packets_kept());
+  EXPECT_EQ(old_packets.size() * 4,
+            downsampler_->packets_kept() + downsampler_->packets_dropped());
+
+  // The target buffer has one every 4 of the oldest packets, the source buffer
+  // all the most recent ones.
+  for (size_t i = 0; i < old_packets.size(); i++)
+    EXPECT_EQ(old_packets[i].timestamp(), i * 4);
+  EXPECT_EQ(recent_packets.front().timestamp(), old_packets.size() * 4);
+  EXPECT_EQ(recent_packets.back().timestamp(), ts - 1);
+}
+
+TEST_F(PacketDownsamplerTest, KeepsSequenceState) {
+  uint64_t ts = 0;
+  for (ChunkID chunk_id = 0; chunk_id < 20; chunk_id++) {
+    std::vector<TracePacket> packets;
+    TracePacket interned = MakePacket(ts++);
+    interned.mutable_interned_data();
+    packets.push_back(interned);
+    for (int i = 0; i < 3; i++)
+      packets.push_back(MakePacket(ts++));
+    CopyChunk(/*writer_id=*/1, chunk_id, packets);
+  }
+
+  size_t num_interned = 0;
+  for (const TracePacket& packet : ReadPackets(target_.get())) {
+    if (packet.has_interned_data()) {
+      EXPECT_EQ(packet.timestamp() % 4, 0u);
+      num_interned++;
+    }
+  }
+  // One packet with interned data for each overwritten chunk.
+  EXPECT_GT(num_interned, 0u);
+  EXPECT_EQ(num_interned * 4,
+            downsampler_->packets_kept() + downsampler_->packets_dropped());
+}
+
+TEST_F(PacketDownsamplerTest, ReadChunksAreNotDownsampled) {
+  uint64_t ts = 0;
+  for (ChunkID chunk_id = 0; chunk_id < 20; chunk_id++) {
+    CopyChunk(/*writer_id=*/1, chunk_id, {MakePacket(ts++), MakePacket(ts++)});
+    ReadPackets(source_.get());
+  }
+  EXPECT_TRUE(ReadPackets(target_.get()).empty());
+  EXPECT_EQ(downsampler_->packets_kept() + downsampler_->packets_dropped(), 0u);
+}
+
+TEST_F(PacketDownsamplerTest, DropsFragmentedPackets) {
+  uint64_t ts = 0;
+  for (ChunkID chunk_id = 0; chunk_id < 20; chunk_id++) {
+    // The last packet of each chunk is declared to continue in the next
+    // chunk, and the first one to continue from the previous.
+    std::vector<TracePacket> packets;
+    for (int i = 0; i < 4; i++)
+      packets.push_back(MakePacket(ts++));
+    CopyChunk(
+        /*writer_id=*/1, chunk_id, packets,
+        SharedMemoryABI::ChunkHeader::kFirstPacketContinuesFromPrevChunk |
+            SharedMemoryABI::ChunkHeader::kLastPacketContinuesOnNextChunk);
+  }
+
+  // Only the two packets in the middle of each chunk are eligible.
+  for (const TracePacket& packet : ReadPackets(target_.get())) {
+    EXPECT_NE(packet.timestamp() % 4, 0u);
+    EXPECT_NE(packet.timestamp() % 4, 3u);
+  }
+  EXPECT_GT(downsampler_->packets_kept(), 0u);
+}
+
+TEST_F(PacketDownsamplerTest, MultipleSequences) {
+  uint64_t ts = 0;
+  for (ChunkID chunk_id = 0; chunk_id < 10; chunk_id++) {
+    for (WriterID writer_id = 1; writer_id <= 2; writer_id++) {
+      std::vector<TracePacket> packets;
+      for (int i = 0; i < 4; i++)
+        packets.push_back(MakePacket(writer_id * 1000 + ts++));
+      CopyChunk(writer_id, chunk_id, packets);
+    }
+  }
+
+  // Each sequence is decimated independently.
+  std::vector<uint64_t> timestamps[2];
+  for (const TracePacket& packet : ReadPackets(target_.get()))
+    timestamps[packet.timestamp() / 2000].push_back(packet.timestamp());
+  ASSERT_FALSE(timestamps[0].empty());
+  ASSERT_FALSE(timestamps[1].empty());
+  EXPECT_EQ(timestamps[0].front(), 1000u);
+  EXPECT_EQ(timestamps[1].front(), 2004u);
+}
+
+}  // namespace
+}  // namespace perfetto
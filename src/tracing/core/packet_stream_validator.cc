@@ -18,6 +18,7 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <cinttypes>
 
 #include "perfetto/base/logging.h"
@@ -32,7 +33,7 @@ namespace {
 
 using protozero::proto_utils::ProtoWireType;
 
-const uint32_t kReservedFieldIds[] = {
+constexpr uint32_t kReservedFieldIds[] = {
     protos::pbzero::TracePacket::kTrustedUidFieldNumber,
     protos::pbzero::TracePacket::kTrustedPacketSequenceIdFieldNumber,
     protos::pbzero::TracePacket::kTraceConfigFieldNumber,
@@ -41,6 +42,26 @@ const uint32_t kReservedFieldIds[] = {
     protos::pbzero::TracePacket::kSynchronizationMarkerFieldNumber,
 };
 
+constexpr uint64_t ReservedFieldsMask(size_t i = 0) {
+  return i == base::ArraySize(kReservedFieldIds)
+             ? 0
+             : (1ull << kReservedFieldIds[i]) | ReservedFieldsMask(i + 1);
+}
+
+// All the reserved ids are < 64 (the shift above would otherwise fail to
+// compile), hence they are checked with a single bitmask test.
+constexpr uint64_t kReservedFieldsMask = ReservedFieldsMask();
+
+inline bool IsReservedField(uint32_t field_id) {
+  return field_id < 64 && ((kReservedFieldsMask >> field_id) & 1);
+}
+
+// The fast path in ParseFieldsInSlice() only parses a field if its preamble
+// and its varint value (or length) are guaranteed to be within the slice,
+// even if they have the maximum size.
+constexpr size_t kMaxVarIntSize = 10;
+constexpr size_t kFastPathMinBytes = 2 * kMaxVarIntSize;
+
 // This translation unit is quite subtle and perf-sensitive. Remember to check
 // BM_PacketStreamValidator in perfetto_benchmarks when making changes.
 
@@ -89,11 +110,9 @@ class ProtoFieldParserFSM {
         uint64_t field_type = varint & 7;  // 7 = 0..0111
         auto field_id = static_cast<uint32_t>(varint >> 3);
         // Check if the field id is reserved, go into an error state if it is.
-        for (size_t i = 0; i < base::ArraySize(kReservedFieldIds); ++i) {
-          if (field_id == kReservedFieldIds[i]) {
-            state_ = kWroteReservedField;
-            return 0;
-          }
+        if (IsReservedField(field_id)) {
+          state_ = kWroteReservedField;
+          return 0;
         }
         // The field type is legit, now check it's well formed and within
         // boundaries.
@@ -144,6 +163,9 @@ class ProtoFieldParserFSM {
   // if the FSM is back to the state where it should parse the next field and
   // hasn't started parsing any preamble.
   bool valid() const { return state_ == kFieldPreamble && varint_shift_ == 0; }
+
+  // True if the next byte pushed would be the first one of a field preamble.
+  bool at_field_boundary() const { return valid(); }
   int state() const { return static_cast<int>(state_); }
 
  private:
@@ -164,6 +186,68 @@ class ProtoFieldParserFSM {
   uint32_t varint_shift_ = 0;
 };
 
+// Fast path for the (common) case of fields which don't straddle a slice
+// boundary: parses whole fields starting at |*ptr|, decoding their varints in
+// one go rather than pushing them one byte at a time into the FSM. Stops when
+// fewer than kFastPathMinBytes are left in the slice, leaving the rest to the
+// FSM, or when the payload of a length-delimited or fixed field continues past
+// the end of the slice, in which case |*skip_bytes| is set to the bytes still
+// to be skipped. Returns false if the packet is invalid, with the same rules as
+// ProtoFieldParserFSM.
+bool ParseFieldsInSlice(const uint8_t** ptr,
+                        const uint8_t* end,
+                        size_t* skip_bytes) {
+  using protozero::proto_utils::ParseVarInt;
+  const uint8_t* pos = *ptr;
+  while (static_cast<size_t>(end - pos) >= kFastPathMinBytes) {
+    uint64_t preamble;
+    const uint8_t* next = ParseVarInt(pos, end, &preamble);
+    if (next == pos)
+      return false;  // VarInt larger than 64 bits.
+    if (IsReservedField(static_cast<uint32_t>(preamble >> 3)))
+      return false;
+
+    uint64_t payload_size;
+    switch (static_cast<ProtoWireType>(preamble & 7)) {
+      case ProtoWireType::kVarInt: {
+        uint64_t value;
+        const uint8_t* value_end = ParseVarInt(next, end, &value);
+        if (value_end == next)
+          return false;
+        pos = value_end;
+        continue;
+      }
+      case ProtoWireType::kFixed32:
+        payload_size = 4;
+        break;
+      case ProtoWireType::kFixed64:
+        payload_size = 8;
+        break;
+      case ProtoWireType::kLengthDelimited: {
+        const uint8_t* len_end = ParseVarInt(next, end, &payload_size);
+        if (len_end == next ||
+            payload_size > protozero::proto_utils::kMaxMessageLength) {
+          return false;
+        }
+        next = len_end;
+        break;
+      }
+      default:
+        return false;  // Unknown field type.
+    }
+
+    if (payload_size > static_cast<uint64_t>(end - next)) {
+      *ptr = end;
+      *skip_bytes =
+          static_cast<size_t>(payload_size) - static_cast<size_t>(end - next);
+      return true;
+    }
+    pos = next + payload_size;
+  }
+  *ptr = pos;
+  return true;
+}
+
 }  // namespace
 
 // static
@@ -171,16 +255,25 @@ bool PacketStreamValidator::Validate(const Slices& slices) {
   ProtoFieldParserFSM parser;
   size_t skip_bytes = 0;
   for (const Slice& slice : slices) {
-    for (size_t i = 0; i < slice.size;) {
-      const size_t skip_bytes_cur_slice = std::min(skip_bytes, slice.size - i);
-      if (skip_bytes_cur_slice > 0) {
-        i += skip_bytes_cur_slice;
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(slice.start);
+    const uint8_t* const end = ptr + slice.size;
+    while (ptr < end) {
+      if (skip_bytes > 0) {
+        const size_t skip_bytes_cur_slice =
+            std::min(skip_bytes, static_cast<size_t>(end - ptr));
+        ptr += skip_bytes_cur_slice;
         skip_bytes -= skip_bytes_cur_slice;
-      } else {
-        uint8_t octet = *(reinterpret_cast<const uint8_t*>(slice.start) + i);
-        skip_bytes = parser.Push(octet);
-        i++;
+        continue;
+      }
+      if (parser.at_field_boundary()) {
+        if (!ParseFieldsInSlice(&ptr, end, &skip_bytes)) {
+          PERFETTO_DLOG("Packet validation error (fast path)");
+          return false;
+        }
+        if (ptr == end)
+          break;
       }
+      skip_bytes = parser.Push(*ptr++);
     }
   }
   if (skip_bytes == 0 && parser.valid())
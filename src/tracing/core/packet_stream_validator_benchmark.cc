@@ -68,6 +68,41 @@ static void BM_PacketStreamValidator(benchmark::State& state) {
   PERFETTO_CHECK(res);
 }
 
+// Packets made of many small top-level fields (as e.g. track events), which
+// stress the parsing of the field preambles rather than the skipping of large
+// payloads, split into slices of state.range(0) bytes.
+static void BM_PacketStreamValidator_SmallFields(benchmark::State& state) {
+  using namespace perfetto;
+
+  std::vector<uint8_t> buf;
+  for (size_t num_packets = 0; num_packets < 64; num_packets++) {
+    protozero::HeapBuffered<protos::pbzero::TracePacket> packet;
+    packet->set_timestamp(1000ull * 1000 * 1000 * 3600 * 24 * 365);
+    packet->set_sequence_flags(2);
+    packet->set_for_testing()->set_str("event_name");
+    std::vector<uint8_t> packet_buf = packet.SerializeAsArray();
+    buf.insert(buf.end(), packet_buf.begin(), packet_buf.end());
+  }
+
+  Slices slices;
+  const auto slice_size = static_cast<size_t>(state.range(0));
+  for (size_t pos = 0; pos < buf.size(); pos += slice_size) {
+    size_t size = std::min(slice_size, buf.size() - pos);
+    Slice slice = Slice::Allocate(size);
+    memcpy(slice.own_data(), &buf[pos], size);
+    slices.emplace_back(std::move(slice));
+  }
+
+  bool res = true;
+  for (auto _ : state) {
+    res &= PacketStreamValidator::Validate(slices);
+  }
+  PERFETTO_CHECK(res);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(buf.size()));
+}
+
 }  // namespace
 
 BENCHMARK(BM_PacketStreamValidator);
+BENCHMARK(BM_PacketStreamValidator_SmallFields)->Arg(64)->Arg(512)->Arg(4096);
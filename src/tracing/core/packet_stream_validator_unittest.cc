@@ -151,6 +151,58 @@ TEST(PacketStreamValidatorTest, FragmentedPacketWithUid) {
   }
 }
 
+// Exercises both the in-slice fast path and the byte-by-byte parsing of the
+// fields which straddle slice boundaries.
+TEST(PacketStreamValidatorTest, ManyFieldsFragmented) {
+  // Concatenating serialized packets is equivalent to merging them.
+  std::string ser_buf;
+  for (size_t i = 0; i < 32; i++) {
+    protos::gen::TracePacket proto;
+    proto.set_timestamp(1000ull * 1000 * 1000 * 3600 * 24 * 365 + i);
+    proto.mutable_for_testing()->set_str(std::string(i, 'x'));
+    ser_buf += proto.SerializeAsString();
+  }
+  std::string ser_buf_with_uid = ser_buf;
+  protos::gen::TracePacket uid_proto;
+  uid_proto.set_trusted_uid(123);
+  ser_buf_with_uid.insert(ser_buf.size() / 2, uid_proto.SerializeAsString());
+
+  for (size_t i = 0; i < ser_buf.size(); i += 7) {
+    for (size_t j = i; j < ser_buf.size(); j += 13) {
+      Slices seq;
+      seq.emplace_back(&ser_buf[0], i);
+      seq.emplace_back(&ser_buf[i], j - i);
+      seq.emplace_back(&ser_buf[j], ser_buf.size() - j);
+      EXPECT_TRUE(PacketStreamValidator::Validate(seq));
+
+      Slices seq_with_uid;
+      seq_with_uid.emplace_back(&ser_buf_with_uid[0], i);
+      seq_with_uid.emplace_back(&ser_buf_with_uid[i], j - i);
+      seq_with_uid.emplace_back(&ser_buf_with_uid[j],
+                                ser_buf_with_uid.size() - j);
+      EXPECT_FALSE(PacketStreamValidator::Validate(seq_with_uid));
+    }
+  }
+}
+
+TEST(PacketStreamValidatorTest, VarIntTooLong) {
+  protos::gen::TracePacket proto;
+  proto.mutable_for_testing()->set_str(std::string(64, 'x'));
+  std::string ser_buf = proto.SerializeAsString();
+  // A varint field (timestamp) whose value has 11 bytes.
+  std::string varint_field = "\x40";
+  varint_field += std::string(10, '\xff');
+  varint_field += '\x01';
+  ser_buf = varint_field + ser_buf;
+
+  for (size_t i = 0; i < ser_buf.size(); i++) {
+    Slices seq;
+    seq.emplace_back(&ser_buf[0], i);
+    seq.emplace_back(&ser_buf[i], ser_buf.size() - i);
+    EXPECT_FALSE(PacketStreamValidator::Validate(seq));
+  }
+}
+
 TEST(PacketStreamValidatorTest, TruncatedPacket) {
   protos::gen::TracePacket proto;
   proto.mutable_for_testing()->set_str("string field");
@@ -17,9 +17,11 @@
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 #include <utility>
 
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/time.h"
@@ -46,12 +48,30 @@ MaybeUnboundBufferID MakeTargetBufferIdForReservation(uint16_t reservation_id) {
 bool IsReservationTargetBufferId(MaybeUnboundBufferID buffer_id) {
   return (buffer_id >> 16) > 0;
 }
+
+// The arbiter and page the current thread got its last chunk from, see
+// GetNewChunk(). Arbiters are identified by a unique id rather than by their
+// address, which can be reused by a later instance.
+struct PageAffinity {
+  uint32_t arbiter_id;
+  size_t page_idx;
+};
+PERFETTO_THREAD_LOCAL PageAffinity g_page_affinity;
+
+std::atomic<uint32_t> g_next_arbiter_id{1};
+
+// With adaptive batching, the latency of CommitData() requests is sampled once
+// every this many requests, as the acknowledgement costs an IPC reply.
+constexpr uint32_t kCommitLatencySamplingInterval = 16;
 }  // namespace
 
 // static
 SharedMemoryABI::PageLayout SharedMemoryArbiterImpl::default_page_layout =
     SharedMemoryABI::PageLayout::kPageDiv1;
 
+// static
+bool SharedMemoryArbiterImpl::adaptive_page_layout = true;
+
 // static
 constexpr BufferID SharedMemoryArbiterImpl::kInvalidBufferId;
 
@@ -81,7 +101,8 @@ SharedMemoryArbiterImpl::SharedMemoryArbiterImpl(
     size_t page_size,
     TracingService::ProducerEndpoint* producer_endpoint,
     base::TaskRunner* task_runner)
-    : initially_bound_(task_runner && producer_endpoint),
+    : arbiter_id_(g_next_arbiter_id.fetch_add(1, std::memory_order_relaxed)),
+      initially_bound_(task_runner && producer_endpoint),
       producer_endpoint_(producer_endpoint),
       task_runner_(task_runner),
       shmem_abi_(reinterpret_cast<uint8_t*>(start), size, page_size),
@@ -93,7 +114,6 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
     const SharedMemoryABI::ChunkHeader& header,
     BufferExhaustedPolicy buffer_exhausted_policy,
     size_t size_hint) {
-  PERFETTO_DCHECK(size_hint == 0);  // Not implemented yet.
   // If initially unbound, we do not support stalling. In theory, we could
   // support stalling for TraceWriters created after the arbiter and startup
   // buffer reservations were bound, but to avoid raciness between the creation
@@ -103,81 +123,99 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
 
   int stall_count = 0;
   unsigned stall_interval_us = 0;
-  bool task_runner_runs_on_current_thread = false;
   static const unsigned kMaxStallIntervalUs = 100000;
   static const int kLogAfterNStalls = 3;
   static const int kFlushCommitsAfterEveryNStalls = 2;
   static const int kAssertAtNStalls = 100;
 
-  for (;;) {
-    // TODO(primiano): Probably this lock is not really required and this code
-    // could be rewritten leveraging only the Try* atomic operations in
-    // SharedMemoryABI. But let's not be too adventurous for the moment.
-    {
-      std::unique_lock<std::mutex> scoped_lock(lock_);
+  // Only used if the first free page found needs to be partitioned. Chunks in
+  // pages already partitioned are used regardless of their size.
+  const SharedMemoryABI::PageLayout layout = GetPageLayoutForSizeHint(size_hint);
 
-      task_runner_runs_on_current_thread =
-          task_runner_ && task_runner_->RunsTasksOnCurrentThread();
+  for (;;) {
+    // This doesn't take |lock_|: pages are partitioned and chunks acquired
+    // with atomic compare-and-swaps on the page headers, so concurrent writers
+    // can't get the same chunk. Each thread starts looking from the page it
+    // got its last chunk from, so threads tend to fill different pages
+    // instead of contending on the same page header.
+    const size_t num_pages = shmem_abi_.num_pages();
+    size_t initial_page_idx = page_idx_.load(std::memory_order_relaxed);
+    if (g_page_affinity.arbiter_id == arbiter_id_)
+      initial_page_idx = g_page_affinity.page_idx;
+    for (size_t i = 0; i < num_pages; i++) {
+      const size_t page_idx = (initial_page_idx + i) % num_pages;
+      bool is_new_page = false;
+      if (shmem_abi_.is_page_free(page_idx))
+        is_new_page = shmem_abi_.TryPartitionPage(page_idx, layout);
+      uint32_t free_chunks;
+      if (is_new_page) {
+        free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
+      } else {
+        free_chunks = shmem_abi_.GetFreeChunks(page_idx);
+      }
 
-      // If more than half of the SMB.size() is filled with completed chunks for
-      // which we haven't notified the service yet (i.e. they are still enqueued
-      // in |commit_data_req_|), force a synchronous CommitDataRequest() even if
-      // we acquire a chunk, to reduce the likeliness of stalling the writer.
-      //
-      // We can only do this if we're writing on the same thread that we access
-      // the producer endpoint on, since we cannot notify the producer endpoint
-      // to commit synchronously on a different thread. Attempting to flush
-      // synchronously on another thread will lead to subtle bugs caused by
-      // out-of-order commit requests (crbug.com/919187#c28).
-      bool should_commit_synchronously =
-          task_runner_runs_on_current_thread &&
-          buffer_exhausted_policy == BufferExhaustedPolicy::kStall &&
-          commit_data_req_ && bytes_pending_commit_ >= shmem_abi_.size() / 2;
-
-      const size_t initial_page_idx = page_idx_;
-      for (size_t i = 0; i < shmem_abi_.num_pages(); i++) {
-        page_idx_ = (initial_page_idx + i) % shmem_abi_.num_pages();
-        bool is_new_page = false;
-
-        // TODO(primiano): make the page layout dynamic.
-        auto layout = SharedMemoryArbiterImpl::default_page_layout;
-
-        if (shmem_abi_.is_page_free(page_idx_)) {
-          // TODO(primiano): Use the |size_hint| here to decide the layout.
-          is_new_page = shmem_abi_.TryPartitionPage(page_idx_, layout);
-        }
-        uint32_t free_chunks;
-        if (is_new_page) {
-          free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
-        } else {
-          free_chunks = shmem_abi_.GetFreeChunks(page_idx_);
+      for (uint32_t chunk_idx = 0; free_chunks;
+           chunk_idx++, free_chunks >>= 1) {
+        if (!(free_chunks & 1))
+          continue;
+        // We found a free chunk.
+        Chunk chunk =
+            shmem_abi_.TryAcquireChunkForWriting(page_idx, chunk_idx, &header);
+        if (!chunk.is_valid())
+          continue;
+        if (stall_count > kLogAfterNStalls) {
+          PERFETTO_LOG("Recovered from stall after %d iterations",
+                       stall_count);
         }
-
-        for (uint32_t chunk_idx = 0; free_chunks;
-             chunk_idx++, free_chunks >>= 1) {
-          if (!(free_chunks & 1))
-            continue;
-          // We found a free chunk.
-          Chunk chunk = shmem_abi_.TryAcquireChunkForWriting(
-              page_idx_, chunk_idx, &header);
-          if (!chunk.is_valid())
-            continue;
-          if (stall_count > kLogAfterNStalls) {
-            PERFETTO_LOG("Recovered from stall after %d iterations",
-                         stall_count);
+        g_page_affinity.arbiter_id = arbiter_id_;
+        g_page_affinity.page_idx = page_idx;
+        if (i > 0)
+          page_idx_.store(page_idx, std::memory_order_relaxed);
+        stats_.chunks_acquired.fetch_add(1, std::memory_order_relaxed);
+        stats_.chunk_bytes_acquired.fetch_add(chunk.size(),
+                                              std::memory_order_relaxed);
+
+        // If more than half of the SMB.size() is filled with completed chunks
+        // for which we haven't notified the service yet (i.e. they are still
+        // enqueued in |commit_data_req_|), force a synchronous
+        // CommitDataRequest() even if we acquire a chunk, to reduce the
+        // likeliness of stalling the writer. |bytes_pending_commit_| is
+        // checked without the lock first, to keep |lock_| out of the common
+        // case.
+        //
+        // We can only do this if we're writing on the same thread that we
+        // access the producer endpoint on, since we cannot notify the producer
+        // endpoint to commit synchronously on a different thread. Attempting
+        // to flush synchronously on another thread will lead to subtle bugs
+        // caused by out-of-order commit requests (crbug.com/919187#c28).
+        if (buffer_exhausted_policy == BufferExhaustedPolicy::kStall &&
+            bytes_pending_commit_.load(std::memory_order_relaxed) >=
+                shmem_abi_.size() / 2) {
+          bool should_commit_synchronously;
+          {
+            std::lock_guard<std::mutex> scoped_lock(lock_);
+            should_commit_synchronously =
+                task_runner_ && task_runner_->RunsTasksOnCurrentThread() &&
+                (commit_data_req_ || direct_commits_enabled_) &&
+                bytes_pending_commit_ >= shmem_abi_.size() / 2;
           }
-
-          if (should_commit_synchronously) {
-            // We can't flush while holding the lock.
-            scoped_lock.unlock();
+          if (should_commit_synchronously)
             FlushPendingCommitDataRequests();
-            return chunk;
-          } else {
-            return chunk;
-          }
         }
+        return chunk;
       }
-    }  // scoped_lock
+    }
+
+    // All chunks are taken, we are going to either drop or stall below.
+    bool task_runner_runs_on_current_thread = false;
+    if (buffer_exhausted_policy == BufferExhaustedPolicy::kDrop) {
+      stats_.chunks_dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      stats_.stalls.fetch_add(1, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> scoped_lock(lock_);
+      task_runner_runs_on_current_thread =
+          task_runner_ && task_runner_->RunsTasksOnCurrentThread();
+    }
 
     if (buffer_exhausted_policy == BufferExhaustedPolicy::kDrop) {
       PERFETTO_DLOG("Shared memory buffer exhaused, returning invalid Chunk!");
@@ -229,25 +267,87 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
 void SharedMemoryArbiterImpl::ReturnCompletedChunk(
     Chunk chunk,
     MaybeUnboundBufferID target_buffer,
-    PatchList* patch_list) {
+    PatchList* patch_list,
+    size_t bytes_written) {
   PERFETTO_DCHECK(chunk.is_valid());
+  // Chunks that need patching, or whose writer has still patches to send for
+  // the previous chunks, go through |commit_data_req_| even with direct
+  // commits, so that the service gets the patches before the chunks that
+  // follow them.
+  if (direct_commits_enabled_ && patch_list->empty() &&
+      !(chunk.GetPacketCountAndFlags().second &
+        SharedMemoryABI::ChunkHeader::kChunkNeedsPatching)) {
+    ReturnCompletedChunkDirect(std::move(chunk), bytes_written);
+    return;
+  }
   const WriterID writer_id = chunk.writer_id();
   UpdateCommitDataRequest(std::move(chunk), writer_id, target_buffer,
-                          patch_list);
+                          patch_list, bytes_written);
+}
+
+void SharedMemoryArbiterImpl::ReturnCompletedChunkDirect(
+    Chunk chunk,
+    size_t bytes_written) {
+  const size_t chunk_size = chunk.size();
+  stats_.chunk_bytes_written.fetch_add(bytes_written,
+                                       std::memory_order_relaxed);
+  stats_.chunks_committed.fetch_add(1, std::memory_order_relaxed);
+
+  // This one has release-store semantics, the service can move the chunk from
+  // now on.
+  shmem_abi_.ReleaseChunkAsComplete(std::move(chunk));
+
+  // Commit straight away when crossing half of the SMB, otherwise within
+  // |direct_commits_max_delay_ms_| of the first chunk of the batch.
+  const size_t half_smb_size = shmem_abi_.size() / 2;
+  const size_t prev_pending = bytes_pending_commit_.fetch_add(chunk_size);
+  const bool smb_half_full = prev_pending < half_smb_size &&
+                             prev_pending + chunk_size >= half_smb_size;
+  if (!smb_half_full && direct_commit_scheduled_.exchange(true))
+    return;
+
+  // |task_runner_| is never reset, and direct commits are only enabled on
+  // arbiters created bound, hence it can be read without |lock_|.
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this, smb_half_full] {
+        if (!weak_this)
+          return;
+        if (!smb_half_full)
+          weak_this->direct_commit_scheduled_.store(false);
+        weak_this->FlushPendingCommitDataRequests();
+      },
+      smb_half_full ? 0 : direct_commits_max_delay_ms_);
 }
 
 void SharedMemoryArbiterImpl::SendPatches(WriterID writer_id,
                                           MaybeUnboundBufferID target_buffer,
                                           PatchList* patch_list) {
   PERFETTO_DCHECK(!patch_list->empty() && patch_list->front().is_patched());
-  UpdateCommitDataRequest(Chunk(), writer_id, target_buffer, patch_list);
+  UpdateCommitDataRequest(Chunk(), writer_id, target_buffer, patch_list,
+                          /*bytes_written=*/0);
+}
+
+SharedMemoryABI::PageLayout SharedMemoryArbiterImpl::GetPageLayoutForSizeHint(
+    size_t size_hint) {
+  if (size_hint == 0 || !adaptive_page_layout)
+    return default_page_layout;
+  for (uint32_t layout = SharedMemoryABI::kPageDiv14;
+       layout > SharedMemoryABI::kPageDiv1; layout--) {
+    const size_t chunk_size = shmem_abi_.GetChunkSizeForLayout(
+        layout << SharedMemoryABI::kLayoutShift);
+    if (chunk_size - sizeof(SharedMemoryABI::ChunkHeader) >= size_hint)
+      return static_cast<SharedMemoryABI::PageLayout>(layout);
+  }
+  return SharedMemoryABI::kPageDiv1;
 }
 
 void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
     Chunk chunk,
     WriterID writer_id,
     MaybeUnboundBufferID target_buffer,
-    PatchList* patch_list) {
+    PatchList* patch_list,
+    size_t bytes_written) {
   // Note: chunk will be invalid if the call came from SendPatches().
   base::TaskRunner* task_runner_to_post_delayed_callback_on = nullptr;
   // The delay with which the flush will be posted.
@@ -264,7 +364,7 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
       if (fully_bound_ && !delayed_flush_scheduled_) {
         weak_this = weak_ptr_factory_.GetWeakPtr();
         task_runner_to_post_delayed_callback_on = task_runner_;
-        flush_delay_ms = batch_commits_duration_ms_;
+        flush_delay_ms = GetBatchCommitsDurationLocked();
         delayed_flush_scheduled_ = true;
       }
     }
@@ -274,6 +374,8 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
       PERFETTO_DCHECK(chunk.writer_id() == writer_id);
       uint8_t chunk_idx = chunk.chunk_idx();
       bytes_pending_commit_ += chunk.size();
+      stats_.chunk_bytes_written.fetch_add(bytes_written,
+                                           std::memory_order_relaxed);
       size_t page_idx;
       // If the chunk needs patching, it should not be marked as complete yet,
       // because this would indicate to the service that the producer will not
@@ -285,9 +387,15 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
       // first time. If the producer then fully patched the chunk, thus removing
       // the kChunkNeedsPatching flag, and the service re-read the chunk after
       // the patching, the service would be thrown off by the removed flag.
-      if (direct_patching_enabled_ &&
-          (chunk.GetPacketCountAndFlags().second &
-           SharedMemoryABI::ChunkHeader::kChunkNeedsPatching)) {
+      //
+      // With direct commits, no chunk of |commit_data_req_| is marked as
+      // complete before the request is sent: the service moves all the
+      // completed chunks of the SMB on each CommitData(), it must not move
+      // (and free) a chunk before the request that lists it.
+      if (direct_commits_enabled_ ||
+          (direct_patching_enabled_ &&
+           (chunk.GetPacketCountAndFlags().second &
+            SharedMemoryABI::ChunkHeader::kChunkNeedsPatching))) {
         page_idx = shmem_abi_.GetPageAndChunkIndex(std::move(chunk)).first;
       } else {
         // If the chunk doesn't need patching, we can mark it as complete
@@ -355,9 +463,12 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
     // delayed flush to happen and we flush immediately. Otherwise, if we
     // accumulate the patch and a crash occurs before the patch is sent, the
     // service will not know of the patch and won't be able to reconstruct the
-    // trace.
-    if (fully_bound_ &&
-        (last_patch_req || bytes_pending_commit_ >= shmem_abi_.size() / 2)) {
+    // trace. With adaptive batching, the chunks committed but not yet read by
+    // the service are taken into account too.
+    bool smb_almost_full = bytes_pending_commit_ >= shmem_abi_.size() / 2;
+    if (!smb_almost_full && IsAdaptiveBatchingEnabledLocked())
+      smb_almost_full = GetFreeBytesInSMB() < shmem_abi_.size() / 4;
+    if (fully_bound_ && (last_patch_req || smb_almost_full)) {
       weak_this = weak_ptr_factory_.GetWeakPtr();
       task_runner_to_post_delayed_callback_on = task_runner_;
       flush_delay_ms = 0;
@@ -447,8 +558,11 @@ bool SharedMemoryArbiterImpl::TryDirectPatchLocked(
     // as the producer will not write to it anymore. This allows the service to
     // read the chunk in full while scraping, which would not be the case if the
     // chunk was left in a kChunkBeingWritten state.
+    // With direct commits, the chunk is completed only when
+    // |commit_data_req_| is sent, see UpdateCommitDataRequest().
     chunk.ClearNeedsPatchingFlag();
-    shmem_abi_.ReleaseChunkAsComplete(std::move(chunk));
+    if (!direct_commits_enabled_)
+      shmem_abi_.ReleaseChunkAsComplete(std::move(chunk));
   }
 
   return true;
@@ -460,6 +574,68 @@ void SharedMemoryArbiterImpl::SetBatchCommitsDuration(
   batch_commits_duration_ms_ = batch_commits_duration_ms;
 }
 
+void SharedMemoryArbiterImpl::EnableAdaptiveBatchCommits(
+    uint32_t max_batch_commits_duration_ms) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  adaptive_batch_commits_duration_ms_ = max_batch_commits_duration_ms;
+}
+
+void SharedMemoryArbiterImpl::SetMaxBatchCommitsDurationByService(
+    uint32_t max_batch_commits_duration_ms) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  max_batch_commits_duration_by_service_ms_ = max_batch_commits_duration_ms;
+}
+
+uint32_t SharedMemoryArbiterImpl::GetBatchCommitsDurationLocked() {
+  if (!IsAdaptiveBatchingEnabledLocked())
+    return batch_commits_duration_ms_;
+
+  const uint32_t max_duration_ms =
+      std::min(adaptive_batch_commits_duration_ms_,
+               max_batch_commits_duration_by_service_ms_);
+
+  // The chunks of the batch can't be read, and hence freed, by the service
+  // before the service has processed the commit. Keep the sum of the batching
+  // period and of the service latency within the max.
+  const uint64_t latency_ms = commit_latency_us_ / 1000;
+  uint64_t duration_ms =
+      latency_ms < max_duration_ms ? max_duration_ms - latency_ms : 0;
+
+  // Shrink the period as the SMB fills up, so that writers don't run out of
+  // chunks while the batch holds them.
+  duration_ms = duration_ms * GetFreeBytesInSMB() / shmem_abi_.size();
+
+  const auto res = static_cast<uint32_t>(duration_ms);
+  stats_.last_batch_commits_duration_ms.store(res, std::memory_order_relaxed);
+  return res;
+}
+
+size_t SharedMemoryArbiterImpl::GetFreeBytesInSMB() {
+  size_t free_bytes = 0;
+  for (size_t page_idx = 0; page_idx < shmem_abi_.num_pages(); page_idx++) {
+    if (shmem_abi_.is_page_free(page_idx)) {
+      free_bytes += shmem_abi_.page_size();
+      continue;
+    }
+    const uint32_t layout = shmem_abi_.GetPageLayout(page_idx);
+    const uint32_t free_chunks = shmem_abi_.GetFreeChunks(page_idx);
+    free_bytes += static_cast<size_t>(PERFETTO_POPCOUNT(free_chunks)) *
+                  shmem_abi_.GetChunkSizeForLayout(layout);
+  }
+  return free_bytes;
+}
+
+void SharedMemoryArbiterImpl::OnCommitDataAcked(uint64_t latency_us) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  if (commit_latency_us_ == 0) {
+    commit_latency_us_ = latency_us;
+  } else {
+    commit_latency_us_ = (commit_latency_us_ * 7 + latency_us) / 8;
+  }
+  stats_.commit_latency_us.store(commit_latency_us_,
+                                 std::memory_order_relaxed);
+}
+
 bool SharedMemoryArbiterImpl::EnableDirectSMBPatching() {
   std::lock_guard<std::mutex> scoped_lock(lock_);
   if (!direct_patching_supported_by_service_) {
@@ -469,6 +645,13 @@ bool SharedMemoryArbiterImpl::EnableDirectSMBPatching() {
   return direct_patching_enabled_ = true;
 }
 
+void SharedMemoryArbiterImpl::EnableDirectCommits(uint32_t max_delay_ms) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  PERFETTO_DCHECK(initially_bound_ && active_writer_ids_.IsEmpty());
+  direct_commits_enabled_ = true;
+  direct_commits_max_delay_ms_ = max_delay_ms;
+}
+
 void SharedMemoryArbiterImpl::SetDirectSMBPatchingSupportedByService() {
   std::lock_guard<std::mutex> scoped_lock(lock_);
   direct_patching_supported_by_service_ = true;
@@ -486,6 +669,7 @@ void SharedMemoryArbiterImpl::SetDirectSMBPatchingSupportedByService() {
 void SharedMemoryArbiterImpl::FlushPendingCommitDataRequests(
     std::function<void()> callback) {
   std::unique_ptr<CommitDataRequest> req;
+  bool sample_latency = false;
   {
     std::unique_lock<std::mutex> scoped_lock(lock_);
 
@@ -513,6 +697,11 @@ void SharedMemoryArbiterImpl::FlushPendingCommitDataRequests(
       return;
     }
 
+    // With direct commits, the service moves the completed chunks on any
+    // CommitData(), even one without chunks to move.
+    if (!commit_data_req_ && direct_commits_enabled_)
+      commit_data_req_.reset(new CommitDataRequest());
+
     // |commit_data_req_| could have become a nullptr, for example when a forced
     // sync flush happens in GetNewChunk().
     if (commit_data_req_) {
@@ -547,10 +736,30 @@ void SharedMemoryArbiterImpl::FlushPendingCommitDataRequests(
 
       req = std::move(commit_data_req_);
       bytes_pending_commit_ = 0;
+      stats_.commit_requests.fetch_add(1, std::memory_order_relaxed);
+      stats_.chunks_committed.fetch_add(
+          static_cast<uint64_t>(req->chunks_to_move_size()),
+          std::memory_order_relaxed);
+      if (IsAdaptiveBatchingEnabledLocked() &&
+          ++commits_since_latency_sample_ >= kCommitLatencySamplingInterval) {
+        commits_since_latency_sample_ = 0;
+        sample_latency = true;
+      }
     }
   }  // scoped_lock
 
-  if (req) {
+  if (req && sample_latency) {
+    auto weak_this = weak_ptr_factory_.GetWeakPtr();
+    const int64_t start_ns = base::GetWallTimeNs().count();
+    producer_endpoint_->CommitData(*req, [weak_this, start_ns, callback] {
+      if (weak_this) {
+        int64_t latency_ns = base::GetWallTimeNs().count() - start_ns;
+        weak_this->OnCommitDataAcked(static_cast<uint64_t>(latency_ns / 1000));
+      }
+      if (callback)
+        callback();
+    });
+  } else if (req) {
     producer_endpoint_->CommitData(*req, callback);
   } else if (callback) {
     // If |req| was nullptr, it means that an enqueued deferred commit was
@@ -568,6 +777,21 @@ bool SharedMemoryArbiterImpl::TryShutdown() {
   return active_writer_ids_.IsEmpty();
 }
 
+SharedMemoryArbiter::Stats SharedMemoryArbiterImpl::GetStats() {
+  Stats stats;
+  stats.chunks_acquired = stats_.chunks_acquired.load();
+  stats.chunk_bytes_acquired = stats_.chunk_bytes_acquired.load();
+  stats.chunk_bytes_written = stats_.chunk_bytes_written.load();
+  stats.stalls = stats_.stalls.load();
+  stats.chunks_dropped = stats_.chunks_dropped.load();
+  stats.commit_requests = stats_.commit_requests.load();
+  stats.chunks_committed = stats_.chunks_committed.load();
+  stats.last_batch_commits_duration_ms =
+      stats_.last_batch_commits_duration_ms.load();
+  stats.commit_latency_us = stats_.commit_latency_us.load();
+  return stats;
+}
+
 std::unique_ptr<TraceWriter> SharedMemoryArbiterImpl::CreateTraceWriter(
     BufferID target_buffer,
     BufferExhaustedPolicy buffer_exhausted_policy) {
@@ -635,8 +859,8 @@ void SharedMemoryArbiterImpl::BindStartupTargetBuffer(
 
   std::unique_lock<std::mutex> scoped_lock(lock_);
 
-  // We should already be bound to an endpoint, but not fully bound.
-  PERFETTO_CHECK(!fully_bound_);
+  // We should already be bound to an endpoint. We may be fully bound though,
+  // if no trace writer was created for the reservation yet.
   PERFETTO_CHECK(producer_endpoint_);
   PERFETTO_CHECK(task_runner_);
   PERFETTO_CHECK(task_runner_->RunsTasksOnCurrentThread());
@@ -668,8 +892,6 @@ void SharedMemoryArbiterImpl::AbortStartupTracingForReservation(
     return;
   }
 
-  PERFETTO_CHECK(!fully_bound_);
-
   // Bind the target buffer reservation to an invalid buffer (ID 0), so that
   // existing commits, as well as future commits (of currently acquired chunks),
   // will be released as free free by the service but otherwise ignored (i.e.
@@ -866,8 +1088,13 @@ void SharedMemoryArbiterImpl::ReleaseWriterID(WriterID id) {
   // unlocking, because |task_runner_| is never reset.
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
   task_runner->PostTask([weak_this, id] {
-    if (weak_this)
-      weak_this->producer_endpoint_->UnregisterTraceWriter(id);
+    if (!weak_this)
+      return;
+    // The service needs the writer to be registered to move the chunks
+    // returned with direct commits, move its last ones first.
+    if (weak_this->direct_commits_enabled_)
+      weak_this->FlushPendingCommitDataRequests();
+    weak_this->producer_endpoint_->UnregisterTraceWriter(id);
   });
 }
 
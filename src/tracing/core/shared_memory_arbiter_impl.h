@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -104,6 +105,8 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // Returns a new Chunk to write tracing data. Depending on the provided
   // BufferExhaustedPolicy, this may return an invalid chunk if no valid free
   // chunk could be found in the SMB.
+  // |size_hint| is the number of bytes the writer expects to write into the
+  // chunk, 0 if unknown. It is used to decide how to partition a free page.
   SharedMemoryABI::Chunk GetNewChunk(const SharedMemoryABI::ChunkHeader&,
                                      BufferExhaustedPolicy,
                                      size_t size_hint = 0);
@@ -116,9 +119,12 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // PatchList is a pointer to the list of patches for previous chunks. The
   // first patched entries will be removed from the patched list and sent over
   // to the service in the same CommitData() IPC request.
+  // |bytes_written| is the number of payload bytes used in the chunk, only for
+  // the Stats.
   void ReturnCompletedChunk(SharedMemoryABI::Chunk,
                             MaybeUnboundBufferID target_buffer,
-                            PatchList*);
+                            PatchList*,
+                            size_t bytes_written = 0);
 
   // Send a request to the service to apply completed patches from |patch_list|.
   // |writer_id| is the ID of the TraceWriter that calls this method,
@@ -127,10 +133,27 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
                    MaybeUnboundBufferID target_buffer,
                    PatchList* patch_list);
 
+  // Only for producers that live in the same process as the service. The
+  // completed chunks that don't need patching are just marked as complete in
+  // the SMB, without being added to a CommitDataRequest nor taking |lock_|.
+  // Each CommitData() then makes the service move all the completed chunks of
+  // the SMB into its buffers. A CommitData() is sent at most |max_delay_ms|
+  // after a chunk is completed, or straight away when half of the SMB is
+  // pending commit. Must be called before any TraceWriter is created.
+  void EnableDirectCommits(uint32_t max_delay_ms);
+
   SharedMemoryABI* shmem_abi_for_testing() { return &shmem_abi_; }
 
+  // Forces all pages to be partitioned with the |l| layout, regardless of the
+  // size hints.
   static void set_default_layout_for_testing(SharedMemoryABI::PageLayout l) {
     default_page_layout = l;
+    adaptive_page_layout = false;
+  }
+
+  static void reset_default_layout_for_testing() {
+    default_page_layout = SharedMemoryABI::PageLayout::kPageDiv1;
+    adaptive_page_layout = true;
   }
 
   // SharedMemoryArbiter implementation.
@@ -150,6 +173,12 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
 
   void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) override;
 
+  void EnableAdaptiveBatchCommits(
+      uint32_t max_batch_commits_duration_ms) override;
+
+  void SetMaxBatchCommitsDurationByService(
+      uint32_t max_batch_commits_duration_ms) override;
+
   bool EnableDirectSMBPatching() override;
 
   void SetDirectSMBPatchingSupportedByService() override;
@@ -157,6 +186,7 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   void FlushPendingCommitDataRequests(
       std::function<void()> callback = {}) override;
   bool TryShutdown() override;
+  Stats GetStats() override;
 
   base::TaskRunner* task_runner() const { return task_runner_; }
   size_t page_size() const { return shmem_abi_.page_size(); }
@@ -180,7 +210,10 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // reservation ID in |target_buffer_reservations_|.
   static constexpr BufferID kInvalidBufferId = 0;
 
+  // The layout used to partition pages when there's no size hint. If
+  // |adaptive_page_layout| is false, it's used for all pages.
   static SharedMemoryABI::PageLayout default_page_layout;
+  static bool adaptive_page_layout;
 
   SharedMemoryArbiterImpl(const SharedMemoryArbiterImpl&) = delete;
   SharedMemoryArbiterImpl& operator=(const SharedMemoryArbiterImpl&) = delete;
@@ -188,7 +221,12 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   void UpdateCommitDataRequest(SharedMemoryABI::Chunk chunk,
                                WriterID writer_id,
                                MaybeUnboundBufferID target_buffer,
-                               PatchList* patch_list);
+                               PatchList* patch_list,
+                               size_t bytes_written);
+
+  // Returns the layout with the smallest chunks that can fit |size_hint| bytes
+  // of payload, or the default one if there's no hint.
+  SharedMemoryABI::PageLayout GetPageLayoutForSizeHint(size_t size_hint);
 
   // Search the chunks that are being batched in |commit_data_req_| for a chunk
   // that needs patching and that matches the provided |writer_id| and
@@ -209,6 +247,29 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // Called by the TraceWriter destructor.
   void ReleaseWriterID(WriterID);
 
+  // Returns |chunk| with EnableDirectCommits(), see there.
+  void ReturnCompletedChunkDirect(SharedMemoryABI::Chunk chunk,
+                                  size_t bytes_written);
+
+  // Returns the batching period for a new batch of commits, see
+  // SharedMemoryArbiter::EnableAdaptiveBatchCommits().
+  uint32_t GetBatchCommitsDurationLocked();
+
+  // Whether adaptive batching is enabled on both the producer and service
+  // side.
+  bool IsAdaptiveBatchingEnabledLocked() const {
+    return adaptive_batch_commits_duration_ms_ &&
+           max_batch_commits_duration_by_service_ms_;
+  }
+
+  // Returns the size of the free chunks and pages of the SMB. This is only an
+  // estimate, as chunks are concurrently acquired and freed.
+  size_t GetFreeBytesInSMB();
+
+  // Called when the service acknowledged a CommitData() request sent
+  // |latency_us| before.
+  void OnCommitDataAcked(uint64_t latency_us);
+
   void BindStartupTargetBufferImpl(std::unique_lock<std::mutex> scoped_lock,
                                    uint16_t target_buffer_reservation_id,
                                    BufferID target_buffer_id);
@@ -227,20 +288,53 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // state.
   bool UpdateFullyBoundLocked();
 
+  // Identifies this instance in the thread-local page affinity of
+  // GetNewChunk().
+  const uint32_t arbiter_id_;
+
   const bool initially_bound_;
 
   // Only accessed on |task_runner_| after the producer endpoint was bound.
   TracingService::ProducerEndpoint* producer_endpoint_ = nullptr;
 
+  // Page to start looking for a free chunk from, for threads that haven't
+  // acquired a chunk yet. Accessed without |lock_| by GetNewChunk().
+  std::atomic<size_t> page_idx_{0};
+
+  // See Stats. Updated without |lock_| by GetNewChunk().
+  struct AtomicStats {
+    std::atomic<uint64_t> chunks_acquired{0};
+    std::atomic<uint64_t> chunk_bytes_acquired{0};
+    std::atomic<uint64_t> chunk_bytes_written{0};
+    std::atomic<uint64_t> stalls{0};
+    std::atomic<uint64_t> chunks_dropped{0};
+    std::atomic<uint64_t> commit_requests{0};
+    std::atomic<uint64_t> chunks_committed{0};
+    std::atomic<uint32_t> last_batch_commits_duration_ms{0};
+    std::atomic<uint64_t> commit_latency_us{0};
+  };
+  AtomicStats stats_;
+
+  // Whether a delayed CommitData() for the chunks returned with direct commits
+  // is already scheduled, see EnableDirectCommits().
+  std::atomic<bool> direct_commit_scheduled_{false};
+
   // --- Begin lock-protected members ---
 
   std::mutex lock_;
 
   base::TaskRunner* task_runner_ = nullptr;
+
+  // GetNewChunk() acquires chunks without |lock_|, relying on the atomic
+  // Try*() operations of SharedMemoryABI.
   SharedMemoryABI shmem_abi_;
-  size_t page_idx_ = 0;
   std::unique_ptr<CommitDataRequest> commit_data_req_;
-  size_t bytes_pending_commit_ = 0;  // SUM(chunk.size() : commit_data_req_).
+
+  // SUM(chunk.size() : commit_data_req_), plus the size of the chunks returned
+  // with direct commits since the last CommitData(). Only modified with |lock_|
+  // held (except by ReturnCompletedChunkDirect()), but read without it by
+  // GetNewChunk().
+  std::atomic<size_t> bytes_pending_commit_{0};
   IdAllocator<WriterID> active_writer_ids_;
   bool did_shutdown_ = false;
 
@@ -262,9 +356,25 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // See SharedMemoryArbiter::SetBatchCommitsDuration.
   uint32_t batch_commits_duration_ms_ = 0;
 
+  // See SharedMemoryArbiter::EnableAdaptiveBatchCommits and
+  // SetMaxBatchCommitsDurationByService.
+  uint32_t adaptive_batch_commits_duration_ms_ = 0;
+  uint32_t max_batch_commits_duration_by_service_ms_ = 0;
+
+  // Moving average of the time between sending a CommitData() request and
+  // the service acknowledging it, sampled every few commits with adaptive
+  // batching.
+  uint64_t commit_latency_us_ = 0;
+  uint32_t commits_since_latency_sample_ = 0;
+
   // See SharedMemoryArbiter::EnableDirectSMBPatching.
   bool direct_patching_enabled_ = false;
 
+  // See EnableDirectCommits(). Set before any TraceWriter is created and never
+  // changed afterwards, hence also read without |lock_|.
+  bool direct_commits_enabled_ = false;
+  uint32_t direct_commits_max_delay_ms_ = 0;
+
   // See SharedMemoryArbiter::SetDirectSMBPatchingSupportedByService.
   bool direct_patching_supported_by_service_ = false;
 
@@ -17,6 +17,10 @@
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 
 #include <bitset>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/commit_data_request.h"
@@ -224,6 +228,57 @@ TEST_P(SharedMemoryArbiterImplTest, BatchCommits) {
   arbiter_->FlushPendingCommitDataRequests();
 }
 
+TEST_P(SharedMemoryArbiterImplTest, AdaptiveBatchCommits) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  PatchList ignored;
+
+  // Adaptive batching is not used until the service supports it.
+  arbiter_->EnableAdaptiveBatchCommits(UINT32_MAX);
+  SharedMemoryABI::Chunk chunk =
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(1);
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 0, &ignored);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // Once it does, commits are batched. As in BatchCommits, the very large max
+  // duration prevents the delayed flush from running within the test.
+  arbiter_->SetMaxBatchCommitsDurationByService(UINT32_MAX);
+  chunk = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(0);
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 0, &ignored);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // The batching period is shortened because 2 pages of the SMB are used.
+  uint32_t duration_ms = arbiter_->GetStats().last_batch_commits_duration_ms;
+  EXPECT_GT(duration_ms, 0u);
+  EXPECT_LT(duration_ms, UINT32_MAX);
+
+  // When the SMB is almost full, the batch is committed right away.
+  static constexpr size_t kNumHeldChunks = kNumPages - 3;
+  SharedMemoryABI::Chunk held_chunks[kNumHeldChunks];
+  for (size_t i = 0; i < kNumHeldChunks; i++) {
+    held_chunks[i] = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+    ASSERT_TRUE(held_chunks[i].is_valid());
+  }
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(2, req.chunks_to_move_size());
+      }));
+  arbiter_->ReturnCompletedChunk(std::move(held_chunks[0]), 0, &ignored);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  SharedMemoryArbiter::Stats stats = arbiter_->GetStats();
+  EXPECT_EQ(stats.commit_requests, 2u);
+  EXPECT_EQ(stats.chunks_committed, 3u);
+}
+
 // Helper for verifying trace writer id allocations.
 class TraceWriterIdChecker : public FakeProducerEndpoint {
  public:
@@ -260,6 +315,63 @@ class TraceWriterIdChecker : public FakeProducerEndpoint {
 };
 
 // Check that we can actually create up to kMaxWriterID TraceWriter(s).
+TEST_P(SharedMemoryArbiterImplTest, DirectCommits) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  SharedMemoryABI* abi = arbiter_->shmem_abi_for_testing();
+  arbiter_->SetDirectSMBPatchingSupportedByService();
+  ASSERT_TRUE(arbiter_->EnableDirectSMBPatching());
+  // As in BatchCommits, the commits are triggered manually.
+  arbiter_->EnableDirectCommits(UINT32_MAX);
+
+  // A chunk that doesn't need patching is marked as complete straight away,
+  // without being listed in a commit request.
+  PatchList ignored;
+  SharedMemoryABI::Chunk chunk =
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+  ASSERT_TRUE(chunk.is_valid());
+  std::pair<size_t, size_t> direct_idx = abi->GetPageAndChunkIndex(chunk);
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(0);
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+  EXPECT_EQ(SharedMemoryABI::kChunkComplete,
+            abi->GetChunkState(direct_idx.first, direct_idx.second));
+
+  // A chunk that needs patching is listed in the commit request, and marked as
+  // complete only when the request is sent.
+  chunk = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+  ASSERT_TRUE(chunk.is_valid());
+  std::pair<size_t, size_t> patched_idx = abi->GetPageAndChunkIndex(chunk);
+  chunk.SetFlag(SharedMemoryABI::ChunkHeader::kChunkNeedsPatching);
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 2, &ignored);
+  EXPECT_EQ(SharedMemoryABI::kChunkBeingWritten,
+            abi->GetChunkState(patched_idx.first, patched_idx.second));
+
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([abi, patched_idx](
+                           const CommitDataRequest& req,
+                           MockProducerEndpoint::CommitDataCallback) {
+        ASSERT_EQ(1, req.chunks_to_move_size());
+        EXPECT_EQ(patched_idx.first, req.chunks_to_move()[0].page());
+        EXPECT_EQ(patched_idx.second, req.chunks_to_move()[0].chunk());
+        EXPECT_EQ(2u, req.chunks_to_move()[0].target_buffer());
+        EXPECT_EQ(SharedMemoryABI::kChunkComplete,
+                  abi->GetChunkState(patched_idx.first, patched_idx.second));
+      }));
+  arbiter_->FlushPendingCommitDataRequests();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+
+  // A commit request is sent even without chunks to move, for the service to
+  // move the completed chunks.
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _))
+      .WillOnce(Invoke([](const CommitDataRequest& req,
+                          MockProducerEndpoint::CommitDataCallback) {
+        EXPECT_EQ(0, req.chunks_to_move_size());
+      }));
+  arbiter_->FlushPendingCommitDataRequests();
+}
+
 TEST_P(SharedMemoryArbiterImplTest, WriterIDsAllocation) {
   auto checkpoint = task_runner_->CreateCheckpoint("last_unregistered");
 
@@ -341,6 +453,108 @@ TEST_P(SharedMemoryArbiterImplTest, BufferExhaustedPolicyDrop) {
   ASSERT_TRUE(chunks[0].is_valid());
 }
 
+// Verify that free pages are partitioned according to the size hint passed to
+// GetNewChunk(), unless a layout is forced.
+TEST_P(SharedMemoryArbiterImplTest, AdaptivePageLayout) {
+  SharedMemoryArbiterImpl::reset_default_layout_for_testing();
+  SharedMemoryABI* abi = arbiter_->shmem_abi_for_testing();
+
+  // Returns the number of chunks of the page of the chunk acquired for
+  // |size_hint|. All other chunks of the page are acquired too, so that the
+  // next call has to partition a new page.
+  auto get_num_chunks_for_hint = [&](size_t size_hint) -> uint32_t {
+    SharedMemoryABI::Chunk chunk =
+        arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kStall, size_hint);
+    EXPECT_TRUE(chunk.is_valid());
+    size_t page_idx = abi->GetPageAndChunkIndex(chunk).first;
+    uint32_t num_chunks =
+        SharedMemoryABI::GetNumChunksForLayout(abi->GetPageLayout(page_idx));
+    for (uint32_t i = 1; i < num_chunks; i++) {
+      EXPECT_TRUE(arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kStall)
+                      .is_valid());
+    }
+    EXPECT_EQ(abi->GetFreeChunks(page_idx), 0u);
+    return num_chunks;
+  };
+
+  // Small writers get the smallest chunks.
+  EXPECT_EQ(get_num_chunks_for_hint(100), 14u);
+
+  // A hint larger than the page gets the whole page.
+  EXPECT_EQ(get_num_chunks_for_hint(page_size() * 2), 1u);
+
+  // Otherwise the page is divided in as many chunks as possible.
+  EXPECT_EQ(get_num_chunks_for_hint(page_size() / 3), 2u);
+
+  // No hint: use the default layout.
+  EXPECT_EQ(get_num_chunks_for_hint(0), 1u);
+
+  // Forcing a layout disables the adaptation.
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv2);
+  EXPECT_EQ(get_num_chunks_for_hint(100), 2u);
+
+  SharedMemoryArbiterImpl::reset_default_layout_for_testing();
+}
+
+TEST_P(SharedMemoryArbiterImplTest, Stats) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  SharedMemoryABI::Chunk chunks[kNumPages];
+  for (size_t i = 0; i < kNumPages; i++) {
+    chunks[i] = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+    ASSERT_TRUE(chunks[i].is_valid());
+  }
+  const size_t chunk_size = chunks[0].size();
+  ASSERT_FALSE(
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop).is_valid());
+
+  PatchList ignored;
+  arbiter_->ReturnCompletedChunk(std::move(chunks[0]), 1, &ignored,
+                                 /*bytes_written=*/42);
+
+  SharedMemoryArbiter::Stats stats = arbiter_->GetStats();
+  EXPECT_EQ(stats.chunks_acquired, kNumPages);
+  EXPECT_EQ(stats.chunk_bytes_acquired, kNumPages * chunk_size);
+  EXPECT_EQ(stats.chunk_bytes_written, 42u);
+  EXPECT_EQ(stats.chunks_dropped, 1u);
+  EXPECT_EQ(stats.stalls, 0u);
+}
+
+// Chunks are acquired without taking the arbiter lock. Verify that concurrent
+// writers never get the same chunk.
+TEST_P(SharedMemoryArbiterImplTest, ConcurrentGetNewChunk) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv14);
+  static constexpr size_t kNumThreads = 8;
+  std::vector<std::vector<uint8_t*>> chunks_per_thread(kNumThreads);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    std::vector<uint8_t*>* chunks = &chunks_per_thread[i];
+    threads.emplace_back([this, chunks] {
+      for (;;) {
+        SharedMemoryABI::Chunk chunk =
+            arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+        if (!chunk.is_valid())
+          break;
+        chunks->push_back(chunk.begin());
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  std::set<uint8_t*> all_chunks;
+  size_t num_chunks = 0;
+  for (const auto& chunks : chunks_per_thread) {
+    all_chunks.insert(chunks.begin(), chunks.end());
+    num_chunks += chunks.size();
+  }
+  EXPECT_EQ(num_chunks, kNumPages * 14);
+  EXPECT_EQ(all_chunks.size(), num_chunks);
+  EXPECT_EQ(arbiter_->GetStats().chunks_acquired, num_chunks);
+}
+
 TEST_P(SharedMemoryArbiterImplTest, CreateUnboundAndBind) {
   auto checkpoint_writer = task_runner_->CreateCheckpoint("writer_registered");
   auto checkpoint_flush = task_runner_->CreateCheckpoint("flush_completed");
@@ -16,6 +16,7 @@
 
 #include "src/tracing/core/trace_buffer.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "perfetto/base/logging.h"
@@ -67,13 +68,24 @@ constexpr size_t TraceBuffer::InlineChunkHeaderSize = sizeof(ChunkRecord);
 // static
 std::unique_ptr<TraceBuffer> TraceBuffer::Create(size_t size_in_bytes,
                                                  OverwritePolicy pol) {
-  std::unique_ptr<TraceBuffer> trace_buffer(new TraceBuffer(pol));
+  return Create(size_in_bytes, pol, MemoryOptions());
+}
+
+// static
+std::unique_ptr<TraceBuffer> TraceBuffer::Create(
+    size_t size_in_bytes,
+    OverwritePolicy pol,
+    const MemoryOptions& memory_options) {
+  std::unique_ptr<TraceBuffer> trace_buffer(
+      new TraceBuffer(pol, memory_options));
   if (!trace_buffer->Initialize(size_in_bytes))
     return nullptr;
   return trace_buffer;
 }
 
-TraceBuffer::TraceBuffer(OverwritePolicy pol) : overwrite_policy_(pol) {
+TraceBuffer::TraceBuffer(OverwritePolicy pol,
+                         const MemoryOptions& memory_options)
+    : memory_options_(memory_options), overwrite_policy_(pol) {
   // See comments in ChunkRecord for the rationale of this.
   static_assert(sizeof(ChunkRecord) == sizeof(SharedMemoryABI::PageHeader) +
                                            sizeof(SharedMemoryABI::ChunkHeader),
@@ -82,23 +94,69 @@ TraceBuffer::TraceBuffer(OverwritePolicy pol) : overwrite_policy_(pol) {
 
 TraceBuffer::~TraceBuffer() = default;
 
+std::unique_ptr<TraceBuffer> TraceBuffer::CloneReadOnly() const {
+  std::unique_ptr<TraceBuffer> clone(
+      new TraceBuffer(overwrite_policy_, memory_options_));
+  if (!clone->Initialize(size_))
+    return nullptr;
+  clone->read_only_ = true;
+  clone->discard_writes_ = discard_writes_;
+  clone->stats_ = stats_;
+
+  // Until the first wrap, nothing has been written past |wptr_|.
+  const size_t used_size = stats_.write_wrap_count() > 0
+                               ? size_
+                               : static_cast<size_t>(wptr_ - begin());
+  clone->data_.EnsureCommitted(used_size);
+  memcpy(clone->begin(), begin(), used_size);
+  clone->wptr_ = clone->begin() + (wptr_ - begin());
+
+  // Copy the index, rebasing the ChunkRecord pointers into the new buffer.
+  // |sequences_| is already sorted and the chunks are inserted in order.
+  for (const ChunkSequence* seq : sequences_) {
+    ChunkSequence* clone_seq =
+        clone->GetOrCreateSequence(seq->producer_id, seq->writer_id);
+    clone_seq->last_chunk_id_written = seq->last_chunk_id_written;
+    for (size_t i = 0; i < seq->size(); i++) {
+      ChunkMeta meta = (*seq)[i];
+      meta.chunk_record = reinterpret_cast<ChunkRecord*>(
+          clone->begin() +
+          (reinterpret_cast<uint8_t*>(meta.chunk_record) - begin()));
+      clone_seq->Insert(meta);
+    }
+  }
+  clone->read_iter_ = clone->GetReadIterForSequence(0);
+  return clone;
+}
+
 bool TraceBuffer::Initialize(size_t size) {
   static_assert(
       SharedMemoryABI::kMinPageSize % sizeof(ChunkRecord) == 0,
       "sizeof(ChunkRecord) must be an integer divider of a page size");
-  data_ = base::PagedMemory::Allocate(
-      size, base::PagedMemory::kMayFail | base::PagedMemory::kDontCommit);
+  int alloc_flags =
+      base::PagedMemory::kMayFail | base::PagedMemory::kDontCommit;
+  if (memory_options_.huge_pages)
+    alloc_flags |= base::PagedMemory::kHugePages;
+  data_ = base::PagedMemory::Allocate(size, alloc_flags);
   if (!data_.IsValid()) {
     PERFETTO_ELOG("Trace buffer allocation failed (size: %zu)", size);
     return false;
   }
+  // The buffer is not touched yet (kDontCommit), so all its pages will be
+  // allocated according to the policy.
+  if (memory_options_.numa_node >= 0 &&
+      !data_.AdvisePreferredNumaNode(
+          static_cast<uint32_t>(memory_options_.numa_node))) {
+    PERFETTO_DLOG("Could not set the NUMA node of the trace buffer to %d",
+                  memory_options_.numa_node);
+  }
   size_ = size;
   stats_.set_buffer_size(size);
   max_chunk_size_ = std::min(size, ChunkRecord::kMaxSize);
   wptr_ = begin();
-  index_.clear();
-  last_chunk_id_written_.clear();
-  read_iter_ = GetReadIterForSequence(index_.end());
+  index_.Clear();
+  sequences_.clear();
+  read_iter_ = GetReadIterForSequence(0);
   return true;
 }
 
@@ -114,6 +172,8 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
                                      bool chunk_complete,
                                      const uint8_t* src,
                                      size_t size) {
+  PERFETTO_CHECK(!read_only_);
+
   // |record_size| = |size| + sizeof(ChunkRecord), rounded up to avoid to end
   // up in a fragmented state where size_to_end() < sizeof(ChunkRecord).
   const size_t record_size =
@@ -157,9 +217,9 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // before receiving commit requests for them from the producer. Note that the
   // service may scrape and thus override chunks in arbitrary order since the
   // chunks aren't ordered in the SMB.
-  const auto it = index_.find(key);
-  if (PERFETTO_UNLIKELY(it != index_.end())) {
-    ChunkMeta* record_meta = &it->second;
+  ChunkSequence* seq = FindSequence(producer_id_trusted, writer_id);
+  ChunkMeta* record_meta = seq ? seq->Find(chunk_id) : nullptr;
+  if (PERFETTO_UNLIKELY(record_meta)) {
     ChunkRecord* prev = record_meta->chunk_record;
 
     // Verify that the old chunk's metadata corresponds to the new one.
@@ -191,13 +251,11 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
     // chunk N after having read from chunk N+1, thereby violating sequential
     // read of packets. This shouldn't happen if the producer is well-behaved,
     // because it shouldn't start chunk N+1 before completing chunk N.
-    ChunkMeta::Key subsequent_key = key;
     static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                   "ChunkID wraps");
-    subsequent_key.chunk_id++;
-    const auto subsequent_it = index_.find(subsequent_key);
-    if (subsequent_it != index_.end() &&
-        subsequent_it->second.num_fragments_read > 0) {
+    const ChunkMeta* subsequent_meta =
+        seq->Find(static_cast<ChunkID>(chunk_id + 1));
+    if (subsequent_meta && subsequent_meta->num_fragments_read > 0) {
       stats_.set_abi_violations(stats_.abi_violations() + 1);
       PERFETTO_DCHECK(suppress_client_dchecks_for_testing_);
       return;
@@ -232,6 +290,12 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   if (PERFETTO_UNLIKELY(discard_writes_))
     return DiscardWrite();
 
+  if (PERFETTO_UNLIKELY(frozen_)) {
+    stats_.set_chunks_discarded(stats_.chunks_discarded() + 1);
+    TRACE_BUFFER_DLOG("  discarding write, the buffer is frozen");
+    return;
+  }
+
   // If there isn't enough room from the given write position. Write a padding
   // record to clear the end of the buffer and wrap back.
   const size_t cached_size_to_end = size_to_end();
@@ -274,10 +338,10 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // Now first insert the new chunk. At the end, if necessary, add the padding.
   stats_.set_chunks_written(stats_.chunks_written() + 1);
   stats_.set_bytes_written(stats_.bytes_written() + record_size);
-  auto it_and_inserted = index_.emplace(
-      key, ChunkMeta(GetChunkRecordAt(wptr_), num_fragments, chunk_complete,
-                     chunk_flags, producer_uid_trusted));
-  PERFETTO_DCHECK(it_and_inserted.second);
+  if (!seq)
+    seq = GetOrCreateSequence(producer_id_trusted, writer_id);
+  seq->Insert(ChunkMeta(GetChunkRecordAt(wptr_), chunk_id, num_fragments,
+                        chunk_complete, chunk_flags, producer_uid_trusted));
   TRACE_BUFFER_DLOG("  copying @ [%lu - %lu] %zu", wptr_ - begin(),
                     uintptr_t(wptr_ - begin()) + record_size, record_size);
   WriteChunkRecord(wptr_, record, src, size);
@@ -302,8 +366,7 @@ void TraceBuffer::CopyChunkUntrusted(ProducerID producer_id_trusted,
   // last_chunk_id shouldn't be updated even though it's larger (e.g. |chunk_id|
   // = kMaxChunkId and |last_chunk_id| = 1; chunk_id - last_chunk_id =
   // kMaxChunkId - 1).
-  auto producer_and_writer_id = std::make_pair(producer_id_trusted, writer_id);
-  ChunkID& last_chunk_id = last_chunk_id_written_[producer_and_writer_id];
+  ChunkID& last_chunk_id = seq->last_chunk_id_written;
   static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                 "This code assumes that ChunkID wraps at kMaxChunkID");
   if (chunk_id - last_chunk_id < kMaxChunkID / 2) {
@@ -328,7 +391,7 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   TRACE_BUFFER_DLOG("Delete [%zu %zu]", wptr_ - begin(), search_end - begin());
   DcheckIsAlignedAndWithinBounds(wptr_);
   PERFETTO_DCHECK(search_end <= end());
-  std::vector<ChunkMap::iterator> index_delete;
+  chunks_to_delete_.clear();
   uint64_t chunks_overwritten = stats_.chunks_overwritten();
   uint64_t bytes_overwritten = stats_.bytes_overwritten();
   uint64_t padding_bytes_cleared = stats_.padding_bytes_cleared();
@@ -354,17 +417,19 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     // records are not part of the index).
     if (PERFETTO_LIKELY(!next_chunk.is_padding)) {
       ChunkMeta::Key key(next_chunk);
-      auto it = index_.find(key);
+      ChunkSequence* seq = FindSequence(key.producer_id, key.writer_id);
+      const ChunkMeta* meta = seq ? seq->Find(key.chunk_id) : nullptr;
       bool will_remove = false;
-      if (PERFETTO_LIKELY(it != index_.end())) {
-        const ChunkMeta& meta = it->second;
-        if (PERFETTO_UNLIKELY(meta.num_fragments_read < meta.num_fragments)) {
+      if (PERFETTO_LIKELY(meta)) {
+        if (PERFETTO_UNLIKELY(meta->num_fragments_read < meta->num_fragments)) {
           if (overwrite_policy_ == kDiscard)
             return -1;
           chunks_overwritten++;
           bytes_overwritten += next_chunk.size;
+          if (overwrite_callback_)
+            NotifyChunkOverwritten(*meta, key.producer_id, key.writer_id);
         }
-        index_delete.push_back(it);
+        chunks_to_delete_.emplace_back(seq, key.chunk_id);
         will_remove = true;
       }
       TRACE_BUFFER_DLOG(
@@ -386,9 +451,14 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     PERFETTO_CHECK(next_chunk_ptr <= end());
   }
 
-  // Remove from the index.
-  for (auto it : index_delete) {
-    index_.erase(it);
+  // Remove from the index. Chunks are usually deleted in the same order they
+  // were written, so this usually erases the front of each sequence.
+  for (const auto& seq_and_chunk_id : chunks_to_delete_) {
+    ChunkSequence* seq = seq_and_chunk_id.first;
+    size_t pos = seq->LowerBound(seq_and_chunk_id.second);
+    PERFETTO_DCHECK(pos < seq->size() &&
+                    (*seq)[pos].chunk_id == seq_and_chunk_id.second);
+    seq->Erase(pos);
   }
   stats_.set_chunks_overwritten(chunks_overwritten);
   stats_.set_bytes_overwritten(bytes_overwritten);
@@ -398,6 +468,34 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   return static_cast<ssize_t>(next_chunk_ptr - search_end);
 }
 
+void TraceBuffer::NotifyChunkOverwritten(const ChunkMeta& chunk_meta,
+                                         ProducerID producer_id,
+                                         WriterID writer_id) {
+  // The contents of chunks waiting for patches are not final.
+  if (chunk_meta.flags & kChunkNeedsPatching)
+    return;
+
+  const size_t payload_size =
+      chunk_meta.chunk_record->size - sizeof(ChunkRecord);
+  if (chunk_meta.cur_fragment_offset >= payload_size)
+    return;
+
+  OverwrittenChunk chunk;
+  chunk.sequence_properties = {producer_id, chunk_meta.trusted_uid, writer_id};
+  chunk.chunk_id = chunk_meta.chunk_id;
+  chunk.fragments = reinterpret_cast<const uint8_t*>(chunk_meta.chunk_record) +
+                    sizeof(ChunkRecord) + chunk_meta.cur_fragment_offset;
+  chunk.size = payload_size - chunk_meta.cur_fragment_offset;
+  chunk.num_fragments = static_cast<uint16_t>(chunk_meta.num_fragments -
+                                              chunk_meta.num_fragments_read);
+  chunk.flags = chunk_meta.flags;
+  if (chunk_meta.num_fragments_read > 0)
+    chunk.flags &= ~kFirstPacketContinuesFromPrevChunk;
+  if (!chunk_meta.is_complete())
+    chunk.flags |= kLastPacketContinuesOnNextChunk;
+  overwrite_callback_(chunk);
+}
+
 void TraceBuffer::AddPaddingRecord(size_t size) {
   PERFETTO_DCHECK(size >= sizeof(ChunkRecord) && size <= ChunkRecord::kMaxSize);
   ChunkRecord record(size);
@@ -415,13 +513,15 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
                                         const Patch* patches,
                                         size_t patches_size,
                                         bool other_patches_pending) {
+  PERFETTO_CHECK(!read_only_);
   ChunkMeta::Key key(producer_id, writer_id, chunk_id);
-  auto it = index_.find(key);
-  if (it == index_.end()) {
+  ChunkSequence* seq = FindSequence(producer_id, writer_id);
+  ChunkMeta* chunk_meta_ptr = seq ? seq->Find(chunk_id) : nullptr;
+  if (!chunk_meta_ptr) {
     stats_.set_patches_failed(stats_.patches_failed() + 1);
     return false;
   }
-  ChunkMeta& chunk_meta = it->second;
+  ChunkMeta& chunk_meta = *chunk_meta_ptr;
 
   // Check that the index is consistent with the actual ProducerID/WriterID
   // stored in the ChunkRecord.
@@ -467,80 +567,153 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
 }
 
 void TraceBuffer::BeginRead() {
-  read_iter_ = GetReadIterForSequence(index_.begin());
+  read_iter_ = GetReadIterForSequence(0);
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = false;
 #endif
 }
 
 TraceBuffer::SequenceIterator TraceBuffer::GetReadIterForSequence(
-    ChunkMap::iterator seq_begin) {
+    size_t seq_index) {
+  // Skip the sequences whose chunks have all been overwritten.
+  while (seq_index < sequences_.size() && sequences_[seq_index]->empty())
+    seq_index++;
+
   SequenceIterator iter;
-  iter.seq_begin = seq_begin;
-  if (seq_begin == index_.end()) {
-    iter.cur = iter.seq_end = index_.end();
+  iter.seq_index = seq_index;
+  if (seq_index >= sequences_.size())
     return iter;
-  }
 
-#if PERFETTO_DCHECK_IS_ON()
-  // Either |seq_begin| is == index_.begin() or the item immediately before must
-  // belong to a different {ProducerID, WriterID} sequence.
-  if (seq_begin != index_.begin() && seq_begin != index_.end()) {
-    auto prev_it = seq_begin;
-    prev_it--;
-    PERFETTO_DCHECK(
-        seq_begin == index_.begin() ||
-        std::tie(prev_it->first.producer_id, prev_it->first.writer_id) <
-            std::tie(seq_begin->first.producer_id, seq_begin->first.writer_id));
-  }
-#endif
+  iter.seq = sequences_[seq_index];
+  iter.seq_end = iter.seq->size();
+  PERFETTO_DCHECK(iter.seq_end > 0);
 
-  // Find the first entry that has a greater {ProducerID, WriterID} (or just
-  // index_.end() if we reached the end).
-  ChunkMeta::Key key = seq_begin->first;  // Deliberate copy.
-  key.chunk_id = kMaxChunkID;
-  iter.seq_end = index_.upper_bound(key);
-  PERFETTO_DCHECK(iter.seq_begin != iter.seq_end);
-
-  // Now find the first entry between [seq_begin, seq_end) that is
-  // > last_chunk_id_written_. This is where we the sequence will start (see
-  // notes about wrapping of IDs in the header).
-  auto producer_and_writer_id = std::make_pair(key.producer_id, key.writer_id);
-  PERFETTO_DCHECK(last_chunk_id_written_.count(producer_and_writer_id));
-  iter.wrapping_id = last_chunk_id_written_[producer_and_writer_id];
-  key.chunk_id = iter.wrapping_id;
-  iter.cur = index_.upper_bound(key);
+  // Now find the first chunk that is > |last_chunk_id_written|. This is where
+  // the sequence will start (see notes about wrapping of IDs in the header).
+  iter.wrapping_id = iter.seq->last_chunk_id_written;
+  iter.cur = iter.wrapping_id == kMaxChunkID
+                 ? iter.seq_end
+                 : iter.seq->LowerBound(iter.wrapping_id + 1);
   if (iter.cur == iter.seq_end)
-    iter.cur = iter.seq_begin;
+    iter.cur = 0;
   return iter;
 }
 
+TraceBuffer::ChunkSequence* TraceBuffer::GetOrCreateSequence(
+    ProducerID producer_id,
+    WriterID writer_id) {
+  ChunkSequence* seq = FindSequence(producer_id, writer_id);
+  if (seq)
+    return seq;
+  seq = new ChunkSequence(producer_id, writer_id);
+  index_.Insert(SequenceKey(producer_id, writer_id),
+                std::unique_ptr<ChunkSequence>(seq));
+
+  // New sequences are rare compared to writes, keep |sequences_| sorted here
+  // rather than sorting it on every read.
+  auto pos = std::lower_bound(
+      sequences_.begin(), sequences_.end(), seq,
+      [](const ChunkSequence* a, const ChunkSequence* b) {
+        return SequenceKey(a->producer_id, a->writer_id) <
+               SequenceKey(b->producer_id, b->writer_id);
+      });
+  sequences_.insert(pos, seq);
+  return seq;
+}
+
 void TraceBuffer::SequenceIterator::MoveNext() {
   // Stop iterating when we reach the end of the sequence.
-  // Note: |seq_begin| might be == |seq_end|.
-  if (cur == seq_end || cur->first.chunk_id == wrapping_id) {
+  // Note: |cur| might be already == |seq_end|.
+  if (cur == seq_end || (*seq)[cur].chunk_id == wrapping_id) {
     cur = seq_end;
     return;
   }
 
   // If the current chunk wasn't completed yet, we shouldn't advance past it as
   // it may be rewritten with additional packets.
-  if (!cur->second.is_complete()) {
+  if (!(*seq)[cur].is_complete()) {
     cur = seq_end;
     return;
   }
 
-  ChunkID last_chunk_id = cur->first.chunk_id;
+  ChunkID last_chunk_id = (*seq)[cur].chunk_id;
   if (++cur == seq_end)
-    cur = seq_begin;
+    cur = 0;
 
   // There may be a missing chunk in the sequence of chunks, in which case the
   // next chunk's ID won't follow the last one's. If so, skip the rest of the
   // sequence. We'll return to it later once the hole is filled.
-  if (last_chunk_id + 1 != cur->first.chunk_id)
+  if (last_chunk_id + 1 != (*seq)[cur].chunk_id)
     cur = seq_end;
 }
 
+size_t TraceBuffer::ChunkSequence::LowerBound(ChunkID chunk_id) const {
+  if (size_ == 0 || chunk_id > slot(size_ - 1).chunk_id)
+    return size_;
+
+  // Fast path: if there are no holes in the ChunkIDs the position of the chunk
+  // is just its distance from the first one.
+  size_t offset = static_cast<ChunkID>(chunk_id - slot(0).chunk_id);
+  if (offset < size_ && slot(offset).chunk_id == chunk_id)
+    return offset;
+
+  size_t begin = 0;
+  size_t end = size_;
+  while (begin < end) {
+    size_t mid = begin + (end - begin) / 2;
+    if (slot(mid).chunk_id < chunk_id) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return begin;
+}
+
+TraceBuffer::ChunkMeta* TraceBuffer::ChunkSequence::Insert(
+    const ChunkMeta& meta) {
+  size_t pos = LowerBound(meta.chunk_id);
+  PERFETTO_DCHECK(pos == size_ || slot(pos).chunk_id != meta.chunk_id);
+  if (size_ == capacity_)
+    Grow();
+
+  // Shift the shorter side of the ring to make room at |pos|.
+  if (pos < size_ / 2) {
+    begin_ = (begin_ - 1) & (capacity_ - 1);
+    for (size_t i = 0; i < pos; i++)
+      slot(i) = slot(i + 1);
+  } else {
+    for (size_t i = size_; i > pos; i--)
+      slot(i) = slot(i - 1);
+  }
+  size_++;
+  slot(pos) = meta;
+  return &slot(pos);
+}
+
+void TraceBuffer::ChunkSequence::Erase(size_t pos) {
+  PERFETTO_DCHECK(pos < size_);
+  if (pos < size_ / 2) {
+    for (size_t i = pos; i > 0; i--)
+      slot(i) = slot(i - 1);
+    begin_ = (begin_ + 1) & (capacity_ - 1);
+  } else {
+    for (size_t i = pos; i + 1 < size_; i++)
+      slot(i) = slot(i + 1);
+  }
+  size_--;
+}
+
+void TraceBuffer::ChunkSequence::Grow() {
+  size_t new_capacity = capacity_ ? capacity_ * 2 : 4;
+  std::unique_ptr<ChunkMeta[]> new_slots(new ChunkMeta[new_capacity]);
+  for (size_t i = 0; i < size_; i++)
+    new_slots[i] = slot(i);
+  slots_ = std::move(new_slots);
+  capacity_ = new_capacity;
+  begin_ = 0;
+}
+
 bool TraceBuffer::ReadNextTracePacket(
     TracePacket* packet,
     PacketSequenceProperties* sequence_properties,
@@ -568,16 +741,18 @@ bool TraceBuffer::ReadNextTracePacket(
   for (;; read_iter_.MoveNext()) {
     if (PERFETTO_UNLIKELY(!read_iter_.is_valid())) {
       // We ran out of chunks in the current {ProducerID, WriterID} sequence or
-      // we just reached the index_.end().
+      // we just reached the end of |sequences_|.
 
-      if (PERFETTO_UNLIKELY(read_iter_.seq_end == index_.end()))
+      if (PERFETTO_UNLIKELY(read_iter_.seq_index >= sequences_.size()))
         return false;
 
       // We reached the end of sequence, move to the next one.
-      // Note: ++read_iter_.seq_end might become index_.end(), but
-      // GetReadIterForSequence() knows how to deal with that.
-      read_iter_ = GetReadIterForSequence(read_iter_.seq_end);
-      PERFETTO_DCHECK(read_iter_.is_valid() && read_iter_.cur != index_.end());
+      // Note: |seq_index| + 1 might be past the last sequence (or all the
+      // following ones might be empty), but GetReadIterForSequence() knows how
+      // to deal with that.
+      read_iter_ = GetReadIterForSequence(read_iter_.seq_index + 1);
+      if (PERFETTO_UNLIKELY(!read_iter_.is_valid()))
+        return false;
       previous_packet_dropped = true;
     }
 
@@ -20,12 +20,17 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
 #include <array>
+#include <functional>
 #include <limits>
-#include <map>
+#include <memory>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/thread_annotations.h"
 #include "perfetto/ext/base/utils.h"
@@ -161,12 +166,48 @@ class TraceBuffer {
     WriterID writer_id;
   };
 
+  // The unread part of a chunk which is about to be overwritten, see
+  // set_overwrite_callback().
+  struct OverwrittenChunk {
+    PacketSequenceProperties sequence_properties;
+    ChunkID chunk_id;
+
+    // The unread fragments, each preceded by its varint size, as in the SMB.
+    const uint8_t* fragments;
+    size_t size;
+    uint16_t num_fragments;
+
+    // See SharedMemoryABI::ChunkHeader::flags. Relative to |fragments|: the
+    // first flag is cleared if some fragments were already read, the last is
+    // set if the chunk wasn't complete.
+    uint8_t flags;
+  };
+  using OverwriteCallback = std::function<void(const OverwrittenChunk&)>;
+
+  // How the memory of the buffer is backed, see TraceConfig.BufferConfig.
+  struct MemoryOptions {
+    // Back the buffer with transparent huge pages (best effort).
+    bool huge_pages = false;
+
+    // If >= 0, prefer allocating the pages of the buffer on this NUMA node.
+    int32_t numa_node = -1;
+  };
+
   // Can return nullptr if the memory allocation fails.
   static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
                                              OverwritePolicy = kOverwrite);
+  static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
+                                             OverwritePolicy,
+                                             const MemoryOptions&);
 
   ~TraceBuffer();
 
+  // Returns a snapshot of the buffer, including its read state, which can only
+  // be read: CopyChunkUntrusted() and TryPatchChunkContents() must not be
+  // called on it. Only the part of the buffer that has been written so far is
+  // copied. Returns nullptr if the memory allocation fails.
+  std::unique_ptr<TraceBuffer> CloneReadOnly() const;
+
   // Copies a Chunk from a producer Shared Memory Buffer into the trace buffer.
   // |src| points to the first packet in the SharedMemoryABI's chunk shared with
   // an untrusted producer. "untrusted" here means: the producer might be
@@ -259,9 +300,39 @@ class TraceBuffer {
                            PacketSequenceProperties* sequence_properties,
                            bool* previous_packet_on_sequence_dropped);
 
+  // Sets a callback which is invoked, in kOverwrite mode, for each chunk that
+  // is about to be overwritten before all its packets have been read. The
+  // callback is invoked synchronously from CopyChunkUntrusted() and must not
+  // call back into this TraceBuffer. Chunks which are still waiting for
+  // patches are not passed to the callback.
+  void set_overwrite_callback(OverwriteCallback callback) {
+    overwrite_callback_ = std::move(callback);
+  }
+
+  // Stops the write position from moving: from now on CopyChunkUntrusted()
+  // only accepts chunks which are already in the buffer (i.e. scraped chunks
+  // being completed by the producer's commit) and discards any other chunk.
+  // Patches to the chunks in the buffer are still applied. Used to preserve
+  // the contents of the buffer at the time of a trigger, without waiting for
+  // the final flush.
+  void Freeze() { frozen_ = true; }
+  bool frozen() const { return frozen_; }
+
   const TraceStats::BufferStats& stats() const { return stats_; }
   size_t size() const { return size_; }
 
+  // Returns the size of the chunks which haven't been read (nor overwritten)
+  // yet, including the padding between them. See BufferStats.bytes_read.
+  size_t used_size() const {
+    uint64_t added = stats_.bytes_written() + stats_.padding_bytes_written();
+    uint64_t removed = stats_.bytes_read() + stats_.bytes_overwritten() +
+                       stats_.padding_bytes_cleared();
+    if (added <= removed)
+      return 0;
+    return static_cast<size_t>(
+        std::min(added - removed, static_cast<uint64_t>(size_)));
+  }
+
  private:
   friend class TraceBufferTest;
 
@@ -333,7 +404,7 @@ class TraceBuffer {
   // This struct should not have any field that is essential for reconstructing
   // the contents of the buffer from a crash dump.
   struct ChunkMeta {
-    // Key used for sorting in the map.
+    // Identifies a chunk within the buffer.
     struct Key {
       Key(ProducerID p, WriterID w, ChunkID c)
           : producer_id{p}, writer_id{w}, chunk_id{c} {}
@@ -341,14 +412,6 @@ class TraceBuffer {
       explicit Key(const ChunkRecord& cr)
           : Key(cr.producer_id, cr.writer_id, cr.chunk_id) {}
 
-      // Note that this sorting doesn't keep into account the fact that ChunkID
-      // will wrap over at some point. The extra logic in SequenceIterator deals
-      // with that.
-      bool operator<(const Key& other) const {
-        return std::tie(producer_id, writer_id, chunk_id) <
-               std::tie(other.producer_id, other.writer_id, other.chunk_id);
-      }
-
       bool operator==(const Key& other) const {
         return std::tie(producer_id, writer_id, chunk_id) ==
                std::tie(other.producer_id, other.writer_id, other.chunk_id);
@@ -356,9 +419,6 @@ class TraceBuffer {
 
       bool operator!=(const Key& other) const { return !(*this == other); }
 
-      // These fields should match at all times the corresponding fields in
-      // the |chunk_record|. They are copied here purely for efficiency to avoid
-      // dereferencing the buffer all the time.
       ProducerID producer_id;
       WriterID writer_id;
       ChunkID chunk_id;
@@ -377,8 +437,20 @@ class TraceBuffer {
       kLastReadPacketSkipped = 1 << 1
     };
 
-    ChunkMeta(ChunkRecord* r, uint16_t p, bool complete, uint8_t f, uid_t u)
-        : chunk_record{r}, trusted_uid{u}, flags{f}, num_fragments{p} {
+    // Only used for the unused slots of ChunkSequence.
+    ChunkMeta() = default;
+
+    ChunkMeta(ChunkRecord* r,
+              ChunkID c,
+              uint16_t p,
+              bool complete,
+              uint8_t f,
+              uid_t u)
+        : chunk_record{r},
+          trusted_uid{u},
+          chunk_id{c},
+          flags{f},
+          num_fragments{p} {
       if (complete)
         index_flags = kComplete;
     }
@@ -405,8 +477,14 @@ class TraceBuffer {
       }
     }
 
-    ChunkRecord* const chunk_record;  // Addr of ChunkRecord within |data_|.
-    const uid_t trusted_uid;          // uid of the producer.
+    // These fields are not const only because ChunkMeta(s) are moved around
+    // within the ring array of their ChunkSequence.
+    ChunkRecord* chunk_record = nullptr;  // Addr of ChunkRecord within |data_|.
+    uid_t trusted_uid = 0;                // uid of the producer.
+
+    // Matches |chunk_record->chunk_id|. Copied here purely for efficiency to
+    // avoid dereferencing the buffer while searching a sequence.
+    ChunkID chunk_id = 0;
 
     // Flags set by TraceBuffer to track the state of the chunk in the index.
     uint8_t index_flags = 0;
@@ -427,12 +505,80 @@ class TraceBuffer {
     uint16_t cur_fragment_offset = 0;
   };
 
-  using ChunkMap = std::map<ChunkMeta::Key, ChunkMeta>;
+  // The index entries of all the chunks of a {ProducerID, WriterID} sequence,
+  // sorted by ChunkID. They are stored in a ring array: writers produce
+  // chunks with increasing IDs and the oldest chunks are the first ones to be
+  // overwritten, so new entries are usually appended at the back and stale
+  // ones removed from the front, both in O(1). As ChunkIDs are usually
+  // contiguous, a lookup is usually just an offset from the first ChunkID and
+  // falls back on a binary search if there are holes.
+  // Note that the sorting doesn't take into account the fact that ChunkID will
+  // wrap over at some point. The extra logic in SequenceIterator deals with
+  // that.
+  class ChunkSequence {
+   public:
+    ChunkSequence(ProducerID p, WriterID w) : producer_id(p), writer_id(w) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    ChunkMeta& operator[](size_t i) {
+      PERFETTO_DCHECK(i < size_);
+      return slot(i);
+    }
+    const ChunkMeta& operator[](size_t i) const {
+      PERFETTO_DCHECK(i < size_);
+      return slot(i);
+    }
+
+    // Returns the position of the first chunk with an ID >= |chunk_id|, or
+    // size() if there is none.
+    size_t LowerBound(ChunkID chunk_id) const;
+
+    // Returns nullptr if there is no chunk with the given ID.
+    ChunkMeta* Find(ChunkID chunk_id) {
+      size_t pos = LowerBound(chunk_id);
+      if (pos < size_ && slot(pos).chunk_id == chunk_id)
+        return &slot(pos);
+      return nullptr;
+    }
+
+    // Inserts |meta| keeping the chunks sorted. There must not be a chunk with
+    // the same ID already. Invalidates the pointers to the entries.
+    ChunkMeta* Insert(const ChunkMeta& meta);
+
+    // Removes the chunk at |pos|. Invalidates the pointers to the entries.
+    void Erase(size_t pos);
+
+    const ProducerID producer_id;
+    const WriterID writer_id;
 
-  // Allows to iterate over a sub-sequence of |index_| for all keys belonging to
-  // the same {ProducerID,WriterID}. Furthermore takes into account the wrapping
-  // of ChunkID. Instances are valid only as long as the |index_| is not altered
-  // (can be used safely only between adjacent ReadNextTracePacket() calls).
+    // Keeps track of the highest ChunkID written for this sequence, taking
+    // into account a potential overflow of ChunkIDs. In the case of overflow,
+    // stores the highest ChunkID written since the overflow.
+    ChunkID last_chunk_id_written = 0;
+
+   private:
+    ChunkSequence(const ChunkSequence&) = delete;
+    ChunkSequence& operator=(const ChunkSequence&) = delete;
+
+    ChunkMeta& slot(size_t i) { return slots_[(begin_ + i) & (capacity_ - 1)]; }
+    const ChunkMeta& slot(size_t i) const {
+      return slots_[(begin_ + i) & (capacity_ - 1)];
+    }
+
+    void Grow();
+
+    std::unique_ptr<ChunkMeta[]> slots_;
+    size_t capacity_ = 0;  // Always 0 or a power of two.
+    size_t begin_ = 0;     // Index in |slots_| of the chunk at position 0.
+    size_t size_ = 0;
+  };
+
+  // Allows to iterate over the chunks of a {ProducerID,WriterID} sequence,
+  // taking into account the wrapping of ChunkID. Instances are valid only as
+  // long as the index is not altered (can be used safely only between adjacent
+  // ReadNextTracePacket() calls).
   // The order of the iteration will proceed in the following order:
   // |wrapping_id| + 1 -> |seq_end|, |seq_begin| -> |wrapping_id|.
   // Practical example:
@@ -443,41 +589,46 @@ class TraceBuffer {
   //   through a CopyChunkUntrusted()).
   // The resulting iteration order will be: c5, c6, c7, c0, c1, c2, c3, c4.
   struct SequenceIterator {
-    // Points to the 1st key (the one with the numerically min ChunkID).
-    ChunkMap::iterator seq_begin;
+    // The sequence being iterated. nullptr if there are no more sequences.
+    ChunkSequence* seq = nullptr;
+
+    // Position of |seq| in |sequences_|, == sequences_.size() if there are no
+    // more sequences.
+    size_t seq_index = 0;
 
-    // Points one past the last key (the one with the numerically max ChunkID).
-    ChunkMap::iterator seq_end;
+    // Position within |seq| of the current chunk. The 1st chunk (the one
+    // with the numerically min ChunkID) is at position 0.
+    size_t cur = 0;
 
-    // Current iterator, always >= seq_begin && <= seq_end.
-    ChunkMap::iterator cur;
+    // One past the last chunk (the one with the numerically max ChunkID).
+    size_t seq_end = 0;
 
     // The latest ChunkID written. Determines the start/end of the sequence.
-    ChunkID wrapping_id;
+    ChunkID wrapping_id = 0;
 
     bool is_valid() const { return cur != seq_end; }
 
     ProducerID producer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.producer_id;
+      return seq->producer_id;
     }
 
     WriterID writer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.writer_id;
+      return seq->writer_id;
     }
 
     ChunkID chunk_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.chunk_id;
+      return (*seq)[cur].chunk_id;
     }
 
     ChunkMeta& operator*() {
       PERFETTO_DCHECK(is_valid());
-      return cur->second;
+      return (*seq)[cur];
     }
 
-    // Moves |cur| to the next chunk in the index.
+    // Moves |cur| to the next chunk in the sequence.
     // is_valid() will become false after calling this, if this was the last
     // entry of the sequence.
     void MoveNext();
@@ -497,20 +648,31 @@ class TraceBuffer {
     kFailedEmptyPacket,
   };
 
-  explicit TraceBuffer(OverwritePolicy);
+  TraceBuffer(OverwritePolicy, const MemoryOptions&);
   TraceBuffer(const TraceBuffer&) = delete;
   TraceBuffer& operator=(const TraceBuffer&) = delete;
 
   bool Initialize(size_t size);
 
-  // Returns an object that allows to iterate over chunks in the |index_| that
-  // have the same {ProducerID, WriterID} of
-  // |seq_begin.first.{producer,writer}_id|. |seq_begin| must be an iterator to
-  // the first entry in the |index_| that has a different {ProducerID, WriterID}
-  // from the previous one. It is valid for |seq_begin| to be == index_.end()
-  // (i.e. if the index is empty). The iteration takes care of ChunkID wrapping,
-  // by using |last_chunk_id_|.
-  SequenceIterator GetReadIterForSequence(ChunkMap::iterator seq_begin);
+  // Returns an object that allows to iterate over the chunks of the first
+  // non-empty sequence in |sequences_| at or after |seq_index|. It is valid for
+  // |seq_index| to be >= sequences_.size(), in which case the returned iterator
+  // is not valid. The iteration takes care of ChunkID wrapping, by using
+  // |last_chunk_id_written|.
+  SequenceIterator GetReadIterForSequence(size_t seq_index);
+
+  ChunkSequence* FindSequence(ProducerID producer_id, WriterID writer_id) {
+    auto* seq = index_.Find(SequenceKey(producer_id, writer_id));
+    return seq ? seq->get() : nullptr;
+  }
+
+  ChunkSequence* GetOrCreateSequence(ProducerID, WriterID);
+
+  static uint32_t SequenceKey(ProducerID producer_id, WriterID writer_id) {
+    static_assert(sizeof(ProducerID) + sizeof(WriterID) <= sizeof(uint32_t),
+                  "ProducerID and WriterID must fit in a uint32_t");
+    return (static_cast<uint32_t>(producer_id) << 16) | writer_id;
+  }
 
   // Used as a last resort when a buffer corruption is detected.
   void ClearContentsAndResetRWCursors();
@@ -547,6 +709,11 @@ class TraceBuffer {
   // (60 - 42), the distance between chunk 5 and the end of the deletion range.
   ssize_t DeleteNextChunksFor(size_t bytes_to_clear);
 
+  // Passes the unread fragments of |chunk_meta| to |overwrite_callback_|.
+  void NotifyChunkOverwritten(const ChunkMeta& chunk_meta,
+                              ProducerID,
+                              WriterID);
+
   // Decodes the boundaries of the next packet (or a fragment) pointed by
   // ChunkMeta and pushes that into |TracePacket|. It also increments the
   // |num_fragments_read| counter.
@@ -618,14 +785,26 @@ class TraceBuffer {
   uint8_t* end() const { return begin() + size_; }
   size_t size_to_end() const { return static_cast<size_t>(end() - wptr_); }
 
+  const MemoryOptions memory_options_;
   base::PagedMemory data_;
   size_t size_ = 0;            // Size in bytes of |data_|.
   size_t max_chunk_size_ = 0;  // Max size in bytes allowed for a chunk.
   uint8_t* wptr_ = nullptr;    // Write pointer.
 
   // An index that keeps track of the positions and metadata of each
-  // ChunkRecord.
-  ChunkMap index_;
+  // ChunkRecord, by {ProducerID, WriterID} sequence (see SequenceKey()).
+  base::FlatHashMap<uint32_t, std::unique_ptr<ChunkSequence>> index_;
+
+  // The sequences in |index_|, sorted by {ProducerID, WriterID}. This is the
+  // order in which they are read.
+  // TODO(primiano): should clean up sequences without chunks. Right now this
+  // grows without bounds (although realistically is not a problem unless we
+  // have too many producers/writers within the same trace session).
+  std::vector<ChunkSequence*> sequences_;
+
+  // The chunks to remove from the index in DeleteNextChunksFor(). Only a
+  // member to avoid allocating it on every write.
+  std::vector<std::pair<ChunkSequence*, ChunkID>> chunks_to_delete_;
 
   // Read iterator used for ReadNext(). It is reset by calling BeginRead().
   // It becomes invalid after any call to methods that alters the |index_|.
@@ -638,14 +817,14 @@ class TraceBuffer {
   // a write fails because it would overwrite unread chunks.
   bool discard_writes_ = false;
 
-  // Keeps track of the highest ChunkID written for a given sequence, taking
-  // into account a potential overflow of ChunkIDs. In the case of overflow,
-  // stores the highest ChunkID written since the overflow.
-  //
-  // TODO(primiano): should clean up keys from this map. Right now it grows
-  // without bounds (although realistically is not a problem unless we have too
-  // many producers/writers within the same trace session).
-  std::map<std::pair<ProducerID, WriterID>, ChunkID> last_chunk_id_written_;
+  // See set_overwrite_callback().
+  OverwriteCallback overwrite_callback_;
+
+  // Set on the buffers returned by CloneReadOnly().
+  bool read_only_ = false;
+
+  // See Freeze().
+  bool frozen_ = false;
 
   // Statistics about buffer usage.
   TraceStats::BufferStats stats_;
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "perfetto/ext/tracing/core/basic_types.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "src/tracing/core/trace_buffer.h"
+
+namespace {
+
+using perfetto::ChunkID;
+using perfetto::ProducerID;
+using perfetto::TraceBuffer;
+using perfetto::TracePacket;
+using perfetto::WriterID;
+
+constexpr size_t kBufferSize = 64 * 1024 * 1024;
+constexpr size_t kPacketSize = 256;
+
+// Roughly a 4KB SMB chunk, once the 16 bytes chunk header is added.
+constexpr uint16_t kPacketsPerChunk = 15;
+constexpr size_t kChunkSize = kPacketsPerChunk * kPacketSize;
+
+// Each writer id is unique only within its producer, spread the writers over
+// as many producers as needed.
+constexpr size_t kWritersPerProducer = 1024;
+
+// A chunk of |kPacketsPerChunk| packets of |kPacketSize| bytes, each starting
+// with a redundant 2 bytes varint for its size (as the TraceWriter does).
+std::vector<uint8_t> CreateChunkPayload() {
+  std::vector<uint8_t> payload(kChunkSize);
+  for (size_t i = 0; i < kPacketsPerChunk; i++) {
+    uint8_t* packet = &payload[i * kPacketSize];
+    const size_t size = kPacketSize - 2;
+    packet[0] = static_cast<uint8_t>(0x80 | (size & 0x7f));
+    packet[1] = static_cast<uint8_t>(size >> 7);
+    for (size_t j = 2; j < kPacketSize; j++)
+      packet[j] = static_cast<uint8_t>(i + j);
+  }
+  return payload;
+}
+
+// Copies |num_chunks| chunks into |buf|, round robin across |num_writers|
+// writers, as the service would do when producers commit their chunks.
+void CopyChunks(TraceBuffer* buf,
+                const std::vector<uint8_t>& payload,
+                size_t num_writers,
+                size_t num_chunks,
+                std::vector<ChunkID>* next_chunk_ids) {
+  for (size_t i = 0; i < num_chunks; i++) {
+    size_t writer = i % num_writers;
+    auto producer_id = static_cast<ProducerID>(1 + writer / kWritersPerProducer);
+    auto writer_id = static_cast<WriterID>(1 + writer % kWritersPerProducer);
+    buf->CopyChunkUntrusted(producer_id, /*producer_uid_trusted=*/0, writer_id,
+                            (*next_chunk_ids)[writer]++, kPacketsPerChunk,
+                            /*chunk_flags=*/0, /*chunk_complete=*/true,
+                            payload.data(), payload.size());
+  }
+}
+
+void WriterArgs(benchmark::internal::Benchmark* b) {
+  for (int writers : {1, 64, 1024, 16384})
+    b->Arg(writers);
+}
+
+static void BM_TraceBuffer_CopyChunks(benchmark::State& state) {
+  const auto num_writers = static_cast<size_t>(state.range(0));
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(kBufferSize);
+  std::vector<uint8_t> payload = CreateChunkPayload();
+  std::vector<ChunkID> next_chunk_ids(num_writers);
+
+  // Fill the buffer once, so that the measured copies also have to overwrite
+  // (and remove from the index) the oldest chunks, as in steady state.
+  const size_t chunks_per_buffer = kBufferSize / kChunkSize;
+  CopyChunks(buf.get(), payload, num_writers, chunks_per_buffer,
+             &next_chunk_ids);
+
+  constexpr size_t kChunksPerIteration = 1024;
+  for (auto _ : state) {
+    CopyChunks(buf.get(), payload, num_writers, kChunksPerIteration,
+               &next_chunk_ids);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(kChunksPerIteration * kChunkSize));
+  state.counters["chunks/s"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * kChunksPerIteration),
+      benchmark::Counter::kIsRate);
+}
+
+static void BM_TraceBuffer_ReadPackets(benchmark::State& state) {
+  const auto num_writers = static_cast<size_t>(state.range(0));
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(kBufferSize);
+  std::vector<uint8_t> payload = CreateChunkPayload();
+  std::vector<ChunkID> next_chunk_ids(num_writers);
+
+  // Reads are not idempotent, hence the buffer is refilled (outside of the
+  // measured time) before every read pass.
+  const size_t chunks_per_buffer = kBufferSize / kChunkSize / 2;
+  uint64_t packets_read = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    CopyChunks(buf.get(), payload, num_writers, chunks_per_buffer,
+               &next_chunk_ids);
+    state.ResumeTiming();
+
+    buf->BeginRead();
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties;
+    bool previous_packet_dropped;
+    while (buf->ReadNextTracePacket(&packet, &sequence_properties,
+                                    &previous_packet_dropped)) {
+      packets_read++;
+      packet = TracePacket();
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(packets_read * kPacketSize));
+  state.counters["packets/s"] = benchmark::Counter(
+      static_cast<double>(packets_read), benchmark::Counter::kIsRate);
+}
+
+}  // namespace
+
+BENCHMARK(BM_TraceBuffer_CopyChunks)->Apply(WriterArgs);
+BENCHMARK(BM_TraceBuffer_ReadPackets)->Apply(WriterArgs);
@@ -119,9 +119,15 @@ class TraceBufferTest : public testing::Test {
   }
 
   SequenceIterator GetReadIterForSequence(ProducerID p, WriterID w) {
-    TraceBuffer::ChunkMeta::Key key(p, w, 0);
-    return trace_buffer_->GetReadIterForSequence(
-        trace_buffer_->index_.lower_bound(key));
+    const auto& sequences = trace_buffer_->sequences_;
+    size_t seq_index = 0;
+    while (seq_index < sequences.size() &&
+           std::make_pair(sequences[seq_index]->producer_id,
+                          sequences[seq_index]->writer_id) <
+               std::make_pair(p, w)) {
+      seq_index++;
+    }
+    return trace_buffer_->GetReadIterForSequence(seq_index);
   }
 
   void SuppressClientDchecksForTesting() {
@@ -130,15 +136,21 @@ class TraceBufferTest : public testing::Test {
 
   std::vector<ChunkMetaKey> GetIndex() {
     std::vector<ChunkMetaKey> keys;
-    keys.reserve(trace_buffer_->index_.size());
-    for (const auto& it : trace_buffer_->index_)
-      keys.push_back(it.first);
+    for (const auto* seq : trace_buffer_->sequences_) {
+      for (size_t i = 0; i < seq->size(); i++)
+        keys.emplace_back(seq->producer_id, seq->writer_id, (*seq)[i].chunk_id);
+    }
     return keys;
   }
 
   TraceBuffer* trace_buffer() { return trace_buffer_.get(); }
   size_t size_to_end() { return trace_buffer_->size_to_end(); }
 
+  // Makes the fixture operate on |other|, e.g. on a clone of the buffer.
+  void SwapBuffer(std::unique_ptr<TraceBuffer>* other) {
+    trace_buffer_.swap(*other);
+  }
+
  private:
   std::unique_ptr<TraceBuffer> trace_buffer_;
 };
@@ -166,9 +178,11 @@ TEST_F(TraceBufferTest, ReadWrite_Simple) {
     CreateChunk(ProducerID(1), WriterID(1), chunk_id)
         .AddPacket(42, seed)
         .CopyIntoTraceBuffer();
+    EXPECT_GT(trace_buffer()->used_size(), 42u);
     trace_buffer()->BeginRead();
     ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(42, seed)));
     ASSERT_THAT(ReadPacket(), IsEmpty());
+    EXPECT_EQ(trace_buffer()->used_size(), 0u);
     EXPECT_EQ(chunk_id + 1u, trace_buffer()->stats().chunks_written());
     EXPECT_EQ(trace_buffer()->stats().chunks_written(),
               trace_buffer()->stats().chunks_read());
@@ -1833,6 +1847,109 @@ TEST_F(TraceBufferTest, MissingPacketsOnSequence) {
   ASSERT_TRUE(previous_packet_dropped);
 }
 
+TEST_F(TraceBufferTest, Freeze) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(100, 'a')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(100, 'b')
+      .AddPacket(100, 'c')
+      .PadTo(512)
+      .CopyIntoTraceBuffer(/*chunk_complete=*/false);
+
+  trace_buffer()->Freeze();
+
+  // New chunks, of both existing and new sequences, are discarded.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(2))
+      .AddPacket(100, 'd')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(100, 'e')
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(2u, trace_buffer()->stats().chunks_discarded());
+
+  // The chunks already in the buffer can still be completed.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(100, 'b')
+      .AddPacket(100, 'c')
+      .AddPacket(100, 'f')
+      .PadTo(512)
+      .CopyIntoTraceBuffer();
+  EXPECT_EQ(1u, trace_buffer()->stats().chunks_rewritten());
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(100, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(100, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(100, 'c')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(100, 'f')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Clone_NoFragments) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .AddPacket(10, 'b')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'c')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'a')));
+
+  std::unique_ptr<TraceBuffer> snapshot = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(snapshot);
+
+  // Writes into the original buffer don't affect the snapshot.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(10, 'd')
+      .CopyIntoTraceBuffer();
+
+  // The snapshot keeps the read state of the original buffer.
+  SwapBuffer(&snapshot);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  // Reads from the snapshot don't affect the original buffer.
+  SwapBuffer(&snapshot);
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'd')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(10, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Clone_AfterWrapping) {
+  ResetBuffer(4096);
+  for (ChunkID chunk_id = 0; chunk_id < 10; chunk_id++) {
+    CreateChunk(ProducerID(1), WriterID(1), chunk_id)
+        .AddPacket(1000, static_cast<char>('a' + chunk_id))
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_GT(trace_buffer()->stats().write_wrap_count(), 0u);
+
+  std::unique_ptr<TraceBuffer> snapshot = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(snapshot);
+  EXPECT_EQ(snapshot->stats().chunks_written(),
+            trace_buffer()->stats().chunks_written());
+
+  std::vector<std::vector<FakePacketFragment>> original_packets;
+  trace_buffer()->BeginRead();
+  for (auto packet = ReadPacket(); !packet.empty(); packet = ReadPacket())
+    original_packets.push_back(packet);
+  ASSERT_FALSE(original_packets.empty());
+
+  SwapBuffer(&snapshot);
+  std::vector<std::vector<FakePacketFragment>> snapshot_packets;
+  trace_buffer()->BeginRead();
+  for (auto packet = ReadPacket(); !packet.empty(); packet = ReadPacket())
+    snapshot_packets.push_back(packet);
+  EXPECT_EQ(snapshot_packets, original_packets);
+}
+
 // TODO(primiano): test stats().
 // TODO(primiano): test multiple streams interleaved.
 // TODO(primiano): more testing on packet merging.
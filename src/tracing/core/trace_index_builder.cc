@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/trace_index_builder.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/tracing/core/slice.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+
+#include "protos/perfetto/common/builtin_clock.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_index.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/trace_packet_defaults.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+using protozero::proto_utils::ProtoWireType;
+using BundlePb = protos::pbzero::FtraceEventBundle;
+using PacketPb = protos::pbzero::TracePacket;
+
+constexpr uint32_t kBootTimeClockId = protos::pbzero::BUILTIN_CLOCK_BOOTTIME;
+
+// Reads a packet split in several slices as a contiguous stream of bytes,
+// without copying it.
+class SliceReader {
+ public:
+  explicit SliceReader(const std::vector<Slice>& slices) : slices_(slices) {
+    NextSlice();
+  }
+
+  // Number of bytes read (or skipped) so far.
+  uint64_t pos() const { return pos_; }
+
+  bool ReadVarInt(uint64_t* value) {
+    if (PERFETTO_LIKELY(end_ - ptr_ >= 10)) {
+      const uint8_t* next = protozero::proto_utils::ParseVarInt(
+          ptr_, end_, value);
+      if (next == ptr_)
+        return false;
+      pos_ += static_cast<uint64_t>(next - ptr_);
+      ptr_ = next;
+      return true;
+    }
+    // The varint might span two slices.
+    *value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      if (ptr_ == end_ && !NextSlice())
+        return false;
+      const uint8_t byte = *ptr_++;
+      pos_++;
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  bool Skip(uint64_t size) {
+    while (size > 0) {
+      if (ptr_ == end_ && !NextSlice())
+        return false;
+      const uint64_t step =
+          std::min(size, static_cast<uint64_t>(end_ - ptr_));
+      ptr_ += step;
+      pos_ += step;
+      size -= step;
+    }
+    return true;
+  }
+
+  // Skips the value of a field with the given wire type.
+  bool SkipValue(uint32_t wire_type) {
+    uint64_t value = 0;
+    switch (static_cast<ProtoWireType>(wire_type)) {
+      case ProtoWireType::kVarInt:
+        return ReadVarInt(&value);
+      case ProtoWireType::kFixed64:
+        return Skip(8);
+      case ProtoWireType::kFixed32:
+        return Skip(4);
+      case ProtoWireType::kLengthDelimited:
+        return ReadVarInt(&value) && Skip(value);
+    }
+    return false;
+  }
+
+ private:
+  bool NextSlice() {
+    for (; next_slice_ < slices_.size(); next_slice_++) {
+      const Slice& slice = slices_[next_slice_];
+      if (slice.size == 0)
+        continue;
+      ptr_ = static_cast<const uint8_t*>(slice.start);
+      end_ = ptr_ + slice.size;
+      next_slice_++;
+      return true;
+    }
+    return false;
+  }
+
+  const std::vector<Slice>& slices_;
+  size_t next_slice_ = 0;
+  const uint8_t* ptr_ = nullptr;
+  const uint8_t* end_ = nullptr;
+  uint64_t pos_ = 0;
+};
+
+// Calls |on_field(field_id, wire_type)| for each field of the message which
+// ends at |end|. |on_field| must read or skip the value of the field.
+template <typename F>
+bool ForEachField(SliceReader* reader, uint64_t end, F on_field) {
+  while (reader->pos() < end) {
+    uint64_t tag = 0;
+    if (!reader->ReadVarInt(&tag) ||
+        !on_field(static_cast<uint32_t>(tag >> 3),
+                  static_cast<uint32_t>(tag & 7))) {
+      return false;
+    }
+  }
+  return reader->pos() == end;
+}
+
+// Reads the length of a length-delimited field, returns where it ends.
+bool ReadFieldEnd(SliceReader* reader, uint64_t* end) {
+  uint64_t size = 0;
+  if (!reader->ReadVarInt(&size))
+    return false;
+  *end = reader->pos() + size;
+  return true;
+}
+
+struct TimestampRange {
+  void Add(uint64_t ts) {
+    min = std::min(min, ts);
+    max = std::max(max, ts);
+  }
+  bool empty() const { return min > max; }
+
+  uint64_t min = std::numeric_limits<uint64_t>::max();
+  uint64_t max = 0;
+};
+
+// Adds the timestamps of a packed field of delta encoded timestamps.
+bool ReadDeltaTimestamps(SliceReader* reader,
+                         uint32_t wire_type,
+                         TimestampRange* range) {
+  uint64_t end = 0;
+  if (wire_type != static_cast<uint32_t>(ProtoWireType::kLengthDelimited) ||
+      !ReadFieldEnd(reader, &end)) {
+    return false;
+  }
+  uint64_t ts = 0;
+  while (reader->pos() < end) {
+    uint64_t delta = 0;
+    if (!reader->ReadVarInt(&delta))
+      return false;
+    ts += delta;
+    range->Add(ts);
+  }
+  return reader->pos() == end;
+}
+
+// Adds the timestamps of the events of the FtraceEventBundle which ends at
+// |end|, either as FtraceEvent messages or in the compact encodings.
+bool ReadFtraceTimestamps(SliceReader* reader,
+                          uint64_t end,
+                          TimestampRange* range) {
+  constexpr uint32_t kLengthDelimited =
+      static_cast<uint32_t>(ProtoWireType::kLengthDelimited);
+  TimestampRange bundle_range;
+  bool boot_clock = true;
+  bool ok = ForEachField(reader, end, [&](uint32_t id, uint32_t wire_type) {
+    if (id == BundlePb::kFtraceClockFieldNumber) {
+      uint64_t clock = 0;
+      if (!reader->ReadVarInt(&clock))
+        return false;
+      boot_clock = clock == protos::pbzero::FTRACE_CLOCK_UNSPECIFIED;
+      return true;
+    }
+    if (wire_type != kLengthDelimited)
+      return reader->SkipValue(wire_type);
+
+    uint64_t field_end = 0;
+    if (!ReadFieldEnd(reader, &field_end))
+      return false;
+    if (id == BundlePb::kEventFieldNumber) {
+      // The timestamp is the first field of the events written by
+      // traced_probes: don't look further.
+      uint64_t tag = 0;
+      if (reader->pos() < field_end && reader->ReadVarInt(&tag) &&
+          tag == protozero::proto_utils::MakeTagVarInt(
+                     protos::pbzero::FtraceEvent::kTimestampFieldNumber)) {
+        uint64_t ts = 0;
+        if (!reader->ReadVarInt(&ts))
+          return false;
+        bundle_range.Add(ts);
+      }
+      return reader->pos() <= field_end &&
+             reader->Skip(field_end - reader->pos());
+    }
+    if (id == BundlePb::kCompactSchedFieldNumber) {
+      using CompactSchedPb = BundlePb::CompactSched;
+      return ForEachField(reader, field_end, [&](uint32_t sched_id,
+                                                 uint32_t sched_type) {
+        if (sched_id == CompactSchedPb::kSwitchTimestampFieldNumber ||
+            sched_id == CompactSchedPb::kWakingTimestampFieldNumber) {
+          return ReadDeltaTimestamps(reader, sched_type, &bundle_range);
+        }
+        return reader->SkipValue(sched_type);
+      });
+    }
+    if (id == BundlePb::kCompactEventsFieldNumber) {
+      using CompactEventsPb = BundlePb::CompactEvents;
+      return ForEachField(reader, field_end, [&](uint32_t events_id,
+                                                 uint32_t events_type) {
+        uint64_t type_end = 0;
+        if (events_id != CompactEventsPb::kEventTypeFieldNumber ||
+            events_type != kLengthDelimited) {
+          return reader->SkipValue(events_type);
+        }
+        if (!ReadFieldEnd(reader, &type_end))
+          return false;
+        return ForEachField(reader, type_end, [&](uint32_t type_id,
+                                                  uint32_t type_type) {
+          if (type_id == CompactEventsPb::EventType::kTimestampFieldNumber)
+            return ReadDeltaTimestamps(reader, type_type, &bundle_range);
+          return reader->SkipValue(type_type);
+        });
+      });
+    }
+    return reader->Skip(field_end - reader->pos());
+  });
+  if (ok && boot_clock && !bundle_range.empty()) {
+    range->Add(bundle_range.min);
+    range->Add(bundle_range.max);
+  }
+  return ok;
+}
+
+size_t VarIntSize(uint64_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7)
+    size++;
+  return size;
+}
+
+void AppendPacked(const base::FlatSet<uint32_t>& values,
+                  protozero::PackedVarInt* packed) {
+  packed->Reset();
+  for (uint32_t value : values)
+    packed->Append(value);
+}
+
+}  // namespace
+
+constexpr uint32_t TraceIndexBuilder::kServiceBuffer;
+
+TraceIndexBuilder::TraceIndexBuilder() = default;
+TraceIndexBuilder::~TraceIndexBuilder() = default;
+
+void TraceIndexBuilder::AddPacket(const TracePacket& packet, uint32_t buffer) {
+  const uint64_t packet_size =
+      packet.size() + 1 + VarIntSize(packet.size());
+  if (section_ended_ || sections_.back().buffer != buffer) {
+    sections_.emplace_back();
+    sections_.back().offset = data_size_;
+    sections_.back().buffer = buffer;
+    section_ended_ = false;
+  }
+  Section& section = sections_.back();
+  section.size += packet_size;
+  section.packet_count++;
+  data_size_ += packet_size;
+
+  // Decode the fields of the packet which the index needs. The sequence id is
+  // appended last by the service, so the sequence state is only looked up
+  // once the whole packet has been read.
+  constexpr uint32_t kLengthDelimited =
+      static_cast<uint32_t>(ProtoWireType::kLengthDelimited);
+  SliceReader reader(packet.slices());
+  uint64_t timestamp = 0;
+  bool has_timestamp = false;
+  uint32_t clock_id = 0;
+  bool has_clock_id = false;
+  uint32_t defaults_clock_id = 0;
+  bool has_defaults_clock_id = false;
+  uint32_t sequence_id = 0;
+  bool incremental_state_cleared = false;
+  bool has_data = false;
+  TimestampRange ftrace_range;
+  bool ok = ForEachField(&reader, packet.size(), [&](uint32_t id,
+                                                     uint32_t wire_type) {
+    if (wire_type == kLengthDelimited) {
+      uint64_t field_end = 0;
+      if (!ReadFieldEnd(&reader, &field_end))
+        return false;
+      section.packet_types.insert(id);
+      if (id == PacketPb::kFtraceEventsFieldNumber) {
+        has_data = true;
+        return ReadFtraceTimestamps(&reader, field_end, &ftrace_range);
+      }
+      if (id == PacketPb::kTracePacketDefaultsFieldNumber) {
+        return ForEachField(&reader, field_end, [&](uint32_t defaults_id,
+                                                    uint32_t defaults_type) {
+          uint64_t value = 0;
+          if (defaults_id != protos::pbzero::TracePacketDefaults::
+                                 kTimestampClockIdFieldNumber) {
+            return reader.SkipValue(defaults_type);
+          }
+          if (!reader.ReadVarInt(&value))
+            return false;
+          defaults_clock_id = static_cast<uint32_t>(value);
+          has_defaults_clock_id = true;
+          return true;
+        });
+      }
+      if (id != PacketPb::kInternedDataFieldNumber)
+        has_data = true;
+      return reader.Skip(field_end - reader.pos());
+    }
+    if (wire_type != static_cast<uint32_t>(ProtoWireType::kVarInt))
+      return reader.SkipValue(wire_type);
+    uint64_t value = 0;
+    if (!reader.ReadVarInt(&value))
+      return false;
+    switch (id) {
+      case PacketPb::kTimestampFieldNumber:
+        timestamp = value;
+        has_timestamp = true;
+        break;
+      case PacketPb::kTimestampClockIdFieldNumber:
+        clock_id = static_cast<uint32_t>(value);
+        has_clock_id = true;
+        break;
+      case PacketPb::kTrustedPacketSequenceIdFieldNumber:
+        sequence_id = static_cast<uint32_t>(value);
+        break;
+      case PacketPb::kSequenceFlagsFieldNumber:
+        if (value & PacketPb::SEQ_INCREMENTAL_STATE_CLEARED)
+          incremental_state_cleared = true;
+        break;
+      case PacketPb::kIncrementalStateClearedFieldNumber:
+        if (value)
+          incremental_state_cleared = true;
+        break;
+    }
+    return true;
+  });
+  if (!ok) {
+    // Malformed packets are passed through as is, their content is unknown.
+    section.has_untimed_packets = true;
+    return;
+  }
+
+  if (sequence_id) {
+    section.sequence_ids.insert(sequence_id);
+    if (incremental_state_cleared) {
+      section.incremental_state_cleared_sequence_ids.insert(sequence_id);
+      default_clock_ids_.Erase(sequence_id);
+    }
+    if (has_defaults_clock_id)
+      default_clock_ids_[sequence_id] = defaults_clock_id;
+    if (!has_clock_id) {
+      const uint32_t* default_clock_id = default_clock_ids_.Find(sequence_id);
+      if (default_clock_id) {
+        clock_id = *default_clock_id;
+        has_clock_id = true;
+      }
+    }
+  }
+
+  bool timed = false;
+  if (has_timestamp && (!has_clock_id || clock_id == kBootTimeClockId)) {
+    section.min_timestamp = std::min(section.min_timestamp, timestamp);
+    section.max_timestamp = std::max(section.max_timestamp, timestamp);
+    timed = true;
+  }
+  if (!ftrace_range.empty()) {
+    section.min_timestamp = std::min(section.min_timestamp, ftrace_range.min);
+    section.max_timestamp = std::max(section.max_timestamp, ftrace_range.max);
+    timed = true;
+  }
+  if (has_data && !timed)
+    section.has_untimed_packets = true;
+}
+
+void TraceIndexBuilder::EndSection() {
+  section_ended_ = true;
+}
+
+std::vector<uint8_t> TraceIndexBuilder::Serialize() {
+  protozero::HeapBuffered<PacketPb> packet;
+  auto* index = packet->set_trace_index();
+  protozero::PackedVarInt packed;
+  for (const Section& section : sections_) {
+    auto* section_pb = index->add_sections();
+    section_pb->set_offset(section.offset);
+    section_pb->set_size(section.size);
+    if (section.buffer != kServiceBuffer)
+      section_pb->set_buffer(section.buffer);
+    section_pb->set_packet_count(section.packet_count);
+    if (section.min_timestamp <= section.max_timestamp) {
+      section_pb->set_min_timestamp(section.min_timestamp);
+      section_pb->set_max_timestamp(section.max_timestamp);
+    }
+    if (section.has_untimed_packets)
+      section_pb->set_has_untimed_packets(true);
+    if (!section.sequence_ids.empty()) {
+      AppendPacked(section.sequence_ids, &packed);
+      section_pb->set_sequence_ids(packed);
+    }
+    if (!section.incremental_state_cleared_sequence_ids.empty()) {
+      AppendPacked(section.incremental_state_cleared_sequence_ids, &packed);
+      section_pb->set_incremental_state_cleared_sequence_ids(packed);
+    }
+    if (!section.packet_types.empty()) {
+      AppendPacked(section.packet_types, &packed);
+      section_pb->set_packet_types(packed);
+    }
+  }
+  index->set_data_size(data_size_);
+  index->set_magic(protos::pbzero::TraceIndex::MAGIC_TRACE_INDEX);
+  // Patched below, once the size of the packet is known.
+  index->set_packet_size(0);
+  std::vector<uint8_t> packet_bytes = packet.SerializeAsArray();
+
+  // Prepend the preamble of the packet within the Trace message.
+  uint8_t preamble[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+  uint8_t* wptr = protozero::proto_utils::WriteVarInt(
+      protozero::proto_utils::MakeTagLengthDelimited(
+          protos::pbzero::Trace::kPacketFieldNumber),
+      preamble);
+  wptr = protozero::proto_utils::WriteVarInt(packet_bytes.size(), wptr);
+  std::vector<uint8_t> res(preamble, wptr);
+  res.insert(res.end(), packet_bytes.begin(), packet_bytes.end());
+
+  // The packet size is the last fixed64 of the packet, little endian.
+  uint64_t packet_size = res.size();
+  PERFETTO_CHECK(res.size() >= sizeof(packet_size));
+  for (size_t i = 0; i < sizeof(packet_size); i++) {
+    res[res.size() - sizeof(packet_size) + i] =
+        static_cast<uint8_t>(packet_size >> (8 * i));
+  }
+  return res;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_CORE_TRACE_INDEX_BUILDER_H_
+#define SRC_TRACING_CORE_TRACE_INDEX_BUILDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <vector>
+
+#include "perfetto/base/flat_set.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+
+namespace perfetto {
+
+class TracePacket;
+
+// Builds the TraceIndex that the service appends to the file of the sessions
+// with TraceConfig.write_trace_index (see trace_index.proto). The packets
+// written into the file are grouped into sections: one for each run of
+// packets of the same buffer in each drain.
+// The packets are decoded in place, without copying the ones split in several
+// slices, to find their timestamps (including the ones of the events of
+// ftrace bundles), sequence and type.
+class TraceIndexBuilder {
+ public:
+  // The buffer of the packets emitted by the service itself.
+  static constexpr uint32_t kServiceBuffer =
+      std::numeric_limits<uint32_t>::max();
+
+  TraceIndexBuilder();
+  ~TraceIndexBuilder();
+
+  // Adds a packet written into the file right after the previous one. Starts
+  // a new section if the packet comes from another buffer than the previous
+  // one, or if EndSection() was called since.
+  void AddPacket(const TracePacket&, uint32_t buffer);
+
+  // Ends the current section, e.g. at the end of a drain.
+  void EndSection();
+
+  // Returns the TracePacket of the index, including its preamble, to write
+  // at the end of the file.
+  std::vector<uint8_t> Serialize();
+
+  size_t num_sections() const { return sections_.size(); }
+
+  // Total size of the packets added so far, including their preamble.
+  uint64_t data_size() const { return data_size_; }
+
+ private:
+  struct Section {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t buffer = kServiceBuffer;
+    uint32_t packet_count = 0;
+    uint64_t min_timestamp = std::numeric_limits<uint64_t>::max();
+    uint64_t max_timestamp = 0;
+    bool has_untimed_packets = false;
+    base::FlatSet<uint32_t> sequence_ids;
+    base::FlatSet<uint32_t> incremental_state_cleared_sequence_ids;
+    base::FlatSet<uint32_t> packet_types;
+  };
+
+  std::vector<Section> sections_;
+  bool section_ended_ = true;
+  uint64_t data_size_ = 0;
+
+  // The timestamp_clock_id of the TracePacketDefaults of each sequence.
+  base::FlatHashMap<uint32_t, uint32_t> default_clock_ids_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_CORE_TRACE_INDEX_BUILDER_H_
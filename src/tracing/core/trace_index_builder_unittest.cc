@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/trace_index_builder.h"
+
+#include <string.h>
+
+#include <string>
+
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/common/builtin_clock.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/trace.gen.h"
+#include "protos/perfetto/trace/trace_index.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/trace_packet_defaults.pbzero.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::ElementsAre;
+using PacketPb = protos::pbzero::TracePacket;
+
+class TraceIndexBuilderTest : public ::testing::Test {
+ protected:
+  // Adds |packet| to |builder_|, split in slices of |slice_size| bytes to
+  // check that fields spanning several slices are decoded.
+  void Add(protozero::HeapBuffered<PacketPb>* packet,
+           uint32_t buffer,
+           size_t slice_size = 4096) {
+    packet_data_.emplace_back(new std::string(packet->SerializeAsString()));
+    const std::string& data = *packet_data_.back();
+    TracePacket trace_packet;
+    for (size_t i = 0; i < data.size(); i += slice_size)
+      trace_packet.AddSlice(&data[i], std::min(slice_size, data.size() - i));
+    builder_.AddPacket(trace_packet, buffer);
+  }
+
+  protos::gen::TraceIndex Serialize() {
+    std::vector<uint8_t> data = builder_.Serialize();
+    protos::gen::Trace trace;
+    EXPECT_TRUE(trace.ParseFromArray(data.data(), data.size()));
+    EXPECT_EQ(trace.packet().size(), 1u);
+    EXPECT_TRUE(trace.packet()[0].has_trace_index());
+    EXPECT_EQ(trace.packet()[0].trace_index().packet_size(), data.size());
+    return trace.packet()[0].trace_index();
+  }
+
+  TraceIndexBuilder builder_;
+  std::vector<std::unique_ptr<std::string>> packet_data_;
+};
+
+TEST_F(TraceIndexBuilderTest, Sections) {
+  for (uint32_t buffer : {TraceIndexBuilder::kServiceBuffer, 0u, 0u, 1u}) {
+    protozero::HeapBuffered<PacketPb> packet;
+    packet->set_timestamp(100);
+    packet->set_for_testing()->set_str("payload");
+    Add(&packet, buffer);
+  }
+  builder_.EndSection();
+  const uint64_t packet_size = builder_.data_size() / 4;
+  {
+    protozero::HeapBuffered<PacketPb> packet;
+    packet->set_timestamp(200);
+    packet->set_for_testing()->set_str("payload");
+    Add(&packet, 1);
+  }
+  EXPECT_EQ(builder_.num_sections(), 4u);
+
+  protos::gen::TraceIndex index = Serialize();
+  EXPECT_EQ(index.magic(),
+            static_cast<uint32_t>(protos::gen::TraceIndex::MAGIC_TRACE_INDEX));
+  EXPECT_EQ(index.data_size(), builder_.data_size());
+  ASSERT_EQ(index.sections().size(), 4u);
+
+  // A new section starts when the buffer changes and after EndSection().
+  const auto& sections = index.sections();
+  EXPECT_FALSE(sections[0].has_buffer());
+  EXPECT_EQ(sections[0].offset(), 0u);
+  EXPECT_EQ(sections[0].size(), packet_size);
+  EXPECT_EQ(sections[1].buffer(), 0u);
+  EXPECT_EQ(sections[1].offset(), packet_size);
+  EXPECT_EQ(sections[1].size(), 2 * packet_size);
+  EXPECT_EQ(sections[1].packet_count(), 2u);
+  EXPECT_EQ(sections[2].buffer(), 1u);
+  EXPECT_EQ(sections[2].packet_count(), 1u);
+  EXPECT_EQ(sections[2].min_timestamp(), 100u);
+  EXPECT_EQ(sections[3].buffer(), 1u);
+  EXPECT_EQ(sections[3].offset(), 4 * packet_size);
+  EXPECT_EQ(sections[3].min_timestamp(), 200u);
+  EXPECT_EQ(sections[3].max_timestamp(), 200u);
+  EXPECT_THAT(sections[3].packet_types(),
+              ElementsAre(static_cast<uint32_t>(
+                  PacketPb::kForTestingFieldNumber)));
+}
+
+TEST_F(TraceIndexBuilderTest, FtraceTimestamps) {
+  protozero::HeapBuffered<PacketPb> packet;
+  auto* bundle = packet->set_ftrace_events();
+  bundle->set_cpu(1);
+  auto* event = bundle->add_event();
+  event->set_timestamp(500);
+  event->set_pid(42);
+  protozero::PackedVarInt switch_timestamps;
+  switch_timestamps.Append(300);
+  switch_timestamps.Append(1000);
+  bundle->set_compact_sched()->set_switch_timestamp(switch_timestamps);
+  protozero::PackedVarInt event_timestamps;
+  event_timestamps.Append(200);
+  event_timestamps.Append(50);
+  bundle->set_compact_events()->add_event_type()->set_timestamp(
+      event_timestamps);
+  packet->set_trusted_packet_sequence_id(1);
+  Add(&packet, 0, /*slice_size=*/1);
+
+  // The events of bundles in another clock don't count.
+  protozero::HeapBuffered<PacketPb> global_clock_packet;
+  auto* global_bundle = global_clock_packet->set_ftrace_events();
+  global_bundle->set_ftrace_clock(protos::pbzero::FTRACE_CLOCK_GLOBAL);
+  global_bundle->add_event()->set_timestamp(5000);
+  global_clock_packet->set_trusted_packet_sequence_id(1);
+  Add(&global_clock_packet, 0, /*slice_size=*/3);
+
+  protos::gen::TraceIndex index = Serialize();
+  ASSERT_EQ(index.sections().size(), 1u);
+  const auto& section = index.sections()[0];
+  EXPECT_EQ(section.min_timestamp(), 200u);
+  EXPECT_EQ(section.max_timestamp(), 1300u);
+  EXPECT_TRUE(section.has_untimed_packets());
+  EXPECT_EQ(section.packet_count(), 2u);
+}
+
+TEST_F(TraceIndexBuilderTest, Clocks) {
+  // A packet in another clock.
+  protozero::HeapBuffered<PacketPb> packet;
+  packet->set_timestamp(100);
+  packet->set_timestamp_clock_id(protos::pbzero::BUILTIN_CLOCK_MONOTONIC);
+  packet->set_for_testing()->set_str("payload");
+  packet->set_trusted_packet_sequence_id(1);
+  Add(&packet, 0);
+  builder_.EndSection();
+
+  // The default clock of the sequence is inherited by the next packets, until
+  // its incremental state is cleared.
+  protozero::HeapBuffered<PacketPb> defaults_packet;
+  defaults_packet->set_sequence_flags(PacketPb::SEQ_INCREMENTAL_STATE_CLEARED);
+  defaults_packet->set_trace_packet_defaults()->set_timestamp_clock_id(
+      protos::pbzero::BUILTIN_CLOCK_MONOTONIC);
+  defaults_packet->set_trusted_packet_sequence_id(2);
+  Add(&defaults_packet, 0);
+  protozero::HeapBuffered<PacketPb> monotonic_packet;
+  monotonic_packet->set_timestamp(200);
+  monotonic_packet->set_for_testing()->set_str("payload");
+  monotonic_packet->set_trusted_packet_sequence_id(2);
+  Add(&monotonic_packet, 0);
+  builder_.EndSection();
+
+  protozero::HeapBuffered<PacketPb> cleared_packet;
+  cleared_packet->set_sequence_flags(PacketPb::SEQ_INCREMENTAL_STATE_CLEARED);
+  cleared_packet->set_timestamp(300);
+  cleared_packet->set_for_testing()->set_str("payload");
+  cleared_packet->set_trusted_packet_sequence_id(2);
+  Add(&cleared_packet, 0);
+
+  protos::gen::TraceIndex index = Serialize();
+  ASSERT_EQ(index.sections().size(), 3u);
+  const auto& sections = index.sections();
+  EXPECT_TRUE(sections[0].has_untimed_packets());
+  EXPECT_FALSE(sections[0].has_min_timestamp());
+  EXPECT_THAT(sections[0].sequence_ids(), ElementsAre(1u));
+  EXPECT_TRUE(sections[0].incremental_state_cleared_sequence_ids().empty());
+
+  EXPECT_TRUE(sections[1].has_untimed_packets());
+  EXPECT_FALSE(sections[1].has_min_timestamp());
+  EXPECT_THAT(sections[1].sequence_ids(), ElementsAre(2u));
+  EXPECT_THAT(sections[1].incremental_state_cleared_sequence_ids(),
+              ElementsAre(2u));
+
+  EXPECT_FALSE(sections[2].has_untimed_packets());
+  EXPECT_EQ(sections[2].min_timestamp(), 300u);
+  EXPECT_EQ(sections[2].max_timestamp(), 300u);
+}
+
+TEST_F(TraceIndexBuilderTest, Footer) {
+  protozero::HeapBuffered<PacketPb> packet;
+  packet->set_timestamp(100);
+  Add(&packet, 0);
+  std::vector<uint8_t> data = builder_.Serialize();
+
+  // The last bytes are the tag and the value of the magic, then the tag and
+  // the value of the size of the index.
+  ASSERT_GT(data.size(), 14u);
+  const uint8_t* footer = &data[data.size() - 14];
+  uint32_t magic = 0;
+  uint64_t packet_size = 0;
+  EXPECT_EQ(footer[0], 0x15);
+  memcpy(&magic, &footer[1], sizeof(magic));
+  EXPECT_EQ(footer[5], 0x19);
+  memcpy(&packet_size, &footer[6], sizeof(packet_size));
+  EXPECT_EQ(magic,
+            static_cast<uint32_t>(protos::gen::TraceIndex::MAGIC_TRACE_INDEX));
+  EXPECT_EQ(packet_size, data.size());
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -76,8 +76,13 @@ void TraceWriterImpl::Flush(std::function<void()> callback) {
   PERFETTO_CHECK(cur_packet_->is_finalized());
 
   if (cur_chunk_.is_valid()) {
+    // The chunk is returned before getting full, next time ask for a chunk
+    // that fits what has been written into this one. The hint is halved at
+    // most, to not shrink the chunks of a busy writer too much on each flush.
+    const size_t bytes_written = GetCurChunkBytesWritten();
+    chunk_size_hint_ = std::max(bytes_written, chunk_size_hint_ / 2);
     shmem_arbiter_->ReturnCompletedChunk(std::move(cur_chunk_), target_buffer_,
-                                         &patch_list_);
+                                         &patch_list_, bytes_written);
   } else {
     // When in stall mode, all patches should have been returned with the last
     // chunk, since the last packet was completed. In drop_packets_ mode, this
@@ -199,8 +204,17 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
   header.chunk_id.store(next_chunk_id_, std::memory_order_relaxed);
   header.packets.store(packets, std::memory_order_relaxed);
 
-  SharedMemoryABI::Chunk new_chunk =
-      shmem_arbiter_->GetNewChunk(header, buffer_exhausted_policy_);
+  // If we get here with a valid chunk, the chunk is full (or it reached the
+  // max number of packets). Ask for larger chunks from now on.
+  size_t cur_chunk_bytes_written = 0;
+  if (cur_chunk_.is_valid()) {
+    cur_chunk_bytes_written = GetCurChunkBytesWritten();
+    chunk_size_hint_ =
+        std::max(chunk_size_hint_, 2 * cur_chunk_.payload_size());
+  }
+
+  SharedMemoryABI::Chunk new_chunk = shmem_arbiter_->GetNewChunk(
+      header, buffer_exhausted_policy_, chunk_size_hint_);
   if (!new_chunk.is_valid()) {
     // Shared memory buffer exhausted, switch into |drop_packets_| mode. We'll
     // drop data until the garbage chunk has been filled once and then retry.
@@ -265,7 +279,8 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
 
     if (cur_chunk_.is_valid()) {
       shmem_arbiter_->ReturnCompletedChunk(std::move(cur_chunk_),
-                                           target_buffer_, &patch_list_);
+                                           target_buffer_, &patch_list_,
+                                           cur_chunk_bytes_written);
     }
 
     drop_packets_ = true;
@@ -342,7 +357,7 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
     // ReturnCompletedChunk will consume the first patched entries from
     // |patch_list_| and shrink it.
     shmem_arbiter_->ReturnCompletedChunk(std::move(cur_chunk_), target_buffer_,
-                                         &patch_list_);
+                                         &patch_list_, cur_chunk_bytes_written);
   }
 
   // Switch to the new chunk.
@@ -365,6 +380,14 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
   return protozero::ContiguousMemoryRange{payload_begin, cur_chunk_.end()};
 }
 
+size_t TraceWriterImpl::GetCurChunkBytesWritten() const {
+  PERFETTO_DCHECK(cur_chunk_.is_valid());
+  uint8_t* const wptr = protobuf_stream_writer_.write_ptr();
+  if (wptr < cur_chunk_.payload_begin() || wptr > cur_chunk_.end())
+    return 0;
+  return static_cast<size_t>(wptr - cur_chunk_.payload_begin());
+}
+
 WriterID TraceWriterImpl::writer_id() const {
   return id_;
 }
@@ -62,6 +62,9 @@ class TraceWriterImpl : public TraceWriter,
   // ScatteredStreamWriter::Delegate implementation.
   protozero::ContiguousMemoryRange GetNewBuffer() override;
 
+  // Returns the number of payload bytes written so far into |cur_chunk_|.
+  size_t GetCurChunkBytesWritten() const;
+
   // The per-producer arbiter that coordinates access to the shared memory
   // buffer from several threads.
   SharedMemoryArbiterImpl* const shmem_arbiter_;
@@ -86,6 +89,12 @@ class TraceWriterImpl : public TraceWriter,
   // The chunk we are holding onto (if any).
   SharedMemoryABI::Chunk cur_chunk_;
 
+  // How many bytes we expect to write into the next chunk, passed to
+  // GetNewChunk() to pick the chunk size. It grows when chunks get full and
+  // shrinks when they are flushed before getting full. 0 until the first chunk
+  // is returned.
+  size_t chunk_size_hint_ = 0;
+
   // Passed to protozero message to write directly into |cur_chunk_|. It
   // keeps track of the write pointer. It calls us back (GetNewBuffer()) when
   // |cur_chunk_| is filled.
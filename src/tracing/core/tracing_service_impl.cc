@@ -58,8 +58,10 @@
 #include "perfetto/ext/base/metatrace.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/version.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/ext/base/watchdog.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/consumer.h"
@@ -76,6 +78,7 @@
 #include "perfetto/tracing/core/tracing_service_state.h"
 #include "src/android_stats/statsd_logging_helper.h"
 #include "src/protozero/filtering/message_filter.h"
+#include "src/tracing/core/packet_downsampler.h"
 #include "src/tracing/core/packet_stream_validator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/core/trace_buffer.h"
@@ -114,6 +117,13 @@ namespace {
 constexpr int kMaxBuffersPerConsumer = 128;
 constexpr uint32_t kDefaultSnapshotsIntervalMs = 10 * 1000;
 constexpr int kDefaultWriteIntoFilePeriodMs = 5000;
+
+// The period of the drain into the file of a write_into_file session is halved
+// when a buffer of the session is filled above kDrainFillPercentHigh (or chunks
+// got overwritten) between two drains, and doubled back when all of them stay
+// below kDrainFillPercentLow.
+constexpr uint32_t kDrainFillPercentHigh = 50;
+constexpr uint32_t kDrainFillPercentLow = 25;
 constexpr int kMaxConcurrentTracingSessions = 15;
 constexpr int kMaxConcurrentTracingSessionsPerUid = 5;
 constexpr int kMaxConcurrentTracingSessionsForStatsdUid = 10;
@@ -123,6 +133,10 @@ constexpr uint32_t kMillisPerHour = 3600000;
 constexpr uint32_t kMillisPerDay = kMillisPerHour * 24;
 constexpr uint32_t kMaxTracingDurationMillis = 7 * 24 * kMillisPerHour;
 
+// When there are read workers, ReadBuffers() filters the packets in parallel
+// only if there are at least these many.
+constexpr size_t kMinPacketsForParallelFilter = 256;
+
 // These apply only if enable_extra_guardrails is true.
 constexpr uint32_t kGuardrailsMaxTracingBufferSizeKb = 128 * 1024;
 constexpr uint32_t kGuardrailsMaxTracingDurationMillis = 24 * kMillisPerHour;
@@ -287,29 +301,156 @@ bool ShouldLogEvent(const TraceConfig& cfg) {
   PERFETTO_FATAL("For GCC");
 }
 
-// Appends `data` (which has `size` bytes), to `*packet`. Splits the data in
-// slices no larger than `max_slice_size`.
+// Appends `data` (which has `size` used bytes, out of `alloc_size` allocated),
+// to `*packet`. Splits the data in slices no larger than `max_slice_size`
+// without copying it: the first slice owns the whole buffer and the following
+// ones point into it, which is safe because they all belong to `packet`.
+// If only a small part of a large buffer is used (e.g. when most of a large
+// packet is filtered out), the used part is instead copied into a buffer of
+// the right size, so that the whole allocation isn't held until the packets
+// are consumed.
 void AppendOwnedSlicesToPacket(std::unique_ptr<uint8_t[]> data,
                                size_t size,
+                               size_t alloc_size,
                                size_t max_slice_size,
                                perfetto::TracePacket* packet) {
   if (size <= max_slice_size) {
-    packet->AddSlice(Slice::TakeOwnership(std::move(data), size));
+    if (alloc_size <= max_slice_size) {
+      packet->AddSlice(Slice::TakeOwnership(std::move(data), size));
+      return;
+    }
+    Slice slice = Slice::Allocate(size);
+    memcpy(slice.own_data(), data.get(), size);
+    packet->AddSlice(std::move(slice));
     return;
   }
-  uint8_t* src_ptr = data.get();
-  for (size_t size_left = size; size_left > 0;) {
-    const size_t slice_size = std::min(size_left, max_slice_size);
+  const uint8_t* src_ptr = data.get();
+  packet->AddSlice(Slice::TakeOwnership(std::move(data), max_slice_size));
+  for (size_t offset = max_slice_size; offset < size;) {
+    const size_t slice_size = std::min(size - offset, max_slice_size);
+    packet->AddSlice(src_ptr + offset, slice_size);
+    offset += slice_size;
+  }
+}
 
-    Slice slice = Slice::Allocate(slice_size);
-    memcpy(slice.own_data(), src_ptr, slice_size);
-    packet->AddSlice(std::move(slice));
+// The packets read from a TraceBuffer by ReadTraceBuffer().
+struct BufferReadResult {
+  struct Packet {
+    TracePacket packet;
+    TraceBuffer::PacketSequenceProperties sequence_properties{};
+    bool previous_packet_dropped = false;
+  };
 
-    src_ptr += slice_size;
-    size_left -= slice_size;
+  std::vector<Packet> packets;
+  uint64_t invalid_packets = 0;
+  size_t bytes = 0;  // SUM(packet.size() for each packet in |packets|).
+};
+
+// Reads the packets of |tbuf| and drops the invalid ones. Stops reading after
+// crossing |max_bytes| (this is not an upper bound, at least one packet is
+// read). This doesn't touch the state of the service nor of the tracing
+// session, so that it can run on a read worker.
+void ReadTraceBuffer(TraceBuffer* tbuf,
+                     size_t max_bytes,
+                     BufferReadResult* result) {
+  tbuf->BeginRead();
+  for (;;) {
+    BufferReadResult::Packet read_packet;
+    if (!tbuf->ReadNextTracePacket(&read_packet.packet,
+                                   &read_packet.sequence_properties,
+                                   &read_packet.previous_packet_dropped)) {
+      break;
+    }
+    PERFETTO_DCHECK(read_packet.sequence_properties.producer_id_trusted != 0);
+    PERFETTO_DCHECK(read_packet.sequence_properties.writer_id != 0);
+    PERFETTO_DCHECK(read_packet.sequence_properties.producer_uid_trusted !=
+                    kInvalidUid);
+    PERFETTO_DCHECK(read_packet.packet.size() > 0);
+    if (!PacketStreamValidator::Validate(read_packet.packet.slices())) {
+      result->invalid_packets++;
+      PERFETTO_DLOG("Dropping invalid packet");
+      continue;
+    }
+    result->bytes += read_packet.packet.size();
+    result->packets.emplace_back(std::move(read_packet));
+    if (result->bytes >= max_bytes)
+      break;
   }
 }
 
+// Counters of FilterPackets(), added up into the TracingSession ones.
+struct FilterPacketsStats {
+  uint64_t input_packets = 0;
+  uint64_t input_bytes = 0;
+  uint64_t output_bytes = 0;
+  uint64_t errors = 0;
+};
+
+// Replaces in place each packet in [|begin|, |end|) with its filtered version.
+// Like ReadTraceBuffer(), this doesn't touch the state of the service, so that
+// different ranges of packets can be filtered in parallel on the read workers,
+// each one with its own |filter|.
+void FilterPackets(protozero::MessageFilter* filter,
+                   TracePacket* begin,
+                   TracePacket* end,
+                   size_t max_slice_size,
+                   FilterPacketsStats* stats) {
+  std::vector<protozero::MessageFilter::InputSlice> filter_input;
+  for (TracePacket* it = begin; it != end; ++it) {
+    const auto& packet_slices = it->slices();
+    filter_input.clear();
+    filter_input.resize(packet_slices.size());
+    ++stats->input_packets;
+    const size_t input_size = it->size();
+    stats->input_bytes += input_size;
+    for (size_t i = 0; i < packet_slices.size(); ++i)
+      filter_input[i] = {packet_slices[i].start, packet_slices[i].size};
+    auto filtered_packet =
+        filter->FilterMessageFragments(&filter_input[0], filter_input.size());
+
+    // Replace the packet in-place with the filtered one (unless failed).
+    *it = TracePacket();
+    if (filtered_packet.error) {
+      ++stats->errors;
+      PERFETTO_DLOG("Trace packet filtering failed @ packet %" PRIu64,
+                    stats->input_packets);
+      continue;
+    }
+    stats->output_bytes += filtered_packet.size;
+    // The filter allocates its output based on the input size, which is an
+    // upper bound for the filtered size.
+    AppendOwnedSlicesToPacket(std::move(filtered_packet.data),
+                              filtered_packet.size, input_size, max_slice_size,
+                              &*it);
+  }  // for (packet)
+}
+
+// Holds the small slices with the trusted fields that ReadBuffers() appends to
+// each packet. Rather than allocating a Slice for each packet, they are packed
+// in large blocks. The packets don't own this memory, as it happens already for
+// the slices that point into the TraceBuffer, so this has to outlive them.
+class TrustedSliceArena {
+ public:
+  // Copies |size| bytes into the arena and returns a pointer to the copy.
+  const void* Append(const void* data, size_t size) {
+    PERFETTO_DCHECK(size <= kBlockSize);
+    if (blocks_.empty() || block_used_ + size > kBlockSize) {
+      blocks_.emplace_back(new uint8_t[kBlockSize]);
+      block_used_ = 0;
+    }
+    uint8_t* dst = &blocks_.back()[block_used_];
+    memcpy(dst, data, size);
+    block_used_ += size;
+    return dst;
+  }
+
+ private:
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  std::vector<std::unique_ptr<uint8_t[]>> blocks_;
+  size_t block_used_ = 0;
+};
+
 }  // namespace
 
 // These constants instead are defined in the header because are used by tests.
@@ -318,6 +459,9 @@ constexpr size_t TracingServiceImpl::kDefaultShmPageSize;
 
 constexpr size_t TracingServiceImpl::kMaxShmSize;
 constexpr uint32_t TracingServiceImpl::kDataSourceStopTimeoutMs;
+constexpr uint32_t TracingServiceImpl::kFlushDeadlineMissesToDeprioritize;
+constexpr uint32_t TracingServiceImpl::kDeprioritizedFlushDeadlineMs;
+constexpr uint32_t TracingServiceImpl::kDirectCommitsMaxDelayMs;
 constexpr uint8_t TracingServiceImpl::kSyncMarker[];
 
 std::string GetBugreportPath() {
@@ -397,6 +541,8 @@ TracingServiceImpl::ConnectProducer(Producer* producer,
       in_process, smb_scraping_enabled));
   auto it_and_inserted = producers_.emplace(id, endpoint.get());
   PERFETTO_DCHECK(it_and_inserted.second);
+  endpoint->direct_commits_enabled_ =
+      in_process && inprocess_direct_commits_enabled_;
   endpoint->shmem_size_hint_bytes_ = shared_memory_size_hint_bytes;
   endpoint->shmem_page_size_hint_bytes_ = shared_memory_page_size_hint_bytes;
 
@@ -677,6 +823,25 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
     return PERFETTO_SVC_ERR("Too many buffers configured (%d)",
                             cfg.buffers_size());
   }
+  for (int i = 0; i < cfg.buffers_size(); i++) {
+    const TraceConfig::BufferConfig& buffer_cfg = cfg.buffers()[i];
+    if (!buffer_cfg.has_downsample_on_overwrite())
+      continue;
+    if (buffer_cfg.fill_policy() == TraceConfig::BufferConfig::DISCARD) {
+      return PERFETTO_SVC_ERR(
+          "buffers[%d]: downsample_on_overwrite requires RING_BUFFER", i);
+    }
+    uint32_t target_buffer =
+        buffer_cfg.downsample_on_overwrite().target_buffer();
+    if (target_buffer <= static_cast<uint32_t>(i) ||
+        target_buffer >= static_cast<uint32_t>(cfg.buffers_size())) {
+      return PERFETTO_SVC_ERR(
+          "buffers[%d]: invalid downsample_on_overwrite.target_buffer (%" PRIu32
+          "), must be > %d and < %d",
+          i, target_buffer, i, cfg.buffers_size());
+    }
+  }
+
   // Check that the config specifies all buffers for its data sources. This
   // is also checked in SetupDataSource, but it is simpler to return a proper
   // error to the consumer from here (and there will be less state to undo).
@@ -770,6 +935,7 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
   // If the filter loading fails, abort the tracing session rather than running
   // unfiltered.
   std::unique_ptr<protozero::MessageFilter> trace_filter;
+  std::vector<std::unique_ptr<protozero::MessageFilter>> worker_trace_filters;
   if (cfg.has_trace_filter()) {
     const auto& filt = cfg.trace_filter();
     const std::string& bytecode = filt.bytecode();
@@ -793,6 +959,17 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
           cfg, PerfettoStatsdAtom::kTracedEnableTracingInvalidFilter);
       return PERFETTO_SVC_ERR("Failed to set filter root.");
     }
+
+    // The filter is stateful. Each read worker needs its own instance to
+    // filter the packets in parallel with the others (see ReadBuffers()).
+    for (size_t i = 0; i < read_workers_.size(); i++) {
+      std::unique_ptr<protozero::MessageFilter> worker_filter(
+          new protozero::MessageFilter());
+      PERFETTO_CHECK(
+          worker_filter->LoadFilterBytecode(bytecode.data(), bytecode.size()));
+      PERFETTO_CHECK(worker_filter->SetFilterRoot(&packet_field_id, 1));
+      worker_trace_filters.emplace_back(std::move(worker_filter));
+    }
   }
 
   const TracingSessionID tsid = ++last_tracing_session_id_;
@@ -802,8 +979,10 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
                     std::forward_as_tuple(tsid, consumer, cfg, task_runner_))
            .first->second;
 
-  if (trace_filter)
+  if (trace_filter) {
     tracing_session->trace_filter = std::move(trace_filter);
+    tracing_session->worker_trace_filters = std::move(worker_trace_filters);
+  }
 
   if (cfg.write_into_file()) {
     if (!fd ^ !cfg.output_path().empty()) {
@@ -833,8 +1012,19 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
     if (write_period_ms < min_write_period_ms_)
       write_period_ms = min_write_period_ms_;
     tracing_session->write_period_ms = write_period_ms;
+    tracing_session->drain_period_ms = write_period_ms;
+    tracing_session->drain_stats.min_period_ms = write_period_ms;
     tracing_session->max_file_size_bytes = cfg.max_file_size_bytes();
     tracing_session->bytes_written_into_file = 0;
+    if (cfg.write_trace_index()) {
+      // The index describes the packets as written into the file, which can't
+      // be seeked into once compressed.
+      if (cfg.compression_type() == TraceConfig::COMPRESSION_TYPE_DEFLATE) {
+        PERFETTO_ELOG("write_trace_index is not supported with compression");
+      } else {
+        tracing_session->trace_index.reset(new TraceIndexBuilder());
+      }
+    }
   }
 
   // Initialize the log buffers.
@@ -861,8 +1051,13 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
         buffer_cfg.fill_policy() == TraceConfig::BufferConfig::DISCARD
             ? TraceBuffer::kDiscard
             : TraceBuffer::kOverwrite;
+    TraceBuffer::MemoryOptions memory_options;
+    memory_options.huge_pages = buffer_cfg.transparent_huge_pages();
+    if (buffer_cfg.has_numa_node())
+      memory_options.numa_node = static_cast<int32_t>(buffer_cfg.numa_node());
     auto it_and_inserted = buffers_.emplace(
-        global_id, TraceBuffer::Create(buf_size_bytes, policy));
+        global_id,
+        TraceBuffer::Create(buf_size_bytes, policy, memory_options));
     PERFETTO_DCHECK(it_and_inserted.second);  // buffers_.count(global_id) == 0.
     std::unique_ptr<TraceBuffer>& trace_buffer = it_and_inserted.first->second;
     if (!trace_buffer) {
@@ -890,6 +1085,25 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
         "Failed to allocate tracing buffers: OOM or too many buffers");
   }
 
+  // Chain the buffers to their older tiers. The indexes have been validated
+  // above.
+  for (size_t i = 0; i < num_buffers; i++) {
+    const TraceConfig::BufferConfig& buffer_cfg = cfg.buffers()[i];
+    if (!buffer_cfg.has_downsample_on_overwrite())
+      continue;
+    const auto& downsample_cfg = buffer_cfg.downsample_on_overwrite();
+    TraceBuffer* source = GetBufferByID(tracing_session->buffers_index[i]);
+    TraceBuffer* target = GetBufferByID(
+        tracing_session->buffers_index[downsample_cfg.target_buffer()]);
+    tracing_session->downsamplers.emplace_back(new PacketDownsampler(
+        target, downsample_cfg.keep_one_every_n_packets()));
+    PacketDownsampler* downsampler = tracing_session->downsamplers.back().get();
+    source->set_overwrite_callback(
+        [downsampler](const TraceBuffer::OverwrittenChunk& chunk) {
+          downsampler->OnChunkOverwritten(chunk);
+        });
+  }
+
   consumer->tracing_session_id_ = tsid;
 
   // Setup the data sources on the producers without starting them.
@@ -1523,6 +1737,19 @@ void TracingServiceImpl::ActivateTriggers(
                               PerfettoStatsdAtom::kTracedTriggerStopTracing,
                               iter->name());
 
+          // With freeze_buffers_on_stop the contents of the buffers are
+          // pinned right now and the final flush is issued straight away,
+          // ignoring |stop_delay_ms|.
+          if (tracing_session.config.trigger_config()
+                  .freeze_buffers_on_stop()) {
+            FreezeBuffers(&tracing_session);
+            task_runner_->PostTask([weak_this, tsid] {
+              if (weak_this && weak_this->GetTracingSession(tsid))
+                weak_this->FlushAndDisableTracing(tsid);
+            });
+            break;
+          }
+
           // Now that we've seen a trigger we need to stop, flush, and disable
           // this session after the configured |stop_delay_ms|.
           task_runner_->PostDelayedTask(
@@ -1631,8 +1858,9 @@ void TracingServiceImpl::Flush(TracingSessionID tsid,
   FlushRequestID flush_request_id = ++last_flush_request_id_;
   PendingFlush& pending_flush =
       tracing_session->pending_flushes
-          .emplace_hint(tracing_session->pending_flushes.end(),
-                        flush_request_id, PendingFlush(std::move(callback)))
+          .emplace_hint(
+              tracing_session->pending_flushes.end(), flush_request_id,
+              PendingFlush(std::move(callback), base::GetWallTimeNs()))
           ->second;
 
   // Send a flush request to each producer involved in the tracing session. In
@@ -1645,20 +1873,41 @@ void TracingServiceImpl::Flush(TracingSessionID tsid,
     flush_map[producer_id].push_back(ds_inst_id);
   }
 
+  // Producers which keep missing their flush deadline are sent the request
+  // last, and are waited for at most kDeprioritizedFlushDeadlineMs.
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  std::vector<ProducerID> deprioritized_producers;
   for (const auto& kv : flush_map) {
     ProducerID producer_id = kv.first;
     ProducerEndpointImpl* producer = GetProducer(producer_id);
+    if (producer->flush_deadlines_missed_in_a_row_ >=
+            kFlushDeadlineMissesToDeprioritize &&
+        kDeprioritizedFlushDeadlineMs < timeout_ms) {
+      deprioritized_producers.push_back(producer_id);
+      continue;
+    }
     const std::vector<DataSourceInstanceID>& data_sources = kv.second;
     producer->Flush(flush_request_id, data_sources);
     pending_flush.producers.insert(producer_id);
   }
+  for (ProducerID producer_id : deprioritized_producers) {
+    GetProducer(producer_id)->Flush(flush_request_id, flush_map[producer_id]);
+    pending_flush.producers.insert(producer_id);
+    task_runner_->PostDelayedTask(
+        [weak_this, tsid, flush_request_id, producer_id] {
+          if (weak_this) {
+            weak_this->OnProducerFlushDeadline(tsid, flush_request_id,
+                                               producer_id);
+          }
+        },
+        kDeprioritizedFlushDeadlineMs);
+  }
 
   // If there are no producers to flush (realistically this happens only in
   // some tests) fire OnFlushTimeout() straight away, without waiting.
   if (flush_map.empty())
     timeout_ms = 0;
 
-  auto weak_this = weak_ptr_factory_.GetWeakPtr();
   task_runner_->PostDelayedTask(
       [weak_this, tsid, flush_request_id] {
         if (weak_this)
@@ -1670,29 +1919,50 @@ void TracingServiceImpl::Flush(TracingSessionID tsid,
 void TracingServiceImpl::NotifyFlushDoneForProducer(
     ProducerID producer_id,
     FlushRequestID flush_request_id) {
+  const base::TimeNanos now = base::GetWallTimeNs();
+  bool acked_in_time = false;
   for (auto& kv : tracing_sessions_) {
     // Remove all pending flushes <= |flush_request_id| for |producer_id|.
     auto& pending_flushes = kv.second.pending_flushes;
     auto end_it = pending_flushes.upper_bound(flush_request_id);
     for (auto it = pending_flushes.begin(); it != end_it;) {
       PendingFlush& pending_flush = it->second;
-      pending_flush.producers.erase(producer_id);
+      // The producer isn't in the set anymore if it missed the deadline.
+      if (pending_flush.producers.erase(producer_id)) {
+        acked_in_time = true;
+        auto ack_time_ns =
+            static_cast<uint64_t>((now - pending_flush.start_time).count());
+        TracingSession::FlushStats& flush_stats =
+            kv.second.flush_stats[producer_id];
+        flush_stats.flushes_acked++;
+        flush_stats.flush_ack_time_ns += ack_time_ns;
+        flush_stats.flush_ack_max_time_ns =
+            std::max(flush_stats.flush_ack_max_time_ns, ack_time_ns);
+        flush_stats.ack_latency.Add(ack_time_ns);
+      }
       if (pending_flush.producers.empty()) {
         auto weak_this = weak_ptr_factory_.GetWeakPtr();
         TracingSessionID tsid = kv.first;
         auto callback = std::move(pending_flush.callback);
-        task_runner_->PostTask([weak_this, tsid, callback]() {
-          if (weak_this) {
-            weak_this->CompleteFlush(tsid, std::move(callback),
-                                     /*success=*/true);
-          }
-        });
+        const bool success = !pending_flush.deadline_missed;
+        const base::TimeNanos start_time = pending_flush.start_time;
+        task_runner_->PostTask(
+            [weak_this, tsid, callback, success, start_time]() {
+              if (weak_this) {
+                weak_this->CompleteFlush(tsid, std::move(callback), success,
+                                         start_time);
+              }
+            });
         it = pending_flushes.erase(it);
       } else {
         it++;
       }
     }  // for (pending_flushes)
   }    // for (tracing_session)
+
+  ProducerEndpointImpl* producer = GetProducer(producer_id);
+  if (acked_in_time && producer)
+    producer->flush_deadlines_missed_in_a_row_ = 0;
 }
 
 void TracingServiceImpl::OnFlushTimeout(TracingSessionID tsid,
@@ -1704,17 +1974,72 @@ void TracingServiceImpl::OnFlushTimeout(TracingSessionID tsid,
   if (it == tracing_session->pending_flushes.end())
     return;  // Nominal case: flush was completed and acked on time.
 
+  PendingFlush& pending_flush = it->second;
+  for (ProducerID producer_id : pending_flush.producers)
+    OnFlushDeadlineMissed(tracing_session, producer_id);
+
   // If there were no producers to flush, consider it a success.
-  bool success = it->second.producers.empty();
+  bool success =
+      pending_flush.producers.empty() && !pending_flush.deadline_missed;
 
-  auto callback = std::move(it->second.callback);
+  auto callback = std::move(pending_flush.callback);
+  const base::TimeNanos start_time = pending_flush.start_time;
   tracing_session->pending_flushes.erase(it);
-  CompleteFlush(tsid, std::move(callback), success);
+  CompleteFlush(tsid, std::move(callback), success, start_time);
+}
+
+// Invoked kDeprioritizedFlushDeadlineMs after sending a flush request to a
+// producer which has been deprioritized. The flush completes without it, as
+// soon as the other producers ack it.
+void TracingServiceImpl::OnProducerFlushDeadline(
+    TracingSessionID tsid,
+    FlushRequestID flush_request_id,
+    ProducerID producer_id) {
+  TracingSession* tracing_session = GetTracingSession(tsid);
+  if (!tracing_session)
+    return;
+  auto it = tracing_session->pending_flushes.find(flush_request_id);
+  if (it == tracing_session->pending_flushes.end())
+    return;
+  PendingFlush& pending_flush = it->second;
+  if (!pending_flush.producers.erase(producer_id))
+    return;  // The producer acked the flush in time.
+
+  pending_flush.deadline_missed = true;
+  OnFlushDeadlineMissed(tracing_session, producer_id);
+
+  // Collect what the producer wrote so far right away, rather than after the
+  // flush timeout.
+  ProducerEndpointImpl* producer = GetProducer(producer_id);
+  if (producer)
+    ScrapeSharedMemoryBuffers(tracing_session, producer);
+
+  if (!pending_flush.producers.empty())
+    return;
+  auto callback = std::move(pending_flush.callback);
+  const base::TimeNanos start_time = pending_flush.start_time;
+  tracing_session->pending_flushes.erase(it);
+  CompleteFlush(tsid, std::move(callback), /*success=*/false, start_time);
+}
+
+void TracingServiceImpl::OnFlushDeadlineMissed(TracingSession* tracing_session,
+                                               ProducerID producer_id) {
+  tracing_session->flush_stats[producer_id].flush_deadlines_missed++;
+  ProducerEndpointImpl* producer = GetProducer(producer_id);
+  if (!producer)
+    return;
+  if (++producer->flush_deadlines_missed_in_a_row_ ==
+      kFlushDeadlineMissesToDeprioritize) {
+    PERFETTO_ILOG("Producer %" PRIu16
+                  " missed %u flush deadlines in a row, deprioritizing it",
+                  producer_id, kFlushDeadlineMissesToDeprioritize);
+  }
 }
 
 void TracingServiceImpl::CompleteFlush(TracingSessionID tsid,
                                        ConsumerEndpoint::FlushCallback callback,
-                                       bool success) {
+                                       bool success,
+                                       base::TimeNanos start_time) {
   TracingSession* tracing_session = GetTracingSession(tsid);
   if (!tracing_session) {
     callback(false);
@@ -1730,6 +2055,9 @@ void TracingServiceImpl::CompleteFlush(TracingSessionID tsid,
       tracing_session,
       protos::pbzero::TracingServiceEvent::kAllDataSourcesFlushedFieldNumber,
       true /* snapshot_clocks */);
+  const base::TimeNanos flush_time = base::GetWallTimeNs() - start_time;
+  tracing_session->flush_latency.Add(flush_time);
+  flush_latency_.Add(flush_time);
   callback(success);
 }
 
@@ -1758,6 +2086,7 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
     return;
 
   PERFETTO_DLOG("Scraping SMB for producer %" PRIu16, producer->id_);
+  const base::TimeNanos scrape_start = base::GetWallTimeNs();
 
   // Find and copy any uncommitted chunks from the SMB.
   //
@@ -1844,10 +2173,41 @@ void TracingServiceImpl::ScrapeSharedMemoryBuffers(
 
       CopyProducerPageIntoLogBuffer(
           producer->id_, producer->uid_, writer_id, chunk_id, *target_buffer_id,
-          packet_count, flags, chunk_complete, chunk.payload_begin(),
-          chunk.payload_size());
+          packet_count, flags, chunk_complete, /*scraped=*/true,
+          chunk.payload_begin(), chunk.payload_size());
     }
   }
+
+  TracingSession::ScrapeStats& scrape_stats =
+      tracing_session->scrape_stats[producer->id_];
+  const base::TimeNanos scrape_time = base::GetWallTimeNs() - scrape_start;
+  scrape_stats.scrapes++;
+  scrape_stats.scrape_time_ns += static_cast<uint64_t>(scrape_time.count());
+  scrape_stats.scrape_latency.Add(scrape_time);
+  producer->smb_scrape_latency_.Add(scrape_time);
+  smb_scrape_latency_.Add(scrape_time);
+}
+
+void TracingServiceImpl::FreezeBuffers(TracingSession* tracing_session) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_DLOG("Freezing buffers of tracing session %" PRIu64,
+                tracing_session->id);
+
+  // Pull in the chunks the producers are still writing, so that the following
+  // commits and flushes can complete them.
+  for (auto& producer_id_and_producer : producers_)
+    ScrapeSharedMemoryBuffers(tracing_session, producer_id_and_producer.second);
+
+  for (BufferID buffer_id : tracing_session->buffers_index) {
+    TraceBuffer* buf = GetBufferByID(buffer_id);
+    if (buf)
+      buf->Freeze();
+  }
+
+  SnapshotLifecyleEvent(
+      tracing_session,
+      protos::pbzero::TracingServiceEvent::kBuffersFrozenFieldNumber,
+      true /* snapshot_clocks */);
 }
 
 void TracingServiceImpl::FlushAndDisableTracing(TracingSessionID tsid) {
@@ -1954,7 +2314,8 @@ void TracingServiceImpl::PeriodicClearIncrementalStateTask(
 // |consumer| will be == nullptr (as opposite to the case of a consumer asking
 // to send the trace data back over IPC).
 bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
-                                     ConsumerEndpointImpl* consumer) {
+                                     ConsumerEndpointImpl* consumer,
+                                     int readback_fd) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   TracingSession* tracing_session = GetTracingSession(tsid);
   if (!tracing_session) {
@@ -1993,6 +2354,14 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     return false;
   }
 
+  // When the consumer passed a file to read the buffers into, the packets are
+  // written into it like for |write_into_file|, all in one go, and the
+  // consumer is only notified at the end (see ReadBuffersIntoFile()).
+  const bool readback_into_file = consumer && readback_fd >= 0;
+  const bool into_file =
+      static_cast<bool>(tracing_session->write_into_file) || readback_into_file;
+
+  const base::TimeNanos read_start = base::GetWallTimeNs();
   std::vector<TracePacket> packets;
   packets.reserve(1024);  // Just an educated guess to avoid trivial expansions.
 
@@ -2065,68 +2434,124 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
 
   // TODO(primiano): Extend the ReadBuffers API to allow reading only some
   // buffers, not all of them in one go.
-  for (size_t buf_idx = 0;
-       buf_idx < tracing_session->num_buffers() && !did_hit_threshold;
-       buf_idx++) {
-    auto tbuf_iter = buffers_.find(tracing_session->buffers_index[buf_idx]);
+  std::vector<TraceBuffer*> buffers_to_read;
+  for (BufferID buffer_id : tracing_session->buffers_index) {
+    auto tbuf_iter = buffers_.find(buffer_id);
     if (tbuf_iter == buffers_.end()) {
       PERFETTO_DFATAL("Buffer not found.");
       continue;
     }
-    TraceBuffer& tbuf = *tbuf_iter->second;
-    tbuf.BeginRead();
-    while (!did_hit_threshold) {
-      TracePacket packet;
-      TraceBuffer::PacketSequenceProperties sequence_properties{};
-      bool previous_packet_dropped;
-      if (!tbuf.ReadNextTracePacket(&packet, &sequence_properties,
-                                    &previous_packet_dropped)) {
-        break;
-      }
-      PERFETTO_DCHECK(sequence_properties.producer_id_trusted != 0);
-      PERFETTO_DCHECK(sequence_properties.writer_id != 0);
-      PERFETTO_DCHECK(sequence_properties.producer_uid_trusted != kInvalidUid);
-      PERFETTO_DCHECK(packet.size() > 0);
-      if (!PacketStreamValidator::Validate(packet.slices())) {
-        tracing_session->invalid_packets++;
-        PERFETTO_DLOG("Dropping invalid packet");
-        continue;
+    buffers_to_read.push_back(tbuf_iter->second.get());
+  }
+  std::vector<BufferReadResult> read_results(buffers_to_read.size());
+
+  // When indexing the file, the index of the first packet read from each
+  // buffer, and of the first one emitted by the service after them. The ones
+  // before are emitted by the service too.
+  std::vector<std::pair<size_t, uint32_t>> buffer_boundaries;
+  if (tracing_session->trace_index)
+    buffer_boundaries.emplace_back(0, TraceIndexBuilder::kServiceBuffer);
+
+  // When draining into a file, sample how much the buffers filled up since the
+  // previous drain, to adapt the period of the next one.
+  uint32_t fill_percent = 0;
+  uint64_t chunks_overwritten = 0;
+  if (tracing_session->write_into_file) {
+    for (TraceBuffer* tbuf : buffers_to_read) {
+      const size_t size = std::max<size_t>(tbuf->size(), 1);
+      fill_percent = std::max(
+          fill_percent, static_cast<uint32_t>(tbuf->used_size() * 100 / size));
+      chunks_overwritten += tbuf->stats().chunks_overwritten();
+    }
+  }
+
+  // Backs the trusted slices of the packets read below. It must stay alive
+  // until the packets have been written into the file or passed to the
+  // consumer, at the end of this function.
+  TrustedSliceArena trusted_slices;
+
+  // When draining into a file, all the buffers are read in one go. If there
+  // are read workers, read the buffers in parallel on them. This thread just
+  // waits for them, so nothing else can touch the buffers in the meantime.
+  const bool read_on_workers =
+      into_file && buffers_to_read.size() > 1 && !read_workers_.empty();
+  if (read_on_workers) {
+    std::vector<base::WaitableEvent> read_done(buffers_to_read.size());
+    for (size_t i = 0; i < buffers_to_read.size(); i++) {
+      TraceBuffer* tbuf = buffers_to_read[i];
+      BufferReadResult* result = &read_results[i];
+      base::WaitableEvent* done = &read_done[i];
+      read_workers_[i % read_workers_.size()]->PostTask([tbuf, result, done] {
+        ReadTraceBuffer(tbuf, std::numeric_limits<size_t>::max(), result);
+        done->Notify();
+      });
+    }
+    for (base::WaitableEvent& done : read_done)
+      done.Wait();
+  }
+
+  for (size_t buf_idx = 0;
+       buf_idx < buffers_to_read.size() && !did_hit_threshold; buf_idx++) {
+    BufferReadResult& result = read_results[buf_idx];
+    if (!read_on_workers) {
+      size_t max_bytes = std::numeric_limits<size_t>::max();
+      if (!into_file) {
+        max_bytes = packets_bytes < kApproxBytesPerTask
+                        ? kApproxBytesPerTask - packets_bytes
+                        : 0;
       }
+      ReadTraceBuffer(buffers_to_read[buf_idx], max_bytes, &result);
+    }
+    tracing_session->invalid_packets += result.invalid_packets;
+    if (tracing_session->trace_index) {
+      buffer_boundaries.emplace_back(packets.size(),
+                                     static_cast<uint32_t>(buf_idx));
+    }
+
+    for (BufferReadResult::Packet& read_packet : result.packets) {
+      TracePacket& packet = read_packet.packet;
+      const auto& sequence_properties = read_packet.sequence_properties;
 
       // Append a slice with the trusted field data. This can't be spoofed
-      // because above we validated that the existing slices don't contain any
-      // trusted fields. For added safety we append instead of prepending
-      // because according to protobuf semantics, if the same field is
-      // encountered multiple times the last instance takes priority. Note that
-      // truncated packets are also rejected, so the producer can't give us a
-      // partial packet (e.g., a truncated string) which only becomes valid when
-      // the trusted data is appended here.
-      Slice slice = Slice::Allocate(32);
+      // because ReadTraceBuffer() validated that the existing slices don't
+      // contain any trusted fields. For added safety we append instead of
+      // prepending because according to protobuf semantics, if the same field
+      // is encountered multiple times the last instance takes priority. Note
+      // that truncated packets are also rejected, so the producer can't give
+      // us a partial packet (e.g., a truncated string) which only becomes
+      // valid when the trusted data is appended here.
+      uint8_t trusted_buf[32];
       protozero::StaticBuffered<protos::pbzero::TracePacket> trusted_packet(
-          slice.own_data(), slice.size);
+          &trusted_buf[0], sizeof(trusted_buf));
       trusted_packet->set_trusted_uid(
           static_cast<int32_t>(sequence_properties.producer_uid_trusted));
       trusted_packet->set_trusted_packet_sequence_id(
           tracing_session->GetPacketSequenceID(
               sequence_properties.producer_id_trusted,
               sequence_properties.writer_id));
-      if (previous_packet_dropped)
-        trusted_packet->set_previous_packet_dropped(previous_packet_dropped);
-      slice.size = trusted_packet.Finalize();
-      packet.AddSlice(std::move(slice));
+      if (read_packet.previous_packet_dropped) {
+        trusted_packet->set_previous_packet_dropped(
+            read_packet.previous_packet_dropped);
+      }
+      size_t trusted_size = trusted_packet.Finalize();
+      packet.AddSlice(trusted_slices.Append(&trusted_buf[0], trusted_size),
+                      trusted_size);
 
       // Append the packet (inclusive of the trusted uid) to |packets|.
       packets_bytes += packet.size();
       total_slices += packet.slices().size();
-      did_hit_threshold = packets_bytes >= kApproxBytesPerTask &&
-                          !tracing_session->write_into_file;
       packets.emplace_back(std::move(packet));
     }  // for(packets...)
-  }    // for(buffers...)
+    did_hit_threshold = packets_bytes >= kApproxBytesPerTask && !into_file;
+  }  // for(buffers...)
 
   const bool has_more = did_hit_threshold;
 
   size_t prev_packets_size = packets.size();
+  if (tracing_session->trace_index) {
+    buffer_boundaries.emplace_back(prev_packets_size,
+                                   TraceIndexBuilder::kServiceBuffer);
+  }
   if (!tracing_session->config.builtin_data_sources()
            .disable_service_events()) {
     // We don't bother snapshotting clocks here because we wouldn't be able to
@@ -2166,45 +2591,72 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
   // makes debugging and reasoning about the trace stats easier.
   // This place swaps the contents of each |packets| entry in place.
   if (tracing_session->trace_filter) {
-    auto& trace_filter = *tracing_session->trace_filter;
     // The filter root shoud be reset from protos.Trace to protos.TracePacket
     // by the earlier call to SetFilterRoot() in EnableTracing().
-    PERFETTO_DCHECK(trace_filter.root_msg_index() != 0);
-    std::vector<protozero::MessageFilter::InputSlice> filter_input;
-    for (auto it = packets.begin(); it != packets.end(); ++it) {
-      const auto& packet_slices = it->slices();
-      filter_input.clear();
-      filter_input.resize(packet_slices.size());
-      ++tracing_session->filter_input_packets;
-      tracing_session->filter_input_bytes += it->size();
-      for (size_t i = 0; i < packet_slices.size(); ++i)
-        filter_input[i] = {packet_slices[i].start, packet_slices[i].size};
-      auto filtered_packet = trace_filter.FilterMessageFragments(
-          &filter_input[0], filter_input.size());
-
-      // Replace the packet in-place with the filtered one (unless failed).
-      *it = TracePacket();
-      if (filtered_packet.error) {
-        ++tracing_session->filter_errors;
-        PERFETTO_DLOG("Trace packet filtering failed @ packet %" PRIu64,
-                      tracing_session->filter_input_packets);
-        continue;
-      }
-      tracing_session->filter_output_bytes += filtered_packet.size;
-      AppendOwnedSlicesToPacket(std::move(filtered_packet.data),
-                                filtered_packet.size, kMaxTracePacketSliceSize,
-                                &*it);
-
-    }  // for (packet)
-  }    // if (trace_filter)
+    PERFETTO_DCHECK(tracing_session->trace_filter->root_msg_index() != 0);
+
+    // If there are read workers, split the packets in contiguous ranges and
+    // filter them in parallel, one range per worker (each with its own filter
+    // instance) plus one on this thread. Not worth it for a handful of packets.
+    std::vector<protozero::MessageFilter*> filters{
+        tracing_session->trace_filter.get()};
+    if (packets.size() >= kMinPacketsForParallelFilter &&
+        !read_workers_.empty()) {
+      for (auto& worker_filter : tracing_session->worker_trace_filters)
+        filters.push_back(worker_filter.get());
+    }
+    const size_t num_ranges = filters.size();
+    const size_t packets_per_range = (packets.size() + num_ranges - 1) /
+                                     num_ranges;
+    auto range_begin = [&packets, packets_per_range](size_t i) {
+      return packets.data() + std::min(i * packets_per_range, packets.size());
+    };
+    std::vector<FilterPacketsStats> filter_stats(num_ranges);
+    std::vector<base::WaitableEvent> filter_done(num_ranges - 1);
+    for (size_t i = 1; i < num_ranges; i++) {
+      TracePacket* begin = range_begin(i);
+      TracePacket* end = range_begin(i + 1);
+      protozero::MessageFilter* filter = filters[i];
+      FilterPacketsStats* stats = &filter_stats[i];
+      base::WaitableEvent* done = &filter_done[i - 1];
+      base::TaskRunner* worker =
+          read_workers_[(i - 1) % read_workers_.size()].get();
+      worker->PostTask([filter, begin, end, stats, done] {
+        FilterPackets(filter, begin, end, kMaxTracePacketSliceSize, stats);
+        done->Notify();
+      });
+    }
+    FilterPackets(filters[0], range_begin(0), range_begin(1),
+                  kMaxTracePacketSliceSize, &filter_stats[0]);
+    for (base::WaitableEvent& done : filter_done)
+      done.Wait();
+
+    for (const FilterPacketsStats& stats : filter_stats) {
+      tracing_session->filter_input_packets += stats.input_packets;
+      tracing_session->filter_input_bytes += stats.input_bytes;
+      tracing_session->filter_output_bytes += stats.output_bytes;
+      tracing_session->filter_errors += stats.errors;
+    }
+  }  // if (trace_filter)
+
+  // Compress the packets after filtering them, as the filter can only deal
+  // with uncompressed packets. When writing into a file this also makes
+  // |max_file_size_bytes| apply to the compressed size of the trace.
+  if (MaybeCompressPackets(tracing_session, &packets)) {
+    total_slices = 0;
+    for (const TracePacket& packet : packets)
+      total_slices += packet.slices().size();
+  }
 
   // If the caller asked us to write into a file by setting
-  // |write_into_file| == true in the trace config, drain the packets read
-  // (if any) into the given file descriptor.
-  if (tracing_session->write_into_file) {
-    const uint64_t max_size = tracing_session->max_file_size_bytes
-                                  ? tracing_session->max_file_size_bytes
-                                  : std::numeric_limits<size_t>::max();
+  // |write_into_file| == true in the trace config (or by passing a file to
+  // ReadBuffersIntoFile()), drain the packets read (if any) into the given file
+  // descriptor.
+  if (into_file) {
+    const uint64_t max_size =
+        tracing_session->max_file_size_bytes && !readback_into_file
+            ? tracing_session->max_file_size_bytes
+            : std::numeric_limits<size_t>::max();
 
     // When writing into a file, the file should look like a root trace.proto
     // message. Each packet should be prepended with a proto preamble stating
@@ -2212,11 +2664,16 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     const size_t max_iovecs = total_slices + packets.size();
 
     size_t num_iovecs = 0;
-    bool stop_writing_into_file = tracing_session->write_period_ms == 0;
+    bool stop_writing_into_file =
+        !readback_into_file && tracing_session->write_period_ms == 0;
     std::unique_ptr<struct iovec[]> iovecs(new struct iovec[max_iovecs]);
     size_t num_iovecs_at_last_packet = 0;
     uint64_t bytes_about_to_be_written = 0;
-    for (TracePacket& packet : packets) {
+    TraceIndexBuilder* trace_index =
+        readback_into_file ? nullptr : tracing_session->trace_index.get();
+    size_t boundary = 0;
+    for (size_t i = 0; i < packets.size(); i++) {
+      TracePacket& packet = packets[i];
       std::tie(iovecs[num_iovecs].iov_base, iovecs[num_iovecs].iov_len) =
           packet.GetProtoPreamble();
       bytes_about_to_be_written += iovecs[num_iovecs].iov_len;
@@ -2239,9 +2696,20 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
       }
 
       num_iovecs_at_last_packet = num_iovecs;
+
+      if (trace_index) {
+        while (boundary + 1 < buffer_boundaries.size() &&
+               buffer_boundaries[boundary + 1].first <= i) {
+          boundary++;
+        }
+        trace_index->AddPacket(packet, buffer_boundaries[boundary].second);
+      }
     }
+    if (trace_index)
+      trace_index->EndSection();
     PERFETTO_DCHECK(num_iovecs <= max_iovecs);
-    int fd = *tracing_session->write_into_file;
+    int fd =
+        readback_into_file ? readback_fd : *tracing_session->write_into_file;
 
     uint64_t total_wr_size = 0;
 
@@ -2258,11 +2726,36 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
       total_wr_size += static_cast<size_t>(wr_size);
     }
 
+    if (readback_into_file) {
+      RecordReadBuffersLatency(tracing_session, read_start);
+      PERFETTO_DLOG("Read buffers into file, written: %" PRIu64 " KB",
+                    (total_wr_size + 1023) / 1024);
+      // Keep this as tail call, just in case the consumer re-enters.
+      consumer->consumer_->OnTraceData({}, /*has_more=*/false);
+      return true;
+    }
+
     tracing_session->bytes_written_into_file += total_wr_size;
+    RecordReadBuffersLatency(tracing_session, read_start);
+    AdaptDrainPeriod(tracing_session, fill_percent, chunks_overwritten);
 
-    PERFETTO_DLOG("Draining into file, written: %" PRIu64 " KB, stop: %d",
-                  (total_wr_size + 1023) / 1024, stop_writing_into_file);
+    PERFETTO_DLOG("Draining into file, written: %" PRIu64
+                  " KB, fill: %u%%, next period: %u ms, stop: %d",
+                  (total_wr_size + 1023) / 1024, fill_percent,
+                  tracing_session->drain_period_ms, stop_writing_into_file);
     if (stop_writing_into_file) {
+      // The index is only valid if all the packets it describes made it into
+      // the file.
+      if (trace_index && tracing_session->bytes_written_into_file ==
+                             trace_index->data_size()) {
+        std::vector<uint8_t> index = trace_index->Serialize();
+        if (base::WriteAll(fd, index.data(), index.size()) !=
+            static_cast<ssize_t>(index.size())) {
+          PERFETTO_PLOG("Failed to write the trace index");
+        }
+      }
+      tracing_session->trace_index.reset();
+
       // Ensure all data was written to the file before we close it.
       base::FlushFile(fd);
       tracing_session->write_into_file.reset();
@@ -2292,11 +2785,64 @@ bool TracingServiceImpl::ReadBuffers(TracingSessionID tsid,
     });
   }
 
+  RecordReadBuffersLatency(tracing_session, read_start);
+
   // Keep this as tail call, just in case the consumer re-enters.
   consumer->consumer_->OnTraceData(std::move(packets), has_more);
   return true;
 }
 
+void TracingServiceImpl::RecordReadBuffersLatency(
+    TracingSession* tracing_session,
+    base::TimeNanos start_time) {
+  const base::TimeNanos read_time = base::GetWallTimeNs() - start_time;
+  tracing_session->read_buffers_latency.Add(read_time);
+  read_buffers_latency_.Add(read_time);
+}
+
+void TracingServiceImpl::AdaptDrainPeriod(TracingSession* tracing_session,
+                                          uint32_t fill_percent,
+                                          uint64_t chunks_overwritten) {
+  TracingSession::DrainStats& stats = tracing_session->drain_stats;
+  const uint64_t new_chunks_overwritten =
+      chunks_overwritten - tracing_session->chunks_overwritten_at_last_drain;
+  tracing_session->chunks_overwritten_at_last_drain = chunks_overwritten;
+  stats.drains++;
+  stats.last_fill_percent = fill_percent;
+  stats.max_fill_percent = std::max(stats.max_fill_percent, fill_percent);
+  if (new_chunks_overwritten) {
+    stats.drains_with_overwrites++;
+    stats.chunks_overwritten += new_chunks_overwritten;
+  }
+  if (!tracing_session->write_period_ms)
+    return;  // This is the last drain.
+
+  // Drain more often while the producers fill the buffers faster than the
+  // drain empties them, rather than letting them overwrite the data that
+  // could be written into the file.
+  uint32_t& period_ms = tracing_session->drain_period_ms;
+  if (new_chunks_overwritten || fill_percent >= kDrainFillPercentHigh) {
+    period_ms = std::max(period_ms / 2, min_write_period_ms_);
+  } else if (fill_percent < kDrainFillPercentLow) {
+    period_ms = std::min(period_ms * 2, tracing_session->write_period_ms);
+  }
+  stats.min_period_ms = std::min(stats.min_period_ms, period_ms);
+}
+
+void TracingServiceImpl::SetBufferReadWorkers(size_t num_workers) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  read_workers_.clear();
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  PERFETTO_ELOG("Buffer read workers are not supported on this platform");
+  base::ignore_result(num_workers);
+#else
+  for (size_t i = 0; i < num_workers; i++) {
+    read_workers_.emplace_back(new base::ThreadTaskRunner(
+        base::ThreadTaskRunner::CreateAndStart("TracedBufReader")));
+  }
+#endif
+}
+
 void TracingServiceImpl::FreeBuffers(TracingSessionID tsid) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DLOG("Freeing buffers for session %" PRIu64, tsid);
@@ -2609,6 +3155,7 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
     uint16_t num_fragments,
     uint8_t chunk_flags,
     bool chunk_complete,
+    bool scraped,
     const uint8_t* src,
     size_t size) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
@@ -2642,6 +3189,9 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
     return;
   }
 
+  ProducerEndpointImpl::WriterStats* writer_stats =
+      producer->GetWriterStats(buffer_id, writer_id);
+
   // If the writer was registered by the producer, it should only write into the
   // buffer it was registered with.
   base::Optional<BufferID> associated_buffer =
@@ -2654,9 +3204,19 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
                   buffer_id);
     PERFETTO_DFATAL("Wrong target buffer");
     chunks_discarded_++;
+    writer_stats->chunks_discarded++;
     return;
   }
 
+  if (scraped) {
+    writer_stats->chunks_scraped++;
+    writer_stats->bytes_scraped += size;
+  } else {
+    writer_stats->chunks_committed++;
+    writer_stats->bytes_committed += size;
+  }
+
+  ScopedLatencyRecorder copy_latency(&chunk_copy_latency_);
   buf->CopyChunkUntrusted(producer_id_trusted, producer_uid_trusted, writer_id,
                           chunk_id, num_fragments, chunk_flags, chunk_complete,
                           src, size);
@@ -2666,6 +3226,7 @@ void TracingServiceImpl::ApplyChunkPatches(
     ProducerID producer_id_trusted,
     const std::vector<CommitDataRequest::ChunkToPatch>& chunks_to_patch) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  ProducerEndpointImpl* producer = GetProducer(producer_id_trusted);
 
   for (const auto& chunk : chunks_to_patch) {
     const ChunkID chunk_id = static_cast<ChunkID>(chunk.chunk_id());
@@ -2719,8 +3280,20 @@ void TracingServiceImpl::ApplyChunkPatches(
       memcpy(&patches[i].data[0], patch_data.data(), patches[i].data.size());
       i++;
     }
-    buf->TryPatchChunkContents(producer_id_trusted, writer_id, chunk_id,
-                               &patches[0], i, chunk.has_more_patches());
+    bool patched =
+        buf->TryPatchChunkContents(producer_id_trusted, writer_id, chunk_id,
+                                   &patches[0], i, chunk.has_more_patches());
+
+    const auto buffer_id = static_cast<BufferID>(chunk.target_buffer());
+    if (producer && producer->is_allowed_target_buffer(buffer_id)) {
+      ProducerEndpointImpl::WriterStats* writer_stats =
+          producer->GetWriterStats(buffer_id, writer_id);
+      if (patched) {
+        writer_stats->patches_applied += i;
+      } else {
+        writer_stats->patches_failed += i;
+      }
+    }
   }
 }
 
@@ -3065,6 +3638,88 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     }
     *trace_stats.add_buffer_stats() = buf->stats();
   }  // for (buf in session).
+
+  const std::vector<BufferID>& session_buffers = tracing_session->buffers_index;
+  for (const auto& id_and_producer : producers_) {
+    ProducerEndpointImpl* producer = id_and_producer.second;
+    TraceStats::ProducerStats* producer_stats = nullptr;
+    auto get_producer_stats = [&] {
+      if (!producer_stats) {
+        producer_stats = trace_stats.add_producer_stats();
+        producer_stats->set_producer_id(static_cast<int32_t>(producer->id_));
+        producer_stats->set_producer_name(producer->name_);
+      }
+      return producer_stats;
+    };
+
+    auto scrape_it = tracing_session->scrape_stats.find(producer->id_);
+    if (scrape_it != tracing_session->scrape_stats.end()) {
+      get_producer_stats()->set_smb_scrapes(scrape_it->second.scrapes);
+      get_producer_stats()->set_smb_scrape_time_ns(
+          scrape_it->second.scrape_time_ns);
+      scrape_it->second.scrape_latency.Serialize(
+          get_producer_stats()->mutable_smb_scrape_latency());
+    }
+
+    auto flush_it = tracing_session->flush_stats.find(producer->id_);
+    if (flush_it != tracing_session->flush_stats.end()) {
+      const TracingSession::FlushStats& flush_stats = flush_it->second;
+      get_producer_stats()->set_flushes_acked(flush_stats.flushes_acked);
+      get_producer_stats()->set_flush_deadlines_missed(
+          flush_stats.flush_deadlines_missed);
+      get_producer_stats()->set_flush_ack_time_ns(
+          flush_stats.flush_ack_time_ns);
+      get_producer_stats()->set_flush_ack_max_time_ns(
+          flush_stats.flush_ack_max_time_ns);
+      flush_stats.ack_latency.Serialize(
+          get_producer_stats()->mutable_flush_ack_latency());
+    }
+
+    for (auto it = producer->writer_stats_.GetIterator(); it; ++it) {
+      const auto buffer_id = static_cast<BufferID>(it.key() >> 16);
+      auto buf_it =
+          std::find(session_buffers.begin(), session_buffers.end(), buffer_id);
+      if (buf_it == session_buffers.end())
+        continue;
+      const ProducerEndpointImpl::WriterStats& stats = it.value();
+      TraceStats::WriterStats* writer_stats =
+          get_producer_stats()->add_writer_stats();
+      writer_stats->set_writer_id(it.key() & 0xffff);
+      writer_stats->set_buffer(
+          static_cast<uint32_t>(buf_it - session_buffers.begin()));
+      writer_stats->set_chunks_committed(stats.chunks_committed);
+      writer_stats->set_bytes_committed(stats.bytes_committed);
+      writer_stats->set_chunks_scraped(stats.chunks_scraped);
+      writer_stats->set_bytes_scraped(stats.bytes_scraped);
+      writer_stats->set_patches_applied(stats.patches_applied);
+      writer_stats->set_patches_failed(stats.patches_failed);
+      writer_stats->set_chunks_discarded(stats.chunks_discarded);
+    }
+
+    // Only for the producers which are already reported above, as this isn't
+    // specific to the session.
+    if (producer_stats) {
+      producer->commit_data_latency_.Serialize(
+          producer_stats->mutable_commit_data_latency());
+    }
+  }  // for (producer).
+
+  if (tracing_session->drain_period_ms) {
+    const TracingSession::DrainStats& drain_stats =
+        tracing_session->drain_stats;
+    auto* wif_stats = trace_stats.mutable_write_into_file_stats();
+    wif_stats->set_drains(drain_stats.drains);
+    wif_stats->set_last_fill_percent(drain_stats.last_fill_percent);
+    wif_stats->set_max_fill_percent(drain_stats.max_fill_percent);
+    wif_stats->set_drains_with_overwrites(drain_stats.drains_with_overwrites);
+    wif_stats->set_chunks_overwritten(drain_stats.chunks_overwritten);
+    wif_stats->set_period_ms(tracing_session->drain_period_ms);
+    wif_stats->set_min_period_ms(drain_stats.min_period_ms);
+  }
+
+  tracing_session->flush_latency.Serialize(trace_stats.mutable_flush_latency());
+  tracing_session->read_buffers_latency.Serialize(
+      trace_stats.mutable_read_buffers_latency());
   return trace_stats;
 }
 
@@ -3183,6 +3838,23 @@ void TracingServiceImpl::MaybeEmitReceivedTriggers(
   }
 }
 
+bool TracingServiceImpl::MaybeCompressPackets(
+    TracingSession* tracing_session,
+    std::vector<TracePacket>* packets) {
+  const TraceConfig& cfg = tracing_session->config;
+  if (cfg.compression_type() != TraceConfig::COMPRESSION_TYPE_DEFLATE ||
+      cfg.compress_from_cli() || packets->empty()) {
+    return false;
+  }
+  if (!compressor_fn_) {
+    // Compression is best effort: the trace is just left uncompressed.
+    PERFETTO_DLOG("Compression requested but no compressor is available");
+    return false;
+  }
+  compressor_fn_(packets);
+  return true;
+}
+
 bool TracingServiceImpl::MaybeSaveTraceForBugreport(
     std::function<void()> callback) {
   TracingSession* max_session = nullptr;
@@ -3253,6 +3925,8 @@ bool TracingServiceImpl::MaybeSaveTraceForBugreport(
       }  // for (packets)
     }    // if (!disable_service_events())
   }      // if (max_session->write_into_file)
+  // The index would describe the packets of the stolen file.
+  max_session->trace_index.reset();
   max_session->write_into_file = std::move(br_fd);
   max_session->on_disable_callback_for_bugreport = std::move(callback);
   max_session->seized_for_bugreport = true;
@@ -3268,6 +3942,134 @@ bool TracingServiceImpl::MaybeSaveTraceForBugreport(
   return true;
 }
 
+void TracingServiceImpl::CloneSession(
+    ConsumerEndpointImpl* consumer,
+    const std::string& unique_session_name,
+    ConsumerEndpoint::CloneSessionCallback callback) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (consumer->tracing_session_id_) {
+    callback(false, "The consumer already has a tracing session");
+    return;
+  }
+
+  TracingSessionID src_tsid = 0;
+  for (const auto& kv : tracing_sessions_) {
+    if (!unique_session_name.empty() &&
+        kv.second.config.unique_session_name() == unique_session_name) {
+      src_tsid = kv.first;
+      break;
+    }
+  }
+  if (!src_tsid) {
+    callback(false, "No tracing session with unique_session_name \"" +
+                        unique_session_name + "\"");
+    return;
+  }
+  const TracingSession& src = tracing_sessions_.find(src_tsid)->second;
+  if (consumer->uid_ != 0 && consumer->uid_ != src.consumer_uid) {
+    callback(false, "Not allowed to clone a session of another uid");
+    return;
+  }
+
+  // Flush first, so that the snapshot includes what the producers haven't
+  // committed yet. The snapshot is taken even if the flush times out.
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  auto weak_consumer = consumer->weak_ptr_factory_.GetWeakPtr();
+  Flush(src_tsid, 0, [weak_this, weak_consumer, src_tsid, callback](bool) {
+    if (!weak_this || !weak_consumer)
+      return;
+    base::Status status =
+        weak_this->DoCloneSession(weak_consumer.get(), src_tsid);
+    callback(status.ok(), status.message());
+  });
+}
+
+base::Status TracingServiceImpl::DoCloneSession(ConsumerEndpointImpl* consumer,
+                                                TracingSessionID src_tsid) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  TracingSession* src = GetTracingSession(src_tsid);
+  if (!src)
+    return PERFETTO_SVC_ERR("The session ended before it could be cloned");
+  if (consumer->tracing_session_id_)
+    return PERFETTO_SVC_ERR("The consumer already has a tracing session");
+  if (tracing_sessions_.size() >= kMaxConcurrentTracingSessions) {
+    return PERFETTO_SVC_ERR("Too many concurrent tracing sesions (%zu)",
+                            tracing_sessions_.size());
+  }
+
+  // Snapshot all the buffers before changing any state, as this can fail.
+  // The copy is taken synchronously: from here on the source session can keep
+  // writing into its buffers.
+  std::vector<std::unique_ptr<TraceBuffer>> snapshots;
+  for (BufferID src_buffer_id : src->buffers_index) {
+    TraceBuffer* src_buffer = GetBufferByID(src_buffer_id);
+    std::unique_ptr<TraceBuffer> snapshot =
+        src_buffer ? src_buffer->CloneReadOnly() : nullptr;
+    if (!snapshot)
+      return PERFETTO_SVC_ERR("Failed to snapshot the tracing buffers: OOM");
+    snapshots.emplace_back(std::move(snapshot));
+  }
+  std::vector<BufferID> buffer_ids;
+  for (size_t i = 0; i < snapshots.size(); i++) {
+    BufferID buffer_id = buffer_ids_.Allocate();
+    if (!buffer_id) {
+      for (BufferID allocated_id : buffer_ids)
+        buffer_ids_.Free(allocated_id);
+      return PERFETTO_SVC_ERR("Failed to snapshot the tracing buffers: too "
+                              "many buffers");
+    }
+    buffer_ids.push_back(buffer_id);
+  }
+
+  // The snapshot is a session which has already been stopped, owned by the
+  // cloning consumer, which reads it and frees it as any other session.
+  TraceConfig cfg = src->config;
+  cfg.set_write_into_file(false);
+  cfg.set_unique_session_name("");
+  const TracingSessionID tsid = ++last_tracing_session_id_;
+  TracingSession* session =
+      &tracing_sessions_
+           .emplace(std::piecewise_construct, std::forward_as_tuple(tsid),
+                    std::forward_as_tuple(tsid, consumer, cfg, task_runner_))
+           .first->second;
+  session->buffers_index = buffer_ids;
+  for (size_t i = 0; i < buffer_ids.size(); i++)
+    buffers_.emplace(buffer_ids[i], std::move(snapshots[i]));
+
+  // Keep the sequence IDs of the source, so that the packets read from the
+  // snapshot are consistent with the ones read from the source session.
+  session->packet_sequence_ids = src->packet_sequence_ids;
+  session->last_packet_sequence_id = src->last_packet_sequence_id;
+  session->received_triggers = src->received_triggers;
+  session->initial_clock_snapshot = src->initial_clock_snapshot;
+  TracingSession::ClockSnapshotData clock_snapshot;
+  SnapshotClocks(&clock_snapshot);
+  session->clock_snapshot_ring_buffer.emplace_back(std::move(clock_snapshot));
+
+  // The filter has been validated when the source session was enabled.
+  if (cfg.has_trace_filter()) {
+    const std::string& bytecode = cfg.trace_filter().bytecode();
+    uint32_t packet_field_id = TracePacket::kPacketFieldNumber;
+    auto create_filter = [&bytecode, &packet_field_id] {
+      std::unique_ptr<protozero::MessageFilter> filter(
+          new protozero::MessageFilter());
+      PERFETTO_CHECK(
+          filter->LoadFilterBytecode(bytecode.data(), bytecode.size()));
+      PERFETTO_CHECK(filter->SetFilterRoot(&packet_field_id, 1));
+      return filter;
+    };
+    session->trace_filter = create_filter();
+    for (size_t i = 0; i < read_workers_.size(); i++)
+      session->worker_trace_filters.emplace_back(create_filter());
+  }
+
+  consumer->tracing_session_id_ = tsid;
+  UpdateMemoryGuardrail();
+  PERFETTO_LOG("Cloned tracing session %" PRIu64 " into %" PRIu64, src_tsid,
+               tsid);
+  return base::OkStatus();
+}
+
 void TracingServiceImpl::MaybeLogUploadEvent(const TraceConfig& cfg,
                                              PerfettoStatsdAtom atom,
                                              const std::string& trigger_name) {
@@ -3388,6 +4190,26 @@ void TracingServiceImpl::ConsumerEndpointImpl::ReadBuffers() {
   }
 }
 
+void TracingServiceImpl::ConsumerEndpointImpl::ReadBuffersIntoFile(
+    base::ScopedFile fd) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (!tracing_session_id_) {
+    PERFETTO_LOG(
+        "Consumer called ReadBuffersIntoFile() but tracing was not active");
+    consumer_->OnTraceData({}, /* has_more = */ false);
+    return;
+  }
+  if (!fd) {
+    // Not much to write into, fall back on passing the packets.
+    ReadBuffers();
+    return;
+  }
+  // The buffers are read in one go, so |fd| can be closed afterwards.
+  if (!service_->ReadBuffers(tracing_session_id_, this, *fd)) {
+    consumer_->OnTraceData({}, /* has_more = */ false);
+  }
+}
+
 void TracingServiceImpl::ConsumerEndpointImpl::FreeBuffers() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   if (!tracing_session_id_) {
@@ -3549,6 +4371,10 @@ void TracingServiceImpl::ConsumerEndpointImpl::QueryServiceState(
     producer->set_name(kv.second->name_);
     producer->set_sdk_version(kv.second->sdk_version_);
     producer->set_uid(static_cast<int32_t>(kv.second->uid()));
+    kv.second->commit_data_latency_.Serialize(
+        producer->mutable_commit_data_latency());
+    kv.second->smb_scrape_latency_.Serialize(
+        producer->mutable_smb_scrape_latency());
   }
 
   for (const auto& kv : service_->data_sources_) {
@@ -3558,6 +4384,16 @@ void TracingServiceImpl::ConsumerEndpointImpl::QueryServiceState(
     data_source->set_producer_id(
         static_cast<int>(registered_data_source.producer_id));
   }
+
+  service_->commit_data_latency_.Serialize(
+      svc_state.mutable_commit_data_latency());
+  service_->chunk_copy_latency_.Serialize(
+      svc_state.mutable_chunk_copy_latency());
+  service_->smb_scrape_latency_.Serialize(
+      svc_state.mutable_smb_scrape_latency());
+  service_->flush_latency_.Serialize(svc_state.mutable_flush_latency());
+  service_->read_buffers_latency_.Serialize(
+      svc_state.mutable_read_buffers_latency());
   callback(/*success=*/true, svc_state);
 }
 
@@ -3567,6 +4403,7 @@ void TracingServiceImpl::ConsumerEndpointImpl::QueryCapabilities(
   TracingServiceCapabilities caps;
   caps.set_has_query_capabilities(true);
   caps.set_has_trace_config_output_path(true);
+  caps.set_has_clone_session(true);
   caps.add_observable_events(ObservableEvents::TYPE_DATA_SOURCES_INSTANCES);
   caps.add_observable_events(ObservableEvents::TYPE_ALL_DATA_SOURCES_STARTED);
   static_assert(ObservableEvents::Type_MAX ==
@@ -3594,6 +4431,13 @@ void TracingServiceImpl::ConsumerEndpointImpl::SaveTraceForBugreport(
   }
 }
 
+void TracingServiceImpl::ConsumerEndpointImpl::CloneSession(
+    const std::string& unique_session_name,
+    CloneSessionCallback callback) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  service_->CloneSession(this, unique_session_name, std::move(callback));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // TracingServiceImpl::ProducerEndpointImpl implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -3671,6 +4515,7 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     return;
   }
   PERFETTO_DCHECK(shmem_abi_.is_valid());
+  const base::TimeNanos commit_start = base::GetWallTimeNs();
   for (const auto& entry : req_untrusted.chunks_to_move()) {
     const uint32_t page_idx = entry.page();
     if (page_idx >= shmem_abi_.num_pages())
@@ -3684,29 +4529,22 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
       continue;
     }
 
-    // TryAcquireChunkForReading() has load-acquire semantics. Once acquired,
-    // the ABI contract expects the producer to not touch the chunk anymore
-    // (until the service marks that as free). This is why all the reads below
-    // are just memory_order_relaxed. Also, the code here assumes that all this
-    // data can be malicious and just gives up if anything is malformed.
-    BufferID buffer_id = static_cast<BufferID>(entry.target_buffer());
-    const SharedMemoryABI::ChunkHeader& chunk_header = *chunk.header();
-    WriterID writer_id = chunk_header.writer_id.load(std::memory_order_relaxed);
-    ChunkID chunk_id = chunk_header.chunk_id.load(std::memory_order_relaxed);
-    auto packets = chunk_header.packets.load(std::memory_order_relaxed);
-    uint16_t num_fragments = packets.count;
-    uint8_t chunk_flags = packets.flags;
-
-    service_->CopyProducerPageIntoLogBuffer(
-        id_, uid_, writer_id, chunk_id, buffer_id, num_fragments, chunk_flags,
-        /*chunk_complete=*/true, chunk.payload_begin(), chunk.payload_size());
-
-    // This one has release-store semantics.
-    shmem_abi_.ReleaseChunkAsFree(std::move(chunk));
+    MoveChunkToLogBuffer(std::move(chunk),
+                         static_cast<BufferID>(entry.target_buffer()));
   }  // for(chunks_to_move)
 
+  // With direct commits, the chunks which don't need patching aren't listed
+  // in |chunks_to_move| (see SharedMemoryArbiterImpl::EnableDirectCommits()).
+  if (direct_commits_enabled_)
+    MoveCompletedChunks();
+
   service_->ApplyChunkPatches(id_, req_untrusted.chunks_to_patch());
 
+  // The flush acks below are accounted separately, in the flush latencies.
+  const base::TimeNanos commit_time = base::GetWallTimeNs() - commit_start;
+  commit_data_latency_.Add(commit_time);
+  service_->commit_data_latency_.Add(commit_time);
+
   if (req_untrusted.flush_request_id()) {
     service_->NotifyFlushDoneForProducer(id_, req_untrusted.flush_request_id());
   }
@@ -3718,6 +4556,59 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     callback();
 }
 
+void TracingServiceImpl::ProducerEndpointImpl::MoveChunkToLogBuffer(
+    SharedMemoryABI::Chunk chunk,
+    BufferID buffer_id) {
+  // TryAcquireChunkForReading() has load-acquire semantics. Once acquired,
+  // the ABI contract expects the producer to not touch the chunk anymore
+  // (until the service marks that as free). This is why all the reads below
+  // are just memory_order_relaxed. Also, the code here assumes that all this
+  // data can be malicious and just gives up if anything is malformed.
+  const SharedMemoryABI::ChunkHeader& chunk_header = *chunk.header();
+  WriterID writer_id = chunk_header.writer_id.load(std::memory_order_relaxed);
+  ChunkID chunk_id = chunk_header.chunk_id.load(std::memory_order_relaxed);
+  auto packets = chunk_header.packets.load(std::memory_order_relaxed);
+  uint16_t num_fragments = packets.count;
+  uint8_t chunk_flags = packets.flags;
+
+  service_->CopyProducerPageIntoLogBuffer(
+      id_, uid_, writer_id, chunk_id, buffer_id, num_fragments, chunk_flags,
+      /*chunk_complete=*/true, /*scraped=*/false, chunk.payload_begin(),
+      chunk.payload_size());
+
+  // This one has release-store semantics.
+  shmem_abi_.ReleaseChunkAsFree(std::move(chunk));
+}
+
+void TracingServiceImpl::ProducerEndpointImpl::MoveCompletedChunks() {
+  for (size_t page_idx = 0; page_idx < shmem_abi_.num_pages(); page_idx++) {
+    uint32_t layout = shmem_abi_.GetPageLayout(page_idx);
+    uint32_t used_chunks = shmem_abi_.GetUsedChunks(layout);  // A bitmap.
+    for (uint32_t chunk_idx = 0; used_chunks; chunk_idx++, used_chunks >>= 1) {
+      if (!(used_chunks & 1) ||
+          SharedMemoryABI::GetChunkStateFromLayout(layout, chunk_idx) !=
+              SharedMemoryABI::kChunkComplete) {
+        continue;
+      }
+
+      // The writer is registered by a task posted when it's created, which
+      // may still be pending if a commit of another writer is running. Leave
+      // its chunks in the SMB until the next commit in that case.
+      WriterID writer_id =
+          shmem_abi_.GetChunkUnchecked(page_idx, layout, chunk_idx).writer_id();
+      base::Optional<BufferID> buffer_id = buffer_id_for_writer(writer_id);
+      if (!buffer_id)
+        continue;
+
+      SharedMemoryABI::Chunk chunk =
+          shmem_abi_.TryAcquireChunkForReading(page_idx, chunk_idx);
+      if (!chunk.is_valid())
+        continue;
+      MoveChunkToLogBuffer(std::move(chunk), *buffer_id);
+    }
+  }
+}
+
 void TracingServiceImpl::ProducerEndpointImpl::SetupSharedMemory(
     std::unique_ptr<SharedMemory> shared_memory,
     size_t page_size_bytes,
@@ -3737,6 +4628,10 @@ void TracingServiceImpl::ProducerEndpointImpl::SetupSharedMemory(
         shared_memory_->start(), shared_memory_->size(),
         shared_buffer_page_size_kb_ * 1024, this, task_runner_));
     inproc_shmem_arbiter_->SetDirectSMBPatchingSupportedByService();
+    inproc_shmem_arbiter_->SetMaxBatchCommitsDurationByService(
+        TracingService::kMaxBatchCommitsDurationMs);
+    if (direct_commits_enabled_)
+      inproc_shmem_arbiter_->EnableDirectCommits(kDirectCommitsMaxDelayMs);
   }
 
   OnTracingSetup();
@@ -3864,6 +4759,19 @@ void TracingServiceImpl::ProducerEndpointImpl::NotifyDataSourceStopped(
 
 void TracingServiceImpl::ProducerEndpointImpl::OnFreeBuffers(
     const std::vector<BufferID>& target_buffers) {
+  if (writer_stats_.size()) {
+    std::vector<uint32_t> keys_to_erase;
+    for (auto it = writer_stats_.GetIterator(); it; ++it) {
+      const auto buffer_id = static_cast<BufferID>(it.key() >> 16);
+      if (std::find(target_buffers.begin(), target_buffers.end(), buffer_id) !=
+          target_buffers.end()) {
+        keys_to_erase.push_back(it.key());
+      }
+    }
+    for (uint32_t key : keys_to_erase)
+      writer_stats_.Erase(key);
+  }
+
   if (allowed_target_buffers_.empty())
     return;
   for (BufferID buffer : target_buffers)
@@ -31,6 +31,7 @@
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/circular_queue.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/optional.h"
 #include "perfetto/ext/base/periodic_task.h"
 #include "perfetto/ext/base/weak_ptr.h"
@@ -46,6 +47,8 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "src/android_stats/perfetto_atoms.h"
 #include "src/tracing/core/id_allocator.h"
+#include "src/tracing/core/latency_histogram.h"
+#include "src/tracing/core/trace_index_builder.h"
 
 namespace protozero {
 class MessageFilter;
@@ -58,6 +61,7 @@ class TaskRunner;
 }  // namespace base
 
 class Consumer;
+class PacketDownsampler;
 class Producer;
 class SharedMemory;
 class SharedMemoryArbiterImpl;
@@ -74,6 +78,17 @@ class TracingServiceImpl : public TracingService {
   static constexpr size_t kDefaultShmSize = 256 * 1024ul;
   static constexpr size_t kMaxShmSize = 32 * 1024 * 1024ul;
   static constexpr uint32_t kDataSourceStopTimeoutMs = 5000;
+
+  // A producer which misses the deadline of this many flushes in a row is
+  // deprioritized: the following flushes wait for it at most
+  // kDeprioritizedFlushDeadlineMs, after which its SMB is scraped and the
+  // flush completes without it. An ack within the deadline restores it.
+  static constexpr uint32_t kFlushDeadlineMissesToDeprioritize = 3;
+  static constexpr uint32_t kDeprioritizedFlushDeadlineMs = 500;
+
+  // With SetInProcessDirectCommitsEnabled(), the max time between the
+  // completion of a chunk by an in-process producer and its commit.
+  static constexpr uint32_t kDirectCommitsMaxDelayMs = 10;
   static constexpr uint8_t kSyncMarker[] = {0x82, 0x47, 0x7a, 0x76, 0xb2, 0x8d,
                                             0x42, 0xba, 0x81, 0xdc, 0x33, 0x32,
                                             0x6d, 0x57, 0xa0, 0x79};
@@ -139,6 +154,26 @@ class TracingServiceImpl : public TracingService {
 
     uid_t uid() const { return uid_; }
 
+    // Counters of the chunks and patches of one writer of this producer into
+    // one target buffer, see TraceStats.WriterStats.
+    struct WriterStats {
+      uint64_t chunks_committed = 0;
+      uint64_t bytes_committed = 0;
+      uint64_t chunks_scraped = 0;
+      uint64_t bytes_scraped = 0;
+      uint64_t patches_applied = 0;
+      uint64_t patches_failed = 0;
+      uint64_t chunks_discarded = 0;
+    };
+
+    WriterStats* GetWriterStats(BufferID buffer_id, WriterID writer_id) {
+      return &writer_stats_[WriterStatsKey(buffer_id, writer_id)];
+    }
+
+    static uint32_t WriterStatsKey(BufferID buffer_id, WriterID writer_id) {
+      return static_cast<uint32_t>(buffer_id) << 16 | writer_id;
+    }
+
    private:
     friend class TracingServiceImpl;
     friend class TracingServiceImplTest;
@@ -146,6 +181,13 @@ class TracingServiceImpl : public TracingService {
     ProducerEndpointImpl(const ProducerEndpointImpl&) = delete;
     ProducerEndpointImpl& operator=(const ProducerEndpointImpl&) = delete;
 
+    // Copies |chunk|, acquired for reading, into |buffer_id| and frees it.
+    void MoveChunkToLogBuffer(SharedMemoryABI::Chunk chunk, BufferID buffer_id);
+
+    // Moves all the completed chunks of the SMB of writers registered with
+    // the service into their target buffer. Used with direct commits.
+    void MoveCompletedChunks();
+
     ProducerID const id_;
     const uid_t uid_;
     TracingServiceImpl* const service_;
@@ -162,6 +204,10 @@ class TracingServiceImpl : public TracingService {
     bool in_process_;
     bool smb_scraping_enabled_;
 
+    // See TracingService::SetInProcessDirectCommitsEnabled(). Only for
+    // |in_process_| producers.
+    bool direct_commits_enabled_ = false;
+
     // Set of the global target_buffer IDs that the producer is configured to
     // write into in any active tracing session.
     std::set<BufferID> allowed_target_buffers_;
@@ -176,10 +222,25 @@ class TracingServiceImpl : public TracingService {
     // before use.
     std::map<WriterID, BufferID> writers_;
 
+    // Keyed by WriterStatsKey(). Only has entries for buffers in
+    // |allowed_target_buffers_|. Unlike |writers_|, entries are kept after
+    // the writer is unregistered, until the buffer is freed, so that the stats
+    // of the writers of data sources already stopped are still reported.
+    base::FlatHashMap<uint32_t, WriterStats> writer_stats_;
+
     // This is used only in in-process configurations.
     // SharedMemoryArbiterImpl methods themselves are thread-safe.
     std::unique_ptr<SharedMemoryArbiterImpl> inproc_shmem_arbiter_;
 
+    // Number of consecutive flushes that this producer didn't ack before its
+    // deadline, see kFlushDeadlineMissesToDeprioritize.
+    uint32_t flush_deadlines_missed_in_a_row_ = 0;
+
+    // Latencies of the CommitData() IPCs and of the scrapes of the SMB of
+    // this producer, over its lifetime. See TracingServiceState.Producer.
+    LatencyHistogram commit_data_latency_;
+    LatencyHistogram smb_scrape_latency_;
+
     PERFETTO_THREAD_CHECKER(thread_checker_)
     base::WeakPtrFactory<ProducerEndpointImpl> weak_ptr_factory_;  // Keep last.
   };
@@ -201,6 +262,7 @@ class TracingServiceImpl : public TracingService {
     void StartTracing() override;
     void DisableTracing() override;
     void ReadBuffers() override;
+    void ReadBuffersIntoFile(base::ScopedFile) override;
     void FreeBuffers() override;
     void Flush(uint32_t timeout_ms, FlushCallback) override;
     void Detach(const std::string& key) override;
@@ -210,6 +272,8 @@ class TracingServiceImpl : public TracingService {
     void QueryServiceState(QueryServiceStateCallback) override;
     void QueryCapabilities(QueryCapabilitiesCallback) override;
     void SaveTraceForBugreport(SaveTraceForBugreportCallback) override;
+    void CloneSession(const std::string& unique_session_name,
+                      CloneSessionCallback) override;
 
     // Will queue a task to notify the consumer about the state change.
     void OnDataSourceInstanceStateChange(const ProducerEndpointImpl&,
@@ -259,6 +323,7 @@ class TracingServiceImpl : public TracingService {
                                      uint16_t num_fragments,
                                      uint8_t chunk_flags,
                                      bool chunk_complete,
+                                     bool scraped,
                                      const uint8_t* src,
                                      size_t size);
   void ApplyChunkPatches(ProducerID,
@@ -283,7 +348,11 @@ class TracingServiceImpl : public TracingService {
              uint32_t timeout_ms,
              ConsumerEndpoint::FlushCallback);
   void FlushAndDisableTracing(TracingSessionID);
-  bool ReadBuffers(TracingSessionID, ConsumerEndpointImpl*);
+  // If |readback_fd| is valid, the packets are written into it rather than
+  // passed to |consumer|, see ConsumerEndpoint::ReadBuffersIntoFile().
+  bool ReadBuffers(TracingSessionID,
+                   ConsumerEndpointImpl*,
+                   int readback_fd = -1);
   void FreeBuffers(TracingSessionID);
 
   // Service implementation.
@@ -309,6 +378,16 @@ class TracingServiceImpl : public TracingService {
     smb_scraping_enabled_ = enabled;
   }
 
+  void SetInProcessDirectCommitsEnabled(bool enabled) override {
+    inprocess_direct_commits_enabled_ = enabled;
+  }
+
+  void SetCompressorFn(CompressorFn compressor_fn) override {
+    compressor_fn_ = compressor_fn;
+  }
+
+  void SetBufferReadWorkers(size_t num_workers) override;
+
   // Exposed mainly for testing.
   size_t num_producers() const { return producers_.size(); }
   ProducerEndpointImpl* GetProducer(ProducerID) const;
@@ -369,9 +448,18 @@ class TracingServiceImpl : public TracingService {
   };
 
   struct PendingFlush {
+    // The producers which have neither acked the flush nor missed their
+    // deadline yet.
     std::set<ProducerID> producers;
     ConsumerEndpoint::FlushCallback callback;
-    explicit PendingFlush(decltype(callback) cb) : callback(std::move(cb)) {}
+    base::TimeNanos start_time;
+
+    // Set when at least one producer missed its deadline, in which case the
+    // flush completes without waiting for it and is reported as failed.
+    bool deadline_missed = false;
+
+    PendingFlush(decltype(callback) cb, base::TimeNanos start)
+        : callback(std::move(cb)), start_time(start) {}
   };
 
   // Holds the state of a tracing session. A tracing session is uniquely bound
@@ -394,10 +482,10 @@ class TracingServiceImpl : public TracingService {
     size_t num_buffers() const { return buffers_index.size(); }
 
     uint32_t delay_to_next_write_period_ms() const {
-      PERFETTO_DCHECK(write_period_ms > 0);
-      return write_period_ms -
+      PERFETTO_DCHECK(drain_period_ms > 0);
+      return drain_period_ms -
              static_cast<uint32_t>(base::GetWallTimeMs().count() %
-                                   write_period_ms);
+                                   drain_period_ms);
     }
 
     uint32_t flush_timeout_ms() {
@@ -576,6 +664,30 @@ class TracingServiceImpl : public TracingService {
     uint64_t max_file_size_bytes = 0;
     uint64_t bytes_written_into_file = 0;
 
+    // Set for the sessions with TraceConfig.write_trace_index. Indexes the
+    // packets written into |write_into_file|, appended to it when the service
+    // stops writing into it.
+    std::unique_ptr<TraceIndexBuilder> trace_index;
+
+    // The actual period of the drain into |write_into_file|, between
+    // |write_period_ms| and min_write_period_ms_, see AdaptDrainPeriod().
+    uint32_t drain_period_ms = 0;
+
+    // See TraceStats.WriteIntoFileStats.
+    struct DrainStats {
+      uint64_t drains = 0;
+      uint32_t last_fill_percent = 0;
+      uint32_t max_fill_percent = 0;
+      uint64_t drains_with_overwrites = 0;
+      uint64_t chunks_overwritten = 0;
+      uint32_t min_period_ms = 0;
+    };
+    DrainStats drain_stats;
+
+    // Sum of BufferStats.chunks_overwritten of the buffers of the session at
+    // the last drain.
+    uint64_t chunks_overwritten_at_last_drain = 0;
+
     // Set when using SaveTraceForBugreport(). This callback will be called
     // when the tracing session ends and the data has been saved into the file.
     std::function<void()> on_disable_callback_for_bugreport;
@@ -587,10 +699,44 @@ class TracingServiceImpl : public TracingService {
 
     // When non-NULL the packets should be post-processed using the filter.
     std::unique_ptr<protozero::MessageFilter> trace_filter;
+
+    // One for each buffer with BufferConfig.downsample_on_overwrite. They are
+    // invoked by the buffers of this session, which are destroyed before the
+    // session itself in FreeBuffers().
+    std::vector<std::unique_ptr<PacketDownsampler>> downsamplers;
+
+    // One more instance of |trace_filter| for each read worker, used to
+    // filter the packets in parallel.
+    std::vector<std::unique_ptr<protozero::MessageFilter>> worker_trace_filters;
+
     uint64_t filter_input_packets = 0;
     uint64_t filter_input_bytes = 0;
     uint64_t filter_output_bytes = 0;
     uint64_t filter_errors = 0;
+
+    // Scraping of the SMB of each producer for this session, see
+    // TraceStats.ProducerStats.
+    struct ScrapeStats {
+      uint64_t scrapes = 0;
+      uint64_t scrape_time_ns = 0;
+      LatencyHistogram scrape_latency;
+    };
+    std::map<ProducerID, ScrapeStats> scrape_stats;
+
+    // Flushes of each producer for this session, see TraceStats.ProducerStats.
+    struct FlushStats {
+      uint64_t flushes_acked = 0;
+      uint64_t flush_deadlines_missed = 0;
+      uint64_t flush_ack_time_ns = 0;
+      uint64_t flush_ack_max_time_ns = 0;
+      LatencyHistogram ack_latency;
+    };
+    std::map<ProducerID, FlushStats> flush_stats;
+
+    // Latencies of the Flush() requests (from the request to the callback)
+    // and of the ReadBuffers() passes of this session, see TraceStats.
+    LatencyHistogram flush_latency;
+    LatencyHistogram read_buffers_latency;
   };
 
   TracingServiceImpl(const TracingServiceImpl&) = delete;
@@ -640,16 +786,29 @@ class TracingServiceImpl : public TracingService {
   void MaybeEmitTraceConfig(TracingSession*, std::vector<TracePacket>*);
   void MaybeEmitSystemInfo(TracingSession*, std::vector<TracePacket>*);
   void MaybeEmitReceivedTriggers(TracingSession*, std::vector<TracePacket>*);
+  bool MaybeCompressPackets(TracingSession*, std::vector<TracePacket>*);
   void MaybeNotifyAllDataSourcesStarted(TracingSession*);
   bool MaybeSaveTraceForBugreport(std::function<void()> callback);
+  void CloneSession(ConsumerEndpointImpl*,
+                    const std::string& unique_session_name,
+                    ConsumerEndpoint::CloneSessionCallback);
+  base::Status DoCloneSession(ConsumerEndpointImpl*, TracingSessionID src_tsid);
   void OnFlushTimeout(TracingSessionID, FlushRequestID);
+  void OnProducerFlushDeadline(TracingSessionID, FlushRequestID, ProducerID);
+  void OnFlushDeadlineMissed(TracingSession*, ProducerID);
   void OnDisableTracingTimeout(TracingSessionID);
   void DisableTracingNotifyConsumerAndFlushFile(TracingSession*);
   void PeriodicFlushTask(TracingSessionID, bool post_next_only);
   void CompleteFlush(TracingSessionID tsid,
                      ConsumerEndpoint::FlushCallback callback,
-                     bool success);
+                     bool success,
+                     base::TimeNanos start_time);
   void ScrapeSharedMemoryBuffers(TracingSession*, ProducerEndpointImpl*);
+  void RecordReadBuffersLatency(TracingSession*, base::TimeNanos start_time);
+  void AdaptDrainPeriod(TracingSession*,
+                        uint32_t fill_percent,
+                        uint64_t chunks_overwritten);
+  void FreezeBuffers(TracingSession*);
   void PeriodicClearIncrementalStateTask(TracingSessionID, bool post_next_only);
   TraceBuffer* GetBufferByID(BufferID);
   void OnStartTriggersTimeout(TracingSessionID tsid);
@@ -687,6 +846,11 @@ class TracingServiceImpl : public TracingService {
   base::CircularQueue<TriggerHistory> trigger_history_;
 
   bool smb_scraping_enabled_ = false;
+  bool inprocess_direct_commits_enabled_ = false;
+  CompressorFn compressor_fn_ = nullptr;
+
+  // See SetBufferReadWorkers(). These are base::ThreadTaskRunner(s).
+  std::vector<std::unique_ptr<base::TaskRunner>> read_workers_;
   bool lockdown_mode_ = false;
   uint32_t min_write_period_ms_ = 100;       // Overridable for testing.
   int64_t trigger_window_ns_ = kOneDayInNs;  // Overridable for testing.
@@ -702,6 +866,14 @@ class TracingServiceImpl : public TracingService {
   uint64_t chunks_discarded_ = 0;
   uint64_t patches_discarded_ = 0;
 
+  // Latencies of the internal operations of the service across all producers
+  // and sessions, reported by QueryServiceState(). See TracingServiceState.
+  LatencyHistogram commit_data_latency_;
+  LatencyHistogram chunk_copy_latency_;
+  LatencyHistogram smb_scrape_latency_;
+  LatencyHistogram flush_latency_;
+  LatencyHistogram read_buffers_latency_;
+
   PERFETTO_THREAD_CHECKER(thread_checker_)
 
   base::WeakPtrFactory<TracingServiceImpl>
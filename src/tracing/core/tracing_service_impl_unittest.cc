@@ -30,6 +30,7 @@
 #include "perfetto/tracing/core/data_source_config.h"
 #include "perfetto/tracing/core/data_source_descriptor.h"
 #include "src/base/test/test_task_runner.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 #include "src/tracing/core/trace_writer_impl.h"
 #include "src/tracing/test/mock_consumer.h"
@@ -41,6 +42,7 @@
 #include "protos/perfetto/trace/test_event.gen.h"
 #include "protos/perfetto/trace/test_event.pbzero.h"
 #include "protos/perfetto/trace/trace.gen.h"
+#include "protos/perfetto/trace/trace_index.gen.h"
 #include "protos/perfetto/trace/trace_packet.gen.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 #include "protos/perfetto/trace/trigger.gen.h"
@@ -50,15 +52,18 @@ using ::testing::AssertionFailure;
 using ::testing::AssertionResult;
 using ::testing::AssertionSuccess;
 using ::testing::Contains;
+using ::testing::ElementsAre;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
 using ::testing::ExplainMatchResult;
+using ::testing::HasSubstr;
 using ::testing::InSequence;
 using ::testing::Invoke;
 using ::testing::InvokeWithoutArgs;
 using ::testing::IsEmpty;
 using ::testing::Mock;
 using ::testing::Not;
+using ::testing::Pointee;
 using ::testing::Property;
 using ::testing::StrictMock;
 using ::testing::StringMatchResultListener;
@@ -94,6 +99,40 @@ MATCHER_P(HasTriggerMode, mode, "") {
   return HasTriggerModeInternal(arg, mode);
 }
 
+// A TracingService::CompressorFn which wraps all the packets in a single
+// |compressed_packets| packet without actually compressing them.
+void WrapPacketsCompressFn(std::vector<TracePacket>* packets) {
+  std::string wrapped;
+  for (TracePacket& packet : *packets) {
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    wrapped.append(preamble, preamble_size);
+    wrapped.append(packet.GetRawBytesForTesting());
+  }
+  protos::gen::TracePacket wrapper;
+  wrapper.set_compressed_packets(wrapped);
+  std::string serialized = wrapper.SerializeAsString();
+  Slice slice = Slice::Allocate(serialized.size());
+  memcpy(slice.own_data(), serialized.data(), serialized.size());
+  packets->clear();
+  packets->emplace_back();
+  packets->back().AddSlice(std::move(slice));
+}
+
+// Returns the packets wrapped by WrapPacketsCompressFn.
+std::vector<protos::gen::TracePacket> UnwrapPackets(
+    const std::vector<protos::gen::TracePacket>& packets) {
+  std::vector<protos::gen::TracePacket> res;
+  for (const auto& packet : packets) {
+    protos::gen::Trace trace;
+    EXPECT_TRUE(packet.has_compressed_packets());
+    EXPECT_TRUE(trace.ParseFromString(packet.compressed_packets()));
+    res.insert(res.end(), trace.packet().begin(), trace.packet().end());
+  }
+  return res;
+}
+
 }  // namespace
 
 class TracingServiceImplTest : public testing::Test {
@@ -1112,6 +1151,61 @@ TEST_F(TracingServiceImplTest, StopTracingTriggerRingBuffer) {
                   Property(&protos::gen::TestEvent::str, Eq(large_payload))))));
 }
 
+// Creates a tracing session with a STOP_TRACING trigger which freezes the
+// buffers and checks that the data committed after the trigger is discarded.
+TEST_F(TracingServiceImplTest, StopTracingTriggerFreezeBuffers) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("ds_1");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_data_sources()->mutable_config()->set_name("ds_1");
+  auto* trigger_config = trace_config.mutable_trigger_config();
+  trigger_config->set_trigger_mode(TraceConfig::TriggerConfig::STOP_TRACING);
+  trigger_config->set_freeze_buffers_on_stop(true);
+  auto* trigger = trigger_config->add_triggers();
+  trigger->set_name("trigger_name");
+  // Ignored when freezing the buffers.
+  trigger->set_stop_delay_ms(8.64e+7);
+  trigger_config->set_trigger_timeout_ms(8.64e+7);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("ds_1");
+  producer->WaitForDataSourceStart("ds_1");
+
+  auto writer = producer->CreateTraceWriter("ds_1");
+  writer->NewTracePacket()->set_for_testing()->set_str("before_trigger");
+  writer->Flush();
+  task_runner.RunUntilIdle();
+
+  producer->endpoint()->ActivateTriggers({"trigger_name"});
+  writer->NewTracePacket()->set_for_testing()->set_str("after_trigger");
+
+  producer->WaitForFlush(writer.get());
+  producer->WaitForDataSourceStop("ds_1");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  EXPECT_THAT(packets, Contains(Property(
+                           &protos::gen::TracePacket::for_testing,
+                           Property(&protos::gen::TestEvent::str,
+                                    Eq("before_trigger")))));
+  EXPECT_THAT(packets, Not(Contains(Property(
+                           &protos::gen::TracePacket::for_testing,
+                           Property(&protos::gen::TestEvent::str,
+                                    Eq("after_trigger"))))));
+  EXPECT_THAT(packets,
+              Contains(Property(
+                  &protos::gen::TracePacket::service_event,
+                  Property(&protos::gen::TracingServiceEvent::buffers_frozen,
+                           Eq(true)))));
+}
+
 // Creates a tracing session with a STOP_TRACING trigger and checks that the
 // session only cleans up once even with multiple triggers.
 TEST_F(TracingServiceImplTest, StopTracingTriggerMultipleTriggers) {
@@ -1678,6 +1772,69 @@ TEST_F(TracingServiceImplTest, WriteIntoFileAndStopOnMaxSize) {
   }
 }
 
+// The consumer can ask the service to write the trace into a file rather than
+// receiving the packets over IPC.
+TEST_F(TracingServiceImplTest, ReadBuffersIntoFile) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  static const int kNumTestPackets = 10;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < kNumTestPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload" + std::to_string(i));
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  // All the packets go into the file, the consumer is only told that the
+  // trace is over.
+  base::TempFile tmp_file = base::TempFile::Create();
+  EXPECT_CALL(*consumer, OnTraceData(Pointee(IsEmpty()), false));
+  consumer->endpoint()->ReadBuffersIntoFile(
+      base::ScopedFile(dup(tmp_file.fd())));
+  Mock::VerifyAndClearExpectations(consumer.get());
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  std::vector<std::string> payloads;
+  for (const auto& packet : trace.packet()) {
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+  ASSERT_EQ(payloads.size(), static_cast<size_t>(kNumTestPackets));
+  for (int i = 0; i < kNumTestPackets; i++)
+    ASSERT_EQ(payloads[static_cast<size_t>(i)], "payload" + std::to_string(i));
+
+  // The buffers have been drained.
+  EXPECT_THAT(consumer->ReadBuffers(),
+              Not(Contains(Property(&protos::gen::TracePacket::for_testing,
+                                    Property(&protos::gen::TestEvent::str,
+                                             Eq("payload0"))))));
+}
+
 TEST_F(TracingServiceImplTest, WriteIntoFileWithPath) {
   auto tmp_file = base::TempFile::Create();
   // Deletes the file (the service would refuse to overwrite an existing file)
@@ -1730,103 +1887,179 @@ TEST_F(TracingServiceImplTest, WriteIntoFileWithPath) {
                   Property(&protos::gen::TestEvent::str, Eq("payload")))));
 }
 
-// Test the logic that allows the trace config to set the shm total size and
-// page size from the trace config. Also check that, if the config doesn't
-// specify a value we fall back on the hint provided by the producer.
-TEST_F(TracingServiceImplTest, ProducerShmAndPageSizeOverriddenByTraceConfig) {
+TEST_F(TracingServiceImplTest, WriteIntoFileWithBufferReadWorkers) {
+  svc->SetBufferReadWorkers(2);
+
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
-  const size_t kMaxPageSizeKb = 32;
 
-  struct ConfiguredAndExpectedSizes {
-    size_t config_page_size_kb;
-    size_t hint_page_size_kb;
-    size_t expected_page_size_kb;
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("ds_1");
+  producer->RegisterDataSource("ds_2");
 
-    size_t config_size_kb;
-    size_t hint_size_kb;
-    size_t expected_size_kb;
-  };
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config_1 = trace_config.add_data_sources()->mutable_config();
+  ds_config_1->set_name("ds_1");
+  ds_config_1->set_target_buffer(0);
+  auto* ds_config_2 = trace_config.add_data_sources()->mutable_config();
+  ds_config_2->set_name("ds_2");
+  ds_config_2->set_target_buffer(1);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
 
-  ConfiguredAndExpectedSizes kSizes[] = {
-      // Config and hint are 0, fallback to default values.
-      {0, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
-      // Use configured sizes.
-      {16, 0, 16, 16, 0, 16},
-      // Config is 0, use hint.
-      {0, 4, 4, 0, 16, 16},
-      // Config takes precendence over hint.
-      {4, 8, 4, 16, 32, 16},
-      // Config takes precendence over hint, even if it's larger.
-      {8, 4, 8, 32, 16, 32},
-      // Config page size % 4 != 0, fallback to defaults.
-      {3, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
-      // Config page size less than system page size, fallback to defaults.
-      {2, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
-      // Config sizes too large, use max.
-      {4096, 0, kMaxPageSizeKb, 4096000, 0, kMaxShmSizeKb},
-      // Hint sizes too large, use max.
-      {0, 4096, kMaxPageSizeKb, 0, 4096000, kMaxShmSizeKb},
-      // Config buffer size isn't a multiple of 4KB, fallback to defaults.
-      {0, 0, kDefaultShmPageSizeKb, 18, 0, kDefaultShmSizeKb},
-      // Invalid page size -> also ignore buffer size config.
-      {2, 0, kDefaultShmPageSizeKb, 32, 0, kDefaultShmSizeKb},
-      // Invalid buffer size -> also ignore page size config.
-      {16, 0, kDefaultShmPageSizeKb, 18, 0, kDefaultShmSizeKb},
-      // Config page size % buffer size != 0, fallback to defaults.
-      {8, 0, kDefaultShmPageSizeKb, 20, 0, kDefaultShmSizeKb},
-      // Config page size % default buffer size != 0, fallback to defaults.
-      {28, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
-  };
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("ds_1");
+  producer->WaitForDataSourceSetup("ds_2");
+  producer->WaitForDataSourceStart("ds_1");
+  producer->WaitForDataSourceStart("ds_2");
 
-  const size_t kNumProducers = base::ArraySize(kSizes);
-  std::unique_ptr<MockProducer> producer[kNumProducers];
-  for (size_t i = 0; i < kNumProducers; i++) {
-    auto name = "mock_producer_" + std::to_string(i);
-    producer[i] = CreateMockProducer();
-    producer[i]->Connect(svc.get(), name, base::GetCurrentUserId(),
-                         kSizes[i].hint_size_kb * 1024,
-                         kSizes[i].hint_page_size_kb * 1024);
-    producer[i]->RegisterDataSource("data_source");
+  static const int kNumTestPackets = 10;
+  std::unique_ptr<TraceWriter> writer1 = producer->CreateTraceWriter("ds_1");
+  std::unique_ptr<TraceWriter> writer2 = producer->CreateTraceWriter("ds_2");
+  for (int i = 0; i < kNumTestPackets; i++) {
+    writer1->NewTracePacket()->set_for_testing()->set_str(
+        "buf0_" + std::to_string(i));
+    writer2->NewTracePacket()->set_for_testing()->set_str(
+        "buf1_" + std::to_string(i));
+  }
+  writer1->Flush();
+  writer2->Flush();
+  writer1.reset();
+  writer2.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("ds_1");
+  producer->WaitForDataSourceStop("ds_2");
+  consumer->WaitForTracingDisabled();
+
+  // The packets of each buffer are written in order, the ones of the first
+  // buffer before the ones of the second buffer.
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  std::vector<std::string> payloads;
+  for (const auto& packet : trace.packet()) {
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
   }
+  std::vector<std::string> expected;
+  for (int buf = 0; buf < 2; buf++) {
+    for (int i = 0; i < kNumTestPackets; i++)
+      expected.push_back("buf" + std::to_string(buf) + "_" + std::to_string(i));
+  }
+  EXPECT_EQ(payloads, expected);
+}
+
+TEST_F(TracingServiceImplTest, WriteIntoFileWithTraceIndex) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("ds_1");
+  producer->RegisterDataSource("ds_2");
 
   TraceConfig trace_config;
-  trace_config.add_buffers()->set_size_kb(128);
-  auto* ds_config = trace_config.add_data_sources()->mutable_config();
-  ds_config->set_name("data_source");
-  for (size_t i = 0; i < kNumProducers; i++) {
-    auto* producer_config = trace_config.add_producers();
-    producer_config->set_producer_name("mock_producer_" + std::to_string(i));
-    producer_config->set_shm_size_kb(
-        static_cast<uint32_t>(kSizes[i].config_size_kb));
-    producer_config->set_page_size_kb(
-        static_cast<uint32_t>(kSizes[i].config_page_size_kb));
+  trace_config.add_buffers()->set_size_kb(4096);
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config_1 = trace_config.add_data_sources()->mutable_config();
+  ds_config_1->set_name("ds_1");
+  ds_config_1->set_target_buffer(0);
+  auto* ds_config_2 = trace_config.add_data_sources()->mutable_config();
+  ds_config_2->set_name("ds_2");
+  ds_config_2->set_target_buffer(1);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  trace_config.set_write_trace_index(true);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("ds_1");
+  producer->WaitForDataSourceSetup("ds_2");
+  producer->WaitForDataSourceStart("ds_1");
+  producer->WaitForDataSourceStart("ds_2");
+
+  static const int kNumTestPackets = 10;
+  std::unique_ptr<TraceWriter> writer1 = producer->CreateTraceWriter("ds_1");
+  std::unique_ptr<TraceWriter> writer2 = producer->CreateTraceWriter("ds_2");
+  for (int i = 0; i < kNumTestPackets; i++) {
+    auto tp1 = writer1->NewTracePacket();
+    tp1->set_timestamp(static_cast<uint64_t>(1000 + i));
+    tp1->set_for_testing()->set_str("buf0");
+    auto tp2 = writer2->NewTracePacket();
+    tp2->set_timestamp(static_cast<uint64_t>(2000 + i));
+    tp2->set_for_testing()->set_str("buf1");
   }
+  writer1->Flush();
+  writer2->Flush();
+  writer1.reset();
+  writer2.reset();
 
-  consumer->EnableTracing(trace_config);
-  size_t expected_shm_sizes_kb[kNumProducers]{};
-  size_t expected_page_sizes_kb[kNumProducers]{};
-  size_t actual_shm_sizes_kb[kNumProducers]{};
-  size_t actual_page_sizes_kb[kNumProducers]{};
-  for (size_t i = 0; i < kNumProducers; i++) {
-    expected_shm_sizes_kb[i] = kSizes[i].expected_size_kb;
-    expected_page_sizes_kb[i] = kSizes[i].expected_page_size_kb;
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("ds_1");
+  producer->WaitForDataSourceStop("ds_2");
+  consumer->WaitForTracingDisabled();
 
-    producer[i]->WaitForTracingSetup();
-    producer[i]->WaitForDataSourceSetup("data_source");
-    actual_shm_sizes_kb[i] =
-        producer[i]->endpoint()->shared_memory()->size() / 1024;
-    actual_page_sizes_kb[i] =
-        producer[i]->endpoint()->shared_buffer_page_size_kb();
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  ASSERT_TRUE(trace.packet().back().has_trace_index());
+  const protos::gen::TraceIndex& index = trace.packet().back().trace_index();
+  EXPECT_EQ(index.magic(),
+            static_cast<uint32_t>(protos::gen::TraceIndex::MAGIC_TRACE_INDEX));
+  ASSERT_LT(index.packet_size(), trace_raw.size());
+  EXPECT_EQ(index.data_size(), trace_raw.size() - index.packet_size());
+
+  // The index can be found from the last bytes of the file.
+  uint32_t magic = 0;
+  uint64_t packet_size = 0;
+  ASSERT_EQ(trace_raw[trace_raw.size() - 14], '\x15');
+  memcpy(&magic, &trace_raw[trace_raw.size() - 13], sizeof(magic));
+  ASSERT_EQ(trace_raw[trace_raw.size() - 9], '\x19');
+  memcpy(&packet_size, &trace_raw[trace_raw.size() - 8], sizeof(packet_size));
+  EXPECT_EQ(magic, index.magic());
+  EXPECT_EQ(packet_size, index.packet_size());
+
+  // The sections cover all the packets before the index, one section for the
+  // packets of each buffer.
+  uint64_t offset = 0;
+  uint32_t packet_count = 0;
+  std::map<uint32_t, protos::gen::TraceIndex::Section> buffer_sections;
+  for (const auto& section : index.sections()) {
+    EXPECT_EQ(section.offset(), offset);
+    offset += section.size();
+    packet_count += section.packet_count();
+    if (section.has_buffer()) {
+      EXPECT_EQ(buffer_sections.count(section.buffer()), 0u);
+      buffer_sections[section.buffer()] = section;
+    }
   }
-  for (size_t i = 0; i < kNumProducers; i++) {
-    producer[i]->WaitForDataSourceStart("data_source");
+  EXPECT_EQ(offset, index.data_size());
+  EXPECT_EQ(packet_count, static_cast<uint32_t>(trace.packet().size() - 1));
+
+  ASSERT_EQ(buffer_sections.size(), 2u);
+  for (uint32_t buf = 0; buf < 2; buf++) {
+    const auto& section = buffer_sections[buf];
+    EXPECT_EQ(section.packet_count(), static_cast<uint32_t>(kNumTestPackets));
+    EXPECT_EQ(section.min_timestamp(), 1000u * (buf + 1));
+    EXPECT_EQ(section.max_timestamp(), 1000u * (buf + 1) + kNumTestPackets - 1);
+    EXPECT_FALSE(section.has_untimed_packets());
+    EXPECT_EQ(section.sequence_ids().size(), 1u);
+    EXPECT_THAT(section.packet_types(),
+                ElementsAre(static_cast<uint32_t>(
+                    protos::pbzero::TracePacket::kForTestingFieldNumber)));
   }
-  ASSERT_THAT(actual_page_sizes_kb, ElementsAreArray(expected_page_sizes_kb));
-  ASSERT_THAT(actual_shm_sizes_kb, ElementsAreArray(expected_shm_sizes_kb));
 }
 
-TEST_F(TracingServiceImplTest, ExplicitFlush) {
+TEST_F(TracingServiceImplTest, WriteIntoFileAdaptsDrainPeriod) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
 
@@ -1835,36 +2068,52 @@ TEST_F(TracingServiceImplTest, ExplicitFlush) {
   producer->RegisterDataSource("data_source");
 
   TraceConfig trace_config;
-  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_buffers()->set_size_kb(4096);
   auto* ds_config = trace_config.add_data_sources()->mutable_config();
   ds_config->set_name("data_source");
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
 
-  consumer->EnableTracing(trace_config);
   producer->WaitForTracingSetup();
   producer->WaitForDataSourceSetup("data_source");
   producer->WaitForDataSourceStart("data_source");
 
-  std::unique_ptr<TraceWriter> writer =
-      producer->CreateTraceWriter("data_source");
-  {
-    auto tp = writer->NewTracePacket();
-    tp->set_for_testing()->set_str("payload");
-  }
-
-  auto flush_request = consumer->Flush();
-  producer->WaitForFlush(writer.get());
-  ASSERT_TRUE(flush_request.WaitForReply());
+  // Simulates the drains rather than waiting for them.
+  auto* session = tracing_session();
+  EXPECT_EQ(session->drain_period_ms, 100000u);
+  svc->AdaptDrainPeriod(session, /*fill_percent=*/60, /*chunks_overwritten=*/0);
+  EXPECT_EQ(session->drain_period_ms, 50000u);
+  svc->AdaptDrainPeriod(session, /*fill_percent=*/30, /*chunks_overwritten=*/0);
+  EXPECT_EQ(session->drain_period_ms, 50000u);
+  svc->AdaptDrainPeriod(session, /*fill_percent=*/10, /*chunks_overwritten=*/5);
+  EXPECT_EQ(session->drain_period_ms, 25000u);
+  svc->AdaptDrainPeriod(session, /*fill_percent=*/10, /*chunks_overwritten=*/5);
+  EXPECT_EQ(session->drain_period_ms, 50000u);
+  svc->AdaptDrainPeriod(session, /*fill_percent=*/0, /*chunks_overwritten=*/5);
+  EXPECT_EQ(session->drain_period_ms, 100000u);
+  svc->AdaptDrainPeriod(session, /*fill_percent=*/0, /*chunks_overwritten=*/5);
+  EXPECT_EQ(session->drain_period_ms, 100000u);
+
+  TraceStats stats = svc->GetTraceStats(session);
+  const auto& wif_stats = stats.write_into_file_stats();
+  EXPECT_EQ(wif_stats.drains(), 6u);
+  EXPECT_EQ(wif_stats.last_fill_percent(), 0u);
+  EXPECT_EQ(wif_stats.max_fill_percent(), 60u);
+  EXPECT_EQ(wif_stats.drains_with_overwrites(), 1u);
+  EXPECT_EQ(wif_stats.chunks_overwritten(), 5u);
+  EXPECT_EQ(wif_stats.period_ms(), 100000u);
+  EXPECT_EQ(wif_stats.min_period_ms(), 25000u);
 
   consumer->DisableTracing();
   producer->WaitForDataSourceStop("data_source");
   consumer->WaitForTracingDisabled();
-  EXPECT_THAT(consumer->ReadBuffers(),
-              Contains(Property(
-                  &protos::gen::TracePacket::for_testing,
-                  Property(&protos::gen::TestEvent::str, Eq("payload")))));
 }
 
-TEST_F(TracingServiceImplTest, ImplicitFlushOnTimedTraces) {
+TEST_F(TracingServiceImplTest, FilterWithBufferReadWorkers) {
+  svc->SetBufferReadWorkers(2);
+
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
 
@@ -1872,12 +2121,455 @@ TEST_F(TracingServiceImplTest, ImplicitFlushOnTimedTraces) {
   producer->Connect(svc.get(), "mock_producer");
   producer->RegisterDataSource("data_source");
 
+  // Allows only Trace.packet.for_testing.str.
+  protozero::FilterBytecodeGenerator filt;
+  filt.AddNestedField(1 /* root trace.packet */, 1);
+  filt.EndMessage();
+  filt.AddNestedField(900 /* packet.for_testing */, 2);
+  filt.EndMessage();
+  filt.AddSimpleField(1 /* for_testing.str */);
+  filt.EndMessage();
+
   TraceConfig trace_config;
-  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_buffers()->set_size_kb(4096);
   auto* ds_config = trace_config.add_data_sources()->mutable_config();
   ds_config->set_name("data_source");
-  trace_config.set_duration_ms(1);
-
+  ds_config->set_target_buffer(0);
+  trace_config.mutable_trace_filter()->set_bytecode(filt.Serialize());
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // Enough packets to filter them in parallel.
+  static const int kNumTestPackets = 1000;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (int i = 0; i < kNumTestPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_timestamp(static_cast<uint64_t>(i));
+    tp->set_for_testing()->set_str("payload_" + std::to_string(i));
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::vector<std::string> payloads;
+  for (const auto& packet : consumer->ReadBuffers()) {
+    EXPECT_FALSE(packet.has_timestamp());
+    EXPECT_FALSE(packet.has_trusted_packet_sequence_id());
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+  std::vector<std::string> expected;
+  for (int i = 0; i < kNumTestPackets; i++)
+    expected.push_back("payload_" + std::to_string(i));
+  EXPECT_EQ(payloads, expected);
+}
+
+// Filtered packets larger than the maximum slice size are split into several
+// slices of the filter output, which must still read back as the original
+// packet.
+TEST_F(TracingServiceImplTest, FilterLargePacket) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  // Allows only Trace.packet.for_testing.str.
+  protozero::FilterBytecodeGenerator filt;
+  filt.AddNestedField(1 /* root trace.packet */, 1);
+  filt.EndMessage();
+  filt.AddNestedField(900 /* packet.for_testing */, 2);
+  filt.EndMessage();
+  filt.AddSimpleField(1 /* for_testing.str */);
+  filt.EndMessage();
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.mutable_trace_filter()->set_bytecode(filt.Serialize());
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::string large_payload;
+  for (size_t i = 0; i < 3 * TracingServiceImpl::kMaxTracePacketSliceSize; i++)
+    large_payload.push_back(static_cast<char>('a' + i % 26));
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_timestamp(1);
+    tp->set_for_testing()->set_str("small");
+  }
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_timestamp(2);
+    tp->set_for_testing()->set_str(large_payload);
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::vector<std::string> payloads;
+  for (const auto& packet : consumer->ReadBuffers()) {
+    EXPECT_FALSE(packet.has_timestamp());
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+  std::vector<std::string> expected{"small", large_payload};
+  EXPECT_EQ(payloads, expected);
+}
+
+TEST_F(TracingServiceImplTest, CompressReadBuffers) {
+  svc->SetCompressorFn(&WrapPacketsCompressFn);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload");
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  EXPECT_THAT(packets, Not(Contains(Property(
+                           &protos::gen::TracePacket::for_testing,
+                           Property(&protos::gen::TestEvent::str,
+                                    Eq("payload"))))));
+  EXPECT_THAT(UnwrapPackets(packets),
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("payload")))));
+}
+
+TEST_F(TracingServiceImplTest, CompressWriteIntoFile) {
+  svc->SetCompressorFn(&WrapPacketsCompressFn);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(100000);  // 100s
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload");
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  EXPECT_THAT(UnwrapPackets(trace.packet()),
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("payload")))));
+}
+
+TEST_F(TracingServiceImplTest, CompressFromCliSkipsServiceCompression) {
+  svc->SetCompressorFn(&WrapPacketsCompressFn);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  trace_config.set_compress_from_cli(true);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload");
+  }
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  EXPECT_THAT(consumer->ReadBuffers(),
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("payload")))));
+}
+
+// Test the logic that allows the trace config to set the shm total size and
+// page size from the trace config. Also check that, if the config doesn't
+// specify a value we fall back on the hint provided by the producer.
+TEST_F(TracingServiceImplTest, ProducerShmAndPageSizeOverriddenByTraceConfig) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+  const size_t kMaxPageSizeKb = 32;
+
+  struct ConfiguredAndExpectedSizes {
+    size_t config_page_size_kb;
+    size_t hint_page_size_kb;
+    size_t expected_page_size_kb;
+
+    size_t config_size_kb;
+    size_t hint_size_kb;
+    size_t expected_size_kb;
+  };
+
+  ConfiguredAndExpectedSizes kSizes[] = {
+      // Config and hint are 0, fallback to default values.
+      {0, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
+      // Use configured sizes.
+      {16, 0, 16, 16, 0, 16},
+      // Config is 0, use hint.
+      {0, 4, 4, 0, 16, 16},
+      // Config takes precendence over hint.
+      {4, 8, 4, 16, 32, 16},
+      // Config takes precendence over hint, even if it's larger.
+      {8, 4, 8, 32, 16, 32},
+      // Config page size % 4 != 0, fallback to defaults.
+      {3, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
+      // Config page size less than system page size, fallback to defaults.
+      {2, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
+      // Config sizes too large, use max.
+      {4096, 0, kMaxPageSizeKb, 4096000, 0, kMaxShmSizeKb},
+      // Hint sizes too large, use max.
+      {0, 4096, kMaxPageSizeKb, 0, 4096000, kMaxShmSizeKb},
+      // Config buffer size isn't a multiple of 4KB, fallback to defaults.
+      {0, 0, kDefaultShmPageSizeKb, 18, 0, kDefaultShmSizeKb},
+      // Invalid page size -> also ignore buffer size config.
+      {2, 0, kDefaultShmPageSizeKb, 32, 0, kDefaultShmSizeKb},
+      // Invalid buffer size -> also ignore page size config.
+      {16, 0, kDefaultShmPageSizeKb, 18, 0, kDefaultShmSizeKb},
+      // Config page size % buffer size != 0, fallback to defaults.
+      {8, 0, kDefaultShmPageSizeKb, 20, 0, kDefaultShmSizeKb},
+      // Config page size % default buffer size != 0, fallback to defaults.
+      {28, 0, kDefaultShmPageSizeKb, 0, 0, kDefaultShmSizeKb},
+  };
+
+  const size_t kNumProducers = base::ArraySize(kSizes);
+  std::unique_ptr<MockProducer> producer[kNumProducers];
+  for (size_t i = 0; i < kNumProducers; i++) {
+    auto name = "mock_producer_" + std::to_string(i);
+    producer[i] = CreateMockProducer();
+    producer[i]->Connect(svc.get(), name, base::GetCurrentUserId(),
+                         kSizes[i].hint_size_kb * 1024,
+                         kSizes[i].hint_page_size_kb * 1024);
+    producer[i]->RegisterDataSource("data_source");
+  }
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  for (size_t i = 0; i < kNumProducers; i++) {
+    auto* producer_config = trace_config.add_producers();
+    producer_config->set_producer_name("mock_producer_" + std::to_string(i));
+    producer_config->set_shm_size_kb(
+        static_cast<uint32_t>(kSizes[i].config_size_kb));
+    producer_config->set_page_size_kb(
+        static_cast<uint32_t>(kSizes[i].config_page_size_kb));
+  }
+
+  consumer->EnableTracing(trace_config);
+  size_t expected_shm_sizes_kb[kNumProducers]{};
+  size_t expected_page_sizes_kb[kNumProducers]{};
+  size_t actual_shm_sizes_kb[kNumProducers]{};
+  size_t actual_page_sizes_kb[kNumProducers]{};
+  for (size_t i = 0; i < kNumProducers; i++) {
+    expected_shm_sizes_kb[i] = kSizes[i].expected_size_kb;
+    expected_page_sizes_kb[i] = kSizes[i].expected_page_size_kb;
+
+    producer[i]->WaitForTracingSetup();
+    producer[i]->WaitForDataSourceSetup("data_source");
+    actual_shm_sizes_kb[i] =
+        producer[i]->endpoint()->shared_memory()->size() / 1024;
+    actual_page_sizes_kb[i] =
+        producer[i]->endpoint()->shared_buffer_page_size_kb();
+  }
+  for (size_t i = 0; i < kNumProducers; i++) {
+    producer[i]->WaitForDataSourceStart("data_source");
+  }
+  ASSERT_THAT(actual_page_sizes_kb, ElementsAreArray(expected_page_sizes_kb));
+  ASSERT_THAT(actual_shm_sizes_kb, ElementsAreArray(expected_shm_sizes_kb));
+}
+
+TEST_F(TracingServiceImplTest, ExplicitFlush) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload");
+  }
+
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+  EXPECT_THAT(consumer->ReadBuffers(),
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("payload")))));
+}
+
+TEST_F(TracingServiceImplTest, InProcessDirectCommits) {
+  svc->SetInProcessDirectCommitsEnabled(true);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // Every tenth packet spans several chunks, which then go through the
+  // commit requests because they need patching.
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  std::vector<std::string> expected;
+  for (int i = 0; i < 500; i++) {
+    std::string payload(i % 10 == 0 ? 10000u : 100u,
+                        static_cast<char>('a' + i % 26));
+    payload += std::to_string(i);
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str(payload);
+    expected.push_back(payload);
+  }
+
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  std::vector<std::string> payloads;
+  for (const auto& packet : consumer->ReadBuffers()) {
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+  EXPECT_EQ(payloads, expected);
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
+TEST_F(TracingServiceImplTest, ImplicitFlushOnTimedTraces) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  trace_config.set_duration_ms(1);
+
   consumer->EnableTracing(trace_config);
   producer->WaitForTracingSetup();
   producer->WaitForDataSourceSetup("data_source");
@@ -1964,6 +2656,75 @@ TEST_F(TracingServiceImplTest, BatchFlushes) {
                   Property(&protos::gen::TestEvent::str, Eq("payload")))));
 }
 
+// A producer which repeatedly misses the flush deadline stops holding back the
+// flushes of the other producers.
+TEST_F(TracingServiceImplTest, DeprioritizeProducersMissingFlushDeadline) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  std::unique_ptr<MockProducer> slow_producer = CreateMockProducer();
+  slow_producer->Connect(svc.get(), "slow_producer");
+  slow_producer->RegisterDataSource("slow_data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+  trace_config.add_data_sources()->mutable_config()->set_name(
+      "slow_data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  slow_producer->WaitForTracingSetup();
+  slow_producer->WaitForDataSourceSetup("slow_data_source");
+  producer->WaitForDataSourceStart("data_source");
+  slow_producer->WaitForDataSourceStart("slow_data_source");
+
+  for (uint32_t i = 0;
+       i < TracingServiceImpl::kFlushDeadlineMissesToDeprioritize; i++) {
+    auto flush_request = consumer->Flush(/*timeout_ms=*/100);
+    producer->WaitForFlush(nullptr);
+    slow_producer->WaitForFlush(nullptr, /*reply=*/false);
+    ASSERT_FALSE(flush_request.WaitForReply());
+  }
+
+  // The slow producer is now waited for only kDeprioritizedFlushDeadlineMs,
+  // rather than for the whole (longer than the test timeout) flush timeout.
+  auto flush_request = consumer->Flush(/*timeout_ms=*/60000);
+  producer->WaitForFlush(nullptr);
+  slow_producer->WaitForFlush(nullptr, /*reply=*/false);
+  ASSERT_FALSE(flush_request.WaitForReply());
+
+  // Acking a flush in time restores it.
+  flush_request = consumer->Flush(/*timeout_ms=*/60000);
+  producer->WaitForFlush(nullptr);
+  slow_producer->WaitForFlush(nullptr);
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->GetTraceStats();
+  TraceStats stats = consumer->WaitForTraceStats(true);
+  ASSERT_EQ(stats.producer_stats_size(), 2);
+  for (const TraceStats::ProducerStats& producer_stats :
+       stats.producer_stats()) {
+    if (producer_stats.producer_name() != "slow_producer")
+      continue;
+    EXPECT_EQ(producer_stats.flushes_acked(), 1u);
+    EXPECT_EQ(producer_stats.flush_ack_time_ns(),
+              producer_stats.flush_ack_max_time_ns());
+    EXPECT_EQ(producer_stats.flush_deadlines_missed(),
+              TracingServiceImpl::kFlushDeadlineMissesToDeprioritize + 1);
+  }
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  slow_producer->WaitForDataSourceStop("slow_data_source");
+  consumer->WaitForTracingDisabled();
+}
+
 TEST_F(TracingServiceImplTest, PeriodicFlush) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
@@ -3048,6 +3809,242 @@ TEST_F(TracingServiceImplTest, GetTraceStats) {
   consumer->WaitForTracingDisabled();
 }
 
+TEST_F(TracingServiceImplTest, GetTraceStatsPerWriter) {
+  svc->SetSMBScrapingEnabled(true);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  ProducerID producer_id = *last_producer_id();
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer = producer->endpoint()->CreateTraceWriter(
+      tracing_session()->buffers_index[0]);
+  WaitForTraceWritersChanged(producer_id);
+
+  // The first packets are committed by the writer when flushing.
+  writer->NewTracePacket()->set_for_testing()->set_str("payload1");
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  // The next ones are scraped by the service, as the writer isn't flushed.
+  writer->NewTracePacket()->set_for_testing()->set_str("payload2");
+  writer->NewTracePacket()->set_for_testing()->set_str("payload3");
+  flush_request = consumer->Flush();
+  producer->WaitForFlush(nullptr);
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->GetTraceStats();
+  TraceStats stats = consumer->WaitForTraceStats(true);
+  ASSERT_EQ(stats.producer_stats_size(), 1);
+  const TraceStats::ProducerStats& producer_stats = stats.producer_stats()[0];
+  EXPECT_EQ(producer_stats.producer_id(), static_cast<int32_t>(producer_id));
+  EXPECT_EQ(producer_stats.producer_name(), "mock_producer");
+  EXPECT_GE(producer_stats.smb_scrapes(), 2u);
+  ASSERT_EQ(producer_stats.writer_stats_size(), 1);
+  const TraceStats::WriterStats& writer_stats =
+      producer_stats.writer_stats()[0];
+  EXPECT_EQ(writer_stats.writer_id(), writer->writer_id());
+  EXPECT_EQ(writer_stats.buffer(), 0u);
+  EXPECT_EQ(writer_stats.chunks_committed(), 1u);
+  EXPECT_GT(writer_stats.bytes_committed(), 0u);
+  EXPECT_EQ(writer_stats.chunks_scraped(), 1u);
+  EXPECT_GT(writer_stats.bytes_scraped(), 0u);
+  EXPECT_EQ(writer_stats.chunks_discarded(), 0u);
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+}
+
+TEST_F(TracingServiceImplTest, DownsampleOnOverwrite) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  // A small full resolution buffer, which keeps one every 10 of the packets
+  // it overwrites in a larger one.
+  TraceConfig trace_config;
+  auto* recent_buffer = trace_config.add_buffers();
+  recent_buffer->set_size_kb(16);
+  auto* downsample_cfg = recent_buffer->mutable_downsample_on_overwrite();
+  downsample_cfg->set_target_buffer(1);
+  downsample_cfg->set_keep_one_every_n_packets(10);
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer = producer->endpoint()->CreateTraceWriter(
+      tracing_session()->buffers_index[0]);
+  static constexpr int kNumPackets = 1000;
+  for (int i = 0; i < kNumPackets; i++) {
+    std::string payload = std::to_string(i);
+    payload.resize(100, '.');
+    writer->NewTracePacket()->set_for_testing()->set_str(payload);
+  }
+  auto flush_request = consumer->Flush();
+  producer->WaitForFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::set<int> indexes;
+  for (const auto& packet : consumer->ReadBuffers()) {
+    if (packet.has_for_testing())
+      indexes.insert(std::stoi(packet.for_testing().str()));
+  }
+
+  // The oldest packets are decimated, the most recent ones are all there.
+  EXPECT_LT(indexes.size(), static_cast<size_t>(kNumPackets));
+  EXPECT_EQ(indexes.count(0), 1u);
+  EXPECT_EQ(indexes.count(1), 0u);
+  for (int i = kNumPackets - 10; i < kNumPackets; i++)
+    EXPECT_EQ(indexes.count(i), 1u);
+}
+
+TEST_F(TracingServiceImplTest, DownsampleOnOverwriteInvalidTarget) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  // The target buffer must come after the source one.
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  auto* buffer = trace_config.add_buffers();
+  buffer->set_size_kb(128);
+  buffer->mutable_downsample_on_overwrite()->set_target_buffer(0);
+
+  auto on_fail = task_runner.CreateCheckpoint("on_fail");
+  EXPECT_CALL(*consumer, OnTracingDisabled(HasSubstr("target_buffer")))
+      .WillOnce(InvokeWithoutArgs(on_fail));
+  consumer->EnableTracing(trace_config);
+  task_runner.RunUntilCheckpoint("on_fail");
+}
+
+TEST_F(TracingServiceImplTest, CloneSession) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.set_unique_session_name("flight_recorder");
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer = producer->endpoint()->CreateTraceWriter(
+      tracing_session()->buffers_index[0]);
+  writer->NewTracePacket()->set_for_testing()->set_str("payload1");
+  writer->NewTracePacket()->set_for_testing()->set_str("payload2");
+
+  // The source session is flushed before being cloned.
+  std::unique_ptr<MockConsumer> clone_consumer = CreateMockConsumer();
+  clone_consumer->Connect(svc.get());
+  auto on_cloned = task_runner.CreateCheckpoint("on_cloned");
+  clone_consumer->endpoint()->CloneSession(
+      "flight_recorder", [&on_cloned](bool success, const std::string& msg) {
+        EXPECT_TRUE(success) << msg;
+        on_cloned();
+      });
+  producer->WaitForFlush(writer.get());
+  task_runner.RunUntilCheckpoint("on_cloned");
+
+  // Packets written after the snapshot only go into the source session.
+  writer->NewTracePacket()->set_for_testing()->set_str("payload3");
+  writer->Flush();
+
+  auto clone_packets = clone_consumer->ReadBuffers();
+  EXPECT_THAT(clone_packets,
+              Contains(Property(&protos::gen::TracePacket::for_testing,
+                                Property(&protos::gen::TestEvent::str,
+                                         Eq("payload1")))));
+  EXPECT_THAT(clone_packets,
+              Contains(Property(&protos::gen::TracePacket::for_testing,
+                                Property(&protos::gen::TestEvent::str,
+                                         Eq("payload2")))));
+  EXPECT_THAT(clone_packets,
+              Not(Contains(Property(&protos::gen::TracePacket::for_testing,
+                                    Property(&protos::gen::TestEvent::str,
+                                             Eq("payload3"))))));
+  clone_consumer->FreeBuffers();
+
+  // The source session is unaffected, including by the reads of the clone.
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+  auto packets = consumer->ReadBuffers();
+  for (const char* payload : {"payload1", "payload2", "payload3"}) {
+    EXPECT_THAT(packets,
+                Contains(Property(&protos::gen::TracePacket::for_testing,
+                                  Property(&protos::gen::TestEvent::str,
+                                           Eq(payload)))));
+  }
+}
+
+TEST_F(TracingServiceImplTest, CloneSessionErrors) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get(), /*uid=*/123);
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.set_unique_session_name("flight_recorder");
+  consumer->EnableTracing(trace_config);
+
+  auto clone = [this](MockConsumer* cloner, const std::string& name) {
+    std::string error;
+    auto on_done = task_runner.CreateCheckpoint("on_clone_" + name);
+    cloner->endpoint()->CloneSession(
+        name, [&error, &on_done](bool success, const std::string& msg) {
+          EXPECT_FALSE(success);
+          error = msg;
+          on_done();
+        });
+    task_runner.RunUntilCheckpoint("on_clone_" + name);
+    return error;
+  };
+
+  std::unique_ptr<MockConsumer> other_uid = CreateMockConsumer();
+  other_uid->Connect(svc.get(), /*uid=*/456);
+  EXPECT_THAT(clone(other_uid.get(), "unknown"), HasSubstr("No tracing"));
+  EXPECT_THAT(clone(other_uid.get(), "flight_recorder"),
+              HasSubstr("another uid"));
+
+  // The consumer of the source session has already a session.
+  EXPECT_THAT(clone(consumer.get(), "flight_recorder"),
+              HasSubstr("already has a tracing session"));
+}
+
 TEST_F(TracingServiceImplTest, ObserveEventsDataSourceInstances) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
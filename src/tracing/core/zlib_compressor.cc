@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/zlib_compressor.h"
+
+#include <string.h>
+
+#include <tuple>
+
+#include <zlib.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/tracing/core/slice.h"
+#include "perfetto/protozero/proto_utils.h"
+
+namespace perfetto {
+namespace {
+
+using protozero::proto_utils::MakeTagLengthDelimited;
+using protozero::proto_utils::WriteVarInt;
+
+// ID of |compressed_packets| in trace_packet.proto.
+constexpr uint32_t kCompressedPacketsId = 50;
+
+// Some transport mechanisms have a 512kb limit on packet size. The
+// uncompressed size of each batch is limited so that the compressed packets
+// stay below that even if the data doesn't compress at all (in which case
+// deflate only adds a few bytes every 16kb).
+constexpr size_t kMaxBatchSize = 480 * 1024;
+
+// The compressed data is written into owned slices of this size. This has to
+// be <= TracingServiceImpl::kMaxTracePacketSliceSize to allow sending the
+// packets over IPC.
+constexpr size_t kOutputSliceSize = 64 * 1024;
+
+class PacketCompressor {
+ public:
+  explicit PacketCompressor(std::vector<TracePacket>* output)
+      : output_(output) {}
+  ~PacketCompressor() { PERFETTO_DCHECK(!is_compressing_); }
+
+  void Push(TracePacket packet);
+
+  // Finalizes the compressed packet for the current batch (if any).
+  void Flush();
+
+ private:
+  void Deflate(const void* data, size_t size, int flush);
+
+  std::vector<TracePacket>* const output_;
+  z_stream stream_{};
+  bool is_compressing_ = false;
+
+  // Uncompressed size of the packets of the current batch.
+  size_t batch_size_ = 0;
+
+  // The compressed data of the current batch.
+  std::vector<Slice> slices_;
+};
+
+void PacketCompressor::Push(TracePacket packet) {
+  const size_t size = TracePacket::kMaxPreambleBytes + packet.size();
+  if (is_compressing_ && batch_size_ + size > kMaxBatchSize)
+    Flush();
+
+  // Packets which don't fit in a batch are passed through uncompressed.
+  if (size > kMaxBatchSize) {
+    output_->emplace_back(std::move(packet));
+    return;
+  }
+
+  if (!is_compressing_) {
+    memset(&stream_, 0, sizeof(stream_));
+    PERFETTO_CHECK(deflateInit(&stream_, Z_DEFAULT_COMPRESSION) == Z_OK);
+    is_compressing_ = true;
+    batch_size_ = 0;
+  }
+
+  // The batch is compressed as a sequence of Trace.packet fields, like a
+  // trace file.
+  char* preamble;
+  size_t preamble_size;
+  std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+  Deflate(preamble, preamble_size, Z_NO_FLUSH);
+  for (const Slice& slice : packet.slices())
+    Deflate(slice.start, slice.size, Z_NO_FLUSH);
+  batch_size_ += size;
+}
+
+void PacketCompressor::Flush() {
+  if (!is_compressing_)
+    return;
+
+  Deflate(nullptr, 0, Z_FINISH);
+  PERFETTO_DCHECK(!slices_.empty());
+  slices_.back().size = kOutputSliceSize - stream_.avail_out;
+  PERFETTO_CHECK(deflateEnd(&stream_) == Z_OK);
+  is_compressing_ = false;
+
+  size_t compressed_size = 0;
+  for (const Slice& slice : slices_)
+    compressed_size += slice.size;
+
+  uint8_t preamble[16];
+  uint8_t* ptr = WriteVarInt(MakeTagLengthDelimited(kCompressedPacketsId),
+                             &preamble[0]);
+  ptr = WriteVarInt(compressed_size, ptr);
+  size_t preamble_size = static_cast<size_t>(ptr - &preamble[0]);
+  Slice preamble_slice = Slice::Allocate(preamble_size);
+  memcpy(preamble_slice.own_data(), &preamble[0], preamble_size);
+
+  TracePacket compressed_packet;
+  compressed_packet.AddSlice(std::move(preamble_slice));
+  for (Slice& slice : slices_)
+    compressed_packet.AddSlice(std::move(slice));
+  slices_.clear();
+  output_->emplace_back(std::move(compressed_packet));
+}
+
+void PacketCompressor::Deflate(const void* data, size_t size, int flush) {
+  PERFETTO_DCHECK(is_compressing_);
+  if (size == 0 && flush == Z_NO_FLUSH)
+    return;
+  stream_.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+  stream_.avail_in = static_cast<uInt>(size);
+  for (;;) {
+    if (stream_.avail_out == 0) {
+      slices_.emplace_back(Slice::Allocate(kOutputSliceSize));
+      stream_.next_out = slices_.back().own_data();
+      stream_.avail_out = static_cast<uInt>(kOutputSliceSize);
+    }
+    int res = deflate(&stream_, flush);
+    if (res == Z_STREAM_END)
+      break;
+    PERFETTO_CHECK(res == Z_OK);
+    // With Z_FINISH, deflate() returns Z_OK only if it ran out of output
+    // space, otherwise it's done when all the input has been consumed.
+    if (flush != Z_FINISH && stream_.avail_in == 0)
+      break;
+  }
+}
+
+}  // namespace
+
+void ZlibCompressFn(std::vector<TracePacket>* packets) {
+  std::vector<TracePacket> output;
+  PacketCompressor compressor(&output);
+  for (TracePacket& packet : *packets)
+    compressor.Push(std::move(packet));
+  compressor.Flush();
+  *packets = std::move(output);
+}
+
+}  // namespace perfetto
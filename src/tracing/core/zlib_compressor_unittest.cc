@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/core/zlib_compressor.h"
+
+#include <random>
+#include <string>
+
+#include <zlib.h>
+
+#include "protos/perfetto/trace/test_event.gen.h"
+#include "protos/perfetto/trace/trace.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+std::string Inflate(const std::string& data) {
+  z_stream stream{};
+  EXPECT_EQ(inflateInit(&stream), Z_OK);
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  std::string res;
+  char buf[4096];
+  int ret;
+  do {
+    stream.next_out = reinterpret_cast<Bytef*>(buf);
+    stream.avail_out = sizeof(buf);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    EXPECT_TRUE(ret == Z_OK || ret == Z_STREAM_END);
+    res.append(buf, sizeof(buf) - stream.avail_out);
+  } while (ret == Z_OK);
+  inflateEnd(&stream);
+  return res;
+}
+
+// Holds the serialized packets, which TracePacket doesn't own.
+class ZlibCompressorTest : public ::testing::Test {
+ protected:
+  void AddPacket(const std::string& payload) {
+    protos::gen::TracePacket proto;
+    proto.mutable_for_testing()->set_str(payload);
+    buffers_.emplace_back(new std::string(proto.SerializeAsString()));
+    TracePacket packet;
+    // Split the packet in two slices to exercise the multi-slice path.
+    const std::string& buf = *buffers_.back();
+    packet.AddSlice(buf.data(), buf.size() / 2);
+    packet.AddSlice(buf.data() + buf.size() / 2, buf.size() - buf.size() / 2);
+    packets_.emplace_back(std::move(packet));
+    payloads_.push_back(payload);
+  }
+
+  // Returns the payloads of the packets in |packets_|, decompressing them if
+  // needed.
+  std::vector<std::string> Decode() {
+    std::vector<std::string> res;
+    for (const TracePacket& packet : packets_) {
+      TracePacket copy;
+      for (const Slice& slice : packet.slices())
+        copy.AddSlice(slice.start, slice.size);
+      protos::gen::TracePacket proto;
+      EXPECT_TRUE(proto.ParseFromString(copy.GetRawBytesForTesting()));
+      if (!proto.has_compressed_packets()) {
+        res.push_back(proto.for_testing().str());
+        continue;
+      }
+      protos::gen::Trace trace;
+      EXPECT_TRUE(trace.ParseFromString(Inflate(proto.compressed_packets())));
+      for (const auto& inner : trace.packet())
+        res.push_back(inner.for_testing().str());
+    }
+    return res;
+  }
+
+  std::vector<std::unique_ptr<std::string>> buffers_;
+  std::vector<TracePacket> packets_;
+  std::vector<std::string> payloads_;
+};
+
+TEST_F(ZlibCompressorTest, Empty) {
+  ZlibCompressFn(&packets_);
+  EXPECT_TRUE(packets_.empty());
+}
+
+TEST_F(ZlibCompressorTest, SmallPackets) {
+  size_t uncompressed_size = 0;
+  for (int i = 0; i < 1000; i++) {
+    AddPacket("packet " + std::to_string(i));
+    uncompressed_size += packets_.back().size();
+  }
+
+  ZlibCompressFn(&packets_);
+
+  ASSERT_EQ(packets_.size(), 1u);
+  EXPECT_LT(packets_[0].size(), uncompressed_size / 2);
+  EXPECT_EQ(Decode(), payloads_);
+}
+
+TEST_F(ZlibCompressorTest, SplitsLargeBatches) {
+  // Random data doesn't compress, so the output has to be split in several
+  // packets to stay below the packet size limit.
+  std::minstd_rand0 rnd(0);
+  for (int i = 0; i < 64; i++) {
+    std::string payload(64 * 1024, '\0');
+    for (char& c : payload)
+      c = static_cast<char>(rnd());
+    AddPacket(payload);
+  }
+
+  ZlibCompressFn(&packets_);
+
+  EXPECT_GT(packets_.size(), 1u);
+  for (const TracePacket& packet : packets_)
+    EXPECT_LE(packet.size(), 512u * 1024);
+  EXPECT_EQ(Decode(), payloads_);
+}
+
+TEST_F(ZlibCompressorTest, LargePacketIsNotCompressed) {
+  AddPacket("before");
+  AddPacket(std::string(1024 * 1024, 'x'));
+  AddPacket("after");
+
+  ZlibCompressFn(&packets_);
+
+  // The large packet is passed through as is, between the two batches.
+  ASSERT_EQ(packets_.size(), 3u);
+  EXPECT_EQ(packets_[1].size(), buffers_[1]->size());
+  EXPECT_EQ(Decode(), payloads_);
+}
+
+}  // namespace
+}  // namespace perfetto
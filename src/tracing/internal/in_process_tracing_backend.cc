@@ -110,6 +110,9 @@ TracingService* InProcessTracingBackend::GetOrCreateService(
     std::unique_ptr<InProcessShmFactory> shm(new InProcessShmFactory());
     service_ = TracingService::CreateInstance(std::move(shm), task_runner);
     service_->SetSMBScrapingEnabled(true);
+    // The producers share the address space of the service, their chunks
+    // don't need to be listed in commit requests.
+    service_->SetInProcessDirectCommitsEnabled(true);
   }
   return service_.get();
 }
@@ -106,6 +106,7 @@ class UnsupportedConsumerEndpoint : public ConsumerEndpoint {
   }
 
   void ReadBuffers() override {}
+  void ReadBuffersIntoFile(base::ScopedFile) override {}
   void FreeBuffers() override {}
 
   void Detach(const std::string& /*key*/) override {}
@@ -117,6 +118,8 @@ class UnsupportedConsumerEndpoint : public ConsumerEndpoint {
   void QueryCapabilities(QueryCapabilitiesCallback) override {}
 
   void SaveTraceForBugreport(SaveTraceForBugreportCallback) override {}
+  void CloneSession(const std::string& /*unique_session_name*/,
+                    CloneSessionCallback) override {}
 
  private:
   Consumer* const consumer_;
@@ -128,6 +128,21 @@ uint64_t ComputeConfigHash(const DataSourceConfig& config) {
   return hasher.digest();
 }
 
+// Like ComputeConfigHash(), but ignores the fields which are filled in by the
+// service. Used to match the data sources set up by the service against the
+// ones started by startup tracing.
+uint64_t ComputeStartupConfigHash(const DataSourceConfig& config) {
+  DataSourceConfig config_copy(config);
+  config_copy.set_target_buffer(0);
+  config_copy.set_trace_duration_ms(0);
+  config_copy.set_stop_timeout_ms(0);
+  config_copy.set_enable_extra_guardrails(false);
+  config_copy.set_session_initiator(
+      DataSourceConfig::SESSION_INITIATOR_UNSPECIFIED);
+  config_copy.set_tracing_session_id(0);
+  return ComputeConfigHash(config_copy);
+}
+
 }  // namespace
 
 // ----- Begin of TracingMuxerImpl::ProducerImpl
@@ -185,6 +200,9 @@ void TracingMuxerImpl::ProducerImpl::OnDisconnect() {
   // concurrently creating new trace writers. The reconnection below will
   // atomically swap the new service in place of the old one.
   dead_services_.push_back(service_);
+  // The startup data sources can't be adopted by the new connection, which
+  // uses a different shared memory buffer.
+  muxer_->AbortStartupTracingSessions(backend_id_);
   // Try reconnecting the producer.
   muxer_->OnProducerDisconnected(this);
 }
@@ -732,6 +750,8 @@ void TracingMuxerImpl::Initialize(const TracingInitArgs& args) {
         args.shmem_size_hint_kb * 1024;
     rb.producer_conn_args.shmem_page_size_hint_bytes =
         args.shmem_page_size_hint_kb * 1024;
+    rb.producer_conn_args.use_producer_provided_smb =
+        args.enable_startup_tracing && type == kSystemBackend;
     rb.producer->Initialize(rb.backend->ConnectProducer(rb.producer_conn_args));
   };
 
@@ -842,6 +862,9 @@ void TracingMuxerImpl::SetupDataSource(TracingBackendId backend_id,
                 cfg.name().c_str());
   uint64_t config_hash = ComputeConfigHash(cfg);
 
+  if (MaybeAdoptStartupDataSource(backend_id, instance_id, cfg))
+    return;
+
   for (const auto& rds : data_sources_) {
     if (rds.descriptor.name() != cfg.name())
       continue;
@@ -873,56 +896,9 @@ void TracingMuxerImpl::SetupDataSource(TracingBackendId backend_id,
       continue;
     }
 
-    for (uint32_t i = 0; i < kMaxDataSourceInstances; i++) {
-      // Find a free slot.
-      if (static_state.TryGet(i))
-        continue;
-
-      auto* internal_state =
-          reinterpret_cast<DataSourceState*>(&static_state.instances[i]);
-      std::lock_guard<std::recursive_mutex> guard(internal_state->lock);
-      static_assert(
-          std::is_same<decltype(internal_state->data_source_instance_id),
-                       DataSourceInstanceID>::value,
-          "data_source_instance_id type mismatch");
-      internal_state->backend_id = backend_id;
-      internal_state->backend_connection_id = backend_connection_id;
-      internal_state->data_source_instance_id = instance_id;
-      internal_state->buffer_id =
-          static_cast<internal::BufferId>(cfg.target_buffer());
-      internal_state->config_hash = config_hash;
-      internal_state->data_source = rds.factory();
-      internal_state->interceptor = nullptr;
-      internal_state->interceptor_id = 0;
-
-      if (cfg.has_interceptor_config()) {
-        for (size_t j = 0; j < interceptors_.size(); j++) {
-          if (cfg.interceptor_config().name() ==
-              interceptors_[j].descriptor.name()) {
-            PERFETTO_DLOG("Intercepting data source %" PRIu64
-                          " \"%s\" into \"%s\"",
-                          instance_id, cfg.name().c_str(),
-                          cfg.interceptor_config().name().c_str());
-            internal_state->interceptor_id = static_cast<uint32_t>(j + 1);
-            internal_state->interceptor = interceptors_[j].factory();
-            internal_state->interceptor->OnSetup({cfg});
-            break;
-          }
-        }
-        if (!internal_state->interceptor_id) {
-          PERFETTO_ELOG("Unknown interceptor configured for data source: %s",
-                        cfg.interceptor_config().name().c_str());
-        }
-      }
-
-      // This must be made at the end. See matching acquire-load in
-      // DataSource::Trace().
-      static_state.valid_instances.fetch_or(1 << i, std::memory_order_release);
-
-      DataSourceBase::SetupArgs setup_args;
-      setup_args.config = &cfg;
-      setup_args.internal_instance_index = i;
-      internal_state->data_source->OnSetup(setup_args);
+    if (SetupDataSourceImpl(rds, backend_id, backend_connection_id,
+                            instance_id, cfg,
+                            /*startup_target_buffer_reservation=*/0)) {
       return;
     }
     PERFETTO_ELOG(
@@ -933,6 +909,76 @@ void TracingMuxerImpl::SetupDataSource(TracingBackendId backend_id,
   }
 }
 
+TracingMuxerImpl::FindDataSourceRes TracingMuxerImpl::SetupDataSourceImpl(
+    const RegisteredDataSource& rds,
+    TracingBackendId backend_id,
+    uint32_t backend_connection_id,
+    DataSourceInstanceID instance_id,
+    const DataSourceConfig& cfg,
+    uint16_t startup_target_buffer_reservation) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  DataSourceStaticState& static_state = *rds.static_state;
+  for (uint32_t i = 0; i < kMaxDataSourceInstances; i++) {
+    // Find a free slot.
+    if (static_state.TryGet(i))
+      continue;
+
+    auto* internal_state =
+        reinterpret_cast<DataSourceState*>(&static_state.instances[i]);
+    std::lock_guard<std::recursive_mutex> guard(internal_state->lock);
+    static_assert(
+        std::is_same<decltype(internal_state->data_source_instance_id),
+                     DataSourceInstanceID>::value,
+        "data_source_instance_id type mismatch");
+    internal_state->backend_id = backend_id;
+    internal_state->backend_connection_id = backend_connection_id;
+    internal_state->data_source_instance_id = instance_id;
+    internal_state->buffer_id =
+        static_cast<internal::BufferId>(cfg.target_buffer());
+    // Startup instances are matched against the config sent by the service
+    // when it adopts them, see MaybeAdoptStartupDataSource().
+    internal_state->config_hash = startup_target_buffer_reservation
+                                      ? ComputeStartupConfigHash(cfg)
+                                      : ComputeConfigHash(cfg);
+    internal_state->startup_target_buffer_reservation =
+        startup_target_buffer_reservation;
+    internal_state->data_source = rds.factory();
+    internal_state->interceptor = nullptr;
+    internal_state->interceptor_id = 0;
+
+    if (cfg.has_interceptor_config()) {
+      for (size_t j = 0; j < interceptors_.size(); j++) {
+        if (cfg.interceptor_config().name() ==
+            interceptors_[j].descriptor.name()) {
+          PERFETTO_DLOG("Intercepting data source %" PRIu64
+                        " \"%s\" into \"%s\"",
+                        instance_id, cfg.name().c_str(),
+                        cfg.interceptor_config().name().c_str());
+          internal_state->interceptor_id = static_cast<uint32_t>(j + 1);
+          internal_state->interceptor = interceptors_[j].factory();
+          internal_state->interceptor->OnSetup({cfg});
+          break;
+        }
+      }
+      if (!internal_state->interceptor_id) {
+        PERFETTO_ELOG("Unknown interceptor configured for data source: %s",
+                      cfg.interceptor_config().name().c_str());
+      }
+    }
+
+    // This must be made at the end. See matching acquire-load in
+    // DataSource::Trace().
+    static_state.valid_instances.fetch_or(1 << i, std::memory_order_release);
+
+    DataSourceBase::SetupArgs setup_args;
+    setup_args.config = &cfg;
+    setup_args.internal_instance_index = i;
+    internal_state->data_source->OnSetup(setup_args);
+    return FindDataSourceRes(&static_state, internal_state, i);
+  }
+  return FindDataSourceRes();
+}
+
 // Called by the service of one of the backends.
 void TracingMuxerImpl::StartDataSource(TracingBackendId backend_id,
                                        DataSourceInstanceID instance_id) {
@@ -945,6 +991,15 @@ void TracingMuxerImpl::StartDataSource(TracingBackendId backend_id,
     return;
   }
 
+  // Adopted startup data sources are already running.
+  if (ds.internal_state->startup_target_buffer_reservation)
+    return;
+
+  StartDataSourceImpl(ds);
+}
+
+void TracingMuxerImpl::StartDataSourceImpl(const FindDataSourceRes& ds) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
   DataSourceBase::StartArgs start_args{};
   start_args.internal_instance_index = ds.instance_idx;
 
@@ -1059,6 +1114,211 @@ void TracingMuxerImpl::ClearDataSourceIncrementalState(
       1, std::memory_order_relaxed);
 }
 
+// Can be called from any thread other than the muxer one.
+void TracingMuxerImpl::SetupStartupTracingBlocking(
+    const TraceConfig& config,
+    SetupStartupTracingOpts opts) {
+  PERFETTO_DCHECK(!task_runner_->RunsTasksOnCurrentThread());
+  base::WaitableEvent setup_done;
+  task_runner_->PostTask([this, &config, opts, &setup_done] {
+    SetupStartupTracing(config, opts);
+    setup_done.Notify();
+  });
+  setup_done.Wait();
+}
+
+void TracingMuxerImpl::SetupStartupTracing(const TraceConfig& config,
+                                           SetupStartupTracingOpts opts) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  RegisteredBackend* backend = nullptr;
+  for (RegisteredBackend& rb : backends_) {
+    if (!rb.producer_conn_args.use_producer_provided_smb)
+      continue;
+    if (opts.backend == kUnspecifiedBackend || opts.backend == rb.type) {
+      backend = &rb;
+      break;
+    }
+  }
+  if (!backend) {
+    PERFETTO_ELOG(
+        "Startup tracing requires the system backend and "
+        "TracingInitArgs::enable_startup_tracing");
+    return;
+  }
+  ProducerImpl* producer = backend->producer.get();
+
+  // 0 is not a valid reservation id.
+  uint16_t reservation_id = ++last_startup_target_buffer_reservation_;
+  if (!reservation_id)
+    reservation_id = ++last_startup_target_buffer_reservation_;
+
+  bool any_started = false;
+  for (const auto& ds_cfg : config.data_sources()) {
+    const DataSourceConfig& cfg = ds_cfg.config();
+    for (const auto& rds : data_sources_) {
+      if (rds.descriptor.name() != cfg.name())
+        continue;
+      auto ds = SetupDataSourceImpl(rds, backend->id, producer->connection_id_,
+                                    /*instance_id=*/0, cfg, reservation_id);
+      if (!ds) {
+        PERFETTO_ELOG(
+            "Maximum number of data source instances exhausted. "
+            "Dropping startup data source %s",
+            cfg.name().c_str());
+        continue;
+      }
+      StartDataSourceImpl(ds);
+      any_started = true;
+    }
+  }
+  if (!any_started) {
+    PERFETTO_ELOG("Startup tracing didn't start any data source");
+    return;
+  }
+
+  RegisteredStartupSession session;
+  session.reservation_id = reservation_id;
+  session.backend_id = backend->id;
+  startup_sessions_.push_back(session);
+  task_runner_->PostDelayedTask(
+      [this, reservation_id] { AbortStartupTracingSession(reservation_id); },
+      opts.timeout_ms);
+}
+
+bool TracingMuxerImpl::MaybeAdoptStartupDataSource(
+    TracingBackendId backend_id,
+    DataSourceInstanceID instance_id,
+    const DataSourceConfig& cfg) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (startup_sessions_.empty())
+    return false;
+
+  uint64_t startup_config_hash = ComputeStartupConfigHash(cfg);
+  for (const auto& rds : data_sources_) {
+    if (rds.descriptor.name() != cfg.name())
+      continue;
+    DataSourceStaticState& static_state = *rds.static_state;
+    for (uint32_t i = 0; i < kMaxDataSourceInstances; i++) {
+      DataSourceState* internal_state = static_state.TryGet(i);
+      if (!internal_state || internal_state->backend_id != backend_id ||
+          !internal_state->startup_target_buffer_reservation ||
+          internal_state->data_source_instance_id ||
+          internal_state->config_hash != startup_config_hash) {
+        continue;
+      }
+      uint16_t reservation_id =
+          internal_state->startup_target_buffer_reservation;
+      auto session = std::find_if(
+          startup_sessions_.begin(), startup_sessions_.end(),
+          [reservation_id](const RegisteredStartupSession& s) {
+            return s.reservation_id == reservation_id;
+          });
+      // The session is being aborted.
+      if (session == startup_sessions_.end())
+        continue;
+
+      auto target_buffer = static_cast<BufferID>(cfg.target_buffer());
+      if (!session->bound) {
+        // This commits the chunks written so far to |target_buffer| in place.
+        ProducerImpl* producer = backends_[backend_id].producer.get();
+        producer->service_->MaybeSharedMemoryArbiter()->BindStartupTargetBuffer(
+            reservation_id, target_buffer);
+        session->bound = true;
+        session->target_buffer = target_buffer;
+      } else if (session->target_buffer != target_buffer) {
+        PERFETTO_ELOG(
+            "Can't adopt startup data source %s: all the data sources of a "
+            "startup session must target the same buffer",
+            cfg.name().c_str());
+        continue;
+      }
+
+      std::lock_guard<std::recursive_mutex> guard(internal_state->lock);
+      internal_state->data_source_instance_id = instance_id;
+      internal_state->buffer_id =
+          static_cast<internal::BufferId>(target_buffer);
+      internal_state->config_hash = ComputeConfigHash(cfg);
+      PERFETTO_DLOG("Adopted startup data source %" PRIu64 " %s", instance_id,
+                    cfg.name().c_str());
+      return true;
+    }
+  }
+  return false;
+}
+
+// Stops the data sources of the startup session which weren't adopted by the
+// service. If none was, also discards the data they have written.
+void TracingMuxerImpl::AbortStartupTracingSession(uint16_t reservation_id) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  auto it = std::find_if(startup_sessions_.begin(), startup_sessions_.end(),
+                         [reservation_id](const RegisteredStartupSession& s) {
+                           return s.reservation_id == reservation_id;
+                         });
+  if (it == startup_sessions_.end())
+    return;  // Already aborted.
+  RegisteredStartupSession session = *it;
+  startup_sessions_.erase(it);
+
+  for (const auto& rds : data_sources_) {
+    DataSourceStaticState* static_state = rds.static_state;
+    for (uint32_t i = 0; i < kMaxDataSourceInstances; i++) {
+      DataSourceState* internal_state = static_state->TryGet(i);
+      if (!internal_state ||
+          internal_state->backend_id != session.backend_id ||
+          internal_state->startup_target_buffer_reservation != reservation_id ||
+          internal_state->data_source_instance_id) {
+        continue;
+      }
+      PERFETTO_DLOG("Aborting startup data source %s",
+                    rds.descriptor.name().c_str());
+
+      StopArgsImpl stop_args{};
+      stop_args.internal_instance_index = i;
+      stop_args.async_stop_closure = [this, static_state, i] {
+        // Unlike StopDataSource_AsyncEnd(), there is no service to notify.
+        task_runner_->PostTask([this, static_state, i] {
+          static_state->valid_instances.fetch_and(~(1u << i),
+                                                  std::memory_order_acq_rel);
+          auto* state =
+              reinterpret_cast<DataSourceState*>(&static_state->instances[i]);
+          {
+            std::lock_guard<std::recursive_mutex> guard(state->lock);
+            state->trace_lambda_enabled = false;
+            state->data_source.reset();
+          }
+          TracingMuxer::generation_++;
+        });
+      };
+      {
+        std::lock_guard<std::recursive_mutex> guard(internal_state->lock);
+        if (internal_state->interceptor)
+          internal_state->interceptor->OnStop({});
+        internal_state->data_source->OnStop(stop_args);
+      }
+      if (stop_args.async_stop_closure)
+        std::move(stop_args.async_stop_closure)();
+    }
+  }
+
+  if (!session.bound) {
+    ProducerImpl* producer = backends_[session.backend_id].producer.get();
+    producer->service_->MaybeSharedMemoryArbiter()
+        ->AbortStartupTracingForReservation(reservation_id);
+  }
+}
+
+void TracingMuxerImpl::AbortStartupTracingSessions(
+    TracingBackendId backend_id) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  std::vector<uint16_t> reservation_ids;
+  for (const auto& session : startup_sessions_) {
+    if (session.backend_id == backend_id)
+      reservation_ids.push_back(session.reservation_id);
+  }
+  for (uint16_t reservation_id : reservation_ids)
+    AbortStartupTracingSession(reservation_id);
+}
+
 void TracingMuxerImpl::SyncProducersForTesting() {
   std::mutex mutex;
   std::condition_variable cv;
@@ -1140,6 +1400,7 @@ void TracingMuxerImpl::DestroyStoppedTraceWritersForCurrentThread() {
 
       // The DataSource instance has been destroyed or recycled.
       ds_tls.Reset();  // Will also destroy the |ds_tls.trace_writer|.
+      tls.initialized_instances &= ~(1u << inst);
     }
   };
 
@@ -1536,6 +1797,15 @@ std::unique_ptr<TraceWriterBase> TracingMuxerImpl::CreateTraceWriter(
   // CreateTraceWriter posts tasks under the hood.
   std::shared_ptr<ProducerEndpoint> service =
       std::atomic_load(&producer->service_);
+  if (data_source->startup_target_buffer_reservation) {
+    return service->MaybeSharedMemoryArbiter()->CreateStartupTraceWriter(
+        data_source->startup_target_buffer_reservation);
+  }
+  // Arbiters created for a producer-provided buffer can't stall.
+  if (backends_[data_source->backend_id]
+          .producer_conn_args.use_producer_provided_smb) {
+    buffer_exhausted_policy = BufferExhaustedPolicy::kDrop;
+  }
   return service->CreateTraceWriter(data_source->buffer_id,
                                     buffer_exhausted_policy);
 }
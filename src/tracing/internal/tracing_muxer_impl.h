@@ -115,6 +115,11 @@ class TracingMuxerImpl : public TracingMuxer {
 
   std::unique_ptr<TracingSession> CreateTracingSession(BackendType);
 
+  // Implements Tracing::SetupStartupTracingBlocking(). Can be called from any
+  // thread other than the muxer one.
+  void SetupStartupTracingBlocking(const TraceConfig&,
+                                   SetupStartupTracingOpts);
+
   // Producer-side bookkeeping methods.
   void UpdateDataSourcesOnAllBackends();
   void SetupDataSource(TracingBackendId,
@@ -363,6 +368,20 @@ class TracingMuxerImpl : public TracingMuxer {
     InterceptorBase::TracePacketCallback packet_callback{};
   };
 
+  // A set of data sources started by SetupStartupTracingBlocking(), which
+  // haven't been adopted by a tracing session of the service yet.
+  struct RegisteredStartupSession {
+    // Identifies both the session and the target buffer reservation of the
+    // SharedMemoryArbiter its trace writers commit to.
+    uint16_t reservation_id = 0;
+    TracingBackendId backend_id = 0;
+
+    // Set once the first data source was adopted, at which point the
+    // reservation is bound to the target buffer of that data source.
+    bool bound = false;
+    BufferID target_buffer = 0;
+  };
+
   struct RegisteredBackend {
     // Backends are supposed to have static lifetime.
     TracingBackend* backend = nullptr;
@@ -396,10 +415,31 @@ class TracingMuxerImpl : public TracingMuxer {
   };
   FindDataSourceRes FindDataSource(TracingBackendId, DataSourceInstanceID);
 
+  // Creates an instance of |rds| in a free slot and calls its OnSetup().
+  // Returns an empty result if all the slots are in use.
+  FindDataSourceRes SetupDataSourceImpl(
+      const RegisteredDataSource& rds,
+      TracingBackendId,
+      uint32_t backend_connection_id,
+      DataSourceInstanceID,
+      const DataSourceConfig&,
+      uint16_t startup_target_buffer_reservation);
+  void StartDataSourceImpl(const FindDataSourceRes&);
+
+  // Startup tracing bookkeeping methods.
+  void SetupStartupTracing(const TraceConfig&, SetupStartupTracingOpts);
+  bool MaybeAdoptStartupDataSource(TracingBackendId,
+                                   DataSourceInstanceID,
+                                   const DataSourceConfig&);
+  void AbortStartupTracingSession(uint16_t reservation_id);
+  void AbortStartupTracingSessions(TracingBackendId);
+
   std::unique_ptr<base::TaskRunner> task_runner_;
   std::vector<RegisteredDataSource> data_sources_;
   std::vector<RegisteredBackend> backends_;
   std::vector<RegisteredInterceptor> interceptors_;
+  std::vector<RegisteredStartupSession> startup_sessions_;
+  uint16_t last_startup_target_buffer_reservation_ = 0;
   TracingPolicy* policy_ = nullptr;
 
   std::atomic<TracingSessionGlobalID> next_tracing_session_id_{};
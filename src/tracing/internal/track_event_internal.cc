@@ -400,5 +400,15 @@ protos::pbzero::DebugAnnotation* TrackEventInternal::AddDebugAnnotation(
   return annotation;
 }
 
+// static
+void TrackEventInternal::InternDebugAnnotationNames(
+    perfetto::EventContext* event_ctx,
+    const char* const* names,
+    size_t count,
+    uint64_t* iids) {
+  for (size_t i = 0; i < count; i++)
+    iids[i] = InternedDebugAnnotationName::Get(event_ctx, names[i]);
+}
+
 }  // namespace internal
 }  // namespace perfetto
@@ -151,11 +151,21 @@ void ConsumerIPCClientImpl::DisableTracing() {
 }
 
 void ConsumerIPCClientImpl::ReadBuffers() {
+  // Without a file, the service sends the packets in the IPC replies.
+  ReadBuffersIntoFile(base::ScopedFile());
+}
+
+void ConsumerIPCClientImpl::ReadBuffersIntoFile(base::ScopedFile fd) {
   if (!connected_) {
     PERFETTO_DLOG("Cannot ReadBuffers(), not connected to tracing service");
     return;
   }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  // Passing FDs is not supported on Windows, read the packets over IPC.
+  fd.reset();
+#endif
+
   ipc::Deferred<protos::gen::ReadBuffersResponse> async_response;
 
   // The IPC layer guarantees that callbacks are destroyed after this object
@@ -166,8 +176,10 @@ void ConsumerIPCClientImpl::ReadBuffers() {
       [this](ipc::AsyncResult<protos::gen::ReadBuffersResponse> response) {
         OnReadBuffersResponse(std::move(response));
       });
+  // |fd| will be closed when this function returns, but it's fine because the
+  // IPC layer dup()'s it when sending the IPC.
   consumer_port_.ReadBuffers(protos::gen::ReadBuffersRequest(),
-                             std::move(async_response));
+                             std::move(async_response), *fd);
 }
 
 void ConsumerIPCClientImpl::OnReadBuffersResponse(
@@ -459,4 +471,27 @@ void ConsumerIPCClientImpl::SaveTraceForBugreport(
   consumer_port_.SaveTraceForBugreport(req, std::move(async_response));
 }
 
+void ConsumerIPCClientImpl::CloneSession(const std::string& unique_session_name,
+                                         CloneSessionCallback callback) {
+  if (!connected_) {
+    PERFETTO_DLOG("Cannot CloneSession(), not connected to tracing service");
+    return;
+  }
+
+  protos::gen::CloneSessionRequest req;
+  req.set_unique_session_name(unique_session_name);
+  ipc::Deferred<protos::gen::CloneSessionResponse> async_response;
+  async_response.Bind(
+      [callback](ipc::AsyncResult<protos::gen::CloneSessionResponse> response) {
+        if (!response) {
+          // If the IPC fails, we are talking to an older version of the service
+          // that didn't support CloneSession at all.
+          callback(false, "The tracing service doesn't support CloneSession()");
+        } else {
+          callback(response->success(), response->msg());
+        }
+      });
+  consumer_port_.CloneSession(req, std::move(async_response));
+}
+
 }  // namespace perfetto
@@ -65,6 +65,7 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   void ChangeTraceConfig(const TraceConfig&) override;
   void DisableTracing() override;
   void ReadBuffers() override;
+  void ReadBuffersIntoFile(base::ScopedFile) override;
   void FreeBuffers() override;
   void Flush(uint32_t timeout_ms, FlushCallback) override;
   void Detach(const std::string& key) override;
@@ -74,6 +75,8 @@ class ConsumerIPCClientImpl : public TracingService::ConsumerEndpoint,
   void QueryServiceState(QueryServiceStateCallback) override;
   void QueryCapabilities(QueryCapabilitiesCallback) override;
   void SaveTraceForBugreport(SaveTraceForBugreportCallback) override;
+  void CloneSession(const std::string& unique_session_name,
+                    CloneSessionCallback) override;
 
   // ipc::ServiceProxy::EventListener implementation.
   // These methods are invoked by the IPC layer, which knows nothing about
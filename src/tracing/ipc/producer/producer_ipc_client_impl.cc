@@ -140,7 +140,8 @@ void ProducerIPCClientImpl::OnConnect() {
         OnConnectionInitialized(
             resp.success(),
             resp.success() ? resp->using_shmem_provided_by_producer() : false,
-            resp.success() ? resp->direct_smb_patching_supported() : false);
+            resp.success() ? resp->direct_smb_patching_supported() : false,
+            resp.success() ? resp->max_batch_commits_duration_ms() : 0);
       });
   protos::gen::InitializeConnectionRequest req;
   req.set_producer_name(name_);
@@ -205,7 +206,8 @@ void ProducerIPCClientImpl::OnDisconnect() {
 void ProducerIPCClientImpl::OnConnectionInitialized(
     bool connection_succeeded,
     bool using_shmem_provided_by_producer,
-    bool direct_smb_patching_supported) {
+    bool direct_smb_patching_supported,
+    uint32_t max_batch_commits_duration_ms) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   // If connection_succeeded == false, the OnDisconnect() call will follow next
   // and there we'll notify the |producer_|. TODO: add a test for this.
@@ -213,6 +215,7 @@ void ProducerIPCClientImpl::OnConnectionInitialized(
     return;
   is_shmem_provided_by_producer_ = using_shmem_provided_by_producer;
   direct_smb_patching_supported_ = direct_smb_patching_supported;
+  max_batch_commits_duration_ms_ = max_batch_commits_duration_ms;
   producer_->OnConnect();
 
   // Bail out if the service failed to adopt our producer-allocated SMB.
@@ -222,6 +225,14 @@ void ProducerIPCClientImpl::OnConnectionInitialized(
     ipc_channel_.reset();
     return;
   }
+
+  // With a producer-provided SMB, the arbiter already exists at this point.
+  if (shared_memory_arbiter_) {
+    if (direct_smb_patching_supported_)
+      shared_memory_arbiter_->SetDirectSMBPatchingSupportedByService();
+    shared_memory_arbiter_->SetMaxBatchCommitsDurationByService(
+        max_batch_commits_duration_ms_);
+  }
 }
 
 void ProducerIPCClientImpl::OnServiceRequest(
@@ -285,6 +296,8 @@ void ProducerIPCClientImpl::OnServiceRequest(
           task_runner_);
       if (direct_smb_patching_supported_)
         shared_memory_arbiter_->SetDirectSMBPatchingSupportedByService();
+      shared_memory_arbiter_->SetMaxBatchCommitsDurationByService(
+          max_batch_commits_duration_ms_);
     } else {
       // Producer-provided SMB (used by Chrome for startup tracing).
       PERFETTO_CHECK(is_shmem_provided_by_producer_ && shared_memory_ &&
@@ -109,6 +109,13 @@ void ConsumerIPCService::ReadBuffers(const protos::gen::ReadBuffersRequest&,
                                      DeferredReadBuffersResponse resp) {
   RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
   remote_consumer->read_buffers_response = std::move(resp);
+  // If the consumer passed a file, the service writes the packets into it and
+  // the reply only signals the end of the trace.
+  base::ScopedFile fd = ipc::Service::TakeReceivedFD();
+  if (fd) {
+    remote_consumer->service_endpoint->ReadBuffersIntoFile(std::move(fd));
+    return;
+  }
   remote_consumer->service_endpoint->ReadBuffers();
 }
 
@@ -338,6 +345,34 @@ void ConsumerIPCService::OnSaveTraceForBugreportCallback(
   response.Resolve(std::move(resp));
 }
 
+void ConsumerIPCService::CloneSession(
+    const protos::gen::CloneSessionRequest& req,
+    DeferredCloneSessionResponse resp) {
+  RemoteConsumer* remote_consumer = GetConsumerForCurrentRequest();
+  auto it = pending_clone_session_responses_.insert(
+      pending_clone_session_responses_.end(), std::move(resp));
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  auto callback = [weak_this, it](bool success, const std::string& msg) {
+    if (weak_this)
+      weak_this->OnCloneSessionCallback(success, msg, std::move(it));
+  };
+  remote_consumer->service_endpoint->CloneSession(req.unique_session_name(),
+                                                  callback);
+}
+
+// Called by the service in response to service_endpoint->CloneSession().
+void ConsumerIPCService::OnCloneSessionCallback(
+    bool success,
+    const std::string& msg,
+    PendingCloneSessionResponses::iterator pending_response_it) {
+  DeferredCloneSessionResponse response(std::move(*pending_response_it));
+  pending_clone_session_responses_.erase(pending_response_it);
+  auto resp = ipc::AsyncResult<protos::gen::CloneSessionResponse>::Create();
+  resp->set_success(success);
+  resp->set_msg(msg);
+  response.Resolve(std::move(resp));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // RemoteConsumer methods
 ////////////////////////////////////////////////////////////////////////////////
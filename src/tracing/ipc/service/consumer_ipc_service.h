@@ -71,6 +71,8 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
                          DeferredQueryCapabilitiesResponse) override;
   void SaveTraceForBugreport(const protos::gen::SaveTraceForBugreportRequest&,
                              DeferredSaveTraceForBugreportResponse) override;
+  void CloneSession(const protos::gen::CloneSessionRequest&,
+                    DeferredCloneSessionResponse) override;
   void OnClientDisconnected() override;
 
  private:
@@ -130,6 +132,7 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
       std::list<DeferredQueryCapabilitiesResponse>;
   using PendingSaveTraceForBugreportResponses =
       std::list<DeferredSaveTraceForBugreportResponse>;
+  using PendingCloneSessionResponses = std::list<DeferredCloneSessionResponse>;
 
   ConsumerIPCService(const ConsumerIPCService&) = delete;
   ConsumerIPCService& operator=(const ConsumerIPCService&) = delete;
@@ -148,6 +151,9 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
       bool success,
       const std::string& msg,
       PendingSaveTraceForBugreportResponses::iterator);
+  void OnCloneSessionCallback(bool success,
+                              const std::string& msg,
+                              PendingCloneSessionResponses::iterator);
 
   TracingService* const core_service_;
 
@@ -159,6 +165,7 @@ class ConsumerIPCService : public protos::gen::ConsumerPort {
   PendingQuerySvcResponses pending_query_service_responses_;
   PendingQueryCapabilitiesResponses pending_query_capabilities_responses_;
   PendingSaveTraceForBugreportResponses pending_bugreport_responses_;
+  PendingCloneSessionResponses pending_clone_session_responses_;
 
   base::WeakPtrFactory<ConsumerIPCService> weak_ptr_factory_;  // Keep last.
 };
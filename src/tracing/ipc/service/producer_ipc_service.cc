@@ -139,6 +139,8 @@ void ProducerIPCService::InitializeConnection(
       ipc::AsyncResult<protos::gen::InitializeConnectionResponse>::Create();
   async_res->set_using_shmem_provided_by_producer(using_producer_shmem);
   async_res->set_direct_smb_patching_supported(true);
+  async_res->set_max_batch_commits_duration_ms(
+      TracingService::kMaxBatchCommitsDurationMs);
   response.Resolve(std::move(async_res));
 }
 
@@ -16,6 +16,7 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <functional>
@@ -56,6 +57,7 @@
 #include "protos/perfetto/common/tracing_service_state.gen.h"
 #include "protos/perfetto/common/track_event_descriptor.gen.h"
 #include "protos/perfetto/config/interceptor_config.gen.h"
+#include "protos/perfetto/config/interceptors/console_config.gen.h"
 #include "protos/perfetto/config/track_event/track_event_config.gen.h"
 #include "protos/perfetto/trace/clock_snapshot.pbzero.h"
 #include "protos/perfetto/trace/gpu/gpu_render_stage_event.gen.h"
@@ -172,6 +174,7 @@ using ::testing::NiceMock;
 using ::testing::Not;
 using ::testing::Property;
 using ::testing::StrEq;
+using ::testing::UnorderedElementsAreArray;
 
 // ------------------------------
 // Declarations of helper classes
@@ -313,6 +316,40 @@ class TestIncrementalDataSource
   void OnStop(const StopArgs&) override {}
 };
 
+struct TestCustomTlsState;
+
+struct TestCustomTlsDataSourceTraits
+    : public perfetto::DefaultDataSourceTraits {
+  using CustomTlsStateType = TestCustomTlsState;
+};
+
+class TestCustomTlsDataSource
+    : public perfetto::DataSource<TestCustomTlsDataSource,
+                                  TestCustomTlsDataSourceTraits> {
+ public:
+  void OnSetup(const SetupArgs& args) override {
+    legacy_config = args.config->legacy_config();
+  }
+  void OnStart(const StartArgs&) override {}
+  void OnStop(const StopArgs&) override {}
+
+  std::string legacy_config;
+};
+
+struct TestCustomTlsState {
+  explicit TestCustomTlsState(TestCustomTlsDataSource::TraceContext& ctx) {
+    auto ds = ctx.GetDataSourceLocked();
+    if (ds)
+      legacy_config = ds->legacy_config;
+    num_constructed++;
+  }
+
+  std::string legacy_config;
+  static int num_constructed;
+};
+
+int TestCustomTlsState::num_constructed;
+
 // A convenience wrapper around TracingSession that allows to do block on
 //
 struct TestTracingSessionHandle {
@@ -381,6 +418,7 @@ class PerfettoApiTest : public ::testing::TestWithParam<perfetto::BackendType> {
     TracingInitArgs args;
     args.backends = supported_backends;
     args.tracing_policy = g_test_tracing_policy;
+    args.enable_startup_tracing = true;
     perfetto::Tracing::Initialize(args);
     RegisterDataSource<MockDataSource>("my_data_source");
     perfetto::TrackEvent::Register();
@@ -1258,6 +1296,64 @@ TEST_P(PerfettoApiTest, TrackEventConcurrentSessions) {
   EXPECT_THAT(trace2, Not(HasSubstr("Session2_Third")));
 }
 
+TEST_P(PerfettoApiTest, StartupTracing) {
+  if (GetParam() != perfetto::kSystemBackend)
+    GTEST_SKIP() << "Startup tracing is only supported by the system backend";
+
+  perfetto::TraceConfig cfg;
+  cfg.set_duration_ms(500);
+  cfg.add_buffers()->set_size_kb(1024);
+  auto* ds_cfg = cfg.add_data_sources()->mutable_config();
+  ds_cfg->set_name("track_event");
+  perfetto::protos::gen::TrackEventConfig te_cfg;
+  te_cfg.add_disabled_categories("*");
+  te_cfg.add_enabled_categories("foo");
+  ds_cfg->set_track_event_config_raw(te_cfg.SerializeAsString());
+
+  perfetto::SetupStartupTracingOpts opts;
+  opts.backend = GetParam();
+  perfetto::Tracing::SetupStartupTracingBlocking(cfg, opts);
+
+  // These events are written before the service knows about the session.
+  TRACE_EVENT_BEGIN("foo", "StartupEvent");
+  TRACE_EVENT_END("foo");
+  TRACE_EVENT_BEGIN("bar", "DisabledEvent");
+  TRACE_EVENT_END("bar");
+
+  // The session started by the service adopts the startup data source.
+  auto* tracing_session = NewTrace(cfg);
+  tracing_session->get()->StartBlocking();
+  TRACE_EVENT_BEGIN("foo", "SessionEvent");
+  TRACE_EVENT_END("foo");
+  perfetto::TrackEvent::Flush();
+  tracing_session->get()->StopBlocking();
+
+  std::vector<char> raw_trace = tracing_session->get()->ReadTraceBlocking();
+  std::string trace(raw_trace.data(), raw_trace.size());
+  EXPECT_THAT(trace, HasSubstr("StartupEvent"));
+  EXPECT_THAT(trace, HasSubstr("SessionEvent"));
+  EXPECT_THAT(trace, Not(HasSubstr("DisabledEvent")));
+}
+
+TEST_P(PerfettoApiTest, StartupTracingTimeout) {
+  if (GetParam() != perfetto::kSystemBackend)
+    GTEST_SKIP() << "Startup tracing is only supported by the system backend";
+
+  perfetto::TraceConfig cfg;
+  cfg.add_buffers()->set_size_kb(1024);
+  cfg.add_data_sources()->mutable_config()->set_name("my_data_source");
+
+  auto* data_source = &data_sources_["my_data_source"];
+  perfetto::SetupStartupTracingOpts opts;
+  opts.backend = GetParam();
+  opts.timeout_ms = 10;
+  perfetto::Tracing::SetupStartupTracingBlocking(cfg, opts);
+  data_source->on_start.Wait();
+
+  // Without a session adopting it, the data source stops after the timeout.
+  data_source->on_stop.Wait();
+}
+
 TEST_P(PerfettoApiTest, TrackEventProcessAndThreadDescriptors) {
   // Thread and process descriptors can be set before tracing is enabled.
   perfetto::TrackEvent::SetProcessDescriptor(
@@ -2085,6 +2181,31 @@ TEST_P(PerfettoApiTest, TrackEventTypedArgsWithInterningByValue) {
   EXPECT_THAT(log_messages, ElementsAre("This above all:"));
 }
 
+TEST_P(PerfettoApiTest, TrackEventTypedArgsWithInterningManyValues) {
+  // Create a new trace session.
+  auto* tracing_session = NewTraceWithCategories({"foo"});
+  tracing_session->get()->StartBlocking();
+
+  // More values than the entries of the interning cache, so that some of them
+  // evict each other.
+  static const char kBodies[64][2] = {};
+  TRACE_EVENT_BEGIN("foo", "EventWithState", [&](perfetto::EventContext ctx) {
+    std::vector<size_t> iids;
+    for (const char* body : kBodies)
+      iids.push_back(InternedLogMessageBodySmall::Get(&ctx, body));
+    for (size_t round = 0; round < 2; round++) {
+      for (size_t i = 0; i < 64; i++) {
+        EXPECT_EQ(iids[i], InternedLogMessageBodySmall::Get(&ctx, kBodies[i]));
+      }
+    }
+    std::sort(iids.begin(), iids.end());
+    EXPECT_EQ(std::unique(iids.begin(), iids.end()), iids.end());
+  });
+  TRACE_EVENT_END("foo");
+
+  tracing_session->get()->StopBlocking();
+}
+
 struct InternedLogMessageBodyHashed
     : public perfetto::TrackEventInternedDataIndex<
           InternedLogMessageBodyHashed,
@@ -2474,6 +2595,32 @@ TEST_P(PerfettoApiTest, ManyDebugAnnotations) {
               ElementsAre("B:test.E(arg1=(int)1,arg2=(int)2,arg3=(int)3)"));
 }
 
+TEST_P(PerfettoApiTest, MixedDebugAnnotations) {
+  // Create a new trace session.
+  auto* tracing_session = NewTraceWithCategories({"test"});
+  tracing_session->get()->StartBlocking();
+
+  // Interleaves primitive values, which are written in runs, with other
+  // values and a lambda. The event is emitted twice to also use the interned
+  // names.
+  for (int i = 0; i < 2; i++) {
+    TRACE_EVENT_BEGIN(
+        "test", "E", "int_arg", -1, "bool_arg", true, "str_arg", "hello",
+        "double_arg", 2.5, "uint_arg", 3u, "size_t_arg", size_t{4},
+        [](perfetto::EventContext ctx) {
+          ctx.event()->set_log_message()->set_source_location_iid(42);
+        });
+  }
+  perfetto::TrackEvent::Flush();
+
+  tracing_session->get()->StopBlocking();
+  auto slices = ReadSlicesFromTrace(tracing_session->get());
+  const char kSlice[] =
+      "B:test.E(int_arg=(int)-1,bool_arg=(bool)1,str_arg=(string)hello,"
+      "double_arg=(double)2.5,uint_arg=(uint)3,size_t_arg=(uint)4)";
+  EXPECT_THAT(slices, ElementsAre(kSlice, kSlice));
+}
+
 TEST_P(PerfettoApiTest, DebugAnnotationAndLambda) {
   // Create a new trace session.
   auto* tracing_session = NewTraceWithCategories({"test"});
@@ -3187,6 +3334,48 @@ TEST_P(PerfettoApiTest, CustomIncrementalState) {
   tracing_session->get()->StopBlocking();
 }
 
+TEST_P(PerfettoApiTest, CustomTlsState) {
+  perfetto::DataSourceDescriptor dsd;
+  dsd.set_name("custom_tls_data_source");
+  TestCustomTlsDataSource::Register(dsd);
+  perfetto::test::SyncProducers();
+
+  perfetto::TraceConfig cfg;
+  cfg.add_buffers()->set_size_kb(1024);
+  auto* ds_cfg = cfg.add_data_sources()->mutable_config();
+  ds_cfg->set_name("custom_tls_data_source");
+  ds_cfg->set_legacy_config("first");
+
+  auto* tracing_session = NewTrace(cfg);
+  tracing_session->get()->StartBlocking();
+
+  // The state is created by the first trace point of the thread only.
+  TestCustomTlsState::num_constructed = 0;
+  for (int i = 0; i < 3; i++) {
+    TestCustomTlsDataSource::Trace(
+        [](TestCustomTlsDataSource::TraceContext ctx) {
+          auto* state = ctx.GetCustomTlsState();
+          ASSERT_TRUE(state);
+          EXPECT_EQ("first", state->legacy_config);
+        });
+  }
+  EXPECT_EQ(1, TestCustomTlsState::num_constructed);
+  tracing_session->get()->StopBlocking();
+
+  // A new instance of the data source gets a new state.
+  ds_cfg->set_legacy_config("second");
+  tracing_session = NewTrace(cfg);
+  tracing_session->get()->StartBlocking();
+  TestCustomTlsDataSource::Trace(
+      [](TestCustomTlsDataSource::TraceContext ctx) {
+        auto* state = ctx.GetCustomTlsState();
+        ASSERT_TRUE(state);
+        EXPECT_EQ("second", state->legacy_config);
+      });
+  EXPECT_EQ(2, TestCustomTlsState::num_constructed);
+  tracing_session->get()->StopBlocking();
+}
+
 // Regression test for b/139110180. Checks that GetDataSourceLocked() can be
 // called from OnStart() and OnStop() callbacks without deadlocking.
 TEST_P(PerfettoApiTest, GetDataSourceLockedFromCallbacks) {
@@ -3921,6 +4110,64 @@ TEST_P(PerfettoApiTest, ConsoleInterceptorVerify) {
   EXPECT_THAT(lines, ContainerEq(golden_lines));
 }
 
+TEST_P(PerfettoApiTest, ConsoleInterceptorAsyncOutput) {
+  perfetto::ConsoleInterceptor::Register();
+  auto temp_file = perfetto::test::CreateTempFile();
+  perfetto::ConsoleInterceptor::SetOutputFdForTesting(temp_file.fd);
+
+  perfetto::TraceConfig cfg;
+  cfg.set_duration_ms(500);
+  cfg.add_buffers()->set_size_kb(1024);
+  auto* ds_cfg = cfg.add_data_sources()->mutable_config();
+  ds_cfg->set_name("track_event");
+  perfetto::protos::gen::ConsoleConfig console_cfg;
+  console_cfg.set_async_output(true);
+  ds_cfg->mutable_interceptor_config()->set_name("console");
+  ds_cfg->mutable_interceptor_config()->set_console_config_raw(
+      console_cfg.SerializeAsString());
+
+  auto* tracing_session = NewTrace(cfg);
+  tracing_session->get()->StartBlocking();
+  EmitConsoleEvents();
+  tracing_session->get()->StopBlocking();
+  perfetto::ConsoleInterceptor::SetOutputFdForTesting(0);
+
+  std::vector<std::string> lines;
+  FILE* f = fdopen(temp_file.fd, "r");
+  fseek(f, 0u, SEEK_SET);
+  std::array<char, 128> line{};
+  while (fgets(line.data(), line.size(), f)) {
+    // Ignore timestamps and process/thread ids.
+    std::string s(line.data() + 28);
+    // Filter out durations.
+    s = std::regex_replace(s, std::regex(" [+][0-9]*ms"), "");
+    lines.push_back(std::move(s));
+  }
+  fclose(f);
+  EXPECT_EQ(0, remove(temp_file.path.c_str()));
+
+  // The output of each thread is queued separately, hence the events of the
+  // two threads aren't interleaved in the same order as with sync output.
+  // clang-format off
+  std::vector<std::string> golden_lines = {
+      "foo   Instant event\n",
+      "foo   Scoped event {\n",
+      "foo   -  Nested event {\n",
+      "foo   -  -  Instant event\n",
+      "foo   -  -  Annotated event(foo:1, bar:hello)\n",
+      "foo   -  } Nested event\n",
+      "test  AsyncEvent {\n",
+      "foo   EventFromAnotherThread {\n",
+      "foo   -  Instant event\n",
+      "test  } AsyncEvent\n",
+      "foo   } EventFromAnotherThread\n",
+      "foo   -  More annotations(dict:{key:123}, array:[first, second])\n",
+      "foo   } Scoped event\n",
+  };
+  // clang-format on
+  EXPECT_THAT(lines, UnorderedElementsAreArray(golden_lines));
+}
+
 TEST_P(PerfettoApiTest, TrackEventObserver) {
   class Observer : public perfetto::TrackEventSessionObserver {
    public:
@@ -4223,8 +4470,12 @@ PERFETTO_DECLARE_DATA_SOURCE_STATIC_MEMBERS(MockDataSource);
 PERFETTO_DECLARE_DATA_SOURCE_STATIC_MEMBERS(MockDataSource2);
 PERFETTO_DECLARE_DATA_SOURCE_STATIC_MEMBERS(TestIncrementalDataSource,
                                             TestIncrementalDataSourceTraits);
+PERFETTO_DECLARE_DATA_SOURCE_STATIC_MEMBERS(TestCustomTlsDataSource,
+                                            TestCustomTlsDataSourceTraits);
 
 PERFETTO_DEFINE_DATA_SOURCE_STATIC_MEMBERS(MockDataSource);
 PERFETTO_DEFINE_DATA_SOURCE_STATIC_MEMBERS(MockDataSource2);
 PERFETTO_DEFINE_DATA_SOURCE_STATIC_MEMBERS(TestIncrementalDataSource,
                                            TestIncrementalDataSourceTraits);
+PERFETTO_DEFINE_DATA_SOURCE_STATIC_MEMBERS(TestCustomTlsDataSource,
+                                           TestCustomTlsDataSourceTraits);
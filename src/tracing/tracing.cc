@@ -64,6 +64,13 @@ std::unique_ptr<TracingSession> Tracing::NewTrace(BackendType backend) {
       ->CreateTracingSession(backend);
 }
 
+// static
+void Tracing::SetupStartupTracingBlocking(const TraceConfig& config,
+                                          SetupStartupTracingOpts opts) {
+  static_cast<internal::TracingMuxerImpl*>(internal::TracingMuxer::Get())
+      ->SetupStartupTracingBlocking(config, opts);
+}
+
 // Can be called from any thread.
 bool TracingSession::FlushBlocking(uint32_t timeout_ms) {
   std::atomic<bool> flush_result;
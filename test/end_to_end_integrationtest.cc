@@ -1307,6 +1307,35 @@ TEST_F(PerfettoCmdlineTest, NoSanitizers(SimpleConfig)) {
   EXPECT_EQ(0, perfetto.Run(&stderr_)) << stderr_;
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB) && \
+    (PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
+     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID))
+// The trace compressed by the cmdline client is written on threads which must
+// be started in the daemonized process, not before the fork of --background.
+TEST_F(PerfettoCmdlineTest, NoSanitizers(BackgroundCompressFromCli)) {
+  std::string cfg(
+      "buffers { size_kb: 1024 } duration_ms: 100 "
+      "compression_type: COMPRESSION_TYPE_DEFLATE compress_from_cli: true");
+  const std::string path = RandomTraceFileName();
+  auto perfetto =
+      ExecPerfetto({"--background", "-o", path, "-c", "-", "--txt"}, cfg);
+  StartServiceIfRequiredNoNewExecsAfterThis();
+  EXPECT_EQ(0, perfetto.Run(&stderr_)) << stderr_;
+
+  // The daemonized process writes the trace once tracing stops.
+  protos::gen::Trace trace;
+  for (int i = 0; i < 100 && trace.packet().empty(); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::string trace_str;
+    if (!base::ReadFile(path, &trace_str) || !trace.ParseFromString(trace_str))
+      trace.clear_packet();
+  }
+  ASSERT_FALSE(trace.packet().empty());
+  for (const auto& packet : trace.packet())
+    EXPECT_TRUE(packet.has_compressed_packets());
+}
+#endif
+
 TEST_F(PerfettoCmdlineTest, NoSanitizers(DetachAndAttach)) {
   auto attach_to_not_existing = ExecPerfetto({"--attach=not_existent"});
 
@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how the tracing service scales with the number of producers and
+// writers, the packet sizes, the SMB and buffer sizes, the fill policy, commit
+// batching and service-side filtering. Each benchmark run is one tracing
+// session: every iteration makes all the writers of all the producers write
+// kPacketsPerIteration packets concurrently and waits for the service to
+// acknowledge their commits. The data is read back at the end to compute the
+// drop rate.
+//
+// Besides the time per iteration and the bytes per second, it reports:
+// - Ser ns/KB: CPU time of the service thread per KB written.
+// - Lat p50/p99/p999: time taken by producers to write one packet, in ns.
+// - Drop %: packets written by producers but missing from the trace, because
+//   the SMB was full (writers use BufferExhaustedPolicy::kDrop) or because the
+//   trace buffer was full (overwritten or discarded chunks).
+//
+// To use it as a regression gate, run it with --benchmark_out=x.json before and
+// after a change and compare the outputs with tools/compare.py from
+// google-benchmark.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <random>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/waitable_event.h"
+#include "perfetto/ext/tracing/core/producer.h"
+#include "perfetto/ext/tracing/core/shared_memory_arbiter.h"
+#include "perfetto/ext/tracing/core/trace_writer.h"
+#include "perfetto/ext/tracing/ipc/producer_ipc_client.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "perfetto/tracing/core/data_source_descriptor.h"
+#include "perfetto/tracing/core/trace_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/protozero/filtering/filter_bytecode_generator.h"
+#include "test/test_helper.h"
+
+#include "protos/perfetto/common/trace_stats.gen.h"
+#include "protos/perfetto/trace/test_event.gen.h"
+#include "protos/perfetto/trace/test_event.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+
+namespace {
+
+constexpr char kDataSourceName[] = "perfetto.scaling_benchmark";
+constexpr uint32_t kPacketsPerIteration = 1000;
+
+// The max batching period for BenchmarkFlags::kBatchCommits.
+constexpr uint32_t kMaxBatchCommitsDurationMs = 10;
+
+enum BenchmarkFlags {
+  kDiscard = 1 << 0,       // DISCARD rather than RING_BUFFER.
+  kFilter = 1 << 1,        // Service-side filtering with TraceConfig.filter.
+  kBatchCommits = 1 << 2,  // Adaptive batching of the producers' commits.
+};
+
+// The distribution of the payload sizes of the packets.
+enum SizeMix {
+  kSmall = 0,  // 32 bytes, like most track events.
+  kMixed = 1,  // 80% of 32 bytes, 15% of 512 bytes, 5% of 4 KB.
+  kLarge = 2,  // 8 KB, which is fragmented across chunks.
+};
+
+constexpr uint32_t kMaxPayloadSize = 8192;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+uint32_t PayloadSize(SizeMix mix, std::minstd_rand0* rng) {
+  switch (mix) {
+    case kSmall:
+      return 32;
+    case kMixed: {
+      uint32_t dice = (*rng)() % 100;
+      return dice < 80 ? 32 : (dice < 95 ? 512 : 4096);
+    }
+    case kLarge:
+      return kMaxPayloadSize;
+  }
+  return 0;
+}
+
+// A producer with its own thread, which writes from several threads (one per
+// TraceWriter) into its SMB.
+class ScalingProducer : public Producer {
+ public:
+  ScalingProducer(base::TaskRunner* task_runner,
+                  uint32_t smb_size_kb,
+                  bool batch_commits)
+      : task_runner_(task_runner),
+        smb_size_kb_(smb_size_kb),
+        batch_commits_(batch_commits) {}
+
+  // Must be called on |task_runner_|. |on_connected| is invoked once the
+  // service has seen the data source and |on_started| once the data source has
+  // been started, both on |task_runner_|.
+  void Connect(const char* socket_name,
+               std::function<void()> on_connected,
+               std::function<void()> on_started) {
+    on_connected_ = std::move(on_connected);
+    on_started_ = std::move(on_started);
+    endpoint_ = ProducerIPCClient::Connect(
+        socket_name, this, "perfetto.scaling_benchmark_producer", task_runner_,
+        TracingService::ProducerSMBScrapingMode::kDefault,
+        smb_size_kb_ * 1024u, /*shared_memory_page_size_hint_bytes=*/4096);
+  }
+
+  // Can be called on any thread once the data source has been started.
+  std::unique_ptr<TraceWriter> CreateTraceWriter() {
+    return endpoint_->CreateTraceWriter(target_buffer_.load(),
+                                        BufferExhaustedPolicy::kDrop);
+  }
+
+  // Producer implementation.
+  void OnConnect() override {
+    DataSourceDescriptor descriptor;
+    descriptor.set_name(kDataSourceName);
+    endpoint_->RegisterDataSource(descriptor);
+    endpoint_->Sync(std::move(on_connected_));
+  }
+  void OnDisconnect() override {
+    PERFETTO_FATAL("Producer unexpectedly disconnected from the service");
+  }
+  void OnTracingSetup() override {}
+  void SetupDataSource(DataSourceInstanceID,
+                       const DataSourceConfig&) override {}
+  void StartDataSource(DataSourceInstanceID,
+                       const DataSourceConfig& config) override {
+    target_buffer_ = static_cast<BufferID>(config.target_buffer());
+    if (batch_commits_) {
+      endpoint_->MaybeSharedMemoryArbiter()->EnableAdaptiveBatchCommits(
+          kMaxBatchCommitsDurationMs);
+    }
+    std::move(on_started_)();
+  }
+  void StopDataSource(DataSourceInstanceID) override {}
+  void Flush(FlushRequestID id, const DataSourceInstanceID*, size_t) override {
+    // The writers flush at the end of each iteration already.
+    endpoint_->NotifyFlushComplete(id);
+  }
+  void ClearIncrementalState(const DataSourceInstanceID*, size_t) override {}
+
+ private:
+  base::TaskRunner* const task_runner_;
+  const uint32_t smb_size_kb_;
+  const bool batch_commits_;
+  std::function<void()> on_connected_;
+  std::function<void()> on_started_;
+  std::atomic<BufferID> target_buffer_{0};
+  std::unique_ptr<TracingService::ProducerEndpoint> endpoint_;
+};
+
+// Writes |kPacketsPerIteration| packets with |writer|, flushes it and waits for
+// the service to acknowledge the commit. Appends the time taken to write each
+// packet to |latencies_ns|.
+void WritePackets(TraceWriter* writer,
+                  SizeMix mix,
+                  std::minstd_rand0* rng,
+                  uint32_t* seq_value,
+                  uint64_t* bytes_written,
+                  std::vector<uint32_t>* latencies_ns) {
+  static const std::string kPayload(kMaxPayloadSize, 'x');
+  for (uint32_t i = 0; i < kPacketsPerIteration; i++) {
+    uint32_t size = PayloadSize(mix, rng);
+    int64_t start_ns = base::GetWallTimeNs().count();
+    {
+      auto packet = writer->NewTracePacket();
+      auto* test_event = packet->set_for_testing();
+      test_event->set_seq_value((*seq_value)++);
+      test_event->set_str(kPayload.data(), size);
+    }
+    latencies_ns->push_back(
+        static_cast<uint32_t>(base::GetWallTimeNs().count() - start_ns));
+    *bytes_written += size;
+  }
+  base::WaitableEvent flushed;
+  writer->Flush([&flushed] { flushed.Notify(); });
+  flushed.Wait();
+}
+
+// Allows the packet fields written by the producers and by the service which
+// are needed to check the trace.
+std::string GetFilterBytecode() {
+  protozero::FilterBytecodeGenerator filter;
+  filter.AddNestedField(1 /* trace.packet */, 1);
+  filter.EndMessage();
+  filter.AddSimpleField(3 /* packet.trusted_uid */);
+  filter.AddSimpleField(10 /* packet.trusted_packet_sequence_id */);
+  filter.AddSimpleField(35 /* packet.trace_stats */);
+  filter.AddNestedField(900 /* packet.for_testing */, 2);
+  filter.EndMessage();
+  filter.AddSimpleField(1 /* for_testing.str */);
+  filter.AddSimpleField(2 /* for_testing.seq_value */);
+  filter.EndMessage();
+  return filter.Serialize();
+}
+
+double Percentile(std::vector<uint32_t>* values, double percentile) {
+  if (values->empty())
+    return 0;
+  size_t idx = static_cast<size_t>(percentile * (values->size() - 1));
+  std::nth_element(values->begin(),
+                   values->begin() + static_cast<std::ptrdiff_t>(idx),
+                   values->end());
+  return (*values)[idx];
+}
+
+// Args: {producers, writers per producer, SizeMix, SMB KB, buffer KB, flags}.
+void BenchmarkScaling(benchmark::State& state) {
+  const auto num_producers = static_cast<uint32_t>(state.range(0));
+  const auto num_writers = static_cast<uint32_t>(state.range(1));
+  const auto mix = static_cast<SizeMix>(state.range(2));
+  const auto smb_size_kb = static_cast<uint32_t>(state.range(3));
+  const auto buffer_size_kb = static_cast<uint32_t>(state.range(4));
+  const auto flags = static_cast<uint32_t>(state.range(5));
+
+  base::TestTaskRunner task_runner;
+  TestHelper helper(&task_runner);
+  helper.StartServiceIfRequired();
+  helper.ConnectConsumer();
+  helper.WaitForConsumerConnect();
+
+  // Connect the producers before starting the session, so that they all get
+  // the data source.
+  std::vector<base::ThreadTaskRunner> producer_threads;
+  std::vector<std::unique_ptr<ScalingProducer>> producers;
+  for (uint32_t i = 0; i < num_producers; i++) {
+    producer_threads.emplace_back(
+        base::ThreadTaskRunner::CreateAndStart("perfetto.prd.scaling"));
+    producers.emplace_back(new ScalingProducer(
+        producer_threads.back().get(), smb_size_kb, flags & kBatchCommits));
+  }
+  for (uint32_t i = 0; i < num_producers; i++) {
+    std::string suffix = "." + std::to_string(i);
+    auto on_connected =
+        helper.WrapTask(helper.CreateCheckpoint("producer.connected" + suffix));
+    auto on_started =
+        helper.WrapTask(helper.CreateCheckpoint("producer.started" + suffix));
+    ScalingProducer* producer = producers[i].get();
+    producer_threads[i].PostTaskAndWaitForTesting(
+        [producer, on_connected, on_started] {
+          producer->Connect(TestHelper::GetDefaultModeProducerSocketName(),
+                            on_connected, on_started);
+        });
+  }
+  for (uint32_t i = 0; i < num_producers; i++)
+    helper.RunUntilCheckpoint("producer.connected." + std::to_string(i));
+
+  TraceConfig trace_config;
+  auto* buffer = trace_config.add_buffers();
+  buffer->set_size_kb(buffer_size_kb);
+  buffer->set_fill_policy(flags & kDiscard
+                              ? TraceConfig::BufferConfig::DISCARD
+                              : TraceConfig::BufferConfig::RING_BUFFER);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name(kDataSourceName);
+  ds_config->set_target_buffer(0);
+  if (flags & kFilter)
+    trace_config.mutable_trace_filter()->set_bytecode(GetFilterBytecode());
+  helper.StartTracing(trace_config);
+  for (uint32_t i = 0; i < num_producers; i++)
+    helper.RunUntilCheckpoint("producer.started." + std::to_string(i));
+
+  // One TraceWriter per writer thread, each with its own state.
+  struct Writer {
+    std::unique_ptr<TraceWriter> trace_writer;
+    std::minstd_rand0 rng;
+    uint32_t seq_value = 0;
+    uint64_t bytes_written = 0;
+    std::vector<uint32_t> latencies_ns;
+  };
+  std::vector<Writer> writers(num_producers * num_writers);
+  for (size_t i = 0; i < writers.size(); i++) {
+    writers[i].trace_writer = producers[i / num_writers]->CreateTraceWriter();
+    writers[i].rng.seed(static_cast<uint32_t>(i + 1));
+  }
+
+  base::ThreadTaskRunner* service_thread = helper.service_thread();
+  uint64_t service_start_ns =
+      service_thread ? service_thread->GetThreadCPUTimeNsForTesting() : 0;
+  for (auto _ : state) {
+    std::vector<std::thread> threads;
+    for (Writer& writer : writers) {
+      threads.emplace_back([&writer, mix] {
+        WritePackets(writer.trace_writer.get(), mix, &writer.rng,
+                     &writer.seq_value, &writer.bytes_written,
+                     &writer.latencies_ns);
+      });
+    }
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+  uint64_t service_ns =
+      service_thread
+          ? service_thread->GetThreadCPUTimeNsForTesting() - service_start_ns
+          : 0;
+
+  uint64_t bytes_written = 0;
+  uint64_t packets_written = 0;
+  std::vector<uint32_t> latencies_ns;
+  for (Writer& writer : writers) {
+    bytes_written += writer.bytes_written;
+    packets_written += writer.seq_value;
+    latencies_ns.insert(latencies_ns.end(), writer.latencies_ns.begin(),
+                        writer.latencies_ns.end());
+    writer.trace_writer.reset();
+  }
+
+  helper.DisableTracing();
+  helper.WaitForTracingDisabled();
+  helper.ReadData();
+  helper.WaitForReadData();
+
+  uint64_t packets_read = 0;
+  for (const auto& packet : helper.trace())
+    packets_read += packet.has_for_testing();
+  uint64_t chunks_lost = 0;
+  for (const auto& packet : helper.full_trace()) {
+    if (!packet.has_trace_stats())
+      continue;
+    for (const auto& buf_stats : packet.trace_stats().buffer_stats()) {
+      chunks_lost +=
+          buf_stats.chunks_overwritten() + buf_stats.chunks_discarded();
+    }
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(bytes_written));
+  if (service_thread && bytes_written > 0) {
+    state.counters["Ser ns/KB"] = benchmark::Counter(
+        static_cast<double>(service_ns) * 1024 /
+        static_cast<double>(bytes_written));
+  }
+  state.counters["Lat p50"] =
+      benchmark::Counter(Percentile(&latencies_ns, 0.5));
+  state.counters["Lat p99"] =
+      benchmark::Counter(Percentile(&latencies_ns, 0.99));
+  state.counters["Lat p999"] =
+      benchmark::Counter(Percentile(&latencies_ns, 0.999));
+  state.counters["Drop %"] = benchmark::Counter(
+      packets_written == 0
+          ? 0
+          : 100.0 * static_cast<double>(packets_written - packets_read) /
+                static_cast<double>(packets_written));
+  state.counters["Chunks lost"] =
+      benchmark::Counter(static_cast<double>(chunks_lost));
+
+  // The producers must be destroyed on their threads.
+  for (uint32_t i = 0; i < num_producers; i++) {
+    producer_threads[i].PostTaskAndWaitForTesting(
+        [&producers, i] { producers[i].reset(); });
+  }
+}
+
+void ScalingArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Args({1, 1, kMixed, 256, 4096, 0});
+    b->Args({2, 2, kMixed, 256, 4096, kFilter | kBatchCommits});
+    return;
+  }
+  // Producers x writers x packet sizes, with the default SMB and a buffer large
+  // enough not to lose data.
+  for (int producers : {1, 4, 16}) {
+    for (int writers : {1, 4}) {
+      for (int mix : {kSmall, kMixed, kLarge})
+        b->Args({producers, writers, mix, 1024, 64 * 1024, 0});
+    }
+  }
+  // Fill policies, filtering and batching, with a buffer that fills up.
+  for (int flags : std::initializer_list<int>{
+           0, kDiscard, kFilter, kBatchCommits, kFilter | kBatchCommits}) {
+    b->Args({4, 4, kMixed, 1024, 4 * 1024, flags});
+  }
+  // SMB sizes.
+  for (int smb_size_kb : {128, 512, 4096})
+    b->Args({4, 4, kMixed, smb_size_kb, 64 * 1024, 0});
+}
+
+}  // namespace
+
+static void BM_EndToEnd_Scaling(benchmark::State& state) {
+  BenchmarkScaling(state);
+}
+
+BENCHMARK(BM_EndToEnd_Scaling)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime()
+    ->ArgNames({"prod", "wri", "mix", "smb_kb", "buf_kb", "flags"})
+    ->Apply(ScalingArgs);
+
+}  // namespace perfetto
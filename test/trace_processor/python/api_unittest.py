@@ -13,6 +13,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import struct
 import unittest
 
 from trace_processor.api import TraceProcessor, TraceProcessorException
@@ -343,3 +344,125 @@ class TestQueryResultIterator(unittest.TestCase):
     # so we should raise a TraceProcessorException.
     with self.assertRaises(TraceProcessorException):
       qr_df = qr_iterator.as_pandas_dataframe()
+
+
+class TestColumnarQueryResultIterator(unittest.TestCase):
+  COLUMN = ProtoFactory().ColumnarBatch().Column()
+
+  def test_typed_columns(self):
+    batch = ProtoFactory().ColumnarBatch()
+    batch.num_rows = 3
+    batch.is_last_batch = True
+
+    ints = batch.columns.add()
+    ints.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_INT64
+    ints.int64_values = struct.pack('<3q', 100, 0, -300)
+    ints.validity = bytes([0b101])
+
+    doubles = batch.columns.add()
+    doubles.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_FLOAT64
+    doubles.float64_values = struct.pack('<3d', 1.5, 2.5, 3.5)
+
+    strings = batch.columns.add()
+    strings.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_STRING
+    strings.string_values = "bar1\0\0bar3\0"
+
+    nulls = batch.columns.add()
+    nulls.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_NULL
+
+    qr_iterator = TraceProcessor.ColumnarQueryResultIterator(
+        ['foo_num', 'foo_double', 'foo_id', 'foo_null'], [batch])
+    self.assertEqual(len(qr_iterator), 3)
+
+    rows = [(row.foo_num, row.foo_double, row.foo_id, row.foo_null)
+            for row in qr_iterator]
+    self.assertEqual(rows, [(100, 1.5, 'bar1', None), (None, 2.5, '', None),
+                            (-300, 3.5, 'bar3', None)])
+
+  def test_many_batches_and_mixed_column(self):
+    CELL_VARINT = ProtoFactory().CellsBatch().CELL_VARINT
+    CELL_STRING = ProtoFactory().CellsBatch().CELL_STRING
+    CELL_NULL = ProtoFactory().CellsBatch().CELL_NULL
+
+    batch_1 = ProtoFactory().ColumnarBatch()
+    batch_1.num_rows = 2
+    column = batch_1.columns.add()
+    column.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_INT64
+    column.int64_values = struct.pack('<2q', 1, 2)
+
+    batch_2 = ProtoFactory().ColumnarBatch()
+    batch_2.num_rows = 3
+    batch_2.is_last_batch = True
+    column = batch_2.columns.add()
+    column.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_MIXED
+    column.mixed_cells.cells.extend([CELL_STRING, CELL_NULL, CELL_VARINT])
+    column.mixed_cells.string_cells = "bar\0"
+    column.mixed_cells.varint_cells.extend([5])
+
+    qr_iterator = TraceProcessor.ColumnarQueryResultIterator(['foo'],
+                                                             [batch_1, batch_2])
+    self.assertEqual([row.foo for row in qr_iterator], [1, 2, 'bar', None, 5])
+
+  def test_invalid_column_type(self):
+    batch = ProtoFactory().ColumnarBatch()
+    batch.num_rows = 1
+    batch.is_last_batch = True
+    batch.columns.add()
+
+    with self.assertRaises(TraceProcessorException):
+      TraceProcessor.ColumnarQueryResultIterator(['foo'], [batch])
+
+  def test_typed_columns_as_pandas(self):
+    batch_1 = ProtoFactory().ColumnarBatch()
+    batch_1.num_rows = 2
+    ints = batch_1.columns.add()
+    ints.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_INT64
+    ints.int64_values = struct.pack('<2q', 100, 200)
+    strings = batch_1.columns.add()
+    strings.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_STRING
+    strings.string_values = "bar1\0\0"
+    strings.validity = bytes([0b01])
+
+    batch_2 = ProtoFactory().ColumnarBatch()
+    batch_2.num_rows = 2
+    batch_2.is_last_batch = True
+    ints = batch_2.columns.add()
+    ints.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_INT64
+    ints.int64_values = struct.pack('<2q', 300, 400)
+    strings = batch_2.columns.add()
+    strings.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_STRING
+    strings.string_values = "bar3\0bar4\0"
+
+    qr_iterator = TraceProcessor.ColumnarQueryResultIterator(
+        ['foo_num', 'foo_id'], [batch_1, batch_2])
+    qr_df = qr_iterator.as_pandas_dataframe()
+
+    self.assertEqual(str(qr_df['foo_num'].dtype), 'int64')
+    self.assertEqual(list(qr_df['foo_num']), [100, 200, 300, 400])
+    self.assertEqual(list(qr_df['foo_id']), ['bar1', None, 'bar3', 'bar4'])
+
+  def test_null_values_as_pandas(self):
+    batch_1 = ProtoFactory().ColumnarBatch()
+    batch_1.num_rows = 3
+    ints = batch_1.columns.add()
+    ints.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_INT64
+    ints.int64_values = struct.pack('<3q', 100, 0, 300)
+    ints.validity = bytes([0b101])
+
+    batch_2 = ProtoFactory().ColumnarBatch()
+    batch_2.num_rows = 1
+    batch_2.is_last_batch = True
+    nulls = batch_2.columns.add()
+    nulls.type = TestColumnarQueryResultIterator.COLUMN.COLUMN_NULL
+
+    qr_iterator = TraceProcessor.ColumnarQueryResultIterator(['foo_num'],
+                                                             [batch_1, batch_2])
+    qr_df = qr_iterator.as_pandas_dataframe()
+
+    # As with a dataframe built from Python lists, an integer column with NULLs
+    # becomes a float column with NaNs.
+    values = list(qr_df['foo_num'])
+    self.assertEqual(values[0], 100)
+    self.assertNotEqual(values[1], values[1])
+    self.assertEqual(values[2], 300)
+    self.assertNotEqual(values[3], values[3])
@@ -22,6 +22,7 @@
 #include "perfetto/trace_processor/trace_processor.h"
 
 #include "src/profiling/symbolizer/breakpad_symbolizer.h"
+#include "src/profiling/symbolizer/caching_symbolizer.h"
 #include "src/profiling/symbolizer/local_symbolizer.h"
 #include "src/profiling/symbolizer/symbolize_database.h"
 #include "src/profiling/symbolizer/symbolizer.h"
@@ -44,6 +45,7 @@ int SymbolizeProfile(std::istream* input, std::ostream* output) {
   } else {
     symbolizer.reset(new profiling::BreakpadSymbolizer(breakpad_dir));
   }
+  symbolizer = profiling::MaybeCachingSymbolizer(std::move(symbolizer));
 
   if (!symbolizer)
     PERFETTO_FATAL("No symbolizer selected");
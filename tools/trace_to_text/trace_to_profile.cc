@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/profiling/symbolizer/caching_symbolizer.h"
 #include "src/profiling/symbolizer/local_symbolizer.h"
 #include "src/profiling/symbolizer/symbolize_database.h"
 #include "tools/trace_to_text/utils.h"
@@ -68,8 +69,9 @@ std::string GetRandomString(size_t n) {
 
 void MaybeSymbolize(trace_processor::TraceProcessor* tp) {
   std::unique_ptr<profiling::Symbolizer> symbolizer =
-      profiling::LocalSymbolizerOrDie(profiling::GetPerfettoBinaryPath(),
-                                      getenv("PERFETTO_SYMBOLIZER_MODE"));
+      profiling::MaybeCachingSymbolizer(profiling::LocalSymbolizerOrDie(
+          profiling::GetPerfettoBinaryPath(),
+          getenv("PERFETTO_SYMBOLIZER_MODE")));
   if (!symbolizer)
     return;
   profiling::SymbolizeDatabase(tp, symbolizer.get(),
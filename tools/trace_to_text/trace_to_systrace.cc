@@ -29,9 +29,14 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_writer.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/trace_processor/export_systrace.h"
 #include "perfetto/trace_processor/trace_processor.h"
 #include "tools/trace_to_text/utils.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+#include <thread>
+#endif
+
 #define FILTER_RAW_EVENTS \
   " where not (name like \"chrome_event.%\" or name like \"track_event.%\")"
 
@@ -161,7 +166,8 @@ class QueryWriter {
   TraceWriter* trace_writer_;
 };
 
-int ExtractRawEvents(TraceWriter* trace_writer,
+int ExtractRawEvents(trace_processor::TraceProcessor* tp,
+                     TraceWriter* trace_writer,
                      QueryWriter& q_writer,
                      bool wrapped_in_json,
                      Keep truncate_keep) {
@@ -188,54 +194,6 @@ int ExtractRawEvents(TraceWriter* trace_writer,
   fprintf(stderr, "Converting ftrace events%c", kProgressChar);
   fflush(stderr);
 
-  auto raw_callback = [wrapped_in_json](Iterator* it,
-                                        base::StringWriter* writer) {
-    const char* line = it->Get(0 /* col */).string_value;
-    if (wrapped_in_json) {
-      for (uint32_t i = 0; line[i] != '\0'; i++) {
-        char c = line[i];
-        switch (c) {
-          case '\n':
-            writer->AppendLiteral("\\n");
-            break;
-          case '\f':
-            writer->AppendLiteral("\\f");
-            break;
-          case '\b':
-            writer->AppendLiteral("\\b");
-            break;
-          case '\r':
-            writer->AppendLiteral("\\r");
-            break;
-          case '\t':
-            writer->AppendLiteral("\\t");
-            break;
-          case '\\':
-            writer->AppendLiteral("\\\\");
-            break;
-          case '"':
-            writer->AppendLiteral("\\\"");
-            break;
-          default:
-            writer->AppendChar(c);
-            break;
-        }
-      }
-      writer->AppendChar('\\');
-      writer->AppendChar('n');
-    } else {
-      writer->AppendString(line);
-      writer->AppendChar('\n');
-    }
-  };
-
-  // An estimate of 130b per ftrace event, allowing some space for the processes
-  // and threads.
-  const uint32_t max_ftrace_events = (140 * 1024 * 1024) / 130;
-
-  static const char kRawEventsQuery[] =
-      "select to_ftrace(id) from raw" FILTER_RAW_EVENTS;
-
   // 1. Write the appropriate header for the file type.
   if (wrapped_in_json) {
     trace_writer->Write(",\n");
@@ -246,20 +204,26 @@ int ExtractRawEvents(TraceWriter* trace_writer,
   }
 
   // 2. Write the actual events.
-  if (truncate_keep == Keep::kEnd && raw_events > max_ftrace_events) {
-    char end_truncate[150];
-    sprintf(end_truncate, "%s limit %d offset %d", kRawEventsQuery,
-            max_ftrace_events, raw_events - max_ftrace_events);
-    if (!q_writer.RunQuery(end_truncate, raw_callback))
-      return 1;
-  } else if (truncate_keep == Keep::kStart) {
-    char start_truncate[150];
-    sprintf(start_truncate, "%s limit %d", kRawEventsQuery, max_ftrace_events);
-    if (!q_writer.RunQuery(start_truncate, raw_callback))
-      return 1;
-  } else {
-    if (!q_writer.RunQuery(kRawEventsQuery, raw_callback))
-      return 1;
+  trace_processor::systrace::ExportOptions options;
+  options.escape_for_json = wrapped_in_json;
+  if (truncate_keep != Keep::kAll) {
+    // An estimate of 130b per ftrace event, allowing some space for the
+    // processes and threads.
+    options.max_events = (140 * 1024 * 1024) / 130;
+    options.keep_end = truncate_keep == Keep::kEnd;
+  }
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  options.worker_threads = std::thread::hardware_concurrency();
+#endif
+  auto write = [trace_writer](const char* data, size_t size) {
+    trace_writer->Write(data, size);
+    return trace_processor::util::OkStatus();
+  };
+  trace_processor::util::Status status =
+      trace_processor::systrace::ExportRawEvents(tp, options, write);
+  if (!status.ok()) {
+    PERFETTO_ELOG("Error while writing systrace %s", status.c_message());
+    return 1;
   }
 
   // 3. Write the footer for JSON.
@@ -269,13 +233,46 @@ int ExtractRawEvents(TraceWriter* trace_writer,
   return 0;
 }
 
+// Writes the ftrace events while the trace is parsed, as soon as they leave
+// the sorting window, rather than after loading the whole trace.
+int StreamRawEvents(trace_processor::TraceProcessor* tp,
+                    std::istream* input,
+                    TraceWriter* trace_writer) {
+  trace_processor::systrace::ExportOptions options;
+#if PERFETTO_BUILDFLAG(PERFETTO_THREADS)
+  options.worker_threads = std::thread::hardware_concurrency();
+#endif
+  trace_processor::systrace::RawEventsStreamer streamer(tp, options);
+  auto write = [trace_writer](const char* data, size_t size) {
+    trace_writer->Write(data, size);
+    return trace_processor::util::OkStatus();
+  };
+  auto export_new_events = [&streamer, &write] {
+    trace_processor::util::Status status = streamer.ExportNewEvents(write);
+    if (!status.ok())
+      PERFETTO_ELOG("Error while writing systrace %s", status.c_message());
+    return status.ok();
+  };
+
+  trace_writer->Write(kFtraceHeader);
+  if (!ReadTrace(tp, input, export_new_events))
+    return 1;
+  tp->NotifyEndOfFile();
+  if (!export_new_events())
+    return 1;
+  fprintf(stderr, "Converted %" PRIu64 " ftrace events%c",
+          streamer.exported_events(), kProgressChar);
+  return 0;
+}
+
 }  // namespace
 
 int TraceToSystrace(std::istream* input,
                     std::ostream* output,
                     bool ctrace,
                     Keep truncate_keep,
-                    bool full_sort) {
+                    bool full_sort,
+                    bool streaming) {
   std::unique_ptr<TraceWriter> trace_writer(
       ctrace ? new DeflateTraceWriter(output) : new TraceWriter(output));
 
@@ -283,9 +280,19 @@ int TraceToSystrace(std::istream* input,
   config.sorting_mode = full_sort
                             ? trace_processor::SortingMode::kForceFullSort
                             : trace_processor::SortingMode::kDefaultHeuristics;
+  if (streaming) {
+    // Only the raw table is exported.
+    config.ingest_syscalls_as_slices = false;
+  }
   std::unique_ptr<trace_processor::TraceProcessor> tp =
       trace_processor::TraceProcessor::CreateInstance(config);
 
+  if (streaming) {
+    if (ctrace)
+      *output << "TRACE:\n";
+    return StreamRawEvents(tp.get(), input, trace_writer.get());
+  }
+
   if (!ReadTrace(tp.get(), input))
     return 1;
   tp->NotifyEndOfFile();
@@ -343,7 +350,7 @@ int ExtractSystrace(trace_processor::TraceProcessor* tp,
 
     trace_writer->Write(kProcessDumpFooter);
   }
-  return ExtractRawEvents(trace_writer, q_writer, wrapped_in_json,
+  return ExtractRawEvents(tp, trace_writer, q_writer, wrapped_in_json,
                           truncate_keep);
 }
 
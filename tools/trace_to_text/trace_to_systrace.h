@@ -35,7 +35,8 @@ int TraceToSystrace(std::istream* input,
                     std::ostream* output,
                     bool ctrace,
                     Keep truncate_keep,
-                    bool full_sort);
+                    bool full_sort,
+                    bool streaming = false);
 
 int ExtractSystrace(trace_processor::TraceProcessor*,
                     TraceWriter*,
@@ -49,6 +49,12 @@ constexpr size_t kCompressionBufferSize = 500 * 1024;
 }  // namespace
 
 bool ReadTrace(trace_processor::TraceProcessor* tp, std::istream* input) {
+  return ReadTrace(tp, input, std::function<bool()>());
+}
+
+bool ReadTrace(trace_processor::TraceProcessor* tp,
+               std::istream* input,
+               const std::function<bool()>& on_chunk) {
   // 1MB chunk size seems the best tradeoff on a MacBook Pro 2013 - i7 2.8 GHz.
   constexpr size_t kChunkSize = 1024 * 1024;
 
@@ -80,6 +86,8 @@ bool ReadTrace(trace_processor::TraceProcessor* tp, std::istream* input) {
       break;
     file_size += static_cast<uint64_t>(rsize);
     tp->Parse(std::move(buf), static_cast<size_t>(rsize));
+    if (on_chunk && !on_chunk())
+      return false;
   }
 
   fprintf(stderr, "Loaded trace%c", kProgressChar);
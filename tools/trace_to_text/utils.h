@@ -54,6 +54,12 @@ constexpr char kProgressChar = '\r';
 #endif
 
 bool ReadTrace(trace_processor::TraceProcessor* tp, std::istream* input);
+
+// As above, but also calls |on_chunk| after each chunk of the trace is
+// parsed. Stops reading (returning false) if it returns false.
+bool ReadTrace(trace_processor::TraceProcessor* tp,
+               std::istream* input,
+               const std::function<bool()>& on_chunk);
 void IngestTraceOrDie(trace_processor::TraceProcessor* tp,
                       const std::string& trace_proto);
 
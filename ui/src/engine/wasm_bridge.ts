@@ -107,7 +107,10 @@ export class WasmBridge {
   // This function is bound and passed to Initialize and is called by the C++
   // code while in the ccall(trace_processor_on_rpc_request).
   private onReply(heapPtr: number, size: number) {
-    const data = this.connection.HEAPU8.slice(heapPtr, heapPtr + size);
+    // Pointers are passed as signed 32-bit integers, so the addresses above
+    // 2 GB come out negative. In memory64 builds they are passed as BigInts.
+    const addr = heapPtr < 0 ? heapPtr + 2 ** 32 : Number(heapPtr);
+    const data = this.connection.HEAPU8.slice(addr, addr + size);
     assertExists(this.messagePort).postMessage(data, [data.buffer]);
   }
 